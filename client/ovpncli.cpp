@@ -26,6 +26,12 @@
 #include <memory>
 #include <utility>
 #include <atomic>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional> // for std::hash
+#include <algorithm>
 
 #include <openvpn/io/io.hpp>
 
@@ -92,14 +98,24 @@
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/platform_string.hpp>
 #include <openvpn/common/count.hpp>
+#include <openvpn/common/seqlock.hpp>
+#include <openvpn/common/threadpolicy.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/log/logasync.hpp>
 #include <openvpn/asio/asiostop.hpp>
+#include <openvpn/asio/asiopool.hpp>
 #include <openvpn/time/asiotimer.hpp>
 #include <openvpn/client/cliconnect.hpp>
 #include <openvpn/client/cliopthelper.hpp>
+#include <openvpn/client/clitimeline.hpp>
 #include <openvpn/options/merge.hpp>
 #include <openvpn/error/excode.hpp>
 #include <openvpn/crypto/selftest.hpp>
 
+#ifdef OPENVPN_METRICS
+#include <openvpn/ws/metricsserv.hpp>
+#endif
+
 // copyright
 #include <openvpn/legal/copyright.hpp>
 
@@ -116,7 +132,8 @@ namespace openvpn {
       MySessionStats(OpenVPNClient* parent_arg)
 	: parent(parent_arg)
       {
-	std::memset(errors, 0, sizeof(errors));
+	for (auto& e : errors)
+	  e.store(0, std::memory_order_relaxed);
 #ifdef OPENVPN_DEBUG_VERBOSE_ERRORS
 	session_stats_set_verbose(true);
 #endif
@@ -147,20 +164,33 @@ namespace openvpn {
 	    if (index < N_STATS)
 	      return get_stat(index);
 	    else
-	      return errors[index - N_STATS];
+	      return error_count(index - N_STATS);
 	  }
 	else
 	  return 0;
       }
 
+      // all values in combined_value() order, size combined_n()
+      void combined_values(count_t* values) const
+      {
+	const Snapshot snap = snapshot();
+	for (size_t i = 0; i < N_STATS; ++i)
+	  values[i] = snap.stats[i];
+	for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	  values[N_STATS + i] = error_count(i);
+      }
+
       count_t stat_count(const size_t index) const
       {
 	return get_stat_fast(index);
       }
 
-      count_t error_count(const size_t index) const
+      virtual count_t error_count(const size_t index) const override
       {
-	return errors[index];
+	if (index < Error::N_ERRORS)
+	  return errors[index].load(std::memory_order_relaxed);
+	else
+	  return 0;
       }
 
       void detach_from_parent()
@@ -178,13 +208,13 @@ namespace openvpn {
 	    else
 	      OPENVPN_LOG("ERROR: " << Error::name(err));
 #endif
-	    ++errors[err];
+	    errors[err].fetch_add(1, std::memory_order_relaxed);
 	  }
       }
 
     private:
       OpenVPNClient* parent;
-      count_t errors[Error::N_ERRORS];
+      std::atomic<count_t> errors[Error::N_ERRORS]; // atomic for readers on other threads
     };
 
     class MyClientEvents : public ClientEvent::Queue
@@ -194,10 +224,25 @@ namespace openvpn {
 
       MyClientEvents(OpenVPNClient* parent_arg) : parent(parent_arg) {}
 
+      void set_timeline(ConnectTimeline* timeline_arg)
+      {
+	timeline = timeline_arg;
+      }
+
       virtual void add_event(ClientEvent::Base::Ptr event) override
       {
 	if (parent)
 	  {
+	    if (timeline && !timeline->frozen())
+	      {
+		timeline->mark(event->name());
+		if (event->id() == ClientEvent::CONNECTED)
+		  {
+		    timeline->freeze();
+		    OPENVPN_LOG("Connect timeline: " << timeline->to_string());
+		  }
+	      }
+
 	    Event ev;
 	    ev.name = event->name();
 	    ev.info = event->render();
@@ -232,6 +277,16 @@ namespace openvpn {
 		ci.gw6 = c->vpn_gw6;
 		ci.clientIp = c->client_ip;
 		ci.tunName = c->tun_name;
+		if (timeline && timeline->frozen())
+		  {
+		    for (size_t i = 0; i < timeline->size(); ++i)
+		      {
+			ConnectMilestone m;
+			m.name = (*timeline)[i].name;
+			m.ms = (*timeline)[i].ms;
+			ci.timeline.push_back(std::move(m));
+		      }
+		  }
 		ci.defined = true;
 		return;
 	      }
@@ -247,6 +302,7 @@ namespace openvpn {
     private:
       OpenVPNClient* parent;
       ClientEvent::Base::Ptr last_connected;
+      ConnectTimeline* timeline = nullptr;
     };
 
     class MySocketProtect : public SocketProtect
@@ -275,6 +331,15 @@ namespace openvpn {
 	  return true;
       }
 
+      bool socket_protect_ahead() const override
+      {
+#if defined(OPENVPN_COMMAND_AGENT)
+	return false; // bypass routes are per endpoint
+#else
+	return true;
+#endif
+      }
+
       void detach_from_parent()
       {
 	parent = nullptr;
@@ -365,12 +430,19 @@ namespace openvpn {
     class MyClockTick
     {
     public:
+      enum Action {
+	CLOCK_TICK, // call OpenVPNClient::clock_tick()
+	STATS_PUSH, // publish stats and call OpenVPNClient::stats_push()
+      };
+
       MyClockTick(openvpn_io::io_context& io_context,
 		  OpenVPNClient* parent_arg,
-		  const unsigned int ms)
+		  const unsigned int ms,
+		  const Action action_arg = CLOCK_TICK)
 	: timer(io_context),
 	  parent(parent_arg),
-	  period(Time::Duration::milliseconds(ms))
+	  period(Time::Duration::milliseconds(ms)),
+	  action(action_arg)
       {
       }
 
@@ -392,7 +464,10 @@ namespace openvpn {
 			   if (!parent || error)
 			     return;
 			   try {
-			     parent->clock_tick();
+			     if (action == STATS_PUSH)
+			       parent->on_stats_push();
+			     else
+			       parent->clock_tick();
 			   }
 			   catch (...)
 			     {
@@ -405,9 +480,199 @@ namespace openvpn {
       AsioTimer timer;
       OpenVPNClient* parent;
       const Time::Duration period;
+      const Action action;
+    };
+
+    // Hands log lines to OpenVPNClient::log() from a background
+    // writer thread, so that the client thread never blocks on the
+    // log callback (Config::asyncLog).
+    class AsyncLogReceiver : public LogReceiver
+    {
+    public:
+      AsyncLogReceiver(LogReceiver* parent)
+	: queue(new Sink(parent))
+      {
+      }
+
+      virtual void log(const LogInfo& msg) override
+      {
+	queue.push(msg.text);
+      }
+
+    private:
+      struct Sink : public Log::AsyncQueue::Sink
+      {
+	Sink(LogReceiver* parent_arg)
+	  : parent(parent_arg)
+	{
+	}
+
+	virtual void write(const std::string& line, const std::time_t) override
+	{
+	  parent->log(LogInfo(line));
+	}
+
+	LogReceiver* parent;
+      };
+
+      Log::AsyncQueue queue;
     };
 
     namespace Private {
+      // Process-wide cache of parsed profiles, so that repeated
+      // eval_config() calls on an unchanged profile (such as when the
+      // UI re-validates it before connecting) don't parse it again.
+      // Entries are matched on the full profile content, the hash
+      // only speeds up the lookup.  Since the profile and the parsed
+      // options may hold private keys, entries are overwritten before
+      // they are dropped, and OpenVPNClient::stop() and the client
+      // destructor clear() the cache.
+      class ConfigCache
+      {
+      public:
+	enum {
+	  MAX_ENTRIES = 4,
+	};
+
+	static ConfigCache& instance()
+	{
+	  static ConfigCache cache;
+	  return cache;
+	}
+
+	~ConfigCache()
+	{
+	  clear();
+	}
+
+	// everything in Config that parse_config() output depends on
+	static std::string key(const Config& config)
+	{
+	  std::string ret;
+	  ret.reserve(config.content.length() + config.serverOverride.length() + 64);
+	  ret += config.content;
+	  ret += '\0';
+	  for (auto &kv : config.contentList)
+	    {
+	      ret += kv.key;
+	      ret += '\0';
+	      ret += kv.value;
+	      ret += '\0';
+	    }
+	  ret += '\0';
+	  ret += config.serverOverride;
+	  return ret;
+	}
+
+	bool get(const std::string& key, EvalConfig& eval, OptionList& options)
+	{
+	  const std::size_t h = std::hash<std::string>()(key);
+	  std::lock_guard<std::mutex> lock(mutex);
+	  for (auto i = entries.begin(); i != entries.end(); ++i)
+	    {
+	      if (i->hash == h && i->key == key)
+		{
+		  eval = i->eval;
+		  options = i->options;
+		  entries.splice(entries.begin(), entries, i);
+		  return true;
+		}
+	    }
+	  return false;
+	}
+
+	void put(std::string key, const EvalConfig& eval, const OptionList& options)
+	{
+	  const std::size_t h = std::hash<std::string>()(key);
+	  std::lock_guard<std::mutex> lock(mutex);
+	  entries.push_front(Entry{h, std::move(key), eval, options});
+	  if (entries.size() > MAX_ENTRIES)
+	    {
+	      wipe(entries.back());
+	      entries.pop_back();
+	    }
+	}
+
+	void clear()
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  for (auto &e : entries)
+	    wipe(e);
+	  entries.clear();
+	}
+
+      private:
+	struct Entry
+	{
+	  std::size_t hash;
+	  std::string key;
+	  EvalConfig eval;
+	  OptionList options;
+	};
+
+	static void wipe(Entry& e)
+	{
+	  wipe(e.key);
+	  for (auto &o : e.options)
+	    for (size_t i = 0; i < o.size(); ++i)
+	      wipe(o.ref(i));
+	}
+
+	// memset that the compiler won't drop
+	static void wipe(std::string& s)
+	{
+	  volatile char *v = &s[0];
+	  for (size_t i = 0; i < s.length(); ++i)
+	    v[i] = 0;
+	}
+
+	std::mutex mutex;
+	std::list<Entry> entries; // most recently used first
+      };
+
+      class RuntimeState : public AsioContextPool
+      {
+      public:
+	RuntimeState(Runtime* parent_arg, const unsigned int n_threads)
+	  : AsioContextPool(n_threads),
+	    dns_cache(new RemoteDNSCache("")),
+	    parent(parent_arg)
+	{
+	  start();
+	}
+
+	~RuntimeState()
+	{
+	  stop();
+	}
+
+	unsigned int clients() const
+	{
+	  unsigned int ret = 0;
+	  for (unsigned int i = 0; i < size(); ++i)
+	    ret += load(i);
+	  return ret;
+	}
+
+	// in-memory DNS cache for clients without a dnsCacheFile
+	RemoteDNSCache::Ptr dns_cache;
+
+      protected:
+	virtual void run(const unsigned int unit) override
+	{
+#if !defined(OPENVPN_OVPNCLI_SINGLE_THREAD)
+	  openvpn_io::detail::signal_blocker signal_blocker; // signals should be handled by parent thread
+#endif
+#if defined(OPENVPN_LOG_LOGTHREAD_H) && !defined(OPENVPN_LOG_LOGBASE_H)
+	  Log::Context log_context(parent);
+#endif
+	  AsioContextPool::run(unit);
+	}
+
+      private:
+	Runtime* parent;
+      };
+
       class ClientState
       {
       public:
@@ -422,6 +687,14 @@ namespace openvpn {
 	MyClientEvents::Ptr events;
 	ClientConnect::Ptr session;
 	std::unique_ptr<MyClockTick> clock_tick;
+	ConnectTimeline timeline;
+	std::unique_ptr<MyClockTick> stats_push_tick;
+
+	// stats published by stats_push_tick for stats_snapshot()
+	typedef SeqLockArray<count_t, SessionStats::N_STATS + Error::N_ERRORS> StatsSnapshot;
+	StatsSnapshot stats_published;
+	std::atomic<bool> stats_publishing{false};
+	std::vector<long long> stats_push_values;
 
 	// extra settings submitted by API client
 	std::string server_override;
@@ -429,7 +702,15 @@ namespace openvpn {
 	Protocol proto_override;
 	IPv6Setting ipv6;
 	int conn_timeout = 0;
+	int connect_race = 0;
+	int connect_race_delay_ms = 250;
+	std::string dns_cache_file;
+	int dns_cache_ttl = 0;
+	int dc_threads = 0;
+	ThreadPolicy thread_policy;
 	bool tun_persist = false;
+	int fast_reconnect = 0;
+	bool battery_saver = false;
 	bool wintun = false;
 	bool google_dns_fallback = false;
 	bool synchronous_dns_lookup = false;
@@ -437,8 +718,17 @@ namespace openvpn {
 	bool retry_on_auth_failed = false;
 	std::string private_key_password;
 	std::string external_pki_alias;
+	bool external_pki_async = false;
+	bool latency_stats = false;
+	bool async_log = false;
+	std::string packet_sample_file;
+	int packet_sample_rate = 0;
+	int packet_sample_flow_first = 0;
+	std::string metrics_listen;
 	bool disable_client_cert = false;
 	int ssl_debug_level = 0;
+	bool ssl_context_cache = false;
+	bool protect_pool = false;
 	int default_key_direction = -1;
 	bool force_aes_cbc_ciphersuites = false;
 	std::string tls_version_min_override;
@@ -452,6 +742,7 @@ namespace openvpn {
 	PeerInfo::Set::Ptr extra_peer_info;
 	HTTPProxyTransport::Options::Ptr http_proxy_options;
 	unsigned int clock_tick_ms = 0;
+	unsigned int stats_push_ms = 0;
 #ifdef OPENVPN_GREMLIN
 	Gremlin::Config::Ptr gremlin_config;
 #endif
@@ -484,9 +775,12 @@ namespace openvpn {
 
 	  // client stats
 	  stats.reset(new SESSION_STATS(parent));
+	  if (latency_stats)
+	    stats->enable_latency();
 
 	  // client events
 	  events.reset(new CLIENT_EVENTS(parent));
+	  events->set_timeline(&timeline);
 
 	  // socket protect
 	  socket_protect.set_parent(parent);
@@ -509,6 +803,8 @@ namespace openvpn {
 	  remote_override.detach_from_parent();
 	  if (clock_tick)
 	    clock_tick->detach_from_parent();
+	  if (stats_push_tick)
+	    stats_push_tick->detach_from_parent();
 	  if (stats)
 	    stats->detach_from_parent();
 	  if (events)
@@ -537,6 +833,55 @@ namespace openvpn {
 	  return io_context_;
 	}
 
+	// runtime, see OpenVPNClient::start()
+
+	void set_runtime(RuntimeState* runtime_arg)
+	{
+	  runtime = runtime_arg;
+	  runtime_unit = runtime->acquire();
+	}
+
+	RuntimeState* get_runtime()
+	{
+	  return runtime;
+	}
+
+	unsigned int get_runtime_unit() const
+	{
+	  return runtime_unit;
+	}
+
+	// Called on the runtime thread after the session has stopped:
+	// release everything that runs on the thread, so that the
+	// client may be destroyed from another one.
+	void runtime_finish()
+	{
+	  foreign_thread_ready.store(false, std::memory_order_release);
+	  stop_scope_local.reset();
+	  stop_scope_global.reset();
+	  clock_tick.reset();
+	  stats_push_tick.reset();
+	  session.reset();
+	  if (stats)
+	    stats->detach_from_parent();
+	  if (events)
+	    events->detach_from_parent();
+	  runtime->release(runtime_unit);
+	  {
+	    std::lock_guard<std::mutex> lock(runtime_mutex);
+	    runtime_done = true;
+	  }
+	  runtime_cond.notify_all();
+	}
+
+	void runtime_wait()
+	{
+	  if (!runtime)
+	    return;
+	  std::unique_lock<std::mutex> lock(runtime_mutex);
+	  runtime_cond.wait(lock, [this]() { return runtime_done; });
+	}
+
 	// async stop
 
 	Stop* async_stop_local()
@@ -559,6 +904,8 @@ namespace openvpn {
 	{
 	  if (clock_tick)
 	    clock_tick->cancel();
+	  if (stats_push_tick)
+	    stats_push_tick->cancel();
 	}
 
 	void setup_async_stop_scopes()
@@ -589,6 +936,12 @@ namespace openvpn {
 	openvpn_io::io_context* io_context_ = nullptr;
 	bool io_context_owned = false;
 
+	RuntimeState* runtime = nullptr;
+	unsigned int runtime_unit = 0;
+	std::mutex runtime_mutex;
+	std::condition_variable runtime_cond;
+	bool runtime_done = false;
+
 	std::atomic<bool> foreign_thread_ready{false};
       };
     };
@@ -627,6 +980,11 @@ namespace openvpn {
 	if (!config.ipv6.empty())
 	  IPv6Setting::parse(config.ipv6);
 
+	// reuse a previous parse of the same profile
+	std::string cache_key = Private::ConfigCache::key(config);
+	if (Private::ConfigCache::instance().get(cache_key, eval, options))
+	  return;
+
 	// parse config
 	OptionList::KeyValueList kvl;
 	kvl.reserve(config.contentList.size());
@@ -664,6 +1022,7 @@ namespace openvpn {
 	    se.friendlyName = i->friendlyName;
 	    eval.serverList.push_back(se);
 	  }
+	Private::ConfigCache::instance().put(std::move(cache_key), eval, options);
       }
       catch (const std::exception& e)
 	{
@@ -678,12 +1037,30 @@ namespace openvpn {
 	state->server_override = config.serverOverride;
 	state->port_override = config.portOverride;
 	state->conn_timeout = config.connTimeout;
+	state->connect_race = config.connectRace;
+	state->connect_race_delay_ms = config.connectRaceDelayMS;
+	state->dns_cache_file = config.dnsCacheFile;
+	state->dns_cache_ttl = config.dnsCacheTTL;
+	state->dc_threads = config.dataChannelThreads;
+	if (config.cpuAffinity >= 0)
+	  state->thread_policy.cpus.push_back(config.cpuAffinity);
+	state->thread_policy.busy_poll_us = config.busyPollUs > 0 ? config.busyPollUs : 0;
+	state->thread_policy.spin_us = config.spinUs > 0 ? config.spinUs : 0;
 	state->tun_persist = config.tunPersist;
+	state->fast_reconnect = config.fastReconnect;
+	state->battery_saver = config.batterySaver;
 	state->wintun = config.wintun;
 	state->google_dns_fallback = config.googleDnsFallback;
 	state->synchronous_dns_lookup = config.synchronousDnsLookup;
 	state->autologin_sessions = config.autologinSessions;
 	state->retry_on_auth_failed = config.retryOnAuthFailed;
+	state->external_pki_async = config.externalPkiAsync;
+	state->latency_stats = config.latencyStats;
+	state->async_log = config.asyncLog;
+	state->packet_sample_file = config.packetSampleFile;
+	state->packet_sample_rate = config.packetSampleRate;
+	state->packet_sample_flow_first = config.packetSampleFlowFirst;
+	state->metrics_listen = config.metricsListen;
 	state->private_key_password = config.privateKeyPassword;
 	if (!config.protoOverride.empty())
 	  state->proto_override = Protocol::parse(config.protoOverride, Protocol::NO_SUFFIX);
@@ -691,10 +1068,14 @@ namespace openvpn {
 	  state->ipv6 = IPv6Setting::parse(config.ipv6);
 	if (!config.compressionMode.empty())
 	  state->proto_context_options->parse_compression_mode(config.compressionMode);
+	if (config.reliableWindow > 0)
+	  state->proto_context_options->reliable_window = config.reliableWindow;
 	if (eval.externalPki)
 	  state->external_pki_alias = config.externalPkiAlias;
 	state->disable_client_cert = config.disableClientCert;
 	state->ssl_debug_level = config.sslDebugLevel;
+	state->ssl_context_cache = config.sslContextCache;
+	state->protect_pool = config.protectPool;
 	state->default_key_direction = config.defaultKeyDirection;
 	state->force_aes_cbc_ciphersuites = config.forceAesCbcCiphersuites;
 	state->tls_version_min_override = config.tlsVersionMinOverride;
@@ -709,6 +1090,7 @@ namespace openvpn {
 	state->echo = config.echo;
 	state->info = config.info;
 	state->clock_tick_ms = config.clockTickMS;
+	state->stats_push_ms = config.statsPushMS;
 	if (!config.gremlinConfig.empty())
 	  {
 #ifdef OPENVPN_GREMLIN
@@ -784,10 +1166,12 @@ namespace openvpn {
     OPENVPN_CLIENT_EXPORT EvalConfig OpenVPNClient::eval_config(const Config& config)
     {
       // parse and validate configuration file
+      state->timeline.start();
       EvalConfig eval;
       parse_config(config, eval, state->options);
       if (eval.error)
 	return eval;
+      state->timeline.mark("PROFILE");
 
       // handle extra settings in config
       parse_extras(config, eval);
@@ -880,7 +1264,10 @@ namespace openvpn {
 #ifdef OPENVPN_LOG_GLOBAL
 #error ovpn3 core logging object only supports thread-local scope
 #endif
-      Log::Context log_context(this);
+      std::unique_ptr<AsyncLogReceiver> async_log;
+      if (state->async_log)
+	async_log.reset(new AsyncLogReceiver(this));
+      Log::Context log_context(async_log ? static_cast<LogReceiver*>(async_log.get()) : this);
 #endif
 
       OPENVPN_LOG(ClientAPI::OpenVPNClient::platform());
@@ -893,6 +1280,17 @@ namespace openvpn {
       Status status;
       bool session_started = false;
       try {
+#ifdef OPENVPN_METRICS
+	std::unique_ptr<WS::Metrics::Exporter> metrics;
+	if (!state->metrics_listen.empty())
+	  {
+	    metrics.reset(new WS::Metrics::Exporter(state->metrics_listen, { new WS::Metrics::SessionStatsSource(state->stats), new WS::Metrics::ObjPoolSource() }));
+	    metrics->start();
+	  }
+#else
+	if (!state->metrics_listen.empty())
+	  OPENVPN_LOG("metricsListen ignored, metrics endpoint not built in");
+#endif
 	connect_attach();
 #if defined(OPENVPN_OVPNCLI_ASYNC_SETUP)
 	openvpn_io::post(*state->io_context(), [this]() {
@@ -912,6 +1310,52 @@ namespace openvpn {
 	}
     }
 
+    OPENVPN_CLIENT_EXPORT Status OpenVPNClient::start(Runtime& runtime)
+    {
+      try {
+	state->set_runtime(runtime.state);
+	state->attach<MySessionStats, MyClientEvents>(this,
+						      &state->get_runtime()->io_context(state->get_runtime_unit()),
+						      get_async_stop());
+	SSLFactoryCache::instance().reserve(state->get_runtime()->clients());
+      }
+      catch (const std::exception& e)
+	{
+	  return status_from_exception(e);
+	}
+
+      // set up on the runtime thread, since the session may only be
+      // touched from there once started
+      std::promise<Status> setup;
+      openvpn_io::post(*state->io_context(), [this, &setup]() {
+	  Status status;
+	  bool session_started = false;
+	  try {
+	    connect_setup(status, session_started);
+	  }
+	  catch (const std::exception& e)
+	    {
+	      status = status_from_exception(e);
+	    }
+	  if (session_started && status.error)
+	    state->session->stop(); // DISCONNECTED event calls runtime_finish()
+	  else if (!session_started)
+	    runtime_finish();
+	  setup.set_value(status);
+	});
+      return setup.get_future().get();
+    }
+
+    OPENVPN_CLIENT_EXPORT void OpenVPNClient::wait()
+    {
+      state->runtime_wait();
+    }
+
+    OPENVPN_CLIENT_EXPORT void OpenVPNClient::runtime_finish()
+    {
+      state->runtime_finish();
+    }
+
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::do_connect_async()
     {
       enum StopType {
@@ -954,12 +1398,31 @@ namespace openvpn {
       ClientOptions::Config cc;
       cc.cli_stats = state->stats;
       cc.cli_events = state->events;
+      if (!state->packet_sample_file.empty())
+	{
+	  PacketSampler::Config psc;
+	  psc.fn = state->packet_sample_file;
+	  psc.every = std::max(state->packet_sample_rate, 0);
+	  psc.flow_first = std::max(state->packet_sample_flow_first, 0);
+	  if (psc.every || psc.flow_first)
+	    cc.packet_sampler.reset(new PacketSampler(psc));
+	}
       cc.server_override = state->server_override;
       cc.port_override = state->port_override;
       cc.proto_override = state->proto_override;
       cc.ipv6 = state->ipv6;
       cc.conn_timeout = state->conn_timeout;
+      cc.connect_race = state->connect_race;
+      cc.connect_race_delay_ms = state->connect_race_delay_ms;
+      cc.dns_cache_file = state->dns_cache_file;
+      cc.dns_cache_ttl = state->dns_cache_ttl > 0 ? state->dns_cache_ttl : 0;
+      if (state->get_runtime() && state->dns_cache_file.empty())
+	cc.dns_cache = state->get_runtime()->dns_cache;
+      cc.dc_threads = state->dc_threads > 0 ? state->dc_threads : 0;
+      cc.thread_policy = state->thread_policy;
       cc.tun_persist = state->tun_persist;
+      cc.fast_reconnect = state->fast_reconnect > 0 ? state->fast_reconnect : 0;
+      cc.battery_saver = state->battery_saver;
       cc.wintun = state->wintun;
       cc.google_dns_fallback = state->google_dns_fallback;
       cc.synchronous_dns_lookup = state->synchronous_dns_lookup;
@@ -977,6 +1440,8 @@ namespace openvpn {
       cc.private_key_password = state->private_key_password;
       cc.disable_client_cert = state->disable_client_cert;
       cc.ssl_debug_level = state->ssl_debug_level;
+      cc.ssl_factory_cache = state->ssl_context_cache || state->get_runtime();
+      cc.protect_pool = state->protect_pool;
       cc.default_key_direction = state->default_key_direction;
       cc.force_aes_cbc_ciphersuites = state->force_aes_cbc_ciphersuites;
       cc.tls_version_min_override = state->tls_version_min_override;
@@ -1023,6 +1488,7 @@ namespace openvpn {
 	      if (!req.error)
 		{
 		  cc.external_pki = this;
+		  cc.async_external_pki = state->external_pki_async;
 		  process_epki_cert_chain(req);
 		}
 	      else
@@ -1055,6 +1521,8 @@ namespace openvpn {
       // configure creds in options
       client_options->submit_creds(state->creds);
 
+      state->timeline.mark("OPTIONS");
+
       // instantiate top-level client session
       state->session.reset(new ClientConnect(*state->io_context(), client_options));
 
@@ -1065,6 +1533,18 @@ namespace openvpn {
 	  state->clock_tick->schedule();
 	}
 
+      // periodic stats snapshot, published once up front so that
+      // stats_snapshot() never returns a blank one
+      if (state->stats_push_ms)
+	{
+	  state->stats_push_values.resize(MySessionStats::combined_n());
+	  state->stats->combined_values(state->stats_push_values.data());
+	  state->stats_published.store(state->stats_push_values.data());
+	  state->stats_publishing.store(true, std::memory_order_release);
+	  state->stats_push_tick.reset(new MyClockTick(*state->io_context(), this, state->stats_push_ms, MyClockTick::STATS_PUSH));
+	  state->stats_push_tick->schedule();
+	}
+
       // raise an exception if app has expired
       check_app_expired();
 
@@ -1109,7 +1589,10 @@ namespace openvpn {
 
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::connect_run()
     {
-      state->io_context()->run();
+      const int err = state->thread_policy.pin(0);
+      if (err)
+	OPENVPN_LOG("error binding to core " << state->thread_policy.cpu(0) << ": " << strerror_str(err));
+      run_io_context(*state->io_context(), state->thread_policy, nullptr);
     }
 
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::connect_session_stop()
@@ -1181,6 +1664,14 @@ namespace openvpn {
 	  sig = req.sig;
 	  return true;
 	}
+      else if (state->external_pki_async)
+	{
+	  // called on the SSL thread, report the error on the client thread
+	  openvpn_io::post(*state->io_context(), [this, req]() {
+	      external_pki_error(req, Error::EPKI_SIGN_ERROR);
+	    });
+	  return false;
+	}
       else
 	{
 	  external_pki_error(req, Error::EPKI_SIGN_ERROR);
@@ -1243,6 +1734,30 @@ namespace openvpn {
       return sv;
     }
 
+    OPENVPN_CLIENT_EXPORT bool OpenVPNClient::stats_snapshot(std::vector<long long>& values) const
+    {
+      const size_t n = MySessionStats::combined_n();
+      if (values.size() < n)
+	values.resize(n);
+      if (state->is_foreign_thread_access())
+	{
+	  if (state->stats_publishing.load(std::memory_order_acquire))
+	    {
+	      state->stats_published.load(values.data());
+	      return true;
+	    }
+	  MySessionStats* stats = state->stats.get();
+	  if (stats)
+	    {
+	      stats->dco_update();
+	      stats->combined_values(values.data());
+	      return true;
+	    }
+	}
+      std::fill(values.begin(), values.begin() + n, 0);
+      return false;
+    }
+
     OPENVPN_CLIENT_EXPORT InterfaceStats OpenVPNClient::tun_stats() const
     {
       InterfaceStats ret;
@@ -1302,6 +1817,27 @@ namespace openvpn {
 		      ret.lastPacketReceived = delta;
 		  }
 	      }
+
+	      ret.rtt = stats->rtt();
+	      ret.rttJitter = stats->rtt_jitter();
+	      ret.rttLoss = int(stats->rtt_loss());
+
+	      for (size_t i = 0; i < SessionStats::N_LATENCY; ++i)
+		{
+		  const LatencyHistogram* h = stats->latency(i);
+		  if (!h)
+		    break;
+		  LatencyStats ls;
+		  ls.name = SessionStats::latency_name(i);
+		  ls.count = h->count();
+		  ls.mean = h->mean() / 1000;
+		  ls.p50 = h->percentile(0.5) / 1000;
+		  ls.p90 = h->percentile(0.9) / 1000;
+		  ls.p99 = h->percentile(0.99) / 1000;
+		  ls.p999 = h->percentile(0.999) / 1000;
+		  ls.max = h->max() / 1000;
+		  ret.latency.push_back(std::move(ls));
+		}
 	      return ret;
 	    }
 	}
@@ -1315,6 +1851,7 @@ namespace openvpn {
 
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::stop()
     {
+      Private::ConfigCache::instance().clear();
       if (state->is_foreign_thread_access())
 	state->trigger_async_stop_local();
     }
@@ -1363,9 +1900,31 @@ namespace openvpn {
     {
     }
 
+    OPENVPN_CLIENT_EXPORT void OpenVPNClient::stats_push(const std::vector<long long>& values)
+    {
+    }
+
+    OPENVPN_CLIENT_EXPORT void OpenVPNClient::on_stats_push()
+    {
+      MySessionStats* stats = state->stats.get();
+      if (!stats)
+	return;
+      std::vector<long long>& values = state->stats_push_values;
+      stats->dco_update();
+      stats->combined_values(values.data());
+      state->stats_published.store(values.data());
+      stats_push(values);
+    }
+
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::on_disconnect()
     {
       state->on_disconnect();
+
+      // let the session finish stopping first
+      if (state->get_runtime())
+	openvpn_io::post(*state->io_context(), [this]() {
+	    runtime_finish();
+	  });
     }
 
     OPENVPN_CLIENT_EXPORT std::string OpenVPNClient::crypto_self_test()
@@ -1373,6 +1932,11 @@ namespace openvpn {
       return SelfTest::crypto_self_test();
     }
 
+    OPENVPN_CLIENT_EXPORT std::string OpenVPNClient::crypto_self_test_cached(const std::string& cacheFile)
+    {
+      return SelfTest::crypto_self_test(cacheFile);
+    }
+
     OPENVPN_CLIENT_EXPORT int OpenVPNClient::app_expire()
     {
 #ifdef APP_EXPIRE_TIME
@@ -1414,6 +1978,36 @@ namespace openvpn {
     }
 
     OPENVPN_CLIENT_EXPORT OpenVPNClient::~OpenVPNClient()
+    {
+      if (state->get_runtime())
+	{
+	  stop();
+	  wait();
+	}
+      Private::ConfigCache::instance().clear();
+      delete state;
+    }
+
+    OPENVPN_CLIENT_EXPORT Runtime::Runtime(int threads)
+    {
+      state = new Private::RuntimeState(this, threads > 0 ? threads : 0);
+    }
+
+    OPENVPN_CLIENT_EXPORT int Runtime::threads() const
+    {
+      return state->size();
+    }
+
+    OPENVPN_CLIENT_EXPORT int Runtime::clients() const
+    {
+      return state->clients();
+    }
+
+    OPENVPN_CLIENT_EXPORT void Runtime::log(const LogInfo&)
+    {
+    }
+
+    OPENVPN_CLIENT_EXPORT Runtime::~Runtime()
     {
       delete state;
     }
@@ -207,9 +207,51 @@ namespace openvpn {
       // Connection timeout in seconds, or 0 to retry indefinitely
       int connTimeout = 0;
 
+      // If > 1, try up to this many remote entries in parallel,
+      // starting each one connectRaceDelayMS after the previous,
+      // and keep the first one whose server responds
+      int connectRace = 0;
+      int connectRaceDelayMS = 250;
+
+      // If defined, remember resolved remote server addresses in this
+      // file, so that later sessions can connect without waiting for DNS.
+      // Entries are refreshed after dnsCacheTTL seconds (0 for default).
+      std::string dnsCacheFile;
+      int dnsCacheTTL = 0;
+
+      // If > 1, encrypt and decrypt bursts of data channel packets
+      // on this many threads (AEAD ciphers only).  Helps a single
+      // high-throughput session use more than one core.
+      int dataChannelThreads = 0;
+
+      // For low-latency deployments: pin the thread that runs
+      // connect() to this CPU core (-1 for none, Linux only), have
+      // the kernel busy poll the UDP socket for up to busyPollUs
+      // microseconds, and keep polling for new events for spinUs
+      // microseconds before sleeping.  Spinning costs CPU time.
+      int cpuAffinity = -1;
+      int busyPollUs = 0;
+      int spinUs = 0;
+
       // Keep tun interface active during pauses or reconnections
       bool tunPersist = false;
 
+      // If > 0, when the UDP transport of a connected session fails
+      // or reconnect(0) is called, first try a fast reconnect: keep
+      // the data channel keys, peer-id and pushed options, open a
+      // new socket and let the server float to it.  If nothing is
+      // received from the server within this many seconds, fall
+      // back to a full reconnect.  Needs a server that assigns a
+      // peer-id.  Best combined with tunPersist.
+      int fastReconnect = 0;
+
+      // Reduce wakeups on battery powered devices: keepalives are
+      // coalesced with other timer wakeups, and the keepalive interval
+      // grows (up to 2 minutes, and under a third of ping-restart)
+      // for as long as the server stays reachable at the longer
+      // interval.
+      bool batterySaver = false;
+
       // If true and a redirect-gateway profile doesn't also define
       // DNS servers, use the standard Google DNS servers.
       bool googleDnsFallback = false;
@@ -228,18 +270,66 @@ namespace openvpn {
       // for External PKI profiles.
       std::string externalPkiAlias;
 
+      // If true, run TLS handshakes on a separate thread for External
+      // PKI profiles, so that the client thread keeps servicing the
+      // tunnel while external_pki_sign_request() is pending.  The
+      // sign callback is then made from that thread.
+      bool externalPkiAsync = false;
+
+      // If true, record latency histograms for the data path and
+      // handshakes, returned by transport_stats().
+      bool latencyStats = false;
+
+      // If true, log lines are queued and passed to log() from a
+      // background thread, so that slow log() implementations don't
+      // stall the tunnel.  Lines are dropped (and the drop count
+      // logged) if the queue overflows.
+      bool asyncLog = false;
+
+      // If packetSampleFile is defined, write a pcap capture of
+      // tunnel packets (before encryption/after decryption) to it,
+      // sampling 1 in packetSampleRate packets plus the first
+      // packetSampleFlowFirst packets of each flow.
+      std::string packetSampleFile;
+      int packetSampleRate = 0;
+      int packetSampleFlowFirst = 0;
+
+      // If defined as host:port, serve session stats, error counts
+      // and latency histograms (see latencyStats) on
+      // http://host:port/metrics in the OpenMetrics format while
+      // connected.  Requires a build with OPENVPN_METRICS.
+      std::string metricsListen;
+
       // If true, don't send client cert/key to peer.
       bool disableClientCert = false;
 
       // SSL library debug level
       int sslDebugLevel = 0;
 
+      // If true, keep the SSL context (parsed certs and keys, CA store,
+      // DH) in a process-wide cache after disconnect, so that the next
+      // connect with the same profile and settings skips building it.
+      // Not used with External PKI.
+      bool sslContextCache = false;
+
+      // If true, keep a few transport sockets protected ahead of time
+      // (see socket_protect()), so that connecting doesn't wait for
+      // the callback.  socket_protect() is then also called from a
+      // background thread, with an unspecified remote ("0.0.0.0" or
+      // "::"), so it must not depend on the remote.
+      bool protectPool = false;
+
       // Compression mode, one of:
       // yes -- allow compression on both uplink and downlink
       // asym -- allow compression on downlink only (i.e. server -> client)
       // no (default if empty) -- support compression stubs only
       std::string compressionMode;
 
+      // Control channel send window (0 for default of 4, max 16).
+      // Raising it speeds up large control channel transfers, but
+      // only up to the peer's receive window (8 for OpenVPN 2.x).
+      int reliableWindow = 0;
+
       // private key password (optional)
       std::string privateKeyPassword;
 
@@ -308,7 +398,14 @@ namespace openvpn {
       // Set to 0 to disable.
       unsigned int clockTickMS = 0;
 
-      // Gremlin configuration (requires that the core is built with OPENVPN_GREMLIN)
+      // Periodic stats snapshot in milliseconds.  If nonzero, the
+      // core publishes all stats every statsPushMS and passes them
+      // to stats_push(), and stats_snapshot() returns the last
+      // published snapshot.  Set to 0 to disable.
+      unsigned int statsPushMS = 0;
+
+      // Gremlin configuration, see openvpn/transport/gremlin.hpp for the
+      // format (requires that the core is built with OPENVPN_GREMLIN)
       std::string gremlinConfig;
 
       // Use wintun instead of tap-windows6 on Windows
@@ -327,6 +424,13 @@ namespace openvpn {
 
     // used to communicate extra details about successful connection
     // (client reads)
+    // a milestone of the initial connect, see ConnectionInfo::timeline
+    struct ConnectMilestone
+    {
+      std::string name; // PROFILE, OPTIONS or a client event name
+      int ms = 0;       // since eval_config() was called
+    };
+
     struct ConnectionInfo
     {
       bool defined = false;
@@ -341,6 +445,12 @@ namespace openvpn {
       std::string gw6;
       std::string clientIp;
       std::string tunName;
+
+      // Where the time to the first CONNECTED went: profile parsed,
+      // client options built (including PKI load), then every
+      // client event (RESOLVE, WAIT, CONNECTING,
+      // GET_CONFIG, ASSIGN_IP, ...).  Also logged as one line.
+      std::vector<ConnectMilestone> timeline;
     };
 
     // returned by some methods as a status/error indication
@@ -381,6 +491,19 @@ namespace openvpn {
     };
 
     // used to pass basic transport stats
+    // Latency percentiles in microseconds
+    struct LatencyStats
+    {
+      std::string name;  // NET_TO_TUN, TUN_TO_NET or HANDSHAKE
+      long long count = 0;
+      long long mean = 0;
+      long long p50 = 0;
+      long long p90 = 0;
+      long long p99 = 0;
+      long long p999 = 0;
+      long long max = 0;
+    };
+
     struct TransportStats
     {
       long long bytesIn;
@@ -391,6 +514,16 @@ namespace openvpn {
       // number of binary milliseconds (1/1024th of a second) since
       // last packet was received, or -1 if undefined
       int lastPacketReceived;
+
+      // data channel round trip time and jitter in microseconds,
+      // and probe loss in 1/1000, measured when the profile has
+      // rtt-probe and the server takes part; -1 if undefined
+      long long rtt = -1;
+      long long rttJitter = -1;
+      int rttLoss = -1;
+
+      // empty unless Config::latencyStats is set
+      std::vector<LatencyStats> latency;
     };
 
     // return value of merge_config methods
@@ -448,6 +581,41 @@ namespace openvpn {
 
     namespace Private {
       class ClientState;
+      class RuntimeState;
+    };
+
+    // A fixed-size pool of threads shared by many OpenVPNClient
+    // instances, for processes that run many tunnels at once (see
+    // OpenVPNClient::start()).  Clients on a runtime share its threads
+    // and their buffer pools, an in-memory DNS cache, and the SSL
+    // context cache, rather than each having a thread of its own.
+    class Runtime : public LogReceiver
+    {
+    public:
+      // Start threads threads, or one per core if 0.
+      explicit Runtime(int threads);
+
+      // Stops the threads.  Clients started on the runtime must
+      // have finished (see OpenVPNClient::wait()) before.
+      virtual ~Runtime();
+
+      // number of threads
+      int threads() const;
+
+      // number of clients started on the runtime and not yet finished
+      int clients() const;
+
+      // Log lines of all clients on the runtime come here, from the
+      // runtime threads.  Discarded by default.
+      virtual void log(const LogInfo&) override;
+
+    private:
+      friend class OpenVPNClient;
+
+      Runtime(const Runtime&) = delete;
+      Runtime& operator=(const Runtime&) = delete;
+
+      Private::RuntimeState* state;
     };
 
     // Top-level OpenVPN client class.
@@ -493,7 +661,8 @@ namespace openvpn {
       Status provide_creds(const ProvideCreds&);
 
       // Callback to "protect" a socket from being routed through the tunnel.
-      // Will be called from the thread executing connect().
+      // Will be called from the thread executing connect(), and from
+      // a background thread if protectPool is set.
       // The remote and ipv6 are the remote host this socket will connect to
       virtual bool socket_protect(int socket, std::string remote, bool ipv6);
 
@@ -503,6 +672,18 @@ namespace openvpn {
       // and possibly provide_creds() as well before this function.
       Status connect();
 
+      // Alternative to connect() for running many clients: start the
+      // client on the least loaded thread of runtime and return once it
+      // is set up, without waiting for disconnect.  Callbacks are then
+      // made from that thread, except log() (see Runtime::log()).  The
+      // DISCONNECTED event marks the end of the session.  Like
+      // connect(), may only be called once per instance.
+      Status start(Runtime& runtime);
+
+      // Wait until a client started by start() has finished.  Call
+      // stop() first to end the session.  The destructor does both.
+      void wait();
+
       // Return information about the most recent connection.  Should be called
       // after an event of type "CONNECTED".
       ConnectionInfo connection_info();
@@ -551,6 +732,15 @@ namespace openvpn {
       // return all stats in a bundle
       std::vector<long long> stats_bundle() const;
 
+      // Copy all stats, in stats_bundle() order, into a vector owned
+      // by the caller.  The vector is only resized when smaller than
+      // stats_n(), so polling with the same vector doesn't allocate.
+      // With Config::statsPushMS set, this is the last snapshot
+      // published by the client thread, read without locking, so
+      // all values are from the same moment.  Returns false, with
+      // the values zeroed, if the client isn't connecting or connected.
+      bool stats_snapshot(std::vector<long long>& values) const;
+
       // return tun stats only
       InterfaceStats tun_stats() const;
 
@@ -580,9 +770,18 @@ namespace openvpn {
       // Periodic convenience clock tick, controlled by Config::clockTickMS
       virtual void clock_tick();
 
+      // Periodic stats snapshot, controlled by Config::statsPushMS, in
+      // stats_bundle() order.  Will be called from the thread executing
+      // connect(), and values is only valid during the call.
+      virtual void stats_push(const std::vector<long long>& values);
+
       // Do a crypto library self test
       static std::string crypto_self_test();
 
+      // Same, with the result cached in cacheFile for later runs of
+      // the same build
+      static std::string crypto_self_test_cached(const std::string& cacheFile);
+
       // Returns date/time of app expiration as a unix time value
       static int app_expire();
 
@@ -612,6 +811,7 @@ namespace openvpn {
 
     private:
       void connect_setup(Status&, bool&);
+      void runtime_finish();
       void do_connect_async();
       static Status status_from_exception(const std::exception&);
       static void parse_config(const Config&, EvalConfig&, OptionList&);
@@ -624,6 +824,9 @@ namespace openvpn {
       friend class MyClientEvents;
       void on_disconnect();
 
+      friend class MyClockTick;
+      void on_stats_push();
+
       // from ExternalPKIBase
       virtual bool sign(const std::string& data, std::string& sig, const std::string& algorithm);
 
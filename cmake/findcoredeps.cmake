@@ -12,6 +12,8 @@ option(USE_MBEDTLS "Use mbed TLS instead of OpenSSL")
 
 option(USE_WERROR "Treat compiler warnings as errors (-Werror)")
 
+option(ALLOC_STATS "Count heap allocations per data path phase in SessionStats")
+
 if (DEFINED ENV{DEP_DIR})
     message(WARNING "Overriding DEP_DIR setting with environment variable")
     set(DEP_DIR $ENV{DEP_DIR})
@@ -90,6 +92,10 @@ function(add_core_dependencies target)
         list(APPEND CORE_DEFINES -DUSE_OPENSSL)
     endif ()
 
+    if (ALLOC_STATS)
+        list(APPEND CORE_DEFINES -DOPENVPN_ALLOC_STATS)
+    endif ()
+
     if (APPLE)
         find_library(coreFoundation CoreFoundation)
         find_library(iokit IOKit)
@@ -19,6 +19,7 @@
 
 // modify exported C++ class names to incorporate their enclosing namespace
 %rename(ClientAPI_OpenVPNClient) OpenVPNClient;
+%rename(ClientAPI_Runtime) Runtime;
 %rename(ClientAPI_TunBuilderBase) TunBuilderBase;
 %rename(ClientAPI_ExternalPKIBase) ExternalPKIBase;
 %rename(ClientAPI_ServerEntry) ServerEntry;
@@ -30,10 +31,12 @@
 %rename(ClientAPI_Config) Config;
 %rename(ClientAPI_Event) Event;
 %rename(ClientAPI_ConnectionInfo) ConnectionInfo;
+%rename(ClientAPI_ConnectMilestone) ConnectMilestone;
 %rename(ClientAPI_Status) Status;
 %rename(ClientAPI_LogInfo) LogInfo;
 %rename(ClientAPI_InterfaceStats) InterfaceStats;
 %rename(ClientAPI_TransportStats) TransportStats;
+%rename(ClientAPI_LatencyStats) LatencyStats;
 %rename(ClientAPI_MergeConfig) MergeConfig;
 %rename(ClientAPI_ExternalPKIRequestBase) ExternalPKIRequestBase;
 %rename(ClientAPI_ExternalPKICertRequest) ExternalPKICertRequest;
@@ -44,7 +47,9 @@
 namespace std {
   %template(ClientAPI_ServerEntryVector) vector<openvpn::ClientAPI::ServerEntry>;
   %template(ClientAPI_LLVector) vector<long long>;
+  %template(ClientAPI_LatencyStatsVector) vector<openvpn::ClientAPI::LatencyStats>;
   %template(ClientAPI_StringVec) vector<string>;
+  %template(ClientAPI_ConnectMilestoneVector) vector<openvpn::ClientAPI::ConnectMilestone>;
 };
 
 // interface to be bridged between C++ and target language
@@ -47,6 +47,16 @@ namespace openvpn {
       typedef RCPtr<ListenerBase> Ptr;
 
       virtual void handle_accept(AsioPolySock::Base::Ptr sock, const openvpn_io::error_code& error) = 0;
+
+      // Connections taken from the listen backlog without waiting,
+      // right after an accept completes, when the acceptor's accept
+      // batch is > 1.  Unlike handle_accept(), the listener must not
+      // queue another accept.  Returns false to leave any further
+      // connections in the backlog.
+      virtual bool handle_accept_batched(AsioPolySock::Base::Ptr sock)
+      {
+	return false;
+      }
     };
 
     struct Base : public RC<thread_unsafe_refcount>
@@ -57,6 +67,13 @@ namespace openvpn {
 				const size_t acceptor_index,
 				openvpn_io::io_context& io_context) = 0;
       virtual void close() = 0;
+
+      // Up to n connections per accept wakeup, the first through
+      // ListenerBase::handle_accept(), the others through
+      // handle_accept_batched().
+      virtual void set_accept_batch(const size_t n)
+      {
+      }
     };
 
     struct Item
@@ -24,6 +24,14 @@
 #include <openvpn/acceptor/base.hpp>
 #include <openvpn/ssl/sslconsts.hpp>
 
+#ifdef OPENVPN_PLATFORM_LINUX
+#include <linux/filter.h>
+#endif
+
+#if defined(OPENVPN_PLATFORM_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#define OPENVPN_ACCEPTOR_TCP_CBPF
+#endif
+
 namespace openvpn {
   namespace Acceptor {
 
@@ -41,12 +49,21 @@ namespace openvpn {
 				openvpn_io::io_context& io_context) override
       {
 	AsioPolySock::TCP::Ptr sock(new AsioPolySock::TCP(io_context, acceptor_index));
-	acceptor.async_accept(sock->socket, [listener=ListenerBase::Ptr(listener), sock](const openvpn_io::error_code& error) mutable
+	acceptor.async_accept(sock->socket, [self=Ptr(this), listener=ListenerBase::Ptr(listener), sock, acceptor_index, &io_context](const openvpn_io::error_code& error) mutable
 			      {
+				if (!error)
+				  self->accept_pending(*listener, acceptor_index, io_context);
 				listener->handle_accept(std::move(sock), error);
 			      });
       }
 
+      virtual void set_accept_batch(const size_t n) override
+      {
+	accept_batch = n ? n : 1;
+	if (accept_batch > 1)
+	  acceptor.non_blocking(true);
+      }
+
       virtual void close() override
       {
 #ifdef OPENVPN_DEBUG_ACCEPT
@@ -89,8 +106,79 @@ namespace openvpn {
 	return flags & (DISABLE_REUSE_ADDR|REUSE_PORT);
       }
 
+      // Per-CPU accept: each worker thread, bound to its own CPU,
+      // opens a REUSE_PORT acceptor on the same endpoint, and calls
+      // set_incoming_cpu() with that CPU before bind.  The acceptors
+      // must be bound in CPU order, and the first one then calls
+      // attach_cpu_steering() with the number of workers.  Each
+      // connection is then accepted by the worker on the CPU that
+      // processed its SYN, which keeps it on the core that handles
+      // its softirqs.  Without the steering program (e.g. before
+      // Linux 4.5), kernels that honor SO_INCOMING_CPU for listeners
+      // still prefer the matching acceptor.  No-ops where unsupported.
+      void set_incoming_cpu(const int cpu)
+      {
+#ifdef SO_INCOMING_CPU
+	SockOpt::incoming_cpu(acceptor.native_handle(), cpu);
+#endif
+      }
+
+      // Attach a classic BPF program to the reuseport group that
+      // picks the acceptor bound (cpu % n_cpus)-th.  Call after bind.
+      void attach_cpu_steering(const unsigned int n_cpus)
+      {
+#ifdef OPENVPN_ACCEPTOR_TCP_CBPF
+	if (n_cpus < 2)
+	  return;
+	struct sock_filter code[CPU_STEERING_LEN];
+	cpu_steering_program(code, n_cpus);
+	struct sock_fprog prog;
+	prog.len = CPU_STEERING_LEN;
+	prog.filter = code;
+	if (::setsockopt(acceptor.native_handle(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+	  throw Exception("error attaching SO_ATTACH_REUSEPORT_CBPF CPU steering program");
+#endif
+      }
+
+#ifdef OPENVPN_ACCEPTOR_TCP_CBPF
+      enum {
+	CPU_STEERING_LEN = 3,
+      };
+
+      // the program that attach_cpu_steering() attaches
+      static void cpu_steering_program(struct sock_filter (&code)[CPU_STEERING_LEN],
+				       const unsigned int n_cpus)
+      {
+	const struct sock_filter prog[CPU_STEERING_LEN] = {
+	  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, (__u32)(SKF_AD_OFF + SKF_AD_CPU)), // A = current CPU
+	  BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, n_cpus),                          // A = acceptor index
+	  BPF_STMT(BPF_RET|BPF_A, 0),
+	};
+	for (size_t i = 0; i < CPU_STEERING_LEN; ++i)
+	  code[i] = prog[i];
+      }
+#endif
+
       openvpn_io::ip::tcp::endpoint local_endpoint;
       openvpn_io::ip::tcp::acceptor acceptor;
+
+    private:
+      // take further connections waiting in the backlog
+      void accept_pending(ListenerBase& listener,
+			  const size_t acceptor_index,
+			  openvpn_io::io_context& io_context)
+      {
+	for (size_t i = 1; i < accept_batch; ++i)
+	  {
+	    AsioPolySock::TCP::Ptr sock(new AsioPolySock::TCP(io_context, acceptor_index));
+	    openvpn_io::error_code error;
+	    acceptor.accept(sock->socket, error);
+	    if (error || !listener.handle_accept_batched(std::move(sock)))
+	      break;
+	  }
+      }
+
+      size_t accept_batch = 1;
     };
 
   }
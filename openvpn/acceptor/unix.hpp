@@ -45,12 +45,21 @@ namespace openvpn {
 				openvpn_io::io_context& io_context) override
       {
 	AsioPolySock::Unix::Ptr sock(new AsioPolySock::Unix(io_context, acceptor_index));
-	acceptor.async_accept(sock->socket, [listener=ListenerBase::Ptr(listener), sock](const openvpn_io::error_code& error) mutable
+	acceptor.async_accept(sock->socket, [self=Ptr(this), listener=ListenerBase::Ptr(listener), sock, acceptor_index, &io_context](const openvpn_io::error_code& error) mutable
 			      {
+				if (!error)
+				  self->accept_pending(*listener, acceptor_index, io_context);
 				listener->handle_accept(std::move(sock), error);
 			      });
       }
 
+      virtual void set_accept_batch(const size_t n) override
+      {
+	accept_batch = n ? n : 1;
+	if (accept_batch > 1)
+	  acceptor.non_blocking(true);
+      }
+
       virtual void close() override
       {
 	acceptor.close();
@@ -75,6 +84,24 @@ namespace openvpn {
 
       openvpn_io::local::stream_protocol::endpoint local_endpoint;
       openvpn_io::basic_socket_acceptor<openvpn_io::local::stream_protocol> acceptor;
+
+    private:
+      // take further connections waiting in the backlog
+      void accept_pending(ListenerBase& listener,
+			  const size_t acceptor_index,
+			  openvpn_io::io_context& io_context)
+      {
+	for (size_t i = 1; i < accept_batch; ++i)
+	  {
+	    AsioPolySock::Unix::Ptr sock(new AsioPolySock::Unix(io_context, acceptor_index));
+	    openvpn_io::error_code error;
+	    acceptor.accept(sock->socket, error);
+	    if (error || !listener.handle_accept_batched(std::move(sock)))
+	      break;
+	  }
+      }
+
+      size_t accept_batch = 1;
     };
 
   }
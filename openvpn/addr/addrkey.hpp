@@ -0,0 +1,199 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Canonical fixed-size form of an IP::Addr (optionally with a port)
+// for hot lookup keys.
+//
+// IP::Addr switches on the version in every comparison and hash.
+// AddrKey switches once, when it is built, into a 128-bit address
+// (IPv4 as v4-mapped ::ffff:a.b.c.d) plus a tag word holding the
+// version, port and IPv6 scope id.  The version in the tag keeps an
+// IPv4 address distinct from its v4-mapped IPv6 twin, so equality
+// agrees with IP::Addr.  Comparison and hashing are then a few word
+// operations without branches on the version, and no dependency on
+// CityHash.
+
+#ifndef OPENVPN_ADDR_ADDRKEY_H
+#define OPENVPN_ADDR_ADDRKEY_H
+
+#include <cstdint>
+#include <string>
+
+#include <openvpn/common/hash.hpp>
+#include <openvpn/common/fasthash.hpp>
+#include <openvpn/addr/ip.hpp>
+
+namespace openvpn {
+  namespace IP {
+
+    class AddrKey
+    {
+    public:
+      AddrKey() {}
+
+      explicit AddrKey(const Addr& a, const std::uint16_t port = 0)
+      {
+	switch (a.version())
+	  {
+	  case Addr::V4:
+	    *this = from_ipv4(a.to_ipv4_nocheck().to_uint32(), port);
+	    break;
+	  case Addr::V6:
+	    {
+	      const IPv6::Addr& a6 = a.to_ipv6_nocheck();
+	      hi = a6.high64();
+	      lo = a6.low64();
+	      tag = make_tag(Addr::V6, port, std::uint32_t(a6.scope_id()));
+	      break;
+	    }
+	  default:
+	    tag = make_tag(Addr::UNSPEC, port, 0);
+	    break;
+	  }
+      }
+
+      // fast path for addresses read from packet headers (host order)
+      static AddrKey from_ipv4(const std::uint32_t addr, const std::uint16_t port = 0)
+      {
+	AddrKey k;
+	k.hi = 0;
+	k.lo = V4_MAPPED | addr;
+	k.tag = make_tag(Addr::V4, port, 0);
+	return k;
+      }
+
+      Addr addr() const
+      {
+	switch (version())
+	  {
+	  case Addr::V4:
+	    return Addr::from_ipv4(IPv4::Addr::from_uint32(std::uint32_t(lo)));
+	  case Addr::V6:
+	    return Addr::from_ipv6(IPv6::Addr::from_uint64(hi, lo, int(std::uint32_t(tag))));
+	  default:
+	    return Addr();
+	  }
+      }
+
+      Addr::Version version() const
+      {
+	return Addr::Version(tag >> 56);
+      }
+
+      std::uint16_t port() const
+      {
+	return std::uint16_t(tag >> 32);
+      }
+
+      // SipHash of the key, for tables keyed by addresses and ports
+      // that remote peers choose
+      std::size_t keyed_hashval() const
+      {
+	const std::uint64_t w[3] = { hi, lo, tag };
+	return std::size_t(SipHash::hash(w, sizeof(w)));
+      }
+
+      // for unordered containers, in place of std::hash
+      struct KeyedHash
+      {
+	std::size_t operator()(const AddrKey& k) const
+	{
+	  return k.keyed_hashval();
+	}
+      };
+
+      bool operator==(const AddrKey& other) const
+      {
+	return ((hi ^ other.hi) | (lo ^ other.lo) | (tag ^ other.tag)) == 0;
+      }
+
+      bool operator!=(const AddrKey& other) const
+      {
+	return !operator==(other);
+      }
+
+      // A total order for ordered containers: by address, then by
+      // version, port and scope.  Unlike IP::Addr it doesn't put all
+      // IPv4 addresses first.
+      bool operator<(const AddrKey& other) const
+      {
+	const bool hi_eq = hi == other.hi;
+	const bool lo_eq = lo == other.lo;
+	return (hi < other.hi)
+	  | (hi_eq & (lo < other.lo))
+	  | (hi_eq & lo_eq & (tag < other.tag));
+      }
+
+      std::size_t hashval() const
+      {
+	std::uint64_t h = hi * 0x9E3779B97F4A7C15ull;
+	h ^= (lo * 0xC2B2AE3D27D4EB4Full) >> 7;
+	h += tag * 0x165667B19E3779F9ull;
+	h ^= h >> 32;
+	h *= 0xD6E8FEB86659FD93ull;
+	h ^= h >> 32;
+	return std::size_t(h);
+      }
+
+      std::string to_string() const
+      {
+	return addr().to_string();
+      }
+
+    private:
+      static constexpr std::uint64_t V4_MAPPED = 0x0000FFFF00000000ull;
+
+      static std::uint64_t make_tag(const Addr::Version ver, const std::uint16_t port, const std::uint32_t scope_id)
+      {
+	return (std::uint64_t(ver) << 56) | (std::uint64_t(port) << 32) | scope_id;
+      }
+
+      std::uint64_t hi = 0;
+      std::uint64_t lo = 0;
+      std::uint64_t tag = 0;
+    };
+
+    // Hash for IP::Addr, IPv4::Addr and IPv6::Addr keys in unordered
+    // containers, through AddrKey.
+    struct AddrHash
+    {
+      std::size_t operator()(const Addr& a) const
+      {
+	return AddrKey(a).hashval();
+      }
+
+      std::size_t operator()(const IPv4::Addr& a) const
+      {
+	return AddrKey::from_ipv4(a.to_uint32()).hashval();
+      }
+
+      std::size_t operator()(const IPv6::Addr& a) const
+      {
+	return AddrKey(Addr::from_ipv6(a)).hashval();
+      }
+    };
+
+  }
+}
+
+OPENVPN_HASH_METHOD(openvpn::IP::AddrKey, hashval);
+
+#endif
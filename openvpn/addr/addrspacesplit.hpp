@@ -26,6 +26,7 @@
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/addr/route.hpp>
+#include <openvpn/addr/routetree.hpp>
 
 namespace openvpn {
   namespace IP {
@@ -47,10 +48,11 @@ namespace openvpn {
       AddressSpaceSplitter(const RouteList& in, const Addr::VersionMask vermask)
       {
 	in.verify_canonical();
+	const RouteTree tree(in);
 	if (vermask & Addr::V4_MASK)
-	  descend(in, Route(Addr::from_zero(Addr::V4), 0));
+	  descend(tree, Route(Addr::from_zero(Addr::V4), 0));
 	if (vermask & Addr::V6_MASK)
-	  descend(in, Route(Addr::from_zero(Addr::V6), 0));
+	  descend(tree, Route(Addr::from_zero(Addr::V6), 0));
       }
 
     private:
@@ -68,7 +70,7 @@ namespace openvpn {
        * @param route The route we currently are looking at and split if it does
        *	      not meet the requirements
        */
-      void descend(const RouteList& in, const Route& route)
+      void descend(const RouteTree& in, const Route& route)
       {
 	switch (find(in, route))
 	  {
@@ -91,18 +93,14 @@ namespace openvpn {
 	  }
       }
 
-      static Type find(const RouteList& in, const Route& route)
+      static Type find(const RouteTree& in, const Route& route)
       {
-	Type type = LEAF;
-	for (RouteList::const_iterator i = in.begin(); i != in.end(); ++i)
-	  {
-	    const Route& r = *i;
-	    if (route == r)
-	      type = EQUAL;
-	    else if (route.contains(r))
-	      return SUBROUTE;
-	  }
-	return type;
+	if (in.contains_subroute(route))
+	  return SUBROUTE;
+	else if (in.exists(route))
+	  return EQUAL;
+	else
+	  return LEAF;
       }
     };
   }
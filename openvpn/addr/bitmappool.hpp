@@ -0,0 +1,265 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef OPENVPN_ADDR_BITMAPPOOL_H
+#define OPENVPN_ADDR_BITMAPPOOL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/ffs.hpp>
+
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/range.hpp>
+
+namespace openvpn {
+  namespace IP {
+
+    // Pool of the addresses in a range, kept as one bit per address.
+    // Unlike PoolType, nothing is allocated per address, and acquire
+    // and release are lock-free, so the pool may be shared between
+    // threads.
+    class BitmapPool
+    {
+    public:
+      enum {
+	MAX_EXTENT = 1 << 24, // larger ranges, e.g. IPv6 /64, are truncated
+      };
+
+      BitmapPool(const Range& range)
+	: start(range.start()),
+	  extent(std::min(range.extent(), size_t(MAX_EXTENT))),
+	  n_words((extent + WORD_BITS - 1) / WORD_BITS),
+	  words(new std::atomic<Word>[n_words])
+      {
+	for (size_t i = 0; i < n_words; ++i)
+	  words[i].store(0, std::memory_order_relaxed);
+
+	// bits past the end of the range are permanently in use
+	const size_t tail = extent % WORD_BITS;
+	if (tail)
+	  words[n_words - 1].store(~Word(0) << tail, std::memory_order_relaxed);
+      }
+
+      BitmapPool(const BitmapPool&) = delete;
+      BitmapPool& operator=(const BitmapPool&) = delete;
+
+      // Acquire an address from pool.  Returns true if successful,
+      // with address placed in dest, or false if pool depleted.
+      // The search continues from the most recently allocated word,
+      // so released addresses tend not to be reused right away.
+      bool acquire_addr(Addr& dest)
+      {
+	const size_t first = hint.load(std::memory_order_relaxed);
+	for (size_t n = 0; n < n_words; ++n)
+	  {
+	    const size_t i = (first + n) % n_words;
+	    Word w = words[i].load(std::memory_order_relaxed);
+	    while (~w)
+	      {
+		const unsigned int b = find_first_set(Word(~w)) - 1;
+		if (words[i].compare_exchange_weak(w, w | (Word(1) << b),
+						   std::memory_order_acquire,
+						   std::memory_order_relaxed))
+		  {
+		    hint.store(i, std::memory_order_relaxed);
+		    in_use.fetch_add(1, std::memory_order_relaxed);
+		    dest = start + long(i * WORD_BITS + b);
+		    return true;
+		  }
+	      }
+	  }
+	return false;
+      }
+
+      // Acquire a specific address from pool, returning true if
+      // successful, or false if the address is not available.
+      bool acquire_specific_addr(const Addr& addr)
+      {
+	size_t off;
+	if (!offset(addr, off))
+	  return false;
+	const Word bit = Word(1) << (off % WORD_BITS);
+	if (words[off / WORD_BITS].fetch_or(bit, std::memory_order_acquire) & bit)
+	  return false;
+	in_use.fetch_add(1, std::memory_order_relaxed);
+	return true;
+      }
+
+      // Return a previously acquired address to the pool.  Returns
+      // false if the address is not owned by the pool.  Releasing
+      // a free address does nothing.
+      bool release_addr(const Addr& addr)
+      {
+	size_t off;
+	if (!offset(addr, off))
+	  return false;
+	const Word bit = Word(1) << (off % WORD_BITS);
+	if (words[off / WORD_BITS].fetch_and(Word(~bit), std::memory_order_release) & bit)
+	  in_use.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+      }
+
+      bool contains(const Addr& addr) const
+      {
+	size_t off;
+	return offset(addr, off);
+      }
+
+      // Return number of pool addresses currently in use.
+      size_t n_in_use() const
+      {
+	return in_use.load(std::memory_order_relaxed);
+      }
+
+      // Return number of free pool addresses.
+      size_t n_free() const
+      {
+	return extent - n_in_use();
+      }
+
+      std::string to_string() const
+      {
+	std::string ret;
+	for (size_t i = 0; i < extent; ++i)
+	  {
+	    if (words[i / WORD_BITS].load(std::memory_order_relaxed) & (Word(1) << (i % WORD_BITS)))
+	      {
+		ret += (start + long(i)).to_string();
+		ret += '\n';
+	      }
+	  }
+	return ret;
+      }
+
+    private:
+      // unsigned int so that find_first_set() is available everywhere
+      typedef unsigned int Word;
+
+      enum {
+	WORD_BITS = sizeof(Word) * 8,
+      };
+
+      bool offset(const Addr& addr, size_t& off) const
+      {
+	if (!extent
+	    || addr.version() != start.version()
+	    || addr < start
+	    || addr >= start + long(extent))
+	  return false;
+	if (addr.version() == Addr::V4)
+	  off = (addr.to_ipv4() - start.to_ipv4()).to_ulong();
+	else
+	  off = (addr.to_ipv6() - start.to_ipv6()).to_ulong();
+	return true;
+      }
+
+      const Addr start;
+      const size_t extent;
+      const size_t n_words;
+      std::unique_ptr<std::atomic<Word>[]> words;
+      std::atomic<size_t> hint{0};
+      std::atomic<size_t> in_use{0};
+    };
+
+    // A set of BitmapPools, e.g. one per thread.  acquire_addr()
+    // takes from the caller's own shard first and only looks at the
+    // others when it is depleted.  Shards must be added before the
+    // set is shared between threads.
+    class BitmapPoolSet
+    {
+    public:
+      void add_shard(const Range& range)
+      {
+	if (range.defined())
+	  shards.emplace_back(new BitmapPool(range));
+      }
+
+      size_t n_shards() const
+      {
+	return shards.size();
+      }
+
+      bool acquire_addr(Addr& dest, const size_t shard_index=0)
+      {
+	const size_t n = shards.size();
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    if (shards[(shard_index + i) % n]->acquire_addr(dest))
+	      return true;
+	  }
+	return false;
+      }
+
+      bool acquire_specific_addr(const Addr& addr)
+      {
+	for (auto& s : shards)
+	  {
+	    if (s->contains(addr))
+	      return s->acquire_specific_addr(addr);
+	  }
+	return false;
+      }
+
+      void release_addr(const Addr& addr)
+      {
+	for (auto& s : shards)
+	  {
+	    if (s->release_addr(addr))
+	      return;
+	  }
+      }
+
+      size_t n_in_use() const
+      {
+	size_t ret = 0;
+	for (auto& s : shards)
+	  ret += s->n_in_use();
+	return ret;
+      }
+
+      size_t n_free() const
+      {
+	size_t ret = 0;
+	for (auto& s : shards)
+	  ret += s->n_free();
+	return ret;
+      }
+
+      std::string to_string() const
+      {
+	std::string ret;
+	for (auto& s : shards)
+	  ret += s->to_string();
+	return ret;
+      }
+
+    private:
+      std::vector<std::unique_ptr<BitmapPool>> shards;
+    };
+  }
+}
+
+#endif
@@ -31,6 +31,7 @@
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/ostream.hpp>
 #include <openvpn/common/hash.hpp>
+#include <openvpn/common/fasthash.hpp>
 #include <openvpn/addr/ipv4.hpp>
 #include <openvpn/addr/ipv6.hpp>
 #include <openvpn/addr/iperr.hpp>
@@ -879,14 +880,16 @@ namespace openvpn {
 	  }
       }
 
-#ifdef HAVE_CITYHASH
       std::size_t hashval() const
       {
+#ifdef HAVE_CITYHASH
 	HashSizeT h;
+#else
+	FastHash::Hasher h;
+#endif
 	hash(h);
-	return h.value();
+	return std::size_t(h.value());
       }
-#endif
 
 #ifdef OPENVPN_IP_IMMUTABLE
     private:
@@ -976,8 +979,6 @@ namespace openvpn {
   }
 }
 
-#ifdef HAVE_CITYHASH
 OPENVPN_HASH_METHOD(openvpn::IP::Addr, hashval);
-#endif
 
 #endif
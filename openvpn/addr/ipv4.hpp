@@ -36,6 +36,7 @@
 #include <openvpn/common/ffs.hpp>
 #include <openvpn/common/hexstr.hpp>
 #include <openvpn/common/hash.hpp>
+#include <openvpn/common/fasthash.hpp>
 #include <openvpn/addr/iperr.hpp>
 
 namespace openvpn {
@@ -504,14 +505,16 @@ namespace openvpn {
 	h(u.addr);
       }
 
-#ifdef HAVE_CITYHASH
       std::size_t hashval() const
       {
+#ifdef HAVE_CITYHASH
 	HashSizeT h;
+#else
+	FastHash::Hasher h;
+#endif
 	hash(h);
-	return h.value();
+	return std::size_t(h.value());
       }
-#endif
 
 #ifdef OPENVPN_IP_IMMUTABLE
     private:
@@ -581,8 +584,6 @@ namespace openvpn {
   }
 }
 
-#ifdef HAVE_CITYHASH
 OPENVPN_HASH_METHOD(openvpn::IPv4::Addr, hashval);
-#endif
 
 #endif // OPENVPN_ADDR_IPV4_H
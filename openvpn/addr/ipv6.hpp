@@ -35,6 +35,7 @@
 #include <openvpn/common/ffs.hpp>
 #include <openvpn/common/hexstr.hpp>
 #include <openvpn/common/hash.hpp>
+#include <openvpn/common/fasthash.hpp>
 #include <openvpn/addr/ipv4.hpp>
 #include <openvpn/addr/iperr.hpp>
 
@@ -218,6 +219,26 @@ namespace openvpn {
 	return neg ? -(ret + 1) : ret;
       }
 
+      // the address as two 64-bit words in host byte order
+      std::uint64_t high64() const
+      {
+	return u.u64[Endian::e2(1)];
+      }
+
+      std::uint64_t low64() const
+      {
+	return u.u64[Endian::e2(0)];
+      }
+
+      static Addr from_uint64(const std::uint64_t high, const std::uint64_t low, const int scope_id = 0)
+      {
+	Addr ret;
+	ret.scope_id_ = scope_id;
+	ret.u.u64[Endian::e2(1)] = high;
+	ret.u.u64[Endian::e2(0)] = low;
+	return ret;
+      }
+
       std::string arpa() const
       {
 	throw ipv6_exception("arpa() not implemented");
@@ -546,14 +567,16 @@ namespace openvpn {
 	h(u.bytes, sizeof(u.bytes));
       }
 
-#ifdef HAVE_CITYHASH
       std::size_t hashval() const
       {
+#ifdef HAVE_CITYHASH
 	HashSizeT h;
+#else
+	FastHash::Hasher h;
+#endif
 	hash(h);
-	return h.value();
+	return std::size_t(h.value());
       }
-#endif
 
 #ifdef OPENVPN_IP_IMMUTABLE
     private:
@@ -840,8 +863,6 @@ namespace openvpn {
   }
 }
 
-#ifdef HAVE_CITYHASH
 OPENVPN_HASH_METHOD(openvpn::IPv6::Addr, hashval);
-#endif
 
 #endif // OPENVPN_ADDR_IPV6_H
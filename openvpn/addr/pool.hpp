@@ -31,6 +31,7 @@
 #include <openvpn/common/exception.hpp>
 
 #include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/addrkey.hpp>
 #include <openvpn/addr/range.hpp>
 
 namespace openvpn {
@@ -156,7 +157,7 @@ namespace openvpn {
 
     private:
       std::deque<ADDR> freelist;
-      std::unordered_map<ADDR, bool> map;
+      std::unordered_map<ADDR, bool, AddrHash> map;
     };
 
     typedef PoolType<IP::Addr> Pool;
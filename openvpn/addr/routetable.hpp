@@ -0,0 +1,436 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Route -> entry table with lock-free longest-prefix-match lookups,
+// for the server to find the session owning an inner destination
+// address among client addresses (host routes) and iroutes.
+//
+// Like RouteTree this is a path-compressed binary trie, but with
+// addresses kept as 128-bit keys so that a step is a couple of word
+// operations, and with atomic links so that lookups can run on any
+// thread without a lock.  Writers are serialized by an internal mutex.
+// A writer never changes a node that readers can reach other than
+// through its atomic fields: new nodes are built completely before
+// they are linked in, and unlinked nodes and replaced entries are
+// reclaimed RCU-style through QSBR, as in PeerIDTable.  Readers
+// register a Reader and call quiescent() when they hold no entry
+// pointers.
+
+#ifndef OPENVPN_ADDR_ROUTETABLE_H
+#define OPENVPN_ADDR_ROUTETABLE_H
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/ffs.hpp>
+#include <openvpn/common/qsbr.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+
+namespace openvpn {
+  namespace IP {
+
+    template <typename T, typename RECLAIM = std::default_delete<T>>
+    class RouteTable
+    {
+    public:
+      OPENVPN_EXCEPTION(route_table_error);
+
+      typedef QSBR::Reader Reader;
+
+      RouteTable(RECLAIM reclaim_arg = RECLAIM())
+	: reclaim_fn(std::move(reclaim_arg))
+      {
+      }
+
+      RouteTable(const RouteTable&) = delete;
+      RouteTable& operator=(const RouteTable&) = delete;
+
+      ~RouteTable()
+      {
+	for (auto& r : roots)
+	  destroy(r.load(std::memory_order_relaxed));
+      }
+
+      // Register the calling worker thread as a reader.  The Reader
+      // must be destroyed before the table.
+      std::unique_ptr<Reader> register_reader()
+      {
+	return qsbr.register_reader();
+      }
+
+      // Lock-free longest prefix match, returns nullptr if no route
+      // contains addr.  The returned pointer remains valid until the
+      // calling thread's next Reader::quiescent() call.
+      T* longest_match(const Addr& addr) const
+      {
+	const Key k(addr);
+	const unsigned int len = addr.size();
+	T* best = nullptr;
+	const Node* n = root(addr).load(std::memory_order_acquire);
+	while (n && n->prefix_len <= len && n->key.match(k, n->prefix_len))
+	  {
+	    T* obj = n->obj.load(std::memory_order_acquire);
+	    if (obj)
+	      best = obj;
+	    if (n->prefix_len == len)
+	      break;
+	    n = n->child[k.bit(n->prefix_len)].load(std::memory_order_acquire);
+	  }
+	return best;
+      }
+
+      // Lock-free exact match.
+      T* lookup(const Route& r) const
+      {
+	const Node* n = find(r);
+	return n ? n->obj.load(std::memory_order_acquire) : nullptr;
+      }
+
+      // Install obj for r, which must not have an entry yet.  The
+      // table takes ownership of obj.  Returns false if r is already
+      // in use.  Host bits of r are ignored.
+      bool insert(const Route& r, T* obj)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	return insert_(r, obj);
+      }
+
+      // Atomically replace the entry for r, deferring reclaim of the
+      // previous entry.  A null obj removes r.
+      void replace(const Route& r, T* obj)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	replace_(r, obj);
+	qsbr.reclaim();
+      }
+
+      // Remove the entry for r, deferring its reclaim.
+      void erase(const Route& r)
+      {
+	replace(r, nullptr);
+      }
+
+      // Remove the entry for r only if it is still expected, for
+      // owners that may have been replaced by another writer.
+      bool erase(const Route& r, const T* expected)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	const Node* n = find(r);
+	if (!n || n->obj.load(std::memory_order_relaxed) != expected)
+	  return false;
+	replace_(r, nullptr);
+	qsbr.reclaim();
+	return true;
+      }
+
+      // Reclaim retired entries and nodes that no reader can still
+      // reference.  Called implicitly by replace() and erase().
+      void reclaim()
+      {
+	qsbr.reclaim();
+      }
+
+      size_t size() const
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	return size_;
+      }
+
+      size_t n_retired() const
+      {
+	return qsbr.n_retired();
+      }
+
+    private:
+      // address as a left-aligned 128-bit big-endian number
+      struct Key
+      {
+	Key() {}
+
+	explicit Key(const Addr& a)
+	{
+	  if (a.version() == Addr::V4)
+	    {
+	      w[0] = std::uint64_t(a.to_ipv4_nocheck().to_uint32()) << 32;
+	      w[1] = 0;
+	    }
+	  else if (a.version() == Addr::V6)
+	    {
+	      unsigned char b[16];
+	      a.to_ipv6_nocheck().to_byte_string(b);
+	      w[0] = w[1] = 0;
+	      for (int i = 0; i < 8; ++i)
+		{
+		  w[0] = (w[0] << 8) | b[i];
+		  w[1] = (w[1] << 8) | b[i + 8];
+		}
+	    }
+	  else
+	    throw route_table_error("address undefined");
+	}
+
+	static std::uint64_t mask(const unsigned int len)
+	{
+	  if (!len)
+	    return 0;
+	  if (len >= 64)
+	    return ~std::uint64_t(0);
+	  return ~std::uint64_t(0) << (64 - len);
+	}
+
+	Key prefix(const unsigned int len) const
+	{
+	  Key k;
+	  k.w[0] = w[0] & mask(len);
+	  k.w[1] = len > 64 ? w[1] & mask(len - 64) : 0;
+	  return k;
+	}
+
+	// true if the first len bits equal those of k
+	bool match(const Key& k, const unsigned int len) const
+	{
+	  if ((w[0] ^ k.w[0]) & mask(len))
+	    return false;
+	  return len <= 64 || !((w[1] ^ k.w[1]) & mask(len - 64));
+	}
+
+	// bit pos, counting from the most significant bit
+	unsigned int bit(const unsigned int pos) const
+	{
+	  return pos < 64
+	    ? unsigned(w[0] >> (63 - pos)) & 1
+	    : unsigned(w[1] >> (127 - pos)) & 1;
+	}
+
+	// length of the common prefix, at most max
+	unsigned int common_prefix_len(const Key& k, const unsigned int max) const
+	{
+	  unsigned int n;
+	  const std::uint64_t x0 = w[0] ^ k.w[0];
+	  if (x0)
+	    n = 64 - unsigned(find_last_set(x0));
+	  else
+	    {
+	      const std::uint64_t x1 = w[1] ^ k.w[1];
+	      n = 128 - unsigned(find_last_set(x1));
+	    }
+	  return n < max ? n : max;
+	}
+
+	bool operator==(const Key& k) const
+	{
+	  return w[0] == k.w[0] && w[1] == k.w[1];
+	}
+
+	std::uint64_t w[2];
+      };
+
+      struct Node
+      {
+	Node(const Key& key_arg, const unsigned int prefix_len_arg, T* obj_arg)
+	  : key(key_arg),
+	    prefix_len(prefix_len_arg),
+	    obj(obj_arg)
+	{
+	  child[0].store(nullptr, std::memory_order_relaxed);
+	  child[1].store(nullptr, std::memory_order_relaxed);
+	}
+
+	bool is(const Key& k, const unsigned int len) const
+	{
+	  return prefix_len == len && key == k;
+	}
+
+	const Key key; // host bits clear
+	const unsigned int prefix_len;
+	std::atomic<T*> obj; // null for glue nodes
+	std::atomic<Node*> child[2];
+      };
+
+      typedef std::atomic<Node*> Link;
+
+      Link& root(const Addr& a)
+      {
+	return roots[a.version() == Addr::V6];
+      }
+
+      const Link& root(const Addr& a) const
+      {
+	return roots[a.version() == Addr::V6];
+      }
+
+      static unsigned int checked_prefix_len(const Route& r)
+      {
+	if (r.prefix_len > r.addr.size())
+	  throw route_table_error("bad prefix length " + r.to_string());
+	return r.prefix_len;
+      }
+
+      const Node* find(const Route& r) const
+      {
+	const unsigned int len = checked_prefix_len(r);
+	const Key k = Key(r.addr).prefix(len);
+	const Node* n = root(r.addr).load(std::memory_order_acquire);
+	while (n && n->prefix_len < len && n->key.match(k, n->prefix_len))
+	  n = n->child[k.bit(n->prefix_len)].load(std::memory_order_acquire);
+	return n && n->is(k, len) ? n : nullptr;
+      }
+
+      // mutex must be held
+      bool insert_(const Route& r, T* obj)
+      {
+	const unsigned int len = checked_prefix_len(r);
+	const Key k = Key(r.addr).prefix(len);
+	Link* link = &root(r.addr);
+	while (true)
+	  {
+	    Node* n = link->load(std::memory_order_relaxed);
+	    if (!n)
+	      {
+		link->store(new Node(k, len, obj), std::memory_order_release);
+		break;
+	      }
+	    if (n->is(k, len))
+	      {
+		if (n->obj.load(std::memory_order_relaxed))
+		  return false;
+		n->obj.store(obj, std::memory_order_release);
+		break;
+	      }
+	    if (n->prefix_len < len && n->key.match(k, n->prefix_len))
+	      {
+		link = &n->child[k.bit(n->prefix_len)];
+		continue;
+	      }
+
+	    // r is not below n, so n moves below either r itself or a
+	    // new glue node holding their common prefix, which is
+	    // complete before readers can see it
+	    Node* nn;
+	    const unsigned int cpl = k.common_prefix_len(n->key, std::min(len, n->prefix_len));
+	    if (cpl == len)
+	      nn = new Node(k, len, obj);
+	    else
+	      {
+		nn = new Node(k.prefix(cpl), cpl, nullptr);
+		nn->child[k.bit(cpl)].store(new Node(k, len, obj), std::memory_order_relaxed);
+	      }
+	    nn->child[n->key.bit(cpl)].store(n, std::memory_order_relaxed);
+	    link->store(nn, std::memory_order_release);
+	    break;
+	  }
+	++size_;
+	return true;
+      }
+
+      // mutex must be held
+      void replace_(const Route& r, T* obj)
+      {
+	const unsigned int len = checked_prefix_len(r);
+	const Key k = Key(r.addr).prefix(len);
+
+	// find the node along with the links to it and to its parent
+	Link* parent_link = nullptr;
+	Link* link = &root(r.addr);
+	Node* n = link->load(std::memory_order_relaxed);
+	while (n && n->prefix_len < len && n->key.match(k, n->prefix_len))
+	  {
+	    parent_link = link;
+	    link = &n->child[k.bit(n->prefix_len)];
+	    n = link->load(std::memory_order_relaxed);
+	  }
+	if (!n || !n->is(k, len) || !n->obj.load(std::memory_order_relaxed))
+	  {
+	    if (obj)
+	      insert_(r, obj);
+	    return;
+	  }
+
+	T* old = n->obj.exchange(obj, std::memory_order_acq_rel);
+	retire(old);
+	if (obj)
+	  return;
+	--size_;
+
+	// n is glue now: keep it while it joins two subtrees, and
+	// take its glue parent out too if that is left with one
+	Node* c0 = n->child[0].load(std::memory_order_relaxed);
+	Node* c1 = n->child[1].load(std::memory_order_relaxed);
+	if (c0 && c1)
+	  return;
+	link->store(c0 ? c0 : c1, std::memory_order_release);
+	retire(n);
+	if (c0 || c1 || !parent_link)
+	  return;
+	Node* p = parent_link->load(std::memory_order_relaxed);
+	if (p->obj.load(std::memory_order_relaxed))
+	  return;
+	Node* other = p->child[0].load(std::memory_order_relaxed);
+	if (!other)
+	  other = p->child[1].load(std::memory_order_relaxed);
+	parent_link->store(other, std::memory_order_release);
+	retire(p);
+      }
+
+      void retire(T* obj)
+      {
+	qsbr.retire([this, obj]() {
+	    reclaim_fn(obj);
+	  });
+      }
+
+      void retire(Node* n)
+      {
+	qsbr.retire([n]() {
+	    delete n;
+	  });
+      }
+
+      void destroy(Node* n)
+      {
+	if (!n)
+	  return;
+	destroy(n->child[0].load(std::memory_order_relaxed));
+	destroy(n->child[1].load(std::memory_order_relaxed));
+	T* obj = n->obj.load(std::memory_order_relaxed);
+	if (obj)
+	  reclaim_fn(obj);
+	delete n;
+      }
+
+      Link roots[2] = {{nullptr}, {nullptr}};
+
+      mutable std::mutex mutex;
+      size_t size_ = 0;
+      RECLAIM reclaim_fn;
+      QSBR qsbr; // destroyed first, reclaims the retired entries and nodes
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,197 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// A set of IPv4/IPv6 routes stored in a path-compressed binary trie
+// (Patricia tree), for containment and longest-prefix-match queries
+// that would otherwise need a linear scan of a RouteList.
+
+#pragma once
+
+#include <memory>
+#include <algorithm>
+
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+
+namespace openvpn {
+  namespace IP {
+    class RouteTree
+    {
+    public:
+      RouteTree() {}
+
+      // bulk build, routes must be canonical
+      explicit RouteTree(const RouteList& routes)
+      {
+	for (const auto& r : routes)
+	  insert(r);
+      }
+
+      void insert(const Route& r)
+      {
+	std::unique_ptr<Node>* pp = &root(r.addr);
+	while (true)
+	  {
+	    Node* n = pp->get();
+	    if (!n)
+	      {
+		pp->reset(new Node(r, true));
+		return;
+	      }
+	    if (n->route == r)
+	      {
+		n->present = true;
+		return;
+	      }
+	    if (n->route.contains(r))
+	      {
+		pp = &n->child[bit(r.addr, n->route.prefix_len)];
+		continue;
+	      }
+
+	    // r is not below n, so n moves below either r itself
+	    // or a new glue node holding their common prefix
+	    std::unique_ptr<Node> old(pp->release());
+	    if (r.contains(old->route))
+	      pp->reset(new Node(r, true));
+	    else
+	      {
+		const unsigned int cpl = common_prefix_len(r, old->route);
+		pp->reset(new Node(Route(r.addr.network_addr(cpl), cpl), false));
+		(*pp)->child[bit(r.addr, cpl)].reset(new Node(r, true));
+	      }
+	    const unsigned int pl = (*pp)->route.prefix_len;
+	    (*pp)->child[bit(old->route.addr, pl)] = std::move(old);
+	    return;
+	  }
+      }
+
+      // true if r itself is in the set
+      bool exists(const Route& r) const
+      {
+	const Node* n = find_node(r);
+	return n && n->present && n->route == r;
+      }
+
+      // Longest route in the set that contains r (r itself included),
+      // or nullptr if none does.
+      const Route* longest_match(const Route& r) const
+      {
+	const Route* best = nullptr;
+	const Node* n = root(r.addr).get();
+	while (n && n->route.contains(r))
+	  {
+	    if (n->present)
+	      best = &n->route;
+	    if (n->route.prefix_len >= r.prefix_len)
+	      break;
+	    n = n->child[bit(r.addr, n->route.prefix_len)].get();
+	  }
+	return best;
+      }
+
+      const Route* longest_match(const Addr& a) const
+      {
+	return longest_match(Route(a, a.size()));
+      }
+
+      // true if the set holds a route strictly inside r
+      bool contains_subroute(const Route& r) const
+      {
+	const Node* n = find_node(r);
+
+	// every node below r is either a route or a glue node with two
+	// children, so any non-empty subtree holds a route
+	if (!n || !r.contains(n->route))
+	  return false;
+	if (n->route.prefix_len > r.prefix_len)
+	  return true;
+	return n->child[0] || n->child[1];
+      }
+
+      bool empty() const
+      {
+	return !roots[0] && !roots[1];
+      }
+
+    private:
+      struct Node
+      {
+	Node(const Route& route_arg, const bool present_arg)
+	  : route(route_arg),
+	    present(present_arg)
+	{
+	}
+
+	Route route;
+	bool present; // false for glue nodes
+	std::unique_ptr<Node> child[2];
+      };
+
+      // Descend to the first node that is either r or below r,
+      // or the deepest node above r if there is none.
+      const Node* find_node(const Route& r) const
+      {
+	const Node* n = root(r.addr).get();
+	while (n && n->route.contains(r) && n->route.prefix_len < r.prefix_len)
+	  {
+	    const Node* c = n->child[bit(r.addr, n->route.prefix_len)].get();
+	    if (!c)
+	      break;
+	    n = c;
+	  }
+	return n;
+      }
+
+      std::unique_ptr<Node>& root(const Addr& a)
+      {
+	return roots[a.version() == Addr::V6];
+      }
+
+      const std::unique_ptr<Node>& root(const Addr& a) const
+      {
+	return roots[a.version() == Addr::V6];
+      }
+
+      // bit pos of the address, counting from the most significant bit
+      static unsigned int bit(const Addr& a, const unsigned int pos)
+      {
+	unsigned char bytes[16];
+	a.to_byte_string_variable(bytes);
+	return (bytes[pos >> 3] >> (7 - (pos & 7))) & 1;
+      }
+
+      static unsigned int common_prefix_len(const Route& r1, const Route& r2)
+      {
+	unsigned char b1[16], b2[16];
+	r1.addr.to_byte_string_variable(b1);
+	r2.addr.to_byte_string_variable(b2);
+	const unsigned int max = std::min(r1.prefix_len, r2.prefix_len);
+	unsigned int i = 0;
+	while (i < max && ((b1[i >> 3] ^ b2[i >> 3]) & (0x80 >> (i & 7))) == 0)
+	  ++i;
+	return i;
+      }
+
+      std::unique_ptr<Node> roots[2];
+    };
+  }
+}
@@ -46,6 +46,17 @@ namespace openvpn {
       else
 	return CF::empty_dict();
     }
+
+    // Values of all keys in one round trip to configd,
+    // keys without a value are left out.
+    inline Dict DynamicStoreCopyMultiple(const DynamicStore& ds, const Array& keys)
+    {
+      Dict dict(SCDynamicStoreCopyMultiple(ds(), keys(), nullptr));
+      if (dict.defined())
+	return dict;
+      else
+	return CF::empty_dict();
+    }
   }
 }
 
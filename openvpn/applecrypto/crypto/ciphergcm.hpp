@@ -0,0 +1,235 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Wrap the CommonCrypto one-shot AES-GCM and ChaCha20-Poly1305 AEAD
+// functions, which run on the hardware AES and NEON units of Apple
+// CPUs.  They are exported by libcommonCrypto (macOS 10.13/iOS 11 for
+// GCM, macOS 10.15/iOS 13 for ChaCha20-Poly1305) but only declared in
+// the non-public CommonCryptorSPI.h, so they are declared here and
+// weakly linked: on older systems init() throws and the cipher is
+// unavailable.
+
+#ifndef OPENVPN_APPLECRYPTO_CRYPTO_CIPHERGCM_H
+#define OPENVPN_APPLECRYPTO_CRYPTO_CIPHERGCM_H
+
+#include <string>
+#include <cstring>
+
+#include <CommonCrypto/CommonCryptor.h>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/likely.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+
+extern "C" {
+  CCCryptorStatus CCCryptorGCMOneshotEncrypt(CCAlgorithm alg, const void *key, size_t keyLength,
+					     const void *iv, size_t ivLength,
+					     const void *aData, size_t aDataLength,
+					     const void *dataIn, size_t dataInLength,
+					     void *cipherOut, void *tagOut, size_t tagLength)
+    __attribute__((weak_import));
+
+  CCCryptorStatus CCCryptorGCMOneshotDecrypt(CCAlgorithm alg, const void *key, size_t keyLength,
+					     const void *iv, size_t ivLength,
+					     const void *aData, size_t aDataLength,
+					     const void *dataIn, size_t dataInLength,
+					     void *dataOut, const void *tagIn, size_t tagLength)
+    __attribute__((weak_import));
+
+  CCCryptorStatus CCCryptorChaCha20Poly1305OneshotEncrypt(const void *key, size_t keyLength,
+							  const void *iv, size_t ivLength,
+							  const void *aData, size_t aDataLength,
+							  const void *dataIn, size_t dataInLength,
+							  void *dataOut, void *tagOut, size_t tagLength)
+    __attribute__((weak_import));
+
+  CCCryptorStatus CCCryptorChaCha20Poly1305OneshotDecrypt(const void *key, size_t keyLength,
+							  const void *iv, size_t ivLength,
+							  const void *aData, size_t aDataLength,
+							  const void *dataIn, size_t dataInLength,
+							  void *dataOut, const void *tagIn, size_t tagLength)
+    __attribute__((weak_import));
+}
+
+namespace openvpn {
+  namespace AppleCrypto {
+    class CipherContextGCM
+    {
+      CipherContextGCM(const CipherContextGCM&) = delete;
+      CipherContextGCM& operator=(const CipherContextGCM&) = delete;
+
+    public:
+      OPENVPN_EXCEPTION(apple_gcm_error);
+
+      // mode parameter for constructor
+      enum {
+	MODE_UNDEF = -1,
+	ENCRYPT = kCCEncrypt,
+	DECRYPT = kCCDecrypt
+      };
+
+      // CommonCrypto cipher constants
+      enum {
+	IV_LEN = 12,
+	AUTH_TAG_LEN = 16,
+	SUPPORTS_IN_PLACE_ENCRYPT = 0, // not documented for the one-shot functions
+	MAX_BATCH = 32, // max packets per encrypt_batch() call
+      };
+
+      // one packet of an encrypt_batch() call
+      struct Op
+      {
+	const unsigned char *input;
+	unsigned char *output;
+	size_t length;
+	const unsigned char *iv;
+	unsigned char *tag;
+	const unsigned char *ad;
+	size_t ad_len;
+      };
+
+      CipherContextGCM()
+	: initialized(false)
+      {
+      }
+
+      ~CipherContextGCM() { erase() ; }
+
+      void init(const CryptoAlgs::Type alg,
+		const unsigned char *key,
+		const unsigned int keysize,
+		const int mode) // unused
+      {
+	erase();
+
+	// get key size, and check that CommonCrypto exports the cipher
+	unsigned int ckeysz = 0;
+	chachapoly = cipher_type(alg, ckeysz);
+	if (ckeysz > keysize)
+	  throw apple_gcm_error("insufficient key material");
+
+	// the one-shot functions take the raw key on each call
+	std::memcpy(key_, key, ckeysz);
+	key_len = ckeysz;
+	initialized = true;
+      }
+
+      void encrypt(const unsigned char *input,
+		   unsigned char *output,
+		   size_t length,
+		   const unsigned char *iv,
+		   unsigned char *tag,
+		   const unsigned char *ad,
+		   size_t ad_len)
+      {
+	check_initialized();
+	const CCCryptorStatus status = chachapoly
+	  ? CCCryptorChaCha20Poly1305OneshotEncrypt(key_, key_len, iv, IV_LEN, ad, ad_len,
+						    input, length, output, tag, AUTH_TAG_LEN)
+	  : CCCryptorGCMOneshotEncrypt(kCCAlgorithmAES, key_, key_len, iv, IV_LEN, ad, ad_len,
+				       input, length, output, tag, AUTH_TAG_LEN);
+	if (unlikely(status != kCCSuccess))
+	  OPENVPN_THROW(apple_gcm_error, "one-shot AEAD encrypt failed with status=" << status);
+      }
+
+      // CommonCrypto has no multi-buffer AEAD, so packets are
+      // encrypted one after another
+      void encrypt_batch(const Op *ops, const size_t n)
+      {
+	for (size_t i = 0; i < n; ++i)
+	  encrypt(ops[i].input, ops[i].output, ops[i].length, ops[i].iv, ops[i].tag, ops[i].ad, ops[i].ad_len);
+      }
+
+      // input and output may NOT be equal
+      bool decrypt(const unsigned char *input,
+		   unsigned char *output,
+		   size_t length,
+		   const unsigned char *iv,
+		   const unsigned char *tag,
+		   const unsigned char *ad,
+		   size_t ad_len)
+      {
+	check_initialized();
+	const CCCryptorStatus status = chachapoly
+	  ? CCCryptorChaCha20Poly1305OneshotDecrypt(key_, key_len, iv, IV_LEN, ad, ad_len,
+						    input, length, output, tag, AUTH_TAG_LEN)
+	  : CCCryptorGCMOneshotDecrypt(kCCAlgorithmAES, key_, key_len, iv, IV_LEN, ad, ad_len,
+				       input, length, output, tag, AUTH_TAG_LEN);
+	return status == kCCSuccess;
+      }
+
+      bool is_initialized() const { return initialized; }
+
+    private:
+      // returns true for ChaCha20-Poly1305
+      static bool cipher_type(const CryptoAlgs::Type alg, unsigned int& keysize)
+      {
+	switch (alg)
+	  {
+	  case CryptoAlgs::AES_128_GCM:
+	    keysize = 16;
+	    break;
+	  case CryptoAlgs::AES_192_GCM:
+	    keysize = 24;
+	    break;
+	  case CryptoAlgs::AES_256_GCM:
+	    keysize = 32;
+	    break;
+	  case CryptoAlgs::CHACHA20_POLY1305:
+	    if (&CCCryptorChaCha20Poly1305OneshotEncrypt == nullptr)
+	      OPENVPN_THROW(apple_gcm_error, CryptoAlgs::name(alg) << ": not supported by this OS version");
+	    keysize = 32;
+	    return true;
+	  default:
+	    OPENVPN_THROW(apple_gcm_error, CryptoAlgs::name(alg) << ": not usable");
+	  }
+	if (&CCCryptorGCMOneshotEncrypt == nullptr)
+	  OPENVPN_THROW(apple_gcm_error, CryptoAlgs::name(alg) << ": not supported by this OS version");
+	return false;
+      }
+
+      void erase()
+      {
+	if (initialized)
+	  {
+	    ::memset_s(key_, sizeof(key_), 0, sizeof(key_)); // not optimized away
+	    initialized = false;
+	  }
+      }
+
+      void check_initialized() const
+      {
+	if (unlikely(!initialized))
+	  throw apple_gcm_error("uninitialized");
+      }
+
+      bool initialized;
+      bool chachapoly = false;
+      unsigned int key_len = 0;
+      unsigned char key_[32];
+    };
+  }
+}
+
+#endif
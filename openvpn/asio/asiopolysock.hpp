@@ -25,6 +25,8 @@
 #ifndef OPENVPN_ASIO_ASIOPOLYSOCK_H
 #define OPENVPN_ASIO_ASIOPOLYSOCK_H
 
+#include <vector>
+
 #include <openvpn/io/io.hpp>
 
 #include <openvpn/common/platform.hpp>
@@ -62,6 +64,14 @@ namespace openvpn {
       virtual void async_send(const openvpn_io::const_buffer& buf,
 			      Function<void(const openvpn_io::error_code&, const size_t)>&& callback) = 0;
 
+      // Gathered send, as used by TCPTransport::Link.  Sockets
+      // that can't gather send the first buffer only.
+      virtual void async_send(const std::vector<openvpn_io::const_buffer>& bufs,
+			      Function<void(const openvpn_io::error_code&, const size_t)>&& callback)
+      {
+	async_send(bufs.front(), std::move(callback));
+      }
+
       virtual void async_receive(const openvpn_io::mutable_buffer& buf,
 				 Function<void(const openvpn_io::error_code&, const size_t)>&& callback) = 0;
 
@@ -82,6 +92,14 @@ namespace openvpn {
 	return -1;
       }
 
+      // Wait until the socket is writable, for data written to
+      // native_handle() directly, as with sendfile().  Returns
+      // false if the socket doesn't support it.
+      virtual bool async_wait_write(Function<void(const openvpn_io::error_code&)>&& callback)
+      {
+	return false;
+      }
+
 #ifdef ASIO_HAS_LOCAL_SOCKETS
       virtual bool peercreds(SockOpt::Creds& cr)
       {
@@ -128,6 +146,12 @@ namespace openvpn {
 	socket.async_send(buf, std::move(callback));
       }
 
+      virtual void async_send(const std::vector<openvpn_io::const_buffer>& bufs,
+			      Function<void(const openvpn_io::error_code&, const size_t)>&& callback) override
+      {
+	socket.async_send(bufs, std::move(callback));
+      }
+
       virtual void async_receive(const openvpn_io::mutable_buffer& buf,
 				 Function<void(const openvpn_io::error_code&, const size_t)>&& callback) override
       {
@@ -207,6 +231,12 @@ namespace openvpn {
 	return socket.native_handle();
       }
 
+      virtual bool async_wait_write(Function<void(const openvpn_io::error_code&)>&& callback) override
+      {
+	socket.async_wait(openvpn_io::socket_base::wait_write, std::move(callback));
+	return true;
+      }
+
 #if defined(OPENVPN_POLYSOCK_SUPPORTS_ALT_ROUTING)
       virtual std::string remote_endpoint_str() const override
       {
@@ -245,6 +275,12 @@ namespace openvpn {
 	socket.async_send(buf, std::move(callback));
       }
 
+      virtual void async_send(const std::vector<openvpn_io::const_buffer>& bufs,
+			      Function<void(const openvpn_io::error_code&, const size_t)>&& callback) override
+      {
+	socket.async_send(bufs, std::move(callback));
+      }
+
       virtual void async_receive(const openvpn_io::mutable_buffer& buf,
 				 Function<void(const openvpn_io::error_code&, const size_t)>&& callback) override
       {
@@ -311,6 +347,12 @@ namespace openvpn {
 	return socket.native_handle();
       }
 
+      virtual bool async_wait_write(Function<void(const openvpn_io::error_code&)>&& callback) override
+      {
+	socket.async_wait(openvpn_io::socket_base::wait_write, std::move(callback));
+	return true;
+      }
+
       openvpn_io::local::stream_protocol::socket socket;
     };
 #endif
@@ -0,0 +1,176 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// A fixed number of threads, each running its own io_context, that
+// host many independent single-threaded objects, such as client
+// sessions, in one process.  acquire() places an object on the
+// least loaded thread, where it stays until release().  Each
+// io_context is only run by its own thread, so objects on it need
+// no locking, and per-thread caches (buffer and object pools) are
+// shared by all of them.
+
+#ifndef OPENVPN_ASIO_ASIOPOOL_H
+#define OPENVPN_ASIO_ASIOPOOL_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/threadpolicy.hpp>
+#include <openvpn/asio/asiowork.hpp>
+
+namespace openvpn {
+  class AsioContextPool
+  {
+  public:
+    OPENVPN_EXCEPTION(asio_context_pool_error);
+
+    AsioContextPool(const unsigned int n_threads,
+		    const ThreadPolicy& policy_arg = ThreadPolicy())
+      : policy(policy_arg)
+    {
+      const unsigned int n = n_threads ? n_threads : std::max(std::thread::hardware_concurrency(), 1u);
+      for (unsigned int i = 0; i < n; ++i)
+	units.emplace_back(new Unit());
+    }
+
+    virtual ~AsioContextPool()
+    {
+      stop();
+    }
+
+    // Start the threads.  Separate from the constructor so that
+    // derived classes can override run().
+    void start()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (started)
+	throw asio_context_pool_error("already started");
+      started = true;
+      for (unsigned int i = 0; i < units.size(); ++i)
+	units[i]->thread.reset(new std::thread([this, i]() {
+	      run(i);
+	    }));
+    }
+
+    // Stop the io_contexts and join the threads.  Objects still
+    // placed on the pool don't get to finish their work.
+    void stop()
+    {
+      for (auto& u : units)
+	{
+	  u->work.reset();
+	  u->io_context.stop();
+	}
+      for (auto& u : units)
+	{
+	  if (u->thread)
+	    {
+	      u->thread->join();
+	      u->thread.reset();
+	    }
+	}
+    }
+
+    unsigned int size() const
+    {
+      return (unsigned int)units.size();
+    }
+
+    // Place an object on the thread with the fewest objects.
+    unsigned int acquire()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      unsigned int best = 0;
+      for (unsigned int i = 1; i < units.size(); ++i)
+	if (units[i]->load < units[best]->load)
+	  best = i;
+      ++units[best]->load;
+      return best;
+    }
+
+    void release(const unsigned int unit)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (unit < units.size() && units[unit]->load)
+	--units[unit]->load;
+    }
+
+    // number of objects placed on unit
+    unsigned int load(const unsigned int unit) const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return unit < units.size() ? units[unit]->load : 0;
+    }
+
+    openvpn_io::io_context& io_context(const unsigned int unit)
+    {
+      return units.at(unit)->io_context;
+    }
+
+    // counters of the thread of unit
+    const ThreadStats& thread_stats(const unsigned int unit) const
+    {
+      return units.at(unit)->stats;
+    }
+
+  protected:
+    // Body of the thread of unit.  Overrides may set up per-thread
+    // state, such as a log context, around a call to this, and
+    // must call stop() in their destructor.
+    virtual void run(const unsigned int unit)
+    {
+      Unit& u = *units[unit];
+      policy.pin(unit);
+      run_io_context(u.io_context, policy, &u.stats);
+    }
+
+  private:
+    struct Unit
+    {
+      Unit()
+	: io_context(1), // concurrency hint=1
+	  work(new AsioWork(io_context))
+      {
+      }
+
+      openvpn_io::io_context io_context;
+      std::unique_ptr<AsioWork> work;
+      std::unique_ptr<std::thread> thread;
+      ThreadStats stats;
+      unsigned int load = 0;
+    };
+
+    AsioContextPool(const AsioContextPool&) = delete;
+    AsioContextPool& operator=(const AsioContextPool&) = delete;
+
+    const ThreadPolicy policy;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Unit>> units;
+    bool started = false;
+  };
+}
+
+#endif
@@ -0,0 +1,519 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Asynchronous queue in front of a (possibly slow) auth backend such
+// as LDAP or an HTTP auth service.  At most max_in_flight requests
+// are passed to the backend at a time, up to max_queued more wait in
+// FIFO order, and anything beyond that fails immediately.  Every
+// request completes by its deadline, so a stalled backend can't hold
+// up client instances indefinitely.  Successful auth-token reauths
+// are cached for a short time so they don't reach the backend at all.
+//
+// Runs on a single io_context, like the client instances that use it.
+
+#ifndef OPENVPN_AUTH_AUTHQUEUE_H
+#define OPENVPN_AUTH_AUTHQUEUE_H
+
+#include <string>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/function.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimersafe.hpp>
+#include <openvpn/auth/authcreds.hpp>
+#include <openvpn/auth/authcert.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+namespace openvpn {
+
+  class AuthQueue : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<AuthQueue> Ptr;
+
+    struct Result
+    {
+      enum Status {
+	SUCCESS,
+	FAIL,     // backend rejected the credentials
+	BACKEND_ERROR, // backend failed to answer
+	TIMEOUT,  // deadline passed
+	OVERLOAD, // queue was full
+      };
+
+      Result() {}
+
+      Result(const Status status_arg, std::string reason_arg=std::string())
+	: status(status_arg),
+	  reason(std::move(reason_arg))
+      {
+      }
+
+      bool success() const
+      {
+	return status == SUCCESS;
+      }
+
+      const char *status_str() const
+      {
+	switch (status)
+	  {
+	  case SUCCESS:
+	    return "SUCCESS";
+	  case FAIL:
+	    return "FAIL";
+	  case BACKEND_ERROR:
+	    return "BACKEND_ERROR";
+	  case TIMEOUT:
+	    return "TIMEOUT";
+	  case OVERLOAD:
+	    return "OVERLOAD";
+	  default:
+	    return "UNKNOWN";
+	  }
+      }
+
+      Status status = BACKEND_ERROR;
+      std::string reason;
+      bool cached = false;    // answered from the auth-token cache
+      bool fast_path = false; // answered by the FastPath
+    };
+
+    typedef Function<void(const Result& result)> Completion;
+
+    class Request : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Request> Ptr;
+
+      // The completion won't be called after this, e.g. when
+      // the client instance goes away first.
+      void cancel()
+      {
+	if (!done)
+	  {
+	    if (queue && !in_flight)
+	      queue->cancelled();
+	    done = true;
+	    completion.reset();
+	  }
+      }
+
+      bool is_done() const
+      {
+	return done;
+      }
+
+      AuthCreds::Ptr creds;
+      AuthCert::Ptr cert;
+      PeerAddr::Ptr peer_addr;
+
+    private:
+      friend class AuthQueue;
+
+      Completion completion;
+      AuthQueue* queue = nullptr;
+      Time deadline;
+      bool in_flight = false;
+      bool done = false;
+    };
+
+    // Implemented by auth backends.  start() must eventually call
+    // complete exactly once, possibly after the request has timed
+    // out or was cancelled, so that its in-flight slot is freed.
+    // Backends should bound their own operations (e.g. with HTTP
+    // timeouts), because the queue can't abort them.
+    struct Backend : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<Backend> Ptr;
+
+      virtual void start(const Request& req, Completion complete) = 0;
+      virtual void stop() = 0;
+    };
+
+    // Authenticates requests in-process before they are queued,
+    // e.g. by verifying a server-generated auth token.  Requests
+    // it doesn't accept go to the backend as usual.
+    struct FastPath : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<FastPath> Ptr;
+
+      virtual bool authenticated(const Request& req) = 0;
+    };
+
+    struct Config
+    {
+      unsigned int max_in_flight = 16;  // concurrent backend requests
+      size_t max_queued = 1024;         // requests waiting for a slot
+      Time::Duration deadline = Time::Duration::seconds(10);
+
+      // cache successful auths with passwords starting with
+      // token_prefix, set token_cache_ttl to zero to disable
+      std::string token_prefix = "SESS_ID_";
+      Time::Duration token_cache_ttl = Time::Duration::seconds(60);
+      size_t token_cache_max = 4096;
+    };
+
+    struct Stats
+    {
+      std::uint64_t submitted = 0;
+      std::uint64_t cache_hits = 0;
+      std::uint64_t fast_path = 0;
+      std::uint64_t overload = 0;
+      std::uint64_t timeout = 0;
+    };
+
+    AuthQueue(openvpn_io::io_context& io_context_arg,
+	      Backend::Ptr backend_arg,
+	      const Config& config_arg)
+      : io_context(io_context_arg),
+	backend(std::move(backend_arg)),
+	config(config_arg),
+	deadline_timer(io_context_arg)
+    {
+    }
+
+    ~AuthQueue()
+    {
+      stop();
+    }
+
+    void set_fast_path(FastPath::Ptr fast_path_arg)
+    {
+      fast_path = std::move(fast_path_arg);
+    }
+
+    // Queue an auth request.  completion is always called
+    // asynchronously, unless the returned request is cancelled
+    // first.
+    Request::Ptr submit(const AuthCreds::Ptr& creds,
+			const AuthCert::Ptr& cert,
+			const PeerAddr::Ptr& peer_addr,
+			Completion completion)
+    {
+      Request::Ptr req(new Request);
+      req->creds = creds;
+      req->cert = cert;
+      req->peer_addr = peer_addr;
+      req->completion = std::move(completion);
+      ++stats_.submitted;
+
+      if (halt)
+	finish_async(req, Result(Result::BACKEND_ERROR, "auth queue stopped"));
+      else if (fast_path && fast_path->authenticated(*req))
+	{
+	  ++stats_.fast_path;
+	  Result r(Result::SUCCESS);
+	  r.fast_path = true;
+	  finish_async(req, std::move(r));
+	}
+      else if (cache_lookup(*req))
+	{
+	  ++stats_.cache_hits;
+	  Result r(Result::SUCCESS);
+	  r.cached = true;
+	  finish_async(req, std::move(r));
+	}
+      else if (n_in_flight < config.max_in_flight)
+	{
+	  arm(req);
+	  dispatch(req);
+	}
+      else if (n_waiting < config.max_queued)
+	{
+	  arm(req);
+	  waiting.push_back(req);
+	  ++n_waiting;
+	}
+      else
+	{
+	  ++stats_.overload;
+	  finish_async(req, Result(Result::OVERLOAD, "auth queue full"));
+	}
+      return req;
+    }
+
+    // Drop cached auth-token results for username, e.g. when the
+    // user's tokens are revoked.
+    void invalidate_user(const std::string& username)
+    {
+      for (auto i = token_cache.begin(); i != token_cache.end(); )
+	{
+	  if (i->second.username == username)
+	    {
+	      token_lru.erase(i->second.lru);
+	      i = token_cache.erase(i);
+	    }
+	  else
+	    ++i;
+	}
+    }
+
+    void stop()
+    {
+      if (halt)
+	return;
+      halt = true;
+      deadline_timer.cancel();
+      for (auto& req : deadlines)
+	{
+	  req->completion.reset();
+	  req->queue = nullptr;
+	  req->done = true;
+	}
+      deadlines.clear();
+      waiting.clear();
+      n_waiting = 0;
+      token_cache.clear();
+      token_lru.clear();
+      backend->stop();
+    }
+
+    unsigned int in_flight() const
+    {
+      return n_in_flight;
+    }
+
+    size_t queued() const
+    {
+      return n_waiting;
+    }
+
+    const Stats& stats() const
+    {
+      return stats_;
+    }
+
+  private:
+    struct CacheEntry
+    {
+      std::string username;
+      Time expire;
+      std::list<std::string>::iterator lru;
+    };
+
+    bool cacheable(const Request& req) const
+    {
+      return config.token_cache_ttl.defined()
+	&& req.creds
+	&& !config.token_prefix.empty()
+	&& has_prefix(req.creds->password, config.token_prefix);
+    }
+
+    static bool has_prefix(const SafeString& str, const std::string& prefix)
+    {
+      if (str.length() < prefix.length())
+	return false;
+      for (size_t i = 0; i < prefix.length(); ++i)
+	if (str[i] != prefix[i])
+	  return false;
+      return true;
+    }
+
+    static std::string cache_key(const Request& req)
+    {
+      std::string key = req.creds->username;
+      key += '\0';
+      key += req.creds->password.to_string();
+      return key;
+    }
+
+    bool cache_lookup(const Request& req)
+    {
+      if (!cacheable(req))
+	return false;
+      auto i = token_cache.find(cache_key(req));
+      if (i == token_cache.end())
+	return false;
+      if (Time::now() >= i->second.expire)
+	{
+	  token_lru.erase(i->second.lru);
+	  token_cache.erase(i);
+	  return false;
+	}
+      token_lru.splice(token_lru.end(), token_lru, i->second.lru);
+      return true;
+    }
+
+    void cache_insert(const Request& req)
+    {
+      std::string key = cache_key(req);
+      auto i = token_cache.find(key);
+      if (i != token_cache.end())
+	{
+	  i->second.expire = Time::now() + config.token_cache_ttl;
+	  token_lru.splice(token_lru.end(), token_lru, i->second.lru);
+	  return;
+	}
+      if (token_cache.size() >= config.token_cache_max)
+	{
+	  if (token_lru.empty())
+	    return;
+	  token_cache.erase(token_lru.front());
+	  token_lru.pop_front();
+	}
+      CacheEntry& e = token_cache[key];
+      e.username = req.creds->username;
+      e.expire = Time::now() + config.token_cache_ttl;
+      e.lru = token_lru.insert(token_lru.end(), std::move(key));
+    }
+
+    void arm(const Request::Ptr& req)
+    {
+      req->queue = this;
+      req->deadline = Time::now() + config.deadline;
+      deadlines.push_back(req);
+      if (deadlines.size() == 1)
+	schedule_deadline();
+    }
+
+    void dispatch(Request::Ptr req)
+    {
+      req->in_flight = true;
+      ++n_in_flight;
+      Ptr self(this);
+      backend->start(*req, [self, req](const Result& result) {
+	self->backend_done(req, result);
+      });
+    }
+
+    void backend_done(const Request::Ptr& req, const Result& result)
+    {
+      if (halt)
+	return;
+      --n_in_flight;
+      req->in_flight = false;
+      if (!req->done)
+	{
+	  if (result.success() && cacheable(*req))
+	    cache_insert(*req);
+	  finish(*req, result);
+	}
+      next();
+    }
+
+    // start waiting requests while there are free slots
+    void next()
+    {
+      while (n_in_flight < config.max_in_flight && !waiting.empty())
+	{
+	  Request::Ptr req = std::move(waiting.front());
+	  waiting.pop_front();
+	  if (req->done)
+	    continue;
+	  --n_waiting;
+	  dispatch(req);
+	}
+    }
+
+    // a waiting request was cancelled
+    void cancelled()
+    {
+      --n_waiting;
+    }
+
+    void finish(Request& req, const Result& result)
+    {
+      req.done = true;
+
+      // don't keep the io_context busy once nothing is pending
+      while (!deadlines.empty() && deadlines.front()->done)
+	deadlines.pop_front();
+      if (deadlines.empty())
+	deadline_timer.cancel();
+
+      Completion completion(std::move(req.completion));
+      if (completion)
+	completion(result);
+    }
+
+    void finish_async(Request::Ptr req, Result result)
+    {
+      openvpn_io::post(io_context, [req, result=std::move(result)]() {
+	if (!req->done)
+	  {
+	    req->done = true;
+	    Completion completion(std::move(req->completion));
+	    if (completion)
+	      completion(result);
+	  }
+      });
+    }
+
+    // Deadlines are submit time + a constant, so the earliest
+    // pending one is always at the front.
+    void schedule_deadline()
+    {
+      while (!deadlines.empty() && deadlines.front()->done)
+	deadlines.pop_front();
+      if (deadlines.empty())
+	return;
+      deadline_timer.expires_at(deadlines.front()->deadline);
+      Ptr self(this);
+      deadline_timer.async_wait([self](const openvpn_io::error_code& error) {
+	if (!error && !self->halt)
+	  self->deadline_expired();
+      });
+    }
+
+    void deadline_expired()
+    {
+      const Time now = Time::now();
+      while (!deadlines.empty() && (deadlines.front()->done || deadlines.front()->deadline <= now))
+	{
+	  Request::Ptr req = std::move(deadlines.front());
+	  deadlines.pop_front();
+	  if (!req->done)
+	    {
+	      if (!req->in_flight)
+		--n_waiting;
+	      ++stats_.timeout;
+	      finish(*req, Result(Result::TIMEOUT, "auth backend timeout"));
+	    }
+	}
+      schedule_deadline();
+    }
+
+    openvpn_io::io_context& io_context;
+    Backend::Ptr backend;
+    FastPath::Ptr fast_path;
+    const Config config;
+    AsioTimerSafe deadline_timer;
+    std::deque<Request::Ptr> deadlines; // queued and in-flight requests, in submit order
+    std::deque<Request::Ptr> waiting;   // may contain done requests
+    size_t n_waiting = 0;               // not-done requests in waiting
+    unsigned int n_in_flight = 0;
+    std::unordered_map<std::string, CacheEntry> token_cache;
+    std::list<std::string> token_lru;   // token_cache keys, least recently used first
+    Stats stats_;
+    bool halt = false;
+  };
+
+}
+
+#endif
@@ -0,0 +1,338 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-generated auth tokens that the server can verify on its own.
+// A client that was pushed an auth-token sends it back as password on
+// renegotiation and reconnect, and a valid token lets the server skip
+// the auth backend entirely.
+//
+// Token layout, base64 (URL-safe) encoded after the "SESS_ID_AT_"
+// prefix:
+//
+//   [version 1] [key id 1] [session 8] [initial 8] [issued 8] [HMAC-SHA256 32]
+//
+// session is a random ID chosen at the initial login, initial is
+// the time of the initial login and issued the time this token was
+// generated (seconds since the epoch, big-endian).  The HMAC also
+// covers the username and a binding string chosen by the caller,
+// e.g. the identity of the client cert, so a token is only valid
+// for the user and client it was issued to.
+
+#ifndef OPENVPN_AUTH_AUTHTOKEN_H
+#define OPENVPN_AUTH_AUTHTOKEN_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/base64.hpp>
+#include <openvpn/common/memneq.hpp>
+#include <openvpn/common/sess_id.hpp>
+#include <openvpn/common/to_string.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+#include <openvpn/auth/authcert.hpp>
+#include <openvpn/auth/authqueue.hpp>
+
+namespace openvpn {
+
+  template <typename CRYPTO_API>
+  class AuthTokenHMAC
+  {
+  public:
+    OPENVPN_EXCEPTION(auth_token_error);
+
+    // Secret shared by all threads that generate or verify
+    // tokens.  The id is embedded in tokens so that tokens made
+    // with the previous key still verify after a rotation.
+    class Key
+    {
+    public:
+      static constexpr size_t SIZE = 32;
+
+      Key(RandomAPI& rng, const std::uint8_t id_arg)
+	: id(id_arg)
+      {
+	rng.assert_crypto();
+	rng.rand_bytes(data, sizeof(data));
+      }
+
+      ~Key()
+      {
+	std::memset(data, 0, sizeof(data));
+      }
+
+    private:
+      friend class AuthTokenHMAC;
+      std::uint8_t id;
+      std::uint8_t data[SIZE];
+    };
+
+    struct Config
+    {
+      // a token must be renewed within this many seconds
+      unsigned int renew_window = 2 * 3600;
+
+      // max seconds since the initial login, 0 for no limit
+      unsigned int max_lifetime = 0;
+    };
+
+    enum Status {
+      VALID,
+      NOT_TOKEN,      // doesn't look like one of our tokens
+      MALFORMED,
+      UNKNOWN_KEY,    // made with a key that was rotated out
+      BAD_HMAC,       // forged, or other user/binding
+      EXPIRED,
+      NOT_YET_VALID,  // issued in the future
+    };
+
+    static const char *status_str(const Status status)
+    {
+      switch (status)
+	{
+	case VALID:
+	  return "VALID";
+	case NOT_TOKEN:
+	  return "NOT_TOKEN";
+	case MALFORMED:
+	  return "MALFORMED";
+	case UNKNOWN_KEY:
+	  return "UNKNOWN_KEY";
+	case BAD_HMAC:
+	  return "BAD_HMAC";
+	case EXPIRED:
+	  return "EXPIRED";
+	case NOT_YET_VALID:
+	  return "NOT_YET_VALID";
+	default:
+	  return "UNKNOWN";
+	}
+    }
+
+    // What a valid token says about its session
+    struct Info
+    {
+      SessionID64 session;
+      std::uint64_t initial = 0;
+      std::uint64_t issued = 0;
+    };
+
+    static constexpr const char *PREFIX = "SESS_ID_AT_";
+
+    AuthTokenHMAC(const Config& config_arg,
+		  const Key& current,
+		  const Key* previous=nullptr)
+      : config(config_arg),
+	current_id(current.id)
+    {
+      ctx.init(CryptoAlgs::SHA256, current.data, sizeof(current.data));
+      if (previous && previous->id != current.id)
+	{
+	  previous_id = previous->id;
+	  prev_ctx.init(CryptoAlgs::SHA256, previous->data, sizeof(previous->data));
+	}
+    }
+
+    static bool is_token(const std::string& password)
+    {
+      return password.compare(0, std::strlen(PREFIX), PREFIX) == 0;
+    }
+
+    // Token for the initial login of a new session.
+    std::string generate_initial(RandomAPI& rng,
+				 const std::string& username,
+				 const std::string& binding,
+				 const std::time_t now=std::time(nullptr))
+    {
+      Info info;
+      info.session = SessionID64(rng);
+      info.initial = now;
+      return generate(username, binding, info, now);
+    }
+
+    // Renewed token for the session described by info (from a
+    // previously verified token).
+    std::string generate(const std::string& username,
+			 const std::string& binding,
+			 const Info& info,
+			 const std::time_t now=std::time(nullptr))
+    {
+      std::uint8_t tok[TOKEN_SIZE];
+      tok[0] = VERSION;
+      tok[1] = current_id;
+      std::memcpy(tok + 2, info.session.c_data(), SessionID64::size());
+      write_u64(tok + 10, info.initial);
+      write_u64(tok + 18, now);
+      compute_hmac(ctx, tok, username, binding, tok + DATA_SIZE);
+      return PREFIX + base64_urlsafe->encode(tok, sizeof(tok));
+    }
+
+    Status verify(const std::string& token,
+		  const std::string& username,
+		  const std::string& binding,
+		  Info* info=nullptr,
+		  const std::time_t now=std::time(nullptr))
+    {
+      if (!is_token(token))
+	return NOT_TOKEN;
+
+      std::uint8_t tok[TOKEN_SIZE + 4];
+      size_t size;
+      try {
+	size = base64_urlsafe->decode(tok, sizeof(tok), token.substr(std::strlen(PREFIX)));
+      }
+      catch (const std::exception&)
+	{
+	  return MALFORMED;
+	}
+      if (size != TOKEN_SIZE || tok[0] != VERSION)
+	return MALFORMED;
+
+      typename CRYPTO_API::HMACContext* hc;
+      if (tok[1] == current_id)
+	hc = &ctx;
+      else if (prev_ctx.is_initialized() && tok[1] == previous_id)
+	hc = &prev_ctx;
+      else
+	return UNKNOWN_KEY;
+
+      // memneq wants aligned buffers
+      alignas(std::uint64_t) std::uint8_t mac[HMAC_SIZE];
+      alignas(std::uint64_t) std::uint8_t tok_mac[HMAC_SIZE];
+      compute_hmac(*hc, tok, username, binding, mac);
+      std::memcpy(tok_mac, tok + DATA_SIZE, HMAC_SIZE);
+      if (crypto::memneq(mac, tok_mac, HMAC_SIZE))
+	return BAD_HMAC;
+
+      const std::uint64_t initial = read_u64(tok + 10);
+      const std::uint64_t issued = read_u64(tok + 18);
+      const std::uint64_t t = now;
+      if (issued > t + CLOCK_SKEW || initial > issued)
+	return NOT_YET_VALID;
+      if (t >= issued + config.renew_window)
+	return EXPIRED;
+      if (config.max_lifetime && t >= initial + config.max_lifetime)
+	return EXPIRED;
+
+      if (info)
+	{
+	  info->session = SessionID64(tok + 2);
+	  info->initial = initial;
+	  info->issued = issued;
+	}
+      return VALID;
+    }
+
+  private:
+    enum {
+      VERSION = 1,
+      HMAC_SIZE = 32,
+      DATA_SIZE = 2 + SessionID64::size() + 8 + 8,
+      TOKEN_SIZE = DATA_SIZE + HMAC_SIZE,
+      CLOCK_SKEW = 60, // tolerated between server threads/nodes
+    };
+
+    static void compute_hmac(typename CRYPTO_API::HMACContext& hc,
+			     const std::uint8_t* data,
+			     const std::string& username,
+			     const std::string& binding,
+			     std::uint8_t* out)
+    {
+      std::uint8_t len[8];
+      hc.reset();
+      hc.update(data, DATA_SIZE);
+      // length-prefix the strings so their boundary can't be moved
+      write_u64(len, username.length());
+      hc.update(len, sizeof(len));
+      hc.update((const std::uint8_t *)username.c_str(), username.length());
+      write_u64(len, binding.length());
+      hc.update(len, sizeof(len));
+      hc.update((const std::uint8_t *)binding.c_str(), binding.length());
+      hc.final(out);
+    }
+
+    static void write_u64(std::uint8_t* p, std::uint64_t v)
+    {
+      for (int i = 7; i >= 0; --i)
+	{
+	  p[i] = std::uint8_t(v);
+	  v >>= 8;
+	}
+    }
+
+    static std::uint64_t read_u64(const std::uint8_t* p)
+    {
+      std::uint64_t v = 0;
+      for (int i = 0; i < 8; ++i)
+	v = (v << 8) | p[i];
+      return v;
+    }
+
+    const Config config;
+    const std::uint8_t current_id;
+    std::uint8_t previous_id = 0;
+    typename CRYPTO_API::HMACContext ctx;
+    typename CRYPTO_API::HMACContext prev_ctx;
+  };
+
+  // Accepts AuthQueue requests with a valid token for the user,
+  // bound to the issuer and serial number of the client cert.
+  template <typename CRYPTO_API>
+  class AuthTokenFastPath : public AuthQueue::FastPath
+  {
+  public:
+    typedef RCPtr<AuthTokenFastPath> Ptr;
+    typedef AuthTokenHMAC<CRYPTO_API> TokenHMAC;
+
+    AuthTokenFastPath(const typename TokenHMAC::Config& config,
+		      const typename TokenHMAC::Key& current,
+		      const typename TokenHMAC::Key* previous=nullptr)
+      : hmac(config, current, previous)
+    {
+    }
+
+    static std::string binding(const AuthCert* cert)
+    {
+      if (!cert || !cert->defined())
+	return std::string();
+      return cert->issuer_fp_str(false) + '/' + openvpn::to_string(cert->get_sn());
+    }
+
+    virtual bool authenticated(const AuthQueue::Request& req) override
+    {
+      if (!req.creds || !TokenHMAC::is_token(req.creds->password.to_string()))
+	return false;
+      return hmac.verify(req.creds->password.to_string(),
+			 req.creds->username,
+			 binding(req.cert.get())) == TokenHMAC::VALID;
+    }
+
+  private:
+    TokenHMAC hmac;
+  };
+
+}
+
+#endif
@@ -31,6 +31,7 @@
 #include <openvpn/aws/awscreds.hpp>
 #include <openvpn/ws/httpcliset.hpp>
 #include <openvpn/common/jsonhelper.hpp>
+#include <openvpn/common/jsonflat.hpp>
 #include <openvpn/common/hexstr.hpp>
 #include <openvpn/random/devurand.hpp>
 #include <openvpn/frame/frame_init.hpp>
@@ -236,7 +237,7 @@ namespace openvpn {
 	  // parse the identity document (JSON)
 	  {
 	    const std::string title = "identity-document";
-	    const Json::Value root = json::parse(ident, title);
+	    const json::FlatObject root(ident, title);
 	    info.region = json::get_string(root, "region", title);
 	    info.instanceId = json::get_string(root, "instanceId", title);
 	    info.privateIp = json::get_string(root, "privateIp", title);
@@ -259,8 +260,7 @@ namespace openvpn {
 	      WS::ClientSet::Transaction& cred_trans = *lts.transactions.at(lookup_product_code ? 3 : 2);
 	      if (cred_trans.request_status_success())
 		{
-		  const std::string creds = cred_trans.content_in.to_string();
-		  const Json::Value root = json::parse(creds);
+		  const json::FlatObject root(cred_trans.content_in.to_string());
 		  info.creds.access_key = json::get_string(root, "AccessKeyId");
 		  info.creds.secret_key = json::get_string(root, "SecretAccessKey");
 		  info.creds.token = json::get_string(root, "Token");
@@ -379,9 +379,9 @@ namespace openvpn {
 
 	  // parse JSON reply
 	  const std::string jtxt = trans.content_in.to_string();
-	  const Json::Value root = json::parse(jtxt, title);
 	  if (debug_level >= 3)
-	    OPENVPN_LOG("AWSPC REPLY\n" << root.toStyledString());
+	    OPENVPN_LOG("AWSPC REPLY\n" << jtxt);
+	  const json::FlatObject root(jtxt, title);
 
 	  // check for errors
 	  if (json::exists(root, "errorMessage"))
@@ -419,13 +419,13 @@ namespace openvpn {
 	  }
       }
 
-      bool awspc_req_verify_consistency(const Json::Value& reply,
+      bool awspc_req_verify_consistency(const json::FlatObject& reply,
 					const std::string& key) const
       {
 	return json::get_string(reply, key, "awspc-verify-reply") == json::get_string(awspc_req, key, "awspc-verify-request");
       }
 
-      bool awspc_req_verify_consistency(const Json::Value& reply) const
+      bool awspc_req_verify_consistency(const json::FlatObject& reply) const
       {
 	return awspc_req_verify_consistency(reply, "region")
 	  && awspc_req_verify_consistency(reply, "instanceId")
@@ -433,7 +433,7 @@ namespace openvpn {
 	  && awspc_req_verify_consistency(reply, "nonce");
       }
 
-      static std::string to_string_sig(const Json::Value& reply)
+      static std::string to_string_sig(const json::FlatObject& reply)
       {
 	const std::string title = "to-string-sig";
 	return json::get_string(reply, "region", title)
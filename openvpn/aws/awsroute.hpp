@@ -45,7 +45,13 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
 #include <openvpn/common/xmlhelper.hpp>
+#include <openvpn/common/cleanup.hpp>
 #include <openvpn/aws/awshttp.hpp>
 #include <openvpn/aws/awspc.hpp>
 #include <openvpn/aws/awsrest.hpp>
@@ -338,23 +344,7 @@ namespace openvpn {
 				       const std::string& target_value,
 				       bool ipv6)
       {
-	std::string target_type_str;
-
-	switch (target_type)
-	{
-	case RouteTargetType::INSTANCE_ID:
-	  target_type_str = "InstanceId";
-	  break;
-
-	case RouteTargetType::INTERFACE_ID:
-	  target_type_str = "NetworkInterfaceId";
-	  break;
-
-	default:
-	  OPENVPN_THROW(aws_route_error,
-	  		"replace_create_route: unknown RouteTargetType " << (int)target_type);
-	}
-
+	const std::string target_type_str = target_type_name(target_type);
 	const std::string dest_cidr_block_name = ipv6 ?
 		"DestinationCidrIpv6Block" : "DestinationCidrBlock";
 
@@ -438,7 +428,253 @@ namespace openvpn {
 	}
       }
 
+      // Apply many route changes at once, such as on gateway
+      // failover.  Up to max_parallel EC2 requests are in flight,
+      // each lane of requests reusing one keep-alive connection.
+      // Requests that were throttled or failed with a server or
+      // communication error are retried with exponential backoff.
+      // Requests are signed with the credentials of ctx, as
+      // obtained by PCQuery.
+      class Batch
+      {
+      public:
+	enum {
+	  MAX_ATTEMPTS = 8,      // per request, including the first
+	  BACKOFF_BASE_MS = 200, // delay before first retry
+	  BACKOFF_MAX_MS = 20000,
+	};
+
+	Batch(Context& ctx_arg,
+	      const unsigned int max_parallel_arg = 8)
+	  : ctx(ctx_arg),
+	    max_parallel(std::max(max_parallel_arg, 1u))
+	{
+	}
+
+	// Queue a ReplaceRoute, or CreateRoute if the route doesn't exist
+	void replace_create_route(const std::string& route_table_id,
+				  const std::string& route,
+				  RouteTargetType target_type,
+				  const std::string& target_value,
+				  bool ipv6)
+	{
+	  Change c;
+	  c.action = "ReplaceRoute";
+	  c.route_table_id = route_table_id;
+	  c.cidr = route;
+	  c.target_type_str = target_type_name(target_type);
+	  c.target_value = target_value;
+	  c.ipv6 = ipv6;
+	  changes.push_back(std::move(c));
+	}
+
+	// Queue a DeleteRoute
+	void delete_route(const std::string& route_table_id,
+			  const std::string& cidr,
+			  bool ipv6)
+	{
+	  Change c;
+	  c.action = "DeleteRoute";
+	  c.route_table_id = route_table_id;
+	  c.cidr = cidr;
+	  c.ipv6 = ipv6;
+	  changes.push_back(std::move(c));
+	}
+
+	size_t size() const
+	{
+	  return changes.size();
+	}
+
+	// Apply all queued changes and clear the queue.  Throws
+	// aws_route_error listing the changes that failed.
+	void execute()
+	{
+	  if (changes.empty())
+	    return;
+	  next_change = 0;
+
+	  auto clean = Cleanup([this]() {
+	      for (auto& ts : lanes)
+		{
+		  ts->hsc.stop(false);
+		  ts->hsc.reset();
+		  ts->reset_callbacks();
+		}
+	      lanes.clear();
+	    });
+
+	  WS::ClientSet::run_synchronous([this](WS::ClientSet::Ptr cs) {
+	      const size_t n = std::min(size_t(max_parallel), changes.size());
+	      for (size_t i = 0; i < n; ++i)
+		{
+		  WS::ClientSet::TransactionSet::Ptr ts = ctx.http_context.transaction_set(ec2_host(ctx.instance_info));
+		  ts->preserve_http_state = true;
+		  ts->max_retries = 1; // retries are handled by lane_done
+		  lanes.push_back(ts);
+		  start_next(*cs, *ts);
+		}
+	    }, ctx.async_stop, ctx.http_context.rng());
+
+	  std::ostringstream errors;
+	  size_t n_errors = 0;
+	  for (const auto& c : changes)
+	    {
+	      if (!c.error.empty())
+		{
+		  errors << '\n' << c.error;
+		  ++n_errors;
+		}
+	    }
+	  const size_t n_changes = changes.size();
+	  changes.clear();
+	  if (n_errors)
+	    OPENVPN_THROW(aws_route_error, "Batch: " << n_errors << '/' << n_changes << " route changes failed:" << errors.str());
+	}
+
+      private:
+	struct Change
+	{
+	  std::string action;
+	  std::string route_table_id;
+	  std::string cidr;
+	  std::string target_type_str;
+	  std::string target_value;
+	  bool ipv6 = false;
+	  unsigned int attempts = 0;
+	  std::string error;
+	};
+
+	// take the next queued change on this lane, if any
+	void start_next(WS::ClientSet& cs, WS::ClientSet::TransactionSet& ts)
+	{
+	  if (next_change >= changes.size())
+	    {
+	      // lane is idle, close its keep-alive connection
+	      ts.hsc.stop(false);
+	      return;
+	    }
+	  const size_t index = next_change++;
+	  ts.delayed_start = Time::Duration();
+	  request(cs, ts, index);
+	}
+
+	void request(WS::ClientSet& cs, WS::ClientSet::TransactionSet& ts, const size_t index)
+	{
+	  const Change& c = changes[index];
+	  REST::Query q;
+	  q.emplace_back("Action", c.action);
+	  if (c.action == "DeleteRoute")
+	    q.emplace_back(c.ipv6 ? "DestinationIpv6CidrBlock" : "DestinationCidrBlock", c.cidr);
+	  else
+	    {
+	      q.emplace_back(c.ipv6 ? "DestinationCidrIpv6Block" : "DestinationCidrBlock", c.cidr);
+	      q.emplace_back(c.target_type_str, c.target_value);
+	    }
+	  q.emplace_back("RouteTableId", c.route_table_id);
+
+	  std::unique_ptr<WS::ClientSet::Transaction> t(new WS::ClientSet::Transaction);
+	  t->req.uri = ec2_uri(ctx, std::move(q));
+	  t->req.method = "GET";
+	  t->ci.keepalive = true;
+	  ts.transactions.clear();
+	  ts.transactions.push_back(std::move(t));
+	  ts.completion = [this, cs=&cs, index](WS::ClientSet::TransactionSet& ts) {
+	      lane_done(*cs, ts, index);
+	    };
+	  cs.new_request(&ts);
+	}
+
+	void lane_done(WS::ClientSet& cs, WS::ClientSet::TransactionSet& ts, const size_t index)
+	{
+	  Change& c = changes[index];
+	  try {
+	    const WS::ClientSet::Transaction& t = ts.first_transaction();
+	    const std::string reply = t.content_in_string();
+
+	    // throttled or transient failure
+	    if (should_retry(t, reply) && ++c.attempts < MAX_ATTEMPTS)
+	      {
+		ts.delayed_start = backoff(c.attempts);
+		request(cs, ts, index);
+		return;
+	      }
+
+	    if (returned_true(t, reply, c.action))
+	      OPENVPN_LOG("AWS EC2 " << c.action << ' ' << c.cidr << " -> table " << c.route_table_id);
+	    else if (c.action == "ReplaceRoute" && t.comm_status_success())
+	      {
+		// ReplaceRoute will legitimately fail if
+		// the route doesn't exist yet
+		c.action = "CreateRoute";
+		c.attempts = 0;
+		ts.delayed_start = Time::Duration();
+		request(cs, ts, index);
+		return;
+	      }
+	    else
+	      c.error = c.action + ' ' + c.cidr + ": " + t.format_status(ts) + '\n' + reply;
+	  }
+	  catch (const std::exception& e)
+	    {
+	      c.error = c.action + ' ' + c.cidr + ": " + e.what();
+	    }
+	  start_next(cs, ts);
+	}
+
+	static bool should_retry(const WS::ClientSet::Transaction& t, const std::string& reply)
+	{
+	  if (!t.comm_status_success() || t.reply.status_code >= 500)
+	    return true;
+	  return reply.find("<Code>RequestLimitExceeded</Code>") != std::string::npos
+	    || reply.find("<Code>Throttling</Code>") != std::string::npos;
+	}
+
+	static bool returned_true(const WS::ClientSet::Transaction& t,
+				  const std::string& reply,
+				  const std::string& action)
+	{
+	  if (!t.http_status_success())
+	    return false;
+	  const Xml::Document doc(reply, action);
+	  return Xml::find_text(&doc, action + "Response", "return") == "true";
+	}
+
+	// exponential, with jitter so that throttled lanes don't retry in step
+	Time::Duration backoff(const unsigned int attempts) const
+	{
+	  unsigned int ms = BACKOFF_BASE_MS;
+	  for (unsigned int i = 1; i < attempts && ms < BACKOFF_MAX_MS; ++i)
+	    ms *= 2;
+	  ms = std::min(ms, (unsigned int)BACKOFF_MAX_MS);
+	  ms = ms / 2 + ctx.http_context.rng()->randrange(ms / 2 + 1);
+	  return Time::Duration::milliseconds(ms);
+	}
+
+	Context& ctx;
+	const unsigned int max_parallel;
+	std::vector<Change> changes;
+	std::vector<WS::ClientSet::TransactionSet::Ptr> lanes;
+	size_t next_change = 0;
+      };
+
     private:
+      static std::string target_type_name(const RouteTargetType target_type)
+      {
+	switch (target_type)
+	{
+	case RouteTargetType::INSTANCE_ID:
+	  return "InstanceId";
+
+	case RouteTargetType::INTERFACE_ID:
+	  return "NetworkInterfaceId";
+
+	default:
+	  OPENVPN_THROW(aws_route_error,
+			"unknown RouteTargetType " << (int)target_type);
+	}
+      }
+
       static void execute_transaction(Context& ctx)
       {
 	WS::ClientSet::new_request_synchronous(ctx.ts, ctx.async_stop, ctx.http_context.rng(), true);
@@ -22,6 +22,8 @@
 #ifndef OPENVPN_BUFFER_BUFCOMPOSED_H
 #define OPENVPN_BUFFER_BUFCOMPOSED_H
 
+#include <cstring>
+
 #include <openvpn/common/exception.hpp>
 #include <openvpn/buffer/bufcomplete.hpp>
 #include <openvpn/buffer/buflist.hpp>
@@ -39,9 +41,7 @@ namespace openvpn {
 	if (iter_defined())
 	  throw Exception("BufferComposed::Complete: residual data");
 #endif
-	BufferPtr ret = bc.bv.join();
-	bc.bv.clear();
-	return ret;
+	return bc.get();
       }
 
     private:
@@ -71,16 +71,47 @@ namespace openvpn {
       BufferVector::const_iterator iter;
     };
 
+    // Total size of all composed buffers, maintained incrementally
+    // so that it can be checked on every put without re-walking
+    // the chain.
     size_t size() const
     {
-      return bv.join_size();
+      return size_;
+    }
+
+    // True if any byte appended so far is a null char.  Only the
+    // newly added buffer is scanned on each put.
+    bool null_seen() const
+    {
+      return null_seen_;
     }
 
     void put(BufferPtr bp)
     {
+      const size_t n = bp->size();
+      if (!null_seen_ && n)
+	null_seen_ = std::memchr(bp->c_data(), 0, n) != nullptr;
+      size_ += n;
       bv.push_back(std::move(bp));
     }
 
+    // Return the composed buffers as a single buffer and reset.
+    // When only one buffer has been put, it is returned as-is
+    // without copying.
+    BufferPtr get()
+    {
+      BufferPtr ret = bv.join();
+      clear();
+      return ret;
+    }
+
+    void clear()
+    {
+      bv.clear();
+      size_ = 0;
+      null_seen_ = false;
+    }
+
     Complete complete()
     {
       return Complete(*this);
@@ -88,6 +119,8 @@ namespace openvpn {
 
   private:
     BufferVector bv;
+    size_t size_ = 0;
+    bool null_seen_ = false;
   };
 }
 
@@ -63,6 +63,9 @@
 #include <openvpn/common/abort.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/allocstat.hpp>
+#include <openvpn/common/arena.hpp>
+#include <openvpn/buffer/bufpool.hpp>
 #include <openvpn/buffer/bufclamp.hpp>
 
 #ifdef OPENVPN_BUFFER_ABORT
@@ -641,6 +644,7 @@ namespace openvpn {
       DESTRUCT_ZERO  = (1<<1),  // if enabled, destructor will zero data before deletion
       GROW  = (1<<2),           // if enabled, buffer will grow (otherwise buffer_full exception will be thrown)
       ARRAY = (1<<3),           // if enabled, use as array
+      POOL  = (1<<4),           // if enabled, allocate from and release to the per-thread BufferPool
     };
 
     BufferAllocatedType()
@@ -649,13 +653,35 @@ namespace openvpn {
       flags_ = 0;
     }
 
+    // heap instances (BufferPtr) come from the thread's current
+    // Arena, if any, see openvpn/common/arena.hpp
+    static void* operator new(const std::size_t size)
+    {
+      return Arena::object_new(size);
+    }
+
+    static void operator delete(void* p) noexcept
+    {
+      Arena::object_delete(p);
+    }
+
+    // the class operator new above hides placement new
+    static void* operator new(const std::size_t, void* p) noexcept
+    {
+      return p;
+    }
+
+    static void operator delete(void*, void*) noexcept
+    {
+    }
+
     BufferAllocatedType(const size_t capacity, const unsigned int flags)
     {
       flags_ = flags;
       capacity_ = capacity;
       if (capacity)
 	{
-	  data_ = new T[capacity];
+	  data_ = alloc_(capacity, flags);
 	  if (flags & CONSTRUCT_ZERO)
 	    std::memset(data_, 0, capacity * sizeof(T));
 	  if (flags & ARRAY)
@@ -669,7 +695,7 @@ namespace openvpn {
       size_ = capacity_ = size;
       if (size)
 	{
-	  data_ = new T[size];
+	  data_ = new_array_(size);
 	  std::memcpy(data_, data, size * sizeof(T));
 	}
     }
@@ -682,7 +708,7 @@ namespace openvpn {
       flags_ = other.flags_;
       if (capacity_)
         {
-          data_ = new T[capacity_];
+          data_ = new_array_(capacity_);
           if (size_)
             std::memcpy(data_ + offset_, other.data_ + offset_, size_ * sizeof(T));
         }
@@ -698,7 +724,7 @@ namespace openvpn {
       flags_ = flags;
       if (capacity_)
 	{
-	  data_ = new T[capacity_];
+	  data_ = new_array_(capacity_);
 	  if (size_)
 	    std::memcpy(data_ + offset_, other.data_ + offset_, size_ * sizeof(T));
 	}
@@ -713,7 +739,7 @@ namespace openvpn {
 	    {
 	      erase_();
 	      if (other.capacity_)
-		data_ = new T[other.capacity_];
+		data_ = new_array_(other.capacity_);
 	      capacity_ = other.capacity_;
 	    }
 	  offset_ = other.offset_;
@@ -733,7 +759,7 @@ namespace openvpn {
 	  erase_();
 	  if (capacity)
 	    {
-	      data_ = new T[capacity];
+	      data_ = alloc_(capacity, flags);
 	    }
 	  capacity_ = capacity;
 	}
@@ -751,7 +777,7 @@ namespace openvpn {
 	{
 	  erase_();
 	  if (size)
-	    data_ = new T[size];
+	    data_ = new_array_(size);
 	  capacity_ = size;
 	}
       size_ = size;
@@ -857,10 +883,11 @@ namespace openvpn {
 
     void realloc_(const size_t newcap)
     {
-      T* data = new T[newcap];
+      T* data = new_array_(newcap);
       if (size_)
 	std::memcpy(data + offset_, data_ + offset_, size_ * sizeof(T));
       delete_(data_, capacity_, flags_);
+      flags_ &= ~POOL; // grown buffers don't belong to a pool size class
       data_ = data;
       //std::cout << "*** RESIZE " << capacity_ << " -> " << newcap << std::endl; // fixme
       capacity_ = newcap;
@@ -889,11 +916,28 @@ namespace openvpn {
       capacity_ = 0;
     }
 
+    static T* new_array_(const size_t capacity)
+    {
+      AllocStats::count_object();
+      return new T[capacity];
+    }
+
+    static T* alloc_(const size_t capacity, const unsigned int flags)
+    {
+      if (flags & POOL)
+	return BufferPool<T>::alloc(capacity);
+      else
+	return new_array_(capacity);
+    }
+
     static void delete_(T* data, const size_t size, const unsigned int flags)
     {
       if (size && (flags & DESTRUCT_ZERO))
 	std::memset(data, 0, size * sizeof(T));
-      delete [] data;
+      if (flags & POOL)
+	BufferPool<T>::release(data, size);
+      else
+	delete [] data;
     }
 
     unsigned int flags_;
@@ -0,0 +1,324 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-thread, size-classed freelist for the storage of data path
+// buffers.  BufferAllocatedType draws from and returns to this pool
+// for buffers initialized with the POOL flag (normally set by
+// Frame::Context::prepare), so that the steady-state data path does
+// not touch the global allocator.  Since the Frame contexts are
+// standardized to a common capacity, a handful of size classes
+// per thread is sufficient.  Blocks are plain new[] allocations, so
+// a block released on a different thread than the one that allocated
+// it is simply cached by the releasing thread.
+//
+// On Linux, set_huge_pages() makes the pool carve new blocks out of
+// 2 MB huge page regions rather than new[], to cut TLB misses on
+// servers with many packets in flight.  Blocks are cache line
+// aligned, so Frame::Context's align_adjust places payloads the same
+// way as in new[] blocks.  Regions are never unmapped: blocks that
+// don't fit in a thread's pool go to a process-wide freelist.
+//
+// Define OPENVPN_NO_BUFFER_POOL to make the POOL flag a no-op.
+
+#ifndef OPENVPN_BUFFER_BUFPOOL_H
+#define OPENVPN_BUFFER_BUFPOOL_H
+
+#include <cstddef> // for std::size_t
+
+#include <openvpn/common/platform.hpp>
+
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(OPENVPN_NO_BUFFER_POOL)
+#define OPENVPN_BUFFER_POOL_HUGE
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <type_traits>
+#include <openvpn/linux/hugepage.hpp>
+#endif
+
+namespace openvpn {
+
+  template <typename T>
+  class BufferPool
+  {
+  public:
+    enum {
+      N_CLASSES = 4, // max number of distinct capacities cached per thread
+      MAX_FREE = 64, // max number of free blocks cached per capacity
+    };
+
+    struct Stats
+    {
+      unsigned long long hits = 0;    // allocations satisfied by the pool
+      unsigned long long misses = 0;  // allocations that fell through to new[]
+      unsigned long long returns = 0; // blocks cached on release
+      unsigned long long drops = 0;   // blocks freed on release because the pool was full
+      unsigned long long huge = 0;    // misses satisfied from huge page regions
+    };
+
+    static T* alloc(const std::size_t capacity)
+    {
+#ifndef OPENVPN_NO_BUFFER_POOL
+      if (!dead)
+	{
+	  Pool& p = pool;
+	  SizeClass* sc = p.find(capacity, true);
+	  if (sc && sc->n_free)
+	    {
+	      ++p.stats.hits;
+	      return sc->free[--sc->n_free];
+	    }
+	  ++p.stats.misses;
+#ifdef OPENVPN_BUFFER_POOL_HUGE
+	  if (sc && huge_enabled().load(std::memory_order_relaxed))
+	    {
+	      // refill half the size class at once, to take the lock rarely
+	      sc->n_free = slab().get(capacity, sc->free, MAX_FREE / 2);
+	      if (sc->n_free)
+		{
+		  ++p.stats.huge;
+		  return sc->free[--sc->n_free];
+		}
+	    }
+#endif
+	}
+#endif
+      return new T[capacity];
+    }
+
+    static void release(T* data, const std::size_t capacity)
+    {
+#ifndef OPENVPN_NO_BUFFER_POOL
+      if (!dead)
+	{
+	  Pool& p = pool;
+	  SizeClass* sc = p.find(capacity, false);
+	  if (sc)
+	    {
+	      if (sc->n_free < MAX_FREE)
+		{
+		  ++p.stats.returns;
+		  sc->free[sc->n_free++] = data;
+		  return;
+		}
+	      ++p.stats.drops;
+	    }
+	}
+#endif
+      free_block(data, capacity);
+    }
+
+#ifdef OPENVPN_BUFFER_POOL_HUGE
+    // Carve pool blocks from huge pages, from now on.  Process-wide.
+    static void set_huge_pages(const bool enable)
+    {
+      if (std::is_trivial<T>::value)
+	huge_enabled().store(enable, std::memory_order_relaxed);
+    }
+
+    // bytes of huge page regions mapped by the pool
+    static std::size_t huge_bytes()
+    {
+      return slab().mapped();
+    }
+#endif
+
+    // pool counters for the calling thread
+    static Stats stats()
+    {
+      if (dead)
+	return Stats();
+      return pool.stats;
+    }
+
+    // free all blocks cached by the calling thread
+    static void purge()
+    {
+      if (!dead)
+	pool.purge();
+    }
+
+  private:
+    static void free_block(T* data, const std::size_t capacity)
+    {
+#ifdef OPENVPN_BUFFER_POOL_HUGE
+      if (slab().put(data, capacity))
+	return;
+#endif
+      delete [] data;
+    }
+
+#ifdef OPENVPN_BUFFER_POOL_HUGE
+    // Huge page regions, and blocks carved from them that no
+    // thread's pool had room for, shared by all threads.
+    class Slab
+    {
+    public:
+      enum {
+	ALIGN = 64, // block alignment, a cache line
+      };
+
+      // up to n blocks of capacity to out, returns the number
+      std::size_t get(const std::size_t capacity, T** out, const std::size_t n)
+      {
+	const std::size_t stride = (capacity * sizeof(T) + ALIGN - 1) & ~std::size_t(ALIGN - 1);
+	std::lock_guard<std::mutex> lock(mutex);
+	std::size_t i = 0;
+	std::vector<T*>& fl = freelist[capacity];
+	while (i < n && !fl.empty())
+	  {
+	    out[i++] = fl.back();
+	    fl.pop_back();
+	  }
+	while (i < n)
+	  {
+	    if (left < stride)
+	      {
+		const HugePage::Region r = HugePage::map(stride, false);
+		if (!r.addr)
+		  break;
+		regions.push_back(r);
+		mapped_bytes.fetch_add(r.size, std::memory_order_relaxed);
+		next = static_cast<unsigned char*>(r.addr);
+		left = r.size;
+	      }
+	    out[i++] = reinterpret_cast<T*>(next);
+	    next += stride;
+	    left -= stride;
+	  }
+	return i;
+      }
+
+      // take back data if it was carved from a region
+      bool put(T* data, const std::size_t capacity)
+      {
+	if (!mapped_bytes.load(std::memory_order_relaxed))
+	  return false;
+	const std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(data);
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const auto& r : regions)
+	  {
+	    const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(r.addr);
+	    if (addr >= base && addr < base + r.size)
+	      {
+		freelist[capacity].push_back(data);
+		return true;
+	      }
+	  }
+	return false;
+      }
+
+      std::size_t mapped() const
+      {
+	return mapped_bytes.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::mutex mutex;
+      std::vector<HugePage::Region> regions;
+      std::map<std::size_t, std::vector<T*>> freelist; // by capacity
+      unsigned char* next = nullptr; // unused part of the last region
+      std::size_t left = 0;
+      std::atomic<std::size_t> mapped_bytes{0};
+    };
+
+    // never destroyed, since blocks may be released after exit()
+    static Slab& slab()
+    {
+      static Slab* s = new Slab();
+      return *s;
+    }
+
+    static std::atomic<bool>& huge_enabled()
+    {
+      static std::atomic<bool> enabled{false};
+      return enabled;
+    }
+#endif
+
+    struct SizeClass
+    {
+      std::size_t capacity;
+      std::size_t n_free;
+      T* free[MAX_FREE];
+    };
+
+    struct Pool
+    {
+      Pool()
+      {
+	for (auto& sc : classes)
+	  sc.capacity = sc.n_free = 0;
+      }
+
+      ~Pool()
+      {
+	purge();
+	dead = true;
+      }
+
+      // Find the size class for capacity, optionally claiming
+      // an unused slot for it.
+      SizeClass* find(const std::size_t capacity, const bool create)
+      {
+	for (auto& sc : classes)
+	  {
+	    if (sc.capacity == capacity)
+	      return &sc;
+	    if (!sc.capacity)
+	      {
+		if (!create || !capacity)
+		  return nullptr;
+		sc.capacity = capacity;
+		return &sc;
+	      }
+	  }
+	return nullptr;
+      }
+
+      void purge()
+      {
+	for (auto& sc : classes)
+	  {
+	    while (sc.n_free)
+	      free_block(sc.free[--sc.n_free], sc.capacity);
+	  }
+      }
+
+      SizeClass classes[N_CLASSES];
+      Stats stats;
+    };
+
+    static thread_local Pool pool;
+    static thread_local bool dead; // pool has been destroyed on thread exit
+  };
+
+  template <typename T>
+  thread_local typename BufferPool<T>::Pool BufferPool<T>::pool;
+
+  template <typename T>
+  thread_local bool BufferPool<T>::dead = false;
+
+} // namespace openvpn
+
+#endif
@@ -22,7 +22,9 @@
 #ifndef OPENVPN_CLIENT_ASYNC_RESOLVE_H
 #define OPENVPN_CLIENT_ASYNC_RESOLVE_H
 
-#ifdef USE_ASIO
+#if defined(OPENVPN_ASYNC_RESOLVE_DNS)
+#include <openvpn/client/async_resolve/dns.hpp>
+#elif defined(USE_ASIO)
 #include <openvpn/client/async_resolve/asio.hpp>
 #else
 #include <openvpn/client/async_resolve/generic.hpp>
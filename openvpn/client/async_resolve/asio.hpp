@@ -54,7 +54,7 @@ namespace openvpn {
 	: io_context(io_context_arg),
 	  parent(parent_arg)
       {
-	std::thread t([self=Ptr(this), host, port]()
+	std::thread t([self=Ptr(this), host, port]() mutable
 	{
 	  openvpn_io::io_context io_context(1);
 	  openvpn_io::error_code error;
@@ -64,7 +64,9 @@ namespace openvpn {
 	  results = resolver.resolve(host, port, error);
 	  if (!self->is_detached())
 	  {
-	    self->post_callback(results, error);
+	    // hand our reference and the results over to the
+	    // completion handler rather than copying them
+	    post_callback(std::move(self), std::move(results), error);
 	  }
 	});
 	// detach the thread so that the client won't need to wait for
@@ -83,17 +85,19 @@ namespace openvpn {
 	return detached.load(std::memory_order_relaxed);
       }
 
-      void post_callback(typename RESOLVER_TYPE::results_type results,
-			 openvpn_io::error_code error)
+      static void post_callback(Ptr self,
+				typename RESOLVER_TYPE::results_type&& results,
+				const openvpn_io::error_code& error)
       {
-	openvpn_io::post(io_context, [self=Ptr(this), results, error]()
+	openvpn_io::io_context& io_context = self->io_context;
+	openvpn_io::post(io_context, [self=std::move(self), results=std::move(results), error]() mutable
 	{
 	  auto parent = self->parent;
 	  if (!self->is_detached() && parent)
 	  {
 	    self->detach();
 	    OPENVPN_ASYNC_HANDLER;
-	    parent->resolve_callback(error, results);
+	    parent->resolve_callback(error, std::move(results));
 	  }
 	});
       }
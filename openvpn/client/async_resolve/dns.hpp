@@ -0,0 +1,615 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Fully asynchronous stub resolver.  Instead of running getaddrinfo()
+// on a thread per request, A and AAAA queries are sent in parallel
+// over UDP to the nameservers from /etc/resolv.conf, and the answers
+// are processed on the caller's io_context.  Names listed in
+// /etc/hosts and numeric addresses are answered locally.
+
+#ifndef OPENVPN_CLIENT_ASYNC_RESOLVE_DNS_H
+#define OPENVPN_CLIENT_ASYNC_RESOLVE_DNS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <functional>
+#include <cstdint>
+#include <cctype>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/hostport.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/split.hpp>
+#include <openvpn/common/splitlines.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/time/asiotimer.hpp>
+
+namespace openvpn {
+  namespace DNSStub {
+
+    enum Type {
+      A = 1,
+      AAAA = 28,
+    };
+
+    enum RCode {
+      NOERROR = 0,
+      SERVFAIL = 2,
+      NXDOMAIN = 3,
+    };
+
+    enum {
+      PORT = 53,
+      MAX_PACKET = 1500,
+      MAX_NAME = 253,
+    };
+
+    struct Config
+    {
+      typedef std::shared_ptr<const Config> Ptr;
+
+      std::vector<IP::Addr> nameservers;
+      unsigned short port = PORT;
+      std::map<std::string, std::vector<IP::Addr>> hosts;
+      unsigned int timeout_ms = 2000; // per attempt
+      unsigned int attempts = 2;      // per nameserver
+
+      static Ptr from_system()
+      {
+	std::shared_ptr<Config> c(new Config());
+	c->parse_resolv_conf(read_file("/etc/resolv.conf"));
+	c->parse_hosts(read_file("/etc/hosts"));
+	return c;
+      }
+
+      void parse_resolv_conf(const std::string& content)
+      {
+	SplitLines in(content, 0);
+	while (in(true))
+	  {
+	    const std::vector<std::string> f = split(in.line_ref());
+	    if (f.size() >= 2 && f[0] == "nameserver")
+	      add_addr(nameservers, f[1]);
+	    else if (f.size() >= 2 && f[0] == "options")
+	      {
+		for (size_t i = 1; i < f.size(); ++i)
+		  {
+		    unsigned int v;
+		    if (string::starts_with(f[i], "timeout:") && parse_number(f[i].substr(8), v) && v)
+		      timeout_ms = v * 1000;
+		    else if (string::starts_with(f[i], "attempts:") && parse_number(f[i].substr(9), v) && v)
+		      attempts = v;
+		  }
+	      }
+	  }
+	if (nameservers.empty())
+	  nameservers.push_back(IP::Addr("127.0.0.1"));
+      }
+
+      void parse_hosts(const std::string& content)
+      {
+	SplitLines in(content, 0);
+	while (in(true))
+	  {
+	    const std::vector<std::string> f = split(in.line_ref());
+	    if (f.size() < 2 || f[0][0] == '#')
+	      continue;
+	    for (size_t i = 1; i < f.size() && f[i][0] != '#'; ++i)
+	      add_addr(hosts[string::to_lower_copy(f[i])], f[0]);
+	  }
+      }
+
+      // Return the Config used by all resolvers, loaded from the
+      // system files on first use unless set() was called before.
+      static Ptr get()
+      {
+	std::lock_guard<std::mutex> lock(global_mutex());
+	Ptr& c = global();
+	if (!c)
+	  c = from_system();
+	return c;
+      }
+
+      static void set(Ptr config)
+      {
+	std::lock_guard<std::mutex> lock(global_mutex());
+	global() = std::move(config);
+      }
+
+    private:
+      static Ptr& global()
+      {
+	static Ptr c;
+	return c;
+      }
+
+      static std::mutex& global_mutex()
+      {
+	static std::mutex m;
+	return m;
+      }
+
+      static std::string read_file(const std::string& fn)
+      {
+	try {
+	  return read_text(fn, 1024*1024);
+	}
+	catch (const std::exception&)
+	  {
+	    return std::string();
+	  }
+      }
+
+      static std::vector<std::string> split(const std::string& line)
+      {
+	return Split::by_space<std::vector<std::string>, StandardLex, SpaceMatch, Split::NullLimit>(line);
+      }
+
+      static void add_addr(std::vector<IP::Addr>& list, const std::string& str)
+      {
+	// strip scope id, e.g. fe80::1%eth0
+	const std::string a = str.substr(0, str.find('%'));
+	if (IP::Addr::is_valid(a))
+	  list.push_back(IP::Addr(a));
+      }
+    };
+
+    // Encode a single-question recursive query for name.
+    inline bool encode_query(std::vector<unsigned char>& out,
+			     const std::uint16_t id,
+			     const std::string& name,
+			     const Type type)
+    {
+      out.clear();
+      if (name.empty() || name.length() > MAX_NAME)
+	return false;
+      const unsigned char hdr[12] = {
+	(unsigned char)(id >> 8), (unsigned char)id,
+	0x01, 0x00, // RD
+	0x00, 0x01, // QDCOUNT
+	0, 0, 0, 0, 0, 0,
+      };
+      out.insert(out.end(), hdr, hdr + sizeof(hdr));
+      size_t label = 0;
+      while (label < name.length())
+	{
+	  size_t dot = name.find('.', label);
+	  if (dot == std::string::npos)
+	    dot = name.length();
+	  const size_t len = dot - label;
+	  if (len == 0 || len > 63)
+	    return false;
+	  out.push_back((unsigned char)len);
+	  out.insert(out.end(), name.begin() + label, name.begin() + dot);
+	  label = dot + 1;
+	}
+      out.push_back(0);
+      out.push_back(0);
+      out.push_back((unsigned char)type);
+      out.push_back(0);
+      out.push_back(1); // IN
+      return true;
+    }
+
+    // Skip over a possibly compressed name, returning false if it
+    // runs past the end of the message.
+    inline bool skip_name(const unsigned char *data, const size_t size, size_t& pos)
+    {
+      while (pos < size)
+	{
+	  const unsigned char len = data[pos];
+	  if ((len & 0xC0) == 0xC0)
+	    {
+	      pos += 2;
+	      return pos <= size;
+	    }
+	  else if (len & 0xC0)
+	    return false;
+	  pos += len + 1;
+	  if (!len)
+	    return pos <= size;
+	}
+      return false;
+    }
+
+    // Check that the question at pos is for name, type and class IN,
+    // comparing labels case-insensitively, and advance past it.
+    // Compression is not accepted here since the question is the
+    // first name in the message.
+    inline bool match_question(const unsigned char *data, const size_t size, size_t& pos,
+			       const std::string& name, const Type type)
+    {
+      size_t label = 0;
+      while (true)
+	{
+	  if (pos >= size)
+	    return false;
+	  const size_t len = data[pos++];
+	  if (!len)
+	    break;
+	  if (len > 63 || pos + len > size || label >= name.length())
+	    return false;
+	  size_t dot = name.find('.', label);
+	  if (dot == std::string::npos)
+	    dot = name.length();
+	  if (dot - label != len)
+	    return false;
+	  for (size_t i = 0; i < len; ++i)
+	    if (std::tolower(data[pos + i]) != std::tolower((unsigned char)name[label + i]))
+	      return false;
+	  pos += len;
+	  label = dot + 1;
+	}
+      if (label < name.length() || pos + 4 > size)
+	return false;
+      const unsigned int qtype = (data[pos] << 8) | data[pos+1];
+      const unsigned int qclass = (data[pos+2] << 8) | data[pos+3];
+      pos += 4;
+      return qtype == (unsigned int)type && qclass == 1;
+    }
+
+    // Decode the response to the query with the given id, name and
+    // type, appending any addresses of that type found in the answer
+    // section.  Returns false if the message is not a response to
+    // that query, either because the id or the question section does
+    // not match, in which case it should be ignored.
+    inline bool decode_response(const unsigned char *data,
+				const size_t size,
+				const std::uint16_t id,
+				const std::string& name,
+				const Type type,
+				std::vector<IP::Addr>& addrs,
+				int& rcode)
+    {
+      if (size < 12)
+	return false;
+      if ((std::uint16_t)((data[0] << 8) | data[1]) != id || !(data[2] & 0x80))
+	return false;
+      const unsigned int qdcount = (data[4] << 8) | data[5];
+      const unsigned int ancount = (data[6] << 8) | data[7];
+      size_t pos = 12;
+      if (qdcount != 1 || !match_question(data, size, pos, name, type))
+	return false;
+      rcode = data[3] & 0x0F;
+      for (unsigned int i = 0; i < ancount; ++i)
+	{
+	  if (!skip_name(data, size, pos) || pos + 10 > size)
+	    return true;
+	  const unsigned int rtype = (data[pos] << 8) | data[pos+1];
+	  const unsigned int rclass = (data[pos+2] << 8) | data[pos+3];
+	  const size_t rdlen = (data[pos+8] << 8) | data[pos+9];
+	  pos += 10;
+	  if (pos + rdlen > size)
+	    return true;
+	  if (rclass == 1 && rtype == (unsigned int)type)
+	    {
+	      if (type == A && rdlen == 4)
+		addrs.push_back(IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(data + pos)));
+	      else if (type == AAAA && rdlen == 16)
+		addrs.push_back(IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(data + pos)));
+	    }
+	  pos += rdlen;
+	}
+      return true;
+    }
+
+    // A single name lookup, resolved into endpoints of PROTO.
+    template <typename PROTO>
+    class Query : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Query> Ptr;
+      typedef typename PROTO::resolver::results_type results_type;
+      typedef std::function<void(const openvpn_io::error_code&, results_type)> Callback;
+
+      Query(openvpn_io::io_context& io_context_arg,
+	    Config::Ptr config_arg,
+	    Callback callback_arg)
+	: io_context(io_context_arg),
+	  config(std::move(config_arg)),
+	  socket(io_context_arg),
+	  timer(io_context_arg),
+	  callback(std::move(callback_arg))
+      {
+      }
+
+      void start(const std::string& host_arg, const std::string& port_arg)
+      {
+	host = host_arg;
+	port = port_arg;
+	unsigned int port_num;
+	if (!parse_number_validate<unsigned int>(port, 5, 0, 65535, &port_num))
+	  return post_finish(openvpn_io::error::service_not_found);
+	port_number = (unsigned short)port_num;
+
+	// numeric address
+	if (IP::Addr::is_valid(host))
+	  {
+	    addrs[0].push_back(IP::Addr(host));
+	    return post_finish(openvpn_io::error_code());
+	  }
+
+	// /etc/hosts
+	std::string name = string::to_lower_copy(host);
+	if (!name.empty() && name.back() == '.')
+	  name.pop_back();
+	{
+	  const auto h = config->hosts.find(name);
+	  if (h != config->hosts.end())
+	    {
+	      addrs[0] = h->second;
+	      return post_finish(openvpn_io::error_code());
+	    }
+	}
+
+	qname = name;
+	if (config->nameservers.empty()
+	    || !encode_query(pending[0].query, 0, name, A)
+	    || !encode_query(pending[1].query, 0, name, AAAA))
+	  return post_finish(openvpn_io::error::host_not_found);
+	pending[0].type = A;
+	pending[1].type = AAAA;
+	send_queries();
+      }
+
+      // Abandon the query without calling back.
+      void cancel()
+      {
+	callback = nullptr;
+	close();
+      }
+
+    private:
+      struct Pending
+      {
+	std::vector<unsigned char> query;
+	Type type = A;
+	std::uint16_t id = 0;
+	bool done = false;
+      };
+
+      static std::mt19937& rng()
+      {
+	static thread_local std::mt19937 r{std::random_device{}()};
+	return r;
+      }
+
+      void send_queries()
+      {
+	const IP::Addr& ns = config->nameservers[ns_index % config->nameservers.size()];
+	ns_endpoint = openvpn_io::ip::udp::endpoint(ns.to_asio(), config->port);
+
+	// a fresh socket, and so a fresh source port, per attempt
+	openvpn_io::error_code ec;
+	socket.close(ec);
+	socket.open(ns_endpoint.protocol(), ec);
+	if (!ec)
+	  {
+	    for (auto& p : pending)
+	      {
+		if (p.done)
+		  continue;
+		p.id = (std::uint16_t)rng()();
+		if (&p == &pending[1] && p.id == pending[0].id)
+		  p.id ^= 1;
+		p.query[0] = (unsigned char)(p.id >> 8);
+		p.query[1] = (unsigned char)p.id;
+		socket.send_to(openvpn_io::buffer(p.query), ns_endpoint, 0, ec);
+		if (ec)
+		  break;
+	      }
+	  }
+	if (ec)
+	  return next_attempt();
+
+	queue_recv();
+	timer.expires_after(Time::Duration::milliseconds(config->timeout_ms));
+	timer.async_wait([self=Ptr(this), gen=attempt](const openvpn_io::error_code& error)
+			 {
+			   OPENVPN_ASYNC_HANDLER;
+			   if (!error && gen == self->attempt)
+			     self->next_attempt();
+			 });
+      }
+
+      void next_attempt()
+      {
+	if (!callback)
+	  return;
+	++attempt;
+	++ns_index;
+	if (attempt >= config->attempts * config->nameservers.size())
+	  finish(openvpn_io::error::timed_out);
+	else
+	  send_queries();
+      }
+
+      void queue_recv()
+      {
+	socket.async_receive_from(openvpn_io::buffer(recv_buf, sizeof(recv_buf)), recv_endpoint,
+				  [self=Ptr(this), gen=attempt](const openvpn_io::error_code& error, const size_t bytes)
+				  {
+				    OPENVPN_ASYNC_HANDLER;
+				    if (gen == self->attempt)
+				      self->handle_recv(error, bytes);
+				  });
+      }
+
+      void handle_recv(const openvpn_io::error_code& error, const size_t bytes)
+      {
+	if (!callback || error == openvpn_io::error::operation_aborted)
+	  return;
+	if (error)
+	  return next_attempt();
+	if (recv_endpoint == ns_endpoint)
+	  {
+	    for (size_t i = 0; i < 2; ++i)
+	      {
+		Pending& p = pending[i];
+		int rcode = NOERROR;
+		if (p.done || !decode_response(recv_buf, bytes, p.id, qname, p.type, addrs[i], rcode))
+		  continue;
+		if (rcode == SERVFAIL)
+		  {
+		    // let the next nameserver have a go
+		    addrs[i].clear();
+		    continue;
+		  }
+		p.done = true;
+		if (pending[0].done && pending[1].done)
+		  return finish(addrs[0].empty() && addrs[1].empty()
+				? openvpn_io::error_code(openvpn_io::error::host_not_found)
+				: openvpn_io::error_code());
+	      }
+	  }
+	queue_recv();
+      }
+
+      void post_finish(const openvpn_io::error_code& error)
+      {
+	openvpn_io::post(io_context, [self=Ptr(this), error]()
+			 {
+			   OPENVPN_ASYNC_HANDLER;
+			   self->finish(error);
+			 });
+      }
+
+      void finish(openvpn_io::error_code error)
+      {
+	close();
+	Callback cb;
+	cb.swap(callback);
+	if (!cb)
+	  return;
+
+	// take what we have if one of the two queries timed out
+	if (error == openvpn_io::error::timed_out && (!addrs[0].empty() || !addrs[1].empty()))
+	  error = openvpn_io::error_code();
+
+	std::vector<typename PROTO::endpoint> endpoints;
+	if (!error)
+	  {
+	    for (const auto& list : addrs)
+	      for (const auto& addr : list)
+		endpoints.emplace_back(addr.to_asio(), port_number);
+	  }
+	cb(error, results_type::create(endpoints.begin(), endpoints.end(), host, port));
+      }
+
+      void close()
+      {
+	openvpn_io::error_code ec;
+	socket.close(ec);
+	timer.cancel();
+      }
+
+      openvpn_io::io_context& io_context;
+      Config::Ptr config;
+      openvpn_io::ip::udp::socket socket;
+      AsioTimer timer;
+      Callback callback;
+
+      std::string host;
+      std::string qname;
+      std::string port;
+      unsigned short port_number = 0;
+
+      Pending pending[2];
+      std::vector<IP::Addr> addrs[2]; // A, AAAA
+
+      openvpn_io::ip::udp::endpoint ns_endpoint;
+      openvpn_io::ip::udp::endpoint recv_endpoint;
+      unsigned char recv_buf[MAX_PACKET];
+      size_t ns_index = 0;
+      size_t attempt = 0;
+    };
+  }
+
+  // Named apart from the getaddrinfo()-based AsyncResolvable so that
+  // both can be linked into one program; async_resolve.hpp aliases
+  // it to AsyncResolvable when OPENVPN_ASYNC_RESOLVE_DNS is defined.
+  template<typename RESOLVER_TYPE>
+  class AsyncResolvableDNS
+  {
+  private:
+    typedef DNSStub::Query<typename RESOLVER_TYPE::protocol_type> Query;
+
+    openvpn_io::io_context& io_context;
+    typename Query::Ptr query;
+
+  public:
+    AsyncResolvableDNS(openvpn_io::io_context& io_context_arg)
+      : io_context(io_context_arg)
+    {
+    }
+
+    virtual ~AsyncResolvableDNS()
+    {
+      async_resolve_cancel();
+    }
+
+    virtual void resolve_callback(const openvpn_io::error_code& error,
+				  typename RESOLVER_TYPE::results_type results) = 0;
+
+    // Starting a new resolve abandons the previous one, if any.
+    void async_resolve_name(const std::string& host, const std::string& port)
+    {
+      async_resolve_cancel();
+      query.reset(new Query(io_context, DNSStub::Config::get(),
+			    [this](const openvpn_io::error_code& error,
+				   typename RESOLVER_TYPE::results_type results)
+			    {
+			      query.reset();
+			      resolve_callback(error, results);
+			    }));
+      query->start(host, port);
+    }
+
+    // no-op: the pending socket and timer keep the io_context busy
+    void async_resolve_lock()
+    {
+    }
+
+    void async_resolve_cancel()
+    {
+      if (query)
+	{
+	  query->cancel();
+	  query.reset();
+	}
+    }
+  };
+
+#if defined(OPENVPN_ASYNC_RESOLVE_DNS)
+  template<typename RESOLVER_TYPE>
+  using AsyncResolvable = AsyncResolvableDNS<RESOLVER_TYPE>;
+#endif
+}
+
+#endif /* OPENVPN_CLIENT_ASYNC_RESOLVE_DNS_H */
@@ -51,12 +51,15 @@
 
 #include <memory>
 #include <utility>
+#include <vector>
+#include <algorithm>
 
 #include <openvpn/common/bigmutex.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/asio/asiowork.hpp>
 #include <openvpn/error/excode.hpp>
 #include <openvpn/time/asiotimer.hpp>
+#include <openvpn/ssl/sslexecasio.hpp>
 #include <openvpn/client/cliopt.hpp>
 #include <openvpn/client/remotelist.hpp>
 #include <openvpn/client/clilife.hpp>
@@ -91,8 +94,13 @@ namespace openvpn {
 	server_poll_timer(io_context_arg),
 	restart_wait_timer(io_context_arg),
 	conn_timer(io_context_arg),
-	conn_timer_pending(false)
+	conn_timer_pending(false),
+	race_timer(io_context_arg)
     {
+      // External PKI signatures may take a network round trip,
+      // keep them off the client thread
+      if (client_options->async_external_pki())
+	ssl_pool.reset(new SSLThreadPool(1));
     }
 
     void start()
@@ -143,9 +151,14 @@ namespace openvpn {
 	      client->tun_set_disconnect();
 	      client->stop(false);
 	    }
+	  stop_racers();
 	  cancel_timers();
 	  asio_work.reset();
 
+	  // wait for in-flight handshake work before io_context goes away
+	  if (ssl_pool)
+	    ssl_pool->stop();
+
 	  client_options->finalize(true);
 
 	  if (lifecycle_started)
@@ -190,6 +203,7 @@ namespace openvpn {
 	      client->stop(false);
 	      interim_finalize();
 	    }
+	  stop_racers();
 	  cancel_timers();
 	  asio_work.reset(new AsioWork(io_context));
 	  ClientEvent::Base::Ptr ev = new ClientEvent::Pause(reason);
@@ -216,6 +230,11 @@ namespace openvpn {
 	{
 	  if (seconds < 0)
 	    seconds = 0;
+	  if (seconds == 0 && client && client->fast_reconnect())
+	    {
+	      OPENVPN_LOG("Client reconnect, trying fast reconnect");
+	      return;
+	    }
 	  OPENVPN_LOG("Client terminated, reconnecting in " << seconds << "...");
 	  server_poll_timer.cancel();
 	  client_options->remote_reset_cache_item();
@@ -306,6 +325,7 @@ namespace openvpn {
       server_poll_timer.cancel();
       conn_timer.cancel();
       conn_timer_pending = false;
+      race_timer.cancel();
     }
 
     void restart_wait_callback(unsigned int gen, const openvpn_io::error_code& e)
@@ -398,6 +418,148 @@ namespace openvpn {
 	}
     }
 
+    // Connection racing (RFC 8305 style).  While the primary client
+    // hasn't heard from its server, further remote entries are tried
+    // in parallel at staggered intervals.  The first session to
+    // receive a packet from its server becomes the primary client and
+    // the others are dropped.  The race is decided before the TLS
+    // handshake, so credentials are only ever sent to one server.
+    class Racer : public ClientProto::NotifyCallback,
+		  public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Racer> Ptr;
+
+      Racer(ClientConnect* parent_arg, const RemoteList::Index& index_arg)
+	: parent(parent_arg),
+	  index(index_arg)
+      {
+      }
+
+      ClientConnect* parent;
+      RemoteList::Index index; // remote list entry this racer connects to
+      Client::Ptr client;
+
+    private:
+      virtual void client_proto_first_packet() override
+      {
+	parent->race_won(this);
+      }
+
+      virtual void client_proto_terminate() override
+      {
+	parent->race_lost(this);
+      }
+    };
+
+    void schedule_race()
+    {
+      if ((int)racers.size() + 1 < client_options->connect_race() && !halt)
+	{
+	  race_timer.expires_after(client_options->connect_race_delay());
+	  race_timer.async_wait([self=Ptr(this), gen=generation](const openvpn_io::error_code& error)
+                                {
+                                  OPENVPN_ASYNC_HANDLER;
+                                  self->race_callback(gen, error);
+                                });
+	}
+    }
+
+    void race_callback(unsigned int gen, const openvpn_io::error_code& e)
+    {
+      if (e || gen != generation || halt || !client || client->first_packet_received())
+	return;
+
+      // Race the next remote entry, unless it would need a DNS lookup
+      // (the transport stores lookup results into whichever entry is
+      // current) or we have wrapped around to an entry already in the race.
+      const RemoteList::Index prev = client_options->remote_index();
+      client_options->next();
+      const RemoteList::Index index = client_options->remote_index();
+      if (!client_options->remote_cached() || racing(index))
+	{
+	  client_options->set_remote_index(prev);
+	  return;
+	}
+
+      OPENVPN_LOG("Racing connection to next remote entry...");
+      Racer::Ptr r(new Racer(this, index));
+      Client::Config::Ptr cli_config = client_options->client_config(true);
+      if (ssl_pool)
+	cli_config->proto_context_config->ssl_executor.reset(new SSLAsioExecutor(ssl_pool, io_context));
+      r->client.reset(new Client(io_context, *cli_config, r.get()));
+      racers.push_back(r);
+      r->client->start();
+      schedule_race();
+    }
+
+    bool racing(const RemoteList::Index& index) const
+    {
+      if (index.equals(client_index))
+	return true;
+      for (auto &r : racers)
+	{
+	  if (index.equals(r->index))
+	    return true;
+	}
+      return false;
+    }
+
+    // primary client heard from its server first
+    virtual void client_proto_first_packet()
+    {
+      race_timer.cancel();
+      if (!racers.empty())
+	{
+	  stop_racers();
+	  client_options->set_remote_index(client_index);
+	}
+    }
+
+    void race_won(Racer* winner)
+    {
+      const Racer::Ptr keep(winner);
+      OPENVPN_LOG("Remote entry won connection race");
+      race_timer.cancel();
+
+      // the previous primary client never heard from its server,
+      // so it has no tun to finalize
+      if (client)
+	client->stop(false);
+      client = winner->client;
+      client->set_notify_callback(this);
+      client_index = winner->index;
+      client_options->set_remote_index(client_index);
+      winner->client.reset();
+      stop_racers();
+    }
+
+    void race_lost(Racer* racer)
+    {
+      const Racer::Ptr keep(racer);
+      racers.erase(std::remove(racers.begin(), racers.end(), keep), racers.end());
+      release_racer(keep);
+    }
+
+    void stop_racers()
+    {
+      race_timer.cancel();
+      for (auto &r : racers)
+	{
+	  if (r->client)
+	    r->client->stop(false);
+	  release_racer(r);
+	}
+      racers.clear();
+    }
+
+    // racers may be released from within their own callbacks,
+    // so defer destruction
+    void release_racer(const Racer::Ptr& r)
+    {
+      openvpn_io::post(io_context, [r]() {});
+    }
+
     void queue_restart(const unsigned int delay_ms = 2000)
     {
       OPENVPN_LOG("Client terminated, restarting in " << delay_ms << " ms...");
@@ -603,6 +765,7 @@ namespace openvpn {
 	  client->stop(false);
 	  interim_finalize();
 	}
+      stop_racers();
       if (generation > 1 && !transport_factory_relay)
 	{
 	  ClientEvent::Base::Ptr ev = new ClientEvent::Reconnecting();
@@ -614,10 +777,14 @@ namespace openvpn {
 
       // client_config in cliopt.hpp
       Client::Config::Ptr cli_config = client_options->client_config(!transport_factory_relay);
+      if (ssl_pool)
+	cli_config->proto_context_config->ssl_executor.reset(new SSLAsioExecutor(ssl_pool, io_context));
       client.reset(new Client(io_context, *cli_config, this)); // build ClientProto::Session from cliproto.hpp
+      client_index = client_options->remote_index();
       client_finalized = false;
 
       // relay?
+      const bool relay = bool(transport_factory_relay);
       if (transport_factory_relay)
 	{
 	  client->transport_factory_override(std::move(transport_factory_relay));
@@ -636,6 +803,8 @@ namespace openvpn {
 	}
       conn_timer_start();
       client->start();
+      if (!relay)
+	schedule_race();
     }
 
     // ClientLifeCycle::NotifyCallback callbacks
@@ -677,6 +846,10 @@ namespace openvpn {
     bool conn_timer_pending;
     std::unique_ptr<AsioWork> asio_work;
     RemoteList::PreResolve::Ptr pre_resolve;
+    SSLThreadPool::Ptr ssl_pool; // defined if async_external_pki()
+    AsioTimer race_timer;
+    RemoteList::Index client_index; // remote list entry of primary client
+    std::vector<Racer::Ptr> racers;
   };
 
 }
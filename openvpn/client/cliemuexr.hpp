@@ -27,6 +27,7 @@
 #include <openvpn/common/exception.hpp>
 #include <openvpn/tun/client/emuexr.hpp>
 #include <openvpn/addr/addrspacesplit.hpp>
+#include <openvpn/addr/routetree.hpp>
 
 namespace openvpn {
   class EmulateExcludeRouteImpl : public EmulateExcludeRoute
@@ -106,9 +107,11 @@ namespace openvpn {
 
       // Complete address space (0.0.0.0/0 or ::/0) split into smaller networks
       // Figure out which parts of this non overlapping address we want to install
+      const IP::RouteTree include_tree(include);
+      const IP::RouteTree exclude_tree(*excludedRoutes);
       for (const auto& r: IP::AddressSpaceSplitter(rl, ip_ver_flags))
 	{
-	  if (check_route_should_be_installed(r, *excludedRoutes))
+	  if (check_route_should_be_installed(r, include_tree, exclude_tree))
 	    if (!tb->tun_builder_add_route(r.addr.to_string(), r.prefix_len, -1, r.addr.version() == IP::Addr::V6))
 	      throw emulate_exclude_route_error("tun_builder_add_route failed");
 	}
@@ -116,7 +119,9 @@ namespace openvpn {
       ipv.set_emulate_exclude_routes();
     }
 
-    bool check_route_should_be_installed(const IP::Route& r, const IP::RouteList & excludedRoutes) const
+    static bool check_route_should_be_installed(const IP::Route& r,
+						const IP::RouteTree& includedRoutes,
+						const IP::RouteTree& excludedRoutes)
       {
 	// The whole address space was partioned into NON-overlapping routes that
 	// we get one by one with the parameter r.
@@ -124,28 +129,18 @@ namespace openvpn {
 	// excluded IPs.
 	// Figure out if this particular route should be installed or not
 
-	IP::Route const* bestroute = nullptr;
 	// Get the best (longest-prefix/smallest) route from included routes that completely
 	// matches this route
-	for (const auto& incRoute: include)
-	{
-	  if (incRoute.contains(r))
-	    {
-	      if (!bestroute || bestroute->prefix_len < incRoute.prefix_len)
-		bestroute = &incRoute;
-	    }
-	}
+	const IP::Route* bestroute = includedRoutes.longest_match(r);
 
 	// No positive route matches the route at all, do not install it
 	if (!bestroute)
 	  return false;
 
 	// Check if there is a more specific exclude route
-	for (const auto& exclRoute: excludedRoutes)
-	  {
-	    if (exclRoute.contains(r) && exclRoute.prefix_len > bestroute->prefix_len)
-	      return false;
-	  }
+	const IP::Route* exclRoute = excludedRoutes.longest_match(r);
+	if (exclRoute && exclRoute->prefix_len > bestroute->prefix_len)
+	  return false;
 	return true;
       }
 
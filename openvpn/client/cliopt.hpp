@@ -36,17 +36,21 @@
 #include <openvpn/common/platform.hpp>
 #include <openvpn/common/options.hpp>
 #include <openvpn/common/stop.hpp>
+#include <openvpn/common/threadpolicy.hpp>
 #include <openvpn/frame/frame_init.hpp>
 #include <openvpn/pki/epkibase.hpp>
 #include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/random/bufrand.hpp>
 #include <openvpn/ssl/mssparms.hpp>
 #include <openvpn/tun/tunmtu.hpp>
 #include <openvpn/tun/ipv6_setting.hpp>
 #include <openvpn/netconf/hwaddr.hpp>
 
 #include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/transport/protectpool.hpp>
 #include <openvpn/transport/reconnect_notify.hpp>
 #include <openvpn/transport/client/udpcli.hpp>
+#include <openvpn/transport/client/mpcli.hpp>
 #include <openvpn/transport/client/tcpcli.hpp>
 #include <openvpn/transport/client/httpcli.hpp>
 #include <openvpn/transport/altproxy.hpp>
@@ -55,6 +59,8 @@
 #include <openvpn/client/cliopthelper.hpp>
 #include <openvpn/client/optfilt.hpp>
 #include <openvpn/client/clilife.hpp>
+#include <openvpn/client/sslfactorycache.hpp>
+#include <openvpn/crypto/hashstr.hpp>
 
 #include <openvpn/ssl/sslchoose.hpp>
 
@@ -128,8 +134,16 @@ namespace openvpn {
       Protocol proto_override;
       IPv6Setting ipv6;
       int conn_timeout = 0;
+      int connect_race = 0;            // if > 1, race up to this many remote entries when connecting
+      int connect_race_delay_ms = 250; // delay before starting each further racer
+      std::string dns_cache_file;      // if defined, persist remote DNS resolutions here
+      unsigned int dns_cache_ttl = 0;  // seconds, 0 for RemoteDNSCache::DEFAULT_TTL
+      RemoteDNSCache::Ptr dns_cache;   // if defined, a cache shared with other sessions, used instead of dns_cache_file
+      unsigned int dc_threads = 0;     // if > 1, spread AEAD data channel batches over this many threads
+      ThreadPolicy thread_policy;      // busy polling of the UDP socket
       SessionStats::Ptr cli_stats;
       ClientEvent::Queue::Ptr cli_events;
+      PacketSampler::Ptr packet_sampler;
       ProtoContextOptions::Ptr proto_context_options;
       HTTPProxyTransport::Options::Ptr http_proxy_options;
       bool alt_proxy = false;
@@ -137,6 +151,8 @@ namespace openvpn {
       bool echo = false;
       bool info = false;
       bool tun_persist = false;
+      unsigned int fast_reconnect = 0; // seconds, if > 0 try to keep the session across UDP transport restarts
+      bool battery_saver = false;      // coalesce keepalives with other wakeups, adapt the ping interval
       bool wintun = false;
       bool google_dns_fallback = false;
       bool synchronous_dns_lookup = false;
@@ -147,9 +163,12 @@ namespace openvpn {
       bool force_aes_cbc_ciphersuites = false;
       bool autologin_sessions = false;
       bool retry_on_auth_failed = false;
+      bool async_external_pki = false; // run handshakes on an SSL thread if external_pki is set
       bool allow_local_lan_access = false;
       std::string tls_version_min_override;
       std::string tls_cert_profile_override;
+      bool ssl_factory_cache = false;  // reuse SSL factories across connects, see SSLFactoryCache
+      bool protect_pool = false;       // protect transport sockets ahead of time, see ProtectedSocketPool
       PeerInfo::Set::Ptr extra_peer_info;
 #ifdef OPENVPN_GREMLIN
       Gremlin::Config::Ptr gremlin_config;
@@ -182,12 +201,16 @@ namespace openvpn {
 	reconnect_notify(config.reconnect_notify),
 	cli_stats(config.cli_stats),
 	cli_events(config.cli_events),
+	packet_sampler(config.packet_sampler),
 	server_poll_timeout_(10),
 	server_override(config.server_override),
 	port_override(config.port_override),
 	proto_override(config.proto_override),
 	conn_timeout_(config.conn_timeout),
+	connect_race_(config.remote_override ? 0 : config.connect_race),
+	connect_race_delay_ms(config.connect_race_delay_ms),
 	tcp_queue_limit(64),
+	fast_reconnect_grace(Time::Duration::seconds(config.fast_reconnect)),
 	proto_context_options(config.proto_context_options),
 	http_proxy_options(config.http_proxy_options),
 #ifdef OPENVPN_GREMLIN
@@ -200,7 +223,8 @@ namespace openvpn {
 	creds_locked(false),
 	asio_work_always_on_(false),
 	synchronous_dns_lookup(false),
-	retry_on_auth_failed_(config.retry_on_auth_failed)
+	retry_on_auth_failed_(config.retry_on_auth_failed),
+	async_external_pki_(config.external_pki && config.async_external_pki)
 #ifdef OPENVPN_EXTERNAL_TRANSPORT_FACTORY
 	,extern_transport_factory(config.extern_transport_factory)
 #endif
@@ -216,9 +240,13 @@ namespace openvpn {
       // digest factory
       DigestFactory::Ptr digest_factory(new CryptoDigestFactory<SSLLib::CryptoAPI>());
 
+      // sockets protected ahead of time
+      if (config.protect_pool && socket_protect && socket_protect->socket_protect_ahead())
+	protect_pool.reset(new ProtectedSocketPool(socket_protect));
+
       // initialize RNG/PRNG
       rng.reset(new SSLLib::RandomAPI(false));
-      prng.reset(new SSLLib::RandomAPI(true));
+      prng.reset(new BufferedRandom(rng));
 
 #if defined(ENABLE_DCO) && !defined(OPENVPN_FORCE_TUN_NULL) && !defined(OPENVPN_EXTERNAL_TUN_FACTORY)
       if (config.dco)
@@ -231,11 +259,54 @@ namespace openvpn {
       // frame
       const unsigned int tun_mtu = parse_tun_mtu(opt, 0); // get tun-mtu parameter from config
       const MSSCtrlParms mc(opt);
-      frame = frame_init(true, tun_mtu, mc.mssfix_ctrl, true);
+      const size_t data_align = opt.get_num<size_t>("data-align", 1, 0, 0, 64); // AEAD payload alignment
+      if (data_align && data_align != 16 && data_align != 32 && data_align != 64)
+	throw option_error("data-align must be 16, 32 or 64");
+      frame = frame_init(true, tun_mtu, mc.mssfix_ctrl, true, data_align);
+
+      // data channel crypto pipeline, shared by all keys of the session
+      if (config.dc_threads > 1 && !dco)
+	dc_pipeline.reset(new DCPipeline(config.dc_threads));
+
+      // busy polling of the UDP socket
+      thread_policy = config.thread_policy;
 
       // TCP queue limit
       tcp_queue_limit = opt.get_num<decltype(tcp_queue_limit)>("tcp-queue-limit", 1, tcp_queue_limit, 1, 65536);
 
+      // UDP socket buffer auto-tuning: grow on drops up to this size
+      udp_buffer_max = opt.get_num<decltype(udp_buffer_max)>("udp-buffer-max", 1, 0, 0, 64*1024*1024);
+
+      // UDP recvmmsg()/sendmmsg() batching and GSO
+      udp_batching.load(opt);
+
+      // UDP I/O through io_uring where the kernel supports it
+      udp_io_uring = opt.exists("io-uring");
+
+      // TCP send queue: drop bulk data queued for longer than this
+      tcp_queue_target_ms = opt.get_num<decltype(tcp_queue_target_ms)>("tcp-queue-target", 1, 0, 0, 10000);
+
+      // TCP socket: limit the unsent data queued in the kernel
+      tcp_notsent_lowat = opt.get_num<decltype(tcp_notsent_lowat)>("tcp-notsent-lowat", 1, 0, 0, 16*1024*1024);
+
+      // ECN and DSCP of tunneled packets on the outer UDP packets
+      ecn = opt.exists("ecn");
+      passtos = opt.exists("passtos");
+
+      // multipath: one UDP path per local address
+      {
+	const OptionList::IndexList* mp = opt.get_index_ptr("multipath-link");
+	if (mp)
+	  {
+	    for (const auto i : *mp)
+	      {
+		const Option& o = opt[i];
+		o.touch();
+		multipath_links.push_back(IP::Addr(o.get(1, 64), "multipath-link").to_string());
+	      }
+	  }
+      }
+
       // route-nopull
       pushed_options_filter.reset(new PushedOptionsFilter(opt.exists("route-nopull")));
 
@@ -266,8 +337,15 @@ namespace openvpn {
 
       // If running in tun_persist mode, we need to do basic DNS caching so that
       // we can avoid emitting DNS requests while the tunnel is blocked during
-      // reconnections.
-      remote_list->set_enable_cache(config.tun_persist);
+      // reconnections.  Connection racing also relies on the cache, since
+      // all remote entries need to be resolved before racing them, as does
+      // the persistent DNS cache, which is consulted during pre-resolve.
+      RemoteDNSCache::Ptr dns_cache = config.dns_cache;
+      if (!dns_cache && !config.dns_cache_file.empty())
+	dns_cache.reset(new RemoteDNSCache(config.dns_cache_file, config.dns_cache_ttl));
+      if (dns_cache)
+	remote_list->set_dns_cache(dns_cache);
+      remote_list->set_enable_cache(config.tun_persist || connect_race_ > 1 || dns_cache);
 
       // process server/port overrides
       remote_list->set_server_override(config.server_override);
@@ -413,6 +491,7 @@ namespace openvpn {
 	    tunconf->frame = frame;
 	    tunconf->stats = cli_stats;
 	    tunconf->stop = config.stop;
+	    tunconf->drain_budget = opt.get_num<unsigned int>("tun-drain", 1, 0, 0, 4096);
 	    if (config.tun_persist)
 	    {
 	      tunconf->tun_persist.reset(new TunMac::TunPersist(true, false, nullptr));
@@ -591,6 +670,40 @@ namespace openvpn {
       remote_list->reset_cache_item();
     }
 
+    // Position in the remote list, used by ClientConnect to remember
+    // which entry each racing session was started with.
+    RemoteList::Index remote_index() const
+    {
+      return remote_list->current_index();
+    }
+
+    void set_remote_index(const RemoteList::Index& index)
+    {
+      remote_list->set_index(index);
+      load_transport_config();
+    }
+
+    // true if the current remote entry can be connected to without
+    // a DNS lookup
+    bool remote_cached() const
+    {
+      return remote_list->endpoint_available(nullptr, nullptr, nullptr);
+    }
+
+    // Maximum number of sessions to race, or 0/1 to connect to one
+    // remote entry at a time.  Not supported through proxies or DCO.
+    int connect_race() const
+    {
+      if (dco || alt_proxy || http_proxy_options || remote_list->size() < 2)
+	return 0;
+      return connect_race_;
+    }
+
+    Time::Duration connect_race_delay() const
+    {
+      return Time::Duration::milliseconds(connect_race_delay_ms);
+    }
+
     bool pause_on_connection_timeout()
     {
       if (reconnect_notify)
@@ -604,6 +717,11 @@ namespace openvpn {
       return retry_on_auth_failed_;
     }
 
+    bool async_external_pki() const
+    {
+      return async_external_pki_;
+    }
+
     Client::Config::Ptr client_config(const bool relay_mode)
     {
       Client::Config::Ptr cli_config = new Client::Config;
@@ -611,6 +729,10 @@ namespace openvpn {
       // Copy ProtoConfig so that modifications due to server push will
       // not persist across client instantiations.
       cli_config->proto_context_config.reset(new Client::ProtoConfig(proto_config_cached(relay_mode)));
+#ifdef SSL_LIB_CLIENT_SESSION_TICKETS
+      // offer the session cached by the last connection to this server
+      cli_config->proto_context_config->ssl_cache_key = remote_list->current_server_host();
+#endif
 
       cli_config->proto_context_options = proto_context_options;
       cli_config->push_base = push_base;
@@ -618,9 +740,13 @@ namespace openvpn {
       cli_config->tun_factory = tun_factory;
       cli_config->cli_stats = cli_stats;
       cli_config->cli_events = cli_events;
+      cli_config->packet_sampler = packet_sampler;
       cli_config->creds = creds;
       cli_config->pushed_options_filter = pushed_options_filter;
       cli_config->tcp_queue_limit = tcp_queue_limit;
+      cli_config->ecn = ecn;
+      cli_config->passtos = passtos;
+      cli_config->fast_reconnect_grace = fast_reconnect_grace;
       cli_config->echo = echo;
       cli_config->info = info;
       cli_config->autologin_sessions = autologin_sessions;
@@ -690,6 +816,20 @@ namespace openvpn {
     {
       if (tun_factory)
 	tun_factory->finalize(disconnected);
+      if (disconnected && protect_pool)
+	protect_pool->stop();
+    }
+
+    ~ClientOptions()
+    {
+      // return cached SSL factories no longer referenced elsewhere
+      if (ssl_factories.empty())
+	return;
+      cp_main.reset();
+      cp_relay.reset();
+      for (auto& e : ssl_factories)
+	if (e.second.factory->use_count() == 1)
+	  SSLFactoryCache::instance().put(e.first, std::move(e.second));
     }
 
   private:
@@ -718,35 +858,49 @@ namespace openvpn {
       if (opt.exists("allow-name-constraints"))
 	lflags |= SSLConfigAPI::LF_ALLOW_NAME_CONSTRAINTS;
 
-      // client SSL config
-      SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
-      cc->set_external_pki_callback(config.external_pki);
-      cc->set_frame(frame);
-      cc->set_flags(SSLConst::LOG_VERIFY_STATUS);
-      cc->set_debug_level(config.ssl_debug_level);
-      cc->set_rng(rng);
-      cc->set_local_cert_enabled(pcc.clientCertEnabled() && !config.disable_client_cert);
-      cc->set_private_key_password(config.private_key_password);
-      cc->set_force_aes_cbc_ciphersuites(config.force_aes_cbc_ciphersuites);
-      cc->load(opt, lflags);
-      cc->set_tls_version_min_override(config.tls_version_min_override);
-      cc->set_tls_cert_profile_override(config.tls_cert_profile_override);
-      if (!cc->get_mode().is_client())
-	throw option_error("only client configuration supported");
-
       // client ProtoContext config
       Client::ProtoConfig::Ptr cp(new Client::ProtoConfig());
       cp->relay_mode = relay_mode;
-      cp->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, cli_stats, prng));
+      cp->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, cli_stats, prng, dc_pipeline));
+      cp->dc_batch_decrypt = bool(dc_pipeline);
       cp->dc_deferred = true; // defer data channel setup until after options pull
       cp->tls_auth_factory.reset(new CryptoOvpnHMACFactory<SSLLib::CryptoAPI>());
       cp->tls_crypt_factory.reset(new CryptoTLSCryptFactory<SSLLib::CryptoAPI>());
       cp->tls_crypt_metadata_factory.reset(new CryptoTLSCryptMetadataFactory());
       cp->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
-      cp->ssl_factory = cc->new_factory();
+
+      // The SSL factory comes from the process-wide cache if enabled,
+      // except with external PKI, whose callbacks belong to this
+      // connect only.
+      if (config.ssl_factory_cache && !config.external_pki)
+	{
+	  const std::string key = ssl_factory_key(opt, config, pcc, lflags);
+	  SSLFactoryCache::Entry entry;
+	  if (SSLFactoryCache::instance().take(key, entry))
+	    {
+	      OPENVPN_LOG("Reusing cached SSL context");
+	      entry.touch(opt);
+	    }
+	  else
+	    {
+	      const std::vector<bool> untouched = SSLFactoryCache::Entry::untouched(opt);
+	      entry.factory = new_ssl_factory(opt, config, pcc, lflags);
+	      entry.set_touched(opt, untouched);
+	    }
+	  cp->ssl_factory = entry.factory;
+	  ssl_factories.emplace_back(key, std::move(entry));
+	}
+      else
+	cp->ssl_factory = new_ssl_factory(opt, config, pcc, lflags);
+
       cp->load(opt, *proto_context_options, config.default_key_direction, false);
       cp->set_xmit_creds(!autologin || pcc.hasEmbeddedPassword() || autologin_sessions);
       cp->force_aes_cbc_ciphersuites = config.force_aes_cbc_ciphersuites; // also used to disable proto V2
+      if (config.battery_saver)
+	{
+	  cp->housekeeping_slack = Time::Duration::seconds(2);
+	  cp->keepalive_ping_max = Time::Duration::seconds(120);
+	}
       cp->extra_peer_info = build_peer_info(config, pcc, autologin_sessions);
       cp->frame = frame;
       cp->now = &now_;
@@ -756,6 +910,80 @@ namespace openvpn {
       return cp;
     }
 
+    SSLFactoryAPI::Ptr new_ssl_factory(const OptionList& opt,
+				       const Config& config,
+				       const ParseClientConfig& pcc,
+				       const unsigned int lflags)
+    {
+      // client SSL config
+      SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
+      cc->set_external_pki_callback(config.external_pki);
+      cc->set_frame(frame);
+      cc->set_flags(SSLConst::LOG_VERIFY_STATUS);
+      cc->set_debug_level(config.ssl_debug_level);
+      cc->set_rng(rng);
+      cc->set_local_cert_enabled(pcc.clientCertEnabled() && !config.disable_client_cert);
+      cc->set_private_key_password(config.private_key_password);
+      cc->set_force_aes_cbc_ciphersuites(config.force_aes_cbc_ciphersuites);
+      cc->load(opt, lflags);
+      cc->set_tls_version_min_override(config.tls_version_min_override);
+      cc->set_tls_cert_profile_override(config.tls_cert_profile_override);
+#ifdef SSL_LIB_CLIENT_SESSION_TICKETS
+      cc->set_client_session_tickets(true); // resume on reconnect, see client_config()
+#endif
+      if (!cc->get_mode().is_client())
+	throw option_error("only client configuration supported");
+      return cc->new_factory();
+    }
+
+    // Digest of everything new_ssl_factory() builds from.  The
+    // profile is hashed whole, so that cert, key and CA edits or any
+    // option the SSL config reads all give a new key.
+    static std::string ssl_factory_key(const OptionList& opt,
+				       const Config& config,
+				       const ParseClientConfig& pcc,
+				       const unsigned int lflags)
+    {
+      CryptoDigestFactory<SSLLib::CryptoAPI> digest_factory;
+      HashString h(digest_factory, CryptoAlgs::SHA256);
+      h.update(opt.render(Option::RENDER_BRACKET));
+      h.update('\0');
+      h.update(std::to_string(lflags));
+      h.update(pcc.clientCertEnabled() && !config.disable_client_cert ? 'C' : '-');
+      h.update(config.force_aes_cbc_ciphersuites ? 'A' : '-');
+      h.update(std::to_string(config.ssl_debug_level));
+      h.update('\0');
+      h.update(config.private_key_password);
+      h.update('\0');
+      h.update(config.tls_version_min_override);
+      h.update('\0');
+      h.update(config.tls_cert_profile_override);
+      return h.final_hex();
+    }
+
+    UDPTransport::ClientConfig::Ptr udp_transport_config(const std::string& local_addr)
+    {
+      UDPTransport::ClientConfig::Ptr udpconf = UDPTransport::ClientConfig::new_obj();
+      udpconf->remote_list = remote_list;
+      udpconf->frame = frame;
+      udpconf->stats = cli_stats;
+      udpconf->socket_protect = socket_protect;
+      udpconf->protect_pool = protect_pool;
+      udpconf->server_addr_float = server_addr_float;
+      udpconf->tos = ecn || passtos;
+      udpconf->local_addr = local_addr;
+      udpconf->thread_policy = thread_policy;
+      udpconf->io_uring = udp_io_uring;
+      udpconf->set_batching(udp_batching);
+      // receive drops are only reported to recvmmsg() reads, so
+      // buffer auto-tuning needs udp-recv-batch > 1
+      udpconf->buffer_max = udp_buffer_max;
+#ifdef OPENVPN_GREMLIN
+      udpconf->gremlin_config = gremlin_config;
+#endif
+      return udpconf;
+    }
+
     std::string load_transport_config()
     {
       // get current transport protocol
@@ -816,6 +1044,7 @@ namespace openvpn {
 	  httpconf->stats = cli_stats;
 	  httpconf->digest_factory.reset(new CryptoDigestFactory<SSLLib::CryptoAPI>());
 	  httpconf->socket_protect = socket_protect;
+	  httpconf->protect_pool = protect_pool;
 	  httpconf->http_proxy_options = http_proxy_options;
 	  httpconf->rng = rng;
 #ifdef PRIVATE_TUNNEL_PROXY
@@ -828,16 +1057,15 @@ namespace openvpn {
 	  if (transport_protocol.is_udp())
 	    {
 	      // UDP transport
-	      UDPTransport::ClientConfig::Ptr udpconf = UDPTransport::ClientConfig::new_obj();
-	      udpconf->remote_list = remote_list;
-	      udpconf->frame = frame;
-	      udpconf->stats = cli_stats;
-	      udpconf->socket_protect = socket_protect;
-	      udpconf->server_addr_float = server_addr_float;
-#ifdef OPENVPN_GREMLIN
-	      udpconf->gremlin_config = gremlin_config;
-#endif
-	      transport_factory = udpconf;
+	      if (multipath_links.size() > 1)
+		{
+		  MultipathTransport::ClientConfig::Ptr mpconf = MultipathTransport::ClientConfig::new_obj();
+		  for (const auto& addr : multipath_links)
+		    mpconf->paths.push_back(udp_transport_config(addr));
+		  transport_factory = mpconf;
+		}
+	      else
+		transport_factory = udp_transport_config(multipath_links.empty() ? std::string() : multipath_links.front());
 	    }
 	  else if (transport_protocol.is_tcp()
 #ifdef OPENVPN_TLS_LINK
@@ -851,6 +1079,9 @@ namespace openvpn {
 	      tcpconf->frame = frame;
 	      tcpconf->stats = cli_stats;
 	      tcpconf->socket_protect = socket_protect;
+	      tcpconf->protect_pool = protect_pool;
+	      tcpconf->send_priority.target_ns = std::uint64_t(tcp_queue_target_ms) * 1000000;
+	      tcpconf->notsent_lowat = tcp_notsent_lowat;
 #ifdef OPENVPN_TLS_LINK
 	      if (transport_protocol.is_tls())
 		tcpconf->use_tls = true;
@@ -880,16 +1111,29 @@ namespace openvpn {
     TransportClientFactory::Ptr transport_factory;
     TunClientFactory::Ptr tun_factory;
     SocketProtect* socket_protect;
+    ProtectedSocketPool::Ptr protect_pool;
     ReconnectNotify* reconnect_notify;
     SessionStats::Ptr cli_stats;
     ClientEvent::Queue::Ptr cli_events;
+    PacketSampler::Ptr packet_sampler;
     ClientCreds::Ptr creds;
     unsigned int server_poll_timeout_;
     std::string server_override;
     std::string port_override;
     Protocol proto_override;
     int conn_timeout_;
+    int connect_race_;
+    int connect_race_delay_ms;
     unsigned int tcp_queue_limit;
+    unsigned int tcp_queue_target_ms = 0;
+    unsigned int tcp_notsent_lowat = 0;
+    int udp_buffer_max = 0;
+    UDPTransport::ClientConfig::Batching udp_batching;
+    bool udp_io_uring = false;
+    bool ecn = false;
+    bool passtos = false;
+    std::vector<std::string> multipath_links; // local addresses of multipath-link paths
+    Time::Duration fast_reconnect_grace;
     ProtoContextOptions::Ptr proto_context_options;
     HTTPProxyTransport::Options::Ptr http_proxy_options;
 #ifdef OPENVPN_GREMLIN
@@ -904,11 +1148,15 @@ namespace openvpn {
     bool asio_work_always_on_;
     bool synchronous_dns_lookup;
     bool retry_on_auth_failed_;
+    bool async_external_pki_;
     PushOptionsBase::Ptr push_base;
     OptionList::FilterBase::Ptr pushed_options_filter;
     ClientLifeCycle::Ptr client_lifecycle;
     AltProxy::Ptr alt_proxy;
     DCO::Ptr dco;
+    DCPipeline::Ptr dc_pipeline;
+    ThreadPolicy thread_policy;
+    std::vector<std::pair<std::string, SSLFactoryCache::Entry>> ssl_factories; // checked out of SSLFactoryCache
 #ifdef OPENVPN_EXTERNAL_TRANSPORT_FACTORY
     ExternalTransport::Factory* extern_transport_factory;
 #endif
@@ -50,6 +50,8 @@
 #include <openvpn/common/string.hpp>
 #include <openvpn/common/base64.hpp>
 #include <openvpn/ip/ptb.hpp>
+#include <openvpn/ip/ecn.hpp>
+#include <openvpn/transport/fec.hpp>
 #include <openvpn/tun/client/tunbase.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/transport/client/relay.hpp>
@@ -60,9 +62,11 @@
 #include <openvpn/client/cliconstants.hpp>
 #include <openvpn/client/clihalt.hpp>
 #include <openvpn/time/asiotimer.hpp>
+#include <openvpn/time/asiotimerwheel.hpp>
 #include <openvpn/time/coarsetime.hpp>
 #include <openvpn/time/durhelper.hpp>
 #include <openvpn/error/excode.hpp>
+#include <openvpn/log/pktsample.hpp>
 
 #include <openvpn/ssl/proto.hpp>
 
@@ -78,6 +82,7 @@ namespace openvpn {
     struct NotifyCallback {
       virtual void client_proto_terminate() = 0;
       virtual void client_proto_connected() {}
+      virtual void client_proto_first_packet() {} // server has responded
     };
 
     class Session : ProtoContext,
@@ -125,12 +130,17 @@ namespace openvpn {
 	PushOptionsBase::Ptr push_base;
 	TransportClientFactory::Ptr transport_factory;
 	TunClientFactory::Ptr tun_factory;
+	TimerWheel::Ptr timer_wheel; // optional, for housekeeping timers
 	SessionStats::Ptr cli_stats;
 	ClientEvent::Queue::Ptr cli_events;
 	ClientCreds::Ptr creds;
+	PacketSampler::Ptr packet_sampler; // optional, sampled pcap capture of tunnel packets
 	OptionList::Limits pushed_options_limit;
 	OptionList::FilterBase::Ptr pushed_options_filter;
 	unsigned int tcp_queue_limit = 0;
+	bool ecn = false;     // RFC 6040 ECN propagation, needs TOS support from the transport
+	bool passtos = false; // copy the DSCP of tunneled packets to the outer packets
+	Time::Duration fast_reconnect_grace; // if enabled, see Session::fast_reconnect()
 	bool echo = false;
 	bool info = false;
 	bool autologin_sessions = false;
@@ -144,21 +154,28 @@ namespace openvpn {
 	  transport_factory(config.transport_factory),
 	  tun_factory(config.tun_factory),
 	  tcp_queue_limit(config.tcp_queue_limit),
+	  ecn(config.ecn),
+	  passtos(config.passtos),
+	  fast_reconnect_grace(config.fast_reconnect_grace),
 	  notify_callback(notify_callback_arg),
-	  housekeeping_timer(io_context_arg),
+	  housekeeping_timer(config.timer_wheel ? config.timer_wheel : TimerWheel::Ptr(new AsioTimerWheel(io_context_arg)),
+			     [this]() { housekeeping_callback(); }),
 	  push_request_timer(io_context_arg),
 	  received_options(config.push_base),
 	  creds(config.creds),
 	  proto_context_options(config.proto_context_options),
 	  cli_stats(config.cli_stats),
 	  cli_events(config.cli_events),
+	  packet_sampler(config.packet_sampler),
 	  echo(config.echo),
 	  info(config.info),
 	  autologin_sessions(config.autologin_sessions),
 	  pushed_options_limit(config.pushed_options_limit),
 	  pushed_options_filter(config.pushed_options_filter),
 	  inactive_timer(io_context_arg),
-	  info_hold_timer(io_context_arg)
+	  info_hold_timer(io_context_arg),
+	  fast_reconnect_timer(io_context_arg),
+	  fec_timer(io_context_arg)
       {
 #ifdef OPENVPN_PACKET_LOG
 	packet_log.open(OPENVPN_PACKET_LOG, std::ios::binary);
@@ -174,6 +191,12 @@ namespace openvpn {
 
       bool first_packet_received() const { return first_packet_received_; }
 
+      // used by ClientConnect to adopt a session that won a connection race
+      void set_notify_callback(NotifyCallback* notify_callback_arg)
+      {
+	notify_callback = notify_callback_arg;
+      }
+
       void start()
       {
 	if (!halt)
@@ -211,6 +234,43 @@ namespace openvpn {
 	  Base::send_explicit_exit_notify();
       }
 
+      // Replace a broken UDP transport without renegotiating.  The
+      // data channel keys, peer-id and pushed options are kept, and
+      // the server floats to our new socket when it gets our next
+      // data packet.  If nothing is received from the server within
+      // fast_reconnect_grace, the session stops so that the caller
+      // falls back to a full reconnect.  Returns false if the session
+      // can't be kept.
+      bool fast_reconnect()
+      {
+	if (halt
+	    || fast_reconnect_pending
+	    || !fast_reconnect_grace.enabled()
+	    || !connected_
+	    || transport_factory->is_relay()
+	    || !transport->transport_protocol().is_udp()
+	    || Base::conf().remote_peer_id < 0
+	    || !Base::data_channel_ready())
+	  return false;
+
+	fast_reconnect_pending = true;
+	transport->stop();
+	fast_reconnect_timer.expires_after(fast_reconnect_grace);
+	fast_reconnect_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+                                        {
+                                          OPENVPN_ASYNC_HANDLER;
+                                          self->fast_reconnect_callback(error);
+                                        });
+
+	// we may be called from within the old transport object
+	openvpn_io::post(io_context, [self=Ptr(this)]()
+                         {
+                           OPENVPN_ASYNC_HANDLER;
+                           self->fast_reconnect_restart();
+                         });
+	return true;
+      }
+
       void tun_set_disconnect()
       {
 	if (tun)
@@ -234,6 +294,8 @@ namespace openvpn {
 	    push_request_timer.cancel();
 	    inactive_timer.cancel();
 	    info_hold_timer.cancel();
+	    fast_reconnect_timer.cancel();
+	    fec_timer.cancel();
 	    if (notify_callback && call_terminate_callback)
 	      notify_callback->client_proto_terminate();
 	    if (tun)
@@ -270,44 +332,91 @@ namespace openvpn {
 	return true;
       }
 
+      // transport obj calls here with incoming packets and the
+      // TOS of their outer header, if it was configured to
+      virtual void transport_recv_tos(BufferAllocated& buf, const unsigned int tos)
+      {
+	recv_tos = tos;
+	transport_recv(buf);
+	recv_tos = 0;
+      }
+
       // transport obj calls here with incoming packets
       virtual void transport_recv(BufferAllocated& buf)
       {
+	SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TRANSPORT_READ);
+	SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TRANSPORT_IO);
 	try {
 	  OPENVPN_LOG_CLIPROTO("Transport RECV " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
 
+	  // packets received in a burst are timed from the burst start
+	  const std::uint64_t recv_ns = tun_burst_active ? 0 : latency_now();
+
 	  // update current time
 	  Base::update_now();
 
 	  // update last packet received
 	  stat().update_last_packet_received(now());
 
+	  if (fast_reconnect_pending)
+	    fast_reconnect_done();
+
 	  // log connecting event (only on first packet received)
 	  if (!first_packet_received_)
 	    {
 	      ClientEvent::Base::Ptr ev = new ClientEvent::Connecting();
 	      cli_events->add_event(std::move(ev));
 	      first_packet_received_ = true;
+	      if (notify_callback)
+		notify_callback->client_proto_first_packet();
+	    }
+
+	  // strip FEC framing, and process a packet rebuilt from
+	  // parity as if received
+	  if (fec && FEC::is_fec(buf))
+	    {
+	      BufferAllocated recovered;
+	      const bool data = fec->decode(buf, recovered);
+	      if (recovered.size())
+		transport_recv(recovered);
+	      if (!data)
+		return;
 	    }
 
 	  // get packet type
 	  Base::PacketType pt = Base::packet_type(buf);
 
 	  // process packet
-	  if (pt.is_data())
+	  if (pt.is_data() && tun_burst_active && Base::conf().dc_batch_decrypt)
+	    {
+	      // data packet, decrypted with the rest of the burst
+	      queue_decrypt_burst(pt, buf);
+	    }
+	  else if (pt.is_data())
 	    {
 	      // data packet
 	      Base::data_decrypt(pt, buf);
+	      if (ecn && buf.size() && !ECN::decap(buf, recv_tos))
+		buf.reset_size();
 	      if (buf.size())
 		{
 #ifdef OPENVPN_PACKET_LOG
 		  log_packet(buf, false);
 #endif
+		  if (packet_sampler)
+		    packet_sampler->sample(buf);
 		  // make packet appear as incoming on tun interface
 		  if (tun)
 		    {
 		      OPENVPN_LOG_CLIPROTO("TUN send, size=" << buf.size());
-		      tun->tun_send(buf);
+		      if (tun_burst_active)
+			queue_tun_burst(buf);
+		      else
+			{
+			  tun_send(buf);
+			  if (recv_ns)
+			    cli_stats->record_latency(SessionStats::LAT_NET_TO_TUN, LatencyHistogram::now_ns() - recv_ns);
+			}
 		    }
 		}
 
@@ -316,6 +425,9 @@ namespace openvpn {
 	    }
 	  else if (pt.is_control())
 	    {
+	      // keep queued data packets ahead of any key change
+	      flush_decrypt_burst();
+
 	      // control packet
 	      Base::control_net_recv(pt, std::move(buf));
 
@@ -350,11 +462,208 @@ namespace openvpn {
       {
       }
 
+      // multipath transport asks for a probe of the path it is about
+      // to send on
+      virtual bool transport_send_probe()
+      {
+	try {
+	  Base::update_now();
+	  return Base::send_path_probe();
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "transport_send_probe");
+	    return false;
+	  }
+      }
+
+      virtual void path_probe_reply()
+      {
+	if (transport)
+	  transport->transport_probe_reply();
+      }
+
+      // transport obj calls here before a burst of transport_recv
+      // calls, decrypted packets are then queued and written to
+      // tun in one tun_send_batch() call at the end of the burst
+      virtual void transport_recv_burst_begin()
+      {
+	tun_burst_active = true;
+	tun_burst_size = 0;
+	tun_burst_recv_ns = latency_now();
+      }
+
+      virtual void transport_recv_burst_end()
+      {
+	SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TRANSPORT_READ);
+	SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TRANSPORT_IO);
+	flush_decrypt_burst();
+	tun_burst_active = false;
+	flush_tun_burst();
+      }
+
+      // With ProtoContext::Config::dc_batch_decrypt, data packets of a
+      // burst are queued undecrypted and then decrypted in one
+      // data_decrypt_batch() call, which keeps them in order.
+      void queue_decrypt_burst(const Base::PacketType& pt, BufferAllocated& buf)
+      {
+	if (decrypt_burst_size == decrypt_burst.size())
+	  decrypt_burst.emplace_back();
+	decrypt_burst[decrypt_burst_size++].swap(buf);
+	buf.reset_content();
+	decrypt_burst_types.push_back(pt);
+	decrypt_burst_tos.push_back(std::uint8_t(recv_tos));
+	if (decrypt_burst_size >= TUN_BURST_MAX)
+	  flush_decrypt_burst();
+      }
+
+      void flush_decrypt_burst()
+      {
+	const size_t n = decrypt_burst_size;
+	if (!n)
+	  return;
+	decrypt_burst_size = 0;
+	try {
+	  if (!halt)
+	    {
+	      Base::data_decrypt_batch(decrypt_burst_types.data(), decrypt_burst.data(), n);
+	      for (size_t i = 0; i < n; ++i)
+		{
+		  BufferAllocated& buf = decrypt_burst[i];
+		  if (!buf.size())
+		    continue;
+		  if (ecn && !ECN::decap(buf, decrypt_burst_tos[i]))
+		    continue;
+#ifdef OPENVPN_PACKET_LOG
+		  log_packet(buf, false);
+#endif
+		  if (packet_sampler)
+		    packet_sampler->sample(buf);
+		  if (tun)
+		    queue_tun_burst(buf);
+		}
+
+	      // do a lightweight flush
+	      Base::flush(false);
+	    }
+	}
+	catch (const ExceptionCode& e)
+	  {
+	    if (e.code_defined())
+	      {
+		if (e.fatal())
+		  transport_error((Error::Type)e.code(), e.what());
+		else
+		  cli_stats->error((Error::Type)e.code());
+	      }
+	    else
+	      process_exception(e, "transport_recv_burst_excode");
+	  }
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "transport_recv_burst");
+	  }
+	decrypt_burst_types.clear();
+	decrypt_burst_tos.clear();
+      }
+
+      void queue_tun_burst(BufferAllocated& buf)
+      {
+	if (tun_burst_size == tun_burst.size())
+	  tun_burst.emplace_back();
+
+	// swap rather than copy, so that the transport gets back a
+	// previously used buffer and steady-state bursts don't allocate
+	tun_burst[tun_burst_size++].swap(buf);
+	buf.reset_content();
+	if (tun_burst_size >= TUN_BURST_MAX)
+	  flush_tun_burst();
+      }
+
+      void flush_tun_burst()
+      {
+	const size_t n = tun_burst_size;
+	tun_burst_size = 0;
+	if (n && tun && !halt)
+	  {
+	    try {
+	      {
+		SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TUN_WRITE);
+		SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TUN_IO);
+		tun->tun_send_batch(tun_burst.data(), n);
+	      }
+	      if (tun_burst_recv_ns)
+		cli_stats->record_latency(SessionStats::LAT_NET_TO_TUN, LatencyHistogram::now_ns() - tun_burst_recv_ns, n);
+	    }
+	    catch (const std::exception& e)
+	      {
+		process_exception(e, "tun_send_batch");
+	      }
+	  }
+      }
+
+      // timestamp for latency stats, or 0 if they are disabled
+      std::uint64_t latency_now() const
+      {
+	return cli_stats->latency_enabled() ? LatencyHistogram::now_ns() : 0;
+      }
+
+      bool tun_send(BufferAllocated& buf)
+      {
+	SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TUN_WRITE);
+	SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TUN_IO);
+	return tun->tun_send(buf);
+      }
+
+      bool transport_send(BufferAllocated& buf, const unsigned int tos = 0)
+      {
+	SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TRANSPORT_WRITE);
+	SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TRANSPORT_IO);
+	if (tos)
+	  return transport->transport_send_tos(buf, tos);
+	return transport->transport_send(buf);
+      }
+
+      // send an encrypted data channel packet, framed for FEC with
+      // the parity of the group when it completes
+      bool transport_send_data(BufferAllocated& buf, const unsigned int tos)
+      {
+	if (!fec)
+	  return transport_send(buf, tos);
+	const bool parity = fec->encode(buf, fec_parity);
+	const bool ret = transport_send(buf, tos);
+	if (parity)
+	  transport_send(fec_parity, tos);
+	else if (fec->pending())
+	  schedule_fec_flush();
+	return ret;
+      }
+
+      // send the parity of a group that is slow to fill up, so
+      // that its last packets are protected too
+      void schedule_fec_flush()
+      {
+	if (fec_timer_pending)
+	  return;
+	fec_timer_pending = true;
+	fec_timer.expires_after(Time::Duration::milliseconds(FEC::FLUSH_MS));
+	fec_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+                             {
+                               OPENVPN_ASYNC_HANDLER;
+                               self->fec_timer_pending = false;
+                               if (!error && !self->halt && self->fec && self->fec->flush(self->fec_parity))
+                                 self->transport_send(self->fec_parity);
+                             });
+      }
+
       // tun i/o driver calls here with incoming packets
       virtual void tun_recv(BufferAllocated& buf)
       {
+	SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TUN_READ);
+	SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TUN_IO);
 	try {
 	  OPENVPN_LOG_CLIPROTO("TUN recv, size=" << buf.size());
+	  const std::uint64_t read_ns = latency_now();
 
 	  // update current time
 	  Base::update_now();
@@ -363,6 +672,8 @@ namespace openvpn {
 #ifdef OPENVPN_PACKET_LOG
 	  log_packet(buf, true);
 #endif
+	  if (packet_sampler)
+	    packet_sampler->sample(buf);
 
 	  // if transport layer has an output queue, check if it's full
 	  if (transport_has_send_queue)
@@ -377,21 +688,27 @@ namespace openvpn {
 	  // encrypt packet
 	  if (buf.size())
 	    {
-	      const ProtoContext::Config& c = Base::conf();
-	      if (c.mss_inter > 0 && buf.size() > c.mss_inter)
+	      const int mss_inter = Base::mss_inter();
+	      if (mss_inter > 0 && buf.size() > size_t(mss_inter))
 		{
-		  Ptb::generate_icmp_ptb(buf, c.mss_inter);
-		  tun->tun_send(buf);
+		  Ptb::generate_icmp_ptb(buf, std::uint16_t(mss_inter));
+		  tun_send(buf);
 		}
 	      else
 		{
+		  // outer TOS from the cleartext packet
+		  const unsigned int tos = (ecn || passtos) ? ECN::encap(ECN::tos(buf), passtos, ecn) : 0;
 		  Base::data_encrypt(buf);
 		  if (buf.size())
 		  {
 		    // send packet via transport to destination
 		    OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
-		    if (transport->transport_send(buf))
-		      Base::update_last_sent();
+		    if (transport_send_data(buf, tos))
+		      {
+			Base::update_last_sent();
+			if (read_ns)
+			  cli_stats->record_latency(SessionStats::LAT_TUN_TO_NET, LatencyHistogram::now_ns() - read_ns);
+		      }
 		    else if (halt)
 		      return;
 		  }
@@ -426,6 +743,8 @@ namespace openvpn {
 
       virtual void transport_pre_resolve()
       {
+	if (transport_restarting)
+	  return;
 	ClientEvent::Base::Ptr ev = new ClientEvent::Resolve();
 	cli_events->add_event(std::move(ev));
       }
@@ -441,12 +760,16 @@ namespace openvpn {
 
       virtual void transport_wait_proxy()
       {
+	if (transport_restarting)
+	  return;
 	ClientEvent::Base::Ptr ev = new ClientEvent::WaitProxy();
 	cli_events->add_event(std::move(ev));
       }
 
       virtual void transport_wait()
       {
+	if (transport_restarting)
+	  return;
 	ClientEvent::Base::Ptr ev = new ClientEvent::Wait();
 	cli_events->add_event(std::move(ev));
       }
@@ -454,6 +777,17 @@ namespace openvpn {
       virtual void transport_connecting()
       {
 	try {
+	  if (transport_restarting)
+	    {
+	      // keep the established session, let the server float to us
+	      transport_restarting = false;
+	      OPENVPN_LOG("Fast reconnect: sending to " << server_endpoint_render());
+	      Base::update_now();
+	      Base::flush(true);
+	      Base::send_keepalive_now();
+	      set_housekeeping_timer();
+	      return;
+	    }
 	  OPENVPN_LOG("Connecting to " << server_endpoint_render());
 	  Base::set_protocol(transport->transport_protocol());
 	  Base::start();
@@ -468,6 +802,11 @@ namespace openvpn {
 
       virtual void transport_error(const Error::Type fatal_err, const std::string& err_text)
       {
+	if (notify_callback && fast_reconnect())
+	  {
+	    OPENVPN_LOG("Transport Error: " << err_text << ", trying fast reconnect");
+	    return;
+	  }
 	if (fatal_err != Error::UNDEF)
 	  {
 	    fatal_ = fatal_err;
@@ -535,10 +874,29 @@ namespace openvpn {
       virtual void control_net_send(const Buffer& net_buf)
       {
 	OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(net_buf));
+	SessionStats::AllocScope alloc_scope(cli_stats.get(), AllocStats::TRANSPORT_WRITE);
+	SessionStats::CpuScope cpu_scope(cli_stats.get(), CpuStats::TRANSPORT_IO);
 	if (transport->transport_send_const(net_buf))
 	  Base::update_last_sent();
       }
 
+      // proto base class calls here when an SSLExecutor job completes
+      virtual void control_async_ready()
+      {
+	if (halt)
+	  return;
+	try {
+	  Base::update_now();
+	  Base::control_async_process();
+	  Base::flush(true);
+	  set_housekeeping_timer();
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "control_async_ready");
+	  }
+      }
+
       // proto base class calls here for app-level control-channel messages received
       virtual void control_recv(BufferPtr&& app_bp)
       {
@@ -574,6 +932,12 @@ namespace openvpn {
 		// modify proto config (cipher, auth, and compression methods)
 		Base::process_push(received_options, *proto_context_options);
 
+		// forward error correction, on datagram transports only
+		if (Base::conf().dc_fec && Base::conf().protocol.is_udp())
+		  fec.reset(new FEC((*Base::conf().frame)[Frame::READ_LINK_UDP]));
+		else
+		  fec.reset();
+
 		// initialize tun/routing
 		tun = tun_factory->new_tun_client_obj(io_context, *this, transport.get());
 		tun->tun_start(received_options, *transport, Base::dc_settings());
@@ -626,6 +990,18 @@ namespace openvpn {
 	  auto opts = OptionList::parse_from_csv_static(msg.substr(11), nullptr);
 	  extract_auth_token(opts);
 	}
+	else if (received_options.complete() && string::starts_with(msg, "PUSH_UPDATE,"))
+	  {
+	    // Incremental change to the pushed routes/DNS settings.
+	    // Only the delta is applied to the tun, if it supports it.
+	    const OptionList update = OptionList::parse_from_csv_static(msg.substr(12), nullptr);
+	    if (received_options.push_update(update, pushed_options_filter.get()))
+	      {
+		OPENVPN_LOG("PUSH_UPDATE:" << std::endl << render_options_sanitized(update, Option::RENDER_PASS_FMT|Option::RENDER_NUMBER|Option::RENDER_BRACKET));
+		if (!tun || !tun->tun_update(received_options))
+		  OPENVPN_LOG("PUSH_UPDATE: tun does not support in-place updates, changes will take effect on reconnect");
+	      }
+	  }
 	else if (string::starts_with(msg, "AUTH_FAILED"))
 	  {
 	    std::string reason;
@@ -753,7 +1129,7 @@ namespace openvpn {
 
       virtual void tun_error(const Error::Type fatal_err, const std::string& err_text)
       {
-	if (fatal_err == Error::TUN_HALT)
+	if (fatal_err == Error::TUN_HALT || fatal_err == Error::INACTIVE_TIMEOUT)
 	  send_explicit_exit_notify();
 	if (fatal_err != Error::UNDEF)
 	  {
@@ -870,10 +1246,43 @@ namespace openvpn {
 	schedule_push_request_callback(Time::Duration::seconds(0));
       }
 
-      void housekeeping_callback(const openvpn_io::error_code& e)
+      void fast_reconnect_restart()
       {
+	if (halt || !fast_reconnect_pending)
+	  return;
 	try {
-	  if (!e && !halt)
+	  transport = transport_factory->new_transport_client_obj(io_context, this);
+	  transport_has_send_queue = transport->transport_has_send_queue();
+	  transport_restarting = true;
+	  transport->transport_start();
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "fast_reconnect_restart");
+	  }
+      }
+
+      void fast_reconnect_done()
+      {
+	fast_reconnect_pending = false;
+	fast_reconnect_timer.cancel();
+	OPENVPN_LOG("Fast reconnect: server reached at " << server_endpoint_render());
+      }
+
+      void fast_reconnect_callback(const openvpn_io::error_code& e)
+      {
+	if (!e && !halt && fast_reconnect_pending)
+	  {
+	    OPENVPN_LOG("Fast reconnect: no response from server, doing full reconnect");
+	    stop(true);
+	  }
+      }
+
+      void housekeeping_callback()
+      {
+	const Ptr self(this); // stop() may release the last reference
+	try {
+	  if (!halt)
 	    {
 	      // update current time
 	      Base::update_now();
@@ -912,11 +1321,6 @@ namespace openvpn {
 		next.max(now());
 		housekeeping_schedule.reset(next);
 		housekeeping_timer.expires_at(next);
-		housekeeping_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
-                                              {
-                                                OPENVPN_ASYNC_HANDLER;
-                                                self->housekeeping_callback(error);
-                                              });
 	      }
 	    else
 	      {
@@ -934,7 +1338,13 @@ namespace openvpn {
 	    {
 	      if (o->size() >= 3)
 		inactive_bytes = parse_number_throw<unsigned int>(o->get(2, 16), "inactive bytes");
-	      schedule_inactive_timer();
+
+	      // DCO counts tun traffic in the kernel and notifies us,
+	      // without a periodic wakeup here
+	      if (tun && tun->tun_inactive(inactive_duration, inactive_bytes))
+		OPENVPN_LOG("inactive timer offloaded to " << tun->tun_name());
+	      else
+		schedule_inactive_timer();
 	    }
 	}
 	catch (const std::exception& e)
@@ -953,7 +1363,7 @@ namespace openvpn {
                                   });
       }
 
-      void inactive_callback(const openvpn_io::error_code& e) // fixme for DCO
+      void inactive_callback(const openvpn_io::error_code& e)
       {
 	try {
 	  if (!e && !halt)
@@ -1086,13 +1496,33 @@ namespace openvpn {
       TunClientFactory::Ptr tun_factory;
       TunClient::Ptr tun;
 
+      // decrypted packets queued during a transport receive burst
+      enum { TUN_BURST_MAX = 64 };
+      std::vector<BufferAllocated> tun_burst;
+      size_t tun_burst_size = 0;
+      bool tun_burst_active = false;
+      std::uint64_t tun_burst_recv_ns = 0;
+
+      // data packets queued for decryption during a transport receive burst
+      std::vector<BufferAllocated> decrypt_burst;
+      std::vector<Base::PacketType> decrypt_burst_types;
+      std::vector<std::uint8_t> decrypt_burst_tos; // outer TOS, with ecn
+      size_t decrypt_burst_size = 0;
+
       unsigned int tcp_queue_limit;
+      bool ecn;
+      bool passtos;
+      unsigned int recv_tos = 0; // outer TOS of the packet in transport_recv()
       bool transport_has_send_queue = false;
 
+      Time::Duration fast_reconnect_grace;
+      bool fast_reconnect_pending = false;
+      bool transport_restarting = false; // next transport_connecting() resumes the session
+
       NotifyCallback* notify_callback;
 
       CoarseTime housekeeping_schedule;
-      AsioTimer housekeeping_timer;
+      TimerWheel::Timer housekeeping_timer;
       AsioTimer push_request_timer;
       bool halt = false;
 
@@ -1108,6 +1538,7 @@ namespace openvpn {
 
       SessionStats::Ptr cli_stats;
       ClientEvent::Queue::Ptr cli_events;
+      PacketSampler::Ptr packet_sampler;
 
       ClientEvent::Connected::Ptr connected_;
 
@@ -1129,6 +1560,13 @@ namespace openvpn {
       std::unique_ptr<std::vector<ClientEvent::Base::Ptr>> info_hold;
       AsioTimer info_hold_timer;
 
+      AsioTimer fast_reconnect_timer;
+
+      std::unique_ptr<FEC> fec;   // forward error correction, if pushed
+      BufferAllocated fec_parity;
+      AsioTimer fec_timer;
+      bool fec_timer_pending = false;
+
 #ifdef OPENVPN_PACKET_LOG
       std::ofstream packet_log;
 #endif
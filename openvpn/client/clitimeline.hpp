@@ -0,0 +1,117 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Timeline of a client connect, for finding where startup time goes.
+// Each milestone (profile parsed, options built, every client event
+// up to the first CONNECTED) is recorded with its monotonic time
+// since the timeline was started.  Recording stops at freeze(), so
+// reconnects don't overwrite the initial connect, and a frozen
+// timeline may be read from any thread.  Milestone names must be
+// string literals or otherwise outlive the timeline.
+
+#ifndef OPENVPN_CLIENT_CLITIMELINE_H
+#define OPENVPN_CLIENT_CLITIMELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sstream>
+
+namespace openvpn {
+
+  class ConnectTimeline
+  {
+  public:
+    enum {
+      MAX_MILESTONES = 32,
+    };
+
+    struct Milestone
+    {
+      const char *name;
+      unsigned int ms; // since start()
+    };
+
+    // (re)start the timeline from now
+    void start()
+    {
+      t0 = std::chrono::steady_clock::now();
+      n = 0;
+      started = true;
+      frozen_.store(false, std::memory_order_relaxed);
+    }
+
+    // ignored unless started, and after freeze() or MAX_MILESTONES
+    void mark(const char *name)
+    {
+      if (!started || frozen() || n >= MAX_MILESTONES)
+	return;
+      const auto dur = std::chrono::steady_clock::now() - t0;
+      milestones[n].name = name;
+      milestones[n].ms = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+      ++n;
+    }
+
+    void freeze()
+    {
+      frozen_.store(true, std::memory_order_release);
+    }
+
+    bool frozen() const
+    {
+      return frozen_.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+      return n;
+    }
+
+    const Milestone& operator[](const size_t i) const
+    {
+      return milestones[i];
+    }
+
+    // one line, e.g. "PROFILE=12ms OPTIONS=48ms ... CONNECTED=803ms"
+    std::string to_string() const
+    {
+      std::ostringstream os;
+      for (size_t i = 0; i < n; ++i)
+	{
+	  if (i)
+	    os << ' ';
+	  os << milestones[i].name << '=' << milestones[i].ms << "ms";
+	}
+      return os.str();
+    }
+
+  private:
+    std::chrono::steady_clock::time_point t0;
+    Milestone milestones[MAX_MILESTONES];
+    size_t n = 0;
+    bool started = false;
+    std::atomic<bool> frozen_{false};
+  };
+
+}
+
+#endif
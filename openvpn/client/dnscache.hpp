@@ -0,0 +1,210 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Persistent cache of remote server DNS resolutions, used by
+// RemoteList::PreResolve to skip DNS on cold starts.
+
+#ifndef OPENVPN_CLIENT_DNSCACHE_H
+#define OPENVPN_CLIENT_DNSCACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include <cstdlib>
+#include <mutex>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/split.hpp>
+#include <openvpn/common/splitlines.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/addr/ip.hpp>
+
+namespace openvpn {
+
+  // Maps a server hostname to its last resolved address list.
+  // The file holds one entry per line:
+  //
+  //   <hostname> <expire-time> <addr> [<addr> ...]
+  //
+  // The system resolver does not expose record TTLs, so each
+  // entry is given a fixed ttl when stored.  Entries past their
+  // expire time are still returned (as STALE) for up to max_stale
+  // seconds, so that the caller can connect right away while
+  // refreshing the entry in the background.
+  //
+  // A cache may be shared by sessions on different threads.  With an
+  // empty filename it is kept in memory only.
+  class RemoteDNSCache : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<RemoteDNSCache> Ptr;
+
+    enum Status {
+      MISS,
+      FRESH,
+      STALE,
+    };
+
+    enum {
+      DEFAULT_TTL = 3600,             // 1 hour
+      DEFAULT_MAX_STALE = 7*24*3600,  // 1 week
+      MAX_FILE_SIZE = 65536,
+      MAX_ADDRS = 16,
+    };
+
+    RemoteDNSCache(const std::string& fn_arg,
+		   const unsigned int ttl_arg = DEFAULT_TTL,
+		   const unsigned int max_stale_arg = DEFAULT_MAX_STALE)
+      : fn(fn_arg),
+	ttl(ttl_arg ? ttl_arg : DEFAULT_TTL),
+	max_stale(max_stale_arg)
+    {
+      load();
+    }
+
+    Status lookup(const std::string& host, std::vector<IP::Addr>& addrs) const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto i = map.find(host);
+      if (i == map.end())
+	return MISS;
+      const Entry& e = i->second;
+      const std::time_t now = std::time(nullptr);
+      if (now >= e.expire + (std::time_t)max_stale)
+	return MISS;
+      addrs = e.addrs;
+      return now < e.expire ? FRESH : STALE;
+    }
+
+    // Record a successful resolution and write the cache back to disk.
+    void store(const std::string& host, const std::vector<IP::Addr>& addrs)
+    {
+      if (host.empty() || addrs.empty() || IP::Addr::is_valid(host))
+	return;
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry& e = map[host];
+      e.expire = std::time(nullptr) + ttl;
+      e.addrs = addrs;
+      if (e.addrs.size() > MAX_ADDRS)
+	e.addrs.resize(MAX_ADDRS);
+      save();
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return map.size();
+    }
+
+    const std::string& filename() const
+    {
+      return fn;
+    }
+
+  private:
+    struct Entry
+    {
+      std::time_t expire = 0;
+      std::vector<IP::Addr> addrs;
+    };
+
+    // A missing, truncated or corrupt file only costs us the
+    // entries we can't parse.
+    void load()
+    {
+      if (fn.empty())
+	return;
+      std::string content;
+      try {
+	content = read_text(fn, MAX_FILE_SIZE);
+      }
+      catch (const std::exception&)
+	{
+	  return;
+	}
+
+      const std::time_t now = std::time(nullptr);
+      SplitLines in(content, 0);
+      while (in(true))
+	{
+	  const std::vector<std::string> f = Split::by_space<std::vector<std::string>, StandardLex, SpaceMatch, Split::NullLimit>(in.line_ref());
+	  if (f.size() < 3)
+	    continue;
+	  Entry e;
+	  char *end = nullptr;
+	  e.expire = (std::time_t)std::strtoll(f[1].c_str(), &end, 10);
+	  if (!end || *end || now >= e.expire + (std::time_t)max_stale)
+	    continue;
+	  for (size_t i = 2; i < f.size() && e.addrs.size() < MAX_ADDRS; ++i)
+	    {
+	      IP::Addr addr;
+	      try {
+		addr = IP::Addr(f[i]);
+	      }
+	      catch (const std::exception&)
+		{
+		  continue;
+		}
+	      e.addrs.push_back(addr);
+	    }
+	  if (!e.addrs.empty())
+	    map[f[0]] = std::move(e);
+	}
+    }
+
+    void save() const
+    {
+      if (fn.empty())
+	return;
+      std::string out;
+      for (const auto& kv : map)
+	{
+	  out += kv.first;
+	  out += ' ';
+	  out += std::to_string((long long)kv.second.expire);
+	  for (const auto& addr : kv.second.addrs)
+	    {
+	      out += ' ';
+	      out += addr.to_string();
+	    }
+	  out += '\n';
+	}
+      try {
+	write_string(fn, out);
+      }
+      catch (const std::exception& e)
+	{
+	  OPENVPN_LOG("DNS cache: error writing " << fn << ": " << e.what());
+	}
+    }
+
+    std::string fn;
+    unsigned int ttl;
+    unsigned int max_stale;
+    mutable std::mutex mutex;
+    std::map<std::string, Entry> map;
+  };
+
+}
+
+#endif
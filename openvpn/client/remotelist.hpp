@@ -49,6 +49,7 @@
 #include <openvpn/client/cliconstants.hpp>
 #include <openvpn/log/sessionstats.hpp>
 #include <openvpn/client/async_resolve.hpp>
+#include <openvpn/client/dnscache.hpp>
 
 #if OPENVPN_DEBUG_REMOTELIST >= 1
 #define OPENVPN_LOG_REMOTELIST(x) OPENVPN_LOG(x)
@@ -138,6 +139,32 @@ namespace openvpn {
 	OPENVPN_LOG_REMOTELIST("*** RemoteList::Item endpoint SET " << to_string());
       }
 
+      // cache a list of IP addresses, such as one loaded from
+      // a RemoteDNSCache
+      void set_ip_addr_list(const std::vector<IP::Addr>& addrs)
+      {
+	res_addr_list.reset(new ResolvedAddrList());
+	for (const auto& addr : addrs)
+	  {
+	    ResolvedAddr::Ptr ra(new ResolvedAddr());
+	    ra->addr = addr;
+	    res_addr_list->push_back(std::move(ra));
+	  }
+	OPENVPN_LOG_REMOTELIST("*** RemoteList::Item endpoint SET " << to_string());
+      }
+
+      std::vector<IP::Addr> ip_addr_list() const
+      {
+	std::vector<IP::Addr> ret;
+	if (res_addr_list)
+	  {
+	    ret.reserve(res_addr_list->size());
+	    for (const auto& ra : *res_addr_list)
+	      ret.push_back(ra->addr);
+	  }
+	return ret;
+      }
+
       // cache a list of DNS-resolved IP addresses
       template <class EPRANGE>
       void set_endpoint_range(const EPRANGE& endpoint_range, RandomAPI* rng)
@@ -204,6 +231,7 @@ namespace openvpn {
       std::string port;
     };
 
+  public:
     // Used to index into remote list.
     // The primary index is the remote list index.
     // The secondary index is the index into the
@@ -265,6 +293,10 @@ namespace openvpn {
     // This is useful in tun_persist mode, where it may be necessary
     // to pre-resolve all potential remote server items prior
     // to initial tunnel establishment.
+    //
+    // If the remote list has a RemoteDNSCache, items found there are
+    // not resolved.  Stale entries are used as well, and re-resolved
+    // in the background after pre_resolve_done has been called.
     class PreResolve : public virtual RC<thread_unsafe_refcount>, AsyncResolvableTCP
     {
     public:
@@ -283,7 +315,8 @@ namespace openvpn {
 	   notify_callback(nullptr),
 	   remote_list(remote_list_arg),
 	   stats(stats_arg),
-	   index(0)
+	   index(0),
+	   refreshing(false)
       {
       }
 
@@ -316,6 +349,8 @@ namespace openvpn {
       {
 	notify_callback = nullptr;
 	index = 0;
+	refreshing = false;
+	refresh.clear();
 	async_resolve_cancel();
       }
 
@@ -337,6 +372,10 @@ namespace openvpn {
 		    OPENVPN_LOG_REMOTELIST("*** PreResolve USED CACHE for " << item.server_host);
 		    item.res_addr_list = sitem->res_addr_list;
 		  }
+		else if (from_dns_cache(item))
+		  {
+		    OPENVPN_LOG_REMOTELIST("*** PreResolve USED DNS CACHE for " << item.server_host);
+		  }
 		else
 		  {
 		    OPENVPN_LOG_REMOTELIST("*** PreResolve RESOLVE on " << item.server_host << " : " << item.server_port);
@@ -355,22 +394,81 @@ namespace openvpn {
 	  NotifyCallback* ncb = notify_callback;
 	  if (remote_list->cached_item_exists())
 	    remote_list->prune_uncached();
+	  std::vector<Item::Ptr> stale;
+	  stale.swap(refresh);
 	  cancel();
 	  ncb->pre_resolve_done();
+
+	  // pre_resolve_done may have restarted us
+	  if (!stale.empty() && !notify_callback)
+	    {
+	      refresh = std::move(stale);
+	      refreshing = true;
+	      next_refresh();
+	    }
 	}
       }
 
+      bool from_dns_cache(Item& item)
+      {
+	RemoteDNSCache* dns_cache = remote_list->dns_cache.get();
+	if (!dns_cache)
+	  return false;
+	std::vector<IP::Addr> addrs;
+	const RemoteDNSCache::Status status = dns_cache->lookup(item.server_host, addrs);
+	if (status == RemoteDNSCache::MISS)
+	  return false;
+	item.set_ip_addr_list(addrs);
+	if (status == RemoteDNSCache::STALE)
+	  refresh.push_back(&item);
+	return true;
+      }
+
+      // Re-resolve stale DNS cache entries without holding up the
+      // connection.  Results go to the DNS cache and replace the
+      // addresses of the item, which the remote list will pick up
+      // the next time it cycles through it.
+      void next_refresh()
+      {
+	if (refresh.empty())
+	  {
+	    refreshing = false;
+	    return;
+	  }
+	const Item& item = *refresh.back();
+	OPENVPN_LOG_REMOTELIST("*** PreResolve REFRESH on " << item.server_host << " : " << item.server_port);
+	async_resolve_name(item.server_host, item.server_port);
+      }
+
+      void refresh_callback(const openvpn_io::error_code& error,
+			    openvpn_io::ip::tcp::resolver::results_type results)
+      {
+	Item::Ptr item = std::move(refresh.back());
+	refresh.pop_back();
+	if (!error)
+	  {
+	    item->set_endpoint_range(results, remote_list->rng.get());
+	    remote_list->dns_cache_store(*item);
+	  }
+	else
+	  OPENVPN_LOG("DNS refresh error on " << item->server_host << ": " << error.message());
+	next_refresh();
+      }
+
       // callback on resolve completion
       void resolve_callback(const openvpn_io::error_code& error,
 			    openvpn_io::ip::tcp::resolver::results_type results) override
       {
-	if (notify_callback && index < remote_list->list.size())
+	if (refreshing)
+	  refresh_callback(error, std::move(results));
+	else if (notify_callback && index < remote_list->list.size())
 	  {
 	    Item& item = *remote_list->list[index++];
 	    if (!error)
 	      {
 		// resolve succeeded
 		item.set_endpoint_range(results, remote_list->rng.get());
+		remote_list->dns_cache_store(item);
 	      }
 	    else
 	      {
@@ -387,6 +485,8 @@ namespace openvpn {
       RemoteList::Ptr remote_list;
       SessionStats::Ptr stats;
       size_t index;
+      std::vector<Item::Ptr> refresh;
+      bool refreshing;
     };
 
     // create an empty remote list
@@ -510,6 +610,13 @@ namespace openvpn {
       return enable_cache;
     }
 
+    // Persist resolved addresses across sessions.  Only consulted
+    // by PreResolve, so it has no effect unless caching is enabled.
+    void set_dns_cache(const RemoteDNSCache::Ptr& dns_cache_arg)
+    {
+      dns_cache = dns_cache_arg;
+    }
+
     // override all server hosts to server_override
     void set_server_override(const std::string& server_override)
     {
@@ -633,6 +740,7 @@ namespace openvpn {
       Item& item = *list[primary_index()];
       item.set_endpoint_range(endpoint_range, rng.get());
       index.reset_secondary();
+      dns_cache_store(item);
     }
 
     // get an endpoint for contacting server
@@ -644,6 +752,16 @@ namespace openvpn {
 	throw remote_list_error("current remote server endpoint is undefined");
     }
 
+    // current position in the list
+    const Index& current_index() const { return index; }
+
+    // return to a position previously obtained from current_index()
+    void set_index(const Index& other)
+    {
+      if (other.primary() < list.size())
+	index = other;
+    }
+
     // return true if object has at least one connection entry
     bool defined() const { return list.size() > 0; }
 
@@ -792,6 +910,12 @@ namespace openvpn {
       return nullptr;
     }
 
+    void dns_cache_store(const Item& item)
+    {
+      if (dns_cache && item.res_addr_list_defined())
+	dns_cache->store(item.server_host, item.ip_addr_list());
+    }
+
     // prune remote entries so that only those of Protocol proto_override remain
     void set_proto_override(const Protocol& proto_override)
     {
@@ -919,6 +1043,8 @@ namespace openvpn {
     RemoteOverride* remote_override = nullptr;
 
     RandomAPI::Ptr rng;
+
+    RemoteDNSCache::Ptr dns_cache;
   };
 
 }
@@ -0,0 +1,158 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Process-wide cache of client SSL factories, so that a new connect
+// with the same profile skips PEM parsing and building the cert and
+// CA stores.  Entries are keyed by a digest of everything a factory
+// was built from.  A factory is checked out by one ClientOptions at
+// a time and put back when it is no longer referenced, so a factory
+// (whose refcount isn't thread-safe) is never shared by sessions
+// running at the same time.
+
+#ifndef OPENVPN_CLIENT_SSLFACTORYCACHE_H
+#define OPENVPN_CLIENT_SSLFACTORYCACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <utility>
+
+#include <openvpn/common/options.hpp>
+#include <openvpn/ssl/sslapi.hpp>
+
+namespace openvpn {
+
+  class SSLFactoryCache
+  {
+  public:
+    enum {
+      MAX_ENTRIES = 4,
+    };
+
+    // A cached factory, with the indices of the profile options that
+    // building it consumed, so they can be marked as used again.
+    struct Entry
+    {
+      SSLFactoryAPI::Ptr factory;
+      std::vector<size_t> touched;
+
+      // mark the options consumed when the factory was built
+      void touch(const OptionList& opt) const
+      {
+	for (const size_t i : touched)
+	  if (i < opt.size())
+	    opt[i].touch();
+      }
+
+      // record the options touched since untouched was taken
+      void set_touched(const OptionList& opt, const std::vector<bool>& untouched)
+      {
+	touched.clear();
+	for (size_t i = 0; i < opt.size() && i < untouched.size(); ++i)
+	  if (untouched[i] && opt[i].touched())
+	    touched.push_back(i);
+      }
+
+      static std::vector<bool> untouched(const OptionList& opt)
+      {
+	std::vector<bool> ret(opt.size());
+	for (size_t i = 0; i < opt.size(); ++i)
+	  ret[i] = !opt[i].touched();
+	return ret;
+      }
+    };
+
+    static SSLFactoryCache& instance()
+    {
+      static SSLFactoryCache cache;
+      return cache;
+    }
+
+    // Check out the entry for key.  Returns false if there is none,
+    // or it is checked out by another session.
+    bool take(const std::string& key, Entry& entry)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto i = entries.begin(); i != entries.end(); ++i)
+	{
+	  if (i->first == key)
+	    {
+	      entry = std::move(i->second);
+	      entries.erase(i);
+	      return true;
+	    }
+	}
+      return false;
+    }
+
+    // Return an entry.  The caller must hold the only reference to
+    // the factory.  The least recently returned entry is dropped when
+    // the cache is full.
+    void put(const std::string& key, Entry&& entry)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto i = entries.begin(); i != entries.end(); ++i)
+	{
+	  if (i->first == key)
+	    {
+	      entries.erase(i);
+	      break;
+	    }
+	}
+      entries.emplace_front(key, std::move(entry));
+      if (entries.size() > max_entries)
+	entries.pop_back();
+    }
+
+    // Keep up to n entries, for processes running many sessions
+    // with different profiles at once.  Never lowers the limit.
+    void reserve(const size_t n)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (n > max_entries)
+	max_entries = n;
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.clear();
+    }
+
+    size_t size()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return entries.size();
+    }
+
+  private:
+    SSLFactoryCache() {}
+
+    std::mutex mutex;
+    size_t max_entries = MAX_ENTRIES;
+    std::list<std::pair<std::string, Entry>> entries; // most recently returned first
+  };
+
+}
+
+#endif
@@ -42,6 +42,12 @@ namespace openvpn {
       return "\\\\.\\pipe\\" OVPNAGENT_NAME_STRING;
     }
 
+    // pipe for the binary protocol, see agentproto.hpp
+    static std::string binary_pipe_path()
+    {
+      return "\\\\.\\pipe\\" OVPNAGENT_NAME_STRING "-bin";
+    }
+
     static bool valid_pipe(const std::string& client_exe,
 			   const std::string& server_exe)
     {
@@ -0,0 +1,657 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Compact binary protocol between the client and the Windows agent,
+// spoken over a persistent named pipe connection (see
+// Agent::binary_pipe_path()) as a faster alternative to a
+// round trip of HTTP+JSON per agent action.
+//
+// Each message is a request or a reply, framed as
+//
+//   u32 length of what follows
+//   u16 VERSION
+//   u16 number of records
+//   u32 request id, echoed in the reply
+//   records, each
+//     u16 action
+//     u16 status (replies only, STATUS_OK on success)
+//     u16 number of fields
+//     fields, each u16 tag, u32 length, data
+//
+// with all integers in network byte order.  A request batches one
+// or more actions, which the agent runs in order.  The reply has
+// one record per action run, and stops at the first one that fails.
+// Replies carry the id of their request and may be sent in any
+// order, so the agent is free to complete a request asynchronously
+// while later requests on the same connection are being read.
+//
+// The protocol code itself is platform-neutral.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <unordered_map>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/function.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/asio/asiopolysock.hpp>
+#include <openvpn/acceptor/base.hpp>
+
+namespace openvpn {
+  namespace AgentProto {
+
+    OPENVPN_EXCEPTION(agent_proto_error);
+
+    enum {
+      VERSION = 1,
+      HEADER_SIZE = 12,             // length, version, record count, id
+      MAX_MESSAGE = 1024 * 1024,    // largest length accepted from the peer
+    };
+
+    enum Action : std::uint16_t {
+      TUN_SETUP = 1,
+      ADD_BYPASS_ROUTE = 2,
+      START_PROCESS = 3,
+    };
+
+    enum Status : std::uint16_t {
+      STATUS_OK = 0,
+      STATUS_ERROR = 1,
+      STATUS_UNKNOWN_ACTION = 2,
+    };
+
+    enum Field : std::uint16_t {
+      // request fields
+      PID = 1,
+      HOST,
+      IPV6,
+      WINTUN,
+      CONFIRM_EVENT,
+      DESTROY_EVENT,
+      TUN,                      // TunBuilderCapture, as JSON text
+      SEND_RING_HMEM,
+      RECEIVE_RING_HMEM,
+      SEND_RING_TAIL_MOVED,
+      RECEIVE_RING_TAIL_MOVED,
+      CONFIG_FILE,
+      CONFIG_DIR,
+      EXIT_EVENT_NAME,
+      MANAGEMENT_HOST,
+      MANAGEMENT_PASSWORD,
+      MANAGEMENT_PORT,
+      LOG,
+      LOG_APPEND,
+
+      // reply fields
+      LOG_TXT = 100,
+      TAP_HANDLE_HEX,
+      ERROR_TXT,
+    };
+
+    // One action of a request, or its result in a reply
+    struct Record
+    {
+      Record() {}
+
+      Record(const std::uint16_t type_arg)
+	: type(type_arg)
+      {
+      }
+
+      void set(const std::uint16_t tag, std::string value)
+      {
+	fields.emplace_back(tag, std::move(value));
+      }
+
+      void set_uint(const std::uint16_t tag, std::uint64_t value)
+      {
+	unsigned char data[8];
+	for (int i = 7; i >= 0; --i)
+	  {
+	    data[i] = static_cast<unsigned char>(value);
+	    value >>= 8;
+	  }
+	set(tag, std::string(reinterpret_cast<const char *>(data), sizeof(data)));
+      }
+
+      void set_bool(const std::uint16_t tag, const bool value)
+      {
+	set(tag, std::string(1, value ? '\1' : '\0'));
+      }
+
+      // returns nullptr if the field is absent
+      const std::string* find(const std::uint16_t tag) const
+      {
+	for (const auto& f : fields)
+	  if (f.first == tag)
+	    return &f.second;
+	return nullptr;
+      }
+
+      const std::string& get_string(const std::uint16_t tag) const
+      {
+	const std::string* v = find(tag);
+	if (!v)
+	  OPENVPN_THROW(agent_proto_error, "action " << type << ": missing field " << tag);
+	return *v;
+      }
+
+      std::string get_string_optional(const std::uint16_t tag) const
+      {
+	const std::string* v = find(tag);
+	return v ? *v : std::string();
+      }
+
+      std::uint64_t get_uint(const std::uint16_t tag) const
+      {
+	const std::string& v = get_string(tag);
+	if (v.length() > 8)
+	  OPENVPN_THROW(agent_proto_error, "action " << type << ": field " << tag << " is not an integer");
+	std::uint64_t ret = 0;
+	for (const char c : v)
+	  ret = (ret << 8) | static_cast<unsigned char>(c);
+	return ret;
+      }
+
+      std::uint64_t get_uint_optional(const std::uint16_t tag, const std::uint64_t default_value) const
+      {
+	return find(tag) ? get_uint(tag) : default_value;
+      }
+
+      bool get_bool(const std::uint16_t tag) const
+      {
+	return get_uint(tag) != 0;
+      }
+
+      bool get_bool_optional(const std::uint16_t tag) const
+      {
+	return find(tag) ? get_bool(tag) : false;
+      }
+
+      std::uint16_t type = 0;
+      std::uint16_t status = STATUS_OK;
+      std::vector<std::pair<std::uint16_t, std::string>> fields;
+    };
+
+    struct Message
+    {
+      std::uint32_t id = 0;
+      std::vector<Record> records;
+    };
+
+    // Append the framed message to buf
+    inline void serialize(const Message& msg, Buffer& buf)
+    {
+      struct Out
+      {
+	Out(Buffer& buf_arg)
+	  : buf(buf_arg)
+	{
+	}
+
+	void u16(const std::uint16_t v)
+	{
+	  buf.push_back(static_cast<unsigned char>(v >> 8));
+	  buf.push_back(static_cast<unsigned char>(v));
+	}
+
+	void u32(const std::uint32_t v)
+	{
+	  u16(static_cast<std::uint16_t>(v >> 16));
+	  u16(static_cast<std::uint16_t>(v));
+	}
+
+	Buffer& buf;
+      };
+
+      if (msg.records.size() > 0xFFFF)
+	throw agent_proto_error("too many records");
+      size_t len = HEADER_SIZE - 4;
+      for (const auto& r : msg.records)
+	{
+	  if (r.fields.size() > 0xFFFF)
+	    throw agent_proto_error("too many fields");
+	  len += 6;
+	  for (const auto& f : r.fields)
+	    len += 6 + f.second.length();
+	}
+      if (len > MAX_MESSAGE)
+	throw agent_proto_error("message too large");
+
+      Out out(buf);
+      out.u32(static_cast<std::uint32_t>(len));
+      out.u16(VERSION);
+      out.u16(static_cast<std::uint16_t>(msg.records.size()));
+      out.u32(msg.id);
+      for (const auto& r : msg.records)
+	{
+	  out.u16(r.type);
+	  out.u16(r.status);
+	  out.u16(static_cast<std::uint16_t>(r.fields.size()));
+	  for (const auto& f : r.fields)
+	    {
+	      out.u16(f.first);
+	      out.u32(static_cast<std::uint32_t>(f.second.length()));
+	      buf.write(f.second.data(), f.second.length());
+	    }
+	}
+    }
+
+    // Parse one complete framed message
+    inline Message parse(const unsigned char* data, const size_t size)
+    {
+      struct In
+      {
+	In(const unsigned char* data_arg, const size_t size_arg)
+	  : data(data_arg),
+	    size(size_arg)
+	{
+	}
+
+	const unsigned char* take(const size_t n)
+	{
+	  if (n > size)
+	    throw agent_proto_error("truncated message");
+	  const unsigned char* ret = data;
+	  data += n;
+	  size -= n;
+	  return ret;
+	}
+
+	std::uint16_t u16()
+	{
+	  const unsigned char* p = take(2);
+	  return static_cast<std::uint16_t>((p[0] << 8) | p[1]);
+	}
+
+	std::uint32_t u32()
+	{
+	  const std::uint32_t hi = u16();
+	  return (hi << 16) | u16();
+	}
+
+	const unsigned char* data;
+	size_t size;
+      };
+
+      In in(data, size);
+      const std::uint32_t len = in.u32();
+      if (len != in.size)
+	throw agent_proto_error("bad message length");
+      if (in.u16() != VERSION)
+	throw agent_proto_error("unsupported protocol version");
+      const std::uint16_t n_records = in.u16();
+
+      Message msg;
+      msg.id = in.u32();
+      msg.records.resize(n_records);
+      for (auto& r : msg.records)
+	{
+	  r.type = in.u16();
+	  r.status = in.u16();
+	  const std::uint16_t n_fields = in.u16();
+	  r.fields.reserve(n_fields);
+	  for (std::uint16_t i = 0; i < n_fields; ++i)
+	    {
+	      const std::uint16_t tag = in.u16();
+	      const std::uint32_t flen = in.u32();
+	      const unsigned char* f = in.take(flen);
+	      r.set(tag, std::string(reinterpret_cast<const char *>(f), flen));
+	    }
+	}
+      if (in.size)
+	throw agent_proto_error("trailing data in message");
+      return msg;
+    }
+
+    // Reassembles messages from a byte stream
+    class MessageReader
+    {
+    public:
+      void put(const unsigned char* data, const size_t size)
+      {
+	pending.insert(pending.end(), data, data + size);
+      }
+
+      // Returns false until a complete message has been put.
+      bool get(Message& msg)
+      {
+	if (pending.size() < 4)
+	  return false;
+	const size_t len = (size_t(pending[0]) << 24) | (size_t(pending[1]) << 16)
+	                 | (size_t(pending[2]) << 8) | size_t(pending[3]);
+	if (len > MAX_MESSAGE)
+	  throw agent_proto_error("message too large");
+	if (pending.size() < len + 4)
+	  return false;
+	msg = parse(pending.data(), len + 4);
+	pending.erase(pending.begin(), pending.begin() + len + 4);
+	return true;
+      }
+
+    private:
+      std::vector<unsigned char> pending;
+    };
+
+    // Agent side of one client connection.  Requests are passed to
+    // the handler as they arrive, and the handler answers each one
+    // with reply(), either right away or later.
+    class Session : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Session> Ptr;
+
+      struct Handler : public RC<thread_unsafe_refcount>
+      {
+	typedef RCPtr<Handler> Ptr;
+
+	// return false to refuse the connection
+	virtual bool agent_allow(AsioPolySock::Base& sock)
+	{
+	  return true;
+	}
+
+	virtual void agent_request(Session& session, Message& request) = 0;
+
+	virtual void agent_session_closed(Session& session)
+	{
+	}
+      };
+
+      Session(AsioPolySock::Base::Ptr sock_arg, Handler* handler_arg)
+	: sock(std::move(sock_arg)),
+	  handler(handler_arg)
+      {
+      }
+
+      void start()
+      {
+	queue_read();
+      }
+
+      void reply(const Message& msg)
+      {
+	if (halt)
+	  return;
+	BufferPtr buf(new BufferAllocated(HEADER_SIZE, BufferAllocated::GROW));
+	serialize(msg, *buf);
+	out.push_back(std::move(buf));
+	if (out.size() == 1)
+	  queue_write();
+      }
+
+      void stop()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    sock->close();
+	    handler->agent_session_closed(*this);
+	  }
+      }
+
+      bool is_stopped() const
+      {
+	return halt;
+      }
+
+      AsioPolySock::Base& socket()
+      {
+	return *sock;
+      }
+
+    private:
+      void queue_read()
+      {
+	sock->async_receive(openvpn_io::buffer(rbuf, sizeof(rbuf)),
+			    [self=Ptr(this)](const openvpn_io::error_code& error, const size_t bytes_recvd)
+			    {
+			      self->handle_read(error, bytes_recvd);
+			    });
+      }
+
+      void handle_read(const openvpn_io::error_code& error, const size_t bytes_recvd)
+      {
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    stop();
+	    return;
+	  }
+	try {
+	  reader.put(rbuf, bytes_recvd);
+	  Message msg;
+	  while (!halt && reader.get(msg))
+	    handler->agent_request(*this, msg);
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("AgentProto: " << sock->remote_endpoint_str() << ": " << e.what());
+	    stop();
+	  }
+	if (!halt)
+	  queue_read();
+      }
+
+      void queue_write()
+      {
+	const Buffer& buf = *out.front();
+	sock->async_send(openvpn_io::buffer(buf.c_data(), buf.size()),
+			 [self=Ptr(this)](const openvpn_io::error_code& error, const size_t bytes_sent)
+			 {
+			   self->handle_write(error, bytes_sent);
+			 });
+      }
+
+      void handle_write(const openvpn_io::error_code& error, const size_t bytes_sent)
+      {
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    stop();
+	    return;
+	  }
+	Buffer& buf = *out.front();
+	buf.advance(bytes_sent);
+	if (buf.empty())
+	  out.pop_front();
+	if (!out.empty())
+	  queue_write();
+      }
+
+      AsioPolySock::Base::Ptr sock;
+      Handler::Ptr handler;
+      MessageReader reader;
+      std::deque<BufferPtr> out;
+      unsigned char rbuf[2048];
+      bool halt = false;
+    };
+
+    // Accepts connections from one or more acceptors and runs a
+    // Session for each.
+    class Listener : public Acceptor::ListenerBase
+    {
+    public:
+      typedef RCPtr<Listener> Ptr;
+
+      Listener(openvpn_io::io_context& io_context_arg,
+	       Session::Handler* handler_arg)
+	: io_context(io_context_arg),
+	  handler(handler_arg)
+      {
+      }
+
+      virtual ~Listener()
+      {
+	if (close_handler)
+	  close_handler->parent = nullptr;
+      }
+
+      void add_acceptor(Acceptor::Base::Ptr acceptor)
+      {
+	acceptors.push_back(std::move(acceptor));
+	acceptors.back()->async_accept(this, acceptors.size() - 1, io_context);
+      }
+
+      void stop()
+      {
+	if (halt)
+	  return;
+	halt = true;
+	for (auto& a : acceptors)
+	  a->close();
+	acceptors.clear();
+	const SessionMap s = std::move(sessions);
+	sessions.clear();
+	for (auto& session : s)
+	  session.second->stop();
+      }
+
+      size_t n_sessions() const
+      {
+	return sessions.size();
+      }
+
+    private:
+      typedef std::unordered_map<Session*, Session::Ptr> SessionMap;
+
+      // forwards session close to the real handler, then
+      // forgets the session
+      struct CloseHandler : public Session::Handler
+      {
+	CloseHandler(Listener* parent_arg)
+	  : parent(parent_arg)
+	{
+	}
+
+	virtual void agent_request(Session& session, Message& request) override
+	{
+	  if (parent)
+	    parent->handler->agent_request(session, request);
+	}
+
+	virtual void agent_session_closed(Session& session) override
+	{
+	  if (parent)
+	    {
+	      Listener::Ptr p(parent);
+	      p->handler->agent_session_closed(session);
+	      p->sessions.erase(&session);
+	    }
+	}
+
+	Listener* parent;
+      };
+
+      virtual void handle_accept(AsioPolySock::Base::Ptr sock, const openvpn_io::error_code& error) override
+      {
+	if (halt)
+	  return;
+	const size_t index = sock->index();
+	try {
+	  if (error)
+	    throw agent_proto_error("accept failed: " + error.message());
+	  if (handler->agent_allow(*sock))
+	    {
+	      if (!close_handler)
+		close_handler.reset(new CloseHandler(this));
+	      Session::Ptr session(new Session(std::move(sock), close_handler.get()));
+	      sessions.emplace(session.get(), session);
+	      session->start();
+	    }
+	  else
+	    sock->close();
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("AgentProto: " << e.what());
+	  }
+	if (index < acceptors.size())
+	  acceptors[index]->async_accept(this, index, io_context);
+      }
+
+      openvpn_io::io_context& io_context;
+      Session::Handler::Ptr handler;
+      RCPtr<CloseHandler> close_handler;
+      std::vector<Acceptor::Base::Ptr> acceptors;
+      SessionMap sessions;
+      bool halt = false;
+    };
+
+    // Blocking client side of the protocol over a persistent
+    // connection.  STREAM provides
+    //
+    //   void write_all(const unsigned char* data, size_t size);
+    //   size_t read_some(unsigned char* data, size_t size); // 0 on EOF
+    //
+    // and reports errors by throwing.
+    template <typename STREAM>
+    class SyncClient
+    {
+    public:
+      SyncClient(STREAM& stream_arg)
+	: stream(stream_arg)
+      {
+      }
+
+      // Send a batch of actions and wait for their results.
+      // Replies to other requests are dropped.
+      Message transact(Message& request)
+      {
+	request.id = ++next_id;
+	BufferAllocated buf(HEADER_SIZE, BufferAllocated::GROW);
+	serialize(request, buf);
+	stream.write_all(buf.c_data(), buf.size());
+
+	Message reply;
+	unsigned char rbuf[2048];
+	while (true)
+	  {
+	    while (reader.get(reply))
+	      {
+		if (reply.id == request.id)
+		  return reply;
+	      }
+	    const size_t n = stream.read_some(rbuf, sizeof(rbuf));
+	    if (!n)
+	      throw agent_proto_error("connection closed by agent");
+	    reader.put(rbuf, n);
+	  }
+      }
+
+    private:
+      STREAM& stream;
+      MessageReader reader;
+      std::uint32_t next_id = 0;
+    };
+
+  }
+}
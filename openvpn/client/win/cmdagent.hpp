@@ -22,17 +22,22 @@
 #pragma once
 
 #include <utility>
+#include <mutex>
+#include <memory>
+#include <algorithm>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/options.hpp>
 #include <openvpn/common/wstring.hpp>
 #include <openvpn/common/jsonhelper.hpp>
+#include <openvpn/common/jsonflat.hpp>
 #include <openvpn/buffer/bufstr.hpp>
 #include <openvpn/buffer/bufhex.hpp>
 #include <openvpn/frame/frame_init.hpp>
 #include <openvpn/ws/httpcliset.hpp>
 #include <openvpn/win/winerr.hpp>
 #include <openvpn/client/win/agentconfig.hpp>
+#include <openvpn/client/win/agentproto.hpp>
 #include <openvpn/win/modname.hpp>
 #include <openvpn/tun/win/client/setupbase.hpp>
 #include <openvpn/win/npinfo.hpp>
@@ -72,6 +77,22 @@ namespace openvpn {
 
       OPENVPN_LOG(os.str());
 
+      // try the binary protocol first
+      {
+	AgentProto::Message req;
+	AgentProto::Record r(AgentProto::ADD_BYPASS_ROUTE);
+#if _WIN32_WINNT < 0x0600 // pre-Vista needs us to explicitly communicate our PID
+	r.set_uint(AgentProto::PID, ::GetProcessId(::GetCurrentProcess()));
+#endif
+	r.set(AgentProto::HOST, endpoint.to_string());
+	r.set_bool(AgentProto::IPV6, endpoint.is_ipv6());
+	req.records.push_back(std::move(r));
+
+	AgentProto::Message reply;
+	if (BinaryConnection::instance().transact(req, reply))
+	  return reply.records.size() == 1 && reply.records[0].status == AgentProto::STATUS_OK;
+      }
+
       // Create HTTP transaction container
       WS::ClientSet::TransactionSet::Ptr ts = SetupClient::new_transaction_set(Agent::named_pipe_path(), 1, Win::module_name_utf8(), [](HANDLE) { });
 
@@ -84,6 +105,163 @@ namespace openvpn {
     }
 
   private:
+    // Persistent connection to the agent's binary protocol pipe,
+    // shared by all agent requests of the process
+    class BinaryConnection
+    {
+    public:
+      enum {
+	TIMEOUT_MS = 60 * 1000,
+      };
+
+      static BinaryConnection& instance()
+      {
+	static BinaryConnection conn;
+	return conn;
+      }
+
+      // Run a batch of actions.  Returns false if the agent doesn't
+      // offer the binary protocol, so the caller can fall back to
+      // HTTP+JSON.
+      bool transact(AgentProto::Message& request, AgentProto::Message& reply)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pipe.defined())
+	  {
+	    try {
+	      reply = client->transact(request);
+	      return true;
+	    }
+	    catch (const std::exception& e)
+	      {
+		// the agent may have restarted since the connection was made
+		OPENVPN_LOG("WinCommandAgent: reconnecting to agent: " << e.what());
+		close();
+	      }
+	  }
+	if (!open())
+	  return false;
+	try {
+	  reply = client->transact(request);
+	}
+	catch (...)
+	  {
+	    close();
+	    throw;
+	  }
+	return true;
+      }
+
+      // A new handle to the agent process, owned by the caller,
+      // or nullptr if unknown
+      HANDLE agent_process()
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	HANDLE ret = nullptr;
+	if (process.defined()
+	    && !::DuplicateHandle(::GetCurrentProcess(), process(), ::GetCurrentProcess(), &ret,
+				  0, FALSE, DUPLICATE_SAME_ACCESS))
+	  ret = nullptr;
+	return ret;
+      }
+
+      // blocking pipe I/O for AgentProto::SyncClient
+      void write_all(const unsigned char* data, size_t size)
+      {
+	while (size)
+	  {
+	    const size_t n = io(true, const_cast<unsigned char *>(data), size);
+	    if (!n)
+	      throw ovpnagent("agent closed the binary pipe");
+	    data += n;
+	    size -= n;
+	  }
+      }
+
+      size_t read_some(unsigned char* data, const size_t size)
+      {
+	return io(false, data, size);
+      }
+
+    private:
+      bool open()
+      {
+	const std::string name = Agent::binary_pipe_path();
+	pipe.reset(::CreateFileA(name.c_str(),
+				 GENERIC_READ | GENERIC_WRITE,
+				 0,
+				 nullptr,
+				 OPEN_EXISTING,
+				 FILE_FLAG_OVERLAPPED,
+				 nullptr));
+	if (!pipe.defined())
+	  {
+	    // an older agent, or all pipe instances busy
+	    const Win::LastError err;
+	    OPENVPN_LOG("WinCommandAgent: " << name << " unavailable: " << err.message());
+	    return false;
+	  }
+
+#if _WIN32_WINNT >= 0x0600 // Vista and higher
+	Win::NamedPipePeerInfoServer npinfo(pipe());
+	const std::string server_exe = wstring::to_utf8(npinfo.exe_path);
+	if (!Agent::valid_pipe(Win::module_name_utf8(), server_exe))
+	  {
+	    close();
+	    OPENVPN_THROW(ovpnagent, name << " server running from " << server_exe << " could not be validated");
+	  }
+	process.reset(npinfo.proc.release());
+#endif
+	client.reset(new AgentProto::SyncClient<BinaryConnection>(*this));
+	return true;
+      }
+
+      void close()
+      {
+	client.reset();
+	process.reset();
+	pipe.reset();
+      }
+
+      // returns 0 if the agent closed the pipe
+      size_t io(const bool write, unsigned char* data, const size_t size)
+      {
+	OVERLAPPED ov = {};
+	ov.hEvent = io_event();
+	const DWORD len = static_cast<DWORD>(std::min(size, size_t(65536)));
+	const BOOL ok = write
+	  ? ::WriteFile(pipe(), data, len, nullptr, &ov)
+	  : ::ReadFile(pipe(), data, len, nullptr, &ov);
+	if (!ok && ::GetLastError() != ERROR_IO_PENDING)
+	  return io_error();
+
+	DWORD n = 0;
+	if (::WaitForSingleObject(ov.hEvent, TIMEOUT_MS) != WAIT_OBJECT_0)
+	  {
+	    ::CancelIoEx(pipe(), &ov);
+	    ::GetOverlappedResult(pipe(), &ov, &n, TRUE);
+	    throw ovpnagent("agent binary pipe timeout");
+	  }
+	if (!::GetOverlappedResult(pipe(), &ov, &n, FALSE))
+	  return io_error();
+	return n;
+      }
+
+      static size_t io_error()
+      {
+	const Win::LastError err;
+	if (err.value() == ERROR_BROKEN_PIPE)
+	  return 0;
+	OPENVPN_THROW(ovpnagent, "agent binary pipe: " << err.message());
+      }
+
+      std::mutex mutex;
+      Win::ScopedHANDLE pipe;
+      Win::ScopedHANDLE process;
+      Win::Event io_event;
+      std::unique_ptr<AgentProto::SyncClient<BinaryConnection>> client;
+    };
+
     struct Config : public RC<thread_unsafe_refcount>
     {
       typedef RCPtr<Config> Ptr;
@@ -177,6 +355,22 @@ namespace openvpn {
 	jreq["confirm_event"] = confirm_event.duplicate_local();
 	jreq["destroy_event"] = destroy_event.duplicate_local();
 	jreq["tun"] = pull.to_json(); // convert TunBuilderCapture to JSON
+
+	// try the binary protocol first
+	{
+	  AgentProto::Message req;
+	  req.records.push_back(tun_setup_record(jreq));
+
+	  AgentProto::Message reply;
+	  if (BinaryConnection::instance().transact(req, reply))
+	    {
+	      const HANDLE proc = BinaryConnection::instance().agent_process();
+	      if (proc)
+		service_process.assign(proc);
+	      return get_binary_result(os, reply);
+	    }
+	}
+
 	const std::string jtxt = jreq.toStyledString();
 	os << jtxt; // dump it
 
@@ -191,7 +385,7 @@ namespace openvpn {
 	WS::ClientSet::new_request_synchronous(ts, stop);
 
 	// Get result
-	const Json::Value jres = get_json_result(os, *ts);
+	const json::FlatObject jres = get_json_result(os, *ts);
 
 	// Dump log
 	const std::string log_txt = json::get_string(jres, "log_txt");
@@ -239,7 +433,49 @@ namespace openvpn {
 	destroy_event.signal_event();
       }
 
-      Json::Value get_json_result(std::ostream& os, WS::ClientSet::TransactionSet& ts)
+      // the fields of a JSON tun-setup request, with only the
+      // TunBuilderCapture itself left as JSON
+      static AgentProto::Record tun_setup_record(const Json::Value& jreq)
+      {
+	AgentProto::Record r(AgentProto::TUN_SETUP);
+	if (jreq.isMember("pid"))
+	  r.set_uint(AgentProto::PID, jreq["pid"].asUInt());
+	const bool wintun = jreq["wintun"].asBool();
+	r.set_bool(AgentProto::WINTUN, wintun);
+	if (wintun)
+	  {
+	    r.set(AgentProto::SEND_RING_HMEM, jreq["send_ring_hmem"].asString());
+	    r.set(AgentProto::RECEIVE_RING_HMEM, jreq["receive_ring_hmem"].asString());
+	    r.set(AgentProto::SEND_RING_TAIL_MOVED, jreq["send_ring_tail_moved"].asString());
+	    r.set(AgentProto::RECEIVE_RING_TAIL_MOVED, jreq["receive_ring_tail_moved"].asString());
+	  }
+	r.set(AgentProto::CONFIRM_EVENT, jreq["confirm_event"].asString());
+	r.set(AgentProto::DESTROY_EVENT, jreq["destroy_event"].asString());
+	r.set(AgentProto::TUN, json::format_compact(jreq["tun"]));
+	return r;
+      }
+
+      HANDLE get_binary_result(std::ostream& os, const AgentProto::Message& reply)
+      {
+	if (reply.records.size() != 1 || reply.records[0].type != AgentProto::TUN_SETUP)
+	  throw ovpnagent("unexpected binary reply");
+	const AgentProto::Record& r = reply.records[0];
+	if (r.status != AgentProto::STATUS_OK)
+	  {
+	    os << r.get_string_optional(AgentProto::ERROR_TXT);
+	    throw ovpnagent("request error");
+	  }
+
+	// Dump log
+	os << r.get_string(AgentProto::LOG_TXT);
+
+	// Parse TAP handle
+	const std::string& tap_handle_hex = r.get_string(AgentProto::TAP_HANDLE_HEX);
+	os << "TAP handle: " << tap_handle_hex << std::endl;
+	return BufHex::parse<HANDLE>(tap_handle_hex, "TAP handle");
+      }
+
+      json::FlatObject get_json_result(std::ostream& os, WS::ClientSet::TransactionSet& ts)
       {
 	// Get content
 	if (ts.transactions.size() != 1)
@@ -276,14 +512,14 @@ namespace openvpn {
 	  }
 
 	// Parse the returned json dict
-	Json::Value jres;
-	Json::Reader reader;
-	if (!reader.parse(content, jres, false))
+	try {
+	  return json::FlatObject(content, "returned JSON");
+	}
+	catch (const json::json_parse& e)
 	  {
 	    os << content;
-	    OPENVPN_THROW(ovpnagent, "error parsing returned JSON: " << reader.getFormattedErrorMessages());
+	    OPENVPN_THROW(ovpnagent, "error parsing returned JSON: " << e.what());
 	  }
-	return jres;
       }
 
       Config::Ptr config;
@@ -24,6 +24,7 @@
 #define OPENVPN_COMMON_ACTION_H
 
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <ostream>
 #include <sstream>
@@ -42,6 +43,15 @@ namespace openvpn {
 
     virtual void execute(std::ostream& os) = 0;
     virtual std::string to_string() const = 0;
+
+    // ActionList offers each action the actions that follow it
+    // before executing it.  An action may accept them if it can
+    // execute them more efficiently together, in which case they
+    // are run by its next execute() instead of individually.
+    virtual bool batch_add(const Ptr& other)
+    {
+      return false;
+    }
 #ifdef HAVE_JSON
     virtual Json::Value to_json() const
     {
@@ -92,15 +102,31 @@ namespace openvpn {
       return false;
     }
 
+    // remove all actions equivalent to action
+    void remove(const Action::Ptr& action)
+    {
+      if (action)
+	{
+	  const std::string cmp = action->to_string();
+	  erase(std::remove_if(begin(), end(), [&cmp](const Action::Ptr& a) {
+		return a->to_string() == cmp;
+	      }), end());
+	}
+    }
+
     virtual void execute(std::ostream& os)
     {
       Iter i(size(), reverse_);
-      while (i())
+      bool more = i();
+      while (more)
 	{
 	  if (is_halt())
 	    return;
+	  Action& action = *(*this)[i.index()];
+	  while ((more = i()) && action.batch_add((*this)[i.index()]))
+	    ;
 	  try {
-	    (*this)[i.index()]->execute(os);
+	    action.execute(os);
 	  }
 	  catch (const std::exception& e)
 	    {
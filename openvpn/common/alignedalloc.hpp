@@ -0,0 +1,89 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Heap allocation on a cache line boundary.  Before C++17, new only
+// guarantees the alignment of max_align_t, so an alignas(64) member
+// doesn't keep a heap object off its neighbours' cache lines.
+// Types that need it derive from AlignedNew instead, and pad their
+// hot members out to CACHE_LINE_SIZE by hand.
+
+#ifndef OPENVPN_COMMON_ALIGNEDALLOC_H
+#define OPENVPN_COMMON_ALIGNEDALLOC_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include <openvpn/common/platform.hpp>
+
+#if defined(OPENVPN_PLATFORM_WIN)
+#include <malloc.h>
+#endif
+
+namespace openvpn {
+
+  enum {
+    CACHE_LINE_SIZE = 64,
+  };
+
+  inline void* aligned_malloc(const size_t align, const size_t size)
+  {
+#if defined(OPENVPN_PLATFORM_WIN)
+    void* p = ::_aligned_malloc(size, align);
+#else
+    void* p = nullptr;
+    if (::posix_memalign(&p, align, size))
+      p = nullptr;
+#endif
+    if (!p)
+      throw std::bad_alloc();
+    return p;
+  }
+
+  inline void aligned_free(void* p) noexcept
+  {
+#if defined(OPENVPN_PLATFORM_WIN)
+    ::_aligned_free(p);
+#else
+    std::free(p);
+#endif
+  }
+
+  // Heap instances of classes derived from this start on an ALIGN
+  // boundary.
+  template <size_t ALIGN = CACHE_LINE_SIZE>
+  struct AlignedNew
+  {
+    static void* operator new(const size_t size)
+    {
+      return aligned_malloc(ALIGN, size);
+    }
+
+    static void operator delete(void* p) noexcept
+    {
+      aligned_free(p);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Optional heap allocation accounting for hot paths.  When built with
+// OPENVPN_ALLOC_STATS (cmake -DALLOC_STATS=ON), allocations are
+// attributed to the phase the calling thread is in, as set by
+// SessionStats::AllocScope, and added to that scope's SessionStats
+// ALLOCS_* counters.  Without OPENVPN_ALLOC_STATS everything here
+// compiles to nothing.
+//
+// Every heap allocation is seen if the program replaces global
+// operator new with openvpn/common/allocstat_new.hpp.  Otherwise only
+// BufferAllocated data arrays and RC objects (on their first RCPtr
+// reference) are counted.
+
+#ifndef OPENVPN_COMMON_ALLOCSTAT_H
+#define OPENVPN_COMMON_ALLOCSTAT_H
+
+#include <cstdint>
+#include <atomic>
+
+namespace openvpn {
+  namespace AllocStats {
+
+    enum Phase {
+      NONE = 0,
+      DATA_ENCRYPT,
+      DATA_DECRYPT,
+      TUN_READ,
+      TUN_WRITE,
+      TRANSPORT_READ,
+      TRANSPORT_WRITE,
+      CONTROL,
+      N_PHASES
+    };
+
+#ifdef OPENVPN_ALLOC_STATS
+
+    struct ThreadState
+    {
+      Phase phase = NONE;
+      std::uint64_t n_new[N_PHASES] = {};    // from global operator new
+      std::uint64_t n_object[N_PHASES] = {}; // from BufferAllocated and RC
+    };
+
+    inline ThreadState& thread_state()
+    {
+      static thread_local ThreadState ts;
+      return ts;
+    }
+
+    // set by allocstat_new.hpp on the first allocation
+    inline std::atomic<bool>& global_new_hooked()
+    {
+      static std::atomic<bool> hooked{false};
+      return hooked;
+    }
+
+    inline void count_new() noexcept
+    {
+      ThreadState& ts = thread_state();
+      ++ts.n_new[ts.phase];
+    }
+
+    inline void count_object() noexcept
+    {
+      ThreadState& ts = thread_state();
+      ++ts.n_object[ts.phase];
+    }
+
+    // Enter phase p for the lifetime of this object.  Allocations
+    // are attributed to the innermost phase only, so a TUN_READ
+    // scope doesn't count what its nested DATA_ENCRYPT scope does.
+    class Scope
+    {
+    public:
+      Scope(const Phase p) noexcept
+	: ts(thread_state()),
+	  prev(ts.phase),
+	  phase(p),
+	  n_new(ts.n_new[p]),
+	  n_object(ts.n_object[p])
+      {
+	ts.phase = p;
+      }
+
+      ~Scope()
+      {
+	ts.phase = prev;
+      }
+
+      // allocations in this phase since construction
+      std::uint64_t count() const noexcept
+      {
+	if (global_new_hooked().load(std::memory_order_relaxed))
+	  return ts.n_new[phase] - n_new;
+	else
+	  return ts.n_object[phase] - n_object;
+      }
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+    private:
+      ThreadState& ts;
+      const Phase prev;
+      const Phase phase;
+      const std::uint64_t n_new;
+      const std::uint64_t n_object;
+    };
+
+#else
+
+    inline void count_new() noexcept {}
+    inline void count_object() noexcept {}
+
+    class Scope
+    {
+    public:
+      Scope(const Phase) noexcept {}
+      std::uint64_t count() const noexcept { return 0; }
+    };
+
+#endif
+  }
+}
+
+#endif
@@ -0,0 +1,58 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Replacement global operator new/delete that feeds AllocStats.
+// Include in exactly one translation unit of a program built with
+// OPENVPN_ALLOC_STATS, e.g. the one with main().
+
+#ifndef OPENVPN_COMMON_ALLOCSTAT_NEW_H
+#define OPENVPN_COMMON_ALLOCSTAT_NEW_H
+
+#include <cstdlib>
+#include <new>
+
+#include <openvpn/common/allocstat.hpp>
+
+#ifdef OPENVPN_ALLOC_STATS
+
+void* operator new(std::size_t size)
+{
+  openvpn::AllocStats::global_new_hooked().store(true, std::memory_order_relaxed);
+  openvpn::AllocStats::count_new();
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+#endif
+
+#endif
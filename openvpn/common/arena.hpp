@@ -0,0 +1,221 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Handshake-scoped arena for small, short-lived control channel
+// objects.  While an Arena::Scope is active on a thread, objects of
+// classes that use Arena::object_new()/object_delete() as their
+// operator new/delete (BufferAllocatedType, so every BufferPtr) are
+// bump-allocated from the arena's current chunk instead of the global
+// heap.  This keeps the many small objects of a TLS handshake
+// together rather than scattered between long-lived allocations,
+// which is what fragments the heap of a long-running server.
+//
+// Objects may outlive the arena's owner: each chunk counts its live
+// objects and is freed in one step when the last of them is released
+// after the owner has called retire() (KeyContext does so when it
+// reaches ACTIVE).  Releasing an object is safe on any thread.
+//
+// Define OPENVPN_NO_ARENA to allocate everything from the global heap.
+
+#ifndef OPENVPN_COMMON_ARENA_H
+#define OPENVPN_COMMON_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <new>
+
+#include <openvpn/common/rc.hpp>
+
+namespace openvpn {
+
+  class Arena : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<Arena> Ptr;
+
+    enum {
+      CHUNK_SIZE = 4096,
+      MAX_OBJECT = CHUNK_SIZE / 8, // larger objects use the global heap
+      HEADER = alignof(std::max_align_t) > sizeof(void*) ? alignof(std::max_align_t) : sizeof(void*),
+    };
+
+    struct Stats
+    {
+      unsigned long long arena_objects = 0;  // objects allocated from an arena
+      unsigned long long heap_objects = 0;   // arena-aware objects from the global heap
+      unsigned long long chunks = 0;         // chunks allocated
+    };
+
+    // Make arena the allocation arena of the calling thread for the
+    // lifetime of this object.  arena may be null.
+    class Scope
+    {
+    public:
+      Scope(Arena* arena) noexcept
+	: prev(current())
+      {
+	current() = arena;
+      }
+
+      ~Scope()
+      {
+	current() = prev;
+      }
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+    private:
+      Arena* const prev;
+    };
+
+    Arena() {}
+
+    ~Arena()
+    {
+      retire();
+    }
+
+    // Stop allocating from this arena.  Chunks are freed as soon as
+    // their last object is released.
+    void retire() noexcept
+    {
+      if (chunk)
+	{
+	  chunk->unref();
+	  chunk = nullptr;
+	}
+      retired = true;
+    }
+
+    bool is_retired() const noexcept
+    {
+      return retired;
+    }
+
+    // For use as a class operator new
+    static void* object_new(const std::size_t size)
+    {
+#ifndef OPENVPN_NO_ARENA
+      Arena* a = current();
+      if (a && !a->retired && size <= MAX_OBJECT)
+	return a->alloc(size);
+#endif
+
+      ++thread_stats().heap_objects;
+      void* block = ::operator new(HEADER + size);
+      header(block) = nullptr;
+      return static_cast<unsigned char*>(block) + HEADER;
+    }
+
+    // For use as a class operator delete
+    static void object_delete(void* p) noexcept
+    {
+      if (!p)
+	return;
+      void* block = static_cast<unsigned char*>(p) - HEADER;
+      Chunk* c = header(block);
+      if (c)
+	c->unref();
+      else
+	::operator delete(block);
+    }
+
+    // counters for the calling thread
+    static Stats stats()
+    {
+      return thread_stats();
+    }
+
+  private:
+    struct Chunk
+    {
+      // one reference for the arena while the chunk is current,
+      // plus one per live object
+      std::atomic<std::size_t> refs{1};
+      std::size_t used = 0;
+
+      void unref() noexcept
+      {
+	if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	  {
+	    this->~Chunk();
+	    ::operator delete(this);
+	  }
+      }
+
+      unsigned char* data() noexcept
+      {
+	return reinterpret_cast<unsigned char*>(this) + data_offset();
+      }
+
+      static constexpr std::size_t data_offset()
+      {
+	return (sizeof(Chunk) + HEADER - 1) / HEADER * HEADER;
+      }
+    };
+
+    void* alloc(const std::size_t size)
+    {
+      const std::size_t n = HEADER + (size + HEADER - 1) / HEADER * HEADER;
+      if (!chunk || chunk->used + n > CHUNK_SIZE - Chunk::data_offset())
+	{
+	  void* mem = ::operator new(CHUNK_SIZE);
+	  Chunk* c = new (mem) Chunk();
+	  ++thread_stats().chunks;
+	  if (chunk)
+	    chunk->unref();
+	  chunk = c;
+	}
+      unsigned char* block = chunk->data() + chunk->used;
+      chunk->used += n;
+      chunk->refs.fetch_add(1, std::memory_order_relaxed);
+      header(block) = chunk;
+      ++thread_stats().arena_objects;
+      return block + HEADER;
+    }
+
+    static Chunk*& header(void* block) noexcept
+    {
+      return *static_cast<Chunk**>(block);
+    }
+
+    static Arena*& current() noexcept
+    {
+      static thread_local Arena* arena = nullptr;
+      return arena;
+    }
+
+    static Stats& thread_stats() noexcept
+    {
+      static thread_local Stats s;
+      return s;
+    }
+
+    Chunk* chunk = nullptr;
+    bool retired = false;
+  };
+
+}
+
+#endif
@@ -20,17 +20,35 @@
 //    If not, see <http://www.gnu.org/licenses/>.
 
 // General-purpose base64 encode and decode.
+//
+// On x86 (SSSE3/AVX2, picked at runtime) and AArch64 (NEON), the
+// bulk of the input is handled by vector kernels that translate
+// whole blocks of characters.  A decode block that contains anything
+// other than alphabet characters -- padding, whitespace, garbage --
+// is left to the scalar loop, so the result and the exceptions
+// thrown are the same as without the kernels.
 
 #ifndef OPENVPN_COMMON_BASE64_H
 #define OPENVPN_COMMON_BASE64_H
 
 #include <string>
 #include <cstring> // for std::memset, std::strlen
+#include <algorithm>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/extern.hpp>
 
+#if !defined(OPENVPN_BASE64_NO_SIMD)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OPENVPN_BASE64_SSE
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define OPENVPN_BASE64_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 namespace openvpn {
 
   class Base64 {
@@ -44,6 +62,7 @@ namespace openvpn {
       {}
 
       size_t size() const { return size_; }
+      const unsigned char *data() const { return data_; }
       unsigned char operator[](const size_t i) const { return data_[i]; }
 
 
@@ -73,6 +92,18 @@ namespace openvpn {
 	  data[index++]=c;
 	}
 
+	void append(const unsigned char *src, const size_t n)
+	{
+	  const size_t avail = size - index;
+	  std::memcpy(data + index, src, std::min(n, avail));
+	  if (n > avail)
+	    {
+	      index = size;
+	      throw base64_decode_out_of_bound_error();
+	    }
+	  index += n;
+	}
+
 	unsigned char *data;
 	size_t size;
 	size_t index;
@@ -118,6 +149,21 @@ namespace openvpn {
 	    dec[c] = (unsigned char)i;
 	  }
       }
+
+      // The vector decoder classifies characters by range, which only
+      // works if the two extra characters and the pad character are
+      // distinct and outside of [A-Za-z0-9].
+      simd_decode = !is_alnum(enc[62]) && !is_alnum(enc[63]) && !is_alnum(equal)
+		    && enc[62] != enc[63] && enc[62] != equal && enc[63] != equal;
+
+      // offsets added to a 6-bit value to get its character, see enc_map()
+      std::memset(enc_lut, 0, sizeof(enc_lut));
+      enc_lut[0] = 'a' - 26;
+      for (unsigned int i = 1; i <= 10; ++i)
+	enc_lut[i] = (unsigned char)('0' - 52);
+      enc_lut[11] = (unsigned char)(enc[62] - 62);
+      enc_lut[12] = (unsigned char)(enc[63] - 63);
+      enc_lut[13] = 'A';
     }
 
     static size_t decode_size_max(const size_t encode_size)
@@ -139,7 +185,13 @@ namespace openvpn {
       const size_t size = data.size();
 
       p = s = new char[encode_size_max(size)];
-      for (i = 0; i < size; ) {
+      i = 0;
+      if (const unsigned char *src = contiguous(data, 0))
+	{
+	  i = encode_blocks(src, size, p);
+	  p += i / 3 * 4;
+	}
+      while (i < size) {
 	c = static_cast<unsigned char>(data[i++]) << 8;
 	if (i < size)
 	  c += static_cast<unsigned char>(data[i]);
@@ -195,7 +247,10 @@ namespace openvpn {
     template <typename V>
     void decode(V& dest, const std::string& str) const
     {
-      for (const char *p = str.c_str(); *p != '\0' && (*p == equal || is_base64_char(*p)); p += 4)
+      const char *p = str.c_str();
+      if (simd_decode)
+	p += decode_blocks(dest, p, str.length());
+      for (; *p != '\0' && (*p == equal || is_base64_char(*p)); p += 4)
 	{
 	  unsigned int marker;
 	  const unsigned int val = token_decode(p, marker);
@@ -281,9 +336,336 @@ namespace openvpn {
       return (-1 - decoded_len) % 3;
     }
 
+    static bool is_alnum(const unsigned char c)
+    {
+      return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+    }
+
+    // Pointer to the bytes of a contiguous container, or nullptr if
+    // the container can only be indexed.
+    static const unsigned char *byte_ptr(const char *p) { return (const unsigned char *)p; }
+    static const unsigned char *byte_ptr(const unsigned char *p) { return p; }
+
+    template <typename V>
+    static auto contiguous(const V& data, int) -> decltype(byte_ptr(data.data()))
+    {
+      return byte_ptr(data.data());
+    }
+
+    template <typename V>
+    static auto contiguous(const V& data, long) -> decltype(byte_ptr(data.c_data()))
+    {
+      return byte_ptr(data.c_data());
+    }
+
+    template <typename V>
+    static const unsigned char *contiguous(const V&, ...)
+    {
+      return nullptr;
+    }
+
+    template <typename V>
+    static void append(V& dest, const unsigned char *src, const size_t n)
+    {
+      for (size_t i = 0; i < n; ++i)
+	dest.push_back(src[i]);
+    }
+
+    static void append(std::string& dest, const unsigned char *src, const size_t n)
+    {
+      dest.append((const char *)src, n);
+    }
+
+    static void append(UCharWrap& dest, const unsigned char *src, const size_t n)
+    {
+      dest.append(src, n);
+    }
+
+    // Encode whole blocks from the start of src to dst.  Returns the
+    // number of bytes consumed, a multiple of 3 that leaves the tail
+    // to the scalar loop.
+    size_t encode_blocks(const unsigned char *src, const size_t len, char *dst) const
+    {
+      size_t i = 0;
+#if defined(OPENVPN_BASE64_SSE)
+      if (have_avx2())
+	i = encode_avx2(src, len, dst);
+      if (have_ssse3())
+	i += encode_ssse3(src + i, len - i, dst + i / 3 * 4);
+#elif defined(OPENVPN_BASE64_NEON)
+      i = encode_neon(src, len, dst);
+#endif
+      return i;
+    }
+
+    // Decode whole blocks of alphabet characters from the start of
+    // src, stopping at the first block that isn't.  Returns the number
+    // of characters consumed, a multiple of 4.
+    template <typename V>
+    size_t decode_blocks(V& dest, const char *src, const size_t len) const
+    {
+      enum { CHUNK = 256 };
+      size_t i = 0;
+#if defined(OPENVPN_BASE64_SSE) || defined(OPENVPN_BASE64_NEON)
+      unsigned char out[CHUNK / 4 * 3 + 16]; // kernels may store past the end
+      while (len - i >= 16)
+	{
+	  const size_t n = std::min(len - i, size_t(CHUNK));
+	  size_t done = 0;
+#if defined(OPENVPN_BASE64_SSE)
+	  if (have_avx2())
+	    done = decode_avx2(src + i, n, out);
+	  if (have_ssse3())
+	    done += decode_ssse3(src + i + done, n - done, out + done / 4 * 3);
+#else
+	  done = decode_neon(src + i, n, out);
+#endif
+	  append(dest, out, done / 4 * 3);
+	  i += done;
+	  if (done != n)
+	    break;
+	}
+#endif
+      return i;
+    }
+
+#if defined(OPENVPN_BASE64_SSE)
+    static bool have_ssse3()
+    {
+      static const bool ssse3 = __builtin_cpu_supports("ssse3");
+      return ssse3;
+    }
+
+    static bool have_avx2()
+    {
+      static const bool avx2 = __builtin_cpu_supports("avx2");
+      return avx2;
+    }
+
+    // The encoder works on 16-bit lanes holding byte pairs [1,0] [2,1]
+    // of each 3-byte group and uses multiplies as per-lane shifts to
+    // move the four 6-bit fields into their own bytes.  The fields are
+    // then mapped to characters by adding an offset looked up by range
+    // in enc_lut: 0-25 -> [13], 26-51 -> [0], 52-61 -> [1..10],
+    // 62 -> [11], 63 -> [12].
+
+    __attribute__((target("ssse3")))
+    static __m128i enc_split(const __m128i in)
+    {
+      const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+      const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+      return _mm_or_si128(t0, t1);
+    }
+
+    __attribute__((target("ssse3")))
+    static __m128i enc_map(const __m128i idx, const __m128i lut)
+    {
+      __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+      r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+      return _mm_add_epi8(idx, _mm_shuffle_epi8(lut, r));
+    }
+
+    // 12 bytes in (16 read), 16 characters out
+    __attribute__((target("ssse3")))
+    size_t encode_ssse3(const unsigned char *src, const size_t len, char *dst) const
+    {
+      const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+      const __m128i lut = _mm_loadu_si128((const __m128i *)enc_lut);
+      size_t i = 0;
+      for (; i + 16 <= len; i += 12, dst += 16)
+	{
+	  const __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), shuf);
+	  _mm_storeu_si128((__m128i *)dst, enc_map(enc_split(in), lut));
+	}
+      return i;
+    }
+
+    // 24 bytes in (28 read), 32 characters out
+    __attribute__((target("avx2")))
+    size_t encode_avx2(const unsigned char *src, const size_t len, char *dst) const
+    {
+      const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+					    1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+      const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)enc_lut));
+      size_t i = 0;
+      for (; i + 28 <= len; i += 24, dst += 32)
+	{
+	  __m256i in = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i)));
+	  in = _mm256_inserti128_si256(in, _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+	  in = _mm256_shuffle_epi8(in, shuf);
+
+	  const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+	  const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+	  const __m256i idx = _mm256_or_si256(t0, t1);
+
+	  __m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+	  r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+	  _mm256_storeu_si256((__m256i *)dst, _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, r)));
+	}
+      return i;
+    }
+
+    // The decoder maps characters to 6-bit values by range, rejecting
+    // the block if any character is out of every range, then packs
+    // four values to three bytes with multiply-adds.
+
+    __attribute__((target("ssse3")))
+    static __m128i in_range(const __m128i c, const char lo, const char hi)
+    {
+      return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+    }
+
+    __attribute__((target("ssse3")))
+    bool dec_map(const __m128i c, __m128i& val) const
+    {
+      const __m128i upper = in_range(c, 'A', 'Z');
+      const __m128i lower = in_range(c, 'a', 'z');
+      const __m128i digit = in_range(c, '0', '9');
+      const __m128i c62 = _mm_cmpeq_epi8(c, _mm_set1_epi8(enc[62]));
+      const __m128i c63 = _mm_cmpeq_epi8(c, _mm_set1_epi8(enc[63]));
+      const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(c62, c63)));
+      if (_mm_movemask_epi8(valid) != 0xFFFF)
+	return false;
+      __m128i off = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+      off = _mm_or_si128(off, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+      off = _mm_or_si128(off, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+      off = _mm_or_si128(off, _mm_and_si128(c62, _mm_set1_epi8(char(62 - enc[62]))));
+      off = _mm_or_si128(off, _mm_and_si128(c63, _mm_set1_epi8(char(63 - enc[63]))));
+      val = _mm_add_epi8(c, off);
+      return true;
+    }
+
+    // 16 x 6-bit values -> 12 bytes in the low part of the result
+    __attribute__((target("ssse3")))
+    static __m128i dec_pack(const __m128i val)
+    {
+      const __m128i m = _mm_maddubs_epi16(val, _mm_set1_epi32(0x01400140));
+      const __m128i w = _mm_madd_epi16(m, _mm_set1_epi32(0x00011000));
+      return _mm_shuffle_epi8(w, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+
+    // 16 characters in, 12 bytes out (16 written)
+    __attribute__((target("ssse3")))
+    size_t decode_ssse3(const char *src, const size_t len, unsigned char *dst) const
+    {
+      size_t i = 0;
+      for (; i + 16 <= len; i += 16, dst += 12)
+	{
+	  __m128i val;
+	  if (!dec_map(_mm_loadu_si128((const __m128i *)(src + i)), val))
+	    break;
+	  _mm_storeu_si128((__m128i *)dst, dec_pack(val));
+	}
+      return i;
+    }
+
+    // 32 characters in, 24 bytes out (28 written)
+    __attribute__((target("avx2")))
+    size_t decode_avx2(const char *src, const size_t len, unsigned char *dst) const
+    {
+      size_t i = 0;
+      for (; i + 32 <= len; i += 32, dst += 24)
+	{
+	  const __m256i c = _mm256_loadu_si256((const __m256i *)(src + i));
+	  const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+	  const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+	  const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+	  const __m256i c62 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(enc[62]));
+	  const __m256i c63 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(enc[63]));
+	  const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(c62, c63)));
+	  if (_mm256_movemask_epi8(valid) != -1)
+	    break;
+	  __m256i off = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+	  off = _mm256_or_si256(off, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+	  off = _mm256_or_si256(off, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+	  off = _mm256_or_si256(off, _mm256_and_si256(c62, _mm256_set1_epi8(char(62 - enc[62]))));
+	  off = _mm256_or_si256(off, _mm256_and_si256(c63, _mm256_set1_epi8(char(63 - enc[63]))));
+	  const __m256i val = _mm256_add_epi8(c, off);
+
+	  const __m256i m = _mm256_maddubs_epi16(val, _mm256_set1_epi32(0x01400140));
+	  const __m256i w = _mm256_madd_epi16(m, _mm256_set1_epi32(0x00011000));
+	  const __m256i out = _mm256_shuffle_epi8(w, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+								     2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	  _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(out));
+	  _mm_storeu_si128((__m128i *)(dst + 12), _mm256_extracti128_si256(out, 1));
+	}
+      return i;
+    }
+#endif
+
+#if defined(OPENVPN_BASE64_NEON)
+    // NEON has de-interleaving loads and stores and a 64-byte table
+    // lookup, so the 6-bit fields are simply shifted into place.
+
+    // 48 bytes in, 64 characters out
+    size_t encode_neon(const unsigned char *src, const size_t len, char *dst) const
+    {
+      uint8x16x4_t tbl;
+      tbl.val[0] = vld1q_u8(enc);
+      tbl.val[1] = vld1q_u8(enc + 16);
+      tbl.val[2] = vld1q_u8(enc + 32);
+      tbl.val[3] = vld1q_u8(enc + 48);
+      const uint8x16_t m3f = vdupq_n_u8(0x3f);
+      size_t i = 0;
+      for (; i + 48 <= len; i += 48, dst += 64)
+	{
+	  const uint8x16x3_t in = vld3q_u8(src + i);
+	  uint8x16x4_t out;
+	  out.val[0] = vqtbl4q_u8(tbl, vshrq_n_u8(in.val[0], 2));
+	  out.val[1] = vqtbl4q_u8(tbl, vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), m3f));
+	  out.val[2] = vqtbl4q_u8(tbl, vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), m3f));
+	  out.val[3] = vqtbl4q_u8(tbl, vandq_u8(in.val[2], m3f));
+	  vst4q_u8((unsigned char *)dst, out);
+	}
+      return i;
+    }
+
+    // Maps c to 6-bit values, returns all-ones lanes where c was valid.
+    uint8x16_t dec_map(const uint8x16_t c, uint8x16_t& val) const
+    {
+      const uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+      const uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+      const uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+      const uint8x16_t c62 = vceqq_u8(c, vdupq_n_u8(enc[62]));
+      const uint8x16_t c63 = vceqq_u8(c, vdupq_n_u8(enc[63]));
+      uint8x16_t off = vandq_u8(upper, vdupq_n_u8((unsigned char)-'A'));
+      off = vorrq_u8(off, vandq_u8(lower, vdupq_n_u8((unsigned char)(26 - 'a'))));
+      off = vorrq_u8(off, vandq_u8(digit, vdupq_n_u8((unsigned char)(52 - '0'))));
+      off = vorrq_u8(off, vandq_u8(c62, vdupq_n_u8((unsigned char)(62 - enc[62]))));
+      off = vorrq_u8(off, vandq_u8(c63, vdupq_n_u8((unsigned char)(63 - enc[63]))));
+      val = vaddq_u8(c, off);
+      return vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(c62, c63)));
+    }
+
+    // 64 characters in, 48 bytes out
+    size_t decode_neon(const char *src, const size_t len, unsigned char *dst) const
+    {
+      size_t i = 0;
+      for (; i + 64 <= len; i += 64, dst += 48)
+	{
+	  const uint8x16x4_t c = vld4q_u8((const unsigned char *)(src + i));
+	  uint8x16_t v0, v1, v2, v3;
+	  uint8x16_t ok = dec_map(c.val[0], v0);
+	  ok = vandq_u8(ok, dec_map(c.val[1], v1));
+	  ok = vandq_u8(ok, dec_map(c.val[2], v2));
+	  ok = vandq_u8(ok, dec_map(c.val[3], v3));
+	  if (vminvq_u8(ok) != 0xFF)
+	    break;
+	  uint8x16x3_t out;
+	  out.val[0] = vorrq_u8(vshlq_n_u8(v0, 2), vshrq_n_u8(v1, 4));
+	  out.val[1] = vorrq_u8(vshlq_n_u8(v1, 4), vshrq_n_u8(v2, 2));
+	  out.val[2] = vorrq_u8(vshlq_n_u8(v2, 6), v3);
+	  vst3q_u8(dst, out);
+	}
+      return i;
+    }
+#endif
+
     unsigned char enc[64];
     unsigned char dec[128];
     unsigned char equal;
+    unsigned char enc_lut[16];
+    bool simd_decode;
   };
 
   // provide a static Base64 object
@@ -0,0 +1,86 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Compile-time build profile, for builds that only need part of the
+// data channel, such as embedded routers that only ever run AES-GCM.
+//
+// Define OPENVPN_PROFILE_GCM_ONLY to select the embedded profile, or
+// any of these to exclude single engines:
+//
+//   OPENVPN_NO_CBC_HMAC    -- CBC/HMAC data channel (crypto_chm.hpp)
+//   OPENVPN_NO_COMPRESS    -- LZO, LZ4 and Snappy compressors, but not
+//                             the stubs for compression framing
+//   OPENVPN_SINGLE_SSL_LIB -- fail the build if more than one SSL
+//                             library is selected
+//
+// Excluded engines are not compiled at all.  At run time the
+// BuildProfile flags below let code reject or skip them, e.g. a
+// server pushing a CBC cipher fails the CryptoDCSelect lookup.
+
+#ifndef OPENVPN_COMMON_BUILDPROFILE_H
+#define OPENVPN_COMMON_BUILDPROFILE_H
+
+#ifdef OPENVPN_PROFILE_GCM_ONLY
+#ifndef OPENVPN_NO_CBC_HMAC
+#define OPENVPN_NO_CBC_HMAC
+#endif
+#ifndef OPENVPN_NO_COMPRESS
+#define OPENVPN_NO_COMPRESS
+#endif
+#ifndef OPENVPN_SINGLE_SSL_LIB
+#define OPENVPN_SINGLE_SSL_LIB
+#endif
+#endif
+
+#ifdef OPENVPN_NO_COMPRESS
+#ifndef NO_LZO
+#define NO_LZO
+#endif
+#undef HAVE_LZ4
+#undef HAVE_SNAPPY
+#endif
+
+namespace openvpn {
+  namespace BuildProfile {
+
+#ifdef OPENVPN_NO_CBC_HMAC
+    constexpr bool cbc_hmac = false;
+#else
+    constexpr bool cbc_hmac = true;
+#endif
+
+#ifdef OPENVPN_NO_COMPRESS
+    constexpr bool compress = false;
+#else
+    constexpr bool compress = true;
+#endif
+
+    // data channel cipher used when the config doesn't name one
+    inline const char *default_dc_cipher()
+    {
+      return cbc_hmac ? "BF-CBC" : "AES-256-GCM";
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,291 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Hashing for internal hash tables, without the HAVE_CITYHASH
+// dependency of hash.hpp.
+//
+// FastHash is wyhash (final version 4, public domain): fast on short
+// keys such as addresses, with good dispersion in all bits.  It is
+// not meant to stand up to an attacker choosing keys to collide, so
+// tables keyed by values a remote peer picks (its address and port,
+// its session ID) should use SipHash-2-4 keyed with
+// SipHash::process_key(), a random key drawn once per process.
+//
+// FastHash reads words in host byte order, so its values are only
+// meant to be stable within a process.
+
+#ifndef OPENVPN_COMMON_FASTHASH_H
+#define OPENVPN_COMMON_FASTHASH_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <type_traits>
+
+namespace openvpn {
+
+  namespace FastHash {
+
+    // 64x64 -> 128 bit multiply, high and low halves
+    inline void mum(std::uint64_t& a, std::uint64_t& b)
+    {
+#if defined(__SIZEOF_INT128__)
+      const unsigned __int128 r = (unsigned __int128)a * b;
+      a = (std::uint64_t)r;
+      b = (std::uint64_t)(r >> 64);
+#else
+      const std::uint64_t ha = a >> 32, hb = b >> 32, la = (std::uint32_t)a, lb = (std::uint32_t)b;
+      const std::uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+      const std::uint64_t t = rl + (rm0 << 32);
+      std::uint64_t c = t < rl;
+      const std::uint64_t lo = t + (rm1 << 32);
+      c += lo < t;
+      b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+      a = lo;
+#endif
+    }
+
+    inline std::uint64_t mix(std::uint64_t a, std::uint64_t b)
+    {
+      mum(a, b);
+      return a ^ b;
+    }
+
+    namespace detail {
+      constexpr std::uint64_t S0 = 0x2d358dccaa6c78a5ull;
+      constexpr std::uint64_t S1 = 0x8bb84b93962eacc9ull;
+      constexpr std::uint64_t S2 = 0x4b33a62ed433d4a3ull;
+      constexpr std::uint64_t S3 = 0x4d5a2da51de1aa47ull;
+
+      inline std::uint64_t r8(const unsigned char *p)
+      {
+	std::uint64_t v;
+	std::memcpy(&v, p, 8);
+	return v;
+      }
+
+      inline std::uint64_t r4(const unsigned char *p)
+      {
+	std::uint32_t v;
+	std::memcpy(&v, p, 4);
+	return v;
+      }
+
+      inline std::uint64_t r3(const unsigned char *p, const std::size_t k)
+      {
+	return (std::uint64_t(p[0]) << 16) | (std::uint64_t(p[k >> 1]) << 8) | p[k - 1];
+      }
+    }
+
+    inline std::uint64_t hash(const void *data, const std::size_t len, std::uint64_t seed = 0)
+    {
+      using namespace detail;
+      const unsigned char *p = (const unsigned char *)data;
+      std::uint64_t a, b;
+      seed ^= mix(seed ^ S0, S1);
+      if (len <= 16)
+	{
+	  if (len >= 4)
+	    {
+	      a = (r4(p) << 32) | r4(p + ((len >> 3) << 2));
+	      b = (r4(p + len - 4) << 32) | r4(p + len - 4 - ((len >> 3) << 2));
+	    }
+	  else if (len > 0)
+	    {
+	      a = r3(p, len);
+	      b = 0;
+	    }
+	  else
+	    a = b = 0;
+	}
+      else
+	{
+	  std::size_t i = len;
+	  if (i > 48)
+	    {
+	      std::uint64_t see1 = seed, see2 = seed;
+	      do {
+		seed = mix(r8(p) ^ S1, r8(p + 8) ^ seed);
+		see1 = mix(r8(p + 16) ^ S2, r8(p + 24) ^ see1);
+		see2 = mix(r8(p + 32) ^ S3, r8(p + 40) ^ see2);
+		p += 48;
+		i -= 48;
+	      } while (i > 48);
+	      seed ^= see1 ^ see2;
+	    }
+	  while (i > 16)
+	    {
+	      seed = mix(r8(p) ^ S1, r8(p + 8) ^ seed);
+	      i -= 16;
+	      p += 16;
+	    }
+	  a = r8(p + i - 16);
+	  b = r8(p + i - 8);
+	}
+      a ^= S1;
+      b ^= seed;
+      mum(a, b);
+      return mix(a ^ S0 ^ len, b ^ S1);
+    }
+
+    // hash of a single word, such as a peer ID
+    inline std::uint64_t hash64(const std::uint64_t v, const std::uint64_t seed = 0)
+    {
+      return mix(v ^ seed ^ detail::S0, v ^ detail::S1);
+    }
+
+    // Incremental hasher, with the interface of Hash64 in hash.hpp
+    // for use with the hash(HASH&) methods of IP::Addr and friends.
+    class Hasher
+    {
+    public:
+      Hasher(const std::uint64_t seed = 0)
+	: hashval(seed)
+      {
+      }
+
+      void operator()(const void *data, const std::size_t size)
+      {
+	hashval = hash(data, size, hashval);
+      }
+
+      void operator()(const std::string& str)
+      {
+	(*this)(str.c_str(), str.length());
+      }
+
+      template <typename T>
+      void operator()(const T& obj)
+      {
+	static_assert(std::is_pod<T>::value, "FastHash::Hasher: POD type required");
+	(*this)(&obj, sizeof(obj));
+      }
+
+      std::uint64_t value() const
+      {
+	return hashval;
+      }
+
+    private:
+      std::uint64_t hashval;
+    };
+  }
+
+  // SipHash-2-4, a keyed hash for tables whose keys an attacker may
+  // choose.
+  class SipHash
+  {
+  public:
+    struct Key
+    {
+      std::uint64_t k0 = 0;
+      std::uint64_t k1 = 0;
+    };
+
+    static std::uint64_t hash(const Key& key, const void *data, const std::size_t len)
+    {
+      const unsigned char *p = (const unsigned char *)data;
+      std::uint64_t v0 = key.k0 ^ 0x736f6d6570736575ull;
+      std::uint64_t v1 = key.k1 ^ 0x646f72616e646f6dull;
+      std::uint64_t v2 = key.k0 ^ 0x6c7967656e657261ull;
+      std::uint64_t v3 = key.k1 ^ 0x7465646279746573ull;
+
+      const unsigned char *end = p + (len & ~std::size_t(7));
+      for (; p != end; p += 8)
+	{
+	  const std::uint64_t m = le64(p);
+	  v3 ^= m;
+	  round(v0, v1, v2, v3);
+	  round(v0, v1, v2, v3);
+	  v0 ^= m;
+	}
+
+      std::uint64_t b = std::uint64_t(len) << 56;
+      switch (len & 7)
+	{
+	case 7: b |= std::uint64_t(p[6]) << 48; // fall through
+	case 6: b |= std::uint64_t(p[5]) << 40; // fall through
+	case 5: b |= std::uint64_t(p[4]) << 32; // fall through
+	case 4: b |= std::uint64_t(p[3]) << 24; // fall through
+	case 3: b |= std::uint64_t(p[2]) << 16; // fall through
+	case 2: b |= std::uint64_t(p[1]) << 8;  // fall through
+	case 1: b |= std::uint64_t(p[0]);
+	}
+      v3 ^= b;
+      round(v0, v1, v2, v3);
+      round(v0, v1, v2, v3);
+      v0 ^= b;
+
+      v2 ^= 0xff;
+      for (int i = 0; i < 4; ++i)
+	round(v0, v1, v2, v3);
+      return v0 ^ v1 ^ v2 ^ v3;
+    }
+
+    static std::uint64_t hash(const void *data, const std::size_t len)
+    {
+      return hash(process_key(), data, len);
+    }
+
+    // random key, drawn on first use
+    static const Key& process_key()
+    {
+      static const Key key = random_key();
+      return key;
+    }
+
+  private:
+    static Key random_key()
+    {
+      std::random_device rd;
+      Key k;
+      k.k0 = (std::uint64_t(rd()) << 32) ^ rd();
+      k.k1 = (std::uint64_t(rd()) << 32) ^ rd();
+      return k;
+    }
+
+    static std::uint64_t rotl(const std::uint64_t x, const int b)
+    {
+      return (x << b) | (x >> (64 - b));
+    }
+
+    static void round(std::uint64_t& v0, std::uint64_t& v1, std::uint64_t& v2, std::uint64_t& v3)
+    {
+      v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+      v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+      v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+      v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    }
+
+    static std::uint64_t le64(const unsigned char *p)
+    {
+      return std::uint64_t(p[0]) | (std::uint64_t(p[1]) << 8)
+	| (std::uint64_t(p[2]) << 16) | (std::uint64_t(p[3]) << 24)
+	| (std::uint64_t(p[4]) << 32) | (std::uint64_t(p[5]) << 40)
+	| (std::uint64_t(p[6]) << 48) | (std::uint64_t(p[7]) << 56);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,752 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Single-pass JSON parser for the common case of a document whose
+// top level is a dictionary of scalars, such as agent replies and
+// AWS metadata/API responses.  Nested arrays and dictionaries are
+// validated and skipped, and only their presence is recorded.
+//
+// The document text is owned by the object, and string values are
+// unescaped in place, so a parse makes one allocation for the text
+// (none when moved in) and one for the member table, instead of a
+// DOM node and string per value.  The json::get_*() helpers of
+// jsonhelper.hpp are overloaded for FlatObject with the same
+// signatures and error messages, so consumers only change the
+// type of their root.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/jsonhelperfmt.hpp>
+
+namespace openvpn {
+  namespace json {
+
+    class FlatObject
+    {
+    public:
+      enum Type {
+	NULL_VALUE,
+	STRING,
+	NUMBER,
+	BOOL,
+	ARRAY,  // contents skipped
+	OBJECT, // contents skipped
+      };
+
+      struct Value
+      {
+	std::string str() const
+	{
+	  return std::string(data, size);
+	}
+
+	bool equals(const char *s) const
+	{
+	  return std::strlen(s) == size && !std::memcmp(s, data, size);
+	}
+
+	Type type;
+	const char *data; // STRING: unescaped; NUMBER, BOOL: source text
+	size_t size;
+      };
+
+      FlatObject() {}
+
+      template <typename TITLE>
+      FlatObject(std::string text_arg, const TITLE& title)
+      {
+	parse(std::move(text_arg), title);
+      }
+
+      explicit FlatObject(std::string text_arg)
+      {
+	parse(std::move(text_arg), "json");
+      }
+
+      FlatObject(const FlatObject&) = delete;
+      FlatObject& operator=(const FlatObject&) = delete;
+
+      FlatObject(FlatObject&& other) noexcept
+      {
+	*this = std::move(other);
+      }
+
+      // the members point into the text, which may move with it
+      FlatObject& operator=(FlatObject&& other) noexcept
+      {
+	const char *old_base = other.text.data();
+	text = std::move(other.text);
+	members = std::move(other.members);
+	const char *new_base = text.data();
+	for (auto& m : members)
+	  {
+	    m.name = new_base + (m.name - old_base);
+	    m.value.data = new_base + (m.value.data - old_base);
+	  }
+	return *this;
+      }
+
+      template <typename TITLE>
+      void parse(std::string text_arg, const TITLE& title)
+      {
+	text = std::move(text_arg);
+	members.clear();
+	try {
+	  Parser p(&text[0], text.length());
+	  p.parse_object(members);
+	}
+	catch (const std::exception& e)
+	  {
+	    members.clear();
+	    throw json_parse(StringTempl::to_string(title) + " : " + e.what());
+	  }
+      }
+
+      // returns nullptr if absent; the last duplicate wins, as with jsoncpp
+      const Value* find(const char *name) const
+      {
+	const size_t len = std::strlen(name);
+	for (auto i = members.rbegin(); i != members.rend(); ++i)
+	  if (i->name_size == len && !std::memcmp(i->name, name, len))
+	    return &i->value;
+	return nullptr;
+      }
+
+      const Value* find(const std::string& name) const
+      {
+	return find(name.c_str());
+      }
+
+      size_t size() const
+      {
+	return members.size();
+      }
+
+    private:
+      struct Member
+      {
+	const char *name;
+	size_t name_size;
+	Value value;
+      };
+
+      class Parser
+      {
+      public:
+	Parser(char *data, const size_t size)
+	  : p(data),
+	    end(data + size)
+	{
+	}
+
+	void parse_object(std::vector<Member>& members)
+	{
+	  skip_ws();
+	  expect('{');
+	  skip_ws();
+	  if (peek() == '}')
+	    ++p;
+	  else
+	    {
+	      while (true)
+		{
+		  skip_ws();
+		  Member m;
+		  m.name = parse_string(m.name_size);
+		  skip_ws();
+		  expect(':');
+		  skip_ws();
+		  m.value = parse_value(0);
+		  members.push_back(m);
+		  skip_ws();
+		  if (peek() == ',')
+		    ++p;
+		  else
+		    {
+		      expect('}');
+		      break;
+		    }
+		}
+	    }
+	  skip_ws();
+	  if (p != end)
+	    throw Exception("trailing data after top-level dictionary");
+	}
+
+      private:
+	enum {
+	  MAX_DEPTH = 64,
+	};
+
+	char peek() const
+	{
+	  if (p == end)
+	    throw Exception("unexpected end of document");
+	  return *p;
+	}
+
+	void expect(const char c)
+	{
+	  if (peek() != c)
+	    throw Exception(std::string("expected '") + c + '\'');
+	  ++p;
+	}
+
+	void skip_ws()
+	{
+	  while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+	    ++p;
+	}
+
+	void literal(const char *lit)
+	{
+	  const size_t len = std::strlen(lit);
+	  if (size_t(end - p) < len || std::memcmp(p, lit, len))
+	    throw Exception("bad literal");
+	  p += len;
+	}
+
+	Value parse_value(const int depth)
+	{
+	  Value v;
+	  v.data = p;
+	  v.size = 0;
+	  switch (peek())
+	    {
+	    case '"':
+	      v.type = STRING;
+	      v.data = parse_string(v.size);
+	      break;
+	    case '{':
+	    case '[':
+	      v.type = *p == '{' ? OBJECT : ARRAY;
+	      skip_container(depth + 1);
+	      break;
+	    case 't':
+	      v.type = BOOL;
+	      literal("true");
+	      v.size = 4;
+	      break;
+	    case 'f':
+	      v.type = BOOL;
+	      literal("false");
+	      v.size = 5;
+	      break;
+	    case 'n':
+	      v.type = NULL_VALUE;
+	      literal("null");
+	      break;
+	    default:
+	      v.type = NUMBER;
+	      parse_number();
+	      v.size = p - v.data;
+	      break;
+	    }
+	  return v;
+	}
+
+	void skip_container(const int depth)
+	{
+	  if (depth > MAX_DEPTH)
+	    throw Exception("nesting too deep");
+	  const char close = *p++ == '{' ? '}' : ']';
+	  skip_ws();
+	  if (peek() == close)
+	    {
+	      ++p;
+	      return;
+	    }
+	  while (true)
+	    {
+	      skip_ws();
+	      if (close == '}')
+		{
+		  size_t size;
+		  parse_string(size);
+		  skip_ws();
+		  expect(':');
+		  skip_ws();
+		}
+	      parse_value(depth);
+	      skip_ws();
+	      if (peek() == ',')
+		++p;
+	      else
+		{
+		  expect(close);
+		  return;
+		}
+	    }
+	}
+
+	void digits()
+	{
+	  const char *start = p;
+	  while (p != end && *p >= '0' && *p <= '9')
+	    ++p;
+	  if (p == start)
+	    throw Exception("bad number");
+	}
+
+	void parse_number()
+	{
+	  if (peek() == '-')
+	    ++p;
+	  if (peek() == '0')
+	    ++p;
+	  else
+	    digits();
+	  if (p != end && *p == '.')
+	    {
+	      ++p;
+	      digits();
+	    }
+	  if (p != end && (*p == 'e' || *p == 'E'))
+	    {
+	      ++p;
+	      if (peek() == '+' || *p == '-')
+		++p;
+	      digits();
+	    }
+	}
+
+	unsigned int hex4()
+	{
+	  if (end - p < 4)
+	    throw Exception("bad \\u escape");
+	  unsigned int ret = 0;
+	  for (int i = 0; i < 4; ++i)
+	    {
+	      const char c = *p++;
+	      ret <<= 4;
+	      if (c >= '0' && c <= '9')
+		ret |= c - '0';
+	      else if (c >= 'a' && c <= 'f')
+		ret |= c - 'a' + 10;
+	      else if (c >= 'A' && c <= 'F')
+		ret |= c - 'A' + 10;
+	      else
+		throw Exception("bad \\u escape");
+	    }
+	  return ret;
+	}
+
+	// The unescaped string is never longer than its source,
+	// so it is written back over it.
+	const char *parse_string(size_t& size)
+	{
+	  expect('"');
+	  char *const start = p;
+	  char *out = p;
+	  while (true)
+	    {
+	      const char c = peek();
+	      ++p;
+	      if (c == '"')
+		break;
+	      if (static_cast<unsigned char>(c) < 0x20)
+		throw Exception("control character in string");
+	      if (c != '\\')
+		{
+		  *out++ = c;
+		  continue;
+		}
+	      const char e = peek();
+	      ++p;
+	      switch (e)
+		{
+		case '"':
+		case '\\':
+		case '/':
+		  *out++ = e;
+		  break;
+		case 'b':
+		  *out++ = '\b';
+		  break;
+		case 'f':
+		  *out++ = '\f';
+		  break;
+		case 'n':
+		  *out++ = '\n';
+		  break;
+		case 'r':
+		  *out++ = '\r';
+		  break;
+		case 't':
+		  *out++ = '\t';
+		  break;
+		case 'u':
+		  {
+		    unsigned int cp = hex4();
+		    if (cp >= 0xD800 && cp <= 0xDBFF)
+		      {
+			if (end - p < 6 || p[0] != '\\' || p[1] != 'u')
+			  throw Exception("unpaired surrogate");
+			p += 2;
+			const unsigned int lo = hex4();
+			if (lo < 0xDC00 || lo > 0xDFFF)
+			  throw Exception("unpaired surrogate");
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+		      }
+		    else if (cp >= 0xDC00 && cp <= 0xDFFF)
+		      throw Exception("unpaired surrogate");
+		    out = utf8(out, cp);
+		    break;
+		  }
+		default:
+		  throw Exception("bad escape");
+		}
+	    }
+	  size = out - start;
+	  return start;
+	}
+
+	static char *utf8(char *out, const unsigned int cp)
+	{
+	  if (cp < 0x80)
+	    *out++ = static_cast<char>(cp);
+	  else if (cp < 0x800)
+	    {
+	      *out++ = static_cast<char>(0xC0 | (cp >> 6));
+	      *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	    }
+	  else if (cp < 0x10000)
+	    {
+	      *out++ = static_cast<char>(0xE0 | (cp >> 12));
+	      *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+	      *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	    }
+	  else
+	    {
+	      *out++ = static_cast<char>(0xF0 | (cp >> 18));
+	      *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+	      *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+	      *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	    }
+	  return out;
+	}
+
+	char *p;
+	char *const end;
+      };
+
+      std::string text;
+      std::vector<Member> members;
+    };
+
+    namespace flat_detail {
+      // integer value of a NUMBER, false if it has a fraction or
+      // exponent or doesn't fit in T
+      template <typename T>
+      inline bool to_integer(const FlatObject::Value& v, T& ret)
+      {
+	if (v.type != FlatObject::NUMBER)
+	  return false;
+	const char *p = v.data;
+	const char *const end = v.data + v.size;
+	const bool neg = (*p == '-');
+	if (neg)
+	  {
+	    if (!std::numeric_limits<T>::is_signed)
+	      return false;
+	    ++p;
+	  }
+	const std::uint64_t limit = neg
+	  ? std::uint64_t(-(std::numeric_limits<T>::min() + 1)) + 1
+	  : std::uint64_t(std::numeric_limits<T>::max());
+	std::uint64_t acc = 0;
+	for (; p != end; ++p)
+	  {
+	    if (*p < '0' || *p > '9')
+	      return false;
+	    const unsigned int d = *p - '0';
+	    if (acc > (limit - d) / 10)
+	      return false;
+	    acc = acc * 10 + d;
+	  }
+	ret = neg ? T(-std::int64_t(acc - 1) - 1) : T(acc);
+	return true;
+      }
+
+      inline const FlatObject::Value* get(const FlatObject& root, const char *name)
+      {
+	const FlatObject::Value* v = root.find(name);
+	return (v && v->type != FlatObject::NULL_VALUE) ? v : nullptr;
+      }
+
+      inline const FlatObject::Value* get(const FlatObject& root, const std::string& name)
+      {
+	return get(root, name.c_str());
+      }
+
+      template <typename T, typename NAME, typename TITLE>
+      inline T get_integer(const FlatObject& root,
+			   const NAME& name,
+			   const char *type,
+			   const TITLE& title)
+      {
+	const FlatObject::Value* v = get(root, name);
+	if (!v)
+	  throw json_parse(std::string(type) + ' ' + fmt_name(name, title) + " is missing");
+	T ret;
+	if (!to_integer(*v, ret))
+	  throw json_parse(std::string(type) + ' ' + fmt_name(name, title) + " is of incorrect type");
+	return ret;
+      }
+
+      template <typename T, typename NAME, typename TITLE>
+      inline T get_integer_optional(const FlatObject& root,
+				    const NAME& name,
+				    const T default_value,
+				    const char *type,
+				    const TITLE& title)
+      {
+	if (!get(root, name))
+	  return default_value;
+	return get_integer<T>(root, name, type, title);
+      }
+    }
+
+    template <typename NAME>
+    inline bool exists(const FlatObject& root, const NAME& name)
+    {
+      return flat_detail::get(root, name) != nullptr;
+    }
+
+    template <typename NAME>
+    inline bool string_exists(const FlatObject& root, const NAME& name)
+    {
+      const FlatObject::Value* v = flat_detail::get(root, name);
+      return v && v->type == FlatObject::STRING;
+    }
+
+    template <typename NAME, typename TITLE>
+    inline std::string get_string(const FlatObject& root,
+				  const NAME& name,
+				  const TITLE& title)
+    {
+      const FlatObject::Value* v = flat_detail::get(root, name);
+      if (!v)
+	throw json_parse("string " + fmt_name(name, title) + " is missing");
+      if (v->type != FlatObject::STRING)
+	throw json_parse("string " + fmt_name(name, title) + " is of incorrect type");
+      return v->str();
+    }
+
+    template <typename NAME>
+    inline std::string get_string(const FlatObject& root, const NAME& name)
+    {
+      return get_string(root, name, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline std::string get_string_optional(const FlatObject& root,
+					   const NAME& name,
+					   const std::string& default_value,
+					   const TITLE& title)
+    {
+      const FlatObject::Value* v = flat_detail::get(root, name);
+      if (!v)
+	return default_value;
+      if (v->type != FlatObject::STRING)
+	throw json_parse("string " + fmt_name(name, title) + " is of incorrect type");
+      return v->str();
+    }
+
+    template <typename NAME>
+    inline std::string get_string_optional(const FlatObject& root,
+					   const NAME& name,
+					   const std::string& default_value)
+    {
+      return get_string_optional(root, name, default_value, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline int get_int(const FlatObject& root,
+		       const NAME& name,
+		       const TITLE& title)
+    {
+      return flat_detail::get_integer<int>(root, name, "int", title);
+    }
+
+    template <typename NAME>
+    inline int get_int(const FlatObject& root, const NAME& name)
+    {
+      return get_int(root, name, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline int get_int_optional(const FlatObject& root,
+				const NAME& name,
+				const int default_value,
+				const TITLE& title)
+    {
+      return flat_detail::get_integer_optional<int>(root, name, default_value, "int", title);
+    }
+
+    template <typename NAME>
+    inline int get_int_optional(const FlatObject& root,
+				const NAME& name,
+				const int default_value)
+    {
+      return get_int_optional(root, name, default_value, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline unsigned int get_uint(const FlatObject& root,
+				 const NAME& name,
+				 const TITLE& title)
+    {
+      return flat_detail::get_integer<unsigned int>(root, name, "uint", title);
+    }
+
+    template <typename NAME>
+    inline unsigned int get_uint(const FlatObject& root, const NAME& name)
+    {
+      return get_uint(root, name, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline unsigned int get_uint_optional(const FlatObject& root,
+					  const NAME& name,
+					  const unsigned int default_value,
+					  const TITLE& title)
+    {
+      return flat_detail::get_integer_optional<unsigned int>(root, name, default_value, "uint", title);
+    }
+
+    template <typename NAME>
+    inline unsigned int get_uint_optional(const FlatObject& root,
+					  const NAME& name,
+					  const unsigned int default_value)
+    {
+      return get_uint_optional(root, name, default_value, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline std::uint64_t get_uint64(const FlatObject& root,
+				    const NAME& name,
+				    const TITLE& title)
+    {
+      return flat_detail::get_integer<std::uint64_t>(root, name, "uint64", title);
+    }
+
+    template <typename NAME>
+    inline std::uint64_t get_uint64(const FlatObject& root, const NAME& name)
+    {
+      return get_uint64(root, name, nullptr);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline bool get_bool(const FlatObject& root,
+			 const NAME& name,
+			 const TITLE& title)
+    {
+      const FlatObject::Value* v = flat_detail::get(root, name);
+      if (!v)
+	throw json_parse("bool " + fmt_name(name, title) + " is missing");
+      if (v->type != FlatObject::BOOL)
+	throw json_parse("bool " + fmt_name(name, title) + " is of incorrect type");
+      return v->size == 4;
+    }
+
+    template <typename NAME>
+    inline bool get_bool(const FlatObject& root, const NAME& name)
+    {
+      return get_bool(root, name, nullptr);
+    }
+
+    // like the Json::Value version, accepts bools and numbers
+    template <typename NAME>
+    inline bool get_bool_optional(const FlatObject& root,
+				  const NAME& name,
+				  const bool default_value=false)
+    {
+      const FlatObject::Value* v = flat_detail::get(root, name);
+      if (!v)
+	return default_value;
+      if (v->type == FlatObject::BOOL)
+	return v->size == 4;
+      if (v->type == FlatObject::NUMBER)
+	{
+	  for (size_t i = 0; i < v->size; ++i)
+	    if (v->data[i] >= '1' && v->data[i] <= '9')
+	      return true;
+	  return false;
+	}
+      return default_value;
+    }
+
+    template <typename NAME, typename TITLE>
+    inline void to_string(const FlatObject& root,
+			  std::string& dest,
+			  const NAME& name,
+			  const TITLE& title)
+    {
+      dest = get_string(root, name, title);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline void to_string_optional(const FlatObject& root,
+				   std::string& dest,
+				   const NAME& name,
+				   const std::string& default_value,
+				   const TITLE& title)
+    {
+      dest = get_string_optional(root, name, default_value, title);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline void to_int(const FlatObject& root,
+		       int& dest,
+		       const NAME& name,
+		       const TITLE& title)
+    {
+      dest = get_int(root, name, title);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline void to_uint(const FlatObject& root,
+			unsigned int& dest,
+			const NAME& name,
+			const TITLE& title)
+    {
+      dest = get_uint(root, name, title);
+    }
+
+    template <typename NAME, typename TITLE>
+    inline void to_bool(const FlatObject& root,
+			bool& dest,
+			const NAME& name,
+			const TITLE& title)
+    {
+      dest = get_bool(root, name, title);
+    }
+  }
+}
@@ -25,6 +25,7 @@
 #include <cstring>
 #include <cstdint>
 #include <utility>
+#include <memory>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/string.hpp>
@@ -42,7 +43,24 @@
 namespace openvpn {
   namespace json {
 
-    OPENVPN_EXCEPTION(json_parse);
+#ifndef OPENVPN_JSON
+    namespace detail {
+      // Parse straight from the caller's text with a reader built
+      // once per thread, rather than through a std::istream copy
+      // with a new reader each time.
+      inline Json::CharReader& char_reader()
+      {
+	thread_local std::unique_ptr<Json::CharReader> reader;
+	if (!reader)
+	  {
+	    Json::CharReaderBuilder builder;
+	    builder["collectComments"] = false;
+	    reader.reset(builder.newCharReader());
+	  }
+	return *reader;
+      }
+    }
+#endif
 
     template <typename TITLE>
     inline Json::Value parse(const std::string& str, const TITLE& title)
@@ -50,13 +68,9 @@ namespace openvpn {
 #ifdef OPENVPN_JSON
       return Json::Value::parse(str, StringTempl::to_string(title));
 #else
-      Json::CharReaderBuilder builder;
-      builder["collectComments"] = false;
       Json::Value root;
       std::string errors;
-      std::istringstream instr(str);
-
-      if (!Json::parseFromStream(builder, instr, &root, &errors))
+      if (!detail::char_reader().parse(str.data(), str.data() + str.length(), &root, &errors))
 	throw json_parse(StringTempl::to_string(title) + " : " + errors);
       return root;
 #endif
@@ -78,13 +92,9 @@ namespace openvpn {
 #ifdef OPENVPN_JSON
       return Json::Value::parse(buf, StringTempl::to_string(title));
 #else
-      Json::CharReaderBuilder builder;
-      builder["collectComments"] = false;
       Json::Value root;
       std::string errors;
-
-      std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
-      if (!reader->parse(reinterpret_cast<const char *>(buf.c_data()), reinterpret_cast<const char *>(buf.c_data()) + buf.size(), &root, &errors))
+      if (!detail::char_reader().parse(reinterpret_cast<const char *>(buf.c_data()), reinterpret_cast<const char *>(buf.c_data()) + buf.size(), &root, &errors))
 	throw json_parse(StringTempl::to_string(title) + " : " + errors);
       return root;
 #endif
@@ -23,11 +23,14 @@
 
 #include <string>
 
+#include <openvpn/common/exception.hpp>
 #include <openvpn/common/stringtempl2.hpp>
 
 namespace openvpn {
   namespace json {
 
+    OPENVPN_EXCEPTION(json_parse);
+
     // format name.title but omit .title if title is empty
     template <typename NAME, typename TITLE>
     inline std::string fmt_name(const NAME& name, const TITLE& title)
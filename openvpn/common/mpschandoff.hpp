@@ -0,0 +1,214 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Hand packets (or any movable element, e.g. BufferAllocated, which
+// moves as a pointer to its storage) from any thread to the thread
+// running an io_context, through a bounded MPSCRing.  The consumer
+// waits on an eventfd, which producers write at most once per drain,
+// so a burst costs one wakeup however many packets it carries.  The
+// consumer gets the packets in batches.
+//
+// When the ring is full the packets that don't fit are dropped and
+// counted, in SessionStats::HANDOFF_DROPS if a stats object is given.
+//
+// Linux only.  The owner must keep the object alive until producers
+// are done with it.
+
+#ifndef OPENVPN_COMMON_MPSCHANDOFF_H
+#define OPENVPN_COMMON_MPSCHANDOFF_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/mpscring.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/log/sessionstats.hpp>
+
+namespace openvpn {
+
+  template <typename T>
+  class MPSCHandoff
+  {
+  public:
+    OPENVPN_EXCEPTION(mpsc_handoff_error);
+
+    enum {
+      BATCH = 64, // elements per handoff_recv() call at most
+    };
+
+    struct Recv
+    {
+      // Called on the consumer thread, elements may be moved from.
+      virtual void handoff_recv(T* v, const size_t n) = 0;
+    };
+
+    MPSCHandoff(openvpn_io::io_context& io_context_arg,
+		const size_t capacity,
+		const SessionStats::Ptr& stats_arg)
+      : ring(capacity),
+	stats(stats_arg),
+	io_context(io_context_arg),
+	batch(new T[BATCH])
+    {
+      efd.reset(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+      if (!efd.defined())
+	throw mpsc_handoff_error("eventfd: " + strerror_str(errno));
+    }
+
+    ~MPSCHandoff()
+    {
+      stop();
+    }
+
+    // Consumer thread.
+    void start(Recv* recv_arg)
+    {
+      recv = recv_arg;
+      if (!halt)
+	return;
+      halt = false;
+      stream.reset(new openvpn_io::posix::stream_descriptor(io_context, efd()));
+      queue_wait();
+    }
+
+    // Consumer thread.  Elements still in the ring stay there.
+    void stop()
+    {
+      halt = true;
+      recv = nullptr;
+      if (stream)
+	{
+	  stream->cancel();
+	  stream->release();
+	  stream.reset();
+	}
+    }
+
+    // Any thread.  Take the n elements from v, returns how many made
+    // it into the ring; the rest are dropped.
+    size_t push(T* v, const size_t n)
+    {
+      const size_t k = ring.push(v, n);
+      if (k)
+	wakeup();
+      if (k < n)
+	drop(n - k);
+      return k;
+    }
+
+    bool push(T&& v)
+    {
+      return push(&v, 1) == 1;
+    }
+
+    std::uint64_t n_dropped() const
+    {
+      return n_dropped_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t n_wakeups() const
+    {
+      return n_wakeups_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    MPSCHandoff(const MPSCHandoff&) = delete;
+    MPSCHandoff& operator=(const MPSCHandoff&) = delete;
+
+    void wakeup()
+    {
+      if (!wake_pending.exchange(true, std::memory_order_acq_rel))
+	{
+	  const std::uint64_t one = 1;
+	  if (::write(efd(), &one, sizeof(one)) == sizeof(one))
+	    n_wakeups_.fetch_add(1, std::memory_order_relaxed);
+	}
+    }
+
+    void drop(const size_t n)
+    {
+      n_dropped_.fetch_add(n, std::memory_order_relaxed);
+      if (stats)
+	stats->inc_stat(SessionStats::HANDOFF_DROPS, n);
+    }
+
+    void queue_wait()
+    {
+      stream->async_read_some(openvpn_io::buffer(&efd_value, sizeof(efd_value)),
+			      [this](const openvpn_io::error_code& error, const size_t bytes_recvd)
+			      {
+				// after stop() this may be gone
+				if (error != openvpn_io::error::operation_aborted)
+				  handle_wait();
+			      });
+    }
+
+    void handle_wait()
+    {
+      if (halt)
+	return;
+
+      // clear first, so that a push racing with the drain below
+      // writes the eventfd again; the exchange pairs with the
+      // producer's to make its element visible here
+      wake_pending.exchange(false, std::memory_order_acq_rel);
+      size_t n;
+      while (!halt && (n = ring.pop(batch.get(), BATCH)))
+	{
+	  if (recv)
+	    recv->handoff_recv(batch.get(), n);
+	  for (size_t i = 0; i < n; ++i)
+	    batch[i] = T();
+	}
+      if (!halt)
+	queue_wait();
+    }
+
+    MPSCRing<T> ring;
+    SessionStats::Ptr stats;
+
+    // consumer
+    openvpn_io::io_context& io_context;
+    ScopedFD efd;
+    std::unique_ptr<openvpn_io::posix::stream_descriptor> stream;
+    std::unique_ptr<T[]> batch;
+    std::uint64_t efd_value = 0;
+    Recv* recv = nullptr;
+    bool halt = true;
+
+    std::atomic<bool> wake_pending{false};
+    std::atomic<std::uint64_t> n_dropped_{0};
+    std::atomic<std::uint64_t> n_wakeups_{0};
+  };
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Bounded lock-free multi-producer, single-consumer ring (after
+// Vyukov's bounded queue).  Each cell carries a sequence number that
+// tells whether it is free for, or holds the element of, a given
+// position.  Producers claim a run of consecutive free cells with a
+// single CAS on the tail, so a batch costs one contended operation.
+// Elements are moved in and out, no allocation happens after
+// construction.
+
+#ifndef OPENVPN_COMMON_MPSCRING_H
+#define OPENVPN_COMMON_MPSCRING_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <openvpn/common/exception.hpp>
+
+namespace openvpn {
+
+  template <typename T>
+  class MPSCRing
+  {
+  public:
+    OPENVPN_SIMPLE_EXCEPTION(mpsc_ring_capacity);
+
+    // capacity is rounded up to a power of 2
+    explicit MPSCRing(const size_t capacity_arg)
+      : mask(round_up(capacity_arg) - 1),
+	cells(new Cell[mask + 1])
+    {
+      for (size_t i = 0; i <= mask; ++i)
+	cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+      return mask + 1;
+    }
+
+    // Any thread.  Move up to n elements from v into the ring, in
+    // order, and return how many were taken.  When the ring is full
+    // the remaining elements are left untouched.
+    size_t push(T* v, const size_t n)
+    {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      for (;;)
+	{
+	  // the consumer frees cells in order, so count the free run
+	  // starting at pos
+	  size_t k = 0;
+	  std::intptr_t diff = 0;
+	  while (k < n)
+	    {
+	      diff = std::intptr_t(cell(pos + k).seq.load(std::memory_order_acquire)) - std::intptr_t(pos + k);
+	      if (diff)
+		break;
+	      ++k;
+	    }
+	  if (!k)
+	    {
+	      if (diff < 0 || !n)
+		return 0; // full
+	      pos = tail.load(std::memory_order_relaxed); // pos was claimed by another producer
+	      continue;
+	    }
+	  if (tail.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+	    {
+	      for (size_t i = 0; i < k; ++i)
+		{
+		  Cell& c = cell(pos + i);
+		  c.value = std::move(v[i]);
+		  c.seq.store(pos + i + 1, std::memory_order_release);
+		}
+	      return k;
+	    }
+	}
+    }
+
+    bool push(T&& v)
+    {
+      return push(&v, 1) == 1;
+    }
+
+    // Consumer thread only.  Move up to max elements into v and
+    // return how many.  An element whose push() is still in progress
+    // ends the batch, along with everything behind it.
+    size_t pop(T* v, const size_t max)
+    {
+      size_t k = 0;
+      while (k < max)
+	{
+	  Cell& c = cell(head);
+	  if (c.seq.load(std::memory_order_acquire) != head + 1)
+	    break;
+	  v[k++] = std::move(c.value);
+	  c.seq.store(head + mask + 1, std::memory_order_release);
+	  ++head;
+	}
+      return k;
+    }
+
+    bool pop(T& v)
+    {
+      return pop(&v, 1) == 1;
+    }
+
+    // Consumer thread only.
+    bool empty() const
+    {
+      return cells[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+    }
+
+  private:
+    MPSCRing(const MPSCRing&) = delete;
+    MPSCRing& operator=(const MPSCRing&) = delete;
+
+    struct Cell
+    {
+      std::atomic<size_t> seq;
+      T value;
+    };
+
+    static size_t round_up(const size_t n)
+    {
+      if (!n || n > (size_t(1) << (sizeof(size_t) * 8 - 2)))
+	throw mpsc_ring_capacity();
+      size_t c = 1;
+      while (c < n)
+	c <<= 1;
+      return c;
+    }
+
+    Cell& cell(const size_t pos)
+    {
+      return cells[pos & mask];
+    }
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+
+    // producers and consumer on separate cache lines
+    char pad0[64];
+    std::atomic<size_t> tail{0};
+    char pad1[64];
+    size_t head = 0;
+  };
+
+}
+
+#endif
@@ -134,6 +134,15 @@ namespace openvpn {
       ++head_id_;
     }
 
+    // Release the queue's storage if the window is empty,
+    // for a session that has gone idle.  std::deque keeps
+    // at least one block allocated even when empty.
+    void compact()
+    {
+      if (q_.empty())
+	std::deque<M>().swap(q_);
+    }
+
   private:
     // Expand the queue if necessary so that id maps
     // to an object in the queue
@@ -0,0 +1,252 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Per-thread object pools for large, frequently recycled objects such
+// as server sessions and key contexts.  A class T derives from
+// PoolAllocated<T> and provides a static pool_name(); objects of
+// exactly sizeof(T) released on a thread are kept on that thread's
+// free list, up to MAX_CACHED, and handed out again by the next
+// allocation there.  A server that churns through many short
+// sessions then reuses the same blocks instead of asking the global
+// heap for them each time.
+//
+// An object may be released on any thread; its block joins the free
+// list of the releasing thread.  Objects of classes derived from T
+// (larger than sizeof(T)) always use the global heap.  Occupancy of
+// every pool in the process is available from ObjPool::snapshot().
+//
+// Define OPENVPN_NO_OBJPOOL to allocate everything from the global
+// heap while still counting live objects.
+
+#ifndef OPENVPN_COMMON_OBJPOOL_H
+#define OPENVPN_COMMON_OBJPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace openvpn {
+  namespace ObjPool {
+
+    // process-wide counters of one pool
+    struct Counters
+    {
+      Counters(const char *name_arg);
+
+      const char *const name;
+      std::atomic<std::uint64_t> live{0};    // objects allocated and not yet released
+      std::atomic<std::uint64_t> cached{0};  // free blocks held on thread free lists
+      std::atomic<std::uint64_t> reused{0};  // allocations served from a free list
+      std::atomic<std::uint64_t> heap{0};    // allocations served by the global heap
+    };
+
+    struct Snapshot
+    {
+      std::string name;
+      std::uint64_t live = 0;
+      std::uint64_t cached = 0;
+      std::uint64_t reused = 0;
+      std::uint64_t heap = 0;
+    };
+
+    class Registry
+    {
+    public:
+      static void add(const Counters* c)
+      {
+	Registry& r = instance();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.pools.push_back(c);
+      }
+
+      static std::vector<Snapshot> snapshot()
+      {
+	Registry& r = instance();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	std::vector<Snapshot> ret;
+	ret.reserve(r.pools.size());
+	for (const Counters* c : r.pools)
+	  {
+	    Snapshot s;
+	    s.name = c->name;
+	    s.live = c->live.load(std::memory_order_relaxed);
+	    s.cached = c->cached.load(std::memory_order_relaxed);
+	    s.reused = c->reused.load(std::memory_order_relaxed);
+	    s.heap = c->heap.load(std::memory_order_relaxed);
+	    ret.push_back(std::move(s));
+	  }
+	return ret;
+      }
+
+    private:
+      static Registry& instance()
+      {
+	// never destroyed, so pools may be released during static destruction
+	static Registry* r = new Registry();
+	return *r;
+      }
+
+      std::mutex mutex;
+      std::vector<const Counters*> pools;
+    };
+
+    inline Counters::Counters(const char *name_arg)
+      : name(name_arg)
+    {
+      Registry::add(this);
+    }
+
+    // occupancy of every pool used so far, in order of first use
+    inline std::vector<Snapshot> snapshot()
+    {
+      return Registry::snapshot();
+    }
+  }
+
+  template <typename T, std::size_t MAX_CACHED = 256>
+  class PoolAllocated
+  {
+  public:
+    static void* operator new(const std::size_t size)
+    {
+      static_assert(sizeof(Node) <= sizeof(T), "pooled object smaller than a free list node");
+      static_assert(alignof(T) <= alignof(std::max_align_t), "pooled object is over-aligned");
+
+      ObjPool::Counters& c = counters();
+#ifndef OPENVPN_NO_OBJPOOL
+      if (size == sizeof(T) && !thread_dead())
+	{
+	  FreeList& fl = free_list();
+	  if (fl.head)
+	    {
+	      Node* n = fl.head;
+	      fl.head = n->next;
+	      --fl.size;
+	      c.cached.fetch_sub(1, std::memory_order_relaxed);
+	      c.reused.fetch_add(1, std::memory_order_relaxed);
+	      c.live.fetch_add(1, std::memory_order_relaxed);
+	      return n;
+	    }
+	}
+#endif
+      void* p = ::operator new(size);
+      c.heap.fetch_add(1, std::memory_order_relaxed);
+      c.live.fetch_add(1, std::memory_order_relaxed);
+      return p;
+    }
+
+    static void operator delete(void* p, const std::size_t size) noexcept
+    {
+      if (!p)
+	return;
+      ObjPool::Counters& c = counters();
+      c.live.fetch_sub(1, std::memory_order_relaxed);
+#ifndef OPENVPN_NO_OBJPOOL
+      if (size == sizeof(T) && !thread_dead())
+	{
+	  FreeList& fl = free_list();
+	  if (fl.size < MAX_CACHED)
+	    {
+	      Node* n = static_cast<Node*>(p);
+	      n->next = fl.head;
+	      fl.head = n;
+	      ++fl.size;
+	      c.cached.fetch_add(1, std::memory_order_relaxed);
+	      return;
+	    }
+	}
+#endif
+      ::operator delete(p);
+    }
+
+    // free blocks cached by the calling thread
+    static std::size_t thread_cached()
+    {
+      return thread_dead() ? 0 : free_list().size;
+    }
+
+    // Return the calling thread's free blocks to the global heap.
+    static void thread_trim() noexcept
+    {
+      if (!thread_dead())
+	free_list().clear();
+    }
+
+  private:
+    struct Node
+    {
+      Node* next;
+    };
+
+    struct FreeList
+    {
+      ~FreeList()
+      {
+	clear();
+	thread_dead() = true;
+      }
+
+      void clear() noexcept
+      {
+	while (head)
+	  {
+	    Node* n = head;
+	    head = n->next;
+	    ::operator delete(n);
+	  }
+	counters().cached.fetch_sub(size, std::memory_order_relaxed);
+	size = 0;
+      }
+
+      Node* head = nullptr;
+      std::size_t size = 0;
+    };
+
+    static ObjPool::Counters& counters()
+    {
+      static ObjPool::Counters* c = new ObjPool::Counters(T::pool_name());
+      return *c;
+    }
+
+    static FreeList& free_list() noexcept
+    {
+      static thread_local FreeList fl;
+      return fl;
+    }
+
+    // set once the thread's free list has been destroyed, so that
+    // objects released by later thread_local destructors go straight
+    // to the heap
+    static bool& thread_dead() noexcept
+    {
+      static thread_local bool dead = false;
+      return dead;
+    }
+  };
+
+}
+
+#endif
@@ -730,10 +730,11 @@ namespace openvpn {
     {
       if (lim)
 	lim->add_string(str);
-      std::vector<std::string> list = Split::by_char<std::vector<std::string>, Lex, Limits>(str, ',', 0, ~0, lim);
-      for (std::vector<std::string>::const_iterator i = list.begin(); i != list.end(); ++i)
+      Split::ByChar<Lex, Limits> split(str, ',', ~0, lim);
+      Split::View term;
+      while (split.next(term))
 	{
-	  const Option opt = Split::by_space<Option, Lex, SpaceMatch, Limits>(*i, lim);
+	  Option opt = Split::by_space<Option, Lex, SpaceMatch, Limits>(term, lim);
 	  if (opt.size())
 	    {
 	      if (lim)
@@ -777,10 +778,12 @@ namespace openvpn {
       SplitLines in(str, 0);
       while (in(true))
 	{
-	  const std::string& line = in.line_ref();
+	  Split::ByChar<NullLex, Limits> split(in.line_ref(), '=', 1, lim);
+	  Split::View term;
 	  Option opt;
 	  opt.reserve(2);
-	  Split::by_char_void<Option, NullLex, Limits>(opt, line, '=', 0, 1, lim);
+	  while (split.next(term))
+	    opt.push_back(term.to_string());
 	  if (opt.size())
 	    {
 	      if (lim)
@@ -823,6 +826,7 @@ namespace openvpn {
       if (lim)
 	lim->add_string(str);
 
+      reserve(size() + count_lines(str));
       SplitLines in(str, lim ? lim->get_max_line_len() : 0);
       int line_num = 0;
       bool in_multiline = false;
@@ -864,8 +868,24 @@ namespace openvpn {
 			extraneous_err(line_num, "option", opt);
 		      untag_open_tag(opt.ref(0));
 		      opt.push_back("");
-		      multiline = opt;
-		      in_multiline = true;
+
+		      // fast path for well-formed blocks, such as inline PEM
+		      const size_t n = in.read_block("</" + opt.ref(0) + '>', opt.ref(1));
+		      if (n)
+			{
+			  line_num += (int)n;
+			  if (lim)
+			    {
+			      lim->add_opt();
+			      lim->validate_directive(opt);
+			    }
+			  push_back(std::move(opt));
+			}
+		      else
+			{
+			  multiline = std::move(opt);
+			  in_multiline = true;
+			}
 		    }
 		  else
 		    {
@@ -931,7 +951,7 @@ namespace openvpn {
 			    extraneous_err(line_num, "meta option", opt);
 			  untag_open_meta_tag(opt.ref(0));
 			  opt.push_back("");
-			  multiline = opt;
+			  multiline = std::move(opt);
 			  in_multiline = true;
 			}
 		      else
@@ -1343,6 +1363,7 @@ namespace openvpn {
     void update_map()
     {
       map_.clear();
+      map_.reserve(size());
       for (size_t i = 0; i < size(); ++i)
 	{
 	  const Option& opt = (*this)[i];
@@ -1420,6 +1441,13 @@ namespace openvpn {
     }
 
   private:
+    // upper bound on the number of options in a config string,
+    // used to size the option vector up front
+    static size_t count_lines(const std::string& str)
+    {
+      return std::count(str.begin(), str.end(), '\n') + 1;
+    }
+
     // multiline tagging (meta)
 
     // return true if string is a meta tag, e.g. WEB_CA_BUNDLE_START
@@ -0,0 +1,186 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Quiescent-state based reclamation, the RCU flavour behind the
+// lock-free lookup tables (PeerIDTable, IP::RouteTable).
+//
+// Each worker thread that reads a table registers a Reader and calls
+// Reader::quiescent() at a point where it holds no pointers obtained
+// from the table, typically once per event loop iteration or packet
+// burst.  Writers unlink an object and retire() it; it is reclaimed
+// only after every online reader has passed through a quiescent
+// state.  Readers that block for a long time should go offline() so
+// they don't hold up reclaim.
+
+#ifndef OPENVPN_COMMON_QSBR_H
+#define OPENVPN_COMMON_QSBR_H
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include <openvpn/common/alignedalloc.hpp>
+
+namespace openvpn {
+
+  class QSBR
+  {
+  public:
+    // Heap allocated on a cache line boundary with epoch, written
+    // by the reader thread on every quiescent(), alone in the first
+    // line.
+    class Reader : public AlignedNew<>
+    {
+    public:
+      // Declare that this thread holds no pointers obtained from
+      // the tables of this domain.
+      void quiescent()
+      {
+	epoch.store(domain.global_epoch.load(std::memory_order_seq_cst), std::memory_order_release);
+      }
+
+      // Stop participating in reclaim, e.g. before blocking.
+      void offline()
+      {
+	epoch.store(OFFLINE, std::memory_order_release);
+      }
+
+      // Resume after offline().
+      void online()
+      {
+	quiescent();
+      }
+
+      ~Reader()
+      {
+	domain.unregister_reader(this);
+      }
+
+    private:
+      friend class QSBR;
+
+      Reader(QSBR& domain_arg)
+	: domain(domain_arg)
+      {
+	quiescent();
+      }
+
+      std::atomic<std::uint64_t> epoch;
+      unsigned char pad[CACHE_LINE_SIZE - sizeof(std::atomic<std::uint64_t>)];
+      QSBR& domain;
+    };
+
+    QSBR() {}
+
+    QSBR(const QSBR&) = delete;
+    QSBR& operator=(const QSBR&) = delete;
+
+    // Readers must be gone by now.
+    ~QSBR()
+    {
+      for (auto& r : retired)
+	r.reclaim();
+    }
+
+    // Register the calling worker thread as a reader.  The Reader
+    // must be destroyed before the domain.
+    std::unique_ptr<Reader> register_reader()
+    {
+      std::unique_ptr<Reader> r(new Reader(*this));
+      std::lock_guard<std::mutex> lock(mutex);
+      readers.push_back(r.get());
+      return r;
+    }
+
+    // Defer reclaim, an action freeing an object that has been
+    // unlinked but may still be seen by readers, until every online
+    // reader has passed a quiescent state.
+    void retire(std::function<void()> reclaim)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      // readers that pass a quiescent state after this increment
+      // can no longer reference the object
+      const std::uint64_t e = global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+      retired.push_back(Retired{std::move(reclaim), e});
+    }
+
+    // Run the reclaim actions that no reader can be waiting for.
+    void reclaim()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      reclaim_();
+    }
+
+    size_t n_retired() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return retired.size();
+    }
+
+  private:
+    static constexpr std::uint64_t OFFLINE = std::numeric_limits<std::uint64_t>::max();
+
+    struct Retired
+    {
+      std::function<void()> reclaim;
+      std::uint64_t epoch;
+    };
+
+    // mutex must be held
+    void reclaim_()
+    {
+      if (retired.empty())
+	return;
+      std::uint64_t min_epoch = OFFLINE;
+      for (const Reader* r : readers)
+	min_epoch = std::min(min_epoch, r->epoch.load(std::memory_order_acquire));
+      auto it = std::partition(retired.begin(), retired.end(), [min_epoch](const Retired& r) {
+	  return r.epoch > min_epoch;
+	});
+      for (auto i = it; i != retired.end(); ++i)
+	i->reclaim();
+      retired.erase(it, retired.end());
+    }
+
+    void unregister_reader(Reader* r)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      readers.erase(std::remove(readers.begin(), readers.end(), r), readers.end());
+      reclaim_();
+    }
+
+    std::atomic<std::uint64_t> global_epoch{0};
+
+    mutable std::mutex mutex;
+    std::vector<Reader*> readers;
+    std::vector<Retired> retired;
+  };
+
+}
+
+#endif
@@ -85,6 +85,7 @@
 #include <utility>
 
 #include <openvpn/common/olong.hpp>
+#include <openvpn/common/allocstat.hpp>
 
 #ifdef OPENVPN_RC_DEBUG
 #include <iostream>
@@ -703,6 +704,11 @@ namespace openvpn {
   {
 #ifdef OPENVPN_RC_DEBUG
     std::cout << "ADD REF " << cxx_demangle(typeid(p).name()) << std::endl;
+#endif
+#ifdef OPENVPN_ALLOC_STATS
+    // first reference to a new object
+    if (p->refcount_.use_count() == 0)
+      AllocStats::count_object();
 #endif
     ++p->refcount_;
   }
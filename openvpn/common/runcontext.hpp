@@ -47,6 +47,8 @@
 #include <openvpn/common/environ.hpp>
 #include <openvpn/common/number.hpp>
 #include <openvpn/common/signal_name.hpp>
+#include <openvpn/common/threadpolicy.hpp>
+#include <openvpn/common/strerror.hpp>
 #include <openvpn/asio/asiosignal.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/time/asiotimer.hpp>
@@ -139,6 +141,42 @@ namespace openvpn {
       log_reopen = std::move(lr);
     }
 
+    // Placement and polling of the worker threads that use
+    // run_thread().  Set before starting them.
+    void set_thread_policy(const ThreadPolicy& policy)
+    {
+      thread_policy_ = policy;
+    }
+
+    const ThreadPolicy& thread_policy() const
+    {
+      return thread_policy_;
+    }
+
+    // called from worker thread: pin the thread per the thread
+    // policy and run its io_context, with counters for thread_stats()
+    void run_thread(const unsigned int unit, openvpn_io::io_context& io_context)
+    {
+      ThreadStats* ts;
+      {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	while (thread_stats_.size() <= unit)
+	  thread_stats_.emplace_back(new ThreadStats());
+	ts = thread_stats_[unit].get();
+      }
+      const int err = thread_policy_.pin(unit);
+      if (err)
+	OPENVPN_LOG(prefix << "Thread " << unit << ": error binding to core " << thread_policy_.cpu(unit) << ": " << strerror_str(err));
+      run_io_context(io_context, thread_policy_, ts);
+    }
+
+    // counters of a thread run by run_thread(), or nullptr
+    const ThreadStats* thread_stats(const unsigned int unit)
+    {
+      std::lock_guard<std::recursive_mutex> lock(mutex);
+      return unit < thread_stats_.size() ? thread_stats_[unit].get() : nullptr;
+    }
+
     void set_thread(const unsigned int unit, std::thread* thread)
     {
       while (threadlist.size() <= unit)
@@ -361,6 +399,11 @@ namespace openvpn {
 	    case SIGUSR2:
 	      if (stats)
 		OPENVPN_LOG(stats->dump());
+	      {
+		std::lock_guard<std::recursive_mutex> lock(mutex);
+		for (size_t i = 0; i < thread_stats_.size(); ++i)
+		  OPENVPN_LOG(prefix << "Thread " << i << ": " << thread_stats_[i]->to_string());
+	      }
 	      signal_rearm();
 	      break;
 	    case SIGHUP:
@@ -423,6 +466,10 @@ namespace openvpn {
     // stop
     Stop* async_stop_ = nullptr;
 
+    // worker threads, thread_stats_ protected by mutex
+    ThreadPolicy thread_policy_;
+    std::vector<std::unique_ptr<ThreadStats>> thread_stats_;
+
     // log observers
     std::vector<unsigned int> log_observers; // unit numbers of log observers
     std::unique_ptr<std::vector<RunContextLogEntry>> log_history;
@@ -0,0 +1,93 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// A fixed-size array published by one writer thread and read by any
+// number of threads without locking.  The writer bumps a sequence
+// number to odd before updating and back to even afterwards; a reader
+// copies the values and retries if the sequence number was odd or
+// changed underneath it, so it always gets a set of values that were
+// published together.  Values are relaxed atomics, so that the racy
+// copy of a reader that then retries is not undefined behavior.
+
+#ifndef OPENVPN_COMMON_SEQLOCK_H
+#define OPENVPN_COMMON_SEQLOCK_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace openvpn {
+
+  template <typename T, size_t N>
+  class SeqLockArray
+  {
+  public:
+    SeqLockArray()
+      : seq(0)
+    {
+      for (auto& v : values)
+	v.store(T(), std::memory_order_relaxed);
+    }
+
+    static constexpr size_t size()
+    {
+      return N;
+    }
+
+    // writer thread only
+    void store(const T* src)
+    {
+      const unsigned int s = seq.load(std::memory_order_relaxed);
+      seq.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < N; ++i)
+	values[i].store(src[i], std::memory_order_relaxed);
+      seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Copy the last published values to dest, any thread.  Returns
+    // the number of stores published so far.
+    unsigned int load(T* dest) const
+    {
+      while (true)
+	{
+	  const unsigned int s1 = seq.load(std::memory_order_acquire);
+	  if (s1 & 1)
+	    continue; // writer is mid-update
+	  for (size_t i = 0; i < N; ++i)
+	    dest[i] = values[i].load(std::memory_order_relaxed);
+	  std::atomic_thread_fence(std::memory_order_acquire);
+	  if (seq.load(std::memory_order_relaxed) == s1)
+	    return s1 / 2;
+	}
+    }
+
+  private:
+    SeqLockArray(const SeqLockArray&) = delete;
+    SeqLockArray& operator=(const SeqLockArray&) = delete;
+
+    std::atomic<unsigned int> seq;
+    std::atomic<T> values[N];
+  };
+
+}
+
+#endif
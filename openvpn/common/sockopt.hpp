@@ -49,6 +49,18 @@ namespace openvpn {
     }
 #endif
 
+#ifdef SO_INCOMING_CPU
+    // set SO_INCOMING_CPU, so that a listening socket in a
+    // SO_REUSEPORT group is preferred for connections whose packets
+    // the kernel processes on cpu
+    inline void incoming_cpu(const int fd, const int cpu)
+    {
+      if (::setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU,
+		     (void *)&cpu, sizeof(cpu)) < 0)
+	throw Exception("error setting SO_INCOMING_CPU on socket");
+    }
+#endif
+
     // set SO_REUSEADDR for TCP
     inline void reuseaddr(const int fd)
     {
@@ -67,6 +79,41 @@ namespace openvpn {
 	throw Exception("error setting TCP_NODELAY on socket");
     }
 
+#ifdef TCP_NOTSENT_LOWAT
+    // set TCP_NOTSENT_LOWAT to limit the unsent data queued in the
+    // kernel, so writability is only reported below that mark
+    inline void tcp_notsent_lowat(const int fd, const unsigned int bytes)
+    {
+      const int lowat = static_cast<int>(bytes);
+      if (::setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+		     (void *)&lowat, sizeof(lowat)) != 0)
+	throw Exception("error setting TCP_NOTSENT_LOWAT on socket");
+    }
+#endif
+
+#ifdef SO_BUSY_POLL
+    // set SO_BUSY_POLL to have blocking reads and the reactor's
+    // waits poll the device queue for up to usec microseconds, and
+    // with prefer, SO_PREFER_BUSY_POLL to defer its interrupts while
+    // we do.  Values above net.core.busy_read need CAP_NET_ADMIN.
+    inline void busy_poll(const int fd, const unsigned int usec, const bool prefer)
+    {
+      const int val = static_cast<int>(usec);
+      if (::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+		     (void *)&val, sizeof(val)) != 0)
+	throw Exception("error setting SO_BUSY_POLL on socket");
+#ifdef SO_PREFER_BUSY_POLL
+      if (prefer)
+	{
+	  const int on = 1;
+	  if (::setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+			 (void *)&on, sizeof(on)) != 0)
+	    throw Exception("error setting SO_PREFER_BUSY_POLL on socket");
+	}
+#endif
+    }
+#endif
+
     // set FD_CLOEXEC to prevent fd from being passed across execs
     inline void set_cloexec(const int fd)
     {
@@ -29,6 +29,7 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <algorithm>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/lex.hpp>
@@ -45,6 +46,52 @@ namespace openvpn {
       void add_term() {}
     };
 
+    // A read-only view of part of a string, which must not be modified
+    // or go out of scope while the view is in use.
+    class View
+    {
+    public:
+      View() {}
+
+      View(const char *data_arg, const size_t size_arg)
+	: data_(data_arg),
+	  size_(size_arg)
+      {
+      }
+
+      View(const std::string& str)
+	: data_(str.data()),
+	  size_(str.length())
+      {
+      }
+
+      const char *data() const { return data_; }
+      size_t size() const { return size_; }
+      bool empty() const { return size_ == 0; }
+
+      const char *begin() const { return data_; }
+      const char *end() const { return data_ + size_; }
+
+      std::string to_string() const
+      {
+	return std::string(data_, size_);
+      }
+
+      bool operator==(const View& other) const
+      {
+	return size_ == other.size_ && std::equal(begin(), end(), other.begin());
+      }
+
+      bool operator!=(const View& other) const
+      {
+	return !operator==(other);
+      }
+
+    private:
+      const char *data_ = "";
+      size_t size_ = 0;
+    };
+
     // Split a string using a character (such as ',') as a separator.
     // Types:
     //   V : string vector of return data
@@ -85,6 +132,66 @@ namespace openvpn {
       ret.push_back(std::move(term));
     }
 
+    // Lazily split a string using a character as a separator,
+    // yielding views of the terms rather than copies.  The terms and
+    // limit accounting are those of by_char_void() with flags=0, which
+    // leaves quotes and escapes in place so that each term is a
+    // substring of the input.
+    // Types:
+    //   LEX : lexical analyzer class such as StandardLex
+    //   LIM : limit class such as OptionList::Limits
+    template <typename LEX, typename LIM>
+    class ByChar
+    {
+    public:
+      ByChar(const View& input, const char split_by_arg, const unsigned int max_terms_arg=~0, LIM* lim_arg=nullptr)
+	: pos(input.begin()),
+	  end(input.end()),
+	  split_by(split_by_arg),
+	  max_terms(max_terms_arg),
+	  lim(lim_arg)
+      {
+      }
+
+      // Set term to the next term, returning false after the last one.
+      bool next(View& term)
+      {
+	if (done)
+	  return false;
+	const char *begin = pos;
+	while (pos != end)
+	  {
+	    const char c = *pos;
+	    lex.put(c);
+	    if (!lex.in_quote() && c == split_by && nterms < max_terms)
+	      {
+		term = View(begin, pos - begin);
+		++pos;
+		++nterms;
+		if (lim)
+		  lim->add_term();
+		return true;
+	      }
+	    ++pos;
+	  }
+	term = View(begin, pos - begin);
+	done = true;
+	if (lim)
+	  lim->add_term();
+	return true;
+      }
+
+    private:
+      LEX lex;
+      const char *pos;
+      const char *end;
+      const char split_by;
+      const unsigned int max_terms;
+      LIM* lim;
+      unsigned int nterms = 0;
+      bool done = false;
+    };
+
     // convenience method that returns data rather than modifying an in-place argument
     template <typename V, typename LEX, typename LIM>
     inline V by_char(const std::string& input, const char split_by, const unsigned int flags=0, const unsigned int max_terms=~0, LIM* lim=nullptr)
@@ -102,16 +209,16 @@ namespace openvpn {
     //   LIM : limit class such as OptionList::Limits
     // Args:
     //   ret : return data -- a list of strings
-    //   input : input string to be split
+    //   input : input string to be split, or a view of one
     //   lim : an optional limits object such as OptionList::Limits
     template <typename V, typename LEX, typename SPACE, typename LIM>
-    inline void by_space_void(V& ret, const std::string& input, LIM* lim=nullptr)
+    inline void by_space_void(V& ret, const View& input, LIM* lim=nullptr)
     {
       LEX lex;
 
       std::string term;
       bool defined = false;
-      for (std::string::const_iterator i = input.begin(); i != input.end(); ++i)
+      for (const char *i = input.begin(); i != input.end(); ++i)
 	{
 	  const char c = *i;
 	  lex.put(c);
@@ -145,7 +252,7 @@ namespace openvpn {
 
     // convenience method that returns data rather than modifying an in-place argument
     template <typename V, typename LEX, typename SPACE, typename LIM>
-    inline V by_space(const std::string& input, LIM* lim=nullptr)
+    inline V by_space(const View& input, LIM* lim=nullptr)
     {
       V ret;
       by_space_void<V, LEX, SPACE, LIM>(ret, input, lim);
@@ -24,7 +24,9 @@
 #ifndef OPENVPN_COMMON_SPLITLINES_H
 #define OPENVPN_COMMON_SPLITLINES_H
 
+#include <cstring>
 #include <utility>
+#include <algorithm>
 
 #include <openvpn/common/string.hpp>
 
@@ -47,24 +49,73 @@ namespace openvpn {
     {
       line.clear();
       overflow = false;
-      const size_t overflow_index = index + max_line_len;
-      while (index < size)
+      if (index >= size)
+	return false;
+
+      // locate the end of line with memchr rather than copying
+      // the line one char at a time
+      const char *begin = data + index;
+      const size_t avail = size - index;
+      const size_t scan = max_line_len ? std::min(avail, max_line_len) : avail;
+      const char *nl = (const char *)std::memchr(begin, '\n', scan);
+      size_t len = scan;
+      if (nl)
+	len = nl - begin + 1;
+      else if (scan < avail)
+	overflow = true;
+      line.assign(begin, len);
+      index += len;
+      if (trim && !overflow)
+	string::trim_crlf(line);
+      return true;
+    }
+
+    // Consume the lines up to and including the first one equal to
+    // end_line (as trimmed by operator()), appending the lines before
+    // it to block with '\n' line endings.  Meant for long inline
+    // blocks: runs of lines are copied at once rather than one line
+    // at a time.  Returns the number of lines consumed, or 0 if
+    // end_line is missing or a line is longer than max_line_len, in
+    // which case block and the position are left unchanged.
+    size_t read_block(const std::string& end_line, std::string& block)
+    {
+      const size_t block_size = block.size();
+      size_t pos = index;
+      size_t run = index; // start of lines not yet copied to block
+      size_t n = 0;
+      while (pos < size)
 	{
-	  if (max_line_len && index >= overflow_index)
+	  const char *begin = data + pos;
+	  const size_t avail = size - pos;
+	  const char *nl = (const char *)std::memchr(begin, '\n', avail);
+	  const size_t len = nl ? nl - begin + 1 : avail;
+	  if (max_line_len && len > max_line_len)
+	    break;
+	  ++n;
+	  size_t tlen = len;
+	  while (tlen && (begin[tlen-1] == '\n' || begin[tlen-1] == '\r'))
+	    --tlen;
+	  if (tlen == end_line.length() && !std::memcmp(begin, end_line.c_str(), tlen))
 	    {
-	      overflow = true;
-	      return true;
+	      block.append(data + run, pos - run);
+	      index = pos + len;
+	      line.clear();
+	      overflow = false;
+	      return n;
 	    }
-	  const char c = data[index++];
-	  line += c;
-	  if (c == '\n' || index >= size)
+
+	  // copy lines not ending in a bare '\n' on their own
+	  if (!nl || tlen + 1 != len)
 	    {
-	      if (trim)
-		string::trim_crlf(line);
-	      return true;
+	      block.append(data + run, pos - run);
+	      block.append(begin, tlen);
+	      block += '\n';
+	      run = pos + len;
 	    }
+	  pos += len;
 	}
-      return false;
+      block.resize(block_size);
+      return 0;
     }
 
     bool line_overflow() const
@@ -0,0 +1,195 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Placement and polling policy for the threads that run a data
+// path io_context: the core each thread is pinned to, busy polling
+// of its sockets in the kernel, and how long it keeps polling the
+// io_context in user space before blocking in the reactor.  Spinning
+// trades a core's worth of CPU for not paying the wakeup latency of
+// a sleeping thread on each burst of packets.
+
+#ifndef OPENVPN_COMMON_THREADPOLICY_H
+#define OPENVPN_COMMON_THREADPOLICY_H
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/sockopt.hpp>
+#include <openvpn/log/latencyhist.hpp>
+
+#if !defined(OPENVPN_PLATFORM_WIN)
+#include <openvpn/time/cputime.hpp>
+#endif
+
+#ifdef OPENVPN_PLATFORM_LINUX
+#include <openvpn/linux/core.hpp>
+#endif
+
+namespace openvpn {
+
+  struct ThreadPolicy
+  {
+    std::vector<int> cpus;           // pin thread unit to cpus[unit % cpus.size()], none if empty
+    unsigned int busy_poll_us = 0;   // SO_BUSY_POLL of data path sockets, see apply_socket()
+    bool prefer_busy_poll = false;   // SO_PREFER_BUSY_POLL along with it
+    unsigned int spin_us = 0;        // poll the io_context this long before blocking in the reactor
+
+    bool defined() const
+    {
+      return !cpus.empty() || busy_poll_us || spin_us;
+    }
+
+    // core for thread unit, or -1
+    int cpu(const unsigned int unit) const
+    {
+      return cpus.empty() ? -1 : cpus[unit % cpus.size()];
+    }
+
+    // Pin the calling thread, as thread unit.  Returns 0 on
+    // success or if there is nothing to do, else an errno value.
+    int pin(const unsigned int unit) const
+    {
+      const int core = cpu(unit);
+      if (core < 0)
+	return 0;
+#ifdef OPENVPN_PLATFORM_LINUX
+      return bind_to_core(core);
+#else
+      return ENOTSUP;
+#endif
+    }
+
+    // Busy poll a data path socket.  May throw.
+    void apply_socket(const int fd) const
+    {
+#ifdef SO_BUSY_POLL
+      if (busy_poll_us)
+	SockOpt::busy_poll(fd, busy_poll_us, prefer_busy_poll);
+#endif
+    }
+  };
+
+  // Counters of a thread run by run_io_context(), updated by that
+  // thread and readable from any other.
+  struct ThreadStats
+  {
+    std::atomic<std::uint64_t> handlers{0};      // handlers run
+    std::atomic<std::uint64_t> spin_handlers{0}; // of those, run after spinning rather than blocking
+    std::atomic<std::uint64_t> blocks{0};        // waits in the reactor
+    std::atomic<std::uint64_t> cpu_us{0};        // thread CPU time, updated before waits, at most every 100 ms
+    LatencyHistogram latency;                    // time to run each batch of ready handlers
+
+    std::string to_string() const
+    {
+      std::ostringstream os;
+      os << "handlers=" << handlers.load(std::memory_order_relaxed)
+	 << " spin=" << spin_handlers.load(std::memory_order_relaxed)
+	 << " blocks=" << blocks.load(std::memory_order_relaxed)
+	 << " cpu_ms=" << cpu_us.load(std::memory_order_relaxed) / 1000
+	 << " batch_p50_us=" << latency.percentile(50.0) / 1000
+	 << " batch_p99_us=" << latency.percentile(99.0) / 1000;
+      return os.str();
+    }
+  };
+
+  // Run io_context on the calling thread until it runs out of work
+  // or is stopped, like io_context::run(), spinning per policy.
+  // stats may be null.
+  inline void run_io_context(openvpn_io::io_context& io_context, const ThreadPolicy& policy, ThreadStats* stats)
+  {
+    if (!policy.spin_us && !stats)
+      {
+	io_context.run();
+	return;
+      }
+
+    const std::uint64_t spin_ns = std::uint64_t(policy.spin_us) * 1000;
+    std::uint64_t cpu_next = 0;
+    for (;;)
+      {
+	// run what is ready
+	const std::uint64_t start = stats ? LatencyHistogram::now_ns() : 0;
+	std::size_t n = io_context.poll();
+	if (n)
+	  {
+	    if (stats)
+	      {
+		stats->latency.record(LatencyHistogram::now_ns() - start);
+		stats->handlers.fetch_add(n, std::memory_order_relaxed);
+	      }
+	    continue;
+	  }
+	if (io_context.stopped())
+	  break;
+
+	// spin
+	if (spin_ns)
+	  {
+	    const std::uint64_t deadline = LatencyHistogram::now_ns() + spin_ns;
+	    do {
+	      n = io_context.poll_one();
+	    } while (!n && !io_context.stopped() && LatencyHistogram::now_ns() < deadline);
+	    if (n)
+	      {
+		if (stats)
+		  {
+		    stats->spin_handlers.fetch_add(n, std::memory_order_relaxed);
+		    stats->handlers.fetch_add(n, std::memory_order_relaxed);
+		  }
+		continue;
+	      }
+	    if (io_context.stopped())
+	      break;
+	  }
+
+	// block
+	if (stats)
+	  {
+#if !defined(OPENVPN_PLATFORM_WIN)
+	    const std::uint64_t now = LatencyHistogram::now_ns();
+	    if (now >= cpu_next)
+	      {
+		const double cpu = cpu_time(true);
+		if (cpu >= 0.0)
+		  stats->cpu_us.store(std::uint64_t(cpu * 1000000.0), std::memory_order_relaxed);
+		cpu_next = now + 100000000;
+	      }
+#endif
+	    stats->blocks.fetch_add(1, std::memory_order_relaxed);
+	  }
+	n = io_context.run_one();
+	if (!n)
+	  break;
+	if (stats)
+	  stats->handlers.fetch_add(n, std::memory_order_relaxed);
+      }
+  }
+
+} // namespace openvpn
+
+#endif
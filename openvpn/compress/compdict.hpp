@@ -0,0 +1,125 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// A compression dictionary shared by both ends of a tunnel, for
+// compressing small packets with a lot of content in common
+// (SNMP, RPC, telemetry) that compress poorly on their own.
+// It is distributed base64-encoded with the configuration, e.g.
+// as the output of "zstd --train" truncated to MAX_SIZE.
+
+#ifndef OPENVPN_COMPRESS_COMPDICT_H
+#define OPENVPN_COMPRESS_COMPDICT_H
+
+#include <string>
+#include <cstdint>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/common/hexstr.hpp>
+#include <openvpn/common/base64.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace openvpn {
+
+  class CompressDict : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<CompressDict> Ptr;
+
+    OPENVPN_EXCEPTION(compress_dict_error);
+
+    enum {
+      MAX_SIZE = 65536, // LZ4 only refers back 64 KB
+    };
+
+    CompressDict(const unsigned char *data, const size_t size)
+      : dict(data, size, 0)
+    {
+      if (!size || size > MAX_SIZE)
+	OPENVPN_THROW(compress_dict_error, "dictionary size must be 1.." << int(MAX_SIZE) << " bytes, not " << size);
+
+      // FNV-1a, to make sure both ends use the same dictionary
+      std::uint64_t h = 0xcbf29ce484222325ULL;
+      for (size_t i = 0; i < size; ++i)
+	{
+	  h ^= data[i];
+	  h *= 0x100000001b3ULL;
+	}
+      id_ = render_hex(&h, sizeof(h));
+
+#ifdef HAVE_LZ4
+#if LZ4_VERSION_NUMBER >= 10900
+      LZ4_initStream(&lz4_stream, sizeof(lz4_stream));
+#else
+      LZ4_resetStream(&lz4_stream);
+#endif
+      LZ4_loadDict(&lz4_stream, (const char *)dict.c_data(), (int)dict.size());
+#endif
+    }
+
+    // base64 text, which may be split over several lines
+    static Ptr parse(const std::string& b64)
+    {
+      BufferAllocated data(MAX_SIZE + 3, BufferAllocated::GROW);
+      try {
+	base64->decode(data, string::remove_spaces(b64));
+      }
+      catch (const std::exception& e)
+	{
+	  OPENVPN_THROW(compress_dict_error, "bad base64 dictionary: " << e.what());
+	}
+      return new CompressDict(data.c_data(), data.size());
+    }
+
+    const unsigned char *data() const { return dict.c_data(); }
+    size_t size() const { return dict.size(); }
+
+    // identifies the dictionary content in peer info and pushed options
+    const std::string& id() const { return id_; }
+
+#ifdef HAVE_LZ4
+    // Compressor state after loading the dictionary, to be copied
+    // before compressing each packet, since LZ4_loadDict() would
+    // hash the whole dictionary again.
+    const LZ4_stream_t& lz4_dict_stream() const { return lz4_stream; }
+#endif
+
+  private:
+    CompressDict(const CompressDict&) = delete;
+    CompressDict& operator=(const CompressDict&) = delete;
+
+    BufferAllocated dict; // referenced by lz4_stream, so never moved
+    std::string id_;
+#ifdef HAVE_LZ4
+    LZ4_stream_t lz4_stream;
+#endif
+  };
+
+}
+
+#endif
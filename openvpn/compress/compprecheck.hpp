@@ -0,0 +1,147 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Cheap per-packet test for inner traffic that is already encrypted
+// and so not worth a compression attempt.  It only looks at the IP
+// and transport headers, and at the start of TCP payloads for a TLS
+// record header.
+// Should only be included by compress.hpp
+
+#ifndef OPENVPN_COMPRESS_COMPPRECHECK_H
+#define OPENVPN_COMPRESS_COMPPRECHECK_H
+
+#include <cstdint>
+
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ipcommon.hpp>
+#include <openvpn/ip/eth.hpp>
+#include <openvpn/ip/ip4.hpp>
+#include <openvpn/ip/ip6.hpp>
+#include <openvpn/ip/tcp.hpp>
+#include <openvpn/ip/udp.hpp>
+
+namespace openvpn {
+  class CompressPrecheck
+  {
+  public:
+    enum {
+      ESP = 50,            // IPsec ESP protocol
+      PORT_SSH = 22,
+      PORT_HTTPS = 443,    // TLS over TCP, QUIC over UDP
+      PORT_IPSEC_NAT_T = 4500,
+      PORT_WIREGUARD = 51820,
+      TLS_APPLICATION_DATA = 0x17,
+    };
+
+    // Returns false if buf, a tun packet (or tap frame if layer2),
+    // is known to carry encrypted data.  Returns true if it may be
+    // compressible, including for anything we can't parse.
+    static bool compressible(const Buffer& buf, const bool layer2)
+    {
+      const std::uint8_t* p = buf.c_data();
+      size_t len = buf.size();
+      if (layer2)
+	{
+	  if (len < sizeof(EthHeader))
+	    return true;
+	  const std::uint16_t ethertype = ntohs(reinterpret_cast<const EthHeader*>(p)->ethertype);
+	  if (ethertype != 0x0800 && ethertype != 0x86DD)
+	    return true;
+	  p += sizeof(EthHeader);
+	  len -= sizeof(EthHeader);
+	}
+      if (!len)
+	return true;
+
+      unsigned int protocol;
+      size_t hlen;
+      switch (IPCommon::version(p[0]))
+	{
+	case IPCommon::IPv4:
+	  {
+	    if (len < sizeof(IPv4Header))
+	      return true;
+	    const IPv4Header* ip = reinterpret_cast<const IPv4Header*>(p);
+	    if (ntohs(ip->frag_off) & IPv4Header::OFFMASK) // non-first fragment
+	      return true;
+	    protocol = ip->protocol;
+	    hlen = IPv4Header::length(ip->version_len);
+	    break;
+	  }
+	case IPCommon::IPv6:
+	  {
+	    if (len < sizeof(IPv6Header))
+	      return true;
+	    protocol = reinterpret_cast<const IPv6Header*>(p)->nexthdr; // extension headers are not followed
+	    hlen = sizeof(IPv6Header);
+	    break;
+	  }
+	default:
+	  return true;
+	}
+
+      if (protocol == ESP)
+	return false;
+      if (hlen > len)
+	return true;
+      p += hlen;
+      len -= hlen;
+
+      if (protocol == IPCommon::UDP)
+	{
+	  if (len < sizeof(UDPHeader))
+	    return true;
+	  const UDPHeader* udp = reinterpret_cast<const UDPHeader*>(p);
+	  return !(encrypted_udp_port(ntohs(udp->source)) || encrypted_udp_port(ntohs(udp->dest)));
+	}
+      else if (protocol == IPCommon::TCP)
+	{
+	  if (len < sizeof(TCPHeader))
+	    return true;
+	  const TCPHeader* tcp = reinterpret_cast<const TCPHeader*>(p);
+	  if (encrypted_tcp_port(ntohs(tcp->source)) || encrypted_tcp_port(ntohs(tcp->dest)))
+	    return false;
+
+	  // TLS application data record on any port
+	  const size_t thlen = TCPHeader::length(tcp->doff_res);
+	  if (thlen < sizeof(TCPHeader) || len < thlen + 3)
+	    return true;
+	  const std::uint8_t* rec = p + thlen;
+	  return !(rec[0] == TLS_APPLICATION_DATA && rec[1] == 0x03 && rec[2] <= 0x04);
+	}
+      return true;
+    }
+
+  private:
+    static bool encrypted_udp_port(const unsigned int port)
+    {
+      return port == PORT_HTTPS || port == PORT_IPSEC_NAT_T || port == PORT_WIREGUARD;
+    }
+
+    static bool encrypted_tcp_port(const unsigned int port)
+    {
+      return port == PORT_HTTPS || port == PORT_SSH;
+    }
+  };
+}
+
+#endif
@@ -20,18 +20,24 @@
 //    If not, see <http://www.gnu.org/licenses/>.
 
 // Base class and factory for compression/decompression objects.
-// Currently we support LZO, Snappy, and LZ4 implementations.
+// Currently we support LZO, Snappy, and LZ4 implementations,
+// the latter also with a pre-shared dictionary.
 
 #ifndef OPENVPN_COMPRESS_COMPRESS_H
 #define OPENVPN_COMPRESS_COMPRESS_H
 
+#include <algorithm>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/likely.hpp>
+#include <openvpn/common/buildprofile.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/compress/compprecheck.hpp>
+#include <openvpn/compress/compdict.hpp>
 
 #define OPENVPN_LOG_COMPRESS(x)
 #define OPENVPN_LOG_COMPRESS_VERBOSE(x)
@@ -65,7 +71,54 @@ namespace openvpn {
     // Decompression method implemented by underlying compression class.
     virtual void decompress(BufferAllocated& buf) = 0;
 
+    // Like decompress(), but a compressed packet is written straight
+    // into dest, which the caller prepared for the packet's next
+    // stage (e.g. with Frame::READ_TUN, keeping the headroom for the
+    // tun prefix), instead of into a work buffer that is then
+    // swapped into buf.  Returns true if the packet is in dest.
+    // Otherwise it is in buf, as after decompress(), and dest is
+    // unchanged.
+    bool decompress_to(BufferAllocated& buf, BufferAllocated& dest)
+    {
+      decompress_dest = &dest;
+      decompressed = false;
+      decompress(buf);
+      decompress_dest = nullptr;
+      return decompressed;
+    }
+
+    // Release work buffers, which are re-created on the next
+    // compress or decompress.
+    virtual void compact() {}
+
+    // In adaptive mode, a compression attempt that saves less than
+    // 1/ADAPT_MIN_SAVING of the packet makes the compressor send the
+    // next packets uncompressed without trying.  The number of
+    // skipped packets doubles with each further miss, up to
+    // ADAPT_BACKOFF_MAX, after which every ADAPT_BACKOFF_MAX+1'th
+    // packet probes again.  An attempt that compresses well resets
+    // the backoff.
+    void set_adaptive(const bool enable)
+    {
+      adaptive = enable;
+      adapt_backoff = adapt_skip = 0;
+    }
+
+    // With precheck enabled, packets that CompressPrecheck identifies
+    // as carrying encrypted data are sent uncompressed without trying.
+    void set_precheck(const bool enable, const bool layer2)
+    {
+      precheck = enable;
+      precheck_layer2 = layer2;
+    }
+
   protected:
+    enum {
+      ADAPT_MIN_SAVING = 16,
+      ADAPT_BACKOFF_MIN = 8,
+      ADAPT_BACKOFF_MAX = 1024,
+    };
+
     // magic numbers to indicate no compression
     enum {
       NO_COMPRESS      = 0xFA,
@@ -79,12 +132,43 @@ namespace openvpn {
       // Compression algs
       OVPN_COMPv2_NONE=0,
       OVPN_COMPv2_LZ4=1,
+      OVPN_COMPv2_LZ4DICT=0x40, // OpenVPN 3 only
     };
 
     Compress(const Frame::Ptr& frame_arg,
 	     const SessionStats::Ptr& stats_arg)
       : frame(frame_arg), stats(stats_arg) {}
 
+    // Returns true if adaptive mode or the precheck say to skip
+    // compressing buf.
+    bool skip_compress(const Buffer& buf)
+    {
+      if (unlikely(adapt_skip))
+	--adapt_skip;
+      else if (!precheck || CompressPrecheck::compressible(buf, precheck_layer2))
+	return false;
+      stats->inc_stat(SessionStats::COMPRESS_SKIPPED, 1);
+      return true;
+    }
+
+    // Record the outcome of a compression attempt.  out_size is the
+    // compressed size, or in_size if the packet went out uncompressed.
+    void compress_result(const size_t in_size, const size_t out_size)
+    {
+      const size_t saved = out_size < in_size ? in_size - out_size : 0;
+      if (saved)
+	stats->inc_stat(SessionStats::COMPRESS_BYTES_SAVED, saved);
+      if (!adaptive)
+	return;
+      if (saved && saved >= in_size / ADAPT_MIN_SAVING)
+	adapt_backoff = 0;
+      else
+	{
+	  adapt_backoff = adapt_backoff ? std::min(adapt_backoff * 2, (unsigned int)ADAPT_BACKOFF_MAX) : (unsigned int)ADAPT_BACKOFF_MIN;
+	  adapt_skip = adapt_backoff;
+	}
+    }
+
     void error(BufferAllocated& buf)
     {
       stats->error(Error::COMPRESS_ERROR);
@@ -136,8 +220,44 @@ namespace openvpn {
       return uc;
     }
 
+    // The buffer to decompress into: dest if not null, else work,
+    // prepared with Frame::DECOMPRESS_WORK.  Sets payload to the
+    // room for the decompressed packet.
+    BufferAllocated& decompress_buffer(BufferAllocated* dest, BufferAllocated& work, size_t& payload)
+    {
+      if (dest)
+	{
+	  payload = std::min((*frame)[Frame::DECOMPRESS_WORK].payload(), dest->remaining());
+	  return *dest;
+	}
+      payload = frame->prepare(Frame::DECOMPRESS_WORK, work);
+      return work;
+    }
+
+    // Complete a decompression of size bytes into out, as returned
+    // by decompress_buffer().  Returns true if out is dest.
+    static bool decompress_finish(BufferAllocated& buf, BufferAllocated* dest, BufferAllocated& out, const size_t size)
+    {
+      out.set_size(size);
+      if (&out == dest)
+	return true;
+      buf.swap(out);
+      return false;
+    }
+
     Frame::Ptr frame;
     SessionStats::Ptr stats;
+
+    // set while decompress_to() runs
+    BufferAllocated* decompress_dest = nullptr;
+    bool decompressed = false;
+
+  private:
+    bool adaptive = false;
+    bool precheck = false;
+    bool precheck_layer2 = false;
+    unsigned int adapt_backoff = 0; // current skip length, 0 if compression is paying off
+    unsigned int adapt_skip = 0;    // packets left to skip
   };
 }
 
@@ -171,6 +291,7 @@ namespace openvpn {
       LZ4,
       LZ4v2,
       SNAPPY,
+      LZ4DICT,    // LZ4v2 with the dictionary given to set_dict()
     };
 
     OPENVPN_SIMPLE_EXCEPTION(compressor_unavailable);
@@ -188,6 +309,11 @@ namespace openvpn {
     Type type() const { return type_; }
     bool asym() const { return asym_; }
 
+    // Pre-shared dictionary for LZ4DICT.  On the client it is also
+    // advertised to the server while the method is still ANY.
+    void set_dict(const CompressDict::Ptr& dict) { dict_ = dict; }
+    const CompressDict::Ptr& dict() const { return dict_; }
+
     unsigned int extra_payload_bytes() const
     {
       switch (type_)
@@ -196,6 +322,7 @@ namespace openvpn {
 	  return 0;
 	case COMP_STUBv2:
 	case LZ4v2:
+	case LZ4DICT:
 	  return 2; // worst case
 	default:
 	  return 1;
@@ -227,6 +354,10 @@ namespace openvpn {
 	  return new CompressLZ4(frame, stats, asym_);
 	case LZ4v2:
 	  return new CompressLZ4v2(frame, stats, asym_);
+	case LZ4DICT:
+	  if (!dict_)
+	    throw compressor_unavailable();
+	  return new CompressLZ4Dict(frame, stats, dict_, asym_);
 #endif
 #ifdef HAVE_SNAPPY
 	case SNAPPY:
@@ -262,6 +393,7 @@ namespace openvpn {
 	  return false;
 #endif
 	case LZ4v2:
+	case LZ4DICT:
 #ifdef HAVE_LZ4
 	  return true;
 #else
@@ -344,6 +476,17 @@ namespace openvpn {
 	}
     }
 
+    // On the client, used to tell server which dictionary we have
+    // for LZ4DICT, if any.  Compression V2 only.
+    std::string peer_info_dict() const
+    {
+#ifdef HAVE_LZ4
+      if (dict_ && (type_ == ANY || type_ == LZ4DICT))
+	return "IV_LZ4DICT=" + dict_->id() + '\n';
+#endif
+      return std::string();
+    }
+
     // On the client, used to tell server which compression methods we support.
     // Limited only to compression V1 methods.
     const char *peer_info_string_v1() const
@@ -410,6 +553,7 @@ namespace openvpn {
 	case SNAPPY:
 	case LZ4:
 	case LZ4v2:
+	case LZ4DICT:
 	case LZO_SWAP:
 	case COMP_STUB:
 	case COMP_STUBv2:
@@ -433,6 +577,8 @@ namespace openvpn {
 	  return "LZ4";
 	case LZ4v2:
 	  return "LZ4v2";
+	case LZ4DICT:
+	  return "LZ4DICT";
 	case SNAPPY:
 	  return "SNAPPY";
 	case LZO_STUB:
@@ -466,6 +612,8 @@ namespace openvpn {
 	  return "lz4";
 	case LZ4v2:
 	  return "lz4v2";
+	case LZ4DICT:
+	  return "lz4-dict";
 	case SNAPPY:
 	  return "snappy";
 	case COMP_STUB:
@@ -485,6 +633,8 @@ namespace openvpn {
 	return LZ4v2;
       else if (method == "lz4")
 	return LZ4;
+      else if (method == "lz4-dict")
+	return LZ4DICT;
       else if (method == "lzo")
 	return LZO;
       else if (method == "lzo-swap")
@@ -505,6 +655,7 @@ namespace openvpn {
 	{
 	case COMP_STUBv2:
 	case LZ4v2:
+	case LZ4DICT:
 	  return COMP_STUBv2;
 	default:
 	  return COMP_STUB;
@@ -541,6 +692,7 @@ namespace openvpn {
   private:
     Type type_ = NONE;
     bool asym_ = false;
+    CompressDict::Ptr dict_;
   };
 
 } // namespace openvpn
@@ -82,7 +82,7 @@ namespace openvpn {
 	// compressed packets even if we didn't ask for them
 	case CompressLZO::LZO_COMPRESS:
 	  OPENVPN_LOG_COMPRESS_VERBOSE("CompressStub: handled unsolicited LZO packet");
-	  lzo.decompress_work(buf);
+	  decompressed = lzo.decompress_work(buf, decompress_dest);
 	  break;
 #endif
 	default: 
@@ -91,6 +91,13 @@ namespace openvpn {
 	}
     }
 
+#ifndef NO_LZO
+    virtual void compact()
+    {
+      lzo.compact();
+    }
+#endif
+
   private:
     const bool support_swap;
 #ifndef NO_LZO
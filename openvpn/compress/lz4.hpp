@@ -26,6 +26,7 @@
 // Should only be included by compress.hpp
 
 #include <algorithm> // for std::max
+#include <memory>
 
 #include <lz4.h>
 
@@ -39,26 +40,32 @@ namespace openvpn {
     {
     }
 
-    bool do_decompress(BufferAllocated& buf)
+    // Decompress into decompress_dest if set, else into work.
+    bool do_decompress(BufferAllocated& buf, const CompressDict* dict = nullptr)
     {
-      // initialize work buffer
-      const int payload_size = frame->prepare(Frame::DECOMPRESS_WORK, work);
+      size_t payload_size;
+      BufferAllocated& out = decompress_buffer(decompress_dest, work, payload_size);
 
       // do uncompress
-      const int decomp_size = LZ4_decompress_safe((const char *)buf.c_data(), (char *)work.data(),
-						  (int)buf.size(), payload_size);
+      const int decomp_size = dict
+	? LZ4_decompress_safe_usingDict((const char *)buf.c_data(), (char *)out.data(),
+					(int)buf.size(), (int)payload_size,
+					(const char *)dict->data(), (int)dict->size())
+	: LZ4_decompress_safe((const char *)buf.c_data(), (char *)out.data(),
+			      (int)buf.size(), (int)payload_size);
       if (decomp_size < 0)
 	{
 	  error(buf);
 	  return false;
 	}
       OPENVPN_LOG_COMPRESS_VERBOSE("LZ4 uncompress " << buf.size() << " -> " << decomp_size);
-      work.set_size(decomp_size);
-      buf.swap(work);
+      decompressed = decompress_finish(buf, decompress_dest, out, decomp_size);
       return true;
     }
 
-    bool do_compress(BufferAllocated& buf)
+    // With a stream, compress against the dictionary loaded into it.
+    // The stream state is consumed.
+    bool do_compress(BufferAllocated& buf, LZ4_stream_t* stream = nullptr)
     {
       // initialize work buffer
       frame->prepare(Frame::COMPRESS_WORK, work);
@@ -71,8 +78,11 @@ namespace openvpn {
 	}
 
       // do compress
-      const unsigned int comp_size = LZ4_compress_default((const char *)buf.c_data(), (char *)work.data(),
-                                                          (int)buf.size(), (int)work.capacity());
+      const unsigned int comp_size = stream
+	? LZ4_compress_fast_continue(stream, (const char *)buf.c_data(), (char *)work.data(),
+				     (int)buf.size(), (int)work.capacity(), 1)
+	: LZ4_compress_default((const char *)buf.c_data(), (char *)work.data(),
+			       (int)buf.size(), (int)work.capacity());
 
       // did compression actually reduce data length?
       if (comp_size < buf.size())
@@ -83,12 +93,16 @@ namespace openvpn {
 	      return false;
 	    }
 	  OPENVPN_LOG_COMPRESS_VERBOSE("LZ4 compress " << buf.size() << " -> " << comp_size);
+	  compress_result(buf.size(), comp_size);
 	  work.set_size(comp_size);
 	  buf.swap(work);
 	  return true;
 	}
       else
-	return false;
+	{
+	  compress_result(buf.size(), buf.size());
+	  return false;
+	}
     }
 
     // Worst case size expansion on compress.
@@ -105,6 +119,12 @@ namespace openvpn {
     }
 
     BufferAllocated work;
+
+  public:
+    virtual void compact()
+    {
+      work.clear();
+    }
   };
 
   class CompressLZ4 : public CompressLZ4Base
@@ -130,7 +150,7 @@ namespace openvpn {
       if (!buf.size())
 	return;
 
-      if (hint && !asym)
+      if (hint && !asym && !skip_compress(buf))
 	{
 	  if (do_compress(buf))
 	    {
@@ -186,7 +206,7 @@ namespace openvpn {
       if (!buf.size())
 	return;
 
-      if (hint && !asym)
+      if (hint && !asym && !skip_compress(buf))
 	{
 	  if (do_compress(buf))
 	    {
@@ -222,6 +242,77 @@ namespace openvpn {
     const bool asym;
   };
 
+  // LZ4v2 framing, compressing against a pre-shared dictionary.
+  // Each packet is still compressed on its own, so that packet loss
+  // and reordering don't matter.
+  class CompressLZ4Dict : public CompressLZ4Base
+  {
+  public:
+    CompressLZ4Dict(const Frame::Ptr& frame, const SessionStats::Ptr& stats,
+		    const CompressDict::Ptr& dict_arg, const bool asym_arg)
+      : CompressLZ4Base(frame, stats),
+	dict(dict_arg),
+	asym(asym_arg)
+    {
+      OPENVPN_LOG_COMPRESS("LZ4-DICT init id=" << dict->id() << " asym=" << asym_arg);
+    }
+
+    virtual const char *name() const { return "lz4-dict"; }
+
+    virtual void compress(BufferAllocated& buf, const bool hint)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      if (hint && !asym && !skip_compress(buf))
+	{
+	  // start from the state after loading the dictionary
+	  if (!stream)
+	    stream.reset(new LZ4_stream_t);
+	  *stream = dict->lz4_dict_stream();
+	  if (do_compress(buf, stream.get()))
+	    {
+	      v2_push(buf, OVPN_COMPv2_LZ4DICT);
+	      return;
+	    }
+	}
+
+      // indicate that we didn't compress
+      v2_push(buf, OVPN_COMPv2_NONE);
+    }
+
+    virtual void decompress(BufferAllocated& buf)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      const int c = v2_pull(buf);
+      switch (c)
+	{
+	case OVPN_COMPv2_NONE:
+	  break;
+	case OVPN_COMPv2_LZ4DICT:
+	  do_decompress(buf, dict.get());
+	  break;
+	default:
+	  error(buf); // unknown op
+	}
+    }
+
+    virtual void compact()
+    {
+      CompressLZ4Base::compact();
+      stream.reset();
+    }
+
+  private:
+    const CompressDict::Ptr dict;
+    std::unique_ptr<LZ4_stream_t> stream; // 16 KB
+    const bool asym;
+  };
+
 }
 
 #endif
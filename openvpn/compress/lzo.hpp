@@ -50,7 +50,6 @@ namespace openvpn {
 	asym(asym_arg)
     {
       OPENVPN_LOG_COMPRESS("LZO init swap=" << support_swap_arg << " asym=" << asym_arg);
-      lzo_workspace.init(LZO1X_1_15_MEM_COMPRESS, BufferAllocated::ARRAY);
     }
 
     static void init_static()
@@ -61,21 +60,23 @@ namespace openvpn {
 
     virtual const char *name() const { return "lzo"; }
 
-    void decompress_work(BufferAllocated& buf)
+    // Decompress into dest if not null, else into work.  Returns
+    // true if the packet is in dest.
+    bool decompress_work(BufferAllocated& buf, BufferAllocated* dest = nullptr)
     {
-      // initialize work buffer
-      lzo_uint zlen = frame->prepare(Frame::DECOMPRESS_WORK, work);
+      size_t payload;
+      BufferAllocated& out = decompress_buffer(dest, work, payload);
+      lzo_uint zlen = payload;
 
-      // do uncompress
-      const int err = lzo1x_decompress_safe(buf.c_data(), buf.size(), work.data(), &zlen, lzo_workspace.data());
+      // do uncompress (lzo1x_decompress_safe doesn't use a workspace)
+      const int err = lzo1x_decompress_safe(buf.c_data(), buf.size(), out.data(), &zlen, nullptr);
       if (err != LZO_E_OK)
 	{
 	  error(buf);
-	  return;
+	  return false;
 	}
       OPENVPN_LOG_COMPRESS_VERBOSE("LZO uncompress " << buf.size() << " -> " << zlen);
-      work.set_size(zlen);
-      buf.swap(work);
+      return decompress_finish(buf, dest, out, zlen);
     }
 
     virtual void compress(BufferAllocated& buf, const bool hint)
@@ -84,7 +85,7 @@ namespace openvpn {
       if (!buf.size())
 	return;
 
-      if (hint && !asym)
+      if (hint && !asym && !skip_compress(buf))
 	{
 	  // initialize work buffer
 	  frame->prepare(Frame::COMPRESS_WORK, work);
@@ -96,6 +97,11 @@ namespace openvpn {
 	      return;
 	    }
 
+	  // the workspace is only needed to compress, so allocate it
+	  // on first use
+	  if (!lzo_workspace.allocated())
+	    lzo_workspace.init(LZO1X_1_15_MEM_COMPRESS, BufferAllocated::ARRAY);
+
 	  // do compress
 	  lzo_uint zlen = 0;
 	  const int err = ::lzo1x_1_15_compress(buf.c_data(), buf.size(), work.data(), &zlen, lzo_workspace.data());
@@ -108,6 +114,7 @@ namespace openvpn {
 	    }
 
 	  // did compression actually reduce data length?
+	  compress_result(buf.size(), std::min<size_t>(zlen, buf.size()));
 	  if (zlen < buf.size())
 	    {
 	      OPENVPN_LOG_COMPRESS_VERBOSE("LZO compress " << buf.size() << " -> " << zlen);
@@ -144,13 +151,19 @@ namespace openvpn {
 	case LZO_COMPRESS_SWAP:
 	  do_unswap(buf);
 	case LZO_COMPRESS:
-	  decompress_work(buf);
+	  decompressed = decompress_work(buf, decompress_dest);
 	  break;
 	default: 
 	  error(buf); // unknown op
 	}
     }
 
+    virtual void compact()
+    {
+      work.clear();
+      lzo_workspace.clear();
+    }
+
   private:
     // worst case size expansion on compress
     size_t lzo_extra_buffer(const size_t len)
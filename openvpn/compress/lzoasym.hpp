@@ -56,21 +56,23 @@ namespace openvpn {
 
     virtual const char *name() const { return "lzo-asym"; }
 
-    void decompress_work(BufferAllocated& buf)
+    // Decompress into dest if not null, else into work.  Returns
+    // true if the packet is in dest.
+    bool decompress_work(BufferAllocated& buf, BufferAllocated* dest = nullptr)
     {
-      // initialize work buffer
-      size_t zlen = frame->prepare(Frame::DECOMPRESS_WORK, work);
+      size_t payload;
+      BufferAllocated& out = decompress_buffer(dest, work, payload);
+      size_t zlen = payload;
 
       // do uncompress
-      const int err = lzo_asym_impl::lzo1x_decompress_safe(buf.c_data(), buf.size(), work.data(), &zlen);
+      const int err = lzo_asym_impl::lzo1x_decompress_safe(buf.c_data(), buf.size(), out.data(), &zlen);
       if (err != lzo_asym_impl::LZOASYM_E_OK)
 	{
 	  error(buf);
-	  return;
+	  return false;
 	}
       OPENVPN_LOG_COMPRESS_VERBOSE("LZO-ASYM uncompress " << buf.size() << " -> " << zlen);
-      work.set_size(zlen);
-      buf.swap(work);
+      return decompress_finish(buf, dest, out, zlen);
     }
 
     virtual void compress(BufferAllocated& buf, const bool hint)
@@ -102,13 +104,18 @@ namespace openvpn {
 	case LZO_COMPRESS_SWAP:
 	  do_unswap(buf);
 	case LZO_COMPRESS:
-	  decompress_work(buf);
+	  decompressed = decompress_work(buf, decompress_dest);
 	  break;
 	default: 
 	  error(buf); // unknown op
 	}
     }
 
+    virtual void compact()
+    {
+      work.clear();
+    }
+
   private:
     const bool support_swap;
     BufferAllocated work;
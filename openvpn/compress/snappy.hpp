@@ -52,7 +52,7 @@ namespace openvpn {
       if (!buf.size())
 	return;
 
-      if (hint && !asym)
+      if (hint && !asym && !skip_compress(buf))
 	{
 	  // initialize work buffer
 	  frame->prepare(Frame::COMPRESS_WORK, work);
@@ -69,6 +69,7 @@ namespace openvpn {
 	  snappy::RawCompress((const char *)buf.c_data(), buf.size(), (char *)work.data(), &comp_size);
 
 	  // did compression actually reduce data length?
+	  compress_result(buf.size(), std::min(comp_size, buf.size()));
 	  if (comp_size < buf.size())
 	    {
 	      OPENVPN_LOG_COMPRESS_VERBOSE("SNAPPY compress " << buf.size() << " -> " << comp_size);
@@ -99,8 +100,8 @@ namespace openvpn {
 	  {
 	    do_unswap(buf);
 
-	    // initialize work buffer
-	    const size_t payload_size = frame->prepare(Frame::DECOMPRESS_WORK, work);
+	    size_t payload_size;
+	    BufferAllocated& out = decompress_buffer(decompress_dest, work, payload_size);
 
 	    // do uncompress
 	    size_t decomp_size;
@@ -110,14 +111,13 @@ namespace openvpn {
 		error(buf);
 		break;
 	      }
-	    if (!snappy::RawUncompress((const char *)buf.c_data(), buf.size(), (char *)work.data()))
+	    if (!snappy::RawUncompress((const char *)buf.c_data(), buf.size(), (char *)out.data()))
 	      {
 		error(buf);
 		break;
 	      }
 	    OPENVPN_LOG_COMPRESS_VERBOSE("SNAPPY uncompress " << buf.size() << " -> " << decomp_size);
-	    work.set_size(decomp_size);
-	    buf.swap(work);
+	    decompressed = decompress_finish(buf, decompress_dest, out, decomp_size);
 	  }
 	  break;
 	default: 
@@ -126,6 +126,11 @@ namespace openvpn {
 	}
     }
 
+    virtual void compact()
+    {
+      work.clear();
+    }
+
   private:
     const bool asym;
     BufferAllocated work;
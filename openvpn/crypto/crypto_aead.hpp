@@ -25,6 +25,11 @@
 #define OPENVPN_CRYPTO_CRYPTO_AEAD_H
 
 #include <cstring>           // for std::memcpy, std::memset
+#include <memory>            // for std::unique_ptr
+#include <algorithm>         // for std::min
+#include <cassert>
+#include <cstdint>
+#include <typeinfo>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -34,12 +39,16 @@
 #include <openvpn/crypto/packet_id.hpp>
 #include <openvpn/log/sessionstats.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
+#include <openvpn/crypto/dcpipeline.hpp>
 
 // Sample AES-GCM head:
 //   48000001 00000005 7e7046bd 444a7e28 cc6387b1 64a4d6c1 380275a...
 //   [ OP32 ] [seq # ] [             auth tag            ] [ payload ... ]
 //            [4-byte
 //            IV head]
+//
+// With PacketID::WIDE_FORM the sequence number, and so the IV head,
+// is 8 bytes, and the nonce tail 4 bytes.
 
 namespace openvpn {
   namespace AEAD {
@@ -53,18 +62,35 @@ namespace openvpn {
       public:
 	Nonce()
 	{
-	  static_assert(4 + CRYPTO_API::CipherContextGCM::IV_LEN == sizeof(data),
+	  static_assert(CRYPTO_API::CipherContextGCM::IV_LEN == 12,
 			"AEAD IV_LEN inconsistency");
 	  ad_op32 = false;
+	  pid_len = PacketID::shortidsize;
 	  std::memset(data, 0, sizeof(data));
+	  std::memset(tail, 0, sizeof(tail));
 	}
 
 	// setup
 	void set_tail(const StaticKey& sk)
 	{
-	  if (sk.size() < 8)
+	  if (sk.size() < sizeof(tail))
 	    throw aead_error("insufficient key material for nonce tail");
-	  std::memcpy(data + 8, sk.data(), 8);
+	  std::memcpy(tail, sk.data(), sizeof(tail));
+	  place_tail();
+	}
+
+	// setup -- PacketID::SHORT_FORM or PacketID::WIDE_FORM
+	void set_pid_form(const int form)
+	{
+	  if (form != PacketID::SHORT_FORM && form != PacketID::WIDE_FORM)
+	    throw aead_error("unsupported packet ID form");
+	  pid_len = (unsigned char)PacketID::size(form);
+	  place_tail();
+	}
+
+	size_t pid_size() const
+	{
+	  return pid_len;
 	}
 
 	// for encrypt
@@ -72,7 +98,8 @@ namespace openvpn {
 	      const unsigned char *op32)
 	{
 	  std::memcpy(data, ref.data, sizeof(data));
-	  Buffer buf(data + 4, 4, false);
+	  pid_len = ref.pid_len;
+	  Buffer buf(data + 4, pid_len, false);
 	  pid_send.write_next(buf, false, now);
 	  if (op32)
 	    {
@@ -83,17 +110,39 @@ namespace openvpn {
 	    ad_op32 = false;
 	}
 
+	// for encrypt_batch -- set up everything but the packet ID once
+	void prepare(const Nonce& ref, const unsigned char *op32)
+	{
+	  std::memcpy(data, ref.data, sizeof(data));
+	  pid_len = ref.pid_len;
+	  if (op32)
+	    {
+	      ad_op32 = true;
+	      std::memcpy(data, op32, 4);
+	    }
+	  else
+	    ad_op32 = false;
+	}
+
+	// for encrypt_batch -- write next packet ID into prepared nonce
+	void next_packet_id(PacketIDSend& pid_send, const PacketID::time_t now)
+	{
+	  Buffer buf(data + 4, pid_len, false);
+	  pid_send.write_next(buf, false, now);
+	}
+
 	// for encrypt
 	void prepend_ad(Buffer& buf) const
 	{
-	  buf.prepend(data + 4, 4);
+	  buf.prepend(data + 4, pid_len);
 	}
 
 	// for decrypt
 	Nonce(const Nonce& ref, Buffer& buf, const unsigned char *op32)
 	{
 	  std::memcpy(data, ref.data, sizeof(data));
-	  buf.read(data + 4, 4);
+	  pid_len = ref.pid_len;
+	  buf.read(data + 4, pid_len);
 	  if (op32)
 	    {
 	      ad_op32 = true;
@@ -106,7 +155,7 @@ namespace openvpn {
 	// for decrypt
 	bool verify_packet_id(PacketIDReceive& pid_recv, const PacketID::time_t now)
 	{
-	  Buffer buf(data + 4, 4, true);
+	  Buffer buf(data + 4, pid_len, true);
 	  const PacketID pid = pid_recv.read_next(buf);
 	  return pid_recv.test_add(pid, now, true); // verify packet ID
 	}
@@ -123,16 +172,26 @@ namespace openvpn {
 
 	const size_t ad_len() const
 	{
-	  return ad_op32 ? 8 : 4;
+	  return ad_op32 ? 4 + pid_len : pid_len;
 	}
 
       private:
+	// the nonce tail fills the 12-byte IV after the packet ID
+	void place_tail()
+	{
+	  std::memcpy(data + 4 + pid_len, tail, 12 - pid_len);
+	}
+
 	bool ad_op32; // true if AD includes op32 opcode
+	unsigned char pid_len; // 4, or 8 for PacketID::WIDE_FORM
 
 	// Sample data:
 	//   [ OP32 (optional) ] [  pkt ID     ] [     nonce tail          ]
 	//   [ 48 00 00 01     ] [ 00 00 00 05 ] [ 7f 45 64 db 33 5b 6c 29 ]
+	// or with PacketID::WIDE_FORM:
+	//   [ 48 00 00 01     ] [ 00 00 00 00 00 00 00 05 ] [ 7f 45 64 db ]
 	unsigned char data[16];
+	unsigned char tail[8];
       };
 
       struct Encrypt {
@@ -148,16 +207,33 @@ namespace openvpn {
 	PacketIDReceive pid_recv;
 	BufferAllocated work;
       };
+      typedef typename CRYPTO_API::CipherContextGCM GCM;
+
+      enum {
+	PIPELINE_MIN_BYTES = 16384, // smallest batch worth spreading over a DCPipeline
+	PIPELINE_CHUNK = 64,        // packets per DCPipeline::run() when decrypting
+      };
+
     public:
       typedef CryptoDCInstance Base;
 
+      // If pipeline is defined, large batches are spread over its
+      // threads, each with its own keyed cipher contexts.  Packet IDs
+      // are still assigned and checked in order on the calling thread.
       Crypto(const CryptoAlgs::Type cipher_arg,
 	     const Frame::Ptr& frame_arg,
-	     const SessionStats::Ptr& stats_arg)
+	     const SessionStats::Ptr& stats_arg,
+	     const DCPipeline::Ptr& pipeline_arg = DCPipeline::Ptr())
 	: cipher(cipher_arg),
 	  frame(frame_arg),
-	  stats(stats_arg)
+	  stats(stats_arg),
+	  pipeline(pipeline_arg)
       {
+	if (pipeline)
+	  {
+	    e_slices.reset(new GCM[pipeline->size() - 1]);
+	    d_slices.reset(new GCM[pipeline->size() - 1]);
+	  }
       }
 
       // Encrypt/Decrypt
@@ -170,38 +246,7 @@ namespace openvpn {
 	  {
 	    // build nonce/IV/AD
 	    Nonce nonce(e.nonce, e.pid_send, now, op32);
-
-	    if (CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_ENCRYPT)
-	      {
-		unsigned char *data = buf.data();
-		const size_t size = buf.size();
-
-		// alloc auth tag in buffer
-		unsigned char *auth_tag = buf.prepend_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
-
-		// encrypt in-place
-		e.impl.encrypt(data, data, size, nonce.iv(), auth_tag, nonce.ad(), nonce.ad_len());
-	      }
-	    else
-	      {
-		// encrypt to work buf
-		frame->prepare(Frame::ENCRYPT_WORK, e.work);
-		if (e.work.max_size() < buf.size())
-		  throw aead_error("encrypt work buffer too small");
-
-		// alloc auth tag in buffer
-		unsigned char *auth_tag = e.work.prepend_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
-
-		// prepare output buffer
-		unsigned char *work_data = e.work.write_alloc(buf.size());
-
-		// encrypt
-		e.impl.encrypt(buf.data(), work_data, buf.size(), nonce.iv(), auth_tag, nonce.ad(), nonce.ad_len());
-		buf.swap(e.work);
-	      }
-
-	    // prepend additional data
-	    nonce.prepend_ad(buf);
+	    encrypt_(buf, nonce);
 	  }
 	return e.pid_send.wrap_warning();
       }
@@ -213,35 +258,102 @@ namespace openvpn {
 	  {
 	    // get nonce/IV/AD
 	    Nonce nonce(d.nonce, buf, op32);
+	    return decrypt_(buf, nonce, now);
+	  }
+	return Error::SUCCESS;
+      }
 
-	    // get auth tag
-	    unsigned char *auth_tag = buf.read_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
+      // Only for instances of exactly this class, since subclasses
+      // may override encrypt or decrypt.
+      virtual FastPath fast_path()
+      {
+	FastPath fp;
+	if (typeid(*this) == typeid(Crypto))
+	  {
+	    fp.encrypt = &encrypt_static;
+	    fp.decrypt = &decrypt_static;
+	  }
+	return fp;
+      }
 
-	    // initialize work buffer
-	    frame->prepare(Frame::DECRYPT_WORK, d.work);
-	    if (d.work.max_size() < buf.size())
-	      throw aead_error("decrypt work buffer too small");
+      // The batch variants build the nonce prefix and op32 AD once
+      // and then only update the packet ID for each packet.  Packets
+      // that can be encrypted in-place are passed to the cipher in
+      // groups, so that a backend with a multi-buffer implementation
+      // can process them together.
+      virtual bool encrypt_batch(BufferAllocated* bufs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+      {
+	Nonce prefix;
+	prefix.prepare(e.nonce, op32);
+	Nonce nonces[GCM::MAX_BATCH];
+	typename GCM::Op ops[GCM::MAX_BATCH];
+	BufferAllocated* pending[GCM::MAX_BATCH];
+	size_t m = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    BufferAllocated& buf = bufs[i];
+	    if (!buf.size())
+	      continue;
+	    align_payload(buf);
+	    if (!GCM::SUPPORTS_IN_PLACE_ENCRYPT || buf.offset() < GCM::AUTH_TAG_LEN + prefix.pid_size())
+	      {
+		prefix.next_packet_id(e.pid_send, now);
+		encrypt_(buf, prefix);
+		continue;
+	      }
 
-	    // decrypt from buf -> work
-	    if (!d.impl.decrypt(buf.c_data(), d.work.data(), buf.size(), nonce.iv(), auth_tag,
-				nonce.ad(), nonce.ad_len()))
+	    Nonce& nonce = nonces[m];
+	    nonce = prefix;
+	    nonce.next_packet_id(e.pid_send, now);
+	    typename GCM::Op& op = ops[m];
+	    op.input = op.output = buf.data();
+	    op.length = buf.size();
+	    op.iv = nonce.iv();
+	    op.tag = buf.prepend_alloc(GCM::AUTH_TAG_LEN);
+	    assert(frame->payload_aligned(op.input, frame->payload_align()));
+	    assert(frame->payload_aligned(op.tag, GCM::AUTH_TAG_LEN));
+	    op.ad = nonce.ad();
+	    op.ad_len = nonce.ad_len();
+	    pending[m] = &buf;
+	    if (++m == GCM::MAX_BATCH)
 	      {
-		buf.reset_size();
-		return Error::DECRYPT_ERROR;
+		encrypt_group(nonces, ops, pending, m);
+		m = 0;
 	      }
-	    d.work.set_size(buf.size());
+	  }
+	if (m)
+	  encrypt_group(nonces, ops, pending, m);
+	return e.pid_send.wrap_warning();
+      }
+
+      virtual void decrypt_batch(BufferAllocated* bufs, Error::Type* errs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+      {
+	if (pipeline && GCM::SUPPORTS_IN_PLACE_ENCRYPT && batch_bytes(bufs, n) >= PIPELINE_MIN_BYTES)
+	  {
+	    for (size_t i = 0; i < n; i += PIPELINE_CHUNK)
+	      decrypt_pipelined(bufs + i, errs + i, std::min(n - i, size_t(PIPELINE_CHUNK)), now, op32);
+	    return;
+	  }
 
-	    // verify packet ID
-	    if (!nonce.verify_packet_id(d.pid_recv, now))
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    BufferAllocated& buf = bufs[i];
+	    try {
+	      if (buf.size())
+		{
+		  Nonce nonce(d.nonce, buf, op32);
+		  errs[i] = decrypt_(buf, nonce, now);
+		}
+	      else
+		errs[i] = Error::SUCCESS;
+	    }
+	    catch (BufferException&)
 	      {
 		buf.reset_size();
-		return Error::REPLAY_ERROR;
+		errs[i] = Error::BUFFER_ERROR;
 	      }
-
-	    // return cleartext result in buf
-	    buf.swap(d.work);
 	  }
-	return Error::SUCCESS;
       }
 
       // Initialization
@@ -251,6 +363,12 @@ namespace openvpn {
       {
 	e.impl.init(cipher, encrypt_key.data(), encrypt_key.size(), CRYPTO_API::CipherContextGCM::ENCRYPT);
 	d.impl.init(cipher, decrypt_key.data(), decrypt_key.size(), CRYPTO_API::CipherContextGCM::DECRYPT);
+	if (pipeline)
+	  for (unsigned int i = 0; i < pipeline->size() - 1; ++i)
+	    {
+	      e_slices[i].init(cipher, encrypt_key.data(), encrypt_key.size(), CRYPTO_API::CipherContextGCM::ENCRYPT);
+	      d_slices[i].init(cipher, decrypt_key.data(), decrypt_key.size(), CRYPTO_API::CipherContextGCM::DECRYPT);
+	    }
       }
 
       virtual void init_hmac(StaticKey&& encrypt_key,
@@ -268,7 +386,9 @@ namespace openvpn {
 			    const SessionStats::Ptr& recv_stats_arg)
       {
 	e.pid_send.init(send_form);
+	e.nonce.set_pid_form(send_form);
 	d.pid_recv.init(recv_mode, recv_form, recv_name, recv_unit, recv_stats_arg);
+	d.nonce.set_pid_form(recv_form);
       }
 
       // Indicate whether or not cipher/digest is defined
@@ -289,6 +409,26 @@ namespace openvpn {
 	return true;
       }
 
+      virtual void compact()
+      {
+	e.work.clear();
+	d.work.clear();
+      }
+
+      virtual bool export_pid(PacketID& send, PacketID& recv) const
+      {
+	send = e.pid_send.last();
+	recv = d.pid_recv.high();
+	return true;
+      }
+
+      virtual bool import_pid(const PacketID& send, const PacketID& recv)
+      {
+	e.pid_send.resume(send);
+	d.pid_recv.resume(recv);
+	return true;
+      }
+
       // Rekeying
 
       virtual void rekey(const typename Base::RekeyType type)
@@ -296,11 +436,268 @@ namespace openvpn {
       }
 
     private:
+      void encrypt_(BufferAllocated& buf, const Nonce& nonce)
+      {
+	// Encrypt in-place when the backend supports it and the buffer
+	// has enough headroom for the auth tag and packet ID.  Otherwise
+	// fall back to copying through the work buffer, and count it so
+	// that undersized frame headroom shows up in the stats.
+	align_payload(buf);
+	if (CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_ENCRYPT
+	    && buf.offset() >= CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN + nonce.pid_size())
+	  {
+	    unsigned char *data = buf.data();
+	    const size_t size = buf.size();
+
+	    // alloc auth tag in buffer
+	    unsigned char *auth_tag = buf.prepend_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
+	    assert(frame->payload_aligned(data, frame->payload_align()));
+	    assert(frame->payload_aligned(auth_tag, CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN));
+
+	    // encrypt in-place
+	    e.impl.encrypt(data, data, size, nonce.iv(), auth_tag, nonce.ad(), nonce.ad_len());
+	  }
+	else
+	  {
+	    stats->error(Error::N_ENCRYPT_COPY);
+
+	    // encrypt to work buf
+	    frame->prepare(Frame::ENCRYPT_WORK, e.work);
+	    if (e.work.max_size() < buf.size())
+	      throw aead_error("encrypt work buffer too small");
+
+	    // alloc auth tag in buffer
+	    unsigned char *auth_tag = e.work.prepend_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
+
+	    // prepare output buffer
+	    unsigned char *work_data = e.work.write_alloc(buf.size());
+	    assert(frame->payload_aligned(work_data, frame->payload_align()));
+
+	    // encrypt
+	    e.impl.encrypt(buf.data(), work_data, buf.size(), nonce.iv(), auth_tag, nonce.ad(), nonce.ad_len());
+	    buf.swap(e.work);
+	  }
+
+	// prepend additional data
+	nonce.prepend_ad(buf);
+      }
+
+      static bool encrypt_static(CryptoDCInstance& dc, BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+      {
+	return static_cast<Crypto&>(dc).Crypto::encrypt(buf, now, op32);
+      }
+
+      static Error::Type decrypt_static(CryptoDCInstance& dc, BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+      {
+	return static_cast<Crypto&>(dc).Crypto::decrypt(buf, now, op32);
+      }
+
+      // With a Frame payload alignment, move plaintext that a header
+      // such as the compression byte has pushed off the boundary back
+      // onto it, if the headroom allows, so that it is encrypted
+      // in-place at an aligned address.
+      void align_payload(BufferAllocated& buf) const
+      {
+	const size_t align = frame->payload_align();
+	if (align)
+	  {
+	    const size_t skew = std::uintptr_t(buf.c_data()) & (align - 1);
+	    if (skew && buf.offset() >= skew + CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN + e.nonce.pid_size())
+	      buf.realign(buf.offset() - skew);
+	  }
+      }
+
+      void encrypt_group(const Nonce* nonces,
+			 const typename CRYPTO_API::CipherContextGCM::Op* ops,
+			 BufferAllocated** bufs,
+			 const size_t n)
+      {
+	if (pipeline && batch_bytes(ops, n) >= PIPELINE_MIN_BYTES)
+	  {
+	    EncryptTask task(*this, ops, n);
+	    pipeline->run(task);
+	  }
+	else
+	  e.impl.encrypt_batch(ops, n);
+	for (size_t i = 0; i < n; ++i)
+	  nonces[i].prepend_ad(*bufs[i]);
+      }
+
+      // Each DCPipeline slice takes a contiguous range of the batch
+      // and uses its own cipher context, slice 0 the primary one.
+
+      GCM& e_slice(const unsigned int slice)
+      {
+	return slice ? e_slices[slice - 1] : e.impl;
+      }
+
+      GCM& d_slice(const unsigned int slice)
+      {
+	return slice ? d_slices[slice - 1] : d.impl;
+      }
+
+      static size_t slice_begin(const size_t n, const unsigned int slice, const unsigned int n_slices)
+      {
+	return n * slice / n_slices;
+      }
+
+      static size_t batch_bytes(const BufferAllocated* bufs, const size_t n)
+      {
+	size_t ret = 0;
+	for (size_t i = 0; i < n; ++i)
+	  ret += bufs[i].size();
+	return ret;
+      }
+
+      static size_t batch_bytes(const typename GCM::Op* ops, const size_t n)
+      {
+	size_t ret = 0;
+	for (size_t i = 0; i < n; ++i)
+	  ret += ops[i].length;
+	return ret;
+      }
+
+      struct EncryptTask : public DCPipeline::Task
+      {
+	EncryptTask(Crypto& self_arg, const typename GCM::Op* ops_arg, const size_t n_arg)
+	  : self(self_arg), ops(ops_arg), n(n_arg)
+	{
+	}
+
+	virtual void run(const unsigned int slice) override
+	{
+	  const unsigned int n_slices = self.pipeline->size();
+	  const size_t begin = slice_begin(n, slice, n_slices);
+	  const size_t end = slice_begin(n, slice + 1, n_slices);
+	  if (end > begin)
+	    self.e_slice(slice).encrypt_batch(ops + begin, end - begin);
+	}
+
+	Crypto& self;
+	const typename GCM::Op* ops;
+	const size_t n;
+      };
+
+      // Decrypt up to PIPELINE_CHUNK packets in three steps: split
+      // off the headers in order, authenticate and decrypt in-place
+      // in parallel, then check packet IDs in order.  Results are the
+      // same as for decrypt_() on each packet in turn.
+      void decrypt_pipelined(BufferAllocated* bufs, Error::Type* errs, const size_t n,
+			     const PacketID::time_t now, const unsigned char *op32)
+      {
+	DecryptTask task(*this, bufs, n);
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    BufferAllocated& buf = bufs[i];
+	    errs[i] = Error::SUCCESS;
+	    task.tags[i] = nullptr;
+	    if (!buf.size())
+	      continue;
+	    if (buf.size() < d.nonce.pid_size() + GCM::AUTH_TAG_LEN)
+	      {
+		buf.reset_size();
+		errs[i] = Error::BUFFER_ERROR;
+		continue;
+	      }
+	    task.nonces[i] = Nonce(d.nonce, buf, op32);
+	    task.tags[i] = buf.read_alloc(GCM::AUTH_TAG_LEN);
+	  }
+
+	pipeline->run(task);
+
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    if (!task.tags[i])
+	      continue;
+	    BufferAllocated& buf = bufs[i];
+	    if (!task.ok[i])
+	      {
+		buf.reset_size();
+		errs[i] = Error::DECRYPT_ERROR;
+	      }
+	    else if (!task.nonces[i].verify_packet_id(d.pid_recv, now))
+	      {
+		buf.reset_size();
+		errs[i] = Error::REPLAY_ERROR;
+	      }
+	  }
+      }
+
+      struct DecryptTask : public DCPipeline::Task
+      {
+	DecryptTask(Crypto& self_arg, BufferAllocated* bufs_arg, const size_t n_arg)
+	  : self(self_arg), bufs(bufs_arg), n(n_arg)
+	{
+	}
+
+	virtual void run(const unsigned int slice) override
+	{
+	  const unsigned int n_slices = self.pipeline->size();
+	  const size_t end = slice_begin(n, slice + 1, n_slices);
+	  GCM& impl = self.d_slice(slice);
+	  for (size_t i = slice_begin(n, slice, n_slices); i < end; ++i)
+	    {
+	      if (!tags[i])
+		continue;
+	      BufferAllocated& buf = bufs[i];
+	      const Nonce& nonce = nonces[i];
+	      ok[i] = impl.decrypt(buf.c_data(), buf.data(), buf.size(), nonce.iv(), tags[i],
+				   nonce.ad(), nonce.ad_len());
+	    }
+	}
+
+	Crypto& self;
+	BufferAllocated* bufs;
+	const size_t n;
+	Nonce nonces[PIPELINE_CHUNK];
+	unsigned char* tags[PIPELINE_CHUNK]; // nullptr if packet is skipped
+	bool ok[PIPELINE_CHUNK];
+      };
+
+      Error::Type decrypt_(BufferAllocated& buf, Nonce& nonce, const PacketID::time_t now)
+      {
+	// get auth tag
+	unsigned char *auth_tag = buf.read_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
+
+	// initialize work buffer
+	frame->prepare(Frame::DECRYPT_WORK, d.work);
+	if (d.work.max_size() < buf.size())
+	  throw aead_error("decrypt work buffer too small");
+	assert(frame->payload_aligned(d.work.data(), frame->payload_align()));
+
+	// decrypt from buf -> work
+	if (!d.impl.decrypt(buf.c_data(), d.work.data(), buf.size(), nonce.iv(), auth_tag,
+			    nonce.ad(), nonce.ad_len()))
+	  {
+	    buf.reset_size();
+	    return Error::DECRYPT_ERROR;
+	  }
+	d.work.set_size(buf.size());
+
+	// verify packet ID
+	if (!nonce.verify_packet_id(d.pid_recv, now))
+	  {
+	    buf.reset_size();
+	    return Error::REPLAY_ERROR;
+	  }
+
+	// return cleartext result in buf
+	buf.swap(d.work);
+	return Error::SUCCESS;
+      }
+
+    protected:
+      // accessible to instances that key the cipher contexts differently
       CryptoAlgs::Type cipher;
       Frame::Ptr frame;
       SessionStats::Ptr stats;
       Encrypt e;
       Decrypt d;
+
+    private:
+      DCPipeline::Ptr pipeline;
+      std::unique_ptr<GCM[]> e_slices; // contexts for slices 1..n-1
+      std::unique_ptr<GCM[]> d_slices;
     };
 
     template <typename CRYPTO_API>
@@ -311,16 +708,18 @@ namespace openvpn {
 
       CryptoContext(const CryptoAlgs::Type cipher_arg,
 		    const Frame::Ptr& frame_arg,
-		    const SessionStats::Ptr& stats_arg)
+		    const SessionStats::Ptr& stats_arg,
+		    const DCPipeline::Ptr& pipeline_arg = DCPipeline::Ptr())
 	: cipher(CryptoAlgs::legal_dc_cipher(cipher_arg)),
 	  frame(frame_arg),
-	  stats(stats_arg)
+	  stats(stats_arg),
+	  pipeline(pipeline_arg)
       {
       }
 
       virtual CryptoDCInstance::Ptr new_obj(const unsigned int key_id)
       {
-	return new Crypto<CRYPTO_API>(cipher, frame, stats);
+	return new Crypto<CRYPTO_API>(cipher, frame, stats, pipeline);
       }
 
       // cipher/HMAC/key info
@@ -343,6 +742,7 @@ namespace openvpn {
       CryptoAlgs::Type cipher;
       Frame::Ptr frame;
       SessionStats::Ptr stats;
+      DCPipeline::Ptr pipeline;
     };
   }
 }
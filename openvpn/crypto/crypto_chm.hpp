@@ -49,6 +49,7 @@ namespace openvpn {
 	prng(prng_arg)
     {
       encrypt_.frame = frame;
+      encrypt_.stats = stats;
       decrypt_.frame = frame;
       encrypt_.set_prng(prng);
     }
@@ -99,6 +100,26 @@ namespace openvpn {
       return true;
     }
 
+    virtual void compact()
+    {
+      encrypt_.compact();
+      decrypt_.compact();
+    }
+
+    virtual bool export_pid(PacketID& send, PacketID& recv) const
+    {
+      send = encrypt_.pid_send.last();
+      recv = decrypt_.pid_recv.high();
+      return true;
+    }
+
+    virtual bool import_pid(const PacketID& send, const PacketID& recv)
+    {
+      encrypt_.pid_send.resume(send);
+      decrypt_.pid_recv.resume(recv);
+      return true;
+    }
+
     // Indicate whether or not cipher/digest is defined
 
     virtual unsigned int defined() const
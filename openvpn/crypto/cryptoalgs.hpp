@@ -25,6 +25,7 @@
 #define OPENVPN_CRYPTO_CRYPTOALGS_H
 
 #include <string>
+#include <cstdint>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -56,6 +57,7 @@ namespace openvpn {
       AES_128_GCM,
       AES_192_GCM,
       AES_256_GCM,
+      CHACHA20_POLY1305,
 
       // digests
       MD4,
@@ -106,13 +108,13 @@ namespace openvpn {
       {
       }
 
-      const char *name() const { return name_; }
-      unsigned int flags() const { return flags_; }      // contains Mode and AlgFlags
-      Mode mode() const { return Mode(flags_ & MODE_MASK); }
-      size_t size() const { return size_; }              // digest size
-      size_t key_length() const { return size_; }        // cipher key length
-      size_t iv_length() const { return iv_length_; }    // cipher only
-      size_t block_size() const { return block_size_; }  // cipher only
+      constexpr const char *name() const { return name_; }
+      constexpr unsigned int flags() const { return flags_; }      // contains Mode and AlgFlags
+      constexpr Mode mode() const { return Mode(flags_ & MODE_MASK); }
+      constexpr size_t size() const { return size_; }              // digest size
+      constexpr size_t key_length() const { return size_; }        // cipher key length
+      constexpr size_t iv_length() const { return iv_length_; }    // cipher only
+      constexpr size_t block_size() const { return block_size_; }  // cipher only
 
     private:
       const char *name_;
@@ -134,6 +136,7 @@ namespace openvpn {
       { "AES-128-GCM",  F_CIPHER|F_ALLOW_DC|AEAD|F_NO_CIPHER_DIGEST,  16, 12, 16 },
       { "AES-192-GCM",  F_CIPHER|F_ALLOW_DC|AEAD|F_NO_CIPHER_DIGEST,  24, 12, 16 },
       { "AES-256-GCM",  F_CIPHER|F_ALLOW_DC|AEAD|F_NO_CIPHER_DIGEST,  32, 12, 16 },
+      { "CHACHA20-POLY1305",  F_CIPHER|F_ALLOW_DC|AEAD|F_NO_CIPHER_DIGEST,  32, 12, 1 },
       { "MD4",          F_DIGEST,                              16,  0,  0 },
       { "MD5",          F_DIGEST|F_ALLOW_DC,                   16,  0,  0 },
       { "SHA1",         F_DIGEST|F_ALLOW_DC,                   20,  0,  0 },
@@ -148,6 +151,65 @@ namespace openvpn {
       return type != NONE;
     }
 
+    // Capabilities known at compile time, type must be < SIZE
+
+    constexpr bool is_aead(const Type type)
+    {
+      return algs[type].mode() == AEAD;
+    }
+
+    // 64-bit block size, subject to the data limits
+    // of crypto/bs64_data_limit.hpp
+    constexpr bool is_bs64(const Type type)
+    {
+      return algs[type].block_size() == 8;
+    }
+
+    // Hash table mapping case-insensitive names to Type,
+    // built at compile time.
+    namespace NameTable {
+      constexpr size_t N_SLOTS = 64; // power of 2, well above SIZE to keep probes short
+
+      constexpr std::uint32_t hash(const char *name, const size_t len)
+      {
+	std::uint32_t h = 2166136261u; // FNV-1a on upper-cased name
+	for (size_t i = 0; i < len; ++i)
+	  {
+	    const char c = name[i];
+	    h = (h ^ std::uint8_t((c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c)) * 16777619u;
+	  }
+	return h;
+      }
+
+      constexpr size_t length(const char *str)
+      {
+	size_t len = 0;
+	while (str[len])
+	  ++len;
+	return len;
+      }
+
+      struct Table
+      {
+	unsigned char slot[N_SLOTS]; // Type + 1, or 0 if empty
+      };
+
+      constexpr Table build()
+      {
+	Table t{};
+	for (size_t i = 0; i < SIZE; ++i)
+	  {
+	    size_t h = hash(algs[i].name(), length(algs[i].name())) & (N_SLOTS - 1);
+	    while (t.slot[h])
+	      h = (h + 1) & (N_SLOTS - 1);
+	    t.slot[h] = static_cast<unsigned char>(i + 1);
+	  }
+	return t;
+      }
+
+      constexpr Table table = build();
+    }
+
     inline const Alg* get_index_ptr(const size_t i)
     {
       static_assert(SIZE == array_size(algs), "algs array inconsistency");
@@ -173,11 +235,14 @@ namespace openvpn {
 
     inline Type lookup(const std::string& name)
     {
-      for (size_t i = 0; i < SIZE; ++i)
+      static_assert(SIZE < NameTable::N_SLOTS, "CryptoAlgs::NameTable too small");
+      size_t h = NameTable::hash(name.c_str(), name.length()) & (NameTable::N_SLOTS - 1);
+      while (const unsigned int s = NameTable::table.slot[h])
 	{
-	  const Alg& alg = algs[i];
+	  const Alg& alg = algs[s - 1];
 	  if (string::strcasecmp(name, alg.name()) == 0)
-	    return static_cast<Type>(i);
+	    return static_cast<Type>(s - 1);
+	  h = (h + 1) & (NameTable::N_SLOTS - 1);
 	}
       OPENVPN_THROW(crypto_alg, name << ": not found");
     }
@@ -52,6 +52,52 @@ namespace openvpn {
 
     virtual Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32) = 0;
 
+    // Type-erased handle to encrypt/decrypt of an implementation
+    // whose concrete type is known when the handle is made.  The
+    // functions are instantiated for that type, so the whole data
+    // path below them, down to the cipher context, is bound at compile
+    // time and can be inlined.  Both are null if not supported.
+    struct FastPath
+    {
+      bool (*encrypt)(CryptoDCInstance& dc, BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32) = nullptr;
+      Error::Type (*decrypt)(CryptoDCInstance& dc, BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32) = nullptr;
+
+      bool defined() const { return encrypt != nullptr; }
+    };
+
+    virtual FastPath fast_path() { return FastPath(); }
+
+    // Batch variants that process n buffers back to back with the
+    // same op32 header.  Implementations may override these to
+    // amortize per-call setup across packets, the defaults simply
+    // loop over encrypt/decrypt.
+
+    // returns true if packet ID is close to wrapping
+    virtual bool encrypt_batch(BufferAllocated* bufs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+    {
+      bool wrap = false;
+      for (size_t i = 0; i < n; ++i)
+	wrap |= encrypt(bufs[i], now, op32);
+      return wrap;
+    }
+
+    // status of each packet is returned in errs[i], failed packets are
+    // left empty, and a malformed packet doesn't stop the batch
+    virtual void decrypt_batch(BufferAllocated* bufs, Error::Type* errs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+    {
+      for (size_t i = 0; i < n; ++i)
+	{
+	  try {
+	    errs[i] = decrypt(bufs[i], now, op32);
+	  }
+	  catch (BufferException&)
+	    {
+	      bufs[i].reset_size();
+	      errs[i] = Error::BUFFER_ERROR;
+	    }
+	}
+    }
+
     // Initialization
 
     // return value of defined()
@@ -82,6 +128,17 @@ namespace openvpn {
 
     virtual void explicit_exit_notify() {}
 
+    // Release work buffers, which are re-created on the next
+    // encrypt or decrypt.  Keys and packet ID state are kept.
+    virtual void compact() {}
+
+    // Packet ID state of the send and receive directions, for moving
+    // an established session to another process (see
+    // ProtoContext::export_session()).  Both return false if the
+    // implementation doesn't support it.
+    virtual bool export_pid(PacketID& send, PacketID& recv) const { return false; }
+    virtual bool import_pid(const PacketID& send, const PacketID& recv) { return false; }
+
     // Rekeying
 
     enum RekeyType {
@@ -124,6 +181,14 @@ namespace openvpn {
 
     virtual CryptoDCContext::Ptr new_obj(const CryptoAlgs::Type cipher,
 					 const CryptoAlgs::Type digest) = 0;
+
+    // true if the instances made for AEAD ciphers accept
+    // PacketID::WIDE_FORM in init_pid()
+    virtual bool supports_wide_pid() const { return false; }
+
+    // true if new_obj() can make an instance for the AEAD cipher,
+    // for IV_CIPHERS
+    virtual bool supports_aead(const CryptoAlgs::Type cipher) const { return false; }
   };
 
   // Manage cipher/digest settings, DC factory, and DC context.
@@ -25,8 +25,11 @@
 #define OPENVPN_CRYPTO_CRYPTODCSEL_H
 
 #include <openvpn/common/exception.hpp>
+#include <openvpn/common/buildprofile.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
+#ifndef OPENVPN_NO_CBC_HMAC
 #include <openvpn/crypto/crypto_chm.hpp>
+#endif
 #include <openvpn/crypto/crypto_aead.hpp>
 #include <openvpn/random/randapi.hpp>
 
@@ -40,12 +43,15 @@ namespace openvpn {
   public:
     typedef RCPtr<CryptoDCSelect> Ptr;
 
+    // pipeline, if defined, spreads AEAD batches over its threads
     CryptoDCSelect(const Frame::Ptr& frame_arg,
 		   const SessionStats::Ptr& stats_arg,
-		   const RandomAPI::Ptr& prng_arg)
+		   const RandomAPI::Ptr& prng_arg,
+		   const DCPipeline::Ptr& pipeline_arg = DCPipeline::Ptr())
       : frame(frame_arg),
 	stats(stats_arg),
-	prng(prng_arg)
+	prng(prng_arg),
+	pipeline(pipeline_arg)
     {
     }
 
@@ -53,18 +59,33 @@ namespace openvpn {
 					 const CryptoAlgs::Type digest)
     {
       const CryptoAlgs::Alg& alg = CryptoAlgs::get(cipher);
+#ifndef OPENVPN_NO_CBC_HMAC
       if (alg.flags() & CryptoAlgs::CBC_HMAC)
 	return new CryptoContextCHM<CRYPTO_API>(cipher, digest, frame, stats, prng);
-      else if (alg.flags() & CryptoAlgs::AEAD)
-	return new AEAD::CryptoContext<CRYPTO_API>(cipher, frame, stats);
+#endif
+      if (alg.flags() & CryptoAlgs::AEAD)
+	return new AEAD::CryptoContext<CRYPTO_API>(cipher, frame, stats, pipeline);
       else
-	OPENVPN_THROW(crypto_dc_select, alg.name() << ": only CBC/HMAC and AEAD cipher modes supported");
+	OPENVPN_THROW(crypto_dc_select, alg.name() << (BuildProfile::cbc_hmac
+						       ? ": only CBC/HMAC and AEAD cipher modes supported"
+						       : ": only AEAD cipher modes supported by this build"));
+    }
+
+    virtual bool supports_wide_pid() const
+    {
+      return true;
+    }
+
+    virtual bool supports_aead(const CryptoAlgs::Type cipher) const
+    {
+      return CryptoAlgs::is_aead(cipher) && CRYPTO_API::CipherContextGCM::is_supported(cipher);
     }
 
   private:
     Frame::Ptr frame;
     SessionStats::Ptr stats;
     RandomAPI::Ptr prng;
+    DCPipeline::Ptr pipeline;
   };
 
 }
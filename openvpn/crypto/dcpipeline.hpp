@@ -0,0 +1,147 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Fork-join thread pool for data channel crypto.  run() splits one
+// batch of packets into size() slices, runs slice 0 on the calling
+// thread and the others on the pool threads, and returns when all
+// are done, so the caller sees the batch complete and in order.  The
+// pool threads spin for a short while between batches before going
+// to sleep, since under load the next batch follows within
+// microseconds.  run() calls from different threads are serialized.
+
+#ifndef OPENVPN_CRYPTO_DCPIPELINE_H
+#define OPENVPN_CRYPTO_DCPIPELINE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+
+namespace openvpn {
+
+  class DCPipeline : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<DCPipeline> Ptr;
+
+    OPENVPN_SIMPLE_EXCEPTION(dc_pipeline_error);
+
+    // one batch of work, run(slice) is called once for each
+    // slice in [0, size()), concurrently
+    struct Task
+    {
+      virtual void run(const unsigned int slice) = 0;
+    };
+
+    enum {
+      SPIN = 1 << 14, // polls before a pool thread sleeps
+    };
+
+    // n_slices includes the calling thread, so n_slices - 1
+    // pool threads are started
+    DCPipeline(const unsigned int n_slices)
+      : n_slices_(n_slices)
+    {
+      if (n_slices < 2)
+	throw dc_pipeline_error();
+      for (unsigned int i = 1; i < n_slices; ++i)
+	threads.emplace_back([this, i]() { worker(i); });
+    }
+
+    ~DCPipeline()
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	halt = true;
+      }
+      cv.notify_all();
+      for (auto& t : threads)
+	t.join();
+    }
+
+    unsigned int size() const
+    {
+      return n_slices_;
+    }
+
+    void run(Task& t)
+    {
+      std::lock_guard<std::mutex> serialize(run_mutex);
+      task = &t;
+      pending.store(n_slices_ - 1, std::memory_order_relaxed);
+      {
+	// under mutex so a worker about to sleep can't miss it
+	std::lock_guard<std::mutex> lock(mutex);
+	generation.fetch_add(1, std::memory_order_release);
+      }
+      cv.notify_all();
+
+      t.run(0);
+
+      for (unsigned int spin = 0; pending.load(std::memory_order_acquire); ++spin)
+	if (spin >= SPIN)
+	  std::this_thread::yield();
+    }
+
+  private:
+    void worker(const unsigned int slice)
+    {
+      unsigned int seen = 0;
+      while (true)
+	{
+	  unsigned int gen = generation.load(std::memory_order_acquire);
+	  for (unsigned int spin = 0; gen == seen && spin < SPIN; ++spin)
+	    gen = generation.load(std::memory_order_acquire);
+	  if (gen == seen)
+	    {
+	      std::unique_lock<std::mutex> lock(mutex);
+	      cv.wait(lock, [&]() {
+		  return halt || generation.load(std::memory_order_acquire) != seen;
+		});
+	      if (halt)
+		return;
+	      gen = generation.load(std::memory_order_acquire);
+	    }
+	  seen = gen;
+	  task->run(slice);
+	  pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+    }
+
+    const unsigned int n_slices_;
+    std::vector<std::thread> threads;
+
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool halt = false;
+    Task* task = nullptr;
+    std::atomic<unsigned int> generation{0};
+    std::atomic<unsigned int> pending{0};
+  };
+
+}
+
+#endif
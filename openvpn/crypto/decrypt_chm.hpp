@@ -114,6 +114,12 @@ namespace openvpn {
       return Error::SUCCESS;
     }
 
+    // release the work buffer until the next decrypt()
+    void compact()
+    {
+      work.clear();
+    }
+
     Frame::Ptr frame;
     CipherContext<CRYPTO_API> cipher;
     OvpnHMAC<CRYPTO_API> hmac;
@@ -36,6 +36,7 @@
 #include <openvpn/crypto/ovpnhmac.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/log/sessionstats.hpp>
 
 namespace openvpn {
   template <typename CRYPTO_API>
@@ -70,26 +71,54 @@ namespace openvpn {
 	      throw chm_unsupported_cipher_mode();
 	    }
 
-	  // initialize work buffer
-	  frame->prepare(Frame::ENCRYPT_WORK, work);
-
-	  // encrypt from buf -> work
-	  const size_t encrypt_bytes = cipher.encrypt(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size());
-	  if (!encrypt_bytes)
+	  // Encrypt in-place if the buffer has headroom for the IV and
+	  // HMAC and tailroom for the cipher padding, otherwise copy
+	  // through the work buffer.
+	  const size_t hmac_size = hmac.defined() ? hmac.output_size() : 0;
+	  if (buf.offset() >= iv_length + hmac_size
+	      && buf.size() + buf.remaining() >= cipher.output_size(buf.size()))
 	    {
-	      buf.reset_size();
-	      return;
+	      // encrypt buf -> buf
+	      const size_t encrypt_bytes = cipher.encrypt(iv_buf, buf.data(), buf.size() + buf.remaining(), buf.c_data(), buf.size());
+	      if (!encrypt_bytes)
+		{
+		  buf.reset_size();
+		  return;
+		}
+	      buf.set_size(encrypt_bytes);
+
+	      // prepend the IV to the ciphertext
+	      buf.prepend(iv_buf, iv_length);
+
+	      // HMAC the ciphertext
+	      prepend_hmac(buf);
 	    }
-	  work.set_size(encrypt_bytes);
+	  else
+	    {
+	      if (stats)
+		stats->error(Error::N_ENCRYPT_COPY);
+
+	      // initialize work buffer
+	      frame->prepare(Frame::ENCRYPT_WORK, work);
+
+	      // encrypt from buf -> work
+	      const size_t encrypt_bytes = cipher.encrypt(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size());
+	      if (!encrypt_bytes)
+		{
+		  buf.reset_size();
+		  return;
+		}
+	      work.set_size(encrypt_bytes);
 
-	  // prepend the IV to the ciphertext
-	  work.prepend(iv_buf, iv_length);
+	      // prepend the IV to the ciphertext
+	      work.prepend(iv_buf, iv_length);
 
-	  // HMAC the ciphertext
-	  prepend_hmac(work);
+	      // HMAC the ciphertext
+	      prepend_hmac(work);
 
-	  // return ciphertext result in buf
-	  buf.swap(work);
+	      // return ciphertext result in buf
+	      buf.swap(work);
+	    }
 	}
       else // no encryption
 	{
@@ -107,7 +136,14 @@ namespace openvpn {
       prng = std::move(prng_arg);
     }
 
+    // release the work buffer until the next encrypt()
+    void compact()
+    {
+      work.clear();
+    }
+
     Frame::Ptr frame;
+    SessionStats::Ptr stats;
     CipherContext<CRYPTO_API> cipher;
     OvpnHMAC<CRYPTO_API> hmac;
     PacketIDSend pid_send;
@@ -26,6 +26,7 @@
 
 #include <string>
 #include <cstring>
+#include <algorithm> // for std::min
 #include <sstream>
 #include <cstdint> // for std::uint32_t
 
@@ -63,33 +64,52 @@ namespace openvpn {
    * uses a 32-bit time_t but some
    * 64 bit platforms use a
    * 64 bit time_t.
+   *
+   * A wide packet-id is a 64 bit sequence
+   * number without a timestamp, for AEAD
+   * data channels where a 32 bit number
+   * would wrap too quickly at high rates.
    */
   struct PacketID
   {
     typedef std::uint32_t id_t;
+    typedef std::uint64_t wide_id_t;
     typedef std::uint32_t net_time_t;
     typedef Time::base_type time_t;
 
     enum {
       SHORT_FORM = 0, // short form of ID (4 bytes)
       LONG_FORM = 1,  // long form of ID (8 bytes)
+      WIDE_FORM = 2,  // 64 bit ID without time (8 bytes)
 
       UNDEF = 0,       // special undefined/null id_t value
     };
 
-    id_t id;       // legal values are 1 through 2^32-1
+    wide_id_t id;  // legal values are 1 through 2^32-1, or 2^64-1 for WIDE_FORM
     time_t time;   // converted to PacketID::net_time_t before transmission
 
     static size_t size(const int form)
     {
       if (form == PacketID::LONG_FORM)
 	return longidsize;
+      else if (form == PacketID::WIDE_FORM)
+	return wideidsize;
       else
 	return shortidsize;
     }
 
+    // highest legal ID of form
+    static wide_id_t max_id(const int form)
+    {
+      if (form == PacketID::WIDE_FORM)
+	return ~wide_id_t(0);
+      else
+	return ~id_t(0);
+    }
+
     constexpr static size_t shortidsize = sizeof(id_t);
     constexpr static size_t longidsize = sizeof(id_t) + sizeof(net_time_t);
+    constexpr static size_t wideidsize = sizeof(wide_id_t);
 
     bool is_valid() const
     {
@@ -98,7 +118,7 @@ namespace openvpn {
 
     void reset()
     {
-      id = id_t(0);
+      id = wide_id_t(0);
       time = time_t(0);
     }
 
@@ -107,6 +127,16 @@ namespace openvpn {
       id_t net_id;
       net_time_t net_time;
 
+      if (form == WIDE_FORM)
+	{
+	  id_t net_id_low;
+	  buf.read ((unsigned char *)&net_id, sizeof (net_id));
+	  buf.read ((unsigned char *)&net_id_low, sizeof (net_id_low));
+	  id = (wide_id_t(ntohl (net_id)) << 32) | ntohl (net_id_low);
+	  time = time_t(0);
+	  return;
+	}
+
       buf.read ((unsigned char *)&net_id, sizeof (net_id));
       id = ntohl (net_id);
 
@@ -121,7 +151,17 @@ namespace openvpn {
 
     void write(Buffer& buf, const int form, const bool prepend) const
     {
-      const id_t net_id = htonl(id);
+      if (form == WIDE_FORM)
+	{
+	  const id_t net_id[2] = { htonl(id_t(id >> 32)), htonl(id_t(id)) };
+	  if (prepend)
+	    buf.prepend ((const unsigned char *)net_id, sizeof (net_id));
+	  else
+	    buf.write ((const unsigned char *)net_id, sizeof (net_id));
+	  return;
+	}
+
+      const id_t net_id = htonl(id_t(id));
       const net_time_t net_time = htonl(time);
 
       if (prepend)
@@ -148,7 +188,7 @@ namespace openvpn {
 
   struct PacketIDConstruct : public PacketID
   {
-    PacketIDConstruct(const PacketID::time_t v_time = PacketID::time_t(0), const PacketID::id_t v_id = PacketID::id_t(0))
+    PacketIDConstruct(const PacketID::time_t v_time = PacketID::time_t(0), const PacketID::wide_id_t v_id = PacketID::wide_id_t(0))
     {
       id = v_id;
       time = v_time;
@@ -165,9 +205,9 @@ namespace openvpn {
       init(PacketID::SHORT_FORM);
     }
 
-    void init(const int form) // PacketID::LONG_FORM or PacketID::SHORT_FORM
+    void init(const int form) // PacketID::LONG_FORM, PacketID::SHORT_FORM or PacketID::WIDE_FORM
     {
-      pid_.id = PacketID::id_t(0);
+      pid_.id = PacketID::wide_id_t(0);
       pid_.time = PacketID::time_t(0);
       form_ = form;
     }
@@ -178,7 +218,7 @@ namespace openvpn {
       if (!pid_.time)
 	pid_.time = now;
       ret.id = ++pid_.id;
-      if (unlikely(!pid_.id)) // wraparound
+      if (unlikely(!pid_.id || pid_.id > PacketID::max_id(form_))) // wraparound
 	{
 	  if (form_ != PacketID::LONG_FORM)
 	    throw packet_id_wrap();
@@ -202,16 +242,27 @@ namespace openvpn {
      */
     bool wrap_warning() const
     {
-      const PacketID::id_t wrap_at = 0xFF000000;
+      const PacketID::wide_id_t wrap_at = PacketID::max_id(form_) & ~PacketID::wide_id_t(0xFFFFFF);
       return pid_.id >= wrap_at;
     }
 
+    // Last packet ID sent, and resume() to continue after it, for
+    // moving an established session to another process.
+    const PacketID& last() const { return pid_; }
+
+    void resume(const PacketID& last)
+    {
+      pid_ = last;
+    }
+
     std::string str() const
     {
       std::string ret;
       ret = pid_.str();
       if (form_ == PacketID::LONG_FORM)
 	ret += 'L';
+      else if (form_ == PacketID::WIDE_FORM)
+	ret += 'W';
       return ret;
     }
 
@@ -236,6 +287,13 @@ namespace openvpn {
     static constexpr unsigned int REPLAY_WINDOW_BYTES = 1 << REPLAY_WINDOW_ORDER;
     static constexpr unsigned int REPLAY_WINDOW_SIZE = REPLAY_WINDOW_BYTES * 8;
 
+    // history bitmap is kept in 64-bit words so that ranges of
+    // bits can be cleared a word at a time
+    typedef std::uint64_t word_t;
+    static constexpr unsigned int WORD_BITS = sizeof(word_t) * 8;
+    static constexpr unsigned int REPLAY_WINDOW_WORDS = REPLAY_WINDOW_SIZE / WORD_BITS;
+    static_assert(REPLAY_WINDOW_SIZE % WORD_BITS == 0, "replay window must be a multiple of the history word size");
+
     // mode
     enum {
       UDP_MODE = 0,
@@ -334,7 +392,7 @@ namespace openvpn {
 	  if (!mod)
 	    return Error::SUCCESS;
 	  base = REPLAY_INDEX(-1);
-	  history[base / 8] |= (1 << (base % 8));
+	  set_bit(base);
 	  if (extent < REPLAY_WINDOW_SIZE)
 	    ++extent;
 	  id_high = pin.id;
@@ -344,19 +402,16 @@ namespace openvpn {
 	  // ID jumped forward by more than one
 	  if (!mod)
 	    return Error::SUCCESS;
-	  const unsigned int delta = pin.id - id_high;
+	  const PacketID::wide_id_t delta = pin.id - id_high;
 	  if (delta < REPLAY_WINDOW_SIZE)
 	    {
-	      base = REPLAY_INDEX(-delta);
-	      history[base / 8] |= (1 << (base % 8));
-	      extent += delta;
+	      base = REPLAY_INDEX(-int(delta));
+	      set_bit(base);
+	      extent += (unsigned int)delta;
 	      if (extent > REPLAY_WINDOW_SIZE)
 		extent = REPLAY_WINDOW_SIZE;
-	      for (unsigned i = 1; i < delta; ++i)
-		{
-		  const unsigned int newbase = REPLAY_INDEX(i);
-		  history[newbase / 8] &= ~(1 << (newbase % 8));
-		}
+	      // clear the bits of the IDs we skipped over
+	      clear_range(REPLAY_INDEX(1), (unsigned int)delta - 1);
 	    }
 	  else
 	    {
@@ -370,21 +425,21 @@ namespace openvpn {
       else
 	{
 	  // ID backtrack
-	  const unsigned int delta = id_high - pin.id;
+	  const PacketID::wide_id_t delta = id_high - pin.id;
 	  if (delta > max_backtrack)
 	    max_backtrack = delta;
 	  if (delta < extent)
 	    {
 	      if (pin.id > id_floor)
 		{
-		  const unsigned int ri = REPLAY_INDEX(delta);
-		  std::uint8_t *p = &history[ri / 8];
-		  const std::uint8_t mask = (1 << (ri % 8));
-		  if (*p & mask)
+		  const unsigned int ri = REPLAY_INDEX(int(delta));
+		  word_t& w = history[ri / WORD_BITS];
+		  const word_t mask = word_t(1) << (ri % WORD_BITS);
+		  if (w & mask)
 		    return Error::PKTID_REPLAY;
 		  if (!mod)
 		    return Error::SUCCESS;
-		  *p |= mask;
+		  w |= mask;
 		}
 	      else
 		return Error::PKTID_EXPIRE;
@@ -396,6 +451,30 @@ namespace openvpn {
       return Error::SUCCESS;
     }
 
+    // Highest packet ID received, and resume() to accept only IDs
+    // after it, for moving an established session to another
+    // process.  The replay history isn't carried over, so packets
+    // reordered across the move are dropped.
+    PacketID high() const
+    {
+      PacketID ret;
+      ret.id = id_high;
+      ret.time = time_high;
+      return ret;
+    }
+
+    void resume(const PacketID& high)
+    {
+      if (!initialized_)
+	throw packet_id_not_initialized();
+      base = 0;
+      extent = 0;
+      id_high = high.id;
+      time_high = high.time;
+      id_floor = high.id;
+      std::memset(history, 0, sizeof(history));
+    }
+
     PacketID read_next(Buffer& buf) const
     {
       if (!initialized_)
@@ -418,24 +497,46 @@ namespace openvpn {
       return (base + i) & (REPLAY_WINDOW_SIZE - 1);
     }
 
+    void set_bit(const unsigned int i)
+    {
+      history[i / WORD_BITS] |= word_t(1) << (i % WORD_BITS);
+    }
+
+    // clear n bits of the circular history starting at bit index start
+    void clear_range(unsigned int start, unsigned int n)
+    {
+      while (n)
+	{
+	  const unsigned int wi = start / WORD_BITS;
+	  const unsigned int bi = start % WORD_BITS;
+	  const unsigned int len = std::min(n, WORD_BITS - bi);
+	  if (len == WORD_BITS)
+	    history[wi] = 0;
+	  else
+	    history[wi] &= ~(((word_t(1) << len) - 1) << bi);
+	  n -= len;
+	  start = (start + len) & (REPLAY_WINDOW_SIZE - 1);
+	}
+    }
+
     bool initialized_;
 
     unsigned int base;              // bit position of deque base in history
     unsigned int extent;            // extent (in bits) of deque in history
     PacketID::time_t expire;        // expiration of history
-    PacketID::id_t id_high;         // highest sequence number received
+    PacketID::wide_id_t id_high;    // highest sequence number received
     PacketID::time_t time_high;     // highest time stamp received
-    PacketID::id_t id_floor;        // we will only accept backtrack IDs > id_floor
-    unsigned int max_backtrack;
+    PacketID::wide_id_t id_floor;   // we will only accept backtrack IDs > id_floor
+    PacketID::wide_id_t max_backtrack;
 
     int mode;                       // UDP_MODE or TCP_MODE
-    int form;                       // PacketID::LONG_FORM or PacketID::SHORT_FORM
+    int form;                       // PacketID::LONG_FORM, PacketID::SHORT_FORM or PacketID::WIDE_FORM
     int unit;                       // unit number of this object (for debugging)
     std::string name;               // name of this object (for debugging)
 
     SessionStats::Ptr stats;
 
-    std::uint8_t history[REPLAY_WINDOW_BYTES]; /* "sliding window" bitmask of recent packet IDs received */
+    word_t history[REPLAY_WINDOW_WORDS]; /* "sliding window" bitmask of recent packet IDs received */
   };
 
   // Our standard packet ID window with order=8 (window size=2048).
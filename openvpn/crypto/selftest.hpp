@@ -26,7 +26,11 @@
 
 #include <string>
 
+#include <openvpn/common/version.hpp>
+#include <openvpn/common/file.hpp>
+
 #ifdef USE_OPENSSL
+#include <openssl/opensslv.h>
 //#include <openvpn/openssl/util/selftest.hpp>
 #endif
 
@@ -35,17 +39,19 @@
 #endif
 
 #ifdef USE_MBEDTLS
+#include <mbedtls/version.h>
 #include <openvpn/mbedtls/util/selftest.hpp>
 #endif
 
 #ifdef USE_MBEDTLS_APPLE_HYBRID
 //#include <openvpn/applecrypto/util/selftest.hpp>
+#include <mbedtls/version.h>
 #include <openvpn/mbedtls/util/selftest.hpp>
 #endif
 
 namespace openvpn {
   namespace SelfTest {
-    inline std::string crypto_self_test()
+    inline std::string run_crypto_self_test()
     {
       std::string ret;
 #     ifdef USE_OPENSSL
@@ -59,6 +65,53 @@ namespace openvpn {
 #     endif
       return ret;
     }
+
+    // The self tests only depend on the code, so their results are
+    // the same for every run of a given build.
+    inline std::string crypto_self_test_build_id()
+    {
+      std::string ret = "OpenVPN " OPENVPN_VERSION;
+#     ifdef USE_OPENSSL
+        ret += " / " OPENSSL_VERSION_TEXT;
+#     endif
+#     if defined(USE_MBEDTLS) || defined(USE_MBEDTLS_APPLE_HYBRID)
+        ret += " / " MBEDTLS_VERSION_STRING_FULL;
+#     endif
+      return ret;
+    }
+
+    // run once per process
+    inline std::string crypto_self_test()
+    {
+      static const std::string ret = run_crypto_self_test(); // GLOBAL
+      return ret;
+    }
+
+    // Cached across processes in cache_file, whose first line is
+    // crypto_self_test_build_id(), so that a process start doesn't
+    // repeat the tests of a build that already passed them.  The
+    // file is rewritten when the build changes.
+    inline std::string crypto_self_test(const std::string& cache_file)
+    {
+      const std::string id = crypto_self_test_build_id() + '\n';
+      try {
+	const std::string cached = read_text_simple(cache_file);
+	if (cached.compare(0, id.length(), id) == 0)
+	  return cached.substr(id.length());
+      }
+      catch (const std::exception&)
+	{
+	}
+
+      const std::string ret = crypto_self_test();
+      try {
+	write_string(cache_file, id + ret);
+      }
+      catch (const std::exception&)
+	{
+	}
+      return ret;
+    }
   }
 } // namespace openvpn
 
@@ -152,6 +152,12 @@ namespace openvpn {
       return out.str();
     }
 
+    // KEY_SIZE bytes, or nullptr if undefined
+    const unsigned char *raw() const
+    {
+      return key_data_.size() == KEY_SIZE ? key_data_.c_data() : nullptr;
+    }
+
     unsigned char *raw_alloc()
     {
       key_data_.init(KEY_SIZE, key_t::DESTRUCT_ZERO|key_t::ARRAY);
@@ -498,6 +498,23 @@ namespace openvpn {
 	  }
       }
 
+#ifdef OVPN_PEER_INACTIVE
+      // kovpn counts tun traffic and notifies us through
+      // tun_read_handler when less than bytes passed in duration
+      virtual bool tun_inactive(const Time::Duration& duration, const unsigned int bytes) override
+      {
+	if (halt || !impl || peer_id < 0)
+	  return false;
+	struct ovpn_peer_inactive pi;
+	std::memset(&pi, 0, sizeof(pi));
+	pi.peer_id = peer_id;
+	pi.timeout = duration.to_seconds();
+	pi.min_bytes = bytes;
+	impl->peer_set_inactive(&pi);
+	return true;
+      }
+#endif
+
       virtual void explicit_exit_notify() override
       {
 	impl->peer_xmit_explicit_exit_notify(peer_id);
@@ -641,6 +658,15 @@ namespace openvpn {
 		    return;
 		  }
 
+#ifdef OVPN_PEER_INACTIVE
+		if (thn->head.status == OVPN_STATUS_INACTIVE)
+		  {
+		    OPENVPN_LOG("dcocli: peer_id=" << peer_id << " inactive");
+		    if (tun_parent)
+		      tun_parent->tun_error(Error::INACTIVE_TIMEOUT, "inactive timer expired");
+		    break;
+		  }
+#endif
 		const bool stop = (thn->head.status != OVPN_STATUS_ACTIVE);
 		OPENVPN_LOG("dcocli: status=" << int(thn->head.status) << " peer_id=" << peer_id << " rx_bytes=" << thn->rx_bytes << " tx_bytes=" << thn->tx_bytes); // fixme
 		if (stop)
@@ -0,0 +1,703 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// server-side DCO (Data Channel Offload) module for Linux/kovpn
+//
+// One kovpn device carries the data channel of all clients.  New
+// clients are accepted on a regular UDP socket in userspace.  Once
+// a client passes process_initial_packet(), it gets its own UDP
+// socket, bound to the same local endpoint with SO_REUSEPORT and
+// connected to the client, so that the kernel delivers the client's
+// packets to it rather than to the listening socket.  That socket
+// becomes a kovpn peer, and from then on data packets are handled
+// in the kernel while control packets reach the client instance
+// through the kovpn fd, tagged with the peer ID.
+//
+// The client instance (normally ServerProto::Session) only runs the
+// control channel: its data channel factory is wrapped in a
+// KoRekey::Factory so that negotiated keys are installed into the
+// kernel, and its tun provider is the peer itself, whose native
+// handle (kovpn fd, peer ID) is what the management layer uses to
+// add the client's routes with KoTun::API::peer_add_routes().
+//
+// Bringing up the ovpn interface (addresses, link state) is left to
+// the caller, as is the case for the server tun.  UDP only, client
+// float is not supported.
+//
+// Like dcocli.hpp, this module needs the kovpn headers, so include it
+// only in builds that define ENABLE_DCO.
+
+#ifndef OPENVPN_TRANSPORT_DCO_DCOSERV_H
+#define OPENVPN_TRANSPORT_DCO_DCOSERV_H
+
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <cstring>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/sockopt.hpp>
+#include <openvpn/common/to_string.hpp>
+#include <openvpn/buffer/asiobuf.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/transport/server/transbase.hpp>
+#include <openvpn/tun/server/tunbase.hpp>
+#include <openvpn/kovpn/kovpn.hpp>
+#include <openvpn/kovpn/kodev.hpp>
+#include <openvpn/kovpn/korekey.hpp>
+#include <openvpn/kovpn/kostats.hpp>
+
+namespace openvpn {
+  namespace DCOTransport {
+
+    OPENVPN_EXCEPTION(dco_server_error);
+
+    class ServerConfig : public TransportServerFactory
+    {
+    public:
+      typedef RCPtr<ServerConfig> Ptr;
+
+      std::string dev_name = "ovpns";
+      IP::Addr local_addr;
+      unsigned short local_port = 1194;
+
+      unsigned int max_peers = 1024;
+      unsigned int n_parallel = 8; // parallel reads on the kovpn fd
+      unsigned int drain_budget = 64; // if > 0, drain up to this many packets per kovpn fd wakeup instead of n_parallel reads
+      unsigned int stats_notify_seconds = 60; // per-peer status notifications from kovpn, 0 to poll each peer instead
+      unsigned int ping_restart_override = 0;
+
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+
+      // data channel factory of the client instances, which
+      // will be wrapped so that their keys go to kovpn
+      CryptoDCFactory::Ptr dc_factory;
+
+      TransportClientInstance::Factory::Ptr client_instance_factory;
+
+      static Ptr new_obj()
+      {
+	return new ServerConfig;
+      }
+
+      virtual TransportServer::Ptr new_server_obj(openvpn_io::io_context& io_context) override;
+
+    private:
+      ServerConfig() {}
+    };
+
+    class Server : public TransportServer
+    {
+      friend ServerConfig; // calls constructor
+
+      typedef KoTun::TunClient<Server*> TunImpl;
+
+      // calls tun_read_handler and tun_error_handler
+      friend TunImpl::Base;
+
+    public:
+      typedef RCPtr<Server> Ptr;
+
+      virtual void start() override
+      {
+	if (halt || impl)
+	  return;
+	if (!config->frame || !config->client_instance_factory || !config->dc_factory)
+	  throw dco_server_error("frame, dc_factory and client_instance_factory must be set");
+
+	KoTun::DevConf devconf;
+	devconf.dc.tcp = false;
+	devconf.set_dev_name(config->dev_name);
+	devconf.dc.max_peers = config->max_peers;
+	devconf.dc.max_dev_queues = 1;
+	devconf.dc.dev_tx_queue_len = 4096;
+	devconf.dc.max_tun_queue_len = 4096;
+	devconf.dc.max_tcp_send_queue_len = 64;
+	devconf.dc.cpu_id = -1;
+
+	// create kovpn tun socket
+	impl.reset(new TunImpl(io_context,
+			       devconf,
+			       this,
+			       config->frame,
+			       nullptr,
+			       nullptr));
+	if (config->drain_budget)
+	  impl->start_drain(config->drain_budget);
+	else
+	  impl->start(config->n_parallel);
+
+	// feed transport stats from one sweep over all peers
+	if (config->stats)
+	  {
+	    stats_source.reset(new StatsSource(this));
+	    config->stats->dco_configure(stats_source.get());
+	  }
+
+	// listening socket for clients that have no peer yet
+	local_endpoint = openvpn_io::ip::udp::endpoint(config->local_addr.to_asio(), config->local_port);
+	open_bound(listen_socket);
+	local_endpoint = listen_socket.local_endpoint();
+	queue_listen_read();
+
+	OPENVPN_LOG("DCO server " << local_endpoint_info() << " max_peers=" << config->max_peers);
+      }
+
+      virtual void stop() override
+      {
+	if (!halt)
+	  {
+	    halt = true;
+
+	    // stopping the client instance removes the peer
+	    while (!peers.empty())
+	      {
+		const Peer::Ptr peer = peers.begin()->second;
+		peer->stop_instance();
+	      }
+
+	    if (stats_source)
+	      {
+		config->stats->dco_update(); // final update
+		config->stats->dco_configure(nullptr);
+		stats_source->server = nullptr;
+		stats_source.reset();
+	      }
+
+	    listen_socket.close();
+	    if (impl)
+	      impl->stop();
+	  }
+      }
+
+      virtual std::string local_endpoint_info() const override
+      {
+	std::ostringstream os;
+	os << "UDP " << local_endpoint << " via " << config->dev_name;
+	return os.str();
+      }
+
+      virtual IP::Addr local_endpoint_addr() const override
+      {
+	return IP::Addr::from_asio(local_endpoint.address());
+      }
+
+      size_t n_peers() const
+      {
+	return peers.size();
+      }
+
+      virtual ~Server() override
+      {
+	stop();
+      }
+
+    private:
+      // Per-client state: the transport and tun provider of one
+      // client instance, and the receiver of its rekey events.
+      class Peer : public TransportClientInstance::Send,
+		   public TunClientInstance::Send,
+		   public KoRekey::Receiver
+      {
+      public:
+	typedef RCPtr<Peer> Ptr;
+
+	Peer(Server* parent_arg,
+	     openvpn_io::ip::udp::socket&& socket_arg,
+	     const PeerAddr::Ptr& addr_arg,
+	     const int peer_id_arg)
+	  : parent(parent_arg),
+	    socket(std::move(socket_arg)),
+	    addr(addr_arg),
+	    peer_id(peer_id_arg),
+	    info(addr_arg->to_string() + " peer_id=" + openvpn::to_string(peer_id_arg)),
+	    tun_name(parent_arg->config->dev_name),
+	    notify(parent_arg->config->stats_notify_seconds > 0)
+	{
+	}
+
+	// TransportClientInstance::Send / TunClientInstance::Send
+
+	virtual bool defined() const override
+	{
+	  return !halt;
+	}
+
+	virtual void stop() override
+	{
+	  if (!halt)
+	    {
+	      halt = true;
+	      const Ptr self(this);
+	      socket.close();
+	      parent->remove_peer(*this);
+	    }
+	}
+
+	virtual bool transport_send_const(const Buffer& buf) override
+	{
+	  return !halt && parent->send(peer_id, buf);
+	}
+
+	virtual bool transport_send(BufferAllocated& buf) override
+	{
+	  return !halt && parent->send(peer_id, buf);
+	}
+
+	virtual const std::string& transport_info() const override
+	{
+	  return info;
+	}
+
+	virtual bool stats_pending() const override
+	{
+	  return !halt;
+	}
+
+	// Served from the last kovpn status notification when those
+	// are enabled, so that polling all peers costs no ioctls.
+	virtual PeerStats stats_poll() override
+	{
+	  if (!parent_notifies())
+	    refresh();
+	  return stats();
+	}
+
+	// the data channel never passes through userspace
+	virtual bool tun_send_const(const Buffer& buf) override
+	{
+	  return false;
+	}
+
+	virtual bool tun_send(BufferAllocated& buf) override
+	{
+	  return false;
+	}
+
+	virtual TunClientInstance::NativeHandle tun_native_handle() override
+	{
+	  if (halt)
+	    return TunClientInstance::NativeHandle();
+	  return TunClientInstance::NativeHandle(parent->impl->native_handle(), peer_id);
+	}
+
+	virtual void relay(const IP::Addr& target, const int port) override
+	{
+	  OPENVPN_LOG("DCO server: relay not supported, peer " << info);
+	}
+
+	virtual const std::string& tun_info() const override
+	{
+	  return tun_name;
+	}
+
+	// KoRekey::Receiver
+
+	virtual void rekey(const CryptoDCInstance::RekeyType rktype,
+			   const KoRekey::Info& rkinfo) override
+	{
+	  if (halt)
+	    return;
+
+	  KoRekey::Key key(rktype, rkinfo, peer_id, false);
+	  parent->impl->peer_keys_reset(key());
+	  if (recv && recv->is_keepalive_enabled())
+	    {
+	      struct ovpn_peer_keepalive ka;
+
+	      // Disable userspace keepalive, get the userspace
+	      // keepalive parameters, and enable kovpn keepalive.
+	      ka.peer_id = peer_id;
+	      recv->disable_keepalive(ka.keepalive_ping,
+				      ka.keepalive_timeout);
+
+	      // Allow overide of keepalive timeout
+	      if (parent->config->ping_restart_override)
+		ka.keepalive_timeout = parent->config->ping_restart_override;
+
+	      parent->impl->peer_set_keepalive(&ka);
+	    }
+	}
+
+	virtual void explicit_exit_notify() override
+	{
+	  if (!halt)
+	    parent->impl->peer_xmit_explicit_exit_notify(peer_id);
+	}
+
+	// Server side
+
+	void start(const TransportClientInstance::Recv::Ptr& recv_arg,
+		   BufferAllocated& buf)
+	{
+	  recv = recv_arg;
+	  recv->override_dc_factory(CryptoDCFactory::Ptr(new KoRekey::Factory(parent->config->dc_factory, this, parent->config->frame)));
+	  recv->override_tun(this);
+	  recv->start(this, addr, peer_id);
+	  transport_recv(buf);
+	}
+
+	void transport_recv(BufferAllocated& buf)
+	{
+	  if (!halt && recv)
+	    {
+	      const TransportClientInstance::Recv::Ptr r(recv);
+	      cc_rx_bytes += buf.size();
+	      r->transport_recv(buf);
+	    }
+	}
+
+	// status notification from kovpn
+	void status_notify(const PeerStats& ps)
+	{
+	  const bool active = (ps.status == OVPN_STATUS_ACTIVE);
+	  kernel_stats = ps;
+	  if (recv)
+	    recv->stats_notify(stats(), !active);
+	  if (!active)
+	    stop_instance();
+	}
+
+	// fetch the data channel counters from kovpn
+	void refresh()
+	{
+	  struct ovpn_peer_status ops;
+	  ops.peer_id = peer_id;
+	  if (!halt && parent->impl->peer_get_status(&ops))
+	    {
+	      kernel_stats.rx_bytes = ops.rx_bytes;
+	      kernel_stats.tx_bytes = ops.tx_bytes;
+	    }
+	}
+
+	PeerStats stats() const
+	{
+	  PeerStats ps(kernel_stats);
+	  ps.rx_bytes += cc_rx_bytes;
+	  return ps;
+	}
+
+	// bytes not yet accounted for in the server's SessionStats
+	SessionStats::DCOTransportSource::Data unreported()
+	{
+	  const PeerStats ps = stats();
+	  const SessionStats::DCOTransportSource::Data data(ps.rx_bytes, ps.tx_bytes);
+	  const SessionStats::DCOTransportSource::Data delta = data - reported;
+	  reported = data;
+	  return delta;
+	}
+
+	// stop the client instance, which calls back to stop()
+	void stop_instance()
+	{
+	  const Ptr self(this);
+	  const TransportClientInstance::Recv::Ptr r(recv);
+	  if (r)
+	    r->stop();
+	  stop();
+	}
+
+	const openvpn_io::ip::udp::endpoint& remote_endpoint() const
+	{
+	  return remote;
+	}
+
+	bool parent_notifies() const
+	{
+	  return notify;
+	}
+
+	int id() const
+	{
+	  return peer_id;
+	}
+
+	openvpn_io::ip::udp::endpoint remote;
+
+      private:
+	Server* parent;
+	openvpn_io::ip::udp::socket socket;
+	PeerAddr::Ptr addr;
+	int peer_id;
+	std::string info;
+	std::string tun_name;
+	TransportClientInstance::Recv::Ptr recv; // released with the peer, after the instance let go of us
+	std::uint64_t cc_rx_bytes = 0;
+	PeerStats kernel_stats;
+	SessionStats::DCOTransportSource::Data reported;
+	bool notify;
+	bool halt = false;
+      };
+
+      // SessionStats source for the whole server
+      struct StatsSource : public SessionStats::DCOTransportSource
+      {
+	typedef RCPtr<StatsSource> Ptr;
+
+	StatsSource(Server* server_arg)
+	  : server(server_arg)
+	{
+	}
+
+	virtual Data dco_transport_stats_delta() override
+	{
+	  if (server)
+	    return server->sweep_stats();
+	  else
+	    return Data();
+	}
+
+	Server* server;
+      };
+
+      Server(openvpn_io::io_context& io_context_arg,
+	     ServerConfig* config_arg)
+	: io_context(io_context_arg),
+	  config(config_arg),
+	  listen_socket(io_context_arg)
+      {
+      }
+
+      void open_bound(openvpn_io::ip::udp::socket& sock)
+      {
+	sock.open(local_endpoint.protocol());
+	SockOpt::reuseport(sock.native_handle());
+	SockOpt::set_cloexec(sock.native_handle());
+	sock.bind(local_endpoint);
+      }
+
+      void queue_listen_read()
+      {
+	config->frame->prepare(Frame::READ_LINK_UDP, listen_buf);
+	listen_socket.async_receive_from((*config->frame)[Frame::READ_LINK_UDP].mutable_buffer(listen_buf), listen_sender,
+					 [self=Ptr(this)](const openvpn_io::error_code& error, const size_t bytes_recvd)
+					 {
+					   self->handle_listen_read(error, bytes_recvd);
+					 });
+      }
+
+      void handle_listen_read(const openvpn_io::error_code& error, const size_t bytes_recvd)
+      {
+	if (halt)
+	  return;
+	if (!error)
+	  {
+	    listen_buf.set_size(bytes_recvd);
+	    try {
+	      recv_initial(listen_buf, listen_sender);
+	    }
+	    catch (const std::exception& e)
+	      {
+		OPENVPN_LOG("DCO server: new client " << listen_sender << ": " << e.what());
+	      }
+	  }
+	else
+	  OPENVPN_LOG("DCO server: UDP read error: " << error.message());
+	if (!halt)
+	  queue_listen_read();
+      }
+
+      // packet on the listening socket
+      void recv_initial(BufferAllocated& buf, const openvpn_io::ip::udp::endpoint& sender)
+      {
+	// may have been queued before the peer socket was connected
+	auto e = by_endpoint.find(sender);
+	if (e != by_endpoint.end())
+	  {
+	    auto p = peers.find(e->second);
+	    if (p != peers.end())
+	      p->second->transport_recv(buf);
+	    return;
+	  }
+
+	// kovpn has no room for another peer
+	if (peers.size() >= config->max_peers)
+	  return;
+
+	PeerAddr::Ptr addr(new PeerAddr());
+	addr->remote.addr = IP::Addr::from_asio(sender.address());
+	addr->remote.port = sender.port();
+	addr->local.addr = IP::Addr::from_asio(local_endpoint.address());
+	addr->local.port = local_endpoint.port();
+
+	BufferAllocated reply;
+	switch (config->client_instance_factory->process_initial_packet(buf, *addr, reply))
+	  {
+	  case TransportClientInstance::Factory::INITIAL_REPLY:
+	    listen_socket.send_to(reply.const_buffer(), sender);
+	    return;
+	  case TransportClientInstance::Factory::INITIAL_INSTANCE:
+	    break;
+	  default:
+	    return;
+	  }
+
+	// per-client socket, connected so that it takes the client's
+	// packets away from the listening socket
+	openvpn_io::ip::udp::socket sock(io_context);
+	open_bound(sock);
+	sock.connect(sender);
+
+	// attach it to kovpn as a new peer
+	const int peer_id = impl->peer_new_udp_client(sock.native_handle(), 0, config->stats_notify_seconds);
+
+	Peer::Ptr peer(new Peer(this, std::move(sock), addr, peer_id));
+	peer->remote = sender;
+	peers[peer_id] = peer;
+	by_endpoint[sender] = peer_id;
+	peer->start(config->client_instance_factory->new_client_instance(), buf);
+      }
+
+      void remove_peer(Peer& peer)
+      {
+	add_stats(retired, peer.unreported());
+	by_endpoint.erase(peer.remote_endpoint());
+	peers.erase(peer.id());
+      }
+
+      // One pass over all peers, polling kovpn only when it doesn't
+      // notify us.  Includes the last bytes of peers that are gone.
+      SessionStats::DCOTransportSource::Data sweep_stats()
+      {
+	SessionStats::DCOTransportSource::Data delta = retired;
+	retired = SessionStats::DCOTransportSource::Data();
+	for (auto& p : peers)
+	  {
+	    if (!p.second->parent_notifies())
+	      p.second->refresh();
+	    add_stats(delta, p.second->unreported());
+	  }
+	return delta;
+      }
+
+      static void add_stats(SessionStats::DCOTransportSource::Data& to,
+			    const SessionStats::DCOTransportSource::Data& from)
+      {
+	to.bytes_in += from.bytes_in;
+	to.bytes_out += from.bytes_out;
+      }
+
+      // control channel packet to peer
+      bool send(const int peer_id, const Buffer& buf)
+      {
+	struct ovpn_tun_head head;
+	std::memset(&head, 0, sizeof(head));
+	head.type = OVPN_TH_TRANS_BY_PEER_ID;
+	head.peer_id = peer_id;
+	return impl->write_seq(AsioConstBufferSeq2(Buffer(reinterpret_cast<Buffer::type>(&head), sizeof(head), true),
+						   buf));
+      }
+
+      Peer* find_peer(const std::uint32_t peer_id)
+      {
+	auto p = peers.find(int(peer_id));
+	if (p != peers.end())
+	  return p->second.get();
+	else
+	  return nullptr;
+      }
+
+      void tun_read_handler(KoTun::PacketFrom::SPtr& pfp) // called by TunImpl
+      {
+	if (halt)
+	  return;
+
+	try {
+	  const struct ovpn_tun_head *th = (const struct ovpn_tun_head *)pfp->buf.read_alloc(sizeof(struct ovpn_tun_head));
+	  switch (th->type)
+	    {
+	    case OVPN_TH_TRANS_BY_PEER_ID:
+	      {
+		Peer* peer = find_peer(th->peer_id);
+		if (!peer)
+		  {
+		    OPENVPN_LOG("dcoserv: OVPN_TH_TRANS_BY_PEER_ID unrecognized peer_id=" << th->peer_id);
+		    return;
+		  }
+		peer->transport_recv(pfp->buf);
+		break;
+	      }
+	    case OVPN_TH_NOTIFY_STATUS:
+	      {
+		const struct ovpn_tun_head_status *thn = (const struct ovpn_tun_head_status *)th;
+		Peer* peer = find_peer(thn->head.peer_id);
+		if (!peer)
+		  {
+		    OPENVPN_LOG("dcoserv: OVPN_TH_NOTIFY_STATUS unrecognized peer_id=" << thn->head.peer_id);
+		    return;
+		  }
+		PeerStats ps;
+		ps.rx_bytes = thn->rx_bytes;
+		ps.tx_bytes = thn->tx_bytes;
+		ps.status = thn->head.status;
+		peer->status_notify(ps);
+		break;
+	      }
+	    default:
+	      OPENVPN_LOG("dcoserv: unknown ovpn_tun_head type=" << (int)th->type);
+	      break;
+	    }
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("dcoserv: tun_read_handler: " << e.what());
+	  }
+      }
+
+      void tun_error_handler(const Error::Type errtype, // called by TunImpl
+			     const openvpn_io::error_code* error)
+      {
+	OPENVPN_LOG("dcoserv: TUN error" << (error ? ": " + error->message() : std::string()));
+	stop();
+      }
+
+      openvpn_io::io_context& io_context;
+      ServerConfig::Ptr config;
+      TunImpl::Ptr impl;
+
+      openvpn_io::ip::udp::endpoint local_endpoint;
+      openvpn_io::ip::udp::socket listen_socket;
+      openvpn_io::ip::udp::endpoint listen_sender;
+      BufferAllocated listen_buf;
+
+      std::map<int, Peer::Ptr> peers;
+      std::map<openvpn_io::ip::udp::endpoint, int> by_endpoint;
+
+      StatsSource::Ptr stats_source;
+      SessionStats::DCOTransportSource::Data retired; // unreported bytes of removed peers
+
+      bool halt = false;
+    };
+
+    inline TransportServer::Ptr ServerConfig::new_server_obj(openvpn_io::io_context& io_context)
+    {
+      return TransportServer::Ptr(new Server(io_context, this));
+    }
+  }
+}
+
+#endif
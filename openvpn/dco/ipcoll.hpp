@@ -0,0 +1,126 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// IP collision detection for DCO and tun setup.  The addresses and
+// routes already configured on the host are indexed once per setup
+// in a RouteTree (on Linux from TunNetlink::SITNL::net_system_routes(),
+// a single address dump and route dump), so checking a pushed address
+// or route against them costs a walk down the tree rather than a
+// scan of every system entry.  Addresses handed out to DCO units are
+// tracked as well, so that two units can't claim the same one.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <ostream>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/to_string.hpp>
+#include <openvpn/addr/route.hpp>
+#include <openvpn/addr/routetree.hpp>
+#include <openvpn/dco/ipcollbase.hpp>
+
+namespace openvpn {
+  class IPCollisionDetect : public IPCollisionDetectBase, public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<IPCollisionDetect> Ptr;
+
+    // system holds the networks and routes configured on the host
+    explicit IPCollisionDetect(const IP::RouteList& system)
+    {
+      for (IP::Route r : system)
+	{
+	  r.force_canonical();
+	  index.insert(r);
+	}
+    }
+
+    // Throws ip_collision if addr_str (an address or a route) overlaps
+    // a system network or route, or is in use by another unit.  The
+    // action added to late_remove releases it again.
+    virtual void add(const std::string& addr_str,
+		     const unsigned int unit,
+		     ActionList& late_remove) override
+    {
+      IP::Route r = IP::route_from_string(addr_str, "ip-collision");
+      r.force_canonical();
+
+      if (const IP::Route* m = index.longest_match(r))
+	throw ip_collision(addr_str + " collides with system route " + m->to_string());
+      if (index.contains_subroute(r))
+	throw ip_collision(addr_str + " contains a system route");
+
+      const std::string key = r.to_string();
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto e = in_use.emplace(key, unit);
+	if (!e.second)
+	  {
+	    if (e.first->second != unit)
+	      throw ip_collision(addr_str + " already in use by unit " + openvpn::to_string(e.first->second));
+	    return;
+	  }
+      }
+      late_remove.add(new Remove(IPCollisionDetect::Ptr(this), key));
+    }
+
+    // number of addresses claimed by units
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return in_use.size();
+    }
+
+  private:
+    class Remove : public Action
+    {
+    public:
+      Remove(IPCollisionDetect::Ptr parent_arg, const std::string& key_arg)
+	: parent(std::move(parent_arg)),
+	  key(key_arg)
+      {
+      }
+
+      virtual void execute(std::ostream& os) override
+      {
+	std::lock_guard<std::mutex> lock(parent->mutex);
+	parent->in_use.erase(key);
+      }
+
+      virtual std::string to_string() const override
+      {
+	return "IP collision release " + key;
+      }
+
+    private:
+      IPCollisionDetect::Ptr parent;
+      std::string key;
+    };
+
+    IP::RouteTree index;  // read-only after construction
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, unsigned int> in_use;
+  };
+}
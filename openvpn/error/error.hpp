@@ -99,6 +99,9 @@ namespace openvpn {
       PKTID_REPLAY,
       PKTID_TIME_BACKTRACK,
 
+      // Data channel detail
+      N_ENCRYPT_COPY,      // Number of packets encrypted through a work buffer copy rather than in-place
+
       N_ERRORS,
 
       // undefined error
@@ -172,6 +175,7 @@ namespace openvpn {
 	"PKTID_EXPIRE",
 	"PKTID_REPLAY",
 	"PKTID_TIME_BACKTRACK",
+	"N_ENCRYPT_COPY",
       };
 
       static_assert(N_ERRORS == array_size(names), "error names array inconsistency");
@@ -21,10 +21,17 @@
 
 // Define Frame classes.  These classes act as a factory for standard protocol
 // buffers and also try to optimize the buffers for alignment.
+//
+// A Frame with a payload alignment (see frame_init()) guarantees that
+// the AEAD ciphertext of data channel packets starts on a payload_align()
+// boundary, and the auth tag in front of it on a 16 byte boundary, so
+// that vector cipher kernels run on aligned loads.
 
 #ifndef OPENVPN_FRAME_FRAME_H
 #define OPENVPN_FRAME_FRAME_H
 
+#include <cstdint>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
@@ -60,6 +67,7 @@ namespace openvpn {
     };
 
     OPENVPN_SIMPLE_EXCEPTION(frame_context_index);
+    OPENVPN_SIMPLE_EXCEPTION(frame_payload_align);
 
     // We manage an array of Context objects, one for each
     // Frame context above.
@@ -99,9 +107,17 @@ namespace openvpn {
 	align_adjust_ = align_adjust;
       }
 
+      // Copy of this context with a different payload size and
+      // alignment prefix, e.g. for reads that carry a header.
+      Context resized(const size_t payload, const size_t align_adjust) const
+      {
+	return Context(headroom_, payload, tailroom_, align_adjust, align_block_, buffer_flags_);
+      }
+
       size_t headroom() const { return adj_headroom_; }
       size_t payload() const { return payload_; }
       size_t tailroom() const { return tailroom_; }
+      size_t align_block() const { return align_block_; }
       size_t capacity() const { return adj_capacity_; }
       unsigned int buffer_flags() const { return buffer_flags_; }
 
@@ -109,7 +125,7 @@ namespace openvpn {
       // headroom and alignment issues.
       size_t prepare(Buffer& buf) const
       {
-	buf.reset(capacity(), buffer_flags());
+	buf.reset(capacity(), buffer_flags() | BufferAllocated::POOL);
 	buf.init_headroom(actual_headroom(buf.c_data_raw()));
 	return payload();
       }
@@ -258,6 +274,26 @@ namespace openvpn {
 
     size_t n_contexts() const { return N_ALIGN_CONTEXTS; }
 
+    // Alignment of data channel payloads: 0 for none, or 16, 32 or 64
+    // bytes, which must not exceed the align_block of any context.
+    void set_payload_align(const size_t align)
+    {
+      if (align && (align < 16 || align > 64 || (align & (align - 1))))
+	throw frame_payload_align();
+      for (const auto& c : contexts)
+	if (align > c.align_block())
+	  throw frame_payload_align();
+      payload_align_ = align;
+    }
+
+    size_t payload_align() const { return payload_align_; }
+
+    // true if p is on an align boundary, or payload alignment is off
+    bool payload_aligned(const void *p, const size_t align) const
+    {
+      return !payload_align_ || !(std::uintptr_t(p) & (align - 1));
+    }
+
     Context& operator[](const size_t i)
     {
       if (i >= N_ALIGN_CONTEXTS)
@@ -302,6 +338,7 @@ namespace openvpn {
 
   private:
     Context contexts[N_ALIGN_CONTEXTS];
+    size_t payload_align_ = 0;
   };
 
 } // namespace openvpn
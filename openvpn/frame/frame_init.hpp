@@ -25,6 +25,7 @@
 #define OPENVPN_FRAME_FRAME_INIT_H
 
 #include <algorithm>
+#include <string>
 
 #include <openvpn/frame/frame.hpp>
 
@@ -33,12 +34,13 @@ namespace openvpn {
   inline Frame::Ptr frame_init(const bool align_adjust_3_1,
 			       const size_t tun_mtu,
 			       const size_t control_channel_payload,
-			       const bool verbose)
+			       const bool verbose,
+			       const size_t payload_align = 0) // 0, or 16/32/64 for Frame::set_payload_align()
   {
     const size_t payload = std::max(tun_mtu + 512, size_t(2048));
     const size_t headroom = 512;
     const size_t tailroom = 512;
-    const size_t align_block = 16;
+    const size_t align_block = std::max(payload_align, size_t(16));
     const unsigned int buffer_flags = 0;
 
     Frame::Ptr frame(new Frame(Frame::Context(headroom, payload, tailroom, 0, align_block, buffer_flags)));
@@ -51,10 +53,12 @@ namespace openvpn {
 							   tailroom, 0, align_block, buffer_flags);
     (*frame)[Frame::WRITE_SSL_CLEARTEXT] = Frame::Context(headroom, payload, tailroom, 0, align_block, BufferAllocated::GROW);
     frame->standardize_capacity(~0);
+    frame->set_payload_align(payload_align);
 
     if (verbose)
       OPENVPN_LOG("Frame=" << headroom << '/' << payload << '/' << tailroom
-		  << " mssfix-ctrl=" << (*frame)[Frame::READ_BIO_MEMQ_STREAM].payload());
+		  << " mssfix-ctrl=" << (*frame)[Frame::READ_BIO_MEMQ_STREAM].payload()
+		  << (payload_align ? " align=" + std::to_string(payload_align) : std::string()));
 
     return frame;
   }
@@ -24,6 +24,8 @@
 #ifndef OPENVPN_FRAME_MEMQ_DGRAM_H
 #define OPENVPN_FRAME_MEMQ_DGRAM_H
 
+#include <vector>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/buffer/memq.hpp>
@@ -44,12 +46,18 @@ namespace openvpn {
       return empty() ? 0 : q.front()->size();
     }
 
+    // Queue one datagram.  It lands in a frame-prepared buffer, so
+    // that a consumer taking it with read_buf() can prepend its own
+    // headers in place.
     void write(const unsigned char *data, size_t size)
     {
       if (frame_)
 	{
 	  const Frame::Context& fc = (*frame_)[Frame::READ_BIO_MEMQ_STREAM];
-	  q.push_back(fc.copy(data, size));
+	  BufferPtr b = new_buffer();
+	  fc.prepare(*b);
+	  b->write(data, size);
+	  q.push_back(std::move(b));
 	  length += size;
 	}
       else
@@ -62,14 +70,41 @@ namespace openvpn {
       if (len > b->size())
 	len = b->size();
       b->read(data, len);
-      if (b->empty())
-	q.pop_front();
       length -= len;
+      if (b->empty())
+	{
+	  recycle(b);
+	  q.pop_front();
+	}
       return len;
     }
 
   private:
+    // Same recycling as MemQStream: buffers drained by read() that
+    // nobody else references are reused by write().
+    enum {
+      FREE_MAX = 4,
+    };
+
+    BufferPtr new_buffer()
+    {
+      if (!free_.empty())
+	{
+	  BufferPtr ret = std::move(free_.back());
+	  free_.pop_back();
+	  return ret;
+	}
+      return BufferPtr(new BufferAllocated);
+    }
+
+    void recycle(BufferPtr& bp)
+    {
+      if (free_.size() < FREE_MAX && bp->use_count() == 1)
+	free_.push_back(std::move(bp));
+    }
+
     Frame::Ptr frame_;
+    std::vector<BufferPtr> free_;
   };
 
 } // namespace openvpn
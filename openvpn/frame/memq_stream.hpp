@@ -26,6 +26,7 @@
 #define OPENVPN_FRAME_MEMQ_STREAM_H
 
 #include <algorithm>
+#include <vector>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -68,7 +69,7 @@ namespace openvpn {
 	      // Start a new buffer
 	      while (b.size())
 		{
-		  BufferPtr newbuf(new BufferAllocated);
+		  BufferPtr newbuf = new_buffer();
 		  fc.prepare(*newbuf);
 		  const size_t write_size = std::min(b.size(), fc.payload());
 		  const unsigned char *from = b.read_alloc(write_size);
@@ -96,13 +97,49 @@ namespace openvpn {
 	  qf->read(to, read_size);
 	  length -= read_size;
 	  if (qf->empty())
-	    q.pop_front();
+	    {
+	      recycle(qf);
+	      q.pop_front();
+	    }
 	}
       return b.size();
     }
 
+    // Drop the free list, and the queue's storage if it is empty
+    void compact()
+    {
+      std::vector<BufferPtr>().swap(free_);
+      if (q.empty())
+	q_type().swap(q);
+    }
+
   private:
+    // Drained buffers that nobody else references are kept on a
+    // short free list and reused by write(), so that a steady stream
+    // doesn't allocate a new buffer object per chunk.
+    enum {
+      FREE_MAX = 4,
+    };
+
+    BufferPtr new_buffer()
+    {
+      if (!free_.empty())
+	{
+	  BufferPtr ret = std::move(free_.back());
+	  free_.pop_back();
+	  return ret;
+	}
+      return BufferPtr(new BufferAllocated);
+    }
+
+    void recycle(BufferPtr& bp)
+    {
+      if (free_.size() < FREE_MAX && bp->use_count() == 1)
+	free_.push_back(std::move(bp));
+    }
+
     Frame::Ptr frame_;
+    std::vector<BufferPtr> free_;
   };
 
 } // namespace openvpn
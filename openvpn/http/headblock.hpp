@@ -0,0 +1,270 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// HTTP headers stored as one block of text with offsets, an
+// alternative to HeaderList for the parsers' views mode.  The text
+// and offset storage keep their capacity across clear(), so parsing
+// the headers of further requests on a connection doesn't allocate.
+// Lookup is case-insensitive through a small hash index.
+
+#ifndef OPENVPN_HTTP_HEADBLOCK_H
+#define OPENVPN_HTTP_HEADBLOCK_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <openvpn/http/header.hpp>
+
+namespace openvpn {
+  namespace HTTP {
+
+    // A non-owning view of header text.  Valid until the
+    // HeaderBlock it came from is cleared or parses further input.
+    struct HeaderView
+    {
+      HeaderView() {}
+      HeaderView(const char *data_arg, const size_t size_arg)
+	: data(data_arg), size(size_arg) {}
+
+      bool empty() const { return size == 0; }
+
+      bool equals(const char *str) const
+      {
+	return std::strlen(str) == size && std::memcmp(data, str, size) == 0;
+      }
+
+      bool iequals(const char *str) const
+      {
+	const size_t len = std::strlen(str);
+	return len == size && iequals(data, str, size);
+      }
+
+      HeaderView trim() const
+      {
+	HeaderView ret(*this);
+	while (ret.size && is_space(ret.data[0]))
+	  {
+	    ++ret.data;
+	    --ret.size;
+	  }
+	while (ret.size && is_space(ret.data[ret.size - 1]))
+	  --ret.size;
+	return ret;
+      }
+
+      std::string to_string() const
+      {
+	return std::string(data, size);
+      }
+
+      static bool iequals(const char *a, const char *b, const size_t size)
+      {
+	for (size_t i = 0; i < size; ++i)
+	  if (lower(a[i]) != lower(b[i]))
+	    return false;
+	return true;
+      }
+
+      static char lower(const char c)
+      {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+      }
+
+      static bool is_space(const char c)
+      {
+	return c == ' ' || c == '\t';
+      }
+
+      const char *data = "";
+      size_t size = 0;
+    };
+
+    class HeaderBlock
+    {
+    public:
+      enum {
+	INDEX_SIZE = 64, // hash index slots, a power of 2
+      };
+
+      void clear()
+      {
+	text.clear();
+	spans.clear();
+	indexed = false;
+      }
+
+      // number of headers
+      size_t size() const { return spans.size(); }
+
+      bool empty() const { return spans.empty(); }
+
+      // bytes of header names and values
+      size_t bytes() const { return text.size(); }
+
+      // Parser interface: start a new header with the first
+      // character of its name, then add name or value characters.
+      // Value characters of continuation lines go to the last
+      // header.
+
+      void begin(const char c)
+      {
+	Span s;
+	s.name = text.size();
+	s.value = s.name + 1;
+	spans.push_back(s);
+	text.push_back(c);
+	indexed = false;
+      }
+
+      void name_push(const char c)
+      {
+	text.push_back(c);
+	++spans.back().value;
+      }
+
+      void value_push(const char c)
+      {
+	text.push_back(c);
+      }
+
+      HeaderView name(const size_t i) const
+      {
+	const Span& s = spans[i];
+	return HeaderView(text.data() + s.name, s.value - s.name);
+      }
+
+      HeaderView value(const size_t i) const
+      {
+	return HeaderView(text.data() + spans[i].value, end(i) - spans[i].value);
+      }
+
+      // Index of the first header named key (case-insensitive),
+      // or -1 if none.
+      int find(const char *key) const
+      {
+	const size_t len = std::strlen(key);
+	if (!indexed)
+	  build_index();
+	if (spans.size() >= INDEX_SIZE)
+	  {
+	    for (size_t i = 0; i < spans.size(); ++i)
+	      if (name_is(i, key, len))
+		return int(i);
+	    return -1;
+	  }
+	for (unsigned int slot = hash(key, len) & (INDEX_SIZE - 1); index[slot]; slot = (slot + 1) & (INDEX_SIZE - 1))
+	  {
+	    const size_t i = index[slot] - 1;
+	    if (name_is(i, key, len))
+	      return int(i);
+	  }
+	return -1;
+      }
+
+      // Value of the first header named key, empty if none.
+      HeaderView get_value(const char *key) const
+      {
+	const int i = find(key);
+	if (i >= 0)
+	  return value(i);
+	else
+	  return HeaderView();
+      }
+
+      HeaderView get_value_trim(const char *key) const
+      {
+	return get_value(key).trim();
+      }
+
+      // copy into a HeaderList, for code that needs owned strings
+      void to_list(HeaderList& list) const
+      {
+	for (size_t i = 0; i < spans.size(); ++i)
+	  list.emplace_back(name(i).to_string(), value(i).to_string());
+      }
+
+      std::string to_string() const
+      {
+	std::ostringstream out;
+	for (size_t i = 0; i < spans.size(); ++i)
+	  out << '[' << i << "] " << name(i).to_string() << '=' << value(i).to_string() << std::endl;
+	return out.str();
+      }
+
+    private:
+      // offsets into text, the value ends where the next name starts
+      struct Span
+      {
+	size_t name;
+	size_t value;
+      };
+
+      size_t end(const size_t i) const
+      {
+	return i + 1 < spans.size() ? spans[i + 1].name : text.size();
+      }
+
+      bool name_is(const size_t i, const char *key, const size_t len) const
+      {
+	const Span& s = spans[i];
+	return s.value - s.name == len && HeaderView::iequals(text.data() + s.name, key, len);
+      }
+
+      // FNV-1a of the lower-cased name
+      static unsigned int hash(const char *str, const size_t len)
+      {
+	std::uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i)
+	  h = (h ^ (unsigned char)HeaderView::lower(str[i])) * 16777619u;
+	return h;
+      }
+
+      // Open addressing, slots hold header index + 1.  The first
+      // header of a name is found first, since headers are
+      // inserted in order.
+      void build_index() const
+      {
+	std::memset(index, 0, sizeof(index));
+	if (spans.size() < INDEX_SIZE)
+	  for (size_t i = 0; i < spans.size(); ++i)
+	    {
+	      const Span& s = spans[i];
+	      unsigned int slot = hash(text.data() + s.name, s.value - s.name) & (INDEX_SIZE - 1);
+	      while (index[slot])
+		slot = (slot + 1) & (INDEX_SIZE - 1);
+	      index[slot] = (unsigned char)(i + 1);
+	    }
+	indexed = true;
+      }
+
+      std::string text;
+      std::vector<Span> spans;
+      mutable unsigned char index[INDEX_SIZE];
+      mutable bool indexed = false;
+    };
+
+  }
+}
+
+#endif
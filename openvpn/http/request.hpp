@@ -30,6 +30,7 @@
 #define OPENVPN_HTTP_REQUEST_H
 
 #include <openvpn/http/header.hpp>
+#include <openvpn/http/headblock.hpp>
 #include <openvpn/http/parseutil.hpp>
 
 namespace openvpn {
@@ -45,6 +46,7 @@ namespace openvpn {
 	http_version_major = 0;
 	http_version_minor = 0;
 	headers.clear();
+	header_block.clear();
       }
 
       std::string to_string() const
@@ -55,6 +57,7 @@ namespace openvpn {
 	out << "uri=" << uri << std::endl;
 	out << "version=" << http_version_major << '/' << http_version_minor << std::endl;
 	out << headers.to_string();
+	out << header_block.to_string();
 	return out.str();
       }
 
@@ -75,6 +78,7 @@ namespace openvpn {
       int http_version_major;
       int http_version_minor;
       HeaderList headers;
+      HeaderBlock header_block; // instead of headers in the parser's views mode
     };
 
     class RequestParser {
@@ -114,6 +118,13 @@ namespace openvpn {
       {
       }
 
+      // In views mode, headers are parsed into header_block
+      // rather than headers.
+      void set_views(const bool v)
+      {
+	views = v;
+      }
+
       // Reset to initial parser state.
       void reset()
       {
@@ -286,7 +297,7 @@ namespace openvpn {
 		state_ = expecting_newline_3;
 		return pending;
 	      }
-	    else if (!req.headers.empty() && (input == ' ' || input == '\t'))
+	    else if (has_header(req) && (input == ' ' || input == '\t'))
 	      {
 		state_ = header_lws;
 		return pending;
@@ -297,8 +308,7 @@ namespace openvpn {
 	      }
 	    else
 	      {
-		req.headers.push_back(Header());
-		req.headers.back().name.push_back(input);
+		header_begin(req, input);
 		state_ = header_name;
 		return pending;
 	      }
@@ -319,7 +329,7 @@ namespace openvpn {
 	    else
 	      {
 		state_ = header_value;
-		req.headers.back().value.push_back(input);
+		header_value_push(req, input);
 		return pending;
 	      }
 	  case header_name:
@@ -334,7 +344,7 @@ namespace openvpn {
 	      }
 	    else
 	      {
-		req.headers.back().name.push_back(input);
+		header_name_push(req, input);
 		return pending;
 	      }
 	  case space_before_header_value:
@@ -359,7 +369,7 @@ namespace openvpn {
 	      }
 	    else
 	      {
-		req.headers.back().value.push_back(input);
+		header_value_push(req, input);
 		return pending;
 	      }
 	  case expecting_newline_2:
@@ -383,8 +393,41 @@ namespace openvpn {
       }
 
     private:
+      bool has_header(const Request& req) const
+      {
+	return views ? !req.header_block.empty() : !req.headers.empty();
+      }
+
+      void header_begin(Request& req, const unsigned char input)
+      {
+	if (views)
+	  req.header_block.begin(input);
+	else
+	  {
+	    req.headers.push_back(Header());
+	    req.headers.back().name.push_back(input);
+	  }
+      }
+
+      void header_name_push(Request& req, const unsigned char input)
+      {
+	if (views)
+	  req.header_block.name_push(input);
+	else
+	  req.headers.back().name.push_back(input);
+      }
+
+      void header_value_push(Request& req, const unsigned char input)
+      {
+	if (views)
+	  req.header_block.value_push(input);
+	else
+	  req.headers.back().value.push_back(input);
+      }
+
       // The current state of the parser.
       state state_;
+      bool views = false;
     };
 
     struct RequestType
@@ -51,5 +51,16 @@ namespace openvpn {
 #endif
   }
 
+  // Like init_openssl(), but leave the engine and SSL setup to the
+  // first crypto or SSL context that needs it, see OpenSSLEngineInit.
+  inline void init_openssl_lazy(const std::string& engine)
+  {
+#if defined(USE_OPENSSL)
+    OpenSSLEngineInit::defer(engine);
+#elif defined(USE_MINICRYPTO) && (defined(OPENVPN_ARCH_x86_64) || defined(OPENVPN_ARCH_i386))
+    OPENSSL_cpuid_setup();
+#endif
+  }
+
 }
 #endif
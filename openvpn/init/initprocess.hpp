@@ -49,8 +49,8 @@ namespace openvpn {
 	// initialize compression
 	CompressContext::init_static();
 
-	// init OpenSSL if included
-	init_openssl("auto");
+	// init OpenSSL if included, on first use
+	init_openssl_lazy("auto");
 
 	base64_init_static();
       }
@@ -24,11 +24,22 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 
 #include <openvpn/common/endian.hpp>
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/common/size.hpp>
 
+#if !defined(OPENVPN_CSUM_NO_SIMD)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OPENVPN_CSUM_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define OPENVPN_CSUM_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 namespace openvpn {
   namespace IPChecksum {
 
@@ -54,9 +65,94 @@ namespace openvpn {
       return ~unfold(sum);
     }
 
+    inline std::uint32_t fold64(std::uint64_t sum)
+    {
+      sum = (sum >> 32) + (sum & 0xffffffff);
+      sum += (sum >> 32);
+      return std::uint32_t(sum);
+    }
+
+    // Sum of len/4 native-order 32-bit words, to be folded by the
+    // caller.  A 64-bit accumulator avoids the per-word carry chain.
+    inline std::uint64_t sum32_scalar(const std::uint8_t *buf, size_t len)
+    {
+      std::uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      while (len >= 16)
+	{
+	  s0 += ((const std::uint32_t *)buf)[0];
+	  s1 += ((const std::uint32_t *)buf)[1];
+	  s2 += ((const std::uint32_t *)buf)[2];
+	  s3 += ((const std::uint32_t *)buf)[3];
+	  buf += 16;
+	  len -= 16;
+	}
+      while (len >= 4)
+	{
+	  s0 += *(const std::uint32_t *)buf;
+	  buf += 4;
+	  len -= 4;
+	}
+      return s0 + s1 + s2 + s3;
+    }
+
+#if defined(OPENVPN_CSUM_AVX2)
+    __attribute__((target("avx2")))
+    inline std::uint64_t sum32_avx2(const std::uint8_t *buf, size_t len)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      __m256i acc0 = zero, acc1 = zero;
+      while (len >= 32)
+	{
+	  const __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+	  acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+	  acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+	  buf += 32;
+	  len -= 32;
+	}
+      std::uint64_t lanes[4];
+      _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+      return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum32_scalar(buf, len);
+    }
+
+    inline bool have_avx2()
+    {
+      static const bool avx2 = __builtin_cpu_supports("avx2");
+      return avx2;
+    }
+#endif
+
+#if defined(OPENVPN_CSUM_NEON)
+    inline std::uint64_t sum32_neon(const std::uint8_t *buf, size_t len)
+    {
+      uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+      while (len >= 32)
+	{
+	  acc0 = vpadalq_u32(acc0, vld1q_u32((const std::uint32_t *)buf));
+	  acc1 = vpadalq_u32(acc1, vld1q_u32((const std::uint32_t *)(buf + 16)));
+	  buf += 32;
+	  len -= 32;
+	}
+      const uint64x2_t acc = vaddq_u64(acc0, acc1);
+      return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) + sum32_scalar(buf, len);
+    }
+#endif
+
+    // pick the widest kernel the CPU supports
+    inline std::uint64_t sum32(const std::uint8_t *buf, const size_t len)
+    {
+#if defined(OPENVPN_CSUM_AVX2)
+      if (len >= 64 && have_avx2())
+	return sum32_avx2(buf, len);
+#elif defined(OPENVPN_CSUM_NEON)
+      if (len >= 64)
+	return sum32_neon(buf, len);
+#endif
+      return sum32_scalar(buf, len);
+    }
+
     inline std::uint32_t compute(const std::uint8_t *buf, size_t len)
     {
-      std::uint32_t result = 0;
+      std::uint64_t result = 0;
 
       if (!len)
 	return 0;
@@ -83,17 +179,9 @@ namespace openvpn {
 	    }
 	  if (len >= 4)
 	    {
-	      const uint8_t *end = buf + (len & ~3);
-	      std::uint32_t carry = 0;
-	      do {
-		std::uint32_t w = *(std::uint32_t *)buf;
-		buf += 4;
-		result += carry;
-		result += w;
-		carry = (w > result);
-	      } while (buf < end);
-	      result += carry;
-	      result = (result & 0xffff) + (result >> 16);
+	      const size_t n = len & ~size_t(3);
+	      result += sum32(buf, n);
+	      buf += n;
 	    }
 	  if (len & 2)
 	    {
@@ -109,10 +197,11 @@ namespace openvpn {
 	  result += (*buf << 8);
 #endif
 	}
-      result = fold(result);
+      std::uint32_t r = fold64(result);
+      r = fold(r);
       if (odd)
-	result = ((result >> 8) & 0xff) | ((result & 0xff) << 8);
-      return result;
+	r = ((r >> 8) & 0xff) | ((r & 0xff) << 8);
+      return r;
     }
 
     inline std::uint32_t compute(const void *buf, const size_t len)
@@ -167,5 +256,114 @@ namespace openvpn {
     {
       return cfold(compute(data, size));
     }
+
+    // Fused copy and sum kernels: copy len bytes (a multiple of 4)
+    // and return the same sum as the sum32 kernels over src.
+    inline std::uint64_t copy_sum32_scalar(std::uint8_t *dst, const std::uint8_t *src, size_t len)
+    {
+      std::uint64_t s0 = 0, s1 = 0;
+      while (len >= 8)
+	{
+	  std::uint32_t w[2];
+	  std::memcpy(w, src, 8);
+	  std::memcpy(dst, w, 8);
+	  s0 += w[0];
+	  s1 += w[1];
+	  src += 8;
+	  dst += 8;
+	  len -= 8;
+	}
+      if (len >= 4)
+	{
+	  std::uint32_t w;
+	  std::memcpy(&w, src, 4);
+	  std::memcpy(dst, &w, 4);
+	  s0 += w;
+	}
+      return s0 + s1;
+    }
+
+#if defined(OPENVPN_CSUM_AVX2)
+    __attribute__((target("avx2")))
+    inline std::uint64_t copy_sum32_avx2(std::uint8_t *dst, const std::uint8_t *src, size_t len)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      __m256i acc0 = zero, acc1 = zero;
+      while (len >= 32)
+	{
+	  const __m256i v = _mm256_loadu_si256((const __m256i *)src);
+	  _mm256_storeu_si256((__m256i *)dst, v);
+	  acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+	  acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+	  src += 32;
+	  dst += 32;
+	  len -= 32;
+	}
+      std::uint64_t lanes[4];
+      _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+      return lanes[0] + lanes[1] + lanes[2] + lanes[3] + copy_sum32_scalar(dst, src, len);
+    }
+#endif
+
+#if defined(OPENVPN_CSUM_NEON)
+    inline std::uint64_t copy_sum32_neon(std::uint8_t *dst, const std::uint8_t *src, size_t len)
+    {
+      uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+      while (len >= 32)
+	{
+	  const uint32x4_t v0 = vreinterpretq_u32_u8(vld1q_u8(src));
+	  const uint32x4_t v1 = vreinterpretq_u32_u8(vld1q_u8(src + 16));
+	  vst1q_u8(dst, vreinterpretq_u8_u32(v0));
+	  vst1q_u8(dst + 16, vreinterpretq_u8_u32(v1));
+	  acc0 = vpadalq_u32(acc0, v0);
+	  acc1 = vpadalq_u32(acc1, v1);
+	  src += 32;
+	  dst += 32;
+	  len -= 32;
+	}
+      const uint64x2_t acc = vaddq_u64(acc0, acc1);
+      return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) + copy_sum32_scalar(dst, src, len);
+    }
+#endif
+
+    inline std::uint64_t copy_sum32(std::uint8_t *dst, const std::uint8_t *src, const size_t len)
+    {
+#if defined(OPENVPN_CSUM_AVX2)
+      if (len >= 64 && have_avx2())
+	return copy_sum32_avx2(dst, src, len);
+#elif defined(OPENVPN_CSUM_NEON)
+      if (len >= 64)
+	return copy_sum32_neon(dst, src, len);
+#endif
+      return copy_sum32_scalar(dst, src, len);
+    }
+
+    // Copy len bytes from src to dst and return compute(src, len),
+    // reading the data only once.
+    inline std::uint32_t copy_compute(void *dst, const void *src, const size_t len)
+    {
+      std::uint8_t *d = (std::uint8_t *)dst;
+      const std::uint8_t *s = (const std::uint8_t *)src;
+      size_t n = len & ~size_t(3);
+      std::uint64_t result = copy_sum32(d, s, n);
+      if (len & 2)
+	{
+	  std::uint16_t w;
+	  std::memcpy(&w, s + n, 2);
+	  std::memcpy(d + n, &w, 2);
+	  result += w;
+	  n += 2;
+	}
+      if (len & 1)
+	{
+	  d[n] = s[n];
+#ifdef OPENVPN_LITTLE_ENDIAN
+	  result += s[n];
+#else
+	  result += (s[n] << 8);
+#endif
+	}
+      return fold(fold64(result));
+    }
   }
 }
\ No newline at end of file
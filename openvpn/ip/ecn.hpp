@@ -0,0 +1,116 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2018 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// ECN and DSCP propagation between a tunneled IP packet and the
+// outer transport packet (RFC 6040 normal mode)
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/csum.hpp>
+#include <openvpn/ip/ip4.hpp>
+#include <openvpn/ip/ip6.hpp>
+#include <openvpn/ip/ipcommon.hpp>
+
+namespace openvpn {
+  namespace ECN {
+
+    // codepoints in the low two bits of the IPv4 TOS or IPv6
+    // traffic class byte
+    enum {
+      NOT_ECT = 0,
+      ECT_1 = 1,
+      ECT_0 = 2,
+      CE = 3,
+      MASK = 3,
+    };
+
+    // TOS or traffic class byte of an IP packet, 0 if buf doesn't
+    // start with an IP header
+    inline unsigned int tos(const Buffer& buf)
+    {
+      if (buf.empty())
+	return 0;
+      const std::uint8_t *p = buf.c_data();
+      switch (IPCommon::version(p[0]))
+	{
+	case IPCommon::IPv4:
+	  if (buf.size() >= sizeof(struct IPv4Header))
+	    return ((const IPv4Header *)p)->tos;
+	  break;
+	case IPCommon::IPv6:
+	  if (buf.size() >= sizeof(struct IPv6Header))
+	    {
+	      const IPv6Header *ip6 = (const IPv6Header *)p;
+	      return ((ip6->version_prio & 0x0F) << 4) | (ip6->flow_lbl[0] >> 4);
+	    }
+	  break;
+	}
+      return 0;
+    }
+
+    // Outer TOS byte for a packet encapsulating one with inner_tos,
+    // copying the DSCP and/or the ECN field.  Without ecn, the outer
+    // packet is Not-ECT (RFC 6040 compatibility mode).
+    inline unsigned int encap(const unsigned int inner_tos, const bool dscp, const bool ecn)
+    {
+      return inner_tos & ((dscp ? 0xFC : 0) | (ecn ? MASK : 0));
+    }
+
+    // Update the ECN field of the decapsulated packet in buf from the
+    // outer packet's outer_tos.  Returns false if the packet must be
+    // dropped: the outer packet was marked CE but the inner one is
+    // not ECN-capable.
+    inline bool decap(Buffer& buf, const unsigned int outer_tos)
+    {
+      const unsigned int outer = outer_tos & MASK;
+      if (outer == NOT_ECT || outer == ECT_0)
+	return true; // inner unchanged
+      const unsigned int inner = tos(buf) & MASK;
+      if (inner == NOT_ECT)
+	return outer != CE;
+      if (inner == CE || inner == outer)
+	return true;
+
+      // ECT(0) with outer ECT(1), or ECT with outer CE: take outer
+      std::uint8_t *p = buf.data();
+      if (IPCommon::version(p[0]) == IPCommon::IPv4)
+	{
+	  IPv4Header *ip4 = (IPv4Header *)p;
+	  std::uint16_t old_word, new_word;
+	  std::memcpy(&old_word, p, 2);
+	  ip4->tos = std::uint8_t((ip4->tos & ~MASK) | outer);
+	  std::memcpy(&new_word, p, 2);
+	  ip4->check = IPChecksum::cfold(IPChecksum::diff2(old_word, new_word, IPChecksum::cunfold(ip4->check)));
+	}
+      else
+	{
+	  IPv6Header *ip6 = (IPv6Header *)p;
+	  ip6->flow_lbl[0] = std::uint8_t((ip6->flow_lbl[0] & ~(MASK << 4)) | (outer << 4));
+	}
+      return true;
+    }
+  }
+}
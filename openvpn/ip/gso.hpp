@@ -0,0 +1,403 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Userspace TCP segmentation (GSO) and coalescing (GRO) for tun
+// devices that exchange offloaded packets behind a virtio-net header.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/common/endian.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ipcommon.hpp>
+#include <openvpn/ip/ip4.hpp>
+#include <openvpn/ip/ip6.hpp>
+#include <openvpn/ip/tcp.hpp>
+#include <openvpn/ip/csum.hpp>
+
+namespace openvpn {
+  namespace GSO {
+
+#pragma pack(push)
+#pragma pack(1)
+
+    // Same layout as struct virtio_net_hdr in <linux/virtio_net.h>,
+    // in host byte order.
+    struct VirtioNetHdr
+    {
+      enum {
+	F_NEEDS_CSUM = 1,
+      };
+
+      enum {
+	GSO_NONE = 0,
+	GSO_TCPV4 = 1,
+	GSO_TCPV6 = 4,
+	GSO_ECN = 0x80,
+      };
+
+      std::uint8_t    flags;
+      std::uint8_t    gso_type;
+      std::uint16_t   hdr_len;
+      std::uint16_t   gso_size;
+      std::uint16_t   csum_start;
+      std::uint16_t   csum_offset;
+    };
+
+#pragma pack(pop)
+
+    enum {
+      TCP_FIN = 0x01,
+      TCP_SYN = 0x02,
+      TCP_RST = 0x04,
+      TCP_PSH = 0x08,
+      TCP_ACK = 0x10,
+      TCP_URG = 0x20,
+      TCP_ECE = 0x40,
+      TCP_CWR = 0x80,
+
+      TCP_CHECK_OFFSET = 16,
+      MAX_PACKET = 65535,
+    };
+
+    // Fill in a checksum left partial by the kernel (F_NEEDS_CSUM
+    // on a packet that is not a GSO super-packet).
+    inline bool complete_csum(Buffer& pkt, const VirtioNetHdr& hdr)
+    {
+      if (!(hdr.flags & VirtioNetHdr::F_NEEDS_CSUM))
+	return true;
+      const size_t start = hdr.csum_start;
+      const size_t field = start + hdr.csum_offset;
+      if (field + 2 > pkt.size())
+	return false;
+      const std::uint16_t csum = IPChecksum::cfold(IPChecksum::compute(pkt.c_data() + start, pkt.size() - start));
+      std::memcpy(pkt.data() + field, &csum, 2);
+      return true;
+    }
+
+    // Layout of an IPv4/IPv6 TCP packet with no IPv6 extension headers.
+    struct TCPLayout
+    {
+      bool parse(const std::uint8_t *data, const size_t size)
+      {
+	if (size < sizeof(IPv4Header))
+	  return false;
+	version = IPCommon::version(data[0]);
+	if (version == IPCommon::IPv4)
+	  {
+	    const IPv4Header *ip = (const IPv4Header *)data;
+	    iphl = IPv4Header::length(ip->version_len);
+	    if (ip->protocol != IPCommon::TCP || iphl < sizeof(IPv4Header))
+	      return false;
+	  }
+	else if (version == IPCommon::IPv6)
+	  {
+	    const IPv6Header *ip = (const IPv6Header *)data;
+	    iphl = sizeof(IPv6Header);
+	    if (size < iphl || ip->nexthdr != IPCommon::TCP)
+	      return false;
+	  }
+	else
+	  return false;
+	if (size < iphl + sizeof(TCPHeader))
+	  return false;
+	thl = TCPHeader::length(((const TCPHeader *)(data + iphl))->doff_res);
+	if (thl < sizeof(TCPHeader) || size < iphl + thl)
+	  return false;
+	return true;
+      }
+
+      size_t hl() const
+      {
+	return iphl + thl;
+      }
+
+      unsigned int version = 0;
+      size_t iphl = 0;
+      size_t thl = 0;
+    };
+
+    // Checksum of the TCP pseudo-header, unfolded
+    inline std::uint32_t pseudo_header_sum(const std::uint8_t *ip, const TCPLayout& l, const size_t tcp_len)
+    {
+      std::uint32_t sum;
+      if (l.version == IPCommon::IPv4)
+	sum = IPChecksum::compute(&((const IPv4Header *)ip)->saddr, 8);
+      else
+	sum = IPChecksum::compute(&((const IPv6Header *)ip)->saddr, 32);
+      return sum + htons(IPCommon::TCP) + htons(std::uint16_t(tcp_len));
+    }
+
+    inline void set_ip_len(std::uint8_t *ip, const TCPLayout& l, const size_t total)
+    {
+      if (l.version == IPCommon::IPv4)
+	{
+	  IPv4Header *h = (IPv4Header *)ip;
+	  h->tot_len = htons(std::uint16_t(total));
+	  h->check = 0;
+	  h->check = IPChecksum::checksum(h, l.iphl);
+	}
+      else
+	((IPv6Header *)ip)->payload_len = htons(std::uint16_t(total - l.iphl));
+    }
+
+    // Split a TCP super-packet that the tun handed us with a GSO
+    // header into packets of at most gso_size payload bytes, each
+    // with its own IP length/ID, sequence number and checksums.
+    //
+    //   GSO::Segmenter seg;
+    //   if (seg.init(pkt, hdr))
+    //     while (prepare(buf), seg.next(buf))
+    //       process(buf);
+    class Segmenter
+    {
+    public:
+      bool init(const Buffer& pkt_arg, const VirtioNetHdr& hdr)
+      {
+	const unsigned int type = hdr.gso_type & ~VirtioNetHdr::GSO_ECN;
+	if ((type != VirtioNetHdr::GSO_TCPV4 && type != VirtioNetHdr::GSO_TCPV6) || !hdr.gso_size)
+	  return false;
+	pkt = &pkt_arg;
+	if (!layout.parse(pkt->c_data(), pkt->size()))
+	  return false;
+	mss = hdr.gso_size;
+	offset = 0;
+	index = 0;
+	return true;
+      }
+
+      // largest packet that next() will produce
+      size_t max_segment() const
+      {
+	return layout.hl() + mss;
+      }
+
+      // Append the next segment to seg, returns false when done
+      bool next(Buffer& seg)
+      {
+	const size_t hl = layout.hl();
+	const size_t payload = pkt->size() - hl;
+	if (offset >= payload && (index || payload))
+	  return false;
+	const size_t len = std::min(mss, payload - offset);
+	const bool last = offset + len >= payload;
+
+	std::uint8_t *ip = seg.write_alloc(hl + len);
+	std::memcpy(ip, pkt->c_data(), hl);
+	const std::uint32_t payload_sum = IPChecksum::copy_compute(ip + hl, pkt->c_data() + hl + offset, len);
+
+	set_ip_len(ip, layout, hl + len);
+	if (layout.version == IPCommon::IPv4 && index)
+	  {
+	    IPv4Header *h = (IPv4Header *)ip;
+	    h->id = htons(ntohs(h->id) + std::uint16_t(index));
+	    h->check = 0;
+	    h->check = IPChecksum::checksum(h, layout.iphl);
+	  }
+
+	TCPHeader *th = (TCPHeader *)(ip + layout.iphl);
+	th->seq = htonl(ntohl(th->seq) + std::uint32_t(offset));
+	if (!last)
+	  th->flags &= ~(TCP_FIN|TCP_PSH);
+	if (index)
+	  th->flags &= ~TCP_CWR;
+	th->check = 0;
+	const std::uint32_t sum = pseudo_header_sum(ip, layout, layout.thl + len)
+	  + IPChecksum::compute(th, layout.thl) + payload_sum;
+	th->check = IPChecksum::cfold(sum);
+
+	offset += len;
+	++index;
+	return true;
+      }
+
+    private:
+      const Buffer* pkt = nullptr;
+      TCPLayout layout;
+      size_t mss = 0;
+      size_t offset = 0;
+      size_t index = 0;
+    };
+
+    // Merge a run of consecutive in-order segments of one TCP flow
+    // into a single super-packet that the tun can take with a GSO
+    // header.  Segments must all carry mss payload bytes, except
+    // the last one which may be shorter.
+    //
+    //   GSO::Coalescer gro(out);
+    //   gro.start(pkts[i]);
+    //   while (j < n && gro.append(pkts[j])) ++j;
+    //   if (gro.count() > 1) write(gro.finish(), out); else write(pkts[i]);
+    class Coalescer
+    {
+    public:
+      Coalescer(Buffer& out_arg)
+	: out(out_arg)
+      {
+      }
+
+      // returns false if pkt can't start a super-packet
+      bool start(const Buffer& pkt)
+      {
+	first = nullptr;
+	n = 0;
+	if (!layout.parse(pkt.c_data(), pkt.size()))
+	  return false;
+	const std::uint8_t *ip = pkt.c_data();
+	if (layout.version == IPCommon::IPv4)
+	  {
+	    const IPv4Header *h = (const IPv4Header *)ip;
+	    if (ntohs(h->tot_len) != pkt.size() || (ntohs(h->frag_off) & (IPv4Header::OFFMASK|0x2000)))
+	      return false;
+	  }
+	else if (ntohs(((const IPv6Header *)ip)->payload_len) + layout.iphl != pkt.size())
+	  return false;
+	const TCPHeader *th = (const TCPHeader *)(ip + layout.iphl);
+	if ((th->flags & ~(TCP_ACK|TCP_PSH)) || (th->flags & TCP_PSH))
+	  return false;
+	mss = pkt.size() - layout.hl();
+	if (!mss)
+	  return false;
+	first = &pkt;
+	n = 1;
+	next_seq = ntohl(th->seq) + std::uint32_t(mss);
+	closed = false;
+	return true;
+      }
+
+      // returns false if pkt doesn't continue the super-packet
+      bool append(const Buffer& pkt)
+      {
+	if (!n || closed)
+	  return false;
+	const size_t hl = layout.hl();
+	const size_t len = pkt.size() - std::min(pkt.size(), hl);
+	if (pkt.size() <= hl || len > mss || size() + len > MAX_PACKET)
+	  return false;
+	if (!same_headers(pkt.c_data(), pkt.size()))
+	  return false;
+	const TCPHeader *th = (const TCPHeader *)(pkt.c_data() + layout.iphl);
+	if (ntohl(th->seq) != next_seq)
+	  return false;
+
+	if (n == 1)
+	  {
+	    out.reset_content();
+	    out.write(first->c_data(), first->size());
+	  }
+	out.write(pkt.c_data() + hl, len);
+	if (th->flags & TCP_PSH)
+	  ((TCPHeader *)(out.data() + layout.iphl))->flags |= TCP_PSH;
+	next_seq += std::uint32_t(len);
+	closed = len < mss || (th->flags & TCP_PSH);
+	++n;
+	return true;
+      }
+
+      size_t count() const
+      {
+	return n;
+      }
+
+      // Fix up the headers of the merged packet in out and return
+      // the GSO header to write with it.  Only valid if count() > 1.
+      VirtioNetHdr finish()
+      {
+	std::uint8_t *ip = out.data();
+	set_ip_len(ip, layout, out.size());
+	const std::uint16_t csum = IPChecksum::fold(pseudo_header_sum(ip, layout, out.size() - layout.iphl));
+	std::memcpy(ip + layout.iphl + TCP_CHECK_OFFSET, &csum, 2);
+
+	VirtioNetHdr hdr;
+	hdr.flags = VirtioNetHdr::F_NEEDS_CSUM;
+	hdr.gso_type = layout.version == IPCommon::IPv4 ? VirtioNetHdr::GSO_TCPV4 : VirtioNetHdr::GSO_TCPV6;
+	hdr.hdr_len = std::uint16_t(layout.hl());
+	hdr.gso_size = std::uint16_t(mss);
+	hdr.csum_start = std::uint16_t(layout.iphl);
+	hdr.csum_offset = TCP_CHECK_OFFSET;
+	return hdr;
+      }
+
+    private:
+      size_t size() const
+      {
+	return n > 1 ? out.size() : first->size();
+      }
+
+      // everything but lengths, IPv4 ID, checksums, sequence
+      // number and PSH must match the first segment
+      bool same_headers(const std::uint8_t *ip, const size_t size) const
+      {
+	const std::uint8_t *ip0 = first->c_data();
+	if (IPCommon::version(ip[0]) != layout.version)
+	  return false;
+	if (layout.version == IPCommon::IPv4)
+	  {
+	    const IPv4Header *h0 = (const IPv4Header *)ip0;
+	    const IPv4Header *h = (const IPv4Header *)ip;
+	    if (h->version_len != h0->version_len
+		|| h->tos != h0->tos
+		|| h->frag_off != h0->frag_off
+		|| h->ttl != h0->ttl
+		|| h->protocol != h0->protocol
+		|| h->saddr != h0->saddr
+		|| h->daddr != h0->daddr
+		|| ntohs(h->tot_len) != size
+		|| std::memcmp(h + 1, h0 + 1, layout.iphl - sizeof(IPv4Header)))
+	      return false;
+	  }
+	else
+	  {
+	    const IPv6Header *h0 = (const IPv6Header *)ip0;
+	    const IPv6Header *h = (const IPv6Header *)ip;
+	    if (std::memcmp(h, h0, 4)
+		|| h->nexthdr != h0->nexthdr
+		|| h->hop_limit != h0->hop_limit
+		|| std::memcmp(&h->saddr, &h0->saddr, 32)
+		|| ntohs(h->payload_len) + layout.iphl != size)
+	      return false;
+	  }
+
+	const TCPHeader *t0 = (const TCPHeader *)(ip0 + layout.iphl);
+	const TCPHeader *t = (const TCPHeader *)(ip + layout.iphl);
+	return t->source == t0->source
+	  && t->dest == t0->dest
+	  && t->ack_seq == t0->ack_seq
+	  && t->doff_res == t0->doff_res
+	  && (t->flags & ~TCP_PSH) == t0->flags
+	  && t->window == t0->window
+	  && t->urgent_p == t0->urgent_p
+	  && !std::memcmp(t + 1, t0 + 1, layout.thl - sizeof(TCPHeader));
+      }
+
+      Buffer& out;
+      const Buffer* first = nullptr;
+      TCPLayout layout;
+      size_t mss = 0;
+      size_t n = 0;
+      std::uint32_t next_seq = 0;
+      bool closed = false;
+    };
+  }
+}
@@ -146,6 +146,20 @@ namespace openvpn {
 	  }
       }
 
+#ifdef OVPN_PEER_INACTIVE
+      // Set inactivity threshold, kovpn sends an OVPN_TH_NOTIFY_STATUS
+      // with OVPN_STATUS_INACTIVE when it is crossed
+      inline void peer_set_inactive(const int kovpn_fd,
+				    const struct ovpn_peer_inactive *pi)
+      {
+	if (::ioctl(kovpn_fd, OVPN_PEER_INACTIVE, pi) < 0)
+	  {
+	    const int eno = errno;
+	    OPENVPN_THROW(kotun_error, "OVPN_PEER_INACTIVE failed, errno=" << eno << ' ' << KovpnStats::errstr(eno));
+	  }
+      }
+#endif
+
       // Add routes
       inline void peer_add_routes(const int kovpn_fd,
 				  const int peer_id,
@@ -364,6 +378,14 @@ namespace openvpn {
 	API::peer_set_keepalive(native_handle(), ka);
       }
 
+#ifdef OVPN_PEER_INACTIVE
+      // Set inactivity threshold
+      void peer_set_inactive(const struct ovpn_peer_inactive *pi)
+      {
+	API::peer_set_inactive(native_handle(), pi);
+      }
+#endif
+
       // Get status info
       bool peer_get_status(struct ovpn_peer_status* ops)
       {
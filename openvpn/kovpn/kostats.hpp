@@ -25,12 +25,16 @@
 #include <algorithm> // for std::min, std::max
 #include <memory>
 #include <atomic>
+#include <string>
+#include <sstream>
 
 #include <sys/ioctl.h>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/arraysize.hpp>
 #include <openvpn/common/core.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/log/openmetrics.hpp>
 #include <openvpn/kovpn/kovpn.hpp>
 
 namespace openvpn {
@@ -122,6 +126,29 @@ namespace openvpn {
 	}
     }
 
+    // Stats, per-CPU stats and error counters as one OpenMetrics
+    // family, labeled with the names used by the output_ methods.
+    void render_metrics(OpenMetrics::Writer& w) const
+    {
+      std::ostringstream os;
+      output_stats(os);
+      output_percpu(os);
+      output_err_counters(os);
+
+      w.family("kovpn", "counter", "kovpn kernel module stats and error counters");
+      std::istringstream is(os.str());
+      std::string line;
+      while (std::getline(is, line))
+	{
+	  const size_t comma = line.find_last_of(',');
+	  if (comma == std::string::npos)
+	    continue;
+	  std::uint64_t value;
+	  if (parse_number(line.substr(comma + 1), value))
+	    w.sample("kovpn_total", OpenMetrics::Writer::label("name", line.substr(0, comma)), value);
+	}
+    }
+
     void increment_cc_rx_bytes(const std::uint64_t value)
     {
       cc_rx_bytes.fetch_add(value, std::memory_order_relaxed);
@@ -0,0 +1,212 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Minimal eBPF assembler and loader for the small programs the core
+// attaches to the kernel (XDP redirect, tun queue steering), so that
+// no BPF toolchain or libbpf is needed at build time.  Only forward
+// jumps are supported; they target labels that are patched in by
+// finish().
+
+#ifndef OPENVPN_LINUX_BPFASM_H
+#define OPENVPN_LINUX_BPFASM_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/strerror.hpp>
+
+namespace openvpn {
+  namespace BPF {
+
+    OPENVPN_EXCEPTION(bpf_error);
+
+    inline int sys_bpf(const int cmd, union bpf_attr& attr)
+    {
+      return int(::syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+    }
+
+    class Asm
+    {
+    public:
+      typedef unsigned int Label;
+
+      enum {
+	R0=0, R1, R2, R3, R4, R5, R6, R7, R8, R9,
+      };
+
+      void op(const std::uint8_t code, const std::uint8_t dst, const std::uint8_t src, const std::int16_t off, const std::int32_t imm)
+      {
+	struct bpf_insn i;
+	std::memset(&i, 0, sizeof(i));
+	i.code = code;
+	i.dst_reg = dst & 0xF;
+	i.src_reg = src & 0xF;
+	i.off = off;
+	i.imm = imm;
+	prog.push_back(i);
+      }
+
+      void mov_reg(const std::uint8_t dst, const std::uint8_t src)
+      {
+	op(BPF_ALU64|BPF_MOV|BPF_X, dst, src, 0, 0);
+      }
+
+      void mov_imm(const std::uint8_t dst, const std::int32_t imm)
+      {
+	op(BPF_ALU64|BPF_MOV|BPF_K, dst, 0, 0, imm);
+      }
+
+      // 32-bit move, zero-extended (imm is not sign-extended)
+      void mov32_imm(const std::uint8_t dst, const std::uint32_t imm)
+      {
+	op(BPF_ALU|BPF_MOV|BPF_K, dst, 0, 0, static_cast<std::int32_t>(imm));
+      }
+
+      void add_imm(const std::uint8_t dst, const std::int32_t imm)
+      {
+	op(BPF_ALU64|BPF_ADD|BPF_K, dst, 0, 0, imm);
+      }
+
+      // 32-bit subtract, wraps and zero-extends
+      void sub32_imm(const std::uint8_t dst, const std::uint32_t imm)
+      {
+	op(BPF_ALU|BPF_SUB|BPF_K, dst, 0, 0, static_cast<std::int32_t>(imm));
+      }
+
+      void and_imm(const std::uint8_t dst, const std::int32_t imm)
+      {
+	op(BPF_ALU64|BPF_AND|BPF_K, dst, 0, 0, imm);
+      }
+
+      void rsh_imm(const std::uint8_t dst, const std::int32_t imm)
+      {
+	op(BPF_ALU64|BPF_RSH|BPF_K, dst, 0, 0, imm);
+      }
+
+      void load(const std::uint8_t size, const std::uint8_t dst, const std::uint8_t src, const std::int16_t off)
+      {
+	op(BPF_LDX|BPF_MEM|size, dst, src, off, 0);
+      }
+
+      // R0 = packet bytes at off, in host byte order (socket filter
+      // programs only, with the skb context in R6; clobbers R1-R5)
+      void load_abs(const std::uint8_t size, const std::int32_t off)
+      {
+	op(BPF_LD|BPF_ABS|size, 0, 0, 0, off);
+      }
+
+      void load_map_fd(const std::uint8_t dst, const int fd)
+      {
+	op(BPF_LD|BPF_DW|BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+	op(0, 0, 0, 0, 0);
+      }
+
+      Label new_label()
+      {
+	labels.push_back(0);
+	return Label(labels.size() - 1);
+      }
+
+      // jump if (dst op imm)
+      void jmp_imm(const std::uint8_t jop, const std::uint8_t dst, const std::int32_t imm, const Label l)
+      {
+	fixups.emplace_back(prog.size(), l);
+	op(BPF_JMP|jop|BPF_K, dst, 0, 0, imm);
+      }
+
+      // jump if (dst op src)
+      void jmp_reg(const std::uint8_t jop, const std::uint8_t dst, const std::uint8_t src, const Label l)
+      {
+	fixups.emplace_back(prog.size(), l);
+	op(BPF_JMP|jop|BPF_X, dst, src, 0, 0);
+      }
+
+      void jmp(const Label l)
+      {
+	fixups.emplace_back(prog.size(), l);
+	op(BPF_JMP|BPF_JA, 0, 0, 0, 0);
+      }
+
+      void call(const std::int32_t func)
+      {
+	op(BPF_JMP|BPF_CALL, 0, 0, 0, func);
+      }
+
+      void exit()
+      {
+	op(BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+      }
+
+      void label(const Label l)
+      {
+	if (l >= labels.size())
+	  labels.resize(l + 1);
+	labels[l] = prog.size();
+      }
+
+      const std::vector<struct bpf_insn>& finish()
+      {
+	for (const auto& f : fixups)
+	  prog[f.first].off = static_cast<std::int16_t>(labels[f.second] - f.first - 1);
+	return prog;
+      }
+
+      // Load the finished program, returns its fd.
+      int load_program(const std::uint32_t prog_type, const std::string& title)
+      {
+	finish();
+	static const char license[] = "GPL";
+	char log[4096];
+	log[0] = '\0';
+	union bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.prog_type = prog_type;
+	attr.insn_cnt = static_cast<std::uint32_t>(prog.size());
+	attr.insns = reinterpret_cast<std::uint64_t>(prog.data());
+	attr.license = reinterpret_cast<std::uint64_t>(license);
+	attr.log_level = 1;
+	attr.log_size = sizeof(log);
+	attr.log_buf = reinterpret_cast<std::uint64_t>(log);
+	const int fd = sys_bpf(BPF_PROG_LOAD, attr);
+	if (fd < 0)
+	  throw bpf_error(title + " program load failed: " + strerror_str(errno) + ' ' + log);
+	return fd;
+      }
+
+    private:
+      std::vector<struct bpf_insn> prog;
+      std::vector<std::pair<size_t, Label>> fixups;
+      std::vector<size_t> labels;
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,108 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Anonymous memory on 2 MB pages, for large, long-lived areas of
+// packet buffers: one TLB entry then covers a thousand 2 KB buffers
+// rather than two.  hugetlbfs pages are used if the administrator
+// has reserved them (vm.nr_hugepages), else the area is aligned to
+// 2 MB and advised for transparent huge pages, which the kernel
+// provides as it can.
+
+#ifndef OPENVPN_LINUX_HUGEPAGE_H
+#define OPENVPN_LINUX_HUGEPAGE_H
+
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace openvpn {
+  namespace HugePage {
+
+    enum {
+      SIZE = 2 * 1024 * 1024,
+    };
+
+    struct Region
+    {
+      void* addr = nullptr;
+      std::size_t size = 0;
+      bool hugetlb = false; // on reserved hugetlbfs pages, rather than THP
+    };
+
+    // Map at least size bytes, rounded up to SIZE, optionally
+    // faulting them all in now.  Returns a Region with a null addr
+    // on failure.
+    inline Region map(const std::size_t size, const bool populate)
+    {
+      Region r;
+      r.size = (size + SIZE - 1) & ~std::size_t(SIZE - 1);
+      const int flags = MAP_PRIVATE|MAP_ANONYMOUS|(populate ? MAP_POPULATE : 0);
+
+#ifdef MAP_HUGETLB
+      void* addr = ::mmap(nullptr, r.size, PROT_READ|PROT_WRITE, flags|MAP_HUGETLB, -1, 0);
+      if (addr != MAP_FAILED)
+	{
+	  r.addr = addr;
+	  r.hugetlb = true;
+	  return r;
+	}
+#endif
+
+      // over-allocate by a page to align to SIZE, then trim
+      const std::size_t map_size = r.size + SIZE;
+      void* area = ::mmap(nullptr, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if (area == MAP_FAILED)
+	{
+	  r.size = 0;
+	  return r;
+	}
+      const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(area);
+      const std::uintptr_t aligned = (base + SIZE - 1) & ~std::uintptr_t(SIZE - 1);
+      if (aligned > base)
+	::munmap(area, aligned - base);
+      const std::size_t tail = (base + map_size) - (aligned + r.size);
+      if (tail)
+	::munmap(reinterpret_cast<void*>(aligned + r.size), tail);
+      r.addr = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+      ::madvise(r.addr, r.size, MADV_HUGEPAGE);
+#endif
+      if (populate)
+	{
+	  // touch each page, as MAP_POPULATE would have
+	  volatile unsigned char* p = static_cast<unsigned char*>(r.addr);
+	  for (std::size_t i = 0; i < r.size; i += 4096)
+	    p[i] = 0;
+	}
+      return r;
+    }
+
+    inline void unmap(const Region& r)
+    {
+      if (r.addr)
+	::munmap(r.addr, r.size);
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,122 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Linux kernel TLS.  Once the sending direction of a TLS session
+// is installed on its TCP socket, plain writes of cleartext to the
+// socket go out as TLS records, encrypted by the kernel, so that a
+// large transfer needs no userspace record layer and no extra copy.
+
+#ifndef OPENVPN_LINUX_KTLS_H
+#define OPENVPN_LINUX_KTLS_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/ssl/sslapi.hpp>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+namespace openvpn {
+  namespace KTLS {
+
+    namespace detail {
+      template <typename INFO>
+      inline void fill(INFO& info, const SSLAPI::TrafficKeys& keys, const unsigned short cipher_type)
+      {
+	static_assert(sizeof(info.salt) + sizeof(info.iv) == sizeof(keys.iv), "unexpected kTLS nonce layout");
+	std::memset(&info, 0, sizeof(info));
+	info.info.version = keys.version;
+	info.info.cipher_type = cipher_type;
+	std::memcpy(info.key, keys.key, sizeof(info.key));
+	std::memcpy(info.salt, keys.iv, sizeof(info.salt));
+	std::memcpy(info.iv, keys.iv + sizeof(info.salt), sizeof(info.iv));
+	for (size_t i = 0; i < sizeof(info.rec_seq); ++i)
+	  info.rec_seq[i] = (unsigned char)(keys.rec_seq >> (8 * (sizeof(info.rec_seq) - 1 - i)));
+      }
+
+      template <typename INFO>
+      inline bool set_tx(const int fd, INFO& info)
+      {
+	const int status = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info));
+	volatile unsigned char *p = reinterpret_cast<unsigned char *>(&info);
+	for (size_t i = 0; i < sizeof(info); ++i)
+	  p[i] = 0;
+	return status == 0;
+      }
+    }
+
+    // Hand the sending direction of a TLS session to the kernel.
+    // Returns false, with errno set and the socket still usable for
+    // userspace TLS, if the kernel or the cipher isn't supported.
+    // The socket must have no unsent data queued by the caller.
+    inline bool enable_tx(const int fd, const SSLAPI::TrafficKeys& keys, std::string* err = nullptr)
+    {
+      if (::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")))
+	{
+	  if (err)
+	    *err = "TCP_ULP: " + strerror_str(errno);
+	  return false;
+	}
+
+      bool ok = false;
+      errno = EINVAL;
+      switch (keys.cipher)
+	{
+	case SSLAPI::TrafficKeys::AES_128_GCM:
+	  {
+	    tls12_crypto_info_aes_gcm_128 info;
+	    if (keys.key_len != sizeof(info.key))
+	      break;
+	    detail::fill(info, keys, TLS_CIPHER_AES_GCM_128);
+	    ok = detail::set_tx(fd, info);
+	    break;
+	  }
+	case SSLAPI::TrafficKeys::AES_256_GCM:
+	  {
+	    tls12_crypto_info_aes_gcm_256 info;
+	    if (keys.key_len != sizeof(info.key))
+	      break;
+	    detail::fill(info, keys, TLS_CIPHER_AES_GCM_256);
+	    ok = detail::set_tx(fd, info);
+	    break;
+	  }
+	}
+      if (!ok && err)
+	*err = "TLS_TX: " + strerror_str(errno);
+      return ok;
+    }
+
+  }
+}
+
+#endif
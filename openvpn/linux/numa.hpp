@@ -0,0 +1,182 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Linux NUMA topology from sysfs, and binding a thread to the
+// CPUs of one node.  A thread bound to a node allocates its memory
+// there on first touch, so per-thread state such as io_context
+// internals, buffer pools and session objects stays node-local.
+
+#ifndef OPENVPN_LINUX_NUMA_H
+#define OPENVPN_LINUX_NUMA_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <string>
+#include <vector>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/common/split.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/common/to_string.hpp>
+
+namespace openvpn {
+  namespace NUMA {
+
+    OPENVPN_EXCEPTION(numa_error);
+
+    // Parse a sysfs CPU list such as "0-3,8-11".
+    inline std::vector<int> parse_cpulist(const std::string& str)
+    {
+      std::vector<int> ret;
+      for (const auto& range : Split::by_char<std::vector<std::string>, NullLex, Split::NullLimit>(string::trim_crlf_copy(str), ','))
+	{
+	  if (range.empty())
+	    continue;
+	  const size_t dash = range.find('-');
+	  unsigned int first, last;
+	  if (!parse_number(range.substr(0, dash), first))
+	    throw numa_error("bad cpulist: " + str);
+	  if (dash == std::string::npos)
+	    last = first;
+	  else if (!parse_number(range.substr(dash + 1), last) || last < first)
+	    throw numa_error("bad cpulist: " + str);
+	  for (unsigned int cpu = first; cpu <= last; ++cpu)
+	    ret.push_back(int(cpu));
+	}
+      return ret;
+    }
+
+    class Topology
+    {
+    public:
+      // Load the online nodes and their CPUs.  Without NUMA support
+      // in the kernel, all online CPUs form a single node 0.
+      explicit Topology(const std::string& sysfs = "/sys/devices/system")
+      {
+	try {
+	  for (const int n : parse_cpulist(read_text_simple(sysfs + "/node/online")))
+	    {
+	      Node node;
+	      node.id = n;
+	      node.cpus = parse_cpulist(read_text_simple(sysfs + "/node/node" + openvpn::to_string(n) + "/cpulist"));
+	      if (!node.cpus.empty())
+		nodes.push_back(std::move(node));
+	    }
+	}
+	catch (const std::exception&)
+	  {
+	    nodes.clear();
+	  }
+	if (nodes.empty())
+	  {
+	    Node node;
+	    node.id = 0;
+	    try {
+	      node.cpus = parse_cpulist(read_text_simple(sysfs + "/cpu/online"));
+	    }
+	    catch (const std::exception&)
+	      {
+	      }
+	    nodes.push_back(std::move(node));
+	  }
+      }
+
+      size_t size() const
+      {
+	return nodes.size();
+      }
+
+      int node_id(const size_t index) const
+      {
+	return nodes[index].id;
+      }
+
+      const std::vector<int>& cpus(const size_t index) const
+      {
+	return nodes[index].cpus;
+      }
+
+      // Index of the node owning cpu, or 0 if unknown.
+      size_t index_of_cpu(const int cpu) const
+      {
+	for (size_t i = 0; i < nodes.size(); ++i)
+	  for (const int c : nodes[i].cpus)
+	    if (c == cpu)
+	      return i;
+	return 0;
+      }
+
+      // Spread n threads over the nodes in proportion to their
+      // CPU counts, keeping consecutive threads on the same node.
+      // Returns the node index for each thread.
+      std::vector<size_t> spread(const size_t n) const
+      {
+	size_t total = 0;
+	for (const auto& node : nodes)
+	  total += node.cpus.size();
+	std::vector<size_t> ret;
+	ret.reserve(n);
+	size_t acc = 0;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	  {
+	    acc += nodes[i].cpus.size();
+	    const size_t end = (i + 1 == nodes.size() || !total) ? n : (n * acc + total / 2) / total;
+	    while (ret.size() < end)
+	      ret.push_back(i);
+	  }
+	return ret;
+      }
+
+    private:
+      struct Node
+      {
+	int id;
+	std::vector<int> cpus;
+      };
+
+      std::vector<Node> nodes;
+    };
+
+    // Bind the calling thread to a set of CPUs, returns 0 or an errno value.
+    inline int bind_to_cpus(const std::vector<int>& cpus)
+    {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      for (const int cpu : cpus)
+	if (cpu >= 0 && cpu < CPU_SETSIZE)
+	  CPU_SET(cpu, &cpuset);
+      if (!CPU_COUNT(&cpuset))
+	return EINVAL;
+      return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    }
+
+    // CPU the calling thread is running on, or -1.
+    inline int current_cpu()
+    {
+      return ::sched_getcpu();
+    }
+  }
+}
+
+#endif
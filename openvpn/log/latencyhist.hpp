@@ -0,0 +1,167 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Log-linear latency histogram in the style of HdrHistogram.  Each
+// power of two is split into SUB_COUNT linear buckets, so a value is
+// known to within 1/SUB_COUNT of itself over the whole range, with a
+// fixed array of counters and no allocation on record().  Counters
+// are relaxed atomics, so a histogram may be recorded by one thread
+// and read by another, e.g. a UI thread polling client stats.
+
+#ifndef OPENVPN_LOG_LATENCYHIST_H
+#define OPENVPN_LOG_LATENCYHIST_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+#include <openvpn/common/ffs.hpp>
+
+namespace openvpn {
+
+  class LatencyHistogram
+  {
+  public:
+    enum {
+      SUB_BITS = 3,    // 8 buckets per power of two, values within 12.5%
+      SUB_COUNT = 1 << SUB_BITS,
+      MAX_BITS = 40,   // values up to 2^40 ns (about 18 minutes) are distinct
+      N_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT,
+    };
+
+    LatencyHistogram()
+    {
+      reset();
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // monotonic timestamp in nanoseconds for computing latencies
+    static std::uint64_t now_ns()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // record n_samples samples of the same value
+    void record(const std::uint64_t ns, const std::uint64_t n_samples = 1)
+    {
+      if (!n_samples)
+	return;
+      counts[bucket(ns)].fetch_add(n_samples, std::memory_order_relaxed);
+      n.fetch_add(n_samples, std::memory_order_relaxed);
+      sum.fetch_add(ns * n_samples, std::memory_order_relaxed);
+      std::uint64_t m = max_.load(std::memory_order_relaxed);
+      while (ns > m && !max_.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+	;
+    }
+
+    std::uint64_t count() const
+    {
+      return n.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t max() const
+    {
+      return max_.load(std::memory_order_relaxed);
+    }
+
+    // sum of all recorded values
+    std::uint64_t total_ns() const
+    {
+      return sum.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t bucket_count(const unsigned int b) const
+    {
+      return b < N_BUCKETS ? counts[b].load(std::memory_order_relaxed) : 0;
+    }
+
+    std::uint64_t mean() const
+    {
+      const std::uint64_t c = count();
+      return c ? sum.load(std::memory_order_relaxed) / c : 0;
+    }
+
+    // Value at or below which fraction p (0.0 to 1.0) of the samples
+    // fall, reported as the upper bound of its bucket (but no more
+    // than the largest recorded value).
+    std::uint64_t percentile(const double p) const
+    {
+      const std::uint64_t c = count();
+      if (!c)
+	return 0;
+      std::uint64_t target = static_cast<std::uint64_t>(p * c + 0.5);
+      if (target < 1)
+	target = 1;
+      std::uint64_t seen = 0;
+      for (unsigned int b = 0; b < N_BUCKETS; ++b)
+	{
+	  seen += counts[b].load(std::memory_order_relaxed);
+	  if (seen >= target)
+	    {
+	      const std::uint64_t hi = lower_bound(b + 1) - 1;
+	      const std::uint64_t m = max();
+	      return hi < m ? hi : m;
+	    }
+	}
+      return max();
+    }
+
+    void reset()
+    {
+      for (auto& c : counts)
+	c.store(0, std::memory_order_relaxed);
+      n.store(0, std::memory_order_relaxed);
+      sum.store(0, std::memory_order_relaxed);
+      max_.store(0, std::memory_order_relaxed);
+    }
+
+    static unsigned int bucket(const std::uint64_t v)
+    {
+      if (v < SUB_COUNT)
+	return static_cast<unsigned int>(v);
+      const int msb = find_last_set(static_cast<unsigned long long>(v)) - 1;
+      if (msb >= MAX_BITS)
+	return N_BUCKETS - 1;
+      const int shift = msb - SUB_BITS;
+      return static_cast<unsigned int>((shift + 1) * SUB_COUNT + ((v >> shift) & (SUB_COUNT - 1)));
+    }
+
+    // smallest value that falls into bucket b
+    static std::uint64_t lower_bound(const unsigned int b)
+    {
+      if (b < SUB_COUNT)
+	return b;
+      const unsigned int shift = b / SUB_COUNT - 1;
+      return std::uint64_t(SUB_COUNT + b % SUB_COUNT) << shift;
+    }
+
+  private:
+    std::atomic<std::uint64_t> counts[N_BUCKETS];
+    std::atomic<std::uint64_t> n;
+    std::atomic<std::uint64_t> sum;
+    std::atomic<std::uint64_t> max_;
+  };
+
+}
+
+#endif
@@ -0,0 +1,307 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Asynchronous log pipeline: logging threads copy already formatted
+// lines into a bounded lock-free ring of preallocated records (lines
+// longer than a record span several consecutive ones), and a
+// background writer thread hands them to a Sink.  Timestamp rendering
+// and the (possibly slow) sink I/O are done on the writer.  If the
+// ring is full, lines are dropped and counted rather than blocking
+// the caller.
+
+#ifndef OPENVPN_LOG_LOGASYNC_H
+#define OPENVPN_LOG_LOGASYNC_H
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/to_string.hpp>
+#include <openvpn/common/logrotate.hpp>
+#include <openvpn/time/timestr.hpp>
+
+namespace openvpn {
+  namespace Log {
+
+    class AsyncQueue
+    {
+    public:
+      // Receives log lines on the writer thread.
+      struct Sink : public RC<thread_safe_refcount>
+      {
+	typedef RCPtr<Sink> Ptr;
+
+	// t is the time the line was logged
+	virtual void write(const std::string& line, const std::time_t t) = 0;
+      };
+
+      enum {
+	RECORD_SIZE = 496, // bytes of text per record
+      };
+
+      // capacity is rounded up to a power of 2
+      AsyncQueue(const Sink::Ptr& sink_arg, const size_t capacity=1024)
+	: sink(sink_arg),
+	  ring(round_up(capacity)),
+	  mask(ring.size() - 1),
+	  max_records(ring.size() / 2)
+      {
+	for (size_t i = 0; i < ring.size(); ++i)
+	  ring[i].seq.store(i, std::memory_order_relaxed);
+	writer = std::thread([this]() { run(); });
+      }
+
+      ~AsyncQueue()
+      {
+	stop();
+      }
+
+      // Callable from any thread.  Returns false and counts a
+      // drop if the ring is full.  Lines longer than half the
+      // ring are truncated.
+      bool push(const char *text, size_t len)
+      {
+	const size_t n = std::max(size_t(1), std::min((len + RECORD_SIZE - 1) / RECORD_SIZE, max_records));
+	len = std::min(len, n * RECORD_SIZE);
+
+	// Claim n consecutive records.  The writer frees records in
+	// order, so if the last one is free, so are the others.
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	while (true)
+	  {
+	    const size_t last = pos + n - 1;
+	    const long dif = long(ring[last & mask].seq.load(std::memory_order_acquire) - last);
+	    if (dif == 0)
+	      {
+		if (enqueue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+		  break;
+	      }
+	    else if (dif < 0)
+	      {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	      }
+	    else
+	      pos = enqueue_pos.load(std::memory_order_relaxed);
+	  }
+
+	const std::time_t t = std::time(nullptr);
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    Record& r = ring[(pos + i) & mask];
+	    const size_t chunk = std::min(len, size_t(RECORD_SIZE));
+	    std::memcpy(r.text, text, chunk);
+	    r.len = chunk;
+	    r.more = (i + 1 < n);
+	    r.time = t;
+	    r.seq.store(pos + i + 1, std::memory_order_seq_cst);
+	    text += chunk;
+	    len -= chunk;
+	  }
+
+	// only take the lock when the writer is idle
+	if (writer_waiting.load(std::memory_order_seq_cst))
+	  wake();
+	return true;
+      }
+
+      bool push(const std::string& str)
+      {
+	return push(str.c_str(), str.length());
+      }
+
+      // number of lines dropped because the ring was full
+      size_t n_dropped() const
+      {
+	return dropped.load(std::memory_order_relaxed);
+      }
+
+      // Write out everything queued so far, then stop the writer.
+      void stop()
+      {
+	if (writer.joinable())
+	  {
+	    halt.store(true, std::memory_order_seq_cst);
+	    wake();
+	    writer.join();
+	  }
+      }
+
+    private:
+      struct Record
+      {
+	std::atomic<size_t> seq;
+	size_t len = 0;
+	bool more = false; // line continues in next record
+	std::time_t time = 0;
+	char text[RECORD_SIZE];
+      };
+
+      void run()
+      {
+	size_t pos = 0;
+	size_t dropped_reported = 0;
+	std::string line;
+	while (true)
+	  {
+	    Record& r = ring[pos & mask];
+	    if (r.seq.load(std::memory_order_acquire) == pos + 1)
+	      {
+		line.append(r.text, r.len);
+		const bool more = r.more;
+		const std::time_t t = r.time;
+		r.seq.store(pos + mask + 1, std::memory_order_release);
+		++pos;
+		if (more)
+		  continue;
+
+		const size_t d = n_dropped();
+		if (d != dropped_reported)
+		  {
+		    sink->write("ASYNC LOG: " + to_string(d - dropped_reported) + " lines dropped\n", t);
+		    dropped_reported = d;
+		  }
+		sink->write(line, t);
+		line.clear();
+		continue;
+	      }
+
+	    if (halt.load(std::memory_order_seq_cst))
+	      break;
+
+	    // Going idle: publish writer_waiting before the final
+	    // check, so that a producer either sees the flag or its
+	    // record is seen here.
+	    writer_waiting.store(true, std::memory_order_seq_cst);
+	    if (r.seq.load(std::memory_order_seq_cst) != pos + 1 && !halt.load(std::memory_order_seq_cst))
+	      {
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+		  return halt.load(std::memory_order_seq_cst)
+		    || r.seq.load(std::memory_order_acquire) == pos + 1;
+		});
+	      }
+	    writer_waiting.store(false, std::memory_order_relaxed);
+	  }
+      }
+
+      void wake()
+      {
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	}
+	cv.notify_one();
+      }
+
+      static size_t round_up(const size_t n)
+      {
+	size_t ret = 2;
+	while (ret < n)
+	  ret <<= 1;
+	return ret;
+      }
+
+      Sink::Ptr sink;
+      std::vector<Record> ring;
+      const size_t mask;
+      const size_t max_records; // max records per line
+      std::atomic<size_t> enqueue_pos{0};
+      std::atomic<size_t> dropped{0};
+      std::atomic<bool> writer_waiting{false};
+      std::atomic<bool> halt{false};
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::thread writer;
+    };
+
+    OPENVPN_EXCEPTION(async_log_file_error);
+
+    // Sink that appends timestamped lines to a file, rotating it
+    // with log_rotate() when it grows past max_size bytes.
+    class AsyncFileSink : public AsyncQueue::Sink
+    {
+    public:
+      typedef RCPtr<AsyncFileSink> Ptr;
+
+      AsyncFileSink(const std::string& fn_arg,
+		    const size_t max_size_arg,
+		    const int max_versions_arg)
+	: fn(fn_arg),
+	  max_size(max_size_arg),
+	  max_versions(max_versions_arg)
+      {
+	open();
+      }
+
+      virtual ~AsyncFileSink()
+      {
+	if (fp)
+	  std::fclose(fp);
+      }
+
+      virtual void write(const std::string& line, const std::time_t t) override
+      {
+	if (!fp)
+	  return;
+	const std::string ts = date_time(t);
+	std::fprintf(fp, "%s %s", ts.c_str(), line.c_str());
+	std::fflush(fp);
+	size += ts.length() + 1 + line.length();
+	if (max_size && size >= max_size)
+	  {
+	    std::fclose(fp);
+	    fp = nullptr;
+	    log_rotate(fn, max_versions);
+	    open();
+	  }
+      }
+
+    private:
+      void open()
+      {
+	fp = std::fopen(fn.c_str(), "a");
+	if (!fp)
+	  throw async_log_file_error("cannot open " + fn);
+	std::fseek(fp, 0, SEEK_END);
+	const long pos = std::ftell(fp);
+	size = pos > 0 ? size_t(pos) : 0;
+      }
+
+      const std::string fn;
+      const size_t max_size;
+      const int max_versions;
+      std::FILE *fp = nullptr;
+      size_t size = 0;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,203 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Render SessionStats counters, error counts, CPU time by subsystem,
+// latency histograms and object pool occupancy in the OpenMetrics
+// text exposition format, for scraping by Prometheus.  All values are read with relaxed atomic loads, so
+// rendering never blocks the threads updating them.
+
+#ifndef OPENVPN_LOG_OPENMETRICS_H
+#define OPENVPN_LOG_OPENMETRICS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <openvpn/common/count.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/common/objpool.hpp>
+#include <openvpn/error/error.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/latencyhist.hpp>
+
+namespace openvpn {
+  namespace OpenMetrics {
+
+    class Writer
+    {
+    public:
+      Writer(const std::string& prefix_arg = "openvpn_")
+	: prefix(prefix_arg)
+      {
+      }
+
+      // Start a metric family.  type is "counter", "gauge" or
+      // "histogram".  Samples of the family must follow.
+      void family(const std::string& name, const char *type, const char *help)
+      {
+	os << "# TYPE " << prefix << name << ' ' << type << '\n';
+	os << "# HELP " << prefix << name << ' ' << help << '\n';
+      }
+
+      // labels is empty or a rendered label set such as type="foo"
+      void sample(const std::string& name, const std::string& labels, const std::uint64_t value)
+      {
+	os << prefix << name;
+	if (!labels.empty())
+	  os << '{' << labels << '}';
+	os << ' ' << value << '\n';
+      }
+
+      // a value in ns, rendered in seconds
+      void sample_seconds(const std::string& name, const std::string& labels, const std::uint64_t ns)
+      {
+	os << prefix << name;
+	if (!labels.empty())
+	  os << '{' << labels << '}';
+	os << ' ' << seconds(ns) << '\n';
+      }
+
+      void counter(const std::string& name, const char *help, const std::uint64_t value)
+      {
+	family(name, "counter", help);
+	sample(name + "_total", "", value);
+      }
+
+      // Latency histogram in seconds, with a bucket boundary at each
+      // power of two nanoseconds from 1us up.  Cumulative counts are
+      // summed from one pass over the buckets, so they are
+      // consistent with _count even while samples are being added.
+      void histogram(const std::string& name, const std::string& labels, const LatencyHistogram& h)
+      {
+	const std::string sep = labels.empty() ? "" : ",";
+	std::uint64_t cum = 0;
+	for (unsigned int b = 0; b < LatencyHistogram::N_BUCKETS; ++b)
+	  {
+	    if (b % LatencyHistogram::SUB_COUNT == 0 && b >= MIN_BUCKET)
+	      bucket(name, labels + sep, LatencyHistogram::lower_bound(b), cum);
+	    cum += h.bucket_count(b);
+	  }
+	os << prefix << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cum << '\n';
+	os << prefix << name << "_count";
+	if (!labels.empty())
+	  os << '{' << labels << '}';
+	os << ' ' << cum << '\n';
+	os << prefix << name << "_sum";
+	if (!labels.empty())
+	  os << '{' << labels << '}';
+	os << ' ' << seconds(h.total_ns()) << '\n';
+      }
+
+      std::string str()
+      {
+	return os.str() + "# EOF\n";
+      }
+
+      static std::string label(const char *name, const std::string& value)
+      {
+	std::string ret = name;
+	ret += "=\"";
+	for (const char c : value)
+	  {
+	    if (c == '"' || c == '\\')
+	      ret += '\\';
+	    if (c == '\n')
+	      ret += "\\n";
+	    else
+	      ret += c;
+	  }
+	ret += '"';
+	return ret;
+      }
+
+    private:
+      enum {
+	// first bucket boundary rendered, 2^10 ns
+	MIN_BUCKET = (10 - LatencyHistogram::SUB_BITS + 1) * LatencyHistogram::SUB_COUNT,
+      };
+
+      // values below lower_bound ns
+      void bucket(const std::string& name, const std::string& labels, const std::uint64_t lower_bound, const std::uint64_t cum)
+      {
+	os << prefix << name << "_bucket{" << labels << "le=\"" << seconds(lower_bound) << "\"} " << cum << '\n';
+      }
+
+      static std::string seconds(const std::uint64_t ns)
+      {
+	std::ostringstream s;
+	s.precision(9);
+	s << double(ns) / 1e9;
+	return s.str();
+      }
+
+      const std::string prefix;
+      std::ostringstream os;
+    };
+
+    // SessionStats counters, error counts and (if enabled) latency
+    // histograms
+    inline void render(Writer& w, const SessionStats& stats)
+    {
+      const SessionStats::Snapshot snap = stats.snapshot();
+      for (size_t i = 0; i < SessionStats::N_STATS; ++i)
+	if (i < SessionStats::CPU_CRYPTO || i > SessionStats::CPU_HOUSEKEEPING)
+	  w.counter(string::to_lower_copy(SessionStats::stat_name(i)), SessionStats::stat_name(i), snap.stats[i]);
+
+      w.family("cpu_seconds", "counter", "CPU time by subsystem");
+      for (size_t i = SessionStats::CPU_CRYPTO; i <= SessionStats::CPU_HOUSEKEEPING; ++i)
+	w.sample_seconds("cpu_seconds_total", Writer::label("subsystem", SessionStats::stat_name(i) + 4), snap.stats[i]); // name without CPU_
+
+      w.family("errors", "counter", "errors by Error::Type");
+      for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	w.sample("errors_total", Writer::label("type", Error::name(i)), stats.error_count(i));
+
+      if (stats.latency_enabled())
+	{
+	  w.family("latency_seconds", "histogram", "data path and handshake latency");
+	  for (size_t i = 0; i < SessionStats::N_LATENCY; ++i)
+	    w.histogram("latency_seconds", Writer::label("path", SessionStats::latency_name(i)), *stats.latency(i));
+	}
+    }
+
+    // occupancy of the process-wide object pools
+    inline void render_pools(Writer& w)
+    {
+      const std::vector<ObjPool::Snapshot> pools = ObjPool::snapshot();
+      w.family("pool_objects", "gauge", "pooled objects by state");
+      for (const auto& p : pools)
+	{
+	  const std::string pool = Writer::label("pool", p.name);
+	  w.sample("pool_objects", pool + ",state=\"live\"", p.live);
+	  w.sample("pool_objects", pool + ",state=\"cached\"", p.cached);
+	}
+      w.family("pool_allocs", "counter", "pooled object allocations by source");
+      for (const auto& p : pools)
+	{
+	  const std::string pool = Writer::label("pool", p.name);
+	  w.sample("pool_allocs_total", pool + ",source=\"cache\"", p.reused);
+	  w.sample("pool_allocs_total", pool + ",source=\"heap\"", p.heap);
+	}
+    }
+  }
+}
+
+#endif
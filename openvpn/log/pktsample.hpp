@@ -0,0 +1,225 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Sampled capture of tunnel (inner) packets to a pcap file, cheap
+// enough to leave enabled at low rates.  A packet is captured if it
+// is the Nth packet since the last 1-in-N sample, or one of the first
+// K packets of its flow.  Flows are tracked in a fixed-size
+// direct-mapped table keyed on a direction-independent hash of the
+// 5-tuple, so a colliding flow may restart another flow's count.
+
+#ifndef OPENVPN_LOG_PKTSAMPLE_H
+#define OPENVPN_LOG_PKTSAMPLE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ipcommon.hpp>
+
+namespace openvpn {
+
+  class PacketSampler : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<PacketSampler> Ptr;
+
+    OPENVPN_EXCEPTION(packet_sampler_error);
+
+    struct Config
+    {
+      std::string fn;                 // pcap output file
+      unsigned int every = 0;         // capture 1 in N packets, 0 to disable
+      unsigned int flow_first = 0;    // capture first K packets of each flow, 0 to disable
+      unsigned int snaplen = 256;     // max bytes captured per packet
+    };
+
+    PacketSampler(const Config& config_arg)
+      : config(config_arg),
+	countdown(config_arg.every)
+    {
+      if (config.flow_first)
+	flows.reset(new Flow[N_FLOWS]());
+
+      out.open(config.fn, std::ios::binary | std::ios::trunc);
+      if (!out)
+	throw packet_sampler_error("cannot open " + config.fn);
+
+      // pcap global header, raw IP link type
+      const std::uint32_t hdr[6] = {
+	0xa1b2c3d4,
+	2 | (4 << 16), // version 2.4
+	0,             // thiszone
+	0,             // sigfigs
+	config.snaplen,
+	LINKTYPE_RAW,
+      };
+      out.write((const char *)hdr, sizeof(hdr));
+      out.flush();
+    }
+
+    bool enabled() const
+    {
+      return config.every || config.flow_first;
+    }
+
+    // Capture buf (an inner IP packet) if it is selected.
+    // Returns true if it was captured.
+    bool sample(const Buffer& buf)
+    {
+      if (!buf.size())
+	return false;
+
+      bool take = false;
+      if (config.every && --countdown == 0)
+	{
+	  countdown = config.every;
+	  take = true;
+	}
+      if (config.flow_first && !take)
+	take = flow_take(buf.c_data(), buf.size());
+      if (take)
+	write(buf);
+      return take;
+    }
+
+    // number of packets written
+    std::uint64_t n_captured() const
+    {
+      return captured;
+    }
+
+  private:
+    enum {
+      LINKTYPE_RAW = 101,
+      N_FLOWS = 1024, // must be a power of 2
+    };
+
+    struct Flow
+    {
+      std::uint64_t key;
+      std::uint32_t count;
+    };
+
+    bool flow_take(const unsigned char *p, const size_t len)
+    {
+      const std::uint64_t key = flow_key(p, len);
+      Flow& f = flows[key & (N_FLOWS - 1)];
+      if (f.key != key)
+	{
+	  f.key = key;
+	  f.count = 0;
+	}
+      if (f.count < config.flow_first)
+	{
+	  ++f.count;
+	  return true;
+	}
+      return false;
+    }
+
+    // Hash of the 5-tuple that is the same for both directions.
+    // Non-TCP/UDP packets hash on addresses and protocol only.
+    static std::uint64_t flow_key(const unsigned char *p, const size_t len)
+    {
+      size_t addr_off, addr_len, l4_off;
+      unsigned int proto;
+      switch (IPCommon::version(p[0]))
+	{
+	case IPCommon::IPv4:
+	  if (len < 20)
+	    return 0;
+	  addr_off = 12;
+	  addr_len = 4;
+	  l4_off = (p[0] & 0x0F) * 4;
+	  proto = p[9];
+	  break;
+	case IPCommon::IPv6:
+	  if (len < 40)
+	    return 0;
+	  addr_off = 8;
+	  addr_len = 16;
+	  l4_off = 40; // extension headers aren't followed
+	  proto = p[6];
+	  break;
+	default:
+	  return 0;
+	}
+
+      std::uint64_t src = hash(p + addr_off, addr_len);
+      std::uint64_t dst = hash(p + addr_off + addr_len, addr_len);
+      if ((proto == IPCommon::TCP || proto == IPCommon::UDP) && len >= l4_off + 4)
+	{
+	  src = mix(src ^ ((p[l4_off] << 8) | p[l4_off + 1]));
+	  dst = mix(dst ^ ((p[l4_off + 2] << 8) | p[l4_off + 3]));
+	}
+      return mix((src ^ dst) + proto);
+    }
+
+    static std::uint64_t hash(const unsigned char *p, const size_t len)
+    {
+      std::uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+      for (size_t i = 0; i < len; ++i)
+	h = (h ^ p[i]) * 0x100000001b3ULL;
+      return h;
+    }
+
+    static std::uint64_t mix(std::uint64_t h)
+    {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      return h;
+    }
+
+    void write(const Buffer& buf)
+    {
+      const auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+      const std::uint32_t incl = static_cast<std::uint32_t>(std::min(buf.size(), size_t(config.snaplen)));
+      const std::uint32_t rec[4] = {
+	static_cast<std::uint32_t>(now / 1000000),
+	static_cast<std::uint32_t>(now % 1000000),
+	incl,
+	static_cast<std::uint32_t>(buf.size()),
+      };
+      out.write((const char *)rec, sizeof(rec));
+      out.write((const char *)buf.c_data(), incl);
+      out.flush();
+      ++captured;
+    }
+
+    const Config config;
+    unsigned int countdown;
+    std::unique_ptr<Flow[]> flows;
+    std::ofstream out;
+    std::uint64_t captured = 0;
+  };
+
+}
+
+#endif
@@ -20,17 +20,33 @@
 //    If not, see <http://www.gnu.org/licenses/>.
 
 // A class that handles statistics tracking in an OpenVPN session
+//
+// The operating stats counters are sharded into cache-line sized
+// slots, so that the transport, tun and DCO threads of a session
+// don't contend on one cache line.  Up to N_SHARDS threads of the
+// process at a time own a slot, claimed on first use and released on
+// thread exit, and update it with plain relaxed loads and stores.
+// Any further threads share one extra slot and use an atomic add.
+// Readers sum the slots without locking.
 
 #ifndef OPENVPN_LOG_SESSIONSTATS_H
 #define OPENVPN_LOG_SESSIONSTATS_H
 
 #include <cstring>
+#include <cstdint>
+#include <memory>
+#include <atomic>
 
 #include <openvpn/common/size.hpp>
+#include <openvpn/common/alignedalloc.hpp>
 #include <openvpn/common/count.hpp>
+#include <openvpn/common/ffs.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/allocstat.hpp>
 #include <openvpn/error/error.hpp>
 #include <openvpn/time/time.hpp>
+#include <openvpn/time/cpustat.hpp>
+#include <openvpn/log/latencyhist.hpp>
 
 namespace openvpn {
 
@@ -49,17 +65,70 @@ namespace openvpn {
       TUN_BYTES_OUT,       // tun/tap bytes out
       TUN_PACKETS_IN,      // tun/tap packets in
       TUN_PACKETS_OUT,     // tun/tap packets out
+      COMPRESS_BYTES_SAVED, // bytes saved by data channel compression
+      COMPRESS_SKIPPED,    // packets sent uncompressed without trying, by adaptive mode or precheck
+      HANDSHAKES,          // SSL/TLS handshakes completed
+      HANDOFF_DROPS,       // packets dropped because a cross-thread handoff queue was full
+      SOCKET_RECV_DROPS,   // packets dropped by a full socket receive buffer
+      SOCKET_SEND_DROPS,   // packets not sent because of a full socket send buffer
+      RELAY_BYTES,         // bytes passed on by a TransportRelayForwarder
+      RELAY_PACKETS,       // packets passed on by a TransportRelayForwarder
+      RELAY_DROPS,         // packets a TransportRelayForwarder could not pass on
+
+      // heap allocations per phase, only counted with OPENVPN_ALLOC_STATS
+      // (see openvpn/common/allocstat.hpp)
+      ALLOCS_DATA_ENCRYPT,
+      ALLOCS_DATA_DECRYPT,
+      ALLOCS_TUN_READ,
+      ALLOCS_TUN_WRITE,
+      ALLOCS_TRANSPORT_READ,
+      ALLOCS_TRANSPORT_WRITE,
+      ALLOCS_CONTROL,
+
+      // CPU time in ns per subsystem, see CpuScope and
+      // openvpn/time/cpustat.hpp
+      CPU_CRYPTO,
+      CPU_COMPRESS,
+      CPU_HANDSHAKE,
+      CPU_TUN_IO,
+      CPU_TRANSPORT_IO,
+      CPU_HOUSEKEEPING,
       N_STATS,
     };
 
+    // opt-in latency histograms, see enable_latency()
+    enum Latency {
+      LAT_NET_TO_TUN = 0,  // network packet received -> written to tun
+      LAT_TUN_TO_NET,      // tun packet read -> handed to transport
+      LAT_HANDSHAKE,       // KeyContext created -> SSL handshake complete
+      N_LATENCY,
+    };
+
+    enum {
+      N_SHARDS = 8, // counter slots, each in its own cache line
+    };
+
+    // counter values summed over all slots
+    struct Snapshot
+    {
+      count_t stats[N_STATS];
+    };
+
     SessionStats()
-      : verbose_(false)
+      : verbose_(false),
+	shards_(new Shards())
     {
-      std::memset((void *)stats_, 0, sizeof(stats_));
+      for (auto& sh : shards_->shard)
+	for (auto& v : sh.stats)
+	  v.store(0, std::memory_order_relaxed);
     }
 
     virtual void error(const size_t type, const std::string* text=nullptr) {}
 
+    // Count of errors of the given Error::Type, for derived
+    // classes that keep them.  Must be safe to call from any thread.
+    virtual count_t error_count(const size_t type) const { return 0; }
+
     // if true, clients may provide additional detail to error() method above
     // via text argument.
     bool verbose() const { return verbose_; }
@@ -70,20 +139,30 @@ namespace openvpn {
     void inc_stat(const size_t type, const count_t value)
     {
       if (type < N_STATS)
-	stats_[type] += value;
+	add(type, value);
     }
 
     count_t get_stat(const size_t type) const
     {
       if (type < N_STATS)
-	return stats_[type];
+	return sum(type);
       else
 	return 0;
     }
 
     count_t get_stat_fast(const size_t type) const
     {
-      return stats_[type];
+      return sum(type);
+    }
+
+    // Each counter in the snapshot is a value it had at some point
+    // during the call, and never less than an earlier snapshot's.
+    Snapshot snapshot() const
+    {
+      Snapshot snap;
+      for (size_t i = 0; i < N_STATS; ++i)
+	snap.stats[i] = sum(i);
+      return snap;
     }
 
     static const char *stat_name(const size_t type)
@@ -97,6 +176,28 @@ namespace openvpn {
 	"TUN_BYTES_OUT",
 	"TUN_PACKETS_IN",
 	"TUN_PACKETS_OUT",
+	"COMPRESS_BYTES_SAVED",
+	"COMPRESS_SKIPPED",
+	"HANDSHAKES",
+	"HANDOFF_DROPS",
+	"SOCKET_RECV_DROPS",
+	"SOCKET_SEND_DROPS",
+	"RELAY_BYTES",
+	"RELAY_PACKETS",
+	"RELAY_DROPS",
+	"ALLOCS_DATA_ENCRYPT",
+	"ALLOCS_DATA_DECRYPT",
+	"ALLOCS_TUN_READ",
+	"ALLOCS_TUN_WRITE",
+	"ALLOCS_TRANSPORT_READ",
+	"ALLOCS_TRANSPORT_WRITE",
+	"ALLOCS_CONTROL",
+	"CPU_CRYPTO",
+	"CPU_COMPRESS",
+	"CPU_HANDSHAKE",
+	"CPU_TUN_IO",
+	"CPU_TRANSPORT_IO",
+	"CPU_HOUSEKEEPING",
       };
 
       if (type < N_STATS)
@@ -105,6 +206,64 @@ namespace openvpn {
 	return "UNKNOWN_STAT_TYPE";
     }
 
+    // Start recording latency histograms.  Must be called before
+    // the session starts, since recording is not synchronized with
+    // enabling.
+    void enable_latency()
+    {
+      if (!latency_)
+	latency_.reset(new LatencyHistogram[N_LATENCY]);
+    }
+
+    bool latency_enabled() const
+    {
+      return bool(latency_);
+    }
+
+    void record_latency(const size_t type, const std::uint64_t ns, const std::uint64_t n_samples = 1)
+    {
+      if (latency_ && type < N_LATENCY)
+	latency_[type].record(ns, n_samples);
+    }
+
+    // returns nullptr if latency histograms are disabled
+    const LatencyHistogram* latency(const size_t type) const
+    {
+      if (latency_ && type < N_LATENCY)
+	return &latency_[type];
+      else
+	return nullptr;
+    }
+
+    static const char *latency_name(const size_t type)
+    {
+      static const char *names[] = {
+	"NET_TO_TUN",
+	"TUN_TO_NET",
+	"HANDSHAKE",
+      };
+
+      if (type < N_LATENCY)
+	return names[type];
+      else
+	return "UNKNOWN_LATENCY_TYPE";
+    }
+
+    // Data channel path estimates from RTT probes (see RTTProbe):
+    // smoothed round trip time and jitter in microseconds, loss in
+    // 1/1000, each -1 until measured.  Set by the session thread,
+    // readable from any thread.
+    void update_rtt(const count_t srtt, const count_t jitter, const count_t loss_permille)
+    {
+      rtt_srtt_.store(srtt, std::memory_order_relaxed);
+      rtt_jitter_.store(jitter, std::memory_order_relaxed);
+      rtt_loss_.store(loss_permille, std::memory_order_relaxed);
+    }
+
+    count_t rtt() const { return rtt_srtt_.load(std::memory_order_relaxed); }
+    count_t rtt_jitter() const { return rtt_jitter_.load(std::memory_order_relaxed); }
+    count_t rtt_loss() const { return rtt_loss_.load(std::memory_order_relaxed); }
+
     void update_last_packet_received(const Time& now)
     {
       last_packet_received_ = now;
@@ -112,6 +271,63 @@ namespace openvpn {
 
     const Time& last_packet_received() const { return last_packet_received_; }
 
+    // Attribute heap allocations made during this object's lifetime
+    // to phase p, adding them to the matching ALLOCS_* counter of
+    // stats on destruction.  A no-op without OPENVPN_ALLOC_STATS.
+    class AllocScope
+    {
+    public:
+      AllocScope(SessionStats* stats_arg, const AllocStats::Phase p) noexcept
+#ifdef OPENVPN_ALLOC_STATS
+	: scope(p),
+	  stats(stats_arg),
+	  phase(p)
+#endif
+      {
+      }
+
+#ifdef OPENVPN_ALLOC_STATS
+      ~AllocScope()
+      {
+	const std::uint64_t n = scope.count();
+	if (n && stats)
+	  stats->inc_stat(ALLOCS_DATA_ENCRYPT + phase - AllocStats::DATA_ENCRYPT, n);
+      }
+
+    private:
+      AllocStats::Scope scope;
+      SessionStats* stats;
+      const AllocStats::Phase phase;
+#endif
+    };
+
+    // Attribute the CPU time of this object's lifetime, less that of
+    // nested scopes, to subsystem s, adding it to the matching CPU_*
+    // counter of stats on destruction.
+    class CpuScope
+    {
+    public:
+      CpuScope(SessionStats* stats_arg, const CpuStats::Subsystem s) noexcept
+#ifndef OPENVPN_NO_CPU_STATS
+	: scope(s),
+	  stats(stats_arg)
+#endif
+      {
+      }
+
+#ifndef OPENVPN_NO_CPU_STATS
+      ~CpuScope()
+      {
+	if (stats && scope.get_subsystem() != CpuStats::NONE)
+	  stats->add(CPU_CRYPTO + scope.get_subsystem() - CpuStats::CRYPTO, CpuStats::to_ns(scope.own_ticks()));
+      }
+
+    private:
+      CpuStats::Scope scope;
+      SessionStats* stats;
+#endif
+    };
+
     struct DCOTransportSource : public virtual RC<thread_unsafe_refcount>
     {
       typedef RCPtr<DCOTransportSource> Ptr;
@@ -156,8 +372,8 @@ namespace openvpn {
       if (dco_)
 	{
 	  const DCOTransportSource::Data data = dco_->dco_transport_stats_delta();
-	  stats_[BYTES_IN] += data.bytes_in;
-	  stats_[BYTES_OUT] += data.bytes_out;
+	  add(BYTES_IN, data.bytes_in);
+	  add(BYTES_OUT, data.bytes_out);
 	}
     }
 
@@ -165,10 +381,92 @@ namespace openvpn {
     void session_stats_set_verbose(const bool v) { verbose_ = v; }
 
   private:
+    struct Shard
+    {
+      std::atomic<count_t> stats[N_STATS];
+      unsigned char pad[CACHE_LINE_SIZE - sizeof(std::atomic<count_t>) * N_STATS % CACHE_LINE_SIZE];
+    };
+
+    static_assert(sizeof(Shard) % CACHE_LINE_SIZE == 0, "Shard must fill whole cache lines");
+
+    // owned slots, then the shared one
+    struct Shards : public AlignedNew<>
+    {
+      Shard shard[N_SHARDS + 1];
+    };
+
+    // Slot owned by the calling thread, or SHARED.  Slots are
+    // process-wide, so a thread owns the same slot in every
+    // SessionStats object.
+    class ShardOwner
+    {
+    public:
+      enum {
+	SHARED = N_SHARDS,
+      };
+
+      ShardOwner()
+      {
+	unsigned int mask = free_mask().load(std::memory_order_relaxed);
+	while (mask)
+	  {
+	    const unsigned int bit = mask & -mask;
+	    if (free_mask().compare_exchange_weak(mask, mask & ~bit, std::memory_order_acquire))
+	      {
+		index = find_first_set(bit) - 1;
+		return;
+	      }
+	  }
+      }
+
+      ~ShardOwner()
+      {
+	if (index != SHARED)
+	  free_mask().fetch_or(1u << index, std::memory_order_release);
+      }
+
+      int index = SHARED;
+
+    private:
+      static std::atomic<unsigned int>& free_mask()
+      {
+	static std::atomic<unsigned int> mask{(1u << N_SHARDS) - 1};
+	return mask;
+      }
+    };
+
+    static int shard_index()
+    {
+      thread_local const ShardOwner owner;
+      return owner.index;
+    }
+
+    void add(const size_t type, const count_t value)
+    {
+      const int index = shard_index();
+      std::atomic<count_t>& v = shards_->shard[index].stats[type];
+      if (index != ShardOwner::SHARED)
+	v.store(v.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); // single writer
+      else
+	v.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    count_t sum(const size_t type) const
+    {
+      count_t ret = 0;
+      for (const auto& sh : shards_->shard)
+	ret += sh.stats[type].load(std::memory_order_relaxed);
+      return ret;
+    }
+
     bool verbose_;
     Time last_packet_received_;
     DCOTransportSource::Ptr dco_;
-    volatile count_t stats_[N_STATS];
+    const std::unique_ptr<Shards> shards_;
+    std::unique_ptr<LatencyHistogram[]> latency_;
+    std::atomic<count_t> rtt_srtt_{-1};
+    std::atomic<count_t> rtt_jitter_{-1};
+    std::atomic<count_t> rtt_loss_{-1};
   };
 
 } // namespace openvpn
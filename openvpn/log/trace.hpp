@@ -0,0 +1,246 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Binary event tracing for the protocol state machine.
+//
+// OPENVPN_TRACE_EVENT() writes a fixed-size record with a nanosecond
+// timestamp into a ring owned by the calling thread, without locks or
+// formatting.  Each ring keeps the last RING_SIZE - 1 events.  The rings
+// can be dumped at any time as raw records or in the Chrome trace
+// event JSON format, which chrome://tracing and Perfetto can load.
+//
+// Tracing is compiled in only if OPENVPN_TRACE is defined, otherwise
+// OPENVPN_TRACE_EVENT() expands to nothing.
+
+#ifndef OPENVPN_LOG_TRACE_H
+#define OPENVPN_LOG_TRACE_H
+
+#ifdef OPENVPN_TRACE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <fstream>
+#include <algorithm>
+
+#include <openvpn/common/exception.hpp>
+
+#define OPENVPN_TRACE_EVENT(type, obj, id, a, b) \
+  openvpn::Trace::record(openvpn::Trace::type, obj, id, a, b)
+
+namespace openvpn {
+  namespace Trace {
+
+    enum Type : std::uint16_t {
+      KEY_STATE,         // a: old state, b: new state
+      KEY_EVENT,         // a: current event, b: next event
+      KEY_NEXT_EVENT,    // a: scheduled event that fired
+      RETRANSMIT,        // a: packet size
+      DATA_LIMIT,        // a: DataLimit::Mode, b: DataLimit::State
+      N_TYPES
+    };
+
+    inline const char *type_name(const unsigned int type)
+    {
+      static const char *names[] = {
+	"KEY_STATE",
+	"KEY_EVENT",
+	"KEY_NEXT_EVENT",
+	"RETRANSMIT",
+	"DATA_LIMIT",
+      };
+      static_assert(sizeof(names) / sizeof(names[0]) == N_TYPES, "trace type names");
+      return type < N_TYPES ? names[type] : "UNKNOWN";
+    }
+
+    struct Record
+    {
+      std::uint64_t ns;   // steady clock
+      std::uint64_t obj;  // object the event belongs to, e.g. ProtoContext
+      std::uint16_t type;
+      std::uint16_t id;   // e.g. key_id
+      std::uint32_t a;
+      std::uint32_t b;
+      std::uint32_t pad;
+    };
+    static_assert(sizeof(Record) == 32, "trace record size");
+
+    class Ring
+    {
+    public:
+      enum {
+	RING_SIZE = 4096, // must be a power of 2
+      };
+
+      Ring(const unsigned int tid_arg)
+	: tid(tid_arg)
+      {
+      }
+
+      void record(const Record& r)
+      {
+	// only the owning thread writes, the release store lets
+	// a dumping thread see complete records behind pos
+	const std::uint64_t p = pos.load(std::memory_order_relaxed);
+	recs[p & (RING_SIZE - 1)] = r;
+	pos.store(p + 1, std::memory_order_release);
+      }
+
+      // Copy out the retained records, oldest first.  The slot
+      // the writer may be filling next is not retained, and records
+      // overwritten during the copy are skipped.
+      std::vector<Record> snapshot() const
+      {
+	const std::uint64_t end = pos.load(std::memory_order_acquire);
+	const std::uint64_t begin = end > RING_SIZE - 1 ? end - (RING_SIZE - 1) : 0;
+	std::vector<Record> ret;
+	ret.reserve(end - begin);
+	for (std::uint64_t p = begin; p < end; ++p)
+	  ret.push_back(recs[p & (RING_SIZE - 1)]);
+	// the writer may be overwriting the slot of record now - RING_SIZE
+	const std::uint64_t now = pos.load(std::memory_order_acquire);
+	if (now + 1 > begin + RING_SIZE)
+	  ret.erase(ret.begin(), ret.begin() + std::min<std::uint64_t>(now + 1 - RING_SIZE - begin, ret.size()));
+	return ret;
+      }
+
+      const unsigned int tid;
+
+    private:
+      std::atomic<std::uint64_t> pos{0};
+      Record recs[RING_SIZE];
+    };
+
+    // All rings ever created, kept after their threads exit so
+    // that their events can still be dumped.
+    class Registry
+    {
+    public:
+      static Registry& instance()
+      {
+	static Registry reg;
+	return reg;
+      }
+
+      Ring* new_ring()
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	rings.emplace_back(new Ring(static_cast<unsigned int>(rings.size() + 1)));
+	return rings.back().get();
+      }
+
+      template <typename CALLBACK>
+      void for_each(CALLBACK cb) const
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const auto& r : rings)
+	  cb(*r);
+      }
+
+    private:
+      mutable std::mutex mutex;
+      std::vector<std::unique_ptr<Ring>> rings;
+    };
+
+    inline std::uint64_t now_ns()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline Ring* thread_ring()
+    {
+      static thread_local Ring* ring = nullptr;
+      if (!ring)
+	ring = Registry::instance().new_ring();
+      return ring;
+    }
+
+    inline void record(const Type type, const void *obj, const unsigned int id, const std::uint32_t a, const std::uint32_t b)
+    {
+      Record r;
+      r.ns = now_ns();
+      r.obj = reinterpret_cast<std::uintptr_t>(obj);
+      r.type = type;
+      r.id = static_cast<std::uint16_t>(id);
+      r.a = a;
+      r.b = b;
+      r.pad = 0;
+      thread_ring()->record(r);
+    }
+
+    // Raw dump: for each ring a 4-byte tid and 4-byte record
+    // count, followed by the records in host byte order.
+    inline void dump_binary(std::ostream& os)
+    {
+      Registry::instance().for_each([&os](const Ring& ring) {
+	const std::vector<Record> recs = ring.snapshot();
+	const std::uint32_t hdr[2] = { ring.tid, static_cast<std::uint32_t>(recs.size()) };
+	os.write(reinterpret_cast<const char *>(hdr), sizeof(hdr));
+	if (!recs.empty())
+	  os.write(reinterpret_cast<const char *>(recs.data()), recs.size() * sizeof(Record));
+      });
+    }
+
+    // Chrome trace event format, one instant event per record
+    inline void dump_chrome(std::ostream& os)
+    {
+      os << "{\"traceEvents\":[";
+      bool first = true;
+      Registry::instance().for_each([&os, &first](const Ring& ring) {
+	for (const auto& r : ring.snapshot())
+	  {
+	    if (!first)
+	      os << ',';
+	    first = false;
+	    os << "\n{\"name\":\"" << type_name(r.type)
+	       << "\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << ring.tid
+	       << ",\"ts\":" << r.ns / 1000 << '.' << char('0' + r.ns / 100 % 10) << char('0' + r.ns / 10 % 10) << char('0' + r.ns % 10)
+	       << ",\"args\":{\"obj\":\"0x" << std::hex << r.obj << std::dec
+	       << "\",\"id\":" << r.id << ",\"a\":" << r.a << ",\"b\":" << r.b << "}}";
+	  }
+      });
+      os << "\n]}\n";
+    }
+
+    OPENVPN_EXCEPTION(trace_error);
+
+    inline void dump_chrome_file(const std::string& fn)
+    {
+      std::ofstream ofs(fn);
+      if (!ofs)
+	throw trace_error("cannot open " + fn);
+      dump_chrome(ofs);
+    }
+  }
+}
+
+#else
+
+#define OPENVPN_TRACE_EVENT(type, obj, id, a, b) do {} while (0)
+
+#endif
+
+#endif
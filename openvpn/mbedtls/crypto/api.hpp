@@ -27,10 +27,31 @@
 #include <openvpn/mbedtls/crypto/digest.hpp>
 #include <openvpn/mbedtls/crypto/hmac.hpp>
 
+// Define OPENVPN_MBEDTLS_PSA to run the crypto layer through the
+// PSA Crypto API, which uses hardware accelerator drivers registered
+// with mbed TLS (requires MBEDTLS_PSA_CRYPTO_C).
+#ifdef OPENVPN_MBEDTLS_PSA
+#include <openvpn/mbedtls/crypto/psacipher.hpp>
+#include <openvpn/mbedtls/crypto/psagcm.hpp>
+#include <openvpn/mbedtls/crypto/psadigest.hpp>
+#include <openvpn/mbedtls/crypto/psahmac.hpp>
+#endif
+
 namespace openvpn {
 
   // type container for MbedTLS Crypto-level API
   struct MbedTLSCryptoAPI {
+#ifdef OPENVPN_MBEDTLS_PSA
+    // cipher
+    typedef MbedTLSCrypto::PSA::CipherContext CipherContext;
+    typedef MbedTLSCrypto::PSA::CipherContextGCM CipherContextGCM;
+
+    // digest
+    typedef MbedTLSCrypto::PSA::DigestContext DigestContext;
+
+    // HMAC
+    typedef MbedTLSCrypto::PSA::HMACContext HMACContext;
+#else
     // cipher
     typedef MbedTLSCrypto::CipherContext CipherContext;
     typedef MbedTLSCrypto::CipherContextGCM CipherContextGCM;
@@ -40,6 +61,7 @@ namespace openvpn {
 
     // HMAC
     typedef MbedTLSCrypto::HMACContext HMACContext;
+#endif
   };
 }
 
@@ -19,7 +19,7 @@
 //    along with this program in the COPYING file.
 //    If not, see <http://www.gnu.org/licenses/>.
 
-// Wrap the mbed TLS GCM API.
+// Wrap the mbed TLS GCM and ChaCha20-Poly1305 AEAD APIs.
 
 #ifndef OPENVPN_MBEDTLS_CRYPTO_CIPHERGCM_H
 #define OPENVPN_MBEDTLS_CRYPTO_CIPHERGCM_H
@@ -27,6 +27,9 @@
 #include <string>
 
 #include <mbedtls/gcm.h>
+#if defined(MBEDTLS_CHACHAPOLY_C)
+#include <mbedtls/chachapoly.h>
+#endif
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -56,6 +59,19 @@ namespace openvpn {
 	IV_LEN = 12,
 	AUTH_TAG_LEN = 16,
 	SUPPORTS_IN_PLACE_ENCRYPT = 1,
+	MAX_BATCH = 32, // max packets per encrypt_batch() call
+      };
+
+      // one packet of an encrypt_batch() call
+      struct Op
+      {
+	const unsigned char *input;
+	unsigned char *output;
+	size_t length;
+	const unsigned char *iv;
+	unsigned char *tag;
+	const unsigned char *ad;
+	size_t ad_len;
       };
 
 #if 0
@@ -80,6 +96,20 @@ namespace openvpn {
       {
 	erase();
 
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	if (alg == CryptoAlgs::CHACHA20_POLY1305)
+	  {
+	    if (keysize < 32)
+	      throw mbedtls_gcm_error("insufficient key material");
+	    mbedtls_chachapoly_init(&cpctx);
+	    if (mbedtls_chachapoly_setkey(&cpctx, key) < 0)
+	      throw mbedtls_gcm_error("mbedtls_chachapoly_setkey");
+	    chachapoly = true;
+	    initialized = true;
+	    return;
+	  }
+#endif
+
 	// get cipher type
 	unsigned int ckeysz = 0;
 	const mbedtls_cipher_id_t cid = cipher_type(alg, ckeysz);
@@ -103,6 +133,16 @@ namespace openvpn {
 		   size_t ad_len)
       {
 	check_initialized();
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	if (chachapoly)
+	  {
+	    const int status = mbedtls_chachapoly_encrypt_and_tag(&cpctx, length, iv, ad, ad_len,
+								  input, output, tag);
+	    if (unlikely(status))
+	      OPENVPN_THROW(mbedtls_gcm_error, "mbedtls_chachapoly_encrypt_and_tag failed with status=" << status);
+	    return;
+	  }
+#endif
 	const int status = mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT,
 						     length, iv, IV_LEN, ad, ad_len,
 						     input, output, AUTH_TAG_LEN, tag);
@@ -110,6 +150,14 @@ namespace openvpn {
 	  OPENVPN_THROW(mbedtls_gcm_error, "mbedtls_gcm_crypt_and_tag failed with status=" << status);
       }
 
+      // mbed TLS has no multi-buffer GCM, so packets are
+      // encrypted one after another
+      void encrypt_batch(const Op *ops, const size_t n)
+      {
+	for (size_t i = 0; i < n; ++i)
+	  encrypt(ops[i].input, ops[i].output, ops[i].length, ops[i].iv, ops[i].tag, ops[i].ad, ops[i].ad_len);
+      }
+
       // input and output may NOT be equal
       bool decrypt(const unsigned char *input,
 		  unsigned char *output,
@@ -120,6 +168,11 @@ namespace openvpn {
 		  size_t ad_len)
       {
 	check_initialized();
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	if (chachapoly)
+	  return mbedtls_chachapoly_auth_decrypt(&cpctx, length, iv, ad, ad_len, tag,
+						 input, output) == 0;
+#endif
 	const int status = mbedtls_gcm_auth_decrypt(&ctx, length, iv, IV_LEN, ad, ad_len, tag,
 						    AUTH_TAG_LEN, input, output);
 	return status == 0;
@@ -127,6 +180,23 @@ namespace openvpn {
 
       bool is_initialized() const { return initialized; }
 
+      // true if alg can be used with this mbed TLS build
+      static bool is_supported(const CryptoAlgs::Type alg)
+      {
+	switch (alg)
+	  {
+	  case CryptoAlgs::AES_128_GCM:
+	  case CryptoAlgs::AES_192_GCM:
+	  case CryptoAlgs::AES_256_GCM:
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	  case CryptoAlgs::CHACHA20_POLY1305:
+#endif
+	    return true;
+	  default:
+	    return false;
+	  }
+      }
+
     private:
       static mbedtls_cipher_id_t cipher_type(const CryptoAlgs::Type alg, unsigned int& keysize)
       {
@@ -150,6 +220,15 @@ namespace openvpn {
       {
 	if (initialized)
 	  {
+#if defined(MBEDTLS_CHACHAPOLY_C)
+	    if (chachapoly)
+	      {
+		mbedtls_chachapoly_free(&cpctx);
+		chachapoly = false;
+		initialized = false;
+		return;
+	      }
+#endif
 	    mbedtls_gcm_free(&ctx);
 	    initialized = false;
 	  }
@@ -163,6 +242,10 @@ namespace openvpn {
 
       bool initialized;
       mbedtls_gcm_context ctx;
+#if defined(MBEDTLS_CHACHAPOLY_C)
+      bool chachapoly = false;
+      mbedtls_chachapoly_context cpctx;
+#endif
     };
   }
 }
@@ -0,0 +1,109 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Common helpers for the mbed TLS PSA Crypto contexts in
+// psacipher.hpp, psagcm.hpp, psadigest.hpp and psahmac.hpp.  PSA
+// routes operations to the accelerator drivers registered with
+// mbed TLS, where the legacy mbedtls_* APIs always run in software.
+// Algorithms PSA doesn't support fall back to the legacy contexts.
+
+#ifndef OPENVPN_MBEDTLS_CRYPTO_PSA_H
+#define OPENVPN_MBEDTLS_CRYPTO_PSA_H
+
+#include <string>
+
+#include <psa/crypto.h>
+
+#include <openvpn/common/exception.hpp>
+
+namespace openvpn {
+  namespace MbedTLSCrypto {
+    namespace PSA {
+
+      OPENVPN_EXCEPTION(mbedtls_psa_error);
+
+      // psa_crypto_init() is idempotent and thread-safe once it has
+      // succeeded, so it is simply called before each key import
+      inline void init()
+      {
+	const psa_status_t status = psa_crypto_init();
+	if (status != PSA_SUCCESS)
+	  OPENVPN_THROW(mbedtls_psa_error, "psa_crypto_init failed with status=" << status);
+      }
+
+      // A volatile PSA key, destroyed with the object
+      class Key
+      {
+	Key(const Key&) = delete;
+	Key& operator=(const Key&) = delete;
+
+      public:
+	Key() {}
+
+	~Key() { reset(); }
+
+	// Returns false if PSA doesn't support the key type or
+	// algorithm, so that the caller can fall back to the
+	// legacy API, and throws on other errors.
+	bool import(const psa_key_type_t type,
+		    const psa_algorithm_t alg,
+		    const psa_key_usage_t usage,
+		    const unsigned char *key,
+		    const size_t key_size)
+	{
+	  reset();
+	  init();
+	  psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+	  psa_set_key_type(&attr, type);
+	  psa_set_key_algorithm(&attr, alg);
+	  psa_set_key_usage_flags(&attr, usage);
+	  psa_set_key_bits(&attr, key_size * 8);
+	  const psa_status_t status = psa_import_key(&attr, key, key_size, &id_);
+	  psa_reset_key_attributes(&attr);
+	  if (status == PSA_ERROR_NOT_SUPPORTED)
+	    return false;
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_error, "psa_import_key failed with status=" << status);
+	  defined_ = true;
+	  return true;
+	}
+
+	void reset()
+	{
+	  if (defined_)
+	    {
+	      psa_destroy_key(id_);
+	      defined_ = false;
+	    }
+	}
+
+	psa_key_id_t id() const { return id_; }
+
+      private:
+	psa_key_id_t id_ = 0;
+	bool defined_ = false;
+      };
+
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,193 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// CBC and CTR ciphers through the mbed TLS PSA Crypto cipher API,
+// falling back to the legacy context of cipher.hpp for ciphers PSA
+// doesn't support, such as Blowfish.
+
+#ifndef OPENVPN_MBEDTLS_CRYPTO_PSACIPHER_H
+#define OPENVPN_MBEDTLS_CRYPTO_PSACIPHER_H
+
+#include <openvpn/mbedtls/crypto/psa.hpp>
+#include <openvpn/mbedtls/crypto/cipher.hpp>
+
+namespace openvpn {
+  namespace MbedTLSCrypto {
+    namespace PSA {
+      class CipherContext
+      {
+	CipherContext(const CipherContext&) = delete;
+	CipherContext& operator=(const CipherContext&) = delete;
+
+	typedef MbedTLSCrypto::CipherContext Legacy;
+
+      public:
+	OPENVPN_SIMPLE_EXCEPTION(mbedtls_psa_cipher_mode_error);
+	OPENVPN_EXCEPTION(mbedtls_psa_cipher_error);
+
+	enum {
+	  MODE_UNDEF = Legacy::MODE_UNDEF,
+	  ENCRYPT = Legacy::ENCRYPT,
+	  DECRYPT = Legacy::DECRYPT
+	};
+
+	enum {
+	  MAX_IV_LENGTH = Legacy::MAX_IV_LENGTH,
+	  CIPH_CBC_MODE = Legacy::CIPH_CBC_MODE
+	};
+
+	CipherContext() {}
+
+	~CipherContext() { erase(); }
+
+	void init(const CryptoAlgs::Type alg, const unsigned char *key, const int mode)
+	{
+	  erase();
+	  if (!(mode == ENCRYPT || mode == DECRYPT))
+	    throw mbedtls_psa_cipher_mode_error();
+
+	  psa_key_type_t type;
+	  if (cipher_type(alg, type, palg, cmode)
+	      && psa_key.import(type, palg, mode == ENCRYPT ? PSA_KEY_USAGE_ENCRYPT : PSA_KEY_USAGE_DECRYPT,
+				key, CryptoAlgs::key_length(alg)))
+	    {
+	      encrypt = (mode == ENCRYPT);
+	      iv_len = CryptoAlgs::iv_length(alg);
+	      block = CryptoAlgs::block_size(alg);
+	      psa = true;
+	      return;
+	    }
+	  legacy.init(alg, key, mode);
+	}
+
+	void reset(const unsigned char *iv)
+	{
+	  if (!psa)
+	    return legacy.reset(iv);
+	  psa_cipher_abort(&op);
+	  psa_status_t status = encrypt
+	    ? psa_cipher_encrypt_setup(&op, psa_key.id(), palg)
+	    : psa_cipher_decrypt_setup(&op, psa_key.id(), palg);
+	  if (status == PSA_SUCCESS)
+	    status = psa_cipher_set_iv(&op, iv, iv_len);
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_cipher_error, "PSA cipher setup failed with status=" << status);
+	}
+
+	bool update(unsigned char *out, const size_t max_out_size,
+		    const unsigned char *in, const size_t in_size,
+		    size_t& out_acc)
+	{
+	  if (!psa)
+	    return legacy.update(out, max_out_size, in, in_size, out_acc);
+	  size_t outlen = 0;
+	  if (psa_cipher_update(&op, in, in_size, out, max_out_size, &outlen) != PSA_SUCCESS)
+	    return false;
+	  out_acc += outlen;
+	  return true;
+	}
+
+	bool final(unsigned char *out, const size_t max_out_size, size_t& out_acc)
+	{
+	  if (!psa)
+	    return legacy.final(out, max_out_size, out_acc);
+	  size_t outlen = 0;
+	  if (psa_cipher_finish(&op, out, max_out_size, &outlen) != PSA_SUCCESS)
+	    return false;
+	  out_acc += outlen;
+	  return true;
+	}
+
+	bool is_initialized() const { return psa || legacy.is_initialized(); }
+
+	size_t iv_length() const
+	{
+	  return psa ? iv_len : legacy.iv_length();
+	}
+
+	size_t block_size() const
+	{
+	  return psa ? block : legacy.block_size();
+	}
+
+	// return cipher mode (such as CIPH_CBC_MODE, etc.)
+	int cipher_mode() const
+	{
+	  return psa ? cmode : legacy.cipher_mode();
+	}
+
+      private:
+	// returns false if PSA has no such algorithm
+	static bool cipher_type(const CryptoAlgs::Type alg,
+				psa_key_type_t& type,
+				psa_algorithm_t& palg,
+				int& cmode)
+	{
+	  switch (alg)
+	    {
+	    case CryptoAlgs::AES_128_CBC:
+	    case CryptoAlgs::AES_192_CBC:
+	    case CryptoAlgs::AES_256_CBC:
+	      type = PSA_KEY_TYPE_AES;
+	      palg = PSA_ALG_CBC_PKCS7;
+	      cmode = MBEDTLS_MODE_CBC;
+	      return true;
+	    case CryptoAlgs::AES_256_CTR:
+	      type = PSA_KEY_TYPE_AES;
+	      palg = PSA_ALG_CTR;
+	      cmode = MBEDTLS_MODE_CTR;
+	      return true;
+	    case CryptoAlgs::DES_CBC:
+	    case CryptoAlgs::DES_EDE3_CBC:
+	      type = PSA_KEY_TYPE_DES;
+	      palg = PSA_ALG_CBC_PKCS7;
+	      cmode = MBEDTLS_MODE_CBC;
+	      return true;
+	    default:
+	      return false;
+	    }
+	}
+
+	void erase()
+	{
+	  if (psa)
+	    {
+	      psa_cipher_abort(&op);
+	      psa_key.reset();
+	      psa = false;
+	    }
+	}
+
+	bool psa = false;
+	bool encrypt = false;
+	int cmode = 0;
+	size_t iv_len = 0;
+	size_t block = 0;
+	psa_algorithm_t palg = 0;
+	psa_cipher_operation_t op = PSA_CIPHER_OPERATION_INIT;
+	Key psa_key;
+	Legacy legacy;
+      };
+    }
+  }
+}
+
+#endif
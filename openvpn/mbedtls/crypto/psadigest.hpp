@@ -0,0 +1,156 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Message digests through the mbed TLS PSA Crypto hash API, falling
+// back to the legacy context of digest.hpp for digests PSA doesn't
+// support, such as MD4.
+
+#ifndef OPENVPN_MBEDTLS_CRYPTO_PSADIGEST_H
+#define OPENVPN_MBEDTLS_CRYPTO_PSADIGEST_H
+
+#include <openvpn/mbedtls/crypto/psa.hpp>
+#include <openvpn/mbedtls/crypto/digest.hpp>
+
+namespace openvpn {
+  namespace MbedTLSCrypto {
+    namespace PSA {
+      class HMACContext;
+
+      class DigestContext
+      {
+	DigestContext(const DigestContext&) = delete;
+	DigestContext& operator=(const DigestContext&) = delete;
+
+	typedef MbedTLSCrypto::DigestContext Legacy;
+
+      public:
+	friend class HMACContext;
+
+	OPENVPN_EXCEPTION(mbedtls_psa_digest_error);
+
+	enum {
+	  MAX_DIGEST_SIZE = Legacy::MAX_DIGEST_SIZE
+	};
+
+	DigestContext() {}
+
+	DigestContext(const CryptoAlgs::Type alg)
+	{
+	  init(alg);
+	}
+
+	~DigestContext() { erase(); }
+
+	void init(const CryptoAlgs::Type alg)
+	{
+	  erase();
+	  psa_algorithm_t palg;
+	  if (digest_type(alg, palg))
+	    {
+	      PSA::init();
+	      const psa_status_t status = psa_hash_setup(&op, palg);
+	      if (status == PSA_SUCCESS)
+		{
+		  size_ = PSA_HASH_LENGTH(palg);
+		  psa = true;
+		  return;
+		}
+	      if (status != PSA_ERROR_NOT_SUPPORTED)
+		OPENVPN_THROW(mbedtls_psa_digest_error, "psa_hash_setup failed with status=" << status);
+	    }
+	  legacy.init(alg);
+	}
+
+	void update(const unsigned char *in, const size_t size)
+	{
+	  if (!psa)
+	    return legacy.update(in, size);
+	  const psa_status_t status = psa_hash_update(&op, in, size);
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_digest_error, "psa_hash_update failed with status=" << status);
+	}
+
+	size_t final(unsigned char *out)
+	{
+	  if (!psa)
+	    return legacy.final(out);
+	  size_t len = 0;
+	  const psa_status_t status = psa_hash_finish(&op, out, MAX_DIGEST_SIZE, &len);
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_digest_error, "psa_hash_finish failed with status=" << status);
+	  return len;
+	}
+
+	size_t size() const
+	{
+	  return psa ? size_ : legacy.size();
+	}
+
+	bool is_initialized() const { return psa || legacy.is_initialized(); }
+
+      private:
+	// returns false if PSA has no such algorithm
+	static bool digest_type(const CryptoAlgs::Type alg, psa_algorithm_t& palg)
+	{
+	  switch (alg)
+	    {
+	    case CryptoAlgs::MD5:
+	      palg = PSA_ALG_MD5;
+	      return true;
+	    case CryptoAlgs::SHA1:
+	      palg = PSA_ALG_SHA_1;
+	      return true;
+	    case CryptoAlgs::SHA224:
+	      palg = PSA_ALG_SHA_224;
+	      return true;
+	    case CryptoAlgs::SHA256:
+	      palg = PSA_ALG_SHA_256;
+	      return true;
+	    case CryptoAlgs::SHA384:
+	      palg = PSA_ALG_SHA_384;
+	      return true;
+	    case CryptoAlgs::SHA512:
+	      palg = PSA_ALG_SHA_512;
+	      return true;
+	    default:
+	      return false;
+	    }
+	}
+
+	void erase()
+	{
+	  if (psa)
+	    {
+	      psa_hash_abort(&op);
+	      psa = false;
+	    }
+	}
+
+	bool psa = false;
+	size_t size_ = 0;
+	psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+	Legacy legacy;
+      };
+    }
+  }
+}
+
+#endif
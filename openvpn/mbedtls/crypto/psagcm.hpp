@@ -0,0 +1,219 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// AES-GCM and ChaCha20-Poly1305 through the mbed TLS PSA Crypto AEAD
+// API, falling back to the legacy context of ciphergcm.hpp if PSA
+// doesn't support the cipher.  The multi-part API is used since the
+// auth tag precedes the ciphertext in OpenVPN packets, while the
+// one-shot PSA calls append it.
+
+#ifndef OPENVPN_MBEDTLS_CRYPTO_PSAGCM_H
+#define OPENVPN_MBEDTLS_CRYPTO_PSAGCM_H
+
+#include <openvpn/common/likely.hpp>
+#include <openvpn/mbedtls/crypto/psa.hpp>
+#include <openvpn/mbedtls/crypto/ciphergcm.hpp>
+
+namespace openvpn {
+  namespace MbedTLSCrypto {
+    namespace PSA {
+      class CipherContextGCM
+      {
+	CipherContextGCM(const CipherContextGCM&) = delete;
+	CipherContextGCM& operator=(const CipherContextGCM&) = delete;
+
+	typedef MbedTLSCrypto::CipherContextGCM Legacy;
+
+      public:
+	OPENVPN_EXCEPTION(mbedtls_psa_gcm_error);
+
+	enum {
+	  MODE_UNDEF = Legacy::MODE_UNDEF,
+	  ENCRYPT = Legacy::ENCRYPT,
+	  DECRYPT = Legacy::DECRYPT
+	};
+
+	enum {
+	  IV_LEN = Legacy::IV_LEN,
+	  AUTH_TAG_LEN = Legacy::AUTH_TAG_LEN,
+	  SUPPORTS_IN_PLACE_ENCRYPT = 1,
+	  MAX_BATCH = Legacy::MAX_BATCH,
+	};
+
+	typedef Legacy::Op Op;
+
+	CipherContextGCM() {}
+
+	void init(const CryptoAlgs::Type alg,
+		  const unsigned char *key,
+		  const unsigned int keysize,
+		  const int mode)
+	{
+	  psa = false;
+	  psa_key_type_t type;
+	  unsigned int ckeysz;
+	  if (cipher_type(alg, type, psa_alg, ckeysz))
+	    {
+	      if (ckeysz > keysize)
+		throw mbedtls_psa_gcm_error("insufficient key material");
+	      psa = psa_key.import(type, psa_alg, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT, key, ckeysz);
+	    }
+	  if (psa)
+	    initialized = true;
+	  else
+	    {
+	      psa_key.reset();
+	      legacy.init(alg, key, keysize, mode);
+	      initialized = true;
+	    }
+	}
+
+	void encrypt(const unsigned char *input,
+		     unsigned char *output,
+		     size_t length,
+		     const unsigned char *iv,
+		     unsigned char *tag,
+		     const unsigned char *ad,
+		     size_t ad_len)
+	{
+	  check_initialized();
+	  if (!psa)
+	    {
+	      legacy.encrypt(input, output, length, iv, tag, ad, ad_len);
+	      return;
+	    }
+
+	  psa_aead_operation_t op = PSA_AEAD_OPERATION_INIT;
+	  size_t out_len = 0;
+	  size_t fin_len = 0;
+	  size_t tag_len = 0;
+	  psa_status_t status = psa_aead_encrypt_setup(&op, psa_key.id(), psa_alg);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_set_lengths(&op, ad_len, length);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_set_nonce(&op, iv, IV_LEN);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_update_ad(&op, ad, ad_len);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_update(&op, input, length, output, length, &out_len);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_finish(&op, output + out_len, length - out_len, &fin_len,
+				     tag, AUTH_TAG_LEN, &tag_len);
+	  if (unlikely(status != PSA_SUCCESS || out_len + fin_len != length || tag_len != AUTH_TAG_LEN))
+	    {
+	      psa_aead_abort(&op);
+	      OPENVPN_THROW(mbedtls_psa_gcm_error, "PSA AEAD encrypt failed with status=" << status);
+	    }
+	}
+
+	void encrypt_batch(const Op *ops, const size_t n)
+	{
+	  for (size_t i = 0; i < n; ++i)
+	    encrypt(ops[i].input, ops[i].output, ops[i].length, ops[i].iv, ops[i].tag, ops[i].ad, ops[i].ad_len);
+	}
+
+	bool decrypt(const unsigned char *input,
+		     unsigned char *output,
+		     size_t length,
+		     const unsigned char *iv,
+		     const unsigned char *tag,
+		     const unsigned char *ad,
+		     size_t ad_len)
+	{
+	  check_initialized();
+	  if (!psa)
+	    return legacy.decrypt(input, output, length, iv, tag, ad, ad_len);
+
+	  psa_aead_operation_t op = PSA_AEAD_OPERATION_INIT;
+	  size_t out_len = 0;
+	  size_t fin_len = 0;
+	  psa_status_t status = psa_aead_decrypt_setup(&op, psa_key.id(), psa_alg);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_set_lengths(&op, ad_len, length);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_set_nonce(&op, iv, IV_LEN);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_update_ad(&op, ad, ad_len);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_update(&op, input, length, output, length, &out_len);
+	  if (likely(status == PSA_SUCCESS))
+	    status = psa_aead_verify(&op, output + out_len, length - out_len, &fin_len,
+				     tag, AUTH_TAG_LEN);
+	  if (status != PSA_SUCCESS)
+	    {
+	      psa_aead_abort(&op);
+	      return false;
+	    }
+	  return out_len + fin_len == length;
+	}
+
+	bool is_initialized() const { return initialized; }
+
+      private:
+	// returns false if PSA has no such algorithm
+	static bool cipher_type(const CryptoAlgs::Type alg,
+				psa_key_type_t& type,
+				psa_algorithm_t& palg,
+				unsigned int& keysize)
+	{
+	  switch (alg)
+	    {
+	    case CryptoAlgs::AES_128_GCM:
+	      keysize = 16;
+	      break;
+	    case CryptoAlgs::AES_192_GCM:
+	      keysize = 24;
+	      break;
+	    case CryptoAlgs::AES_256_GCM:
+	      keysize = 32;
+	      break;
+#if defined(PSA_WANT_ALG_CHACHA20_POLY1305)
+	    case CryptoAlgs::CHACHA20_POLY1305:
+	      type = PSA_KEY_TYPE_CHACHA20;
+	      palg = PSA_ALG_CHACHA20_POLY1305;
+	      keysize = 32;
+	      return true;
+#endif
+	    default:
+	      return false;
+	    }
+	  type = PSA_KEY_TYPE_AES;
+	  palg = PSA_ALG_GCM;
+	  return true;
+	}
+
+	void check_initialized() const
+	{
+	  if (unlikely(!initialized))
+	    throw mbedtls_psa_gcm_error("uninitialized");
+	}
+
+	bool initialized = false;
+	bool psa = false;
+	psa_algorithm_t psa_alg = 0;
+	Key psa_key;
+	Legacy legacy;
+      };
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,135 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// HMAC through the mbed TLS PSA Crypto MAC API, falling back to the
+// legacy context of hmac.hpp for digests PSA doesn't support.
+
+#ifndef OPENVPN_MBEDTLS_CRYPTO_PSAHMAC_H
+#define OPENVPN_MBEDTLS_CRYPTO_PSAHMAC_H
+
+#include <openvpn/mbedtls/crypto/psa.hpp>
+#include <openvpn/mbedtls/crypto/psadigest.hpp>
+#include <openvpn/mbedtls/crypto/hmac.hpp>
+
+namespace openvpn {
+  namespace MbedTLSCrypto {
+    namespace PSA {
+      class HMACContext
+      {
+	HMACContext(const HMACContext&) = delete;
+	HMACContext& operator=(const HMACContext&) = delete;
+
+	typedef MbedTLSCrypto::HMACContext Legacy;
+
+      public:
+	OPENVPN_EXCEPTION(mbedtls_psa_hmac_error);
+
+	enum {
+	  MAX_HMAC_SIZE = Legacy::MAX_HMAC_SIZE
+	};
+
+	HMACContext() {}
+
+	HMACContext(const CryptoAlgs::Type digest, const unsigned char *key, const size_t key_size)
+	{
+	  init(digest, key, key_size);
+	}
+
+	~HMACContext() { erase(); }
+
+	void init(const CryptoAlgs::Type digest, const unsigned char *key, const size_t key_size)
+	{
+	  erase();
+	  psa_algorithm_t halg;
+	  if (DigestContext::digest_type(digest, halg))
+	    {
+	      alg = PSA_ALG_HMAC(halg);
+	      if (psa_key.import(PSA_KEY_TYPE_HMAC, alg, PSA_KEY_USAGE_SIGN_MESSAGE, key, key_size))
+		{
+		  size_ = PSA_HASH_LENGTH(halg);
+		  psa = true;
+		  reset();
+		  return;
+		}
+	    }
+	  legacy.init(digest, key, key_size);
+	}
+
+	void reset()
+	{
+	  if (!psa)
+	    return legacy.reset();
+	  psa_mac_abort(&op);
+	  const psa_status_t status = psa_mac_sign_setup(&op, psa_key.id(), alg);
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_hmac_error, "psa_mac_sign_setup failed with status=" << status);
+	}
+
+	void update(const unsigned char *in, const size_t size)
+	{
+	  if (!psa)
+	    return legacy.update(in, size);
+	  const psa_status_t status = psa_mac_update(&op, in, size);
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_hmac_error, "psa_mac_update failed with status=" << status);
+	}
+
+	size_t final(unsigned char *out)
+	{
+	  if (!psa)
+	    return legacy.final(out);
+	  size_t len = 0;
+	  const psa_status_t status = psa_mac_sign_finish(&op, out, MAX_HMAC_SIZE, &len);
+	  if (status != PSA_SUCCESS)
+	    OPENVPN_THROW(mbedtls_psa_hmac_error, "psa_mac_sign_finish failed with status=" << status);
+	  return len;
+	}
+
+	size_t size() const
+	{
+	  return psa ? size_ : legacy.size();
+	}
+
+	bool is_initialized() const { return psa || legacy.is_initialized(); }
+
+      private:
+	void erase()
+	{
+	  if (psa)
+	    {
+	      psa_mac_abort(&op);
+	      psa_key.reset();
+	      psa = false;
+	    }
+	}
+
+	bool psa = false;
+	size_t size_ = 0;
+	psa_algorithm_t alg = 0;
+	psa_mac_operation_t op = PSA_MAC_OPERATION_INIT;
+	Key psa_key;
+	Legacy legacy;
+      };
+    }
+  }
+}
+
+#endif
@@ -43,6 +43,7 @@
 #include <openvpn/common/base64.hpp>
 #include <openvpn/common/binprefix.hpp>
 #include <openvpn/common/string.hpp>
+#include <openvpn/common/objpool.hpp>
 #include <openvpn/frame/memq_stream.hpp>
 #include <openvpn/pki/cclist.hpp>
 #include <openvpn/pki/pkcs1.hpp>
@@ -58,6 +59,13 @@
 #include <openvpn/mbedtls/pki/pkctx.hpp>
 #include <openvpn/mbedtls/util/error.hpp>
 
+// the extended export keys callback, which also provides the
+// randoms and PRF type, first appeared in mbed TLS 2.18
+#if defined(MBEDTLS_SSL_EXPORT_KEYS) && MBEDTLS_VERSION_NUMBER >= 0x02120000
+#define OPENVPN_MBEDTLS_EKM
+#include <mbedtls/platform_util.h>
+#endif
+
 // An SSL Context is essentially a configuration that can be used
 // to generate an arbitrary number of actual SSL connections objects.
 
@@ -635,7 +643,7 @@ namespace openvpn {
 
     // Represents an actual SSL session.
     // Normally instantiated by MbedTLSContext::ssl().
-    class SSL : public SSLAPI
+    class SSL : public SSLAPI, public PoolAllocated<SSL, 128>
     {
       // read/write callback errors
       enum {
@@ -649,6 +657,11 @@ namespace openvpn {
     public:
       typedef RCPtr<SSL> Ptr;
 
+      static const char *pool_name()
+      {
+	return "ssl";
+      }
+
       virtual void start_handshake() override
       {
 	mbedtls_ssl_handshake(ssl);
@@ -741,6 +754,25 @@ namespace openvpn {
 	return false; // fixme -- not implemented
       }
 
+      virtual bool export_keying_material(const std::string& label, unsigned char *dest, const size_t size) override
+      {
+#ifdef OPENVPN_MBEDTLS_EKM
+	if (!ekm.defined || ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER)
+	  return false;
+	return mbedtls_ssl_tls_prf(ekm.prf_type, ekm.master_secret, sizeof(ekm.master_secret),
+				   label.c_str(), ekm.randoms, sizeof(ekm.randoms),
+				   dest, size) == 0;
+#else
+	return false;
+#endif
+      }
+
+      virtual void compact() override
+      {
+	ct_in.compact();
+	ct_out.compact();
+      }
+
       virtual const AuthCert::Ptr& auth_cert() const override
       {
 	return authcert;
@@ -934,6 +966,11 @@ namespace openvpn {
 	  if (c.ssl_debug_level)
 	    mbedtls_ssl_conf_dbg(sslconf, dbg_callback, ctx);
 
+#ifdef OPENVPN_MBEDTLS_EKM
+	  // keep the master secret for export_keying_material()
+	  mbedtls_ssl_conf_export_keys_ext_cb(sslconf, export_keys_callback, this);
+#endif
+
 	  /* OpenVPN 2.x disables cbc_record_splitting by default, therefore
 	   * we have to do the same here to keep compatibility.
 	   * If not disabled, this setting will trigger bad behaviours on
@@ -993,6 +1030,27 @@ namespace openvpn {
 	return self->rng->rand_bytes_noexcept(data, len) ? 0 : -1; // using -1 as a general-purpose mbed TLS error code
       }
 
+#ifdef OPENVPN_MBEDTLS_EKM
+      static int export_keys_callback(void *arg,
+				      const unsigned char *ms,
+				      const unsigned char *kb,
+				      size_t maclen,
+				      size_t keylen,
+				      size_t ivlen,
+				      const unsigned char client_random[32],
+				      const unsigned char server_random[32],
+				      mbedtls_tls_prf_types tls_prf_type)
+      {
+	SSL *self = (SSL *)arg;
+	std::memcpy(self->ekm.master_secret, ms, sizeof(self->ekm.master_secret));
+	std::memcpy(self->ekm.randoms, client_random, 32);
+	std::memcpy(self->ekm.randoms + 32, server_random, 32);
+	self->ekm.prf_type = tls_prf_type;
+	self->ekm.defined = true;
+	return 0;
+      }
+#endif
+
       static void dbg_callback(void *arg, int level, const char *filename, int linenum, const char *text)
       {
 	MbedTLSContext *self = (MbedTLSContext *)arg;
@@ -1006,6 +1064,9 @@ namespace openvpn {
 	ssl = nullptr;
 	sslconf = nullptr;
 	overflow = false;
+#ifdef OPENVPN_MBEDTLS_EKM
+	ekm.defined = false;
+#endif
       }
 
       void erase()
@@ -1017,6 +1078,9 @@ namespace openvpn {
 	    delete ssl;
 	    delete sslconf;
 	  }
+#ifdef OPENVPN_MBEDTLS_EKM
+	mbedtls_platform_zeroize(&ekm, sizeof(ekm));
+#endif
 	clear();
       }
 
@@ -1027,6 +1091,14 @@ namespace openvpn {
       MemQStream ct_out;                  // read ciphertext from here
       AuthCert::Ptr authcert;
       bool overflow;
+#ifdef OPENVPN_MBEDTLS_EKM
+      struct {
+	unsigned char master_secret[48];
+	unsigned char randoms[64];        // client random, then server random
+	mbedtls_tls_prf_types prf_type;
+	bool defined;
+      } ekm;
+#endif
     };
 
     /////// start of main class implementation
@@ -1048,6 +1120,15 @@ namespace openvpn {
       return config->mode;
     }
 
+    virtual bool keying_material_exporter() const override
+    {
+#ifdef OPENVPN_MBEDTLS_EKM
+      return true;
+#else
+      return false;
+#endif
+    }
+
     virtual ~MbedTLSContext()
     {
       erase();
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -87,6 +88,7 @@ namespace openvpn {
       stop_called = true;
 
       asio_work.reset();
+      stream_timer.cancel();
 
       // close acceptor
       if (acceptor)
@@ -119,13 +121,19 @@ namespace openvpn {
       }
     };
 
+    // Command history with a fixed memory footprint: lines are
+    // copied into a preallocated circular byte buffer, and the
+    // oldest lines are evicted when either max_lines or max_bytes
+    // would be exceeded.
     class History
     {
     public:
       History(const std::string& type_arg,
-	      const size_t max_size_arg)
+	      const size_t max_lines,
+	      const size_t max_bytes)
 	: type(type_arg),
-	  max_size(max_size_arg)
+	  lines(max_lines),
+	  data(max_bytes)
       {
       }
 
@@ -144,14 +152,14 @@ namespace openvpn {
 	      real_time = true;
 	      std::string ret = real_time_status();
 	      if (arg2 == "all")
-		ret += show(hist.size());
+		ret += show(n_lines);
 	      else if (!arg2.empty())
 		return error();
 	      return ret;
 	    }
 	  else if (arg1 == "all")
 	    {
-	      return show(hist.size());
+	      return show(n_lines);
 	    }
 	  else if (arg1 == "off")
 	    {
@@ -179,26 +187,71 @@ namespace openvpn {
 
       std::string notify(const std::string& msg)
       {
-	hist.push_front(msg);
-	while (hist.size() > max_size)
-	  hist.pop_back();
+	add(msg);
 	if (real_time)
 	  return notify_prefix() + msg;
 	else
 	  return std::string();
       }
 
-    private:
+      // Add msg to history.  A line longer than max_bytes is
+      // truncated, keeping its trailing CRLF.
+      void add(const std::string& msg)
+      {
+	if (lines.empty() || data.empty())
+	  return;
+	const size_t len = std::min(msg.length(), data.size());
+	while (n_lines && (n_lines == lines.size() || n_bytes + len > data.size()))
+	  {
+	    n_bytes -= lines[first].len;
+	    first = (first + 1) % lines.size();
+	    --n_lines;
+	  }
+
+	Line& l = lines[(first + n_lines) % lines.size()];
+	l.off = end;
+	l.len = len;
+	copy_in(msg.c_str(), len);
+	if (len < msg.length() && len >= 2)
+	  {
+	    data[(l.off + len - 2) % data.size()] = '\r';
+	    data[(l.off + len - 1) % data.size()] = '\n';
+	  }
+	n_bytes += len;
+	++n_lines;
+      }
+
+      // show last n lines, oldest first
       std::string show(size_t n) const
       {
-	std::string ret = "";
-	n = std::min(n, hist.size());
-	for (size_t i = 0; i < n; ++i)
-	  ret += hist[n - i - 1];
+	std::string ret;
+	n = std::min(n, n_lines);
+	for (size_t i = n_lines - n; i < n_lines; ++i)
+	  {
+	    const Line& l = lines[(first + i) % lines.size()];
+	    const size_t part = std::min(l.len, data.size() - l.off);
+	    ret.append(data.data() + l.off, part);
+	    ret.append(data.data(), l.len - part);
+	  }
 	ret += "END\r\n";
 	return ret;
       }
 
+    private:
+      struct Line
+      {
+	size_t off = 0;
+	size_t len = 0;
+      };
+
+      void copy_in(const char *src, const size_t len)
+      {
+	const size_t part = std::min(len, data.size() - end);
+	std::memcpy(data.data() + end, src, part);
+	std::memcpy(data.data(), src + part, len - part);
+	end = (end + len) % data.size();
+      }
+
       std::string notify_prefix() const
       {
 	return ">" + string::to_upper_copy(type) + ":";
@@ -221,14 +274,22 @@ namespace openvpn {
       }
 
       std::string type;
-      size_t max_size;
       bool real_time = false;
-      std::deque<std::string> hist;
+      std::vector<Line> lines; // ring of line descriptors
+      std::vector<char> data;  // ring of line bytes
+      size_t first = 0;        // index of oldest line
+      size_t n_lines = 0;
+      size_t n_bytes = 0;
+      size_t end = 0;          // offset in data where the next line goes
     };
 
+    // name/value pairs reported by the stats stream
+    typedef std::vector<std::pair<std::string, long long>> StreamStats;
+
     OMICore(openvpn_io::io_context& io_context_arg)
       : io_context(io_context_arg),
-	stop_timer(io_context_arg)
+	stop_timer(io_context_arg),
+	stream_timer(io_context_arg)
     {
     }
 
@@ -338,8 +399,7 @@ namespace openvpn {
       if (!is_sock_open())
 	return;
       content_out.push_back(std::move(buf));
-      if (content_out_throttle)
-	content_out_throttle->size_change(content_out.size());
+      content_out_size_change();
       if (content_out.size() == 1) // send operation not currently active?
 	queue_send();
     }
@@ -391,7 +451,10 @@ namespace openvpn {
     void state_line(const std::string& line)
     {
       if (!stop_called)
-	send(hist_state.notify(line));
+	{
+	  send(hist_state.notify(line));
+	  stream_state(line);
+	}
     }
 
     void echo_line(const std::string& line)
@@ -431,6 +494,11 @@ namespace openvpn {
     {
     }
 
+    // called on each stats stream tick to collect the stats to report
+    virtual void omi_stream_stats(StreamStats& stats)
+    {
+    }
+
     openvpn_io::io_context& io_context;
 
   private:
@@ -548,6 +616,11 @@ namespace openvpn {
 		  process_signal_cmd(cmd->option);
 		  return false;
 		}
+	      if (arg0 == "stream")
+		{
+		  process_stream_cmd(cmd->option);
+		  return false;
+		}
 	      break;
 	    }
 	  }
@@ -625,6 +698,121 @@ namespace openvpn {
       send("SUCCESS: bytecount interval changed\r\n");
     }
 
+    // stream on [n] : every n seconds (default 1), send a
+    //                 >STREAM:{"type":"stats",...} line, and send a
+    //                 >STREAM:{"type":"state",...} line on each
+    //                 state change.
+    // stream off      : stop streaming
+    //
+    // Stats lines are skipped while the output queue is backed up,
+    // and the next one sent reports how many were skipped.
+    void process_stream_cmd(const Option& o)
+    {
+      try {
+	const std::string arg1 = o.get(1, 16);
+	if (arg1 == "on")
+	  {
+	    stream_interval = o.get_num<decltype(stream_interval)>(2, 1, 1, 86400);
+	    stream_enabled = true;
+	    stream_skipped = 0;
+	    schedule_stream_timer();
+	    send("SUCCESS: stream interval set to " + openvpn::to_string(stream_interval) + "\r\n");
+	    return;
+	  }
+	else if (arg1 == "off")
+	  {
+	    stream_stop();
+	    send("SUCCESS: stream off\r\n");
+	    return;
+	  }
+      }
+      catch (const option_error&)
+	{
+	}
+      send("ERROR: stream parameter must be 'on [n]' or 'off'\r\n");
+    }
+
+    void stream_stop()
+    {
+      stream_enabled = false;
+      stream_timer.cancel();
+    }
+
+    void schedule_stream_timer()
+    {
+      stream_timer.expires_after(Time::Duration::seconds(stream_interval));
+      stream_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+			      {
+				if (!error && self->stream_enabled && !self->stop_called)
+				  self->stream_stats();
+			      });
+    }
+
+    void stream_stats()
+    {
+      if (stream_ready())
+	{
+	  StreamStats stats;
+	  omi_stream_stats(stats);
+	  std::string out = ">STREAM:{\"type\":\"stats\",\"time\":" + openvpn::to_string(::time(NULL));
+	  if (stream_skipped)
+	    out += ",\"skipped\":" + openvpn::to_string(stream_skipped);
+	  for (const auto& s : stats)
+	    out += ",\"" + json_escape(s.first) + "\":" + openvpn::to_string(s.second);
+	  out += "}\r\n";
+	  send(out);
+	  stream_skipped = 0;
+	}
+      else
+	++stream_skipped;
+      schedule_stream_timer();
+    }
+
+    // state changes are infrequent, so they are sent even
+    // when the output queue is backed up
+    void stream_state(const std::string& line)
+    {
+      if (stream_enabled)
+	send(">STREAM:{\"type\":\"state\",\"time\":" + openvpn::to_string(::time(NULL))
+	     + ",\"state\":\"" + json_escape(string::trim_crlf_copy(line)) + "\"}\r\n");
+    }
+
+    bool stream_ready() const
+    {
+      return stream_throttle.ready() && send_ready();
+    }
+
+    static std::string json_escape(const std::string& str)
+    {
+      std::string ret;
+      ret.reserve(str.length());
+      for (const char c : str)
+	{
+	  if (c == '"' || c == '\\')
+	    {
+	      ret += '\\';
+	      ret += c;
+	    }
+	  else if ((unsigned char)c < 0x20)
+	    {
+	      static const char hex[] = "0123456789abcdef";
+	      ret += "\\u00";
+	      ret += hex[(c >> 4) & 0xF];
+	      ret += hex[c & 0xF];
+	    }
+	  else
+	    ret += c;
+	}
+      return ret;
+    }
+
+    void content_out_size_change()
+    {
+      if (content_out_throttle)
+	content_out_throttle->size_change(content_out.size());
+      stream_throttle.size_change(content_out.size());
+    }
+
     void process_signal_cmd(const Option& o)
     {
       const std::string type = o.get(1, 16);
@@ -680,9 +868,9 @@ namespace openvpn {
       if (is_open)
 	socket->close();
       content_out.clear();
-      if (content_out_throttle)
-	content_out_throttle->size_change(content_out.size());
+      content_out_size_change();
       in_partial.clear();
+      stream_stop();
       if (is_open)
 	omi_done(eof);
     }
@@ -1009,8 +1197,7 @@ namespace openvpn {
       if (bytes_sent == buf->size())
 	{
 	  content_out.pop_front();
-	  if (content_out_throttle)
-	    content_out_throttle->size_change(content_out.size());
+	  content_out_size_change();
 	}
       else if (bytes_sent < buf->size())
 	buf->advance(bytes_sent);
@@ -1054,13 +1241,24 @@ namespace openvpn {
     // bandwidth stats
     unsigned int bytecount = 0;
 
+    // stats/state stream
+    enum {
+      STREAM_LOW_WATER = 16,  // content_out buffers
+      STREAM_HIGH_WATER = 64,
+    };
+    bool stream_enabled = false;
+    unsigned int stream_interval = 1;
+    unsigned int stream_skipped = 0;
+    AsioTimerSafe stream_timer;
+
     // histories
-    History hist_log   {"log",   100};
-    History hist_state {"state", 100};
-    History hist_echo  {"echo",  100};
+    History hist_log   {"log",   100, 32768};
+    History hist_state {"state", 100, 16384};
+    History hist_echo  {"echo",  100, 16384};
 
     // throttling
     std::unique_ptr<BufferThrottle> content_out_throttle;
+    BufferThrottle stream_throttle{STREAM_LOW_WATER, STREAM_HIGH_WATER};
 
 #if defined(OPENVPN_PLATFORM_WIN)
     Win::ScopedHANDLE log_handle;
@@ -554,6 +554,19 @@ private:
     schedule_bytecount_timer();
   }
 
+  virtual void omi_stream_stats(StreamStats& stats) override
+  {
+    if (client)
+      {
+	const ClientAPI::TransportStats ts = client->transport_stats();
+	stats.emplace_back("bytes_in", ts.bytesIn);
+	stats.emplace_back("bytes_out", ts.bytesOut);
+	stats.emplace_back("packets_in", ts.packetsIn);
+	stats.emplace_back("packets_out", ts.packetsOut);
+	stats.emplace_back("last_packet_received", ts.lastPacketReceived);
+      }
+  }
+
   void start_connection_thread()
   {
     try {
@@ -29,6 +29,7 @@
 #include <openssl/rsa.h>
 #include <openssl/dsa.h>
 #include <openssl/hmac.h>
+#include <openssl/x509.h>
 
 // make sure type 94 doesn't collide with anything in bio.h
 // Start with the same number as before
@@ -306,8 +307,31 @@ inline void RSA_get0_key(const RSA *rsa, const BIGNUM **n, const BIGNUM **e, con
     *d = rsa->d;
 }
 
+inline const ASN1_INTEGER *X509_REVOKED_get0_serialNumber(const X509_REVOKED *x)
+{
+  return x->serialNumber;
+}
+
+inline X509 *X509_STORE_CTX_get0_cert(X509_STORE_CTX *ctx)
+{
+  return ctx->cert;
+}
+
+inline const ASN1_TIME *X509_get0_notAfter(const X509 *x)
+{
+  return x->cert_info->validity->notAfter;
+}
+
+inline const ASN1_TIME *X509_get0_notBefore(const X509 *x)
+{
+  return x->cert_info->validity->notBefore;
+}
+
 /* Renamed in OpenSSL 1.1 */
 #define X509_get0_pubkey X509_get_pubkey
+#define X509_CRL_get0_lastUpdate X509_CRL_get_lastUpdate
+#define X509_CRL_get0_nextUpdate X509_CRL_get_nextUpdate
+#define ASN1_STRING_get0_data ASN1_STRING_data
 #define RSA_F_RSA_OSSL_PRIVATE_ENCRYPT RSA_F_RSA_EAY_PRIVATE_ENCRYPT
 
 /*
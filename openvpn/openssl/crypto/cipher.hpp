@@ -36,6 +36,8 @@
 #include <openvpn/crypto/cryptoalgs.hpp>
 #include <openvpn/openssl/util/error.hpp>
 #include <openvpn/openssl/compat.hpp>
+#include <openvpn/openssl/crypto/fetch.hpp>
+#include <openvpn/openssl/crypto/ctxpool.hpp>
 
 namespace openvpn {
   namespace OpenSSLCrypto {
@@ -75,11 +77,13 @@ namespace openvpn {
 	if (!(mode == ENCRYPT || mode == DECRYPT))
 	  throw openssl_cipher_mode_error();
 	erase();
-	ctx = EVP_CIPHER_CTX_new ();
-	EVP_CIPHER_CTX_reset (ctx);
-	if (!EVP_CipherInit_ex (ctx, cipher_type(alg), nullptr, key, nullptr, mode))
+	const EVP_CIPHER *ciph = cipher_type(alg);
+	bool reuse;
+	ctx = CipherCtxPool::get(ciph, reuse);
+	if (!EVP_CipherInit_ex (ctx, reuse ? nullptr : ciph, nullptr, key, nullptr, mode))
 	  {
 	    openssl_clear_error_stack();
+	    EVP_CIPHER_CTX_free (ctx);
 	    throw openssl_cipher_error("EVP_CipherInit_ex (init)");
 	  }
 	initialized = true;
@@ -152,6 +156,11 @@ namespace openvpn {
 
     private:
       static const EVP_CIPHER *cipher_type(const CryptoAlgs::Type alg)
+      {
+	return Fetch::cipher(alg, legacy_cipher_type(alg));
+      }
+
+      static const EVP_CIPHER *legacy_cipher_type(const CryptoAlgs::Type alg)
       {
 	switch (alg)
 	  {
@@ -178,7 +187,7 @@ namespace openvpn {
       {
 	if (initialized)
 	  {
-	    EVP_CIPHER_CTX_free (ctx);
+	    CipherCtxPool::put (ctx);
 	    initialized = false;
 	  }
       }
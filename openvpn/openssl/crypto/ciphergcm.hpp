@@ -19,7 +19,7 @@
 //    along with this program in the COPYING file.
 //    If not, see <http://www.gnu.org/licenses/>.
 
-// Wrap the OpenSSL GCM API.
+// Wrap the OpenSSL GCM and ChaCha20-Poly1305 AEAD APIs.
 
 #ifndef OPENVPN_OPENSSL_CRYPTO_CIPHERGCM_H
 #define OPENVPN_OPENSSL_CRYPTO_CIPHERGCM_H
@@ -28,6 +28,10 @@
 
 #include <openssl/objects.h>
 #include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -35,6 +39,8 @@
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/cryptoalgs.hpp>
 #include <openvpn/openssl/util/error.hpp>
+#include <openvpn/openssl/crypto/fetch.hpp>
+#include <openvpn/openssl/crypto/ctxpool.hpp>
 
 namespace openvpn {
   namespace OpenSSLCrypto {
@@ -57,7 +63,20 @@ namespace openvpn {
       enum {
 	IV_LEN = 12,
 	AUTH_TAG_LEN = 16,
-	SUPPORTS_IN_PLACE_ENCRYPT = 0,
+	SUPPORTS_IN_PLACE_ENCRYPT = 1,
+	MAX_BATCH = 32, // max packets per encrypt_batch() call
+      };
+
+      // one packet of an encrypt_batch() call
+      struct Op
+      {
+	const unsigned char *input;
+	unsigned char *output;
+	size_t length;
+	const unsigned char *iv;
+	unsigned char *tag;
+	const unsigned char *ad;
+	size_t ad_len;
       };
 
       CipherContextGCM()
@@ -67,42 +86,47 @@ namespace openvpn {
 
       ~CipherContextGCM() { erase() ; }
 
+      // ciph_arg, if given, is used instead of the default
+      // implementation of alg, e.g. one fetched from a specific
+      // provider (see provider.hpp)
       void init(const CryptoAlgs::Type alg,
 		const unsigned char *key,
 		const unsigned int keysize,
-		const int mode)
+		const int mode,
+		const EVP_CIPHER *ciph_arg = nullptr)
       {
 	erase();
 	unsigned int ckeysz = 0;
 	const EVP_CIPHER *ciph = cipher_type(alg, ckeysz);
+	if (ciph_arg)
+	  ciph = ciph_arg;
 	if (ckeysz > keysize)
 	  throw openssl_gcm_error("insufficient key material");
-	ctx = EVP_CIPHER_CTX_new();
-	EVP_CIPHER_CTX_reset(ctx);
-	switch (mode)
-	  {
-	  case ENCRYPT:
-	    if (!EVP_EncryptInit_ex(ctx, ciph, nullptr, key, nullptr))
-	      {
-		openssl_clear_error_stack();
-		throw openssl_gcm_error("EVP_EncryptInit_ex (init)");
-	      }
-	    break;
-	  case DECRYPT:
-	    if (!EVP_DecryptInit_ex(ctx, ciph, nullptr, key, nullptr))
-	      {
-		openssl_clear_error_stack();
-		throw openssl_gcm_error("EVP_DecryptInit_ex (init)");
-	      }
-	    break;
-	  default:
-	    throw openssl_gcm_error("bad mode");
+	if (mode != ENCRYPT && mode != DECRYPT)
+	  throw openssl_gcm_error("bad mode");
+	bool reuse;
+	ctx = CipherCtxPool::get(ciph, reuse);
+	if (!EVP_CipherInit_ex(ctx, reuse ? nullptr : ciph, nullptr, key, nullptr, mode == ENCRYPT))
+	  {
+	    openssl_clear_error_stack();
+	    EVP_CIPHER_CTX_free(ctx);
+	    throw openssl_gcm_error(mode == ENCRYPT ? "EVP_EncryptInit_ex (init)" : "EVP_DecryptInit_ex (init)");
 	  }
 	if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, IV_LEN, nullptr) != 1)
 	  {
 	    openssl_clear_error_stack();
+	    EVP_CIPHER_CTX_free(ctx);
 	    throw openssl_gcm_error("EVP_CIPHER_CTX_ctrl set IV len");
 	  }
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+	// A pipelined init takes the key every time, so keep a copy
+	// if the provider can pipeline this cipher.
+	if (mode == ENCRYPT && EVP_CIPHER_can_pipeline(ciph, 1))
+	  {
+	    pipe_cipher = ciph;
+	    pipe_key.init(key, ckeysz, BufferAllocated::DESTRUCT_ZERO);
+	  }
+#endif
 	initialized = true;
       }
 
@@ -151,6 +175,25 @@ namespace openvpn {
 	  }
       }
 
+      // Encrypt up to MAX_BATCH independent packets.  If the provider
+      // can pipeline the cipher (OpenSSL 3.5 and later), the packets
+      // are handed over in a single pipelined operation, which lets
+      // a multi-buffer implementation interleave them.  Otherwise
+      // they are encrypted one after another.
+      void encrypt_batch(const Op *ops, const size_t n)
+      {
+	check_initialized();
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+	if (pipe_cipher && n > 1)
+	  {
+	    encrypt_pipeline(ops, n);
+	    return;
+	  }
+#endif
+	for (size_t i = 0; i < n; ++i)
+	  encrypt(ops[i].input, ops[i].output, ops[i].length, ops[i].iv, ops[i].tag, ops[i].ad, ops[i].ad_len);
+      }
+
       bool decrypt(const unsigned char *input,
 		  unsigned char *output,
 		  size_t length,
@@ -199,9 +242,29 @@ namespace openvpn {
 
       bool is_initialized() const { return initialized; }
 
+      // true if alg can be used with this OpenSSL build and provider
+      static bool is_supported(const CryptoAlgs::Type alg)
+      {
+	unsigned int keysize = 0;
+	try {
+	  return cipher_type(alg, keysize) != nullptr;
+	}
+	catch (const std::exception&)
+	  {
+	    openssl_clear_error_stack();
+	    return false;
+	  }
+      }
+
     private:
       static const EVP_CIPHER *cipher_type(const CryptoAlgs::Type alg,
 					   unsigned int& keysize)
+      {
+	return Fetch::cipher(alg, legacy_cipher_type(alg, keysize));
+      }
+
+      static const EVP_CIPHER *legacy_cipher_type(const CryptoAlgs::Type alg,
+						  unsigned int& keysize)
       {
 	switch (alg)
 	  {
@@ -214,18 +277,111 @@ namespace openvpn {
 	  case CryptoAlgs::AES_256_GCM:
 	    keysize = 32;
 	    return EVP_aes_256_gcm();
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+	  case CryptoAlgs::CHACHA20_POLY1305:
+	    keysize = 32;
+	    return EVP_chacha20_poly1305();
+#endif
 	  default:
 	    OPENVPN_THROW(openssl_gcm_error, CryptoAlgs::name(alg) << ": not usable");
 	  }
       }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+      void encrypt_pipeline(const Op *ops, const size_t n)
+      {
+	if (n > MAX_BATCH)
+	  throw openssl_gcm_error("batch too large");
+	if (!pctx)
+	  pctx = EVP_CIPHER_CTX_new();
+
+	const unsigned char *iv[MAX_BATCH];
+	const unsigned char *in[MAX_BATCH];
+	unsigned char *out[MAX_BATCH];
+	unsigned char *tag[MAX_BATCH];
+	size_t inl[MAX_BATCH];
+	size_t outl[MAX_BATCH];
+	size_t outsize[MAX_BATCH];
+
+	for (size_t i = 0; i < n; ++i)
+	  iv[i] = ops[i].iv;
+	if (!EVP_CipherPipelineEncryptInit(pctx, pipe_cipher, pipe_key.c_data(), pipe_key.size(), n, iv, IV_LEN))
+	  {
+	    openssl_clear_error_stack();
+	    throw openssl_gcm_error("EVP_CipherPipelineEncryptInit");
+	  }
+
+	// AD, passed with null output buffers
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    in[i] = ops[i].ad;
+	    inl[i] = ops[i].ad_len;
+	    outsize[i] = 0;
+	  }
+	if (!EVP_CipherPipelineUpdate(pctx, nullptr, outl, outsize, in, inl))
+	  {
+	    openssl_clear_error_stack();
+	    throw openssl_gcm_error("EVP_CipherPipelineUpdate AD");
+	  }
+
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    in[i] = ops[i].input;
+	    inl[i] = ops[i].length;
+	    out[i] = ops[i].output;
+	    outsize[i] = ops[i].length;
+	  }
+	if (!EVP_CipherPipelineUpdate(pctx, out, outl, outsize, in, inl))
+	  {
+	    openssl_clear_error_stack();
+	    throw openssl_gcm_error("EVP_CipherPipelineUpdate data");
+	  }
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    out[i] += outl[i];
+	    outsize[i] -= outl[i];
+	    inl[i] = outl[i];
+	  }
+	if (!EVP_CipherPipelineFinal(pctx, out, outl, outsize))
+	  {
+	    openssl_clear_error_stack();
+	    throw openssl_gcm_error("EVP_CipherPipelineFinal");
+	  }
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    if (inl[i] + outl[i] != ops[i].length)
+	      throw openssl_gcm_error("pipelined encrypt size inconsistency");
+	    tag[i] = ops[i].tag;
+	  }
+
+	unsigned char **tags = tag;
+	OSSL_PARAM params[2];
+	params[0] = OSSL_PARAM_construct_octet_ptr(OSSL_CIPHER_PARAM_PIPELINE_AEAD_TAG, (void **)&tags, AUTH_TAG_LEN);
+	params[1] = OSSL_PARAM_construct_end();
+	if (!EVP_CIPHER_CTX_get_params(pctx, params))
+	  {
+	    openssl_clear_error_stack();
+	    throw openssl_gcm_error("EVP_CIPHER_CTX_get_params pipeline tags");
+	  }
+      }
+#endif
+
       void erase()
       {
 	if (initialized)
 	  {
-	    EVP_CIPHER_CTX_free(ctx);
+	    CipherCtxPool::put(ctx);
 	    initialized = false;
 	  }
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+	if (pctx)
+	  {
+	    EVP_CIPHER_CTX_free(pctx);
+	    pctx = nullptr;
+	  }
+	pipe_cipher = nullptr;
+	pipe_key.clear();
+#endif
       }
 
       void check_initialized() const
@@ -238,6 +394,11 @@ namespace openvpn {
 
       bool initialized;
       EVP_CIPHER_CTX *ctx;
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L
+      const EVP_CIPHER *pipe_cipher = nullptr;
+      BufferAllocated pipe_key;
+      EVP_CIPHER_CTX *pctx = nullptr;
+#endif
     };
   }
 }
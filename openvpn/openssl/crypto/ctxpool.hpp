@@ -0,0 +1,112 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-thread free list of EVP_CIPHER_CTX objects.
+//
+// Every rekey builds a new data channel crypto instance, so without
+// recycling each key_id costs a free and a new of the cipher contexts
+// plus, with OpenSSL 3, of the provider state behind them.  Released
+// contexts keep their cipher loaded, so that a context taken for the
+// same cipher again only needs a key-only init, which overwrites the
+// previous key schedule.  Overwriting it already on release would cost
+// as much as the init saves, so a pooled context holds a retired key
+// until it is reused or freed (EVP_CIPHER_CTX_free() cleanses it).
+// At most MAX_FREE contexts are kept per thread.
+
+#ifndef OPENVPN_OPENSSL_CRYPTO_CTXPOOL_H
+#define OPENVPN_OPENSSL_CRYPTO_CTXPOOL_H
+
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include <openvpn/openssl/compat.hpp>
+
+namespace openvpn {
+  namespace OpenSSLCrypto {
+    class CipherCtxPool
+    {
+    public:
+      enum {
+	MAX_FREE = 64, // contexts kept per thread
+      };
+
+      // Return a context for ciph.  If reuse is set on return, the
+      // context already has ciph loaded and should be initialized
+      // with a null cipher, which keeps its provider state.
+      static EVP_CIPHER_CTX *get(const EVP_CIPHER *ciph, bool& reuse)
+      {
+	std::vector<EVP_CIPHER_CTX *>& fl = free_list().ctxs;
+	reuse = false;
+	for (size_t i = fl.size(); i-- > 0; )
+	  {
+	    if (EVP_CIPHER_CTX_cipher(fl[i]) == ciph)
+	      {
+		EVP_CIPHER_CTX *ctx = fl[i];
+		fl[i] = fl.back();
+		fl.pop_back();
+		reuse = true;
+		return ctx;
+	      }
+	  }
+	if (!fl.empty())
+	  {
+	    EVP_CIPHER_CTX *ctx = fl.back();
+	    fl.pop_back();
+	    EVP_CIPHER_CTX_reset(ctx);
+	    return ctx;
+	  }
+	return EVP_CIPHER_CTX_new();
+      }
+
+      // Give back a context, which may have been taken on
+      // another thread.
+      static void put(EVP_CIPHER_CTX *ctx)
+      {
+	std::vector<EVP_CIPHER_CTX *>& fl = free_list().ctxs;
+	if (fl.size() < MAX_FREE && EVP_CIPHER_CTX_cipher(ctx))
+	  fl.push_back(ctx);
+	else
+	  EVP_CIPHER_CTX_free(ctx);
+      }
+
+    private:
+      struct FreeList
+      {
+	~FreeList()
+	{
+	  for (auto ctx : ctxs)
+	    EVP_CIPHER_CTX_free(ctx);
+	}
+
+	std::vector<EVP_CIPHER_CTX *> ctxs;
+      };
+
+      static FreeList& free_list()
+      {
+	static thread_local FreeList fl;
+	return fl;
+      }
+    };
+  }
+}
+
+#endif
@@ -40,6 +40,7 @@
 #include <openvpn/openssl/util/error.hpp>
 
 #include <openvpn/openssl/compat.hpp>
+#include <openvpn/openssl/crypto/fetch.hpp>
 
 namespace openvpn {
   namespace OpenSSLCrypto {
@@ -117,6 +118,11 @@ namespace openvpn {
 
     private:
       static const EVP_MD *digest_type(const CryptoAlgs::Type alg)
+      {
+	return Fetch::digest(alg, legacy_digest_type(alg));
+      }
+
+      static const EVP_MD *legacy_digest_type(const CryptoAlgs::Type alg)
       {
 	switch (alg)
 	  {
@@ -0,0 +1,122 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Process-wide cache of cipher and digest implementations.
+//
+// With OpenSSL 3, passing a legacy EVP_CIPHER/EVP_MD such as
+// EVP_aes_256_gcm() to an init function does an implicit fetch from
+// the provider store on every call, which takes a global lock.  Here
+// each algorithm is fetched once, on first use, and the fetched
+// object is shared by all contexts for the life of the process.
+// Algorithms that can't be fetched (e.g. from an unloaded legacy
+// provider) fall back to the legacy object.  With older OpenSSL the
+// legacy objects are returned as is.
+//
+// Engine setup that InitProcess deferred runs here, before the first
+// algorithm is looked up (see OpenSSLEngineInit).
+
+#ifndef OPENVPN_OPENSSL_CRYPTO_FETCH_H
+#define OPENVPN_OPENSSL_CRYPTO_FETCH_H
+
+#include <atomic>
+
+#include <openssl/evp.h>
+
+#include <openvpn/crypto/cryptoalgs.hpp>
+#include <openvpn/openssl/util/error.hpp>
+#include <openvpn/openssl/util/engine.hpp>
+
+namespace openvpn {
+  namespace OpenSSLCrypto {
+    namespace Fetch {
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+      template <typename T, T* (*FETCH)(OSSL_LIB_CTX*, const char*, const char*), void (*FREE)(T*)>
+      class Cache
+      {
+      public:
+	const T* get(const CryptoAlgs::Type alg, const T* legacy, const char *name)
+	{
+	  if (alg >= CryptoAlgs::SIZE)
+	    return legacy;
+	  const T* ret = cache[alg].load(std::memory_order_acquire);
+	  if (ret)
+	    return ret;
+
+	  OpenSSLEngineInit::ensure();
+	  T* fetched = FETCH(nullptr, name, nullptr);
+	  if (fetched)
+	    ret = fetched;
+	  else
+	    {
+	      openssl_clear_error_stack();
+	      ret = legacy;
+	    }
+
+	  // another thread may have beaten us to it
+	  const T* expected = nullptr;
+	  if (!cache[alg].compare_exchange_strong(expected, ret, std::memory_order_acq_rel))
+	    {
+	      if (fetched)
+		FREE(fetched);
+	      return expected;
+	    }
+	  return ret;
+	}
+
+      private:
+	std::atomic<const T*> cache[CryptoAlgs::SIZE];
+      };
+
+      inline const EVP_CIPHER* cipher(const CryptoAlgs::Type alg, const EVP_CIPHER* legacy)
+      {
+	static Cache<EVP_CIPHER, EVP_CIPHER_fetch, EVP_CIPHER_free> cache;
+	return cache.get(alg, legacy, EVP_CIPHER_get0_name(legacy));
+      }
+
+      inline const EVP_MD* digest(const CryptoAlgs::Type alg, const EVP_MD* legacy)
+      {
+	static Cache<EVP_MD, EVP_MD_fetch, EVP_MD_free> cache;
+	return cache.get(alg, legacy, EVP_MD_get0_name(legacy));
+      }
+
+#else
+
+      inline const EVP_CIPHER* cipher(const CryptoAlgs::Type, const EVP_CIPHER* legacy)
+      {
+	OpenSSLEngineInit::ensure();
+	return legacy;
+      }
+
+      inline const EVP_MD* digest(const CryptoAlgs::Type, const EVP_MD* legacy)
+      {
+	OpenSSLEngineInit::ensure();
+	return legacy;
+      }
+
+#endif
+
+    }
+  }
+}
+
+#endif
@@ -21,11 +21,19 @@
 
 // Wrap the OpenSSL HMAC API defined in <openssl/hmac.h> so
 // that it can be used as part of the crypto layer of the OpenVPN core.
+//
+// For the SHA family, the digest states after absorbing the inner
+// and outer padded keys are computed once at init() time and copied
+// on each reset()/final(), so a per-packet HMAC costs one struct copy
+// per pass instead of an EVP context copy.  Other digests use HMAC_CTX.
 
 #ifndef OPENVPN_OPENSSL_CRYPTO_HMAC_H
 #define OPENVPN_OPENSSL_CRYPTO_HMAC_H
 
 #include <string>
+#include <cstring>
+
+#include <openssl/sha.h>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -60,6 +68,8 @@ namespace openvpn {
       void init(const CryptoAlgs::Type digest, const unsigned char *key, const size_t key_size)
       {
 	erase();
+	if (init_fast(digest, key, key_size))
+	  return;
 	ctx = HMAC_CTX_new ();
 	if (!HMAC_Init_ex (ctx, key, int(key_size), DigestContext::digest_type(digest), nullptr))
 	  {
@@ -73,6 +83,11 @@ namespace openvpn {
       void reset()
       {
 	check_initialized();
+	if (fast)
+	  {
+	    work = inner;
+	    return;
+	  }
 	if (!HMAC_Init_ex (ctx, nullptr, 0, nullptr, nullptr))
 	  {
 	    openssl_clear_error_stack();
@@ -83,6 +98,11 @@ namespace openvpn {
       void update(const unsigned char *in, const size_t size)
       {
 	check_initialized();
+	if (fast)
+	  {
+	    fast_update(work, in, size);
+	    return;
+	  }
 
 	if (!HMAC_Update(ctx, in, int(size)))
 	  {
@@ -94,6 +114,16 @@ namespace openvpn {
       size_t final(unsigned char *out)
       {
 	check_initialized();
+	if (fast)
+	  {
+	    unsigned char hash[SHA512_DIGEST_LENGTH];
+	    fast_final(work, hash);
+	    work = outer;
+	    fast_update(work, hash, fast_size);
+	    fast_final(work, out);
+	    OPENSSL_cleanse(hash, sizeof(hash));
+	    return fast_size;
+	  }
 	unsigned int outlen;
 	if (!HMAC_Final(ctx, out, &outlen))
 	  {
@@ -109,29 +139,163 @@ namespace openvpn {
 	return size_();
       }
 
-      bool is_initialized() const { return ctx != nullptr; }
+      bool is_initialized() const { return ctx != nullptr || fast != FAST_NONE; }
 
     private:
+      enum Fast {
+	FAST_NONE,
+	FAST_SHA1,
+	FAST_SHA256, // also SHA224
+	FAST_SHA512, // also SHA384
+      };
+
+      union State
+      {
+	SHA_CTX sha1;
+	SHA256_CTX sha256;
+	SHA512_CTX sha512;
+      };
+
+      // Precompute the inner and outer digest states, return false
+      // if digest or key_size is not handled by the fast path.
+      bool init_fast(const CryptoAlgs::Type digest, const unsigned char *key, const size_t key_size)
+      {
+	Fast f;
+	size_t block_size;
+	switch (digest)
+	  {
+	  case CryptoAlgs::SHA1:
+	    f = FAST_SHA1;
+	    block_size = SHA_CBLOCK;
+	    break;
+	  case CryptoAlgs::SHA224:
+	  case CryptoAlgs::SHA256:
+	    f = FAST_SHA256;
+	    block_size = SHA256_CBLOCK;
+	    break;
+	  case CryptoAlgs::SHA384:
+	  case CryptoAlgs::SHA512:
+	    f = FAST_SHA512;
+	    block_size = SHA512_CBLOCK;
+	    break;
+	  default:
+	    return false;
+	  }
+	if (key_size > block_size)
+	  return false; // key would have to be hashed first
+
+	unsigned char pad[SHA512_CBLOCK];
+	fast_start(digest, inner);
+	fast_start(digest, outer);
+	std::memset(pad, 0x36, block_size);
+	for (size_t i = 0; i < key_size; ++i)
+	  pad[i] ^= key[i];
+	fast_update(f, inner, pad, block_size);
+	std::memset(pad, 0x5c, block_size);
+	for (size_t i = 0; i < key_size; ++i)
+	  pad[i] ^= key[i];
+	fast_update(f, outer, pad, block_size);
+	OPENSSL_cleanse(pad, sizeof(pad));
+
+	fast = f;
+	fast_size = CryptoAlgs::size(digest);
+	work = inner;
+	return true;
+      }
+
+      static void fast_start(const CryptoAlgs::Type digest, State& st)
+      {
+	switch (digest)
+	  {
+	  case CryptoAlgs::SHA1:
+	    SHA1_Init(&st.sha1);
+	    break;
+	  case CryptoAlgs::SHA224:
+	    SHA224_Init(&st.sha256);
+	    break;
+	  case CryptoAlgs::SHA256:
+	    SHA256_Init(&st.sha256);
+	    break;
+	  case CryptoAlgs::SHA384:
+	    SHA384_Init(&st.sha512);
+	    break;
+	  default:
+	    SHA512_Init(&st.sha512);
+	    break;
+	  }
+      }
+
+      static void fast_update(const Fast f, State& st, const unsigned char *in, const size_t size)
+      {
+	switch (f)
+	  {
+	  case FAST_SHA1:
+	    SHA1_Update(&st.sha1, in, size);
+	    break;
+	  case FAST_SHA256:
+	    SHA256_Update(&st.sha256, in, size);
+	    break;
+	  default:
+	    SHA512_Update(&st.sha512, in, size);
+	    break;
+	  }
+      }
+
+      void fast_update(State& st, const unsigned char *in, const size_t size) const
+      {
+	fast_update(fast, st, in, size);
+      }
+
+      // SHA256_Final and SHA512_Final emit the truncated SHA224 and
+      // SHA384 digests for states started by SHA224_Init/SHA384_Init
+      void fast_final(State& st, unsigned char *out) const
+      {
+	switch (fast)
+	  {
+	  case FAST_SHA1:
+	    SHA1_Final(out, &st.sha1);
+	    break;
+	  case FAST_SHA256:
+	    SHA256_Final(out, &st.sha256);
+	    break;
+	  default:
+	    SHA512_Final(out, &st.sha512);
+	    break;
+	  }
+      }
+
       void erase()
       {
 	  HMAC_CTX_free(ctx);
 	  ctx = nullptr;
+	  if (fast)
+	    {
+	      OPENSSL_cleanse(&inner, sizeof(inner));
+	      OPENSSL_cleanse(&outer, sizeof(outer));
+	      OPENSSL_cleanse(&work, sizeof(work));
+	      fast = FAST_NONE;
+	    }
       }
 
       size_t size_() const
       {
+	if (fast)
+	  return fast_size;
 	return HMAC_size(ctx);
       }
 
       void check_initialized() const
       {
 #ifdef OPENVPN_ENABLE_ASSERT
-	if (!ctx)
+	if (!is_initialized())
 	  throw openssl_hmac_uninitialized();
 #endif
       }
 
       HMAC_CTX* ctx = nullptr;
+      Fast fast = FAST_NONE;
+      size_t fast_size = 0;
+      State inner, outer, work;
     };
   }
 }
@@ -0,0 +1,342 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Data channel offload to a specific OpenSSL 3 provider, such as a
+// QAT or an ARMv8 crypto extension provider.
+//
+// OffloadDCFactory is a CryptoDCFactory that can be set on the
+// ProtoContext::Config of a particular server instead of
+// CryptoDCSelect.  Its AEAD instances key a second set of cipher
+// contexts with the provider's implementation, and send packets of
+// at least min_size bytes through them.  Smaller packets, where the
+// per-call cost of an accelerator outweighs its throughput, stay on
+// the default implementation.  test/dcbench shows where the two
+// cross over.  Ciphers the provider doesn't implement, and CBC/HMAC
+// ciphers, always use the default implementation.
+//
+// The EVP API completes each call before returning, so packets leave
+// the data channel in the order they were submitted.
+
+#ifndef OPENVPN_OPENSSL_CRYPTO_PROVIDER_H
+#define OPENVPN_OPENSSL_CRYPTO_PROVIDER_H
+
+#include <string>
+#include <limits>
+
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#endif
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+#include <openvpn/crypto/cryptodc.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/crypto/crypto_aead.hpp>
+#include <openvpn/openssl/util/error.hpp>
+#include <openvpn/openssl/crypto/api.hpp>
+
+namespace openvpn {
+  namespace OpenSSLCrypto {
+
+    OPENVPN_EXCEPTION(openssl_provider_error);
+
+    // A loaded provider and the data channel AEAD ciphers
+    // fetched from it.
+    class Provider : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<Provider> Ptr;
+
+      // Load the provider called name, unless name is empty (e.g. if
+      // it is already loaded through openssl.cnf), and fetch ciphers
+      // with the property query propq, e.g. "provider=qatprovider".
+      Provider(const std::string& name, const std::string& propq)
+      {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (!name.empty())
+	  {
+	    prov = OSSL_PROVIDER_load(nullptr, name.c_str());
+	    if (!prov)
+	      {
+		openssl_clear_error_stack();
+		throw openssl_provider_error("cannot load provider " + name);
+	      }
+	  }
+	static const CryptoAlgs::Type algs[] = {
+	  CryptoAlgs::AES_128_GCM,
+	  CryptoAlgs::AES_192_GCM,
+	  CryptoAlgs::AES_256_GCM,
+	  CryptoAlgs::CHACHA20_POLY1305,
+	};
+	for (const CryptoAlgs::Type alg : algs)
+	  ciphers[alg] = EVP_CIPHER_fetch(nullptr, CryptoAlgs::name(alg), propq.empty() ? nullptr : propq.c_str());
+	openssl_clear_error_stack();
+#else
+	throw openssl_provider_error("data channel offload requires OpenSSL 3.0 or later");
+#endif
+      }
+
+      ~Provider()
+      {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	for (EVP_CIPHER *c : ciphers)
+	  EVP_CIPHER_free(c);
+	if (prov)
+	  OSSL_PROVIDER_unload(prov);
+#endif
+      }
+
+      // returns nullptr if the provider doesn't implement alg
+      const EVP_CIPHER *cipher(const CryptoAlgs::Type alg) const
+      {
+	return alg < CryptoAlgs::SIZE ? ciphers[alg] : nullptr;
+      }
+
+    private:
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+      OSSL_PROVIDER *prov = nullptr;
+#endif
+      EVP_CIPHER *ciphers[CryptoAlgs::SIZE] = {};
+    };
+
+    // Dispatches each packet to the default or the provider's
+    // implementation by size.
+    class OffloadCipherContextGCM
+    {
+    public:
+      typedef CipherContextGCM::Op Op;
+
+      enum {
+	MODE_UNDEF = CipherContextGCM::MODE_UNDEF,
+	ENCRYPT = CipherContextGCM::ENCRYPT,
+	DECRYPT = CipherContextGCM::DECRYPT,
+	IV_LEN = CipherContextGCM::IV_LEN,
+	AUTH_TAG_LEN = CipherContextGCM::AUTH_TAG_LEN,
+	SUPPORTS_IN_PLACE_ENCRYPT = CipherContextGCM::SUPPORTS_IN_PLACE_ENCRYPT,
+	MAX_BATCH = CipherContextGCM::MAX_BATCH,
+      };
+
+      void init(const CryptoAlgs::Type alg,
+		const unsigned char *key,
+		const unsigned int keysize,
+		const int mode)
+      {
+	cpu.init(alg, key, keysize, mode);
+	min_size = std::numeric_limits<size_t>::max();
+      }
+
+      void init(const Provider& provider,
+		const size_t min_size_arg,
+		const CryptoAlgs::Type alg,
+		const unsigned char *key,
+		const unsigned int keysize,
+		const int mode)
+      {
+	init(alg, key, keysize, mode);
+	const EVP_CIPHER *ciph = provider.cipher(alg);
+	if (ciph)
+	  {
+	    offload.init(alg, key, keysize, mode, ciph);
+	    min_size = min_size_arg;
+	  }
+      }
+
+      void encrypt(const unsigned char *input,
+		   unsigned char *output,
+		   size_t length,
+		   const unsigned char *iv,
+		   unsigned char *tag,
+		   const unsigned char *ad,
+		   size_t ad_len)
+      {
+	select(length).encrypt(input, output, length, iv, tag, ad, ad_len);
+      }
+
+      bool decrypt(const unsigned char *input,
+		   unsigned char *output,
+		   size_t length,
+		   const unsigned char *iv,
+		   unsigned char *tag,
+		   const unsigned char *ad,
+		   size_t ad_len)
+      {
+	return select(length).decrypt(input, output, length, iv, tag, ad, ad_len);
+      }
+
+      void encrypt_batch(const Op *ops, const size_t n)
+      {
+	if (min_size == std::numeric_limits<size_t>::max())
+	  {
+	    cpu.encrypt_batch(ops, n);
+	    return;
+	  }
+	Op big[MAX_BATCH];
+	Op small[MAX_BATCH];
+	size_t n_big = 0;
+	size_t n_small = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    if (ops[i].length >= min_size)
+	      big[n_big++] = ops[i];
+	    else
+	      small[n_small++] = ops[i];
+	  }
+	if (n_big)
+	  offload.encrypt_batch(big, n_big);
+	if (n_small)
+	  cpu.encrypt_batch(small, n_small);
+      }
+
+      bool is_initialized() const { return cpu.is_initialized(); }
+
+    private:
+      CipherContextGCM& select(const size_t length)
+      {
+	return length >= min_size ? offload : cpu;
+      }
+
+      CipherContextGCM cpu;
+      CipherContextGCM offload;
+      size_t min_size = std::numeric_limits<size_t>::max();
+    };
+
+    struct OffloadCryptoAPI : public OpenSSLCryptoAPI
+    {
+      typedef OffloadCipherContextGCM CipherContextGCM;
+    };
+
+    class OffloadAEAD : public AEAD::Crypto<OffloadCryptoAPI>
+    {
+    public:
+      OffloadAEAD(const CryptoAlgs::Type cipher_arg,
+		  const Frame::Ptr& frame_arg,
+		  const SessionStats::Ptr& stats_arg,
+		  const Provider::Ptr& provider_arg,
+		  const size_t min_size_arg)
+	: AEAD::Crypto<OffloadCryptoAPI>(cipher_arg, frame_arg, stats_arg),
+	  provider(provider_arg),
+	  min_size(min_size_arg)
+      {
+      }
+
+      virtual void init_cipher(StaticKey&& encrypt_key,
+			       StaticKey&& decrypt_key) override
+      {
+	e.impl.init(*provider, min_size, cipher, encrypt_key.data(), encrypt_key.size(), OffloadCipherContextGCM::ENCRYPT);
+	d.impl.init(*provider, min_size, cipher, decrypt_key.data(), decrypt_key.size(), OffloadCipherContextGCM::DECRYPT);
+      }
+
+    private:
+      Provider::Ptr provider;
+      const size_t min_size;
+    };
+
+    class OffloadAEADContext : public CryptoDCContext
+    {
+    public:
+      OffloadAEADContext(const CryptoAlgs::Type cipher_arg,
+			 const Frame::Ptr& frame_arg,
+			 const SessionStats::Ptr& stats_arg,
+			 const Provider::Ptr& provider_arg,
+			 const size_t min_size_arg)
+	: cipher(CryptoAlgs::legal_dc_cipher(cipher_arg)),
+	  frame(frame_arg),
+	  stats(stats_arg),
+	  provider(provider_arg),
+	  min_size(min_size_arg)
+      {
+      }
+
+      virtual CryptoDCInstance::Ptr new_obj(const unsigned int key_id) override
+      {
+	return new OffloadAEAD(cipher, frame, stats, provider, min_size);
+      }
+
+      virtual Info crypto_info() override
+      {
+	Info ret;
+	ret.cipher_alg = cipher;
+	ret.hmac_alg = CryptoAlgs::NONE;
+	return ret;
+      }
+
+      virtual size_t encap_overhead() const override
+      {
+	return OffloadCipherContextGCM::AUTH_TAG_LEN;
+      }
+
+    private:
+      CryptoAlgs::Type cipher;
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+      Provider::Ptr provider;
+      const size_t min_size;
+    };
+
+    class OffloadDCFactory : public CryptoDCFactory
+    {
+    public:
+      typedef RCPtr<OffloadDCFactory> Ptr;
+
+      OffloadDCFactory(const Frame::Ptr& frame_arg,
+		       const SessionStats::Ptr& stats_arg,
+		       const RandomAPI::Ptr& prng_arg,
+		       const Provider::Ptr& provider_arg,
+		       const size_t min_size_arg)
+	: frame(frame_arg),
+	  stats(stats_arg),
+	  provider(provider_arg),
+	  min_size(min_size_arg),
+	  select(new CryptoDCSelect<OpenSSLCryptoAPI>(frame_arg, stats_arg, prng_arg))
+      {
+      }
+
+      virtual CryptoDCContext::Ptr new_obj(const CryptoAlgs::Type cipher,
+					   const CryptoAlgs::Type digest) override
+      {
+	if (CryptoAlgs::get(cipher).flags() & CryptoAlgs::AEAD)
+	  return new OffloadAEADContext(cipher, frame, stats, provider, min_size);
+	return select->new_obj(cipher, digest);
+      }
+
+      virtual bool supports_wide_pid() const override
+      {
+	return true;
+      }
+
+      virtual bool supports_aead(const CryptoAlgs::Type cipher) const override
+      {
+	return select->supports_aead(cipher);
+      }
+
+    private:
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+      Provider::Ptr provider;
+      const size_t min_size;
+      CryptoDCSelect<OpenSSLCryptoAPI>::Ptr select;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,192 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Index of the serial numbers revoked by a list of CRLs, so that
+// peer certs can be checked in the verify callback without going
+// through the X509 store's CRL lookup.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/openssl/compat.hpp>
+#include <openvpn/openssl/pki/x509.hpp>
+#include <openvpn/openssl/pki/crl.hpp>
+
+namespace openvpn {
+  namespace OpenSSLPKI {
+
+    // Immutable once built, so it may be built in a background
+    // thread and then shared by any number of verify callbacks.
+    class CRLIndex : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<CRLIndex> Ptr;
+
+      OPENVPN_EXCEPTION(crl_index_error);
+
+      // Each CRL must be signed by one of the certs in cas.
+      CRLIndex(CRLList crls_arg, const X509List& cas)
+	: crls(std::move(crls_arg))
+      {
+	size_t n = 0;
+	for (const auto& crl : crls)
+	  {
+	    verify_signature(crl.obj(), cas);
+	    n += sk_X509_REVOKED_num(X509_CRL_get_REVOKED(crl.obj()));
+	  }
+
+	// open addressing, at most half full
+	size_t size = 16;
+	while (size < n * 2)
+	  size <<= 1;
+	table.resize(size);
+	mask = size - 1;
+
+	for (size_t i = 0; i < crls.size(); ++i)
+	  {
+	    STACK_OF(X509_REVOKED)* revoked = X509_CRL_get_REVOKED(crls[i].obj());
+	    const int nr = sk_X509_REVOKED_num(revoked);
+	    for (int j = 0; j < nr; ++j)
+	      insert(key(i, X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(revoked, j))));
+
+	    // let OpenSSL sort the revoked list now rather than in
+	    // the first verify callback that needs it
+	    if (nr)
+	      {
+		::X509_REVOKED* rev;
+		X509_CRL_get0_by_serial(crls[i].obj(), &rev,
+					const_cast<ASN1_INTEGER *>(X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(revoked, 0))));
+	      }
+	  }
+	n_revoked = n;
+      }
+
+      // Returns X509_V_OK if cert isn't revoked, otherwise an
+      // X509_V_ERR_* code.  A cert whose issuer has no valid CRL
+      // fails, as with X509_V_FLAG_CRL_CHECK_ALL.
+      int check(::X509* cert) const
+      {
+	const X509_NAME* issuer = X509_get_issuer_name(cert);
+	const ASN1_INTEGER* serial = X509_get_serialNumber(cert);
+	int ret = X509_V_ERR_UNABLE_TO_GET_CRL;
+	for (size_t i = 0; i < crls.size(); ++i)
+	  {
+	    ::X509_CRL* crl = crls[i].obj();
+	    if (X509_NAME_cmp(X509_CRL_get_issuer(crl), issuer))
+	      continue;
+	    if (X509_cmp_current_time(X509_CRL_get0_lastUpdate(crl)) > 0)
+	      {
+		if (ret != X509_V_OK)
+		  ret = X509_V_ERR_CRL_NOT_YET_VALID;
+		continue;
+	      }
+	    const ASN1_TIME* next = X509_CRL_get0_nextUpdate(crl);
+	    if (next && X509_cmp_current_time(next) < 0)
+	      {
+		if (ret != X509_V_OK)
+		  ret = X509_V_ERR_CRL_HAS_EXPIRED;
+		continue;
+	      }
+	    if (is_revoked(i, serial))
+	      return X509_V_ERR_CERT_REVOKED;
+	    ret = X509_V_OK;
+	  }
+	return ret;
+      }
+
+      // total number of revoked serials
+      size_t size() const
+      {
+	return n_revoked;
+      }
+
+      const CRLList& crl_list() const
+      {
+	return crls;
+      }
+
+    private:
+      static void verify_signature(::X509_CRL* crl, const X509List& cas)
+      {
+	for (const auto& ca : cas)
+	  {
+	    if (!X509_NAME_cmp(X509_get_subject_name(ca.obj()), X509_CRL_get_issuer(crl))
+		&& X509_CRL_verify(crl, X509_get0_pubkey(ca.obj())) > 0)
+	      return;
+	  }
+	throw crl_index_error("CRL is not signed by any CA in the list");
+      }
+
+      bool is_revoked(const size_t crl_index, const ASN1_INTEGER* serial) const
+      {
+	const std::uint64_t k = key(crl_index, serial);
+	for (size_t i = k & mask; table[i]; i = (i + 1) & mask)
+	  {
+	    if (table[i] == k)
+	      {
+		// rule out a hash collision
+		::X509_REVOKED* rev;
+		return X509_CRL_get0_by_serial(crls[crl_index].obj(), &rev, const_cast<ASN1_INTEGER *>(serial)) == 1;
+	      }
+	  }
+	return false;
+      }
+
+      void insert(const std::uint64_t k)
+      {
+	for (size_t i = k & mask; ; i = (i + 1) & mask)
+	  {
+	    if (!table[i] || table[i] == k)
+	      {
+		table[i] = k;
+		return;
+	      }
+	  }
+      }
+
+      // non-zero hash of CRL index and serial number
+      static std::uint64_t key(const size_t crl_index, const ASN1_INTEGER* serial)
+      {
+	std::uint64_t h = 0xcbf29ce484222325ULL ^ crl_index; // FNV-1a
+	const unsigned char* p = ASN1_STRING_get0_data(serial);
+	const int len = ASN1_STRING_length(serial);
+	for (int i = 0; i < len; ++i)
+	  h = (h ^ p[i]) * 0x100000001b3ULL;
+	h = (h ^ std::uint64_t(ASN1_STRING_type(serial))) * 0x100000001b3ULL;
+	return h ? h : 1;
+      }
+
+      CRLList crls;
+      std::vector<std::uint64_t> table;
+      size_t mask = 0;
+      size_t n_revoked = 0;
+    };
+  }
+}
@@ -23,12 +23,19 @@
 
 #pragma once
 
+#include <cstdint>
+#include <atomic>
+#include <unordered_map>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
 #include <openvpn/pki/cclist.hpp>
+#include <openvpn/openssl/compat.hpp>
 #include <openvpn/openssl/util/error.hpp>
 #include <openvpn/openssl/pki/x509.hpp>
 #include <openvpn/openssl/pki/crl.hpp>
+#include <openvpn/openssl/pki/crlindex.hpp>
 
 namespace openvpn {
   namespace OpenSSLPKI {
@@ -100,5 +107,135 @@ namespace openvpn {
 
       ::X509_STORE* x509_store_;
     };
+
+    // The CAs and CRLs used to verify peers.  If crl_index is
+    // true, the CRLs are kept in a CRLIndex instead of the store.
+    // Immutable, so it can be built in a background thread and
+    // shared by sessions on any thread, and by all SSL contexts of
+    // a server with the same CAs, e.g. its SNI tenants (see
+    // OpenSSLContext::Config::set_trust_store()).
+    //
+    // Chain building looks issuers up in a subject name hash index
+    // instead of the store's lookup methods, which lock the store.
+    // The index also holds the intermediates in extra, e.g. from
+    // "extra-certs", so that peers that send only their leaf cert
+    // are verified without the intermediates in the CA list.  They
+    // are never trust anchors: self-signed certs in extra are
+    // ignored, and a chain must still end at one of the CAs.
+    class TrustStore : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<TrustStore> Ptr;
+
+      TrustStore(const X509Store::CertCRLList& cc,
+		 const bool crl_index,
+		 const X509List* extra = nullptr)
+	: generation(next_generation()),
+	  store(crl_index ? certs_only(cc) : cc)
+      {
+	if (crl_index && cc.crls.defined())
+	  index.reset(new CRLIndex(cc.crls, cc.certs));
+
+	for (const auto& c : cc.certs)
+	  add_issuer(c);
+	if (extra)
+	  for (const auto& c : *extra)
+	    if (X509_check_issued(c.obj(), c.obj()) != X509_V_OK)
+	      add_issuer(c);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (!X509_STORE_set_ex_data(store.obj(), ex_data_index(), this))
+	  throw X509Store::x509_store_error("X509_STORE_set_ex_data");
+	X509_STORE_set_get_issuer(store.obj(), get_issuer);
+#endif
+      }
+
+      X509_STORE* obj() const
+      {
+	return store.obj();
+      }
+
+      // Returns X509_V_OK or an X509_V_ERR_* code if cert is
+      // revoked according to the CRL index.
+      int check_revocation(::X509* cert) const
+      {
+	if (index)
+	  return index->check(cert);
+	return X509_V_OK;
+      }
+
+      // The issuer of cert among the CAs and intermediates,
+      // preferring one that is currently valid, or nullptr.  Not
+      // up-referenced.
+      ::X509* find_issuer(::X509* cert) const
+      {
+	::X509* ret = nullptr;
+	auto r = issuers.equal_range(X509_NAME_hash(X509_get_issuer_name(cert)));
+	for (auto i = r.first; i != r.second; ++i)
+	  {
+	    ::X509* c = i->second.obj();
+	    if (X509_check_issued(c, cert) != X509_V_OK)
+	      continue;
+	    if (X509_cmp_current_time(X509_get0_notBefore(c)) < 0
+		&& X509_cmp_current_time(X509_get0_notAfter(c)) > 0)
+	      return c;
+	    if (!ret)
+	      ret = c;
+	  }
+	return ret;
+      }
+
+      size_t n_issuers() const
+      {
+	return issuers.size();
+      }
+
+      // unique per TrustStore, e.g. to invalidate
+      // verification results cached under an older one
+      const std::uint64_t generation;
+
+    private:
+      void add_issuer(const X509& cert)
+      {
+	issuers.emplace(X509_NAME_hash(X509_get_subject_name(cert.obj())), cert);
+      }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+      // X509_STORE get_issuer method
+      static int get_issuer(::X509** issuer, X509_STORE_CTX* ctx, ::X509* cert)
+      {
+	const TrustStore* self = static_cast<const TrustStore*>(X509_STORE_get_ex_data(X509_STORE_CTX_get0_store(ctx), ex_data_index()));
+	if (!self)
+	  return -1;
+	::X509* ret = self->find_issuer(cert);
+	if (!ret || !X509_up_ref(ret))
+	  return 0;
+	*issuer = ret;
+	return 1;
+      }
+
+      static int ex_data_index()
+      {
+	static const int idx = X509_STORE_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return idx;
+      }
+#endif
+
+      static std::uint64_t next_generation()
+      {
+	static std::atomic<std::uint64_t> gen{0};
+	return ++gen;
+      }
+
+      static X509Store::CertCRLList certs_only(const X509Store::CertCRLList& cc)
+      {
+	X509Store::CertCRLList ret;
+	ret.certs = cc.certs;
+	return ret;
+      }
+
+      X509Store store;
+      CRLIndex::Ptr index;
+      std::unordered_multimap<unsigned long, X509> issuers; // by subject name hash
+    };
   }
 }
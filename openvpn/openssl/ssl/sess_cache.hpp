@@ -23,9 +23,11 @@
 
 #include <string>
 #include <map>
-#include <set>
+#include <list>
+#include <deque>
 #include <tuple>
 #include <memory>
+#include <mutex>
 #include <utility>
 
 #include <openssl/ssl.h>
@@ -38,12 +40,32 @@ namespace openvpn {
   // Client-side session cache.
   // (We don't cache server-side sessions because we use TLS
   // session resumption tickets which are stateless on the server).
-  class OpenSSLSessionCache : public RC<thread_unsafe_refcount>
+  // The cache holds at most max_sessions_per_key sessions per key
+  // (newest are used first) and at most max_keys keys, evicting the
+  // least recently committed key when full.  Sessions may be
+  // committed from the thread that runs the handshake while the
+  // connecting thread extracts them, so the cache is thread-safe.
+  class OpenSSLSessionCache : public RC<thread_safe_refcount>
   {
   public:
     typedef RCPtr<OpenSSLSessionCache> Ptr;
 
-      OPENVPN_EXCEPTION(openssl_sess_cache_error);
+    OPENVPN_EXCEPTION(openssl_sess_cache_error);
+
+    struct Stats
+    {
+      unsigned long long hits = 0;      // extract() found a session
+      unsigned long long misses = 0;    // extract() found nothing
+      unsigned long long inserts = 0;   // sessions committed
+      unsigned long long evictions = 0; // sessions dropped because of size limits
+    };
+
+    OpenSSLSessionCache(const size_t max_keys_arg = 64,
+			const size_t max_sessions_per_key_arg = 4)
+      : max_keys(max_keys_arg ? max_keys_arg : 1),
+	max_sessions_per_key(max_sessions_per_key_arg ? max_sessions_per_key_arg : 1)
+    {
+    }
 
     // Wrapper for OpenSSL SSL_SESSION pointers that manages reference counts.
     class Session
@@ -74,11 +96,6 @@ namespace openvpn {
 	return sess_;
       }
 
-      bool operator<(const Session& rhs) const // used when Session is a std::set key
-      {
-	return sess_ < rhs.sess_;
-      }
-
       explicit operator bool() const
       {
 	return sess_ != nullptr;
@@ -116,20 +133,14 @@ namespace openvpn {
       {
 	if (!sess)
 	  return;
-	auto mi = MSF::find(cache->map, key);
-	if (mi)
-	  {
-	    /* auto ins = */ mi->second.emplace(sess);
-	    //OPENVPN_LOG("OpenSSLSessionCache::Key::commit ADD=" << ins.second << " key=" << key);
-	  }
-	else
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (!::SSL_SESSION_is_resumable(sess))
 	  {
-	    //OPENVPN_LOG("OpenSSLSessionCache::Key::commit CREATE key=" << key);
-	    auto ins = cache->map.emplace(std::piecewise_construct,
-					  std::forward_as_tuple(key),
-					  std::forward_as_tuple());
-	    ins.first->second.emplace(sess);
+	    ::SSL_SESSION_free(sess);
+	    return;
 	  }
+#endif
+	cache->insert(key, sess);
       }
 
     private:
@@ -137,50 +148,106 @@ namespace openvpn {
       OpenSSLSessionCache::Ptr cache;
     };
 
-    // Remove a session from the map after calling func() on it.
-    // This would be a lot cleaner if we had C++17 std::set::extract().
+    // Remove a session from the map, then call func() on it.
     template <typename FUNC>
     void extract(const std::string& key, FUNC func)
     {
-      auto mi = MSF::find(map, key);
-      if (mi)
-	{
-	  //OPENVPN_LOG("OpenSSLSessionCache::Key::lookup EXISTS key=" << key);
-	  SessionSet& ss = mi->second;
-	  if (ss.empty())
-	    throw openssl_sess_cache_error("internal error: SessionSet is empty");
-	  auto ssi = ss.begin();
-	  try {
-	    func(ssi->openssl_session());
+      Session sess(nullptr);
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto mi = MSF::find(map, key);
+	if (mi)
+	  {
+	    //OPENVPN_LOG("OpenSSLSessionCache::Key::lookup EXISTS key=" << key);
+	    SessionSet& ss = mi->second;
+	    if (ss.sessions.empty())
+	      throw openssl_sess_cache_error("internal error: SessionSet is empty");
+	    ++stats_.hits;
+	    sess = std::move(ss.sessions.back());
+	    ss.sessions.pop_back();
+	    --n_sessions;
+	    if (ss.sessions.empty())
+	      remove_key(mi);
 	  }
-	  catch (...)
-	    {
-	      remove_session(mi, ss, ssi);
-	      throw;
-	    }
-	  remove_session(mi, ss, ssi);
-	}
-      else
-	{
-	  //OPENVPN_LOG("OpenSSLSessionCache::Key::lookup NOT_FOUND key=" << key);
-	}
+	else
+	  {
+	    //OPENVPN_LOG("OpenSSLSessionCache::Key::lookup NOT_FOUND key=" << key);
+	    ++stats_.misses;
+	  }
+      }
+      if (sess)
+	func(sess.openssl_session());
+    }
+
+    Stats stats() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats_;
+    }
+
+    // number of cached sessions
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return n_sessions;
     }
 
   private:
-    struct SessionSet : public std::set<Session>
+    struct SessionSet
     {
+      std::deque<Session> sessions;     // oldest first
+      std::list<std::string>::iterator lru;
     };
 
     typedef std::map<std::string, SessionSet> Map;
 
-    void remove_session(Map::iterator mi, SessionSet& ss, SessionSet::iterator ssi)
+    void insert(const std::string& key, ::SSL_SESSION* sess)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Map::iterator mi = map.find(key);
+      if (mi != map.end())
+	lru.splice(lru.end(), lru, mi->second.lru);
+      else
+	{
+	  //OPENVPN_LOG("OpenSSLSessionCache::Key::commit CREATE key=" << key);
+	  if (map.size() >= max_keys)
+	    {
+	      Map::iterator oldest = map.find(lru.front());
+	      stats_.evictions += oldest->second.sessions.size();
+	      remove_key(oldest);
+	    }
+	  mi = map.emplace(std::piecewise_construct,
+			   std::forward_as_tuple(key),
+			   std::forward_as_tuple()).first;
+	  mi->second.lru = lru.insert(lru.end(), key);
+	}
+
+      SessionSet& ss = mi->second;
+      ss.sessions.emplace_back(sess);
+      ++stats_.inserts;
+      ++n_sessions;
+      if (ss.sessions.size() > max_sessions_per_key)
+	{
+	  ss.sessions.pop_front();
+	  ++stats_.evictions;
+	  --n_sessions;
+	}
+    }
+
+    void remove_key(Map::iterator mi)
     {
-      ss.erase(ssi);
-      if (ss.empty())
-	map.erase(mi);
+      n_sessions -= mi->second.sessions.size();
+      lru.erase(mi->second.lru);
+      map.erase(mi);
     }
 
+    const size_t max_keys;
+    const size_t max_sessions_per_key;
+    mutable std::mutex mutex;
     Map map;
+    std::list<std::string> lru; // keys, least recently committed first
+    size_t n_sessions = 0;
+    Stats stats_;
   };
 
 }
@@ -29,6 +29,8 @@
 #include <cstring>
 #include <sstream>
 #include <utility>
+#include <mutex>
+#include <ctime>
 
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
@@ -36,6 +38,8 @@
 #include <openssl/dsa.h>
 #include <openssl/bn.h>
 #include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -47,6 +51,7 @@
 #include <openvpn/common/hexstr.hpp>
 #include <openvpn/common/to_string.hpp>
 #include <openvpn/common/unicode.hpp>
+#include <openvpn/common/objpool.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/pki/cclist.hpp>
@@ -61,6 +66,7 @@
 #include <openvpn/ssl/ssllog.hpp>
 #include <openvpn/ssl/sni_handler.hpp>
 #include <openvpn/openssl/util/error.hpp>
+#include <openvpn/openssl/util/engine.hpp>
 #include <openvpn/openssl/pki/extpki.hpp>
 #include <openvpn/openssl/pki/x509.hpp>
 #include <openvpn/openssl/pki/crl.hpp>
@@ -70,6 +76,7 @@
 #include <openvpn/openssl/pki/x509certinfo.hpp>
 #include <openvpn/openssl/bio/bio_memq_stream.hpp>
 #include <openvpn/openssl/ssl/sess_cache.hpp>
+#include <openvpn/openssl/ssl/verifycache.hpp>
 
 #ifdef HAVE_JSON
 #include <openvpn/common/jsonhelper.hpp>
@@ -92,7 +99,8 @@ namespace openvpn {
     typedef CertCRLListTemplate<OpenSSLPKI::X509List, OpenSSLPKI::CRLList> CertCRLList;
 
     enum {
-      MAX_CIPHERTEXT_IN = 64 // maximum number of queued input ciphertext packets
+      MAX_CIPHERTEXT_IN = 64, // maximum number of queued input ciphertext packets
+      MAX_EARLY_DATA = 16384, // early data a server accepts per connection (SSLConst::ENABLE_EARLY_DATA)
     };
 
     // The data needed to construct an OpenSSLContext.
@@ -142,6 +150,22 @@ namespace openvpn {
 	sni_handler = sni_handler_arg;
       }
 
+      // Verify peers with trust_store_arg instead of a trust store
+      // built from the CA list, so that all SSL contexts with the
+      // same CAs, e.g. the SNI tenants of a server, share one store
+      // and its issuer index.  See build_trust_store().
+      void set_trust_store(OpenSSLPKI::TrustStore::Ptr trust_store_arg)
+      {
+	trust_store = std::move(trust_store_arg);
+      }
+
+      // A trust store for set_trust_store() from the loaded CAs,
+      // CRLs and extra-certs.
+      OpenSSLPKI::TrustStore::Ptr build_trust_store() const
+      {
+	return new OpenSSLPKI::TrustStore(ca, flags & SSLConst::CRL_INDEX, &extra_certs);
+      }
+
       // client side
       void set_sni_name(const std::string& sni_name_arg) override
       {
@@ -297,6 +321,15 @@ namespace openvpn {
 	x509_track_config = std::move(x509_track_config_arg);
       }
 
+      // Server side only: skip chain verification for peer certs
+      // that verified recently.  The cache must not be shared by
+      // contexts with different peer cert requirements.  Not used
+      // if x509-track is enabled.
+      void set_verify_cache(OpenSSLVerifyCache::Ptr verify_cache_arg)
+      {
+	verify_cache = std::move(verify_cache_arg);
+      }
+
       void set_rng(const RandomAPI::Ptr& rng_arg) override
       {
 	// Not implemented (other than assert_crypto check)
@@ -352,6 +385,10 @@ namespace openvpn {
 	    set_sni_name(name);
 	}
 
+	// TLS 1.3 early data
+	if (opt.exists("tls-early-data"))
+	  flags |= SSLConst::ENABLE_EARLY_DATA;
+
 	// ca
 	{
 	  std::string ca_txt = opt.cat("ca");
@@ -548,6 +585,7 @@ namespace openvpn {
       ExternalPKIBase* external_pki = nullptr;
       TLSSessionTicketBase* session_ticket_handler = nullptr; // server side only
       SNI::HandlerBase* sni_handler = nullptr; // server side only
+      OpenSSLPKI::TrustStore::Ptr trust_store; // optional, shared
       Frame::Ptr frame;
       int ssl_debug_level = 0;
       unsigned int flags = 0;           // defined in sslconsts.hpp
@@ -560,6 +598,7 @@ namespace openvpn {
       TLSVersion::Type tls_version_min{TLSVersion::UNDEF}; // minimum TLS version that we will negotiate
       TLSCertProfile::Type tls_cert_profile{TLSCertProfile::UNDEF};
       X509Track::ConfigSet x509_track_config;
+      OpenSSLVerifyCache::Ptr verify_cache; // server side only
       bool local_cert_enabled = true;
       bool force_aes_cbc_ciphersuites = false;
       bool client_session_tickets = false;
@@ -567,20 +606,42 @@ namespace openvpn {
 
     // Represents an actual SSL session.
     // Normally instantiated by OpenSSLContext::ssl().
-    class SSL : public SSLAPI
+    class SSL : public SSLAPI, public PoolAllocated<SSL, 128>
     {
       friend class OpenSSLContext;
 
     public:
       typedef RCPtr<SSL> Ptr;
 
+      static const char *pool_name()
+      {
+	return "ssl";
+      }
+
       void start_handshake() override
       {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	// a client's ClientHello goes out with the first write,
+	// a server's handshake is driven by SSL_read_early_data
+	if (early_write_max || early_read)
+	  return;
+#endif
 	SSL_do_handshake(ssl);
       }
 
       ssize_t write_cleartext_unbuffered(const void *data, const size_t size) override
       {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (early_write_max)
+	  {
+	    const size_t max = early_write_max;
+	    early_write_max = 0;
+	    if (size <= max)
+	      return write_early_data(data, size);
+	  }
+	else if (early_read)
+	  return write_early_data(data, size);
+#endif
 	const int status = BIO_write(ssl_bio, data, size);
 	if (status < 0)
 	  {
@@ -593,17 +654,42 @@ namespace openvpn {
 	      }
 	  }
 	else
-	  return status;
+	  {
+	    if (status > 0)
+	      cleartext_written = true;
+	    return status;
+	  }
       }
 
       ssize_t read_cleartext(void *data, const size_t capacity) override
       {
 	if (!overflow)
 	  {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	    if (early_read)
+	      {
+		// Early data is replayable and arrives before the client
+		// has proven it holds the session keys, so it is held
+		// back until the client's Finished has been checked.
+		ssize_t status;
+		while ((status = read_early_data(data, capacity)) > 0)
+		  early_recv.append((const char *)data, status);
+		if (early_read)
+		  return status;
+	      }
+	    if (!early_recv.empty())
+	      return read_early_recv(data, capacity);
+	    early_write_max = 0;
+#endif
 	    const int status = BIO_read(ssl_bio, data, capacity);
+	    const bool retry = status == -1 && BIO_should_retry(ssl_bio);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	    if (!early_data.empty() && SSL_is_init_finished(ssl))
+	      early_data_done();
+#endif
 	    if (status < 0)
 	      {
-		if (status == -1 && BIO_should_retry(ssl_bio))
+		if (retry)
 		  return SSLConst::SHOULD_RETRY;
 		else
 		  {
@@ -620,7 +706,7 @@ namespace openvpn {
 
       bool read_cleartext_ready() const override
       {
-	return !bmq_stream::memq_from_bio(ct_in)->empty() || SSL_pending(ssl) > 0;
+	return !bmq_stream::memq_from_bio(ct_in)->empty() || SSL_pending(ssl) > 0 || !early_recv.empty();
       }
 
       void write_ciphertext(const BufferPtr& buf) override
@@ -679,14 +765,89 @@ namespace openvpn {
       void mark_no_cache() override
       {
 	sess_cache_key.reset();
+	server_sess_keep = false;
+      }
+
+      bool export_keying_material(const std::string& label, unsigned char *dest, const size_t size) override
+      {
+	if (!SSL_is_init_finished(ssl))
+	  return false;
+	return SSL_export_keying_material(ssl, dest, size, label.c_str(), label.length(), nullptr, 0, 0) == 1;
+      }
+
+      void compact() override
+      {
+	bmq_stream::memq_from_bio(ct_in)->compact();
+	bmq_stream::memq_from_bio(ct_out)->compact();
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	// fails harmlessly if a record is partially read or written
+	SSL_free_buffers(ssl);
+#endif
+      }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      // The sequence number is not exported by OpenSSL, so the keys
+      // are only handed over while it is still implied: right after
+      // a client handshake, before any application record.  The
+      // client Finished is record 0 under the TLS 1.2 keys, and no
+      // record has used the TLS 1.3 application keys yet.
+      bool export_tx_keys(TrafficKeys& keys) override
+      {
+	if (!ktls_tx
+	    || cleartext_written
+	    || SSL_is_server(ssl)
+	    || !SSL_is_init_finished(ssl)
+	    || read_ciphertext_ready())
+	  return false;
+
+	const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+	if (!cipher)
+	  return false;
+	switch (SSL_CIPHER_get_cipher_nid(cipher))
+	  {
+	  case NID_aes_128_gcm:
+	    keys.cipher = TrafficKeys::AES_128_GCM;
+	    keys.key_len = 16;
+	    break;
+	  case NID_aes_256_gcm:
+	    keys.cipher = TrafficKeys::AES_256_GCM;
+	    keys.key_len = 32;
+	    break;
+	  default:
+	    return false;
+	  }
+	const EVP_MD* md = SSL_CIPHER_get_handshake_digest(cipher);
+	if (!md)
+	  return false;
+
+	keys.version = SSL_version(ssl);
+	bool ok = false;
+	if (keys.version == TLS1_2_VERSION)
+	  ok = export_tx_keys_tls12(keys, md);
+	else if (keys.version == TLS1_3_VERSION)
+	  ok = export_tx_keys_tls13(keys, md);
+	if (ok)
+	  erase_tx_secret();
+	return ok;
       }
+#endif
 
       ~SSL()
       {
 	ssl_erase();
       }
 
+      // Process-wide setup, run once: by InitProcess::Init if the
+      // process calls init_openssl(), otherwise by the first
+      // OpenSSLContext.
       static void init_static()
+      {
+	static std::once_flag once; // GLOBAL
+	std::call_once(once, init_static_once);
+      }
+
+    private:
+      static void init_static_once()
       {
 	bmq_stream::init_static();
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_EC)
@@ -723,7 +884,6 @@ namespace openvpn {
 #endif
       }
 
-    private:
       SSL(const OpenSSLContext& ctx, const std::string* hostname, const std::string* cache_key)
       {
 	ssl_clear();
@@ -798,6 +958,26 @@ namespace openvpn {
 	    throw ssl_context_error("OpenSSLContext::SSL: ssl_data_index is uninitialized");
 	  SSL_set_ex_data (ssl, ssl_data_index, this);
 	  set_parent(&ctx);
+
+	  ktls_tx = ctx.config->mode.is_client() && (ctx.config->flags & SSLConst::ENABLE_KTLS_TX);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	  if (ctx.config->flags & SSLConst::ENABLE_EARLY_DATA)
+	    {
+	      if (ctx.config->mode.is_server())
+		{
+		  early_read = SSL_CTX_get_max_early_data(ctx.ctx) > 0;
+		  server_sess_keep = early_read;
+		}
+	      else
+		{
+		  // only a resumed session that allows it
+		  const SSL_SESSION* sess = SSL_get0_session(ssl);
+		  if (sess)
+		    early_write_max = SSL_SESSION_get_max_early_data(sess);
+		}
+	    }
+#endif
 	}
 	catch (...)
 	  {
@@ -811,6 +991,11 @@ namespace openvpn {
 	if (context_data_index < 0)
 	  throw ssl_context_error("OpenSSLContext::SSL: context_data_index is uninitialized");
 	SSL_set_ex_data(ssl, context_data_index, (void *)ctx);
+
+	// take a snapshot of the context's trust store
+	trust = ctx->get_trust();
+	if (trust && !SSL_set1_verify_cert_store(ssl, trust->obj()))
+	  throw OpenSSLException("OpenSSLContext::SSL: SSL_set1_verify_cert_store failed");
       }
 
       void rebuild_authcert() const
@@ -877,9 +1062,211 @@ namespace openvpn {
 	// (Upstream commit: c04b66b18d1a90f0c6326858e4b8367be5444582)
 	if (SSL_session_reused(const_cast<::SSL *>(c_ssl)))
 	  os << " [REUSED]";
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	switch (SSL_get_early_data_status(c_ssl))
+	  {
+	  case SSL_EARLY_DATA_ACCEPTED:
+	    os << " [EARLY DATA]";
+	    break;
+	  case SSL_EARLY_DATA_REJECTED:
+	    os << " [EARLY DATA REJECTED]";
+	    break;
+	  }
+#endif
 	return os.str();
       }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      // key_block = PRF(master_secret, "key expansion",
+      //                 server_random + client_random),
+      // laid out as client key, server key, client salt, server salt
+      bool export_tx_keys_tls12(TrafficKeys& keys, const EVP_MD* md) const
+      {
+	unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+	const size_t master_len = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+	unsigned char client_random[SSL3_RANDOM_SIZE];
+	unsigned char server_random[SSL3_RANDOM_SIZE];
+	SSL_get_client_random(ssl, client_random, sizeof(client_random));
+	SSL_get_server_random(ssl, server_random, sizeof(server_random));
+
+	static const char label[] = "key expansion";
+	unsigned char key_block[2 * 32 + 2 * 4];
+	size_t key_block_len = 2 * keys.key_len + 2 * 4;
+	bool ok = false;
+	EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, nullptr);
+	if (pctx
+	    && EVP_PKEY_derive_init(pctx) > 0
+	    && EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) > 0
+	    && EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, int(master_len)) > 0
+	    && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, (const unsigned char *)label, int(sizeof(label) - 1)) > 0
+	    && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, server_random, int(sizeof(server_random))) > 0
+	    && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, client_random, int(sizeof(client_random))) > 0
+	    && EVP_PKEY_derive(pctx, key_block, &key_block_len) > 0)
+	  {
+	    std::memcpy(keys.key, key_block, keys.key_len);
+	    std::memcpy(keys.iv, key_block + 2 * keys.key_len, 4);
+	    keys.rec_seq = 1;
+
+	    // the explicit nonce only needs to be unique, so follow
+	    // the sequence number
+	    for (size_t i = 0; i < 8; ++i)
+	      keys.iv[4 + i] = (unsigned char)(keys.rec_seq >> (56 - 8 * i));
+	    ok = true;
+	  }
+	EVP_PKEY_CTX_free(pctx);
+	OPENSSL_cleanse(master, sizeof(master));
+	OPENSSL_cleanse(key_block, sizeof(key_block));
+	openssl_clear_error_stack();
+	return ok;
+      }
+
+      // key and iv from the client application traffic secret,
+      // captured by keylog_callback
+      bool export_tx_keys_tls13(TrafficKeys& keys, const EVP_MD* md) const
+      {
+	if (tx_secret.empty()
+	    || !hkdf_expand_label(md, "key", keys.key, keys.key_len)
+	    || !hkdf_expand_label(md, "iv", keys.iv, sizeof(keys.iv)))
+	  return false;
+	keys.rec_seq = 0;
+	return true;
+      }
+
+      // HKDF-Expand-Label(Secret, Label, "", Length) from RFC 8446
+      bool hkdf_expand_label(const EVP_MD* md, const std::string& label,
+			     unsigned char* out, size_t out_len) const
+      {
+	const std::string full_label = "tls13 " + label;
+	std::string info;
+	info += char(out_len >> 8);
+	info += char(out_len & 0xff);
+	info += char(full_label.length());
+	info += full_label;
+	info += char(0);
+
+	bool ok = false;
+	EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+	if (pctx
+	    && EVP_PKEY_derive_init(pctx) > 0
+	    && EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0
+	    && EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0
+	    && EVP_PKEY_CTX_set1_hkdf_key(pctx, (const unsigned char *)tx_secret.data(), int(tx_secret.length())) > 0
+	    && EVP_PKEY_CTX_add1_hkdf_info(pctx, (const unsigned char *)info.data(), int(info.length())) > 0
+	    && EVP_PKEY_derive(pctx, out, &out_len) > 0)
+	  ok = true;
+	EVP_PKEY_CTX_free(pctx);
+	openssl_clear_error_stack();
+	return ok;
+      }
+
+      // Client: the first write rides on the ClientHello.  Server:
+      // a 0.5-RTT write, before the client's Finished.
+      ssize_t write_early_data(const void *data, const size_t size)
+      {
+	size_t written = 0;
+	const int status = SSL_write_early_data(ssl, data, size, &written);
+	if (status != 1)
+	  {
+	    const int err = SSL_get_error(ssl, status);
+	    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+	      return SSLConst::SHOULD_RETRY;
+	    mark_no_cache();
+	    OPENVPN_THROW(OpenSSLException, "OpenSSLContext::SSL::write_cleartext: SSL_write_early_data failed, size=" << size);
+	  }
+	cleartext_written = true;
+	if (!SSL_is_server(ssl))
+	  {
+	    early_data.assign((const char *)data, written);
+
+	    // End the early data here: left to SSL_read, OpenSSL
+	    // would encrypt our Finished as early data too, which
+	    // fails if the server rejected it.
+	    SSL_do_handshake(ssl);
+	  }
+	return written;
+      }
+
+      // Server only.  Returns SHOULD_RETRY with early_read cleared
+      // once the early data, if any, has all been read.
+      ssize_t read_early_data(void *data, const size_t capacity)
+      {
+	size_t size = 0;
+	switch (SSL_read_early_data(ssl, data, capacity, &size))
+	  {
+	  case SSL_READ_EARLY_DATA_SUCCESS:
+	    return size;
+	  case SSL_READ_EARLY_DATA_FINISH:
+	    early_read = false;
+	    return SSLConst::SHOULD_RETRY;
+	  default:
+	    {
+	      const int err = SSL_get_error(ssl, SSL_READ_EARLY_DATA_ERROR);
+	      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+		return SSLConst::SHOULD_RETRY;
+	      mark_no_cache();
+	      OPENVPN_THROW(OpenSSLException, "OpenSSLContext::SSL::read_cleartext: SSL_read_early_data failed, cap=" << capacity);
+	    }
+	  }
+      }
+
+      // Server: hand out the early data once the handshake is done,
+      // ahead of anything received after it.
+      ssize_t read_early_recv(void *data, const size_t capacity)
+      {
+	if (!SSL_is_init_finished(ssl))
+	  {
+	    const int status = SSL_do_handshake(ssl);
+	    if (status != 1)
+	      {
+		const int err = SSL_get_error(ssl, status);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+		  return SSLConst::SHOULD_RETRY;
+		mark_no_cache();
+		OPENVPN_THROW(OpenSSLException, "OpenSSLContext::SSL::read_cleartext: handshake after early data failed");
+	      }
+	  }
+	const size_t size = std::min(capacity, early_recv.length());
+	std::memcpy(data, early_recv.data(), size);
+	OPENSSL_cleanse(&early_recv[0], size);
+	early_recv.erase(0, size);
+	return size;
+      }
+
+      // Client, once the handshake is done: the server may have
+      // skipped the early data (unknown or already used ticket),
+      // in which case it is sent again as ordinary data.
+      void early_data_done()
+      {
+	if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_REJECTED)
+	  {
+	    const int status = BIO_write(ssl_bio, early_data.data(), early_data.length());
+	    if (status != int(early_data.length()))
+	      {
+		mark_no_cache();
+		OPENVPN_THROW(OpenSSLException, "OpenSSLContext::SSL: resending rejected early data failed, size=" << early_data.length() << " status=" << status);
+	      }
+	  }
+	erase_early_data();
+      }
+#endif
+
+      void erase_early_data()
+      {
+	if (!early_data.empty())
+	  OPENSSL_cleanse(&early_data[0], early_data.length());
+	early_data.clear();
+	if (!early_recv.empty())
+	  OPENSSL_cleanse(&early_recv[0], early_recv.length());
+	early_recv.clear();
+      }
+
+      void erase_tx_secret()
+      {
+	if (!tx_secret.empty())
+	  OPENSSL_cleanse(&tx_secret[0], tx_secret.length());
+	tx_secret.clear();
+      }
+
       void ssl_clear()
       {
 	ssl_bio_linkage = false;
@@ -889,6 +1276,11 @@ namespace openvpn {
 	ct_out = nullptr;
 	overflow = false;
 	called_did_full_handshake = false;
+	ktls_tx = false;
+	cleartext_written = false;
+	early_write_max = 0;
+	early_read = false;
+	server_sess_keep = false;
 	sess_cache_key.reset();
       }
 
@@ -910,8 +1302,16 @@ namespace openvpn {
 		SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN);
 		sess_cache_key->commit(SSL_get1_session(ssl));
 	      }
+	    else if (server_sess_keep)
+	      {
+		// the anti-replay cache only accepts a ticket whose
+		// session is still in it, see SSLConst::ENABLE_EARLY_DATA
+		SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN);
+	      }
 	    SSL_free(ssl);
 	  }
+	erase_tx_secret();
+	erase_early_data();
 	openssl_clear_error_stack();
 	ssl_clear();
       }
@@ -958,9 +1358,18 @@ namespace openvpn {
       AuthCert::Ptr authcert;
       OpenSSLSessionCache::Key::UPtr sess_cache_key; // client-side only
       OpenSSLContext::Ptr sni_ctx;
+      OpenSSLPKI::TrustStore::Ptr trust;
       bool ssl_bio_linkage;
       bool overflow;
       bool called_did_full_handshake;
+      bool ktls_tx;            // SSLConst::ENABLE_KTLS_TX
+      bool cleartext_written;  // an application record has been sent
+      std::string tx_secret;   // TLS 1.3 client application traffic secret
+      size_t early_write_max;  // client: early data the resumed session allows, until the first write
+      bool early_read;         // server: SSL_read_early_data until it reports the end
+      bool server_sess_keep;   // server: leave the session in the anti-replay cache on close
+      std::string early_data;  // client: sent as early data, kept until the server accepts or rejects it
+      std::string early_recv;  // server: received as early data, held until the handshake is done
 
       // Helps us to store pointer to self in ::SSL object
       static int ssl_data_index;
@@ -979,6 +1388,8 @@ namespace openvpn {
     OpenSSLContext(Config* config_arg)
       : config(config_arg)
     {
+      OpenSSLEngineInit::ensure();
+      SSL::init_static();
       try
 	{
 	  // Create new SSL_CTX for server or client mode
@@ -1025,6 +1436,8 @@ namespace openvpn {
 	      SSL_CTX_set_verify(ctx, vf,
 				 config->mode.is_client() ? verify_callback_client : verify_callback_server);
 	      SSL_CTX_set_verify_depth(ctx, 16);
+	      if (config->mode.is_server() && config->verify_cache && config->x509_track_config.empty())
+		SSL_CTX_set_cert_verify_callback(ctx, cert_verify_cached, nullptr);
 	    }
 
 	  /* Disable SSLv2 and SSLv3, might be a noop but does not hurt */
@@ -1041,6 +1454,20 @@ namespace openvpn {
 
 		  if (!SSL_CTX_set_tlsext_ticket_key_cb(ctx, tls_ticket_key_callback))
 		    throw OpenSSLException("OpenSSLContext: SSL_CTX_set_tlsext_ticket_key_cb failed");
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+		  // Early data can be replayed.  Tickets stay stateless,
+		  // but with the server cache on, OpenSSL also records
+		  // each session it issues and drops it when a ticket
+		  // for it is first used, so that a ticket's early data
+		  // is only accepted once (per process).
+		  if (config->flags & SSLConst::ENABLE_EARLY_DATA)
+		    {
+		      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		      SSL_CTX_set_max_early_data(ctx, MAX_EARLY_DATA);
+		      SSL_CTX_set_recv_max_early_data(ctx, MAX_EARLY_DATA);
+		    }
+#endif
 		}
 	      else
 		sslopt |= SSL_OP_NO_TICKET;
@@ -1067,6 +1494,10 @@ namespace openvpn {
 		  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
 		  sslopt |= SSL_OP_NO_TICKET;
 		}
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	      if (config->flags & SSLConst::ENABLE_KTLS_TX)
+		SSL_CTX_set_keylog_callback(ctx, keylog_callback);
+#endif
 	    }
 
 	  /* mbed TLS also ignores tls version when force aes cbc cipher suites is on */
@@ -1207,8 +1638,19 @@ namespace openvpn {
 		}
 	    }
 
-	  // Set CAs/CRLs
+	  // Set CAs/CRLs.  The CTX store only serves to build
+	  // our own cert chain, peers are verified with the store
+	  // each SSL session takes from update_trust().
 	  if (config->ca.certs.defined())
+	    {
+	      CertCRLList cas;
+	      cas.certs = config->ca.certs;
+	      OpenSSLPKI::X509Store store(cas);
+	      SSL_CTX_set_cert_store(ctx, store.release());
+	    }
+	  if (config->trust_store)
+	    update_trust(config->trust_store);
+	  else if (config->ca.certs.defined())
 	    update_trust(config->ca);
 	  else if (!(config->flags & SSLConst::NO_VERIFY_PEER))
 	    OPENVPN_THROW(ssl_context_error, "OpenSSLContext: CA not defined");
@@ -1237,10 +1679,24 @@ namespace openvpn {
       return SSL::Ptr(new SSL(*this, hostname, cache_key));
     }
 
+    // Replace the CAs and CRLs used to verify peers.  May be called
+    // from any thread.  SSL sessions created afterwards use the new
+    // trust store, existing sessions keep the one they started with.
     void update_trust(const CertCRLList& cc)
     {
-      OpenSSLPKI::X509Store store(cc);
-      SSL_CTX_set_cert_store(ctx, store.release());
+      update_trust(new OpenSSLPKI::TrustStore(cc, config->flags & SSLConst::CRL_INDEX, &config->extra_certs));
+    }
+
+    void update_trust(OpenSSLPKI::TrustStore::Ptr ts)
+    {
+      std::lock_guard<std::mutex> lock(trust_mutex);
+      trust = std::move(ts);
+    }
+
+    OpenSSLPKI::TrustStore::Ptr get_trust() const
+    {
+      std::lock_guard<std::mutex> lock(trust_mutex);
+      return trust;
     }
 
     ~OpenSSLContext()
@@ -1252,6 +1708,11 @@ namespace openvpn {
     {
       return config->mode;
     }
+
+    bool keying_material_exporter() const override
+    {
+      return true;
+    }
  
   private:
     // ns-cert-type verification
@@ -1474,12 +1935,27 @@ namespace openvpn {
       // get OpenSSLContext
       const OpenSSLContext* self = (OpenSSLContext*) SSL_get_ex_data (ssl, SSL::context_data_index);
 
+      // get OpenSSLContext::SSL
+      const SSL* self_ssl = (SSL *) SSL_get_ex_data (ssl, SSL::ssl_data_index);
+
       // get depth
       const int depth = X509_STORE_CTX_get_error_depth(ctx);
 
       // get current certificate
       X509* current_cert = X509_STORE_CTX_get_current_cert (ctx);
 
+      // check revocation
+      if (preverify_ok)
+	{
+	  const int crl_err = self_ssl->trust ? self_ssl->trust->check_revocation(current_cert) : X509_V_OK;
+	  if (crl_err != X509_V_OK)
+	    {
+	      OPENVPN_LOG_SSL("VERIFY FAIL -- " << X509_verify_cert_error_string(crl_err));
+	      X509_STORE_CTX_set_error(ctx, crl_err);
+	      preverify_ok = false;
+	    }
+	}
+
       // log subject
       const std::string subject = OpenSSLPKI::x509_get_subject(current_cert);
       if (self->config->flags & SSLConst::LOG_VERIFY_STATUS)
@@ -1562,7 +2038,7 @@ namespace openvpn {
       SSL* self_ssl = (SSL *) SSL_get_ex_data (ssl, SSL::ssl_data_index);
 
       // get error code
-      const int err = X509_STORE_CTX_get_error(ctx);
+      int err = X509_STORE_CTX_get_error(ctx);
 
       // get depth
       const int depth = X509_STORE_CTX_get_error_depth(ctx);
@@ -1570,6 +2046,19 @@ namespace openvpn {
       // get current certificate
       X509* current_cert = X509_STORE_CTX_get_current_cert (ctx);
 
+      // check revocation
+      if (preverify_ok)
+	{
+	  const int crl_err = self_ssl->trust ? self_ssl->trust->check_revocation(current_cert) : X509_V_OK;
+	  if (crl_err != X509_V_OK)
+	    {
+	      OPENVPN_LOG_SSL("VERIFY FAIL -- " << X509_verify_cert_error_string(crl_err));
+	      X509_STORE_CTX_set_error(ctx, crl_err);
+	      err = crl_err;
+	      preverify_ok = false;
+	    }
+	}
+
       // log subject
       if (self->config->flags & SSLConst::LOG_VERIFY_STATUS)
 	OPENVPN_LOG_SSL(cert_status_line(preverify_ok, depth, err, OpenSSLPKI::x509_get_subject(current_cert)));
@@ -1639,6 +2128,74 @@ namespace openvpn {
       return preverify_ok || self->deferred_cert_verify_failsafe(*self_ssl);
     }
 
+    // Replaces X509_verify_cert() when a verify cache is configured.
+    // A peer cert found in the cache under the current trust store
+    // generation is accepted without building its chain, anything
+    // else is verified normally (calling verify_callback_server for
+    // each depth) and cached if it passed.
+    static int cert_verify_cached(X509_STORE_CTX *ctx, void *)
+    {
+      ::SSL* ssl = (::SSL*) X509_STORE_CTX_get_ex_data (ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+      const OpenSSLContext* self = (OpenSSLContext*) SSL_get_ex_data (ssl, SSL::context_data_index);
+      SSL* self_ssl = (SSL *) SSL_get_ex_data (ssl, SSL::ssl_data_index);
+      OpenSSLVerifyCache& cache = *self->config->verify_cache;
+
+      X509* leaf = X509_STORE_CTX_get0_cert(ctx);
+      unsigned char fp[EVP_MAX_MD_SIZE];
+      unsigned int fp_len = sizeof(fp);
+      if (!leaf || !self_ssl->authcert || !self_ssl->trust
+	  || !X509_digest(leaf, EVP_sha256(), fp, &fp_len))
+	return X509_verify_cert(ctx);
+      const std::string key((const char *)fp, fp_len);
+      const std::uint64_t generation = self_ssl->trust->generation;
+
+      OpenSSLVerifyCache::Result res;
+      static_assert(sizeof(res.issuer_fp) == sizeof(AuthCert::issuer_fp), "size inconsistency");
+      if (cache.lookup(key, generation, res))
+	{
+	  if (self->config->flags & SSLConst::LOG_VERIFY_STATUS)
+	    OPENVPN_LOG_SSL("VERIFY OK (cached): " << OpenSSLPKI::x509_get_subject(leaf));
+	  self_ssl->authcert->cn = std::move(res.cn);
+	  self_ssl->authcert->sn = res.sn;
+	  std::memcpy(self_ssl->authcert->issuer_fp, res.issuer_fp, sizeof(res.issuer_fp));
+	  X509_STORE_CTX_set_error(ctx, X509_V_OK);
+	  return 1;
+	}
+
+      const int ret = X509_verify_cert(ctx);
+      if (ret > 0
+	  && X509_STORE_CTX_get_error(ctx) == X509_V_OK
+	  && !self_ssl->authcert->is_fail()
+	  && chain_valid_for(ctx, cache.get_ttl()))
+	{
+	  res.cn = self_ssl->authcert->cn;
+	  res.sn = self_ssl->authcert->sn;
+	  std::memcpy(res.issuer_fp, self_ssl->authcert->issuer_fp, sizeof(res.issuer_fp));
+	  cache.insert(key, generation, res);
+	}
+      return ret;
+    }
+
+    // true if no cert in the verified chain expires within dur
+    static bool chain_valid_for(X509_STORE_CTX *ctx, const Time::Duration& dur)
+    {
+      STACK_OF(X509)* chain = X509_STORE_CTX_get1_chain(ctx);
+      if (!chain)
+	return false;
+      std::time_t t = std::time(nullptr) + dur.to_seconds();
+      bool ret = true;
+      for (int i = 0; i < sk_X509_num(chain); ++i)
+	{
+	  if (X509_cmp_time(X509_get0_notAfter(sk_X509_value(chain, i)), &t) <= 0)
+	    {
+	      ret = false;
+	      break;
+	    }
+	}
+      sk_X509_pop_free(chain, X509_free);
+      return ret;
+    }
+
     // Print debugging information on SSL/TLS session negotiation.
     static void info_callback (const ::SSL *s, int where, int ret)
     {
@@ -1764,6 +2321,31 @@ namespace openvpn {
 
 #if OPENSSL_VERSION_NUMBER >= 0x10101000L
 
+    // Keep the client application traffic secret of a TLS 1.3
+    // session for SSL::export_tx_keys.  Lines are in the NSS key
+    // log format: "<label> <client random> <secret>", in hex.
+    static void keylog_callback(const ::SSL *s, const char *line)
+    {
+      static const char label[] = "CLIENT_TRAFFIC_SECRET_0 ";
+      if (std::strncmp(line, label, sizeof(label) - 1))
+	return;
+      SSL* self_ssl = (SSL *) SSL_get_ex_data(s, SSL::ssl_data_index);
+      const char *hex = std::strrchr(line, ' ');
+      if (!self_ssl || !hex)
+	return;
+      std::string secret;
+      for (++hex; hex[0] && hex[1]; hex += 2)
+	{
+	  const int high = parse_hex_char(hex[0]);
+	  const int low = parse_hex_char(hex[1]);
+	  if (high < 0 || low < 0)
+	    return;
+	  secret += char((high << 4) | low);
+	}
+      self_ssl->erase_tx_secret();
+      self_ssl->tx_secret = std::move(secret);
+    }
+
     static int client_hello_callback(::SSL *s, int *al, void *)
     {
       std::string sni_name;
@@ -1913,6 +2495,8 @@ namespace openvpn {
     SSL_CTX* ctx = nullptr;
     ExternalPKIImpl* epki = nullptr;
     OpenSSLSessionCache::Ptr sess_cache; // client-side only
+    OpenSSLPKI::TrustStore::Ptr trust;
+    mutable std::mutex trust_mutex;
   };
 
 #ifdef OPENVPN_NO_EXTERN
@@ -0,0 +1,154 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Reload the CAs and CRLs of an OpenSSLContext without stalling
+// the event loop.  The PEM text or files are parsed, and the new
+// trust store and CRL index built, in a background thread.  The
+// store is then swapped into the context, where new SSL sessions
+// pick it up, and a completion is posted to the io_context.
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <memory>
+#include <utility>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/asio/asiowork.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/function.hpp>
+#include <openvpn/log/logthread.hpp>
+#include <openvpn/openssl/ssl/sslctx.hpp>
+
+namespace openvpn {
+
+  class OpenSSLTrustReloader : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<OpenSSLTrustReloader> Ptr;
+
+    // called on io_context, error is empty on success
+    typedef Function<void(const std::string& error)> Completion;
+
+    OPENVPN_EXCEPTION(trust_reload_error);
+
+    OpenSSLTrustReloader(openvpn_io::io_context& io_context_arg,
+			 OpenSSLContext::Ptr ctx_arg)
+      : io_context(io_context_arg),
+	ctx(std::move(ctx_arg))
+    {
+    }
+
+    // Reload from PEM text holding the CA certs followed by
+    // any CRLs, as with the "ca" and "crl-verify" options.
+    // Returns false if a reload is still in progress.
+    bool reload(std::string ca_crl_txt, Completion completion)
+    {
+      return start(std::move(completion), [txt=std::move(ca_crl_txt)](OpenSSLContext::CertCRLList& cc) {
+	  cc.parse_pem(txt, "ca/crl");
+	});
+    }
+
+    // Like reload() but reads the given PEM file.
+    bool reload_file(std::string fn, Completion completion)
+    {
+      return start(std::move(completion), [fn=std::move(fn)](OpenSSLContext::CertCRLList& cc) {
+	  cc.parse_pem_file(fn);
+	});
+    }
+
+    // true from reload() until its completion has been called
+    bool busy() const
+    {
+      return pending;
+    }
+
+    // Don't call the completion of a reload in progress, and
+    // wait for its thread.  The new trust store may still be
+    // installed.
+    void stop()
+    {
+      halt = true;
+      if (thread.joinable())
+	thread.join();
+      asio_work.reset();
+    }
+
+    virtual ~OpenSSLTrustReloader()
+    {
+      stop();
+    }
+
+  private:
+    template <typename PARSE>
+    bool start(Completion completion, PARSE parse)
+    {
+      if (pending || halt)
+	return false;
+      if (thread.joinable())
+	thread.join();
+      pending = true;
+      asio_work.reset(new AsioWork(io_context)); // keep io_context running until done
+
+      // The thread holds a reference until it posts the
+      // completion, and doesn't touch *this after that.
+      thread = std::thread([self=Ptr(this),
+			    parse=std::move(parse),
+			    completion=std::move(completion),
+			    logwrap=Log::Context::Wrapper()]() mutable {
+	  Log::Context logctx(logwrap);
+	  std::string error;
+	  try {
+	    OpenSSLContext::CertCRLList cc;
+	    parse(cc);
+	    if (!cc.certs.defined())
+	      throw trust_reload_error("no CA certs");
+	    self->ctx->update_trust(cc);
+	  }
+	  catch (const std::exception& e)
+	    {
+	      error = e.what();
+	      if (error.empty())
+		error = "unknown error";
+	    }
+	  openvpn_io::io_context& io_context = self->io_context;
+	  openvpn_io::post(io_context, [self=std::move(self),
+					completion=std::move(completion),
+					error=std::move(error)]() mutable {
+	      self->pending = false;
+	      self->asio_work.reset();
+	      if (!self->halt && completion)
+		completion(error);
+	    });
+	});
+      return true;
+    }
+
+    openvpn_io::io_context& io_context;
+    OpenSSLContext::Ptr ctx;
+    std::thread thread;
+    std::unique_ptr<AsioWork> asio_work;
+    bool pending = false;
+    bool halt = false;
+  };
+
+}
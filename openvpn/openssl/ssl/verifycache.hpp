@@ -0,0 +1,164 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side cache of successful peer cert verifications, keyed by
+// the SHA-256 fingerprint of the leaf cert, so that clients that
+// reconnect within the TTL skip chain building and the per-depth
+// checks.  Entries are tied to the trust store generation they were
+// verified under, so a CA/CRL reload invalidates them.
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class OpenSSLVerifyCache : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<OpenSSLVerifyCache> Ptr;
+
+    struct Stats
+    {
+      unsigned long long hits = 0;
+      unsigned long long misses = 0;      // includes expired and stale entries
+      unsigned long long inserts = 0;
+      unsigned long long evictions = 0;   // entries dropped because of size limits
+    };
+
+    // What verification extracted from the peer cert chain
+    struct Result
+    {
+      std::string cn;                 // leaf common name
+      long sn = -1;                   // leaf serial number
+      unsigned char issuer_fp[20];    // issuer cert SHA1 fingerprint
+    };
+
+    OpenSSLVerifyCache(const size_t max_entries_arg = 4096,
+		       const Time::Duration ttl_arg = Time::Duration::seconds(300))
+      : max_entries(max_entries_arg ? max_entries_arg : 1),
+	ttl(ttl_arg)
+    {
+    }
+
+    const Time::Duration& get_ttl() const
+    {
+      return ttl;
+    }
+
+    // Returns true and sets result if fingerprint was verified
+    // under trust generation within the TTL.
+    bool lookup(const std::string& fingerprint,
+		const std::uint64_t generation,
+		Result& result)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto mi = map.find(fingerprint);
+      if (mi != map.end())
+	{
+	  Entry& e = mi->second;
+	  if (e.generation == generation && Time::now() < e.expire)
+	    {
+	      lru.splice(lru.end(), lru, e.lru);
+	      result = e.result;
+	      ++stats_.hits;
+	      return true;
+	    }
+	  remove(mi);
+	}
+      ++stats_.misses;
+      return false;
+    }
+
+    void insert(const std::string& fingerprint,
+		const std::uint64_t generation,
+		const Result& result)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto mi = map.find(fingerprint);
+      if (mi != map.end())
+	remove(mi);
+      else if (map.size() >= max_entries)
+	{
+	  remove(map.find(lru.front()));
+	  ++stats_.evictions;
+	}
+      Entry& e = map[fingerprint];
+      e.result = result;
+      e.generation = generation;
+      e.expire = Time::now() + ttl;
+      e.lru = lru.insert(lru.end(), fingerprint);
+      ++stats_.inserts;
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.clear();
+      lru.clear();
+    }
+
+    Stats stats() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats_;
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return map.size();
+    }
+
+  private:
+    struct Entry
+    {
+      Result result;
+      std::uint64_t generation = 0;
+      Time expire;
+      std::list<std::string>::iterator lru;
+    };
+
+    typedef std::unordered_map<std::string, Entry> Map;
+
+    void remove(Map::iterator mi)
+    {
+      lru.erase(mi->second.lru);
+      map.erase(mi);
+    }
+
+    const size_t max_entries;
+    const Time::Duration ttl;
+    mutable std::mutex mutex;
+    Map map;
+    std::list<std::string> lru; // fingerprints, least recently used first
+    Stats stats_;
+  };
+
+}
@@ -25,6 +25,8 @@
 #define OPENVPN_OPENSSL_UTIL_ENGINE_H
 
 #include <string>
+#include <mutex>
+#include <atomic>
 
 #ifndef OPENSSL_NO_ENGINE
 #include <openssl/engine.h>
@@ -56,6 +58,55 @@ namespace openvpn {
 #endif
   }
 
+  // Engine setup deferred until a crypto or SSL context first needs
+  // an algorithm (see OpenSSLCrypto::Fetch and OpenSSLContext), so
+  // that a process which never gets there, or gets there late,
+  // doesn't load and register every builtin engine at start.  The
+  // engines are then selected per algorithm by OpenSSL as each one
+  // is first used.
+  class OpenSSLEngineInit
+  {
+  public:
+    // run openssl_setup_engine(engine) on the next ensure()
+    static void defer(const std::string& engine)
+    {
+      std::lock_guard<std::mutex> lock(mutex());
+      name() = engine;
+      pending().store(true, std::memory_order_release);
+    }
+
+    // cheap once the deferred setup has run
+    static void ensure()
+    {
+      if (!pending().load(std::memory_order_acquire))
+	return;
+      std::lock_guard<std::mutex> lock(mutex());
+      if (!pending().load(std::memory_order_relaxed))
+	return;
+      openssl_setup_engine(name());
+      pending().store(false, std::memory_order_release);
+    }
+
+  private:
+    static std::mutex& mutex()
+    {
+      static std::mutex m; // GLOBAL
+      return m;
+    }
+
+    static std::string& name()
+    {
+      static std::string n; // GLOBAL
+      return n;
+    }
+
+    static std::atomic<bool>& pending()
+    {
+      static std::atomic<bool> p{false}; // GLOBAL
+      return p;
+    }
+  };
+
 } // namespace openvpn
 
 #endif // OPENVPN_OPENSSL_UTIL_ENGINE_H
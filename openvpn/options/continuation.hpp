@@ -27,6 +27,10 @@
 #ifndef OPENVPN_OPTIONS_CONTINUATION_H
 #define OPENVPN_OPTIONS_CONTINUATION_H
 
+#include <string>
+#include <vector>
+#include <algorithm>
+
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/options.hpp>
 
@@ -56,6 +60,7 @@ namespace openvpn {
       // so that server-pushed options will be at the end of list.
       if (push_base)
 	extend(push_base->multi, nullptr);
+      pushed_begin = size();
     }
 
     // call with option list fragments
@@ -67,6 +72,7 @@ namespace openvpn {
 	  extend(other, filt);
 	  if (!continuation(other))
 	    {
+	      pushed_end = size();
 	      if (push_base)
 		{
 		  // Append from base where only a single instance of each option makes sense,
@@ -88,7 +94,78 @@ namespace openvpn {
     // returns true if option list is complete
     bool complete() const { return complete_; }
 
+    // Apply a PUSH_UPDATE to a complete option list.  For each
+    // updatable option name in the update, all previously pushed
+    // instances are replaced by the new ones, while "-name" just
+    // removes them.  Options from push_base are kept.  Returns
+    // true if the option list changed.
+    bool push_update(const OptionList& update, OptionList::FilterBase* filt)
+    {
+      if (!complete_)
+	return false;
+
+      OptionList pushed;
+      pushed.insert(pushed.end(), begin() + pushed_begin, begin() + pushed_end);
+
+      std::vector<std::string> replaced;
+      OptionList added;
+      bool changed = false;
+      for (auto &o : update)
+	{
+	  if (o.empty())
+	    continue;
+	  const bool remove = o.ref(0).length() > 1 && o.ref(0)[0] == '-';
+	  const std::string name = remove ? o.ref(0).substr(1) : o.ref(0);
+	  if (!push_update_allowed(name))
+	    continue;
+	  if (std::find(replaced.begin(), replaced.end(), name) == replaced.end())
+	    {
+	      replaced.push_back(name);
+	      changed |= erase_named(pushed, name);
+	    }
+	  if (!remove && (!filt || filt->filter(o)))
+	    {
+	      added.push_back(o);
+	      changed = true;
+	    }
+	}
+      if (!changed)
+	return false;
+
+      pushed.extend(added, nullptr);
+      std::vector<Option>::clear();
+      if (push_base)
+	extend(push_base->multi, nullptr);
+      pushed_begin = size();
+      extend(pushed, nullptr);
+      pushed_end = size();
+      if (push_base)
+	{
+	  update_map();
+	  extend_nonexistent(push_base->singleton);
+	}
+      update_map();
+      return true;
+    }
+
+    // options that may be changed by PUSH_UPDATE
+    static bool push_update_allowed(const std::string& name)
+    {
+      return name == "route"
+	|| name == "route-ipv6"
+	|| name == "dhcp-option";
+    }
+
   private:
+    static bool erase_named(OptionList& opt, const std::string& name)
+    {
+      const size_t n = opt.size();
+      opt.erase(std::remove_if(opt.begin(), opt.end(), [&name](const Option& o) {
+	    return !o.empty() && o.ref(0) == name;
+	  }), opt.end());
+      return opt.size() != n;
+    }
+
     static bool continuation(const OptionList& opt)
     {
       const Option *o = opt.get_ptr("push-continuation");
@@ -98,6 +175,10 @@ namespace openvpn {
     bool partial_;
     bool complete_;
 
+    // range of server-pushed options, between push_base options
+    size_t pushed_begin = 0;
+    size_t pushed_end = 0;
+
     PushOptionsBase::Ptr push_base;
   };
 
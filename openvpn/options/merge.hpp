@@ -357,6 +357,22 @@ namespace openvpn {
 	      profile_content_ += line;
 	      profile_content_ += '\n';
 	    }
+
+	  // copy a well-formed inline block through in one go
+	  if (in_multiline)
+	    {
+	      const std::string close = "</" + multiline.ref(0) + '>';
+	      const size_t n = in.read_block(close, profile_content_);
+	      if (n)
+		{
+		  line_num += (int)n;
+		  profile_content_ += close;
+		  profile_content_ += '\n';
+		  multiline.clear();
+		  in_multiline = false;
+		  opaque_multiline = false;
+		}
+	    }
 	}
 
       // If more than 2 errors occurred, change status to
@@ -0,0 +1,191 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Cache of pre-serialized PUSH_REPLY messages, keyed by config profile.
+// The options common to all clients of a profile are escaped and split
+// into push-continuation segments once, so that building the reply for
+// each connecting client only needs to splice in the per-client options
+// (ifconfig, peer-id, etc.) and copy the cached segments into buffers.
+
+#ifndef OPENVPN_OPTIONS_PUSHCACHE_H
+#define OPENVPN_OPTIONS_PUSHCACHE_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <utility> // for std::move
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/options/servpush.hpp>
+
+namespace openvpn {
+
+  // Immutable once constructed, so it can be shared between
+  // server threads.
+  class PushReply : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PushReply> Ptr;
+
+    enum {
+      DEFAULT_MAX_SIZE = 1024, // includes the trailing null
+    };
+
+    PushReply(const ServerPushList& common,
+	      const size_t max_size_arg = DEFAULT_MAX_SIZE)
+      : max_size(max_size_arg)
+    {
+      for (auto &e : common)
+	add(segments, escape(e));
+    }
+
+    // Build the PUSH_REPLY messages for one client, appending
+    // per_client options after the common ones.
+    std::vector<BufferPtr> build(const ServerPushList& per_client) const
+    {
+      // per-client options continue the last common segment
+      std::vector<std::string> extra;
+      if (!per_client.empty() && !segments.empty())
+	extra.push_back(segments.back());
+      for (auto &e : per_client)
+	add(extra, escape(e));
+
+      const size_t n_common = (!per_client.empty() && !segments.empty()) ? segments.size() - 1 : segments.size();
+      const size_t n = n_common + extra.size();
+      std::vector<BufferPtr> ret;
+      ret.reserve(n);
+      for (size_t i = 0; i < n; ++i)
+	{
+	  const std::string& seg = i < n_common ? segments[i] : extra[i - n_common];
+	  const char *cont = nullptr;
+	  if (n > 1)
+	    cont = (i + 1 < n) ? ",push-continuation 2" : ",push-continuation 1";
+	  ret.push_back(render(seg, cont));
+	}
+      if (ret.empty())
+	ret.push_back(render(std::string(), nullptr));
+      return ret;
+    }
+
+    size_t n_segments() const
+    {
+      return segments.size();
+    }
+
+  private:
+    enum {
+      PREFIX_LEN = 10, // "PUSH_REPLY"
+      CONT_LEN = 20,   // ",push-continuation N"
+    };
+
+    static std::string escape(const std::string& e)
+    {
+      std::ostringstream os;
+      os << ',';
+      ServerPushList::output_arg(e, os);
+      return os.str();
+    }
+
+    // room left for option text in a segment, after the prefix,
+    // continuation marker and null terminator
+    size_t budget() const
+    {
+      const size_t overhead = PREFIX_LEN + CONT_LEN + 1;
+      return max_size > overhead ? max_size - overhead : 0;
+    }
+
+    // Append an escaped option to the last segment, or start a new
+    // segment if it doesn't fit.
+    void add(std::vector<std::string>& segs, const std::string& opt) const
+    {
+      if (segs.empty() || (!segs.back().empty() && segs.back().length() + opt.length() > budget()))
+	segs.emplace_back();
+      segs.back() += opt;
+    }
+
+    static BufferPtr render(const std::string& seg, const char *cont)
+    {
+      const size_t cont_len = cont ? CONT_LEN : 0;
+      BufferPtr buf(new BufferAllocated(PREFIX_LEN + seg.length() + cont_len + 1, 0));
+      buf->write((const unsigned char *)"PUSH_REPLY", PREFIX_LEN);
+      buf->write((const unsigned char *)seg.c_str(), seg.length());
+      if (cont)
+	buf->write((const unsigned char *)cont, cont_len);
+      buf->null_terminate();
+      return buf;
+    }
+
+    const size_t max_size;
+    std::vector<std::string> segments;
+  };
+
+  class PushReplyCache : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PushReplyCache> Ptr;
+
+    PushReplyCache(const size_t max_size_arg = PushReply::DEFAULT_MAX_SIZE)
+      : max_size(max_size_arg)
+    {
+    }
+
+    // Return the cached reply for profile, serializing common
+    // on a cache miss.
+    PushReply::Ptr get(const std::string& profile, const ServerPushList& common)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      PushReply::Ptr& pr = map[profile];
+      if (!pr)
+	pr.reset(new PushReply(common, max_size));
+      return pr;
+    }
+
+    // call when the push options for profile change
+    void invalidate(const std::string& profile)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.erase(profile);
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.clear();
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return map.size();
+    }
+
+  private:
+    const size_t max_size;
+    mutable std::mutex mutex;
+    std::map<std::string, PushReply::Ptr> map;
+  };
+}
+
+#endif
@@ -68,6 +68,9 @@
 #include <openvpn/ws/httpserv.hpp>
 #include <openvpn/win/winerr.hpp>
 #include <openvpn/client/win/agentconfig.hpp>
+#include <openvpn/client/win/agentproto.hpp>
+#include <openvpn/acceptor/namedpipe.hpp>
+#include <openvpn/time/asiotimer.hpp>
 #include <openvpn/win/scoped_handle.hpp>
 #include <openvpn/win/winsvc.hpp>
 #include <openvpn/win/logfile.hpp>
@@ -137,6 +140,94 @@ public:
   {
   }
 
+  struct TunSetupParams
+  {
+    ULONG pid = 0;
+    bool wintun = false;
+
+    // remote event handles for tun object confirmation/destruction
+    std::string confirm_event_hex;
+    std::string destroy_event_hex;
+
+    // wintun only
+    std::string send_ring_hmem;
+    std::string receive_ring_hmem;
+    std::string send_ring_tail_moved;
+    std::string receive_ring_tail_moved;
+
+    TunBuilderCapture::Ptr tbc;
+  };
+
+  // The part of tun setup that follows the teardown of any
+  // previous instance.  The TAP handle for the client is
+  // available from get_remote_tap_handle_hex() afterwards.
+  void tun_setup(const HANDLE client_pipe,
+		 const std::wstring& client_exe,
+		 const TunSetupParams& p,
+		 std::ostream& os)
+  {
+    // pre-establish impersonation
+    {
+      Win::NamedPipeImpersonate impersonate(client_pipe);
+
+      // remember the client process that sent the request
+      set_client_process(get_client_process(client_pipe, p.pid));
+
+      // save the confirm/destroy events
+      set_client_destroy_event(p.destroy_event_hex);
+      set_client_confirm_event(p.confirm_event_hex);
+    }
+
+    if (p.wintun)
+      {
+	assign_ring_buffer(new TunWin::RingBuffer(io_context_,
+						  get_client_process(),
+						  p.send_ring_hmem,
+						  p.receive_ring_hmem,
+						  p.send_ring_tail_moved,
+						  p.receive_ring_tail_moved));
+      }
+
+    // establish the tun setup object
+    Win::ScopedHANDLE tap_handle(establish_tun(*p.tbc, client_exe, nullptr, os, p.wintun));
+
+    // post-establish impersonation
+    {
+      Win::NamedPipeImpersonate impersonate(client_pipe);
+
+      // duplicate the TAP handle into the client process
+      set_remote_tap_handle_hex(tap_handle());
+    }
+  }
+
+  static HANDLE get_client_pipe(AsioPolySock::Base* sock)
+  {
+    AsioPolySock::NamedPipe* np = dynamic_cast<AsioPolySock::NamedPipe*>(sock);
+    if (!np)
+      throw Exception("only named pipe clients are allowed");
+    return np->handle.native_handle();
+  }
+
+  static std::wstring get_client_exe(const HANDLE client_pipe)
+  {
+#if _WIN32_WINNT >= 0x0600 // Vista and higher
+    Win::NamedPipePeerInfoClient npinfo(client_pipe);
+    return npinfo.exe_path;
+#else
+    return std::wstring();
+#endif
+  }
+
+  static Win::ScopedHANDLE get_client_process(const HANDLE pipe, ULONG pid_hint)
+  {
+#if _WIN32_WINNT >= 0x0600 // Vista and higher
+    pid_hint = Win::NamedPipePeerInfo::get_pid(pipe, true);
+#endif
+    if (!pid_hint)
+      throw Exception("cannot determine client PID");
+    return Win::NamedPipePeerInfo::get_process(pid_hint, false);
+  }
+
   Win::ScopedHANDLE establish_tun(const TunBuilderCapture& tbc,
 				  const std::wstring& openvpn_app_path,
 				  Stop* stop,
@@ -483,8 +574,12 @@ public:
 
   TunWin::RingBuffer::Ptr ring_buffer;
 
-private:
-  virtual bool allow_client(AsioPolySock::Base& sock) override
+  openvpn_io::io_context& get_io_context()
+  {
+    return io_context_;
+  }
+
+  bool allow_pipe_client(AsioPolySock::Base& sock)
   {
     AsioPolySock::NamedPipe* np = dynamic_cast<AsioPolySock::NamedPipe*>(&sock);
     if (np)
@@ -505,6 +600,12 @@ private:
     return false;
   }
 
+private:
+  virtual bool allow_client(AsioPolySock::Base& sock) override
+  {
+    return allow_pipe_client(sock);
+  }
+
   TunWin::Setup::Ptr tun;
   openvpn_io::windows::object_handle client_process;
   openvpn_io::windows::object_handle client_confirm_event;
@@ -548,8 +649,8 @@ private:
     std::ostringstream os;
 
     try {
-      const HANDLE client_pipe = get_client_pipe();
-      const std::wstring client_exe = get_client_exe(client_pipe);
+      const HANDLE client_pipe = MyListener::get_client_pipe(sock.get());
+      const std::wstring client_exe = MyListener::get_client_exe(client_pipe);
 
       const HTTP::Request& req = request();
       OPENVPN_LOG("HTTP request received from " << sock->remote_endpoint_str() << '\n' << req.to_string());
@@ -570,18 +671,28 @@ private:
 
 	  if (req.uri == "/tun-setup")
 	    {
+	      MyListener::TunSetupParams p;
+
 	      // get PID
-	      ULONG pid = json::get_uint_optional(root, "pid", 0);
+	      p.pid = json::get_uint_optional(root, "pid", 0);
 
-	      bool wintun = json::get_bool_optional(root, "wintun");
+	      p.wintun = json::get_bool_optional(root, "wintun");
 
 	      // get remote event handles for tun object confirmation/destruction
-	      const std::string confirm_event_hex = json::get_string(root, "confirm_event");
-	      const std::string destroy_event_hex = json::get_string(root, "destroy_event");
+	      p.confirm_event_hex = json::get_string(root, "confirm_event");
+	      p.destroy_event_hex = json::get_string(root, "destroy_event");
+
+	      if (p.wintun)
+		{
+		  p.send_ring_hmem = json::get_string(root, "send_ring_hmem");
+		  p.receive_ring_hmem = json::get_string(root, "receive_ring_hmem");
+		  p.send_ring_tail_moved = json::get_string(root, "send_ring_tail_moved");
+		  p.receive_ring_tail_moved = json::get_string(root, "receive_ring_tail_moved");
+		}
 
 	      // parse JSON data into a TunBuilderCapture object
-	      TunBuilderCapture::Ptr tbc = TunBuilderCapture::from_json(json::get_dict(root, "tun", false));
-	      tbc->validate();
+	      p.tbc = TunBuilderCapture::from_json(json::get_dict(root, "tun", false));
+	      p.tbc->validate();
 
 	      // destroy previous instance
 	      if (parent()->destroy_tun(os))
@@ -590,38 +701,7 @@ private:
 		  ::Sleep(1000);
 		}
 
-	      // pre-establish impersonation
-	      {
-		Win::NamedPipeImpersonate impersonate(client_pipe);
-
-		// remember the client process that sent the request
-		parent()->set_client_process(get_client_process(client_pipe, pid));
-
-		// save the confirm/destroy events
-		parent()->set_client_destroy_event(destroy_event_hex);
-		parent()->set_client_confirm_event(confirm_event_hex);
-	      }
-
-	      if (wintun)
-		{
-		  parent()->assign_ring_buffer(new TunWin::RingBuffer(io_context,
-					       parent()->get_client_process(),
-					       json::get_string(root, "send_ring_hmem"),
-					       json::get_string(root, "receive_ring_hmem"),
-					       json::get_string(root, "send_ring_tail_moved"),
-					       json::get_string(root, "receive_ring_tail_moved")));
-		}
-
-	      // establish the tun setup object
-	      Win::ScopedHANDLE tap_handle(parent()->establish_tun(*tbc, client_exe, nullptr, os, wintun));
-
-	      // post-establish impersonation
-	      {
-		Win::NamedPipeImpersonate impersonate(client_pipe);
-
-		// duplicate the TAP handle into the client process
-		parent()->set_remote_tap_handle_hex(tap_handle());
-	      }
+	      parent()->tun_setup(client_pipe, client_exe, p, os);
 
 	      // build JSON return dictionary
 	      const std::string log_txt = string::remove_blanks(os.str());
@@ -643,7 +723,7 @@ private:
 		Win::NamedPipeImpersonate impersonate(client_pipe);
 
 		// remember the client process that sent the request
-		parent()->set_client_process(get_client_process(client_pipe, pid));
+		parent()->set_client_process(MyListener::get_client_process(client_pipe, pid));
 	      }
 
 	      parent()->add_bypass_route(host, ipv6);
@@ -731,52 +811,202 @@ private:
       return true;
   }
 
-  HANDLE get_client_pipe() const
+  MyListener* parent()
   {
-    AsioPolySock::NamedPipe* np = dynamic_cast<AsioPolySock::NamedPipe*>(sock.get());
-    if (!np)
-      throw Exception("only named pipe clients are allowed");
-    return np->handle.native_handle();
+    return static_cast<MyListener*>(get_parent());
+  }
+
+  BufferList in;
+  BufferPtr out;
+};
+
+class MyClientFactory : public WS::Server::Listener::Client::Factory
+{
+public:
+  typedef RCPtr<MyClientFactory> Ptr;
+
+  virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+  {
+    return new MyClientInstance(ci);
   }
+};
 
-  std::wstring get_client_exe(const HANDLE client_pipe)
+// A batch of actions received over the binary protocol.  The
+// actions run in order, and the reply goes out when the last one
+// is done or one fails.
+class MyBinaryRequest : public RC<thread_unsafe_refcount>
+{
+public:
+  typedef RCPtr<MyBinaryRequest> Ptr;
+
+  MyBinaryRequest(MyListener* parent_arg,
+		  AgentProto::Session& session_arg,
+		  AgentProto::Message& request_arg)
+    : parent(parent_arg),
+      session(&session_arg),
+      request(std::move(request_arg)),
+      timer(parent_arg->get_io_context())
   {
-#if _WIN32_WINNT >= 0x0600 // Vista and higher
-    Win::NamedPipePeerInfoClient npinfo(client_pipe);
-    return npinfo.exe_path;
-#else
-    return std::wstring();
-#endif
+    reply.id = request.id;
   }
 
-  Win::ScopedHANDLE get_client_process(const HANDLE pipe, ULONG pid_hint) const
+  void next()
   {
-#if _WIN32_WINNT >= 0x0600 // Vista and higher
-    pid_hint = Win::NamedPipePeerInfo::get_pid(pipe, true);
-#endif
-    if (!pid_hint)
-      throw Exception("cannot determine client PID");
-    return Win::NamedPipePeerInfo::get_process(pid_hint, false);
+    try {
+      while (index < request.records.size())
+	{
+	  const AgentProto::Record& r = request.records[index];
+
+	  // Destroy a previous tun instance first, and give it a
+	  // moment to go away without holding up other clients.
+	  if (r.type == AgentProto::TUN_SETUP && !tun_params)
+	    {
+	      tun_params.reset(new MyListener::TunSetupParams(tun_setup_params(r)));
+	      if (parent->destroy_tun(os))
+		{
+		  os << "Destroyed previous TAP instance" << std::endl;
+		  timer.expires_after(Time::Duration::seconds(1));
+		  timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error) {
+		      if (!error)
+			self->next();
+		    });
+		  return;
+		}
+	    }
+
+	  reply.records.push_back(run(r));
+	  ++index;
+	}
+    }
+    catch (const std::exception& e)
+      {
+	if (parent->destroy_tun(os))
+	  os << "Destroyed previous TAP instance due to exception" << std::endl;
+
+	const std::string error_msg = string::remove_blanks(os.str() + e.what() + '\n');
+	OPENVPN_LOG_NTNL("EXCEPTION\n" << error_msg);
+
+	AgentProto::Record res(request.records[index].type);
+	res.status = AgentProto::STATUS_ERROR;
+	res.set(AgentProto::ERROR_TXT, error_msg);
+	reply.records.push_back(std::move(res));
+      }
+    session->reply(reply);
   }
 
-  MyListener* parent()
+private:
+  static MyListener::TunSetupParams tun_setup_params(const AgentProto::Record& r)
   {
-    return static_cast<MyListener*>(get_parent());
+    MyListener::TunSetupParams p;
+    p.pid = static_cast<ULONG>(r.get_uint_optional(AgentProto::PID, 0));
+    p.wintun = r.get_bool_optional(AgentProto::WINTUN);
+    p.confirm_event_hex = r.get_string(AgentProto::CONFIRM_EVENT);
+    p.destroy_event_hex = r.get_string(AgentProto::DESTROY_EVENT);
+    if (p.wintun)
+      {
+	p.send_ring_hmem = r.get_string(AgentProto::SEND_RING_HMEM);
+	p.receive_ring_hmem = r.get_string(AgentProto::RECEIVE_RING_HMEM);
+	p.send_ring_tail_moved = r.get_string(AgentProto::SEND_RING_TAIL_MOVED);
+	p.receive_ring_tail_moved = r.get_string(AgentProto::RECEIVE_RING_TAIL_MOVED);
+      }
+
+    // the TunBuilderCapture is still carried as JSON
+    const Json::Value jtun = json::parse(r.get_string(AgentProto::TUN), "tun setup");
+    if (!jtun.isObject())
+      throw Exception("json parse error: tun setup is not a dictionary");
+    p.tbc = TunBuilderCapture::from_json(jtun);
+    p.tbc->validate();
+    return p;
   }
 
-  BufferList in;
-  BufferPtr out;
+  AgentProto::Record run(const AgentProto::Record& r)
+  {
+    AgentProto::Record res(r.type);
+    const HANDLE client_pipe = MyListener::get_client_pipe(&session->socket());
+    switch (r.type)
+      {
+      case AgentProto::TUN_SETUP:
+	{
+	  parent->tun_setup(client_pipe, MyListener::get_client_exe(client_pipe), *tun_params, os);
+	  tun_params.reset();
+
+	  const std::string log_txt = string::remove_blanks(os.str());
+	  os.str("");
+	  res.set(AgentProto::LOG_TXT, log_txt);
+	  res.set(AgentProto::TAP_HANDLE_HEX, parent->get_remote_tap_handle_hex());
+	  OPENVPN_LOG_NTNL("TUN SETUP\n" << log_txt);
+	  break;
+	}
+      case AgentProto::ADD_BYPASS_ROUTE:
+	{
+	  const ULONG pid = static_cast<ULONG>(r.get_uint_optional(AgentProto::PID, 0));
+
+	  // pre-establish impersonation
+	  {
+	    Win::NamedPipeImpersonate impersonate(client_pipe);
+
+	    // remember the client process that sent the request
+	    parent->set_client_process(MyListener::get_client_process(client_pipe, pid));
+	  }
+
+	  parent->add_bypass_route(r.get_string(AgentProto::HOST), r.get_bool(AgentProto::IPV6));
+	  break;
+	}
+#ifdef OPENVPN_AGENT_START_PROCESS
+      case AgentProto::START_PROCESS:
+	parent->start_openvpn_process(client_pipe,
+				      r.get_string(AgentProto::CONFIG_FILE),
+				      r.get_string(AgentProto::CONFIG_DIR),
+				      r.get_string(AgentProto::EXIT_EVENT_NAME),
+				      r.get_string(AgentProto::MANAGEMENT_HOST),
+				      r.get_string(AgentProto::MANAGEMENT_PASSWORD) + "\n",
+				      static_cast<int>(r.get_uint(AgentProto::MANAGEMENT_PORT)),
+				      r.get_string(AgentProto::LOG),
+				      r.get_bool_optional(AgentProto::LOG_APPEND));
+	break;
+#endif
+      default:
+	OPENVPN_LOG("unknown agent action " << r.type);
+	res.status = AgentProto::STATUS_UNKNOWN_ACTION;
+	break;
+      }
+    return res;
+  }
+
+  MyListener* parent;
+  AgentProto::Session::Ptr session;
+  AgentProto::Message request;
+  AgentProto::Message reply;
+  size_t index = 0;
+  std::unique_ptr<MyListener::TunSetupParams> tun_params;
+  std::ostringstream os;
+  AsioTimer timer;
 };
 
-class MyClientFactory : public WS::Server::Listener::Client::Factory
+class MyAgentProtoHandler : public AgentProto::Session::Handler
 {
 public:
-  typedef RCPtr<MyClientFactory> Ptr;
+  typedef RCPtr<MyAgentProtoHandler> Ptr;
 
-  virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+  MyAgentProtoHandler(MyListener* parent_arg)
+    : parent(parent_arg)
   {
-    return new MyClientInstance(ci);
   }
+
+  virtual bool agent_allow(AsioPolySock::Base& sock) override
+  {
+    return parent->allow_pipe_client(sock);
+  }
+
+  virtual void agent_request(AgentProto::Session& session, AgentProto::Message& request) override
+  {
+    OPENVPN_LOG("binary request " << request.id << " with " << request.records.size() << " action(s)");
+    MyBinaryRequest::Ptr r(new MyBinaryRequest(parent, session, request));
+    r->next();
+  }
+
+private:
+  MyListener* parent;
 };
 
 class MyService : public Win::Service
@@ -846,6 +1076,11 @@ public:
     listener.reset(new MyListener(conf, *io_context, hconf, ll, factory));
     listener->start();
 
+    // persistent connections speaking the binary protocol
+    binary_listener.reset(new AgentProto::Listener(*io_context, new MyAgentProtoHandler(listener.get())));
+    for (unsigned int i = 0; i < n_pipe_instances; ++i)
+      binary_listener->add_acceptor(new Acceptor::NamedPipe(*io_context, Agent::binary_pipe_path(), hconf->sddl_string));
+
     report_service_running();
 
     io_context->run();
@@ -861,6 +1096,8 @@ public:
 	    listener->destroy_tun_exit();
 	    listener->stop();
 	  }
+	if (binary_listener)
+	  binary_listener->stop();
       });
   }
 
@@ -888,6 +1125,7 @@ private:
 
   std::unique_ptr<openvpn_io::io_context> io_context;
   MyListener::Ptr listener;
+  AgentProto::Listener::Ptr binary_listener;
   LogBase::Ptr log;
 };
 
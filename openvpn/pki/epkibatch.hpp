@@ -0,0 +1,147 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Combine concurrent External PKI signature requests for the same key.
+// Sessions whose handshakes run on an SSLExecutor pool may ask for
+// signatures from several threads at once.  ExternalPKIBatch passes
+// requests that arrive while a batch is outstanding to the backend
+// as a single sign_batch() call, so that an HSM or remote signer sees
+// one round trip per batch instead of one per handshake.
+
+#ifndef OPENVPN_PKI_EPKIBATCH_H
+#define OPENVPN_PKI_EPKIBATCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include <openvpn/pki/epkibase.hpp>
+
+namespace openvpn {
+
+  class ExternalPKIBatchBase
+  {
+  public:
+    struct SignRequest
+    {
+      std::string data;       // data to be signed (base64)
+      std::string algorithm;
+      std::string sig;        // signature (base64), set by sign_batch()
+      bool status = false;    // set to true by sign_batch() on success
+    };
+
+    // Sign all requests.  Calls are serialized by ExternalPKIBatch.
+    virtual void sign_batch(const std::vector<SignRequest*>& reqs) = 0;
+
+    virtual ~ExternalPKIBatchBase() {}
+  };
+
+  class ExternalPKIBatch : public ExternalPKIBase
+  {
+  public:
+    ExternalPKIBatch(ExternalPKIBatchBase& backend_arg,
+		     const size_t max_batch_arg = 64)
+      : backend(backend_arg),
+	max_batch(max_batch_arg ? max_batch_arg : 1)
+    {
+    }
+
+    // May be called concurrently from any number of threads.  The
+    // first caller to find the backend idle signs everything queued
+    // so far on behalf of the others.
+    virtual bool sign(const std::string& data, std::string& sig, const std::string& algorithm) override
+    {
+      Pending p;
+      p.req.data = data;
+      p.req.algorithm = algorithm;
+
+      std::unique_lock<std::mutex> lock(mutex);
+      queue.push_back(&p);
+      while (!p.done)
+	{
+	  if (busy)
+	    {
+	      cond.wait(lock);
+	      continue;
+	    }
+
+	  std::vector<Pending*> batch;
+	  std::vector<ExternalPKIBatchBase::SignRequest*> reqs;
+	  while (!queue.empty() && batch.size() < max_batch)
+	    {
+	      batch.push_back(queue.front());
+	      reqs.push_back(&queue.front()->req);
+	      queue.pop_front();
+	    }
+	  busy = true;
+	  ++n_batches_;
+
+	  lock.unlock();
+	  try {
+	    backend.sign_batch(reqs);
+	  }
+	  catch (...)
+	    {
+	      for (auto* r : reqs)
+		r->status = false;
+	    }
+	  lock.lock();
+
+	  for (auto* b : batch)
+	    b->done = true;
+	  busy = false;
+	  cond.notify_all();
+	}
+
+      if (p.req.status)
+	sig = std::move(p.req.sig);
+      return p.req.status;
+    }
+
+    // number of sign_batch() calls made so far
+    size_t n_batches() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return n_batches_;
+    }
+
+  private:
+    struct Pending
+    {
+      ExternalPKIBatchBase::SignRequest req;
+      bool done = false;
+    };
+
+    ExternalPKIBatchBase& backend;
+    const size_t max_batch;
+
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Pending*> queue;
+    bool busy = false;
+    size_t n_batches_ = 0;
+  };
+}
+
+#endif
@@ -0,0 +1,259 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Buffered cryptographic random number generator for per-packet use
+// such as CBC IVs and session IDs.
+//
+// Output comes from a pool of ChaCha20 keystream blocks, regenerated
+// with "fast key erasure": the first 32 bytes of each refill become
+// the next key and are wiped, and bytes are wiped from the pool as
+// they are handed out, so that a later compromise of the state
+// doesn't reveal earlier output.  The key is replaced with fresh
+// bytes from the seed RandomAPI (e.g. OpenSSLRandom or DevURand)
+// every RESEED_BYTES of output and in the child after fork(), so
+// that parent and child never share a stream.
+//
+// Like MTRand, an instance keeps state without locking, so use one
+// instance per thread.
+
+#ifndef OPENVPN_RANDOM_BUFRAND_H
+#define OPENVPN_RANDOM_BUFRAND_H
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/size.hpp>
+#include <openvpn/random/randapi.hpp>
+
+#if !defined(OPENVPN_PLATFORM_WIN)
+#include <pthread.h>
+#endif
+
+namespace openvpn {
+
+  class BufferedRandom : public RandomAPI
+  {
+  public:
+    OPENVPN_EXCEPTION(buffered_random_error);
+
+    typedef RCPtr<BufferedRandom> Ptr;
+
+    enum {
+      KEY_SIZE = 32,
+      BLOCK_SIZE = 64,
+      POOL_BLOCKS = 16,
+      POOL_SIZE = BLOCK_SIZE * POOL_BLOCKS,
+      RESEED_BYTES = 1024 * 1024,
+    };
+
+    BufferedRandom(const RandomAPI::Ptr& seed_arg)
+      : seed(seed_arg)
+    {
+      seed->assert_crypto();
+      register_fork_handler();
+      reseed();
+    }
+
+    virtual ~BufferedRandom()
+    {
+      wipe(key, sizeof(key));
+      wipe(pool, sizeof(pool));
+    }
+
+    // Random algorithm name
+    virtual std::string name() const
+    {
+      return "BufferedRandom/" + seed->name();
+    }
+
+    // Return true if algorithm is crypto-strength
+    virtual bool is_crypto() const
+    {
+      return true;
+    }
+
+    // Fill buffer with random bytes
+    virtual void rand_bytes(unsigned char *buf, size_t size)
+    {
+      if (!rndbytes(buf, size))
+	throw buffered_random_error("rand_bytes failed");
+    }
+
+    // Like rand_bytes, but don't throw exception.
+    // Return true on successs, false on fail.
+    virtual bool rand_bytes_noexcept(unsigned char *buf, size_t size)
+    {
+      return rndbytes(buf, size);
+    }
+
+    // ChaCha20 block function (RFC 8439), exposed for testing
+    static void chacha20_block(const unsigned char key[KEY_SIZE],
+			       const std::uint32_t counter,
+			       const unsigned char nonce[12],
+			       unsigned char out[BLOCK_SIZE])
+    {
+      std::uint32_t s[16];
+      s[0] = 0x61707865;
+      s[1] = 0x3320646e;
+      s[2] = 0x79622d32;
+      s[3] = 0x6b206574;
+      for (unsigned int i = 0; i < 8; ++i)
+	s[4 + i] = load32(key + 4 * i);
+      s[12] = counter;
+      for (unsigned int i = 0; i < 3; ++i)
+	s[13 + i] = load32(nonce + 4 * i);
+
+      std::uint32_t x[16];
+      std::memcpy(x, s, sizeof(x));
+      for (unsigned int i = 0; i < 10; ++i)
+	{
+	  quarter_round(x[0], x[4], x[8], x[12]);
+	  quarter_round(x[1], x[5], x[9], x[13]);
+	  quarter_round(x[2], x[6], x[10], x[14]);
+	  quarter_round(x[3], x[7], x[11], x[15]);
+	  quarter_round(x[0], x[5], x[10], x[15]);
+	  quarter_round(x[1], x[6], x[11], x[12]);
+	  quarter_round(x[2], x[7], x[8], x[13]);
+	  quarter_round(x[3], x[4], x[9], x[14]);
+	}
+      for (unsigned int i = 0; i < 16; ++i)
+	store32(out + 4 * i, x[i] + s[i]);
+      wipe(x, sizeof(x));
+      wipe(s, sizeof(s));
+    }
+
+  private:
+    bool rndbytes(unsigned char *buf, size_t size)
+    {
+      try {
+	if (fork_generation().load(std::memory_order_relaxed) != generation
+	    || since_reseed >= RESEED_BYTES)
+	  reseed();
+	while (size)
+	  {
+	    if (avail == 0)
+	      refill();
+	    const size_t n = std::min(size, avail);
+	    unsigned char *src = pool + POOL_SIZE - avail;
+	    std::memcpy(buf, src, n);
+	    wipe(src, n);
+	    avail -= n;
+	    buf += n;
+	    size -= n;
+	    since_reseed += n;
+	  }
+	return true;
+      }
+      catch (const std::exception&)
+	{
+	  return false;
+	}
+    }
+
+    void reseed()
+    {
+      generation = fork_generation().load(std::memory_order_relaxed);
+      unsigned char fresh[KEY_SIZE];
+      if (!seed->rand_bytes_noexcept(fresh, sizeof(fresh)))
+	throw buffered_random_error("reseed failed");
+      for (size_t i = 0; i < KEY_SIZE; ++i)
+	key[i] ^= fresh[i];
+      wipe(fresh, sizeof(fresh));
+      wipe(pool, sizeof(pool));
+      avail = 0;
+      since_reseed = 0;
+    }
+
+    void refill()
+    {
+      static const unsigned char nonce[12] = { 0 };
+      for (unsigned int i = 0; i < POOL_BLOCKS; ++i)
+	chacha20_block(key, i, nonce, pool + i * BLOCK_SIZE);
+      std::memcpy(key, pool, KEY_SIZE);
+      wipe(pool, KEY_SIZE);
+      avail = POOL_SIZE - KEY_SIZE;
+    }
+
+    static std::uint32_t load32(const unsigned char *p)
+    {
+      return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+    }
+
+    static void store32(unsigned char *p, const std::uint32_t v)
+    {
+      p[0] = static_cast<unsigned char>(v);
+      p[1] = static_cast<unsigned char>(v >> 8);
+      p[2] = static_cast<unsigned char>(v >> 16);
+      p[3] = static_cast<unsigned char>(v >> 24);
+    }
+
+    static std::uint32_t rotl(const std::uint32_t v, const int n)
+    {
+      return (v << n) | (v >> (32 - n));
+    }
+
+    static void quarter_round(std::uint32_t& a, std::uint32_t& b, std::uint32_t& c, std::uint32_t& d)
+    {
+      a += b; d ^= a; d = rotl(d, 16);
+      c += d; b ^= c; b = rotl(b, 12);
+      a += b; d ^= a; d = rotl(d, 8);
+      c += d; b ^= c; b = rotl(b, 7);
+    }
+
+    // memset that the compiler won't drop
+    static void wipe(void *p, const size_t n)
+    {
+      volatile unsigned char *v = static_cast<volatile unsigned char *>(p);
+      for (size_t i = 0; i < n; ++i)
+	v[i] = 0;
+    }
+
+    // incremented in the child after each fork()
+    static std::atomic<unsigned int>& fork_generation()
+    {
+      static std::atomic<unsigned int> gen{0};
+      return gen;
+    }
+
+    static void register_fork_handler()
+    {
+#if !defined(OPENVPN_PLATFORM_WIN)
+      static const int registered = ::pthread_atfork(nullptr, nullptr, []() {
+	  fork_generation().fetch_add(1, std::memory_order_relaxed);
+	});
+      (void)registered;
+#endif
+    }
+
+    RandomAPI::Ptr seed;
+    unsigned char key[KEY_SIZE] = {};
+    unsigned char pool[POOL_SIZE];
+    size_t avail = 0;
+    size_t since_reseed = 0;
+    unsigned int generation = 0;
+  };
+
+}
+
+#endif
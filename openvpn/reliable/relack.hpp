@@ -31,6 +31,7 @@
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/reliable/relcommon.hpp>
 
 namespace openvpn {
@@ -40,15 +41,24 @@ namespace openvpn {
   public:
     typedef reliable::id_t id_t;
 
+    // Largest ACK list that OpenVPN 2.x peers accept (RELIABLE_ACK_SIZE)
+    enum { MAX_ACK_LIST_COMPAT = 8 };
+
     ReliableAck(const size_t max_ack_list)
       : max_ack_list_(max_ack_list ? max_ack_list : std::numeric_limits<size_t>::max()) {}
 
     size_t size() const        { return data.size(); }
     bool empty() const         { return data.empty(); }
-    void push_back(id_t value) { data.push_back(value); }
     id_t front() const         { return data.front(); }
     void pop_front()           { data.pop_front(); }
 
+    // Queue an ACK, coalescing it with a pending ACK for the same id
+    // (as happens when the peer retransmits before our ACK went out).
+    void push_back(id_t value)
+    {
+      if (std::find(data.begin(), data.end(), value) == data.end())
+	data.push_back(value);
+    }
     // Called to read incoming ACK IDs from buf and mark them as ACKed in rel_send.
     // If live is false, read the ACK IDs, but don't modify rel_send.
     // Return the number of ACK IDs read.
@@ -65,6 +75,21 @@ namespace openvpn {
       return len;
     }
 
+    // Same as above, with the time of arrival so that rel_send
+    // can measure round trip times.
+    template <typename REL_SEND>
+    static size_t ack(REL_SEND& rel_send, Buffer& buf, const bool live, const Time& now)
+    {
+      const size_t len = buf.pop_front();
+      for (size_t i = 0; i < len; ++i)
+	{
+	  const id_t id = read_id(buf);
+	  if (live)
+	    rel_send.ack(id, now);
+	}
+      return len;
+    }
+
     static size_t ack_skip(Buffer& buf)
     {
       const size_t len = buf.pop_front();
@@ -109,6 +134,13 @@ namespace openvpn {
       return ntohl(net_id);
     }
 
+    // Release storage if no ACKs are pending
+    void compact()
+    {
+      if (data.empty())
+	std::deque<id_t>().swap(data);
+    }
+
   private:
     size_t max_ack_list_; // Maximum number of ACKs placed in a single message by prepend_acklist()
     std::deque<id_t> data;
@@ -88,6 +88,12 @@ namespace openvpn {
       window_.rm_head_nocheck();
     }
 
+    // Release storage of an empty window
+    void compact()
+    {
+      window_.compact();
+    }
+
   private:
     MessageWindow<Message, id_t> window_;
   };
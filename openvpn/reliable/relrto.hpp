@@ -0,0 +1,103 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Retransmission timeout estimation for reliability layer (RFC 6298)
+
+#ifndef OPENVPN_RELIABLE_RELRTO_H
+#define OPENVPN_RELIABLE_RELRTO_H
+
+#include <algorithm>
+
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class ReliableRTO
+  {
+  public:
+    enum {
+      MIN_RTO_MS = 200,
+      MAX_RTO_MS = 16000,
+      MAX_BACKOFF = 6,
+    };
+
+    // Feed a round trip time measured on a message that was not
+    // retransmitted (Karn's rule).
+    void sample(const Time::Duration& rtt)
+    {
+      const Time::type r = rtt.raw();
+      if (!n_samples)
+	{
+	  srtt = r;
+	  rttvar = r / 2;
+	}
+      else
+	{
+	  const Time::type err = srtt > r ? srtt - r : r - srtt;
+	  rttvar = (3 * rttvar + err) / 4;
+	  srtt = (7 * srtt + r) / 8;
+	}
+      ++n_samples;
+    }
+
+    // Return the retransmit timeout for a message that has been
+    // retransmitted n_retransmit times.  tls_timeout is used until
+    // we have a RTT sample, and is the lower bound if it is smaller
+    // than MIN_RTO_MS.
+    Time::Duration rto(const Time::Duration& tls_timeout, const unsigned int n_retransmit = 0) const
+    {
+      Time::Duration ret = tls_timeout;
+      if (n_samples)
+	{
+	  // 1/1024 second clock granularity
+	  ret = Time::Duration::binary_ms(srtt + std::max(rttvar * 4, Time::type(1)));
+	  Time::Duration lower = Time::Duration::milliseconds(MIN_RTO_MS);
+	  lower.min(tls_timeout);
+	  ret.max(lower);
+	}
+      ret = ret * (1u << std::min(n_retransmit, (unsigned int)MAX_BACKOFF));
+      const Time::Duration upper = Time::Duration::milliseconds(MAX_RTO_MS);
+      if (tls_timeout < upper)
+	ret.min(upper);
+      else
+	ret.min(tls_timeout);
+      return ret;
+    }
+
+    Time::Duration srtt_duration() const
+    {
+      return Time::Duration::binary_ms(srtt);
+    }
+
+    unsigned int samples() const
+    {
+      return n_samples;
+    }
+
+  private:
+    Time::type srtt = 0;
+    Time::type rttvar = 0;
+    unsigned int n_samples = 0;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_RELIABLE_RELRTO_H
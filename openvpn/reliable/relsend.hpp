@@ -29,6 +29,7 @@
 #include <openvpn/common/msgwin.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/reliable/relcommon.hpp>
+#include <openvpn/reliable/relrto.hpp>
 
 namespace openvpn {
 
@@ -62,8 +63,15 @@ namespace openvpn {
 	retransmit_at_ = now + tls_timeout;
       }
 
+      unsigned int n_retransmit() const
+      {
+	return n_retransmit_;
+      }
+
     private:
       Time retransmit_at_;
+      Time sent_at_;
+      unsigned int n_retransmit_ = 0;
     };
 
     ReliableSendTemplate() : next(0) {}
@@ -123,24 +131,57 @@ namespace openvpn {
 
     // Return a fresh Message object that can be used to
     // construct the next packet in the sequence.  Don't call
-    // unless ready() returns true.
+    // unless ready() returns true.  tls_timeout is the retransmit
+    // timeout until an RTT has been measured.
     Message& send(const Time& now, const Time::Duration& tls_timeout)
     {
       Message& msg = window_.ref_by_id(next);
       msg.id_ = next++;
-      msg.reset_retransmit(now, tls_timeout);
+      msg.sent_at_ = now;
+      msg.n_retransmit_ = 0;
+      msg.reset_retransmit(now, rto_.rto(tls_timeout));
       return msg;
     }
 
+    // Reschedule a message that has just been retransmitted,
+    // with exponential backoff.
+    void retransmitted(Message& msg, const Time& now, const Time::Duration& tls_timeout)
+    {
+      ++msg.n_retransmit_;
+      msg.reset_retransmit(now, rto_.rto(tls_timeout, msg.n_retransmit_));
+    }
+
     // Return true if send queue is ready to receive another packet
     bool ready() const { return window_.in_window(next); }
 
     // Remove a message from send queue that has been acknowledged
     void ack(const id_t id) { window_.rm_by_id(id); }
 
+    // Same as above, also measuring the round trip time of the
+    // message unless it was retransmitted (Karn's rule).
+    void ack(const id_t id, const Time& now)
+    {
+      if (window_.in_window(id))
+	{
+	  const Message& msg = window_.ref_by_id(id);
+	  if (msg.defined() && !msg.n_retransmit_ && msg.sent_at_.defined())
+	    rto_.sample(now - msg.sent_at_);
+	}
+      window_.rm_by_id(id);
+    }
+
+    const ReliableRTO& rto() const { return rto_; }
+
+    // Release storage of an empty window
+    void compact()
+    {
+      window_.compact();
+    }
+
   private:
     id_t next;
     MessageWindow<Message, id_t> window_;
+    ReliableRTO rto_;
   };
 
 } // namespace openvpn
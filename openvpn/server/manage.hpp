@@ -37,6 +37,7 @@
 #include <openvpn/server/servhalt.hpp>
 #include <openvpn/server/peerstats.hpp>
 #include <openvpn/server/peeraddr.hpp>
+#include <openvpn/server/manevents.hpp>
 #include <openvpn/auth/authcert.hpp>
 #include <openvpn/auth/authstatusconst.hpp>
 
@@ -91,6 +92,50 @@ namespace openvpn {
       virtual void userprop_local_update() = 0;
     };
 
+    // Send base for management layers that take events in batches
+    // (see manevents.hpp): the notifications below are queued on the
+    // session thread's producer instead of being handled in the
+    // call.  Implementations can post their own events, e.g. AUTH
+    // from auth_request() or DISCONNECT from pre_stop().
+    struct BatchedSend : public Send
+    {
+      BatchedSend(const ManEvents::Bus::Producer::Ptr& producer_arg)
+	: producer(producer_arg)
+      {
+      }
+
+      virtual void info_request(const std::string& imsg) override
+      {
+	ManEvents::Event ev(ManEvents::Event::INFO, instance_id());
+	ev.text = imsg;
+	post(std::move(ev));
+      }
+
+      virtual void stats_notify(const PeerStats& ps, const bool final) override
+      {
+	ManEvents::Event ev(ManEvents::Event::STATS, instance_id());
+	ev.stats = ps;
+	ev.final = final;
+	post(std::move(ev));
+      }
+
+      virtual void float_notify(const PeerAddr::Ptr& addr) override
+      {
+	ManEvents::Event ev(ManEvents::Event::FLOAT, instance_id());
+	if (addr)
+	  ev.peer = addr->remote;
+	post(std::move(ev));
+      }
+
+    protected:
+      void post(ManEvents::Event&& ev)
+      {
+	producer->post(std::move(ev));
+      }
+
+      ManEvents::Bus::Producer::Ptr producer;
+    };
+
     // Base class for the client instance receiver.  Note that all
     // client instance receivers (transport, routing, management,
     // etc.) must inherit virtually from RC because the client instance
@@ -0,0 +1,277 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Batched delivery of client instance events (connect, auth,
+// disconnect, stats, etc.) from session threads to the management
+// layer.  Each session thread has its own ManEvents::Producer, which
+// queues events and hands them to the management thread as one
+// vector per batch_size events or flush_ms, whichever comes first.
+// The Sink is called with the batch on the management thread's
+// io_context, so session threads never wait for management work.
+//
+// Back-pressure: at most max_batches batches are in flight to the
+// management thread.  Beyond that, producers keep events queued and
+// retry on their next flush, and once a producer's queue reaches
+// max_queue, new periodic events (non-final stats and info) are
+// dropped and counted.  Other events are always kept, since the
+// management layer's view of which clients exist depends on them.
+//
+// The Bus must outlive its producers and the batches in flight, so
+// the management io_context should be run until the producers have
+// stopped.
+
+#ifndef OPENVPN_SERVER_MANEVENTS_H
+#define OPENVPN_SERVER_MANEVENTS_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/server/peerstats.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+namespace openvpn {
+  namespace ManEvents {
+
+    // Plain data, so that it can be moved across threads.
+    struct Event
+    {
+      enum Type {
+	CONNECT,
+	AUTH,
+	DISCONNECT,
+	STATS,
+	INFO,
+	FLOAT,
+      };
+
+      Event() {}
+
+      Event(const Type type_arg, const std::uint64_t instance_id_arg)
+	: type(type_arg),
+	  instance_id(instance_id_arg)
+      {
+      }
+
+      // may be dropped under back-pressure
+      bool periodic() const
+      {
+	return (type == STATS && !final) || type == INFO;
+      }
+
+      Type type = INFO;
+      std::uint64_t instance_id = 0;
+      std::string text;   // AUTH: username, INFO: message, DISCONNECT: reason
+      AddrPort peer;      // CONNECT, AUTH, FLOAT
+      PeerStats stats;    // STATS
+      bool final = false; // STATS
+    };
+
+    struct Sink
+    {
+      // Called on the management thread, events may be moved from.
+      virtual void man_events(std::vector<Event>& events) = 0;
+    };
+
+    struct Config
+    {
+      size_t batch_size = 256;
+      unsigned int flush_ms = 5;
+      size_t max_batches = 64;
+      size_t max_queue = 4096;
+    };
+
+    class Bus
+    {
+    public:
+      Bus(openvpn_io::io_context& man_context_arg,
+	  Sink* sink_arg,
+	  const Config& config_arg = Config())
+	: man_context(man_context_arg),
+	  sink(sink_arg),
+	  config(config_arg)
+      {
+      }
+
+      // Queues the events of the sessions of one thread, used on
+      // that thread only.
+      class Producer : public RC<thread_unsafe_refcount>
+      {
+      public:
+	typedef RCPtr<Producer> Ptr;
+
+	Producer(Bus& bus_arg, openvpn_io::io_context& io_context)
+	  : bus(bus_arg),
+	    timer(io_context)
+	{
+	}
+
+	void post(Event&& ev)
+	{
+	  if (halt)
+	    return;
+	  if (queue.size() >= bus.config.max_queue && ev.periodic())
+	    {
+	      bus.n_dropped_.fetch_add(1, std::memory_order_relaxed);
+	      return;
+	    }
+	  queue.push_back(std::move(ev));
+	  if (queue.size() >= bus.config.batch_size)
+	    flush(false);
+	  if (!queue.empty())
+	    set_timer();
+	}
+
+	size_t queued() const
+	{
+	  return queue.size();
+	}
+
+	// Hand over everything queued, regardless of back-pressure.
+	void stop()
+	{
+	  if (halt)
+	    return;
+	  flush(true);
+	  halt = true;
+	  timer.cancel();
+	}
+
+      private:
+	void flush(const bool force)
+	{
+	  while (!queue.empty())
+	    {
+	      const size_t n = force ? queue.size() : std::min(queue.size(), bus.config.batch_size);
+	      if (!bus.hand_off(queue, n, force))
+		{
+		  bus.n_deferred_.fetch_add(1, std::memory_order_relaxed);
+		  break;
+		}
+	    }
+	}
+
+	void set_timer()
+	{
+	  if (timer_pending)
+	    return;
+	  timer_pending = true;
+	  timer.expires_after(Time::Duration::milliseconds(bus.config.flush_ms));
+	  timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+			   {
+			     self->timer_pending = false;
+			     if (!error && !self->halt)
+			       {
+				 self->flush(false);
+				 if (!self->queue.empty())
+				   self->set_timer();
+			       }
+			   });
+	}
+
+	Bus& bus;
+	AsioTimer timer;
+	std::deque<Event> queue;
+	bool timer_pending = false;
+	bool halt = false;
+      };
+
+      std::uint64_t n_events() const
+      {
+	return n_events_.load(std::memory_order_relaxed);
+      }
+
+      std::uint64_t n_batches() const
+      {
+	return n_batches_.load(std::memory_order_relaxed);
+      }
+
+      // periodic events dropped under back-pressure
+      std::uint64_t n_dropped() const
+      {
+	return n_dropped_.load(std::memory_order_relaxed);
+      }
+
+      // flushes put off because max_batches were in flight
+      std::uint64_t n_deferred() const
+      {
+	return n_deferred_.load(std::memory_order_relaxed);
+      }
+
+      size_t in_flight() const
+      {
+	return in_flight_.load(std::memory_order_relaxed);
+      }
+
+    private:
+      Bus(const Bus&) = delete;
+      Bus& operator=(const Bus&) = delete;
+
+      // Any thread.  Move the first n events of queue to the
+      // management thread as one batch.
+      bool hand_off(std::deque<Event>& queue, const size_t n, const bool force)
+      {
+	if (in_flight_.fetch_add(1, std::memory_order_acq_rel) >= config.max_batches && !force)
+	  {
+	    in_flight_.fetch_sub(1, std::memory_order_acq_rel);
+	    return false;
+	  }
+	std::vector<Event> batch;
+	batch.reserve(n);
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    batch.push_back(std::move(queue.front()));
+	    queue.pop_front();
+	  }
+	n_events_.fetch_add(n, std::memory_order_relaxed);
+	n_batches_.fetch_add(1, std::memory_order_relaxed);
+	openvpn_io::post(man_context, [this, batch=std::move(batch)]() mutable
+			 {
+			   if (sink)
+			     sink->man_events(batch);
+			   in_flight_.fetch_sub(1, std::memory_order_acq_rel);
+			 });
+	return true;
+      }
+
+      openvpn_io::io_context& man_context;
+      Sink* sink;
+      const Config config;
+
+      std::atomic<size_t> in_flight_{0};
+      std::atomic<std::uint64_t> n_events_{0};
+      std::atomic<std::uint64_t> n_batches_{0};
+      std::atomic<std::uint64_t> n_dropped_{0};
+      std::atomic<std::uint64_t> n_deferred_{0};
+    };
+
+  }
+}
+
+#endif
@@ -25,9 +25,12 @@
 #include <cstdint> // for std::uint32_t, uint64_t, etc.
 
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/objpool.hpp>
 #include <openvpn/common/to_string.hpp>
 #include <openvpn/common/jsonlib.hpp>
+#include <openvpn/common/hash.hpp>
 #include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/addrkey.hpp>
 
 namespace openvpn {
   struct AddrPort
@@ -49,14 +52,30 @@ namespace openvpn {
     }
 #endif
 
+    // keyed, since remote peers choose their address and port
+    std::size_t hashval() const
+    {
+      return IP::AddrKey(addr, port).keyed_hashval();
+    }
+
+    bool operator==(const AddrPort& other) const
+    {
+      return port == other.port && addr == other.addr;
+    }
+
     IP::Addr addr;
     std::uint16_t port;
   };
 
-  struct PeerAddr : public RC<thread_unsafe_refcount>
+  struct PeerAddr : public RC<thread_unsafe_refcount>, public PoolAllocated<PeerAddr>
   {
     typedef RCPtr<PeerAddr> Ptr;
 
+    static const char *pool_name()
+    {
+      return "peer_addr";
+    }
+
     PeerAddr()
       : tcp(false)
     {
@@ -83,10 +102,24 @@ namespace openvpn {
     }
 #endif
 
+    std::size_t hashval() const
+    {
+      const std::uint64_t w[4] = { remote.hashval(), local.hashval(), tcp, 0 };
+      return std::size_t(FastHash::hash(w, sizeof(w)));
+    }
+
+    bool operator==(const PeerAddr& other) const
+    {
+      return tcp == other.tcp && remote == other.remote && local == other.local;
+    }
+
     AddrPort remote;
     AddrPort local;
     bool tcp;
   };
 }
 
+OPENVPN_HASH_METHOD(openvpn::AddrPort, hashval);
+OPENVPN_HASH_METHOD(openvpn::PeerAddr, hashval);
+
 #endif
@@ -0,0 +1,150 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Dispatch of P_DATA_V2 packets by peer-id for the UDP server
+// transport, with floating of clients to a new source address.
+//
+// A packet from the peer's address on record goes straight to its
+// session.  A packet from any other address (NAT rebinding, or a
+// client that restarted its transport after a network change) is
+// handed to the session as well, and only if the session accepts it
+// -- TransportClientInstance::Recv::transport_recv() returns true
+// once ProtoContext::data_decrypt() has checked the AEAD tag and the
+// replay window -- is the peer rebound to the new address.  Rebinding
+// replaces the PeerIDTable entry with an updated copy, so concurrent
+// lookups see either the old or the new address, and generates no
+// control channel traffic.
+//
+// The table doesn't own the sessions: remove() a peer before its
+// session object goes away.
+
+#ifndef OPENVPN_SERVER_PEERFLOAT_H
+#define OPENVPN_SERVER_PEERFLOAT_H
+
+#include <cstdint>
+#include <memory>
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/server/peeraddr.hpp>
+#include <openvpn/server/peeridtable.hpp>
+
+namespace openvpn {
+
+  template <typename RECV>
+  class PeerFloat
+  {
+  public:
+    struct Entry
+    {
+      RECV* recv;
+      AddrPort remote;
+      AddrPort local;
+      std::uint64_t n_floats;
+    };
+
+    typedef PeerIDTable<Entry> Table;
+    typedef typename Table::Reader Reader;
+
+    enum Result {
+      DROPPED,  // no such peer, or not authenticated from a new address
+      RECEIVED, // passed to the session from the known address
+      FLOATED,  // authenticated from a new address, peer rebound
+    };
+
+    // Return the peer-id of a P_DATA_V2 packet, or -1.
+    static int data_v2_peer_id(const Buffer& buf)
+    {
+      enum {
+	DATA_V2 = 9,
+	OP_PEER_ID_UNDEF = 0x00FFFFFF,
+      };
+      if (buf.size() < 4 || (buf[0] >> 3) != DATA_V2)
+	return -1;
+      const int peer_id = (buf[1] << 16) | (buf[2] << 8) | buf[3];
+      return peer_id != OP_PEER_ID_UNDEF ? peer_id : -1;
+    }
+
+    std::unique_ptr<Reader> register_reader()
+    {
+      return table.register_reader();
+    }
+
+    bool add(const int peer_id, RECV* recv, const PeerAddr& addr)
+    {
+      return table.insert(peer_id, new Entry{recv, addr.remote, addr.local, 0});
+    }
+
+    void remove(const int peer_id)
+    {
+      table.erase(peer_id);
+    }
+
+    // The returned pointer remains valid until the calling reader's
+    // next Reader::quiescent() call.
+    const Entry* lookup(const int peer_id) const
+    {
+      return table.lookup(peer_id);
+    }
+
+    std::uint64_t n_floats(const int peer_id) const
+    {
+      const Entry* e = table.lookup(peer_id);
+      return e ? e->n_floats : 0;
+    }
+
+    // Dispatch a packet received from the given address.  Must be
+    // called from a registered reader, on the thread that runs the
+    // peer's session.
+    Result recv(BufferAllocated& buf, const AddrPort& from)
+    {
+      const int peer_id = data_v2_peer_id(buf);
+      const Entry* e = table.lookup(peer_id);
+      if (!e)
+	return DROPPED;
+      if (e->remote.port == from.port && e->remote.addr == from.addr)
+	{
+	  e->recv->transport_recv(buf);
+	  return RECEIVED;
+	}
+
+      if (!e->recv->transport_recv(buf))
+	return DROPPED;
+
+      // e stays valid until we are quiescent, even if the session
+      // removed itself while processing the packet
+      RECV* recv = e->recv;
+      PeerAddr::Ptr addr(new PeerAddr());
+      addr->remote = from;
+      addr->local = e->local;
+      if (!table.replace_if(peer_id, e, new Entry{recv, from, e->local, e->n_floats + 1}))
+	return RECEIVED;
+      recv->float_notify(addr);
+      return FLOATED;
+    }
+
+  private:
+    Table table;
+  };
+
+}
+
+#endif
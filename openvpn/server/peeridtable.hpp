@@ -0,0 +1,241 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Flat peer-id -> entry table for server data channel dispatch.
+//
+// The 24-bit peer-id space is covered by a two-level array of atomic
+// pointers with lazily allocated pages, so a lookup is two dependent
+// loads and never takes a lock.  Insert, replace and erase are
+// serialized by an internal mutex and are expected to happen off the
+// hot path (session creation/teardown, client float).
+//
+// Reclaim is RCU-style, using quiescent-state based reclamation
+// (see QSBR): each worker thread that calls lookup() registers a
+// Reader and calls Reader::quiescent() at a point where it holds no
+// entry pointers.  Entries removed by replace() or erase() are
+// reclaimed only after every online reader has passed through a
+// quiescent state.
+//
+// To float a peer to a new address, store the address in the entry
+// and replace() the entry with an updated copy; readers will then
+// see either the old or the new (session, address) pair, never a mix.
+
+#ifndef OPENVPN_SERVER_PEERIDTABLE_H
+#define OPENVPN_SERVER_PEERIDTABLE_H
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/qsbr.hpp>
+
+namespace openvpn {
+
+  template <typename T, typename RECLAIM = std::default_delete<T>>
+  class PeerIDTable
+  {
+  public:
+    OPENVPN_EXCEPTION(peer_id_table_error);
+
+    enum {
+      PEER_ID_BITS = 24,
+      PAGE_BITS = 12,
+      PAGE_SIZE = 1 << PAGE_BITS,
+      N_PAGES = 1 << (PEER_ID_BITS - PAGE_BITS),
+    };
+
+    typedef QSBR::Reader Reader;
+
+    PeerIDTable(RECLAIM reclaim_arg = RECLAIM())
+      : reclaim_fn(std::move(reclaim_arg))
+    {
+      for (auto& p : pages)
+	p.store(nullptr, std::memory_order_relaxed);
+    }
+
+    PeerIDTable(const PeerIDTable&) = delete;
+    PeerIDTable& operator=(const PeerIDTable&) = delete;
+
+    ~PeerIDTable()
+    {
+      for (auto& p : pages)
+	{
+	  Page* page = p.load(std::memory_order_relaxed);
+	  if (page)
+	    {
+	      for (auto& s : page->slots)
+		{
+		  T* obj = s.load(std::memory_order_relaxed);
+		  if (obj)
+		    reclaim_fn(obj);
+		}
+	      delete page;
+	    }
+	}
+    }
+
+    // Register the calling worker thread as a reader.  The Reader
+    // must be destroyed before the table.
+    std::unique_ptr<Reader> register_reader()
+    {
+      return qsbr.register_reader();
+    }
+
+    // Lock-free lookup.  The returned pointer remains valid until the
+    // calling thread's next Reader::quiescent() call.
+    T* lookup(const int peer_id) const
+    {
+      if (!valid(peer_id))
+	return nullptr;
+      const Page* page = pages[unsigned(peer_id) >> PAGE_BITS].load(std::memory_order_acquire);
+      if (!page)
+	return nullptr;
+      return page->slots[unsigned(peer_id) & (PAGE_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
+    // Install obj for peer_id, which must be unused.  The table takes
+    // ownership of obj.  Returns false if peer_id is already in use.
+    bool insert(const int peer_id, T* obj)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::atomic<T*>& s = slot(peer_id);
+      if (s.load(std::memory_order_relaxed))
+	return false;
+      s.store(obj, std::memory_order_release);
+      ++size_;
+      return true;
+    }
+
+    // Atomically replace the entry for peer_id (e.g. on client
+    // float), deferring reclaim of the previous entry.
+    void replace(const int peer_id, T* obj)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::atomic<T*>& s = slot(peer_id);
+      T* old = s.exchange(obj, std::memory_order_acq_rel);
+      if (old)
+	retire(old);
+      else if (obj)
+	++size_;
+      if (!obj && old)
+	--size_;
+      qsbr.reclaim();
+    }
+
+    // Replace the entry for peer_id with obj only if it is still
+    // expected, so that of two racing floats of the same peer only
+    // the first wins.  On failure, obj is reclaimed immediately
+    // (it was never visible to readers) and false is returned.
+    bool replace_if(const int peer_id, const T* expected, T* obj)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::atomic<T*>& s = slot(peer_id);
+	T* old = s.load(std::memory_order_relaxed);
+	if (old == expected && old)
+	  {
+	    s.store(obj, std::memory_order_release);
+	    retire(old);
+	    qsbr.reclaim();
+	    return true;
+	  }
+      }
+      if (obj)
+	reclaim_fn(obj);
+      return false;
+    }
+
+    // Remove the entry for peer_id, deferring its reclaim.
+    void erase(const int peer_id)
+    {
+      replace(peer_id, nullptr);
+    }
+
+    // Reclaim retired entries that no reader can still reference.
+    // Called implicitly by replace() and erase().
+    void reclaim()
+    {
+      qsbr.reclaim();
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return size_;
+    }
+
+    size_t n_retired() const
+    {
+      return qsbr.n_retired();
+    }
+
+    static bool valid(const int peer_id)
+    {
+      return peer_id >= 0 && peer_id < (1 << PEER_ID_BITS);
+    }
+
+  private:
+    struct Page
+    {
+      Page()
+      {
+	for (auto& s : slots)
+	  s.store(nullptr, std::memory_order_relaxed);
+      }
+
+      std::atomic<T*> slots[PAGE_SIZE];
+    };
+
+    // mutex must be held
+    std::atomic<T*>& slot(const int peer_id)
+    {
+      if (!valid(peer_id))
+	throw peer_id_table_error("peer-id out of range");
+      std::atomic<Page*>& p = pages[unsigned(peer_id) >> PAGE_BITS];
+      Page* page = p.load(std::memory_order_relaxed);
+      if (!page)
+	{
+	  page = new Page();
+	  p.store(page, std::memory_order_release);
+	}
+      return page->slots[unsigned(peer_id) & (PAGE_SIZE - 1)];
+    }
+
+    // mutex must be held
+    void retire(T* obj)
+    {
+      qsbr.retire([this, obj]() {
+	  reclaim_fn(obj);
+	});
+    }
+
+    std::atomic<Page*> pages[N_PAGES];
+
+    mutable std::mutex mutex;
+    size_t size_ = 0;
+    RECLAIM reclaim_fn;
+    QSBR qsbr; // destroyed first, reclaims the retired entries
+  };
+
+}
+
+#endif
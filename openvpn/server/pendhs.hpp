@@ -0,0 +1,187 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Bounded table of half-open handshakes, keyed by the client's
+// ProtoSessionID and address.
+//
+// Clients retransmit their initial reset until they see a reply.
+// Looking up the retransmission here is O(1) and lets the server
+// answer it from the state kept for the first copy instead of
+// building that state again.
+//
+// The table is set-associative: a key hashes to one bucket of WAYS
+// slots, and a new entry takes a free or expired slot of its bucket,
+// or else evicts the oldest one.  So its memory is fixed at
+// construction however many half-open handshakes there are, and an
+// entry lives at most for the table's lifetime.  Not thread-safe.
+
+#ifndef OPENVPN_SERVER_PENDHS_H
+#define OPENVPN_SERVER_PENDHS_H
+
+#include <vector>
+#include <cstdint>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/fasthash.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/ssl/psid.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+namespace openvpn {
+
+  template <typename T>
+  class PendingHandshakeTable
+  {
+  public:
+    enum {
+      WAYS = 4,
+    };
+
+    // capacity is rounded up to a power of two of at least WAYS
+    PendingHandshakeTable(const size_t capacity,
+			  const Time::Duration& lifetime_arg)
+      : lifetime(lifetime_arg)
+    {
+      size_t n = 1;
+      while (n * WAYS < capacity)
+	n <<= 1;
+      mask = n - 1;
+      slots.resize(n * WAYS);
+    }
+
+    // Return the live entry for psid/addr, or nullptr.
+    T* find(const ProtoSessionID& psid, const AddrPort& addr, const Time& now)
+    {
+      Slot* s = lookup(psid, addr, now);
+      return s ? &s->value : nullptr;
+    }
+
+    // Add an entry for psid/addr, replacing a live one with the same
+    // key, and return its value, reset to T().  The entry expires
+    // after the table's lifetime.
+    T& insert(const ProtoSessionID& psid, const AddrPort& addr, const Time& now)
+    {
+      Slot* s = lookup(psid, addr, now);
+      if (!s)
+	s = victim(bucket(psid, addr), now);
+      s->psid = psid;
+      s->addr = addr;
+      s->expire = now + lifetime;
+      s->value = T();
+      return s->value;
+    }
+
+    // Remove the entry for psid/addr, returning true if it was live.
+    bool erase(const ProtoSessionID& psid, const AddrPort& addr, const Time& now)
+    {
+      Slot* s = lookup(psid, addr, now);
+      if (!s)
+	return false;
+      s->clear();
+      return true;
+    }
+
+    void clear()
+    {
+      for (auto& s : slots)
+	s.clear();
+    }
+
+    // live entries, for stats and tests
+    size_t size(const Time& now) const
+    {
+      size_t n = 0;
+      for (const auto& s : slots)
+	n += s.live(now);
+      return n;
+    }
+
+    size_t capacity() const
+    {
+      return slots.size();
+    }
+
+    // live entries pushed out by newer ones while the table was full
+    size_t evicted() const
+    {
+      return n_evicted;
+    }
+
+  private:
+    struct Slot
+    {
+      bool live(const Time& now) const
+      {
+	return expire.defined() && now < expire;
+      }
+
+      void clear()
+      {
+	expire.reset();
+	value = T();
+      }
+
+      ProtoSessionID psid;
+      AddrPort addr;
+      Time expire;
+      T value;
+    };
+
+    Slot* bucket(const ProtoSessionID& psid, const AddrPort& addr)
+    {
+      const size_t h = size_t(FastHash::mix(psid.hashval(), addr.hashval()));
+      return &slots[(h & mask) * WAYS];
+    }
+
+    Slot* lookup(const ProtoSessionID& psid, const AddrPort& addr, const Time& now)
+    {
+      Slot* s = bucket(psid, addr);
+      for (size_t i = 0; i < WAYS; ++i, ++s)
+	if (s->live(now) && s->psid == psid && s->addr == addr)
+	  return s;
+      return nullptr;
+    }
+
+    // a free or expired slot of the bucket, else its oldest entry
+    Slot* victim(Slot* s, const Time& now)
+    {
+      Slot* to = s;
+      for (size_t i = 0; i < WAYS; ++i)
+	{
+	  if (!s[i].live(now))
+	    return &s[i];
+	  if (s[i].expire < to->expire)
+	    to = &s[i];
+	}
+      ++n_evicted;
+      return to;
+    }
+
+    std::vector<Slot> slots;
+    size_t mask;
+    Time::Duration lifetime;
+    size_t n_evicted = 0;
+  };
+
+}
+
+#endif
@@ -0,0 +1,216 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Versioned server configuration, so that pushed options and protocol
+// settings can be changed without restarting the server.  A
+// ServerConfig is immutable once published to a ServerConfigStore.
+// Each server thread builds its own ProtoContext::Config from the
+// current ServerConfig and hands both to ServerProto::Factory::reload(),
+// so that new sessions see one consistent version.  Existing sessions
+// keep the version they started with, and get the changes to their
+// pushed routes and DNS settings as a PUSH_UPDATE built by
+// push_update().
+
+#ifndef OPENVPN_SERVER_SERVCONFIG_H
+#define OPENVPN_SERVER_SERVCONFIG_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <utility> // for std::move
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/options/servpush.hpp>
+#include <openvpn/options/pushcache.hpp>
+#include <openvpn/options/continuation.hpp>
+
+namespace openvpn {
+
+  class ServerConfig : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<ServerConfig> Ptr;
+
+    // opt is the server config, its "push" directives give the
+    // common pushed options
+    ServerConfig(const OptionList& opt,
+		 const size_t max_size_arg = PushReply::DEFAULT_MAX_SIZE)
+      : options_(opt),
+	max_size(max_size_arg)
+    {
+      push_.parse("push", opt);
+      push_reply_.reset(new PushReply(push_, max_size));
+    }
+
+    // assigned by ServerConfigStore::publish(), 0 before
+    unsigned int version() const { return version_; }
+
+    const OptionList& options() const { return options_; }
+    const ServerPushList& push() const { return push_; }
+    const PushReply& push_reply() const { return *push_reply_; }
+
+    // Build the PUSH_UPDATE messages that bring a session which
+    // started with from up to date with this config.  Each message
+    // gives all instances of the option names it changes, since the
+    // client replaces them by name.  Returns false if some changes
+    // can't be pushed: pushed options other than those allowed in a
+    // PUSH_UPDATE, or a name whose instances don't fit in one
+    // message.  The session keeps its old settings for those until
+    // it reconnects.
+    bool push_update(const ServerConfig& from, std::vector<BufferPtr>& msgs) const
+    {
+      const Entries old_ent = entries(from.push_);
+      const Entries new_ent = entries(push_);
+
+      bool complete = true;
+      std::vector<std::string> names;
+      for (const Entries* ent : { &old_ent, &new_ent })
+	for (auto &e : *ent)
+	  if (std::find(names.begin(), names.end(), e.first.ref(0)) == names.end())
+	    names.push_back(e.first.ref(0));
+
+      std::string msg;
+      for (auto &name : names)
+	{
+	  if (named(old_ent, name) == named(new_ent, name))
+	    continue;
+	  if (!OptionListContinuation::push_update_allowed(name))
+	    {
+	      complete = false;
+	      continue;
+	    }
+
+	  std::string group;
+	  for (auto &e : new_ent)
+	    if (e.first.ref(0) == name)
+	      group += escape(e.second);
+	  if (group.empty())
+	    group = ",-" + name;
+
+	  if (PREFIX_LEN + group.length() + 1 > max_size)
+	    {
+	      complete = false;
+	      continue;
+	    }
+	  if (!msg.empty() && PREFIX_LEN + msg.length() + group.length() + 1 > max_size)
+	    {
+	      msgs.push_back(render(msg));
+	      msg.clear();
+	    }
+	  msg += group;
+	}
+      if (!msg.empty())
+	msgs.push_back(render(msg));
+      return complete;
+    }
+
+  private:
+    friend class ServerConfigStore; // sets version_
+
+    enum {
+      PREFIX_LEN = 11, // "PUSH_UPDATE"
+    };
+
+    // pushed options with their unparsed text, empty ones skipped
+    typedef std::vector<std::pair<Option, std::string>> Entries;
+
+    static Entries entries(const ServerPushList& push)
+    {
+      Entries ret;
+      for (auto &e : push)
+	{
+	  ServerPushList one;
+	  one.push_back(e);
+	  const OptionList opt = one.to_option_list();
+	  if (!opt.empty() && !opt[0].empty())
+	    ret.emplace_back(opt[0], e);
+	}
+      return ret;
+    }
+
+    static std::vector<Option> named(const Entries& ent, const std::string& name)
+    {
+      std::vector<Option> ret;
+      for (auto &e : ent)
+	if (e.first.ref(0) == name)
+	  ret.push_back(e.first);
+      return ret;
+    }
+
+    static std::string escape(const std::string& e)
+    {
+      std::ostringstream os;
+      os << ',';
+      ServerPushList::output_arg(e, os);
+      return os.str();
+    }
+
+    static BufferPtr render(const std::string& body)
+    {
+      BufferPtr buf(new BufferAllocated(PREFIX_LEN + body.length() + 1, 0));
+      buf->write((const unsigned char *)"PUSH_UPDATE", PREFIX_LEN);
+      buf->write((const unsigned char *)body.c_str(), body.length());
+      buf->null_terminate();
+      return buf;
+    }
+
+    unsigned int version_ = 0;
+    const OptionList options_;
+    const size_t max_size;
+    ServerPushList push_;
+    PushReply::Ptr push_reply_;
+  };
+
+  // Holds the current ServerConfig, shared by the server threads.
+  class ServerConfigStore : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<ServerConfigStore> Ptr;
+
+    // Make config current, returning its version.  config must not
+    // be published more than once.
+    unsigned int publish(const ServerConfig::Ptr& config)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      config->version_ = ++version;
+      current_ = config;
+      return version;
+    }
+
+    ServerConfig::Ptr current() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return current_;
+    }
+
+  private:
+    mutable std::mutex mutex;
+    unsigned int version = 0;
+    ServerConfig::Ptr current_;
+  };
+}
+
+#endif
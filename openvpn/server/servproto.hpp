@@ -25,6 +25,7 @@
 #define OPENVPN_SERVER_SERVPROTO_H
 
 #include <memory>
+#include <vector>
 #include <utility> // for std::move
 
 #include <openvpn/common/size.hpp>
@@ -33,15 +34,20 @@
 #include <openvpn/common/unicode.hpp>
 #include <openvpn/common/abort.hpp>
 #include <openvpn/common/link.hpp>
+#include <openvpn/common/objpool.hpp>
 #include <openvpn/common/string.hpp>
+#include <openvpn/common/to_string.hpp>
 #include <openvpn/buffer/bufstream.hpp>
-#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/time/asiotimerwheel.hpp>
 #include <openvpn/time/coarsetime.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
 #include <openvpn/ssl/proto.hpp>
 #include <openvpn/transport/server/transbase.hpp>
 #include <openvpn/tun/server/tunbase.hpp>
 #include <openvpn/server/manage.hpp>
+#include <openvpn/server/servconfig.hpp>
+#include <openvpn/server/pendhs.hpp>
 
 #ifdef OPENVPN_DEBUG_SERVPROTO
 #define OPENVPN_LOG_SERVPROTO(x) OPENVPN_LOG(x)
@@ -61,20 +67,60 @@ namespace openvpn {
   public:
     class Session;
 
+    // Sessions of one Factory, for operations on all of them.  The
+    // list is only used on the Factory's thread.
+    struct SessionList : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<SessionList> Ptr;
+
+      std::vector<Session*> sessions;
+    };
+
     class Factory : public TransportClientInstance::Factory
     {
     public:
       typedef RCPtr<Factory> Ptr;
       typedef Base::Config ProtoConfig;
 
+      enum {
+	PENDING_RESETS_DEFAULT = 4096,
+      };
+
       Factory(openvpn_io::io_context& io_context_arg,
 	      const Base::Config& c)
-	: io_context(io_context_arg)
+	: io_context(io_context_arg),
+	  timer_wheel(new AsioTimerWheel(io_context_arg)),
+	  session_list(new SessionList())
       {
-	if (c.tls_crypt_enabled())
-	  preval.reset(new Base::TLSCryptPreValidate(c, true));
-	else if (c.tls_auth_enabled())
-	  preval.reset(new Base::TLSAuthPreValidate(c, true));
+	init_prevalidate(c);
+      }
+
+      // For a fast server shutdown: send an explicit-exit-notify to
+      // the client of each running session of this thread in one
+      // pass, then stop the sessions.  UDP clients reconnect or fail
+      // over within a round trip instead of after their keepalive
+      // timeout.  With a batching transport (see
+      // UDPTransport::Link::set_send_batch()) the notifications
+      // leave in a few sendmmsg() calls at the end of the current
+      // reactor iteration, so call this before the transport is
+      // stopped.  Returns the number of notifications sent.
+      size_t shutdown_broadcast();
+
+      // running and stopped sessions not yet destroyed
+      size_t n_sessions() const
+      {
+	return session_list->sessions.size();
+      }
+
+      // Start new sessions with server config sc, and the proto
+      // config pc that this thread built from it.  Sessions already
+      // running keep their config until their reload_config() is
+      // called.
+      void reload(const ServerConfig::Ptr& sc, const ProtoConfig::Ptr& pc)
+      {
+	init_prevalidate(*pc);
+	proto_context_config = pc;
+	server_config = sc;
       }
 
       virtual TransportClientInstance::Recv::Ptr new_client_instance() override;
@@ -92,6 +138,76 @@ namespace openvpn {
 	  return true;
       }
 
+      virtual size_t validate_initial_packets(const BufferAllocated* const* bufs, const size_t n, bool* ok) override
+      {
+	if (preval)
+	  {
+	    const size_t n_ok = preval->validate_batch(bufs, n, ok);
+	    for (size_t i = n_ok; i < n; ++i)
+	      stats->error(Error::TLS_AUTH_FAIL);
+	    return n_ok;
+	  }
+	else
+	  return TransportClientInstance::Factory::validate_initial_packets(bufs, n, ok);
+      }
+
+      virtual InitialPacket process_initial_packet(const BufferAllocated& net_buf,
+						   const PeerAddr& addr,
+						   BufferAllocated& reply) override
+      {
+	// A retransmitted reset is answered from what was done for the
+	// first copy: the same stateless reply, or nothing if it
+	// started a session, which retransmits its own reset.
+	ProtoSessionID client_psid;
+	const bool reset = Base::initial_reset_psid(net_buf, client_psid);
+	if (reset)
+	  {
+	    const BufferAllocated* cached = pending_resets->find(client_psid, addr.remote, *proto_context_config->now);
+	    if (cached)
+	      {
+		if (!cached->defined() || !validate_initial_packet(net_buf))
+		  return INITIAL_DROP;
+		reply = *cached;
+		return INITIAL_REPLY;
+	      }
+	  }
+
+	InitialPacket ret;
+	if (psid_cookie)
+	  {
+	    switch (psid_cookie->process(net_buf, addr.remote.addr, addr.remote.port, reply))
+	      {
+	      case Base::PsidCookie::REPLY:
+		ret = INITIAL_REPLY;
+		break;
+	      case Base::PsidCookie::ACCEPT:
+		ret = INITIAL_INSTANCE;
+		break;
+	      default:
+		stats->error(Error::TLS_AUTH_FAIL);
+		return INITIAL_DROP;
+	      }
+	  }
+	else
+	  ret = TransportClientInstance::Factory::process_initial_packet(net_buf, addr, reply);
+
+	if (reset && ret != INITIAL_DROP)
+	  {
+	    BufferAllocated& entry = pending_resets->insert(client_psid, addr.remote, *proto_context_config->now);
+	    if (ret == INITIAL_REPLY)
+	      entry = reply;
+	  }
+	return ret;
+      }
+
+      // Bound the number of half-open handshakes remembered by
+      // process_initial_packet(), default PENDING_RESETS_DEFAULT.
+      void set_max_pending_resets(const size_t n)
+      {
+	max_pending_resets = n;
+	pending_resets.reset(new PendingResets(max_pending_resets, pending_resets_lifetime));
+      }
+
       ProtoConfig::Ptr clone_proto_config() const
       {
 	return new ProtoConfig(*proto_context_config);
@@ -99,6 +215,12 @@ namespace openvpn {
 
       openvpn_io::io_context& io_context;
       ProtoConfig::Ptr proto_context_config;
+      ServerConfig::Ptr server_config; // optional, see reload()
+
+      // drives the housekeeping timers of all sessions
+      AsioTimerWheel::Ptr timer_wheel;
+
+      SessionList::Ptr session_list;
 
       ManClientInstance::Factory::Ptr man_factory;
       TunClientInstance::Factory::Ptr tun_factory;
@@ -106,14 +228,42 @@ namespace openvpn {
       SessionStats::Ptr stats;
 
     private:
+      friend class Session; // uses psid_cookie
+
+      void init_prevalidate(const Base::Config& c)
+      {
+	preval.reset();
+	psid_cookie.reset();
+	if (c.tls_crypt_v2_enabled())
+	  preval.reset(new Base::TLSCryptV2PreValidate(c, true));
+	else if (c.tls_crypt_enabled())
+	  preval.reset(new Base::TLSCryptPreValidate(c, true));
+	else if (c.tls_auth_enabled())
+	  preval.reset(new Base::TLSAuthPreValidate(c, true));
+	if (c.psid_cookie)
+	  psid_cookie.reset(new Base::PsidCookie(c));
+
+	// no longer than a PsidCookie cookie stays valid
+	const unsigned int lifetime = c.handshake_window.to_seconds() / 2;
+	pending_resets_lifetime = Time::Duration::seconds(lifetime ? lifetime : 1);
+	pending_resets.reset(new PendingResets(max_pending_resets, pending_resets_lifetime));
+      }
+
+      typedef PendingHandshakeTable<BufferAllocated> PendingResets;
+
       Base::TLSWrapPreValidate::Ptr preval;
+      Base::PsidCookie::Ptr psid_cookie;
+      std::unique_ptr<PendingResets> pending_resets;
+      Time::Duration pending_resets_lifetime;
+      size_t max_pending_resets = PENDING_RESETS_DEFAULT;
     };
 
     // This is the main server-side client instance object
     class Session : Base,                  // OpenVPN protocol implementation
 		    public TransportLink,  // Transport layer
 		    public TunLink,        // Tun/routing layer
-		    public ManLink         // Management layer
+		    public ManLink,        // Management layer
+		    public PoolAllocated<Session, 64>
     {
       friend class Factory; // calls constructor
 
@@ -125,6 +275,11 @@ namespace openvpn {
     public:
       typedef RCPtr<Session> Ptr;
 
+      static const char *pool_name()
+      {
+	return "session";
+      }
+
       virtual bool defined() const override
       {
 	return defined_();
@@ -145,6 +300,7 @@ namespace openvpn {
 
 	// init OpenVPN protocol handshake
 	Base::update_now();
+	assign_reneg();
 	Base::reset();
 	Base::set_local_peer_id(local_peer_id);
 	Base::start();
@@ -210,12 +366,17 @@ namespace openvpn {
 	bool ret = false;
 	if (!Base::primary_defined())
 	  return false;
+	SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::TRANSPORT_IO);
 	try {
 	  OPENVPN_LOG_SERVPROTO("Transport RECV[" << buf.size() << "] " << client_endpoint_render() << ' ' << Base::dump_packet(buf));
 
 	  // update current time
 	  Base::update_now();
 
+	  // first packet of a session that may have been accepted by PsidCookie
+	  if (psid_cookie)
+	    start_from_cookie(buf);
+
 	  // get packet type
 	  Base::PacketType pt = Base::packet_type(buf);
 
@@ -287,11 +448,33 @@ namespace openvpn {
 	Base::dc_settings().set_factory(dc_factory);
       }
 
+      // client capabilities, empty until the client has authenticated
+      const PeerInfo::Capabilities& peer_capabilities() const
+      {
+	return peer_caps;
+      }
+
       virtual ~Session()
       {
 	// fatal error if destructor called while Session is active
 	if (defined_())
 	  std::abort();
+
+	std::vector<Session*>& sl = session_list->sessions;
+	sl[session_index] = sl.back();
+	sl[session_index]->session_index = session_index;
+	sl.pop_back();
+      }
+
+      // Send an explicit-exit-notify to the client, see
+      // Factory::shutdown_broadcast().  Returns false if the
+      // session has no data channel to send it on.
+      bool shutdown_notify()
+      {
+	if (!defined_())
+	  return false;
+	Base::update_now();
+	return Base::send_exit_notify();
       }
 
     private:
@@ -301,18 +484,100 @@ namespace openvpn {
 	      TunClientInstance::Factory::Ptr tun_factory_arg)
 	: Base(factory.clone_proto_config(), factory.stats),
 	  io_context(io_context_arg),
-	  housekeeping_timer(io_context_arg),
+	  housekeeping_timer(factory.timer_wheel, [this]() { housekeeping_callback(); }),
 	  disconnect_at(Time::infinite()),
 	  stats(factory.stats),
 	  man_factory(man_factory_arg),
-	  tun_factory(tun_factory_arg)
-      {}
+	  tun_factory(tun_factory_arg),
+	  psid_cookie(factory.psid_cookie),
+	  server_config(factory.server_config),
+	  session_list(factory.session_list),
+	  session_index(session_list->sessions.size())
+      {
+	session_list->sessions.push_back(this);
+      }
 
       bool defined_() const
       {
 	return !halt && TransportLink::send;
       }
 
+      // If the proto config has a RekeyScheduler, give this client its
+      // own jittered reneg-sec, to be pushed with the PUSH_REPLY.  The
+      // server side keeps its usual hand-window margin over it.
+      void assign_reneg()
+      {
+	Base::Config& c = Base::conf();
+	if (!c.rekey_scheduler || pushed_reneg.defined())
+	  return;
+	const Time::Duration reneg = c.renegotiate - c.handshake_window;
+	if (!reneg.enabled())
+	  return;
+	pushed_reneg = c.rekey_scheduler->assign(now(), reneg, *c.prng);
+	c.expire -= reneg - pushed_reneg;
+	c.renegotiate = pushed_reneg + c.handshake_window;
+      }
+
+      // append per-session options (reneg-sec, key-derivation,
+      // packet-id, rtt-probe) to a PUSH_REPLY message
+      BufferPtr push_session_options(const Buffer& msg) const
+      {
+	std::string str = buf_to_string(msg);
+	const size_t nul = str.find('\0');
+	if (nul != std::string::npos)
+	  str.resize(nul);
+	if (pushed_reneg.defined())
+	  str += ",reneg-sec " + openvpn::to_string(pushed_reneg.to_seconds());
+	if (Base::tls_ekm_enabled())
+	  str += ",key-derivation tls-ekm";
+	if (Base::wide_pid_enabled())
+	  str += ",packet-id wide";
+	if (Base::rtt_probe_enabled())
+	  str += ",rtt-probe";
+	return buf_from_string(str);
+      }
+
+      // derive data channel keys with the TLS keying material
+      // exporter if both ends support it
+      void negotiate_tls_ekm()
+      {
+	if (Base::conf().ssl_factory->keying_material_exporter()
+	    && peer_caps.has_proto(Base::IV_PROTO_TLS_KEY_EXPORT))
+	  Base::enable_tls_ekm();
+      }
+
+      // use 64-bit packet IDs on the data channel if both ends
+      // support them with the AEAD cipher, so that a long-lived
+      // fast session rekeys only on the reneg-sec/bytes policy
+      void negotiate_wide_pid()
+      {
+	const Base::Config& c = Base::conf();
+	const CryptoDCFactory::Ptr factory = c.dc.factory();
+	if (factory && factory->supports_wide_pid()
+	    && CryptoAlgs::is_aead(c.dc.cipher())
+	    && peer_caps.has(PeerInfo::Capabilities::WIDE_PID))
+	  Base::enable_wide_pid();
+      }
+
+      // probe the round trip time of clients that answer probes, if
+      // the server config has rtt-probe
+      void negotiate_rtt_probe()
+      {
+	if (peer_caps.has(PeerInfo::Capabilities::RTT))
+	  Base::enable_rtt_probe();
+      }
+
+      // If the first packet echoes a cookie sent by PsidCookie, pick up
+      // the handshake from there.  Otherwise the client is expected to
+      // start with a regular reset.
+      void start_from_cookie(const BufferAllocated& buf)
+      {
+	const Base::PsidCookie::Ptr pc(std::move(psid_cookie));
+	ProtoSessionID self, peer;
+	if (peer_addr && pc->verify(buf, peer_addr->remote.addr, peer_addr->remote.port, self, peer))
+	  Base::start_from_cookie(self, peer);
+      }
+
       // proto base class calls here for control channel network sends
       virtual void control_net_send(const Buffer& net_buf) override
       {
@@ -324,6 +589,23 @@ namespace openvpn {
 	  }
       }
 
+      // proto base class calls here when an SSLExecutor job completes
+      virtual void control_async_ready() override
+      {
+	if (halt || !Base::primary_defined())
+	  return;
+	try {
+	  Base::update_now();
+	  Base::control_async_process();
+	  Base::flush(true);
+	  set_housekeeping_timer();
+	}
+	catch (const std::exception& e)
+	  {
+	    error(e);
+	  }
+      }
+
       // Called on server with credentials and peer info provided by client.
       // Should be overriden by derived class if credentials are required.
       virtual void server_auth(const std::string& username,
@@ -334,6 +616,11 @@ namespace openvpn {
 	constexpr size_t MAX_USERNAME_SIZE = 256;
 	constexpr size_t MAX_PASSWORD_SIZE = 16384;
 
+	peer_caps.parse(peer_info);
+	negotiate_tls_ekm();
+	negotiate_wide_pid();
+	negotiate_rtt_probe();
+
 	if (get_management())
 	  {
 	    AuthCreds::Ptr auth_creds(new AuthCreds(Unicode::utf8_printable(username, MAX_USERNAME_SIZE|Unicode::UTF8_FILTER),
@@ -414,11 +701,15 @@ namespace openvpn {
 	if (get_tun())
 	  {
 	    Base::init_data_channel();
+	    if (!push_msgs.empty() && (pushed_reneg.defined() || Base::tls_ekm_enabled() || Base::wide_pid_enabled()
+					|| Base::rtt_probe_enabled()))
+	      push_msgs.front() = push_session_options(*push_msgs.front());
 	    for (auto &msg : push_msgs)
 	      {
 		msg->null_terminate();
 		Base::control_send(std::move(msg));
 	      }
+	    pushed = true;
 	    Base::flush(true);
 	    set_housekeeping_timer();
 	  }
@@ -428,6 +719,29 @@ namespace openvpn {
 	  }
       }
 
+      virtual void reload_config(const ServerConfig::Ptr& config) override
+      {
+	if (halt || !config || config == server_config)
+	  return;
+
+	// before the PUSH_REPLY, the new config is simply used for it
+	if (server_config && pushed)
+	  {
+	    std::vector<BufferPtr> msgs;
+	    if (!config->push_update(*server_config, msgs))
+	      OPENVPN_LOG_SERVPROTO("config version " << config->version() << ": some pushed option changes take effect on reconnect");
+	    if (!msgs.empty())
+	      {
+		Base::update_now();
+		for (auto &msg : msgs)
+		  Base::control_send(std::move(msg));
+		Base::flush(true);
+		set_housekeeping_timer();
+	      }
+	  }
+	server_config = config;
+      }
+
       virtual TunClientInstance::NativeHandle tun_native_handle() override
       {
 	if (get_tun())
@@ -567,6 +881,7 @@ namespace openvpn {
 
       virtual void float_notify(const PeerAddr::Ptr& addr) override
       {
+	peer_addr = addr;
 	if (ManLink::send)
 	  ManLink::send->float_notify(addr);
       }
@@ -613,10 +928,11 @@ namespace openvpn {
 	disconnect_at = Time::infinite();
       }
 
-      void housekeeping_callback(const openvpn_io::error_code& e)
+      void housekeeping_callback()
       {
+	const Ptr self(this); // error() may release the last reference
 	try {
-	  if (!e && !halt)
+	  if (!halt)
 	    {
 	      // update current time
 	      Base::update_now();
@@ -664,10 +980,6 @@ namespace openvpn {
 		next.max(now());
 		housekeeping_schedule.reset(next);
 		housekeeping_timer.expires_at(next);
-		housekeeping_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
-                                              {
-                                                self->housekeeping_callback(error);
-                                              });
 	      }
 	    else
 	      {
@@ -732,7 +1044,7 @@ namespace openvpn {
       PeerAddr::Ptr peer_addr;
 
       CoarseTime housekeeping_schedule;
-      AsioTimer housekeeping_timer;
+      TimerWheel::Timer housekeeping_timer;
 
       Time disconnect_at;
 
@@ -740,6 +1052,18 @@ namespace openvpn {
 
       ManClientInstance::Factory::Ptr man_factory;
       TunClientInstance::Factory::Ptr tun_factory;
+
+      Base::PsidCookie::Ptr psid_cookie; // cleared on first packet
+
+      Time::Duration pushed_reneg; // zero unless assigned by a RekeyScheduler
+
+      PeerInfo::Capabilities peer_caps; // parsed from the client's peer info in server_auth()
+
+      ServerConfig::Ptr server_config; // version this session started with, or was updated to
+      bool pushed = false;             // PUSH_REPLY sent
+
+      SessionList::Ptr session_list;
+      size_t session_index;            // in session_list
     };
   };
 
@@ -747,6 +1071,23 @@ namespace openvpn {
   {
     return new Session(io_context, *this, man_factory, tun_factory);
   }
+
+  inline size_t ServerProto::Factory::shutdown_broadcast()
+  {
+    // hold references, stopping a session may release the last one
+    std::vector<Session::Ptr> live;
+    live.reserve(session_list->sessions.size());
+    for (Session* s : session_list->sessions)
+      if (s->defined())
+	live.emplace_back(s);
+
+    size_t n_sent = 0;
+    for (const auto& s : live)
+      n_sent += s->shutdown_notify();
+    for (const auto& s : live)
+      s->stop();
+    return n_sent;
+  }
 }
 
 #endif
@@ -0,0 +1,263 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Hand established sessions and their UDP sockets over a unix domain
+// socket to a new server process, so that a server can be upgraded
+// without its clients renegotiating.  The old process calls
+// ProtoContext::export_session() for each session and send(), the
+// new one receive() and ProtoContext::resume_session().
+
+#ifndef OPENVPN_SERVER_SESSMIGRATE_H
+#define OPENVPN_SERVER_SESSMIGRATE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/common/write.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ssl/sessstate.hpp>
+
+namespace openvpn {
+  namespace SessionMigrate {
+
+    OPENVPN_EXCEPTION(session_migrate_error);
+
+    enum {
+      MAGIC = 0x4f56534d, // "OVSM"
+      MAX_FDS = 64,       // sockets per handoff
+      MAX_PAYLOAD = 64*1024*1024,
+    };
+
+    namespace detail {
+      inline void write_u32(Buffer& buf, const std::uint32_t v)
+      {
+	const std::uint32_t net = htonl(v);
+	buf.write((const unsigned char *)&net, sizeof(net));
+      }
+
+      inline std::uint32_t read_u32(Buffer& buf)
+      {
+	std::uint32_t net;
+	buf.read((unsigned char *)&net, sizeof(net));
+	return ntohl(net);
+      }
+
+      inline void read_all(const int fd, unsigned char *data, size_t size)
+      {
+	while (size)
+	  {
+	    const ssize_t status = ::read(fd, data, size);
+	    if (status < 0)
+	      {
+		if (errno == EINTR)
+		  continue;
+		const int eno = errno;
+		throw session_migrate_error("read: " + strerror_str(eno));
+	      }
+	    if (status == 0)
+	      throw session_migrate_error("read: unexpected EOF");
+	    data += status;
+	    size -= status;
+	  }
+      }
+    }
+
+    // Send the sockets in fds and the sessions in states, which
+    // refer to the sockets by ProtoSessionState::socket_index.  The
+    // fds stay open in the caller.  Blocking, sock should be a
+    // SOCK_STREAM unix socket.
+    inline void send(const int sock,
+		     const std::vector<int>& fds,
+		     const std::vector<ProtoSessionState>& states)
+    {
+      if (fds.size() > MAX_FDS)
+	throw session_migrate_error("too many sockets");
+
+      BufferAllocated payload(4096, BufferAllocated::GROW|BufferAllocated::DESTRUCT_ZERO);
+      detail::write_u32(payload, std::uint32_t(states.size()));
+      for (const auto& st : states)
+	{
+	  if (st.socket_index >= fds.size())
+	    throw session_migrate_error("session refers to unknown socket");
+	  BufferAllocated blob(1024, BufferAllocated::GROW|BufferAllocated::DESTRUCT_ZERO);
+	  st.serialize(blob);
+	  detail::write_u32(payload, std::uint32_t(blob.size()));
+	  payload.write(blob.c_data(), blob.size());
+	}
+
+      // the header carries the sockets, the payload follows
+      unsigned char header[12];
+      {
+	Buffer hb(header, sizeof(header), false);
+	detail::write_u32(hb, MAGIC);
+	detail::write_u32(hb, std::uint32_t(fds.size()));
+	detail::write_u32(hb, std::uint32_t(payload.size()));
+      }
+
+      struct iovec iov;
+      iov.iov_base = header;
+      iov.iov_len = sizeof(header);
+
+      union {
+	struct cmsghdr align;
+	unsigned char buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+      } control;
+      ::memset(&control, 0, sizeof(control));
+
+      struct msghdr msg;
+      ::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      if (!fds.empty())
+	{
+	  msg.msg_control = control.buf;
+	  msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+	  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	  cmsg->cmsg_level = SOL_SOCKET;
+	  cmsg->cmsg_type = SCM_RIGHTS;
+	  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+	  ::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+	}
+
+      ssize_t status;
+      do {
+	status = ::sendmsg(sock, &msg, 0);
+      } while (status < 0 && errno == EINTR);
+      if (status < 0)
+	{
+	  const int eno = errno;
+	  throw session_migrate_error("sendmsg: " + strerror_str(eno));
+	}
+      if (size_t(status) != sizeof(header))
+	throw session_migrate_error("sendmsg: short write");
+
+      if (write_retry(sock, payload.c_data(), payload.size()) != ssize_t(payload.size()))
+	{
+	  const int eno = errno;
+	  throw session_migrate_error("write: " + strerror_str(eno));
+	}
+    }
+
+    // Receive what send() sent.  The sockets are returned in fds, in
+    // the order they were sent.
+    inline void receive(const int sock,
+			std::vector<ScopedFD>& fds,
+			std::vector<ProtoSessionState>& states)
+    {
+      unsigned char header[12];
+      struct iovec iov;
+      iov.iov_base = header;
+      iov.iov_len = sizeof(header);
+
+      union {
+	struct cmsghdr align;
+	unsigned char buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+      } control;
+
+      struct msghdr msg;
+      ::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+
+      ssize_t status;
+      do {
+	status = ::recvmsg(sock, &msg, MSG_WAITALL|MSG_CMSG_CLOEXEC);
+      } while (status < 0 && errno == EINTR);
+      if (status < 0)
+	{
+	  const int eno = errno;
+	  throw session_migrate_error("recvmsg: " + strerror_str(eno));
+	}
+
+      // take ownership of the sockets first, so that they are
+      // closed on any error below
+      fds.clear();
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+	  if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	    {
+	      const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	      for (size_t i = 0; i < n; ++i)
+		{
+		  int fd;
+		  ::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+		  fds.emplace_back(fd);
+		}
+	    }
+	}
+
+      if (size_t(status) != sizeof(header))
+	throw session_migrate_error("recvmsg: short read");
+      if (msg.msg_flags & MSG_CTRUNC)
+	throw session_migrate_error("recvmsg: sockets truncated");
+
+      Buffer hb(header, sizeof(header), true);
+      if (detail::read_u32(hb) != MAGIC)
+	throw session_migrate_error("bad magic");
+      if (detail::read_u32(hb) != fds.size())
+	throw session_migrate_error("socket count mismatch");
+      const std::uint32_t size = detail::read_u32(hb);
+      if (size > MAX_PAYLOAD)
+	throw session_migrate_error("payload too large");
+
+      BufferAllocated payload(size, BufferAllocated::ARRAY|BufferAllocated::DESTRUCT_ZERO);
+      detail::read_all(sock, payload.data(), size);
+
+      try {
+	states.clear();
+	const std::uint32_t count = detail::read_u32(payload);
+	for (std::uint32_t i = 0; i < count; ++i)
+	  {
+	    const std::uint32_t len = detail::read_u32(payload);
+	    if (len > payload.size())
+	      throw session_migrate_error("truncated session");
+	    Buffer blob(payload.data(), len, true);
+	    payload.advance(len);
+	    ProtoSessionState st;
+	    st.parse(blob);
+	    if (st.socket_index >= fds.size())
+	      throw session_migrate_error("session refers to unknown socket");
+	    states.push_back(std::move(st));
+	  }
+      }
+      catch (const BufferException& e)
+	{
+	  throw session_migrate_error(std::string("truncated: ") + e.what());
+	}
+    }
+
+  }
+}
+
+#endif
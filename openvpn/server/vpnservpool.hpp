@@ -25,17 +25,16 @@
 #include <sstream>
 #include <vector>
 #include <memory>
-#include <mutex>
-#include <thread>
 #include <cstdint> // for std::uint32_t
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/objpool.hpp>
 #include <openvpn/common/arraysize.hpp>
 #include <openvpn/server/vpnservnetblock.hpp>
 #include <openvpn/addr/ip.hpp>
 #include <openvpn/addr/route.hpp>
-#include <openvpn/addr/pool.hpp>
+#include <openvpn/addr/bitmappool.hpp>
 
 namespace openvpn {
   namespace VPNServerPool {
@@ -76,26 +75,41 @@ namespace openvpn {
 	IPv6_DEPLETION=(1<<1),
       };
 
-      Pool(const OptionList& opt)
-	: VPNServerNetblock(init_snb_from_opt(opt))
+      // If n_threads is non-zero, the client address ranges are
+      // split into one shard per thread, see acquire().
+      Pool(const OptionList& opt, const unsigned int n_threads=0)
+	: VPNServerNetblock(init_snb_from_opt(opt, n_threads))
       {
 	if (configured(opt, "server"))
 	  {
-	    pool4.add_range(netblock4().clients);
-	    pool6.add_range(netblock6().clients);
+	    if (size())
+	      {
+		for (size_t i = 0; i < size(); ++i)
+		  {
+		    const PerThread& pt = per_thread(i);
+		    pool4.add_shard(pt.range4());
+		    if (pt.range6_defined())
+		      pool6.add_shard(pt.range6());
+		  }
+	      }
+	    else
+	      {
+		pool4.add_shard(netblock4().clients);
+		pool6.add_shard(netblock6().clients);
+	      }
 	  }
       }
 
-      // returns flags
-      unsigned int acquire(IP46& addr_pair, const bool request_ipv6)
+      // Returns flags.  May be called from any thread, thread_index
+      // selects the shard that addresses are taken from first.
+      unsigned int acquire(IP46& addr_pair, const bool request_ipv6, const size_t thread_index=0)
       {
-	std::lock_guard<std::mutex> lock(mutex);
 	unsigned int flags = 0;
-	if (!pool4.acquire_addr(addr_pair.ip4))
+	if (!pool4.acquire_addr(addr_pair.ip4, thread_index))
 	  flags |= IPv4_DEPLETION;
 	if (request_ipv6 && netblock6().defined())
 	  {
-	    if (!pool6.acquire_addr(addr_pair.ip6))
+	    if (!pool6.acquire_addr(addr_pair.ip6, thread_index))
 	      flags |= IPv6_DEPLETION;
 	  }
 	return flags;
@@ -103,7 +117,6 @@ namespace openvpn {
 
       void release(IP46& addr_pair)
       {
-	std::lock_guard<std::mutex> lock(mutex);
 	if (addr_pair.ip4.defined())
 	  pool4.release_addr(addr_pair.ip4);
 	if (addr_pair.ip6.defined())
@@ -111,12 +124,12 @@ namespace openvpn {
       }
 
     private:
-      static VPNServerNetblock init_snb_from_opt(const OptionList& opt)
+      static VPNServerNetblock init_snb_from_opt(const OptionList& opt, const unsigned int n_threads)
       {
 	if (configured(opt, "server"))
-	  return VPNServerNetblock(opt, "server", false, 0);
+	  return VPNServerNetblock(opt, "server", false, n_threads);
 	else if (configured(opt, "ifconfig"))
-	  return VPNServerNetblock(opt, "ifconfig", false, 0);
+	  return VPNServerNetblock(opt, "ifconfig", false, n_threads);
 	else
 	  throw vpn_serv_pool_error("one of 'server' or 'ifconfig' directives is required");
       }
@@ -127,17 +140,21 @@ namespace openvpn {
 	return opt.exists(opt_name) || opt.exists(opt_name + "-ipv6");
       }
 
-      std::mutex mutex;
-
-      IP::Pool pool4;
-      IP::Pool pool6;
+      IP::BitmapPoolSet pool4;
+      IP::BitmapPoolSet pool6;
     };
 
-    class IP46AutoRelease : public IP46, public RC<thread_safe_refcount>
+    class IP46AutoRelease : public IP46, public RC<thread_safe_refcount>,
+			    public PoolAllocated<IP46AutoRelease>
     {
     public:
       typedef RCPtr<IP46AutoRelease> Ptr;
 
+      static const char *pool_name()
+      {
+	return "ip46_auto_release";
+      }
+
       IP46AutoRelease(Pool* pool_arg)
 	: pool(pool_arg)
       {
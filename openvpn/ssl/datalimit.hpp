@@ -23,6 +23,8 @@
 #ifndef OPENVPN_SSL_DATALIMIT_H
 #define OPENVPN_SSL_DATALIMIT_H
 
+#include <limits>
+
 #include <openvpn/common/exception.hpp>
 
 namespace openvpn {
@@ -62,9 +64,16 @@ namespace openvpn {
       return elgible(mode, component(mode).update_state(newstate));
     }
 
+    // Called per packet.  Most packets can't move the component to
+    // a new state and only bump its byte count, so only the first
+    // packet and the one that reaches the red limit take the slow
+    // path, and the limit still triggers at the exact byte.
     State add(const Mode mode, const size_type n)
     {
-      return elgible(mode, component(mode).add(n));
+      Component& c = component(mode);
+      if (c.add_below_threshold(n))
+	return None;
+      return elgible(mode, c.update_state(c.transition()));
     }
 
     bool is_decrypt_green()
@@ -135,21 +144,27 @@ namespace openvpn {
     {
     public:
       Component(const size_type red_limit_arg)
-	: red_limit(red_limit_arg)
+	: red_limit(red_limit_arg),
+	  threshold(next_threshold())
       {
       }
 
-      State add(const size_type n)
+      // Add n bytes, and return true if the byte count is still
+      // short of the next point where transition() could fire.
+      bool add_below_threshold(const size_type n)
       {
 	bytes += n;
-	return update_state(transition(state));
+	return bytes < threshold;
       }
 
       State update_state(const State newstate)
       {
 	State ret = None;
 	if (newstate > state)
-	  state = ret = newstate;
+	  {
+	    state = ret = newstate;
+	    threshold = next_threshold();
+	  }
 	return ret;
       }
 
@@ -158,10 +173,9 @@ namespace openvpn {
 	return state;
       }
 
-    private:
-      State transition(State s) const
+      State transition() const
       {
-	switch (s)
+	switch (state)
 	  {
 	  case None:
 	    if (bytes)
@@ -179,9 +193,28 @@ namespace openvpn {
 	  }
       }
 
+    private:
+      // byte count from which transition() may return a new state
+      size_type next_threshold() const
+      {
+	switch (state)
+	  {
+	  case None:
+	    return 1;
+	  case Green:
+	    if (red_limit)
+	      return red_limit;
+	    // fall through
+	  case Red:
+	  default:
+	    return std::numeric_limits<size_type>::max();
+	  }
+      }
+
       const size_type red_limit;
       size_type bytes = 0;
       State state = None;
+      size_type threshold;
     };
 
     Component& component(const Mode m)
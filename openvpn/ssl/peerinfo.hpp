@@ -21,7 +21,8 @@
 
 // These objects are primary concerned with generating the Peer Info on the
 // client side before transmission to server.  For the reverse case (parsing
-// the Peer Info on the server) we normally use an OptionList.
+// the Peer Info on the server) we normally use an OptionList, or
+// Capabilities below for the parts that the server acts on.
 
 #ifndef OPENVPN_SSL_PEERINFO_H
 #define OPENVPN_SSL_PEERINFO_H
@@ -33,6 +34,8 @@
 #include <openvpn/common/string.hpp>
 #include <openvpn/common/split.hpp>
 #include <openvpn/common/unicode.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/common/splitlines.hpp>
 
 namespace openvpn {
   namespace PeerInfo {
@@ -122,6 +125,142 @@ namespace openvpn {
       }
     };
 
+
+    // The capabilities of a client, parsed once from its Peer Info
+    // on the server, so that handshake and push code can test them
+    // without searching the Peer Info again.
+    struct Capabilities
+    {
+      // IV_x=n flags, set if n is a nonzero number
+      enum Flags : unsigned int {
+	NCP = (1<<0),           // IV_NCP >= 2
+	TCPNL = (1<<1),
+	BS64DL = (1<<2),
+	RELAY = (1<<3),
+	FEC = (1<<4),
+	LZO = (1<<5),
+	LZO_SWAP = (1<<6),
+	LZO_STUB = (1<<7),
+	LZ4 = (1<<8),
+	LZ4v2 = (1<<9),
+	SNAPPY = (1<<10),
+	COMP_STUB = (1<<11),
+	COMP_STUBv2 = (1<<12),
+	RTT = (1<<13),
+	WIDE_PID = (1<<14),
+      };
+
+      void parse(const std::string& peer_info)
+      {
+	*this = Capabilities();
+	SplitLines in(peer_info, 0);
+	while (in(true))
+	  {
+	    const std::string& line = in.line_ref();
+	    const size_t eq = line.find('=');
+	    if (eq == std::string::npos)
+	      continue;
+	    const std::string key(line, 0, eq);
+	    std::string value(line, eq + 1);
+	    if (key == "IV_VER")
+	      version = std::move(value);
+	    else if (key == "IV_PLAT")
+	      platform = std::move(value);
+	    else if (key == "IV_PROTO")
+	      {
+		if (!parse_number(value, iv_proto))
+		  iv_proto = 0;
+	      }
+	    else if (key == "IV_CIPHERS")
+	      {
+		ciphers.clear();
+		for (auto& c : Split::by_char<std::vector<std::string>, NullLex, Split::NullLimit>(value, ':'))
+		  if (!c.empty())
+		    ciphers.push_back(std::move(c));
+	      }
+	    else if (key == "IV_LZ4DICT")
+	      lz4dict = std::move(value);
+	    else if (key == "IV_NCP")
+	      {
+		unsigned int ncp = 0;
+		set_flag(NCP, parse_number(value, ncp) && ncp >= 2);
+	      }
+	    else
+	      {
+		const unsigned int f = flag_by_name(key);
+		if (f)
+		  {
+		    unsigned int n = 0;
+		    set_flag(f, parse_number(value, n) && n);
+		  }
+	      }
+	  }
+      }
+
+      bool has(const unsigned int f) const
+      {
+	return (flags & f) == f;
+      }
+
+      // IV_PROTO bits, see ProtoContext::IV_PROTO_x
+      bool has_proto(const unsigned int bits) const
+      {
+	return (iv_proto & bits) == bits;
+      }
+
+      // IV_CIPHERS lists cipher, matched without regard to case
+      bool supports_cipher(const std::string& cipher) const
+      {
+	for (const auto& c : ciphers)
+	  if (!string::strcasecmp(c, cipher))
+	    return true;
+	return false;
+      }
+
+      unsigned int flags = 0;
+      unsigned int iv_proto = 0;        // IV_PROTO, or 0 if absent or malformed
+      std::vector<std::string> ciphers; // IV_CIPHERS, in the client's order
+      std::string version;              // IV_VER
+      std::string platform;             // IV_PLAT
+      std::string lz4dict;              // IV_LZ4DICT
+
+    private:
+      void set_flag(const unsigned int f, const bool value)
+      {
+	if (value)
+	  flags |= f;
+	else
+	  flags &= ~f;
+      }
+
+      static unsigned int flag_by_name(const std::string& key)
+      {
+	static const struct {
+	  const char *name;
+	  unsigned int flag;
+	} names[] = {
+	  { "IV_TCPNL", TCPNL },
+	  { "IV_BS64DL", BS64DL },
+	  { "IV_RELAY", RELAY },
+	  { "IV_FEC", FEC },
+	  { "IV_LZO", LZO },
+	  { "IV_LZO_SWAP", LZO_SWAP },
+	  { "IV_LZO_STUB", LZO_STUB },
+	  { "IV_LZ4", LZ4 },
+	  { "IV_LZ4v2", LZ4v2 },
+	  { "IV_SNAPPY", SNAPPY },
+	  { "IV_COMP_STUB", COMP_STUB },
+	  { "IV_COMP_STUBv2", COMP_STUBv2 },
+	  { "IV_RTT", RTT },
+	  { "IV_WIDE_PID", WIDE_PID },
+	};
+	for (const auto& n : names)
+	  if (key == n.name)
+	    return n.flag;
+	return 0;
+      }
+    };
+
   }
 }
 
@@ -31,6 +31,7 @@
 #include <algorithm>                  // for std::min
 #include <cstdint>                    // for std::uint32_t, etc.
 #include <memory>
+#include <list>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/size.hpp>
@@ -45,14 +46,19 @@
 #include <openvpn/common/likely.hpp>
 #include <openvpn/common/string.hpp>
 #include <openvpn/common/to_string.hpp>
+#include <openvpn/common/arena.hpp>
+#include <openvpn/common/objpool.hpp>
+#include <openvpn/common/buildprofile.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/buffer/safestr.hpp>
 #include <openvpn/buffer/bufcomposed.hpp>
+#include <openvpn/addr/ip.hpp>
 #include <openvpn/ip/ip4.hpp>
 #include <openvpn/ip/ip6.hpp>
 #include <openvpn/ip/udp.hpp>
 #include <openvpn/ip/tcp.hpp>
 #include <openvpn/time/time.hpp>
+#include <openvpn/time/batchclock.hpp>
 #include <openvpn/time/durhelper.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/random/randapi.hpp>
@@ -65,13 +71,19 @@
 #include <openvpn/crypto/packet_id.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/bs64_data_limit.hpp>
+#include <openvpn/log/trace.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/common/endian64.hpp>
 #include <openvpn/ssl/protostack.hpp>
+#include <openvpn/ssl/sslexec.hpp>
 #include <openvpn/ssl/psid.hpp>
 #include <openvpn/ssl/tlsprf.hpp>
+#include <openvpn/ssl/rekeysched.hpp>
 #include <openvpn/ssl/datalimit.hpp>
 #include <openvpn/ssl/mssparms.hpp>
 #include <openvpn/transport/mssfix.hpp>
+#include <openvpn/transport/pmtud.hpp>
+#include <openvpn/transport/rttprobe.hpp>
 #include <openvpn/transport/protocol.hpp>
 #include <openvpn/tun/layer.hpp>
 #include <openvpn/tun/tunmtu.hpp>
@@ -79,6 +91,7 @@
 #include <openvpn/ssl/proto_context_options.hpp>
 #include <openvpn/ssl/peerinfo.hpp>
 #include <openvpn/ssl/ssllog.hpp>
+#include <openvpn/ssl/sessstate.hpp>
 
 #if OPENVPN_DEBUG_PROTO >= 1
 #define OPENVPN_LOG_PROTO(x) OPENVPN_LOG(x)
@@ -138,11 +151,21 @@ namespace openvpn {
 	KEEPALIVE_FIRST_BYTE = 0x2a  // first byte of keepalive message
       };
 
+      inline std::uint64_t load64(const unsigned char *p)
+      {
+	std::uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+      }
+
+      // The 16-byte magic prefix is compared as two 64-bit words,
+      // which the compiler reduces to compares against constants.
       inline bool is_keepalive(const Buffer& buf)
       {
-	return buf.size() >= sizeof(keepalive_message)
-	  && buf[0] == KEEPALIVE_FIRST_BYTE
-	  && !std::memcmp(keepalive_message, buf.c_data(), sizeof(keepalive_message));
+	const unsigned char *p = buf.c_data();
+	return unlikely(buf.size() >= sizeof(keepalive_message)
+			&& load64(p) == load64(keepalive_message)
+			&& load64(p + 8) == load64(keepalive_message + 8));
       }
 
       const unsigned char explicit_exit_notify_message[] = {    // CONST GLOBAL
@@ -154,6 +177,29 @@ namespace openvpn {
       enum {
 	EXPLICIT_EXIT_NOTIFY_FIRST_BYTE = 0x28  // first byte of exit message
       };
+
+      // OpenVPN 2 occ.c messages: the explicit-exit-notify magic
+      // followed by an opcode byte
+      enum {
+	OCC_STRING_SIZE = 16,
+	OCC_MTU_REQUEST = 2, // ask for OCC_MTU_REPLY
+	OCC_MTU_REPLY = 3,   // 16-bit max received size, 16-bit max sent size
+	OCC_MTU_LOAD = 5,    // padding, discarded by receiver
+
+	// not in OpenVPN 2, only sent to peers that advertise IV_RTT
+	OCC_RTT_REQUEST = 0x20, // 32-bit seq, 64-bit timestamp in us
+	OCC_RTT_REPLY = 0x21,   // the request's seq and timestamp, 32-bit hold time in us
+	OCC_RTT_REQUEST_SIZE = OCC_STRING_SIZE + 13,
+	OCC_RTT_REPLY_SIZE = OCC_STRING_SIZE + 17,
+      };
+
+      inline bool is_occ(const Buffer& buf)
+      {
+	const unsigned char *p = buf.c_data();
+	return unlikely(buf.size() > OCC_STRING_SIZE
+			&& load64(p) == load64(explicit_exit_notify_message)
+			&& load64(p + 8) == load64(explicit_exit_notify_message + 8));
+      }
     }
   }
 
@@ -190,6 +236,9 @@ namespace openvpn {
       OP_SIZE_V2 = 4,                // size of initial packet opcode
       OP_PEER_ID_UNDEF = 0x00FFFFFF, // indicates that Peer ID is undefined
 
+      // largest reliability layer window, also our receive window
+      MAX_RELIABLE_WINDOW = 16,
+
       // states
       // C_x : client states
       // S_x : server states
@@ -216,6 +265,14 @@ namespace openvpn {
       ACTIVE=10,
     };
 
+    // TLS wrapping mode for the control channel
+    enum TLSWrapMode {
+      TLS_PLAIN,
+      TLS_AUTH,
+      TLS_CRYPT,
+      TLS_CRYPT_V2
+    };
+
     static unsigned int opcode_extract(const unsigned int op)
     {
       return op >> OPCODE_SHIFT;
@@ -248,6 +305,16 @@ namespace openvpn {
     OPENVPN_EXCEPTION(process_server_push_error);
     OPENVPN_EXCEPTION_INHERIT(option_error, proto_option_error);
 
+    // IV_PROTO peer info bits
+    enum {
+      IV_PROTO_DATA_V2 = (1<<1),         // supports op32 and P_DATA_V2
+      IV_PROTO_TLS_KEY_EXPORT = (1<<3),  // supports key-derivation tls-ekm
+    };
+
+    enum {
+      PMTUD_BASE = 1280, // outer IP MTU that pmtu-discovery assumes to work
+    };
+
     // configuration data passed to ProtoContext constructor
     class Config : public RCCopyable<thread_unsafe_refcount>
     {
@@ -257,6 +324,25 @@ namespace openvpn {
       // master SSL context factory
       SSLFactoryAPI::Ptr ssl_factory;
 
+      // if defined, run SSL handshakes and control channel
+      // record processing via this executor (see sslexec.hpp)
+      SSLExecutor::Ptr ssl_executor;
+
+      // server-side: if defined, counts handshakes against a global
+      // per-second budget and defers scheduled renegotiations that
+      // would exceed it (see rekeysched.hpp)
+      RekeyScheduler::Ptr rekey_scheduler;
+
+      // client-side: if true, data packets received in a transport
+      // burst are decrypted together via data_decrypt_batch(), so that
+      // a DCPipeline given to the dc factory can spread them over threads
+      bool dc_batch_decrypt = false;
+
+      // client-side: if non-empty, offer a cached TLS session for
+      // this key when (re)connecting (requires client session tickets
+      // to be enabled on ssl_factory)
+      std::string ssl_cache_key;
+
       // data channel
       CryptoDCSettings dc;
 
@@ -287,6 +373,27 @@ namespace openvpn {
       // defer data channel initialization until after client options pull
       bool dc_deferred = false;
 
+      // client-side: server pushed "key-derivation tls-ekm", to derive
+      // data channel keys with the TLS keying material exporter
+      bool dc_tls_ekm = false;
+
+      // client-side: server pushed "packet-id wide", to send 64-bit
+      // packet IDs on the AEAD data channel (see PacketID::WIDE_FORM)
+      bool dc_wide_pid = false;
+
+      // client-side: "fec" in the config advertises IV_FEC, and the
+      // server pushing "fec" turns on forward error correction of
+      // data channel packets on UDP (see FEC)
+      bool fec_peer_info = false;
+      bool dc_fec = false;
+
+      // Probe the data channel round trip time this often, see
+      // RTTProbe.  "rtt-probe [n]" on the client advertises IV_RTT,
+      // and the server pushing "rtt-probe" turns the probes on.  A
+      // server probes the clients that advertise IV_RTT.
+      Time::Duration rtt_probe_interval;
+      bool dc_rtt_probe = false;
+
       // transmit username/password creds to server (client-only)
       bool xmit_creds = true;
 
@@ -298,6 +405,8 @@ namespace openvpn {
 
       // compressor
       CompressContext comp_ctx;
+      bool comp_adaptive = false; // back off from compressing packets that don't shrink
+      bool comp_precheck = false; // don't try to compress packets that carry encrypted data
 
       // tls_auth/crypt parms
       OpenVPNStaticKey tls_key; // leave this undefined to disable tls_auth/crypt
@@ -314,7 +423,8 @@ namespace openvpn {
       TLSCryptMetadataFactory::Ptr tls_crypt_metadata_factory;
 
       // reliability layer parms
-      reliable::id_t reliable_window = 0;
+      reliable::id_t reliable_window = 0;      // send window
+      reliable::id_t reliable_recv_window = 0; // receive window, only affects us
       size_t max_ack_list = 0;
 
       // packet_id parms for both data and control channels
@@ -331,6 +441,19 @@ namespace openvpn {
       Time::Duration keepalive_ping;
       Time::Duration keepalive_timeout;
 
+      // Battery saving.  A keepalive falling due within
+      // housekeeping_slack of another housekeeping wakeup is sent on
+      // that wakeup.  If keepalive_ping_max is enabled, the ping
+      // interval adapts between keepalive_ping and keepalive_ping_max
+      // (see ProtoContext::adapt_keepalive_ping()).
+      Time::Duration housekeeping_slack;
+      Time::Duration keepalive_ping_max;
+
+      // Memory saving for servers with many idle sessions.  If
+      // enabled, a session without data channel traffic for this
+      // long releases its buffers (see ProtoContext::compact()).
+      Time::Duration idle_compact;
+
       // extra peer info key/value pairs generated by client app
       PeerInfo::Set::Ptr extra_peer_info;
 
@@ -344,12 +467,23 @@ namespace openvpn {
       MSSParms mss_parms;
       unsigned int mss_inter = 0;
 
+      // Path MTU discovery on UDP, up to this outer IP packet size
+      // (0 to disable).  The discovered size replaces mss_inter
+      // once confirmed, see ProtoContext::mss_inter().
+      unsigned int pmtud_max = 0;
+
       // Debugging
       int debug_level = 1;
 
       // Compatibility
       bool force_aes_cbc_ciphersuites = false;
 
+      // answer initial client resets statelessly (server-only, see PsidCookie)
+      bool psid_cookie = false;
+
+      // keep the key material that ProtoContext::export_session() needs
+      bool session_export = false;
+
       // For compatibility with openvpn2 we send initial options on rekeying,
       // instead of possible modifications caused by NCP
       std::string initial_options;
@@ -359,7 +493,10 @@ namespace openvpn {
       {
 	// first set defaults
 	reliable_window = 4;
-	max_ack_list = 4;
+	reliable_recv_window = MAX_RELIABLE_WINDOW;
+	max_ack_list = ReliableAck::MAX_ACK_LIST_COMPAT;
+	if (pco.reliable_window)
+	  reliable_window = std::min(pco.reliable_window, (unsigned int)MAX_RELIABLE_WINDOW);
 	handshake_window = Time::Duration::seconds(60);
 	renegotiate = Time::Duration::seconds(3600);
 	tls_timeout = Time::Duration::seconds(1);
@@ -401,7 +538,7 @@ namespace openvpn {
 		  cipher = CryptoAlgs::lookup(cipher_name);
 	      }
 	    else
-	      cipher = CryptoAlgs::lookup("BF-CBC");
+	      cipher = CryptoAlgs::lookup(BuildProfile::default_dc_cipher());
 	  }
 
 	  // data channel HMAC
@@ -557,12 +694,63 @@ namespace openvpn {
 	    }
 	}
 
+	// pre-shared dictionary for "compress lz4-dict"
+	{
+	  const Option *o = opt.get_ptr("compress-dict");
+	  if (o)
+	    {
+	      try {
+		comp_ctx.set_dict(CompressDict::parse(o->get(1, 0)));
+	      }
+	      catch (const CompressDict::compress_dict_error& e)
+		{
+		  OPENVPN_THROW(proto_option_error, "compress-dict: " << e.what());
+		}
+	    }
+	  if (comp_ctx.type() == CompressContext::LZ4DICT && !comp_ctx.dict())
+	    throw proto_option_error("compress lz4-dict requires compress-dict");
+	}
+
+	// back off from compressing packets that don't shrink,
+	// local only, the peer isn't told
+	comp_adaptive = opt.exists("compress-adaptive");
+
+	// don't try to compress packets that carry encrypted data
+	comp_precheck = opt.exists("compress-precheck");
+
 	// tun-mtu
 	tun_mtu = parse_tun_mtu(opt, tun_mtu);
 
 	// mssfix
 	mss_parms.parse(opt);
 
+	// pmtu-discovery
+	{
+	  const Option *o = opt.get_ptr("pmtu-discovery");
+	  if (o)
+	    {
+	      pmtud_max = 1500;
+	      if (o->size() >= 2 && !parse_number_validate<decltype(pmtud_max)>(o->get(1, 16), 16, PMTUD_BASE, 65535, &pmtud_max))
+		throw proto_option_error("pmtu-discovery: parse/range issue");
+	    }
+	}
+
+	// fec
+	if (!server)
+	  fec_peer_info = opt.exists("fec");
+
+	// rtt-probe
+	{
+	  const Option *o = opt.get_ptr("rtt-probe");
+	  if (o)
+	    {
+	      unsigned int n = 5;
+	      if (o->size() >= 2 && !parse_number_validate<unsigned int>(o->get(1, 16), 16, 1, 3600, &n))
+		throw proto_option_error("rtt-probe: parse/range issue");
+	      rtt_probe_interval = Time::Duration::seconds(n);
+	    }
+	}
+
 	// load parameters that can be present in both config file or pushed options
 	load_common(opt, pco, server ? LOAD_COMMON_SERVER : LOAD_COMMON_CLIENT);
       }
@@ -603,17 +791,59 @@ namespace openvpn {
 	    {
 	      OPENVPN_THROW(process_server_push_error, "Problem accepting server-pushed digest '" << new_digest << "': " << e.what());
 	    }
+
+	  // key derivation
+	  dc_tls_ekm = false;
+	  const Option *o = opt.get_ptr("key-derivation");
+	  if (o)
+	    {
+	      const std::string& method = o->get(1, 64);
+	      if (method != "tls-ekm" || !ssl_factory->keying_material_exporter())
+		OPENVPN_THROW(process_server_push_error, "Problem accepting server-pushed key-derivation '" << method << '\'');
+	      dc_tls_ekm = true;
+	    }
+
+	  // packet ID format
+	  dc_wide_pid = false;
+	  o = opt.get_ptr("packet-id");
+	  if (o)
+	    {
+	      const std::string& format = o->get(1, 64);
+	      if (format != "wide"
+		  || !CryptoAlgs::is_aead(dc.cipher())
+		  || !dc.factory()
+		  || !dc.factory()->supports_wide_pid())
+		OPENVPN_THROW(process_server_push_error, "Problem accepting server-pushed packet-id '" << format << '\'');
+	      dc_wide_pid = true;
+	    }
+
+	  // forward error correction
+	  dc_fec = opt.exists("fec");
+	  if (dc_fec && !fec_peer_info)
+	    OPENVPN_THROW(process_server_push_error, "Problem accepting server-pushed fec: not requested");
+
+	  // round trip time probes
+	  dc_rtt_probe = opt.exists("rtt-probe");
+	  if (dc_rtt_probe && !rtt_probe_interval.enabled())
+	    OPENVPN_THROW(process_server_push_error, "Problem accepting server-pushed rtt-probe: not requested");
 	}
 
 	// compression
 	std::string new_comp;
 	try {
+	  const CompressDict::Ptr dict = comp_ctx.dict();
 	  const Option *o;
 	  o = opt.get_ptr("compress");
 	  if (o)
 	    {
 	      new_comp = o->get(1, 128);
 	      CompressContext::Type meth = CompressContext::parse_method(new_comp);
+	      if (meth == CompressContext::LZ4DICT)
+		{
+		  // server names the dictionary it compresses with
+		  if (!dict || o->get(2, 64) != dict->id())
+		    throw Exception("dictionary mismatch");
+		}
 	      if (meth != CompressContext::NONE)
 		{
 		  // if compression is not availabe, CompressContext ctor throws an exception
@@ -648,6 +878,7 @@ namespace openvpn {
 		    }
 		}
 	    }
+	  comp_ctx.set_dict(dict);
 	}
 	catch (const std::exception& e)
 	  {
@@ -811,8 +1042,16 @@ namespace openvpn {
 	  {
 	    out << "IV_NCP=2\n"; // negotiable crypto parameters V2
 	    out << "IV_TCPNL=1\n"; // supports TCP non-linear packet ID
-	    out << "IV_PROTO=2\n"; // supports op32 and P_DATA_V2
+	    unsigned int iv_proto = IV_PROTO_DATA_V2;
+	    if (ssl_factory->keying_material_exporter())
+	      iv_proto |= IV_PROTO_TLS_KEY_EXPORT;
+	    out << "IV_PROTO=" << iv_proto << '\n';
+	    // not an IV_PROTO bit, those are assigned by OpenVPN 2
+	    if (dc.factory() && dc.factory()->supports_wide_pid())
+	      out << "IV_WIDE_PID=1\n"; // supports packet-id wide, 64-bit AEAD packet IDs
+	    out << iv_ciphers();
 	    compstr = comp_ctx.peer_info_string();
+	    out << comp_ctx.peer_info_dict();
 	  }
 	else
 	  compstr = comp_ctx.peer_info_string_v1();
@@ -824,11 +1063,47 @@ namespace openvpn {
 	  out << "IV_BS64DL=1\n"; // indicate support for data limits when using 64-bit block-size ciphers, version 1 (CVE-2016-6329)
 	if (relay_mode)
 	  out << "IV_RELAY=1\n";
+	if (fec_peer_info)
+	  out << "IV_FEC=1\n";
+	if (rtt_probe_interval.enabled())
+	  out << "IV_RTT=1\n";
 	const std::string ret = out.str();
 	OPENVPN_LOG_PROTO("Peer Info:" << std::endl << ret);
 	return ret;
       }
 
+      // IV_CIPHERS: the AEAD data channel ciphers the DC factory can
+      // make, in CryptoAlgs order, then the configured cipher if it
+      // is not one of them.  Empty if there are none.
+      std::string iv_ciphers() const
+      {
+	std::string list;
+	if (dc.factory())
+	  {
+	    for (size_t i = 0; i < CryptoAlgs::SIZE; ++i)
+	      {
+		const CryptoAlgs::Type type = CryptoAlgs::Type(i);
+		const unsigned int flags = CryptoAlgs::get(type).flags();
+		if ((flags & (CryptoAlgs::F_CIPHER|CryptoAlgs::F_ALLOW_DC)) == (CryptoAlgs::F_CIPHER|CryptoAlgs::F_ALLOW_DC)
+		    && dc.factory()->supports_aead(type))
+		  {
+		    if (!list.empty())
+		      list += ':';
+		    list += CryptoAlgs::name(type);
+		  }
+	      }
+	    if (CryptoAlgs::defined(dc.cipher()) && !dc.factory()->supports_aead(dc.cipher()))
+	      {
+		if (!list.empty())
+		  list += ':';
+		list += CryptoAlgs::name(dc.cipher());
+	      }
+	  }
+	if (list.empty())
+	  return list;
+	return "IV_CIPHERS=" + list + '\n';
+      }
+
       // Used to generate link_mtu option sent to peer.
       // Not const because dc.context() caches the DC context.
       unsigned int link_mtu_adjust()
@@ -836,7 +1111,7 @@ namespace openvpn {
 	const size_t adj = protocol.extra_transport_bytes() + // extra 2 bytes for TCP-streamed packet length
           (enable_op32 ? 4 : 1) +                        // leading op
 	  comp_ctx.extra_payload_bytes() +               // compression header
-	  PacketID::size(PacketID::SHORT_FORM) +         // sequence number
+	  PacketID::size(dc_wide_pid ? PacketID::WIDE_FORM : PacketID::SHORT_FORM) + // sequence number
 	  dc.context().encap_overhead();                 // data channel crypto layer overhead
 	return (unsigned int)adj;
       }
@@ -886,6 +1161,9 @@ namespace openvpn {
 	      load_duration_parm(keepalive_timeout, "ping-restart", opt, 1, false, false);
 	    }
 	}
+
+	if (type == LOAD_COMMON_SERVER)
+	  load_duration_parm(idle_compact, "idle-compact", opt, 1, false, false);
       }
 
       std::string relay_prefix(const char *optname) const
@@ -920,7 +1198,7 @@ namespace openvpn {
 
     private:
       PacketType(const Buffer& buf, class ProtoContext& proto)
-	: flags(0), opcode(INVALID_OPCODE), peer_id_(-1)
+	: flags(0), opcode(INVALID_OPCODE), key_id(0), peer_id_(-1)
       {
 	if (likely(buf.size()))
 	  {
@@ -930,68 +1208,56 @@ namespace openvpn {
 	    // examine opcode
 	    {
 	      const unsigned int opc = opcode_extract(op);
-	      switch (opc)
+	      const unsigned int cls = opcode_class(opc, proto.is_server());
+	      if (unlikely(!cls))
+		return;
+	      if (opc == DATA_V2)
 		{
-		case CONTROL_SOFT_RESET_V1:
-		case CONTROL_V1:
-		case ACK_V1:
-		  {
-		    flags |= CONTROL;
-		    opcode = opc;
-		    break;
-		  }
-		case DATA_V2:
-		  {
-		    if (unlikely(buf.size() < 4))
-		      return;
-		    const int opi = ntohl(*(const std::uint32_t *)buf.c_data()) & 0x00FFFFFF;
-		    if (opi != OP_PEER_ID_UNDEF)
-		      peer_id_ = opi;
-		    opcode = opc;
-		    break;
-		  }
-		case DATA_V1:
-		  {
-		    opcode = opc;
-		    break;
-		  }
-		case CONTROL_HARD_RESET_CLIENT_V2:
-		case CONTROL_HARD_RESET_CLIENT_V3:
-		  {
-		    if (!proto.is_server())
-		      return;
-		    flags |= CONTROL;
-		    opcode = opc;
-		    break;
-		  }
-		case CONTROL_HARD_RESET_SERVER_V2:
-		  {
-		    if (proto.is_server())
-		      return;
-		    flags |= CONTROL;
-		    opcode = opc;
-		    break;
-		  }
-		default:
-		  return;
+		  if (unlikely(buf.size() < 4))
+		    return;
+		  const int opi = ntohl(*(const std::uint32_t *)buf.c_data()) & 0x00FFFFFF;
+		  if (opi != OP_PEER_ID_UNDEF)
+		    peer_id_ = opi;
 		}
+	      flags |= (cls & CONTROL);
+	      opcode = opc;
 	    }
 
 	    // examine key ID
 	    {
-	      const unsigned int kid = key_id_extract(op);
-	      if (proto.primary && kid == proto.primary->key_id())
-		flags |= DEFINED;
-	      else if (proto.secondary && kid == proto.secondary->key_id())
-		flags |= (DEFINED | SECONDARY);
-	      else if (opcode == CONTROL_SOFT_RESET_V1 && kid == proto.upcoming_key_id)
+	      key_id = key_id_extract(op);
+	      const unsigned int kf = proto.key_slots[key_id].flags;
+	      if (likely(kf))
+		flags |= kf;
+	      else if (opcode == CONTROL_SOFT_RESET_V1 && key_id == proto.upcoming_key_id)
 		flags |= (DEFINED | SECONDARY | SOFT_RESET);
 	    }
 	  }
       }
 
+      // Classify a received opcode without branching on it: returns
+      // VALID, VALID|CONTROL, or 0 if the opcode isn't acceptable from
+      // our peer (hard resets are only accepted in one direction).
+      static unsigned int opcode_class(const unsigned int opc, const bool server)
+      {
+	enum {
+	  VALID = 1<<7,
+	  D = VALID,
+	  C = VALID|CONTROL,
+	};
+	static constexpr unsigned char table[2][32] = {
+	  // client: accept CONTROL_HARD_RESET_SERVER_V2
+	  //0  1  2  3  4  5  6  7  8  9 10
+	  { 0, 0, 0, C, C, C, D, 0, C, D, 0 },
+	  // server: accept CONTROL_HARD_RESET_CLIENT_V2/V3
+	  { 0, 0, 0, C, C, C, D, C, 0, D, C },
+	};
+	return table[server][opc & 31];
+      }
+
       unsigned int flags;
       unsigned int opcode;
+      unsigned int key_id;
       int peer_id_;
     };
 
@@ -1252,7 +1518,8 @@ namespace openvpn {
 
     // KeyContext encapsulates a single SSL/TLS session.
     // ProtoStackBase uses CRTP-based static polymorphism for method callbacks.
-    class KeyContext : ProtoStackBase<Packet, KeyContext>, public RC<thread_unsafe_refcount>
+    class KeyContext : ProtoStackBase<Packet, KeyContext>, public RC<thread_unsafe_refcount>,
+		       public PoolAllocated<KeyContext, 128>
     {
       typedef ProtoStackBase<Packet, KeyContext> Base;
       friend Base;
@@ -1277,6 +1544,7 @@ namespace openvpn {
 	DataChannelKey() : rekey_defined(false) {}
 
 	OpenVPNStaticKey key;
+	OpenVPNStaticKey ekm; // client: exported ahead of the push
 	bool rekey_defined;
 	CryptoDCInstance::RekeyType rekey_type;
       };
@@ -1284,6 +1552,11 @@ namespace openvpn {
     public:
       typedef RCPtr<KeyContext> Ptr;
 
+      static const char *pool_name()
+      {
+	return "key_context";
+      }
+
       OPENVPN_SIMPLE_EXCEPTION(tls_crypt_unwrap_wkc_error);
 
       // KeyContext events occur on two basic key types:
@@ -1371,17 +1644,22 @@ namespace openvpn {
 	  }
       }
 
-      KeyContext(ProtoContext& p, const bool initiator)
+      // resume is true for the initial key context of a session,
+      // which may use a cached TLS session (renegotiations always
+      // do a full handshake)
+      KeyContext(ProtoContext& p, const bool initiator, const bool resume = false)
 	: Base(*p.config->ssl_factory,
 	       p.config->now, p.config->tls_timeout,
 	       p.config->frame, p.stats,
-	       p.config->reliable_window, p.config->max_ack_list),
+	       p.config->reliable_window, p.config->reliable_recv_window, p.config->max_ack_list,
+	       p.config->ssl_executor,
+	       resume && !p.config->ssl_cache_key.empty() ? &p.config->ssl_cache_key : nullptr),
 	  proto(p),
 	  state(STATE_UNDEF),
-	  crypto_flags(0),
 	  dirty(0),
 	  key_limit_renegotiation_fired(false),
-	  tlsprf(p.config->tlsprf_factory->new_obj(p.is_server()))
+	  tlsprf(p.config->tlsprf_factory->new_obj(p.is_server())),
+	  arena(new Arena())
       {
 	// reliable protocol?
 	set_protocol(proto.config->protocol);
@@ -1417,17 +1695,43 @@ namespace openvpn {
       {
 	if (state == C_INITIAL || state == S_INITIAL)
 	  {
+	    Arena::Scope arena_scope(arena.get());
 	    send_reset();
 	    set_state(state+1);
 	    dirty = true;
 	  }
       }
 
+      // Server-only: the client reset (message ID 0) and our reset
+      // reply have already been exchanged statelessly by PsidCookie.
+      // Replay them through the reliability layer so that message and
+      // tls-wrap packet IDs stay in sync with what the client has seen,
+      // but don't put the reply on the wire a second time.
+      void start_from_cookie()
+      {
+	if (state != S_WAIT_RESET)
+	  throw proto_error("start_from_cookie: bad state");
+	Arena::Scope arena_scope(arena.get());
+
+	Packet pkt;
+	pkt.opcode = initial_op(false, false);
+	pkt.frame_prepare(*proto.config->frame, Frame::WRITE_SSL_INIT);
+	rel_recv.receive(pkt, 0);
+	rel_recv.next_sequenced();
+	rel_recv.advance();
+	raw_recv(std::move(pkt)); // queues our reset, -> S_WAIT_RESET_ACK
+
+	suppress_net_send = true;
+	Base::flush();
+	suppress_net_send = false;
+      }
+
       // control channel flush
       void flush()
       {
 	if (dirty)
 	  {
+	    Arena::Scope arena_scope(arena.get());
 	    post_ack_action();
 	    Base::flush();
 	    send_pending_acks();
@@ -1440,10 +1744,19 @@ namespace openvpn {
 	Base::invalidate(reason);
       }
 
+      // process the result of a completed SSLExecutor job
+      void async_process()
+      {
+	Arena::Scope arena_scope(arena.get());
+	Base::async_process();
+	dirty = true;
+      }
+
       // retransmit packets as part of reliability layer
       void retransmit()
       {
 	// note that we don't set dirty here
+	Arena::Scope arena_scope(arena.get());
 	Base::retransmit();
       }
 
@@ -1467,7 +1780,7 @@ namespace openvpn {
       // send app-level cleartext data to peer via SSL
       void app_send(BufferPtr&& bp)
       {
-	if (state >= ACTIVE)
+	if (state >= ACTIVE && !resumed)
 	  {
 	    app_send_validate(std::move(bp));
 	    dirty = true;
@@ -1479,6 +1792,9 @@ namespace openvpn {
       // pass received ciphertext packets on network to SSL/reliability layers
       bool net_recv(Packet&& pkt)
       {
+	if (resumed) // no SSL session to feed
+	  return false;
+	Arena::Scope arena_scope(arena.get());
 	const bool ret = Base::net_recv(std::move(pkt));
 	dirty = true;
 	return ret;
@@ -1487,9 +1803,7 @@ namespace openvpn {
       // data channel encrypt
       void encrypt(BufferAllocated& buf)
       {
-	if (state >= ACTIVE
-	    && (crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
-	    && !invalidated())
+	if (dcs.ready)
 	  {
 	    // compress and encrypt packet and prepend op header
 	    const bool pid_wrap = do_encrypt(buf, true);
@@ -1509,9 +1823,7 @@ namespace openvpn {
       void decrypt(BufferAllocated& buf)
       {
 	try {
-	  if (state >= ACTIVE
-	      && (crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
-	      && !invalidated())
+	  if (dcs.ready)
 	    {
 	      // Knock off leading op from buffer, but pass the 32-bit version to
 	      // decrypt so it can be used as Additional Data for packet authentication.
@@ -1520,7 +1832,9 @@ namespace openvpn {
 	      buf.advance(head_size);
 
 	      // decrypt packet
-	      const Error::Type err = crypto->decrypt(buf, now->seconds_since_epoch(), op32);
+	      const Error::Type err = dcs.fast.defined()
+		? dcs.fast.decrypt(*dcs.crypto, buf, now->seconds_since_epoch(), op32)
+		: dcs.crypto->decrypt(buf, now->seconds_since_epoch(), op32);
 	      if (err)
 		{
 		  proto.stats->error(err);
@@ -1528,17 +1842,7 @@ namespace openvpn {
 		    invalidate(err);
 		}
 
-	      // trigger renegotiation if we hit decrypt data limit
-	      if (data_limit)
-		data_limit_add(DataLimit::Decrypt, buf.size());
-
-	      // decompress packet
-	      if (compress)
-		compress->decompress(buf);
-
-	      // set MSS for segments server can receive
-	      if (proto.config->mss_inter > 0)
-		MSSFix::mssfix(buf, proto.config->mss_inter);
+	      process_decrypted(buf);
 	    }
 	  else
 	    buf.reset_size(); // no crypto context available
@@ -1552,13 +1856,110 @@ namespace openvpn {
 	  }
       }
 
+      // data limit accounting, decompression and MSS fixup of a
+      // decrypted packet
+      void process_decrypted(BufferAllocated& buf)
+      {
+	// trigger renegotiation if we hit decrypt data limit
+	if (dcs.data_limit)
+	  data_limit_add(DataLimit::Decrypt, buf.size());
+
+	// decompress packet
+	if (dcs.compress)
+	  {
+	    SessionStats::CpuScope cpu_scope(proto.stats.get(), CpuStats::COMPRESS);
+
+	    // decompress into a buffer laid out for the tun write
+	    proto.config->frame->prepare(Frame::READ_TUN, decompress_buf);
+	    if (dcs.compress->decompress_to(buf, decompress_buf))
+	      buf.swap(decompress_buf);
+	  }
+
+	// set MSS for segments server can receive
+	if (dcs.mssfix.enabled())
+	  dcs.mssfix.fix(buf);
+      }
+
+      // process_decrypted() for one packet of a batch
+      void decrypt_finish(BufferAllocated& buf)
+      {
+	try {
+	  process_decrypted(buf);
+	}
+	catch (BufferException&)
+	  {
+	    proto.stats->error(Error::BUFFER_ERROR);
+	    buf.reset_size();
+	    if (proto.is_tcp())
+	      invalidate(Error::BUFFER_ERROR);
+	  }
+      }
+
+      // data channel decrypt of n packets, in order, with the same
+      // results as calling decrypt() on each
+      void decrypt_batch(BufferAllocated* bufs, const size_t n)
+      {
+	enum { MAX_BATCH = 64 };
+	if (!dcs.ready)
+	  {
+	    for (size_t i = 0; i < n; ++i)
+	      bufs[i].reset_size(); // no crypto context available
+	    return;
+	  }
+
+	// Consecutive packets with the same op header are passed to the
+	// crypto layer together.  Knock off the op, but keep the 32-bit
+	// version of it for use as Additional Data.
+	Error::Type errs[MAX_BATCH];
+	unsigned char op32[OP_SIZE_V2];
+	size_t i = 0;
+	while (i < n)
+	  {
+	    const size_t head_size = op_head_size(bufs[i][0]);
+	    const bool v2 = (head_size == OP_SIZE_V2);
+	    if (v2)
+	      std::memcpy(op32, bufs[i].c_data(), OP_SIZE_V2);
+	    size_t j = i;
+	    while (j < n && j - i < MAX_BATCH
+		   && bufs[j].size() >= head_size
+		   && op_head_size(bufs[j][0]) == head_size
+		   && (!v2 || !std::memcmp(op32, bufs[j].c_data(), OP_SIZE_V2)))
+	      bufs[j++].advance(head_size);
+	    if (j == i)
+	      {
+		// header can't be split off
+		proto.stats->error(Error::BUFFER_ERROR);
+		bufs[i++].reset_size();
+		if (proto.is_tcp())
+		  invalidate(Error::BUFFER_ERROR);
+		continue;
+	      }
+
+	    dcs.crypto->decrypt_batch(bufs + i, errs, j - i, now->seconds_since_epoch(), v2 ? op32 : nullptr);
+	    for (size_t k = i; k < j; ++k)
+	      {
+		BufferAllocated& buf = bufs[k];
+		const Error::Type err = errs[k - i];
+		if (err)
+		  {
+		    proto.stats->error(err);
+		    if (proto.is_tcp() && (err == Error::DECRYPT_ERROR || err == Error::HMAC_ERROR || err == Error::BUFFER_ERROR))
+		      invalidate(err);
+		  }
+		decrypt_finish(buf);
+	      }
+	    i = j;
+	  }
+      }
+
       // usually called by parent ProtoContext object when this KeyContext
       // has been retired.
       void prepare_expire(const EventType current_ev = KeyContext::KEV_NONE)
       {
-	set_event(current_ev,
-		  KEV_EXPIRE,
-		  key_limit_renegotiation_fired ? data_limit_expire() : construct_time + proto.config->expire);
+	Time t = key_limit_renegotiation_fired ? data_limit_expire() : construct_time + proto.config->expire;
+	if (deferred_expire.defined() && deferred_expire < t)
+	  t = deferred_expire;
+	set_event(current_ev, KEV_EXPIRE, t);
       }
 
       // set a default next event, if unspecified
@@ -1575,6 +1976,24 @@ namespace openvpn {
 	  set_event(KEV_NONE, ev, t + Time::Duration::seconds(proto.is_server() ? 2 : 1));
       }
 
+      // The renegotiation that just fired was refused by the rekey
+      // scheduler: retry shortly, but never past the expiry that
+      // prepare_expire() set when it fired.  That deadline is kept
+      // for the next prepare_expire() so that repeated refusals
+      // can't push it back.
+      void defer_renegotiation()
+      {
+	const Time retry = *now + Time::Duration::seconds(proto.is_server() ? 2 : 1);
+	if (next_event == KEV_EXPIRE)
+	  {
+	    if (next_event_time <= retry)
+	      return;
+	    if (!deferred_expire.defined() || next_event_time < deferred_expire)
+	      deferred_expire = next_event_time;
+	  }
+	set_event(KEV_NONE, KEV_RENEGOTIATE, retry);
+      }
+
       // return time of upcoming KEV_BECOME_PRIMARY event
       Time become_primary_time()
       {
@@ -1615,8 +2034,8 @@ namespace openvpn {
       // notification from parent of rekey operation
       void rekey(const CryptoDCInstance::RekeyType type)
       {
-	if (crypto)
-	  crypto->rekey(type);
+	if (dcs.crypto)
+	  dcs.crypto->rekey(type);
 	else if (data_channel_key)
 	  {
 	    // save for deferred processing
@@ -1635,24 +2054,201 @@ namespace openvpn {
 				  sizeof(proto_context_private::keepalive_message));
       }
 
+      // Release buffers that are re-created on demand, keeping the
+      // SSL session and data channel keys.  See ProtoContext::compact().
+      void compact()
+      {
+	Base::compact();
+	work.clear();
+	if (app_pre_write_queue.empty())
+	  std::deque<BufferPtr>().swap(app_pre_write_queue);
+	if (dcs.crypto)
+	  dcs.crypto->compact();
+	if (dcs.compress)
+	  dcs.compress->compact();
+      }
+
+      // Hand control messages queued on a resumed key to its
+      // successor.
+      void move_pending_app(KeyContext& to)
+      {
+	while (!app_pre_write_queue.empty())
+	  {
+	    to.app_send(std::move(app_pre_write_queue.front()));
+	    app_pre_write_queue.pop_front();
+	  }
+      }
+
+      // is this a retired key waiting to expire?
+      bool expiring() const { return next_event == KEV_EXPIRE; }
+
+      // Fill in the data channel fields of st, see
+      // ProtoContext::export_session().
+      void export_state(ProtoSessionState& st) const
+      {
+	if (!export_key)
+	  throw proto_error("export_session: key material not kept, Config::session_export is off");
+	if (!dcs.crypto || !dcs.crypto->export_pid(st.data_send, st.data_recv))
+	  throw proto_error("export_session: data channel doesn't support export");
+	st.key_id = key_id_;
+	st.key = *export_key;
+	st.key_age = std::uint32_t((*now - construct_time).to_seconds());
+      }
+
+      // Go ACTIVE with the data channel state of a session established
+      // by another process, see ProtoContext::resume_session().  The
+      // SSL handshake never runs on this key, so received control
+      // packets are dropped and sent control messages wait for the
+      // next key, see move_pending_app().  Renegotiation stays on the
+      // schedule of the original key.
+      void resume(const ProtoSessionState& st)
+      {
+	resumed = true;
+	tlsprf.reset(); // the key comes from st, nothing to derive
+	data_channel_key.reset(new DataChannelKey());
+	data_channel_key->key = st.key;
+	init_data_channel();
+	if (!dcs.crypto->import_pid(st.data_send, st.data_recv))
+	  throw proto_error("resume_session: data channel doesn't support resume");
+	reached_active_time_ = *now;
+	arena->retire();
+	set_state(ACTIVE);
+
+	const Time::Duration age = Time::Duration::seconds(st.key_age);
+	Time reneg = *now;
+	if (age < proto.config->renegotiate)
+	  reneg += proto.config->renegotiate - age;
+	set_event(KEV_BECOME_PRIMARY, KEV_RENEGOTIATE, reneg);
+      }
+
       // send explicit-exit-notify message to peer
       void send_explicit_exit_notify()
       {
 #ifndef OPENVPN_DISABLE_EXPLICIT_EXIT // explicit exit should always be enabled in production
-	if (crypto_flags & CryptoDCInstance::EXPLICIT_EXIT_NOTIFY_DEFINED)
-	  crypto->explicit_exit_notify();
+	if (dcs.crypto_flags & CryptoDCInstance::EXPLICIT_EXIT_NOTIFY_DEFINED)
+	  dcs.crypto->explicit_exit_notify();
 	else
 	  send_data_channel_message(proto_context_private::explicit_exit_notify_message,
 				    sizeof(proto_context_private::explicit_exit_notify_message));
 #endif
       }
 
+      // Send a path MTU probe of about size bytes of transport
+      // payload, followed by a request for the peer's max received
+      // size (OpenVPN 2 OCC_MTU_LOAD and OCC_MTU_REQUEST).  Returns
+      // the actual size of the probe, which depends on the cipher's
+      // padding, or 0 if it wasn't sent.
+      size_t send_pmtu_probe(const unsigned int size)
+      {
+	using namespace proto_context_private;
+	unsigned char msg[OCC_STRING_SIZE + 1];
+	std::memcpy(msg, explicit_exit_notify_message, OCC_STRING_SIZE);
+	const int pad = int(size) - crypto_encap - int(sizeof(msg));
+	if (pad < 0)
+	  return 0;
+	msg[OCC_STRING_SIZE] = OCC_MTU_LOAD;
+	const size_t ret = send_data_channel_message(msg, sizeof(msg), pad);
+	send_occ_mtu_request();
+	return ret;
+      }
+
+      // ask the peer for an OCC_MTU_REPLY, returns 0 if not sent
+      size_t send_occ_mtu_request()
+      {
+	using namespace proto_context_private;
+	unsigned char msg[OCC_STRING_SIZE + 1];
+	std::memcpy(msg, explicit_exit_notify_message, OCC_STRING_SIZE);
+	msg[OCC_STRING_SIZE] = OCC_MTU_REQUEST;
+	return send_data_channel_message(msg, sizeof(msg));
+      }
+
+      // answer OCC_MTU_REQUEST
+      void send_pmtu_reply(const unsigned int max_recv, const unsigned int max_send)
+      {
+	using namespace proto_context_private;
+	unsigned char msg[OCC_STRING_SIZE + 5];
+	std::memcpy(msg, explicit_exit_notify_message, OCC_STRING_SIZE);
+	msg[OCC_STRING_SIZE] = OCC_MTU_REPLY;
+	const std::uint16_t recv = htons(std::uint16_t(std::min(max_recv, 65535u)));
+	const std::uint16_t send = htons(std::uint16_t(std::min(max_send, 65535u)));
+	std::memcpy(msg + OCC_STRING_SIZE + 1, &recv, 2);
+	std::memcpy(msg + OCC_STRING_SIZE + 3, &send, 2);
+	send_data_channel_message(msg, sizeof(msg));
+      }
+
+      // Send an OCC_RTT_REQUEST if one is due.  This key's RTTProbe
+      // starts with the first call.
+      void send_rtt_probe(const Time& now)
+      {
+	using namespace proto_context_private;
+	if (!rtt)
+	  rtt.reset(new RTTProbe(proto.config->rtt_probe_interval));
+	const std::uint64_t ts = LatencyHistogram::now_ns() / 1000;
+	std::uint32_t seq;
+	if (!rtt->probe(now, ts, seq))
+	  return;
+	unsigned char msg[OCC_RTT_REQUEST_SIZE];
+	std::memcpy(msg, explicit_exit_notify_message, OCC_STRING_SIZE);
+	msg[OCC_STRING_SIZE] = OCC_RTT_REQUEST;
+	const std::uint32_t nseq = htonl(seq);
+	const std::uint64_t nts = Endian::rev64(ts);
+	std::memcpy(msg + OCC_STRING_SIZE + 1, &nseq, 4);
+	std::memcpy(msg + OCC_STRING_SIZE + 5, &nts, 8);
+	send_data_channel_message(msg, sizeof(msg));
+      }
+
+      // answer an OCC_RTT_REQUEST, held for hold_us since it arrived
+      void send_rtt_reply(const unsigned char *request, const std::uint32_t hold_us)
+      {
+	using namespace proto_context_private;
+	unsigned char msg[OCC_RTT_REPLY_SIZE];
+	std::memcpy(msg, explicit_exit_notify_message, OCC_STRING_SIZE);
+	msg[OCC_STRING_SIZE] = OCC_RTT_REPLY;
+	std::memcpy(msg + OCC_STRING_SIZE + 1, request, 12);
+	const std::uint32_t nhold = htonl(hold_us);
+	std::memcpy(msg + OCC_STRING_SIZE + 13, &nhold, 4);
+	send_data_channel_message(msg, sizeof(msg));
+      }
+
+      // pass an OCC_RTT_REPLY to this key's RTTProbe, returns false
+      // if it doesn't answer one of our probes
+      bool rtt_reply(const std::uint32_t seq, const std::uint64_t ts,
+		     const std::uint32_t hold_us, const std::uint64_t now_us)
+      {
+	return rtt && rtt->reply(seq, ts, hold_us, now_us);
+      }
+
+      // when send_rtt_probe() should be called next
+      Time next_rtt_probe() const
+      {
+	return rtt ? rtt->next_event() : Time();
+      }
+
+      const RTTProbe* rtt_probe() const { return rtt.get(); }
+
+      // Largest tunnel packet that the path carries: from the
+      // discovered path MTU if there is one, otherwise mssfix.
+      int mss_inter() const
+      {
+	if (proto.pmtu_cur)
+	  return int(proto.pmtu_cur) - crypto_encap;
+	return int(proto.config->mss_inter);
+      }
+
+      // call when ProtoContext::pmtu_cur changes
+      void update_mssfix()
+      {
+	if (dcs.crypto)
+	  dcs.mssfix = MSSFix(mss_inter());
+      }
+
       // general purpose method for sending constant string messages
-      // to peer via data channel
-      void send_data_channel_message(const unsigned char *data, const size_t size)
+      // to peer via data channel, followed by pad zero bytes.
+      // Returns the size of the packet sent, or 0.
+      size_t send_data_channel_message(const unsigned char *data, const size_t size, const size_t pad = 0)
       {
 	if (state >= ACTIVE
-	    && (crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
+	    && (dcs.crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
 	    && !invalidated())
 	  {
 	    // allocate packet
@@ -1661,13 +2257,17 @@ namespace openvpn {
 
 	    // write keepalive message
 	    pkt.buf->write(data, size);
+	    if (pad)
+	      std::memset(pkt.buf->write_alloc(pad), 0, pad);
 
 	    // process packet for transmission
 	    do_encrypt(*pkt.buf, false); // set compress hint to "no"
 
 	    // send it
 	    proto.net_send(key_id_, pkt);
+	    return pkt.buf->size();
 	  }
+	return 0;
       }
 
       // validate the integrity of a packet
@@ -1708,6 +2308,9 @@ namespace openvpn {
 	// set up crypto for data channel
 	if (data_channel_key)
 	  {
+	    if (tlsprf && !resumed)
+	      derive_session_keys(*data_channel_key);
+
 	    bool enable_compress = true;
 	    Config& c = *proto.config;
 	    const unsigned int key_dir = proto.is_server() ? OpenVPNStaticKey::INVERSE : OpenVPNStaticKey::NORMAL;
@@ -1720,48 +2323,55 @@ namespace openvpn {
 		dp.encrypt_red_limit = OPENVPN_BS64_DATA_LIMIT;
 		dp.decrypt_red_limit = OPENVPN_BS64_DATA_LIMIT;
 		OPENVPN_LOG_PROTO("Per-Key Data Limit: " << dp.encrypt_red_limit << '/' << dp.decrypt_red_limit);
-		data_limit.reset(new DataLimit(dp));
+		dcs.data_limit.reset(new DataLimit(dp));
 	      }
 
 	    // build crypto context for data channel encryption/decryption
-	    crypto = c.dc.context().new_obj(key_id_);
-	    crypto_flags = crypto->defined();
+	    dcs.crypto = c.dc.context().new_obj(key_id_);
+	    dcs.crypto_flags = dcs.crypto->defined();
+	    dcs.fast = dcs.crypto->fast_path();
 
-	    if (crypto_flags & CryptoDCInstance::CIPHER_DEFINED)
-	      crypto->init_cipher(key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir),
+	    if (dcs.crypto_flags & CryptoDCInstance::CIPHER_DEFINED)
+	      dcs.crypto->init_cipher(key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir),
 				  key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | key_dir));
 
-	    if (crypto_flags & CryptoDCInstance::HMAC_DEFINED)
-	      crypto->init_hmac(key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir),
+	    if (dcs.crypto_flags & CryptoDCInstance::HMAC_DEFINED)
+	      dcs.crypto->init_hmac(key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir),
 				key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir));
 
-	    crypto->init_pid(PacketID::SHORT_FORM,
+	    dcs.crypto->init_pid(proto.data_pid_form(),
 			     c.pid_mode,
-			     PacketID::SHORT_FORM,
+			     proto.data_pid_form(),
 			     "DATA", int(key_id_),
 			     proto.stats);
 
-	    crypto->init_remote_peer_id(c.remote_peer_id);
+	    dcs.crypto->init_remote_peer_id(c.remote_peer_id);
 
-	    enable_compress = crypto->consider_compression(proto.config->comp_ctx);
+	    enable_compress = dcs.crypto->consider_compression(proto.config->comp_ctx);
 
 	    if (data_channel_key->rekey_defined)
-	      crypto->rekey(data_channel_key->rekey_type);
+	      dcs.crypto->rekey(data_channel_key->rekey_type);
+	    if (proto.config->session_export)
+	      export_key.reset(new OpenVPNStaticKey(key));
 	    data_channel_key.reset();
 
 	    // set up compression for data channel
 	    if (enable_compress)
-	      compress = proto.config->comp_ctx.new_compressor(proto.config->frame, proto.stats);
+	      {
+		dcs.compress = proto.config->comp_ctx.new_compressor(proto.config->frame, proto.stats);
+		dcs.compress->set_adaptive(proto.config->comp_adaptive);
+		dcs.compress->set_precheck(proto.config->comp_precheck, proto.config->layer() == Layer::OSI_LAYER_2);
+	      }
 	    else
-	      compress.reset();
+	      dcs.compress.reset();
 
 	    // cache op32 for hot path in do_encrypt
 	    cache_op32();
 
-	    int crypto_encap = (enable_op32 ? OP_SIZE_V2 : 1) +
-			       c.comp_ctx.extra_payload_bytes() +
-			       PacketID::size(PacketID::SHORT_FORM) +
-			       c.dc.context().encap_overhead();
+	    crypto_encap = (dcs.enable_op32 ? OP_SIZE_V2 : 1) +
+			   c.comp_ctx.extra_payload_bytes() +
+			   PacketID::size(proto.data_pid_form()) +
+			   c.dc.context().encap_overhead();
 
 	    int transport_encap = 0;
 	    if (c.mss_parms.mtu)
@@ -1786,14 +2396,16 @@ namespace openvpn {
 				  " transport_encap=" << transport_encap);
 		c.mss_inter = c.mss_parms.mssfix - (crypto_encap + transport_encap);
 	      }
+	    dcs.mssfix = MSSFix(mss_inter());
+	    update_ready();
 	  }
       }
 
       void data_limit_notify(const DataLimit::Mode cdl_mode,
 			     const DataLimit::State cdl_status)
       {
-	if (data_limit)
-	  data_limit_event(cdl_mode, data_limit->update_state(cdl_mode, cdl_status));
+	if (dcs.data_limit)
+	  data_limit_event(cdl_mode, dcs.data_limit->update_state(cdl_mode, cdl_status));
       }
 
     private:
@@ -1933,25 +2545,30 @@ namespace openvpn {
 	bool pid_wrap;
 
 	// set MSS for segments client can receive
-	if (proto.config->mss_inter > 0)
-	  MSSFix::mssfix(buf, proto.config->mss_inter);
+	if (dcs.mssfix.enabled())
+	  dcs.mssfix.fix(buf);
 
 	// compress packet
-	if (compress)
-	  compress->compress(buf, compress_hint);
+	if (dcs.compress)
+	  {
+	    SessionStats::CpuScope cpu_scope(proto.stats.get(), CpuStats::COMPRESS);
+	    dcs.compress->compress(buf, compress_hint);
+	  }
 
 	// trigger renegotiation if we hit encrypt data limit
-	if (data_limit)
+	if (dcs.data_limit)
 	  data_limit_add(DataLimit::Encrypt, buf.size());
 
-	if (enable_op32)
+	if (dcs.enable_op32)
 	  {
-	    const std::uint32_t op32 = htonl(op32_compose(DATA_V2, key_id_, remote_peer_id));
+	    const std::uint32_t op32 = htonl(op32_compose(DATA_V2, key_id_, dcs.remote_peer_id));
 
 	    static_assert(sizeof(op32) == OP_SIZE_V2, "OP_SIZE_V2 inconsistency");
 
 	    // encrypt packet
-	    pid_wrap = crypto->encrypt(buf, now->seconds_since_epoch(), (const unsigned char *)&op32);
+	    pid_wrap = dcs.fast.defined()
+	      ? dcs.fast.encrypt(*dcs.crypto, buf, now->seconds_since_epoch(), (const unsigned char *)&op32)
+	      : dcs.crypto->encrypt(buf, now->seconds_since_epoch(), (const unsigned char *)&op32);
 
 	    // prepend op
 	    buf.prepend((const unsigned char *)&op32, sizeof(op32));
@@ -1959,7 +2576,9 @@ namespace openvpn {
 	else
 	  {
 	    // encrypt packet
-	    pid_wrap = crypto->encrypt(buf, now->seconds_since_epoch(), nullptr);
+	    pid_wrap = dcs.fast.defined()
+	      ? dcs.fast.encrypt(*dcs.crypto, buf, now->seconds_since_epoch(), nullptr)
+	      : dcs.crypto->encrypt(buf, now->seconds_since_epoch(), nullptr);
 
 	    // prepend op
 	    buf.push_front(op_compose(DATA_V1, key_id_));
@@ -1970,25 +2589,37 @@ namespace openvpn {
       // cache op32 and remote_peer_id
       void cache_op32()
       {
-	enable_op32 = proto.config->enable_op32;
-	remote_peer_id = proto.config->remote_peer_id;
+	dcs.enable_op32 = proto.config->enable_op32;
+	dcs.remote_peer_id = proto.config->remote_peer_id;
       }
 
       void set_state(const int newstate)
       {
 	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KeyContext[" << key_id_ << "] " << state_string(state) << " -> " << state_string(newstate));
+	OPENVPN_TRACE_EVENT(KEY_STATE, &proto, key_id_, state, newstate);
 	state = newstate;
+	update_ready();
+      }
+
+      // recompute the data channel fast-path predicate
+      void update_ready()
+      {
+	dcs.ready = state >= ACTIVE
+	  && (dcs.crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
+	  && !invalidated();
       }
 
       void set_event(const EventType current)
       {
 	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KeyContext[" << key_id_ << "] " << event_type_string(current));
+	OPENVPN_TRACE_EVENT(KEY_EVENT, &proto, key_id_, current, next_event);
 	current_event = current;
       }
 
       void set_event(const EventType current, const EventType next, const Time& next_time)
       {
 	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KeyContext[" << key_id_ << "] " << event_type_string(current) << " -> " << event_type_string(next) << '(' << seconds_until(next_time) << ')');
+	OPENVPN_TRACE_EVENT(KEY_EVENT, &proto, key_id_, current, next);
 	current_event = current;
 	next_event = next;
 	next_event_time = next_time;
@@ -1996,6 +2627,7 @@ namespace openvpn {
 
       void invalidate_callback() // called by ProtoStackBase when session is invalidated
       {
+	dcs.ready = false;
 	reached_active_time_ = Time();
 	next_event = KEV_NONE;
 	next_event_time = Time::infinite();
@@ -2025,7 +2657,7 @@ namespace openvpn {
       // Handle data-limited keys such as Blowfish and other 64-bit block-size ciphers.
       void data_limit_add(const DataLimit::Mode mode, const size_t size)
       {
-	const DataLimit::State state = data_limit->add(mode, size);
+	const DataLimit::State state = dcs.data_limit->add(mode, size);
 	if (state > DataLimit::None)
 	  data_limit_event(mode, state);
       }
@@ -2034,6 +2666,7 @@ namespace openvpn {
       void data_limit_event(const DataLimit::Mode mode, const DataLimit::State state)
       {
 	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " DATA LIMIT " << DataLimit::mode_str(mode) << ' ' << DataLimit::state_str(state) << " key_id=" << key_id_);
+	OPENVPN_TRACE_EVENT(DATA_LIMIT, &proto, key_id_, mode, state);
 
 	// State values:
 	//   DataLimit::Green -- first packet received and decrypted.
@@ -2044,7 +2677,7 @@ namespace openvpn {
 	// When we are in KEV_PRIMARY_PENDING state, we must receive at least
 	// one packet from the peer on this key before we transition to
 	// KEV_BECOME_PRIMARY so we can transmit on it.
-	if (next_event == KEV_PRIMARY_PENDING && data_limit->is_decrypt_green())
+	if (next_event == KEV_PRIMARY_PENDING && dcs.data_limit->is_decrypt_green())
 	  set_event(KEV_NONE, KEV_BECOME_PRIMARY, *now + Time::Duration::seconds(1));
       }
 
@@ -2055,7 +2688,7 @@ namespace openvpn {
       // 4. no data received yet from peer on this key.
       bool data_limit_defer() const
       {
-	return !proto.is_server() && data_limit && key_id_ && !data_limit->is_decrypt_green();
+	return !proto.is_server() && dcs.data_limit && key_id_ && !dcs.data_limit->is_decrypt_green();
       }
 
       // General expiration set when key hits data limit threshold.
@@ -2073,6 +2706,7 @@ namespace openvpn {
       {
 	if (*now >= next_event_time)
 	  {
+	    OPENVPN_TRACE_EVENT(KEY_NEXT_EVENT, &proto, key_id_, next_event, 0);
 	    switch (next_event)
 	      {
 	      case KEV_BECOME_PRIMARY:
@@ -2152,39 +2786,53 @@ namespace openvpn {
 	  }
       }
 
+      void async_ready() // called by ProtoStackBase
+      {
+	proto.control_async_ready();
+      }
+
       void app_recv(BufferPtr&& to_app_buf) // called by ProtoStackBase
       {
 	app_recv_buf.put(std::move(to_app_buf));
 	if (app_recv_buf.size() > APP_MSG_MAX)
 	  throw proto_error("app_recv: received control message is too large");
-	BufferComposed::Complete bcc = app_recv_buf.complete();
 	switch (state)
 	  {
 	  case C_WAIT_AUTH:
-	    if (recv_auth_complete(bcc))
-	      {
-		recv_auth(bcc.get());
-		set_state(C_WAIT_AUTH_ACK);
-	      }
+	    {
+	      BufferComposed::Complete bcc = app_recv_buf.complete();
+	      if (recv_auth_complete(bcc))
+		{
+		  recv_auth(bcc.get());
+		  set_state(C_WAIT_AUTH_ACK);
+		}
+	    }
 	    break;
 	  case S_WAIT_AUTH:
-	    if (recv_auth_complete(bcc))
-	      {
-		recv_auth(bcc.get());
-		send_auth();
-		set_state(S_WAIT_AUTH_ACK);
-	      }
+	    {
+	      BufferComposed::Complete bcc = app_recv_buf.complete();
+	      if (recv_auth_complete(bcc))
+		{
+		  recv_auth(bcc.get());
+		  send_auth();
+		  set_state(S_WAIT_AUTH_ACK);
+		}
+	    }
 	    break;
 	  case S_WAIT_AUTH_ACK: // rare case where client receives auth, goes ACTIVE, but the ACK response is dropped
 	  case ACTIVE:
-	    if (bcc.advance_to_null()) // does composed buffer contain terminating null char?
-	      proto.app_recv(key_id_, bcc.get());
+	    if (app_recv_buf.null_seen()) // does composed buffer contain terminating null char?
+	      proto.app_recv(key_id_, app_recv_buf.get());
 	    break;
 	  }
       }
 
       void net_send(const Packet& net_pkt, const Base::NetSendType nstype)  // called by ProtoStackBase
       {
+	if (suppress_net_send)
+	  return;
+	if (nstype == Base::NET_SEND_RETRANSMIT)
+	  OPENVPN_TRACE_EVENT(RETRANSMIT, &proto, key_id_, net_pkt ? net_pkt.buffer().size() : 0, 0);
 	if (!is_reliable || nstype != Base::NET_SEND_RETRANSMIT) // retransmit packets on UDP only, not TCP
 	  proto.net_send(key_id_, net_pkt);
       }
@@ -2216,6 +2864,11 @@ namespace openvpn {
 	  }
       }
 
+      // On the client this is the first cleartext written after
+      // start_handshake(), so with SSLConst::ENABLE_EARLY_DATA and a
+      // resumed TLS 1.3 session it goes out as early data along with
+      // the ClientHello.  The server holds it back until the
+      // handshake is done, since early data can be replayed.
       void send_auth()
       {
 	BufferPtr buf = new BufferAllocated();
@@ -2292,23 +2945,64 @@ namespace openvpn {
 	    dirty = true;
 	  }
 	reached_active_time_ = *now;
-	proto.slowest_handshake_.max(reached_active_time_ - construct_time);
+
+	// objects of later control messages, which may be long-lived,
+	// come from the global heap
+	arena->retire();
+
+	const Time::Duration handshake_time = reached_active_time_ - construct_time;
+	proto.slowest_handshake_.max(handshake_time);
+	proto.stats->inc_stat(SessionStats::HANDSHAKES, 1);
+	if (proto.stats->latency_enabled())
+	  proto.stats->record_latency(SessionStats::LAT_HANDSHAKE, std::uint64_t(handshake_time.to_double() * 1e9));
 	active_event();
       }
 
-      // use the TLS PRF construction to exchange session keys for building
-      // the data channel crypto context
+      // Generate session keys for building the data channel crypto
+      // context.  A client deferring data channel setup learns the
+      // key derivation method from the push, so it exports the TLS
+      // keying material now, before later control traffic may keep
+      // the SSL object busy, and derives the keys in init_data_channel().
       void generate_session_keys()
       {
 	std::unique_ptr<DataChannelKey> dck(new DataChannelKey());
-	tlsprf->generate_key_expansion(dck->key, proto.psid_self, proto.psid_peer);
-	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KEY " << proto.mode().str() << ' ' << dck->key.render());
-	tlsprf->erase();
+	if (proto.dc_deferred && !proto.is_server())
+	  {
+	    if (proto.config->ssl_factory->keying_material_exporter())
+	      export_keying_material(dck->ekm);
+	  }
+	else
+	  derive_session_keys(*dck);
 	dck.swap(data_channel_key);
 	if (!proto.dc_deferred)
 	  init_data_channel();
       }
 
+      // use the TLS keying material exporter (RFC 5705) if negotiated,
+      // else the TLS PRF construction over the key-method 2 randoms
+      void derive_session_keys(DataChannelKey& dck)
+      {
+	if (proto.tls_ekm)
+	  {
+	    if (!dck.ekm.defined() && !export_keying_material(dck.ekm))
+	      throw proto_error("tls_ekm_failed");
+	    dck.key = dck.ekm;
+	  }
+	else
+	  tlsprf->generate_key_expansion(dck.key, proto.psid_self, proto.psid_peer);
+	dck.ekm.erase();
+	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KEY " << proto.mode().str() << ' ' << dck.key.render());
+	tlsprf->erase();
+	tlsprf.reset(); // only needed for the key-method 2 exchange
+      }
+
+      bool export_keying_material(OpenVPNStaticKey& key)
+      {
+	return Base::export_keying_material("EXPORTER-OpenVPN-datakeys",
+					    key.raw_alloc(),
+					    OpenVPNStaticKey::KEY_SIZE);
+      }
+
       void prepend_dest_psid_and_acks(Buffer& buf)
       {
 	// if sending ACKs, prepend dest PSID
@@ -2488,7 +3182,7 @@ namespace openvpn {
 
 	// process ACKs sent by peer (if packet ID check failed,
 	// read the ACK IDs, but don't modify the rel_send object).
-	if (ReliableAck::ack(rel_send, recv, pid_ok))
+	if (ReliableAck::ack(rel_send, recv, pid_ok, *now))
 	  {
 	    // make sure that our own PSID is contained in packet received from peer
 	    if (!verify_dest_psid (recv))
@@ -2636,7 +3330,7 @@ namespace openvpn {
 	  return false;
 
 	// process ACKs sent by peer
-	if (ReliableAck::ack(rel_send, recv, true))
+	if (ReliableAck::ack(rel_send, recv, true, *now))
 	  {
 	    // make sure that our own PSID is in packet received from peer
 	    if (!verify_dest_psid(recv))
@@ -2739,6 +3433,8 @@ namespace openvpn {
 	OpenVPNStaticKey client_key;
 	plaintext.read(client_key.raw_alloc(), OpenVPNStaticKey::KEY_SIZE);
 	proto.reset_tls_crypt(*proto.config, client_key);
+	if (proto.config->session_export)
+	  proto.tls_crypt_v2_key.reset(new OpenVPNStaticKey(client_key));
 
 	// verify metadata
 	int metadata_type = -1;
@@ -2835,20 +3531,35 @@ namespace openvpn {
 	  return d.to_seconds();
       }
 
+      // Fields touched by every data channel packet, grouped so that
+      // encrypt()/decrypt() stay within one cache line of KeyContext
+      // rather than chasing members spread across the object.
+      struct DataChannelState
+      {
+	CryptoDCInstance::Ptr crypto;
+	CryptoDCInstance::FastPath fast; // statically bound crypto calls, if crypto supports them
+	Compress::Ptr compress;
+	std::unique_ptr<DataLimit> data_limit;
+	unsigned int crypto_flags = 0;
+	int remote_peer_id = -1; // -1 to disable
+	MSSFix mssfix; // limits precomputed from mss_inter
+	bool enable_op32 = false;
+	bool ready = false; // state >= ACTIVE, CRYPTO_DEFINED, and not invalidated
+      };
+
       // BEGIN KeyContext data members
 
+      DataChannelState dcs; // hot: keep first
       ProtoContext& proto; // parent
       int state;
       unsigned int key_id_;
-      unsigned int crypto_flags;
-      int remote_peer_id; // -1 to disable
-      bool enable_op32;
       bool dirty;
       bool key_limit_renegotiation_fired;
+      Time deferred_expire; // expiry held over while renegotiation is deferred
       bool is_reliable;
-      Compress::Ptr compress;
-      CryptoDCInstance::Ptr crypto;
+      bool suppress_net_send = false;
       TLSPRFInstance::Ptr tlsprf;
+      Arena::Ptr arena; // control channel objects until ACTIVE
       Time construct_time;
       Time reached_active_time_;
       Time next_event_time;
@@ -2856,22 +3567,57 @@ namespace openvpn {
       EventType next_event;
       std::deque<BufferPtr> app_pre_write_queue;
       std::unique_ptr<DataChannelKey> data_channel_key;
+      std::unique_ptr<OpenVPNStaticKey> export_key; // with Config::session_export
+      bool resumed = false; // from ProtoContext::resume_session(), no SSL session
+      int crypto_encap = 0; // data channel bytes around a tunnel packet
       BufferComposed app_recv_buf;
-      std::unique_ptr<DataLimit> data_limit;
       BufferAllocated work;
+      BufferAllocated decompress_buf; // see process_decrypted()
+      std::unique_ptr<RTTProbe> rtt; // probes sent with this key, see ProtoContext::rtt_probe()
 
       // static member used by validate_tls_crypt()
       static BufferAllocated static_work;
     };
 
   public:
+    // If net_buf is a client's initial reset, set psid to its source
+    // session ID and return true.  The opcode and session ID are in
+    // the clear in all tls-wrap modes, so the packet is not
+    // authenticated here.
+    static bool initial_reset_psid(const Buffer& net_buf, ProtoSessionID& psid)
+    {
+      if (net_buf.size() < 1 + ProtoSessionID::SIZE || key_id_extract(net_buf[0]) != 0)
+	return false;
+      const unsigned int opcode = opcode_extract(net_buf[0]);
+      if (opcode != CONTROL_HARD_RESET_CLIENT_V2 && opcode != CONTROL_HARD_RESET_CLIENT_V3)
+	return false;
+      Buffer b(net_buf);
+      b.advance(1);
+      psid.read(b);
+      return true;
+    }
+
     class TLSWrapPreValidate : public RC<thread_unsafe_refcount>
     {
     public:
       typedef RCPtr<TLSWrapPreValidate> Ptr;
 
       virtual bool validate(const BufferAllocated& net_buf) = 0;
-    };
+
+      // Validate a burst of packets, e.g. from one recvmmsg() call,
+      // setting ok[i] for each of bufs[i].  Returns the number of
+      // valid packets.
+      virtual size_t validate_batch(const BufferAllocated* const* bufs, const size_t n, bool* ok)
+      {
+	size_t n_ok = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    ok[i] = validate(*bufs[i]);
+	    n_ok += ok[i];
+	  }
+	return n_ok;
+      }
+    };
 
     // Validate the integrity of a packet, only considering tls-auth HMAC.
     class TLSAuthPreValidate : public TLSWrapPreValidate
@@ -2967,26 +3713,7 @@ namespace openvpn {
 	    if (opcode_extract(op) != reset_op || key_id_extract(op) != 0)
 	      return false;
 
-	    const size_t data_offset = TLSCryptContext::hmac_offset + tls_crypt_recv->output_hmac_size();
-	    if (net_buf.size() < data_offset)
-	      return false;
-
-	    frame->prepare(Frame::DECRYPT_WORK, work);
-
-	    // decrypt payload from 'net_buf' into 'work'
-	    const size_t decrypt_bytes = tls_crypt_recv->decrypt(net_buf.c_data() + TLSCryptContext::hmac_offset,
-								 work.data(), work.max_size(),
-								 net_buf.c_data() + data_offset,
-								 net_buf.size() - data_offset);
-	    if (!decrypt_bytes)
-	      return false;
-
-	    work.inc_size(decrypt_bytes);
-
-	    // verify HMAC
-	    return tls_crypt_recv->hmac_cmp(net_buf.c_data(),
-					    TLSCryptContext::hmac_offset,
-					    work.data(), work.size());
+	    return validate_wrapped(net_buf.c_data(), net_buf.size(), *tls_crypt_recv);
 	}
 	catch (BufferException&)
 	{
@@ -2994,6 +3721,31 @@ namespace openvpn {
 	return false;
       }
 
+    protected:
+      // verify the tls-crypt wrapping of the size bytes at data
+      bool validate_wrapped(const unsigned char *data, const size_t size, TLSCryptInstance& recv)
+      {
+	const size_t data_offset = TLSCryptContext::hmac_offset + recv.output_hmac_size();
+	if (size < data_offset)
+	  return false;
+
+	frame->prepare(Frame::DECRYPT_WORK, work);
+
+	// decrypt payload from 'data' into 'work'
+	const size_t decrypt_bytes = recv.decrypt(data + TLSCryptContext::hmac_offset,
+						  work.data(), work.max_size(),
+						  data + data_offset,
+						  size - data_offset);
+	if (!decrypt_bytes)
+	  return false;
+
+	work.inc_size(decrypt_bytes);
+
+	// verify HMAC
+	return recv.hmac_cmp(data, TLSCryptContext::hmac_offset,
+			     work.data(), work.size());
+      }
+
     protected:
       unsigned int reset_op;
 
@@ -3016,8 +3768,471 @@ namespace openvpn {
 
             // in case of server peer, we expect the new v3 packet type
             if (server)
-              reset_op = CONTROL_HARD_RESET_CLIENT_V3;
+	      {
+		reset_op = CONTROL_HARD_RESET_CLIENT_V3;
+
+		// the server key only unwraps the WKc, the packet itself
+		// is wrapped with the client key found inside
+		tls_crypt_context = c.tls_crypt_context;
+		tls_crypt_server = tls_crypt_context->new_obj_recv();
+		tls_crypt_server->init(c.tls_key.slice(OpenVPNStaticKey::HMAC),
+				       c.tls_key.slice(OpenVPNStaticKey::CIPHER));
+	      }
           }
+
+	  bool validate(const BufferAllocated& net_buf) override
+	  {
+	    if (!tls_crypt_server)
+	      return TLSCryptPreValidate::validate(net_buf);
+
+	    try
+	    {
+		if (!net_buf.size())
+		  return false;
+
+		const unsigned int op = net_buf[0];
+		if (opcode_extract(op) != reset_op || key_id_extract(op) != 0)
+		  return false;
+
+		// the WKc follows the tls-crypt frame of the initial reset,
+		// which carries no ACKs, see KeyContext::unwrap_tls_crypt_wkc()
+		const size_t hmac_size = tls_crypt_context->digest_size();
+		const size_t tls_frame_size = 1 + ProtoSessionID::SIZE +
+					      PacketID::size(PacketID::LONG_FORM) +
+					      hmac_size +
+					      sizeof(char) +
+					      sizeof(reliable::id_t);
+		if (net_buf.size() < tls_frame_size + hmac_size + sizeof(uint16_t))
+		  return false;
+
+		TLSCryptInstance* client = client_key(net_buf.c_data() + tls_frame_size,
+						      net_buf.size() - tls_frame_size);
+		return client && validate_wrapped(net_buf.c_data(), tls_frame_size, *client);
+	    }
+	    catch (BufferException&)
+	    {
+	    }
+	    return false;
+	  }
+
+	  // number of WKc unwraps that were served from the cache
+	  unsigned long long n_cache_hits() const
+	  {
+	    return cache_hits;
+	  }
+
+        private:
+	  enum {
+	    CACHE_SIZE = 16,
+	  };
+
+	  // a recently unwrapped WKc and its client key
+	  struct ClientKey
+	  {
+	    BufferAllocated wkc;
+	    TLSCryptInstance::Ptr recv;
+	  };
+
+	  // Return the tls-crypt receive context for the client key in
+	  // the WKc blob at wkc_raw, or nullptr if it can't be unwrapped.
+	  // A client retransmitting its initial reset sends the same
+	  // WKc, so only authenticated blobs are kept in a small LRU
+	  // cache and matched byte for byte.
+	  TLSCryptInstance* client_key(const unsigned char *wkc_raw, const size_t wkc_size)
+	  {
+	    for (auto i = cache.begin(); i != cache.end(); ++i)
+	      {
+		if (i->wkc.size() == wkc_size && !std::memcmp(i->wkc.c_data(), wkc_raw, wkc_size))
+		  {
+		    if (i != cache.begin())
+		      cache.splice(cache.begin(), cache, i);
+		    ++cache_hits;
+		    return cache.front().recv.get();
+		  }
+	      }
+
+	    const size_t hmac_size = tls_crypt_context->digest_size();
+	    const size_t payload_size = wkc_size - sizeof(uint16_t);
+	    uint16_t wkc_len;
+	    std::memcpy(&wkc_len, wkc_raw + payload_size, sizeof(wkc_len));
+	    if (ntohs(wkc_len) != wkc_size)
+	      return nullptr;
+
+	    // the authentication tag covers len || Kc || metadata
+	    BufferAllocated plaintext(wkc_size, BufferAllocated::CONSTRUCT_ZERO);
+	    plaintext.write(&wkc_len, sizeof(wkc_len));
+	    const size_t decrypt_bytes = tls_crypt_server->decrypt(wkc_raw,
+								   plaintext.data() + sizeof(wkc_len),
+								   plaintext.max_size() - sizeof(wkc_len),
+								   wkc_raw + hmac_size,
+								   payload_size - hmac_size);
+	    plaintext.inc_size(decrypt_bytes);
+	    if (plaintext.size() < OpenVPNStaticKey::KEY_SIZE
+		|| !tls_crypt_server->hmac_cmp(wkc_raw, 0, plaintext.c_data(), plaintext.size()))
+	      return nullptr;
+	    plaintext.advance(sizeof(wkc_len));
+
+	    OpenVPNStaticKey key;
+	    plaintext.read(key.raw_alloc(), OpenVPNStaticKey::KEY_SIZE);
+	    plaintext.clear();
+
+	    if (cache.size() >= CACHE_SIZE)
+	      cache.pop_back();
+	    cache.emplace_front();
+	    ClientKey& ck = cache.front();
+	    ck.wkc.init(wkc_size, 0);
+	    ck.wkc.write(wkc_raw, wkc_size);
+	    ck.recv = tls_crypt_context->new_obj_recv();
+	    ck.recv->init(key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | OpenVPNStaticKey::NORMAL),
+			  key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | OpenVPNStaticKey::NORMAL));
+	    return ck.recv.get();
+	  }
+
+	  TLSCryptContext::Ptr tls_crypt_context;
+	  TLSCryptInstance::Ptr tls_crypt_server;
+	  std::list<ClientKey> cache; // most recently used first
+	  unsigned long long cache_hits = 0;
+    };
+
+    // Stateless server-side handling of the initial client reset, in
+    // the spirit of TCP SYN cookies.  A valid HARD_RESET_CLIENT_V2 is
+    // answered with a HARD_RESET_SERVER_V2 whose session ID is an HMAC
+    // of the client address, the client session ID and a coarse
+    // timestamp, without allocating any per-client state.  A session
+    // is only created when the client's next packet acknowledges that
+    // reply and echoes the session ID back, which also proves that the
+    // client can receive packets at its source address.  The session
+    // then joins the handshake with ProtoContext::start_from_cookie().
+    //
+    // Not available with tls-crypt-v2, since the server can't wrap
+    // its reply before it has unwrapped the client key.
+    class PsidCookie : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<PsidCookie> Ptr;
+
+      OPENVPN_SIMPLE_EXCEPTION(psid_cookie_error);
+
+      enum Action {
+	DROP,   // invalid packet
+	REPLY,  // send the stateless reply back to the peer
+	ACCEPT, // cookie verified, create a session for the peer
+      };
+
+      enum {
+	COOKIE_KEY_SIZE = 64,
+	COOKIE_HMAC_MAX = 64,
+      };
+
+      PsidCookie(const Config& c)
+	: frame(c.frame),
+	  now(c.now)
+      {
+	if (!now)
+	  throw psid_cookie_error();
+	if (c.tls_crypt_v2_enabled())
+	  throw psid_cookie_error();
+	else if (c.tls_crypt_enabled())
+	  {
+	    tls_wrap_mode = TLS_CRYPT;
+	    hmac_size = c.tls_crypt_context->digest_size();
+	    tls_crypt_send = c.tls_crypt_context->new_obj_send();
+	    tls_crypt_recv = c.tls_crypt_context->new_obj_recv();
+	    const unsigned int key_dir = OpenVPNStaticKey::NORMAL; // server side
+	    tls_crypt_send->init(c.tls_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir),
+				 c.tls_key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir));
+	    tls_crypt_recv->init(c.tls_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir),
+				 c.tls_key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | key_dir));
+	  }
+	else if (c.tls_auth_enabled())
+	  {
+	    tls_wrap_mode = TLS_AUTH;
+	    hmac_size = c.tls_auth_context->size();
+	    ta_hmac_send = c.tls_auth_context->new_obj();
+	    ta_hmac_recv = c.tls_auth_context->new_obj();
+	    if (c.key_direction >= 0)
+	      {
+		const unsigned int key_dir = c.key_direction ? OpenVPNStaticKey::INVERSE : OpenVPNStaticKey::NORMAL;
+		ta_hmac_send->init(c.tls_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir));
+		ta_hmac_recv->init(c.tls_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir));
+	      }
+	    else
+	      {
+		ta_hmac_send->init(c.tls_key.slice(OpenVPNStaticKey::HMAC));
+		ta_hmac_recv->init(c.tls_key.slice(OpenVPNStaticKey::HMAC));
+	      }
+	  }
+	else
+	  {
+	    tls_wrap_mode = TLS_PLAIN;
+	    hmac_size = 0;
+	  }
+
+	// cookie HMAC with a per-process secret, from whichever
+	// HMAC implementation the config provides
+	if (!c.rng)
+	  throw psid_cookie_error();
+	StaticKey key;
+	key.init_from_rng(*c.rng, COOKIE_KEY_SIZE);
+	if (c.tls_auth_factory)
+	  {
+	    cookie_hmac = c.tls_auth_factory->new_obj(CryptoAlgs::SHA256)->new_obj();
+	    cookie_hmac->init(key);
+	  }
+	else if (c.tls_crypt_context)
+	  {
+	    StaticKey unused_key;
+	    unused_key.init_from_rng(*c.rng, COOKIE_KEY_SIZE);
+	    cookie_tls_crypt = c.tls_crypt_context->new_obj_send();
+	    cookie_tls_crypt->init(key, unused_key);
+	  }
+	else
+	  throw psid_cookie_error();
+
+	// the cookie is valid for the current and the previous time slot
+	slot_seconds = c.handshake_window.to_seconds() / 2;
+	if (!slot_seconds)
+	  slot_seconds = 1;
+      }
+
+      // Process a packet from a peer that has no session.  For a valid
+      // client reset, the stateless reply is written to reply.
+      Action process(const BufferAllocated& net_buf,
+		     const IP::Addr& addr,
+		     const unsigned int port,
+		     BufferAllocated& reply)
+      {
+	try {
+	  if (!net_buf.size() || key_id_extract(net_buf[0]) != 0)
+	    return DROP;
+	  switch (opcode_extract(net_buf[0]))
+	    {
+	    case CONTROL_HARD_RESET_CLIENT_V2:
+	      {
+		ProtoSessionID client_psid;
+		if (!unwrap(net_buf, client_psid))
+		  return DROP;
+
+		// initial reset carries no ACKs and is message ID 0
+		if (ReliableAck::ack_skip(work) || ReliableAck::read_id(work) != 0)
+		  return DROP;
+
+		// the reply's packet ID uses the session clock, so that the
+		// session started from the cookie never sends an older one
+		const PacketID::time_t slot = BatchClock::now().seconds_since_epoch() / slot_seconds;
+		gen_reply(client_psid, cookie(addr, port, client_psid, slot), now->seconds_since_epoch(), reply);
+		return REPLY;
+	      }
+	    case CONTROL_V1:
+	    case ACK_V1:
+	      {
+		ProtoSessionID self, peer;
+		return verify(net_buf, addr, port, self, peer) ? ACCEPT : DROP;
+	      }
+	    }
+	}
+	catch (BufferException&)
+	  {
+	  }
+	return DROP;
+      }
+
+      // Return true if net_buf acknowledges a stateless reply sent to
+      // addr/port and echoes a valid cookie.  On success, self and
+      // peer are the session IDs to pass to start_from_cookie().
+      bool verify(const BufferAllocated& net_buf,
+		  const IP::Addr& addr,
+		  const unsigned int port,
+		  ProtoSessionID& self,
+		  ProtoSessionID& peer)
+      {
+	try {
+	  if (!net_buf.size() || key_id_extract(net_buf[0]) != 0)
+	    return false;
+	  const unsigned int opcode = opcode_extract(net_buf[0]);
+	  if (opcode != CONTROL_V1 && opcode != ACK_V1)
+	    return false;
+	  if (!unwrap(net_buf, peer))
+	    return false;
+
+	  // must ACK our reset, which is message ID 0
+	  bool acked = false;
+	  const size_t n_acks = work.pop_front();
+	  for (size_t i = 0; i < n_acks; ++i)
+	    {
+	      if (ReliableAck::read_id(work) == 0)
+		acked = true;
+	    }
+	  if (!acked)
+	    return false;
+	  self.read(work);
+
+	  // the first control message after the reset is message ID 1
+	  if (opcode == CONTROL_V1 && ReliableAck::read_id(work) != 1)
+	    return false;
+
+	  const PacketID::time_t slot = BatchClock::now().seconds_since_epoch() / slot_seconds;
+	  return self.match(cookie(addr, port, peer, slot))
+	      || self.match(cookie(addr, port, peer, slot - 1));
+	}
+	catch (BufferException&)
+	  {
+	  }
+	return false;
+      }
+
+    private:
+      // Verify the tls-wrap of net_buf, returning its source session ID
+      // and leaving the payload that follows the tls-wrap header in work.
+      bool unwrap(const BufferAllocated& net_buf, ProtoSessionID& src_psid)
+      {
+	const size_t head_size = 1 + ProtoSessionID::SIZE;
+	const size_t pid_size = PacketID::size(PacketID::LONG_FORM);
+	switch (tls_wrap_mode)
+	  {
+	  case TLS_AUTH:
+	    if (net_buf.size() < head_size + hmac_size + pid_size
+		|| !ta_hmac_recv->ovpn_hmac_cmp(net_buf.c_data(), net_buf.size(),
+						head_size, hmac_size, pid_size))
+	      return false;
+	    frame->prepare(Frame::DECRYPT_WORK, work);
+	    work.write(net_buf.c_data() + head_size + hmac_size + pid_size,
+		       net_buf.size() - head_size - hmac_size - pid_size);
+	    break;
+	  case TLS_CRYPT:
+	    {
+	      const size_t data_offset = TLSCryptContext::hmac_offset + hmac_size;
+	      if (net_buf.size() < data_offset)
+		return false;
+	      frame->prepare(Frame::DECRYPT_WORK, work);
+	      const size_t decrypt_bytes = tls_crypt_recv->decrypt(net_buf.c_data() + TLSCryptContext::hmac_offset,
+								   work.data(), work.max_size(),
+								   net_buf.c_data() + data_offset,
+								   net_buf.size() - data_offset);
+	      if (!decrypt_bytes)
+		return false;
+	      work.inc_size(decrypt_bytes);
+	      if (!tls_crypt_recv->hmac_cmp(net_buf.c_data(), TLSCryptContext::hmac_offset,
+					    work.c_data(), work.size()))
+		return false;
+	    }
+	    break;
+	  default:
+	    if (net_buf.size() < head_size)
+	      return false;
+	    frame->prepare(Frame::DECRYPT_WORK, work);
+	    work.write(net_buf.c_data() + head_size, net_buf.size() - head_size);
+	    break;
+	  }
+	unsigned char psid[ProtoSessionID::SIZE];
+	std::memcpy(psid, net_buf.c_data() + 1, sizeof(psid));
+	Buffer psid_buf(psid, sizeof(psid), true);
+	src_psid.read(psid_buf);
+	return true;
+      }
+
+      // Build a HARD_RESET_SERVER_V2 that ACKs the client reset, using
+      // the same layout as KeyContext::encapsulate() on a new session.
+      void gen_reply(const ProtoSessionID& client_psid,
+		     const ProtoSessionID& self,
+		     const PacketID::time_t t,
+		     BufferAllocated& reply)
+      {
+	const unsigned int op = op_compose(CONTROL_HARD_RESET_SERVER_V2, 0);
+
+	// The session started from this cookie sends the reset with
+	// tls-wrap packet ID 1, without transmitting it, and continues
+	// from there, so the client never sees a packet ID reused.
+	PacketIDSend pid_send;
+	pid_send.init(PacketID::LONG_FORM);
+
+	frame->prepare(Frame::WRITE_SSL_INIT, reply);
+	ReliableAck::prepend_id(reply, 0); // our message ID
+	client_psid.prepend(reply);        // dest PSID
+	ReliableAck::prepend_id(reply, 0); // ACK client reset
+	reply.push_front(1);               // number of ACKs
+
+	switch (tls_wrap_mode)
+	  {
+	  case TLS_AUTH:
+	    pid_send.write_next(reply, true, t);
+	    reply.prepend_alloc(hmac_size);
+	    self.prepend(reply);
+	    reply.push_front(op);
+	    ta_hmac_send->ovpn_hmac_gen(reply.data(), reply.size(),
+					1 + ProtoSessionID::SIZE,
+					hmac_size,
+					PacketID::size(PacketID::LONG_FORM));
+	    break;
+	  case TLS_CRYPT:
+	    {
+	      frame->prepare(Frame::ENCRYPT_WORK, work);
+	      work.prepend_alloc(hmac_size);
+	      pid_send.write_next(work, true, t);
+	      self.prepend(work);
+	      work.push_front(op);
+	      tls_crypt_send->hmac_gen(work.data(), TLSCryptContext::hmac_offset,
+				       reply.c_data(), reply.size());
+	      const size_t data_offset = TLSCryptContext::hmac_offset + hmac_size;
+	      const size_t encrypt_bytes = tls_crypt_send->encrypt(work.c_data() + TLSCryptContext::hmac_offset,
+								   work.data() + data_offset,
+								   work.max_size() - data_offset,
+								   reply.c_data(), reply.size());
+	      if (!encrypt_bytes)
+		throw psid_cookie_error();
+	      work.inc_size(encrypt_bytes);
+	      reply.swap(work);
+	    }
+	    break;
+	  default:
+	    self.prepend(reply);
+	    reply.push_front(op);
+	    break;
+	  }
+      }
+
+      ProtoSessionID cookie(const IP::Addr& addr,
+			    const unsigned int port,
+			    const ProtoSessionID& client_psid,
+			    const PacketID::time_t slot)
+      {
+	const size_t hs = cookie_hmac ? cookie_hmac->output_size() : cookie_tls_crypt->output_hmac_size();
+	if (hs > COOKIE_HMAC_MAX)
+	  throw psid_cookie_error();
+
+	// [addr] [port] [client PSID] [slot] [HMAC]
+	unsigned char data[16 + 2 + ProtoSessionID::SIZE + 8 + COOKIE_HMAC_MAX];
+	Buffer buf(data, sizeof(data), false);
+	addr.to_byte_string(buf.write_alloc(16));
+	buf.push_back((unsigned char)(port >> 8));
+	buf.push_back((unsigned char)port);
+	client_psid.write(buf);
+	for (int shift = 56; shift >= 0; shift -= 8)
+	  buf.push_back((unsigned char)(std::uint64_t(slot) >> shift));
+	const size_t input_size = buf.size();
+	buf.write_alloc(hs);
+	if (cookie_hmac)
+	  cookie_hmac->ovpn_hmac_gen(buf.data(), buf.size(), input_size, hs, 0);
+	else
+	  cookie_tls_crypt->hmac_gen(buf.data(), input_size, nullptr, 0);
+
+	// cookie is the leading bytes of the HMAC
+	buf.advance(input_size);
+	return ProtoSessionID(buf);
+      }
+
+      TLSWrapMode tls_wrap_mode;
+      size_t hmac_size;
+      PacketID::time_t slot_seconds;
+      OvpnHMACInstance::Ptr ta_hmac_send;
+      OvpnHMACInstance::Ptr ta_hmac_recv;
+      TLSCryptInstance::Ptr tls_crypt_send;
+      TLSCryptInstance::Ptr tls_crypt_recv;
+      OvpnHMACInstance::Ptr cookie_hmac;
+      TLSCryptInstance::Ptr cookie_tls_crypt;
+      Frame::Ptr frame;
+      TimePtr now;
+      BufferAllocated work;
     };
 
     OPENVPN_SIMPLE_EXCEPTION(select_key_context_error);
@@ -3107,19 +4322,8 @@ namespace openvpn {
       tls_crypt_metadata = c.tls_crypt_metadata_factory->new_obj();
     }
 
-    void reset()
+    void reset_tls_wrap(const Config& c)
     {
-      const Config& c = *config;
-
-      // defer data channel initialization until after client options pull?
-      dc_deferred = c.dc_deferred;
-
-      // clear key contexts
-      reset_all();
-
-      // start with key ID 0
-      upcoming_key_id = 0;
-
       unsigned int key_dir;
 
       // tls-auth initialization
@@ -3170,18 +4374,43 @@ namespace openvpn {
 	  case TLS_PLAIN:
 	    break;
       }
+    }
+
+    void reset()
+    {
+      const Config& c = *config;
+
+      // defer data channel initialization until after client options pull?
+      dc_deferred = c.dc_deferred;
+      tls_ekm = false;
+      wide_pid = false;
+      rtt_probe_on = false;
+      rtt_echo_pending = false;
+
+      // clear key contexts
+      reset_all();
+
+      // start with key ID 0
+      upcoming_key_id = 0;
+
+      reset_tls_wrap(c);
 
       // initialize proto session ID
       psid_self.randomize(*c.prng);
       psid_peer.reset();
 
       // initialize key contexts
-      primary.reset(new KeyContext(*this, is_client()));
+      primary.reset(new KeyContext(*this, is_client(), true));
+      update_key_slots();
       OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " New KeyContext PRIMARY id=" << primary->key_id());
 
       // initialize keepalive timers
       keepalive_expire = Time::infinite();   // initially disabled
+      reset_keepalive_ping();
       update_last_sent();                    // set timer for initial keepalive send
+      update_last_data();                    // idle_compact counts from here
+
+      reset_pmtud();
     }
 
     void set_protocol(const Protocol& p)
@@ -3191,6 +4420,7 @@ namespace openvpn {
 	primary->set_protocol(p);
       if (secondary)
 	secondary->set_protocol(p);
+      reset_pmtud();
     }
 
     // Free up space when parent object has been halted but
@@ -3223,6 +4453,30 @@ namespace openvpn {
       update_last_received(); // set an upper bound on when we expect a response
     }
 
+    // Server-only alternative to start() for a session whose initial
+    // reset exchange was handled by PsidCookie.  self and peer are the
+    // session IDs returned by PsidCookie::verify().  Call after reset().
+    void start_from_cookie(const ProtoSessionID& self, const ProtoSessionID& peer)
+    {
+      if (!primary || !is_server() || tls_wrap_mode == TLS_CRYPT_V2)
+	throw proto_error("start_from_cookie: not supported");
+      psid_self = self;
+      psid_peer = peer;
+      primary->start_from_cookie();
+      update_last_received();
+    }
+
+    // Process completed SSLExecutor jobs (if Config::ssl_executor
+    // is defined), follow with flush(true).  May throw like
+    // control_net_recv().
+    void control_async_process()
+    {
+      if (primary)
+	primary->async_process();
+      if (secondary)
+	secondary->async_process();
+    }
+
     // trigger a protocol renegotiation
     void renegotiate()
     {
@@ -3255,6 +4509,9 @@ namespace openvpn {
     // Should be called at the time returned by next_housekeeping.
     void housekeeping()
     {
+      SessionStats::AllocScope alloc_scope(stats.get(), AllocStats::CONTROL);
+      SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::HOUSEKEEPING);
+
       // handle control channel retransmissions on primary
       if (primary)
 	primary->retransmit();
@@ -3268,6 +4525,15 @@ namespace openvpn {
 
       // handle keepalive/expiration
       keepalive_housekeeping();
+
+      // release buffers of an idle session
+      idle_housekeeping();
+
+      // path MTU probes and replies
+      pmtud_housekeeping();
+
+      // round trip time probes and replies
+      rtt_housekeeping();
     }
 
     // When should we next call housekeeping?
@@ -3284,6 +4550,16 @@ namespace openvpn {
 	    ret.min(secondary->next_retransmit());
 	  ret.min(keepalive_xmit);
 	  ret.min(keepalive_expire);
+	  if (config->idle_compact.enabled() && !compacted)
+	    ret.min(last_data + config->idle_compact);
+	  if (pmtu_reply_pending)
+	    ret.min(*now_);
+	  if (pmtud && data_channel_ready())
+	    ret.min(pmtud->next_event());
+	  if (rtt_echo_pending)
+	    ret.min(*now_);
+	  if (rtt_probe_on && data_channel_ready())
+	    ret.min(primary->next_rtt_probe());
 	  return ret;
 	}
       else
@@ -3312,6 +4588,8 @@ namespace openvpn {
 
     bool control_net_recv(const PacketType& type, BufferAllocated&& net_buf)
     {
+      SessionStats::AllocScope alloc_scope(stats.get(), AllocStats::CONTROL);
+      SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::HANDSHAKE);
       Packet pkt(net_buf.move_to_ptr(), type.opcode);
       if (type.is_soft_reset() && !renegotiate_request(pkt))
 	return false;
@@ -3320,6 +4598,8 @@ namespace openvpn {
 
     bool control_net_recv(const PacketType& type, BufferPtr&& net_bp)
     {
+      SessionStats::AllocScope alloc_scope(stats.get(), AllocStats::CONTROL);
+      SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::HANDSHAKE);
       Packet pkt(std::move(net_bp), type.opcode);
       if (type.is_soft_reset() && !renegotiate_request(pkt))
 	return false;
@@ -3332,23 +4612,31 @@ namespace openvpn {
       //OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " DATA ENCRYPT size=" << in_out.size());
       if (!primary)
 	throw proto_error("data_encrypt: no primary key");
+      SessionStats::AllocScope alloc_scope(stats.get(), AllocStats::DATA_ENCRYPT);
+      SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::CRYPTO);
       primary->encrypt(in_out);
+      update_last_data();
     }
 
     // decrypt a data channel packet (automatically select primary
     // or secondary KeyContext based on packet content)
     bool data_decrypt(const PacketType& type, BufferAllocated& in_out)
     {
+      SessionStats::AllocScope alloc_scope(stats.get(), AllocStats::DATA_DECRYPT);
+      SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::CRYPTO);
       bool ret = false;
 
       //OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " DATA DECRYPT key_id=" << select_key_context(type, false).key_id() << " size=" << in_out.size());
 
+      const size_t recv_size = in_out.size();
       select_key_context(type, false).decrypt(in_out);
 
       // update time of most recent packet received
       if (in_out.size())
 	{
 	  update_last_received();
+	  if (recv_size > max_recv_size)
+	    max_recv_size = recv_size;
 	  ret = true;
 	}
 
@@ -3357,10 +4645,63 @@ namespace openvpn {
 	{
 	  in_out.reset_size();
 	}
+      else if (proto_context_private::is_occ(in_out))
+	occ_recv(in_out);
+      else if (ret)
+	update_last_data();
 
       return ret;
     }
 
+    // Decrypt n data channel packets (all with is_data() types) in
+    // order.  Has the same effect as calling data_decrypt() on each,
+    // but consecutive packets for the same key are decrypted as one
+    // batch.  Returns true if any packet was non-empty.
+    bool data_decrypt_batch(const PacketType* types, BufferAllocated* bufs, const size_t n)
+    {
+      enum { MAX_BATCH = 64 };
+      SessionStats::AllocScope alloc_scope(stats.get(), AllocStats::DATA_DECRYPT);
+      SessionStats::CpuScope cpu_scope(stats.get(), CpuStats::CRYPTO);
+      bool ret = false;
+      bool data = false;
+      size_t i = 0;
+      while (i < n)
+	{
+	  size_t recv_size[MAX_BATCH]; // transport sizes, for max_recv_size
+	  size_t j = i;
+	  do {
+	    recv_size[j - i] = bufs[j].size();
+	    ++j;
+	  } while (j < n && j - i < MAX_BATCH && types[j].key_id == types[i].key_id);
+	  select_key_context(types[i], false).decrypt_batch(bufs + i, j - i);
+	  for (const size_t first = i; i < j; ++i)
+	    {
+	      BufferAllocated& buf = bufs[i];
+	      if (buf.size())
+		{
+		  ret = true;
+		  if (recv_size[i - first] > max_recv_size)
+		    max_recv_size = recv_size[i - first];
+		}
+
+	      // discard keepalive packets
+	      if (proto_context_private::is_keepalive(buf))
+		buf.reset_size();
+	      else if (proto_context_private::is_occ(buf))
+		occ_recv(buf);
+	      else if (buf.size())
+		data = true;
+	    }
+	}
+
+      // update time of most recent packet received
+      if (ret)
+	update_last_received();
+      if (data)
+	update_last_data();
+      return ret;
+    }
+
     // enter disconnected state
     void disconnect(const Error::Type reason)
     {
@@ -3378,15 +4719,168 @@ namespace openvpn {
 	primary->send_explicit_exit_notify();
     }
 
+    // Like send_explicit_exit_notify(), but on either side, for a
+    // server to make its UDP clients reconnect at once when it shuts
+    // down.  Returns false if there is no active data channel key.
+    bool send_exit_notify()
+    {
+      if (!is_udp() || !data_channel_ready())
+	return false;
+      primary->send_explicit_exit_notify();
+      return true;
+    }
+
     // should be called after a successful network packet transmit
     void update_last_sent()
     {
-      keepalive_xmit = *now_ + config->keepalive_ping;
+      last_sent = *now_;
+      keepalive_xmit = *now_ + keepalive_ping_cur;
+    }
+
+    // Release buffers and empty containers that are re-created on
+    // demand, keeping the SSL sessions and data channel keys.  Lets
+    // a server hold many idle sessions in less memory; housekeeping()
+    // calls it when Config::idle_compact is enabled.
+    void compact()
+    {
+      if (primary)
+	primary->compact();
+      if (secondary)
+	secondary->compact();
+      compacted = true;
     }
 
     // can we call data_encrypt or data_decrypt yet?
     bool data_channel_ready() const { return primary && primary->data_channel_ready(); }
 
+    // Largest tunnel packet that fits the path without fragmentation:
+    // from the discovered path MTU (see Config::pmtud_max) once it is
+    // known, otherwise from mssfix.  0 if neither is available.
+    int mss_inter() const
+    {
+      if (primary)
+	return primary->mss_inter();
+      return int(config->mss_inter);
+    }
+
+    // discovered path MTU as a transport payload size, or 0
+    unsigned int pmtu() const { return pmtu_cur; }
+
+    // Round trip estimates of the primary key's probes, or nullptr
+    // if it hasn't sent any.  See enable_rtt_probe().
+    const RTTProbe* rtt_probe() const
+    {
+      return primary ? primary->rtt_probe() : nullptr;
+    }
+
+    // Send a bare OCC_MTU_REQUEST, which the peer answers right away,
+    // to time the path that the transport sends it on.  The answer
+    // calls path_probe_reply().  Returns false if the data channel
+    // isn't up.
+    bool send_path_probe()
+    {
+      return data_channel_ready() && primary->send_occ_mtu_request();
+    }
+
+    // Capture the established data channel and control channel
+    // state, so that another process can take the session over with
+    // resume_session() without renegotiating.  Requires
+    // Config::session_export.  This object must not send data
+    // packets afterwards, or the resumed session would reuse their
+    // packet IDs and AEAD nonces.  The caller fills in the peer
+    // address, pushed options and other app fields of st.
+    void export_session(ProtoSessionState& st) const
+    {
+      if (!data_channel_ready())
+	throw proto_error("export_session: data channel not ready");
+      if (secondary && !secondary->expiring())
+	throw proto_error("export_session: key renegotiation in progress");
+
+      const Config& c = *config;
+      st.cipher = CryptoAlgs::name(c.dc.cipher(), "");
+      st.digest = CryptoAlgs::name(c.dc.digest(), "");
+      st.compress = c.comp_ctx.type();
+      st.compress_asym = c.comp_ctx.asym();
+      st.enable_op32 = c.enable_op32;
+      st.wide_pid = wide_pid;
+      st.tls_ekm = tls_ekm;
+      st.remote_peer_id = c.remote_peer_id;
+      st.local_peer_id = c.local_peer_id;
+      primary->export_state(st);
+
+      st.psid_self = psid_self;
+      st.psid_peer = psid_peer;
+      if (tls_wrap_mode != TLS_PLAIN)
+	{
+	  st.control_send = ta_pid_send.last();
+	  st.control_recv = ta_pid_recv.high();
+	}
+      if (tls_crypt_v2_key)
+	st.tls_crypt_v2_key = *tls_crypt_v2_key;
+    }
+
+    // Take over a session exported by export_session() in another
+    // process, in place of start().  The resumed key has no SSL
+    // session, so control channel messages sent before the next key,
+    // which the usual renegotiation schedule brings, are held until
+    // it becomes primary.  Replay protection starts from the highest
+    // exported packet ID, without the history window below it.
+    void resume_session(const ProtoSessionState& st)
+    {
+      Config& c = *config;
+      c.dc.set_cipher(CryptoAlgs::lookup(st.cipher));
+      c.dc.set_digest(st.digest.empty() ? CryptoAlgs::NONE : CryptoAlgs::lookup(st.digest));
+      c.comp_ctx = CompressContext(CompressContext::Type(st.compress), st.compress_asym);
+      c.enable_op32 = st.enable_op32;
+      c.remote_peer_id = st.remote_peer_id;
+      c.local_peer_id = st.local_peer_id;
+      dc_deferred = false;
+      wide_pid = st.wide_pid;
+      tls_ekm = st.tls_ekm; // for the keys negotiated after resume
+
+      reset_all();
+      reset_tls_wrap(c);
+      if (tls_wrap_mode == TLS_CRYPT_V2 && is_server())
+	{
+	  if (!st.tls_crypt_v2_key.defined())
+	    throw proto_error("resume_session: tls-crypt-v2 client key missing");
+	  reset_tls_crypt(c, st.tls_crypt_v2_key);
+	  if (c.session_export)
+	    tls_crypt_v2_key.reset(new OpenVPNStaticKey(st.tls_crypt_v2_key));
+	}
+      if (tls_wrap_mode != TLS_PLAIN)
+	{
+	  ta_pid_send.resume(st.control_send);
+	  ta_pid_recv.resume(st.control_recv);
+	}
+
+      psid_self = st.psid_self;
+      psid_peer = st.psid_peer;
+
+      upcoming_key_id = st.key_id;
+      primary.reset(new KeyContext(*this, false));
+      primary->resume(st);
+      primary->rekey(CryptoDCInstance::ACTIVATE_PRIMARY);
+      update_key_slots();
+      OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " Resumed KeyContext PRIMARY id=" << primary->key_id());
+
+      reset_keepalive_ping();
+      update_last_received();
+      update_last_sent();
+      update_last_data();
+    }
+
+    // Send a keepalive now rather than at the next keepalive_xmit,
+    // so that the peer sees our new address after a transport restart.
+    void send_keepalive_now()
+    {
+      if (data_channel_ready())
+	{
+	  primary->send_keepalive();
+	  update_last_sent();
+	}
+    }
+
     // total number of SSL/TLS negotiations during lifetime of ProtoContext object
     unsigned int negotiations() const { return n_key_ids; }
 
@@ -3413,20 +4907,69 @@ namespace openvpn {
 	secondary->init_data_channel();
     }
 
+    // Call after reset() and before the session keys are generated,
+    // to derive them with the TLS keying material exporter.  A server
+    // must also push "key-derivation tls-ekm", which enables it on
+    // the client.
+    void enable_tls_ekm()
+    {
+      tls_ekm = true;
+    }
+
+    bool tls_ekm_enabled() const { return tls_ekm; }
+
+    // Call after reset() and before the data channel is initialized,
+    // to send and expect 64-bit packet IDs on an AEAD data channel,
+    // so that the packet ID never forces a renegotiation.  A server
+    // must also push "packet-id wide", which enables it on the
+    // client.
+    void enable_wide_pid()
+    {
+      wide_pid = true;
+    }
+
+    bool wide_pid_enabled() const { return wide_pid; }
+
+    // Call on a server after reset(), for a client that advertised
+    // IV_RTT, to probe the round trip time every
+    // Config::rtt_probe_interval.  The server must also push
+    // "rtt-probe", which enables the probes on the client.
+    void enable_rtt_probe()
+    {
+      rtt_probe_on = config->rtt_probe_interval.enabled();
+    }
+
+    bool rtt_probe_enabled() const { return rtt_probe_on; }
+
+    // PacketID form of data channel packets
+    int data_pid_form() const
+    {
+      return wide_pid ? PacketID::WIDE_FORM : PacketID::SHORT_FORM;
+    }
+
     // Call on client with server-pushed options
     void process_push(const OptionList& opt, const ProtoContextOptions& pco)
     {
       // modify config with pushed options
       config->process_push(opt, pco);
+      tls_ekm = config->dc_tls_ekm;
+      wide_pid = config->dc_wide_pid;
+      rtt_probe_on = config->dc_rtt_probe;
 
       // in case keepalive parms were modified by push
       keepalive_parms_modified();
     }
 
-    // Return the current transport alignment adjustment
+    // Return the current transport alignment adjustment.  With a
+    // Frame payload alignment and an AEAD cipher, this is the offset
+    // of the ciphertext, past op, packet ID and auth tag, so that the
+    // ciphertext and tag of received packets are aligned.
     size_t align_adjust_hint() const
     {
-      return config->enable_op32 ? 0 : 1;
+      const size_t op_size = config->enable_op32 ? OP_SIZE_V2 : 1;
+      if (config->frame->payload_align() && CryptoAlgs::is_aead(config->dc.cipher()))
+	return op_size + PacketID::size(data_pid_form()) + config->dc.context().encap_overhead();
+      return op_size - 1;
     }
 
     // Return true if keepalive parameter(s) are enabled
@@ -3479,7 +5022,7 @@ namespace openvpn {
 
     // current time
     const Time& now() const { return *now_; }
-    void update_now() { now_->update(); }
+    void update_now() { BatchClock::update(*now_); }
 
     // frame
     const Frame& frame() const { return *config->frame; }
@@ -3504,20 +5047,13 @@ namespace openvpn {
 
   private:
 
-    // TLS wrapping mode for the control channel
-    enum TLSWrapMode {
-      TLS_PLAIN,
-      TLS_AUTH,
-      TLS_CRYPT,
-      TLS_CRYPT_V2
-    };
-
     void reset_all()
     {
       if (primary)
 	primary->rekey(CryptoDCInstance::DEACTIVATE_ALL);
       primary.reset();
       secondary.reset();
+      update_key_slots();
     }
 
     virtual void control_net_send(const Buffer& net_buf) = 0;
@@ -3548,11 +5084,188 @@ namespace openvpn {
     {
     }
 
+    // Called when the peer answers an OCC_MTU_REQUEST, see
+    // send_path_probe().
+    virtual void path_probe_reply()
+    {
+    }
+
+    // Called on the owning thread when an SSLExecutor job completes.
+    // Derived class should normally override to handle exceptions and
+    // reschedule housekeeping.
+    virtual void control_async_ready()
+    {
+      control_async_process();
+      flush(true);
+    }
+
     void update_last_received()
     {
+      last_received = *now_;
       keepalive_expire = *now_ + config->keepalive_timeout;
     }
 
+    // data channel traffic other than keepalives
+    void update_last_data()
+    {
+      last_data = *now_;
+      compacted = false;
+    }
+
+    // Compact a session that has been idle for config->idle_compact,
+    // and again on each later housekeeping pass, to release the
+    // buffers that keepalives re-create.
+    void idle_housekeeping()
+    {
+      if (config->idle_compact.enabled() && *now_ >= last_data + config->idle_compact)
+	compact();
+    }
+
+    // (Re)start path MTU discovery from the base size.  The engine
+    // works with transport payload sizes, so take off the IP and
+    // UDP headers and any extra transport framing.
+    void reset_pmtud()
+    {
+      const Config& c = *config;
+      pmtud.reset();
+      pmtu_reply_pending = false;
+      max_recv_size = 0;
+      set_pmtu(0);
+      if (c.pmtud_max && c.protocol.is_udp())
+	{
+	  const unsigned int transport_encap = (c.protocol.is_ipv6() ? sizeof(struct IPv6Header) : sizeof(struct IPv4Header))
+	    + sizeof(struct UDPHeader) + c.protocol.extra_transport_bytes();
+	  const unsigned int base = PMTUD_BASE - transport_encap;
+	  const unsigned int max = std::min(c.pmtud_max - transport_encap,
+					    unsigned((*c.frame)[Frame::WRITE_DC_MSG].payload()));
+	  if (max >= base)
+	    pmtud.reset(new PMTUDiscovery(base, max));
+	  else
+	    OPENVPN_LOG_PROTO(debug_prefix() << " PMTU discovery disabled, frame too small");
+	}
+    }
+
+    void set_pmtu(const unsigned int size)
+    {
+      if (size == pmtu_cur)
+	return;
+      pmtu_cur = size;
+      OPENVPN_LOG_PROTO(debug_prefix() << " PMTU " << size << " mss_inter=" << mss_inter());
+      if (primary)
+	primary->update_mssfix();
+      if (secondary)
+	secondary->update_mssfix();
+    }
+
+    // handle OCC messages received on the data channel
+    void occ_recv(BufferAllocated& buf)
+    {
+      using namespace proto_context_private;
+      switch (buf[OCC_STRING_SIZE])
+	{
+	case OCC_MTU_REQUEST:
+	  pmtu_reply_pending = true; // sent from housekeeping()
+	  break;
+	case OCC_MTU_REPLY:
+	  path_probe_reply();
+	  if (pmtud && buf.size() >= OCC_STRING_SIZE + 5)
+	    {
+	      std::uint16_t max_recv;
+	      std::memcpy(&max_recv, buf.c_data() + OCC_STRING_SIZE + 1, 2);
+	      if (pmtud->reply(ntohs(max_recv), *now_))
+		set_pmtu(pmtud->pmtu());
+	    }
+	  break;
+	case OCC_MTU_LOAD:
+	  break;
+	case OCC_RTT_REQUEST:
+	  // answered from housekeeping(), which takes off the time
+	  // that the answer waits
+	  if (buf.size() >= OCC_RTT_REQUEST_SIZE)
+	    {
+	      std::memcpy(rtt_echo, buf.c_data() + OCC_STRING_SIZE + 1, sizeof(rtt_echo));
+	      rtt_echo_recv = LatencyHistogram::now_ns() / 1000;
+	      rtt_echo_pending = true;
+	    }
+	  break;
+	case OCC_RTT_REPLY:
+	  if (buf.size() >= OCC_RTT_REPLY_SIZE)
+	    rtt_recv(buf.c_data() + OCC_STRING_SIZE + 1);
+	  break;
+	default:
+	  return; // leave other OCC messages to the caller
+	}
+      buf.reset_size();
+    }
+
+    // Answer the peer's MTU request with the largest packet received
+    // since the last answer, so that the answer to a probe shows if
+    // the probe got through.  Then send our own probe when due.
+    void pmtud_housekeeping()
+    {
+      if (!data_channel_ready())
+	return;
+      if (pmtu_reply_pending)
+	{
+	  primary->send_pmtu_reply(unsigned(max_recv_size), pmtu_cur);
+	  pmtu_reply_pending = false;
+	  max_recv_size = 0;
+	}
+      if (pmtud)
+	{
+	  const unsigned int size = pmtud->probe(*now_);
+	  if (size)
+	    pmtud->sent(unsigned(primary->send_pmtu_probe(size)));
+	  set_pmtu(pmtud->pmtu());
+	}
+    }
+
+    // The reply may come back on either key during a key
+    // transition, the probe's RTTProbe is the one that matches it.
+    void rtt_recv(const unsigned char *reply)
+    {
+      std::uint32_t seq, hold;
+      std::uint64_t ts;
+      std::memcpy(&seq, reply, 4);
+      std::memcpy(&ts, reply + 4, 8);
+      std::memcpy(&hold, reply + 12, 4);
+      seq = ntohl(seq);
+      ts = Endian::rev64(ts);
+      hold = ntohl(hold);
+      const std::uint64_t now_us = LatencyHistogram::now_ns() / 1000;
+      for (KeyContext* kc : { primary.get(), secondary.get() })
+	if (kc && kc->rtt_reply(seq, ts, hold, now_us))
+	  {
+	    if (kc == primary.get())
+	      update_rtt_stats(*kc->rtt_probe());
+	    break;
+	  }
+    }
+
+    void update_rtt_stats(const RTTProbe& rtt)
+    {
+      if (stats && rtt.defined())
+	stats->update_rtt(count_t(rtt.srtt()), count_t(rtt.jitter()), count_t(rtt.loss_permille()));
+    }
+
+    // Answer the peer's RTT probe, then send our own when due.
+    void rtt_housekeeping()
+    {
+      if (!data_channel_ready())
+	return;
+      if (rtt_echo_pending)
+	{
+	  const std::uint64_t hold = LatencyHistogram::now_ns() / 1000 - rtt_echo_recv;
+	  primary->send_rtt_reply(rtt_echo, std::uint32_t(std::min(hold, std::uint64_t(0xFFFFFFFF))));
+	  rtt_echo_pending = false;
+	}
+      if (rtt_probe_on)
+	{
+	  primary->send_rtt_probe(*now_);
+	  update_rtt_stats(*primary->rtt_probe());
+	}
+    }
+
     void net_send(const unsigned int key_id, const Packet& net_pkt)
     {
       control_net_send(net_pkt.buffer());
@@ -3568,6 +5281,8 @@ namespace openvpn {
     {
       if (KeyContext::validate(pkt.buffer(), *this, now_))
 	{
+	  if (is_server() && config->rekey_scheduler)
+	    config->rekey_scheduler->acquire(*now_, true); // client-initiated, count only
 	  new_secondary_key(false);
 	  return true;
 	}
@@ -3575,27 +5290,29 @@ namespace openvpn {
 	return false;
     }
 
-    // select a KeyContext (primary or secondary) for received network packets
+    // select the KeyContext for received network packets by key ID
     KeyContext& select_key_context(const PacketType& type, const bool control)
     {
-      const unsigned int flags = type.flags & (PacketType::DEFINED|PacketType::SECONDARY|PacketType::CONTROL);
-      if (!control)
-	{
-	  if (flags == (PacketType::DEFINED) && primary)
-	    return *primary;
-	  else if (flags == (PacketType::DEFINED|PacketType::SECONDARY) && secondary)
-	    return *secondary;
-	}
-      else
-	{
-	  if (flags == (PacketType::DEFINED|PacketType::CONTROL) && primary)
-	    return *primary;
-	  else if (flags == (PacketType::DEFINED|PacketType::SECONDARY|PacketType::CONTROL) && secondary)
-	    return *secondary;
-	}
+      const unsigned int flags = type.flags & (PacketType::DEFINED|PacketType::CONTROL);
+      const unsigned int want = control ? (PacketType::DEFINED|PacketType::CONTROL) : PacketType::DEFINED;
+      KeyContext* kc = key_slots[type.key_id].kc;
+      if (likely(kc && flags == want))
+	return *kc;
       throw select_key_context_error();
     }
 
+    // Rebuild the key ID -> KeyContext map used on the receive path.
+    // Must be called whenever primary or secondary changes.
+    void update_key_slots()
+    {
+      for (auto& ks : key_slots)
+	ks = KeySlot();
+      if (secondary)
+	key_slots[secondary->key_id()] = KeySlot{ secondary.get(), PacketType::DEFINED|PacketType::SECONDARY };
+      if (primary)
+	key_slots[primary->key_id()] = KeySlot{ primary.get(), PacketType::DEFINED };
+    }
+
     // Select a KeyContext (primary or secondary) for control channel sends.
     // Even after new key context goes active, we still wait for
     // KEV_BECOME_PRIMARY event (controlled by the become_primary duration
@@ -3617,8 +5334,10 @@ namespace openvpn {
       const Time now = *now_;
 
       // check for keepalive timeouts
-      if (now >= keepalive_xmit && primary)
+      if (now + config->housekeeping_slack >= keepalive_xmit && primary)
 	{
+	  if (config->keepalive_ping_max.enabled())
+	    adapt_keepalive_ping(now);
 	  primary->send_keepalive();
 	  update_last_sent();
 	}
@@ -3630,6 +5349,46 @@ namespace openvpn {
 	}
     }
 
+    // Called before an idle keepalive, i.e. after keepalive_ping_cur of
+    // silence on our side.  If the peer's packets kept reaching us
+    // through the second half of that silence, the path (including
+    // any NAT binding) survived it, so double the interval.  If they
+    // didn't, go back to the longest interval that worked and keep
+    // it: it is our estimate of the NAT timeout.  The interval stays
+    // below a third of keepalive_timeout so that the peer, which
+    // normally uses the same timeout, still sees a few pings.
+    void adapt_keepalive_ping(const Time& now)
+    {
+      if (keepalive_ping_adapted || !keepalive_ping_cur.enabled())
+	return;
+      const Time::Duration idle = now - last_sent;
+      if (last_received.defined() && now - last_received <= Time::Duration::binary_ms(idle.to_binary_ms() / 2))
+	{
+	  Time::Duration next = keepalive_ping_cur * 2;
+	  next.min(config->keepalive_ping_max);
+	  if (config->keepalive_timeout.enabled())
+	    next.min(Time::Duration::binary_ms(config->keepalive_timeout.to_binary_ms() / 3));
+	  if (next > keepalive_ping_cur)
+	    {
+	      keepalive_ping_good = keepalive_ping_cur;
+	      keepalive_ping_cur = next;
+	    }
+	}
+      else
+	{
+	  keepalive_ping_cur = keepalive_ping_good;
+	  keepalive_ping_adapted = true;
+	  OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " keepalive ping interval settled at " << keepalive_ping_cur.to_seconds() << 's');
+	}
+    }
+
+    void reset_keepalive_ping()
+    {
+      keepalive_ping_cur = config->keepalive_ping;
+      keepalive_ping_good = keepalive_ping_cur;
+      keepalive_ping_adapted = false;
+    }
+
     // Process KEV_x events
     // Return true if any events were processed.
     bool process_events()
@@ -3661,6 +5420,7 @@ namespace openvpn {
     {
       // Create the secondary
       secondary.reset(new KeyContext(*this, initiator));
+      update_key_slots();
       OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " New KeyContext SECONDARY id=" << secondary->key_id() << (initiator ? " local-triggered" : " remote-triggered"));
     }
 
@@ -3670,8 +5430,11 @@ namespace openvpn {
     void promote_secondary_to_primary()
     {
       primary.swap(secondary);
+      update_key_slots();
       if (primary)
 	primary->rekey(CryptoDCInstance::PRIMARY_SECONDARY_SWAP);
+      if (primary && secondary)
+	secondary->move_pending_app(*primary);
       if (secondary)
 	secondary->prepare_expire();
       OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " PRIMARY_SECONDARY_SWAP");
@@ -3691,7 +5454,14 @@ namespace openvpn {
 	      active();
 	      break;
 	    case KeyContext::KEV_RENEGOTIATE:
+	      if (is_server() && config->rekey_scheduler && !config->rekey_scheduler->acquire(*now_))
+		primary->defer_renegotiation(); // over handshake budget, retry shortly
+	      else
+		renegotiate();
+	      break;
 	    case KeyContext::KEV_RENEGOTIATE_FORCE:
+	      if (is_server() && config->rekey_scheduler)
+		config->rekey_scheduler->acquire(*now_, true);
 	      renegotiate();
 	      break;
 	    case KeyContext::KEV_EXPIRE:
@@ -3734,6 +5504,7 @@ namespace openvpn {
 	    case KeyContext::KEV_EXPIRE:
 	      secondary->rekey(CryptoDCInstance::DEACTIVATE_SECONDARY);
 	      secondary.reset();
+	      update_key_slots();
 	      break;
 	    case KeyContext::KEV_RENEGOTIATE_QUEUE:
 	      if (primary)
@@ -3784,11 +5555,12 @@ namespace openvpn {
     void keepalive_parms_modified()
     {
       update_last_received();
+      reset_keepalive_ping();
 
       // For keepalive_xmit timer, don't reschedule current cycle
       // unless it would fire earlier.  Subsequent cycles will
       // time according to new keepalive_ping value.
-      const Time kx = *now_ + config->keepalive_ping;
+      const Time kx = *now_ + keepalive_ping_cur;
       if (kx < keepalive_xmit)
 	keepalive_xmit = kx;
     }
@@ -3814,6 +5586,13 @@ namespace openvpn {
     TimePtr now_;                      // pointer to current time (a clone of config->now)
     Time keepalive_xmit;               // time in future when we will transmit a keepalive (subject to continuous change)
     Time keepalive_expire;             // time in future when we must have received a packet from peer or we will timeout session
+    Time last_sent;                    // time of last packet sent to peer
+    Time last_received;                // time of last packet received from peer
+    Time last_data;                    // time of last data channel packet, not counting keepalives
+    bool compacted = false;            // compact() called since last_data
+    Time::Duration keepalive_ping_cur; // current keepalive interval, config->keepalive_ping unless adapted
+    Time::Duration keepalive_ping_good; // longest adapted interval known to keep the path up
+    bool keepalive_ping_adapted = false;
 
     Time::Duration slowest_handshake_; // longest time to reach a successful handshake
 
@@ -3835,6 +5614,28 @@ namespace openvpn {
     KeyContext::Ptr primary;
     KeyContext::Ptr secondary;
     bool dc_deferred;
+    bool tls_ekm = false; // derive data channel keys with the TLS keying material exporter
+    bool wide_pid = false; // 64-bit data channel packet IDs, see enable_wide_pid()
+
+    std::unique_ptr<PMTUDiscovery> pmtud; // with Config::pmtud_max on UDP
+    unsigned int pmtu_cur = 0;            // pmtud->pmtu() as applied to the keys
+    size_t max_recv_size = 0;             // largest data channel packet since the last OCC_MTU_REPLY
+    bool pmtu_reply_pending = false;      // peer sent OCC_MTU_REQUEST
+
+    bool rtt_probe_on = false;                 // send RTT probes, see enable_rtt_probe()
+    bool rtt_echo_pending = false;             // peer sent OCC_RTT_REQUEST
+    unsigned char rtt_echo[12];                // its seq and timestamp
+    std::uint64_t rtt_echo_recv = 0;           // when it arrived, in us
+
+    std::unique_ptr<OpenVPNStaticKey> tls_crypt_v2_key; // client key from WKc, with Config::session_export
+
+    // primary and secondary indexed by key ID, see update_key_slots()
+    struct KeySlot
+    {
+      KeyContext* kc = nullptr;
+      unsigned int flags = 0; // PacketType flags for this key ID
+    };
+    KeySlot key_slots[KEY_ID_MASK + 1];
 
     // END ProtoContext data members
   };
@@ -58,6 +58,10 @@ namespace openvpn {
     }
 
     CompressionMode compression_mode;
+
+    // Control channel send window, 0 for the default.  Only useful
+    // up to the receive window of the peer (8 for OpenVPN 2.x).
+    unsigned int reliable_window = 0;
   };
 }
 
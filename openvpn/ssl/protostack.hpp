@@ -22,8 +22,10 @@
 #ifndef OPENVPN_SSL_PROTOSTACK_H
 #define OPENVPN_SSL_PROTOSTACK_H
 
+#include <string>
 #include <deque>
 #include <utility>
+#include <exception>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/size.hpp>
@@ -38,6 +40,7 @@
 #include <openvpn/error/excode.hpp>
 #include <openvpn/ssl/sslconsts.hpp>
 #include <openvpn/ssl/sslapi.hpp>
+#include <openvpn/ssl/sslexec.hpp>
 
 // ProtoStackBase is designed to allow general-purpose protocols (including
 // but not limited to OpenVPN) to run over SSL, where the underlying transport
@@ -45,6 +48,13 @@
 // proto.hpp (ProtoContext) layers on top of ProtoStackBase.
 // ProtoStackBase is independent of any particular SSL implementation, and
 // accepts the SSL object type as a template parameter.
+//
+// If an SSLExecutor is given, all calls into the SSL object are made
+// from executor jobs, at most one at a time per ProtoStackBase,
+// and their results are processed when the parent calls
+// async_process() after its async_ready() notification.  The SSL
+// object must not be accessed by other means (ssl_handshake_details(),
+// auth_cert(), etc.) while async_pending() is true.
 
 namespace openvpn {
 
@@ -95,9 +105,14 @@ namespace openvpn {
 		   const Frame::Ptr& frame,           // contains info on how to allocate and align buffers
 		   const SessionStats::Ptr& stats_arg,  // error statistics
 		   const id_t span,                   // basically the window size for our reliability layer
-		   const size_t max_ack_list)         // maximum number of ACK messages to bundle in one packet
+		   const id_t recv_span,              // receive window size, may be larger than span
+		   const size_t max_ack_list,         // maximum number of ACK messages to bundle in one packet
+		   const SSLExecutor::Ptr& executor = SSLExecutor::Ptr(), // optional, run SSL work off this thread
+		   const std::string* cache_key = nullptr) // optional, client-side session cache key
       : tls_timeout(tls_timeout_arg),
-	ssl_(ssl_factory.ssl()),
+	ssl_factory_(&ssl_factory),
+	cache_key_(cache_key ? *cache_key : std::string()),
+	use_cache_key_(cache_key != nullptr),
 	frame_(frame),
 	up_stack_reentry_level(0),
 	invalidated_(false),
@@ -106,26 +121,96 @@ namespace openvpn {
 	next_retransmit_(Time::infinite()),
 	stats(stats_arg),
 	now(now_arg),
-	rel_recv(span),
+	rel_recv(std::max(span, recv_span)),
 	rel_send(span),
-	xmit_acks(max_ack_list)
+	xmit_acks(max_ack_list),
+	executor_(executor)
+    {
+    }
+
+    ~ProtoStackBase()
     {
+      // job completion will be ignored
+      if (async_job)
+	async_job->owner = nullptr;
     }
 
     // Start SSL handshake on underlying SSL connection object.
+    // The SSL object is created here rather than in the constructor,
+    // so that a KeyContext waiting on its reset exchange (or one that
+    // never completes it) doesn't hold an SSL session.
     void start_handshake()
     {
       if (!invalidated())
 	{
+	  if (!ssl_)
+	    {
+	      try {
+		ssl_ = use_cache_key_ ? ssl_factory_->ssl(nullptr, &cache_key_) : ssl_factory_->ssl();
+	      }
+	      catch (...)
+		{
+		  error(Error::SSL_ERROR);
+		  throw;
+		}
+	      ssl_factory_.reset();
+	    }
 	  ssl_->start_handshake();
 	  ssl_started_ = true;
+	  async_kick_ = true; // let the SSL object generate its first flight
 	  up_sequenced();
 	}
     }
 
+    // Process the result of a completed SSLExecutor job, if any: pass
+    // cleartext up to the app and queue ciphertext for the next flush().
+    // Exceptions are the same as those thrown by net_recv().
+    void async_process()
+    {
+      if (!async_result)
+	return;
+      const typename AsyncSSL::Ptr job(std::move(async_result));
+      if (invalidated())
+	return;
+
+      // unwritten cleartext goes back to the front of the queue,
+      // retry when there is new input for the SSL object
+      app_write_queue.insert(app_write_queue.begin(), job->cleartext_in.begin(), job->cleartext_in.end());
+      async_app_blocked_ = !job->cleartext_in.empty();
+
+      for (auto& buf : job->ciphertext_out)
+	ssl_out_queue.push_back(std::move(buf));
+
+      for (auto& buf : job->cleartext_out)
+	parent().app_recv(std::move(buf));
+
+      if (job->exception)
+	{
+	  error(Error::SSL_ERROR);
+	  std::rethrow_exception(job->exception);
+	}
+      switch (job->status)
+	{
+	case AsyncSSL::OK:
+	  break;
+	case AsyncSSL::CLOSE_NOTIFY:
+	  error(Error::SSL_ERROR);
+	  throw ErrorCode(Error::CLIENT_HALT, true, "SSL Close Notify received");
+	default:
+	  error(Error::SSL_ERROR);
+	  throw unknown_status_from_ssl_layer();
+	}
+    }
+
+    // Is an SSLExecutor job in progress?
+    bool async_pending() const
+    {
+      return bool(async_job);
+    }
+
     uint32_t get_tls_warnings() const
     {
-      return ssl_->get_tls_warnings();
+      return ssl_ ? ssl_->get_tls_warnings() : 0;
     }
 
     // Incoming ciphertext packet arriving from network,
@@ -143,7 +228,10 @@ namespace openvpn {
     void app_send(BufferPtr&& buf)
     {
       if (!invalidated())
-	app_write_queue.push_back(std::move(buf));
+	{
+	  app_write_queue.push_back(std::move(buf));
+	  async_app_blocked_ = false;
+	}
     }
 
     // Outgoing raw packet ready to send (will NOT be encrypted
@@ -197,7 +285,7 @@ namespace openvpn {
 	      if (m.ready_retransmit(*now))
 		{
 		  parent().net_send(m.packet, NET_SEND_RETRANSMIT);
-		  m.reset_retransmit(*now, tls_timeout);
+		  rel_send.retransmitted(m, *now, tls_timeout);
 		}
 	    }
 	  update_retransmit();
@@ -235,15 +323,48 @@ namespace openvpn {
 
     std::string ssl_handshake_details() const
     {
-      return ssl_->ssl_handshake_details();
+      return ssl_ ? ssl_->ssl_handshake_details() : std::string();
     }
 
     const AuthCert::Ptr& auth_cert() const
     {
-      return ssl_->auth_cert();
+      static const AuthCert::Ptr none;
+      return ssl_ ? ssl_->auth_cert() : none;
+    }
+
+    bool export_keying_material(const std::string& label, unsigned char *dest, const size_t size)
+    {
+      return ssl_ && ssl_->export_keying_material(label, dest, size);
+    }
+
+    // Release buffers and empty queue storage that are re-created
+    // on demand, for a session that has gone idle.  A no-op while
+    // an SSLExecutor job is outstanding.
+    void compact()
+    {
+      if (async_job || async_result)
+	return;
+      to_app_buf.reset();
+      ack_send_buf.reset();
+      release_if_empty(app_write_queue);
+      release_if_empty(raw_write_queue);
+      release_if_empty(ssl_in_queue);
+      release_if_empty(ssl_out_queue);
+      rel_recv.compact();
+      rel_send.compact();
+      xmit_acks.compact();
+      if (ssl_)
+	ssl_->compact();
     }
 
   private:
+    template <typename Q>
+    static void release_if_empty(Q& q)
+    {
+      if (q.empty())
+	Q().swap(q);
+    }
+
     // Parent methods -- derived class must define these methods
 
     // Encapsulate packet, use id as sequence number.  If xmit_acks is non-empty,
@@ -283,6 +404,12 @@ namespace openvpn {
     //
     // void raw_recv(PACKET&& raw_pkt) = 0;
 
+    // Called on the owning thread when an SSLExecutor job has completed,
+    // parent should call async_process() and then flush() (only used
+    // with an SSLExecutor).
+    //
+    // void async_ready() = 0;
+
     // called if session is invalidated by an error (optional)
     //
     // void invalidate_callback() {}
@@ -298,7 +425,17 @@ namespace openvpn {
     // app data -> SSL -> protocol encapsulation -> reliability layer -> network
     void down_stack_app()
     {
-      if (ssl_started_)
+      if (ssl_started_ && executor_)
+	{
+	  // ciphertext produced by previous jobs
+	  while (!ssl_out_queue.empty() && rel_send.ready())
+	    {
+	      send_ciphertext(std::move(ssl_out_queue.front()));
+	      ssl_out_queue.pop_front();
+	    }
+	  async_kick();
+	}
+      else if (ssl_started_)
 	{
 	  // push app-layer cleartext through SSL object
 	  while (!app_write_queue.empty())
@@ -332,24 +469,27 @@ namespace openvpn {
 
 	  // encapsulate SSL ciphertext packets
 	  while (ssl_->read_ciphertext_ready() && rel_send.ready())
-	    {
-	      typename ReliableSend::Message& m = rel_send.send(*now, tls_timeout);
-	      m.packet = PACKET(ssl_->read_ciphertext());
-
-	      // encapsulate packet
-	      try {
-		parent().encapsulate(m.id(), m.packet);
-	      }
-	      catch (...)
-		{
-		  error(Error::ENCAPSULATION_ERROR);
-		  throw;
-		}
+	    send_ciphertext(ssl_->read_ciphertext());
+	}
+    }
 
-	      // transmit it
-	      parent().net_send(m.packet, NET_SEND_SSL);
-	    }
+    void send_ciphertext(BufferPtr buf)
+    {
+      typename ReliableSend::Message& m = rel_send.send(*now, tls_timeout);
+      m.packet = PACKET(std::move(buf));
+
+      // encapsulate packet
+      try {
+	parent().encapsulate(m.id(), m.packet);
+      }
+      catch (...)
+	{
+	  error(Error::ENCAPSULATION_ERROR);
+	  throw;
 	}
+
+      // transmit it
+      parent().net_send(m.packet, NET_SEND_SSL);
     }
 
     // raw app data -> protocol encapsulation -> reliability layer -> network
@@ -401,20 +541,30 @@ namespace openvpn {
 	    parent().raw_recv(std::move(m.packet));
 	  else // SSL packet
 	    {
-	      if (ssl_started_)
-		ssl_->write_ciphertext(m.packet.buffer_ptr());
-	      else
+	      if (!ssl_started_)
 		break;
+	      else if (executor_)
+		{
+		  ssl_in_queue.push_back(BufferPtr(new BufferAllocated(*m.packet.buffer_ptr())));
+		  async_app_blocked_ = false;
+		}
+	      else
+		ssl_->write_ciphertext(m.packet.buffer_ptr());
 	    }
 	  rel_recv.advance();
 	}
 
+      if (executor_)
+	async_kick();
+
       // read cleartext data from SSL object
-      if (ssl_started_)
+      else if (ssl_started_)
 	while (ssl_->read_cleartext_ready())
 	  {
 	    ssize_t size;
-	    to_app_buf.reset(new BufferAllocated());
+	    // kept across a SHOULD_RETRY, which ends nearly every pass
+	    if (!to_app_buf)
+	      to_app_buf.reset(new BufferAllocated());
 	    frame_->prepare(Frame::READ_SSL_CLEARTEXT, *to_app_buf);
 	    try {
 	      size = ssl_->read_cleartext(to_app_buf->data(), to_app_buf->max_size());
@@ -447,6 +597,130 @@ namespace openvpn {
 	  }
     }
 
+    // SSL work handed to the SSLExecutor.  The job runs on private
+    // copies of the buffers, so that no thread-unsafe reference count
+    // is shared with the owning thread while it is in progress.
+    struct AsyncSSL : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<AsyncSSL> Ptr;
+
+      enum Status {
+	OK,
+	CLOSE_NOTIFY,
+	UNKNOWN_STATUS,
+      };
+
+      AsyncSSL(ProtoStackBase* owner_arg, const typename SSLAPI::Ptr& ssl_arg, const Frame::Ptr& frame_arg)
+	: owner(owner_arg),
+	  ssl(ssl_arg),
+	  frame(frame_arg)
+      {
+      }
+
+      // runs on the executor thread
+      void run()
+      {
+	try {
+	  for (auto& buf : ciphertext_in)
+	    ssl->write_ciphertext(buf);
+	  ciphertext_in.clear();
+
+	  BufferPtr buf;
+	  while (ssl->read_cleartext_ready())
+	    {
+	      if (!buf)
+		buf.reset(new BufferAllocated());
+	      frame->prepare(Frame::READ_SSL_CLEARTEXT, *buf);
+	      const ssize_t size = ssl->read_cleartext(buf->data(), buf->max_size());
+	      if (size >= 0)
+		{
+		  buf->set_size(size);
+		  cleartext_out.push_back(std::move(buf));
+		}
+	      else if (size == SSLConst::SHOULD_RETRY)
+		break;
+	      else
+		{
+		  status = (size == SSLConst::PEER_CLOSE_NOTIFY) ? CLOSE_NOTIFY : UNKNOWN_STATUS;
+		  return;
+		}
+	    }
+
+	  while (!cleartext_in.empty())
+	    {
+	      BufferPtr& buf = cleartext_in.front();
+	      const ssize_t size = ssl->write_cleartext_unbuffered(buf->data(), buf->size());
+	      if (size == static_cast<ssize_t>(buf->size()))
+		cleartext_in.pop_front();
+	      else if (size == SSLConst::SHOULD_RETRY)
+		break;
+	      else if (size >= 0)
+		{
+		  buf->advance(size);
+		  break;
+		}
+	      else
+		{
+		  status = UNKNOWN_STATUS;
+		  return;
+		}
+	    }
+
+	  while (ssl->read_ciphertext_ready())
+	    ciphertext_out.push_back(ssl->read_ciphertext());
+	}
+	catch (...)
+	  {
+	    exception = std::current_exception();
+	  }
+      }
+
+      ProtoStackBase* owner; // only accessed on the owning thread
+      typename SSLAPI::Ptr ssl;
+      Frame::Ptr frame;
+      std::deque<BufferPtr> ciphertext_in;
+      std::deque<BufferPtr> cleartext_in;
+      std::deque<BufferPtr> cleartext_out;
+      std::deque<BufferPtr> ciphertext_out;
+      Status status = OK;
+      std::exception_ptr exception;
+    };
+
+    // Start an SSLExecutor job if there is work for the SSL object
+    // and no job is already in progress.
+    void async_kick()
+    {
+      if (async_job || async_result || !ssl_started_ || invalidated())
+	return;
+      if (ssl_in_queue.empty() && !async_kick_
+	  && (app_write_queue.empty() || async_app_blocked_))
+	return;
+
+      const typename AsyncSSL::Ptr job(new AsyncSSL(this, ssl_, frame_));
+      job->ciphertext_in.swap(ssl_in_queue);
+      for (auto& buf : app_write_queue)
+	job->cleartext_in.push_back(BufferPtr(new BufferAllocated(*buf)));
+      app_write_queue.clear();
+      async_kick_ = false;
+      async_job = job;
+
+      executor_->execute([job]() {
+	  job->run();
+	},
+	[job]() {
+	  if (job->owner)
+	    job->owner->async_complete(job);
+	});
+    }
+
+    // job completion, on the owning thread
+    void async_complete(const typename AsyncSSL::Ptr& job)
+    {
+      async_job.reset();
+      async_result = job;
+      parent().async_ready();
+    }
+
     void update_retransmit()
     {
       next_retransmit_ = *now + rel_send.until_retransmit(*now);
@@ -461,6 +735,9 @@ namespace openvpn {
 
   private:
     const Time::Duration tls_timeout;
+    SSLFactoryAPI::Ptr ssl_factory_;   // until start_handshake() creates ssl_
+    std::string cache_key_;
+    bool use_cache_key_;
     typename SSLAPI::Ptr ssl_;
     Frame::Ptr frame_;
     int up_stack_reentry_level;
@@ -479,6 +756,16 @@ namespace openvpn {
     ReliableRecv rel_recv;
     ReliableSend rel_send;
     ReliableAck xmit_acks;
+
+  private:
+    // SSLExecutor state
+    SSLExecutor::Ptr executor_;
+    typename AsyncSSL::Ptr async_job;    // job in progress
+    typename AsyncSSL::Ptr async_result; // completed job waiting for async_process()
+    std::deque<BufferPtr> ssl_in_queue;  // ciphertext from peer for the next job
+    std::deque<BufferPtr> ssl_out_queue; // ciphertext from SSL waiting for the reliability layer
+    bool async_kick_ = false;
+    bool async_app_blocked_ = false; // SSL object can't accept more cleartext yet
   };
 
 } // namespace openvpn
@@ -30,6 +30,8 @@
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/common/hexstr.hpp>
 #include <openvpn/common/memneq.hpp>
+#include <openvpn/common/hash.hpp>
+#include <openvpn/common/fasthash.hpp>
 
 namespace openvpn {
 
@@ -93,6 +95,17 @@ namespace openvpn {
       return render_hex(id_, SIZE);
     }
 
+    // keyed, since peers choose their session IDs
+    std::size_t hashval() const
+    {
+      return std::size_t(SipHash::hash(id_, SIZE));
+    }
+
+    bool operator==(const ProtoSessionID& other) const
+    {
+      return defined_ == other.defined_ && !std::memcmp(id_, other.id_, SIZE);
+    }
+
   protected:
     ProtoSessionID(const unsigned char *data)
     {
@@ -105,4 +118,6 @@ namespace openvpn {
   };
 } // namespace openvpn
 
+OPENVPN_HASH_METHOD(openvpn::ProtoSessionID, hashval);
+
 #endif // OPENVPN_SSL_PSID_H
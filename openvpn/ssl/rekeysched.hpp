@@ -0,0 +1,175 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side renegotiation scheduler, shared by all sessions of a
+// server.  Without it, every client that connected in the same second
+// (e.g. after a server restart) also rekeys in the same second, every
+// reneg-sec interval.
+//
+// assign() picks a per-client reneg-sec, uniformly jittered over
+// [reneg-sec - window, reneg-sec] and steered away from seconds that
+// already have max_per_second rekeys assigned, for the server to push
+// to the client.  acquire() enforces the same per-second budget on
+// handshakes as they happen: server-initiated renegotiations that
+// find the budget exhausted are deferred by ProtoContext, while
+// client-initiated ones are counted but never refused.
+
+#ifndef OPENVPN_SSL_REKEYSCHED_H
+#define OPENVPN_SSL_REKEYSCHED_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/random/randapi.hpp>
+
+namespace openvpn {
+
+  class RekeyScheduler : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<RekeyScheduler> Ptr;
+
+    struct Config
+    {
+      Time::Duration window = Time::Duration::seconds(600); // spread rekeys over this interval below reneg-sec
+      unsigned int max_per_second = 100; // handshake budget, 0 for unlimited
+    };
+
+    struct Stats
+    {
+      std::uint64_t assigned = 0;  // reneg-sec values handed out by assign()
+      std::uint64_t acquired = 0;  // handshakes admitted by acquire()
+      std::uint64_t deferred = 0;  // acquire() calls refused due to budget
+    };
+
+    RekeyScheduler(const Config& config_arg)
+      : config(config_arg),
+	slots(size_t(config_arg.window.to_seconds()) + 1)
+    {
+    }
+
+    // Pick a reneg-sec for a client whose session starts at now,
+    // given the configured reneg-sec.  Never returns more than
+    // renegotiate, nor less than renegotiate - window (or 10
+    // seconds, whichever is greater).
+    Time::Duration assign(const Time& now, const Time::Duration& renegotiate, RandomAPI& prng)
+    {
+      const std::uint64_t reneg = renegotiate.to_seconds();
+      std::uint64_t lo = 10;
+      if (reneg > lo + config.window.to_seconds())
+	lo = reneg - config.window.to_seconds();
+      if (reneg <= lo)
+	return renegotiate;
+      const std::uint64_t n = reneg - lo + 1;
+      const std::uint64_t base = now.seconds_since_epoch();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      const std::uint64_t start = prng.randrange<std::uint64_t>(n);
+      std::uint64_t best = start;
+      unsigned int best_count = ~0u;
+
+      // probe forward from a random second for one that's under budget
+      for (std::uint64_t i = 0; i < n; ++i)
+	{
+	  const std::uint64_t off = (start + i) % n;
+	  const unsigned int c = count(base + lo + off);
+	  if (c < best_count)
+	    {
+	      best = off;
+	      best_count = c;
+	    }
+	  if (!config.max_per_second || c < config.max_per_second)
+	    break;
+	}
+
+      slot(base + lo + best).count++;
+      ++stats_.assigned;
+      return Time::Duration::seconds(lo + best);
+    }
+
+    // Account for a handshake starting at now.  Returns false if the
+    // budget for the current second is exhausted, unless force is
+    // true, in which case the handshake is always counted.
+    bool acquire(const Time& now, const bool force = false)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const std::uint64_t sec = now.seconds_since_epoch();
+      if (cur_sec != sec)
+	{
+	  cur_sec = sec;
+	  cur_count = 0;
+	}
+      if (!force && config.max_per_second && cur_count >= config.max_per_second)
+	{
+	  ++stats_.deferred;
+	  return false;
+	}
+      ++cur_count;
+      ++stats_.acquired;
+      return true;
+    }
+
+    Stats stats() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats_;
+    }
+
+  private:
+    struct Slot
+    {
+      std::uint64_t sec = 0;
+      unsigned int count = 0;
+    };
+
+    // mutex must be held
+    Slot& slot(const std::uint64_t sec)
+    {
+      Slot& s = slots[sec % slots.size()];
+      if (s.sec != sec)
+	{
+	  s.sec = sec;
+	  s.count = 0;
+	}
+      return s;
+    }
+
+    // mutex must be held
+    unsigned int count(const std::uint64_t sec) const
+    {
+      const Slot& s = slots[sec % slots.size()];
+      return s.sec == sec ? s.count : 0;
+    }
+
+    const Config config;
+    mutable std::mutex mutex;
+    std::vector<Slot> slots; // assigned rekeys per second, over one window
+    std::uint64_t cur_sec = 0;
+    unsigned int cur_count = 0;
+    Stats stats_;
+  };
+
+}
+
+#endif
@@ -35,6 +35,7 @@ namespace openvpn {
 
   class OpenSSLContext;
   class MbedTLSContext;
+  class TLSSessionTicketKeyShm;
 
   // Abstract base class used to provide an interface for TLS
   // Session Ticket keying originally described by RFC 5077.
@@ -115,6 +116,7 @@ namespace openvpn {
       // we need to friend SSL implementation classes
       friend class OpenSSLContext;
       friend class MbedTLSContext;
+      friend class TLSSessionTicketKeyShm; // shares keys with other processes
 
       Name() {} // note that default constructor leaves object in an undefined state
 
@@ -202,6 +204,7 @@ namespace openvpn {
       // we need to friend SSL implementation classes
       friend class OpenSSLContext;
       friend class MbedTLSContext;
+      friend class TLSSessionTicketKeyShm; // shares keys with other processes
 
       Key() {} // note that default constructor leaves object in an undefined state
 
@@ -0,0 +1,189 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side TLS session ticket keys with automatic rotation.
+// A single TLSSessionTicketKeyRing may be shared by the SSL contexts
+// of all server threads.  New tickets are always encrypted with the
+// current key.  Tickets encrypted with one of the previous n_keep keys
+// are still accepted, but are reported as expiring so that the client
+// is issued a fresh ticket.  Keys may also be installed from outside
+// (e.g. restored from disk or distributed to a server farm) so that
+// tickets survive a server restart.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include <openvpn/ssl/sess_ticket.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class TLSSessionTicketKeyRing : public TLSSessionTicketBase
+  {
+  public:
+    struct Stats
+    {
+      unsigned long long created = 0;   // tickets issued
+      unsigned long long hits = 0;      // tickets decrypted with the current key
+      unsigned long long expiring = 0;  // tickets decrypted with a previous key
+      unsigned long long misses = 0;    // tickets with an unknown or retired key
+      unsigned long long rotations = 0; // key rotations
+    };
+
+    TLSSessionTicketKeyRing(RandomAPI::Ptr rng_arg,
+			    std::string sess_id_context_arg,
+			    const Time::Duration rotate_interval_arg = Time::Duration::seconds(12*60*60),
+			    const unsigned int n_keep_arg = 1)
+      : rng(std::move(rng_arg)),
+	sess_id_context(std::move(sess_id_context_arg)),
+	rotate_interval(rotate_interval_arg),
+	n_keep(n_keep_arg)
+    {
+      rng->assert_crypto();
+      std::lock_guard<std::mutex> lock(mutex);
+      push(Name(*rng), Key(*rng));
+    }
+
+    virtual Status create_session_ticket_key(Name& name, Key& key) const override
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      rotate_if_due();
+      const Entry& e = keys.front();
+      name = e.name;
+      key = e.key;
+      ++stats_.created;
+      return TICKET_AVAILABLE;
+    }
+
+    virtual Status lookup_session_ticket_key(const Name& name, Key& key) const override
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      rotate_if_due();
+      for (size_t i = 0; i < keys.size(); ++i)
+	{
+	  const Entry& e = keys[i];
+	  if (e.name == name)
+	    {
+	      key = e.key;
+	      if (i)
+		{
+		  ++stats_.expiring;
+		  return TICKET_EXPIRING;
+		}
+	      ++stats_.hits;
+	      return TICKET_AVAILABLE;
+	    }
+	}
+      ++stats_.misses;
+      return NO_TICKET;
+    }
+
+    virtual std::string session_id_context() const override
+    {
+      return sess_id_context;
+    }
+
+    // Make name/key the current key.  The rotation interval
+    // restarts from now.
+    void install(const Name& name, const Key& key)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      push(name, key);
+    }
+
+    // Replace all keys, current key first.  Intended for keys managed
+    // outside this process (with an infinite rotation interval).
+    void assign(const std::vector<std::pair<Name, Key>>& new_keys)
+    {
+      if (new_keys.empty())
+	throw sess_ticket_error("TLSSessionTicketKeyRing: no keys");
+      std::lock_guard<std::mutex> lock(mutex);
+      const Time now = Time::now();
+      keys.clear();
+      for (const auto& k : new_keys)
+	keys.emplace_back(k.first, k.second, now);
+    }
+
+    // Replace the current key with a new random key.
+    void rotate()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      push(Name(*rng), Key(*rng));
+      ++stats_.rotations;
+    }
+
+    Stats stats() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats_;
+    }
+
+  private:
+    struct Entry
+    {
+      Entry(const Name& name_arg, const Key& key_arg, const Time& created_arg)
+	: name(name_arg),
+	  key(key_arg),
+	  created(created_arg)
+      {
+      }
+
+      Name name;
+      Key key;
+      Time created;
+    };
+
+    // mutex must be held
+    void push(const Name& name, const Key& key) const
+    {
+      keys.emplace_front(name, key, Time::now());
+      while (keys.size() > size_t(n_keep) + 1)
+	keys.pop_back();
+    }
+
+    // mutex must be held
+    void rotate_if_due() const
+    {
+      if (rotate_interval.is_infinite())
+	return;
+      if (Time::now() >= keys.front().created + rotate_interval)
+	{
+	  push(Name(*rng), Key(*rng));
+	  ++stats_.rotations;
+	}
+    }
+
+    const RandomAPI::Ptr rng;
+    const std::string sess_id_context;
+    const Time::Duration rotate_interval;
+    const unsigned int n_keep;
+
+    mutable std::mutex mutex;
+    mutable std::deque<Entry> keys; // current key first
+    mutable Stats stats_;
+  };
+}
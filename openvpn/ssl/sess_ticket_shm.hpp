@@ -0,0 +1,346 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Share TLS session ticket keys between server processes on the
+// same host through a memory-mapped file, so that a session created
+// by one process can be resumed by any other (e.g. several servers
+// behind one address whose load balancer may move a client between
+// them).
+//
+// The file holds the current key followed by up to MAX_KEYS-1
+// previous keys and is protected by a seqlock for readers and by
+// flock() between writers.  A reader that can't get a consistent copy
+// within READ_RETRIES attempts takes the flock; if the seqlock is
+// still odd then, a writer died part way through an update, and the
+// keys are replaced by a fresh one.  Every process may rotate: the first one
+// to notice that the current key is older than the rotation interval
+// publishes a new key, and the others pick it up on their next ticket
+// operation.  The file should live on tmpfs (e.g. /run or /dev/shm)
+// and be readable only by the server user.
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/ssl/sess_ticket.hpp>
+#include <openvpn/ssl/sess_ticket_ring.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class TLSSessionTicketKeyShm : public TLSSessionTicketBase
+  {
+  public:
+    OPENVPN_EXCEPTION(sess_ticket_shm_error);
+
+    enum {
+      MAX_KEYS = 4,
+      READ_RETRIES = 1000, // lockless reload attempts before taking the flock
+    };
+
+    typedef TLSSessionTicketKeyRing::Stats Stats;
+
+    TLSSessionTicketKeyShm(const std::string& path,
+			   RandomAPI::Ptr rng_arg,
+			   const std::string& sess_id_context,
+			   const Time::Duration rotate_interval = Time::Duration::seconds(12*60*60),
+			   const unsigned int n_keep_arg = 1)
+      : rng(std::move(rng_arg)),
+	rotate_seconds(rotate_interval.enabled() ? std::uint64_t(rotate_interval.to_seconds()) : 0),
+	n_keep(n_keep_arg < MAX_KEYS ? n_keep_arg : MAX_KEYS - 1),
+	ring(rng, sess_id_context, Time::Duration::infinite(), MAX_KEYS - 1)
+    {
+      rng->assert_crypto();
+      open(path);
+      std::lock_guard<std::mutex> lock(mutex);
+      reload();
+    }
+
+    ~TLSSessionTicketKeyShm()
+    {
+      ::munmap(shm, sizeof(Layout));
+    }
+
+    virtual Status create_session_ticket_key(Name& name, Key& key) const override
+    {
+      refresh();
+      return ring.create_session_ticket_key(name, key);
+    }
+
+    virtual Status lookup_session_ticket_key(const Name& name, Key& key) const override
+    {
+      refresh();
+      return ring.lookup_session_ticket_key(name, key);
+    }
+
+    virtual std::string session_id_context() const override
+    {
+      return ring.session_id_context();
+    }
+
+    // Publish a new random key to all processes now.
+    void rotate()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      {
+	FileLock fl(fd());
+	publish();
+      }
+      reload();
+    }
+
+    // Publish name/key as the current key to all processes, e.g. a key
+    // distributed by a controller for servers on other hosts.
+    void install(const Name& name, const Key& key)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      {
+	FileLock fl(fd());
+	publish(name, key);
+      }
+      reload();
+    }
+
+    Stats stats() const
+    {
+      return ring.stats();
+    }
+
+  private:
+    static constexpr std::uint32_t MAGIC = 0x4f54534b; // "OTSK"
+    static constexpr std::uint32_t VERSION = 1;
+
+    struct Slot
+    {
+      unsigned char name[Name::SIZE];
+      unsigned char cipher[Key::CIPHER_KEY_SIZE];
+      unsigned char hmac[Key::HMAC_KEY_SIZE];
+    };
+
+    struct Layout
+    {
+      std::uint32_t magic;
+      std::uint32_t version;
+      std::atomic<std::uint64_t> seq; // odd while a writer is updating
+      std::uint64_t created;          // time(2) at which keys[0] was published
+      std::uint32_t n_keys;
+      std::uint32_t reserved;
+      Slot keys[MAX_KEYS];            // current key first
+    };
+
+    class FileLock
+    {
+    public:
+      FileLock(const int fd_arg)
+	: fd(fd_arg)
+      {
+	if (::flock(fd, LOCK_EX) < 0)
+	  throw sess_ticket_shm_error("flock: " + strerror_str(errno));
+      }
+
+      ~FileLock()
+      {
+	::flock(fd, LOCK_UN);
+      }
+
+    private:
+      const int fd;
+    };
+
+    int fd() const
+    {
+      return fd_();
+    }
+
+    void open(const std::string& path)
+    {
+      fd_.reset(::open(path.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR));
+      if (!fd_.defined())
+	throw sess_ticket_shm_error(path + ": open: " + strerror_str(errno));
+
+      FileLock fl(fd());
+      struct stat st;
+      if (::fstat(fd(), &st) < 0)
+	throw sess_ticket_shm_error(path + ": fstat: " + strerror_str(errno));
+      const bool init = size_t(st.st_size) < sizeof(Layout);
+      if (init && ::ftruncate(fd(), sizeof(Layout)) < 0)
+	throw sess_ticket_shm_error(path + ": ftruncate: " + strerror_str(errno));
+
+      void* p = ::mmap(nullptr, sizeof(Layout), PROT_READ|PROT_WRITE, MAP_SHARED, fd(), 0);
+      if (p == MAP_FAILED)
+	throw sess_ticket_shm_error(path + ": mmap: " + strerror_str(errno));
+      shm = static_cast<Layout*>(p);
+
+      if (init || shm->magic != MAGIC)
+	{
+	  shm->magic = MAGIC;
+	  shm->version = VERSION;
+	  shm->seq.store(0, std::memory_order_relaxed);
+	  shm->n_keys = 0;
+	  publish();
+	}
+      else if (shm->version != VERSION)
+	{
+	  ::munmap(shm, sizeof(Layout));
+	  throw sess_ticket_shm_error(path + ": unsupported version");
+	}
+      else if ((shm->seq.load(std::memory_order_acquire) & 1) || !shm->n_keys || shm->n_keys > MAX_KEYS)
+	publish(Name(*rng), Key(*rng), false); // left behind by a writer that died
+    }
+
+    // Pick up keys published by other processes and rotate if due.
+    void refresh() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (rotate_seconds && std::uint64_t(std::time(nullptr)) >= created + rotate_seconds)
+	{
+	  {
+	    FileLock fl(fd());
+	    // another process may have rotated first
+	    if (std::uint64_t(std::time(nullptr)) >= shm->created + rotate_seconds)
+	      publish();
+	  }
+	  reload();
+	}
+      else if (shm->seq.load(std::memory_order_acquire) != seq)
+	reload();
+    }
+
+    // Copy the keys out of shared memory.  mutex must be held.
+    void reload() const
+    {
+      if (try_reload(READ_RETRIES))
+	return;
+
+      // Writers hold the flock for the whole update, so with it held
+      // an odd seq or a bad key count can only be left over from one
+      // that died.
+      FileLock fl(fd());
+      if (try_reload(1))
+	return;
+      publish(Name(*rng), Key(*rng), false);
+      if (!try_reload(1))
+	throw sess_ticket_shm_error("cannot recover key segment");
+    }
+
+    bool try_reload(unsigned int retries) const
+    {
+      Slot slots[MAX_KEYS];
+      std::uint32_t n;
+      std::uint64_t s;
+      std::uint64_t c;
+      for (;;)
+	{
+	  if (!retries--)
+	    return false;
+	  s = shm->seq.load(std::memory_order_acquire);
+	  if (s & 1)
+	    {
+	      std::this_thread::yield();
+	      continue;
+	    }
+	  n = shm->n_keys;
+	  c = shm->created;
+	  std::memcpy(slots, shm->keys, sizeof(slots));
+	  std::atomic_thread_fence(std::memory_order_acquire);
+	  if (shm->seq.load(std::memory_order_relaxed) == s)
+	    break;
+	}
+      if (!n || n > MAX_KEYS)
+	return false;
+
+      std::vector<std::pair<Name, Key>> keys;
+      for (std::uint32_t i = 0; i < n; ++i)
+	{
+	  Name name;
+	  Key key;
+	  std::memcpy(name.value_, slots[i].name, Name::SIZE);
+	  std::memcpy(key.cipher_value_, slots[i].cipher, Key::CIPHER_KEY_SIZE);
+	  std::memcpy(key.hmac_value_, slots[i].hmac, Key::HMAC_KEY_SIZE);
+	  keys.emplace_back(name, key);
+	}
+      std::memset(slots, 0, sizeof(slots));
+      ring.assign(keys);
+      seq = s;
+      created = c;
+      return true;
+    }
+
+    // Publish a new current key.  FileLock must be held.
+    void publish() const
+    {
+      publish(Name(*rng), Key(*rng));
+    }
+
+    // Publish name/key as the current key, dropping the previous
+    // keys unless keep is set.  Writers are serialized by the flock,
+    // so seq is made odd from whatever it was, which also recovers
+    // from a writer that died with it odd.
+    void publish(const Name& name, const Key& key, const bool keep=true) const
+    {
+      const std::uint32_t n = keep && shm->n_keys <= MAX_KEYS ? std::min(shm->n_keys + 1, std::uint32_t(n_keep) + 1) : 1;
+      const std::uint64_t s = shm->seq.load(std::memory_order_relaxed) | 1;
+      shm->seq.store(s, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      std::memmove(&shm->keys[1], &shm->keys[0], sizeof(Slot) * (MAX_KEYS - 1));
+      std::memcpy(shm->keys[0].name, name.value_, Name::SIZE);
+      std::memcpy(shm->keys[0].cipher, key.cipher_value_, Key::CIPHER_KEY_SIZE);
+      std::memcpy(shm->keys[0].hmac, key.hmac_value_, Key::HMAC_KEY_SIZE);
+      std::memset(&shm->keys[n], 0, sizeof(Slot) * (MAX_KEYS - n));
+      shm->n_keys = n;
+      shm->created = std::uint64_t(std::time(nullptr));
+      shm->seq.store(s + 1, std::memory_order_release);
+    }
+
+    const RandomAPI::Ptr rng;
+    const std::uint64_t rotate_seconds; // 0 to disable rotation
+    const unsigned int n_keep;
+
+    ScopedFD fd_;
+    Layout* shm = nullptr;
+
+    mutable std::mutex mutex;
+    mutable TLSSessionTicketKeyRing ring;
+    mutable std::uint64_t seq = 0;
+    mutable std::uint64_t created = 0;
+  };
+}
@@ -0,0 +1,220 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Serialized state of an established session, for handing it off to
+// another process (e.g. a server being upgraded) that resumes the
+// data channel without renegotiating.  See
+// ProtoContext::export_session() and ProtoContext::resume_session(),
+// and openvpn/server/sessmigrate.hpp to move a set of sessions
+// together with their transport sockets.
+//
+// The serialized form holds raw key material, so it must only travel
+// over a private channel, and buffers holding it should be allocated
+// with BufferAllocated::DESTRUCT_ZERO.
+
+#ifndef OPENVPN_SSL_SESSSTATE_H
+#define OPENVPN_SSL_SESSSTATE_H
+
+#include <cstdint>
+#include <string>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/ssl/psid.hpp>
+
+namespace openvpn {
+
+  struct ProtoSessionState
+  {
+    OPENVPN_EXCEPTION(proto_session_state_error);
+
+    enum {
+      MAGIC = 0x4f565353, // "OVSS"
+      VERSION = 2,
+    };
+
+    // Data channel, filled in by ProtoContext::export_session()
+    unsigned int key_id = 0;
+    std::string cipher;          // CryptoAlgs name
+    std::string digest;          // CryptoAlgs name, empty for none
+    int compress = 0;            // CompressContext::Type
+    bool compress_asym = false;
+    bool enable_op32 = false;
+    bool wide_pid = false;       // data channel uses PacketID::WIDE_FORM
+    bool tls_ekm = false;        // keys are derived with the TLS keying material exporter
+    int remote_peer_id = -1;
+    int local_peer_id = -1;
+    std::uint32_t key_age = 0;   // seconds since the key was created
+    OpenVPNStaticKey key;        // data channel key material
+    PacketID data_send;          // last packet ID sent
+    PacketID data_recv;          // highest packet ID received
+
+    // Control channel
+    ProtoSessionID psid_self;
+    ProtoSessionID psid_peer;
+    PacketID control_send;       // tls-auth/tls-crypt packet IDs
+    PacketID control_recv;
+    OpenVPNStaticKey tls_crypt_v2_key; // client key unwrapped from WKc, server only
+
+    // Filled in by the server session that owns the ProtoContext
+    std::string peer_addr;       // transport address of the peer
+    std::uint16_t peer_port = 0;
+    std::string vpn_ip4;         // VPN addresses assigned to the peer
+    std::string vpn_ip6;
+    std::string options;         // options pushed to the peer
+    unsigned int socket_index = 0; // which of the handed-off sockets the session uses
+
+    void serialize(Buffer& buf) const
+    {
+      write_u32(buf, MAGIC);
+      buf.push_back(VERSION);
+      buf.push_back((unsigned char)key_id);
+      write_string(buf, cipher);
+      write_string(buf, digest);
+      buf.push_back((unsigned char)compress);
+      buf.push_back((compress_asym ? 1 : 0) | (enable_op32 ? 2 : 0) | (wide_pid ? 4 : 0) | (tls_ekm ? 8 : 0));
+      write_u32(buf, std::uint32_t(remote_peer_id));
+      write_u32(buf, std::uint32_t(local_peer_id));
+      write_u32(buf, key_age);
+      write_key(buf, key);
+      write_pid(buf, data_send);
+      write_pid(buf, data_recv);
+      psid_self.write(buf);
+      psid_peer.write(buf);
+      write_pid(buf, control_send);
+      write_pid(buf, control_recv);
+      write_key(buf, tls_crypt_v2_key);
+      write_string(buf, peer_addr);
+      write_u32(buf, peer_port);
+      write_string(buf, vpn_ip4);
+      write_string(buf, vpn_ip6);
+      write_string(buf, options);
+      write_u32(buf, socket_index);
+    }
+
+    void parse(Buffer& buf)
+    {
+      try {
+	if (read_u32(buf) != MAGIC || buf.pop_front() != VERSION)
+	  throw proto_session_state_error("bad magic or version");
+	key_id = buf.pop_front();
+	cipher = read_string(buf);
+	digest = read_string(buf);
+	compress = buf.pop_front();
+	const unsigned char flags = buf.pop_front();
+	compress_asym = (flags & 1) != 0;
+	enable_op32 = (flags & 2) != 0;
+	wide_pid = (flags & 4) != 0;
+	tls_ekm = (flags & 8) != 0;
+	remote_peer_id = int(read_u32(buf));
+	local_peer_id = int(read_u32(buf));
+	key_age = read_u32(buf);
+	read_key(buf, key);
+	if (!key.defined())
+	  throw proto_session_state_error("no data channel key");
+	data_send = read_pid(buf);
+	data_recv = read_pid(buf);
+	psid_self.read(buf);
+	psid_peer.read(buf);
+	control_send = read_pid(buf);
+	control_recv = read_pid(buf);
+	read_key(buf, tls_crypt_v2_key);
+	peer_addr = read_string(buf);
+	peer_port = std::uint16_t(read_u32(buf));
+	vpn_ip4 = read_string(buf);
+	vpn_ip6 = read_string(buf);
+	options = read_string(buf);
+	socket_index = read_u32(buf);
+      }
+      catch (const BufferException& e)
+	{
+	  throw proto_session_state_error(std::string("truncated: ") + e.what());
+	}
+    }
+
+  private:
+    static void write_u32(Buffer& buf, const std::uint32_t v)
+    {
+      const std::uint32_t net = htonl(v);
+      buf.write((const unsigned char *)&net, sizeof(net));
+    }
+
+    static std::uint32_t read_u32(Buffer& buf)
+    {
+      std::uint32_t net;
+      buf.read((unsigned char *)&net, sizeof(net));
+      return ntohl(net);
+    }
+
+    static void write_string(Buffer& buf, const std::string& str)
+    {
+      write_u32(buf, std::uint32_t(str.length()));
+      buf.write((const unsigned char *)str.data(), str.length());
+    }
+
+    static std::string read_string(Buffer& buf)
+    {
+      const std::uint32_t len = read_u32(buf);
+      const unsigned char *data = buf.read_alloc(len);
+      return std::string((const char *)data, len);
+    }
+
+    static void write_pid(Buffer& buf, const PacketID& pid)
+    {
+      write_u32(buf, std::uint32_t(pid.id >> 32));
+      write_u32(buf, std::uint32_t(pid.id));
+      write_u32(buf, std::uint32_t(pid.time));
+    }
+
+    static PacketID read_pid(Buffer& buf)
+    {
+      PacketID pid;
+      pid.id = PacketID::wide_id_t(read_u32(buf)) << 32;
+      pid.id |= read_u32(buf);
+      pid.time = read_u32(buf);
+      return pid;
+    }
+
+    // a flag byte, then the key if defined
+    static void write_key(Buffer& buf, const OpenVPNStaticKey& key)
+    {
+      const unsigned char *raw = key.raw();
+      buf.push_back(raw ? 1 : 0);
+      if (raw)
+	buf.write(raw, OpenVPNStaticKey::KEY_SIZE);
+    }
+
+    static void read_key(Buffer& buf, OpenVPNStaticKey& key)
+    {
+      if (buf.pop_front())
+	buf.read(key.raw_alloc(), OpenVPNStaticKey::KEY_SIZE);
+      else
+	key.erase();
+    }
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_SSL_SESSSTATE_H
@@ -0,0 +1,224 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// An SNI handler for servers with many tenants, each with its own
+// certificate.  Names are registered up front with a loader for
+// their SSL context, which is only run on the first handshake for
+// the name.  Built contexts are kept for later handshakes, and the
+// least recently used are dropped above max_contexts.  Connections
+// already using a dropped context keep a reference to it.
+//
+// Lookup is by hash: exact names first, then a "*.example.com"
+// wildcard, which matches a single leftmost label as in RFC 6125.
+// Names are matched case-insensitively.
+//
+// Like the SSLFactoryAPI objects it returns, an IndexedHandler is
+// not thread-safe, so use one per server thread.
+
+#pragma once
+
+#include <string>
+#include <cctype>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <utility>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/ssl/sni_handler.hpp>
+
+namespace openvpn {
+  namespace SNI {
+
+    class IndexedHandler : public HandlerBase
+    {
+    public:
+      typedef std::unique_ptr<IndexedHandler> UPtr;
+
+      OPENVPN_EXCEPTION(sni_index_error);
+
+      // builds the SSL context for a name
+      typedef std::function<SSLFactoryAPI::Ptr()> Loader;
+
+      // optional, returns the sni_metadata for a matched name
+      typedef std::function<Metadata::UPtr(const std::string& sni_name)> MetadataLoader;
+
+      IndexedHandler(const size_t max_contexts_arg = 1024)
+	: max_contexts(max_contexts_arg ? max_contexts_arg : 1)
+      {
+      }
+
+      // Register name, replacing any previous registration
+      // and dropping its built context.
+      void add(const std::string& name, Loader loader, MetadataLoader metadata = MetadataLoader())
+      {
+	Entry& e = map_for(name)[key_for(name)];
+	uncache(e);
+	e.loader = std::move(loader);
+	e.metadata = std::move(metadata);
+      }
+
+      void add(const std::string& name, SSLConfigAPI::Ptr config, MetadataLoader metadata = MetadataLoader())
+      {
+	add(name, [config]() { return config->new_factory(); }, std::move(metadata));
+      }
+
+      bool remove(const std::string& name)
+      {
+	Map& map = map_for(name);
+	auto i = map.find(key_for(name));
+	if (i == map.end())
+	  return false;
+	uncache(i->second);
+	map.erase(i);
+	return true;
+      }
+
+      size_t size() const
+      {
+	return exact.size() + wildcard.size();
+      }
+
+      size_t n_contexts() const
+      {
+	return lru.size();
+      }
+
+      // context cache statistics
+      size_t hits() const { return hits_; }
+      size_t misses() const { return misses_; }
+      size_t evictions() const { return evictions_; }
+
+      virtual SSLFactoryAPI::Ptr sni_hello(const std::string& sni_name,
+					   Metadata::UPtr& sni_metadata,
+					   SSLConfigAPI::Ptr default_factory) const override
+      {
+	Entry* e = lookup(sni_name);
+	if (!e)
+	  return SSLFactoryAPI::Ptr();
+	if (e->metadata)
+	  sni_metadata = e->metadata(sni_name);
+	return context(*e);
+      }
+
+    private:
+      struct Entry
+      {
+	Loader loader;
+	MetadataLoader metadata;
+	SSLFactoryAPI::Ptr factory;
+	std::list<Entry*>::iterator lru_pos;
+      };
+
+      // element addresses are stable, so the LRU list can
+      // point into the maps
+      typedef std::unordered_map<std::string, Entry> Map;
+
+      static bool is_wildcard(const std::string& name)
+      {
+	return string::starts_with(name, "*.");
+      }
+
+      // also validates name
+      static std::string key_for(const std::string& name)
+      {
+	const size_t start = is_wildcard(name) ? 2 : 0;
+	if (name.length() <= start)
+	  throw sni_index_error("empty SNI name");
+	if (name.find('*', start) != std::string::npos)
+	  throw sni_index_error("SNI name " + name + ": wildcard must be the leftmost label");
+	return string::to_lower_copy(name.substr(start));
+      }
+
+      Map& map_for(const std::string& name)
+      {
+	return is_wildcard(name) ? wildcard : exact;
+      }
+
+      // The key buffer is reused across lookups to spare an
+      // allocation per handshake.
+      Entry* lookup(const std::string& sni_name) const
+      {
+	key = sni_name;
+	for (auto& c : key)
+	  c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+	auto i = exact.find(key);
+	if (i != exact.end())
+	  return &i->second;
+
+	const size_t dot = key.find('.');
+	if (dot == std::string::npos || dot == 0)
+	  return nullptr;
+	key.erase(0, dot + 1);
+	i = wildcard.find(key);
+	if (i != wildcard.end())
+	  return &i->second;
+	return nullptr;
+      }
+
+      SSLFactoryAPI::Ptr context(Entry& e) const
+      {
+	if (e.factory)
+	  {
+	    ++hits_;
+	    lru.splice(lru.begin(), lru, e.lru_pos);
+	    return e.factory;
+	  }
+
+	++misses_;
+	SSLFactoryAPI::Ptr f = e.loader();
+	if (f)
+	  {
+	    if (lru.size() >= max_contexts)
+	      {
+		uncache(*lru.back());
+		++evictions_;
+	      }
+	    e.factory = f;
+	    lru.push_front(&e);
+	    e.lru_pos = lru.begin();
+	  }
+	return f;
+      }
+
+      void uncache(Entry& e) const
+      {
+	if (e.factory)
+	  {
+	    lru.erase(e.lru_pos);
+	    e.factory.reset();
+	  }
+      }
+
+      const size_t max_contexts;
+      mutable Map exact;
+      mutable Map wildcard;
+      mutable std::list<Entry*> lru; // most recently used first
+      mutable std::string key;
+      mutable size_t hits_ = 0;
+      mutable size_t misses_ = 0;
+      mutable size_t evictions_ = 0;
+    };
+
+  }
+}
@@ -63,6 +63,31 @@ namespace openvpn {
 
     typedef RCPtr<SSLAPI> Ptr;
 
+    // Record layer state of one direction of an established
+    // session, for handing it to kernel TLS.  Only AES-GCM
+    // suites are exported.
+    struct TrafficKeys
+    {
+      enum Cipher {
+	AES_128_GCM,
+	AES_256_GCM,
+      };
+
+      unsigned int version = 0; // 0x0303 for TLS 1.2, 0x0304 for TLS 1.3
+      Cipher cipher = AES_128_GCM;
+      unsigned char key[32];
+      size_t key_len = 0;
+      unsigned char iv[12];     // 4-byte salt, then 8 bytes of nonce
+      std::uint64_t rec_seq = 0;
+
+      ~TrafficKeys()
+      {
+	volatile unsigned char *p = key;
+	for (size_t i = 0; i < sizeof(key); ++i)
+	  p[i] = 0;
+      }
+    };
+
     virtual void start_handshake() = 0;
     virtual ssize_t write_cleartext_unbuffered(const void *data, const size_t size) = 0;
     virtual ssize_t read_cleartext(void *data, const size_t capacity) = 0;
@@ -75,6 +100,31 @@ namespace openvpn {
     virtual bool did_full_handshake() = 0;
     virtual const AuthCert::Ptr& auth_cert() const = 0;
     virtual void mark_no_cache() = 0; // prevent caching of client-side session (only meaningful when client_session_tickets is enabled)
+
+    // [client only] Export the keys of our sending direction once
+    // the handshake is complete and before any application data
+    // has been written.  A caller that takes over record encryption
+    // with the keys must no longer write cleartext to this object.
+    // Needs SSLConst::ENABLE_KTLS_TX.
+    virtual bool export_tx_keys(TrafficKeys& keys)
+    {
+      return false;
+    }
+
+    // Fill dest with size bytes of keying material for label,
+    // without a context value (RFC 5705), once the handshake is
+    // complete.  Returns false if the backend can't export it.
+    virtual bool export_keying_material(const std::string& label, unsigned char *dest, const size_t size)
+    {
+      return false;
+    }
+
+    // Release buffers that are re-created on demand, for a
+    // session that has gone idle.  Keeps the session itself.
+    virtual void compact()
+    {
+    }
+
     uint32_t get_tls_warnings() const
     {
       return tls_warnings;
@@ -102,6 +152,12 @@ namespace openvpn {
 
     // client or server?
     virtual const Mode& mode() const = 0;
+
+    // true if SSLAPI::export_keying_material() is implemented
+    virtual bool keying_material_exporter() const
+    {
+      return false;
+    }
   };
 
   class SSLConfigAPI : public RC<thread_unsafe_refcount>
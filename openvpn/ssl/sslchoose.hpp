@@ -22,6 +22,13 @@
 #ifndef OPENVPN_SSL_SSLCHOOSE_H
 #define OPENVPN_SSL_SSLCHOOSE_H
 
+#include <openvpn/common/buildprofile.hpp>
+
+#if defined(OPENVPN_SINGLE_SSL_LIB) \
+  && (defined(USE_OPENSSL) + defined(USE_MBEDTLS) + defined(USE_APPLE_SSL) + defined(USE_MBEDTLS_APPLE_HYBRID)) > 1
+#error build profile allows only one SSL library
+#endif
+
 #ifdef USE_OPENSSL
 #include <openvpn/openssl/crypto/api.hpp>
 #include <openvpn/openssl/ssl/sslctx.hpp>
@@ -85,6 +92,7 @@ namespace openvpn {
     typedef AppleRandom RandomAPI;
 #elif defined(USE_OPENSSL)
 #define SSL_LIB_NAME "OpenSSL"
+#define SSL_LIB_CLIENT_SESSION_TICKETS // supports set_client_session_tickets()
     typedef OpenSSLCryptoAPI CryptoAPI;
     typedef OpenSSLContext SSLAPI;
     typedef OpenSSLRandom RandomAPI;
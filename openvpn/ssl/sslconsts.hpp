@@ -69,8 +69,24 @@ namespace openvpn {
       // [server only] Send a list of client CAs to the client
       SEND_CLIENT_CA_LIST=(1<<7),
 
+      // [OpenSSL only] Check peer certs against a hash index of
+      // the revoked serial numbers in the CRLs, rather than having
+      // the X509 store look them up.
+      CRL_INDEX=(1<<8),
+
+      // [OpenSSL client only] Keep the traffic secrets of the
+      // session so that SSLAPI::export_tx_keys can hand the
+      // sending direction to kernel TLS.
+      ENABLE_KTLS_TX=(1<<9),
+
+      // [OpenSSL only] TLS 1.3 0-RTT.  A client resuming a session
+      // sends its first cleartext write as early data, a server
+      // with session tickets accepts it, once per ticket, and
+      // reads it only after the client's Finished.
+      ENABLE_EARLY_DATA=(1<<10),
+
       // last flag marker
-      LAST=(1<<8)
+      LAST=(1<<11)
     };
 
     // filter all but SSL flags
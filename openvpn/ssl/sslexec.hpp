@@ -0,0 +1,55 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Interface for running SSL work off the thread that owns a session.
+// ProtoStackBase uses it, when configured, to run the SSL object's
+// handshake and record processing on a worker thread, so that
+// public-key operations don't stall the owning thread's event loop.
+// SSL contexts used with an executor must tolerate their SSL objects
+// being driven concurrently from different threads.
+// See sslexecasio.hpp for an asio-based thread pool implementation.
+
+#ifndef OPENVPN_SSL_SSLEXEC_H
+#define OPENVPN_SSL_SSLEXEC_H
+
+#include <functional>
+
+#include <openvpn/common/rc.hpp>
+
+namespace openvpn {
+
+  class SSLExecutor : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<SSLExecutor> Ptr;
+    typedef std::function<void()> Function;
+
+    // Run work on a worker thread, then run done on the thread that
+    // owns the session.  work must be destroyed on the worker thread
+    // before done is dispatched, and done must only be run and
+    // destroyed on the owning thread.
+    virtual void execute(Function work, Function done) = 0;
+  };
+
+}
+
+#endif
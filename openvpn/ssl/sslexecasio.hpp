@@ -0,0 +1,120 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Asio-based SSLExecutor.  An SSLThreadPool runs SSL work on a fixed
+// set of threads and can be shared by all sessions in the process.
+// Each owning thread creates its own SSLAsioExecutor that posts
+// completions back to its io_context.  Stop the pool only after the
+// sessions that use it have been destroyed.
+
+#ifndef OPENVPN_SSL_SSLEXECASIO_H
+#define OPENVPN_SSL_SSLEXECASIO_H
+
+#include <vector>
+#include <thread>
+#include <memory>
+#include <utility>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/asio/asiowork.hpp>
+#include <openvpn/ssl/sslexec.hpp>
+
+namespace openvpn {
+
+  class SSLThreadPool : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<SSLThreadPool> Ptr;
+
+    OPENVPN_SIMPLE_EXCEPTION(ssl_thread_pool_error);
+
+    SSLThreadPool(const unsigned int n_threads)
+      : io_context_(int(n_threads)),
+	work(new AsioWork(io_context_))
+    {
+      if (!n_threads)
+	throw ssl_thread_pool_error();
+      for (unsigned int i = 0; i < n_threads; ++i)
+	threads.emplace_back([this, logwrap=Log::Context::Wrapper()]() {
+	    Log::Context logctx(logwrap);
+	    io_context_.run();
+	  });
+    }
+
+    ~SSLThreadPool()
+    {
+      stop();
+    }
+
+    // wait for queued work to finish and join the pool threads
+    void stop()
+    {
+      work.reset();
+      for (auto& t : threads)
+	t.join();
+      threads.clear();
+    }
+
+    openvpn_io::io_context& io_context()
+    {
+      return io_context_;
+    }
+
+  private:
+    openvpn_io::io_context io_context_;
+    std::unique_ptr<AsioWork> work;
+    std::vector<std::thread> threads;
+  };
+
+  class SSLAsioExecutor : public SSLExecutor
+  {
+  public:
+    typedef RCPtr<SSLAsioExecutor> Ptr;
+
+    SSLAsioExecutor(const SSLThreadPool::Ptr& pool_arg,
+		    openvpn_io::io_context& owner_arg)
+      : pool(pool_arg),
+	owner(owner_arg)
+    {
+    }
+
+    void execute(Function work, Function done) override
+    {
+      openvpn_io::io_context& owner_context = owner;
+      openvpn_io::post(pool->io_context(), [work=std::move(work), done=std::move(done), &owner_context]() mutable {
+	  work();
+	  work = nullptr; // release captures before done can run
+	  openvpn_io::post(owner_context, std::move(done));
+	});
+    }
+
+  private:
+    SSLThreadPool::Ptr pool;
+    openvpn_io::io_context& owner;
+  };
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// TimerWheel driven by a single AsioTimer, so that any number of
+// wheel timers cost one pending asio timer per io_context.
+
+#ifndef OPENVPN_TIME_ASIOTIMERWHEEL_H
+#define OPENVPN_TIME_ASIOTIMERWHEEL_H
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/time/timerwheel.hpp>
+
+namespace openvpn {
+
+  class AsioTimerWheel : public TimerWheel
+  {
+  public:
+    typedef RCPtr<AsioTimerWheel> Ptr;
+
+    AsioTimerWheel(openvpn_io::io_context& io_context)
+      : timer(io_context)
+    {
+    }
+
+    // Stop driving the wheel; pending timers no longer fire.
+    void stop()
+    {
+      halt = true;
+      timer.cancel();
+    }
+
+  private:
+    void wakeup(const Time& t) override
+    {
+      if (halt || t == scheduled)
+	return;
+      scheduled = t;
+      if (t.is_infinite())
+	{
+	  timer.cancel();
+	  return;
+	}
+      timer.expires_at(t);
+      timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+                       {
+                         OPENVPN_ASYNC_HANDLER;
+                         if (!error && !self->halt)
+			   {
+			     self->scheduled = Time::infinite();
+			     self->advance(Time::now());
+			   }
+                       });
+    }
+
+    AsioTimer timer;
+    Time scheduled = Time::infinite();
+    bool halt = false;
+  };
+
+}
+
+#endif
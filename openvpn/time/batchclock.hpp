@@ -0,0 +1,92 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-thread clock cache for packet bursts.  A transport that reads
+// a burst of packets in one reactor wakeup (e.g. via recvmmsg) holds
+// a BatchClock::Scope while dispatching them, so that the clock is
+// read once per burst rather than once per packet by every
+// ProtoContext::update_now() call on the data path.  Outside of a
+// scope, update() reads the clock as usual.  Each io_context runs on
+// a single thread, so the cache is effectively per-io_context.
+
+#ifndef OPENVPN_TIME_BATCHCLOCK_H
+#define OPENVPN_TIME_BATCHCLOCK_H
+
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class BatchClock
+  {
+  public:
+    class Scope
+    {
+    public:
+      Scope()
+      {
+	State& s = state();
+	if (!s.depth++)
+	  s.now.update();
+      }
+
+      ~Scope()
+      {
+	--state().depth;
+      }
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+    };
+
+    // set t to the current time, as cached by the innermost
+    // active Scope, if any
+    static void update(Time& t)
+    {
+      const State& s = state();
+      if (s.depth)
+	t = s.now;
+      else
+	t.update();
+    }
+
+    static Time now()
+    {
+      const State& s = state();
+      return s.depth ? s.now : Time::now();
+    }
+
+  private:
+    struct State
+    {
+      Time now;
+      unsigned int depth = 0;
+    };
+
+    static State& state()
+    {
+      static thread_local State s;
+      return s;
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,209 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// CPU time accounting by subsystem.  A Scope attributes the time its
+// thread spends inside it to one subsystem, minus the time spent in
+// nested scopes, which is attributed to theirs.  Time is read from
+// the TSC on x86 and the virtual counter on ARM64 (both constant
+// rate on current CPUs) and from the steady clock elsewhere, and
+// converted to nanoseconds with a rate calibrated once per process.
+// Threads accumulate into thread-local totals, and
+// SessionStats::CpuScope also adds the time to the session's CPU_*
+// counters.
+//
+// Define OPENVPN_NO_CPU_STATS to compile the scopes to nothing.
+
+#ifndef OPENVPN_TIME_CPUSTAT_H
+#define OPENVPN_TIME_CPUSTAT_H
+
+#include <cstdint>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+namespace openvpn {
+  namespace CpuStats {
+
+    enum Subsystem {
+      NONE = 0,
+      CRYPTO,       // data channel encrypt/decrypt
+      COMPRESS,     // data channel compression
+      HANDSHAKE,    // control channel and TLS
+      TUN_IO,
+      TRANSPORT_IO,
+      HOUSEKEEPING, // timers, keepalive, retransmits
+      N_SUBSYSTEMS
+    };
+
+    inline const char *subsystem_name(const size_t s)
+    {
+      static const char *names[] = {
+	"NONE",
+	"CRYPTO",
+	"COMPRESS",
+	"HANDSHAKE",
+	"TUN_IO",
+	"TRANSPORT_IO",
+	"HOUSEKEEPING",
+      };
+
+      if (s < N_SUBSYSTEMS)
+	return names[s];
+      else
+	return "UNKNOWN_SUBSYSTEM";
+    }
+
+    inline std::uint64_t steady_ns()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // raw timestamp in ticks
+    inline std::uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+      return __rdtsc();
+#elif defined(__aarch64__)
+      std::uint64_t v;
+      __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+      return v;
+#else
+      return steady_ns();
+#endif
+    }
+
+    // Nanoseconds per tick, measured against the steady clock over
+    // about a millisecond on first use.
+    inline double ns_per_tick()
+    {
+      static const double ratio = []() {
+	const std::uint64_t n0 = steady_ns();
+	const std::uint64_t t0 = ticks();
+	std::uint64_t n1;
+	do {
+	  n1 = steady_ns();
+	} while (n1 - n0 < 1000000);
+	const std::uint64_t t1 = ticks();
+	return t1 > t0 ? double(n1 - n0) / double(t1 - t0) : 1.0;
+      }();
+      return ratio;
+    }
+
+    inline std::uint64_t to_ns(const std::uint64_t t)
+    {
+      return std::uint64_t(double(t) * ns_per_tick());
+    }
+
+#ifndef OPENVPN_NO_CPU_STATS
+
+    class Scope;
+
+    struct ThreadState
+    {
+      Scope* top = nullptr;
+      std::uint64_t ticks[N_SUBSYSTEMS] = {};
+    };
+
+    inline ThreadState& thread_state()
+    {
+      static thread_local ThreadState ts;
+      return ts;
+    }
+
+    // Attribute the calling thread's time to subsystem s for the
+    // lifetime of this object, excluding nested scopes.
+    class Scope
+    {
+    public:
+      Scope(const Subsystem s) noexcept
+	: ts(thread_state()),
+	  parent(ts.top),
+	  subsystem(s),
+	  since(ticks())
+      {
+	if (parent)
+	  parent->pause(since);
+	ts.top = this;
+      }
+
+      ~Scope()
+      {
+	const std::uint64_t now = ticks();
+	own += now - since;
+	ts.ticks[subsystem] += own;
+	ts.top = parent;
+	if (parent)
+	  parent->since = now;
+      }
+
+      // ticks attributed to this scope so far
+      std::uint64_t own_ticks() const noexcept
+      {
+	return own + (ticks() - since);
+      }
+
+      Subsystem get_subsystem() const noexcept
+      {
+	return subsystem;
+      }
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+    private:
+      void pause(const std::uint64_t now) noexcept
+      {
+	own += now - since;
+      }
+
+      ThreadState& ts;
+      Scope* const parent;
+      const Subsystem subsystem;
+      std::uint64_t since;
+      std::uint64_t own = 0;
+    };
+
+    // nanoseconds the calling thread has spent in subsystem s
+    inline std::uint64_t thread_ns(const Subsystem s)
+    {
+      return to_ns(thread_state().ticks[s]);
+    }
+
+#else
+
+    class Scope
+    {
+    public:
+      Scope(const Subsystem) noexcept {}
+    };
+
+    inline std::uint64_t thread_ns(const Subsystem) { return 0; }
+
+#endif
+  }
+}
+
+#endif
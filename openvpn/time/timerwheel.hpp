@@ -0,0 +1,321 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Hierarchical timer wheel for large numbers of coarse timers, such
+// as per-session housekeeping.  Timers are intrusive list nodes, so
+// expires_at() and cancel() are O(1) regardless of the number of
+// timers, and expiry costs O(1) per timer plus one slot visit per
+// tick.  Resolution is TICK (1/8 second), well within the slack that
+// session housekeeping already allows via CoarseTime, and timers
+// never fire early.
+//
+// The wheel itself is passive: the owner calls advance() with the
+// current time, and is told via the wakeup() virtual when it should
+// next do so (see AsioTimerWheel in asiotimerwheel.hpp).  Not thread
+// safe; a wheel and its timers belong to one thread.
+
+#ifndef OPENVPN_TIME_TIMERWHEEL_H
+#define OPENVPN_TIME_TIMERWHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class TimerWheel : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TimerWheel> Ptr;
+
+    enum {
+      TICK_SHIFT = 7,  // tick = 2^7 binary ms = 1/8 second
+      SLOT_BITS = 8,
+      N_SLOTS = 1 << SLOT_BITS,
+      SLOT_MASK = N_SLOTS - 1,
+      N_LEVELS = 4,    // covers 2^32 ticks (~17 years)
+    };
+
+    typedef std::uint64_t tick_t;
+
+  private:
+    struct Node
+    {
+      Node() : prev(this), next(this) {}
+
+      bool linked() const { return next != this; }
+
+      void unlink()
+      {
+	prev->next = next;
+	next->prev = prev;
+	prev = next = this;
+      }
+
+      // insert this node before pos
+      void link_before(Node* pos)
+      {
+	prev = pos->prev;
+	next = pos;
+	pos->prev->next = this;
+	pos->prev = this;
+      }
+
+      Node* prev;
+      Node* next;
+    };
+
+  public:
+    // A timer on a wheel; typically a member of the object whose
+    // callback it runs.  Unlinks itself on destruction.
+    class Timer : private Node
+    {
+    public:
+      typedef std::function<void()> Callback;
+
+      Timer() {}
+
+      Timer(const TimerWheel::Ptr& wheel_arg, Callback callback_arg)
+	: wheel(wheel_arg),
+	  callback(std::move(callback_arg))
+      {
+      }
+
+      Timer(const Timer&) = delete;
+      Timer& operator=(const Timer&) = delete;
+
+      ~Timer()
+      {
+	cancel();
+      }
+
+      void init(const TimerWheel::Ptr& wheel_arg, Callback callback_arg)
+      {
+	cancel();
+	wheel = wheel_arg;
+	callback = std::move(callback_arg);
+      }
+
+      // (re)arm the timer to fire at or shortly after t
+      void expires_at(const Time& t)
+      {
+	if (!wheel)
+	  return;
+	cancel();
+	if (!t.is_infinite())
+	  wheel->insert(this, t);
+      }
+
+      void cancel()
+      {
+	if (linked())
+	  {
+	    unlink();
+	    wheel->removed();
+	  }
+      }
+
+      bool pending() const { return linked(); }
+
+      const TimerWheel::Ptr& get_wheel() const { return wheel; }
+
+    private:
+      friend class TimerWheel;
+
+      TimerWheel::Ptr wheel;
+      Callback callback;
+      tick_t expiry = 0;
+    };
+
+    TimerWheel()
+      : cur(tick(Time::now()))
+    {
+    }
+
+    virtual ~TimerWheel() {}
+
+    // Fire all timers due at or before now.
+    void advance(const Time& now)
+    {
+      const Ptr self(this); // a callback may release the last reference
+      const tick_t target = tick(now);
+      if (!n_timers && target > cur)
+	cur = target;
+      while (cur < target)
+	{
+	  ++cur;
+	  if (!(cur & SLOT_MASK))
+	    cascade(1);
+
+	  // detach the slot, so that callbacks may freely
+	  // schedule, cancel or destroy any timer
+	  Node due;
+	  Node& slot = wheel[0][cur & SLOT_MASK];
+	  splice(due, slot);
+	  while (due.linked())
+	    {
+	      Timer* t = static_cast<Timer*>(due.next);
+	      t->unlink();
+	      --n_timers;
+	      if (t->callback)
+		t->callback();
+	    }
+	}
+      wakeup_ = next_expiry();
+      wakeup(wakeup_);
+    }
+
+    // Earliest time at which advance() has work to do: either a
+    // pending level-0 timer or the next cascade from a higher level.
+    Time next_expiry() const
+    {
+      if (!n_timers)
+	return Time::infinite();
+      for (tick_t t = cur + 1; ; ++t)
+	{
+	  if (wheel[0][t & SLOT_MASK].linked())
+	    return time(t);
+	  if (!(t & SLOT_MASK))
+	    {
+	      for (unsigned int l = 1; l < N_LEVELS; ++l)
+		for (const auto& slot : wheel[l])
+		  if (slot.linked())
+		    return time(t);
+	      return Time::infinite();
+	    }
+	}
+    }
+
+    // number of pending timers
+    size_t size() const
+    {
+      return n_timers;
+    }
+
+  protected:
+    // Called when the time of the next required advance() call moves
+    // earlier, after advance(), and when the wheel becomes empty; t
+    // may be infinite.
+    virtual void wakeup(const Time& t) {}
+
+  private:
+    static tick_t tick(const Time& t)
+    {
+      return tick_t(t.raw()) >> TICK_SHIFT;
+    }
+
+    // first time at which tick t has been reached
+    static Time time(const tick_t t)
+    {
+      return Time::zero() + Time::Duration::binary_ms(t << TICK_SHIFT);
+    }
+
+    void insert(Timer* timer, const Time& t)
+    {
+      // round up, so that timers never fire early
+      tick_t e = (tick_t(t.raw()) + (tick_t(1) << TICK_SHIFT) - 1) >> TICK_SHIFT;
+      if (e <= cur)
+	e = cur + 1;
+      timer->expiry = e;
+      place(timer);
+      ++n_timers;
+      if (time(e) < wakeup_)
+	{
+	  wakeup_ = time(e);
+	  wakeup(wakeup_);
+	}
+    }
+
+    // let the driver go idle once the last timer is cancelled
+    void removed()
+    {
+      if (!--n_timers && !wakeup_.is_infinite())
+	{
+	  wakeup_ = Time::infinite();
+	  wakeup(wakeup_);
+	}
+    }
+
+    // Link timer into the lowest level whose current revolution, as
+    // seen from cur, still reaches its expiry.  The slot at level l is
+    // cascaded down once cur enters it.
+    void place(Timer* timer)
+    {
+      const tick_t e = std::max(timer->expiry, cur);
+      unsigned int l = 0;
+      tick_t idx = e;
+      while ((idx - (cur >> (SLOT_BITS * l))) >= N_SLOTS)
+	{
+	  if (l == N_LEVELS - 1)
+	    {
+	      // beyond range, park in the last slot to be visited
+	      idx = (cur >> (SLOT_BITS * l)) + SLOT_MASK;
+	      break;
+	    }
+	  idx = e >> (SLOT_BITS * ++l);
+	}
+      timer->link_before(&wheel[l][idx & SLOT_MASK]);
+    }
+
+    // move the timers of the current slot of level l down
+    void cascade(const unsigned int l)
+    {
+      if (l >= N_LEVELS)
+	return;
+      const tick_t idx = cur >> (SLOT_BITS * l);
+      if (!(idx & SLOT_MASK))
+	cascade(l + 1);
+      Node tmp;
+      splice(tmp, wheel[l][idx & SLOT_MASK]);
+      while (tmp.linked())
+	{
+	  Timer* t = static_cast<Timer*>(tmp.next);
+	  t->unlink();
+	  place(t);
+	}
+    }
+
+    // move all nodes of list from into the empty list to
+    static void splice(Node& to, Node& from)
+    {
+      if (!from.linked())
+	return;
+      to.next = from.next;
+      to.prev = from.prev;
+      to.next->prev = &to;
+      to.prev->next = &to;
+      from.prev = from.next = &from;
+    }
+
+    Node wheel[N_LEVELS][N_SLOTS];
+    tick_t cur;                        // last tick processed
+    size_t n_timers = 0;
+    Time wakeup_ = Time::infinite();   // last time passed to wakeup()
+  };
+
+}
+
+#endif
@@ -27,6 +27,7 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <cstdio>
 #include <algorithm>                  // for std::min
 #include <memory>
 
@@ -45,6 +46,7 @@
 #include <openvpn/transport/tcplink.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/transport/protectpool.hpp>
 #include <openvpn/transport/protocol.hpp>
 #include <openvpn/http/reply.hpp>
 #include <openvpn/http/status.hpp>
@@ -75,13 +77,18 @@ namespace openvpn {
 
       typedef RCPtr<Options> Ptr;
 
-      Options() : allow_cleartext_auth(false) {}
+      Options() : allow_cleartext_auth(false), optimistic_send(false) {}
 
       RemoteList::Ptr proxy_server;
       std::string username;
       std::string password;
       bool allow_cleartext_auth;
 
+      // Once a CONNECT through this proxy has succeeded, send the
+      // first OpenVPN packets right behind the next CONNECT instead
+      // of waiting for its reply.
+      bool optimistic_send;
+
       std::string http_version;
       std::string user_agent;
 
@@ -156,6 +163,11 @@ namespace openvpn {
 			user_agent = o.get(2, 256);
 			o.touch();
 		      }
+		    else if (type == "OPTIMISTIC-SEND")
+		      {
+			optimistic_send = true;
+			o.touch();
+		      }
 		    else if (type == "EXT1" || type == "EXT2" || type == "CUSTOM-HEADER")
 		      {
 			CustomHeader::Ptr h(new CustomHeader());
@@ -190,9 +202,48 @@ namespace openvpn {
       DigestFactory::Ptr digest_factory; // needed by proxy auth methods
 
       SocketProtect* socket_protect;
+      ProtectedSocketPool::Ptr protect_pool; // sockets protected ahead of time, optional
 
       bool skip_html;
 
+      // Proxy state kept across reconnects, so that the next CONNECT
+      // can carry credentials up front instead of costing a 407
+      // round trip and a new TCP connection.  NTLM is bound to the
+      // connection, so only the method is remembered and the next
+      // CONNECT starts with the phase 1 message.
+      struct ProxyCache
+      {
+	enum Method {
+	  NONE,
+	  BASIC,
+	  DIGEST,
+	  NTLM,
+	};
+
+	// forget everything learned about another proxy
+	void bind(const std::string& proxy_arg)
+	{
+	  if (proxy_arg != proxy)
+	    {
+	      *this = ProxyCache();
+	      proxy = proxy_arg;
+	    }
+	}
+
+	std::string proxy;      // host:port of the proxy the state belongs to
+	Method method = NONE;   // auth method the proxy asked for last time
+	bool connect_ok = false; // the last CONNECT succeeded
+
+	// last Digest challenge, reused with an incrementing nonce count
+	std::string realm;
+	std::string nonce;
+	std::string algorithm;
+	std::string opaque;
+	unsigned int nonce_count = 0;
+      };
+
+      ProxyCache proxy_cache;
+
       static Ptr new_obj()
       {
 	return new ClientConfig;
@@ -344,6 +395,7 @@ namespace openvpn {
 	   halt(false),
 	   n_transactions(0),
 	   proxy_established(false),
+	   optimistic(false),
 	   http_reply_status(HTTP::ReplyParser::pending),
 	   ntlm_phase_2_response_pending(false),
 	   drain_content_length(0)
@@ -414,7 +466,7 @@ namespace openvpn {
 
       void tcp_write_queue_needs_send() // called by LinkImpl
       {
-	if (proxy_established)
+	if (proxy_established || optimistic)
 	  parent->transport_needs_send();
       }
 
@@ -459,14 +511,24 @@ namespace openvpn {
 			// we are connected, switch socket to tunnel mode
 			if (http_reply.status_code == HTTP::Status::Connected)
 			  {
+			    config->proxy_cache.connect_ok = true;
 			    if (config->skip_html)
 			      {
-				proxy_half_connected();
+				proxy_half_connected(!optimistic);
 				html_skip.reset(new HTTP::HTMLSkip());
 				drain_html(buf);
 			      }
 			    else
-			      proxy_connected(buf, true);
+			      proxy_connected(buf, !optimistic);
+			  }
+			else if (optimistic)
+			  {
+			    // our packets already went to the proxy, so
+			    // start over on a new connection without
+			    // optimistic send
+			    config->proxy_cache.connect_ok = false;
+			    proxy_error(Error::UNDEF, "HTTP proxy status code " + std::to_string(http_reply.status_code) + " after optimistic send");
+			    return;
 			  }
 			else if (ntlm_phase_2_response_pending)
 			  ntlm_auth_phase_2_pre();
@@ -526,12 +588,13 @@ namespace openvpn {
       // raw mode as we search the input stream for the end of the
       // extraneous HTML.  When we reach the beginning of payload data,
       // proxy_connected() should be called with notify_parent == false.
-      void proxy_half_connected()
+      void proxy_half_connected(const bool notify_parent)
       {
 	proxy_established = true;
 	if (parent->transport_is_openvpn_protocol())
 	  impl->set_raw_mode_write(false);
-	parent->transport_connecting();
+	if (notify_parent)
+	  parent->transport_connecting();
       }
 
       void drain_html(BufferAllocated& buf)
@@ -572,6 +635,13 @@ namespace openvpn {
 
       void proxy_eof_handler()
       {
+	if (optimistic)
+	  {
+	    config->proxy_cache.connect_ok = false;
+	    proxy_error(Error::UNDEF, "HTTP proxy closed the connection after optimistic send");
+	    return;
+	  }
+
 	if (http_reply_status == HTTP::ReplyParser::success)
 	  {
 	    if (http_reply.status_code == HTTP::Status::ProxyAuthenticationRequired)
@@ -620,6 +690,7 @@ namespace openvpn {
 		  }
 		else
 		  {
+		    config->proxy_cache = ClientConfig::ProxyCache();
 		    proxy_error(Error::PROXY_NEED_CREDS, "HTTP proxy credentials were not accepted");
 		    return;
 		  }
@@ -648,14 +719,20 @@ namespace openvpn {
       {
 	OPENVPN_LOG("Proxy method: Basic" << std::endl << pa.to_string());
 
+	config->proxy_cache.method = ClientConfig::ProxyCache::BASIC;
+	http_request = basic_auth_request();
+	reset();
+	start_connect_();
+      }
+
+      std::string basic_auth_request()
+      {
 	std::ostringstream os;
 	gen_headers(os);
 	os << "Proxy-Authorization: Basic "
 	   << base64->encode(config->http_proxy_options->username + ':' + config->http_proxy_options->password)
 	   << "\r\n";
-	http_request = os.str();
-	reset();
-	start_connect_();
+	return os.str();
       }
 
       void digest_auth(HTTPProxy::ProxyAuthenticate& pa)
@@ -663,57 +740,16 @@ namespace openvpn {
 	try {
 	  OPENVPN_LOG("Proxy method: Digest" << std::endl << pa.to_string());
 
-	  // constants
-	  const std::string http_method = "CONNECT";
-	  const std::string nonce_count = "00000001";
-	  const std::string qop = "auth";
-
-	  // get values from Proxy-Authenticate header
-	  const std::string realm = pa.parms.get_value("realm");
-	  const std::string nonce = pa.parms.get_value("nonce");
-	  const std::string algorithm = pa.parms.get_value("algorithm");
-	  const std::string opaque = pa.parms.get_value("opaque");
-
-	  // generate a client nonce
-	  unsigned char cnonce_raw[8];
-	  config->rng->assert_crypto();
-	  config->rng->rand_bytes(cnonce_raw, sizeof(cnonce_raw));
-	  const std::string cnonce = render_hex(cnonce_raw, sizeof(cnonce_raw));
-
-	  // build URI
-	  const std::string uri = server_host + ":" + server_port;
-
-	  // calculate session key
-	  const std::string session_key = HTTPProxy::Digest::calcHA1(
-	      *config->digest_factory,
-	      algorithm,
-	      config->http_proxy_options->username,
-	      realm,
-	      config->http_proxy_options->password,
-	      nonce,
-	      cnonce);
-
-	  // calculate response
-	  const std::string response = HTTPProxy::Digest::calcResponse(
-	      *config->digest_factory,
-	      session_key,
-	      nonce,
-	      nonce_count,
-	      cnonce,
-	      qop,
-	      http_method,
-	      uri,
-	      "");
-
-	  // generate proxy request
-	  std::ostringstream os;
-	  gen_headers(os);
-	  os << "Proxy-Authorization: Digest username=\"" << config->http_proxy_options->username << "\", realm=\"" << realm << "\", nonce=\"" << nonce << "\", uri=\"" << uri << "\", qop=" << qop << ", nc=" << nonce_count << ", cnonce=\"" << cnonce << "\", response=\"" << response << "\"";
-	  if (!opaque.empty())
-	    os << ", opaque=\"" + opaque + "\"";
-	  os << "\r\n";
+	  // save the challenge, later connections reuse it
+	  ClientConfig::ProxyCache& cache = config->proxy_cache;
+	  cache.method = ClientConfig::ProxyCache::DIGEST;
+	  cache.realm = pa.parms.get_value("realm");
+	  cache.nonce = pa.parms.get_value("nonce");
+	  cache.algorithm = pa.parms.get_value("algorithm");
+	  cache.opaque = pa.parms.get_value("opaque");
+	  cache.nonce_count = 0;
 
-	  http_request = os.str();
+	  http_request = digest_auth_request();
 	  reset();
 	  start_connect_();
 	}
@@ -723,6 +759,65 @@ namespace openvpn {
 	  }
       }
 
+      // answer the cached Digest challenge
+      std::string digest_auth_request()
+      {
+	ClientConfig::ProxyCache& cache = config->proxy_cache;
+
+	// constants
+	const std::string http_method = "CONNECT";
+	const std::string qop = "auth";
+
+	const std::string& realm = cache.realm;
+	const std::string& nonce = cache.nonce;
+	const std::string& algorithm = cache.algorithm;
+	const std::string& opaque = cache.opaque;
+
+	// the server rejects a nonce count it has seen before
+	char nonce_count[9];
+	std::snprintf(nonce_count, sizeof(nonce_count), "%08x", ++cache.nonce_count);
+
+	// generate a client nonce
+	unsigned char cnonce_raw[8];
+	config->rng->assert_crypto();
+	config->rng->rand_bytes(cnonce_raw, sizeof(cnonce_raw));
+	const std::string cnonce = render_hex(cnonce_raw, sizeof(cnonce_raw));
+
+	// build URI
+	const std::string uri = server_host + ":" + server_port;
+
+	// calculate session key
+	const std::string session_key = HTTPProxy::Digest::calcHA1(
+	    *config->digest_factory,
+	    algorithm,
+	    config->http_proxy_options->username,
+	    realm,
+	    config->http_proxy_options->password,
+	    nonce,
+	    cnonce);
+
+	// calculate response
+	const std::string response = HTTPProxy::Digest::calcResponse(
+	    *config->digest_factory,
+	    session_key,
+	    nonce,
+	    nonce_count,
+	    cnonce,
+	    qop,
+	    http_method,
+	    uri,
+	    "");
+
+	// generate proxy request
+	std::ostringstream os;
+	gen_headers(os);
+	os << "Proxy-Authorization: Digest username=\"" << config->http_proxy_options->username << "\", realm=\"" << realm << "\", nonce=\"" << nonce << "\", uri=\"" << uri << "\", qop=" << qop << ", nc=" << nonce_count << ", cnonce=\"" << cnonce << "\", response=\"" << response << "\"";
+	if (!opaque.empty())
+	  os << ", opaque=\"" + opaque + "\"";
+	os << "\r\n";
+	return os.str();
+      }
+
       std::string get_ntlm_phase_2_response()
       {
 	for (HTTP::HeaderList::const_iterator i = http_reply.headers.begin(); i != http_reply.headers.end(); ++i)
@@ -742,17 +837,48 @@ namespace openvpn {
       {
 	OPENVPN_LOG("Proxy method: NTLM" << std::endl << pa.to_string());
 
+	config->proxy_cache.method = ClientConfig::ProxyCache::NTLM;
+	http_request = ntlm_auth_phase_1_request();
+	reset();
+	ntlm_phase_2_response_pending = true;
+	start_connect_();
+      }
+
+      std::string ntlm_auth_phase_1_request()
+      {
 	const std::string phase_1_reply = HTTPProxy::NTLM::phase_1();
 
 	std::ostringstream os;
 	gen_headers(os);
 	os << "Proxy-Connection: Keep-Alive\r\n";
 	os << "Proxy-Authorization: NTLM " << phase_1_reply << "\r\n";
+	return os.str();
+      }
 
-	http_request = os.str();
-	reset();
-	ntlm_phase_2_response_pending = true;
-	start_connect_();
+      // Start the first CONNECT of a connection with the credentials
+      // of the method the proxy asked for last time.
+      void preemptive_auth()
+      {
+	ClientConfig::ProxyCache& cache = config->proxy_cache;
+	cache.bind(proxy_host + ':' + proxy_port);
+	if (!http_request.empty() || config->http_proxy_options->username.empty())
+	  return;
+	switch (cache.method)
+	  {
+	  case ClientConfig::ProxyCache::BASIC:
+	    if (config->http_proxy_options->allow_cleartext_auth)
+	      http_request = basic_auth_request();
+	    break;
+	  case ClientConfig::ProxyCache::DIGEST:
+	    http_request = digest_auth_request();
+	    break;
+	  case ClientConfig::ProxyCache::NTLM:
+	    http_request = ntlm_auth_phase_1_request();
+	    ntlm_phase_2_response_pending = true;
+	    break;
+	  default:
+	    break;
+	  }
       }
 
       void ntlm_auth_phase_2_pre()
@@ -891,6 +1017,7 @@ namespace openvpn {
 	halt = false;
 	proxy_response_limit.reset();
 	proxy_established = false;
+	optimistic = false;
 	reset_partial();
       }
 
@@ -910,9 +1037,11 @@ namespace openvpn {
 	proxy_remote_list().get_endpoint(server_endpoint);
 	OPENVPN_LOG("Contacting " << server_endpoint << " via HTTP Proxy");
 	parent->transport_wait_proxy();
-	socket.open(server_endpoint.protocol());
+	const bool pre_protected = config->protect_pool && config->protect_pool->assign(socket, server_endpoint.protocol());
+	if (!pre_protected)
+	  socket.open(server_endpoint.protocol());
 
-	if (config->socket_protect)
+	if (config->socket_protect && !pre_protected)
 	  {
 	    if (!config->socket_protect->socket_protect(socket.native_handle(), server_endpoint_addr()))
 	      {
@@ -950,7 +1079,27 @@ namespace openvpn {
 		++n_transactions;
 
 		// tell proxy to connect through to OpenVPN server
+		try {
+		  preemptive_auth();
+		}
+		catch (const std::exception& e)
+		  {
+		    proxy_error(Error::PROXY_NEED_CREDS, std::string("HTTP proxy auth: ") + e.what());
+		    return;
+		  }
 		http_proxy_send();
+
+		// the proxy took our last CONNECT, so don't wait for
+		// the reply before the OpenVPN packets follow
+		if (config->http_proxy_options->optimistic_send
+		    && config->proxy_cache.connect_ok
+		    && !ntlm_phase_2_response_pending
+		    && parent->transport_is_openvpn_protocol())
+		  {
+		    optimistic = true;
+		    impl->set_raw_mode_write(false);
+		    parent->transport_connecting();
+		  }
 	      }
 	    else
 	      {
@@ -1016,6 +1165,7 @@ namespace openvpn {
       unsigned int n_transactions;
       ProxyResponseLimit proxy_response_limit;
       bool proxy_established;
+      bool optimistic; // OpenVPN packets sent before the CONNECT reply
       HTTP::ReplyParser::status http_reply_status;
       HTTP::Reply http_reply;
       HTTP::ReplyParser http_parser;
@@ -0,0 +1,415 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Multipath transport object for client: one session over several
+// transports to the same server, e.g. UDP sockets bound to different
+// uplinks, scheduled by MultipathScheduler.
+
+#ifndef OPENVPN_TRANSPORT_CLIENT_MPCLI_H
+#define OPENVPN_TRANSPORT_CLIENT_MPCLI_H
+
+#include <vector>
+#include <memory>
+#include <sstream>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/transport/multipath.hpp>
+#include <openvpn/transport/client/transbase.hpp>
+
+namespace openvpn {
+  namespace MultipathTransport {
+
+    class ClientConfig : public TransportClientFactory
+    {
+    public:
+      typedef RCPtr<ClientConfig> Ptr;
+
+      std::vector<TransportClientFactory::Ptr> paths; // one transport per path, all to the same server
+      Time::Duration probe_interval = Time::Duration::seconds(1);
+
+      static Ptr new_obj()
+      {
+	return new ClientConfig;
+      }
+
+      virtual TransportClient::Ptr new_transport_client_obj(openvpn_io::io_context& io_context,
+							    TransportClientParent* parent);
+
+    private:
+      ClientConfig() {}
+    };
+
+    // Data packets are spread over the paths that are up, control
+    // packets go on the best one.  The session survives as long as
+    // one path does.  Round trip times are measured with probes that
+    // the parent sends on request (see transport_send_probe()).
+    //
+    // Packets from different paths arrive out of order, which the
+    // data channel replay window absorbs; the scheduler keeps the
+    // skew down by sending where packets are expected first.
+    class Client : public TransportClient
+    {
+      typedef RCPtr<Client> Ptr;
+
+      friend class ClientConfig; // calls constructor
+
+      // parent of the transport of one path
+      class Path : public TransportClientParent
+      {
+      public:
+	Path(Client* client_arg, const size_t index_arg)
+	  : client(client_arg),
+	    index(index_arg)
+	{
+	}
+
+	TransportClient::Ptr transport;
+	bool failed = false;
+
+      private:
+	void transport_recv(BufferAllocated& buf) override
+	{
+	  client->parent->transport_recv(buf);
+	}
+
+	void transport_recv_tos(BufferAllocated& buf, const unsigned int tos) override
+	{
+	  client->parent->transport_recv_tos(buf, tos);
+	}
+
+	void transport_needs_send() override
+	{
+	  client->parent->transport_needs_send();
+	}
+
+	void transport_recv_burst_begin() override
+	{
+	  client->parent->transport_recv_burst_begin();
+	}
+
+	void transport_recv_burst_end() override
+	{
+	  client->parent->transport_recv_burst_end();
+	}
+
+	void transport_error(const Error::Type fatal_err, const std::string& err_text) override
+	{
+	  client->path_error(index, fatal_err, err_text, false);
+	}
+
+	void proxy_error(const Error::Type fatal_err, const std::string& err_text) override
+	{
+	  client->path_error(index, fatal_err, err_text, true);
+	}
+
+	bool transport_is_openvpn_protocol() override
+	{
+	  return client->parent->transport_is_openvpn_protocol();
+	}
+
+	// progress notifications are passed on for the first path
+	// to get there
+	void transport_pre_resolve() override
+	{
+	  if (client->progress(PRE_RESOLVE))
+	    client->parent->transport_pre_resolve();
+	}
+
+	void transport_wait_proxy() override
+	{
+	  if (client->progress(WAIT_PROXY))
+	    client->parent->transport_wait_proxy();
+	}
+
+	void transport_wait() override
+	{
+	  if (client->progress(WAIT))
+	    client->parent->transport_wait();
+	}
+
+	void transport_connecting() override
+	{
+	  client->path_connected(index);
+	}
+
+	bool is_keepalive_enabled() const override
+	{
+	  return client->parent->is_keepalive_enabled();
+	}
+
+	void disable_keepalive(unsigned int& keepalive_ping,
+			       unsigned int& keepalive_timeout) override
+	{
+	  client->parent->disable_keepalive(keepalive_ping, keepalive_timeout);
+	}
+
+	Client* client;
+	const size_t index;
+      };
+
+      enum Progress {
+	PRE_RESOLVE = 1,
+	WAIT_PROXY,
+	WAIT,
+	CONNECTING,
+      };
+
+    public:
+      void transport_start() override
+      {
+	if (paths.empty())
+	  {
+	    halt = false;
+	    for (size_t i = 0; i < config->paths.size(); ++i)
+	      {
+		paths.emplace_back(new Path(this, i));
+		paths.back()->transport = config->paths[i]->new_transport_client_obj(io_context, paths.back().get());
+	      }
+	    for (auto& p : paths)
+	      {
+		if (halt)
+		  break;
+		p->transport->transport_start();
+	      }
+	  }
+      }
+
+      bool transport_send_const(const Buffer& buf) override
+      {
+	TransportClient* t = transport(probe_path >= 0 ? probe_path : sched.primary());
+	return t && t->transport_send_const(buf);
+      }
+
+      bool transport_send(BufferAllocated& buf) override
+      {
+	TransportClient* t = transport(sched.select(buf.size()));
+	return t && t->transport_send(buf);
+      }
+
+      bool transport_send_tos(BufferAllocated& buf, const unsigned int tos) override
+      {
+	TransportClient* t = transport(sched.select(buf.size()));
+	return t && t->transport_send_tos(buf, tos);
+      }
+
+      void transport_probe_reply() override
+      {
+	sched.reply(Time::now());
+	schedule_probe();
+      }
+
+      bool transport_send_queue_empty() override
+      {
+	for (auto& p : paths)
+	  if (!p->failed && !p->transport->transport_send_queue_empty())
+	    return false;
+	return true;
+      }
+
+      bool transport_has_send_queue() override
+      {
+	for (auto& p : paths)
+	  if (p->transport->transport_has_send_queue())
+	    return true;
+	return false;
+      }
+
+      void transport_stop_requeueing() override
+      {
+	for (auto& p : paths)
+	  p->transport->transport_stop_requeueing();
+      }
+
+      unsigned int transport_send_queue_size() override
+      {
+	unsigned int ret = 0;
+	for (auto& p : paths)
+	  if (!p->failed)
+	    ret = std::max(ret, p->transport->transport_send_queue_size());
+	return ret;
+      }
+
+      void reset_align_adjust(const size_t align_adjust) override
+      {
+	for (auto& p : paths)
+	  p->transport->reset_align_adjust(align_adjust);
+      }
+
+      // endpoint of the primary path
+      IP::Addr server_endpoint_addr() const override
+      {
+	const TransportClient* t = primary_transport();
+	return t ? t->server_endpoint_addr() : IP::Addr();
+      }
+
+      void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const override
+      {
+	const TransportClient* t = primary_transport();
+	if (t)
+	  t->server_endpoint_info(host, port, proto, ip_addr);
+      }
+
+      Protocol transport_protocol() const override
+      {
+	const TransportClient* t = primary_transport();
+	return t ? t->transport_protocol() : Protocol();
+      }
+
+      void transport_reparent(TransportClientParent* parent_arg) override
+      {
+	parent = parent_arg;
+      }
+
+      void stop() override { stop_(); }
+      ~Client() override { stop_(); }
+
+    private:
+      Client(openvpn_io::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     TransportClientParent* parent_arg)
+	: io_context(io_context_arg),
+	  config(config_arg),
+	  parent(parent_arg),
+	  sched(config_arg->paths.size()),
+	  probe_timer(io_context_arg)
+      {
+	sched.set_probe_interval(config->probe_interval);
+      }
+
+      TransportClient* transport(const int i) const
+      {
+	return i >= 0 ? paths[i]->transport.get() : nullptr;
+      }
+
+      const TransportClient* primary_transport() const
+      {
+	const int i = sched.primary();
+	if (i >= 0)
+	  return transport(i);
+	return paths.empty() ? nullptr : paths.front()->transport.get();
+      }
+
+      bool progress(const Progress p)
+      {
+	if (p <= progress_)
+	  return false;
+	progress_ = p;
+	return true;
+      }
+
+      void path_connected(const size_t i)
+      {
+	if (halt)
+	  return;
+	OPENVPN_LOG("Multipath: path " << i << " up");
+	sched.set_up(i, true);
+	if (progress(CONNECTING))
+	  parent->transport_connecting();
+	schedule_probe();
+      }
+
+      void path_error(const size_t i, const Error::Type fatal_err, const std::string& err_text, const bool proxy)
+      {
+	if (halt || paths[i]->failed)
+	  return;
+	OPENVPN_LOG("Multipath: path " << i << " failed: " << err_text);
+	paths[i]->failed = true;
+	paths[i]->transport->stop();
+	sched.set_up(i, false);
+	for (auto& p : paths)
+	  if (!p->failed)
+	    return;
+
+	// that was the last one
+	stop();
+	if (proxy)
+	  parent->proxy_error(fatal_err, err_text);
+	else
+	  parent->transport_error(fatal_err, err_text);
+      }
+
+      // ask the parent to send a probe on the path that is due
+      void probe()
+      {
+	const Time now = Time::now();
+	const int i = sched.probe(now);
+	if (i >= 0)
+	  {
+	    probe_path = i;
+	    const bool sent = parent->transport_send_probe();
+	    probe_path = -1;
+	    if (!sent)
+	      sched.cancel();
+	  }
+	schedule_probe();
+      }
+
+      void schedule_probe()
+      {
+	if (halt)
+	  return;
+	const Time next = sched.next_event();
+	if (next.is_infinite())
+	  return;
+	probe_timer.expires_at(next);
+	probe_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+			       {
+				 OPENVPN_ASYNC_HANDLER;
+				 if (!error && !self->halt)
+				   self->probe();
+			       });
+      }
+
+      void stop_()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    probe_timer.cancel();
+	    for (auto& p : paths)
+	      p->transport->stop();
+	  }
+      }
+
+      openvpn_io::io_context& io_context;
+      ClientConfig::Ptr config;
+      TransportClientParent* parent;
+      std::vector<std::unique_ptr<Path>> paths;
+      MultipathScheduler sched;
+      AsioTimer probe_timer;
+      int probe_path = -1; // pins transport_send_const() while a probe is sent
+      Progress progress_ = Progress(0);
+      bool halt = false;
+    };
+
+    inline TransportClient::Ptr ClientConfig::new_transport_client_obj(openvpn_io::io_context& io_context,
+								       TransportClientParent* parent)
+    {
+      return TransportClient::Ptr(new Client(io_context, this, parent));
+    }
+  }
+} // namespace openvpn
+
+#endif
@@ -23,15 +23,168 @@
 // transport client.  This is used to preserve the transport
 // socket when other client components are restarted after
 // a RELAY message is received from the server.
+//
+// A relay tier that only passes the OpenVPN traffic on can instead
+// splice the persisted transport to an egress transport with
+// new_forwarder(), see TransportRelayForwarder.
 
 #ifndef OPENVPN_TRANSPORT_CLIENT_RELAY_H
 #define OPENVPN_TRANSPORT_CLIENT_RELAY_H
 
 #include <memory>
 
+#include <openvpn/common/rc.hpp>
+#include <openvpn/log/sessionstats.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 
 namespace openvpn {
+
+  // Relay forwarding mode: after the relay handshake, move packets
+  // between an ingress and an egress transport as they are, without
+  // a ProtoContext.  A received buffer is handed to the other
+  // transport's transport_send(), so stream transports that queue
+  // the buffer take it over without a copy.  Forwarded and dropped
+  // packets are counted in SessionStats.
+  class TransportRelayForwarder : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TransportRelayForwarder> Ptr;
+
+    struct Parent
+    {
+      // One side failed and the forwarder has stopped.
+      virtual void relay_forward_error(const Error::Type fatal_err, const std::string& err_text) = 0;
+
+      virtual ~Parent() {}
+    };
+
+    TransportRelayForwarder(TransportClient::Ptr ingress_arg,
+			    TransportClient::Ptr egress_arg,
+			    SessionStats::Ptr stats_arg,
+			    Parent* parent_arg)
+      : ingress(this, std::move(ingress_arg)),
+	egress(this, std::move(egress_arg)),
+	stats(std::move(stats_arg)),
+	parent(parent_arg)
+    {
+      ingress.peer = &egress;
+      egress.peer = &ingress;
+    }
+
+    ~TransportRelayForwarder()
+    {
+      stop();
+    }
+
+    // Take both transports over.  The egress transport is started
+    // here unless egress_started, the ingress one is running.
+    void start(const bool egress_started)
+    {
+      ingress.transport->transport_reparent(&ingress);
+      egress.transport->transport_reparent(&egress);
+      if (!egress_started)
+	egress.transport->transport_start();
+    }
+
+    void stop()
+    {
+      if (!halt)
+	{
+	  halt = true;
+	  ingress.transport->stop();
+	  egress.transport->stop();
+	}
+    }
+
+    bool halted() const
+    {
+      return halt;
+    }
+
+  private:
+    class End : public TransportClientParent
+    {
+    public:
+      End(TransportRelayForwarder* fwd_arg, TransportClient::Ptr transport_arg)
+	: fwd(fwd_arg),
+	  transport(std::move(transport_arg))
+      {
+      }
+
+      TransportRelayForwarder* fwd;
+      TransportClient::Ptr transport;
+      End* peer = nullptr;
+
+    private:
+      virtual void transport_recv(BufferAllocated& buf) override
+      {
+	fwd->forward(*peer, buf, 0);
+      }
+
+      virtual void transport_recv_tos(BufferAllocated& buf, const unsigned int tos) override
+      {
+	fwd->forward(*peer, buf, tos);
+      }
+
+      virtual void transport_needs_send() override {}
+
+      virtual void transport_error(const Error::Type fatal_err, const std::string& err_text) override
+      {
+	fwd->error(fatal_err, err_text);
+      }
+
+      virtual void proxy_error(const Error::Type fatal_err, const std::string& err_text) override
+      {
+	fwd->error(fatal_err, err_text);
+      }
+
+      virtual bool transport_is_openvpn_protocol() override { return true; }
+
+      virtual void transport_pre_resolve() override {}
+      virtual void transport_wait_proxy() override {}
+      virtual void transport_wait() override {}
+      virtual void transport_connecting() override {}
+
+      // the endpoints keep their own keepalive
+      virtual bool is_keepalive_enabled() const override { return false; }
+
+      virtual void disable_keepalive(unsigned int& keepalive_ping, unsigned int& keepalive_timeout) override
+      {
+	keepalive_ping = 0;
+	keepalive_timeout = 0;
+      }
+    };
+
+    void forward(End& to, BufferAllocated& buf, const unsigned int tos)
+    {
+      if (halt)
+	return;
+      const size_t size = buf.size();
+      const bool sent = tos ? to.transport->transport_send_tos(buf, tos) : to.transport->transport_send(buf);
+      if (sent)
+	{
+	  stats->inc_stat(SessionStats::RELAY_BYTES, size);
+	  stats->inc_stat(SessionStats::RELAY_PACKETS, 1);
+	}
+      else
+	stats->inc_stat(SessionStats::RELAY_DROPS, 1);
+    }
+
+    void error(const Error::Type fatal_err, const std::string& err_text)
+    {
+      if (halt)
+	return;
+      stop();
+      if (parent)
+	parent->relay_forward_error(fatal_err, err_text);
+    }
+
+    End ingress;
+    End egress;
+    SessionStats::Ptr stats;
+    Parent* parent;
+    bool halt = false;
+  };
   class TransportRelayFactory : public TransportClientFactory
   {
   public:
@@ -94,6 +247,16 @@ namespace openvpn {
       std::string ip_addr_;
     };
 
+    // Relay forwarding mode: splice the persisted transport to egress
+    // instead of handing it to new client components.  Call start()
+    // on the returned forwarder.
+    TransportRelayForwarder::Ptr new_forwarder(TransportClient::Ptr egress,
+					       SessionStats::Ptr stats,
+					       TransportRelayForwarder::Parent* parent)
+    {
+      return new TransportRelayForwarder(transport_, std::move(egress), std::move(stats), parent);
+    }
+
   private:
     class NullParent : public TransportClientParent
     {
@@ -33,7 +33,9 @@
 #include <openvpn/transport/tlslink.hpp>
 #endif
 #include <openvpn/transport/client/transbase.hpp>
+#include <openvpn/common/sockopt.hpp>
 #include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/transport/protectpool.hpp>
 #include <openvpn/client/remotelist.hpp>
 
 namespace openvpn {
@@ -46,10 +48,13 @@ namespace openvpn {
 
       RemoteList::Ptr remote_list;
       size_t free_list_max_size;
+      unsigned int notsent_lowat; // TCP_NOTSENT_LOWAT in bytes, 0 to keep the system default
+      SendPriority send_priority; // control and small packets ahead of bulk data
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
       SocketProtect* socket_protect;
+      ProtectedSocketPool::Ptr protect_pool; // sockets protected ahead of time, optional
 
 #ifdef OPENVPN_TLS_LINK
       bool use_tls = false;
@@ -71,6 +76,7 @@ namespace openvpn {
     private:
       ClientConfig()
 	: free_list_max_size(8),
+	  notsent_lowat(0),
 	  socket_protect(nullptr)
       {}
     };
@@ -198,7 +204,7 @@ namespace openvpn {
 	if (impl)
 	  {
 	    BufferAllocated buf(cbuf, 0);
-	    return impl->send(buf);
+	    return impl->send(buf, SEND_CONTROL);
 	  }
 	else
 	  return false;
@@ -281,9 +287,11 @@ namespace openvpn {
 	OPENVPN_LOG("Contacting " << server_endpoint << " via "
 		    << server_protocol.str());
 	parent->transport_wait();
-	socket.open(server_endpoint.protocol());
+	const bool pre_protected = config->protect_pool && config->protect_pool->assign(socket, server_endpoint.protocol());
+	if (!pre_protected)
+	  socket.open(server_endpoint.protocol());
 
-	if (config->socket_protect)
+	if (config->socket_protect && !pre_protected)
 	  {
 	    if (!config->socket_protect->socket_protect(socket.native_handle(), server_endpoint_addr()))
 	      {
@@ -295,6 +303,10 @@ namespace openvpn {
 	  }
 
 	socket.set_option(openvpn_io::ip::tcp::no_delay(true));
+#ifdef TCP_NOTSENT_LOWAT
+	if (config->notsent_lowat)
+	  SockOpt::tcp_notsent_lowat(socket.native_handle(), config->notsent_lowat);
+#endif
 	socket.async_connect(server_endpoint, [self=Ptr(this)](const openvpn_io::error_code& error)
                                               {
                                                 OPENVPN_ASYNC_HANDLER;
@@ -353,6 +365,7 @@ namespace openvpn {
 #ifdef OPENVPN_GREMLIN
 		impl->gremlin_config(config->gremlin_config);
 #endif
+		impl->set_send_priority(config->send_priority);
 		impl->start();
 		if (!parent->transport_is_openvpn_protocol())
 		  impl->set_raw_mode(true);
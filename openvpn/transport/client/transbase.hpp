@@ -49,6 +49,18 @@ namespace openvpn {
     virtual void stop() = 0;
     virtual bool transport_send_const(const Buffer& buf) = 0;
     virtual bool transport_send(BufferAllocated& buf) = 0;
+
+    // Send with the given TOS/traffic class byte on the outer packet,
+    // on transports that support it (see ECN::encap()).
+    virtual bool transport_send_tos(BufferAllocated& buf, const unsigned int tos)
+    {
+      return transport_send(buf);
+    }
+
+    // Notification that the peer answered the probe last sent by
+    // TransportClientParent::transport_send_probe().
+    virtual void transport_probe_reply() {}
+
     virtual bool transport_send_queue_empty() = 0;
     virtual bool transport_has_send_queue() = 0;
     virtual void transport_stop_requeueing() = 0;
@@ -66,7 +78,27 @@ namespace openvpn {
   struct TransportClientParent
   {
     virtual void transport_recv(BufferAllocated& buf) = 0;
+
+    // Like transport_recv(), with the TOS/traffic class byte of the
+    // outer packet, from transports that report it.
+    virtual void transport_recv_tos(BufferAllocated& buf, const unsigned int tos)
+    {
+      transport_recv(buf);
+    }
+
     virtual void transport_needs_send() = 0; // notification that send queue is empty
+
+    // Send a small packet that the peer answers right away, for
+    // transports that measure their paths (see MultipathScheduler).
+    // The answer is reported to TransportClient::transport_probe_reply().
+    // Returns false if no probe could be sent.
+    virtual bool transport_send_probe() { return false; }
+
+    // Optional notifications bracketing a burst of transport_recv
+    // calls (e.g. from a single recvmmsg() call), allowing the
+    // parent to defer and batch work until the burst is complete.
+    virtual void transport_recv_burst_begin() {}
+    virtual void transport_recv_burst_end() {}
     virtual void transport_error(const Error::Type fatal_err, const std::string& err_text) = 0;
     virtual void proxy_error(const Error::Type fatal_err, const std::string& err_text) = 0;
 
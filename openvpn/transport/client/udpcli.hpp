@@ -30,10 +30,14 @@
 
 #include <openvpn/common/bigmutex.hpp>
 #include <openvpn/common/likely.hpp>
+#include <openvpn/common/options.hpp>
 #include <openvpn/common/platform.hpp>
+#include <openvpn/common/threadpolicy.hpp>
 #include <openvpn/transport/udplink.hpp>
+#include <openvpn/transport/uringlink.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/transport/protectpool.hpp>
 #include <openvpn/client/remotelist.hpp>
 
 namespace openvpn {
@@ -44,14 +48,48 @@ namespace openvpn {
     public:
       typedef RCPtr<ClientConfig> Ptr;
 
+      // recvmmsg()/sendmmsg() batching of the UDP link, from the profile
+      struct Batching
+      {
+	// udp-recv-batch <n>  -- max datagrams per recvmmsg() call, 0 to disable (default 16)
+	// udp-send-batch <n>  -- max datagrams per sendmmsg() flush, 0 to disable (default)
+	// udp-gso             -- coalesce batched sends into UDP_SEGMENT super-packets
+	void load(const OptionList& opt)
+	{
+	  recv_batch = opt.get_num<unsigned int>("udp-recv-batch", 1, recv_batch, 0, 1024);
+	  send_batch = opt.get_num<unsigned int>("udp-send-batch", 1, send_batch, 0, 1024);
+	  send_gso = opt.exists("udp-gso");
+	}
+
+	unsigned int recv_batch = 16;
+	unsigned int send_batch = 0;
+	bool send_gso = false;
+      };
+
+      void set_batching(const Batching& b)
+      {
+	recv_batch = b.recv_batch;
+	send_batch = b.send_batch;
+	send_gso = b.send_gso;
+      }
+
       RemoteList::Ptr remote_list;
       bool server_addr_float;
       bool synchronous_dns_lookup;
       int n_parallel;
+      unsigned int recv_batch;   // max datagrams per recvmmsg() call, 0 to disable batching
+      unsigned int send_batch;   // max datagrams per sendmmsg() flush, 0 to disable batching
+      bool send_gso;             // coalesce batched sends into UDP_SEGMENT super-packets
+      bool io_uring;             // use io_uring (UringLink) where supported, else fall back to Link
+      bool tos;                  // send and report outer TOS/traffic class per packet (Link only)
+      int buffer_max;            // count socket buffer drops and grow the buffers up to this size (Link only), 0 to disable
+      std::string local_addr;    // bind to this local address before connecting, if not empty
+      ThreadPolicy thread_policy; // busy polling of the socket
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
       SocketProtect* socket_protect;
+      ProtectedSocketPool::Ptr protect_pool; // sockets protected ahead of time, optional
 
 #ifdef OPENVPN_GREMLIN
       Gremlin::Config::Ptr gremlin_config;
@@ -70,6 +108,12 @@ namespace openvpn {
 	: server_addr_float(false),
 	  synchronous_dns_lookup(false),
 	  n_parallel(8),
+	  recv_batch(0),
+	  send_batch(0),
+	  send_gso(false),
+	  io_uring(false),
+	  tos(false),
+	  buffer_max(0),
 	  socket_protect(nullptr)
       {}
     };
@@ -82,6 +126,10 @@ namespace openvpn {
       friend class Link<Client*>; // calls udp_read_handler
 
       typedef Link<Client*> LinkImpl;
+#ifdef OPENVPN_UDPLINK_URING
+      friend class UringLink<Client*>; // calls udp_read_handler
+      typedef UringLink<Client*> UringLinkImpl;
+#endif
 
     public:
       void transport_start() override
@@ -121,6 +169,11 @@ namespace openvpn {
 	return send(buf);
       }
 
+      bool transport_send_tos(BufferAllocated& buf, const unsigned int tos) override
+      {
+	return send(buf, tos);
+      }
+
       bool transport_send_queue_empty() override // really only has meaning for TCP
       {
 	return false;
@@ -142,6 +195,10 @@ namespace openvpn {
       {
 	if (impl)
 	  impl->reset_align_adjust(align_adjust);
+#ifdef OPENVPN_UDPLINK_URING
+	if (uring)
+	  uring->reset_align_adjust(align_adjust);
+#endif
       }
 
       void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const override
@@ -190,11 +247,15 @@ namespace openvpn {
 	parent = parent_arg;
       }
 
-      bool send(const Buffer& buf)
+      bool send(const Buffer& buf, const unsigned int tos = 0)
       {
+#ifdef OPENVPN_UDPLINK_URING
+	if (uring)
+	  return !uring->send(buf, nullptr);
+#endif
 	if (impl)
 	  {
-	    const int err = impl->send(buf, nullptr);
+	    const int err = impl->send(buf, nullptr, tos);
 	    if (unlikely(err))
 	      {
 		// While UDP errors are generally ignored, certain
@@ -215,10 +276,25 @@ namespace openvpn {
 	  return false;
       }
 
+      void udp_read_burst_begin() // called by LinkImpl
+      {
+	parent->transport_recv_burst_begin();
+      }
+
+      void udp_read_burst_end() // called by LinkImpl
+      {
+	parent->transport_recv_burst_end();
+      }
+
       void udp_read_handler(PacketFrom::SPtr& pfp) // called by LinkImpl
       {
 	if (config->server_addr_float || pfp->sender_endpoint == server_endpoint)
-	  parent->transport_recv(pfp->buf);
+	  {
+	    if (config->tos)
+	      parent->transport_recv_tos(pfp->buf, pfp->tos);
+	    else
+	      parent->transport_recv(pfp->buf);
+	  }
 	else
 	  config->stats->error(Error::BAD_SRC_ADDR);
       }
@@ -230,6 +306,10 @@ namespace openvpn {
 	    halt = true;
 	    if (impl)
 	      impl->stop();
+#ifdef OPENVPN_UDPLINK_URING
+	    if (uring)
+	      uring->stop();
+#endif
 	    socket.close();
 	    resolver.cancel();
 	    async_resolve_cancel();
@@ -265,9 +345,26 @@ namespace openvpn {
 	config->remote_list->get_endpoint(server_endpoint);
 	OPENVPN_LOG("Contacting " << server_endpoint << " via UDP");
 	parent->transport_wait();
-	socket.open(server_endpoint.protocol());
+	const bool pre_protected = config->protect_pool && config->protect_pool->assign(socket, server_endpoint.protocol());
+	if (!pre_protected)
+	  socket.open(server_endpoint.protocol());
 
-	if (config->socket_protect)
+	if (!config->local_addr.empty())
+	  {
+	    openvpn_io::error_code error;
+	    socket.bind(openvpn_io::ip::udp::endpoint(IP::Addr(config->local_addr).to_asio(), 0), error);
+	    if (error)
+	      {
+		std::ostringstream os;
+		os << "UDP bind error on local address " << config->local_addr << ": " << error.message();
+		config->stats->error(Error::UDP_CONNECT_ERROR);
+		stop();
+		parent->transport_error(Error::UNDEF, os.str());
+		return;
+	      }
+	  }
+
+	if (config->socket_protect && !pre_protected)
 	  {
 	    if (!config->socket_protect->socket_protect(socket.native_handle(), server_endpoint_addr()))
 	      {
@@ -278,6 +375,14 @@ namespace openvpn {
 	      }
 	  }
 
+	try {
+	  config->thread_policy.apply_socket(socket.native_handle());
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("UDP busy poll: " << e.what());
+	  }
+
 	socket.async_connect(server_endpoint, [self=Ptr(this)](const openvpn_io::error_code& error)
                                               {
                                                 OPENVPN_ASYNC_HANDLER;
@@ -292,6 +397,13 @@ namespace openvpn {
 	  {
 	    if (!error)
 	      {
+#ifdef OPENVPN_UDPLINK_URING
+		if (config->io_uring && start_uring_())
+		  {
+		    parent->transport_connecting();
+		    return;
+		  }
+#endif
 		impl.reset(new LinkImpl(this,
 					socket,
 					(*config->frame)[Frame::READ_LINK_UDP],
@@ -299,7 +411,14 @@ namespace openvpn {
 #ifdef OPENVPN_GREMLIN
 		impl->gremlin_config(config->gremlin_config);
 #endif
-		impl->start(config->n_parallel);
+#ifdef OPENVPN_UDPLINK_MMSG
+		impl->set_send_batch(config->send_batch, config->send_gso);
+		if (config->tos)
+		  impl->enable_tos(true);
+		if (config->buffer_max)
+		  impl->enable_buffer_autotune(config->buffer_max);
+#endif
+		impl->start(config->n_parallel, config->recv_batch);
 		parent->transport_connecting();
 	      }
 	    else
@@ -313,6 +432,26 @@ namespace openvpn {
 	  }
       }
 
+#ifdef OPENVPN_UDPLINK_URING
+      bool start_uring_()
+      {
+	try {
+	  uring.reset(new UringLinkImpl(this,
+					socket,
+					(*config->frame)[Frame::READ_LINK_UDP],
+					config->stats));
+	  uring->start(config->recv_batch);
+	  return true;
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("UDP io_uring unavailable, falling back to asio: " << e.what());
+	    uring.reset();
+	    return false;
+	  }
+      }
+#endif
+
       std::string server_host;
       std::string server_port;
 
@@ -320,6 +459,9 @@ namespace openvpn {
       ClientConfig::Ptr config;
       TransportClientParent* parent;
       LinkImpl::Ptr impl;
+#ifdef OPENVPN_UDPLINK_URING
+      UringLinkImpl::Ptr uring;
+#endif
       openvpn_io::ip::udp::resolver resolver;
       UDPTransport::AsioEndpoint server_endpoint;
       bool halt;
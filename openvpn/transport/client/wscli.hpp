@@ -0,0 +1,513 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// WebSocket transport object specialized for client, for networks
+// that only pass HTTP.
+//
+// After the TCP connect the client sends an HTTP/1.1 Upgrade request
+// and waits for the 101 reply.  From then on every packet is carried
+// in one binary WebSocket frame, which already delimits packets, so
+// the 16-bit TCP length prefix is not used.  The frame header and the
+// client mask are prepended in the headroom of the outgoing packet and
+// the payload is masked in place; only buffers without enough headroom
+// are copied into a buffer from the Frame::WRITE_HTTP context.
+
+#ifndef OPENVPN_TRANSPORT_CLIENT_WSCLI_H
+#define OPENVPN_TRANSPORT_CLIENT_WSCLI_H
+
+#include <string>
+#include <sstream>
+#include <memory>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/buffer/buflimit.hpp>
+#include <openvpn/transport/tcplink.hpp>
+#include <openvpn/transport/client/transbase.hpp>
+#include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/transport/protectpool.hpp>
+#include <openvpn/http/reply.hpp>
+#include <openvpn/http/status.hpp>
+#include <openvpn/ws/websocket.hpp>
+#include <openvpn/client/remotelist.hpp>
+
+namespace openvpn {
+  namespace WSTransport {
+
+    class ClientConfig : public TransportClientFactory
+    {
+    public:
+      typedef RCPtr<ClientConfig> Ptr;
+
+      RemoteList::Ptr remote_list;
+      size_t free_list_max_size;
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+
+      // rng, digest factory, origin and subprotocol of the upgrade request
+      WebSocket::Client::Config::Ptr websocket;
+
+      std::string uri;        // request target of the upgrade request
+      std::string user_agent;
+
+      SocketProtect* socket_protect;
+      ProtectedSocketPool::Ptr protect_pool; // sockets protected ahead of time, optional
+
+      static Ptr new_obj()
+      {
+	return new ClientConfig;
+      }
+
+      virtual TransportClient::Ptr new_transport_client_obj(openvpn_io::io_context& io_context,
+							    TransportClientParent* parent);
+
+    private:
+      ClientConfig()
+	: free_list_max_size(8),
+	  uri("/"),
+	  socket_protect(nullptr)
+      {}
+    };
+
+    class Client : public TransportClient, AsyncResolvableTCP
+    {
+      typedef RCPtr<Client> Ptr;
+
+      // always raw, frames are delimited by WebSocket
+      typedef TCPTransport::Link<openvpn_io::ip::tcp, Client*, true> LinkImpl;
+
+      friend class ClientConfig;         // calls constructor
+      friend LinkImpl::Base;             // calls tcp_read_handler
+
+    public:
+      void transport_start() override
+      {
+	if (!impl)
+	  {
+	    halt = false;
+	    if (config->remote_list->endpoint_available(&server_host,
+							&server_port,
+							&server_protocol))
+	      {
+		start_connect_();
+	      }
+	    else
+	      {
+		parent->transport_pre_resolve();
+
+		async_resolve_lock();
+		async_resolve_name(server_host, server_port);
+	      }
+	  }
+      }
+
+      bool transport_send_const(const Buffer& buf) override
+      {
+	return send_const(buf);
+      }
+
+      bool transport_send(BufferAllocated& buf) override
+      {
+	return send(buf);
+      }
+
+      bool transport_send_queue_empty() override
+      {
+	if (impl)
+	  return impl->send_queue_empty();
+	else
+	  return false;
+      }
+
+      bool transport_has_send_queue() override
+      {
+	return true;
+      }
+
+      void transport_stop_requeueing() override { }
+
+      unsigned int transport_send_queue_size() override
+      {
+	if (impl)
+	  return impl->send_queue_size();
+	else
+	  return 0;
+      }
+
+      // received packets are copied out of the WebSocket stream,
+      // so the alignment applies to the copies
+      void reset_align_adjust(const size_t align_adjust) override
+      {
+	read_context.reset_align_adjust(align_adjust);
+      }
+
+      void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const override
+      {
+	host = server_host;
+	port = server_port;
+	const IP::Addr addr = server_endpoint_addr();
+	proto = "WS-";
+	proto += server_protocol.str();
+	ip_addr = addr.to_string();
+      }
+
+      IP::Addr server_endpoint_addr() const override
+      {
+	return IP::Addr::from_asio(server_endpoint.address());
+      }
+
+      Protocol transport_protocol() const override
+      {
+	return server_protocol;
+      }
+
+      void stop() override { stop_(); }
+      ~Client() override { stop_(); }
+
+    private:
+      struct UpgradeResponseLimit : public BufferLimit<size_t>
+      {
+	UpgradeResponseLimit() : BufferLimit(256, 16384) {}
+
+	virtual void bytes_exceeded() {
+	  OPENVPN_THROW_EXCEPTION("WebSocket upgrade response too large (> " << max_bytes << " bytes)");
+	}
+
+	virtual void lines_exceeded() {
+	  OPENVPN_THROW_EXCEPTION("WebSocket upgrade response too large (> " << max_lines << " lines)");
+	}
+      };
+
+      Client(openvpn_io::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     TransportClientParent* parent_arg)
+	:  AsyncResolvableTCP(io_context_arg),
+	   socket(io_context_arg),
+	   config(config_arg),
+	   parent(parent_arg),
+	   read_context((*config_arg->frame)[Frame::READ_LINK_TCP]),
+	   halt(false),
+	   established(false),
+	   http_reply_status(HTTP::ReplyParser::pending)
+      {
+      }
+
+      void transport_reparent(TransportClientParent* parent_arg) override
+      {
+	parent = parent_arg;
+      }
+
+      bool send_const(const Buffer& cbuf)
+      {
+	if (impl && established)
+	  {
+	    BufferAllocated buf;
+	    config->frame->prepare(Frame::WRITE_HTTP, buf);
+	    buf.write(cbuf.c_data(), cbuf.size());
+	    return send_frame(buf, WebSocket::Protocol::Binary);
+	  }
+	else
+	  return false;
+      }
+
+      bool send(BufferAllocated& buf)
+      {
+	if (impl && established)
+	  {
+	    if (buf.offset() < WebSocket::Protocol::MAX_HEAD)
+	      {
+		BufferAllocated copy;
+		config->frame->prepare(Frame::WRITE_HTTP, copy);
+		copy.write(buf.c_data(), buf.size());
+		buf.swap(copy);
+	      }
+	    return send_frame(buf, WebSocket::Protocol::Binary);
+	  }
+	else
+	  return false;
+      }
+
+      // frame and mask in place, buf must have MAX_HEAD of headroom
+      bool send_frame(BufferAllocated& buf, const unsigned int opcode)
+      {
+	ws->sender.frame(buf, WebSocket::Status(opcode));
+	return impl->send(buf);
+      }
+
+      void tcp_error_handler(const char *error) // called by LinkImpl and internally
+      {
+	std::ostringstream os;
+	os << "Transport error on '" << server_host << "' via WebSocket: " << error;
+	stop();
+	parent->transport_error(Error::TRANSPORT_ERROR, os.str());
+      }
+
+      bool tcp_read_handler(BufferAllocated& buf) // called by LinkImpl
+      {
+	try {
+	  if (established)
+	    ws_read_handler(buf);
+	  else
+	    upgrade_read_handler(buf);
+	}
+	catch (const std::exception& e)
+	  {
+	    config->stats->error(Error::TRANSPORT_ERROR);
+	    tcp_error_handler(e.what());
+	    return false;
+	  }
+	return !halt;
+      }
+
+      void tcp_write_queue_needs_send() // called by LinkImpl
+      {
+	if (established)
+	  parent->transport_needs_send();
+      }
+
+      void tcp_eof_handler() // called by LinkImpl
+      {
+	config->stats->error(Error::NETWORK_EOF_ERROR);
+	tcp_error_handler("NETWORK_EOF_ERROR");
+      }
+
+      void upgrade_read_handler(BufferAllocated& buf)
+      {
+	// for anti-DoS, only allow a maximum number of chars in HTTP response
+	upgrade_response_limit.add(buf);
+
+	for (size_t i = 0; i < buf.size(); ++i)
+	  {
+	    http_reply_status = http_parser.consume(http_reply, (char)buf[i]);
+	    if (http_reply_status != HTTP::ReplyParser::pending)
+	      {
+		buf.advance(i+1);
+		if (http_reply_status != HTTP::ReplyParser::success)
+		  throw Exception("WebSocket upgrade response parse error");
+		if (http_reply.status_code != HTTP::Status::SwitchingProtocols)
+		  OPENVPN_THROW_EXCEPTION("WebSocket upgrade refused: " << http_reply.status_code << ' ' << http_reply.status_text);
+		if (http_reply.headers.get_value_trim_lower("upgrade") != "websocket")
+		  throw Exception("WebSocket upgrade response: bad Upgrade header");
+		if (!ws->confirm_websocket_key(http_reply.headers.get_value_trim("sec-websocket-accept")))
+		  throw Exception("WebSocket upgrade response: bad Sec-WebSocket-Accept");
+
+		established = true;
+		parent->transport_connecting();
+
+		// data that arrived with the reply header
+		if (!buf.empty() && !halt)
+		  ws_read_handler(buf);
+		return;
+	      }
+	  }
+      }
+
+      void ws_read_handler(BufferAllocated& buf)
+      {
+	config->stats->inc_stat(SessionStats::BYTES_IN, buf.size());
+	ws->receiver.add_buf(std::move(buf));
+	while (!halt && ws->receiver.complete())
+	  {
+	    const WebSocket::Status s = ws->receiver.status();
+	    switch (s.opcode())
+	      {
+	      case WebSocket::Protocol::Binary:
+		{
+		  const Buffer msg = ws->receiver.buf_unframed();
+		  BufferAllocated pkt;
+		  read_context.prepare(pkt);
+		  pkt.write(msg.c_data(), msg.size());
+		  config->stats->inc_stat(SessionStats::PACKETS_IN, 1);
+		  parent->transport_recv(pkt);
+		  break;
+		}
+	      case WebSocket::Protocol::Ping:
+		{
+		  const Buffer msg = ws->receiver.buf_unframed();
+		  BufferAllocated pong;
+		  config->frame->prepare(Frame::WRITE_HTTP, pong);
+		  pong.write(msg.c_data(), msg.size());
+		  send_frame(pong, WebSocket::Protocol::Pong);
+		  break;
+		}
+	      case WebSocket::Protocol::Close:
+		OPENVPN_THROW_EXCEPTION("WebSocket closed by server, status=" << s.close_status_code());
+	      default:
+		break; // Text, Pong and continuations carry no packets
+	      }
+	    if (!halt)
+	      ws->receiver.reset();
+	  }
+      }
+
+      void stop_()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    if (impl)
+	      impl->stop();
+
+	    socket.close();
+	    async_resolve_cancel();
+	  }
+      }
+
+      // do DNS resolve
+      void resolve_callback(const openvpn_io::error_code& error,
+			    openvpn_io::ip::tcp::resolver::results_type results) override
+      {
+	// release resolver allocated resources
+	async_resolve_cancel();
+
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		// save resolved endpoint list in remote_list
+		config->remote_list->set_endpoint_range(results);
+		start_connect_();
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "DNS resolve error on '" << server_host << "' for WebSocket session: " << error.message();
+		config->stats->error(Error::RESOLVE_ERROR);
+		stop();
+		parent->transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      // do TCP connect
+      void start_connect_()
+      {
+	config->remote_list->get_endpoint(server_endpoint);
+	OPENVPN_LOG("Contacting " << server_endpoint << " via WebSocket");
+	parent->transport_wait();
+	const bool pre_protected = config->protect_pool && config->protect_pool->assign(socket, server_endpoint.protocol());
+	if (!pre_protected)
+	  socket.open(server_endpoint.protocol());
+
+	if (config->socket_protect && !pre_protected)
+	  {
+	    if (!config->socket_protect->socket_protect(socket.native_handle(), server_endpoint_addr()))
+	      {
+		config->stats->error(Error::SOCKET_PROTECT_ERROR);
+		stop();
+		parent->transport_error(Error::UNDEF, "socket_protect error (WebSocket)");
+		return;
+	      }
+	  }
+
+	socket.set_option(openvpn_io::ip::tcp::no_delay(true));
+	socket.async_connect(server_endpoint, [self=Ptr(this)](const openvpn_io::error_code& error)
+                                              {
+                                                OPENVPN_ASYNC_HANDLER;
+                                                self->start_impl_(error);
+                                              });
+      }
+
+      // start I/O on TCP socket and send the upgrade request
+      void start_impl_(const openvpn_io::error_code& error)
+      {
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		try {
+		  ws.reset(new WebSocket::Client::PerRequest(config->websocket));
+		}
+		catch (const std::exception& e)
+		  {
+		    stop();
+		    parent->transport_error(Error::UNDEF, std::string("WebSocket config error: ") + e.what());
+		    return;
+		  }
+		impl.reset(new LinkImpl(this,
+					socket,
+					0, // send_queue_max_size is unlimited because we regulate size in cliproto.hpp
+					config->free_list_max_size,
+					(*config->frame)[Frame::READ_LINK_TCP],
+					config->stats));
+		impl->start();
+
+		BufferAllocated buf;
+		create_upgrade_msg(buf);
+		impl->send(buf);
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "TCP connect error on '" << server_host << ':' << server_port << "' (" << server_endpoint << ") for WebSocket session: " << error.message();
+		config->stats->error(Error::TCP_CONNECT_ERROR);
+		stop();
+		parent->transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      void create_upgrade_msg(BufferAllocated& buf)
+      {
+	std::ostringstream os;
+	os << "GET " << config->uri << " HTTP/1.1\r\n";
+	os << "Host: " << server_host << ':' << server_port << "\r\n";
+	if (!config->user_agent.empty())
+	  os << "User-Agent: " << config->user_agent << "\r\n";
+	ws->client_headers(os);
+	os << "\r\n";
+
+	config->frame->prepare(Frame::WRITE_HTTP, buf);
+	buf_write_string(buf, os.str());
+      }
+
+      std::string server_host;
+      std::string server_port;
+      Protocol server_protocol;
+
+      openvpn_io::ip::tcp::socket socket;
+      ClientConfig::Ptr config;
+      TransportClientParent* parent;
+      LinkImpl::Ptr impl;
+      LinkImpl::protocol::endpoint server_endpoint;
+      Frame::Context read_context;
+      bool halt;
+      bool established;
+
+      WebSocket::Client::PerRequest::Ptr ws;
+      UpgradeResponseLimit upgrade_response_limit;
+      HTTP::ReplyParser::status http_reply_status;
+      HTTP::Reply http_reply;
+      HTTP::ReplyParser http_parser;
+    };
+
+    inline TransportClient::Ptr ClientConfig::new_transport_client_obj(openvpn_io::io_context& io_context,
+								       TransportClientParent* parent)
+    {
+      return TransportClient::Ptr(new Client(io_context, this, parent));
+    }
+  }
+} // namespace openvpn
+
+#endif
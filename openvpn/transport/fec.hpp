@@ -0,0 +1,255 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/frame/frame.hpp>
+
+namespace openvpn {
+  // Forward error correction for encrypted data channel packets on a
+  // lossy datagram transport, with XOR parity: after each group of
+  // packets, a parity packet lets the receiver rebuild any one packet
+  // of the group that was lost, without waiting for a retransmission
+  // by the tunneled protocol.  Received packets are passed on right
+  // away, a rebuilt one as soon as the rest of its group is in.
+  //
+  // The group size follows the loss rate that the peer reports in
+  // each packet, aiming at one loss per two groups, from MIN_GROUP
+  // to MAX_GROUP packets.
+  //
+  // Each packet gets a header starting with an opcode outside of the
+  // range of ProtoContext, so that FEC and plain packets can mix:
+  //
+  //   OPCODE << 3                                   (1 byte)
+  //   group number                                  (2 bytes)
+  //   index in group, or PARITY | packets in group  (1 byte)
+  //   sender's receive loss rate, LOSS_ONE = 100%   (1 byte)
+  //
+  // The parity payload is the XOR of the packets of the group, each
+  // prefixed by its 2-byte length and zero-padded to the longest.
+  class FEC
+  {
+  public:
+    enum {
+      OPCODE = 12,
+      HEADER_SIZE = 5,
+      PARITY = 0x80,
+      MIN_GROUP = 4,
+      MAX_GROUP = 32,
+      LOSS_ONE = 256,
+      N_GROUPS = 4,  // groups that the receiver keeps open
+      FLUSH_MS = 20, // the parity of a partial group is due after this
+    };
+
+    // frame_context sizes parity and rebuilt packets
+    explicit FEC(const Frame::Context& frame_context_arg)
+      : frame_context(frame_context_arg)
+    {
+    }
+
+    static bool is_fec(const Buffer& buf)
+    {
+      return buf.size() >= HEADER_SIZE && (buf[0] >> 3) == OPCODE;
+    }
+
+    // Add the header to buf, an encrypted data channel packet that
+    // needs HEADER_SIZE bytes of headroom, or else goes unprotected.
+    // Returns true if buf completed a group, with its parity in parity.
+    bool encode(BufferAllocated& buf, BufferAllocated& parity)
+    {
+      if (buf.offset() < HEADER_SIZE || buf.size() > 0xFFFF)
+	return false;
+      if (!send_count)
+	send_size = group_size();
+      accumulate(send_acc, buf.c_data(), buf.size());
+      prepend_header(buf, send_count);
+      if (++send_count < send_size)
+	return false;
+      return flush(parity);
+    }
+
+    // Packets have been sent since the last parity.
+    bool pending() const
+    {
+      return send_count != 0;
+    }
+
+    // Close the current group early.  Returns true with its parity
+    // in parity if it had any packets.
+    bool flush(BufferAllocated& parity)
+    {
+      if (!send_count)
+	return false;
+      parity = frame_context.copy_by_value(send_acc.data(), send_acc.size());
+      prepend_header(parity, PARITY | send_count);
+      send_acc.clear();
+      send_count = 0;
+      ++send_group;
+      return true;
+    }
+
+    // Strip the header of a packet for which is_fec() is true.
+    // Returns true if buf is a data channel packet to process.
+    // A lost packet that could be rebuilt is returned in recovered.
+    bool decode(BufferAllocated& buf, BufferAllocated& recovered)
+    {
+      const unsigned int group = (buf[1] << 8) | buf[2];
+      const unsigned int index = buf[3];
+      peer_loss_ = buf[4];
+      buf.advance(HEADER_SIZE);
+
+      Group* g = recv_group(group);
+      if (!g)
+	return !(index & PARITY); // group already closed
+      if (index & PARITY)
+	{
+	  if (g->parity)
+	    return false;
+	  g->parity = true;
+	  g->count = index & ~PARITY;
+	  xor_into(g->acc, buf.c_data(), buf.size());
+	  if (g->count && g->n_received <= g->count)
+	    loss_ = (loss_ * 7 + LOSS_ONE * (g->count - g->n_received) / g->count) / 8;
+	}
+      else
+	{
+	  if (index >= MAX_GROUP || (g->received & (1u << index)))
+	    return true; // duplicates are left to the replay window
+	  g->received |= 1u << index;
+	  ++g->n_received;
+	  accumulate(g->acc, buf.c_data(), buf.size());
+	}
+      rebuild(*g, recovered);
+      return !(index & PARITY);
+    }
+
+    // our smoothed receive loss rate, as reported to the peer
+    unsigned int loss() const { return loss_; }
+
+    // the peer's receive loss rate, which sizes our groups
+    unsigned int peer_loss() const { return peer_loss_; }
+
+    // packets rebuilt from parity
+    std::uint64_t n_recovered() const { return n_recovered_; }
+
+    // number of packets per parity for the current peer loss rate
+    unsigned int group_size() const
+    {
+      if (!peer_loss_)
+	return MAX_GROUP;
+      return std::max(unsigned(MIN_GROUP), std::min(unsigned(MAX_GROUP), unsigned(LOSS_ONE) / (2 * peer_loss_)));
+    }
+
+  private:
+    struct Group
+    {
+      bool used = false;
+      bool parity = false;
+      bool done = false;
+      unsigned int id = 0;
+      unsigned int count = 0;      // packets in group, known from parity
+      unsigned int n_received = 0;
+      std::uint32_t received = 0;  // bit mask of indices received
+      std::vector<unsigned char> acc;
+    };
+
+    void prepend_header(Buffer& buf, const unsigned int index) const
+    {
+      unsigned char *h = buf.prepend_alloc(HEADER_SIZE);
+      h[0] = OPCODE << 3;
+      h[1] = std::uint8_t(send_group >> 8);
+      h[2] = std::uint8_t(send_group);
+      h[3] = std::uint8_t(index);
+      h[4] = std::uint8_t(std::min(loss_, unsigned(LOSS_ONE - 1)));
+    }
+
+    static void xor_into(std::vector<unsigned char>& acc, const unsigned char *data, const size_t size)
+    {
+      if (acc.size() < size)
+	acc.resize(size, 0);
+      for (size_t i = 0; i < size; ++i)
+	acc[i] ^= data[i];
+    }
+
+    static void accumulate(std::vector<unsigned char>& acc, const unsigned char *data, const size_t size)
+    {
+      if (acc.size() < size + 2)
+	acc.resize(size + 2, 0);
+      acc[0] ^= std::uint8_t(size >> 8);
+      acc[1] ^= std::uint8_t(size);
+      for (size_t i = 0; i < size; ++i)
+	acc[i + 2] ^= data[i];
+    }
+
+    // Slot of group, recycling the slot of an older group, or
+    // nullptr if group is older than the one in its slot.
+    Group* recv_group(const unsigned int group)
+    {
+      Group& g = groups[group % N_GROUPS];
+      if (g.used && g.id == group)
+	return &g;
+      if (g.used && std::int16_t(std::uint16_t(group - g.id)) < 0)
+	return nullptr;
+      g.used = true;
+      g.parity = false;
+      g.done = false;
+      g.id = group;
+      g.count = 0;
+      g.n_received = 0;
+      g.received = 0;
+      g.acc.clear();
+      return &g;
+    }
+
+    void rebuild(Group& g, BufferAllocated& recovered)
+    {
+      if (!g.parity || g.done || g.n_received + 1 < g.count)
+	return;
+      g.done = true;
+      if (g.n_received >= g.count || g.acc.size() < 2)
+	return;
+      const size_t size = (g.acc[0] << 8) | g.acc[1];
+      if (!size || size + 2 > g.acc.size())
+	return;
+      recovered = frame_context.copy_by_value(g.acc.data() + 2, size);
+      ++n_recovered_;
+    }
+
+    Frame::Context frame_context;
+
+    // sender
+    std::vector<unsigned char> send_acc;
+    unsigned int send_group = 0;
+    unsigned int send_count = 0;
+    unsigned int send_size = 0;
+
+    // receiver
+    Group groups[N_GROUPS];
+    unsigned int loss_ = 0;
+    unsigned int peer_loss_ = 0;
+    std::uint64_t n_recovered_ = 0;
+  };
+}
@@ -19,11 +19,37 @@
 //    along with this program in the COPYING file.
 //    If not, see <http://www.gnu.org/licenses/>.
 
+// Network impairment emulation ("gremlin").  A Link decides, for each
+// packet offered to one direction of a connection, whether it is lost
+// and when it arrives at the far end, from:
+//
+//   delay    fixed one-way delay
+//   jitter   extra delay, uniform in [0, jitter]; packets stay in
+//            order unless reordering is enabled
+//   drop     Bernoulli loss of 1 in N packets
+//   ge       Gilbert-Elliott loss: a good/bad two-state chain,
+//            stepped once per packet, that loses packets only in
+//            the bad state, for bursty loss
+//   kbps     bottleneck bandwidth, packets queue behind each other
+//   queue    bottleneck queue limit in ms, tail-drop beyond it
+//   reorder  fraction of packets that skip the delay and overtake
+//            packets still in flight
+//
+// The decisions depend only on the seed and the sequence of
+// (time, size) offered, so a run with a given seed is reproducible
+// on any clock.  SendRecvQueue applies two Links to a real transport
+// on the wall clock (OPENVPN_GREMLIN builds of the UDP/TCP links,
+// test/loadgen); Wire and VirtualClock run a Link in simulated time
+// (test/ssl/proto.cpp).
+
 #ifndef OPENVPN_TRANSPORT_GREMLIN_H
 #define OPENVPN_TRANSPORT_GREMLIN_H
 
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
-#include <deque>
+#include <map>
 #include <vector>
 #include <utility>
 #include <sstream>
@@ -32,6 +58,7 @@
 #include <openvpn/common/string.hpp>
 #include <openvpn/common/number.hpp>
 #include <openvpn/common/exception.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/time/asiotimer.hpp>
 #include <openvpn/random/mtrandapi.hpp>
 
@@ -40,13 +67,249 @@ namespace openvpn {
 
     OPENVPN_EXCEPTION(gremlin_error);
 
+    // Impairments of one direction, see top of file.
+    // Probabilities are in [0, 1].
+    struct LinkParams
+    {
+      unsigned int delay_ms = 0;
+      unsigned int jitter_ms = 0;
+      unsigned int drop_probability = 0; // drop 1 in N, 0 for never
+      unsigned int kbps = 0;             // 0 for unlimited
+      unsigned int queue_ms = 0;         // 0 for unbounded
+      double reorder = 0.0;
+      double ge_p = 0.0;                 // good -> bad, 0 disables Gilbert-Elliott
+      double ge_r = 0.0;                 // bad -> good
+      double ge_loss = 1.0;              // loss in bad state
+
+      bool ge_enabled() const
+      {
+	return ge_p > 0.0;
+      }
+
+      // long-run fraction of packets lost by the Gilbert-Elliott chain
+      double ge_loss_rate() const
+      {
+	if (!ge_enabled())
+	  return 0.0;
+	return ge_p / (ge_p + ge_r) * ge_loss;
+      }
+    };
+
+    class Link
+    {
+    public:
+      struct Stats
+      {
+	std::uint64_t packets = 0;
+	std::uint64_t lost = 0;       // by drop or ge
+	std::uint64_t overflow = 0;   // by the bottleneck queue limit
+	std::uint64_t reordered = 0;
+      };
+
+      // A stream link (TCP) neither loses nor reorders.
+      Link(const LinkParams& params_arg, const bool stream_arg)
+	: params(params_arg),
+	  stream(stream_arg)
+      {
+      }
+
+      Link(const LinkParams& params_arg, const std::uint64_t seed, const bool stream_arg)
+	: params(params_arg),
+	  rng(seed),
+	  stream(stream_arg)
+      {
+      }
+
+      // Offer a packet of size bytes at now.  Returns false if it is
+      // lost, otherwise sets deliver to its arrival time.
+      bool transmit(const Time& now, const size_t size, Time& deliver)
+      {
+	++stats_.packets;
+	if (!stream && lost())
+	  {
+	    ++stats_.lost;
+	    return false;
+	  }
+
+	// serialize behind earlier packets at the bottleneck
+	const std::uint64_t t = usec(now);
+	std::uint64_t depart = t;
+	if (params.kbps)
+	  {
+	    const std::uint64_t start = std::max(t, link_free);
+	    if (params.queue_ms && start - t > params.queue_ms * std::uint64_t(1000))
+	      {
+		++stats_.overflow;
+		return false;
+	      }
+	    depart = start + size * std::uint64_t(8000) / params.kbps;
+	    link_free = depart;
+	  }
+
+	std::uint64_t arrive = depart + params.delay_ms * std::uint64_t(1000);
+	if (params.jitter_ms)
+	  arrive += rng.rand() % (params.jitter_ms * std::uint64_t(1000) + 1);
+	if (!stream && chance(params.reorder))
+	  {
+	    arrive = depart;
+	    ++stats_.reordered;
+	  }
+	else
+	  {
+	    arrive = std::max(arrive, last_arrive);
+	    last_arrive = arrive;
+	  }
+	deliver = time(arrive);
+	return true;
+      }
+
+      const Stats& stats() const
+      {
+	return stats_;
+      }
+
+    private:
+      bool lost()
+      {
+	if (params.ge_enabled())
+	  {
+	    if (bad)
+	      bad = !chance(params.ge_r);
+	    else
+	      bad = chance(params.ge_p);
+	    if (bad && chance(params.ge_loss))
+	      return true;
+	  }
+	return params.drop_probability && rng.rand() % params.drop_probability == 0;
+      }
+
+      // Bernoulli trial from the top 53 bits, so that results don't
+      // depend on the standard library's distributions.
+      bool chance(const double prob)
+      {
+	return prob > 0.0 && double(rng.rand() >> 11) / 9007199254740992.0 < prob;
+      }
+
+      // Time has a resolution of 1/1024 s, too coarse to add up
+      // serialization delays, so the link keeps microseconds.
+      static std::uint64_t usec(const Time& t)
+      {
+	return std::uint64_t(t.raw()) * 15625 / 16;
+      }
+
+      static Time time(const std::uint64_t us)
+      {
+	return Time::zero() + Time::Duration::binary_ms((us * 16 + 15624) / 15625);
+      }
+
+      LinkParams params;
+      MTRand rng;
+      bool stream;
+      bool bad = false;
+      std::uint64_t link_free = 0;
+      std::uint64_t last_arrive = 0;
+      Stats stats_;
+    };
+
+    // Simulated time for a Wire-based harness, which can jump to the
+    // next delivery instead of stepping through idle time.  ptr() can
+    // be given to ProtoContext::Config::now.
+    class VirtualClock
+    {
+    public:
+      // starts at a defined time, since Time zero means undefined
+      VirtualClock()
+	: now_(Time::zero() + Time::Duration::seconds(1))
+      {
+      }
+
+      const Time& now() const
+      {
+	return now_;
+      }
+
+      TimePtr ptr()
+      {
+	return &now_;
+      }
+
+      void advance(const Time::Duration& d)
+      {
+	now_ += d;
+      }
+
+      // never moves backwards
+      void advance_to(const Time& t)
+      {
+	now_.max(t);
+      }
+
+    private:
+      Time now_;
+    };
+
+    // One direction of a simulated link, carrying packets of type T.
+    template <typename T>
+    class Wire
+    {
+    public:
+      Wire(const LinkParams& params, const std::uint64_t seed, const bool stream=false)
+	: link_(params, seed, stream)
+      {
+      }
+
+      // returns false if the packet was lost
+      bool send(const Time& now, T pkt, const size_t size)
+      {
+	Time deliver;
+	if (!link_.transmit(now, size, deliver))
+	  return false;
+	queue.emplace(deliver, std::move(pkt)); // after others due at the same time
+	return true;
+      }
+
+      // pop the next packet that has arrived by now
+      bool recv(const Time& now, T& pkt)
+      {
+	if (queue.empty() || queue.begin()->first > now)
+	  return false;
+	pkt = std::move(queue.begin()->second);
+	queue.erase(queue.begin());
+	return true;
+      }
+
+      // arrival time of the next packet, or infinite if none
+      Time next_time() const
+      {
+	if (queue.empty())
+	  return Time::infinite();
+	return queue.begin()->first;
+      }
+
+      size_t size() const
+      {
+	return queue.size();
+      }
+
+      const Link& link() const
+      {
+	return link_;
+      }
+
+    private:
+      Link link_;
+      std::multimap<Time, T> queue;
+    };
+
+    // Runs functions on the wall clock at given times, in time order
+    // and, for equal times, in order of queueing.
     struct DelayedQueue : public RC<thread_unsafe_refcount>
     {
     public:
       typedef RCPtr<DelayedQueue> Ptr;
 
       DelayedQueue(openvpn_io::io_context& io_context,
-		   const unsigned int delay_ms)
+		   const unsigned int delay_ms = 0)
 	: dur(Time::Duration::milliseconds(delay_ms)),
 	  next_event(io_context)
       {
@@ -55,9 +318,14 @@ namespace openvpn {
       template <class F>
       void queue(F&& func_arg)
       {
-	const bool empty = events.empty();
-	events.emplace_back(new Event<F>(Time::now() + dur, std::move(func_arg)));
-	if (empty)
+	queue_at(Time::now() + dur, std::move(func_arg));
+      }
+
+      template <class F>
+      void queue_at(const Time& fire, F&& func_arg)
+      {
+	auto i = events.emplace(fire, std::unique_ptr<EventBase>(new Event<F>(std::move(func_arg))));
+	if (i == events.begin())
 	  set_timer();
       }
 
@@ -75,7 +343,6 @@ namespace openvpn {
       struct EventBase
       {
 	virtual void call() = 0;
-	virtual const Time& fire_time() = 0;
 	virtual ~EventBase() {}
       };
 
@@ -83,9 +350,8 @@ namespace openvpn {
       struct Event : public EventBase
       {
       public:
-	Event(Time fire_arg, F&& func_arg)
-	  : fire(fire_arg),
-	    func(std::move(func_arg))
+	Event(F&& func_arg)
+	  : func(std::move(func_arg))
 	{
 	}
 
@@ -94,13 +360,7 @@ namespace openvpn {
 	  func();
 	}
 
-	virtual const Time& fire_time()
-	{
-	  return fire;
-	}
-
       private:
-	Time fire;
 	F func;
       };
 
@@ -108,25 +368,49 @@ namespace openvpn {
       {
 	if (events.empty())
 	  return;
-	EventBase& ev = *events.front();
-	next_event.expires_at(ev.fire_time());
+	next_event.expires_at(events.begin()->first);
 	next_event.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
 			      {
 				if (!error)
-				  {
-				    EventBase& ev = *self->events.front();
-				    ev.call();
-				    self->events.pop_front();
-				    self->set_timer();
-				  }
+				  self->fire();
 			      });
       }
 
+      // Re-arming for an earlier event can race with a wait that has
+      // already completed, so only run what is due.
+      void fire()
+      {
+	const Time now = Time::now();
+	while (!events.empty() && events.begin()->first <= now)
+	  {
+	    std::unique_ptr<EventBase> ev(std::move(events.begin()->second));
+	    events.erase(events.begin());
+	    ev->call();
+	  }
+	set_timer();
+      }
+
       Time::Duration dur;
       AsioTimer next_event;
-      std::deque<std::unique_ptr<EventBase>> events;
+      std::multimap<Time, std::unique_ptr<EventBase>> events;
     };
 
+    // Parsed from
+    //
+    //   send_delay_ms,recv_delay_ms,send_drop_prob,recv_drop_prob[,key=value...]
+    //
+    // where the drop probabilities are 1 in N and the optional keys are
+    //
+    //   seed=N            seed for reproducible runs, 0 (default) for random
+    //   jitter=MS
+    //   kbps=N
+    //   queue=MS
+    //   reorder=PERCENT
+    //   ge=P:R[:LOSS]     Gilbert-Elliott percentages, LOSS defaults to 100
+    //
+    // Keys other than seed apply to both directions, or to one when
+    // prefixed with send_ or recv_, e.g. recv_kbps=8000.  Percentages
+    // may have decimals.
     class Config : public RC<thread_unsafe_refcount>
     {
     public:
@@ -137,54 +421,153 @@ namespace openvpn {
 	const std::vector<std::string> parms = string::split(config_str, ',');
 	if (parms.size() < 4)
 	  throw gremlin_error("need 4 comma-separated values for send_delay_ms, recv_delay_ms, send_drop_prob, recv_drop_prob");
-	if (!parse_number(string::trim_copy(parms[0]), send_delay_ms))
+	if (!parse_number(string::trim_copy(parms[0]), send.delay_ms))
 	  throw gremlin_error("send_delay_ms");
-	if (!parse_number(string::trim_copy(parms[1]), recv_delay_ms))
+	if (!parse_number(string::trim_copy(parms[1]), recv.delay_ms))
 	  throw gremlin_error("recv_delay_ms");
-	if (!parse_number(string::trim_copy(parms[2]), send_drop_probability))
+	if (!parse_number(string::trim_copy(parms[2]), send.drop_probability))
 	  throw gremlin_error("send_drop_probability");
-	if (!parse_number(string::trim_copy(parms[3]), recv_drop_probability))
+	if (!parse_number(string::trim_copy(parms[3]), recv.drop_probability))
 	  throw gremlin_error("recv_drop_probability");
+	for (size_t i = 4; i < parms.size(); ++i)
+	  parse_key(string::trim_copy(parms[i]));
       }
 
       std::string to_string() const
       {
 	std::ostringstream os;
-	os << '[' << send_delay_ms << ',' << recv_delay_ms << ',' << send_drop_probability << ',' << recv_drop_probability << ']';
+	os << '[' << send.delay_ms << ',' << recv.delay_ms << ',' << send.drop_probability << ',' << recv.drop_probability;
+	if (seed)
+	  os << ",seed=" << seed;
+	render(os, "send_", send);
+	render(os, "recv_", recv);
+	os << ']';
 	return os.str();
       }
 
-      unsigned int send_delay_ms = 0;
-      unsigned int recv_delay_ms = 0;
-      unsigned int send_drop_probability = 0;
-      unsigned int recv_drop_probability = 0;
+      LinkParams send;
+      LinkParams recv;
+      std::uint64_t seed = 0;
+
+    private:
+      void parse_key(const std::string& kv)
+      {
+	const size_t eq = kv.find('=');
+	if (eq == std::string::npos)
+	  throw gremlin_error("expected key=value: " + kv);
+	std::string key = kv.substr(0, eq);
+	const std::string value = kv.substr(eq + 1);
+
+	if (key == "seed")
+	  {
+	    if (!parse_number(value, seed))
+	      throw gremlin_error(key);
+	    return;
+	  }
+
+	LinkParams* dirs[2] = { &send, &recv };
+	size_t n = 2;
+	if (string::starts_with(key, "send_"))
+	  {
+	    key = key.substr(5);
+	    n = 1;
+	  }
+	else if (string::starts_with(key, "recv_"))
+	  {
+	    key = key.substr(5);
+	    dirs[0] = &recv;
+	    n = 1;
+	  }
+	for (size_t i = 0; i < n; ++i)
+	  parse_param(*dirs[i], key, value);
+      }
+
+      static void parse_param(LinkParams& lp, const std::string& key, const std::string& value)
+      {
+	bool ok;
+	if (key == "jitter")
+	  ok = parse_number(value, lp.jitter_ms);
+	else if (key == "kbps")
+	  ok = parse_number(value, lp.kbps);
+	else if (key == "queue")
+	  ok = parse_number(value, lp.queue_ms);
+	else if (key == "reorder")
+	  ok = parse_percent(value, lp.reorder);
+	else if (key == "ge")
+	  {
+	    const std::vector<std::string> ge = string::split(value, ':');
+	    ok = (ge.size() == 2 || ge.size() == 3)
+	      && parse_percent(ge[0], lp.ge_p) && lp.ge_p > 0.0
+	      && parse_percent(ge[1], lp.ge_r)
+	      && (ge.size() == 2 || parse_percent(ge[2], lp.ge_loss));
+	  }
+	else
+	  throw gremlin_error("unknown key: " + key);
+	if (!ok)
+	  throw gremlin_error(key);
+      }
+
+      static bool parse_percent(const std::string& str, double& frac)
+      {
+	if (str.empty())
+	  return false;
+	char *end;
+	const double v = std::strtod(str.c_str(), &end);
+	if (*end || !(v >= 0.0 && v <= 100.0))
+	  return false;
+	frac = v / 100.0;
+	return true;
+      }
+
+      static void render(std::ostream& os, const char *prefix, const LinkParams& lp)
+      {
+	if (lp.jitter_ms)
+	  os << ',' << prefix << "jitter=" << lp.jitter_ms;
+	if (lp.kbps)
+	  os << ',' << prefix << "kbps=" << lp.kbps;
+	if (lp.queue_ms)
+	  os << ',' << prefix << "queue=" << lp.queue_ms;
+	if (lp.reorder > 0.0)
+	  os << ',' << prefix << "reorder=" << lp.reorder * 100.0;
+	if (lp.ge_enabled())
+	  os << ',' << prefix << "ge=" << lp.ge_p * 100.0 << ':' << lp.ge_r * 100.0 << ':' << lp.ge_loss * 100.0;
+      }
     };
 
+    // Both directions of a transport on the wall clock.  Each
+    // instance sharing a seeded Config should get its own stream
+    // number, so that e.g. load generator clients don't all lose the
+    // same packets.
     class SendRecvQueue
     {
     public:
       SendRecvQueue(openvpn_io::io_context& io_context,
 		    const Config::Ptr& conf_arg,
-		    const bool tcp_arg)
+		    const bool tcp_arg,
+		    const std::uint64_t stream_num = 0)
 	: conf(conf_arg),
-	  send(new DelayedQueue(io_context, conf->send_delay_ms)),
-	  recv(new DelayedQueue(io_context, conf->recv_delay_ms)),
-	  tcp(tcp_arg)
+	  send(new DelayedQueue(io_context)),
+	  recv(new DelayedQueue(io_context)),
+	  send_link(new_link(conf->send, 2 * stream_num, tcp_arg)),
+	  recv_link(new_link(conf->recv, 2 * stream_num + 1, tcp_arg))
       {
       }
 
+      // size is the packet's length in bytes, for the bandwidth cap
       template <class F>
-      void send_queue(F&& func_arg)
+      void send_queue(F&& func_arg, const size_t size = 0)
       {
-	if (tcp || flip(conf->send_drop_probability))
-	  send->queue(std::move(func_arg));
+	Time deliver;
+	if (send_link->transmit(Time::now(), size, deliver))
+	  send->queue_at(deliver, std::move(func_arg));
       }
 
       template <class F>
-      void recv_queue(F&& func_arg)
+      void recv_queue(F&& func_arg, const size_t size = 0)
       {
-	if (tcp || flip(conf->recv_drop_probability))
-	  recv->queue(std::move(func_arg));
+	Time deliver;
+	if (recv_link->transmit(Time::now(), size, deliver))
+	  recv->queue_at(deliver, std::move(func_arg));
       }
 
       size_t send_size() const
@@ -197,6 +580,16 @@ namespace openvpn {
 	return recv->size();
       }
 
+      const Link::Stats& send_stats() const
+      {
+	return send_link->stats();
+      }
+
+      const Link::Stats& recv_stats() const
+      {
+	return recv_link->stats();
+      }
+
       void stop()
       {
 	send->stop();
@@ -204,19 +597,19 @@ namespace openvpn {
       }
 
     private:
-      bool flip(const unsigned int prob)
+      Link* new_link(const LinkParams& params, const std::uint64_t stream, const bool tcp) const
       {
-	if (prob)
-	  return ri.randrange(prob) != 0;
+	if (conf->seed)
+	  return new Link(params, conf->seed + stream, tcp);
 	else
-	  return true;
+	  return new Link(params, tcp);
       }
 
       Config::Ptr conf;
-      MTRand ri;
       DelayedQueue::Ptr send;
       DelayedQueue::Ptr recv;
-      bool tcp;
+      std::unique_ptr<Link> send_link;
+      std::unique_ptr<Link> recv_link;
     };
   }
 }
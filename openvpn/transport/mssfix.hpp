@@ -21,6 +21,10 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/ip/ipcommon.hpp>
 #include <openvpn/ip/ip4.hpp>
@@ -34,11 +38,33 @@
 #endif
 
 namespace openvpn {
+  // Clamps the MSS option of TCP SYN packets.  The limits are derived
+  // once per session from mss_inter, and packets that are not TCP SYN
+  // are rejected from a few header bytes before any full parsing.
   class MSSFix {
   public:
+    MSSFix() {}
+
+    explicit MSSFix(const int mss_inter)
+      : max_mss4(clamp(mss_inter - int(sizeof(struct IPv4Header) + sizeof(struct TCPHeader)))),
+	max_mss6(clamp(mss_inter - int(sizeof(struct IPv6Header) + sizeof(struct TCPHeader)))),
+	enabled_(mss_inter > 0)
+    {
+    }
+
+    bool enabled() const
+    {
+      return enabled_;
+    }
+
     static void mssfix(BufferAllocated& buf, int mss_inter)
     {
-      if (buf.empty())
+      MSSFix(mss_inter).fix(buf);
+    }
+
+    void fix(BufferAllocated& buf) const
+    {
+      if (!maybe_syn(buf))
 	return;
 
       switch (IPCommon::version(buf[0]))
@@ -61,7 +87,7 @@ namespace openvpn {
 	      TCPHeader* tcphdr = (TCPHeader*)(buf.data() + ipv4hlen);
 	      int ip_payload_len = buf.length() - ipv4hlen;
 
-	      do_mssfix(tcphdr, mss_inter - (sizeof(struct IPv4Header) + sizeof(struct TCPHeader)), ip_payload_len);
+	      do_mssfix(tcphdr, max_mss4, ip_payload_len);
 	    }
 	}
 	break;
@@ -96,8 +122,7 @@ namespace openvpn {
 	  if (payload_len >= (int) sizeof(struct TCPHeader))
 	    {
 	      TCPHeader *tcphdr = (TCPHeader *)(buf.data() + sizeof(struct IPv6Header));
-	      do_mssfix(tcphdr, mss_inter - (sizeof(struct IPv6Header) + sizeof(struct TCPHeader)),
-			payload_len);
+	      do_mssfix(tcphdr, max_mss6, payload_len);
 	    }
 	}
 	break;
@@ -105,11 +130,33 @@ namespace openvpn {
     }
 
   private:
-    static void do_mssfix(TCPHeader *tcphdr, int max_mss, int ip_payload_len)
+    static std::uint16_t clamp(const int mss)
     {
-      if ((tcphdr->flags & TCPHeader::FLAG_SYN) == 0)
-	return;
+      return std::uint16_t(std::max(0, std::min(mss, 0xffff)));
+    }
 
+    // True if buf may be a TCP SYN, looking only at the protocol
+    // and flags bytes at their usual offsets.  Anything that passes
+    // is fully validated by fix().
+    static bool maybe_syn(const Buffer& buf)
+    {
+      const size_t len = buf.size();
+      if (len < sizeof(struct IPv4Header) + sizeof(struct TCPHeader))
+	return false;
+      const std::uint8_t *p = buf.c_data();
+      const unsigned int ver = IPCommon::version(p[0]);
+      const bool v6 = (ver == IPCommon::IPv6);
+      const size_t iphlen = v6 ? sizeof(struct IPv6Header) : size_t(p[0] & 0x0f) * 4;
+      const size_t flags = iphlen + offsetof(TCPHeader, flags);
+      const std::uint8_t proto = p[v6 ? offsetof(IPv6Header, nexthdr) : offsetof(IPv4Header, protocol)];
+      return (ver == IPCommon::IPv4 || v6)
+	& (proto == IPCommon::TCP)
+	& (flags < len)
+	&& (p[flags] & TCPHeader::FLAG_SYN);
+    }
+
+    static void do_mssfix(TCPHeader *tcphdr, const int max_mss, int ip_payload_len)
+    {
       int tcphlen = TCPHeader::length(tcphdr->doff_res);
       if (tcphlen <= (int) sizeof(struct TCPHeader) || tcphlen > ip_payload_len)
 	return;
@@ -146,5 +193,9 @@ namespace openvpn {
 	  }
       }
     }
+
+    std::uint16_t max_mss4 = 0;
+    std::uint16_t max_mss6 = 0;
+    bool enabled_ = false;
   };
 }
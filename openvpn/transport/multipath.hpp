@@ -0,0 +1,256 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+  // Spreads the packets of a session over several paths to the same
+  // peer.  Each path is rated by a cost, its smoothed round trip time
+  // inflated by its loss rate, and gets a share of the bytes that is
+  // inversely proportional to it (weighted fair queuing on finish
+  // tags).  Paths costing more than MAX_COST_RATIO times the best one
+  // are kept on standby, since their packets would arrive too far
+  // behind the others.  A path carries data once it has answered a
+  // probe; until one has, everything goes on the first path that is
+  // up.
+  //
+  // Round trip time and loss come from probes, one outstanding at a
+  // time: the caller sends a probe on the path returned by probe(),
+  // and calls reply() when the peer answers it.  A path fails after
+  // MAX_FAILURES unanswered probes in a row, and is still probed so
+  // that it comes back when it answers again.
+  //
+  // The scheduler only decides and times; the caller owns the paths.
+  class MultipathScheduler
+  {
+  public:
+    enum {
+      MAX_FAILURES = 3,   // unanswered probes in a row before a path fails
+      MAX_COST_RATIO = 4, // standby above this multiple of the best cost
+      LOSS_ONE = 256,     // loss rate fixed point scale
+      LOSS_PENALTY = 8,   // cost multiplier at 100% loss is 1 + LOSS_PENALTY
+    };
+
+    struct Path
+    {
+      bool up = false;           // transport connected
+      unsigned int failures = 0; // unanswered probes in a row
+      unsigned int n_samples = 0;
+      Time::type srtt = 0;       // smoothed round trip time (1/1024 s)
+      unsigned int loss = 0;     // smoothed probe loss rate, LOSS_ONE is 100%
+      std::uint64_t finish = 0;  // finish tag of the last packet scheduled
+      std::uint64_t bytes = 0;   // bytes scheduled
+      Time next_probe;
+    };
+
+    explicit MultipathScheduler(const size_t n_paths)
+      : paths(n_paths),
+	probe_interval(Time::Duration::seconds(1)),
+	probe_timeout(Time::Duration::seconds(2))
+    {
+    }
+
+    size_t size() const { return paths.size(); }
+    const Path& path(const size_t i) const { return paths[i]; }
+
+    // The transport of path i connected, or failed for good.
+    void set_up(const size_t i, const bool up)
+    {
+      paths[i].up = up;
+      if (!up && probe_path == int(i))
+	probe_path = -1;
+    }
+
+    bool any_up() const
+    {
+      for (const Path& p : paths)
+	if (p.up)
+	  return true;
+      return false;
+    }
+
+    // Path for a data packet of size bytes, or -1 if no path is up.
+    int select(const size_t size)
+    {
+      const Time::type best = best_cost();
+      int ret = -1;
+      for (size_t i = 0; i < paths.size(); ++i)
+	{
+	  const Path& p = paths[i];
+	  if (usable(p, best) && (ret < 0 || p.finish < paths[ret].finish))
+	    ret = int(i);
+	}
+      if (ret < 0)
+	return fallback();
+
+      Path& sel = paths[ret];
+      const std::uint64_t vclock = sel.finish;
+      sel.finish += std::uint64_t(size + 1) * std::uint64_t(cost(sel));
+      sel.bytes += size;
+
+      // paths that sat out don't get to catch up later
+      for (Path& p : paths)
+	if (p.finish < vclock)
+	  p.finish = vclock;
+      if (vclock >= (std::uint64_t(1) << 48))
+	{
+	  for (Path& p : paths)
+	    p.finish -= vclock;
+	}
+      return ret;
+    }
+
+    // Path for control and other packets that go on a single path:
+    // the cheapest usable one, or -1 if no path is up.
+    int primary() const
+    {
+      const Time::type best = best_cost();
+      for (size_t i = 0; i < paths.size(); ++i)
+	{
+	  const Path& p = paths[i];
+	  if (usable(p, best) && cost(p) == best)
+	    return int(i);
+	}
+      return fallback();
+    }
+
+    // Path to send a probe on now, or -1.  Call at next_event().
+    // If the probe can't be sent, call cancel().
+    int probe(const Time& now)
+    {
+      if (probe_path >= 0)
+	{
+	  if (now < probe_sent + probe_timeout)
+	    return -1;
+	  Path& p = paths[probe_path];
+	  ++p.failures;
+	  p.loss = (p.loss * 7 + LOSS_ONE) / 8;
+	  probe_path = -1;
+	}
+
+      // the path that is the longest overdue
+      int ret = -1;
+      for (size_t i = 0; i < paths.size(); ++i)
+	{
+	  const Path& p = paths[i];
+	  if (p.up && now >= p.next_probe && (ret < 0 || p.next_probe < paths[ret].next_probe))
+	    ret = int(i);
+	}
+      if (ret >= 0)
+	{
+	  probe_path = ret;
+	  probe_sent = now;
+	  paths[ret].next_probe = now + probe_interval;
+	}
+      return ret;
+    }
+
+    void cancel()
+    {
+      probe_path = -1;
+    }
+
+    // The peer answered the outstanding probe.
+    void reply(const Time& now)
+    {
+      if (probe_path < 0)
+	return;
+      Path& p = paths[probe_path];
+      const Time::type rtt = (now - probe_sent).raw();
+      if (!p.n_samples++)
+	p.srtt = rtt;
+      else
+	p.srtt = (7 * p.srtt + rtt) / 8;
+      p.loss = p.loss * 7 / 8;
+      p.failures = 0;
+      probe_path = -1;
+    }
+
+    // When probe() should be called next.
+    Time next_event() const
+    {
+      if (probe_path >= 0)
+	return probe_sent + probe_timeout;
+      Time ret = Time::infinite();
+      for (const Path& p : paths)
+	if (p.up)
+	  ret.min(p.next_probe);
+      return ret;
+    }
+
+    void set_probe_interval(const Time::Duration& d) { probe_interval = d; }
+    void set_probe_timeout(const Time::Duration& d) { probe_timeout = d; }
+
+  private:
+    static Time::type cost(const Path& p)
+    {
+      return p.srtt * (LOSS_ONE + LOSS_PENALTY * p.loss) / LOSS_ONE + 1;
+    }
+
+    static bool measured(const Path& p)
+    {
+      return p.up && p.n_samples && p.failures < MAX_FAILURES;
+    }
+
+    bool usable(const Path& p, const Time::type best) const
+    {
+      return measured(p) && cost(p) <= best * MAX_COST_RATIO;
+    }
+
+    // lowest cost of the measured paths, or 0 if there is none
+    Time::type best_cost() const
+    {
+      Time::type ret = 0;
+      for (const Path& p : paths)
+	if (measured(p) && (!ret || cost(p) < ret))
+	  ret = cost(p);
+      return ret;
+    }
+
+    // first path that is up and hasn't failed, else the first one up
+    int fallback() const
+    {
+      int ret = -1;
+      for (size_t i = 0; i < paths.size(); ++i)
+	{
+	  const Path& p = paths[i];
+	  if (p.up && p.failures < MAX_FAILURES)
+	    return int(i);
+	  if (p.up && ret < 0)
+	    ret = int(i);
+	}
+      return ret;
+    }
+
+    std::vector<Path> paths;
+    Time::Duration probe_interval;
+    Time::Duration probe_timeout;
+    int probe_path = -1; // path of the outstanding probe
+    Time probe_sent;
+  };
+}
@@ -0,0 +1,174 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Receive side of the stream framing done by PacketStream, for reads
+// that carry many packets.
+//
+// The socket reads straight into the free space of a ring, and
+// length-prefixed packets are parsed out of it in place.  A packet
+// that is contiguous in the ring is returned as a Buffer view into
+// the ring; only a packet that wraps around the end is copied, into
+// a scratch buffer.  A view stays valid until the next call to
+// next() or commit().
+
+#ifndef OPENVPN_TRANSPORT_PKTRING_H
+#define OPENVPN_TRANSPORT_PKTRING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/transport/pktstream.hpp>
+
+namespace openvpn {
+
+  class PacketRing
+  {
+  public:
+    OPENVPN_SIMPLE_EXCEPTION(packet_ring_overflow);
+
+    // capacity must hold at least one maximum-size packet and prefix
+    explicit PacketRing(const size_t capacity)
+      : ring(capacity, BufferAllocated::ARRAY),
+	head(0),
+	size(0)
+    {
+    }
+
+    // contiguous free space for the next read
+    unsigned char* write_ptr()
+    {
+      return ring.data() + tail();
+    }
+
+    size_t write_space() const
+    {
+      if (size == ring.size())
+	return 0;
+      const size_t t = tail();
+      return t >= head ? ring.size() - t : head - t;
+    }
+
+    // account for n bytes read into write_ptr()
+    void commit(const size_t n)
+    {
+      if (n > write_space())
+	throw packet_ring_overflow();
+      size += n;
+    }
+
+    // copy data into the ring, for stream data that didn't come
+    // from a read into write_ptr()
+    void write(const unsigned char* data, size_t n)
+    {
+      while (n)
+	{
+	  const size_t chunk = std::min(n, write_space());
+	  if (!chunk)
+	    throw packet_ring_overflow();
+	  std::memcpy(write_ptr(), data, chunk);
+	  commit(chunk);
+	  data += chunk;
+	  n -= chunk;
+	}
+    }
+
+    // Return the next complete packet as pkt and consume it, or
+    // false if the ring holds only part of one.  Throws
+    // PacketStream::embedded_packet_size_error on a bad prefix.
+    bool next(Buffer& pkt, const Frame::Context& frame_context)
+    {
+      if (size < sizeof(std::uint16_t))
+	return false;
+      const size_t len = (size_t(at(0)) << 8) | at(1);
+      if (!len || len > frame_context.payload())
+	throw PacketStream::embedded_packet_size_error();
+      if (size < sizeof(std::uint16_t) + len)
+	return false;
+
+      const size_t start = (head + sizeof(std::uint16_t)) % ring.size();
+      if (start + len <= ring.size())
+	pkt = Buffer(ring.data() + start, len, true);
+      else
+	{
+	  // wrapped, linearize
+	  const size_t first = ring.size() - start;
+	  scratch.reset(0, len, 0);
+	  scratch.write(ring.c_data() + start, first);
+	  scratch.write(ring.c_data(), len - first);
+	  pkt = Buffer(scratch.data(), len, true);
+	}
+      consume(sizeof(std::uint16_t) + len);
+      return true;
+    }
+
+    // move all buffered bytes, parsed or not, to the end of buf
+    void drain(Buffer& buf)
+    {
+      const size_t first = std::min(size, ring.size() - head);
+      buf.write(ring.c_data() + head, first);
+      buf.write(ring.c_data(), size - first);
+      consume(size);
+    }
+
+    size_t capacity() const
+    {
+      return ring.size();
+    }
+
+    // bytes buffered, including a partial packet
+    size_t buffered() const
+    {
+      return size;
+    }
+
+  private:
+    size_t tail() const
+    {
+      return (head + size) % ring.size();
+    }
+
+    unsigned char at(const size_t i) const
+    {
+      return ring[(head + i) % ring.size()];
+    }
+
+    void consume(const size_t n)
+    {
+      size -= n;
+      if (size)
+	head = (head + n) % ring.size();
+      else
+	head = 0; // keep the next read contiguous
+    }
+
+    BufferAllocated ring;
+    BufferAllocated scratch;
+    size_t head; // offset of the first unconsumed byte
+    size_t size; // bytes in the ring
+  };
+
+} // namespace openvpn
+
+#endif
@@ -0,0 +1,179 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2018 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+  // Packetization layer path MTU discovery (in the spirit of RFC 4821)
+  // for a datagram transport.  Sizes are transport payload sizes,
+  // i.e. OpenVPN packets as handed to the UDP socket.
+  //
+  // The caller sends a probe of about the size returned by probe(),
+  // tells sent() its actual size, and passes the peer's report of the
+  // largest packet it received to reply().  The search starts with max, then bisects between base
+  // and the largest size not yet known to fail.  A size fails after
+  // MAX_PROBES unanswered probes.  Once the search converges, the
+  // discovered size is probed again every RAISE_INTERVAL, which
+  // detects a path that shrank and retries the sizes above it.
+  //
+  // The engine only sends and times; the caller owns the transport.
+  class PMTUDiscovery
+  {
+  public:
+    enum {
+      MAX_PROBES = 3,  // unanswered probes before a size is considered too big
+      MIN_STEP = 16,   // stop bisecting when the window is smaller than this
+    };
+
+    PMTUDiscovery(const unsigned int base, const unsigned int max)
+      : base_(base),
+	max_(max < base ? base : max),
+	probe_timeout(Time::Duration::seconds(2)),
+	raise_interval(Time::Duration::seconds(600))
+    {
+      restart();
+    }
+
+    // Largest confirmed size, or 0 if none is confirmed yet.
+    unsigned int pmtu() const { return pmtu_; }
+
+    // Size of a probe to send now, or 0.  Call at next_event().
+    unsigned int probe(const Time& now)
+    {
+      if (now < next_)
+	return 0;
+
+      if (outstanding)
+	{
+	  // probe timed out
+	  if (++failures < MAX_PROBES)
+	    return send(outstanding, now);
+	  failures = 0;
+	  const unsigned int size = outstanding;
+	  outstanding = 0;
+	  if (state == VERIFY)
+	    {
+	      // the path no longer carries what it did
+	      pmtu_ = 0;
+	      restart();
+	    }
+	  else
+	    hi = size - 1;
+	}
+
+      switch (state)
+	{
+	case SEARCH:
+	  if (!tried_max)
+	    return send(max_, now);
+	  if (hi >= lo + MIN_STEP)
+	    return send((lo + hi + 1) / 2, now);
+	  state = IDLE;
+	  next_ = now + raise_interval;
+	  return 0;
+	default: // raise timer fired
+	  if (!pmtu_)
+	    {
+	      restart();
+	      return send(max_, now);
+	    }
+	  state = VERIFY;
+	  return send(lo, now);
+	}
+    }
+
+    // Actual size of the probe sent after probe(), as the data
+    // channel may not hit the requested size exactly.  0 if the
+    // probe wasn't sent, which then times out.
+    void sent(const unsigned int size)
+    {
+      sent_size = size;
+    }
+
+    // Peer reports max_recv as the largest packet it received since
+    // its previous report.  Returns true if pmtu() changed.
+    bool reply(const unsigned int max_recv, const Time& now)
+    {
+      if (!outstanding || !sent_size || max_recv < sent_size)
+	return false;
+      const unsigned int prev = pmtu_;
+      if (state == VERIFY)
+	{
+	  // still good, look above it again
+	  restart();
+	}
+      lo = outstanding;
+      pmtu_ = sent_size;
+      outstanding = 0;
+      failures = 0;
+      next_ = now;
+      return pmtu_ != prev;
+    }
+
+    // When probe() should be called next.
+    Time next_event() const { return next_; }
+
+    void set_probe_timeout(const Time::Duration& d) { probe_timeout = d; }
+    void set_raise_interval(const Time::Duration& d) { raise_interval = d; }
+
+  private:
+    enum State {
+      SEARCH,  // bisecting
+      IDLE,    // converged, waiting for the raise timer
+      VERIFY,  // probing the current pmtu() again
+    };
+
+    void restart()
+    {
+      state = SEARCH;
+      lo = base_;
+      hi = max_;
+      tried_max = false;
+    }
+
+    unsigned int send(const unsigned int size, const Time& now)
+    {
+      if (size == max_)
+	tried_max = true;
+      outstanding = size;
+      sent_size = size;
+      next_ = now + probe_timeout;
+      return size;
+    }
+
+    const unsigned int base_;
+    const unsigned int max_;
+    State state;
+    unsigned int lo;              // largest size known or assumed to pass
+    unsigned int hi;              // largest size not known to fail
+    unsigned int pmtu_ = 0;
+    unsigned int outstanding = 0; // size of the probe awaiting a reply
+    unsigned int sent_size = 0;   // its actual size
+    unsigned int failures = 0;    // unanswered probes of that size
+    bool tried_max = false;
+    Time next_;
+    Time::Duration probe_timeout;
+    Time::Duration raise_interval;
+  };
+}
@@ -0,0 +1,239 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// A pool of sockets protected ahead of time, so that connecting
+// doesn't wait for a socket_protect() round trip into the app (on
+// Android, a JNI call into VpnService.protect()).  A background
+// thread keeps a few sockets of each protocol and address family
+// ready, protecting them with the unspecified address of their
+// family, and tops up the pool as transports take sockets from it.
+// Only usable with a SocketProtect whose decision doesn't depend
+// on the endpoint, see BaseSocketProtect::socket_protect_ahead().
+
+#ifndef OPENVPN_TRANSPORT_PROTECTPOOL_H
+#define OPENVPN_TRANSPORT_PROTECTPOOL_H
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/io/io.hpp>
+
+#if !defined(OPENVPN_PLATFORM_WIN)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/transport/socket_protect.hpp>
+
+namespace openvpn {
+
+  class ProtectedSocketPool : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<ProtectedSocketPool> Ptr;
+
+    enum Kind {
+      UDP4 = 0,
+      UDP6,
+      TCP4,
+      TCP6,
+      N_KINDS,
+    };
+
+    // protect must outlive the pool, or at least stop()
+    ProtectedSocketPool(SocketProtect* protect_arg, const size_t depth_arg=2)
+      : protect(protect_arg),
+	depth(depth_arg)
+    {
+      for (auto& d : disabled)
+	d = false;
+      thread = std::thread([this]() { run(); });
+    }
+
+    ~ProtectedSocketPool()
+    {
+      stop();
+      for (auto& q : ready)
+	for (const int fd : q)
+	  close_socket(fd);
+    }
+
+    static Kind kind(const bool tcp, const bool ipv6)
+    {
+      return Kind((tcp ? TCP4 : UDP4) + ipv6);
+    }
+
+    // Returns a protected socket of the given kind, owned by the
+    // caller, or -1 if none is ready.
+    int take(const Kind k)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::deque<int>& q = ready[k];
+      if (q.empty())
+	{
+	  ++n_misses;
+	  return -1;
+	}
+      const int fd = q.front();
+      q.pop_front();
+      ++n_hits;
+      cond.notify_one();
+      return fd;
+    }
+
+    // Hand a socket from the pool to an unopened asio socket.
+    // Returns false if none is ready, in which case the caller
+    // should open and protect the socket itself.
+    template <typename SOCKET, typename PROTOCOL>
+    bool assign(SOCKET& socket, const PROTOCOL& protocol)
+    {
+      const int fd = take(kind(protocol.type() == SOCK_STREAM, protocol.family() == AF_INET6));
+      if (fd < 0)
+	return false;
+      openvpn_io::error_code error;
+      socket.assign(protocol, fd, error);
+      if (error)
+	{
+	  close_socket(fd);
+	  return false;
+	}
+      return true;
+    }
+
+    size_t hits() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return n_hits;
+    }
+
+    size_t misses() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return n_misses;
+    }
+
+    // Wait until the pool is full or the kinds that can't be
+    // created or protected have been given up on.
+    void wait_full()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      full_cond.wait(lock, [this]() { return halt || next_kind() == N_KINDS; });
+    }
+
+    // Stop the refill thread.  No socket_protect() calls are made
+    // after this returns.
+    void stop()
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	halt = true;
+      }
+      cond.notify_one();
+      if (thread.joinable())
+	thread.join();
+    }
+
+  private:
+    static void close_socket(const int fd)
+    {
+#if defined(OPENVPN_PLATFORM_WIN)
+      ::closesocket(fd);
+#else
+      ::close(fd);
+#endif
+    }
+
+    void run()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+	{
+	  Kind k = N_KINDS;
+	  cond.wait(lock, [&]() { return halt || (k = next_kind()) != N_KINDS; });
+	  if (halt)
+	    break;
+
+	  lock.unlock();
+	  const int fd = open_protected(k);
+	  lock.lock();
+
+	  if (fd >= 0)
+	    ready[k].push_back(fd);
+	  else
+	    disabled[k] = true; // e.g. no IPv6, or protect refused
+	  if (next_kind() == N_KINDS)
+	    full_cond.notify_all();
+	}
+      full_cond.notify_all();
+    }
+
+    // called with mutex held
+    Kind next_kind() const
+    {
+      for (int k = 0; k < N_KINDS; ++k)
+	if (!disabled[k] && ready[k].size() < depth)
+	  return Kind(k);
+      return N_KINDS;
+    }
+
+    int open_protected(const Kind k)
+    {
+      const bool ipv6 = (k == UDP6 || k == TCP6);
+      const bool tcp = (k == TCP4 || k == TCP6);
+      int type = tcp ? SOCK_STREAM : SOCK_DGRAM;
+#ifdef SOCK_CLOEXEC
+      type |= SOCK_CLOEXEC;
+#endif
+      const int fd = ::socket(ipv6 ? AF_INET6 : AF_INET, type, tcp ? IPPROTO_TCP : IPPROTO_UDP);
+      if (fd < 0)
+	return -1;
+      if (!protect->socket_protect(fd, IP::Addr::from_zero(ipv6 ? IP::Addr::V6 : IP::Addr::V4)))
+	{
+	  close_socket(fd);
+	  return -1;
+	}
+      return fd;
+    }
+
+    SocketProtect* protect;
+    const size_t depth;
+
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::condition_variable full_cond;
+    std::deque<int> ready[N_KINDS];
+    bool disabled[N_KINDS];
+    bool halt = false;
+    size_t n_hits = 0;
+    size_t n_misses = 0;
+    std::thread thread;
+  };
+
+}
+
+#endif
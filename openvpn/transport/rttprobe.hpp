@@ -0,0 +1,176 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+  // Round trip time, jitter and loss of the data channel path,
+  // measured with timestamped probes that the peer echoes.
+  //
+  // When probe() returns true, the caller sends a probe with its
+  // sequence number and the microsecond timestamp passed to probe(),
+  // and passes each echo to reply().  The peer reports how long it held the probe before
+  // answering, which is not counted.  A probe that is not answered
+  // within the timeout counts as lost.
+  //
+  // The smoothed RTT and its variation follow RFC 6298, the jitter
+  // is the RFC 3550 interarrival jitter of successive RTT samples,
+  // and the loss rate is a moving average over about the last 16
+  // probes.  All times are in microseconds.
+  class RTTProbe
+  {
+  public:
+    enum {
+      SLOTS = 16,      // probes awaiting an echo
+      LOSS_SCALE = 1000000,
+    };
+
+    RTTProbe(const Time::Duration& interval,
+	     const Time::Duration& timeout = Time::Duration::seconds(2))
+      : interval_(interval),
+	timeout_(timeout)
+    {
+    }
+
+    // If a probe is due, pick its sequence number and return true.
+    // now_us is the timestamp that the probe carries.
+    bool probe(const Time& now, const std::uint64_t now_us, std::uint32_t& seq)
+    {
+      expire(now);
+      if (now < next_)
+	return false;
+      Slot& s = slots[++seq_ % SLOTS];
+      if (s.pending)
+	lost(s);
+      s.pending = true;
+      s.seq = seq_;
+      s.ts = now_us;
+      s.sent = now;
+      ++probes_;
+      next_ = now + interval_;
+      seq = seq_;
+      return true;
+    }
+
+    // Echo of probe seq with timestamp ts, received at now_us after
+    // the peer held it for hold_us.  Returns false if it doesn't
+    // match a probe that is still waiting, such as a late echo of a
+    // probe already counted as lost.
+    bool reply(const std::uint32_t seq, const std::uint64_t ts,
+	       const std::uint32_t hold_us, const std::uint64_t now_us)
+    {
+      Slot& s = slots[seq % SLOTS];
+      if (!s.pending || s.seq != seq || s.ts != ts || now_us < ts)
+	return false;
+      s.pending = false;
+      ++replies_;
+      loss_ -= loss_ / 16;
+
+      const std::uint64_t elapsed = now_us - ts;
+      const std::uint64_t r = elapsed > hold_us ? elapsed - hold_us : 0;
+      if (!sampled_)
+	{
+	  srtt_ = r;
+	  rttvar_ = r / 2;
+	}
+      else
+	{
+	  rttvar_ = (3 * rttvar_ + absdiff(srtt_, r)) / 4;
+	  srtt_ = (7 * srtt_ + r) / 8;
+	  const std::int64_t j = std::int64_t(jitter_);
+	  jitter_ = std::uint64_t(j + (std::int64_t(absdiff(last_, r)) - j) / 16);
+	}
+      last_ = r;
+      sampled_ = true;
+      return true;
+    }
+
+    // true once there is an RTT sample
+    bool defined() const { return sampled_; }
+
+    std::uint64_t srtt() const { return srtt_; }
+    std::uint64_t rttvar() const { return rttvar_; }
+    std::uint64_t jitter() const { return jitter_; }
+    std::uint64_t last() const { return last_; }
+
+    // RFC 6298 retransmission timeout: srtt + 4 * rttvar
+    std::uint64_t rto() const { return srtt_ + 4 * rttvar_; }
+
+    // fraction of recent probes lost, in 1/LOSS_SCALE
+    unsigned int loss() const { return loss_; }
+    unsigned int loss_permille() const { return loss_ / (LOSS_SCALE / 1000); }
+
+    std::uint64_t probes() const { return probes_; }
+    std::uint64_t replies() const { return replies_; }
+    std::uint64_t lost() const { return lost_; }
+
+    // When probe() should be called next.
+    Time next_event() const { return next_; }
+
+  private:
+    struct Slot
+    {
+      std::uint64_t ts = 0;
+      Time sent;
+      std::uint32_t seq = 0;
+      bool pending = false;
+    };
+
+    void expire(const Time& now)
+    {
+      for (auto& s : slots)
+	if (s.pending && now >= s.sent + timeout_)
+	  lost(s);
+    }
+
+    void lost(Slot& s)
+    {
+      s.pending = false;
+      ++lost_;
+      loss_ += (LOSS_SCALE - loss_) / 16;
+    }
+
+    static std::uint64_t absdiff(const std::uint64_t a, const std::uint64_t b)
+    {
+      return a > b ? a - b : b - a;
+    }
+
+    const Time::Duration interval_;
+    const Time::Duration timeout_;
+    Slot slots[SLOTS];
+    std::uint32_t seq_ = 0;
+    Time next_;
+    std::uint64_t srtt_ = 0;
+    std::uint64_t rttvar_ = 0;
+    std::uint64_t jitter_ = 0;
+    std::uint64_t last_ = 0;
+    unsigned int loss_ = 0;
+    std::uint64_t probes_ = 0;
+    std::uint64_t replies_ = 0;
+    std::uint64_t lost_ = 0;
+    bool sampled_ = false;
+  };
+}
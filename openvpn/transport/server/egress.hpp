@@ -0,0 +1,425 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Egress scheduler for the sessions of a server thread, in front of
+// the transport.  Each session sends through its own queue (Queue,
+// which wraps the session's TransportClientInstance::Send), and the
+// queues are drained in deficit round robin order, quantum bytes per
+// turn, so that one bulk download can't fill the socket buffer ahead
+// of everyone else.  Each queue drops by the CoDel control law
+// (RFC 8289) once its packets have been waiting longer than target
+// for a whole interval, which keeps the standing queue short.
+//
+// A queue can have a rate limit, to which its packets are paced:
+// held until their departure time, or, if the transport supports
+// SO_TXTIME, handed to it early with the departure time.  An
+// optional link rate paces the whole scheduler, so that the queue
+// builds up here, where it is fair, rather than in the socket
+// buffer or further down the path.
+//
+// Control channel packets (transport_send_const()) are few and
+// latency sensitive, and bypass the queues.
+
+#ifndef OPENVPN_TRANSPORT_SERVER_EGRESS_H
+#define OPENVPN_TRANSPORT_SERVER_EGRESS_H
+
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/log/latencyhist.hpp>
+#include <openvpn/transport/server/transbase.hpp>
+
+namespace openvpn {
+
+  class EgressScheduler : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<EgressScheduler> Ptr;
+
+    struct Config
+    {
+      size_t quantum = 1514;                // bytes per queue per round
+      size_t queue_limit = 1024;            // packets per queue, tail drop above
+      std::uint64_t target_ns = 5000000;    // CoDel target sojourn time
+      std::uint64_t interval_ns = 100000000; // CoDel interval
+      std::uint64_t link_rate = 0;          // bytes per second for all queues, 0 for no limit
+      std::uint64_t txtime_horizon_ns = 10000000; // how early paced packets go to SO_TXTIME transports
+      unsigned int burst = 64;              // packets per drain run, between reactor turns
+    };
+
+    struct Stats
+    {
+      std::uint64_t sent = 0;
+      std::uint64_t codel_drops = 0;
+      std::uint64_t overflow_drops = 0;
+    };
+
+    class Queue : public TransportClientInstance::Send
+    {
+    public:
+      typedef RCPtr<Queue> Ptr;
+
+      // packets queued
+      size_t size() const { return packets.size(); }
+
+      // bytes per second, 0 for no limit
+      void set_rate(const std::uint64_t rate_arg)
+      {
+	rate = rate_arg;
+      }
+
+      std::uint64_t get_rate() const { return rate; }
+
+      bool defined() const override
+      {
+	return inner->defined();
+      }
+
+      void stop() override
+      {
+	packets.clear();
+	bytes = 0;
+	sched->remove(this);
+	inner->stop();
+      }
+
+      bool transport_send_const(const Buffer& buf) override
+      {
+	return inner->transport_send_const(buf);
+      }
+
+      bool transport_send(BufferAllocated& buf) override
+      {
+	return sched->enqueue(*this, buf);
+      }
+
+      const std::string& transport_info() const override
+      {
+	return inner->transport_info();
+      }
+
+      bool stats_pending() const override
+      {
+	return inner->stats_pending();
+      }
+
+      PeerStats stats_poll() override
+      {
+	return inner->stats_poll();
+      }
+
+    private:
+      friend class EgressScheduler;
+
+      struct Packet
+      {
+	BufferAllocated buf;
+	std::uint64_t enqueued;
+      };
+
+      Queue(EgressScheduler* sched_arg, TransportClientInstance::Send::Ptr inner_arg, const std::uint64_t rate_arg)
+	: sched(sched_arg),
+	  inner(std::move(inner_arg)),
+	  rate(rate_arg)
+      {
+      }
+
+      EgressScheduler::Ptr sched;
+      TransportClientInstance::Send::Ptr inner;
+      std::deque<Packet> packets;
+      size_t bytes = 0;
+      std::uint64_t rate;
+      std::uint64_t next_departure = 0; // pacing
+      long deficit = 0;
+      bool active = false;             // in the round robin
+      bool turn = false;               // has had its quantum this round
+
+      // CoDel state
+      std::uint64_t first_above = 0;
+      std::uint64_t drop_next = 0;
+      unsigned int drop_count = 0;
+      bool dropping = false;
+    };
+
+    EgressScheduler(openvpn_io::io_context& io_context, const Config& config_arg)
+      : config(config_arg),
+	timer(io_context),
+	executor(io_context.get_executor())
+    {
+    }
+
+    // Queue for a session's packets to inner, rate limited to rate
+    // bytes per second unless 0.  Pass it to the session in place
+    // of inner.
+    Queue::Ptr new_queue(TransportClientInstance::Send::Ptr inner, const std::uint64_t rate = 0)
+    {
+      return new Queue(this, std::move(inner), rate);
+    }
+
+    const Stats& stats() const { return stats_; }
+
+    // Send what is due at now, up to Config::burst packets.
+    // Returns the time at which more is due, 0 if nothing is
+    // queued.  Called by the scheduler itself, public for tests.
+    std::uint64_t run(const std::uint64_t now)
+    {
+      unsigned int n = 0;
+      size_t idle = 0; // queues in a row not yet due
+      while (!round.empty() && idle < round.size())
+	{
+	  if (n >= config.burst || (config.link_rate && link_departure > now))
+	    return std::max(link_departure, now);
+
+	  Queue& q = *round.front();
+	  if (!due(q, now))
+	    {
+	      end_turn();
+	      ++idle;
+	      continue;
+	    }
+	  if (!q.turn)
+	    {
+	      q.turn = true;
+	      q.deficit += long(config.quantum);
+	    }
+	  const size_t size = q.packets.front().buf.size();
+	  if (long(size) > q.deficit)
+	    {
+	      end_turn();
+	      continue;
+	    }
+
+	  Queue::Packet p = std::move(q.packets.front());
+	  q.packets.pop_front();
+	  q.bytes -= size;
+	  q.deficit -= long(size);
+	  if (codel_drop(q, p, now))
+	    ++stats_.codel_drops;
+	  else
+	    {
+	      send(q, p.buf, now);
+	      ++n;
+	    }
+	  idle = 0;
+	  if (q.packets.empty())
+	    {
+	      q.deficit = 0;
+	      q.turn = false;
+	      q.active = false;
+	      round.pop_front();
+	    }
+	}
+      return next_event(now);
+    }
+
+  private:
+    friend class Queue;
+
+    bool enqueue(Queue& q, BufferAllocated& buf)
+    {
+      if (q.packets.size() >= config.queue_limit)
+	{
+	  ++stats_.overflow_drops;
+	  return false;
+	}
+      q.packets.push_back(Queue::Packet{std::move(buf), now_ns()});
+      q.bytes += q.packets.back().buf.size();
+      if (!q.active)
+	{
+	  q.active = true;
+	  round.emplace_back(&q);
+	}
+      schedule();
+      return true;
+    }
+
+    void remove(Queue* q)
+    {
+      for (auto i = round.begin(); i != round.end(); ++i)
+	if (i->get() == q)
+	  {
+	    q->active = false;
+	    q->turn = false;
+	    round.erase(i);
+	    break;
+	  }
+    }
+
+    void end_turn()
+    {
+      Queue::Ptr q = std::move(round.front());
+      round.pop_front();
+      q->turn = false;
+      round.push_back(std::move(q));
+    }
+
+    // departure time of the next packet of q
+    std::uint64_t departure(const Queue& q, const std::uint64_t now) const
+    {
+      return q.rate ? std::max(q.next_departure, now) : now;
+    }
+
+    bool due(const Queue& q, const std::uint64_t now) const
+    {
+      if (!q.rate || q.next_departure <= now)
+	return true;
+      return q.inner->transport_txtime() && q.next_departure <= now + config.txtime_horizon_ns;
+    }
+
+    static std::uint64_t tx_ns(const size_t size, const std::uint64_t rate)
+    {
+      return std::uint64_t(size) * 1000000000ull / rate;
+    }
+
+    void send(Queue& q, BufferAllocated& buf, const std::uint64_t now)
+    {
+      const size_t size = buf.size();
+      const std::uint64_t dep = departure(q, now);
+      if (q.rate)
+	q.next_departure = dep + tx_ns(size, q.rate);
+      if (config.link_rate)
+	link_departure = std::max(link_departure, now) + tx_ns(size, config.link_rate);
+      if (dep > now)
+	q.inner->transport_send_txtime(buf, dep);
+      else
+	q.inner->transport_send(buf);
+      ++stats_.sent;
+    }
+
+    // RFC 8289 dequeue: returns true if p is to be dropped
+    bool codel_drop(Queue& q, const Queue::Packet& p, const std::uint64_t now)
+    {
+      bool ok_to_drop = false;
+      if (now - p.enqueued < config.target_ns || q.bytes < config.quantum)
+	q.first_above = 0;
+      else if (!q.first_above)
+	q.first_above = now + config.interval_ns;
+      else if (now >= q.first_above)
+	ok_to_drop = true;
+
+      if (q.dropping)
+	{
+	  if (!ok_to_drop)
+	    q.dropping = false;
+	  else if (now >= q.drop_next)
+	    {
+	      ++q.drop_count;
+	      q.drop_next = control_law(q.drop_next, q.drop_count);
+	      return true;
+	    }
+	}
+      else if (ok_to_drop)
+	{
+	  q.dropping = true;
+	  // resume at the previous drop rate if that was recent
+	  q.drop_count = (q.drop_count > 2 && now - q.drop_next < 8 * config.interval_ns) ? q.drop_count - 2 : 1;
+	  q.drop_next = control_law(now, q.drop_count);
+	  return true;
+	}
+      return false;
+    }
+
+    std::uint64_t control_law(const std::uint64_t t, const unsigned int count) const
+    {
+      return t + std::uint64_t(double(config.interval_ns) / std::sqrt(double(count)));
+    }
+
+    // earliest time at which a queued packet is due, 0 if none
+    std::uint64_t next_event(const std::uint64_t now) const
+    {
+      if (round.empty())
+	return 0;
+      std::uint64_t ret = ~std::uint64_t(0);
+      for (const auto& q : round)
+	{
+	  std::uint64_t t = departure(*q, now);
+	  if (q->inner->transport_txtime() && t > now + config.txtime_horizon_ns)
+	    t -= config.txtime_horizon_ns;
+	  else if (q->inner->transport_txtime())
+	    t = now;
+	  ret = std::min(ret, t);
+	}
+      if (config.link_rate)
+	ret = std::max(ret, link_departure);
+      return std::max(ret, now);
+    }
+
+    static std::uint64_t now_ns()
+    {
+      return LatencyHistogram::now_ns();
+    }
+
+    // drain at the end of the current reactor turn, so that the
+    // packets of all sessions from that turn are interleaved
+    void schedule()
+    {
+      if (run_queued)
+	return;
+      run_queued = true;
+      openvpn_io::post(executor, [self=Ptr(this)]()
+		       {
+			 OPENVPN_ASYNC_HANDLER;
+			 self->run_queued = false;
+			 self->drain();
+		       });
+    }
+
+    void drain()
+    {
+      const std::uint64_t now = now_ns();
+      const std::uint64_t next = run(now);
+      if (!next)
+	return;
+      if (next <= now)
+	{
+	  schedule();
+	  return;
+	}
+      timer.expires_after(std::chrono::nanoseconds(next - now));
+      timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+		       {
+			 OPENVPN_ASYNC_HANDLER;
+			 if (!error)
+			   self->drain();
+		       });
+    }
+
+    const Config config;
+    std::deque<Queue::Ptr> round; // queues with packets, in round robin order
+    std::uint64_t link_departure = 0;
+    Stats stats_;
+    openvpn_io::steady_timer timer;
+    openvpn_io::io_context::executor_type executor;
+    bool run_queued = false;
+  };
+
+} // namespace openvpn
+
+#endif
@@ -0,0 +1,302 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Load-driven placement of new sessions across the shards of a
+// ShardedServer.
+//
+// The kernel hashes a new client's handshake to some shard, and
+// without help the session would live there for good.  When that
+// shard is busier than the others, ShardBalancer::place() picks a
+// less loaded shard (preferring one on the same NUMA node) and the
+// receiving shard hands the packet over.  The session is then
+// created on the target shard and allocates its peer ID from the
+// target's residue class, so the steering program delivers its data
+// packets there directly.  The shard the client hashes to keeps a
+// small redirect entry and forwards the remaining packets without
+// a peer ID (control channel, P_DATA_V1) to the owner.  All shard
+// sockets are bound to the same local endpoint, so the owner can
+// reply from its own socket.
+//
+// Load is the recent packet rate of each shard, sampled periodically
+// by the ShardedServer, plus a per-session estimate for sessions
+// placed since the last sample so that a burst of new clients
+// doesn't all land on the same shard.
+//
+// Threading: the load counters are atomic.  Each shard's redirect
+// table and ShardRecv pointer are only touched on that shard's own
+// thread; other shards reach them with openvpn_io::post().
+
+#ifndef OPENVPN_TRANSPORT_SERVER_SHARDBALANCE_H
+#define OPENVPN_TRANSPORT_SERVER_SHARDBALANCE_H
+
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/addrkey.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+namespace openvpn {
+  namespace UDPTransport {
+
+    // Implemented by shard servers that accept sessions placed on
+    // them by another shard.
+    struct ShardRecv
+    {
+      // Called on this shard's thread with a packet from a peer whose
+      // session lives (or is to be created) here, but which arrived
+      // on from_shard's socket.
+      virtual void shard_recv(BufferAllocated& buf, const PeerAddr::Ptr& addr, const unsigned int from_shard) = 0;
+    };
+
+    class ShardBalancer : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<ShardBalancer> Ptr;
+
+      OPENVPN_SIMPLE_EXCEPTION(shard_balancer_error);
+
+      enum {
+	IMBALANCE_PCT = 25, // keep a new session where it arrived unless load exceeds the minimum by this much
+	SLACK = 64,         // ... plus this many packets per sample interval
+	SAME_NODE_PCT = 10, // prefer a shard on the arriving shard's node if within this much of the minimum
+      };
+
+      explicit ShardBalancer(const unsigned int n_shards_arg)
+	: n_shards(n_shards_arg),
+	  shards(new Shard[n_shards_arg])
+      {
+	if (!n_shards)
+	  throw shard_balancer_error();
+      }
+
+      unsigned int size() const
+      {
+	return n_shards;
+      }
+
+      // Setup, before the shards start.
+      void attach(const unsigned int shard, openvpn_io::io_context& io_context, const size_t node)
+      {
+	Shard& s = get(shard);
+	s.io_context = &io_context;
+	s.node = node;
+      }
+
+      // Register (or with nullptr, unregister) the shard's receiver.
+      // Call on the shard's own thread, e.g. from start() and stop().
+      void set_recv(const unsigned int shard, ShardRecv* recv)
+      {
+	Shard& s = get(shard);
+	s.recv = recv;
+	if (!recv)
+	  s.redirect.clear();
+      }
+
+      // Load accounting, callable from any thread.
+
+      void count_packets(const unsigned int shard, const unsigned int n)
+      {
+	get(shard).packets.fetch_add(n, std::memory_order_relaxed);
+      }
+
+      void session_up(const unsigned int shard)
+      {
+	get(shard).sessions.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void session_down(const unsigned int shard)
+      {
+	get(shard).sessions.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      unsigned int sessions(const unsigned int shard) const
+      {
+	return get(shard).sessions.load(std::memory_order_relaxed);
+      }
+
+      unsigned int load(const unsigned int shard) const
+      {
+	return get(shard).score.load(std::memory_order_relaxed);
+      }
+
+      // Fold the packets counted since the last call into each
+      // shard's load.  Called periodically from one thread.
+      void sample()
+      {
+	for (unsigned int i = 0; i < n_shards; ++i)
+	  {
+	    Shard& s = shards[i];
+	    const std::uint64_t packets = s.packets.load(std::memory_order_relaxed);
+	    const std::uint64_t delta = packets - s.last_packets;
+	    s.last_packets = packets;
+	    const std::uint64_t rate = delta < 0xFFFFFFFF ? delta : 0xFFFFFFFF;
+	    const unsigned int prev = s.score.load(std::memory_order_relaxed);
+	    s.score.store(static_cast<unsigned int>((std::uint64_t(prev) + 3 * rate) / 4), std::memory_order_relaxed);
+	  }
+      }
+
+      // Return the shard that should own a new session whose first
+      // packet arrived on from_shard.
+      unsigned int place(const unsigned int from_shard)
+      {
+	const Shard& from = get(from_shard);
+	unsigned int best = from_shard;
+	unsigned int best_node = from_shard;
+	std::uint64_t total = 0;
+	unsigned int total_sessions = 0;
+	for (unsigned int i = 0; i < n_shards; ++i)
+	  {
+	    const unsigned int l = load(i);
+	    total += l;
+	    total_sessions += sessions(i);
+	    if (l < load(best))
+	      best = i;
+	    if (shards[i].node == from.node && l < load(best_node))
+	      best_node = i;
+	  }
+
+	const std::uint64_t min = load(best);
+	unsigned int target = from_shard;
+	if (load(from_shard) > min * (100 + IMBALANCE_PCT) / 100 + SLACK)
+	  target = load(best_node) <= min * (100 + SAME_NODE_PCT) / 100 + SLACK ? best_node : best;
+
+	// charge the target for the new session until the next sample
+	const std::uint64_t per_session = total_sessions ? total / total_sessions : 0;
+	shards[target].score.fetch_add(static_cast<unsigned int>(per_session ? per_session : 1), std::memory_order_relaxed);
+	return target;
+      }
+
+      // Redirects, called on from_shard's thread.
+
+      // Return the owning shard of a peer whose session was placed
+      // on another shard, or -1.
+      int redirect_of(const unsigned int from_shard, const AddrPort& remote) const
+      {
+	const Shard& s = get(from_shard);
+	if (s.redirect.empty())
+	  return -1;
+	const auto i = s.redirect.find(key(remote));
+	return i != s.redirect.end() ? int(i->second) : -1;
+      }
+
+      // Place a new session whose first packet arrived on from_shard.
+      // If it belongs elsewhere, remember the redirect, hand the packet
+      // to the target shard and return true.  Otherwise return false
+      // and leave buf alone.
+      bool forward_new(const unsigned int from_shard, BufferAllocated& buf, const PeerAddr& addr)
+      {
+	const unsigned int target = place(from_shard);
+	if (target == from_shard || !get(target).io_context)
+	  return false;
+	get(from_shard).redirect[key(addr.remote)] = target;
+	forward(from_shard, target, buf, addr);
+	return true;
+      }
+
+      // Hand a packet that arrived on from_shard to the target shard.
+      void forward(const unsigned int from_shard, const unsigned int target, BufferAllocated& buf, const PeerAddr& addr)
+      {
+	Shard& t = get(target);
+	if (!t.io_context)
+	  return;
+	openvpn_io::post(*t.io_context, [self=Ptr(this), from_shard, target, b=std::move(buf),
+					 remote=addr.remote, local=addr.local]() mutable {
+	    ShardRecv* recv = self->shards[target].recv;
+	    if (recv)
+	      {
+		PeerAddr::Ptr a(new PeerAddr());
+		a->remote = remote;
+		a->local = local;
+		recv->shard_recv(b, a, from_shard);
+	      }
+	  });
+      }
+
+      // Called on the owner's thread when a session that was forwarded
+      // from from_shard goes away, to drop the redirect there.
+      void release(const unsigned int from_shard, const AddrPort& remote)
+      {
+	Shard& f = get(from_shard);
+	if (!f.io_context)
+	  return;
+	openvpn_io::post(*f.io_context, [self=Ptr(this), from_shard, k=key(remote)]() {
+	    self->shards[from_shard].redirect.erase(k);
+	  });
+      }
+
+    private:
+      struct Shard
+      {
+	// any thread, padded so that neighbouring shards' counters
+	// don't share a cache line (heap new[] only guarantees 16-byte
+	// alignment before C++17)
+	char pad[64];
+	std::atomic<std::uint64_t> packets{0};
+	std::atomic<unsigned int> sessions{0};
+	std::atomic<unsigned int> score{0};
+
+	// sampler thread
+	std::uint64_t last_packets = 0;
+
+	// fixed after setup
+	openvpn_io::io_context* io_context = nullptr;
+	size_t node = 0;
+
+	// shard's own thread
+	ShardRecv* recv = nullptr;
+	std::unordered_map<IP::AddrKey, unsigned int, IP::AddrKey::KeyedHash> redirect;
+      };
+
+      static IP::AddrKey key(const AddrPort& ap)
+      {
+	return IP::AddrKey(ap.addr, ap.port);
+      }
+
+      Shard& get(const unsigned int shard)
+      {
+	if (shard >= n_shards)
+	  throw shard_balancer_error();
+	return shards[shard];
+      }
+
+      const Shard& get(const unsigned int shard) const
+      {
+	if (shard >= n_shards)
+	  throw shard_balancer_error();
+	return shards[shard];
+      }
+
+      const unsigned int n_shards;
+      std::unique_ptr<Shard[]> shards;
+    };
+
+  }
+}
+
+#endif
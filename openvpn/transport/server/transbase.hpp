@@ -27,6 +27,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 #include <openvpn/io/io.hpp>
 
@@ -39,6 +40,7 @@
 #include <openvpn/server/servhalt.hpp>
 #include <openvpn/server/peerstats.hpp>
 #include <openvpn/server/peeraddr.hpp>
+#include <openvpn/server/servconfig.hpp>
 #include <openvpn/ssl/datalimit.hpp>
 
 namespace openvpn {
@@ -76,6 +78,16 @@ namespace openvpn {
       virtual bool transport_send_const(const Buffer& buf) = 0;
       virtual bool transport_send(BufferAllocated& buf) = 0;
 
+      // Transports on a socket with SO_TXTIME (see
+      // UDPTransport::Link::send_txtime()) return true and implement
+      // transport_send_txtime(), which sends buf with a departure
+      // time in CLOCK_MONOTONIC nanoseconds for the kernel to pace.
+      virtual bool transport_txtime() const { return false; }
+      virtual bool transport_send_txtime(BufferAllocated& buf, const std::uint64_t departure)
+      {
+	return transport_send(buf);
+      }
+
       virtual const std::string& transport_info() const = 0;
 
       // bandwidth stats polling
@@ -133,6 +145,11 @@ namespace openvpn {
 					 const std::string& reason,
 					 const bool tell_client) = 0;
 
+      // Move a running session to a newly published server config,
+      // pushing the changes it can take without reconnecting.
+      virtual void reload_config(const ServerConfig::Ptr& config)
+      {
+      }
     };
 
     // Base class for factory used to create Recv objects.
@@ -142,6 +159,36 @@ namespace openvpn {
 
       virtual Recv::Ptr new_client_instance() = 0;
       virtual bool validate_initial_packet(const BufferAllocated& net_buf) = 0;
+
+      // Validate a burst of initial packets, e.g. from one recvmmsg()
+      // call, setting ok[i] for each of bufs[i].  Returns the number
+      // of valid packets.
+      virtual size_t validate_initial_packets(const BufferAllocated* const* bufs, const size_t n, bool* ok)
+      {
+	size_t n_ok = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    ok[i] = validate_initial_packet(*bufs[i]);
+	    n_ok += ok[i];
+	  }
+	return n_ok;
+      }
+
+      enum InitialPacket {
+	INITIAL_DROP,     // drop the packet
+	INITIAL_REPLY,    // send reply to the peer, don't create an instance
+	INITIAL_INSTANCE, // create an instance and pass it the packet
+      };
+
+      // Called with packets from peers that have no instance yet.
+      // Factories that answer the initial reset statelessly override
+      // this, the default only validates the packet.
+      virtual InitialPacket process_initial_packet(const BufferAllocated& net_buf,
+						   const PeerAddr& addr,
+						   BufferAllocated& reply)
+      {
+	return validate_initial_packet(net_buf) ? INITIAL_INSTANCE : INITIAL_DROP;
+      }
     };
 
   }
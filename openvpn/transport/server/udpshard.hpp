@@ -0,0 +1,469 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Sharded UDP server transport.  One SO_REUSEPORT UDP socket is
+// opened per shard on the same local endpoint, and each shard runs
+// its own io_context on its own thread (shard 0 runs on the io_context
+// passed to the factory).  On Linux, a classic BPF program is attached
+// to the reuseport group that steers P_DATA_V2 packets to shard
+// (peer_id % n_shards).  All other packets, including the initial
+// handshake and P_DATA_V1, fall back to the kernel's 4-tuple hash,
+// so a new client's session is created on the shard its handshake
+// arrived on.  As long as each shard allocates peer IDs from its own
+// residue class (see ShardPeerID), the session's P_DATA_V2 packets
+// keep arriving on that shard after the client floats.  Its control
+// packets (P_CONTROL, P_ACK) carry no peer ID, though, so from the
+// new address they are hashed to an arbitrary shard.  A shard server
+// must forward those to the owning shard, as it does for sessions
+// placed by ShardBalancer; otherwise a renegotiation after a float
+// fails and the session ends when its key expires.
+//
+// Optionally, a ShardBalancer moves new sessions off busy shards (see
+// shardbalance.hpp), and on NUMA machines the shard threads are
+// spread over the nodes and bound to their node's CPUs.  With
+// udp-shard-xdp, an AF_XDP program is attached to the server's
+// interface and each shard receives the queues assigned to it through
+// XDPLink (see xdplink.hpp), next to its UDP socket.
+
+#ifndef OPENVPN_TRANSPORT_SERVER_UDPSHARD_H
+#define OPENVPN_TRANSPORT_SERVER_UDPSHARD_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <utility>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/common/sockopt.hpp>
+#include <openvpn/common/to_string.hpp>
+#include <openvpn/asio/asiowork.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/transport/server/transbase.hpp>
+#include <openvpn/transport/server/shardbalance.hpp>
+#include <openvpn/transport/server/xdplink.hpp>
+
+#ifdef OPENVPN_PLATFORM_LINUX
+#include <linux/filter.h>
+#include <openvpn/linux/numa.hpp>
+#endif
+
+#if defined(OPENVPN_PLATFORM_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#define OPENVPN_UDPSHARD_CBPF
+#endif
+
+namespace openvpn {
+  namespace UDPTransport {
+
+    OPENVPN_EXCEPTION(udp_shard_error);
+
+    class XDPProgram; // see xdplink.hpp
+
+    // Allocate peer IDs for a shard such that the reuseport
+    // steering program maps them back to the same shard.
+    class ShardPeerID
+    {
+    public:
+      enum {
+	MAX_PEER_ID = 0xFFFFFE, // 0xFFFFFF means undefined
+      };
+
+      ShardPeerID(const unsigned int shard_arg, const unsigned int n_shards_arg)
+	: shard(shard_arg),
+	  n_shards(n_shards_arg ? n_shards_arg : 1),
+	  next_id(shard_arg)
+      {
+	if (shard >= n_shards || shard > MAX_PEER_ID)
+	  throw udp_shard_error("bad shard index");
+      }
+
+      // Return the next candidate peer ID for this shard.  Callers
+      // must skip IDs that are still in use after wraparound.
+      int next()
+      {
+	const unsigned int id = next_id;
+	next_id += n_shards;
+	if (next_id > MAX_PEER_ID)
+	  next_id = shard;
+	return int(id);
+      }
+
+      static unsigned int shard_of(const int peer_id, const unsigned int n_shards)
+      {
+	return n_shards ? (unsigned int)peer_id % n_shards : 0;
+      }
+
+    private:
+      unsigned int shard;
+      unsigned int n_shards;
+      unsigned int next_id;
+    };
+
+    // Creates the per-shard server objects.
+    struct ShardServerFactory : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<ShardServerFactory> Ptr;
+
+      // Called on the thread that starts the ShardedServer.  socket is
+      // already bound to the shared local endpoint and belongs to
+      // io_context.  The returned object's start() and stop() methods
+      // are called on the shard's own thread.  Control packets of a
+      // peer that floated may arrive on any shard and should be
+      // forwarded to the shard that owns the session (see above).  If
+      // balancer is defined, the shard server should report its load
+      // to it, offer new sessions to it with forward_new(), forward
+      // packets of redirected peers, and implement ShardRecv.  If xdp
+      // is defined, the shard server should also receive through an
+      // XDPLink on each queue q < xdp->max_queues() with
+      // (q % n_shards) == shard, and forward packets of sessions
+      // owned by other shards.
+      virtual TransportServer::Ptr new_shard_server(openvpn_io::io_context& io_context,
+						    openvpn_io::ip::udp::socket&& socket,
+						    const unsigned int shard,
+						    const unsigned int n_shards,
+						    const ShardBalancer::Ptr& balancer,
+						    XDPProgram* xdp) = 0;
+    };
+
+    class ShardedServerConfig : public TransportServerFactory
+    {
+    public:
+      typedef RCPtr<ShardedServerConfig> Ptr;
+
+      IP::Addr local_addr;
+      unsigned short local_port = 0;
+      unsigned int n_shards = 1;
+      bool steer_peer_id = true;  // attach the peer-ID steering program (Linux only)
+      bool balance = false;       // place new sessions on the least loaded shard
+      unsigned int balance_interval_ms = 1000; // load sampling interval
+      bool numa = false;          // bind shard threads to the CPUs of a NUMA node (Linux only)
+      std::string xdp_ifname;     // receive through AF_XDP on this interface (Linux only)
+      ShardServerFactory::Ptr shard_factory;
+
+      static Ptr new_obj()
+      {
+	return new ShardedServerConfig;
+      }
+
+      // Read the sharding directives of the server config:
+      //   udp-shards <n>            -- number of shards
+      //   udp-shard-balance [<ms>]  -- balance new sessions, sampling every <ms>
+      //   udp-shard-numa            -- bind shard threads to NUMA nodes
+      //   udp-shard-no-steer        -- don't attach the peer-ID steering program
+      //   udp-shard-xdp <ifname>    -- AF_XDP fast path on interface <ifname>
+      // The server transport should only use a ShardedServerConfig
+      // when enabled() is true.
+      void load(const OptionList& opt)
+      {
+	n_shards = opt.get_num<unsigned int>("udp-shards", 1, 1, 1, 1024);
+	const Option* o = opt.get_ptr("udp-shard-balance");
+	balance = o != nullptr;
+	if (o)
+	  balance_interval_ms = o->get_num<unsigned int>(1, balance_interval_ms, 10, 60000);
+	numa = opt.exists("udp-shard-numa");
+	steer_peer_id = !opt.exists("udp-shard-no-steer");
+	xdp_ifname = opt.get_default("udp-shard-xdp", 1, 64, "");
+      }
+
+      static bool enabled(const OptionList& opt)
+      {
+	return opt.exists("udp-shards");
+      }
+
+      TransportServer::Ptr new_server_obj(openvpn_io::io_context& io_context) override;
+
+    private:
+      ShardedServerConfig() {}
+    };
+
+    class ShardedServer : public TransportServer
+    {
+      friend ShardedServerConfig; // calls constructor
+
+    public:
+      typedef RCPtr<ShardedServer> Ptr;
+
+      void start() override
+      {
+	if (!shards.empty())
+	  return;
+	std::vector<openvpn_io::ip::udp::socket> sockets;
+	try {
+	  if (!config->n_shards || !config->shard_factory)
+	    throw udp_shard_error("n_shards and shard_factory must be set");
+
+	  const openvpn_io::ip::udp::endpoint local_endpoint(config->local_addr.to_asio(), config->local_port);
+
+	  // Open and bind the sockets in shard order, since the
+	  // kernel indexes the reuseport group in bind order.
+	  for (unsigned int i = 0; i < config->n_shards; ++i)
+	    {
+	      Shard::UPtr sh(new Shard());
+	      openvpn_io::io_context& ioc = i ? sh->own_io_context : io_context;
+	      sh->io_context = &ioc;
+	      sockets.emplace_back(ioc);
+	      openvpn_io::ip::udp::socket& sock = sockets.back();
+	      sock.open(local_endpoint.protocol());
+	      SockOpt::reuseport(sock.native_handle());
+	      SockOpt::set_cloexec(sock.native_handle());
+	      sock.bind(local_endpoint);
+	      shards.push_back(std::move(sh));
+	    }
+
+	  if (config->steer_peer_id && config->n_shards > 1)
+	    attach_steering(sockets[0].native_handle(), config->n_shards);
+
+	  place_threads();
+	  attach_xdp();
+
+	  if (config->balance && config->n_shards > 1)
+	    {
+	      balancer.reset(new ShardBalancer(config->n_shards));
+	      for (unsigned int i = 0; i < config->n_shards; ++i)
+		balancer->attach(i, *shards[i]->io_context, shards[i]->node);
+	    }
+
+	  for (unsigned int i = 0; i < config->n_shards; ++i)
+	    {
+	      Shard& sh = *shards[i];
+	      sh.server = config->shard_factory->new_shard_server(*sh.io_context, std::move(sockets[i]), i, config->n_shards, balancer, xdp_program());
+	      if (!sh.server)
+		throw udp_shard_error("shard factory returned null server");
+	    }
+
+	  // shard 0 runs on the caller's io_context
+	  local_info = shards[0]->server->local_endpoint_info();
+	  local_addr = shards[0]->server->local_endpoint_addr();
+	  shards[0]->server->start();
+
+	  for (unsigned int i = 1; i < config->n_shards; ++i)
+	    shards[i]->start_thread();
+
+	  if (balancer)
+	    schedule_sample();
+	}
+	catch (...)
+	  {
+	    sockets.clear(); // before the io_contexts they belong to
+	    stop();
+	    throw;
+	  }
+      }
+
+      void stop() override
+      {
+	sample_timer.cancel();
+	for (auto& sh : shards)
+	  sh->stop();
+	shards.clear();
+	balancer.reset();
+#ifdef OPENVPN_XDPLINK
+	xdp.reset(); // after the links have left its XSKMAP
+#endif
+      }
+
+      std::string local_endpoint_info() const override
+      {
+	return local_info + " [" + openvpn::to_string(config->n_shards) + " shards]";
+      }
+
+      IP::Addr local_endpoint_addr() const override
+      {
+	return local_addr;
+      }
+
+      ~ShardedServer() override
+      {
+	stop();
+      }
+
+    private:
+      struct Shard
+      {
+	typedef std::unique_ptr<Shard> UPtr;
+
+	void start_thread()
+	{
+	  work.reset(new AsioWork(own_io_context));
+	  TransportServer* s = server.get();
+	  openvpn_io::post(own_io_context, [s]() {
+	      s->start();
+	    });
+	  thread.reset(new std::thread([this, logwrap=Log::Context::Wrapper()]() {
+		Log::Context logctx(logwrap);
+#ifdef OPENVPN_PLATFORM_LINUX
+		// before anything is allocated on this thread
+		if (!cpus.empty())
+		  NUMA::bind_to_cpus(cpus);
+#endif
+		own_io_context.run();
+	      }));
+	}
+
+	void stop()
+	{
+	  if (thread)
+	    {
+	      TransportServer* s = server.get();
+	      openvpn_io::post(own_io_context, [s]() {
+		  s->stop();
+		});
+	      work.reset();
+	      thread->join();
+	      thread.reset();
+	    }
+	  else if (server)
+	    server->stop();
+	  server.reset();
+	}
+
+	openvpn_io::io_context own_io_context{1};
+	openvpn_io::io_context* io_context = nullptr;
+	size_t node = 0;              // NUMA node index
+	std::vector<int> cpus;        // bind the shard thread to these, if defined
+	TransportServer::Ptr server;
+	std::unique_ptr<AsioWork> work;
+	std::unique_ptr<std::thread> thread;
+      };
+
+      ShardedServer(openvpn_io::io_context& io_context_arg,
+		    ShardedServerConfig* config_arg)
+	: io_context(io_context_arg),
+	  config(config_arg),
+	  sample_timer(io_context_arg)
+      {
+      }
+
+      // With config->numa, spread the shards over the NUMA nodes.
+      // Shard 0 stays on the caller's thread, which isn't bound;
+      // it is counted on the node it is running on now.
+      void place_threads()
+      {
+#ifdef OPENVPN_PLATFORM_LINUX
+	if (!config->numa)
+	  return;
+	const NUMA::Topology topo;
+	if (topo.size() < 2)
+	  return;
+	const std::vector<size_t> nodes = topo.spread(config->n_shards);
+	shards[0]->node = topo.index_of_cpu(NUMA::current_cpu());
+	for (unsigned int i = 1; i < config->n_shards; ++i)
+	  {
+	    shards[i]->node = nodes[i];
+	    shards[i]->cpus = topo.cpus(nodes[i]);
+	  }
+#endif
+      }
+
+      // With config->xdp_ifname, attach the AF_XDP program, with an
+      // XSKMAP entry for every receive queue of the interface.
+      void attach_xdp()
+      {
+	if (config->xdp_ifname.empty())
+	  return;
+#ifdef OPENVPN_XDPLINK
+	const unsigned int n_queues = XDPProgram::rx_queues(config->xdp_ifname);
+	xdp = XDPProgram::attach(config->xdp_ifname, config->local_port, n_queues ? n_queues : 64);
+#else
+	throw udp_shard_error("udp-shard-xdp: AF_XDP is not supported on this platform");
+#endif
+      }
+
+      XDPProgram* xdp_program() const
+      {
+#ifdef OPENVPN_XDPLINK
+	return xdp.get();
+#else
+	return nullptr;
+#endif
+      }
+
+      void schedule_sample()
+      {
+	sample_timer.expires_after(Time::Duration::milliseconds(config->balance_interval_ms));
+	sample_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+			       {
+				 if (!error && self->balancer)
+				   {
+				     self->balancer->sample();
+				     self->schedule_sample();
+				   }
+			       });
+      }
+
+      // Attach a classic BPF program to the reuseport group that
+      // returns (peer_id % n_shards) for P_DATA_V2 packets.  For any
+      // other packet it returns an out-of-range index, which makes
+      // the kernel fall back to hash-based socket selection.
+      static void attach_steering(const int fd, const unsigned int n_shards)
+      {
+#ifdef OPENVPN_UDPSHARD_CBPF
+	enum {
+	  P_DATA_V2 = 9,  // ProtoContext opcode, in the high 5 bits of byte 0
+	  PEER_ID_UNDEF = 0xFFFFFF,
+	};
+
+	// reuseport programs see the packet starting at the UDP payload
+	struct sock_filter code[] = {
+	  BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 0),                  // A = op/key byte
+	  BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 3),                 // A = opcode
+	  BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, P_DATA_V2, 0, 5),   // not P_DATA_V2 -> hash
+	  BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 0),                  // A = op/key + peer ID
+	  BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0x00FFFFFF),        // A = peer ID
+	  BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, PEER_ID_UNDEF, 2, 0), // undefined peer ID -> hash
+	  BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, n_shards),          // A = shard
+	  BPF_STMT(BPF_RET|BPF_A, 0),
+	  BPF_STMT(BPF_RET|BPF_K, 0xFFFFFFFF),                // fall back to hash
+	};
+	struct sock_fprog prog;
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+	  throw udp_shard_error("error attaching SO_ATTACH_REUSEPORT_CBPF steering program");
+#endif
+      }
+
+      openvpn_io::io_context& io_context;
+      ShardedServerConfig::Ptr config;
+      std::vector<Shard::UPtr> shards;
+      ShardBalancer::Ptr balancer;
+#ifdef OPENVPN_XDPLINK
+      XDPProgram::Ptr xdp;
+#endif
+      AsioTimer sample_timer;
+      std::string local_info;
+      IP::Addr local_addr;
+    };
+
+    inline TransportServer::Ptr ShardedServerConfig::new_server_obj(openvpn_io::io_context& io_context)
+    {
+      return TransportServer::Ptr(new ShardedServer(io_context, this));
+    }
+  }
+}
+
+#endif
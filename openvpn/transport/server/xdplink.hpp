@@ -0,0 +1,982 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// AF_XDP fast path for the UDP server transport on Linux.
+//
+// XDPProgram attaches a small XDP program to a network interface.
+// It redirects IPv4 (without options, unfragmented) and IPv6 UDP
+// packets addressed to our port into an XSKMAP, indexed by the
+// receive queue, and passes everything else to the kernel stack.
+// Queues without a socket in the map also fall back to the stack, so
+// a regular UDP socket on the same port should stay open next to it.
+//
+// XDPLink is an AF_XDP socket bound to one queue of that interface,
+// with the same interface towards the read handler as
+// UDPTransport::Link, so the server's UDP transport instantiates it
+// in place of Link and the packets keep going through the usual
+// PacketType classification and ProtoContext::data_decrypt().  One
+// XDPLink per queue pairs naturally with the per-shard io_contexts
+// of ShardedServer.
+//
+// Received frames are parsed in place in the UMEM and only the UDP
+// payload is copied into a PacketFrom buffer.  The UDP checksum is
+// not verified, since the data channel authenticates every packet.
+// Replies are built directly in a UMEM frame, addressed with the MAC
+// addresses and local IP seen on a received packet of the peer.
+// That route is only learned once the read handler has validated
+// the packet and calls learn_route(), so unauthenticated frames
+// can't redirect a session's replies or fill the route table.
+// 802.1Q-tagged frames are not redirected.
+//
+// With ShardedServer (see udpshard.hpp, udp-shard-xdp), the queues
+// are divided among the shards by (queue % n_shards).  An AF_XDP
+// socket only receives the packets of its own queue, so the NIC's
+// RSS hash rather than the reuseport steering program decides which
+// shard sees a packet, and the shard server forwards packets of
+// sessions owned by another shard, as it does for sessions placed by
+// ShardBalancer.
+//
+// Requires Linux 5.9 or later and CAP_NET_ADMIN/CAP_BPF.  Setup
+// errors throw xdp_error.
+
+#ifndef OPENVPN_TRANSPORT_SERVER_XDPLINK_H
+#define OPENVPN_TRANSPORT_SERVER_XDPLINK_H
+
+#include <openvpn/common/platform.hpp>
+
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(OPENVPN_NO_XDP) && defined(__has_include)
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#if defined(XDP_USE_NEED_WAKEUP)
+#define OPENVPN_XDPLINK
+#endif
+#endif
+#endif
+
+#ifdef OPENVPN_XDPLINK
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/common/enumdir.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/time/batchclock.hpp>
+#include <openvpn/linux/bpfasm.hpp>
+#include <openvpn/linux/hugepage.hpp>
+#include <openvpn/transport/udplink.hpp>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace openvpn {
+  namespace UDPTransport {
+
+    OPENVPN_EXCEPTION(xdp_error);
+
+    // XDP program and XSKMAP shared by the XDPLink objects of one
+    // interface.  The program is detached when the object is
+    // destroyed.
+    class XDPProgram : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<XDPProgram> Ptr;
+
+      static Ptr attach(const std::string& ifname,
+			const unsigned short port,
+			const unsigned int max_queues = 64)
+      {
+	return new XDPProgram(ifname, port, max_queues);
+      }
+
+      // Number of receive queues of ifname, from sysfs, or 0 if
+      // unknown.
+      static unsigned int rx_queues(const std::string& ifname)
+      {
+	unsigned int n = 0;
+	enum_dir("/sys/class/net/" + ifname + "/queues", [&n](std::string fn) {
+	    if (fn.compare(0, 3, "rx-") == 0)
+	      ++n;
+	  });
+	return n;
+      }
+
+      unsigned int ifindex() const
+      {
+	return ifindex_;
+      }
+
+      unsigned short port() const
+      {
+	return port_;
+      }
+
+      unsigned int max_queues() const
+      {
+	return max_queues_;
+      }
+
+      // redirect the packets of queue_id to the AF_XDP socket xsk_fd
+      void add_socket(const unsigned int queue_id, const int xsk_fd)
+      {
+	std::uint32_t key = queue_id;
+	std::uint32_t value = static_cast<std::uint32_t>(xsk_fd);
+	union bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_fd = static_cast<std::uint32_t>(map_fd());
+	attr.key = reinterpret_cast<std::uint64_t>(&key);
+	attr.value = reinterpret_cast<std::uint64_t>(&value);
+	attr.flags = BPF_ANY;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, attr) < 0)
+	  throw xdp_error("XSKMAP update failed: " + strerror_str(errno));
+      }
+
+      // send the packets of queue_id back to the kernel stack
+      void remove_socket(const unsigned int queue_id)
+      {
+	std::uint32_t key = queue_id;
+	union bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_fd = static_cast<std::uint32_t>(map_fd());
+	attr.key = reinterpret_cast<std::uint64_t>(&key);
+	sys_bpf(BPF_MAP_DELETE_ELEM, attr);
+      }
+
+    private:
+      XDPProgram(const std::string& ifname,
+		 const unsigned short port,
+		 const unsigned int max_queues)
+	: ifindex_(::if_nametoindex(ifname.c_str())),
+	  port_(port),
+	  max_queues_(max_queues)
+      {
+	if (!ifindex_)
+	  throw xdp_error("unknown interface " + ifname);
+	if (!max_queues_)
+	  throw xdp_error("max_queues must be > 0");
+	create_map();
+	load_program();
+	attach_program();
+      }
+
+      static int sys_bpf(const int cmd, union bpf_attr& attr)
+      {
+	return BPF::sys_bpf(cmd, attr);
+      }
+
+      void create_map()
+      {
+	union bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(std::uint32_t);
+	attr.value_size = sizeof(std::uint32_t);
+	attr.max_entries = max_queues_;
+	const int fd = sys_bpf(BPF_MAP_CREATE, attr);
+	if (fd < 0)
+	  throw xdp_error("XSKMAP creation failed: " + strerror_str(errno));
+	map_fd.reset(fd);
+      }
+
+      struct Asm : public BPF::Asm
+      {
+	enum Label {
+	  L_V4,
+	  L_REDIRECT,
+	  L_PASS,
+	};
+      };
+
+      void load_program()
+      {
+	enum {
+	  R0=Asm::R0, R1=Asm::R1, R2=Asm::R2, R3=Asm::R3, R4=Asm::R4, R5=Asm::R5, R6=Asm::R6,
+	  ETH_HLEN = 14,
+	  IP4_HLEN = 20,
+	  IP6_HLEN = 40,
+	  UDP_HLEN = 8,
+	  XDP_MD_DATA = 0,
+	  XDP_MD_DATA_END = 4,
+	  XDP_MD_RX_QUEUE = 16,
+	};
+
+	// packet loads are in network byte order
+	const std::int32_t eth_ip4 = htons(0x0800);
+	const std::int32_t eth_ip6 = htons(0x86DD);
+	const std::int32_t frag_mask = htons(0x3FFF); // MF flag and fragment offset
+	const std::int32_t port_be = htons(port_);
+
+	Asm a;
+	a.mov_reg(R6, R1);
+	a.load(BPF_W, R2, R6, XDP_MD_DATA);
+	a.load(BPF_W, R3, R6, XDP_MD_DATA_END);
+	a.mov_reg(R4, R2);
+	a.add_imm(R4, ETH_HLEN);
+	a.jmp_reg(BPF_JGT, R4, R3, Asm::L_PASS);
+	a.load(BPF_H, R5, R2, 12);                               // ethertype
+	a.jmp_imm(BPF_JEQ, R5, eth_ip4, Asm::L_V4);
+	a.jmp_imm(BPF_JNE, R5, eth_ip6, Asm::L_PASS);
+
+	// IPv6
+	a.mov_reg(R4, R2);
+	a.add_imm(R4, ETH_HLEN + IP6_HLEN + UDP_HLEN);
+	a.jmp_reg(BPF_JGT, R4, R3, Asm::L_PASS);
+	a.load(BPF_B, R5, R2, ETH_HLEN + 6);                     // next header
+	a.jmp_imm(BPF_JNE, R5, IPPROTO_UDP, Asm::L_PASS);
+	a.load(BPF_H, R5, R2, ETH_HLEN + IP6_HLEN + 2);          // UDP dest port
+	a.jmp_imm(BPF_JNE, R5, port_be, Asm::L_PASS);
+	a.jmp(Asm::L_REDIRECT);
+
+	// IPv4
+	a.label(Asm::L_V4);
+	a.mov_reg(R4, R2);
+	a.add_imm(R4, ETH_HLEN + IP4_HLEN + UDP_HLEN);
+	a.jmp_reg(BPF_JGT, R4, R3, Asm::L_PASS);
+	a.load(BPF_B, R5, R2, ETH_HLEN);                         // version/IHL
+	a.jmp_imm(BPF_JNE, R5, 0x45, Asm::L_PASS);
+	a.load(BPF_B, R5, R2, ETH_HLEN + 9);                     // protocol
+	a.jmp_imm(BPF_JNE, R5, IPPROTO_UDP, Asm::L_PASS);
+	a.load(BPF_H, R5, R2, ETH_HLEN + 6);                     // flags/fragment offset
+	a.and_imm(R5, frag_mask);
+	a.jmp_imm(BPF_JNE, R5, 0, Asm::L_PASS);
+	a.load(BPF_H, R5, R2, ETH_HLEN + IP4_HLEN + 2);          // UDP dest port
+	a.jmp_imm(BPF_JNE, R5, port_be, Asm::L_PASS);
+
+	// bpf_redirect_map(&xskmap, rx_queue_index, XDP_PASS)
+	a.label(Asm::L_REDIRECT);
+	a.load(BPF_W, R2, R6, XDP_MD_RX_QUEUE);
+	a.load_map_fd(R1, map_fd());
+	a.mov_imm(R3, XDP_PASS);
+	a.call(BPF_FUNC_redirect_map);
+	a.exit();
+
+	a.label(Asm::L_PASS);
+	a.mov_imm(R0, XDP_PASS);
+	a.exit();
+
+	try {
+	  prog_fd.reset(a.load_program(BPF_PROG_TYPE_XDP, "XDP"));
+	}
+	catch (const BPF::bpf_error& e)
+	  {
+	    throw xdp_error(e.what());
+	  }
+      }
+
+      void attach_program()
+      {
+	union bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = static_cast<std::uint32_t>(prog_fd());
+	attr.link_create.target_ifindex = ifindex_;
+	attr.link_create.attach_type = BPF_XDP;
+	const int fd = sys_bpf(BPF_LINK_CREATE, attr);
+	if (fd < 0)
+	  throw xdp_error("XDP program attach failed: " + strerror_str(errno));
+	link_fd.reset(fd);
+      }
+
+      unsigned int ifindex_;
+      unsigned short port_;
+      unsigned int max_queues_;
+      ScopedFD map_fd;
+      ScopedFD prog_fd;
+      ScopedFD link_fd; // closing it detaches the program
+    };
+
+    // Reply addressing for one peer, as seen on a received frame.
+    struct XDPRoute
+    {
+      unsigned char local_mac[6];
+      unsigned char peer_mac[6];
+      unsigned char local_addr[16]; // 4 bytes used for IPv4
+    };
+
+    // Routes of the peers an XDPLink replies to.  Routes parsed from
+    // the frames of the current receive burst are staged, and only
+    // become usable once learn() confirms that the peer's packet was
+    // valid.  When the table is full, the least recently confirmed
+    // route is evicted.
+    class XDPRouteTable
+    {
+    public:
+      XDPRouteTable(const size_t max_routes_arg)
+	: max_routes(max_routes_arg ? max_routes_arg : 1)
+      {
+      }
+
+      // remember the route of a frame just received from peer
+      void stage(const AsioEndpoint& peer, const XDPRoute& route)
+      {
+	staged[peer] = route;
+      }
+
+      // forget the routes staged during the previous burst
+      void clear_staged()
+      {
+	staged.clear();
+      }
+
+      // Make the staged route of peer usable for replies.  Returns
+      // false if nothing was staged for peer.
+      bool learn(const AsioEndpoint& peer)
+      {
+	const auto s = staged.find(peer);
+	if (s == staged.end())
+	  return false;
+	auto r = routes.find(peer);
+	if (r != routes.end())
+	  lru.splice(lru.begin(), lru, r->second.lru_pos);
+	else
+	  {
+	    if (routes.size() >= max_routes)
+	      {
+		routes.erase(lru.back());
+		lru.pop_back();
+	      }
+	    lru.push_front(peer);
+	    r = routes.emplace(peer, Entry{XDPRoute(), lru.begin()}).first;
+	  }
+	r->second.route = s->second;
+	return true;
+      }
+
+      void forget(const AsioEndpoint& peer)
+      {
+	const auto r = routes.find(peer);
+	if (r != routes.end())
+	  {
+	    lru.erase(r->second.lru_pos);
+	    routes.erase(r);
+	  }
+      }
+
+      const XDPRoute* find(const AsioEndpoint& peer) const
+      {
+	const auto r = routes.find(peer);
+	return r != routes.end() ? &r->second.route : nullptr;
+      }
+
+      size_t size() const
+      {
+	return routes.size();
+      }
+
+    private:
+      struct Entry
+      {
+	XDPRoute route;
+	std::list<AsioEndpoint>::iterator lru_pos;
+      };
+
+      size_t max_routes;
+      std::map<AsioEndpoint, XDPRoute> staged;
+      std::map<AsioEndpoint, Entry> routes;
+      std::list<AsioEndpoint> lru; // most recently confirmed first
+    };
+
+    template <typename ReadHandler>
+    class XDPLink : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<XDPLink> Ptr;
+
+      enum {
+	DEFAULT_RING_SIZE = 1024, // per ring, UMEM holds 2 frames per ring entry
+	FRAME_SIZE = 4096,
+	DRAIN_BUDGET = 256,       // max packets handled per wakeup
+	MAX_ROUTES = 65536,       // max peers with a learned L2 route
+      };
+
+      XDPLink(ReadHandler read_handler_arg,
+	      openvpn_io::io_context& io_context,
+	      const XDPProgram::Ptr& program_arg,
+	      const unsigned int queue_id_arg,
+	      const Frame::Context& frame_context_arg,
+	      const SessionStats::Ptr& stats_arg)
+	: read_handler(read_handler_arg),
+	  program(program_arg),
+	  queue_id(queue_id_arg),
+	  frame_context(frame_context_arg),
+	  stats(stats_arg),
+	  sd(io_context),
+	  routes(MAX_ROUTES)
+      {
+      }
+
+      // Create the AF_XDP socket, bind it to our queue and start
+      // receiving, with ring_size entries per ring (DEFAULT_RING_SIZE
+      // if 0).
+      void start(const unsigned int ring_size=0)
+      {
+	if (halt || sd.is_open())
+	  return;
+	if (queue_id >= program->max_queues())
+	  throw xdp_error("queue " + std::to_string(queue_id) + " exceeds XSKMAP size");
+	setup(ring_size ? ring_size : (unsigned int)DEFAULT_RING_SIZE);
+	program->add_socket(queue_id, sd.native_handle());
+	in_map = true;
+	queue_read();
+      }
+
+      // Returns 0 on success, or a system error code on error.
+      // May also return SEND_SOCKET_HALTED.
+      int send(const Buffer& buf, const AsioEndpoint* endpoint)
+      {
+	if (halt)
+	  return SEND_SOCKET_HALTED;
+	if (!endpoint)
+	  return EDESTADDRREQ;
+	const XDPRoute* route = routes.find(*endpoint);
+	if (!route)
+	  {
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    return EHOSTUNREACH;
+	  }
+	if (tx_free.empty())
+	  reclaim_tx();
+	if (tx_free.empty() || ring_full(tx))
+	  {
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    return ENOBUFS;
+	  }
+
+	const std::uint64_t addr = tx_free.back();
+	unsigned char* frame = umem + addr;
+	const size_t len = build_frame(frame, *route, *endpoint, buf);
+	if (!len)
+	  {
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    return EMSGSIZE;
+	  }
+	tx_free.pop_back();
+
+	struct xdp_desc* d = static_cast<struct xdp_desc*>(tx.desc) + (tx.cached & tx.mask);
+	d->addr = addr;
+	d->len = static_cast<std::uint32_t>(len);
+	d->options = 0;
+	++tx.cached;
+	__atomic_store_n(tx.producer, tx.cached, __ATOMIC_RELEASE);
+	stats->inc_stat(SessionStats::BYTES_OUT, buf.size());
+	stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+
+	// kick the kernel once per reactor iteration
+	if (!kick_queued)
+	  {
+	    kick_queued = true;
+	    openvpn_io::post(sd.get_executor(), [self=Ptr(this)]()
+                             {
+                               OPENVPN_ASYNC_HANDLER;
+                               self->kick_queued = false;
+                               self->kick_tx();
+                             });
+	  }
+	return 0;
+      }
+
+      // Called by the read handler once a packet received from peer
+      // has been validated (e.g. ProtoContext accepted it), before
+      // returning to the reactor, so that replies to peer use the
+      // addressing of that packet.  Returns false if no packet from
+      // peer was received in the current burst.
+      bool learn_route(const AsioEndpoint& peer)
+      {
+	return routes.learn(peer);
+      }
+
+      // called when the session of peer goes away
+      void forget_route(const AsioEndpoint& peer)
+      {
+	routes.forget(peer);
+      }
+
+      void stop()
+      {
+	if (halt)
+	  return;
+	halt = true;
+	if (in_map)
+	  {
+	    program->remove_socket(queue_id);
+	    in_map = false;
+	  }
+	sd.close();
+      }
+
+      void reset_align_adjust(const size_t align_adjust)
+      {
+	frame_context.reset_align_adjust(align_adjust);
+      }
+
+      ~XDPLink()
+      {
+	stop();
+	for (Ring* r : { &rx, &tx, &fill, &comp })
+	  if (r->map != MAP_FAILED)
+	    ::munmap(r->map, r->map_size);
+	if (umem_area != MAP_FAILED)
+	  ::munmap(umem_area, umem_map_size);
+      }
+
+    private:
+      // A single-producer/single-consumer ring shared with the
+      // kernel.  cached is our private copy of the index we own
+      // (producer for fill/tx, consumer for rx/comp).
+      struct Ring
+      {
+	std::uint32_t* producer = nullptr;
+	std::uint32_t* consumer = nullptr;
+	std::uint32_t* flags = nullptr;
+	void* desc = nullptr;
+	std::uint32_t mask = 0;
+	std::uint32_t size = 0;
+	std::uint32_t cached = 0;
+	void* map = MAP_FAILED;
+	size_t map_size = 0;
+      };
+
+      enum {
+	ETH_HLEN = 14,
+	IP4_HLEN = 20,
+	IP6_HLEN = 40,
+	UDP_HLEN = 8,
+      };
+
+      static bool ring_full(const Ring& r)
+      {
+	return r.cached - __atomic_load_n(r.consumer, __ATOMIC_ACQUIRE) >= r.size;
+      }
+
+      void map_ring(Ring& r, const int fd, const struct xdp_ring_offset& off, const unsigned int n, const size_t desc_size, const off_t pgoff)
+      {
+	r.map_size = off.desc + n * desc_size;
+	r.map = ::mmap(nullptr, r.map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, pgoff);
+	if (r.map == MAP_FAILED)
+	  throw xdp_error("AF_XDP ring mmap failed: " + strerror_str(errno));
+	unsigned char* base = static_cast<unsigned char*>(r.map);
+	r.producer = reinterpret_cast<std::uint32_t*>(base + off.producer);
+	r.consumer = reinterpret_cast<std::uint32_t*>(base + off.consumer);
+	r.flags = reinterpret_cast<std::uint32_t*>(base + off.flags);
+	r.desc = base + off.desc;
+	r.size = n;
+	r.mask = n - 1;
+      }
+
+      void set_ring_size(const int fd, const int opt, const unsigned int n)
+      {
+	if (::setsockopt(fd, SOL_XDP, opt, &n, sizeof(n)) < 0)
+	  throw xdp_error("AF_XDP ring setup failed: " + strerror_str(errno));
+      }
+
+      void setup(const unsigned int ring_size)
+      {
+	unsigned int n = 1;
+	while (n < ring_size && n < 32768)
+	  n <<= 1;
+
+	const int fd = ::socket(AF_XDP, SOCK_RAW|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	  throw xdp_error("AF_XDP socket creation failed: " + strerror_str(errno));
+	sd.assign(fd);
+
+	// UMEM: first n frames for receive, next n for transmit, on
+	// huge pages where possible since every packet touches it
+	umem_size = size_t(2) * n * FRAME_SIZE;
+	const HugePage::Region huge = HugePage::map(umem_size, true);
+	if (huge.addr)
+	  {
+	    umem_area = huge.addr;
+	    umem_map_size = huge.size;
+	  }
+	else
+	  {
+	    umem_area = ::mmap(nullptr, umem_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	    if (umem_area == MAP_FAILED)
+	      throw xdp_error("UMEM allocation failed: " + strerror_str(errno));
+	    umem_map_size = umem_size;
+	  }
+	umem = static_cast<unsigned char*>(umem_area);
+	struct xdp_umem_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.addr = reinterpret_cast<std::uint64_t>(umem_area);
+	reg.len = umem_size;
+	reg.chunk_size = FRAME_SIZE;
+	if (::setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+	  throw xdp_error("UMEM registration failed: " + strerror_str(errno));
+
+	set_ring_size(fd, XDP_UMEM_FILL_RING, n);
+	set_ring_size(fd, XDP_UMEM_COMPLETION_RING, n);
+	set_ring_size(fd, XDP_RX_RING, n);
+	set_ring_size(fd, XDP_TX_RING, n);
+
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	if (::getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+	  throw xdp_error("AF_XDP ring offsets query failed: " + strerror_str(errno));
+	map_ring(rx, fd, off.rx, n, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+	map_ring(tx, fd, off.tx, n, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+	map_ring(fill, fd, off.fr, n, sizeof(std::uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+	map_ring(comp, fd, off.cr, n, sizeof(std::uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+	rx.cached = *rx.consumer;
+	comp.cached = *comp.consumer;
+	tx.cached = *tx.producer;
+	fill.cached = *fill.producer;
+
+	// hand all receive frames to the kernel
+	for (unsigned int i = 0; i < n; ++i)
+	  static_cast<std::uint64_t*>(fill.desc)[(fill.cached + i) & fill.mask] = std::uint64_t(i) * FRAME_SIZE;
+	fill.cached += n;
+	__atomic_store_n(fill.producer, fill.cached, __ATOMIC_RELEASE);
+
+	tx_free.reserve(n);
+	for (unsigned int i = 2 * n; i-- > n; )
+	  tx_free.push_back(std::uint64_t(i) * FRAME_SIZE);
+
+	struct sockaddr_xdp sxdp;
+	std::memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	sxdp.sxdp_ifindex = program->ifindex();
+	sxdp.sxdp_queue_id = queue_id;
+	if (::bind(fd, reinterpret_cast<struct sockaddr*>(&sxdp), sizeof(sxdp)) < 0)
+	  throw xdp_error("AF_XDP bind to queue " + std::to_string(queue_id) + " failed: " + strerror_str(errno));
+      }
+
+      void queue_read()
+      {
+	sd.async_wait(openvpn_io::posix::stream_descriptor::wait_read,
+		      [self=Ptr(this)](const openvpn_io::error_code& error)
+                      {
+                        OPENVPN_ASYNC_HANDLER;
+                        if (!self->halt)
+                          self->handle_read(error);
+                      });
+      }
+
+      void handle_read(const openvpn_io::error_code& error)
+      {
+	if (error)
+	  {
+	    stats->error(Error::NETWORK_RECV_ERROR);
+	    queue_read();
+	    return;
+	  }
+
+	// With the budget spent, more packets may be pending that
+	// won't trigger a new readiness edge, so come back via post().
+	if (drain() == DRAIN_BUDGET && !halt)
+	  openvpn_io::post(sd.get_executor(), [self=Ptr(this)]()
+                           {
+                             OPENVPN_ASYNC_HANDLER;
+                             if (!self->halt)
+                               self->handle_read(openvpn_io::error_code());
+                           });
+	else if (!halt)
+	  queue_read();
+      }
+
+      // Process up to DRAIN_BUDGET received frames.  Returns the
+      // number of frames consumed.
+      unsigned int drain()
+      {
+	const std::uint32_t avail = __atomic_load_n(rx.producer, __ATOMIC_ACQUIRE) - rx.cached;
+	const unsigned int n = std::min<std::uint32_t>(avail, DRAIN_BUDGET);
+	if (n)
+	  {
+	    const BatchClock::Scope clock_scope;
+	    routes.clear_staged();
+	    if (n > 1)
+	      read_handler->udp_read_burst_begin();
+	    for (unsigned int i = 0; i < n; ++i)
+	      {
+		const struct xdp_desc d = static_cast<const struct xdp_desc*>(rx.desc)[rx.cached & rx.mask];
+		++rx.cached;
+		__atomic_store_n(rx.consumer, rx.cached, __ATOMIC_RELEASE);
+		if (!halt)
+		  recv_frame(umem + d.addr, d.len);
+
+		// the fill ring has room for every receive frame
+		static_cast<std::uint64_t*>(fill.desc)[fill.cached & fill.mask] = d.addr & ~std::uint64_t(FRAME_SIZE - 1);
+		++fill.cached;
+	      }
+	    __atomic_store_n(fill.producer, fill.cached, __ATOMIC_RELEASE);
+	    if (n > 1 && !halt)
+	      read_handler->udp_read_burst_end();
+	  }
+	if (!halt && (__atomic_load_n(fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP))
+	  ::recvfrom(sd.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+	return n;
+      }
+
+      void recv_frame(const unsigned char* frame, const size_t len)
+      {
+	if (!pfp)
+	  pfp.reset(new PacketFrom());
+	XDPRoute route;
+	const unsigned char* payload;
+	size_t payload_len;
+	if (!parse_frame(frame, len, pfp->sender_endpoint, route, payload, payload_len))
+	  {
+	    stats->error(Error::NETWORK_RECV_ERROR);
+	    return;
+	  }
+
+	BufferAllocated& buf = pfp->buf;
+	frame_context.prepare(buf);
+	if (payload_len > frame_context.remaining_payload(buf))
+	  {
+	    stats->error(Error::NETWORK_RECV_ERROR);
+	    return;
+	  }
+	buf.write(payload, payload_len);
+	routes.stage(pfp->sender_endpoint, route);
+
+	stats->inc_stat(SessionStats::BYTES_IN, payload_len);
+	stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	read_handler->udp_read_handler(pfp); // may take ownership
+      }
+
+      // Extract sender endpoint, reply addressing and UDP payload
+      // from an Ethernet frame.
+      bool parse_frame(const unsigned char* frame,
+		       const size_t len,
+		       AsioEndpoint& sender,
+		       XDPRoute& route,
+		       const unsigned char*& payload,
+		       size_t& payload_len) const
+      {
+	if (len < ETH_HLEN)
+	  return false;
+	std::memcpy(route.peer_mac, frame + 6, 6);
+	std::memcpy(route.local_mac, frame, 6);
+	const unsigned int ethertype = (frame[12] << 8) | frame[13];
+	const unsigned char* ip = frame + ETH_HLEN;
+	const unsigned char* udp;
+	if (ethertype == 0x0800)
+	  {
+	    if (len < ETH_HLEN + IP4_HLEN + UDP_HLEN || ip[0] != 0x45 || ip[9] != IPPROTO_UDP)
+	      return false;
+	    const size_t tot_len = (ip[2] << 8) | ip[3];
+	    if (tot_len < IP4_HLEN + UDP_HLEN || ETH_HLEN + tot_len > len)
+	      return false;
+	    udp = ip + IP4_HLEN;
+	    struct sockaddr_in* sa = reinterpret_cast<struct sockaddr_in*>(sender.data());
+	    std::memset(sa, 0, sizeof(*sa));
+	    sa->sin_family = AF_INET;
+	    std::memcpy(&sa->sin_addr, ip + 12, 4);
+	    std::memcpy(&sa->sin_port, udp, 2);
+	    sender.resize(sizeof(*sa));
+	    std::memcpy(route.local_addr, ip + 16, 4);
+	  }
+	else if (ethertype == 0x86DD)
+	  {
+	    if (len < ETH_HLEN + IP6_HLEN + UDP_HLEN || ip[6] != IPPROTO_UDP)
+	      return false;
+	    const size_t plen = (ip[4] << 8) | ip[5];
+	    if (plen < UDP_HLEN || ETH_HLEN + IP6_HLEN + plen > len)
+	      return false;
+	    udp = ip + IP6_HLEN;
+	    struct sockaddr_in6* sa = reinterpret_cast<struct sockaddr_in6*>(sender.data());
+	    std::memset(sa, 0, sizeof(*sa));
+	    sa->sin6_family = AF_INET6;
+	    std::memcpy(&sa->sin6_addr, ip + 8, 16);
+	    std::memcpy(&sa->sin6_port, udp, 2);
+	    sender.resize(sizeof(*sa));
+	    std::memcpy(route.local_addr, ip + 24, 16);
+	  }
+	else
+	  return false;
+
+	const size_t udp_len = (udp[4] << 8) | udp[5];
+	if (udp_len < UDP_HLEN || udp + udp_len > frame + len)
+	  return false;
+	payload = udp + UDP_HLEN;
+	payload_len = udp_len - UDP_HLEN;
+	return true;
+      }
+
+      static std::uint32_t csum_add(std::uint32_t sum, const unsigned char* data, size_t len)
+      {
+	for (; len > 1; data += 2, len -= 2)
+	  sum += (data[0] << 8) | data[1];
+	if (len)
+	  sum += data[0] << 8;
+	return sum;
+      }
+
+      static std::uint16_t csum_fold(std::uint32_t sum)
+      {
+	while (sum >> 16)
+	  sum = (sum & 0xFFFF) + (sum >> 16);
+	return static_cast<std::uint16_t>(~sum);
+      }
+
+      static void put16(unsigned char* p, const unsigned int v)
+      {
+	p[0] = static_cast<unsigned char>(v >> 8);
+	p[1] = static_cast<unsigned char>(v);
+      }
+
+      // Build the Ethernet/IP/UDP frame for buf in frame.  Returns
+      // the frame length, or 0 if it doesn't fit.
+      size_t build_frame(unsigned char* frame, const XDPRoute& route, const AsioEndpoint& peer, const Buffer& buf)
+      {
+	const bool v6 = peer.data()->sa_family == AF_INET6;
+	const size_t ip_hlen = v6 ? size_t(IP6_HLEN) : size_t(IP4_HLEN);
+	const size_t udp_len = UDP_HLEN + buf.size();
+	const size_t len = ETH_HLEN + ip_hlen + udp_len;
+	if (len > FRAME_SIZE || udp_len > 0xFFFF)
+	  return 0;
+
+	std::memcpy(frame, route.peer_mac, 6);
+	std::memcpy(frame + 6, route.local_mac, 6);
+	unsigned char* ip = frame + ETH_HLEN;
+	unsigned char* udp = ip + ip_hlen;
+	const unsigned char* peer_port;
+	if (v6)
+	  {
+	    const struct sockaddr_in6* sa = reinterpret_cast<const struct sockaddr_in6*>(peer.data());
+	    put16(frame + 12, 0x86DD);
+	    std::memset(ip, 0, 4);
+	    ip[0] = 0x60;
+	    put16(ip + 4, static_cast<unsigned int>(udp_len));
+	    ip[6] = IPPROTO_UDP;
+	    ip[7] = 64;
+	    std::memcpy(ip + 8, route.local_addr, 16);
+	    std::memcpy(ip + 24, &sa->sin6_addr, 16);
+	    peer_port = reinterpret_cast<const unsigned char*>(&sa->sin6_port);
+	  }
+	else
+	  {
+	    const struct sockaddr_in* sa = reinterpret_cast<const struct sockaddr_in*>(peer.data());
+	    put16(frame + 12, 0x0800);
+	    ip[0] = 0x45;
+	    ip[1] = 0;
+	    put16(ip + 2, static_cast<unsigned int>(IP4_HLEN + udp_len));
+	    put16(ip + 4, ip_id++);
+	    put16(ip + 6, 0x4000); // DF
+	    ip[8] = 64;
+	    ip[9] = IPPROTO_UDP;
+	    put16(ip + 10, 0);
+	    std::memcpy(ip + 12, route.local_addr, 4);
+	    std::memcpy(ip + 16, &sa->sin_addr, 4);
+	    put16(ip + 10, csum_fold(csum_add(0, ip, IP4_HLEN)));
+	    peer_port = reinterpret_cast<const unsigned char*>(&sa->sin_port);
+	  }
+
+	put16(udp, program->port());
+	std::memcpy(udp + 2, peer_port, 2);
+	put16(udp + 4, static_cast<unsigned int>(udp_len));
+	put16(udp + 6, 0);
+	std::memcpy(udp + UDP_HLEN, buf.c_data(), buf.size());
+
+	// the UDP checksum is optional for IPv4 but mandatory for IPv6
+	if (v6)
+	  {
+	    std::uint32_t sum = csum_add(0, ip + 8, 32); // source and dest address
+	    sum += static_cast<std::uint32_t>(udp_len) + IPPROTO_UDP;
+	    std::uint16_t c = csum_fold(csum_add(sum, udp, udp_len));
+	    if (!c)
+	      c = 0xFFFF;
+	    put16(udp + 6, c);
+	  }
+	return len;
+      }
+
+      void kick_tx()
+      {
+	if (halt)
+	  return;
+	if (__atomic_load_n(tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+	  {
+	    if (::sendto(sd.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0
+		&& errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+	      stats->error(Error::NETWORK_SEND_ERROR);
+	  }
+	reclaim_tx();
+      }
+
+      // return transmitted frames to the free list
+      void reclaim_tx()
+      {
+	const std::uint32_t avail = __atomic_load_n(comp.producer, __ATOMIC_ACQUIRE) - comp.cached;
+	for (std::uint32_t i = 0; i < avail; ++i)
+	  tx_free.push_back(static_cast<const std::uint64_t*>(comp.desc)[(comp.cached + i) & comp.mask]);
+	if (avail)
+	  {
+	    comp.cached += avail;
+	    __atomic_store_n(comp.consumer, comp.cached, __ATOMIC_RELEASE);
+	  }
+      }
+
+      bool halt = false;
+      bool in_map = false;
+      bool kick_queued = false;
+      ReadHandler read_handler;
+      XDPProgram::Ptr program;
+      unsigned int queue_id;
+      Frame::Context frame_context;
+      SessionStats::Ptr stats;
+      openvpn_io::posix::stream_descriptor sd; // owns the AF_XDP socket
+
+      void* umem_area = MAP_FAILED;
+      unsigned char* umem = nullptr;
+      size_t umem_size = 0;
+      size_t umem_map_size = 0; // umem_size, rounded up to the huge page size
+      Ring rx;
+      Ring tx;
+      Ring fill;
+      Ring comp;
+      std::vector<std::uint64_t> tx_free;
+      unsigned int ip_id = 0;
+
+      PacketFrom::SPtr pfp;
+      XDPRouteTable routes;
+    };
+  }
+}
+
+#endif
+#endif
@@ -35,6 +35,12 @@ namespace openvpn {
   class BaseSocketProtect {
   public:
     virtual bool socket_protect(int socket, IP::Addr endpoint) = 0;
+
+    // True if protecting a socket doesn't depend on its endpoint,
+    // so that sockets may be protected ahead of time, from another
+    // thread, with the unspecified address of their family as the
+    // endpoint (see ProtectedSocketPool).
+    virtual bool socket_protect_ahead() const { return false; }
   };
 
 #ifdef OPENVPN_PLATFORM_UWP
@@ -72,13 +72,15 @@ namespace openvpn {
 	   const SessionStats::Ptr& stats_arg)
 	: Base(read_handler_arg, socket_arg, send_queue_max_size_arg,
 	       free_list_max_size_arg, frame_context_arg, stats_arg)
-      { }
+      {
+	Base::enable_ring();
+      }
 
     private:
       // Called by LinkCommon
-      virtual void from_app_send_buffer(BufferPtr& buf) override
+      virtual void from_app_send_buffer(BufferPtr& buf, const SendClass cls) override
       {
-	Base::queue_send_buffer(buf);
+	Base::queue_send_buffer(buf, cls);
       }
 
       virtual void recv_buffer(PacketFrom::SPtr& pfp, const size_t bytes_recvd) override
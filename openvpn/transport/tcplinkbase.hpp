@@ -2,9 +2,15 @@
 
 // Base class for generic link objects.
 
+#include <cstdint>
+
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/common/rc.hpp>
 
+#ifdef OPENVPN_GREMLIN
+#include <openvpn/transport/gremlin.hpp>
+#endif
+
 #pragma once
 
 namespace openvpn
@@ -17,12 +23,31 @@ namespace openvpn
       BufferAllocated buf;
     };
 
+    // Send queue classes, in the order in which they are sent.
+    // Packets of a class are sent in order.
+    enum SendClass {
+      SEND_CONTROL = 0,  // control channel
+      SEND_SMALL,        // data channel packets up to SendPriority::small_max
+      SEND_BULK,         // everything else
+      N_SEND_CLASSES,
+    };
+
+    // Priority send queue parameters.  Without a call to
+    // LinkBase::set_send_priority(), and in raw mode or with a
+    // stream mutator, all packets are sent in order as SEND_BULK.
+    struct SendPriority
+    {
+      size_t small_max = 256;            // data channel packets up to this size are SEND_SMALL, 0 for none
+      std::uint64_t target_ns = 0;       // CoDel target for SEND_BULK sojourn time, 0 to never drop
+      std::uint64_t interval_ns = 100000000; // CoDel interval
+    };
+
     class LinkBase : public RC<thread_unsafe_refcount>
     {
     protected:
       virtual void recv_buffer(PacketFrom::SPtr& pfp,
 			       const size_t bytes_recvd) = 0;
-      virtual void from_app_send_buffer(BufferPtr& buf) = 0;
+      virtual void from_app_send_buffer(BufferPtr& buf, const SendClass cls) = 0;
 
     public:
       typedef RCPtr<LinkBase> Ptr;
@@ -31,9 +56,14 @@ namespace openvpn
       virtual unsigned int send_queue_size() const = 0;
       virtual void reset_align_adjust(const size_t align_adjust) = 0;
       virtual bool send(BufferAllocated& b) = 0;
+      virtual bool send(BufferAllocated& b, const SendClass cls) = 0;
+      virtual void set_send_priority(const SendPriority& prio) = 0;
       virtual void set_raw_mode(const bool mode) = 0;
       virtual void start() = 0;
       virtual void stop() = 0;
+#ifdef OPENVPN_GREMLIN
+      virtual void gremlin_config(const Gremlin::Config::Ptr& config) = 0;
+#endif
     };
   }
 }
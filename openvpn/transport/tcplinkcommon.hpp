@@ -5,7 +5,11 @@
 #ifndef OPENVPN_TRANSPORT_COMMONLINK_H
 #define OPENVPN_TRANSPORT_COMMONLINK_H
 
+#include <cmath>
+#include <cstdint>
 #include <deque>
+#include <vector>
+#include <algorithm>
 #include <utility> // for std::move
 #include <memory>
 
@@ -17,8 +21,10 @@
 #include <openvpn/error/excode.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/latencyhist.hpp>
 #include <openvpn/transport/tcplinkbase.hpp>
 #include <openvpn/transport/pktstream.hpp>
+#include <openvpn/transport/pktring.hpp>
 #include <openvpn/transport/mutate.hpp>
 
 #ifdef OPENVPN_GREMLIN
@@ -47,6 +53,11 @@ namespace openvpn {
     {
       typedef std::deque<BufferPtr> Queue;
 
+      enum {
+	SEND_GATHER_MAX = 64, // max queued packets per scatter-gather write
+	RECV_RING_SIZE = 16384, // default size of the receive ring
+      };
+
     public:
       typedef RCPtr<LinkCommon<Protocol, ReadHandler, RAW_MODE_ONLY>> Ptr;
       typedef Protocol protocol;
@@ -83,6 +94,16 @@ namespace openvpn {
 	mutate = mutate_arg;
       }
 
+      // Send control channel packets, then small data channel
+      // packets, ahead of bulk data, and drop bulk data that has
+      // been queued too long (see SendPriority).  Call before the
+      // first send.
+      void set_send_priority(const SendPriority& prio_arg)
+      {
+	prio = prio_arg;
+	prio_enabled = true;
+      }
+
       bool send_queue_empty() const
       {
 	return send_queue_size() == 0;
@@ -94,6 +115,13 @@ namespace openvpn {
 	OPENVPN_LOG_TCPLINK_VERBOSE("TCP inject size=" << size);
 	if (size && !RAW_MODE_ONLY)
 	  {
+	    if (ring_mode())
+	      {
+		ring_alloc();
+		ring->write(src.c_data(), size);
+		ring_recv();
+		return;
+	      }
 	    BufferAllocated buf;
 	    frame_context.prepare(buf);
 	    buf.write(src.c_data(), size);
@@ -124,7 +152,10 @@ namespace openvpn {
 
       unsigned int send_queue_size() const
       {
-	return queue.size()
+	size_t size = queue.size();
+	for (const auto& p : pending)
+	  size += p.size();
+	return size
 #ifdef OPENVPN_GREMLIN
 	  + (gremlin ? gremlin->send_size() : 0)
 #endif
@@ -132,10 +163,19 @@ namespace openvpn {
       }
 
       bool send(BufferAllocated& b)
+      {
+	return send(b, prio.small_max && b.size() <= prio.small_max ? SEND_SMALL : SEND_BULK);
+      }
+
+      bool send(BufferAllocated& b, SendClass cls)
       {
 	if (halt)
 	  return false;
 
+	// reordering would break raw streams and stream mutators
+	if (!prio_enabled || is_raw_mode_write() || mutate)
+	  cls = SEND_BULK;
+
 	if (send_queue_max_size && send_queue_size() >= send_queue_max_size)
 	  {
 	    stats->error(Error::TCP_OVERFLOW);
@@ -159,16 +199,22 @@ namespace openvpn {
 	  mutate->pre_send(*buf);
 #ifdef OPENVPN_GREMLIN
 	if (gremlin)
-	  gremlin_queue_send_buffer(buf);
+	  gremlin_queue_send_buffer(buf, cls);
 	else
 #endif
-	from_app_send_buffer(buf);
+	from_app_send_buffer(buf, cls);
 	return true;
       }
 
       void queue_recv(PacketFrom *tcpfrom)
       {
 	OPENVPN_LOG_TCPLINK_VERBOSE("TLSLink::queue_recv");
+	if (ring_mode())
+	  {
+	    delete tcpfrom;
+	    queue_recv_ring();
+	    return;
+	  }
 	if (!tcpfrom)
 	  tcpfrom = new PacketFrom();
 	frame_context.prepare(tcpfrom->buf);
@@ -183,23 +229,7 @@ namespace openvpn {
 			       }
 			       catch (const std::exception& e)
 			       {
-			         Error::Type err = Error::TCP_SIZE_ERROR;
-				 const char *msg = "TCP_SIZE_ERROR";
-			         // if exception is an ExceptionCode, translate the code
-				 // to return status string
-				 {
-				   const ExceptionCode *ec = dynamic_cast<const ExceptionCode *>(&e);
-				   if (ec && ec->code_defined())
-				   {
-				     err = ec->code();
-				     msg = ec->what();
-				   }
-				 }
-
-			         OPENVPN_LOG_TCPLINK_ERROR("TCP packet extract exception: " << e.what());
-				 self->stats->error(err);
-				 self->read_handler->tcp_error_handler(msg);
-				 self->stop();
+				 self->recv_exception(e);
 			       }
 			     });
       }
@@ -250,17 +280,132 @@ namespace openvpn {
 
       LinkCommon() { stop(); }
 
-      void queue_send_buffer(BufferPtr& buf)
+      // Called by a derived Link whose reads are plain stream data:
+      // in packet mode, read into a PacketRing and parse many packets
+      // per read.
+      void enable_ring()
       {
-	queue.push_back(std::move(buf));
-	if (queue.size() == 1) // send operation not currently active?
-	  queue_send();
+	use_ring = true;
       }
 
+      void recv_exception(const std::exception& e)
+      {
+	Error::Type err = Error::TCP_SIZE_ERROR;
+	const char *msg = "TCP_SIZE_ERROR";
+	// if exception is an ExceptionCode, translate the code
+	// to return status string
+	{
+	  const ExceptionCode *ec = dynamic_cast<const ExceptionCode *>(&e);
+	  if (ec && ec->code_defined())
+	    {
+	      err = ec->code();
+	      msg = ec->what();
+	    }
+	}
+
+	OPENVPN_LOG_TCPLINK_ERROR("TCP packet extract exception: " << e.what());
+	stats->error(err);
+	read_handler->tcp_error_handler(msg);
+	stop();
+      }
+
+      void queue_send_buffer(BufferPtr& buf, const SendClass cls)
+      {
+	pending[cls].push_back(std::move(buf));
+	if (cls == SEND_BULK && prio.target_ns)
+	  bulk_queued.push_back(LatencyHistogram::now_ns());
+	if (queue.empty()) // send operation not currently active?
+	  {
+	    refill();
+	    if (!queue.empty())
+	      queue_send();
+	  }
+      }
+
+      // Move pending packets to the send queue, by class, up to
+      // what fits in one write.  The send queue only holds the
+      // packets of the current write, so a control packet never
+      // waits for more than one.
+      void refill()
+      {
+	const std::uint64_t now = bulk_queued.empty() ? 0 : LatencyHistogram::now_ns();
+	for (auto& p : pending)
+	  while (queue.size() < SEND_GATHER_MAX && !p.empty())
+	    {
+	      BufferPtr buf = std::move(p.front());
+	      p.pop_front();
+	      if (&p == &pending[SEND_BULK] && prio.target_ns)
+		{
+		  const std::uint64_t queued = bulk_queued.front();
+		  bulk_queued.pop_front();
+		  if (codel_drop(now - queued, now, !p.empty()))
+		    {
+		      stats->error(Error::TCP_OVERFLOW);
+		      recycle(buf);
+		      continue;
+		    }
+		}
+	      queue.push_back(std::move(buf));
+	    }
+      }
+
+      // CoDel (RFC 8289) dequeue decision for a SEND_BULK packet
+      // that has been queued for sojourn ns
+      bool codel_drop(const std::uint64_t sojourn, const std::uint64_t now, const bool backlog)
+      {
+	bool ok_to_drop = false;
+	if (sojourn < prio.target_ns || !backlog)
+	  codel.first_above = 0;
+	else if (!codel.first_above)
+	  codel.first_above = now + prio.interval_ns;
+	else if (now >= codel.first_above)
+	  ok_to_drop = true;
+
+	if (codel.dropping)
+	  {
+	    if (!ok_to_drop)
+	      codel.dropping = false;
+	    else if (now >= codel.drop_next)
+	      {
+		++codel.count;
+		codel.drop_next += codel_interval(codel.count);
+		return true;
+	      }
+	  }
+	else if (ok_to_drop)
+	  {
+	    codel.dropping = true;
+	    codel.count = (codel.count > 2 && now - codel.drop_next < 8 * prio.interval_ns) ? codel.count - 2 : 1;
+	    codel.drop_next = now + codel_interval(codel.count);
+	    return true;
+	  }
+	return false;
+      }
+
+      std::uint64_t codel_interval(const unsigned int count) const
+      {
+	return std::uint64_t(double(prio.interval_ns) / std::sqrt(double(count)));
+      }
+
+      void recycle(BufferPtr& buf)
+      {
+	if (free_list.size() < free_list_max_size)
+	  {
+	    buf->reset_content();
+	    free_list.push_back(std::move(buf)); // recycle the buffer for later use
+	  }
+      }
+
+      // Send as many queued packets as fit in one scatter-gather
+      // write, so that a backlog that built up during the previous
+      // write goes out with a single sendmsg().
       void queue_send()
       {
-	BufferAllocated& buf = *queue.front();
-	socket.async_send(buf.const_buffer_clamp(),
+	const size_t n = std::min(queue.size(), size_t(SEND_GATHER_MAX));
+	send_bufs.clear();
+	for (size_t i = 0; i < n; ++i)
+	  send_bufs.push_back(queue[i]->const_buffer_clamp());
+	socket.async_send(send_bufs,
 			  [self=Ptr(this)](const openvpn_io::error_code& error, const size_t bytes_sent)
 			  {
 			    OPENVPN_ASYNC_HANDLER;
@@ -276,21 +421,27 @@ namespace openvpn {
 	      {
 		OPENVPN_LOG_TCPLINK_VERBOSE("TLS-TCP send raw=" << raw_mode_write << " size=" << bytes_sent);
 		stats->inc_stat(SessionStats::BYTES_OUT, bytes_sent);
-		stats->inc_stat(SessionStats::PACKETS_OUT, 1);
 
-		BufferPtr buf = queue.front();
-		if (bytes_sent == buf->size())
+		// retire the fully sent buffers, advance a partially sent one
+		size_t remaining = bytes_sent;
+		size_t packets_sent = 0;
+		while (remaining && !queue.empty())
 		  {
-		    queue.pop_front();
-		    if (free_list.size() < free_list_max_size)
+		    BufferPtr& buf = queue.front();
+		    if (remaining < buf->size())
 		      {
-			buf->reset_content();
-			free_list.push_back(std::move(buf)); // recycle the buffer for later use
+			buf->advance(remaining);
+			remaining = 0;
+			break;
 		      }
+		    remaining -= buf->size();
+		    ++packets_sent;
+		    BufferPtr sent = std::move(buf);
+		    queue.pop_front();
+		    recycle(sent);
 		  }
-		else if (bytes_sent < buf->size())
-		  buf->advance(bytes_sent);
-		else
+		stats->inc_stat(SessionStats::PACKETS_OUT, packets_sent);
+		if (remaining)
 		  {
 		    stats->error(Error::TCP_OVERFLOW);
 		    read_handler->tcp_error_handler("TCP_INTERNAL_ERROR"); // error sent more bytes than we asked for
@@ -306,6 +457,7 @@ namespace openvpn {
 		stop();
 		return;
 	      }
+	    refill();
 	    if (!queue.empty())
 	      queue_send();
 	    else
@@ -360,19 +512,109 @@ namespace openvpn {
 	  {
 	    recv_buffer(pfp, bytes_recvd);
 	  }
-	  else if (error == openvpn_io::error::eof)
+	  else
+	    recv_error(error);
+	}
+      }
+
+      void recv_error(const openvpn_io::error_code& error)
+      {
+	if (error == openvpn_io::error::eof)
 	  {
 	    OPENVPN_LOG_TCPLINK_ERROR("TCP recv EOF");
 	    read_handler->tcp_eof_handler();
 	  }
-	  else
+	else
 	  {
 	    OPENVPN_LOG_TCPLINK_ERROR("TCP recv error: " << error.message());
 	    stats->error(Error::NETWORK_RECV_ERROR);
 	    read_handler->tcp_error_handler("NETWORK_RECV_ERROR");
 	    stop();
 	  }
-	}
+      }
+
+      // Ring reads are used for packet mode only, and not under a
+      // mutate or gremlin, which work on whole read buffers.
+      bool ring_mode() const
+      {
+	return use_ring
+	  && !is_raw_mode_read()
+	  && !mutate
+#ifdef OPENVPN_GREMLIN
+	  && !gremlin
+#endif
+	  ;
+      }
+
+      void ring_alloc()
+      {
+	if (!ring)
+	  ring.reset(new PacketRing(std::max(size_t(RECV_RING_SIZE),
+					     2 * (frame_context.payload() + sizeof(std::uint16_t)))));
+      }
+
+      void queue_recv_ring()
+      {
+	ring_alloc();
+	socket.async_receive(openvpn_io::buffer(ring->write_ptr(), ring->write_space()),
+			     [self=Ptr(this)](const openvpn_io::error_code& error, const size_t bytes_recvd)
+			     {
+			       OPENVPN_ASYNC_HANDLER;
+			       try
+			       {
+				 self->handle_recv_ring(error, bytes_recvd);
+			       }
+			       catch (const std::exception& e)
+			       {
+				 self->recv_exception(e);
+			       }
+			     });
+      }
+
+      void handle_recv_ring(const openvpn_io::error_code& error, const size_t bytes_recvd)
+      {
+	OPENVPN_LOG_TCPLINK_VERBOSE("Link::handle_recv_ring: " << error.message() << " size=" << bytes_recvd);
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    recv_error(error);
+	    return;
+	  }
+	stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+	stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	ring->commit(bytes_recvd);
+
+	// switched to raw mode while the read was pending
+	if (is_raw_mode_read())
+	  {
+	    BufferAllocated buf(ring->buffered(), 0);
+	    ring->drain(buf);
+	    if (process_recv_buffer(buf) && !halt)
+	      queue_recv(nullptr);
+	    return;
+	  }
+
+	if (ring_recv())
+	  queue_recv(nullptr);
+      }
+
+      // hand the complete packets in the ring to the read handler
+      bool ring_recv()
+      {
+	Buffer view;
+	while (!halt && ring->next(view, frame_context))
+	  {
+	    // lay the packet out as if read with its prefix, so that
+	    // it gets the alignment the frame context was set up for
+	    BufferAllocated pkt;
+	    frame_context.prepare(pkt);
+	    pkt.init_headroom(pkt.offset() + sizeof(std::uint16_t));
+	    pkt.write(view.c_data(), view.size());
+	    if (!read_handler->tcp_read_handler(pkt))
+	      return false;
+	  }
+	return !halt;
       }
 
       bool put_pktstream(BufferAllocated& buf, BufferAllocated& pkt)
@@ -400,18 +642,20 @@ namespace openvpn {
       }
 
 #ifdef OPENVPN_GREMLIN
-      void gremlin_queue_send_buffer(BufferPtr& buf)
+      void gremlin_queue_send_buffer(BufferPtr& buf, const SendClass cls)
       {
-	gremlin->send_queue([self=Ptr(this), buf=std::move(buf)]() mutable {
+	const size_t size = buf->size();
+	gremlin->send_queue([self=Ptr(this), buf=std::move(buf), cls]() mutable {
 	    if (!self->halt)
 	      {
-		self->queue_send_buffer(buf);
+		self->queue_send_buffer(buf, cls);
 	      }
-	  });
+	  }, size);
       }
 
       bool gremlin_recv(BufferAllocated& buf)
       {
+	const size_t size = buf.size();
 	gremlin->recv_queue([self=Ptr(this), buf=std::move(buf)]() mutable {
 	    if (!self->halt)
 	      {
@@ -419,7 +663,7 @@ namespace openvpn {
 		if (requeue)
 		  self->queue_recv(nullptr);
 	      }
-	  });
+	  }, size);
 	return false;
       }
 #endif
@@ -436,9 +680,22 @@ namespace openvpn {
       SessionStats::Ptr stats;
       const size_t send_queue_max_size;
       const size_t free_list_max_size;
-      Queue queue;      // send queue
+      Queue queue;      // send queue, packets of the active send
+      Queue pending[N_SEND_CLASSES]; // packets waiting for the next send, by class
+      std::deque<std::uint64_t> bulk_queued; // enqueue times of pending SEND_BULK packets, for CoDel
       Queue free_list;  // recycled free buffers for send queue
+      SendPriority prio;
+      bool prio_enabled = false;
+      struct {
+	std::uint64_t first_above = 0;
+	std::uint64_t drop_next = 0;
+	unsigned int count = 0;
+	bool dropping = false;
+      } codel;
+      std::vector<openvpn_io::const_buffer> send_bufs; // gather list of the active send
       PacketStream pktstream;
+      std::unique_ptr<PacketRing> ring; // packet mode receive framing
+      bool use_ring = false;
       TransportMutateStream::Ptr mutate;
       bool raw_mode_read;
       bool raw_mode_write;
@@ -449,7 +706,7 @@ namespace openvpn {
 
     private:
       virtual void recv_buffer(PacketFrom::SPtr& pfp, const size_t bytes_recvd) = 0;
-      virtual void from_app_send_buffer(BufferPtr& buf) = 0;
+      virtual void from_app_send_buffer(BufferPtr& buf, const SendClass cls) = 0;
     };
   }
 } // namespace openvpn
@@ -25,18 +25,41 @@
 #define OPENVPN_TRANSPORT_UDPLINK_H
 
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 #include <openvpn/io/io.hpp>
 
+#include <openvpn/common/platform.hpp>
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/time/batchclock.hpp>
 
 #ifdef OPENVPN_GREMLIN
 #include <openvpn/transport/gremlin.hpp>
 #endif
 
+// Use recvmmsg() to pull several datagrams out of the socket
+// per reactor wakeup when the link is started with a batch size.
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(OPENVPN_UDPLINK_NO_MMSG)
+#define OPENVPN_UDPLINK_MMSG
+#include <errno.h>
+#include <openvpn/common/strerror.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cstdint>
+#include <ctime>
+#include <linux/net_tstamp.h>
+#if defined(UDP_SEGMENT) && !defined(OPENVPN_UDPLINK_NO_GSO)
+#define OPENVPN_UDPLINK_GSO
+#endif
+#endif
+
 #if defined(OPENVPN_DEBUG_UDPLINK) && OPENVPN_DEBUG_UDPLINK >= 1
 #define OPENVPN_LOG_UDPLINK_ERROR(x) OPENVPN_LOG(x)
 #else
@@ -64,6 +87,16 @@ namespace openvpn {
       typedef std::unique_ptr<PacketFrom> SPtr;
       BufferAllocated buf;
       AsioEndpoint sender_endpoint;
+      unsigned int tos = 0; // outer TOS/traffic class, see Link::enable_tos()
+    };
+
+    // outgoing packet queued for a batched send
+    struct PacketTo
+    {
+      BufferAllocated buf;
+      AsioEndpoint endpoint;
+      bool has_endpoint = false;
+      unsigned int tos = 0;
     };
 
     template <typename ReadHandler>
@@ -94,7 +127,9 @@ namespace openvpn {
 
       // Returns 0 on success, or a system error code on error.
       // May also return SEND_PARTIAL or SEND_SOCKET_HALTED.
-      int send(const Buffer& buf, const AsioEndpoint* endpoint)
+      // A non-zero tos is used as the packet's TOS/traffic class
+      // byte after enable_tos().
+      int send(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos = 0)
       {
 #ifdef OPENVPN_GREMLIN
 	if (gremlin)
@@ -104,13 +139,136 @@ namespace openvpn {
 	  }
 	else
 #endif
-	return do_send(buf, endpoint);
+#ifdef OPENVPN_UDPLINK_MMSG
+	if (send_batch)
+	  return queue_send(buf, endpoint, tos);
+	else
+#endif
+	return do_send(buf, endpoint, tos);
+      }
+
+#ifdef OPENVPN_UDPLINK_MMSG
+      // Coalesce outgoing packets: send() copies packets into a
+      // queue of up to batch_size entries which is flushed with
+      // sendmmsg() at the end of the current reactor iteration
+      // (or immediately when full).  If gso is true, runs of
+      // equal-sized packets to the same endpoint are sent as
+      // UDP_SEGMENT super-packets where the kernel supports it.
+      // Since sends are deferred, errors are only reflected in
+      // stats and not in the return value of send().
+      void set_send_batch(const unsigned int batch_size, const bool gso)
+      {
+	if (batch_size > 1)
+	  send_batch.reset(new SendBatch(batch_size, gso));
+	else
+	  send_batch.reset();
+      }
+
+      // Set the TOS/traffic class of each sent packet from the tos
+      // argument of send(), as a cmsg.  If recv is true, also fill
+      // in PacketFrom::tos of received packets, which is only
+      // available from recvmmsg() reads (see start()).  Call after
+      // the socket is open.
+      void enable_tos(const bool recv)
+      {
+	const int fd = socket.native_handle();
+	const bool ipv6 = socket.local_endpoint().protocol() == openvpn_io::ip::udp::v6();
+	tos_level = ipv6 ? IPPROTO_IPV6 : IPPROTO_IP;
+	tos_type = ipv6 ? IPV6_TCLASS : IP_TOS;
+	if (recv)
+	  {
+	    const int on = 1;
+	    // IPv4 packets on a dual-stack socket report IP_TOS
+	    ::setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on));
+	    if (ipv6 && ::setsockopt(fd, IPPROTO_IPV6, IPV6_RECVTCLASS, &on, sizeof(on)) < 0)
+	      OPENVPN_LOG_UDPLINK_ERROR("UDP IPV6_RECVTCLASS: " << strerror_str(errno));
+	    recv_tos = true;
+	  }
+      }
+
+      // Enable SO_TXTIME, for send_txtime().  The departure times
+      // are only kept with the fq or etf qdisc on the egress device.
+      // Returns false if the kernel doesn't support it.
+      bool enable_txtime()
+      {
+#ifdef SO_TXTIME
+	struct sock_txtime cfg;
+	cfg.clockid = CLOCK_MONOTONIC;
+	cfg.flags = 0;
+	if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == 0)
+	  {
+	    txtime = true;
+	    return true;
+	  }
+	OPENVPN_LOG_UDPLINK_ERROR("UDP SO_TXTIME: " << strerror_str(errno));
+#endif
+	return false;
+      }
+
+      bool txtime_enabled() const
+      {
+	return txtime;
       }
 
-      void start(const int n_parallel)
+      // Count packets dropped for lack of socket buffer space in
+      // SessionStats::SOCKET_RECV_DROPS and SOCKET_SEND_DROPS, and
+      // double the buffer that dropped them, up to max_size bytes
+      // (0 to only count).  Receive drops are read from SO_RXQ_OVFL
+      // cmsgs, which are only available from recvmmsg() reads (see
+      // start()).  Call after the socket is open and before start().
+      void enable_buffer_autotune(const int max_size)
+      {
+	const int on = 1;
+	if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+	  OPENVPN_LOG_UDPLINK_ERROR("UDP SO_RXQ_OVFL: " << strerror_str(errno));
+	else
+	  recv_ovfl = true;
+	buffer_max = max_size;
+      }
+
+      // socket buffer sizes, as set by the kernel (which doubles
+      // the requested size for its bookkeeping overhead)
+      int recv_buffer_size() const
+      {
+	return get_buffer_size(SO_RCVBUF);
+      }
+
+      int send_buffer_size() const
+      {
+	return get_buffer_size(SO_SNDBUF);
+      }
+
+      // Like send(), with the kernel holding the packet until
+      // departure, in CLOCK_MONOTONIC nanoseconds, after
+      // enable_txtime().  Bypasses the send batch, since each packet
+      // has its own time.
+      int send_txtime(const Buffer& buf, const AsioEndpoint* endpoint, const std::uint64_t departure, const unsigned int tos = 0)
+      {
+	if (!txtime)
+	  return send(buf, endpoint, tos);
+	if (send_batch)
+	  flush_send_batch(); // keep the order
+	return do_send_cmsg(buf, endpoint, tos_type ? tos : 0, departure);
+      }
+#endif
+
+      // If batch_size > 1 and recvmmsg() is available, a single
+      // read-readiness wait is queued and the socket is drained in
+      // bursts of up to batch_size datagrams per wakeup, otherwise
+      // n_parallel individual async_receive_from() calls are kept
+      // outstanding.
+      void start(const int n_parallel, const unsigned int batch_size=0)
       {
 	if (!halt)
 	  {
+#ifdef OPENVPN_UDPLINK_MMSG
+	    if (batch_size > 1)
+	      {
+		recv_batch.reset(new RecvBatch(batch_size, recv_tos || recv_ovfl));
+		queue_read_batch();
+		return;
+	      }
+#endif
 	    for (int i = 0; i < n_parallel; i++)
 	      queue_read(nullptr);
 	  }
@@ -119,6 +277,10 @@ namespace openvpn {
       void stop()
       {
 	halt = true;
+#ifdef OPENVPN_UDPLINK_MMSG
+	if (send_batch)
+	  send_batch->n_pending = 0;
+#endif
 #ifdef OPENVPN_GREMLIN
 	if (gremlin)
 	  gremlin->stop();
@@ -179,10 +341,487 @@ namespace openvpn {
 	  }
       }
 
-      int do_send(const Buffer& buf, const AsioEndpoint* endpoint)
+#ifdef OPENVPN_UDPLINK_MMSG
+      // Ring of preallocated PacketFrom objects and the
+      // mmsghdr/iovec arrays that point into them.
+      struct RecvBatch
+      {
+	enum {
+	  DRAIN_BURSTS = 8, // max recvmmsg() calls per reactor wakeup
+	};
+
+	union Cmsg
+	{
+	  char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(std::uint32_t))];
+	  struct cmsghdr align;
+	};
+
+	RecvBatch(const unsigned int size, const bool with_cmsg)
+	  : ring(size),
+	    msgs(size),
+	    iov(size),
+	    cmsg(with_cmsg ? size : 0)
+	{
+	}
+
+	std::vector<PacketFrom::SPtr> ring;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iov;
+	std::vector<Cmsg> cmsg; // IP_TOS/IPV6_TCLASS with recv_tos, SO_RXQ_OVFL with recv_ovfl
+      };
+
+      void queue_read_batch()
+      {
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::queue_read_batch");
+	socket.async_wait(openvpn_io::ip::udp::socket::wait_read,
+			  [self=Ptr(this)](const openvpn_io::error_code& error)
+                          {
+                            OPENVPN_ASYNC_HANDLER;
+                            self->handle_read_batch(error);
+                          });
+      }
+
+      void handle_read_batch(const openvpn_io::error_code& error)
+      {
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::handle_read_batch: " << error.message());
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP recv wait error: " << error.message());
+	    stats->error(Error::NETWORK_RECV_ERROR);
+	    queue_read_batch();
+	    return;
+	  }
+
+	// Drain the socket: asio's epoll reactor is edge-triggered,
+	// so keep reading full bursts without going back through the
+	// reactor, up to a budget that keeps the io_context fair to
+	// the tun device and control-plane handlers.
+	for (unsigned int i = 0; i < RecvBatch::DRAIN_BURSTS && !halt; ++i)
+	  {
+	    if (read_burst() < recv_batch->ring.size())
+	      break;
+	  }
+
+	if (!halt)
+	  queue_read_batch();
+      }
+
+      // Receive and dispatch one recvmmsg() burst, returning the
+      // number of datagrams received.
+      size_t read_burst()
+      {
+	RecvBatch& rb = *recv_batch;
+	const size_t size = rb.ring.size();
+
+	// (re)initialize ring entries, some of which may have
+	// been released to the read handler in the last burst
+	for (size_t i = 0; i < size; ++i)
+	  {
+	    PacketFrom::SPtr& pfp = rb.ring[i];
+	    if (!pfp)
+	      pfp.reset(new PacketFrom());
+	    frame_context.prepare(pfp->buf);
+	    const openvpn_io::mutable_buffer mb = frame_context.mutable_buffer(pfp->buf);
+	    rb.iov[i].iov_base = mb.data();
+	    rb.iov[i].iov_len = mb.size();
+	    struct msghdr& mh = rb.msgs[i].msg_hdr;
+	    mh.msg_name = pfp->sender_endpoint.data();
+	    mh.msg_namelen = static_cast<socklen_t>(pfp->sender_endpoint.capacity());
+	    mh.msg_iov = &rb.iov[i];
+	    mh.msg_iovlen = 1;
+	    if (!rb.cmsg.empty())
+	      {
+		mh.msg_control = rb.cmsg[i].buf;
+		mh.msg_controllen = sizeof(rb.cmsg[i].buf);
+	      }
+	    else
+	      {
+		mh.msg_control = nullptr;
+		mh.msg_controllen = 0;
+	      }
+	    mh.msg_flags = 0;
+	    rb.msgs[i].msg_len = 0;
+	  }
+
+	const int n = ::recvmmsg(socket.native_handle(), rb.msgs.data(), static_cast<unsigned int>(size), MSG_DONTWAIT, nullptr);
+	if (n < 0)
+	  {
+	    const int eno = errno;
+	    if (eno != EAGAIN && eno != EWOULDBLOCK && eno != EINTR)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP recvmmsg error: " << strerror_str(eno));
+		stats->error(Error::NETWORK_RECV_ERROR);
+	      }
+	  }
+	else
+	  {
+	    size_t bytes_recvd = 0;
+	    size_t packets_recvd = 0;
+	    for (int i = 0; i < n; ++i)
+	      {
+		const size_t len = rb.msgs[i].msg_len;
+		if (len)
+		  {
+		    bytes_recvd += len;
+		    ++packets_recvd;
+		  }
+	      }
+	    stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+	    stats->inc_stat(SessionStats::PACKETS_IN, packets_recvd);
+
+	    // the drop counter of the last packet covers the burst
+	    if (recv_ovfl)
+	      {
+		for (int i = n - 1; i >= 0; --i)
+		  {
+		    std::uint32_t drops;
+		    if (cmsg_drops(rb.msgs[i].msg_hdr, drops))
+		      {
+			recv_dropped(drops);
+			break;
+		      }
+		  }
+	      }
+
+	    // hand the burst to the read handler, with one clock
+	    // reading shared by all of its packets
+	    const BatchClock::Scope clock_scope;
+	    if (n > 1)
+	      read_handler->udp_read_burst_begin();
+	    for (int i = 0; i < n && !halt; ++i)
+	      {
+		const size_t len = rb.msgs[i].msg_len;
+		if (!len)
+		  continue;
+		PacketFrom::SPtr& pfp = rb.ring[i];
+		pfp->sender_endpoint.resize(rb.msgs[i].msg_hdr.msg_namelen);
+		pfp->buf.set_size(len);
+		if (recv_tos)
+		  pfp->tos = cmsg_tos(rb.msgs[i].msg_hdr);
+		OPENVPN_LOG_UDPLINK_VERBOSE("UDP[" << len << "] from " << pfp->sender_endpoint << " (batch " << i << '/' << n << ')');
+#ifdef OPENVPN_GREMLIN
+		if (gremlin)
+		  gremlin_recv(pfp);
+		else
+#endif
+		read_handler->udp_read_handler(pfp);
+	      }
+	    if (n > 1 && !halt)
+	      read_handler->udp_read_burst_end();
+	  }
+	return n > 0 ? size_t(n) : 0;
+      }
+
+      static unsigned int cmsg_tos(struct msghdr& mh)
+      {
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+	  {
+	    if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TOS && cm->cmsg_len >= CMSG_LEN(1))
+	      return *CMSG_DATA(cm);
+	    if (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_TCLASS && cm->cmsg_len >= CMSG_LEN(sizeof(int)))
+	      {
+		int tclass;
+		std::memcpy(&tclass, CMSG_DATA(cm), sizeof(tclass));
+		return unsigned(tclass) & 0xFF;
+	      }
+	  }
+	return 0;
+      }
+
+      // SO_RXQ_OVFL count of packets dropped by the socket so far,
+      // only present once it has dropped any
+      static bool cmsg_drops(struct msghdr& mh, std::uint32_t& drops)
+      {
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+	  {
+	    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL && cm->cmsg_len >= CMSG_LEN(sizeof(drops)))
+	      {
+		std::memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+		return true;
+	      }
+	  }
+	return false;
+      }
+
+      void recv_dropped(const std::uint32_t drops)
+      {
+	const std::uint32_t n = drops - recv_drops; // wraps
+	if (!n)
+	  return;
+	recv_drops = drops;
+	stats->inc_stat(SessionStats::SOCKET_RECV_DROPS, n);
+	grow_buffer(SO_RCVBUF, SO_RCVBUFFORCE);
+      }
+
+      // count a send that failed with error eno, if the socket
+      // buffer was full
+      void send_failed(const int eno)
+      {
+	if (eno != EAGAIN && eno != EWOULDBLOCK && eno != ENOBUFS)
+	  return;
+	stats->inc_stat(SessionStats::SOCKET_SEND_DROPS, 1);
+	grow_buffer(SO_SNDBUF, SO_SNDBUFFORCE);
+      }
+
+      // double the socket buffer of option opt, up to buffer_max,
+      // beyond net.core.rmem_max/wmem_max if we have CAP_NET_ADMIN
+      void grow_buffer(const int opt, const int force_opt)
+      {
+	const int size = get_buffer_size(opt); // twice the last requested size
+	if (!buffer_max || size <= 0 || size / 2 >= buffer_max)
+	  return;
+	const int new_size = std::min(size, buffer_max);
+	const int fd = socket.native_handle();
+	if (::setsockopt(fd, SOL_SOCKET, force_opt, &new_size, sizeof(new_size)) < 0
+	    && ::setsockopt(fd, SOL_SOCKET, opt, &new_size, sizeof(new_size)) < 0)
+	  OPENVPN_LOG_UDPLINK_ERROR("UDP socket buffer resize: " << strerror_str(errno));
+	else
+	  OPENVPN_LOG_UDPLINK_VERBOSE("UDP socket buffer " << opt << " resized to " << new_size);
+      }
+
+      int get_buffer_size(const int opt) const
+      {
+	int size = 0;
+	socklen_t len = sizeof(size);
+	if (::getsockopt(socket.native_handle(), SOL_SOCKET, opt, &size, &len) < 0)
+	  return -1;
+	return size;
+      }
+
+      // add a TOS/traffic class cmsg after controllen bytes of
+      // msg_control, returning the new controllen
+      size_t add_tos_cmsg(struct msghdr& mh, const size_t controllen, const unsigned int tos) const
+      {
+	struct cmsghdr *cm = (struct cmsghdr *)((char *)mh.msg_control + controllen);
+	cm->cmsg_level = tos_level;
+	cm->cmsg_type = tos_type;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	const int val = int(tos);
+	std::memcpy(CMSG_DATA(cm), &val, sizeof(val));
+	return controllen + CMSG_SPACE(sizeof(int));
+      }
+#endif
+
+#ifdef OPENVPN_UDPLINK_MMSG
+      struct SendBatch
+      {
+	// GSO limits: kernel UDP_MAX_SEGMENTS and max IP datagram payload
+	enum {
+	  GSO_MAX_SEGMENTS = 64,
+	  GSO_MAX_BYTES = 65000,
+	};
+
+	union Cmsg
+	{
+	  char buf[CMSG_SPACE(sizeof(std::uint16_t)) + CMSG_SPACE(sizeof(int))];
+	  struct cmsghdr align;
+	};
+
+	SendBatch(const unsigned int size, const bool gso_arg)
+	  : pending(size),
+	    msgs(size),
+	    iov(size),
+	    n_segs(size),
+	    cmsg(size),
+	    gso(gso_arg)
+	{
+	}
+
+	std::vector<PacketTo> pending;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iov;
+	std::vector<size_t> n_segs;
+	std::vector<Cmsg> cmsg;
+	size_t n_pending = 0;
+	bool flush_queued = false;
+	bool gso;
+      };
+
+      int queue_send(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos)
+      {
+	if (halt)
+	  return SEND_SOCKET_HALTED;
+	SendBatch& sb = *send_batch;
+	PacketTo& p = sb.pending[sb.n_pending++];
+	p.buf.reset(buf.size(), 0);
+	p.buf.reset_content();
+	p.buf.write(buf.c_data(), buf.size());
+	p.has_endpoint = (endpoint != nullptr);
+	if (endpoint)
+	  p.endpoint = *endpoint;
+	p.tos = tos_type ? tos : 0;
+
+	if (sb.n_pending == sb.pending.size())
+	  flush_send_batch();
+	else if (!sb.flush_queued)
+	  {
+	    sb.flush_queued = true;
+	    openvpn_io::post(socket.get_executor(), [self=Ptr(this)]()
+                             {
+                               OPENVPN_ASYNC_HANDLER;
+                               self->send_batch->flush_queued = false;
+                               self->flush_send_batch();
+                             });
+	  }
+	return 0;
+      }
+
+      static bool same_dest(const PacketTo& a, const PacketTo& b)
+      {
+	return a.has_endpoint == b.has_endpoint
+	  && (!a.has_endpoint || a.endpoint == b.endpoint);
+      }
+
+      // build one mmsghdr per packet, or per GSO run of packets
+      size_t build_send_msgs()
+      {
+	SendBatch& sb = *send_batch;
+	size_t n_msgs = 0;
+	size_t i = 0;
+	while (i < sb.n_pending)
+	  {
+	    PacketTo& first = sb.pending[i];
+	    const size_t seg_size = first.buf.size();
+	    size_t total = seg_size;
+	    size_t j = i;
+	    sb.iov[j].iov_base = first.buf.data();
+	    sb.iov[j].iov_len = seg_size;
+	    ++j;
+#ifdef OPENVPN_UDPLINK_GSO
+	    if (sb.gso)
+	      {
+		// a GSO run is a series of equal-sized packets to the same
+		// destination and with the same TOS, optionally terminated
+		// by one smaller packet
+		while (j < sb.n_pending && j - i < SendBatch::GSO_MAX_SEGMENTS)
+		  {
+		    PacketTo& p = sb.pending[j];
+		    const size_t size = p.buf.size();
+		    if (!size || size > seg_size || total + size > SendBatch::GSO_MAX_BYTES || !same_dest(first, p) || p.tos != first.tos)
+		      break;
+		    sb.iov[j].iov_base = p.buf.data();
+		    sb.iov[j].iov_len = size;
+		    total += size;
+		    ++j;
+		    if (size < seg_size)
+		      break;
+		  }
+	      }
+#endif
+	    struct msghdr& mh = sb.msgs[n_msgs].msg_hdr;
+	    if (first.has_endpoint)
+	      {
+		mh.msg_name = first.endpoint.data();
+		mh.msg_namelen = static_cast<socklen_t>(first.endpoint.size());
+	      }
+	    else
+	      {
+		mh.msg_name = nullptr;
+		mh.msg_namelen = 0;
+	      }
+	    mh.msg_iov = &sb.iov[i];
+	    mh.msg_iovlen = j - i;
+	    mh.msg_control = sb.cmsg[n_msgs].buf;
+	    size_t controllen = 0;
+	    mh.msg_flags = 0;
+#ifdef OPENVPN_UDPLINK_GSO
+	    if (j - i > 1)
+	      {
+		struct cmsghdr *cm = (struct cmsghdr *)mh.msg_control;
+		cm->cmsg_level = IPPROTO_UDP;
+		cm->cmsg_type = UDP_SEGMENT;
+		cm->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+		const std::uint16_t gso_size = static_cast<std::uint16_t>(seg_size);
+		std::memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+		controllen = CMSG_SPACE(sizeof(std::uint16_t));
+	      }
+#endif
+	    if (first.tos)
+	      controllen = add_tos_cmsg(mh, controllen, first.tos);
+	    if (!controllen)
+	      mh.msg_control = nullptr;
+	    mh.msg_controllen = controllen;
+	    sb.msgs[n_msgs].msg_len = 0;
+	    sb.n_segs[n_msgs] = j - i;
+	    ++n_msgs;
+	    i = j;
+	  }
+	return n_msgs;
+      }
+
+      void flush_send_batch()
+      {
+	SendBatch& sb = *send_batch;
+	if (halt || !sb.n_pending)
+	  return;
+
+	const size_t n_msgs = build_send_msgs();
+	size_t sent = 0;
+	while (sent < n_msgs)
+	  {
+	    const int n = ::sendmmsg(socket.native_handle(), &sb.msgs[sent], static_cast<unsigned int>(n_msgs - sent), 0);
+	    if (n < 0)
+	      {
+		const int eno = errno;
+		if (eno == EINTR)
+		  continue;
+#ifdef OPENVPN_UDPLINK_GSO
+		if (sb.gso && sb.n_segs[sent] > 1 && eno == EIO)
+		  {
+		    // no GSO support on egress device, fall back to
+		    // individual sends for the remainder of the batch
+		    OPENVPN_LOG_UDPLINK_ERROR("UDP GSO send failed, disabling GSO");
+		    sb.gso = false;
+		    send_remaining_individually(sent, n_msgs);
+		    break;
+		  }
+#endif
+		OPENVPN_LOG_UDPLINK_ERROR("UDP sendmmsg error: " << strerror_str(eno));
+		stats->error(Error::NETWORK_SEND_ERROR);
+		send_failed(eno);
+		// drop the message that failed and continue with the rest
+		++sent;
+		continue;
+	      }
+	    for (int k = 0; k < n; ++k)
+	      {
+		const size_t idx = sent + k;
+		stats->inc_stat(SessionStats::BYTES_OUT, sb.msgs[idx].msg_len);
+		stats->inc_stat(SessionStats::PACKETS_OUT, sb.n_segs[idx]);
+	      }
+	    sent += n;
+	  }
+	sb.n_pending = 0;
+      }
+
+#ifdef OPENVPN_UDPLINK_GSO
+      void send_remaining_individually(const size_t from_msg, const size_t n_msgs)
+      {
+	SendBatch& sb = *send_batch;
+	for (size_t m = from_msg; m < n_msgs; ++m)
+	  {
+	    const struct msghdr& mh = sb.msgs[m].msg_hdr;
+	    const size_t first = static_cast<const struct iovec *>(mh.msg_iov) - sb.iov.data();
+	    for (size_t i = first; i < first + sb.n_segs[m]; ++i)
+	      {
+		const PacketTo& p = sb.pending[i];
+		do_send(p.buf, p.has_endpoint ? &p.endpoint : nullptr, p.tos);
+	      }
+	  }
+      }
+#endif
+#endif
+
+      int do_send(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos = 0)
       {
 	if (!halt)
 	  {
+#ifdef OPENVPN_UDPLINK_MMSG
+	    if (tos && tos_type)
+	      return do_send_cmsg(buf, endpoint, tos, 0);
+#endif
 	    try {
 	      const size_t wrote = endpoint
 		? socket.send_to(buf.const_buffer(), *endpoint)
@@ -202,6 +841,9 @@ namespace openvpn {
 	      {
 		OPENVPN_LOG_UDPLINK_ERROR("UDP send exception: " << e.what());
 		stats->error(Error::NETWORK_SEND_ERROR);
+#ifdef OPENVPN_UDPLINK_MMSG
+		send_failed(e.code().value());
+#endif
 		return e.code().value();
 	      }
 	  }
@@ -209,24 +851,87 @@ namespace openvpn {
 	  return SEND_SOCKET_HALTED;
       }
 
+#ifdef OPENVPN_UDPLINK_MMSG
+      // do_send() with a TOS and/or a departure time cmsg
+      int do_send_cmsg(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos, const std::uint64_t departure)
+      {
+	union {
+	  char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(std::uint64_t))];
+	  struct cmsghdr align;
+	} control;
+	struct iovec iov;
+	iov.iov_base = const_cast<unsigned char *>(buf.c_data());
+	iov.iov_len = buf.size();
+	struct msghdr mh;
+	std::memset(&mh, 0, sizeof(mh));
+	if (endpoint)
+	  {
+	    mh.msg_name = const_cast<AsioEndpoint *>(endpoint)->data();
+	    mh.msg_namelen = static_cast<socklen_t>(endpoint->size());
+	  }
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	size_t controllen = 0;
+	if (tos)
+	  controllen = add_tos_cmsg(mh, controllen, tos);
+#ifdef SO_TXTIME
+	if (departure)
+	  {
+	    struct cmsghdr *cm = (struct cmsghdr *)(control.buf + controllen);
+	    cm->cmsg_level = SOL_SOCKET;
+	    cm->cmsg_type = SCM_TXTIME;
+	    cm->cmsg_len = CMSG_LEN(sizeof(departure));
+	    std::memcpy(CMSG_DATA(cm), &departure, sizeof(departure));
+	    controllen += CMSG_SPACE(sizeof(departure));
+	  }
+#endif
+	if (!controllen)
+	  mh.msg_control = nullptr;
+	mh.msg_controllen = controllen;
+
+	ssize_t wrote;
+	do {
+	  wrote = ::sendmsg(socket.native_handle(), &mh, 0);
+	} while (wrote < 0 && errno == EINTR);
+	if (wrote < 0)
+	  {
+	    const int eno = errno;
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP sendmsg error: " << strerror_str(eno));
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    send_failed(eno);
+	    return eno;
+	  }
+	stats->inc_stat(SessionStats::BYTES_OUT, wrote);
+	stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+	if (size_t(wrote) == buf.size())
+	  return 0;
+	OPENVPN_LOG_UDPLINK_ERROR("UDP partial send error");
+	stats->error(Error::NETWORK_SEND_ERROR);
+	return SEND_PARTIAL;
+      }
+#endif
+
 #ifdef OPENVPN_GREMLIN
       void gremlin_send(const Buffer& buf, const AsioEndpoint* endpoint)
       {
 	std::unique_ptr<AsioEndpoint> ep;
 	if (endpoint)
 	  ep.reset(new AsioEndpoint(*endpoint));
+	const size_t size = buf.size();
 	gremlin->send_queue([self=Ptr(this), buf=BufferAllocated(buf, 0), ep=std::move(ep)]() mutable {
 	    if (!self->halt)
 	      self->do_send(buf, ep.get());
-	  });
+	  }, size);
       }
 
       void gremlin_recv(PacketFrom::SPtr& pfp)
       {
+	const size_t size = pfp->buf.size();
 	gremlin->recv_queue([self=Ptr(this), pfp=std::move(pfp)]() mutable {
 	    if (!self->halt)
 	      self->read_handler->udp_read_handler(pfp);
-	  });
+	  }, size);
       }
 #endif
 
@@ -239,6 +944,18 @@ namespace openvpn {
 #ifdef OPENVPN_GREMLIN
       std::unique_ptr<Gremlin::SendRecvQueue> gremlin;
 #endif
+
+#ifdef OPENVPN_UDPLINK_MMSG
+      std::unique_ptr<RecvBatch> recv_batch;
+      std::unique_ptr<SendBatch> send_batch;
+      int tos_level = 0;     // cmsg level and type for sent TOS, see enable_tos()
+      int tos_type = 0;
+      bool recv_tos = false;
+      bool txtime = false;   // SO_TXTIME, see enable_txtime()
+      bool recv_ovfl = false; // SO_RXQ_OVFL, see enable_buffer_autotune()
+      std::uint32_t recv_drops = 0; // last SO_RXQ_OVFL count
+      int buffer_max = 0;
+#endif
     };
   }
 } // namespace openvpn
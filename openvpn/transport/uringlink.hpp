@@ -0,0 +1,649 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// io_uring-backed alternative to UDPTransport::Link for Linux, with
+// the same interface towards the read handler.
+//
+// Receive uses a single multishot IORING_OP_RECVMSG on the socket,
+// registered as a fixed file, which picks its buffers from a
+// provided-buffer ring.  The ring is stocked with the buffers of
+// PacketFrom objects prepared from the usual Frame context (and so
+// drawn from the data path buffer pool), and the kernel writes each
+// datagram straight into one of them, so a received packet is handed
+// to the read handler without a copy or a syscall of its own.  The
+// read handler may keep the PacketFrom; its ring slot is restocked
+// with a fresh one.
+//
+// Sends are queued as IORING_OP_SENDMSG requests and submitted with
+// one io_uring_enter() at the end of the reactor iteration, or when
+// all send slots are in flight.
+//
+// Completions are signalled through an eventfd that is watched by the
+// io_context, so timers and control-plane handlers stay on asio.
+// Requires Linux 6.0 or later; start() throws udp_uring_error if the
+// kernel lacks support, and callers are expected to fall back to Link.
+
+#ifndef OPENVPN_TRANSPORT_URINGLINK_H
+#define OPENVPN_TRANSPORT_URINGLINK_H
+
+#include <openvpn/common/platform.hpp>
+
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(OPENVPN_UDPLINK_NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT)
+#define OPENVPN_UDPLINK_URING
+#endif
+#endif
+#endif
+
+#ifdef OPENVPN_UDPLINK_URING
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/time/batchclock.hpp>
+#include <openvpn/transport/udplink.hpp>
+
+namespace openvpn {
+  namespace UDPTransport {
+
+    OPENVPN_EXCEPTION(udp_uring_error);
+
+    template <typename ReadHandler>
+    class UringLink : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<UringLink> Ptr;
+
+      enum {
+	DEFAULT_RECV_BUFS = 256,  // provided-buffer ring size, rounded up to a power of 2
+	SEND_SLOTS = 64,          // max sends in flight
+      };
+
+      UringLink(ReadHandler read_handler_arg,
+		openvpn_io::ip::udp::socket& socket_arg,
+		const Frame::Context& frame_context_arg,
+		const SessionStats::Ptr& stats_arg)
+	: socket(socket_arg),
+	  read_handler(read_handler_arg),
+	  frame_context(frame_context_arg),
+	  stats(stats_arg),
+	  event(socket_arg.get_executor())
+      {
+      }
+
+      // Set up the ring and arm the multishot receive, with n_recv_bufs
+      // receive buffers (DEFAULT_RECV_BUFS if 0).
+      void start(const unsigned int n_recv_bufs=0)
+      {
+	if (halt || initialized)
+	  return;
+	setup(n_recv_bufs ? n_recv_bufs : (unsigned int)DEFAULT_RECV_BUFS);
+	arm_recv();
+	submit();
+	queue_event_wait();
+      }
+
+      int send(const Buffer& buf, const AsioEndpoint* endpoint)
+      {
+	if (halt)
+	  return SEND_SOCKET_HALTED;
+	if (free_send.empty())
+	  submit_wait_send();
+	if (free_send.empty())
+	  {
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    return ENOBUFS;
+	  }
+	const unsigned int i = free_send.back();
+	free_send.pop_back();
+
+	SendSlot& s = send_slots[i];
+	s.pkt.buf.reset(buf.size(), 0);
+	s.pkt.buf.reset_content();
+	s.pkt.buf.write(buf.c_data(), buf.size());
+	s.pkt.has_endpoint = (endpoint != nullptr);
+	if (endpoint)
+	  s.pkt.endpoint = *endpoint;
+	s.iov.iov_base = s.pkt.buf.data();
+	s.iov.iov_len = s.pkt.buf.size();
+	std::memset(&s.mh, 0, sizeof(s.mh));
+	s.mh.msg_iov = &s.iov;
+	s.mh.msg_iovlen = 1;
+	if (endpoint)
+	  {
+	    s.mh.msg_name = s.pkt.endpoint.data();
+	    s.mh.msg_namelen = static_cast<socklen_t>(s.pkt.endpoint.size());
+	  }
+
+	io_uring_sqe* sqe = get_sqe();
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;
+	sqe->addr = reinterpret_cast<std::uint64_t>(&s.mh);
+	sqe->len = 1;
+	sqe->user_data = SEND_TAG | i;
+
+	if (!flush_queued)
+	  {
+	    flush_queued = true;
+	    openvpn_io::post(socket.get_executor(), [self=Ptr(this)]()
+                             {
+                               OPENVPN_ASYNC_HANDLER;
+                               self->flush_queued = false;
+                               self->submit();
+                             });
+	  }
+	return 0;
+      }
+
+      void stop()
+      {
+	if (halt)
+	  return;
+	halt = true;
+	event.close();
+	if (initialized)
+	  cancel_all();
+      }
+
+      void reset_align_adjust(const size_t align_adjust)
+      {
+	frame_context.reset_align_adjust(align_adjust);
+      }
+
+      ~UringLink()
+      {
+	stop();
+      }
+
+    private:
+      static constexpr std::uint64_t SEND_TAG = 1ULL << 32;
+      static constexpr std::uint64_t RECV_TAG = 2ULL << 32;
+      static constexpr std::uint64_t CANCEL_TAG = 3ULL << 32;
+      static constexpr std::uint16_t BGID = 0;
+
+      // kernel-written prefix of each buffer: recvmsg header and
+      // source address
+      enum {
+	NAME_LEN = sizeof(struct sockaddr_in6),
+	HDR_LEN = sizeof(struct io_uring_recvmsg_out) + NAME_LEN,
+      };
+
+      struct RecvSlot
+      {
+	PacketFrom::SPtr pfp;
+	size_t lead = 0; // HDR_LEN if the header sits in the buffer headroom, else 0
+      };
+
+      struct SendSlot
+      {
+	PacketTo pkt;
+	struct msghdr mh;
+	struct iovec iov;
+      };
+
+      // The ring fd and its mappings, released together.  setup()
+      // builds one of these locally and only hands it over to the
+      // link once every step has succeeded, so a failure part way
+      // through leaves nothing behind for stop() to wait on.
+      struct Ring
+      {
+	~Ring()
+	{
+	  if (sq_ring != MAP_FAILED)
+	    ::munmap(sq_ring, sq_ring_size);
+	  if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+	    ::munmap(cq_ring, cq_ring_size);
+	  if (sqes != MAP_FAILED)
+	    ::munmap(sqes, sqes_size);
+	  if (buf_ring != MAP_FAILED)
+	    ::munmap(buf_ring, buf_ring_size);
+	}
+
+	int register_(const unsigned int opcode, const void* arg, const unsigned int nr_args)
+	{
+	  return int(::syscall(__NR_io_uring_register, fd(), opcode, arg, nr_args));
+	}
+
+	ScopedFD fd;
+	void* sq_ring = MAP_FAILED;
+	void* cq_ring = MAP_FAILED;
+	void* sqes = MAP_FAILED;
+	void* buf_ring = MAP_FAILED;
+	size_t sq_ring_size = 0;
+	size_t cq_ring_size = 0;
+	size_t sqes_size = 0;
+	size_t buf_ring_size = 0;
+
+	unsigned int* sq_head = nullptr;
+	unsigned int* sq_tail = nullptr;
+	unsigned int* sq_array = nullptr;
+	unsigned int sq_mask = 0;
+	unsigned int sq_entries = 0;
+	unsigned int* cq_head = nullptr;
+	unsigned int* cq_tail = nullptr;
+	unsigned int cq_mask = 0;
+	io_uring_cqe* cqes = nullptr;
+      };
+
+      static int sys_setup(const unsigned int entries, io_uring_params* p)
+      {
+	return int(::syscall(__NR_io_uring_setup, entries, p));
+      }
+
+      int sys_enter(const unsigned int to_submit, const unsigned int min_complete, const unsigned int flags)
+      {
+	return int(::syscall(__NR_io_uring_enter, ring->fd(), to_submit, min_complete, flags, nullptr, 0));
+      }
+
+      static void* map(const size_t size, const int fd, const off_t off)
+      {
+	return ::mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, off);
+      }
+
+      template <typename T>
+      static T* ptr(void* base, const std::uint32_t off)
+      {
+	return reinterpret_cast<T*>(static_cast<unsigned char*>(base) + off);
+      }
+
+      void setup(unsigned int n_recv_bufs)
+      {
+	std::unique_ptr<Ring> r(new Ring());
+
+	// ring
+	io_uring_params p;
+	std::memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 4 * (n_recv_bufs + SEND_SLOTS);
+	const int fd = sys_setup(SEND_SLOTS + 8, &p);
+	if (fd < 0)
+	  throw udp_uring_error("io_uring_setup failed: " + std::string(std::strerror(errno)));
+	r->fd.reset(fd);
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(std::uint32_t);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	  r->sq_ring_size = r->cq_ring_size = std::max(r->sq_ring_size, r->cq_ring_size);
+	r->sq_ring = map(r->sq_ring_size, fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+	  throw udp_uring_error("io_uring SQ ring mmap failed");
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	  r->cq_ring = r->sq_ring;
+	else
+	  {
+	    r->cq_ring = map(r->cq_ring_size, fd, IORING_OFF_CQ_RING);
+	    if (r->cq_ring == MAP_FAILED)
+	      throw udp_uring_error("io_uring CQ ring mmap failed");
+	  }
+	r->sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+	r->sqes = map(r->sqes_size, fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+	  throw udp_uring_error("io_uring SQE mmap failed");
+
+	r->sq_head = ptr<unsigned int>(r->sq_ring, p.sq_off.head);
+	r->sq_tail = ptr<unsigned int>(r->sq_ring, p.sq_off.tail);
+	r->sq_mask = *ptr<unsigned int>(r->sq_ring, p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->sq_array = ptr<unsigned int>(r->sq_ring, p.sq_off.array);
+	r->cq_head = ptr<unsigned int>(r->cq_ring, p.cq_off.head);
+	r->cq_tail = ptr<unsigned int>(r->cq_ring, p.cq_off.tail);
+	r->cq_mask = *ptr<unsigned int>(r->cq_ring, p.cq_off.ring_mask);
+	r->cqes = ptr<io_uring_cqe>(r->cq_ring, p.cq_off.cqes);
+
+	// fixed file
+	const int sfd = socket.native_handle();
+	if (r->register_(IORING_REGISTER_FILES, &sfd, 1) < 0)
+	  throw udp_uring_error("io_uring fixed file registration failed: " + std::string(std::strerror(errno)));
+
+	// provided-buffer ring, registered empty and stocked below
+	unsigned int n = 1;
+	while (n < n_recv_bufs && n < 32768)
+	  n <<= 1;
+	r->buf_ring_size = n * sizeof(io_uring_buf);
+	r->buf_ring = ::mmap(nullptr, r->buf_ring_size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	if (r->buf_ring == MAP_FAILED)
+	  throw udp_uring_error("io_uring buffer ring mmap failed");
+	io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<std::uint64_t>(r->buf_ring);
+	reg.ring_entries = n;
+	reg.bgid = BGID;
+	if (r->register_(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	  throw udp_uring_error("io_uring buffer ring registration failed: " + std::string(std::strerror(errno)));
+
+	// completion notification
+	ScopedFD efd(::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC));
+	if (!efd.defined())
+	  throw udp_uring_error("eventfd failed");
+	const int efd_arg = efd();
+	if (r->register_(IORING_REGISTER_EVENTFD, &efd_arg, 1) < 0)
+	  throw udp_uring_error("io_uring eventfd registration failed: " + std::string(std::strerror(errno)));
+
+	// send slots
+	std::unique_ptr<SendSlot[]> slots(new SendSlot[SEND_SLOTS]);
+	std::vector<unsigned int> free_slots;
+	free_slots.reserve(SEND_SLOTS);
+	for (unsigned int i = SEND_SLOTS; i-- > 0; )
+	  free_slots.push_back(i);
+
+	// nothing has been submitted yet, so up to here a throw just
+	// closes the ring; from here on cancel_all() can tear it down
+	event.assign(efd.release());
+	sq_local_tail = *r->sq_tail;
+	ring = std::move(r);
+	send_slots = std::move(slots);
+	free_send = std::move(free_slots);
+	initialized = true;
+
+	buf_ring_mask = n - 1;
+	recv_slots.resize(n);
+	for (unsigned int i = 0; i < n; ++i)
+	  restock(i);
+	publish_bufs();
+
+	// multishot recvmsg template: the kernel only looks at the
+	// name and control lengths
+	std::memset(&recv_mh, 0, sizeof(recv_mh));
+	recv_mh.msg_namelen = NAME_LEN;
+      }
+
+      // (re)fill receive slot i with an empty packet and queue it
+      // on the buffer ring
+      void restock(const unsigned int i)
+      {
+	RecvSlot& rs = recv_slots[i];
+	if (!rs.pfp)
+	  rs.pfp.reset(new PacketFrom());
+	BufferAllocated& buf = rs.pfp->buf;
+	frame_context.prepare(buf);
+	const openvpn_io::mutable_buffer mb = frame_context.mutable_buffer(buf);
+	rs.lead = buf.offset() >= HDR_LEN ? size_t(HDR_LEN) : 0;
+	unsigned char* addr = static_cast<unsigned char*>(mb.data()) - rs.lead;
+
+	io_uring_buf& b = static_cast<io_uring_buf*>(ring->buf_ring)[(buf_tail + buf_pending) & buf_ring_mask];
+	b.addr = reinterpret_cast<std::uint64_t>(addr);
+	b.len = static_cast<std::uint32_t>(mb.size() + rs.lead);
+	b.bid = static_cast<std::uint16_t>(i);
+	++buf_pending;
+      }
+
+      void publish_bufs()
+      {
+	if (!buf_pending)
+	  return;
+	buf_tail = static_cast<std::uint16_t>(buf_tail + buf_pending);
+	buf_pending = 0;
+	__atomic_store_n(&static_cast<io_uring_buf_ring*>(ring->buf_ring)->tail, buf_tail, __ATOMIC_RELEASE);
+      }
+
+      io_uring_sqe* get_sqe()
+      {
+	if (sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+	  submit();
+	const unsigned int idx = sq_local_tail & ring->sq_mask;
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(ring->sqes) + idx;
+	std::memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[idx] = idx;
+	++sq_local_tail;
+	return sqe;
+      }
+
+      void submit()
+      {
+	if (!ring || !ring->fd.defined())
+	  return;
+	const unsigned int n = sq_local_tail - *ring->sq_tail;
+	if (!n)
+	  return;
+	__atomic_store_n(ring->sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	if (sys_enter(n, 0, 0) < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR)
+	  stats->error(Error::NETWORK_SEND_ERROR);
+      }
+
+      // all send slots are in flight: submit and wait for one
+      void submit_wait_send()
+      {
+	submit();
+	for (int i = 0; i < 4 && free_send.empty(); ++i)
+	  {
+	    if (sys_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+	      break;
+	    reap();
+	  }
+      }
+
+      void arm_recv()
+      {
+	io_uring_sqe* sqe = get_sqe();
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->fd = 0;
+	sqe->addr = reinterpret_cast<std::uint64_t>(&recv_mh);
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->buf_group = BGID;
+	sqe->user_data = RECV_TAG;
+	recv_armed = true;
+      }
+
+      void queue_event_wait()
+      {
+	event.async_wait(openvpn_io::posix::stream_descriptor::wait_read,
+			 [self=Ptr(this)](const openvpn_io::error_code& error)
+                         {
+                           OPENVPN_ASYNC_HANDLER;
+                           self->handle_event(error);
+                         });
+      }
+
+      void handle_event(const openvpn_io::error_code& error)
+      {
+	if (halt)
+	  return;
+	if (!error)
+	  {
+	    std::uint64_t cnt;
+	    while (::read(event.native_handle(), &cnt, sizeof(cnt)) > 0)
+	      ;
+	    reap();
+	    if (!halt && !recv_armed)
+	      arm_recv();
+	    if (!halt)
+	      submit();
+	  }
+	else
+	  stats->error(Error::NETWORK_RECV_ERROR);
+	if (!halt)
+	  queue_event_wait();
+      }
+
+      // process all available completions
+      void reap()
+      {
+	const BatchClock::Scope clock_scope;
+	bool burst = false;
+	unsigned int head = *ring->cq_head;
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	  {
+	    const io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+	    ++head;
+	    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	    switch (cqe.user_data & ~0xFFFFFFFFULL)
+	      {
+	      case RECV_TAG:
+		if (!burst)
+		  {
+		    burst = true;
+		    read_handler->udp_read_burst_begin();
+		  }
+		recv_complete(cqe);
+		break;
+	      case SEND_TAG:
+		send_complete(cqe);
+		break;
+	      default:
+		break;
+	      }
+	    if (halt)
+	      return;
+	  }
+	publish_bufs();
+	if (burst)
+	  read_handler->udp_read_burst_end();
+      }
+
+      void recv_complete(const io_uring_cqe& cqe)
+      {
+	if (!(cqe.flags & IORING_CQE_F_MORE))
+	  recv_armed = false; // multishot ended, e.g. ENOBUFS; rearmed by handle_event()
+	if (cqe.res < 0)
+	  {
+	    if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+	      stats->error(Error::NETWORK_RECV_ERROR);
+	    return;
+	  }
+	if (!(cqe.flags & IORING_CQE_F_BUFFER))
+	  return;
+	const unsigned int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+	if (bid >= recv_slots.size())
+	  return;
+
+	RecvSlot& rs = recv_slots[bid];
+	PacketFrom& pf = *rs.pfp;
+	unsigned char* base = pf.buf.data() - rs.lead;
+	io_uring_recvmsg_out out;
+	std::memcpy(&out, base, sizeof(out));
+	if (size_t(cqe.res) < size_t(HDR_LEN) || (out.flags & MSG_TRUNC))
+	  {
+	    stats->error(Error::NETWORK_RECV_ERROR);
+	    restock(bid);
+	    return;
+	  }
+
+	pf.sender_endpoint.resize(std::min<size_t>(out.namelen, NAME_LEN));
+	std::memcpy(pf.sender_endpoint.data(), base + sizeof(out), pf.sender_endpoint.size());
+	if (rs.lead)
+	  pf.buf.set_size(out.payloadlen);
+	else
+	  {
+	    pf.buf.set_size(HDR_LEN + out.payloadlen);
+	    pf.buf.advance(HDR_LEN);
+	  }
+	stats->inc_stat(SessionStats::BYTES_IN, out.payloadlen);
+	stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	read_handler->udp_read_handler(rs.pfp); // may take ownership
+	if (!halt)
+	  restock(bid);
+      }
+
+      void send_complete(const io_uring_cqe& cqe)
+      {
+	const unsigned int i = (unsigned int)(cqe.user_data & 0xFFFFFFFFULL);
+	if (i >= SEND_SLOTS)
+	  return;
+	if (cqe.res < 0)
+	  stats->error(Error::NETWORK_SEND_ERROR);
+	else
+	  {
+	    stats->inc_stat(SessionStats::BYTES_OUT, cqe.res);
+	    stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+	  }
+	free_send.push_back(i);
+      }
+
+      // Cancel everything in flight and wait for the kernel to let
+      // go of our buffers before they are freed.  Only called once
+      // setup() has published a complete ring.
+      void cancel_all()
+      {
+	io_uring_sqe* sqe = get_sqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+	sqe->user_data = CANCEL_TAG;
+	submit();
+	for (int i = 0; i < 16 && (recv_armed || free_send.size() < SEND_SLOTS); ++i)
+	  {
+	    if (sys_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+	      break;
+	    unsigned int head = *ring->cq_head;
+	    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	      {
+		const io_uring_cqe& cqe = ring->cqes[head & ring->cq_mask];
+		if ((cqe.user_data & ~0xFFFFFFFFULL) == RECV_TAG && !(cqe.flags & IORING_CQE_F_MORE))
+		  recv_armed = false;
+		else if ((cqe.user_data & ~0xFFFFFFFFULL) == SEND_TAG)
+		  free_send.push_back((unsigned int)(cqe.user_data & 0xFFFFFFFFULL));
+		++head;
+	      }
+	    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	  }
+	ring->fd.close();
+      }
+
+      openvpn_io::ip::udp::socket& socket;
+      bool halt = false;
+      bool flush_queued = false;
+      bool recv_armed = false;
+      ReadHandler read_handler;
+      Frame::Context frame_context;
+      SessionStats::Ptr stats;
+      openvpn_io::posix::stream_descriptor event;
+
+      bool initialized = false;
+      std::unique_ptr<Ring> ring;
+      unsigned int sq_local_tail = 0;
+
+      unsigned int buf_ring_mask = 0;
+      std::uint16_t buf_tail = 0;
+      unsigned int buf_pending = 0;
+      std::vector<RecvSlot> recv_slots;
+      struct msghdr recv_mh;
+
+      std::unique_ptr<SendSlot[]> send_slots;
+      std::vector<unsigned int> free_send;
+    };
+  }
+}
+
+#endif
+#endif
@@ -28,6 +28,7 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <set>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
@@ -646,6 +647,56 @@ namespace openvpn {
     }
 
     std::string to_string() const
+    {
+      return render(true);
+    }
+
+    // True if this capture and other differ at most in add_routes,
+    // so that one can be turned into the other by route changes alone.
+    bool same_except_routes(const TunBuilderCapture& other) const
+    {
+      return render(false) == other.render(false);
+    }
+
+    // Routes to remove and add to go from one add_routes list
+    // to another, each in the order they appear in their list.
+    struct RouteDiff
+    {
+      std::vector<Route> removed;
+      std::vector<Route> added;
+
+      bool empty() const
+      {
+	return removed.empty() && added.empty();
+      }
+    };
+
+    static RouteDiff diff_routes(const std::vector<Route>& prev,
+				 const std::vector<Route>& next)
+    {
+      RouteDiff diff;
+      const std::set<std::string> prev_set = route_set(prev);
+      const std::set<std::string> next_set = route_set(next);
+      for (const auto &r : prev)
+	{
+	  if (next_set.find(r.to_string()) == next_set.end())
+	    diff.removed.push_back(r);
+	}
+      for (const auto &r : next)
+	{
+	  if (prev_set.find(r.to_string()) == prev_set.end())
+	    diff.added.push_back(r);
+	}
+      return diff;
+    }
+
+    RouteDiff diff_routes(const TunBuilderCapture& next) const
+    {
+      return diff_routes(add_routes, next.add_routes);
+    }
+
+  private:
+    std::string render(const bool with_add_routes) const
     {
       std::ostringstream os;
       os << "Session Name: " << session_name << std::endl;
@@ -658,7 +709,8 @@ namespace openvpn {
       os << "Block IPv6: " << (block_ipv6 ? "yes" : "no") << std::endl;
       if (route_metric_default >= 0)
 	os << "Route Metric Default: " << route_metric_default << std::endl;
-      render_list(os, "Add Routes", add_routes);
+      if (with_add_routes)
+	render_list(os, "Add Routes", add_routes);
       render_list(os, "Exclude Routes", exclude_routes);
       render_list(os, "DNS Servers", dns_servers);
       render_list(os, "Search Domains", search_domains);
@@ -677,6 +729,16 @@ namespace openvpn {
       return os.str();
     }
 
+    static std::set<std::string> route_set(const std::vector<Route>& routes)
+    {
+      std::set<std::string> ret;
+      for (const auto &r : routes)
+	ret.insert(r.to_string());
+      return ret;
+    }
+
+  public:
+
 #ifdef HAVE_JSON
 
     Json::Value to_json() const
@@ -31,6 +31,7 @@
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/options.hpp>
 #include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 
 namespace openvpn {
@@ -45,6 +46,38 @@ namespace openvpn {
     virtual void set_disconnect() = 0;
     virtual bool tun_send(BufferAllocated& buf) = 0; // return true if send succeeded
 
+    // Send a burst of packets, returns number of packets sent.
+    // Implementations that can write more efficiently in bulk
+    // should override.
+    virtual size_t tun_send_batch(BufferAllocated* bufs, const size_t n)
+    {
+      size_t n_sent = 0;
+      for (size_t i = 0; i < n; ++i)
+	{
+	  if (tun_send(bufs[i]))
+	    ++n_sent;
+	}
+      return n_sent;
+    }
+
+    // Apply a changed set of pushed options (e.g. after PUSH_UPDATE)
+    // to a running tun without re-establishing it.  Returns false
+    // if the implementation doesn't support in-place updates.
+    virtual bool tun_update(const OptionList& opt)
+    {
+      return false;
+    }
+
+    // Hand the "inactive" directive to the implementation, for
+    // those that count tun traffic outside of userspace (DCO).
+    // Returns true if it will report inactivity itself, through
+    // TunClientParent::tun_error() with Error::INACTIVE_TIMEOUT,
+    // so that the caller needs no timer of its own.
+    virtual bool tun_inactive(const Time::Duration& duration, const unsigned int bytes)
+    {
+      return false;
+    }
+
     virtual std::string tun_name() const = 0;
 
     virtual std::string vpn_ip4() const = 0; // VPN IP addresses
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
@@ -35,6 +36,9 @@
 #include <openvpn/addr/ipv6.hpp>
 #include <openvpn/addr/route.hpp>
 
+#include <vector>
+#include <algorithm>
+
 
 #ifdef DEBUG_RTNL
 #define OPENVPN_LOG_RTNL(_x) OPENVPN_LOG(_x)
@@ -48,6 +52,11 @@ namespace openvpn {
 #define SNDBUF_SIZE (1024 * 2)
 #define RCVBUF_SIZE (1024 * 4)
 
+/* batched requests: messages per sendmsg() and socket buffer sizes */
+#define BATCH_MAX_MSGS 128
+#define BATCH_SNDBUF_SIZE (1024 * 64)
+#define BATCH_RCVBUF_SIZE (1024 * 256)
+
 #define SITNL_ADDATTR(_msg, _max_size, _attr, _data, _size)         \
     {                                                               \
         if (sitnl_addattr(_msg, _max_size, _attr, _data, _size) < 0)\
@@ -133,10 +142,8 @@ namespace openvpn {
        * Open RTNL socket
        */
       static int
-      sitnl_socket(void)
+      sitnl_socket(int sndbuf = SNDBUF_SIZE, int rcvbuf = RCVBUF_SIZE)
       {
-	int sndbuf = SNDBUF_SIZE;
-	int rcvbuf = RCVBUF_SIZE;
 	int fd;
 
 	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
@@ -596,6 +603,74 @@ err:
 	return ret;
       }
 
+      /**
+       * Store the network of an interface address (RTM_NEWADDR) or
+       * the destination of a unicast main-table route (RTM_NEWROUTE)
+       * from a dump.  Default routes are skipped, since every
+       * address is inside them.
+       */
+      static int
+      sitnl_system_save(struct nlmsghdr *n, void *arg)
+      {
+	IP::RouteList *routes = (IP::RouteList *)arg;
+	const unsigned char *bytestr = nullptr;
+	int family = AF_UNSPEC;
+	unsigned int prefix_len = 0;
+	struct rtattr *rta;
+	int len;
+
+	if (n->nlmsg_type == RTM_NEWADDR)
+	{
+	  struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(n);
+	  family = ifa->ifa_family;
+	  prefix_len = ifa->ifa_prefixlen;
+	  rta = IFA_RTA(ifa);
+	  len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+	  while (RTA_OK(rta, len))
+	  {
+	    // IFA_LOCAL is the local end of a point-to-point address
+	    if (rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !bytestr))
+	      bytestr = (const unsigned char *)RTA_DATA(rta);
+	    rta = RTA_NEXT(rta, len);
+	  }
+	}
+	else if (n->nlmsg_type == RTM_NEWROUTE)
+	{
+	  struct rtmsg *r = (struct rtmsg *)NLMSG_DATA(n);
+	  if (r->rtm_table != RT_TABLE_MAIN || r->rtm_type != RTN_UNICAST || !r->rtm_dst_len)
+	    return 0;
+	  family = r->rtm_family;
+	  prefix_len = r->rtm_dst_len;
+	  rta = RTM_RTA(r);
+	  len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	  while (RTA_OK(rta, len))
+	  {
+	    if (rta->rta_type == RTA_DST)
+	      bytestr = (const unsigned char *)RTA_DATA(rta);
+	    rta = RTA_NEXT(rta, len);
+	  }
+	}
+
+	if (!bytestr)
+	  return 0;
+
+	IP::Route route;
+	switch (family)
+	{
+	case AF_INET:
+	  route = IP::Route(IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(bytestr)), prefix_len);
+	  break;
+	case AF_INET6:
+	  route = IP::Route(IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(bytestr)), prefix_len);
+	  break;
+	default:
+	  return 0;
+	}
+	route.force_canonical();
+	routes->push_back(route);
+	return 0;
+      }
+
       static int
       sitnl_addr_set(const int cmd, const uint32_t flags, const std::string& iface,
 		     const IP::Addr& local, const IP::Addr& remote, int prefixlen,
@@ -690,6 +765,35 @@ err:
 		      const int protocol, const int type)
       {
 	struct sitnl_route_req req = { };
+	int ret;
+
+	ret = sitnl_route_req_build(req, cmd, flags, iface, route, gw, table,
+				    metric, scope, protocol, type);
+	if (ret < 0)
+	{
+	  return ret;
+	}
+
+	ret = sitnl_send(&req.n, 0, 0, NULL, NULL);
+	if (ret == -EEXIST)
+	{
+	  ret = 0;
+	}
+
+	return ret;
+      }
+
+      /**
+       * Fill in a route request message, without sending it
+       */
+      static int
+      sitnl_route_req_build(struct sitnl_route_req& req, const int cmd,
+			    const uint32_t flags, const std::string& iface,
+			    const IP::Route& route, const IP::Addr& gw,
+			    const enum rt_class_t table, const int metric,
+			    const enum rt_scope_t scope, const int protocol,
+			    const int type)
+      {
 	int ret = -1;
 
 	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.r));
@@ -742,13 +846,137 @@ err:
 	  SITNL_ADDATTR(&req.n, sizeof(req), RTA_PRIORITY, &metric, 4);
 	}
 
-	ret = sitnl_send(&req.n, 0, 0, NULL, NULL);
-	if ((ret < 0) && (errno == EEXIST))
+	ret = 0;
+
+err:
+	return ret;
+      }
+
+      /**
+       * Send a batch of requests, BATCH_MAX_MSGS per sendmsg(), and
+       * collect the ACK of each one.  results[i] receives the outcome
+       * of reqs[i] (0 or negative errno).
+       */
+      static int
+      sitnl_send_batch(std::vector<struct sitnl_route_req>& reqs,
+		       std::vector<int>& results)
+      {
+	struct sockaddr_nl nladdr = { };
+	std::vector<struct iovec> iovs;
+	std::vector<char> buf(1024 * 16);
+	int fd, ret;
+	unsigned int seq;
+
+	results.assign(reqs.size(), -EIO);
+	if (reqs.empty())
 	{
-	  ret = 0;
+	  return 0;
 	}
 
-err:
+	fd = sitnl_socket(BATCH_SNDBUF_SIZE, BATCH_RCVBUF_SIZE);
+	if (fd < 0)
+	{
+	  OPENVPN_LOG(__func__ << ": can't open rtnl socket");
+	  return -errno;
+	}
+
+	ret = sitnl_bind(fd, 0);
+	if (ret < 0)
+	{
+	  OPENVPN_LOG(__func__ << ": can't bind rtnl socket");
+	  close(fd);
+	  return ret;
+	}
+
+	nladdr.nl_family = AF_NETLINK;
+	seq = time(NULL);
+
+	for (size_t base = 0; base < reqs.size(); base += BATCH_MAX_MSGS)
+	{
+	  const size_t n = std::min(reqs.size() - base, (size_t)BATCH_MAX_MSGS);
+	  size_t pending = n;
+
+	  iovs.resize(n);
+	  for (size_t i = 0; i < n; ++i)
+	  {
+	    struct nlmsghdr& h = reqs[base + i].n;
+	    h.nlmsg_seq = seq + base + i;
+	    h.nlmsg_flags |= NLM_F_ACK;
+	    iovs[i].iov_base = &h;
+	    iovs[i].iov_len = NLMSG_ALIGN(h.nlmsg_len);
+	  }
+
+	  struct msghdr nlmsg = { };
+	  nlmsg.msg_name = &nladdr;
+	  nlmsg.msg_namelen = sizeof(nladdr);
+	  nlmsg.msg_iov = iovs.data();
+	  nlmsg.msg_iovlen = n;
+
+	  if (sendmsg(fd, &nlmsg, 0) < 0)
+	  {
+	    OPENVPN_LOG(__func__ << ": rtnl: error on sendmsg()");
+	    ret = -errno;
+	    goto out;
+	  }
+
+	  /* the kernel ACKs each message in order, read until all are in */
+	  while (pending)
+	  {
+	    const int rcv_len = recv(fd, buf.data(), buf.size(), 0);
+	    if (rcv_len < 0)
+	    {
+	      if ((errno == EINTR) || (errno == EAGAIN))
+	      {
+		continue;
+	      }
+	      OPENVPN_LOG(__func__ << ": rtnl: error on recv()");
+	      ret = -errno;
+	      goto out;
+	    }
+	    if (rcv_len == 0)
+	    {
+	      ret = -EIO;
+	      goto out;
+	    }
+
+	    int rem = rcv_len;
+	    for (struct nlmsghdr *h = (struct nlmsghdr *)buf.data();
+		 NLMSG_OK(h, (unsigned int)rem); h = NLMSG_NEXT(h, rem))
+	    {
+	      if (h->nlmsg_type != NLMSG_ERROR
+		  || h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr)))
+	      {
+		continue;
+	      }
+	      const size_t idx = h->nlmsg_seq - seq;
+	      if (idx < base || idx >= base + n || results[idx] != -EIO)
+	      {
+		continue;
+	      }
+	      const struct nlmsgerr *err = (const struct nlmsgerr *)NLMSG_DATA(h);
+	      results[idx] = err->error == -EEXIST ? 0 : err->error;
+	      if (err->error && err->error != -EEXIST)
+	      {
+		OPENVPN_LOG(__func__ << ": rtnl: message " << idx << ": "
+			    << strerror(-err->error) << " (" << err->error << ")");
+	      }
+	      --pending;
+	    }
+	  }
+	}
+
+	ret = 0;
+	for (const int r : results)
+	{
+	  if (r < 0)
+	  {
+	    ret = r;
+	    break;
+	  }
+	}
+
+out:
+	close(fd);
 	return ret;
       }
 
@@ -793,6 +1021,121 @@ err:
 
     public:
 
+      /**
+       * A single route change for net_route_batch()
+       */
+      struct RouteOp
+      {
+	bool add = true;
+	IP::Route route;
+	IP::Addr gw;
+	std::string iface;
+	uint32_t table = 0;
+	int metric = 0;
+      };
+
+      /**
+       * Apply many route changes with a few netlink round trips
+       * instead of one per route.
+       *
+       * @param ops route changes, applied in order
+       * @param [out] results per-op outcome, as returned by net_route_add/del
+       * @return 0 if all succeeded, otherwise the first error
+       */
+      static int
+      net_route_batch(const std::vector<RouteOp>& ops, std::vector<int>& results)
+      {
+	std::vector<struct sitnl_route_req> reqs(ops.size());
+	std::vector<size_t> map;
+	std::vector<int> sent_results;
+	int ret = 0;
+
+	OPENVPN_LOG(__func__ << ": " << ops.size() << " routes");
+
+	results.assign(ops.size(), 0);
+	map.reserve(ops.size());
+
+	/* build all requests first, so that bad ones fail individually */
+	size_t n = 0;
+	for (size_t i = 0; i < ops.size(); ++i)
+	{
+	  const RouteOp& op = ops[i];
+	  const enum rt_class_t table = (enum rt_class_t)(!op.table ? RT_TABLE_MAIN : op.table);
+	  struct sitnl_route_req& req = reqs[n];
+	  memset(&req, 0, sizeof(req));
+	  if (op.add)
+	  {
+	    results[i] = sitnl_route_req_build(req, RTM_NEWROUTE, NLM_F_CREATE, op.iface,
+					       op.route, op.gw, table, op.metric,
+					       RT_SCOPE_UNIVERSE, RTPROT_BOOT, RTN_UNICAST);
+	  }
+	  else
+	  {
+	    results[i] = sitnl_route_req_build(req, RTM_DELROUTE, 0, op.iface,
+					       op.route, op.gw, table, op.metric,
+					       RT_SCOPE_NOWHERE, 0, 0);
+	  }
+	  if (results[i] == 0)
+	  {
+	    map.push_back(i);
+	    ++n;
+	  }
+	  else if (!ret)
+	  {
+	    ret = results[i];
+	  }
+	}
+	reqs.resize(n);
+
+	const int sret = sitnl_send_batch(reqs, sent_results);
+	for (size_t j = 0; j < n; ++j)
+	{
+	  results[map[j]] = sent_results[j];
+	}
+	if (!ret)
+	{
+	  ret = sret;
+	}
+
+	return ret;
+      }
+
+      /**
+       * Collect the networks of all interface addresses and the
+       * destinations of all non-default unicast routes in the main
+       * table, for both address families, with one address dump and
+       * one route dump.
+       * @param [out] routes canonical routes, appended
+       * @return 0 on success, negative error code otherwise
+       */
+      static int
+      net_system_routes(IP::RouteList& routes)
+      {
+	struct sitnl_addr_req areq = { };
+	areq.n.nlmsg_len = NLMSG_LENGTH(sizeof(areq.i));
+	areq.n.nlmsg_type = RTM_GETADDR;
+	areq.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	areq.i.ifa_family = AF_UNSPEC;
+
+	int ret = sitnl_send(&areq.n, 0, 0, sitnl_system_save, &routes);
+	if (ret < 0)
+	{
+	  OPENVPN_LOG(__func__ << ": failed to dump addresses, err=" << ret);
+	  return ret;
+	}
+
+	struct sitnl_route_req rreq = { };
+	rreq.n.nlmsg_len = NLMSG_LENGTH(sizeof(rreq.r));
+	rreq.n.nlmsg_type = RTM_GETROUTE;
+	rreq.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	rreq.r.rtm_family = AF_UNSPEC;
+
+	ret = sitnl_send(&rreq.n, 0, 0, sitnl_system_save, &routes);
+	if (ret < 0)
+	  OPENVPN_LOG(__func__ << ": failed to dump routes, err=" << ret);
+	return ret;
+      }
+
       static int
       net_route_best_gw(const IP::Route6& route, IPv6::Addr& best_gw6,
 			std::string& best_iface, const std::string& iface_to_ignore = "")
@@ -24,12 +24,21 @@
 #ifndef OPENVPN_TUN_LINUX_CLIENT_TUNCLI_H
 #define OPENVPN_TUN_LINUX_CLIENT_TUNCLI_H
 
+#include <thread>
+#include <vector>
+#include <memory>
+
 #include <openvpn/asio/asioerr.hpp>
 #include <openvpn/common/cleanup.hpp>
 #include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/buffer/asiobuf.hpp>
+#include <openvpn/ip/gso.hpp>
 #include <openvpn/tun/builder/setup.hpp>
 #include <openvpn/tun/tunio.hpp>
 #include <openvpn/tun/persist/tunpersist.hpp>
+#ifdef HAVE_JSON
+#include <openvpn/tun/persist/tunhandoff.hpp>
+#endif
 #include <openvpn/tun/linux/client/tunmethods.hpp>
 
 namespace openvpn {
@@ -68,6 +77,95 @@ namespace openvpn {
 
     typedef TunPersistTemplate<ScopedFD> TunPersist;
 
+    // An additional IFF_MULTI_QUEUE tun queue, serviced by its own
+    // TunIO instance running on a dedicated io_context thread.
+    // Packets read from the queue are handed back to the main
+    // io_context thread through a thread-safe Relay object.
+    template <typename Relay>
+    class TunQueue
+    {
+    public:
+      typedef std::unique_ptr<TunQueue> UPtr;
+
+      TunQueue(const int fd_arg,
+	       const std::string& name,
+	       const Frame::Ptr& frame,
+	       const typename Relay::Ptr& relay_arg)
+	: fd(fd_arg),
+	  relay(relay_arg),
+	  reader(this)
+      {
+	// stats are not thread-safe, so they are accumulated by
+	// the relay on the main thread instead of by TunIO
+	impl.reset(new Impl(io_context, &reader, frame, SessionStats::Ptr(), fd(), name));
+      }
+
+      void start(const int n_parallel, const unsigned int drain_budget)
+      {
+	if (drain_budget)
+	  impl->start_drain(drain_budget);
+	else
+	  impl->start(n_parallel);
+	thread.reset(new std::thread([this, logwrap=Log::Context::Wrapper()]() {
+	      Log::Context logctx(logwrap);
+	      io_context.run();
+	    }));
+      }
+
+      // thread-safe, but tun writes are normally done through the
+      // primary queue on the main thread
+      void stop()
+      {
+	if (thread)
+	  {
+	    Impl* i = impl.get();
+	    openvpn_io::post(io_context, [i]() {
+		i->stop();
+	      });
+	    thread->join();
+	    thread.reset();
+	  }
+	impl.reset();
+	fd.close();
+      }
+
+      ~TunQueue()
+      {
+	stop();
+      }
+
+    private:
+      struct Reader
+      {
+	Reader(TunQueue* parent_arg)
+	  : parent(parent_arg)
+	{
+	}
+
+	// called on queue thread by TunIO
+	void tun_read_handler(PacketFrom::SPtr& pfp)
+	{
+	  parent->relay->post(std::move(pfp->buf));
+	}
+
+	void tun_error_handler(const Error::Type errtype,
+			       const openvpn_io::error_code* error)
+	{
+	}
+
+	TunQueue* parent;
+      };
+
+      typedef Tun<Reader*> Impl;
+
+      openvpn_io::io_context io_context{1};
+      ScopedFD fd;
+      typename Relay::Ptr relay;
+      Reader reader;
+      typename Impl::Ptr impl;
+      std::unique_ptr<std::thread> thread;
+    };
+
     class ClientConfig : public TunClientFactory
     {
     public:
@@ -79,6 +177,9 @@ namespace openvpn {
       TunProp::Config tun_prop;
 
       int n_parallel = 8;
+      unsigned int drain_budget = 0; // if > 0, drain up to this many packets per readiness wakeup instead of n_parallel async reads
+      int n_queues = 1;  // if > 1, open tun with IFF_MULTI_QUEUE and read each queue on its own thread
+      bool vnet_offload = false; // open tun with IFF_VNET_HDR and TSO, segment/coalesce TCP in userspace
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
@@ -98,6 +199,17 @@ namespace openvpn {
 	    if (dev)
 	      dev_name = dev->get(1, 64);
 	  }
+
+	// read the tun device through this many IFF_MULTI_QUEUE queues
+	n_queues = opt.get_num<int>("tun-queues", 1, n_queues, 1, 64);
+
+	// drain up to this many packets per readiness wakeup, 0 for
+	// n_parallel outstanding async reads
+	drain_budget = opt.get_num<unsigned int>("tun-drain", 1, drain_budget, 0, 4096);
+
+	// TSO/GSO super-packets through IFF_VNET_HDR
+	if (opt.exists("tun-offload"))
+	  vnet_offload = true;
       }
 
       static Ptr new_obj()
@@ -117,6 +229,41 @@ namespace openvpn {
 	  return new TunLinuxSetup::Setup<TUN_LINUX>();
       }
 
+#ifdef HAVE_JSON
+      // Send the persisted tun to the next process over sock (see
+      // TunHandoff) and give it up here without tearing it down.
+      void handoff_tun(const int sock)
+      {
+	if (!tun_persist || !tun_persist->obj_defined() || !tun_persist->capture() || !tun_persist->state())
+	  throw TunHandoff::tun_handoff_error("no persisted tun");
+	TunHandoff::send(sock, tun_persist->obj(), *tun_persist->capture(), *tun_persist->state());
+	ScopedFD fd(tun_persist->detach());
+      }
+
+      // Adopt the tun sent by handoff_tun() in the previous process.
+      // The first session with the same settings reuses it as is.
+      void adopt_tun(const int sock)
+      {
+	TunHandoff::Item item = TunHandoff::receive(sock);
+	TunBuilderSetup::Base::Ptr setup = new_setup_obj();
+	auto* ls = dynamic_cast<TunLinuxSetup::Setup<TUN_LINUX>*>(setup.get());
+	if (ls)
+	  {
+	    TunLinuxSetup::Setup<TUN_LINUX>::Config tsconf;
+	    tsconf.layer = tun_prop.layer;
+	    tsconf.iface_name = item.state->iface_name;
+	    tsconf.add_bypass_routes_on_establish = true;
+	    ls->adopt(*item.capture, &tsconf);
+	  }
+	else
+	  setup.reset();
+
+	if (!tun_persist)
+	  tun_persist.reset(new TunPersist(true, false, nullptr));
+	tun_persist->adopt(item.fd.release(), item.capture, item.state, setup);
+      }
+#endif
+
     private:
       ClientConfig() {}
     };
@@ -128,6 +275,40 @@ namespace openvpn {
 
       typedef Tun<Client*> TunImpl;
 
+      // Marshals packets read on secondary queue threads back to
+      // the main io_context thread.  client is only accessed on
+      // the main thread, and is cleared when the Client stops.
+      class QueueRelay : public RC<thread_safe_refcount>
+      {
+      public:
+	typedef RCPtr<QueueRelay> Ptr;
+
+	QueueRelay(openvpn_io::io_context& io_context_arg, Client* client_arg)
+	  : io_context(io_context_arg),
+	    client(client_arg)
+	{
+	}
+
+	void post(BufferAllocated&& buf)
+	{
+	  openvpn_io::post(io_context, [self=Ptr(this), buf=std::move(buf)]() mutable {
+	      if (self->client)
+		self->client->queue_read_handler(buf);
+	    });
+	}
+
+	void detach()
+	{
+	  client = nullptr;
+	}
+
+      private:
+	openvpn_io::io_context& io_context;
+	Client* client;
+      };
+
+      typedef TunQueue<QueueRelay> TunQueueImpl;
+
     public:
       virtual void tun_start(const OptionList& opt, TransportClient& transcli, CryptoDCSettings&) override
       {
@@ -147,7 +328,7 @@ namespace openvpn {
 	      }
 
 	    try {
-	      const IP::Addr server_addr = transcli.server_endpoint_addr();
+	      server_addr = transcli.server_endpoint_addr();
 
 	      int sd = -1;
 
@@ -157,8 +338,16 @@ namespace openvpn {
 		  state = tun_persist->state();
 		  sd = tun_persist->obj();
 		  state = tun_persist->state();
+		  tun_setup = tun_persist->destructor().dynamic_pointer_cast<TunBuilderSetup::Base>();
+		  capture = tun_persist->capture();
 		  OPENVPN_LOG("TunPersist: reused tun context");
 		}
+	      else if (tun_persist->routes_changed() && update_persisted_routes())
+		{
+		  sd = tun_persist->obj();
+		  state = tun_persist->state();
+		  OPENVPN_LOG("TunPersist: reused tun context with updated routes");
+		}
 	      else
 	        {
 		  // notify parent
@@ -188,6 +377,8 @@ namespace openvpn {
 		  tsconf.layer = config->tun_prop.layer;
 		  tsconf.dev_name = config->dev_name;
 		  tsconf.txqueuelen = config->txqueuelen;
+		  tsconf.multi_queue = config->n_queues > 1;
+		  tsconf.vnet_hdr = config->vnet_offload;
 		  tsconf.add_bypass_routes_on_establish = true;
 
 		  // open/config tun
@@ -197,6 +388,9 @@ namespace openvpn {
 		    sd = tun_setup->establish(*po, &tsconf, nullptr, os);
 		  }
 
+		  // retain captured options for tun_update
+		  capture = po;
+
 		  // persist tun settings state
 		  state->iface_name = tsconf.iface_name;
 		  tun_persist->persist_tun_state(sd, state);
@@ -205,15 +399,44 @@ namespace openvpn {
 		  tun_persist->add_destructor(tun_setup);
 		}
 
+	      // with offload, reads carry a virtio-net header and may
+	      // be TCP super-packets of up to 64KB
+	      Frame::Ptr read_frame = config->frame;
+	      if (config->vnet_offload)
+		{
+		  read_frame.reset(new Frame());
+		  for (size_t i = 0; i < read_frame->n_contexts(); ++i)
+		    (*read_frame)[i] = (*config->frame)[i];
+		  const size_t hdr_size = sizeof(GSO::VirtioNetHdr);
+		  Frame::Context& c = (*read_frame)[Frame::READ_TUN];
+		  c = c.resized(std::max(c.payload(), size_t(GSO::MAX_PACKET)) + hdr_size, hdr_size);
+		}
+
 	      // start tun
 	      impl.reset(new TunImpl(io_context,
 				     this,
-				     config->frame,
+				     read_frame,
 				     config->stats,
 				     sd,
 				     state->iface_name
 				     ));
-	      impl->start(config->n_parallel);
+	      if (config->drain_budget)
+		impl->start_drain(config->drain_budget);
+	      else
+		impl->start(config->n_parallel);
+
+	      // start secondary queues
+	      if (config->n_queues > 1)
+		{
+		  queue_relay.reset(new QueueRelay(io_context, this));
+		  for (int i = 1; i < config->n_queues; ++i)
+		    {
+		      const int qfd = TunLinuxSetup::open_tun_queue(state->iface_name, config->tun_prop.layer, config->vnet_offload);
+		      queues.emplace_back(new TunQueueImpl(qfd, state->iface_name, read_frame, queue_relay));
+		      queues.back()->start(config->n_parallel, config->drain_budget);
+		    }
+		  OPENVPN_LOG(state->iface_name << " using " << config->n_queues << " tun queues");
+		}
 
 	      // signal that we are connected
 	      parent.tun_connected();
@@ -234,6 +457,45 @@ namespace openvpn {
 	return send(buf);
       }
 
+      virtual size_t tun_send_batch(BufferAllocated* bufs, const size_t n) override
+      {
+	if (!impl)
+	  return 0;
+	else if (config->vnet_offload)
+	  return send_coalesced(bufs, n);
+	else
+	  return impl->write_batch(bufs, n);
+      }
+
+      // Apply pushed route changes by adding/removing only the routes
+      // that differ, keeping the tun interface up.
+      virtual bool tun_update(const OptionList& opt) override
+      {
+	auto* setup = dynamic_cast<TunLinuxSetup::Setup<TUN_LINUX>*>(tun_setup.get());
+	if (!impl || !capture || !setup)
+	  return false;
+
+	TunBuilderCapture::Ptr po(new TunBuilderCapture());
+	TunProp::State::Ptr st(new TunProp::State());
+	TunProp::configure_builder(po.get(),
+				   st.get(),
+				   nullptr,
+				   server_addr,
+				   config->tun_prop,
+				   opt,
+				   nullptr,
+				   true);
+
+	OPENVPN_LOG("UPDATED OPTIONS:" << std::endl << po->to_string());
+
+	std::ostringstream os;
+	auto os_print = Cleanup([&os](){ OPENVPN_LOG_STRING(os.str()); });
+	setup->update_routes(*capture, *po, os);
+	capture = po;
+	tun_persist->persist_capture(po);
+	return true;
+      }
+
       virtual std::string tun_name() const override
       {
 	if (impl)
@@ -295,15 +557,95 @@ namespace openvpn {
 
       bool send(Buffer& buf)
       {
-	if (impl)
-	  return impl->write(buf);
-	else
+	if (!impl)
 	  return false;
+	else if (config->vnet_offload)
+	  return send_vnet(GSO::VirtioNetHdr(), buf);
+	else
+	  return impl->write(buf);
+      }
+
+      bool send_vnet(const GSO::VirtioNetHdr& hdr, const Buffer& buf)
+      {
+	return impl->write_seq(AsioConstBufferSeq2(Buffer((Buffer::type)&hdr, sizeof(hdr), true), buf));
+      }
+
+      // Merge runs of consecutive TCP segments of the same flow into
+      // super-packets, so that the kernel sees one write per run.
+      size_t send_coalesced(BufferAllocated* bufs, const size_t n)
+      {
+	GSO::Coalescer gro(gro_buf);
+	size_t n_written = 0;
+	size_t i = 0;
+	while (i < n && !halt)
+	  {
+	    size_t j = i + 1;
+	    if (gro.start(bufs[i]))
+	      while (j < n && gro.append(bufs[j]))
+		++j;
+	    if (j - i > 1)
+	      {
+		if (send_vnet(gro.finish(), gro_buf))
+		  n_written += j - i;
+	      }
+	    else if (bufs[i].size() && send_vnet(GSO::VirtioNetHdr(), bufs[i]))
+	      ++n_written;
+	    i = j;
+	  }
+	return n_written;
       }
 
       void tun_read_handler(PacketFrom::SPtr& pfp) // called by TunImpl
       {
-	parent.tun_recv(pfp->buf);
+	if (config->vnet_offload)
+	  recv_vnet(pfp->buf);
+	else
+	  parent.tun_recv(pfp->buf);
+      }
+
+      // Strip the virtio-net header and pass on the packet, or each
+      // segment of a TCP super-packet.  Malformed packets are dropped.
+      void recv_vnet(BufferAllocated& buf)
+      {
+	GSO::VirtioNetHdr hdr;
+	if (buf.size() < sizeof(hdr))
+	  return;
+	std::memcpy(&hdr, buf.c_data(), sizeof(hdr));
+	buf.advance(sizeof(hdr));
+
+	if ((hdr.gso_type & ~GSO::VirtioNetHdr::GSO_ECN) == GSO::VirtioNetHdr::GSO_NONE)
+	  {
+	    if (GSO::complete_csum(buf, hdr))
+	      parent.tun_recv(buf);
+	    return;
+	  }
+
+	const Frame::Context& fc = (*config->frame)[Frame::READ_TUN];
+	if (!gso_seg.init(buf, hdr) || gso_seg.max_segment() > fc.payload())
+	  return;
+	while (!halt)
+	  {
+	    fc.prepare(gso_buf);
+	    if (!gso_seg.next(gso_buf))
+	      break;
+	    parent.tun_recv(gso_buf);
+	  }
+      }
+
+      void queue_read_handler(BufferAllocated& buf) // called by QueueRelay
+      {
+	if (!halt)
+	  {
+	    if (config->stats)
+	      {
+		config->stats->inc_stat(SessionStats::TUN_BYTES_IN, buf.size());
+		config->stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+	      }
+	    if (config->vnet_offload)
+	      recv_vnet(buf);
+	    else
+	      parent.tun_recv(buf);
+	  }
       }
 
       void tun_error_handler(const Error::Type errtype, // called by TunImpl
@@ -311,12 +653,44 @@ namespace openvpn {
       {
       }
 
+      // The persisted tun differs from the new session only in its
+      // routes, so add and remove just those instead of tearing
+      // down and rebuilding the interface.
+      bool update_persisted_routes()
+      {
+	TunBuilderSetup::Base::Ptr base = tun_persist->destructor().dynamic_pointer_cast<TunBuilderSetup::Base>();
+	auto* setup = dynamic_cast<TunLinuxSetup::Setup<TUN_LINUX>*>(base.get());
+	const TunBuilderCapture::Ptr prev = tun_persist->capture();
+	if (!setup || !prev)
+	  return false;
+
+	tun_persist->persist_route_update();
+	const TunBuilderCapture::Ptr& pull = tun_persist->capture();
+	OPENVPN_LOG("CAPTURED OPTIONS:" << std::endl << pull->to_string());
+	{
+	  std::ostringstream os;
+	  auto os_print = Cleanup([&os](){ OPENVPN_LOG_STRING(os.str()); });
+	  setup->update_routes(*prev, *pull, os);
+	}
+	tun_setup = base;
+	capture = pull;
+	return true;
+      }
+
       void stop_()
       {
 	if (!halt)
 	  {
 	    halt = true;
 
+	    // stop secondary queues
+	    if (queue_relay)
+	      {
+		queue_relay->detach();
+		queue_relay.reset();
+	      }
+	    queues.clear();
+
 	    // stop tun
 	    if (impl)
 	      impl->stop();
@@ -330,8 +704,15 @@ namespace openvpn {
       ClientConfig::Ptr config;
       TunClientParent& parent;
       TunImpl::Ptr impl;
+      QueueRelay::Ptr queue_relay;
+      std::vector<TunQueueImpl::UPtr> queues;
       TunProp::State::Ptr state;
       TunBuilderSetup::Base::Ptr tun_setup;
+      TunBuilderCapture::Ptr capture;
+      IP::Addr server_addr;
+      GSO::Segmenter gso_seg;
+      BufferAllocated gso_buf;
+      BufferAllocated gro_buf{GSO::MAX_PACKET, 0};
       bool halt;
     };
 
@@ -296,7 +296,53 @@ namespace openvpn {
       bool add;
     };
 
-    struct NetlinkRoute4 : public Action
+    // Common base of NetlinkRoute4/6, so that a run of route actions
+    // in an ActionList is sent to the kernel as one netlink batch.
+    struct NetlinkRouteBase : public Action
+    {
+      virtual SITNL::RouteOp op() const = 0;
+      virtual void execute_single(std::ostream& os) = 0;
+
+      virtual bool batch_add(const Action::Ptr& other) override
+      {
+	const NetlinkRouteBase* r = dynamic_cast<const NetlinkRouteBase*>(other.get());
+	if (!r || op().iface.empty() || r->op().iface.empty())
+	  return false;
+	batch.push_back(other);
+	return true;
+      }
+
+      virtual void execute(std::ostream& os) override
+      {
+	std::vector<Action::Ptr> others;
+	others.swap(batch);
+	if (others.empty())
+	  {
+	    execute_single(os);
+	    return;
+	  }
+
+	std::vector<SITNL::RouteOp> ops;
+	ops.reserve(others.size() + 1);
+	ops.push_back(op());
+	for (const auto& a : others)
+	  ops.push_back(static_cast<const NetlinkRouteBase&>(*a).op());
+
+	std::vector<int> results;
+	SITNL::net_route_batch(ops, results);
+	for (size_t i = 0; i < results.size(); ++i)
+	  {
+	    if (results[i])
+	      os << "Error while executing " << (i ? others[i-1]->to_string() : to_string())
+		 << ": " << results[i] << std::endl;
+	  }
+      }
+
+    private:
+      std::vector<Action::Ptr> batch;
+    };
+
+    struct NetlinkRoute4 : public NetlinkRouteBase
     {
       typedef RCPtr<NetlinkRoute4> Ptr;
 
@@ -320,7 +366,17 @@ namespace openvpn {
 	return ret;
       }
 
-      virtual void execute(std::ostream& os) override
+      virtual SITNL::RouteOp op() const override
+      {
+	SITNL::RouteOp ret;
+	ret.add = add;
+	ret.route = IP::Route(IP::Addr::from_ipv4(route.addr), route.prefix_len);
+	ret.gw = IP::Addr::from_ipv4(gw);
+	ret.iface = dev;
+	return ret;
+      }
+
+      virtual void execute_single(std::ostream& os) override
       {
 	int ret;
 
@@ -360,7 +416,7 @@ namespace openvpn {
       bool add;
     };
 
-    struct NetlinkRoute6 : public Action
+    struct NetlinkRoute6 : public NetlinkRouteBase
     {
       typedef RCPtr<NetlinkRoute6> Ptr;
 
@@ -384,7 +440,17 @@ namespace openvpn {
 	return ret;
       }
 
-      virtual void execute(std::ostream& os) override
+      virtual SITNL::RouteOp op() const override
+      {
+	SITNL::RouteOp ret;
+	ret.add = add;
+	ret.route = IP::Route(IP::Addr::from_ipv6(route.addr), route.prefix_len);
+	ret.gw = IP::Addr::from_ipv6(gw);
+	ret.iface = dev;
+	return ret;
+      }
+
+      virtual void execute_single(std::ostream& os) override
       {
 	int ret;
 
@@ -614,23 +680,8 @@ namespace openvpn {
 	iface_config(iface_name, -1, pull, rtvec, create, destroy);
 
 	// Process Routes
-	{
-	  for (const auto &route : pull.add_routes)
-	    {
-	      if (route.ipv6)
-		{
-		  if (local6 && !pull.block_ipv6)
-		    add_del_route(route.address, route.prefix_length, local6->gateway, iface_name, R_ADD_ALL|R_IPv6, rtvec, create, destroy);
-		}
-	      else
-		{
-		  if (local4 && !local4->gateway.empty())
-		    add_del_route(route.address, route.prefix_length, local4->gateway, iface_name, R_ADD_ALL, rtvec, create, destroy);
-		  else
-		    OPENVPN_LOG("ERROR: IPv4 route pushed without IPv4 ifconfig and/or route-gateway");
-		}
-	    }
-	}
+	for (const auto &route : pull.add_routes)
+	  add_route(iface_name, pull, route, rtvec, create, destroy);
 
 	// Process exclude routes
 	if (!pull.exclude_routes.empty())
@@ -680,6 +731,32 @@ namespace openvpn {
 	// fixme -- Handle pushed DNS servers
       }
 
+      // add a single pushed route, also used to apply route changes
+      // to an established tun
+      static inline void add_route(const std::string& iface_name,
+				   const TunBuilderCapture& pull,
+				   const TunBuilderCapture::Route& route,
+				   std::vector<IP::Route>* rtvec,
+				   ActionList& create,
+				   ActionList& destroy)
+      {
+	const TunBuilderCapture::RouteAddress* local4 = pull.vpn_ipv4();
+	const TunBuilderCapture::RouteAddress* local6 = pull.vpn_ipv6();
+
+	if (route.ipv6)
+	  {
+	    if (local6 && !pull.block_ipv6)
+	      add_del_route(route.address, route.prefix_length, local6->gateway, iface_name, R_ADD_ALL|R_IPv6, rtvec, create, destroy);
+	  }
+	else
+	  {
+	    if (local4 && !local4->gateway.empty())
+	      add_del_route(route.address, route.prefix_length, local4->gateway, iface_name, R_ADD_ALL, rtvec, create, destroy);
+	    else
+	      OPENVPN_LOG("ERROR: IPv4 route pushed without IPv4 ifconfig and/or route-gateway");
+	  }
+      }
+
       static inline void add_bypass_route(const std::string& tun_iface_name,
 					  const std::string& address,
 					  bool ipv6,
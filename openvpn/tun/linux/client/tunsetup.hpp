@@ -58,6 +58,57 @@ namespace openvpn {
     OPENVPN_EXCEPTION(tun_tx_queue_len_error);
     OPENVPN_EXCEPTION(tun_ifconfig_error);
 
+    // Ask the kernel to hand us checksum-offloaded TCP super-packets
+    // on a tun fd opened with IFF_VNET_HDR.  Failure is not fatal,
+    // the fd then simply carries a header with GSO_NONE.
+    inline void set_tun_offload(const int fd, std::ostream* os)
+    {
+      if (ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM|TUN_F_TSO4|TUN_F_TSO6) < 0 && os)
+	*os << "TUNSETOFFLOAD failed: " << errinfo(errno) << std::endl;
+    }
+
+    // Open an additional queue on an existing tun/tap interface
+    // that was created with IFF_MULTI_QUEUE.  Returns the
+    // non-blocking fd of the new queue.
+    inline int open_tun_queue(const std::string& iface_name, const Layer& layer,
+			      const bool vnet_hdr = false)
+    {
+      static const char node[] = "/dev/net/tun";
+      ScopedFD fd(open(node, O_RDWR));
+      if (!fd.defined())
+	OPENVPN_THROW(tun_open_error, "error opening tun device " << node << ": " << errinfo(errno));
+
+      struct ifreq ifr;
+      std::memset(&ifr, 0, sizeof(ifr));
+      ifr.ifr_flags = IFF_MULTI_QUEUE | IFF_NO_PI;
+      if (vnet_hdr)
+	ifr.ifr_flags |= IFF_VNET_HDR;
+      if (layer() == Layer::OSI_LAYER_3)
+	ifr.ifr_flags |= IFF_TUN;
+      else if (layer() == Layer::OSI_LAYER_2)
+	ifr.ifr_flags |= IFF_TAP;
+      else
+	throw tun_layer_error("unknown OSI layer");
+
+      if (iface_name.length() >= IFNAMSIZ)
+	throw tun_name_error();
+      ::strcpy(ifr.ifr_name, iface_name.c_str());
+
+      if (ioctl(fd(), TUNSETIFF, (void *) &ifr) < 0)
+	{
+	  const int eno = errno;
+	  OPENVPN_THROW(tun_ioctl_error, "failed to open queue on tun device '" << iface_name << "' : " << errinfo(eno));
+	}
+
+      if (vnet_hdr)
+	set_tun_offload(fd(), nullptr);
+
+      if (fcntl(fd(), F_SETFL, O_NONBLOCK) < 0)
+	throw tun_fcntl_error(errinfo(errno));
+
+      return fd.release();
+    }
+
     template <class TUNMETHODS>
     class Setup : public TunBuilderSetup::Base
     {
@@ -77,6 +128,8 @@ namespace openvpn {
 	Layer layer; // OSI layer
 	std::string dev_name;
 	int txqueuelen;
+	bool multi_queue = false; // create interface with IFF_MULTI_QUEUE
+	bool vnet_hdr = false; // create interface with IFF_VNET_HDR and TSO offload
 	bool add_bypass_routes_on_establish; // required when not using tunbuilder
 
 #ifdef HAVE_JSON
@@ -87,6 +140,8 @@ namespace openvpn {
 	  root["layer"] = Json::Value(layer.str());
 	  root["dev_name"] = Json::Value(dev_name);
 	  root["txqueuelen"] = Json::Value(txqueuelen);
+	  root["multi_queue"] = Json::Value(multi_queue);
+	  root["vnet_hdr"] = Json::Value(vnet_hdr);
 	  return root;
 	};
 
@@ -97,6 +152,8 @@ namespace openvpn {
 	  layer = Layer::from_str(json::get_string(root, "layer", title));
 	  json::to_string(root, dev_name, "dev_name", title);
 	  json::to_int(root, txqueuelen, "txqueuelen", title);
+	  multi_queue = json::get_bool_optional(root, "multi_queue");
+	  vnet_hdr = json::get_bool_optional(root, "vnet_hdr");
 	}
 #endif
       };
@@ -147,8 +204,10 @@ namespace openvpn {
 
 	struct ifreq ifr;
 	std::memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_ONE_QUEUE;
+	ifr.ifr_flags = conf->multi_queue ? IFF_MULTI_QUEUE : IFF_ONE_QUEUE;
 	ifr.ifr_flags |= IFF_NO_PI;
+	if (conf->vnet_hdr)
+	  ifr.ifr_flags |= IFF_VNET_HDR;
 	if (conf->layer() == Layer::OSI_LAYER_3)
 	  ifr.ifr_flags |= IFF_TUN;
 	else if (conf->layer() == Layer::OSI_LAYER_2)
@@ -158,6 +217,9 @@ namespace openvpn {
 
 	open_unit(conf->dev_name, ifr, fd);
 
+	if (conf->vnet_hdr)
+	  set_tun_offload(fd(), &os);
+
 	if (fcntl (fd(), F_SETFL, O_NONBLOCK) < 0)
 	  throw tun_fcntl_error(errinfo(errno));
 
@@ -200,6 +262,53 @@ namespace openvpn {
 	return fd.release();
       }
 
+      // Take over an interface that another process established with
+      // pull (see TunHandoff), rebuilding the commands that tear it
+      // down without running any of the commands that set it up.
+      void adopt(const TunBuilderCapture& pull,
+		 TunBuilderSetup::Config* config)
+      {
+	Config *conf = dynamic_cast<Config *>(config);
+	if (!conf)
+	  throw tun_linux_error("missing config");
+
+	tun_iface_name = conf->iface_name;
+	ActionList add_cmds;
+	ActionList::Ptr remove_cmds_new = new ActionListReversed();
+	TUNMETHODS::tun_config(tun_iface_name, pull, nullptr, add_cmds, *remove_cmds_new, conf->add_bypass_routes_on_establish);
+	std::swap(remove_cmds, remove_cmds_new);
+	connected_gw = pull.remote_address.to_string();
+      }
+
+      // Add and remove routes to go from the prev to the pull
+      // configuration on an already established tun interface.
+      // Routes present in both are left untouched.
+      void update_routes(const TunBuilderCapture& prev,
+			 const TunBuilderCapture& pull,
+			 std::ostream& os)
+      {
+	const TunBuilderCapture::RouteDiff diff = prev.diff_routes(pull);
+	if (diff.empty())
+	  return;
+
+	ActionList::Ptr del_cmds = new ActionList();
+	ActionList::Ptr add_cmds = new ActionList();
+	for (const auto &route : diff.removed)
+	  {
+	    ActionList create, destroy;
+	    TUNMETHODS::add_route(tun_iface_name, prev, route, nullptr, create, destroy);
+	    for (auto &a : destroy)
+	      remove_cmds->remove(a);
+	    del_cmds->add(destroy);
+	  }
+	for (const auto &route : diff.added)
+	  TUNMETHODS::add_route(tun_iface_name, pull, route, nullptr, *add_cmds, *remove_cmds);
+
+	os << "update routes: -" << diff.removed.size() << " +" << diff.added.size() << std::endl;
+	del_cmds->execute(os);
+	add_cmds->execute(os);
+      }
+
     private:
       void open_unit(const std::string& name, struct ifreq& ifr, ScopedFD& fd)
       {
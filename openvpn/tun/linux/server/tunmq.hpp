@@ -0,0 +1,563 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Multi-queue server tun for multi-threaded servers on Linux.
+//
+// The tun interface is opened with IFF_MULTI_QUEUE, with one queue
+// per server thread.  Each queue is read and written on its own
+// thread's io_context, and delivers packets to the client sessions
+// of that thread by longest match of the destination address on the
+// client addresses and iroutes, kept in an IP::RouteTable shared by
+// all threads.
+//
+// Return traffic is steered in the kernel: an eBPF program attached
+// with TUNSETSTEERINGEBPF maps a packet's destination address to the
+// queue of the thread whose VPNServerNetblock::PerThread partition
+// contains it.  As long as each thread hands out client addresses
+// from its own partition, packets arrive on the thread that owns the
+// session.  Packets that arrive on the wrong queue anyway (kernels
+// without steering support, static client addresses outside the
+// partition) are handed to the owning thread through a bounded
+// MPSCHandoff ring, with one eventfd wakeup per burst.
+//
+// Only layer 3 (tun) and host addresses are supported.  The
+// MultiQueue must outlive the io_contexts of the server threads.
+
+#ifndef OPENVPN_TUN_LINUX_SERVER_TUNMQ_H
+#define OPENVPN_TUN_LINUX_SERVER_TUNMQ_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <sys/ioctl.h>
+#include <linux/if_tun.h>
+#include <netinet/in.h>
+
+#include <openvpn/io/io.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/mpschandoff.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/common/to_string.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/routetable.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/linux/bpfasm.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/server/vpnservnetblock.hpp>
+#include <openvpn/tun/layer.hpp>
+#include <openvpn/tun/linux/client/tunsetup.hpp>
+#include <openvpn/tun/server/tunbase.hpp>
+
+namespace openvpn {
+  namespace TunLinuxServer {
+
+    OPENVPN_EXCEPTION(tun_mq_error);
+
+    class MultiQueue : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<MultiQueue> Ptr;
+
+      // session of a route, dereferenced on its own thread only
+      struct Owner
+      {
+	unsigned int index;
+	TunClientInstance::Recv* parent;
+      };
+
+      class Queue;
+
+      struct Config
+      {
+	std::string iface_name;
+	unsigned int n_queues = 1;
+	Frame::Ptr frame;
+	const VPNServerNetblock* netblock = nullptr; // per-thread address partitions, or null
+	bool steer = true;                           // attach the steering program
+	size_t handoff_capacity = 1024;              // packets pending per thread before handoffs drop
+	SessionStats::Ptr stats;                     // counts handoff drops, or null
+      };
+
+      // Open one queue per thread on the tun interface, creating it
+      // if it doesn't exist yet.
+      static Ptr open(const Config& config)
+      {
+	return new MultiQueue(config);
+      }
+
+      unsigned int size() const
+      {
+	return unsigned(queues.size());
+      }
+
+      const std::string& iface_name() const
+      {
+	return iface_name_;
+      }
+
+      bool steering() const
+      {
+	return prog_fd.defined();
+      }
+
+      // Bind queue index to a server thread's io_context, returns the
+      // tun factory for the sessions of that thread.  Call on that
+      // thread, then start() the queue.
+      Queue* queue(const unsigned int index, openvpn_io::io_context& io_context);
+
+      // Thread that owns addr: from the registered client addresses
+      // and iroutes, or else from the partitions.  Returns -1 if
+      // unknown.  Call on a server thread, or while no sessions stop.
+      int owner_of(const IP::Addr& addr) const
+      {
+	const Owner* o = owners.longest_match(addr);
+	if (o)
+	  return int(o->index);
+	for (size_t i = 0; i < ranges4.size(); ++i)
+	  if (in_range(addr, ranges4[i]))
+	    return int(i);
+	for (size_t i = 0; i < ranges6.size(); ++i)
+	  if (in_range(addr, ranges6[i]))
+	    return int(i);
+	return -1;
+      }
+
+      // Packets that were read on the wrong queue and handed over.
+      std::uint64_t n_handoff() const
+      {
+	return n_handoff_.load(std::memory_order_relaxed);
+      }
+
+      // Packets dropped because no session owns their destination.
+      std::uint64_t n_unrouted() const
+      {
+	return n_unrouted_.load(std::memory_order_relaxed);
+      }
+
+      // Queue of one server thread.  All methods except handoff()
+      // are called on that thread.
+      class Queue : public TunClientInstance::Factory,
+		    private MPSCHandoff<BufferAllocated>::Recv
+      {
+	friend class MultiQueue;
+
+      public:
+	typedef RCPtr<Queue> Ptr;
+
+	void start()
+	{
+	  if (!halt)
+	    return;
+	  halt = false;
+	  reader = mq->owners.register_reader();
+	  inbox->start(this);
+	  queue_read();
+	}
+
+	void stop()
+	{
+	  halt = true;
+	  if (stream)
+	    {
+	      stream->cancel();
+	      stream->release();
+	      stream.reset();
+	    }
+	  if (inbox)
+	    inbox->stop();
+	  reader.reset();
+	}
+
+	TunClientInstance::Send::Ptr new_obj(TunClientInstance::Recv* parent) override
+	{
+	  return new ClientSend(this, parent);
+	}
+
+	// any thread (the refcount isn't thread-safe, the MultiQueue
+	// keeps the queue alive)
+	void handoff(BufferAllocated&& buf)
+	{
+	  inbox->push(std::move(buf));
+	}
+
+      private:
+	class ClientSend : public TunClientInstance::Send
+	{
+	public:
+	  ClientSend(Queue* queue_arg, TunClientInstance::Recv* parent_arg)
+	    : queue(queue_arg),
+	      parent(parent_arg)
+	  {
+	  }
+
+	  void stop() override
+	  {
+	    if (queue)
+	      {
+		for (const auto& r : routes)
+		  queue->del_route(r, parent);
+		routes.clear();
+		queue.reset();
+	      }
+	  }
+
+	  bool tun_send_const(const Buffer& buf) override
+	  {
+	    return queue && queue->write(buf);
+	  }
+
+	  bool tun_send(BufferAllocated& buf) override
+	  {
+	    return queue && queue->write(buf);
+	  }
+
+	  void add_vpn_addr(const IP::Addr& addr) override
+	  {
+	    add_iroute(IP::Route(addr, addr.size()));
+	  }
+
+	  void add_iroute(const IP::Route& route) override
+	  {
+	    if (queue)
+	      {
+		queue->add_route(route, parent);
+		routes.push_back(route);
+	      }
+	  }
+
+	  TunClientInstance::NativeHandle tun_native_handle() override
+	  {
+	    return TunClientInstance::NativeHandle();
+	  }
+
+	  void relay(const IP::Addr& target, const int port) override
+	  {
+	  }
+
+	  const std::string& tun_info() const override
+	  {
+	    return info;
+	  }
+
+	private:
+	  Queue::Ptr queue;
+	  TunClientInstance::Recv* parent;
+	  std::vector<IP::Route> routes;
+	  std::string info = "TUN_MQ";
+	};
+
+	Queue(MultiQueue* mq_arg, const unsigned int index_arg, const int fd_arg)
+	  : mq(mq_arg),
+	    index(index_arg),
+	    fd(fd_arg)
+	{
+	}
+
+	void bind(openvpn_io::io_context& io_context_arg)
+	{
+	  inbox.reset(new MPSCHandoff<BufferAllocated>(io_context_arg, mq->handoff_capacity, mq->stats));
+	  io_context = &io_context_arg;
+	  stream.reset(new openvpn_io::posix::stream_descriptor(io_context_arg, fd()));
+	}
+
+	// the latest session to claim a route owns it
+	void add_route(const IP::Route& route, TunClientInstance::Recv* parent)
+	{
+	  mq->owners.replace(route, new Owner{index, parent});
+	}
+
+	void del_route(const IP::Route& route, TunClientInstance::Recv* parent)
+	{
+	  const Owner* o = mq->owners.lookup(route);
+	  if (o && o->index == index && o->parent == parent)
+	    mq->owners.erase(route, o);
+	}
+
+	bool write(const Buffer& buf)
+	{
+	  const ssize_t n = ::write(fd(), buf.c_data(), buf.size());
+	  return n == ssize_t(buf.size());
+	}
+
+	void queue_read()
+	{
+	  if (halt)
+	    return;
+	  mq->frame->prepare(Frame::READ_TUN, rbuf);
+	  stream->async_read_some((*mq->frame)[Frame::READ_TUN].mutable_buffer(rbuf),
+				  [self=Ptr(this)](const openvpn_io::error_code& error, const size_t bytes_recvd)
+				  {
+				    self->handle_read(error, bytes_recvd);
+				  });
+	}
+
+	void handle_read(const openvpn_io::error_code& error, const size_t bytes_recvd)
+	{
+	  if (halt)
+	    return;
+	  if (!error)
+	    {
+	      rbuf.set_size(bytes_recvd);
+	      route(rbuf);
+	      reader->quiescent();
+	    }
+	  else if (error == openvpn_io::error::operation_aborted)
+	    return;
+	  queue_read();
+	}
+
+	void route(BufferAllocated& buf)
+	{
+	  IP::Addr dest;
+	  if (!dest_addr(buf, dest))
+	    return;
+	  const Owner* o = mq->owners.longest_match(dest);
+	  if (!o)
+	    mq->n_unrouted_.fetch_add(1, std::memory_order_relaxed);
+	  else if (o->index == index)
+	    o->parent->tun_recv(buf);
+	  else if (mq->queues[o->index]->io_context)
+	    {
+	      mq->n_handoff_.fetch_add(1, std::memory_order_relaxed);
+	      mq->queues[o->index]->handoff(std::move(buf));
+	    }
+	}
+
+	void handoff_recv(BufferAllocated* v, const size_t n) override
+	{
+	  for (size_t i = 0; i < n; ++i)
+	    {
+	      IP::Addr dest;
+	      if (!dest_addr(v[i], dest))
+		continue;
+
+	      // the session may have gone meanwhile
+	      const Owner* o = mq->owners.longest_match(dest);
+	      if (o && o->index == index)
+		o->parent->tun_recv(v[i]);
+	      else
+		mq->n_unrouted_.fetch_add(1, std::memory_order_relaxed);
+	    }
+	  reader->quiescent();
+	}
+
+	static bool dest_addr(const Buffer& buf, IP::Addr& dest)
+	{
+	  if (buf.size() < 20)
+	    return false;
+	  const unsigned char *p = buf.c_data();
+	  switch (p[0] >> 4)
+	    {
+	    case 4:
+	      dest = IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(p + 16));
+	      return true;
+	    case 6:
+	      {
+		if (buf.size() < 40)
+		  return false;
+		struct in6_addr a6;
+		std::memcpy(a6.s6_addr, p + 24, 16);
+		dest = IP::Addr::from_ipv6(IPv6::Addr::from_in6_addr(&a6));
+		return true;
+	      }
+	    default:
+	      return false;
+	    }
+	}
+
+	MultiQueue* mq; // outlives the queues
+	const unsigned int index;
+	ScopedFD fd;
+	openvpn_io::io_context* io_context = nullptr;
+	std::unique_ptr<openvpn_io::posix::stream_descriptor> stream;
+	BufferAllocated rbuf;
+	std::unique_ptr<QSBR::Reader> reader;
+	bool halt = true;
+
+	std::unique_ptr<MPSCHandoff<BufferAllocated>> inbox; // packets handed over by other threads
+      };
+
+    private:
+      MultiQueue(const Config& config)
+	: iface_name_(config.iface_name),
+	  frame(config.frame),
+	  handoff_capacity(config.handoff_capacity),
+	  stats(config.stats)
+      {
+	if (!config.n_queues || !frame)
+	  throw tun_mq_error("n_queues and frame must be set");
+	if (config.netblock)
+	  for (size_t i = 0; i < config.netblock->size() && i < config.n_queues; ++i)
+	    {
+	      const VPNServerNetblock::PerThread& pt = config.netblock->per_thread(i);
+	      ranges4.push_back(pt.range4());
+	      if (pt.range6_defined())
+		ranges6.push_back(pt.range6());
+	    }
+
+	const Layer layer(Layer::OSI_LAYER_3);
+	for (unsigned int i = 0; i < config.n_queues; ++i)
+	  queues.emplace_back(new Queue(this, i, TunLinuxSetup::open_tun_queue(iface_name_, layer)));
+
+	if (config.steer && config.n_queues > 1 && !ranges4.empty())
+	  attach_steering();
+      }
+
+      static bool in_range(const IP::Addr& addr, const IP::Range& r)
+      {
+	return r.defined()
+	  && addr.version() == r.start().version()
+	  && addr >= r.start()
+	  && addr < r.start() + long(r.extent());
+      }
+
+      // Return queue i for destinations in ranges4[i] or ranges6[i],
+      // and 0 otherwise.  IPv6 ranges are only matched when they lie
+      // within one 2^32 block, which holds for any practical pool.
+      void attach_steering()
+      {
+#ifdef TUNSETSTEERINGEBPF
+	enum {
+	  R0=BPF::Asm::R0, R1=BPF::Asm::R1, R6=BPF::Asm::R6, R7=BPF::Asm::R7,
+	  IP4_DADDR = 16,
+	  IP6_DADDR = 24,
+	};
+
+	BPF::Asm a;
+	const BPF::Asm::Label l_v6 = a.new_label();
+	const BPF::Asm::Label l_default = a.new_label();
+	std::vector<BPF::Asm::Label> l_ret;
+	for (size_t i = 0; i < queues.size(); ++i)
+	  l_ret.push_back(a.new_label());
+
+	a.mov_reg(R6, R1);
+	a.load_abs(BPF_B, 0);
+	a.rsh_imm(R0, 4);                                   // IP version
+	a.jmp_imm(BPF_JNE, R0, 4, l_v6);
+
+	// IPv4: (daddr - start) < extent, in 32-bit arithmetic
+	a.load_abs(BPF_W, IP4_DADDR);
+	a.mov_reg(R7, R0);
+	for (size_t i = 0; i < ranges4.size(); ++i)
+	  {
+	    const IP::Range& r = ranges4[i];
+	    if (!r.defined() || r.start().version() != IP::Addr::V4)
+	      continue;
+	    a.mov_reg(R0, R7);
+	    a.sub32_imm(R0, r.start().to_ipv4().to_uint32());
+	    a.mov32_imm(R1, std::uint32_t(r.extent()));
+	    a.jmp_reg(BPF_JLT, R0, R1, l_ret[i]);
+	  }
+	a.jmp(l_default);
+
+	// IPv6: upper 96 bits equal, low 32 bits in range
+	a.label(l_v6);
+	a.jmp_imm(BPF_JNE, R0, 6, l_default);
+	for (size_t i = 0; i < ranges6.size(); ++i)
+	  {
+	    const IP::Range& r = ranges6[i];
+	    std::uint32_t w[4];
+	    if (!r.defined() || !ipv6_words(r, w))
+	      continue;
+	    const BPF::Asm::Label l_next = a.new_label();
+	    for (int j = 0; j < 3; ++j)
+	      {
+		a.load_abs(BPF_W, IP6_DADDR + 4 * j);
+		a.mov32_imm(R1, w[j]);
+		a.jmp_reg(BPF_JNE, R0, R1, l_next);
+	      }
+	    a.load_abs(BPF_W, IP6_DADDR + 12);
+	    a.sub32_imm(R0, w[3]);
+	    a.mov32_imm(R1, std::uint32_t(r.extent()));
+	    a.jmp_reg(BPF_JLT, R0, R1, l_ret[i]);
+	    a.label(l_next);
+	  }
+
+	a.label(l_default);
+	a.mov_imm(R0, 0);
+	a.exit();
+	for (size_t i = 0; i < queues.size(); ++i)
+	  {
+	    a.label(l_ret[i]);
+	    a.mov_imm(R0, int(i));
+	    a.exit();
+	  }
+
+	try {
+	  prog_fd.reset(a.load_program(BPF_PROG_TYPE_SOCKET_FILTER, "tun steering"));
+	}
+	catch (const BPF::bpf_error&)
+	  {
+	    // no steering, misrouted packets are handed off instead
+	    return;
+	  }
+	int pfd = prog_fd();
+	if (::ioctl(queues[0]->fd(), TUNSETSTEERINGEBPF, &pfd) < 0)
+	  prog_fd.close();
+#endif
+      }
+
+      // host-order 32-bit words of the range start, false if the
+      // range crosses a 2^32 boundary
+      static bool ipv6_words(const IP::Range& r, std::uint32_t w[4])
+      {
+	if (r.start().version() != IP::Addr::V6 || r.extent() > 0xFFFFFFFFu)
+	  return false;
+	unsigned char b[16];
+	r.start().to_ipv6().to_byte_string(b);
+	for (int j = 0; j < 4; ++j)
+	  w[j] = (std::uint32_t(b[4*j]) << 24) | (std::uint32_t(b[4*j+1]) << 16)
+	    | (std::uint32_t(b[4*j+2]) << 8) | std::uint32_t(b[4*j+3]);
+	return std::uint64_t(w[3]) + r.extent() <= 0x100000000ull;
+      }
+
+      std::string iface_name_;
+      Frame::Ptr frame;
+      const size_t handoff_capacity;
+      SessionStats::Ptr stats;
+      IP::RouteTable<Owner> owners; // client addresses and iroutes, outlives the queues' readers
+      std::vector<Queue::Ptr> queues;
+      std::vector<IP::Range> ranges4;
+      std::vector<IP::Range> ranges6;
+      ScopedFD prog_fd;
+
+      std::atomic<std::uint64_t> n_handoff_{0};
+      std::atomic<std::uint64_t> n_unrouted_{0};
+    };
+
+    inline MultiQueue::Queue* MultiQueue::queue(const unsigned int index, openvpn_io::io_context& io_context)
+    {
+      if (index >= queues.size())
+	throw tun_mq_error("bad queue index " + openvpn::to_string(index));
+      Queue* q = queues[index].get();
+      q->bind(io_context);
+      return q;
+    }
+
+  }
+}
+
+#endif
@@ -77,6 +77,64 @@ namespace openvpn {
 	Base::tun_prefix = tun_prefix;
 	Base::stream = new TunWrapAsioStream<TunPersist>(tun_persist);
       }
+
+#ifdef OPENVPN_UTUN_MSG_X
+      // Write a burst of packets with one sendmsg_x() call per
+      // WRITE_X_MAX packets, returns number of packets written.
+      size_t write_batch_x(BufferAllocated* bufs, const size_t n)
+      {
+	size_t n_written = 0;
+	size_t bytes_written = 0;
+	size_t i = 0;
+	while (i < n && !Base::halt)
+	  {
+	    struct iovec iov[WRITE_X_MAX];
+	    struct msghdr_x msgs[WRITE_X_MAX];
+	    unsigned int count = 0;
+	    for (; i < n && count < WRITE_X_MAX; ++i)
+	      {
+		BufferAllocated& buf = bufs[i];
+		if (!buf.size())
+		  continue;
+		if (Base::tun_prefix && !Base::add_tun_prefix(buf))
+		  continue;
+		iov[count].iov_base = buf.data();
+		iov[count].iov_len = buf.size();
+		std::memset(&msgs[count], 0, sizeof(msgs[count]));
+		msgs[count].msg_iov = &iov[count];
+		msgs[count].msg_iovlen = 1;
+		++count;
+	      }
+	    if (!count)
+	      break;
+
+	    const ssize_t sent = ::sendmsg_x(Base::stream->native_handle(), msgs, count, 0);
+	    if (sent < 0)
+	      {
+		const openvpn_io::error_code ec(errno, openvpn_io::error::get_system_category());
+		OPENVPN_LOG_TUN_ERROR("TUN sendmsg_x error: " << ec.message());
+		Base::tun_error(Error::TUN_WRITE_ERROR, &ec);
+		break;
+	      }
+	    for (ssize_t j = 0; j < sent; ++j)
+	      bytes_written += iov[j].iov_len;
+	    n_written += sent;
+	    if (size_t(sent) < count)
+	      break; // socket buffer full, drop the rest
+	  }
+	if (Base::stats)
+	  {
+	    Base::stats->inc_stat(SessionStats::TUN_BYTES_OUT, bytes_written);
+	    Base::stats->inc_stat(SessionStats::TUN_PACKETS_OUT, n_written);
+	  }
+	return n_written;
+      }
+
+    private:
+      enum {
+	WRITE_X_MAX = 64,
+      };
+#endif
     };
 
     // These types manage the underlying tun driver fd
@@ -93,6 +151,7 @@ namespace openvpn {
 
       TunProp::Config tun_prop;
       int n_parallel = 8;        // number of parallel async reads on tun socket
+      unsigned int drain_budget = 0; // if > 0, drain up to this many packets per kqueue wakeup instead of n_parallel async reads
 
       Frame::Ptr frame;
       SessionStats::Ptr stats;
@@ -241,7 +300,10 @@ namespace openvpn {
 				     config->frame,
 				     config->stats
 				     ));
-	      impl->start(config->n_parallel);
+	      if (config->drain_budget)
+		impl->start_drain(config->drain_budget);
+	      else
+		impl->start(config->n_parallel);
 
 	      // signal that we are connected
 	      parent.tun_connected();
@@ -265,6 +327,17 @@ namespace openvpn {
 	return send(buf);
       }
 
+      virtual size_t tun_send_batch(BufferAllocated* bufs, const size_t n) override
+      {
+	if (!impl)
+	  return 0;
+#ifdef OPENVPN_UTUN_MSG_X
+	return impl->write_batch_x(bufs, n);
+#else
+	return impl->write_batch(bufs, n);
+#endif
+      }
+
       virtual std::string tun_name() const override
       {
 	if (impl)
@@ -26,6 +26,7 @@
 
 #include <thread>
 #include <mutex>
+#include <algorithm>
 
 #include <openvpn/log/logthread.hpp>
 #include <openvpn/common/action.hpp>
@@ -133,7 +134,7 @@ namespace openvpn {
 	      else
 		{
 		  if (runloop.defined())
-		    schedule_push_timer(0);
+		    schedule_push_timer(0, true);
 		  else
 		    OPENVPN_LOG("MacDNSWatchdog::setdns: runloop undefined");
 		}
@@ -188,19 +189,14 @@ namespace openvpn {
 
       try {
 	SCDynamicStoreContext context = {0, this, nullptr, nullptr, nullptr};
-	CF::DynamicStore ds(SCDynamicStoreCreate(kCFAllocatorDefault,
-						 CFSTR("OpenVPN_MacDNSWatchdog"),
-						 callback_static,
-						 &context));
+	ds.reset(SCDynamicStoreCreate(kCFAllocatorDefault,
+				      CFSTR("OpenVPN_MacDNSWatchdog"),
+				      callback_static,
+				      &context));
 	if (!ds.defined())
 	  throw macdns_watchdog_error("SCDynamicStoreCreate");
-	const CF::Array watched_keys(macdns->dskey_array());
-	if (!watched_keys.defined())
-	  throw macdns_watchdog_error("watched_keys is undefined");
-	if (!SCDynamicStoreSetNotificationKeys(ds(),
-					       watched_keys(),
-					       nullptr))
-	  throw macdns_watchdog_error("SCDynamicStoreSetNotificationKeys failed");
+	watch_keys(macdns->dskey_array());
+	applied = CF::DynamicStoreCopyMultiple(ds, watched_keys);
 	CF::RunLoopSource rls(SCDynamicStoreCreateRunLoopSource(kCFAllocatorDefault, ds(), 0));
 	if (!rls.defined())
 	  throw macdns_watchdog_error("SCDynamicStoreCreateRunLoopSource failed");
@@ -214,6 +210,22 @@ namespace openvpn {
 	  OPENVPN_LOG("MacDNSWatchdog::thread_func exception: " << e.what());
 	}
       cancel_push_timer();
+      applied.reset();
+      watched_keys.reset();
+      ds.reset();
+    }
+
+    void watch_keys(const CF::Array& keys)
+    {
+      if (!keys.defined())
+	throw macdns_watchdog_error("watched_keys is undefined");
+      if (watched_keys.defined() && CFEqual(keys(), watched_keys()))
+	return;
+      if (!SCDynamicStoreSetNotificationKeys(ds(),
+					     keys(),
+					     nullptr))
+	throw macdns_watchdog_error("SCDynamicStoreSetNotificationKeys failed");
+      watched_keys = keys;
     }
 
     static void callback_static(SCDynamicStoreRef store, CFArrayRef changedKeys, void *arg)
@@ -225,16 +237,29 @@ namespace openvpn {
     void callback(SCDynamicStoreRef store, CFArrayRef changedKeys)
     {
       // DNS Watchdog delay from the time that change is detected
-      // to when we forcibly revert it (seconds).
-      schedule_push_timer(1);
+      // to when we forcibly revert it (seconds).  Each further
+      // change restarts the delay, up to MAX_DEBOUNCE seconds after
+      // the first one, so that a network flap is handled once.
+      schedule_push_timer(1, false);
     }
 
-    void schedule_push_timer(const int seconds)
+    enum {
+      MAX_DEBOUNCE = 5,
+    };
+
+    // force: reapply even if the watched keys are unchanged,
+    // used when the config changed
+    void schedule_push_timer(const int seconds, const bool force)
     {
       std::lock_guard<std::mutex> lock(push_timer_lock);
       CFRunLoopTimerContext context = { 0, this, nullptr, nullptr, nullptr };
+      const CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+      if (!push_timer.defined())
+	pending_since = now;
+      force_reapply |= force;
       cancel_push_timer_nolock();
-      push_timer.reset(CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + seconds, 0, 0, 0, push_timer_callback_static, &context));
+      const CFAbsoluteTime fire = std::min(now + seconds, pending_since + MAX_DEBOUNCE);
+      push_timer.reset(CFRunLoopTimerCreate(kCFAllocatorDefault, fire, 0, 0, 0, push_timer_callback_static, &context));
       if (push_timer.defined())
 	CFRunLoopAddTimer(runloop(), push_timer(), kCFRunLoopCommonModes);
       else
@@ -264,11 +289,30 @@ namespace openvpn {
 
     void push_timer_callback(CFRunLoopTimerRef timer)
     {
+      bool force;
+      {
+	std::lock_guard<std::mutex> lock(push_timer_lock);
+	push_timer.reset(nullptr);
+	force = force_reapply;
+	force_reapply = false;
+      }
+
       try {
-	// reset DNS settings after watcher detected modifications by third party
+	// Notifications also come for our own updates and for changes
+	// that were reverted before the timer fired, so only reapply
+	// when the watched keys differ from what we left them at.
+	if (!force && CFEqual(CF::DynamicStoreCopyMultiple(ds, watched_keys)(), applied()))
+	  return;
+
+	// reset DNS settings after watcher detected modifications by third party,
+	// setdns only writes the keys that need it
 	const MacDNS::Config::Ptr config(config_);
 	if (macdns->setdns(*config))
 	  OPENVPN_LOG("MacDNSWatchdog: updated DNS settings");
+
+	// primary service might have changed
+	watch_keys(macdns->dskey_array());
+	applied = CF::DynamicStoreCopyMultiple(ds, watched_keys);
       }
       catch (const std::exception& e)
 	{
@@ -284,6 +328,11 @@ namespace openvpn {
     CF::RunLoop runloop;           // run loop in watcher thread
     CF::Timer push_timer;          // watcher thread timer
     std::mutex push_timer_lock;
+    CFAbsoluteTime pending_since = 0; // first change not yet handled by push_timer
+    bool force_reapply = false;
+    CF::DynamicStore ds;           // watcher thread store, notifies of watched_keys changes
+    CF::Array watched_keys;
+    CF::Dict applied;              // values of watched_keys after last setdns
     Log::Context::Wrapper logwrap; // used to carry forward the log context from parent thread
   };
 }
@@ -48,6 +48,25 @@
 #include <openvpn/common/to_string.hpp>
 #include <openvpn/common/scoped_fd.hpp>
 
+#ifdef OPENVPN_UTUN_MSG_X
+// Multi-packet socket calls from the private Darwin API
+// (xnu bsd/sys/socket_private.h), they work on utun's
+// kernel control socket.  Not in the public SDK headers,
+// so only used if OPENVPN_UTUN_MSG_X is defined.
+struct msghdr_x {
+  void *msg_name;
+  socklen_t msg_namelen;
+  struct iovec *msg_iov;
+  int msg_iovlen;
+  void *msg_control;
+  socklen_t msg_controllen;
+  int msg_flags;
+  size_t msg_datalen;
+};
+
+extern "C" ssize_t sendmsg_x(int s, const struct msghdr_x *msgp, u_int cnt, int flags);
+#endif
+
 namespace openvpn {
   namespace TunMac {
     namespace UTun {
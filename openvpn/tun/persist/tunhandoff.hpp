@@ -0,0 +1,255 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Hand a persisted tun over a unix domain socket to a new client
+// process, so that a daemon can be restarted (for example to upgrade
+// it) without tearing down the tun and reconfiguring its addresses,
+// routes and DNS.  The old process calls send() with the tun fd and
+// the TunBuilderCapture and TunProp::State it was configured with,
+// then TunPersistTemplate::detach(); the new one calls receive() and
+// TunPersistTemplate::adopt(), after which use_persisted_tun()
+// matches the first session with the same settings.
+
+#ifndef OPENVPN_TUN_PERSIST_TUNHANDOFF_H
+#define OPENVPN_TUN_PERSIST_TUNHANDOFF_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+#include <cstdint>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#include <openvpn/common/write.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/common/jsonhelper.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/tun/builder/capture.hpp>
+#include <openvpn/tun/client/tunprop.hpp>
+
+namespace openvpn {
+  namespace TunHandoff {
+
+    OPENVPN_EXCEPTION(tun_handoff_error);
+
+    enum {
+      MAGIC = 0x4f565448, // "OVTH"
+      MAX_PAYLOAD = 16*1024*1024,
+    };
+
+    struct Item
+    {
+      ScopedFD fd;
+      TunBuilderCapture::Ptr capture;
+      TunProp::State::Ptr state;
+    };
+
+    namespace detail {
+      inline std::string addr_str(const IP::Addr& a)
+      {
+	return a.defined() ? a.to_string() : std::string();
+      }
+
+      inline IP::Addr addr_from_json(const Json::Value& root, const char *name)
+      {
+	const std::string s = json::get_string_optional(root, name, std::string(), "state");
+	return s.empty() ? IP::Addr() : IP::Addr(s, name);
+      }
+
+      inline Json::Value state_to_json(const TunProp::State& st)
+      {
+	Json::Value root(Json::objectValue);
+	root["iface_name"] = Json::Value(st.iface_name);
+	root["vpn_ip4_addr"] = Json::Value(addr_str(st.vpn_ip4_addr));
+	root["vpn_ip6_addr"] = Json::Value(addr_str(st.vpn_ip6_addr));
+	root["vpn_ip4_gw"] = Json::Value(addr_str(st.vpn_ip4_gw));
+	root["vpn_ip6_gw"] = Json::Value(addr_str(st.vpn_ip6_gw));
+	root["tun_prefix"] = Json::Value(st.tun_prefix);
+	return root;
+      }
+
+      inline TunProp::State::Ptr state_from_json(const Json::Value& root)
+      {
+	TunProp::State::Ptr st(new TunProp::State());
+	json::assert_dict(root, "state");
+	json::to_string(root, st->iface_name, "iface_name", "state");
+	st->vpn_ip4_addr = addr_from_json(root, "vpn_ip4_addr");
+	st->vpn_ip6_addr = addr_from_json(root, "vpn_ip6_addr");
+	st->vpn_ip4_gw = addr_from_json(root, "vpn_ip4_gw");
+	st->vpn_ip6_gw = addr_from_json(root, "vpn_ip6_gw");
+	json::to_bool(root, st->tun_prefix, "tun_prefix", "state");
+	return st;
+      }
+
+      inline void read_all(const int fd, unsigned char *data, size_t size)
+      {
+	while (size)
+	  {
+	    const ssize_t status = ::read(fd, data, size);
+	    if (status < 0)
+	      {
+		if (errno == EINTR)
+		  continue;
+		const int eno = errno;
+		throw tun_handoff_error("read: " + strerror_str(eno));
+	      }
+	    if (status == 0)
+	      throw tun_handoff_error("read: unexpected EOF");
+	    data += status;
+	    size -= status;
+	  }
+      }
+    }
+
+    // Send the tun fd with the settings it was configured with.  The
+    // fd stays open in the caller.  Blocking, sock should be a
+    // SOCK_STREAM unix socket.
+    inline void send(const int sock,
+		     const int tun_fd,
+		     const TunBuilderCapture& capture,
+		     const TunProp::State& state)
+    {
+      Json::Value root(Json::objectValue);
+      root["capture"] = capture.to_json();
+      root["state"] = detail::state_to_json(state);
+      const std::string payload = json::format_compact(root, 1024);
+
+      // the header carries the fd, the payload follows
+      std::uint32_t header[2] = { htonl(MAGIC), htonl(std::uint32_t(payload.length())) };
+      struct iovec iov;
+      iov.iov_base = header;
+      iov.iov_len = sizeof(header);
+
+      union {
+	struct cmsghdr align;
+	unsigned char buf[CMSG_SPACE(sizeof(int))];
+      } control;
+      ::memset(&control, 0, sizeof(control));
+
+      struct msghdr msg;
+      ::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      ::memcpy(CMSG_DATA(cmsg), &tun_fd, sizeof(int));
+
+      ssize_t status;
+      do {
+	status = ::sendmsg(sock, &msg, 0);
+      } while (status < 0 && errno == EINTR);
+      if (status < 0)
+	{
+	  const int eno = errno;
+	  throw tun_handoff_error("sendmsg: " + strerror_str(eno));
+	}
+      if (size_t(status) != sizeof(header))
+	throw tun_handoff_error("sendmsg: short write");
+
+      if (write_retry(sock, payload.c_str(), payload.length()) != ssize_t(payload.length()))
+	{
+	  const int eno = errno;
+	  throw tun_handoff_error("write: " + strerror_str(eno));
+	}
+    }
+
+    // Receive what send() sent.
+    inline Item receive(const int sock)
+    {
+      Item item;
+      std::uint32_t header[2];
+      struct iovec iov;
+      iov.iov_base = header;
+      iov.iov_len = sizeof(header);
+
+      union {
+	struct cmsghdr align;
+	unsigned char buf[CMSG_SPACE(sizeof(int))];
+      } control;
+
+      struct msghdr msg;
+      ::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+
+      ssize_t status;
+      do {
+	status = ::recvmsg(sock, &msg, MSG_WAITALL|MSG_CMSG_CLOEXEC);
+      } while (status < 0 && errno == EINTR);
+      if (status < 0)
+	{
+	  const int eno = errno;
+	  throw tun_handoff_error("recvmsg: " + strerror_str(eno));
+	}
+
+      // take ownership of the fd first, so that it is closed on
+      // any error below
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+	  if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+	      && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+	    {
+	      int fd;
+	      ::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	      item.fd.reset(fd);
+	    }
+	}
+
+      if (size_t(status) != sizeof(header))
+	throw tun_handoff_error("recvmsg: short read");
+      if (ntohl(header[0]) != MAGIC)
+	throw tun_handoff_error("bad magic");
+      if (!item.fd.defined())
+	throw tun_handoff_error("no tun fd");
+      const std::uint32_t size = ntohl(header[1]);
+      if (size > MAX_PAYLOAD)
+	throw tun_handoff_error("payload too large");
+
+      std::string payload(size, '\0');
+      detail::read_all(sock, (unsigned char *)&payload[0], size);
+
+      try {
+	const Json::Value root = json::parse(payload, "tun handoff");
+	item.capture = TunBuilderCapture::from_json(json::get_dict(root, "capture", false));
+	item.state = detail::state_from_json(json::get_dict(root, "state", false));
+      }
+      catch (const std::exception& e)
+	{
+	  throw tun_handoff_error(std::string("bad payload: ") + e.what());
+	}
+      return item;
+    }
+
+  }
+}
+
+#endif
@@ -42,6 +42,7 @@ namespace openvpn {
 	enable_persistence_(enable_persistence),
 	tb_(tb),
 	use_persisted_tun_(false),
+	routes_changed_(false),
 	disconnect(false)
     {
     }
@@ -60,6 +61,7 @@ namespace openvpn {
     void invalidate()
     {
       options_.clear();
+      capture_.reset();
     }
 
     void close()
@@ -79,6 +81,47 @@ namespace openvpn {
       return options_;
     }
 
+    // Tun builder settings of the persisted session
+    const TunBuilderCapture::Ptr& capture() const
+    {
+      return capture_;
+    }
+
+    // True if the last use_persisted_tun() call found a persisted
+    // session that differs from the to-be-created one only in its
+    // routes.  The caller may then keep the tun and apply the route
+    // difference between capture() and the new settings, followed
+    // by persist_route_update().  Never true with a tun builder,
+    // which has no way to change routes on an established tun.
+    bool routes_changed() const
+    {
+      return routes_changed_;
+    }
+
+    // Adopt the settings of the to-be-created session after the
+    // caller applied the route difference to the persisted tun.
+    void persist_route_update()
+    {
+      if (routes_changed_)
+	{
+	  capture_ = copt_;
+	  options_ = copt_->to_string();
+	  routes_changed_ = false;
+	  use_persisted_tun_ = true;
+	}
+    }
+
+    // Record settings that were changed on the persisted tun
+    // outside of a reconnect, such as by a pushed update.
+    void persist_capture(const TunBuilderCapture::Ptr& capture)
+    {
+      if (enable_persistence_ && capture_ && capture)
+	{
+	  capture_ = capture;
+	  options_ = capture->to_string();
+	}
+    }
+
     // Return true if we should use previously persisted
     // tun socket descriptor/handle
     bool use_persisted_tun(const IP::Addr server_addr,
@@ -119,6 +162,13 @@ namespace openvpn {
 			    && !options_.empty()
 			    && options_ == copt_->to_string()
 			    && (tb_ ? tb_->tun_builder_persist() : true));
+      routes_changed_ = (!use_persisted_tun_
+			 && !tb_
+			 && TunWrapTemplate<SCOPED_OBJ>::obj_defined()
+			 && TunWrapTemplate<SCOPED_OBJ>::destructor_defined()
+			 && copt_
+			 && capture_
+			 && copt_->same_except_routes(*capture_));
       return use_persisted_tun_;
     }
 
@@ -134,12 +184,43 @@ namespace openvpn {
 	{
 	  state_ = state;
 	  options_ = copt_->to_string();
+	  capture_ = copt_;
 	  return true;
 	}
       else
 	return false;
     }
 
+    // Give up the persisted tun for handoff to another process (see
+    // TunHandoff), leaving it and its routes configured.  Returns
+    // the fd/handle, which the caller must close after sending it.
+    typename SCOPED_OBJ::base_type detach()
+    {
+      state_.reset();
+      options_ = "";
+      capture_.reset();
+      routes_changed_ = false;
+      use_persisted_tun_ = false;
+      return TunWrapTemplate<SCOPED_OBJ>::detach();
+    }
+
+    // Take over a tun configured with capture by another process, as
+    // if it had been persisted here.  destruct, if defined, removes
+    // its routes when the tun is finally closed.
+    void adopt(const typename SCOPED_OBJ::base_type obj,
+	       const TunBuilderCapture::Ptr& capture,
+	       const STATE& state,
+	       const DestructorBase::Ptr& destruct)
+    {
+      close();
+      TunWrapTemplate<SCOPED_OBJ>::save_replace_sock(obj);
+      if (destruct)
+	TunWrapTemplate<SCOPED_OBJ>::add_destructor(destruct);
+      state_ = state;
+      capture_ = capture;
+      options_ = capture->to_string();
+    }
+
   private:
     void close_local()
     {
@@ -147,6 +228,8 @@ namespace openvpn {
 	tb_->tun_builder_teardown(disconnect);
       state_.reset();
       options_ = "";
+      capture_.reset();
+      routes_changed_ = false;
     }
 
     const bool enable_persistence_;
@@ -155,7 +238,9 @@ namespace openvpn {
     std::string options_;
 
     TunBuilderCapture::Ptr copt_;
+    TunBuilderCapture::Ptr capture_;
     bool use_persisted_tun_;
+    bool routes_changed_;
 
     bool disconnect;
   };
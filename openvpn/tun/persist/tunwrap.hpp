@@ -62,6 +62,11 @@ namespace openvpn {
       return bool(destruct_);
     }
 
+    const DestructorBase::Ptr& destructor() const
+    {
+      return destruct_;
+    }
+
     // destruct object performs cleanup prior to TAP device
     // HANDLE close, such as removing added routes.
     void add_destructor(const DestructorBase::Ptr& destruct)
@@ -98,6 +103,15 @@ namespace openvpn {
 	}
     }
 
+    // Give up the fd/handle without closing it and drop the
+    // destructor without running it, for handing the tun over to
+    // another process.
+    typename SCOPED_OBJ::base_type detach()
+    {
+      destruct_.reset();
+      return obj_.release();
+    }
+
     void save_replace_sock(const typename SCOPED_OBJ::base_type obj)
     {
       if (retain_obj_)
@@ -24,6 +24,9 @@
 
 #include <utility>
 
+#include <openvpn/common/platform.hpp>
+#include <openvpn/io/io.hpp>
+
 namespace openvpn {
 
   // This object supports that subset of the Asio stream
@@ -62,6 +65,39 @@ namespace openvpn {
       return tun_wrap->obj()->write_some(buffers);
     }
 
+    template <typename CONST_BUFFER>
+    std::size_t write_some(const CONST_BUFFER& buffers, openvpn_io::error_code& ec)
+    {
+      return tun_wrap->obj()->write_some(buffers, ec);
+    }
+
+#ifndef OPENVPN_PLATFORM_WIN
+    // used by TunIO::start_drain()
+    static constexpr openvpn_io::posix::descriptor_base::wait_type wait_read = openvpn_io::posix::descriptor_base::wait_read;
+
+    template <typename WAIT_TYPE, typename HANDLER>
+    void async_wait(const WAIT_TYPE w, HANDLER&& handler)
+    {
+      tun_wrap->obj()->async_wait(w, std::move(handler));
+    }
+
+    template <typename MUTABLE_BUFFER>
+    std::size_t read_some(const MUTABLE_BUFFER& buffers, openvpn_io::error_code& ec)
+    {
+      return tun_wrap->obj()->read_some(buffers, ec);
+    }
+
+    void non_blocking(const bool mode)
+    {
+      tun_wrap->obj()->non_blocking(mode);
+    }
+
+    int native_handle()
+    {
+      return tun_wrap->obj()->native_handle();
+    }
+#endif
+
     void cancel()
     {
       tun_wrap->obj()->cancel();
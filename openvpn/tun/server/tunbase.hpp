@@ -30,6 +30,7 @@
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/function.hpp>
 #include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/route.hpp>
 #include <openvpn/server/servhalt.hpp>
 
 namespace openvpn {
@@ -100,6 +101,13 @@ namespace openvpn {
       // set up relay to target
       virtual void relay(const IP::Addr& target, const int port) = 0;
 
+      // Register a VPN address assigned to this client, for tun
+      // implementations that route return traffic by address.
+      virtual void add_vpn_addr(const IP::Addr& addr) {}
+
+      // Register a network behind this client (iroute), likewise.
+      virtual void add_iroute(const IP::Route& route) {}
+
       virtual const std::string& tun_info() const = 0;
     };
 
@@ -71,31 +71,8 @@ namespace openvpn {
 	{
 	  try {
 	    // handle tun packet prefix, if enabled
-	    if (tun_prefix)
-	      {
-		if (buf.offset() >= 4 && buf.size() >= 1)
-		  {
-		    switch (IPCommon::version(buf[0]))
-		      {
-		      case 4:
-			prepend_pf_inet(buf, PF_INET);
-			break;
-		      case 6:
-			prepend_pf_inet(buf, PF_INET6);
-			break;
-		      default:
-			OPENVPN_LOG_TUN_ERROR("TUN write error: cannot identify IP version for prefix");
-			tun_error(Error::TUN_FRAMING_ERROR, nullptr);
-			return false;
-		      }
-		  }
-		else
-		  {
-		    OPENVPN_LOG_TUN_ERROR("TUN write error: cannot write prefix");
-		    tun_error(Error::TUN_FRAMING_ERROR, nullptr);
-		    return false;
-		  }
-	      }
+	    if (tun_prefix && !add_tun_prefix(buf))
+	      return false;
 
 	    // write data to tun device
 	    const size_t wrote = stream->write_some(buf.const_buffer());
@@ -138,7 +115,7 @@ namespace openvpn {
 		stats->inc_stat(SessionStats::TUN_BYTES_OUT, wrote);
 		stats->inc_stat(SessionStats::TUN_PACKETS_OUT, 1);
 	      }
-	    if (wrote == bs.size())
+	    if (wrote == openvpn_io::buffer_size(bs))
 	      return true;
 	    else
 	      {
@@ -159,6 +136,53 @@ namespace openvpn {
 	return false;
     }
 
+    // Write a burst of packets to the tun device.  The tun
+    // driver consumes exactly one packet per write, so packets
+    // are still written individually, but without per-packet
+    // exception handling and with stats updated once per burst.
+    // Returns the number of packets fully written.
+    size_t write_batch(BufferAllocated* bufs, const size_t n)
+    {
+      if (halt)
+	return 0;
+
+      size_t n_written = 0;
+      size_t bytes_written = 0;
+      for (size_t i = 0; i < n && !halt; ++i)
+	{
+	  BufferAllocated& buf = bufs[i];
+	  if (!buf.size())
+	    continue;
+
+	  // handle tun packet prefix, if enabled
+	  if (tun_prefix && !add_tun_prefix(buf))
+	    continue;
+
+	  openvpn_io::error_code ec;
+	  const size_t wrote = stream->write_some(buf.const_buffer(), ec);
+	  if (ec)
+	    {
+	      OPENVPN_LOG_TUN_ERROR("TUN write error: " << ec.message());
+	      tun_error(Error::TUN_WRITE_ERROR, &ec);
+	      continue;
+	    }
+	  bytes_written += wrote;
+	  if (wrote == buf.size())
+	    ++n_written;
+	  else
+	    {
+	      OPENVPN_LOG_TUN_ERROR("TUN partial write error");
+	      tun_error(Error::TUN_WRITE_ERROR, nullptr);
+	    }
+	}
+      if (stats)
+	{
+	  stats->inc_stat(SessionStats::TUN_BYTES_OUT, bytes_written);
+	  stats->inc_stat(SessionStats::TUN_PACKETS_OUT, n_written);
+	}
+      return n_written;
+    }
+
     void start(const int n_parallel)
     {
       if (!halt)
@@ -168,6 +192,21 @@ namespace openvpn {
 	}
     }
 
+    // Alternative to start() for descriptors that support
+    // asio async_wait() (Unix): wait for readability, then drain up
+    // to budget packets with non-blocking reads before going back
+    // through the reactor, rather than re-arming one async read per
+    // packet.
+    void start_drain(const unsigned int budget)
+    {
+      if (!halt)
+	{
+	  drain_budget = budget ? budget : 1;
+	  stream->non_blocking(true);
+	  queue_wait();
+	}
+    }
+
     // must be called by derived class destructor
     void stop()
     {
@@ -193,14 +232,39 @@ namespace openvpn {
       return name_;
     }
 
-  private:
+  protected:
+    bool add_tun_prefix(Buffer& buf)
+    {
+      if (buf.offset() >= 4 && buf.size() >= 1)
+	{
+	  switch (IPCommon::version(buf[0]))
+	    {
+	    case 4:
+	      prepend_pf_inet(buf, PF_INET);
+	      return true;
+	    case 6:
+	      prepend_pf_inet(buf, PF_INET6);
+	      return true;
+	    default:
+	      OPENVPN_LOG_TUN_ERROR("TUN write error: cannot identify IP version for prefix");
+	      tun_error(Error::TUN_FRAMING_ERROR, nullptr);
+	      return false;
+	    }
+	}
+      else
+	{
+	  OPENVPN_LOG_TUN_ERROR("TUN write error: cannot write prefix");
+	  tun_error(Error::TUN_FRAMING_ERROR, nullptr);
+	  return false;
+	}
+    }
+
     void prepend_pf_inet(Buffer& buf, const std::uint32_t value)
     {
       const std::uint32_t net_value = htonl(value);
       buf.prepend((unsigned char *)&net_value, sizeof(net_value));
     }
 
-  protected:
     void queue_read(PacketFrom *tunfrom)
     {
       OPENVPN_LOG_TUN_VERBOSE("TunIO::queue_read");
@@ -223,29 +287,7 @@ namespace openvpn {
       if (!halt)
 	{
 	  if (!error)
-	    {
-	      pfp->buf.set_size(bytes_recvd);
-	      if (stats)
-		{
-		  stats->inc_stat(SessionStats::TUN_BYTES_IN, bytes_recvd);
-		  stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
-		}
-	      if (!tun_prefix)
-		{
-		  read_handler->tun_read_handler(pfp);
-		}
-	      else if (pfp->buf.size() >= 4)
-		{
-		  // handle tun packet prefix, if enabled
-		  pfp->buf.advance(4);
-		  read_handler->tun_read_handler(pfp);
-		}
-	      else
-		{
-		  OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read prefix");
-		  tun_error(Error::TUN_READ_ERROR, nullptr);
-		}
-	    }
+	    deliver(pfp, bytes_recvd);
 	  else
 	    {
 	      OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << error.message());
@@ -256,6 +298,77 @@ namespace openvpn {
 	}
     }
 
+    void queue_wait()
+    {
+      OPENVPN_LOG_TUN_VERBOSE("TunIO::queue_wait");
+      stream->async_wait(STREAM::wait_read,
+			 [self=Ptr(this)](const openvpn_io::error_code& error)
+                         {
+                           OPENVPN_ASYNC_HANDLER;
+                           self->handle_wait(error);
+                         });
+    }
+
+    void handle_wait(const openvpn_io::error_code& error)
+    {
+      OPENVPN_LOG_TUN_VERBOSE("TunIO::handle_wait: " << error.message());
+      if (halt)
+	return;
+      if (error)
+	{
+	  OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << error.message());
+	  tun_error(Error::TUN_READ_ERROR, &error);
+	}
+      else
+	{
+	  for (unsigned int i = 0; i < drain_budget && !halt; ++i)
+	    {
+	      if (!drain_pfp)
+		drain_pfp.reset(new PacketFrom());
+	      frame_context.prepare(drain_pfp->buf);
+	      openvpn_io::error_code ec;
+	      const size_t len = stream->read_some(frame_context.mutable_buffer(drain_pfp->buf), ec);
+	      if (ec)
+		{
+		  if (ec != openvpn_io::error::would_block && ec != openvpn_io::error::try_again)
+		    {
+		      OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << ec.message());
+		      tun_error(Error::TUN_READ_ERROR, &ec);
+		    }
+		  break;
+		}
+	      deliver(drain_pfp, len); // may take ownership of drain_pfp
+	    }
+	}
+      if (!halt)
+	queue_wait();
+    }
+
+    void deliver(typename PacketFrom::SPtr& pfp, const size_t bytes_recvd)
+    {
+      pfp->buf.set_size(bytes_recvd);
+      if (stats)
+	{
+	  stats->inc_stat(SessionStats::TUN_BYTES_IN, bytes_recvd);
+	  stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+	}
+      if (!tun_prefix)
+	{
+	  read_handler->tun_read_handler(pfp);
+	}
+      else if (pfp->buf.size() >= 4)
+	{
+	  // handle tun packet prefix, if enabled
+	  pfp->buf.advance(4);
+	  read_handler->tun_read_handler(pfp);
+	}
+      else
+	{
+	  OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read prefix");
+	  tun_error(Error::TUN_READ_ERROR, nullptr);
+	}
+    }
+
     void tun_error(const Error::Type errtype, const openvpn_io::error_code* error)
     {
       if (stats)
@@ -274,6 +387,9 @@ namespace openvpn {
     const Frame::Ptr frame;
     const Frame::Context& frame_context;
     SessionStats::Ptr stats;
+
+    unsigned int drain_budget = 0;
+    typename PacketFrom::SPtr drain_pfp; // reused by handle_wait()
   };
 }
 
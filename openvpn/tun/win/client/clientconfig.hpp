@@ -56,6 +56,7 @@ namespace openvpn {
       TunProp::Config tun_prop;
       int n_parallel = 8;         // number of parallel async reads on tun socket
       bool wintun = false;
+      unsigned int wintun_spin_max_usec = 200; // max time to poll an empty Wintun ring before waiting, 0 to disable
 
       Frame::Ptr frame;
       SessionStats::Ptr stats;
@@ -71,6 +71,10 @@ namespace openvpn {
 			       std::ostream& os,
 			       RingBuffer::Ptr ring_buffer) override // defined by SetupBase
       {
+	// keep the WFP filters of the previous session until the
+	// new ones are installed
+	TunWin::WFPContext::Hold wfp_hold(*wfp, os);
+
 	// close out old remove cmds, if they exist
 	destroy(os);
 
@@ -307,6 +311,9 @@ namespace openvpn {
       {
 	// Windows interface index
 	const std::string tap_index_name = tap.index_or_name();
+	if (!tap.index_defined())
+	  throw tun_win_setup("TAP adapter has no interface index");
+	const DWORD tap_index = tap.index;
 
 	// special IPv6 next-hop recognized by TAP driver (magic)
 	const std::string ipv6_next_hop = "fe80::8";
@@ -330,26 +337,16 @@ namespace openvpn {
 
 	// Set IPv4 Interface
 	//
-	// Usage: set address [name=]<string>
-	//  [[source=]dhcp|static]
-	//  [[address=]<IPv4 address>[/<integer>] [[mask=]<IPv4 mask>]
-	//  [[gateway=]<IPv4 address>|none [gwmetric=]<integer>]
-	//  [[type=]unicast|anycast]
-	//  [[subinterface=]<string>]
-	//  [[store=]active|persistent]
-	// Usage: delete address [name=]<string> [[address=]<IPv4 address>]
-	//  [[gateway=]<IPv4 address>|all]
-	//  [[store=]active|persistent]
+	// Addresses, routes and the interface metric are set with the
+	// IP Helper API (see Util::ActionRoute), the rest with netsh.
 	if (local4)
 	  {
 	    // Process ifconfig and topology
 	    if (!l2_post)
 	      {
 		// set lowest interface metric to make Windows use pushed DNS search domain
-		create.add(new WinCmd("netsh interface ip set interface " + tap_index_name + " metric=1"));
+		create.add(new Util::ActionInterfaceMetric(tap_index, AF_INET, 1));
 
-		const std::string metric = route_metric_opt(pull, *local4, MT_IFACE);
-		const std::string netmask = IPv4::Addr::netmask_from_prefix_len(local4->prefix_length).to_string();
 		const IP::Addr localaddr = IP::Addr::from_string(local4->address);
 		const IP::Addr remoteaddr = IP::Addr::from_string(local4->gateway);
 		if (!wintun)
@@ -359,13 +356,16 @@ namespace openvpn {
 		    else
 		      Util::tap_configure_topology_subnet(th, localaddr, local4->prefix_length);
 		  }
-		create.add(new WinCmd("netsh interface ip set address " + tap_index_name + " static " + local4->address + ' ' + netmask + " gateway=" + local4->gateway + metric + " store=active"));
-		destroy.add(new WinCmd("netsh interface ip delete address " + tap_index_name + ' ' + local4->address + " gateway=all store=active"));
+		create.add(new Util::ActionUnicastAddress(localaddr, local4->prefix_length, tap_index, true));
+		destroy.add(new Util::ActionUnicastAddress(localaddr, local4->prefix_length, tap_index, false));
 
-		// specifying 'gateway' when setting ip address makes Windows add unnecessary route 0.0.0.0/0,
-		// which might cause routing conflicts, so we have to delete it after a small delay.
+		// Windows needs a default gateway on the interface to create a network
+		// profile for it, but the 0.0.0.0/0 route might cause routing conflicts,
+		// so we have to delete it after a small delay.
 		// If route is deleted before profile is created, then profile won't be created at all (OVPN-135)
-		WinCmd::Ptr cmd = new WinCmd("netsh interface ip delete route 0.0.0.0/0 " + tap_index_name + ' ' + local4->gateway + " store=active");
+		const IP::Route default_route = IP::Route::from_string("0.0.0.0/0");
+		create.add(new Util::ActionRoute(default_route, tap_index, remoteaddr, route_metric(pull, *local4), true));
+		Action::Ptr cmd = new Util::ActionRoute(default_route, tap_index, remoteaddr, -1, false);
 		delete_route_timer.expires_after(Time::Duration::seconds(5));
 		delete_route_timer.async_wait([self=Ptr(this), cmd=std::move(cmd)](const openvpn_io::error_code& error)
 					      {
@@ -388,69 +388,40 @@ namespace openvpn {
 	    };
 	    for (size_t i = 0; i < array_size(block_ipv6_net); ++i)
 	      {
-		create.add(new WinCmd("netsh interface ipv6 add route " + std::string(block_ipv6_net[i]) + " interface=1 store=active"));
-		destroy.add(new WinCmd("netsh interface ipv6 delete route " + std::string(block_ipv6_net[i]) + " interface=1 store=active"));
+		// loopback interface
+		add_route(create, destroy, IP::Route::from_string(block_ipv6_net[i]), 1, IP::Addr(), -1);
 	      }
 	  }
 
 	// Set IPv6 Interface
 	//
-	// Usage: set address [interface=]<string> [address=]<IPv6 address>
-	//  [[type=]unicast|anycast]
-	//  [[validlifetime=]<integer>|infinite]
-	//  [[preferredlifetime=]<integer>|infinite]
-	//  [[store=]active|persistent]
-	//Usage: delete address [interface=]<string> [address=]<IPv6 address>
-	//  [[store=]active|persistent]
+	// The address is added without an on-link prefix, the route
+	// to the VPN subnet goes through the TAP magic next-hop.
 	if (local6 && !pull.block_ipv6 && !l2_post)
 	  {
-	    create.add(new WinCmd("netsh interface ipv6 set address " + tap_index_name + ' ' + local6->address + " store=active"));
-	    destroy.add(new WinCmd("netsh interface ipv6 delete address " + tap_index_name + ' ' + local6->address + " store=active"));
+	    const IP::Addr localaddr6 = IP::Addr::from_string(local6->address);
+	    create.add(new Util::ActionUnicastAddress(localaddr6, 128, tap_index, true));
+	    destroy.add(new Util::ActionUnicastAddress(localaddr6, 128, tap_index, false));
 
-	    create.add(new WinCmd("netsh interface ipv6 add route " + local6->gateway + '/' + to_string(local6->prefix_length) + ' ' + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
-	    destroy.add(new WinCmd("netsh interface ipv6 delete route " + local6->gateway + '/' + to_string(local6->prefix_length) + ' ' + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
+	    add_route(create, destroy, IP::Route(IP::Addr::from_string(local6->gateway), local6->prefix_length),
+		      tap_index, IP::Addr::from_string(ipv6_next_hop), -1);
 	  }
 
 	// Process Routes
-	//
-	// Usage: add route [prefix=]<IPv4 address>/<integer> [interface=]<string>
-	//  [[nexthop=]<IPv4 address>] [[siteprefixlength=]<integer>]
-	//  [[metric=]<integer>] [[publish=]no|age|yes]
-	//  [[validlifetime=]<integer>|infinite]
-	//  [[preferredlifetime=]<integer>|infinite]
-	//  [[store=]active|persistent]
-	// Usage: delete route [prefix=]<IPv4 address>/<integer> [interface=]<string>
-	//  [[nexthop=]<IPv4 address>]
-	//  [[store=]active|persistent]
-	//
-	// Usage: add route [prefix=]<IPv6 address>/<integer> [interface=]<string>
-	//  [[nexthop=]<IPv6 address>] [[siteprefixlength=]<integer>]
-	//  [[metric=]<integer>] [[publish=]no|age|yes]
-	//  [[validlifetime=]<integer>|infinite]
-	//  [[preferredlifetime=]<integer>|infinite]
-	//  [[store=]active|persistent]
-	// Usage: delete route [prefix=]<IPv6 address>/<integer> [interface=]<string>
-	//  [[nexthop=]<IPv6 address>]
-	//  [[store=]active|persistent]
 	{
 	  for (auto &route : pull.add_routes)
 	    {
-	      const std::string metric = route_metric_opt(pull, route, MT_NETSH);
 	      if (route.ipv6)
 		{
 		  if (!pull.block_ipv6)
-		    {
-		      create.add(new WinCmd("netsh interface ipv6 add route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + ipv6_next_hop + metric + " store=active"));
-		      destroy.add(new WinCmd("netsh interface ipv6 delete route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
-		    }
+		    add_route(create, destroy, route_of(route), tap_index,
+			      IP::Addr::from_string(ipv6_next_hop), route_metric(pull, route));
 		}
 	      else
 		{
 		  if (local4)
-		    {
-		      create.add(new WinCmd("netsh interface ip add route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + local4->gateway + metric + " store=active"));
-		      destroy.add(new WinCmd("netsh interface ip delete route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + local4->gateway + " store=active"));
-		    }
+		    add_route(create, destroy, route_of(route), tap_index,
+			      IP::Addr::from_string(local4->gateway), route_metric(pull, route));
 		  else
 		    throw tun_win_setup("IPv4 routes pushed without IPv4 ifconfig");
 		}
@@ -465,16 +436,13 @@ namespace openvpn {
 		bool ipv6_error = false;
 		for (auto &route : pull.exclude_routes)
 		  {
-		    const std::string metric = route_metric_opt(pull, route, MT_NETSH);
 		    if (route.ipv6)
 		      {
 			ipv6_error = true;
 		      }
 		    else
-		      {
-			create.add(new WinCmd("netsh interface ip add route " + route.address + '/' + to_string(route.prefix_length) + ' ' + to_string(gw.interface_index()) + ' ' + gw.gateway_address() + metric + " store=active"));
-			destroy.add(new WinCmd("netsh interface ip delete route " + route.address + '/' + to_string(route.prefix_length) + ' ' + to_string(gw.interface_index()) + ' ' + gw.gateway_address() + " store=active"));
-		      }
+		      add_route(create, destroy, route_of(route), gw.interface_index(),
+				IP::Addr::from_string(gw.gateway_address()), route_metric(pull, route));
 		  }
 		if (ipv6_error)
 		  os << "NOTE: exclude IPv6 routes not currently supported" << std::endl;
@@ -490,27 +458,23 @@ namespace openvpn {
 	    if (gw.defined())
 	      {
 		if (!pull.remote_address.ipv6)
-		  {
-		    create.add(new WinCmd("netsh interface ip add route " + pull.remote_address.address + "/32 " + to_string(gw.interface_index()) + ' ' + gw.gateway_address() + " store=active"));
-		    destroy.add(new WinCmd("netsh interface ip delete route " + pull.remote_address.address + "/32 " + to_string(gw.interface_index()) + ' ' + gw.gateway_address() + " store=active"));
-		  }
+		  add_route(create, destroy, IP::Route(IP::Addr::from_string(pull.remote_address.address), 32),
+			    gw.interface_index(), IP::Addr::from_string(gw.gateway_address()), -1);
 	      }
 	    else
 	      throw tun_win_setup("redirect-gateway error: cannot detect default gateway");
 
-	    create.add(new WinCmd("netsh interface ip add route 0.0.0.0/1 " + tap_index_name + ' ' + local4->gateway + " store=active"));
-	    create.add(new WinCmd("netsh interface ip add route 128.0.0.0/1 " + tap_index_name + ' ' + local4->gateway + " store=active"));
-	    destroy.add(new WinCmd("netsh interface ip delete route 0.0.0.0/1 " + tap_index_name + ' ' + local4->gateway + " store=active"));
-	    destroy.add(new WinCmd("netsh interface ip delete route 128.0.0.0/1 " + tap_index_name + ' ' + local4->gateway + " store=active"));
+	    const IP::Addr gw4 = IP::Addr::from_string(local4->gateway);
+	    add_route(create, destroy, IP::Route::from_string("0.0.0.0/1"), tap_index, gw4, -1);
+	    add_route(create, destroy, IP::Route::from_string("128.0.0.0/1"), tap_index, gw4, -1);
 	  }
 
 	// Process IPv6 redirect-gateway
 	if (pull.reroute_gw.ipv6 && !pull.block_ipv6)
 	  {
-	    create.add(new WinCmd("netsh interface ipv6 add route 0::/1 " + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
-	    create.add(new WinCmd("netsh interface ipv6 add route 8000::/1 " + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
-	    destroy.add(new WinCmd("netsh interface ipv6 delete route 0::/1 " + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
-	    destroy.add(new WinCmd("netsh interface ipv6 delete route 8000::/1 " + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
+	    const IP::Addr gw6 = IP::Addr::from_string(ipv6_next_hop);
+	    add_route(create, destroy, IP::Route::from_string("::/1"), tap_index, gw6, -1);
+	    add_route(create, destroy, IP::Route::from_string("8000::/1"), tap_index, gw6, -1);
 	  }
 
 	// Process DNS Servers
@@ -881,13 +845,37 @@ namespace openvpn {
 	MT_IFACE,
       };
 
+      static IP::Route route_of(const TunBuilderCapture::RouteBase& route)
+      {
+	return IP::Route(IP::Addr::from_string(route.address), route.prefix_length);
+      }
+
+      // add route on create, remove it on destroy
+      static void add_route(ActionList& create,
+			    ActionList& destroy,
+			    const IP::Route& route,
+			    const DWORD iface_index,
+			    const IP::Addr& next_hop,
+			    const int metric)
+      {
+	create.add(new Util::ActionRoute(route, iface_index, next_hop, metric, true));
+	destroy.add(new Util::ActionRoute(route, iface_index, next_hop, -1, false));
+      }
+
+      // route metric, or -1 for the system default
+      static int route_metric(const TunBuilderCapture& pull,
+			      const TunBuilderCapture::RouteBase& route)
+      {
+	if (route.metric >= 0)
+	  return route.metric;
+	return pull.route_metric_default;
+      }
+
       static std::string route_metric_opt(const TunBuilderCapture& pull,
 					  const TunBuilderCapture::RouteBase& route,
 					  const MetricType mt)
       {
-	int metric = pull.route_metric_default;
-	if (route.metric >= 0)
-	  metric = route.metric;
+	const int metric = route_metric(pull, route);
 	if (metric >= 0)
 	  {
 	    switch (mt)
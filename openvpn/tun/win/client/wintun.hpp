@@ -1,5 +1,8 @@
 #pragma once
 
+#include <chrono>
+#include <algorithm>
+
 #include <openvpn/tun/client/tunbase.hpp>
 #include <openvpn/tun/persist/tunpersist.hpp>
 #include <openvpn/tun/win/client/setupbase.hpp>
@@ -124,43 +127,34 @@ namespace openvpn {
 
       }
 
+      // Packets are written into the receive ring right away, but
+      // the new tail is published (and the driver woken) once per
+      // pass through the io_context, so that all the packets
+      // decrypted from a burst of UDP completions share one commit.
       bool tun_send(BufferAllocated& buf) override
       {
-	TUN_RING* receive_ring = ring_buffer->receive_ring();
-
-	ULONG head = receive_ring->head.load(std::memory_order_acquire);
-	if (head > WINTUN_RING_CAPACITY)
-	  {
-	    if (head == 0xFFFFFFFF)
-	      parent.tun_error(Error::TUN_WRITE_ERROR, "invalid ring head/tail or bogus packet received");
-	    return false;
-	  }
-
-	ULONG tail = receive_ring->tail.load(std::memory_order_acquire);
-	if (tail >= WINTUN_RING_CAPACITY)
+	if (!write_ring(&buf, 1))
 	  return false;
-
-	ULONG aligned_packet_size = packet_align(sizeof(TUN_PACKET_HEADER) + buf.size());
-	ULONG buf_space = wrap(head - tail - WINTUN_PACKET_ALIGN);
-	if (aligned_packet_size > buf_space)
+	if (n_pending >= COMMIT_MAX)
+	  commit_ring();
+	else if (!commit_queued)
 	  {
-	    OPENVPN_LOG("ring is full");
-	    return false;
+	    commit_queued = true;
+	    openvpn_io::post(io_context, [self=Ptr(this)]() {
+	      self->commit_queued = false;
+	      self->commit_ring();
+	    });
 	  }
-
-	// copy packet size and data into ring
-	TUN_PACKET* packet = (TUN_PACKET*)& receive_ring->data[tail];
-	packet->size = buf.size();
-	std::memcpy(packet->data, buf.data(), buf.size());
-
-	// move ring tail
-	receive_ring->tail.store(wrap(tail + aligned_packet_size), std::memory_order_release);
-	if (receive_ring->alertable.load(std::memory_order_acquire) != 0)
-	  SetEvent(ring_buffer->receive_ring_tail_moved());
-
 	return true;
       }
 
+      size_t tun_send_batch(BufferAllocated* bufs, const size_t n) override
+      {
+	const size_t n_sent = write_ring(bufs, n);
+	commit_ring();
+	return n_sent;
+      }
+
       std::string tun_name() const override
       {
 	return "wintun";
@@ -220,20 +214,14 @@ namespace openvpn {
 	    return;
 	  }
 
+	bool got_packets = false;
 	while (true)
 	  {
 	    // tail has moved?
 	    if (head == tail)
 	      {
-		ring_buffer->send_tail_moved_asio_event().async_wait([self = Ptr(this)](const openvpn_io::error_code& error) {
-		  if (!error)
-		    self->read();
-		  else
-		    {
-		      if (!self->halt)
-			self->parent.tun_error(Error::TUN_ERROR, "error waiting on ring send tail moved");
-		    }
-		});
+		if (!spin(got_packets))
+		  wait_tail_moved(head);
 		return;
 	      }
 
@@ -267,12 +255,140 @@ namespace openvpn {
 	    send_ring->head.store(head, std::memory_order_release);
 
 	    parent.tun_recv(buf);
+	    got_packets = true;
 
 	    if (halt)
 	      return;
 	  }
       }
 
+      // Like the Wintun reference client, keep polling the ring for a
+      // short while after it runs empty, since under load the next
+      // packet usually arrives sooner than an event wakeup would.
+      // The spin window doubles each time it catches a packet and
+      // halves each time it expires, bounded by wintun_spin_max_usec.
+      // Each poll is a posted handler, so transport reads still run
+      // on this io_context in between.  Returns false when it's time
+      // to block on the event.
+      bool spin(const bool got_packets)
+      {
+	const unsigned int spin_max = config->wintun_spin_max_usec;
+	if (!spin_max)
+	  return false;
+
+	const auto now = std::chrono::steady_clock::now();
+	if (got_packets)
+	  {
+	    if (spinning)
+	      spin_usec = std::min(spin_usec * 2, spin_max);
+	    spinning = true;
+	    spin_deadline = now + std::chrono::microseconds(spin_usec);
+	  }
+	if (spinning)
+	  {
+	    if (now < spin_deadline)
+	      {
+		openvpn_io::post(io_context, [self=Ptr(this)]() {
+		  self->read();
+		});
+		return true;
+	      }
+	    spinning = false;
+	    spin_usec = std::max(spin_usec / 2, std::min((unsigned int)SPIN_MIN_USEC, spin_max));
+	  }
+	return false;
+      }
+
+      void wait_tail_moved(const ULONG head)
+      {
+	TUN_RING* send_ring = ring_buffer->send_ring();
+
+	// ask the driver to signal the next tail move, and recheck
+	// the tail to close the race with a packet that came in
+	// before it saw the flag
+	send_ring->alertable.store(1, std::memory_order_seq_cst);
+	if (send_ring->tail.load(std::memory_order_seq_cst) != head)
+	  {
+	    send_ring->alertable.store(0, std::memory_order_release);
+	    openvpn_io::post(io_context, [self=Ptr(this)]() {
+	      self->read();
+	    });
+	    return;
+	  }
+
+	ring_buffer->send_tail_moved_asio_event().async_wait([self = Ptr(this)](const openvpn_io::error_code& error) {
+	  self->ring_buffer->send_ring()->alertable.store(0, std::memory_order_release);
+	  if (!error)
+	    self->read();
+	  else
+	    {
+	      if (!self->halt)
+		self->parent.tun_error(Error::TUN_ERROR, "error waiting on ring send tail moved");
+	    }
+	});
+      }
+
+      // Copy packets into the receive ring after the last written
+      // (but maybe not yet published) packet, returns number written.
+      size_t write_ring(BufferAllocated* bufs, const size_t n)
+      {
+	TUN_RING* receive_ring = ring_buffer->receive_ring();
+
+	ULONG head = receive_ring->head.load(std::memory_order_acquire);
+	if (head > WINTUN_RING_CAPACITY)
+	  {
+	    if (head == 0xFFFFFFFF)
+	      parent.tun_error(Error::TUN_WRITE_ERROR, "invalid ring head/tail or bogus packet received");
+	    return 0;
+	  }
+
+	ULONG tail = pending_tail;
+	if (!n_pending)
+	  {
+	    tail = receive_ring->tail.load(std::memory_order_acquire);
+	    if (tail >= WINTUN_RING_CAPACITY)
+	      return 0;
+	  }
+
+	ULONG buf_space = wrap(head - tail - WINTUN_PACKET_ALIGN);
+	size_t n_sent = 0;
+	for (; n_sent < n; ++n_sent)
+	  {
+	    const BufferAllocated& buf = bufs[n_sent];
+	    ULONG aligned_packet_size = packet_align(sizeof(TUN_PACKET_HEADER) + buf.size());
+	    if (aligned_packet_size > buf_space)
+	      {
+		OPENVPN_LOG("ring is full");
+		break;
+	      }
+
+	    // copy packet size and data into ring
+	    TUN_PACKET* packet = (TUN_PACKET*)& receive_ring->data[tail];
+	    packet->size = buf.size();
+	    std::memcpy(packet->data, buf.c_data(), buf.size());
+
+	    tail = wrap(tail + aligned_packet_size);
+	    buf_space -= aligned_packet_size;
+	  }
+
+	pending_tail = tail;
+	n_pending += n_sent;
+	return n_sent;
+      }
+
+      // move ring tail past the written packets
+      void commit_ring()
+      {
+	if (!n_pending)
+	  return;
+	n_pending = 0;
+
+	TUN_RING* receive_ring = ring_buffer->receive_ring();
+	receive_ring->tail.store(pending_tail, std::memory_order_release);
+	if (receive_ring->alertable.load(std::memory_order_acquire) != 0)
+	  SetEvent(ring_buffer->receive_ring_tail_moved());
+      }
+
       struct TUN_PACKET_HEADER
       {
 	uint32_t size;
@@ -310,6 +426,19 @@ namespace openvpn {
 
       bool halt = false;
 
+      enum {
+	SPIN_MIN_USEC = 10,
+	COMMIT_MAX = 64, // max packets written to the receive ring before publishing the tail
+      };
+
+      ULONG pending_tail = 0;
+      size_t n_pending = 0;
+      bool commit_queued = false;
+
+      bool spinning = false;
+      unsigned int spin_usec = SPIN_MIN_USEC;
+      std::chrono::steady_clock::time_point spin_deadline;
+
       ScopedHANDLE driver_handle;
 
       RingBuffer::Ptr ring_buffer;
@@ -59,6 +59,7 @@
 #include <openvpn/common/uniqueptr.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
 #include <openvpn/tun/builder/capture.hpp>
 #include <openvpn/win/reg.hpp>
 #include <openvpn/win/scoped_handle.hpp>
@@ -1060,6 +1061,207 @@ namespace openvpn {
 	else
 	  return nullptr;
       }
+
+      inline void to_sockaddr_inet(SOCKADDR_INET& sa, const IP::Addr& addr)
+      {
+	if (addr.is_ipv6())
+	  {
+	    sa.Ipv6 = addr.to_ipv6().to_sockaddr();
+	    sa.si_family = AF_INET6;
+	  }
+	else
+	  {
+	    sa.Ipv4 = addr.to_ipv4().to_sockaddr();
+	    sa.si_family = AF_INET;
+	  }
+      }
+
+      // An action to add or delete a route with the IP Helper API,
+      // rather than by spawning netsh, which costs tens of milliseconds
+      // per route.  A run of route actions in an ActionList is applied
+      // by one execute() call.
+      class ActionRoute : public Action
+      {
+      public:
+	typedef RCPtr<ActionRoute> Ptr;
+
+	// next_hop undefined for an on-link route, metric < 0 for the
+	// default
+	ActionRoute(const IP::Route& route_arg,
+		    const DWORD iface_index_arg,
+		    const IP::Addr& next_hop_arg,
+		    const int metric_arg,
+		    const bool add_arg)
+	  : route(route_arg),
+	    iface_index(iface_index_arg),
+	    next_hop(next_hop_arg),
+	    metric(metric_arg),
+	    add(add_arg)
+	{
+	}
+
+	virtual bool batch_add(const Action::Ptr& other) override
+	{
+	  if (!dynamic_cast<const ActionRoute*>(other.get()))
+	    return false;
+	  batch.push_back(other);
+	  return true;
+	}
+
+	virtual void execute(std::ostream& os) override
+	{
+	  std::vector<Action::Ptr> others;
+	  others.swap(batch);
+	  apply(os);
+	  for (const auto& a : others)
+	    static_cast<const ActionRoute&>(*a).apply(os);
+	}
+
+	virtual std::string to_string() const override
+	{
+	  std::string ret = std::string("IP Helper ") + (add ? "add" : "delete") + " route " + route.to_string()
+	    + " iface=" + openvpn::to_string(iface_index);
+	  if (next_hop.defined())
+	    ret += " nexthop=" + next_hop.to_string();
+	  if (add && metric >= 0)
+	    ret += " metric=" + openvpn::to_string(metric);
+	  return ret;
+	}
+
+      private:
+	void apply(std::ostream& os) const
+	{
+	  os << to_string() << std::endl;
+
+	  MIB_IPFORWARD_ROW2 row;
+	  ::InitializeIpForwardEntry(&row);
+	  row.InterfaceIndex = iface_index;
+	  to_sockaddr_inet(row.DestinationPrefix.Prefix, route.addr);
+	  row.DestinationPrefix.PrefixLength = (UINT8)route.prefix_len;
+	  if (next_hop.defined())
+	    to_sockaddr_inet(row.NextHop, next_hop);
+	  else
+	    row.NextHop.si_family = row.DestinationPrefix.Prefix.si_family;
+	  row.Protocol = MIB_IPPROTO_NETMGMT;
+	  if (metric >= 0)
+	    row.Metric = metric;
+
+	  const DWORD status = add ? ::CreateIpForwardEntry2(&row) : ::DeleteIpForwardEntry2(&row);
+	  if (status != NO_ERROR
+	      && !(add && status == ERROR_OBJECT_ALREADY_EXISTS)
+	      && !(!add && status == ERROR_NOT_FOUND))
+	    {
+	      const Win::Error err(status);
+	      os << "ActionRoute: " << to_string() << ": " << err.message() << std::endl;
+	    }
+	}
+
+	const IP::Route route;
+	const DWORD iface_index;
+	const IP::Addr next_hop;
+	const int metric;
+	const bool add;
+	std::vector<Action::Ptr> batch;
+      };
+
+      // An action to add or delete an interface address with the IP
+      // Helper API.  prefix_len gives the on-link route that Windows
+      // adds with the address.
+      class ActionUnicastAddress : public Action
+      {
+      public:
+	ActionUnicastAddress(const IP::Addr& addr_arg,
+			     const unsigned int prefix_len_arg,
+			     const DWORD iface_index_arg,
+			     const bool add_arg)
+	  : addr(addr_arg),
+	    prefix_len(prefix_len_arg),
+	    iface_index(iface_index_arg),
+	    add(add_arg)
+	{
+	}
+
+	virtual void execute(std::ostream& os) override
+	{
+	  os << to_string() << std::endl;
+
+	  MIB_UNICASTIPADDRESS_ROW row;
+	  ::InitializeUnicastIpAddressEntry(&row);
+	  row.InterfaceIndex = iface_index;
+	  to_sockaddr_inet(row.Address, addr);
+	  row.OnLinkPrefixLength = (UINT8)prefix_len;
+
+	  const DWORD status = add ? ::CreateUnicastIpAddressEntry(&row) : ::DeleteUnicastIpAddressEntry(&row);
+	  if (status != NO_ERROR
+	      && !(add && status == ERROR_OBJECT_ALREADY_EXISTS)
+	      && !(!add && status == ERROR_NOT_FOUND))
+	    {
+	      const Win::Error err(status);
+	      OPENVPN_THROW(tun_win_util, "ActionUnicastAddress: " << to_string() << ": " << err.message());
+	    }
+	}
+
+	virtual std::string to_string() const override
+	{
+	  return std::string("IP Helper ") + (add ? "add" : "delete") + " address " + addr.to_string()
+	    + '/' + openvpn::to_string(prefix_len) + " iface=" + openvpn::to_string(iface_index);
+	}
+
+      private:
+	const IP::Addr addr;
+	const unsigned int prefix_len;
+	const DWORD iface_index;
+	const bool add;
+      };
+
+      // An action to set a fixed interface metric with the IP Helper API
+      class ActionInterfaceMetric : public Action
+      {
+      public:
+	ActionInterfaceMetric(const DWORD iface_index_arg,
+			      const ADDRESS_FAMILY af_arg,
+			      const ULONG metric_arg)
+	  : iface_index(iface_index_arg),
+	    af(af_arg),
+	    metric(metric_arg)
+	{
+	}
+
+	virtual void execute(std::ostream& os) override
+	{
+	  os << to_string() << std::endl;
+
+	  MIB_IPINTERFACE_ROW row;
+	  ::InitializeIpInterfaceEntry(&row);
+	  row.InterfaceIndex = iface_index;
+	  row.Family = af;
+	  DWORD status = ::GetIpInterfaceEntry(&row);
+	  if (status == NO_ERROR)
+	    {
+	      row.UseAutomaticMetric = FALSE;
+	      row.Metric = metric;
+	      if (af == AF_INET)
+		row.SitePrefixLength = 0; // must be 0 for IPv4, or SetIpInterfaceEntry fails
+	      status = ::SetIpInterfaceEntry(&row);
+	    }
+	  if (status != NO_ERROR)
+	    {
+	      const Win::Error err(status);
+	      os << "ActionInterfaceMetric: " << to_string() << ": " << err.message() << std::endl;
+	    }
+	}
+
+	virtual std::string to_string() const override
+	{
+	  return std::string("IP Helper set interface ") + openvpn::to_string(iface_index)
+	    + (af == AF_INET6 ? " ipv6" : " ipv4") + " metric=" + openvpn::to_string(metric);
+	}
+
+      private:
+	const DWORD iface_index;
+	const ADDRESS_FAMILY af;
+	const ULONG metric;
+      };
 #endif
 
       // Get the current default gateway
@@ -1156,7 +1358,13 @@ namespace openvpn {
 		      if (net_str == "255.255.255.255" && pl == 32)
 			continue;
 
+#if _WIN32_WINNT >= 0x0600 // Vista and higher
+		      actions.add(new ActionRoute(IP::Route(IP::Addr::from_ipv4(net), pl), index,
+						  IP::Addr::from_ipv4(IPv4::Addr::from_uint32(ntohl(row->dwForwardNextHop))),
+						  -1, false));
+#else
 		      actions.add(new WinCmd("netsh interface ip delete route " + net_str + '/' + openvpn::to_string(pl) + ' ' + openvpn::to_string(index) + " store=active"));
+#endif
 		    }
 		}
 	    }
@@ -1187,7 +1395,14 @@ namespace openvpn {
 			    continue;
 			  if ((net & ll_mask) == ll_net && pl >= 64)
 			    continue;
-			  actions.add(new WinCmd("netsh interface ipv6 delete route " + net_str + '/' + openvpn::to_string(pl) + ' ' + openvpn::to_string(index) + " store=active"));
+			  IP::Addr next_hop;
+			  if (row->NextHop.si_family == AF_INET6)
+			    {
+			      const IPv6::Addr nh = IPv6::Addr::from_byte_string(row->NextHop.Ipv6.sin6_addr.u.Byte);
+			      if (!nh.unspecified())
+				next_hop = IP::Addr::from_ipv6(nh);
+			    }
+			  actions.add(new ActionRoute(IP::Route(IP::Addr::from_ipv6(net), pl), index, next_hop, -1, false));
 			}
 		    }
 		}
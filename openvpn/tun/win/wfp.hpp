@@ -23,6 +23,7 @@
 #define OPENVPN_TUN_WIN_WFP_H
 
 #include <ostream>
+#include <vector>
 
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/wstring.hpp>
@@ -48,100 +49,130 @@ namespace openvpn {
       // Block DNS from all apps except openvpn_app_path and
       // from all interfaces except tap_index.
       // Derived from https://github.com/ValdikSS/openvpn-with-patches/commit/3bd4d503d21aa34636e4f97b3e32ae0acca407f0
+      //
+      // The filters are added in a single transaction.  Filters left
+      // from an earlier call are kept, only the ones depending on a
+      // changed openvpn_app_path or tap_index are replaced.
       void block_dns(const std::wstring& openvpn_app_path,
 		     const NET_IFINDEX tap_index,
 		     std::ostream& log)
       {
+	Transaction transaction(engineHandle());
+
+	// Populate packet filter layer information
+	if (!sublayer_added)
+	  {
+	    FWPM_SUBLAYER0 subLayer = {0};
+	    subLayer.subLayerKey = subLayerGUID;
+	    subLayer.displayData.name = L"OpenVPN";
+	    subLayer.displayData.description = L"OpenVPN";
+	    subLayer.flags = 0;
+	    subLayer.weight = 0x100;
+
+	    // Add packet filter to interface
+	    const DWORD status = ::FwpmSubLayerAdd0(engineHandle(), &subLayer, NULL);
+	    if (status != ERROR_SUCCESS)
+	      OPENVPN_THROW(wfp_error, "FwpmSubLayerAdd0 failed with status=0x" << std::hex << status);
+	    sublayer_added = true;
+	  }
+
 	// WFP filter/conditions
 	FWPM_FILTER0 filter = {0};
 	FWPM_FILTER_CONDITION0 condition[2] = {0};
-	UINT64 filterid = 0;
-
-	// Get NET_LUID object for adapter
-	NET_LUID tap_luid = adapter_index_to_luid(tap_index);
-
-	// Get app ID
-	unique_ptr_del<FWP_BYTE_BLOB> openvpn_app_id_blob = get_app_id_blob(openvpn_app_path);
-
-	// Populate packet filter layer information
-	{
-	  FWPM_SUBLAYER0 subLayer = {0};
-	  subLayer.subLayerKey = subLayerGUID;
-	  subLayer.displayData.name = L"OpenVPN";
-	  subLayer.displayData.description = L"OpenVPN";
-	  subLayer.flags = 0;
-	  subLayer.weight = 0x100;
-
-	  // Add packet filter to interface
-	  const DWORD status = ::FwpmSubLayerAdd0(engineHandle(), &subLayer, NULL);
-	  if (status != ERROR_SUCCESS)
-	    OPENVPN_THROW(wfp_error, "FwpmSubLayerAdd0 failed with status=0x" << std::hex << status);
-	}
 
 	// Prepare filter
 	filter.subLayerKey = subLayerGUID;
 	filter.displayData.name = L"OpenVPN";
-	filter.weight.type = FWP_UINT8;
-	filter.weight.uint8 = 0xF;
 	filter.filterCondition = condition;
 
-	// Filter #1 -- permit IPv4 DNS requests from OpenVPN app
-	filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V4;
-	filter.action.type = FWP_ACTION_PERMIT;
-	filter.numFilterConditions = 2;
-
 	condition[0].fieldKey = FWPM_CONDITION_IP_REMOTE_PORT;
 	condition[0].matchType = FWP_MATCH_EQUAL;
 	condition[0].conditionValue.type = FWP_UINT16;
 	condition[0].conditionValue.uint16 = 53;
 
-	condition[1].fieldKey = FWPM_CONDITION_ALE_APP_ID;
-	condition[1].matchType = FWP_MATCH_EQUAL;
-	condition[1].conditionValue.type = FWP_BYTE_BLOB_TYPE;
-	condition[1].conditionValue.byteBlob = openvpn_app_id_blob.get();
+	if (app_filters.empty() || openvpn_app_path != app_path)
+	  {
+	    delete_filters(app_filters);
 
-	add_filter(&filter, NULL, &filterid);
-	log << "permit IPv4 DNS requests from OpenVPN app" << std::endl;
+	    // Get app ID
+	    if (!app_id_blob || openvpn_app_path != app_path)
+	      {
+		app_id_blob = get_app_id_blob(openvpn_app_path);
+		app_path = openvpn_app_path;
+	      }
 
-	// Filter #2 -- permit IPv6 DNS requests from OpenVPN app
-	filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V6;
+	    filter.weight.type = FWP_UINT8;
+	    filter.weight.uint8 = 0xF;
 
-	add_filter(&filter, NULL, &filterid);
-	log << "permit IPv6 DNS requests from OpenVPN app" << std::endl;
+	    // Filter #1 -- permit IPv4 DNS requests from OpenVPN app
+	    filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V4;
+	    filter.action.type = FWP_ACTION_PERMIT;
+	    filter.numFilterConditions = 2;
+
+	    condition[1].fieldKey = FWPM_CONDITION_ALE_APP_ID;
+	    condition[1].matchType = FWP_MATCH_EQUAL;
+	    condition[1].conditionValue.type = FWP_BYTE_BLOB_TYPE;
+	    condition[1].conditionValue.byteBlob = app_id_blob.get();
+
+	    add_filter(&filter, NULL, app_filters);
+	    log << "permit IPv4 DNS requests from OpenVPN app" << std::endl;
+
+	    // Filter #2 -- permit IPv6 DNS requests from OpenVPN app
+	    filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V6;
+
+	    add_filter(&filter, NULL, app_filters);
+	    log << "permit IPv6 DNS requests from OpenVPN app" << std::endl;
+	  }
 
-	// Filter #3 -- block IPv4 DNS requests from other apps
-	filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V4;
-	filter.action.type = FWP_ACTION_BLOCK;
 	filter.weight.type = FWP_EMPTY;
-	filter.numFilterConditions = 1;
 
-	add_filter(&filter, NULL, &filterid);
-	log << "block IPv4 DNS requests from other apps" << std::endl;
+	if (block_filters.empty())
+	  {
+	    // Filter #3 -- block IPv4 DNS requests from other apps
+	    filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V4;
+	    filter.action.type = FWP_ACTION_BLOCK;
+	    filter.numFilterConditions = 1;
 
-	// Filter #4 -- block IPv6 DNS requests from other apps
-	filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V6;
+	    add_filter(&filter, NULL, block_filters);
+	    log << "block IPv4 DNS requests from other apps" << std::endl;
 
-	add_filter(&filter, NULL, &filterid);
-	log << "block IPv6 DNS requests from other apps" << std::endl;
+	    // Filter #4 -- block IPv6 DNS requests from other apps
+	    filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V6;
 
-	// Filter #5 -- allow IPv4 traffic from TAP
-	filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V4;
-	filter.action.type = FWP_ACTION_PERMIT;
-	filter.numFilterConditions = 2;
+	    add_filter(&filter, NULL, block_filters);
+	    log << "block IPv6 DNS requests from other apps" << std::endl;
+	  }
+
+	if (tap_filters.empty() || tap_index != tap_filters_index)
+	  {
+	    delete_filters(tap_filters);
 
-	condition[1].fieldKey = FWPM_CONDITION_IP_LOCAL_INTERFACE;
-	condition[1].matchType = FWP_MATCH_EQUAL;
-	condition[1].conditionValue.type = FWP_UINT64;
-	condition[1].conditionValue.uint64 = &tap_luid.Value;
+	    // Get NET_LUID object for adapter
+	    NET_LUID tap_luid = adapter_index_to_luid(tap_index);
 
-	add_filter(&filter, NULL, &filterid);
-	log << "allow IPv4 traffic from TAP" << std::endl;
+	    // Filter #5 -- allow IPv4 traffic from TAP
+	    filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V4;
+	    filter.action.type = FWP_ACTION_PERMIT;
+	    filter.numFilterConditions = 2;
 
-	// Filter #6 -- allow IPv6 traffic from TAP
-	filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V6;
+	    condition[1].fieldKey = FWPM_CONDITION_IP_LOCAL_INTERFACE;
+	    condition[1].matchType = FWP_MATCH_EQUAL;
+	    condition[1].conditionValue.type = FWP_UINT64;
+	    condition[1].conditionValue.uint64 = &tap_luid.Value;
 
-	add_filter(&filter, NULL, &filterid);
-	log << "allow IPv6 traffic from TAP" << std::endl;
+	    add_filter(&filter, NULL, tap_filters);
+	    log << "allow IPv4 traffic from TAP" << std::endl;
+
+	    // Filter #6 -- allow IPv6 traffic from TAP
+	    filter.layerKey = FWPM_LAYER_ALE_AUTH_CONNECT_V6;
+
+	    add_filter(&filter, NULL, tap_filters);
+	    log << "allow IPv6 traffic from TAP" << std::endl;
+
+	    tap_filters_index = tap_index;
+	  }
+
+	transaction.commit();
       }
 
       void reset(std::ostream& log)
@@ -203,6 +234,40 @@ namespace openvpn {
 	HANDLE handle = NULL;
       };
 
+      // Groups all filter changes of block_dns(), aborted
+      // unless committed.
+      class Transaction
+      {
+      public:
+	Transaction(HANDLE engine_arg)
+	  : engine(engine_arg)
+	{
+	  const DWORD status = ::FwpmTransactionBegin0(engine, 0);
+	  if (status != ERROR_SUCCESS)
+	    OPENVPN_THROW(wfp_error, "FwpmTransactionBegin0 failed with status=0x" << std::hex << status);
+	}
+
+	void commit()
+	{
+	  const DWORD status = ::FwpmTransactionCommit0(engine);
+	  engine = NULL;
+	  if (status != ERROR_SUCCESS)
+	    OPENVPN_THROW(wfp_error, "FwpmTransactionCommit0 failed with status=0x" << std::hex << status);
+	}
+
+	~Transaction()
+	{
+	  if (engine)
+	    ::FwpmTransactionAbort0(engine);
+	}
+
+      private:
+	Transaction(const Transaction&) = delete;
+	Transaction& operator=(const Transaction&) = delete;
+
+	HANDLE engine;
+      };
+
       static GUID new_guid()
       {
 	UUID ret;
@@ -234,15 +299,37 @@ namespace openvpn {
 
       void add_filter(const FWPM_FILTER0 *filter,
 		      PSECURITY_DESCRIPTOR sd,
-		      UINT64 *id)
+		      std::vector<UINT64>& ids)
       {
-	const DWORD status = ::FwpmFilterAdd0(engineHandle(), filter, sd, id);
+	UINT64 id = 0;
+	const DWORD status = ::FwpmFilterAdd0(engineHandle(), filter, sd, &id);
 	if (status != ERROR_SUCCESS)
 	  OPENVPN_THROW(wfp_error, "FwpmFilterAdd0 failed, status=0x" << std::hex << status);
+	ids.push_back(id);
+      }
+
+      void delete_filters(std::vector<UINT64>& ids)
+      {
+	for (const UINT64 id : ids)
+	  {
+	    const DWORD status = ::FwpmFilterDeleteById0(engineHandle(), id);
+	    if (status != ERROR_SUCCESS && status != FWP_E_FILTER_NOT_FOUND)
+	      OPENVPN_THROW(wfp_error, "FwpmFilterDeleteById0 failed, status=0x" << std::hex << status);
+	  }
+	ids.clear();
       }
 
       const GUID subLayerGUID{new_guid()};
       WFPEngine engineHandle;
+
+      // installed filters, by what they depend on
+      bool sublayer_added = false;
+      std::wstring app_path;
+      unique_ptr_del<FWP_BYTE_BLOB> app_id_blob;
+      std::vector<UINT64> app_filters;   // #1, #2
+      std::vector<UINT64> block_filters; // #3, #4
+      NET_IFINDEX tap_filters_index = 0;
+      std::vector<UINT64> tap_filters;   // #5, #6
     };
 
     class WFPContext : public RC<thread_unsafe_refcount>
@@ -250,6 +337,35 @@ namespace openvpn {
     public:
       typedef RCPtr<WFPContext> Ptr;
 
+      // While a Hold exists, unblocking is deferred, so that
+      // filters of the previous session stay in place during a
+      // reconnect and block() only replaces the ones that changed.
+      // Filters not blocked again are removed when the Hold goes away.
+      class Hold
+      {
+      public:
+	Hold(WFPContext& ctx_arg, std::ostream& log_arg)
+	  : ctx(ctx_arg),
+	    log(log_arg)
+	{
+	  ctx.hold = true;
+	}
+
+	~Hold()
+	{
+	  ctx.hold = false;
+	  if (ctx.unblock_pending)
+	    ctx.unblock(log);
+	}
+
+      private:
+	Hold(const Hold&) = delete;
+	Hold& operator=(const Hold&) = delete;
+
+	WFPContext& ctx;
+	std::ostream& log;
+      };
+
     private:
       friend class ActionWFP;
 
@@ -257,13 +373,29 @@ namespace openvpn {
 		 const NET_IFINDEX tap_index,
 		 std::ostream& log)
       {
-	unblock(log);
-	wfp.reset(new WFP());
-	wfp->block_dns(openvpn_app_path, tap_index, log);
+	unblock_pending = false;
+	if (!wfp)
+	  wfp.reset(new WFP());
+	try {
+	  wfp->block_dns(openvpn_app_path, tap_index, log);
+	}
+	catch (...)
+	  {
+	    // transaction was aborted, start over on next block()
+	    wfp->reset(log);
+	    wfp.reset();
+	    throw;
+	  }
       }
 
       void unblock(std::ostream& log)
       {
+	if (hold)
+	  {
+	    unblock_pending = true;
+	    return;
+	  }
+	unblock_pending = false;
 	if (wfp)
 	  {
 	    wfp->reset(log);
@@ -272,6 +404,8 @@ namespace openvpn {
       }
 
       WFP::Ptr wfp;
+      bool hold = false;
+      bool unblock_pending = false;
     };
 
     class ActionWFP : public Action
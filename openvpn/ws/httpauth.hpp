@@ -0,0 +1,155 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// AuthQueue backend that asks an HTTP(S) service, e.g. a sidecar in
+// front of LDAP.  Credentials are POSTed as a form:
+//
+//   username=...&password=...&common_name=...&peer_addr=...
+//
+// A 2xx reply accepts them, 401 or 403 rejects them with the first
+// line of the reply content as reason, anything else is a backend
+// error.  Connections are kept alive and reused between requests.
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <utility>
+
+#include <openvpn/common/unicode.hpp>
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/http/urlencode.hpp>
+#include <openvpn/ws/httpcliset.hpp>
+#include <openvpn/auth/authqueue.hpp>
+
+namespace openvpn {
+  namespace WS {
+
+    class HTTPAuthBackend : public AuthQueue::Backend
+    {
+    public:
+      typedef RCPtr<HTTPAuthBackend> Ptr;
+
+      struct Config
+      {
+	// connect_timeout and general_timeout bound each request
+	WS::Client::Config::Ptr http_config;
+	WS::Client::Host host;
+	std::string uri = "/auth";
+	ClientSet::Pool::Config pool;
+	int debug_level = 0;
+      };
+
+      HTTPAuthBackend(openvpn_io::io_context& io_context,
+		      const Config& config_arg)
+	: config(config_arg),
+	  cs(new ClientSet(io_context)),
+	  pool(new ClientSet::Pool(io_context, config_arg.pool))
+      {
+      }
+
+      virtual void start(const AuthQueue::Request& req, AuthQueue::Completion complete) override
+      {
+	if (halt)
+	  {
+	    complete(AuthQueue::Result(AuthQueue::Result::BACKEND_ERROR, "auth backend stopped"));
+	    return;
+	  }
+
+	ClientSet::TransactionSet::Ptr ts = new ClientSet::TransactionSet;
+	ts->http_config = config.http_config;
+	ts->host = config.host;
+	ts->debug_level = config.debug_level;
+	ts->pool = pool;
+
+	std::unique_ptr<ClientSet::Transaction> t(new ClientSet::Transaction);
+	t->req.method = "POST";
+	t->req.uri = config.uri;
+	t->ci.type = "application/x-www-form-urlencoded";
+	t->content_out.push_back(buf_from_string(form(req)));
+	t->ci.length = t->content_out.join_size();
+	ts->transactions.push_back(std::move(t));
+
+	ts->completion = [complete=std::move(complete)](ClientSet::TransactionSet& ts) mutable {
+	  complete(result(ts.first_transaction()));
+	};
+	cs->new_request(ts);
+      }
+
+      virtual void stop() override
+      {
+	if (halt)
+	  return;
+	halt = true;
+	cs->stop();
+	pool->stop();
+      }
+
+    private:
+      static std::string form(const AuthQueue::Request& req)
+      {
+	std::string ret;
+	if (req.creds)
+	  {
+	    ret += "username=";
+	    ret += URL::encode(req.creds->username);
+	    ret += "&password=";
+	    ret += URL::encode(req.creds->password.to_string());
+	  }
+	if (req.cert && req.cert->defined())
+	  {
+	    ret += "&common_name=";
+	    ret += URL::encode(req.cert->get_cn());
+	  }
+	if (req.peer_addr)
+	  {
+	    ret += "&peer_addr=";
+	    ret += URL::encode(req.peer_addr->to_string());
+	  }
+	return ret;
+      }
+
+      static AuthQueue::Result result(const ClientSet::Transaction& t)
+      {
+	if (t.http_status_success())
+	  return AuthQueue::Result(AuthQueue::Result::SUCCESS);
+	if (t.comm_status_success()
+	    && (t.reply.status_code == HTTP::Status::Unauthorized
+		|| t.reply.status_code == HTTP::Status::Forbidden))
+	  {
+	    std::string reason = t.content_in_string();
+	    const size_t eol = reason.find_first_of("\r\n");
+	    if (eol != std::string::npos)
+	      reason.resize(eol);
+	    return AuthQueue::Result(AuthQueue::Result::FAIL,
+				     Unicode::utf8_printable(reason, 256|Unicode::UTF8_FILTER));
+	  }
+	return AuthQueue::Result(AuthQueue::Result::BACKEND_ERROR, t.format_status());
+      }
+
+      const Config config;
+      ClientSet::Ptr cs;
+      ClientSet::Pool::Ptr pool;
+      bool halt = false;
+    };
+
+  }
+}
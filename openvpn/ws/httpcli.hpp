@@ -77,6 +77,10 @@
 #include <openvpn/asio/alt_routing.hpp>
 #endif
 
+#if defined(OPENVPN_PLATFORM_LINUX)
+#include <openvpn/linux/ktls.hpp>
+#endif
+
 #if defined(OPENVPN_PLATFORM_WIN)
 #include <openvpn/win/scoped_handle.hpp>
 #include <openvpn/win/winerr.hpp>
@@ -190,6 +194,7 @@ namespace openvpn {
 	unsigned int keepalive_timeout = 0;
 	unsigned int max_headers = 0;
 	unsigned int max_header_bytes = 0;
+	bool header_views = false; // parse reply headers into HTTP::Reply::header_block, see header_block()
 	bool enable_cache = false; // if true, supports TLS session resumption tickets
 	olong max_content_bytes = 0;
 	unsigned int msg_overhead_bytes = 0;
@@ -520,6 +525,32 @@ namespace openvpn {
 	  return content_out_hold;
 	}
 
+	// Stop reading from the server once the current read has
+	// been processed, so that a slow http_content_in() consumer
+	// can apply back-pressure.  Content already read is still
+	// delivered.  Timeouts keep running while paused.  Has no
+	// effect when tunneling through a TransportClient.
+	void pause_content_in()
+	{
+	  content_in_pause = true;
+	}
+
+	void resume_content_in()
+	{
+	  content_in_pause = false;
+	  if (content_in_stopped)
+	    {
+	      content_in_stopped = false;
+	      if (link && !halt)
+		link->start();
+	    }
+	}
+
+	bool is_content_in_paused() const
+	{
+	  return content_in_pause;
+	}
+
 	// virtual methods
 
 	virtual Host http_host() = 0;
@@ -681,6 +712,7 @@ namespace openvpn {
 	    if (host.port.empty())
 	      host.port = config->ssl_factory ? "443" : "80";
 
+	    ssl_tx_offload = false;
 	    if (config->ssl_factory)
 	      {
 		if (config->enable_cache)
@@ -859,6 +891,8 @@ namespace openvpn {
 				      (*frame)[Frame::READ_HTTP],
 				      stats));
 	      link->set_raw_mode(true);
+	      content_in_pause = false;
+	      content_in_stopped = false;
 	      link->start();
 	    }
 
@@ -1072,6 +1106,11 @@ namespace openvpn {
 	    {
 	      handle_exception("tcp_read_handler", e);
 	    }
+	  if (content_in_pause && !halt)
+	    {
+	      content_in_stopped = true;
+	      return false; // don't requeue until resume_content_in()
+	    }
 	  return true;
 	}
 
@@ -1164,6 +1203,36 @@ namespace openvpn {
 	    return link->send_queue_empty();
 	}
 
+	// Called before each cleartext write until the first one of
+	// a connection.  When the SSL object will export its transmit
+	// keys (SSLConst::ENABLE_KTLS_TX), wait for the handshake
+	// records to leave the send queue, then install the keys on
+	// the socket so that the request and content go out through
+	// kernel TLS.  Falls back to userspace TLS if the kernel
+	// lacks it.
+	SSLOffload base_ssl_offload_tx()
+	{
+#if defined(OPENVPN_PLATFORM_LINUX)
+	  SSLAPI::TrafficKeys keys;
+	  if (transcli || !link || !ssl_sess->export_tx_keys(keys))
+	    return SSL_OFFLOAD_NONE;
+	  if (!link->send_queue_empty())
+	    return SSL_OFFLOAD_WAIT;
+	  std::string err;
+	  if (!KTLS::enable_tx(socket->native_handle(), keys, &err))
+	    {
+	      if (config->debug_level >= 2)
+		OPENVPN_LOG("HTTP kTLS unavailable: " << err);
+	      return SSL_OFFLOAD_NONE;
+	    }
+	  if (config->debug_level >= 2)
+	    OPENVPN_LOG("HTTP kTLS transmit enabled");
+	  return SSL_OFFLOAD_TX;
+#else
+	  return SSL_OFFLOAD_NONE;
+#endif
+	}
+
 	void base_http_done_handler(BufferAllocated& residual,
 				    const bool parent_handoff)
 	{
@@ -1175,6 +1244,7 @@ namespace openvpn {
 	      schedule_keepalive_timer();
 	      alive = true;
 	      ready = true;
+	      resume_content_in(); // keep watching the idle connection
 	    }
 	  else
 	    stop(true);
@@ -1273,6 +1343,8 @@ namespace openvpn {
 	CoarseTime general_timeout_coarse;
 
 	bool content_out_hold = true;
+	bool content_in_pause = false;
+	bool content_in_stopped = false; // link read not requeued
 	bool alive = false;
       };
 
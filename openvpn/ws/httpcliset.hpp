@@ -103,6 +103,12 @@ namespace openvpn {
 	  return alive() && c->http->host_match(host);
 	}
 
+	void resume_content_in()
+	{
+	  if (c && c->http)
+	    c->http->resume_content_in();
+	}
+
 #ifdef ASIO_HAS_LOCAL_SOCKETS
 	int unix_fd()
 	{
@@ -152,9 +158,185 @@ namespace openvpn {
 	  c->http->start_request();
 	}
 
+	void adopt(HTTPDelegate::Ptr http)
+	{
+	  create_container();
+	  close(false, false);
+	  c->http = std::move(http);
+	}
+
+	HTTPDelegate::Ptr release()
+	{
+	  HTTPDelegate::Ptr ret;
+	  if (c)
+	    ret.swap(c->http);
+	  return ret;
+	}
+
 	Container::Ptr c;
       };
 
+      // Idle keepalive connections shared by TransactionSets that
+      // set TransactionSet::pool, keyed by host, port and TLS
+      // settings.  A TransactionSet that needs a connection takes
+      // an idle one to its host if there is one, and on success
+      // returns its connection to the pool instead of closing it.
+      // Must only be used by ClientSets on the given io_context.
+      class Pool : public RC<thread_unsafe_refcount>
+      {
+      public:
+	typedef RCPtr<Pool> Ptr;
+
+	struct Config
+	{
+	  unsigned int max_idle_per_host = 4;
+	  Time::Duration idle_timeout = Time::Duration::seconds(30);
+
+	  // resume TLS sessions on new connections, as if
+	  // WS::Client::Config::enable_cache was set
+	  bool resume_tls = true;
+	};
+
+	Pool(openvpn_io::io_context& io_context,
+	     const Config& config_arg)
+	  : config(config_arg),
+	    sweep_timer(io_context)
+	{
+	}
+
+	// Return a live idle connection for key, or null.
+	HTTPDelegate::Ptr acquire(const std::string& key)
+	{
+	  auto e = idle.find(key);
+	  if (e == idle.end())
+	    return HTTPDelegate::Ptr();
+	  HTTPDelegate::Ptr ret;
+	  while (!ret && !e->second.empty())
+	    {
+	      // most recently used first, it's the least likely to
+	      // have been closed by the server
+	      Idle& i = e->second.back();
+	      if (i.http->is_alive() && i.expire > Time::now())
+		ret = std::move(i.http);
+	      else
+		i.http->stop(false);
+	      e->second.pop_back();
+	    }
+	  if (e->second.empty())
+	    idle.erase(e);
+	  if (ret)
+	    ++n_reused_;
+	  return ret;
+	}
+
+	// Keep http for reuse, or close it if it's not alive or
+	// key already has max_idle_per_host idle connections.
+	void release(const std::string& key, HTTPDelegate::Ptr http)
+	{
+	  if (!http)
+	    return;
+	  if (halt || !http->is_alive())
+	    {
+	      http->stop(false);
+	      return;
+	    }
+	  std::vector<Idle>& v = idle[key];
+	  if (v.size() >= config.max_idle_per_host)
+	    {
+	      v.front().http->stop(true);
+	      v.erase(v.begin());
+	    }
+	  v.push_back(Idle{std::move(http), Time::now() + config.idle_timeout});
+	  schedule_sweep();
+	}
+
+	void stop()
+	{
+	  halt = true;
+	  sweep_timer.cancel();
+	  for (auto& e : idle)
+	    for (auto& i : e.second)
+	      i.http->stop(true);
+	  idle.clear();
+	}
+
+	bool resume_tls() const
+	{
+	  return config.resume_tls;
+	}
+
+	// number of connections handed out by acquire()
+	unsigned int n_reused() const
+	{
+	  return n_reused_;
+	}
+
+	size_t n_idle() const
+	{
+	  size_t n = 0;
+	  for (auto& e : idle)
+	    n += e.second.size();
+	  return n;
+	}
+
+	static std::string key(const WS::Client::Config& http_config, const WS::Client::Host& host)
+	{
+	  std::ostringstream os;
+	  os << host.host_port_str() << '/' << host.host_cn() << '/' << http_config.ssl_factory.get();
+	  return os.str();
+	}
+
+      private:
+	struct Idle
+	{
+	  HTTPDelegate::Ptr http;
+	  Time expire;
+	};
+
+	void schedule_sweep()
+	{
+	  if (sweep_pending)
+	    return;
+	  sweep_pending = true;
+	  sweep_timer.expires_after(config.idle_timeout);
+	  sweep_timer.async_wait([self=Ptr(this)](const openvpn_io::error_code& error)
+				 {
+				   self->sweep_pending = false;
+				   if (!error && !self->halt)
+				     self->sweep();
+				 });
+	}
+
+	// close expired and dead connections
+	void sweep()
+	{
+	  const Time now = Time::now();
+	  for (auto e = idle.begin(); e != idle.end(); )
+	    {
+	      auto& v = e->second;
+	      v.erase(std::remove_if(v.begin(), v.end(), [&now](Idle& i) {
+		    if (i.http->is_alive() && i.expire > now)
+		      return false;
+		    i.http->stop(true);
+		    return true;
+		  }), v.end());
+	      if (v.empty())
+		e = idle.erase(e);
+	      else
+		++e;
+	    }
+	  if (!idle.empty())
+	    schedule_sweep();
+	}
+
+	const Config config;
+	std::map<std::string, std::vector<Idle>> idle;
+	AsioTimerSafe sweep_timer;
+	unsigned int n_reused_ = 0;
+	bool sweep_pending = false;
+	bool halt = false;
+      };
+
       class TransactionSet;
       struct Transaction;
 
@@ -175,6 +357,15 @@ namespace openvpn {
 	bool accept_gzip_in = false;
 	bool randomize_resolver_results = false;
 
+	// If defined, reply content is passed to this method as it
+	// arrives (already de-chunked, but not gunzipped) instead of
+	// being collected in content_in, so large downloads can be
+	// processed in constant memory.  Return false to stop reading
+	// from the server until TransactionSet::resume_content_in()
+	// is called.  If the transaction is retried, content of the
+	// failed attempt may already have been passed on.
+	Function<bool(Transaction& t, BufferAllocated& buf)> content_in_handler;
+
 	// output
 	int status = UNDEF;
 	std::string description;
@@ -320,6 +511,11 @@ namespace openvpn {
 	bool preserve_http_state = false;
 	HTTPStateContainer hsc;
 
+	// If defined, take connections from and return them to this
+	// pool.  Requests are sent with Connection: keep-alive.
+	// Ignored if preserve_http_state is set.
+	Pool::Ptr pool;
+
 	// configuration
 	WS::Client::Config::Ptr http_config;
 	WS::Client::Host host;
@@ -358,6 +554,12 @@ namespace openvpn {
 	  return hsc.alive(host.host);
 	}
 
+	// resume reading after a content_in_handler returned false
+	void resume_content_in()
+	{
+	  hsc.resume_content_in();
+	}
+
 	WS::ClientSet::Transaction& first_transaction()
 	{
 	  if (transactions.empty())
@@ -663,8 +865,12 @@ namespace openvpn {
 	void done(const bool status, const bool shutdown)
 	{
 	  {
-	    auto clean = Cleanup([this, shutdown]() {
-		if (!ts->preserve_http_state)
+	    auto clean = Cleanup([this, status, shutdown]() {
+		if (ts->preserve_http_state)
+		  return;
+		if (status && ts->pool)
+		  ts->pool->release(Pool::key(*ts->http_config, ts->host), ts->hsc.release());
+		else
 		  ts->hsc.stop(shutdown);
 	      });
 	    stop(status, shutdown);
@@ -711,13 +917,36 @@ namespace openvpn {
 	    ts->error_recovery->retry(*ts, t);
 
 	  // init and attach HTTPStateContainer
+	  if (!ts->alive() && use_pool())
+	    {
+	      HTTPDelegate::Ptr http = ts->pool->acquire(Pool::key(*ts->http_config, ts->host));
+	      if (http)
+		ts->hsc.adopt(std::move(http));
+	    }
 	  if (!ts->alive())
-	    ts->hsc.construct(parent->io_context, ts->http_config);
+	    ts->hsc.construct(parent->io_context, http_config());
 	  ts->hsc.attach(this);
 
 	  ts->hsc.start_request();
 	}
 
+	bool use_pool() const
+	{
+	  return ts->pool && !ts->preserve_http_state;
+	}
+
+	// with a pool, new TLS connections try to resume a session
+	WS::Client::Config::Ptr http_config() const
+	{
+	  if (use_pool() && ts->pool->resume_tls() && ts->http_config->ssl_factory && !ts->http_config->enable_cache)
+	    {
+	      WS::Client::Config::Ptr c(new WS::Client::Config(*ts->http_config));
+	      c->enable_cache = true;
+	      return c;
+	    }
+	  return ts->http_config;
+	}
+
 	void reconnect_schedule(const bool error_retry)
 	{
 	  if (check_if_done())
@@ -746,6 +975,8 @@ namespace openvpn {
 	  WS::Client::ContentInfo ci = t.ci;
 	  if (!ci.length)
 	    ci.length = t.content_out.join_size();
+	  if (use_pool())
+	    ci.keepalive = true;
 #ifdef HAVE_ZLIB
 	  if (t.accept_gzip_in)
 	    ci.extra_headers.emplace_back("Accept-Encoding: gzip");
@@ -823,7 +1054,14 @@ namespace openvpn {
 
 	void http_content_in(HTTPDelegate& hd, BufferAllocated& buf)
 	{
-	  trans().content_in.put_consume(buf, buf_tailroom);
+	  Transaction& t = trans();
+	  if (t.content_in_handler)
+	    {
+	      if (!t.content_in_handler(t, buf))
+		hd.pause_content_in();
+	    }
+	  else
+	    t.content_in.put_consume(buf, buf_tailroom);
 	}
 
 	void http_done(HTTPDelegate& hd, const int status, const std::string& description)
@@ -848,7 +1086,7 @@ namespace openvpn {
 	    if (status == WS::Client::Status::E_SUCCESS && !http_status_should_retry(hd.reply().status_code))
 	      {
 		// uncompress if server sent gzip-compressed data
-		if (hd.reply().headers.get_value_trim("content-encoding") == "gzip")
+		if (!t.content_in_handler && hd.reply().headers.get_value_trim("content-encoding") == "gzip")
 		  {
 #ifdef HAVE_ZLIB
 		    BufferPtr bp = t.content_in.join();
@@ -70,6 +70,7 @@ namespace openvpn {
 	rr_obj.reset();
 	rr_status = REQUEST_REPLY::Parser::pending;
 	rr_parser.reset();
+	rr_parser.set_views(config->header_views);
 	rr_header_bytes = 0;
 	rr_content_length = 0;
 	rr_content_bytes = 0;
@@ -121,6 +122,11 @@ namespace openvpn {
 	return rr_obj.headers;
       }
 
+      // headers if config->header_views is set
+      const HTTP::HeaderBlock& header_block() const {
+	return rr_obj.header_block;
+      }
+
       const olong content_length() const {
 	return rr_content_length;
       }
@@ -250,6 +256,18 @@ namespace openvpn {
       //   bool base_send_queue_empty();
       //   void base_http_done_handler(BufferAllocated& residual)
       //   void base_error_handler(const int errcode, const std::string& err);
+      //   SSLOffload base_ssl_offload_tx(); [optional]
+
+      enum SSLOffload {
+	SSL_OFFLOAD_NONE, // keep encrypting in the SSL object
+	SSL_OFFLOAD_WAIT, // retry when the send queue drains
+	SSL_OFFLOAD_TX,   // outgoing cleartext now goes straight to the socket
+      };
+
+      SSLOffload base_ssl_offload_tx()
+      {
+	return SSL_OFFLOAD_NONE;
+      }
 
       // protected member vars
 
@@ -261,6 +279,7 @@ namespace openvpn {
       typename CONFIG::Ptr config;
       CONTENT_INFO content_info;
       SSLAPI::Ptr ssl_sess;
+      bool ssl_tx_offload = false; // kernel encrypts outgoing records of ssl_sess
 
       BufferPtr outbuf;
 
@@ -288,7 +307,22 @@ namespace openvpn {
 	    const size_t size = std::min(outbuf->size(), http_buf_size());
 	    if (size)
 	      {
-		if (ssl_sess)
+		if (ssl_sess && !ssl_tx_offload)
+		  {
+		    // the parent may hand record encryption of outgoing
+		    // data to the kernel before the first write
+		    switch (parent().base_ssl_offload_tx())
+		      {
+		      case SSL_OFFLOAD_WAIT:
+			return;
+		      case SSL_OFFLOAD_TX:
+			ssl_tx_offload = true;
+			break;
+		      default:
+			break;
+		      }
+		  }
+		if (ssl_sess && !ssl_tx_offload)
 		  {
 		    // HTTPS: send outgoing cleartext HTTP data from request/reply to SSL object
 		    ssize_t actual = 0;
@@ -316,7 +350,8 @@ namespace openvpn {
 		  }
 		else
 		  {
-		    // HTTP: send outgoing cleartext HTTP data from request/reply to TCP socket
+		    // HTTP, or HTTPS with kernel TLS: send outgoing cleartext
+		    // HTTP data from request/reply to TCP socket
 		    BufferAllocated buf;
 		    frame->prepare(Frame::WRITE_HTTP, buf);
 		    buf.write(outbuf->data(), size);
@@ -382,7 +417,7 @@ namespace openvpn {
 		      {
 			// only check header maximums once every 64 bytes
 			if ((config->max_header_bytes && rr_header_bytes > config->max_header_bytes)
-			    || (config->max_headers && rr_obj.headers.size() > config->max_headers))
+			    || (config->max_headers && rr_obj.headers.size() + rr_obj.header_block.size() > config->max_headers))
 			  {
 			    parent().base_error_handler(STATUS::E_HEADER_SIZE, "HTTP headers too large");
 			    return;
@@ -397,7 +432,9 @@ namespace openvpn {
 		      {
 			if (!websocket)
 			  {
-			    rr_content_length = get_content_length(rr_obj.headers);
+			    rr_content_length = config->header_views
+			      ? get_content_length(rr_obj.header_block)
+			      : get_content_length(rr_obj.headers);
 			    if (rr_content_length == CONTENT_INFO::CHUNKED)
 			      rr_chunked.reset(new ChunkedHelper());
 			  }
@@ -460,6 +497,8 @@ namespace openvpn {
 	while (!halt && ssl_sess->read_ciphertext_ready())
 	  {
 	    BufferPtr buf = ssl_sess->read_ciphertext();
+	    if (ssl_tx_offload)
+	      throw http_exception("SSL layer output after the kernel took over TLS transmit");
 	    parent().base_link_send(*buf);
 	  }
       }
@@ -519,6 +558,24 @@ namespace openvpn {
 	  }
       }
 
+      static CONTENT_LENGTH_TYPE get_content_length(const HTTP::HeaderBlock& headers)
+      {
+	if (headers.get_value_trim("transfer-encoding").iequals("chunked"))
+	  {
+	    return CONTENT_INFO::CHUNKED;
+	  }
+	else
+	  {
+	    const HTTP::HeaderView content_length_view = headers.get_value_trim("content-length");
+	    if (content_length_view.empty())
+	      return 0;
+	    const CONTENT_LENGTH_TYPE content_length = parse_number_throw<CONTENT_LENGTH_TYPE>(content_length_view.to_string(), "content-length");
+	    if (content_length < 0)
+	      throw number_parse_exception("content-length is < 0");
+	    return content_length;
+	  }
+      }
+
       static std::string http_out_state_string(const HTTPOutState hos)
       {
 	switch (hos)
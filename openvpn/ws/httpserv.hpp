@@ -33,12 +33,20 @@
 
 #include <openvpn/io/io.hpp>
 
+#if defined(OPENVPN_PLATFORM_LINUX)
+#include <sys/sendfile.h>
+#endif
+
 #include <openvpn/common/platform.hpp>
 #include <openvpn/common/options.hpp>
 #include <openvpn/common/to_string.hpp>
 #include <openvpn/common/arraysize.hpp>
 #include <openvpn/common/function.hpp>
 #include <openvpn/common/sockopt.hpp>
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/strerror.hpp>
+#endif
 #include <openvpn/asio/asiopolysock.hpp>
 #include <openvpn/common/core.hpp>
 #include <openvpn/buffer/bufstream.hpp>
@@ -147,9 +155,16 @@ namespace openvpn {
 	unsigned int tcp_throttle_max_connections_per_period = 0; // set > 0 to enable throttling
 	Time::Duration tcp_throttle_period;
 	unsigned int tcp_max = 0;
+	bool tcp_max_defer = false;            // at tcp_max, leave connections in the listen backlog rather than closing them
+	unsigned int accept_batch = 1;         // connections taken from the backlog per accept wakeup
+	int accept_cpu = -1;                   // with REUSE_PORT, per-CPU accept on this CPU (see Acceptor::TCP::set_incoming_cpu())
+	unsigned int accept_cpus = 0;          // number of per-CPU listeners, steered by the accept_cpu 0 listener
 	unsigned int general_timeout = 60;
+	unsigned int keepalive_timeout = 0;    // seconds idle between requests on a keep-alive connection, 0 for general_timeout
+	unsigned int keepalive_max_requests = 0; // requests per keep-alive connection, 0 for no limit
 	unsigned int max_headers = 0;
 	unsigned int max_header_bytes = 0;
+	bool header_views = false; // parse request headers into HTTP::Request::header_block, see header_block()
 	content_len_t max_content_bytes = 0;
 	unsigned int msg_overhead_bytes = 0;
 	unsigned int send_queue_max_size = 0;
@@ -175,6 +190,13 @@ namespace openvpn {
 	bool keepalive = false;
 	bool lean_headers = false;
 	std::vector<std::string> extra_headers;
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+	// If defined, the content is length bytes of this file from
+	// file_offset, sent with sendfile() where possible.  The
+	// server closes it.
+	int file_fd = -1;
+	content_len_t file_offset = 0;
+#endif
 	WebSocket::Server::PerRequest::Ptr websocket;
       };
 
@@ -299,6 +321,19 @@ namespace openvpn {
 	    http_out_begin();
 
 	    content_info = std::move(ci);
+	    ++n_requests;
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+	    if (content_info.file_fd >= 0)
+	      {
+		file_out.reset(content_info.file_fd);
+		content_info.file_fd = -1;
+		if (content_info.length < 0)
+		  throw http_server_exception("file content requires a length");
+		file_offset = content_info.file_offset;
+		file_remaining = content_info.length;
+		set_async_out(true); // file_out_next() is called for content
+	      }
+#endif
 
 	    outbuf.reset(new BufferAllocated(512, BufferAllocated::GROW));
 	    BufferStreamOut os(*outbuf);
@@ -329,6 +364,8 @@ namespace openvpn {
 	  // return true if client asked for keepalive
 	  bool keepalive_request()
 	  {
+	    if (config->header_views)
+	      return header_block().get_value_trim("connection").equals("keep-alive");
 	    return headers().get_value_trim("connection") == "keep-alive";
 	  }
 
@@ -422,7 +459,7 @@ namespace openvpn {
 	      os << "Content-Encoding: " << content_info.content_encoding << "\r\n";
 	    if (content_info.no_cache && !content_info.lean_headers)
 	      os << "Cache-Control: no-cache, no-store, must-revalidate\r\n";
-	    if ((keepalive = content_info.keepalive))
+	    if ((keepalive = content_info.keepalive && !keepalive_exhausted()))
 	      os << "Connection: keep-alive\r\n";
 	    else
 	      os << "Connection: close\r\n";
@@ -484,7 +521,10 @@ namespace openvpn {
 
 	  void restart(const bool initial)
 	  {
-	    timeout_duration = Time::Duration::seconds(parent->config->general_timeout);
+	    // between keep-alive requests, use the idle timeout until
+	    // the next request starts
+	    idle = !initial && parent->config->keepalive_timeout;
+	    timeout_duration = Time::Duration::seconds(idle ? parent->config->keepalive_timeout : parent->config->general_timeout);
 	    timeout_coarse.reset();
 	    activity();
 	    rr_reset();
@@ -502,6 +542,9 @@ namespace openvpn {
 	    halt = true;
 	    http_destroy();
 	    timeout_timer.cancel();
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+	    file_out.close();
+#endif
 	    if (link)
 	      link->stop();
 	    if (sock)
@@ -582,6 +625,12 @@ namespace openvpn {
 	    tcp_intercept(b);
 
 	    try {
+	      if (idle)
+		{
+		  idle = false;
+		  timeout_duration = Time::Duration::seconds(parent->config->general_timeout);
+		  timeout_coarse.reset();
+		}
 	      activity();
 	      if (ready)
 		add_to_pipeline(b);
@@ -640,6 +689,13 @@ namespace openvpn {
 
 	  void base_http_content_out_needed()
 	  {
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+	    if (file_out.defined())
+	      {
+		file_out_next();
+		return;
+	      }
+#endif
 	    http_content_out_needed();
 	  }
 
@@ -691,6 +747,87 @@ namespace openvpn {
 	    error_handler(errcode, err);
 	  }
 
+	  bool keepalive_exhausted() const
+	  {
+	    return parent->config->keepalive_max_requests && n_requests >= parent->config->keepalive_max_requests;
+	  }
+
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+	  // Send the next part of file content.  Without SSL (or with
+	  // kernel TLS) on Linux, the rest of the file goes to the
+	  // socket with sendfile(), otherwise a buffer at a time
+	  // through the usual output path.
+	  void file_out_next()
+	  {
+	    if (halt)
+	      return;
+	    if (!file_remaining)
+	      {
+		file_out_done();
+		return;
+	      }
+#if defined(OPENVPN_PLATFORM_LINUX)
+	    if ((!ssl_sess || ssl_tx_offload) && link->send_queue_empty() && sock->native_handle() >= 0)
+	      {
+		while (file_remaining)
+		  {
+		    off_t off = file_offset;
+		    const ssize_t n = ::sendfile(sock->native_handle(), file_out(), &off,
+						 std::min(file_remaining, content_len_t(1 << 20)));
+		    if (n > 0)
+		      {
+			file_offset += n;
+			file_remaining -= n;
+			activity();
+		      }
+		    else if (n < 0 && errno == EAGAIN)
+		      {
+			if (!sock->async_wait_write([self=Ptr(this)](const openvpn_io::error_code& error)
+						    {
+						      if (self->halt)
+							return;
+						      if (error)
+							self->asio_error_handler(Status::E_TCP, "sendfile wait", error);
+						      else
+							self->file_out_next();
+						    }))
+			  break;
+			return;
+		      }
+		    else
+		      {
+			error_handler(Status::E_TCP, n ? "sendfile: " + strerror_str(errno) : "sendfile: file truncated");
+			return;
+		      }
+		  }
+		if (!file_remaining)
+		  {
+		    file_out_done();
+		    return;
+		  }
+	      }
+#endif
+	    BufferPtr buf(new BufferAllocated(std::min(file_remaining, content_len_t((*frame)[Frame::WRITE_HTTP].payload())), 0));
+	    const ssize_t n = ::pread(file_out(), buf->data(), buf->capacity(), file_offset);
+	    if (n <= 0)
+	      {
+		error_handler(Status::E_EXCEPTION, n ? "file content read: " + strerror_str(errno) : "file content truncated");
+		return;
+	      }
+	    buf->set_size(n);
+	    file_offset += n;
+	    file_remaining -= n;
+	    http_content_out_finish(std::move(buf));
+	  }
+
+	  void file_out_done()
+	  {
+	    file_out.close();
+	    set_async_out(false);
+	    http_content_out_finish(BufferPtr());
+	  }
+#endif
+
 	  // error handlers
 
 	  void asio_error_handler(int errcode, const char *func_name, const openvpn_io::error_code& error)
@@ -762,6 +899,13 @@ namespace openvpn {
 	  LinkImpl::Ptr link;
 	  bool keepalive = false;
 	  bool handoff = false;
+	  bool idle = false;            // waiting for the next keep-alive request
+	  unsigned int n_requests = 0;
+#if defined(OPENVPN_PLATFORM_TYPE_UNIX)
+	  ScopedFD file_out;
+	  content_len_t file_offset = 0;
+	  content_len_t file_remaining = 0;
+#endif
 #ifdef OPENVPN_POLYSOCK_SUPPORTS_ALT_ROUTING
 	  bool is_alt_routing_ = false;
 #endif
@@ -832,12 +976,17 @@ namespace openvpn {
 
 		    // set options
 		    a->set_socket_options(config->sockopt_flags);
+		    a->set_accept_batch(config->accept_batch);
+		    if (config->accept_cpu >= 0)
+		      a->set_incoming_cpu(config->accept_cpu);
 
 		    // bind to local address
 #ifdef OPENVPN_DEBUG_ACCEPT
 		    OPENVPN_LOG("ACCEPTOR BIND " << a->local_endpoint);
 #endif
 		    a->acceptor.bind(a->local_endpoint);
+		    if (config->accept_cpu == 0)
+		      a->attach_cpu_steering(config->accept_cpus);
 
 		    // listen for incoming client connections
 		    a->acceptor.listen(config->tcp_backlog);
@@ -887,6 +1036,7 @@ namespace openvpn {
 
 		    // listen for incoming client connections
 		    a->acceptor.listen();
+		    a->set_accept_batch(config->accept_batch);
 
 		    // save acceptor
 		    acceptors.emplace_back(std::move(a), Acceptor::Item::SSLOff);
@@ -1008,47 +1158,78 @@ namespace openvpn {
 
 	  try {
 	    if (!error)
-	      {
-		const Acceptor::Item::SSLMode ssl_mode = acceptors[acceptor_index].ssl_mode;
+	      accept_client(std::move(sock));
+	    else
+	      throw http_server_exception("accept failed: " + error.message());
+	  }
+	  catch (const std::exception& e)
+	    {
+	      OPENVPN_LOG("exception in handle_accept: " << e.what());
+	    }
+
+	  // at tcp_max, leave further connections in the backlog
+	  // until a client goes away
+	  if (config->tcp_max_defer && at_tcp_max(0))
+	    deferred_acceptor_indices.push_back(acceptor_index);
+	  else
+	    queue_accept_throttled(acceptor_index, true);
+	}
+
+	virtual bool handle_accept_batched(AsioPolySock::Base::Ptr sock) override
+	{
+	  if (halt)
+	    return false;
+
+	  try {
+	    accept_client(std::move(sock));
+	  }
+	  catch (const std::exception& e)
+	    {
+	      OPENVPN_LOG("exception in handle_accept_batched: " << e.what());
+	    }
+
+	  // keep a slot for the connection passed to handle_accept()
+	  return !at_tcp_max(1);
+	}
+
+	void accept_client(AsioPolySock::Base::Ptr sock)
+	{
+	  const Acceptor::Item::SSLMode ssl_mode = acceptors[sock->index()].ssl_mode;
 
 #ifdef OPENVPN_DEBUG_ACCEPT
-		OPENVPN_LOG("ACCEPT from " << sock->remote_endpoint_str());
+	  OPENVPN_LOG("ACCEPT from " << sock->remote_endpoint_str());
 #endif
 
-		sock->non_blocking(true);
-		sock->set_cloexec();
-		sock->tcp_nodelay();
+	  sock->non_blocking(true);
+	  sock->set_cloexec();
+	  sock->tcp_nodelay();
 
-		if (config->tcp_max && clients.size() >= config->tcp_max)
-		  throw http_server_exception("max clients exceeded");
-		if (!allow_client(*sock))
-		  throw http_server_exception("client socket rejected");
+	  if (at_tcp_max(0))
+	    throw http_server_exception("max clients exceeded");
+	  if (!allow_client(*sock))
+	    throw http_server_exception("client socket rejected");
 
 #ifdef OPENVPN_POLYSOCK_SUPPORTS_ALT_ROUTING
-		if (ssl_mode == Acceptor::Item::AltRouting)
-		  {
-		    const KovpnSockMark ksm(sock->native_handle());
-		    if (!ksm.is_internal())
-		      throw http_server_exception("non alt-routing socket: " + ksm.to_string());
-		  }
+	  if (ssl_mode == Acceptor::Item::AltRouting)
+	    {
+	      const KovpnSockMark ksm(sock->native_handle());
+	      if (!ksm.is_internal())
+		throw http_server_exception("non alt-routing socket: " + ksm.to_string());
+	    }
 #endif
 
-		const client_t client_id = new_client_id();
-		Client::Initializer ci(io_context, this, std::move(sock), client_id);
-		Client::Ptr cli = client_factory->new_client(ci);
-		clients[client_id] = cli;
+	  const client_t client_id = new_client_id();
+	  Client::Initializer ci(io_context, this, std::move(sock), client_id);
+	  Client::Ptr cli = client_factory->new_client(ci);
+	  clients[client_id] = cli;
 
-		cli->start(ssl_mode);
-	      }
-	    else
-	      throw http_server_exception("accept failed: " + error.message());
-	  }
-	  catch (const std::exception& e)
-	    {
-	      OPENVPN_LOG("exception in handle_accept: " << e.what());
-	    }
+	  cli->start(ssl_mode);
+	}
 
-	  queue_accept_throttled(acceptor_index, true);
+	// true if fewer than reserve clients below tcp_max
+	bool at_tcp_max(const size_t reserve) const
+	{
+	  return config->tcp_max && clients.size() + reserve >= config->tcp_max;
 	}
 
 	client_t new_client_id()
@@ -1072,6 +1253,13 @@ namespace openvpn {
 	  ClientMap::const_iterator e = clients.find(client_id);
 	  if (e != clients.end())
 	    clients.erase(e);
+
+	  // resume accepting, see tcp_max_defer
+	  while (!halt && !deferred_acceptor_indices.empty() && !at_tcp_max(0))
+	    {
+	      queue_accept_throttled(deferred_acceptor_indices.front(), false);
+	      deferred_acceptor_indices.pop_front();
+	    }
 	}
 
 	virtual bool allow_client(AsioPolySock::Base& sock)
@@ -1091,6 +1279,7 @@ namespace openvpn {
 	Time throttle_expire;
 	int throttle_connections = 0;
 	std::deque<size_t> throttle_acceptor_indices;
+	std::deque<size_t> deferred_acceptor_indices; // accept paused at tcp_max
 
 	client_t next_id = 0;
 	ClientMap clients;
@@ -0,0 +1,232 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2020 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Embedded HTTP endpoint serving GET /metrics in the OpenMetrics
+// text format.  The server runs its own io_context on a private
+// thread, and Sources render from lock-free counters, so a scrape
+// never stalls the data path.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <utility>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/hostport.hpp>
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/log/openmetrics.hpp>
+#include <openvpn/ws/httpserv.hpp>
+
+namespace openvpn {
+  namespace WS {
+    namespace Metrics {
+
+      OPENVPN_EXCEPTION(metrics_error);
+
+      // Contributes metrics to each scrape.  Called on the
+      // exporter thread.
+      struct Source : public RC<thread_safe_refcount>
+      {
+	typedef RCPtr<Source> Ptr;
+
+	virtual void render_metrics(OpenMetrics::Writer& w) = 0;
+      };
+
+      class SessionStatsSource : public Source
+      {
+      public:
+	SessionStatsSource(const SessionStats::Ptr& stats_arg)
+	  : stats(stats_arg)
+	{
+	}
+
+	virtual void render_metrics(OpenMetrics::Writer& w) override
+	{
+	  OpenMetrics::render(w, *stats);
+	}
+
+      private:
+	SessionStats::Ptr stats;
+      };
+
+      // occupancy of the process-wide object pools
+      struct ObjPoolSource : public Source
+      {
+	virtual void render_metrics(OpenMetrics::Writer& w) override
+	{
+	  OpenMetrics::render_pools(w);
+	}
+      };
+
+      typedef std::vector<Source::Ptr> SourceList;
+
+      class Exporter
+      {
+      public:
+	// listen is host:port
+	Exporter(const std::string& listen,
+		 SourceList sources_arg)
+	  : sources(std::move(sources_arg))
+	{
+	  std::string host, port;
+	  if (!HostPort::split_host_port(listen, host, port, "", false))
+	    throw metrics_error("bad listen address: " + listen);
+	  listen_item.directive = "metrics";
+	  listen_item.addr = host;
+	  listen_item.port = port;
+	  listen_item.proto = Protocol(IP::Addr::from_string(host).is_ipv6() ? Protocol::TCPv6 : Protocol::TCPv4);
+	  listen_item.ssl = Listen::Item::SSLOff;
+	  listen_item.n_threads = 1;
+	}
+
+	~Exporter()
+	{
+	  stop();
+	}
+
+	// Bind the listen socket and start serving scrapes.
+	// Throws if the socket can't be bound.
+	void start()
+	{
+	  WS::Server::Config::Ptr hconf = new WS::Server::Config();
+	  hconf->http_server_id = "OpenVPN-Metrics";
+	  hconf->frame = frame_init_simple(2048);
+	  hconf->stats.reset(new SessionStats());
+	  hconf->max_headers = 64;
+	  hconf->max_header_bytes = 4096;
+	  hconf->header_views = true;
+	  hconf->max_content_bytes = 0;
+	  hconf->general_timeout = 15;
+
+	  listener.reset(new WS::Server::Listener(io_context, hconf, listen_item, new Factory(this)));
+	  listener->start();
+	  thread.reset(new std::thread([this]() {
+	    io_context.run();
+	  }));
+	}
+
+	void stop()
+	{
+	  if (thread)
+	    {
+	      openvpn_io::post(io_context, [this]() {
+		listener->stop();
+	      });
+	      thread->join();
+	      thread.reset();
+	    }
+	}
+
+	std::string render()
+	{
+	  OpenMetrics::Writer w;
+	  for (auto& s : sources)
+	    s->render_metrics(w);
+	  return w.str();
+	}
+
+      private:
+	class Client : public WS::Server::Listener::Client
+	{
+	public:
+	  Client(WS::Server::Listener::Client::Initializer& ci, Exporter* parent_arg)
+	    : WS::Server::Listener::Client(ci),
+	      parent(parent_arg)
+	  {
+	  }
+
+	private:
+	  virtual void http_request_received() override
+	  {
+	    const HTTP::Request& req = request();
+	    WS::Server::ContentInfo ci;
+	    ci.no_cache = true;
+	    ci.keepalive = keepalive_request();
+	    if (req.method == "GET" && (req.uri == "/metrics" || string::starts_with(req.uri, "/metrics?")))
+	      {
+		out = buf_from_string(parent->render());
+		ci.http_status = HTTP::Status::OK;
+		ci.type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+	      }
+	    else
+	      {
+		out = buf_from_string("not found\n");
+		ci.http_status = HTTP::Status::NotFound;
+		ci.type = "text/plain";
+	      }
+	    ci.length = out->size();
+	    generate_reply_headers(ci);
+	  }
+
+	  virtual void http_content_in(BufferAllocated& buf) override
+	  {
+	  }
+
+	  virtual BufferPtr http_content_out() override
+	  {
+	    BufferPtr ret;
+	    ret.swap(out);
+	    return ret;
+	  }
+
+	  virtual bool http_out_eof() override
+	  {
+	    return true;
+	  }
+
+	  virtual bool http_stop(const int status, const std::string& description) override
+	  {
+	    return status == WS::Server::Status::E_SUCCESS;
+	  }
+
+	  Exporter* parent;
+	  BufferPtr out;
+	};
+
+	struct Factory : public WS::Server::Listener::Client::Factory
+	{
+	  Factory(Exporter* parent_arg)
+	    : parent(parent_arg)
+	  {
+	  }
+
+	  virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+	  {
+	    return new Client(ci, parent);
+	  }
+
+	  Exporter* parent;
+	};
+
+	const SourceList sources;
+	Listen::Item listen_item;
+	openvpn_io::io_context io_context{1};
+	WS::Server::Listener::Ptr listener;
+	std::unique_ptr<std::thread> thread;
+      };
+    }
+  }
+}
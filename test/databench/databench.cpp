@@ -0,0 +1,735 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Client data path benchmark: measures packets per second and per-packet
+// latency through the complete ClientProto::Session data path, for each
+// data channel cipher, compression method and packet size.
+//
+// A packet injected at the tun side of the session is compressed,
+// encrypted and handed to a loopback transport, which delivers it to
+// an in-process server ProtoContext.  The server decrypts it and echoes
+// it back encrypted, and the session decrypts it and writes it to the
+// benchmark tun, where its round trip time is taken from a timestamp
+// in the payload.  Each hop is posted to the io_context, as a real
+// transport or tun read completion would be.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/log/lognull.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/io/io.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/init/initprocess.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/client/cliproto.hpp>
+#include <openvpn/client/clievent.hpp>
+#include <openvpn/ip/ip4.hpp>
+#include <openvpn/ip/udp.hpp>
+#include <openvpn/ip/csum.hpp>
+#include <openvpn/log/latencyhist.hpp>
+#include <openvpn/common/allocstat_new.hpp>
+
+#ifndef DATABENCH_SSL_DIR
+#define DATABENCH_SSL_DIR "../ssl/"
+#endif
+
+using namespace openvpn;
+
+namespace {
+
+  enum {
+    TIMESTAMP_OFFSET = sizeof(IPv4Header) + sizeof(UDPHeader),
+  };
+
+  struct Result
+  {
+    double kpps = 0.0;
+    std::uint64_t rtt_p50 = 0;     // tun -> server -> tun, ns
+    std::uint64_t rtt_p99 = 0;
+    std::uint64_t tun_to_net = 0;  // client encrypt side p50, ns
+    std::uint64_t net_to_tun = 0;  // client decrypt side p50, ns
+    double allocs[AllocStats::N_PHASES] = {}; // client allocations per packet
+  };
+
+  struct Settings
+  {
+    CryptoAlgs::Type cipher;
+    CryptoAlgs::Type digest;
+    CompressContext::Type comp;
+    std::string comp_name;
+    size_t size;
+    unsigned long iterations;
+    unsigned int window;
+  };
+
+  // Server end of the loopback link
+  class Server : public ProtoContext
+  {
+  public:
+    Server(const ProtoContext::Config::Ptr& config,
+	   const SessionStats::Ptr& stats,
+	   openvpn_io::io_context& io_context,
+	   const std::string& push_reply_arg)
+      : ProtoContext(config, stats),
+	push_reply(push_reply_arg),
+	housekeeping_timer(io_context)
+    {
+    }
+
+    // transport_recv() of the client session
+    std::function<void(BufferAllocated&)> to_client;
+
+    void start_server()
+    {
+      update_now();
+      reset();
+      start();
+      flush(true);
+    }
+
+    void recv(BufferAllocated& buf)
+    {
+      update_now();
+      const PacketType pt = packet_type(buf);
+      if (pt.is_data())
+	{
+	  data_decrypt(pt, buf);
+	  if (buf.size())
+	    {
+	      data_encrypt(buf); // echo
+	      if (buf.size())
+		to_client(buf);
+	    }
+	}
+      else if (pt.is_control())
+	{
+	  control_net_recv(pt, std::move(buf));
+	  flush(true);
+	}
+      set_housekeeping_timer();
+    }
+
+    void stop()
+    {
+      housekeeping_timer.cancel();
+    }
+
+  private:
+    void control_net_send(const Buffer& net_buf) override
+    {
+      BufferAllocated buf(net_buf, 0);
+      to_client(buf);
+    }
+
+    void control_recv(BufferPtr&& app_bp) override
+    {
+      if (read_control_string<std::string>(*app_bp) == "PUSH_REQUEST")
+	{
+	  write_control_string(push_reply);
+	  flush(true);
+	}
+    }
+
+    void set_housekeeping_timer()
+    {
+      const Time next = next_housekeeping();
+      if (next.is_infinite())
+	return;
+      housekeeping_timer.expires_at(next);
+      housekeeping_timer.async_wait([this](const openvpn_io::error_code& error)
+                                    {
+                                      if (error)
+                                        return;
+                                      update_now();
+                                      housekeeping();
+                                      set_housekeeping_timer();
+                                    });
+    }
+
+    const std::string push_reply;
+    AsioTimer housekeeping_timer;
+  };
+
+  // Client transport that delivers to a Server in the same process
+  class LoopbackTransport : public TransportClient
+  {
+  public:
+    typedef RCPtr<LoopbackTransport> Ptr;
+
+    LoopbackTransport(openvpn_io::io_context& io_context_arg,
+		      TransportClientParent* parent_arg,
+		      Server& server_arg)
+      : io_context(io_context_arg),
+	parent(parent_arg),
+	server(server_arg)
+    {
+    }
+
+    // server -> client
+    void deliver(BufferAllocated& buf)
+    {
+      BufferPtr bp(new BufferAllocated());
+      bp->move(buf);
+      openvpn_io::post(io_context, [self=Ptr(this), bp]()
+                       {
+                         if (!self->halt)
+                           self->parent->transport_recv(*bp);
+                       });
+    }
+
+    void transport_start() override
+    {
+      openvpn_io::post(io_context, [self=Ptr(this)]()
+                       {
+                         if (!self->halt)
+                           self->parent->transport_connecting();
+                       });
+    }
+
+    void stop() override
+    {
+      halt = true;
+    }
+
+    bool transport_send_const(const Buffer& buf) override
+    {
+      BufferAllocated copy(buf, 0);
+      return transport_send(copy);
+    }
+
+    // client -> server
+    bool transport_send(BufferAllocated& buf) override
+    {
+      if (halt)
+	return false;
+      BufferPtr bp(new BufferAllocated());
+      bp->move(buf);
+      openvpn_io::post(io_context, [self=Ptr(this), bp]()
+                       {
+                         if (!self->halt)
+                           self->server.recv(*bp);
+                       });
+      return true;
+    }
+
+    bool transport_send_queue_empty() override { return true; }
+    bool transport_has_send_queue() override { return false; }
+    void transport_stop_requeueing() override {}
+    unsigned int transport_send_queue_size() override { return 0; }
+    void reset_align_adjust(const size_t align_adjust) override {}
+    IP::Addr server_endpoint_addr() const override { return IP::Addr::from_string("127.0.0.1"); }
+
+    void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const override
+    {
+      host = "loopback";
+      port = "0";
+      proto = transport_protocol().str();
+      ip_addr = "127.0.0.1";
+    }
+
+    Protocol transport_protocol() const override { return Protocol(Protocol::UDPv4); }
+    void transport_reparent(TransportClientParent* parent_arg) override { parent = parent_arg; }
+
+  private:
+    openvpn_io::io_context& io_context;
+    TransportClientParent* parent;
+    Server& server;
+    bool halt = false;
+  };
+
+  class LoopbackTransportFactory : public TransportClientFactory
+  {
+  public:
+    typedef RCPtr<LoopbackTransportFactory> Ptr;
+
+    LoopbackTransportFactory(Server& server_arg)
+      : server(server_arg)
+    {
+    }
+
+    TransportClient::Ptr new_transport_client_obj(openvpn_io::io_context& io_context,
+						  TransportClientParent* parent) override
+    {
+      transport.reset(new LoopbackTransport(io_context, parent, server));
+      return transport;
+    }
+
+    LoopbackTransport::Ptr transport;
+
+  private:
+    Server& server;
+  };
+
+  // Tun that hands written packets to a callback and lets the
+  // benchmark inject packets as if they had been read from it
+  class BenchTun : public TunClient
+  {
+  public:
+    typedef RCPtr<BenchTun> Ptr;
+
+    BenchTun(TunClientParent& parent_arg)
+      : parent(parent_arg)
+    {
+    }
+
+    std::function<void(BufferAllocated&)> on_send;
+
+    void inject(BufferAllocated& buf)
+    {
+      if (!halt)
+	parent.tun_recv(buf);
+    }
+
+    void tun_start(const OptionList&, TransportClient&, CryptoDCSettings&) override
+    {
+      parent.tun_connected();
+    }
+
+    void stop() override { halt = true; }
+    void set_disconnect() override {}
+
+    bool tun_send(BufferAllocated& buf) override
+    {
+      if (halt)
+	return false;
+      on_send(buf);
+      return true;
+    }
+
+    std::string tun_name() const override { return "BENCH"; }
+    std::string vpn_ip4() const override { return "10.8.0.2"; }
+    std::string vpn_ip6() const override { return ""; }
+
+  private:
+    TunClientParent& parent;
+    bool halt = false;
+  };
+
+  class BenchTunFactory : public TunClientFactory
+  {
+  public:
+    typedef RCPtr<BenchTunFactory> Ptr;
+
+    TunClient::Ptr new_tun_client_obj(openvpn_io::io_context& io_context,
+				      TunClientParent& parent,
+				      TransportClient* transcli) override
+    {
+      tun.reset(new BenchTun(parent));
+      return tun;
+    }
+
+    BenchTun::Ptr tun;
+  };
+
+  class NullEventQueue : public ClientEvent::Queue
+  {
+  public:
+    void add_event(ClientEvent::Base::Ptr event) override {}
+  };
+
+  struct Keys
+  {
+    std::string server_crt;
+    std::string server_key;
+    std::string dh_pem;
+  };
+
+  // one connection, carrying s.iterations echoed packets
+  class Run : public ClientProto::NotifyCallback
+  {
+  public:
+    Run(const Settings& s_arg, const Keys& keys)
+      : s(s_arg),
+	frame(frame_init(true, 1500, 1024, false)),
+	rng(new SSLLib::RandomAPI(false)),
+	cli_stats(new SessionStats()),
+	serv_stats(new SessionStats()),
+	watchdog(io_context)
+    {
+      cli_stats->enable_latency();
+
+      // server, no peer verification so that the test
+      // certificates' validity period doesn't matter
+      SSLLib::SSLAPI::Config::Ptr sc(new SSLLib::SSLAPI::Config());
+      sc->set_mode(Mode(Mode::SERVER));
+      sc->set_flags(SSLConst::NO_VERIFY_PEER);
+      sc->set_frame(frame);
+      sc->set_rng(rng);
+      sc->load_cert(keys.server_crt);
+      sc->load_private_key(keys.server_key);
+      sc->load_dh(keys.dh_pem);
+
+      ProtoContext::Config::Ptr sp(new ProtoContext::Config());
+      init_proto_config(*sp, sc->new_factory(), serv_stats);
+      sp->comp_ctx = CompressContext(s.comp, false);
+      sp->dc.set_cipher(s.cipher);
+      sp->dc.set_digest(s.digest);
+      sp->enable_op32 = true;
+      sp->remote_peer_id = 0;
+
+      std::string push_reply = "PUSH_REPLY,ifconfig 10.8.0.2 255.255.255.0,peer-id 0,cipher ";
+      push_reply += CryptoAlgs::name(s.cipher);
+      if (s.digest != CryptoAlgs::NONE)
+	push_reply += std::string(",auth ") + CryptoAlgs::name(s.digest);
+      if (s.comp == CompressContext::LZO)
+	push_reply += ",comp-lzo yes";
+      else if (s.comp != CompressContext::NONE)
+	push_reply += ",compress " + s.comp_name;
+      server.reset(new Server(sp, serv_stats, io_context, push_reply));
+
+      // client
+      SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
+      cc->set_mode(Mode(Mode::CLIENT));
+      cc->set_flags(SSLConst::NO_VERIFY_PEER);
+      cc->set_local_cert_enabled(false);
+      cc->set_frame(frame);
+      cc->set_rng(rng);
+
+      ProtoContext::Config::Ptr cp(new ProtoContext::Config());
+      init_proto_config(*cp, cc->new_factory(), cli_stats);
+      cp->dc_deferred = true;
+      cp->dc.set_cipher(s.cipher);
+      cp->dc.set_digest(s.digest);
+
+      ProtoContextOptions::Ptr pco(new ProtoContextOptions());
+      pco->parse_compression_mode("yes");
+
+      transport_factory.reset(new LoopbackTransportFactory(*server));
+      tun_factory.reset(new BenchTunFactory());
+
+      ClientProto::Session::Config sc_config;
+      sc_config.proto_context_config = cp;
+      sc_config.proto_context_options = pco;
+      sc_config.transport_factory = transport_factory;
+      sc_config.tun_factory = tun_factory;
+      sc_config.cli_stats = cli_stats;
+      sc_config.cli_events.reset(new NullEventQueue());
+      session.reset(new ClientProto::Session(io_context, sc_config, this));
+
+      server->to_client = [this](BufferAllocated& buf)
+	{
+	  transport_factory->transport->deliver(buf);
+	};
+    }
+
+    Result run()
+    {
+      watchdog.expires_after(Time::Duration::seconds(30));
+      watchdog.async_wait([this](const openvpn_io::error_code& error)
+                          {
+                            if (!error)
+                              finish("timed out");
+                          });
+      server->start_server();
+      session->start();
+      io_context.run();
+
+      if (!error.empty())
+	OPENVPN_THROW_EXCEPTION(error);
+
+      Result r;
+      const double secs = double(end_ns - start_ns) / 1e9;
+      r.kpps = double(s.iterations) / secs / 1e3;
+      r.rtt_p50 = rtt.percentile(0.50);
+      r.rtt_p99 = rtt.percentile(0.99);
+      r.tun_to_net = cli_stats->latency(SessionStats::LAT_TUN_TO_NET)->percentile(0.50);
+      r.net_to_tun = cli_stats->latency(SessionStats::LAT_NET_TO_TUN)->percentile(0.50);
+      const SessionStats::Snapshot end = cli_stats->snapshot();
+      for (int p = AllocStats::DATA_ENCRYPT; p < AllocStats::N_PHASES; ++p)
+	{
+	  const size_t i = SessionStats::ALLOCS_DATA_ENCRYPT + p - AllocStats::DATA_ENCRYPT;
+	  r.allocs[p] = double(end.stats[i] - start_stats.stats[i]) / s.iterations;
+	}
+      return r;
+    }
+
+  private:
+    void init_proto_config(ProtoContext::Config& c,
+			   SSLFactoryAPI::Ptr ssl_factory,
+			   const SessionStats::Ptr& stats)
+    {
+      c.ssl_factory = std::move(ssl_factory);
+      c.dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, stats, rng));
+      c.tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+      c.frame = frame;
+      c.now = &now;
+      c.rng = rng;
+      c.prng = rng;
+      c.protocol = Protocol(Protocol::UDPv4);
+      c.layer = Layer(Layer::OSI_LAYER_3);
+      c.reliable_window = 4;
+      c.max_ack_list = 4;
+      c.pid_mode = PacketIDReceive::UDP_MODE;
+      c.handshake_window = Time::Duration::seconds(60);
+      c.become_primary = c.handshake_window;
+      c.tls_timeout = Time::Duration::seconds(1);
+      c.renegotiate = Time::Duration::infinite();
+      c.expire = Time::Duration::infinite();
+      c.keepalive_ping = Time::Duration::seconds(10);
+      c.keepalive_timeout = Time::Duration::seconds(60);
+    }
+
+    void client_proto_connected() override
+    {
+      tun = tun_factory->tun;
+      tun->on_send = [this](BufferAllocated& buf) { tun_send(buf); };
+
+      // packet template: IPv4/UDP from the pushed address, with a
+      // compressible payload
+      templ.resize(s.size);
+      for (size_t i = 0; i < templ.size(); ++i)
+	templ[i] = std::uint8_t(i & 0x3f);
+      IPv4Header* ip = reinterpret_cast<IPv4Header*>(templ.data());
+      ip->version_len = IPv4Header::ver_len(4, sizeof(IPv4Header));
+      ip->tos = 0;
+      ip->tot_len = htons(std::uint16_t(s.size));
+      ip->id = 0;
+      ip->frag_off = 0;
+      ip->ttl = 64;
+      ip->protocol = IPCommon::UDP;
+      ip->saddr = htonl(0x0a080002); // 10.8.0.2
+      ip->daddr = htonl(0x0a080001); // 10.8.0.1
+      ip->check = 0;
+      ip->check = IPChecksum::checksum(ip, sizeof(IPv4Header));
+      UDPHeader* udp = reinterpret_cast<UDPHeader*>(templ.data() + sizeof(IPv4Header));
+      udp->source = htons(9);
+      udp->dest = htons(9);
+      udp->len = htons(std::uint16_t(s.size - sizeof(IPv4Header)));
+      udp->check = 0;
+
+      start_stats = cli_stats->snapshot();
+      start_ns = LatencyHistogram::now_ns();
+      for (unsigned int i = 0; i < s.window && n_sent < s.iterations; ++i)
+	post_inject();
+    }
+
+    void client_proto_terminate() override
+    {
+      finish("session terminated: " + std::string(session->fatal_reason()));
+    }
+
+    void post_inject()
+    {
+      ++n_sent;
+      openvpn_io::post(io_context, [this]() { inject(); });
+    }
+
+    void inject()
+    {
+      if (done)
+	return;
+      BufferAllocated buf;
+      frame->prepare(Frame::READ_TUN, buf);
+      buf.write(templ.data(), templ.size());
+      const std::uint64_t ts = LatencyHistogram::now_ns();
+      std::memcpy(buf.data() + TIMESTAMP_OFFSET, &ts, sizeof(ts));
+      tun->inject(buf);
+    }
+
+    void tun_send(BufferAllocated& buf)
+    {
+      std::uint64_t ts;
+      if (buf.size() < TIMESTAMP_OFFSET + sizeof(ts))
+	return;
+      std::memcpy(&ts, buf.c_data() + TIMESTAMP_OFFSET, sizeof(ts));
+      rtt.record(LatencyHistogram::now_ns() - ts);
+      if (++n_received >= s.iterations)
+	{
+	  end_ns = LatencyHistogram::now_ns();
+	  finish(std::string());
+	}
+      else if (n_sent < s.iterations)
+	post_inject();
+    }
+
+    void finish(const std::string& err)
+    {
+      if (done)
+	return;
+      done = true;
+      error = err;
+      watchdog.cancel();
+      session->stop(false);
+      server->stop();
+    }
+
+    const Settings& s;
+    openvpn_io::io_context io_context;
+    Time now;
+    Frame::Ptr frame;
+    RandomAPI::Ptr rng;
+    SessionStats::Ptr cli_stats;
+    SessionStats::Ptr serv_stats;
+    std::unique_ptr<Server> server;
+    LoopbackTransportFactory::Ptr transport_factory;
+    BenchTunFactory::Ptr tun_factory;
+    BenchTun::Ptr tun;
+    ClientProto::Session::Ptr session;
+    AsioTimer watchdog;
+    std::vector<std::uint8_t> templ;
+    LatencyHistogram rtt;
+    unsigned long n_sent = 0;
+    unsigned long n_received = 0;
+    SessionStats::Snapshot start_stats;
+    std::uint64_t start_ns = 0;
+    std::uint64_t end_ns = 0;
+    bool done = false;
+    std::string error;
+  };
+
+  bool selected(const CryptoAlgs::Type cipher, const std::vector<std::string>& ciphers)
+  {
+    if (ciphers.empty())
+      return true;
+    for (const auto& name : ciphers)
+      {
+	if (string::strcasecmp(name, CryptoAlgs::name(cipher)) == 0)
+	  return true;
+      }
+    return false;
+  }
+
+  inline double us(const std::uint64_t ns)
+  {
+    return double(ns) / 1e3;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  InitProcess::init();
+  int ret = 0;
+
+  try {
+    // --window=N packets in flight (default 32)
+    unsigned int window = 32;
+    if (argc >= 2 && string::starts_with(argv[1], "--window="))
+      {
+	window = std::strtoul(argv[1] + std::strlen("--window="), nullptr, 10);
+	--argc;
+	++argv;
+      }
+
+    const unsigned long iterations = argc >= 2 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    if (!iterations || !window)
+      OPENVPN_THROW_EXCEPTION("usage: databench [--window=N] [iterations] [cipher...]");
+    const std::vector<std::string> ciphers(argv + std::min(argc, 2), argv + argc);
+
+    Keys keys;
+    keys.server_crt = read_text(DATABENCH_SSL_DIR "server.crt");
+    keys.server_key = read_text(DATABENCH_SSL_DIR "server.key");
+    keys.dh_pem = read_text(DATABENCH_SSL_DIR "dh.pem");
+
+    struct Comp {
+      CompressContext::Type type;
+      const char* name;
+    };
+    static const Comp comps[] = {
+      { CompressContext::NONE, "none" },
+      { CompressContext::COMP_STUBv2, "stub-v2" },
+      { CompressContext::LZO, "lzo" },
+      { CompressContext::LZ4v2, "lz4-v2" },
+    };
+    static const size_t sizes[] = { 64, 512, 1400 };
+
+    std::cout << "backend: " << get_ssl_library_version() << std::endl
+	      << "iterations: " << iterations << ", window: " << window << std::endl
+	      << std::left << std::setw(18) << "cipher" << std::setw(8) << "digest" << std::setw(9) << "comp"
+	      << std::right << std::setw(6) << "size"
+	      << std::setw(10) << "kpps"
+	      << std::setw(10) << "rtt p50"
+	      << std::setw(10) << "rtt p99"
+	      << std::setw(10) << "tun>net"
+	      << std::setw(10) << "net>tun"
+	      << "  (us)"
+#ifdef OPENVPN_ALLOC_STATS
+	      << "  allocs/pkt: enc dec tunr tunw netr netw ctl"
+#endif
+	      << std::endl;
+
+    for (int c = CryptoAlgs::NONE + 1; c < CryptoAlgs::SIZE; ++c)
+      {
+	const CryptoAlgs::Type cipher = CryptoAlgs::Type(c);
+	const CryptoAlgs::Alg& alg = CryptoAlgs::get(cipher);
+	if ((alg.flags() & (CryptoAlgs::F_CIPHER|CryptoAlgs::F_ALLOW_DC)) != (CryptoAlgs::F_CIPHER|CryptoAlgs::F_ALLOW_DC))
+	  continue;
+	if (!selected(cipher, ciphers))
+	  continue;
+	const CryptoAlgs::Type digest = (alg.flags() & CryptoAlgs::AEAD) ? CryptoAlgs::NONE : CryptoAlgs::SHA256;
+
+	for (const Comp& comp : comps)
+	  {
+	    if (!CompressContext::compressor_available(comp.type))
+	      continue;
+	    for (const size_t size : sizes)
+	      {
+		Settings s{cipher, digest, comp.type, comp.name, size, iterations, window};
+		std::cout << std::left << std::setw(18) << alg.name()
+			  << std::setw(8) << (digest == CryptoAlgs::NONE ? "-" : CryptoAlgs::name(digest))
+			  << std::setw(9) << comp.name
+			  << std::right << std::setw(6) << size;
+		try {
+		  Run run(s, keys);
+		  const Result r = run.run();
+		  std::cout << std::fixed << std::setprecision(1)
+			    << std::setw(10) << r.kpps
+			    << std::setw(10) << us(r.rtt_p50)
+			    << std::setw(10) << us(r.rtt_p99)
+			    << std::setw(10) << us(r.tun_to_net)
+			    << std::setw(10) << us(r.net_to_tun);
+#ifdef OPENVPN_ALLOC_STATS
+		  std::cout << "      " << std::setprecision(2);
+		  for (int p = AllocStats::DATA_ENCRYPT; p < AllocStats::N_PHASES; ++p)
+		    std::cout << ' ' << r.allocs[p];
+#endif
+		  std::cout << std::endl;
+		}
+		catch (const std::exception& e)
+		  {
+		    std::cout << "  skipped: " << e.what() << std::endl;
+		  }
+	      }
+	  }
+      }
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      ret = 1;
+    }
+
+  InitProcess::uninit();
+  return ret;
+}
@@ -0,0 +1,314 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Data channel microbenchmark: measures CryptoDCInstance encrypt/decrypt
+// throughput for each data channel cipher/digest pair and payload size.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define DCBENCH_TSC
+#endif
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/init/initprocess.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#ifdef USE_OPENSSL
+#include <openvpn/openssl/crypto/provider.hpp>
+#endif
+
+using namespace openvpn;
+
+// count heap allocations so that we can report allocations per packet
+static unsigned long long n_alloc = 0;
+
+void* operator new(std::size_t size)
+{
+  ++n_alloc;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  ++n_alloc;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+  inline std::uint64_t ticks()
+  {
+#ifdef DCBENCH_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+#ifdef DCBENCH_TSC
+  const char *tick_unit = "cyc/B";
+#else
+  const char *tick_unit = "ns/B";
+#endif
+
+  struct Result
+  {
+    std::uint64_t ticks = 0;
+    double seconds = 0.0;
+    unsigned long long allocs = 0;
+  };
+
+  StaticKey random_key(RandomAPI& rng)
+  {
+    StaticKey k;
+    k.init_from_rng(rng, 64);
+    return k;
+  }
+
+  CryptoDCInstance::Ptr new_instance(CryptoDCFactory& factory,
+				     const CryptoAlgs::Type cipher,
+				     const CryptoAlgs::Type digest,
+				     const StaticKey& k1,
+				     const StaticKey& k2,
+				     const StaticKey& h1,
+				     const StaticKey& h2,
+				     const SessionStats::Ptr& stats)
+  {
+    CryptoDCContext::Ptr ctx = factory.new_obj(cipher, digest);
+    CryptoDCInstance::Ptr dc = ctx->new_obj(0);
+    const unsigned int defined = dc->defined();
+    if (defined & CryptoDCInstance::CIPHER_DEFINED)
+      dc->init_cipher(StaticKey(k1), StaticKey(k2));
+    if (defined & CryptoDCInstance::HMAC_DEFINED)
+      dc->init_hmac(StaticKey(h1), StaticKey(h2));
+    dc->init_pid(PacketID::SHORT_FORM,
+		 PacketIDReceive::UDP_MODE,
+		 PacketID::SHORT_FORM,
+		 "DATA", 0,
+		 stats);
+    return dc;
+  }
+
+  void run(CryptoDCFactory& factory,
+	   RandomAPI& rng,
+	   const Frame::Ptr& frame,
+	   const CryptoAlgs::Type cipher,
+	   const CryptoAlgs::Type digest,
+	   const unsigned long iterations,
+	   const char *impl = nullptr)
+  {
+    static const size_t sizes[] = { 64, 128, 256, 512, 1024, 1400, 1500 };
+    static const unsigned char op32[] = { 0x48, 0x00, 0x00, 0x00 };
+
+    SessionStats::Ptr stats(new SessionStats());
+    const StaticKey k1 = random_key(rng);
+    const StaticKey k2 = random_key(rng);
+    const StaticKey h1 = random_key(rng);
+    const StaticKey h2 = random_key(rng);
+    CryptoDCInstance::Ptr enc = new_instance(factory, cipher, digest, k1, k2, h1, h2, stats);
+    CryptoDCInstance::Ptr dec = new_instance(factory, cipher, digest, k2, k1, h2, h1, stats);
+
+    for (const size_t size : sizes)
+      {
+	BufferAllocated buf;
+	frame->prepare(Frame::READ_TUN, buf);
+	rng.rand_bytes(buf.write_alloc(size), size);
+
+	// warm up pools and caches
+	for (unsigned int i = 0; i < 64; ++i)
+	  {
+	    enc->encrypt(buf, 0, op32);
+	    if (dec->decrypt(buf, 0, op32) != Error::SUCCESS)
+	      throw Exception("decrypt failed during warmup");
+	  }
+
+	Result er, dr;
+	for (unsigned long i = 0; i < iterations; ++i)
+	  {
+	    const unsigned long long a0 = n_alloc;
+	    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	    const std::uint64_t c0 = ticks();
+	    enc->encrypt(buf, 0, op32);
+	    const std::uint64_t c1 = ticks();
+	    const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+	    const unsigned long long a1 = n_alloc;
+	    const Error::Type err = dec->decrypt(buf, 0, op32);
+	    const std::uint64_t c2 = ticks();
+	    const std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+	    const unsigned long long a2 = n_alloc;
+	    if (err != Error::SUCCESS || buf.size() != size)
+	      throw Exception("decrypt failed");
+
+	    er.ticks += c1 - c0;
+	    dr.ticks += c2 - c1;
+	    er.seconds += std::chrono::duration<double>(t1 - t0).count();
+	    dr.seconds += std::chrono::duration<double>(t2 - t1).count();
+	    er.allocs += a1 - a0;
+	    dr.allocs += a2 - a1;
+	  }
+
+	const double bytes = double(size) * iterations;
+	std::cout << std::left << std::setw(18) << CryptoAlgs::name(cipher)
+		  << std::setw(8) << (impl ? impl : digest != CryptoAlgs::NONE ? CryptoAlgs::name(digest) : "-")
+		  << std::right << std::setw(6) << size
+		  << std::fixed << std::setprecision(2)
+		  << std::setw(10) << er.ticks / bytes
+		  << std::setw(10) << iterations / er.seconds / 1e6
+		  << std::setw(10) << double(er.allocs) / iterations
+		  << std::setw(10) << dr.ticks / bytes
+		  << std::setw(10) << iterations / dr.seconds / 1e6
+		  << std::setw(10) << double(dr.allocs) / iterations
+		  << std::endl;
+      }
+  }
+
+  bool selected(const CryptoAlgs::Type cipher, int argc, char* argv[])
+  {
+    if (argc <= 2)
+      return true;
+    for (int i = 2; i < argc; ++i)
+      {
+	if (CryptoAlgs::lookup(argv[i]) == cipher)
+	  return true;
+      }
+    return false;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  InitProcess::init();
+  int ret = 0;
+
+  try {
+    // --provider=NAME[,PROPQ] also runs the AEAD ciphers through
+    // OpenSSLCrypto::OffloadDCFactory, labelled "prov"
+    std::string provider_arg;
+    if (argc >= 2 && string::starts_with(argv[1], "--provider="))
+      {
+	provider_arg = argv[1] + std::strlen("--provider=");
+	--argc;
+	++argv;
+      }
+
+    const unsigned long iterations = argc >= 2 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    if (!iterations)
+      OPENVPN_THROW_EXCEPTION("usage: dcbench [--provider=NAME[,PROPQ]] [iterations] [cipher...]");
+
+    Frame::Ptr frame = frame_init(true, 1500, 1024, false);
+    RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+    CryptoDCSelect<SSLLib::CryptoAPI> factory(frame, SessionStats::Ptr(new SessionStats()), rng);
+    CryptoDCFactory::Ptr offload;
+    if (!provider_arg.empty())
+      {
+#ifdef USE_OPENSSL
+	const size_t comma = provider_arg.find(',');
+	const std::string name = provider_arg.substr(0, comma);
+	const std::string propq = comma != std::string::npos ? provider_arg.substr(comma + 1) : "provider=" + name;
+	OpenSSLCrypto::Provider::Ptr provider(new OpenSSLCrypto::Provider(name, propq));
+	offload.reset(new OpenSSLCrypto::OffloadDCFactory(frame, SessionStats::Ptr(new SessionStats()), rng, provider, 0));
+#else
+	OPENVPN_THROW_EXCEPTION("--provider requires OpenSSL");
+#endif
+      }
+
+    static const CryptoAlgs::Type hmac_digests[] = { CryptoAlgs::SHA1, CryptoAlgs::SHA256, CryptoAlgs::SHA512 };
+
+    std::cout << "backend: " << get_ssl_library_version() << std::endl
+	      << "iterations: " << iterations << std::endl
+	      << std::left << std::setw(18) << "cipher" << std::setw(8) << "digest"
+	      << std::right << std::setw(6) << "size"
+	      << std::setw(10) << (std::string("enc ") + tick_unit)
+	      << std::setw(10) << "enc Mpps"
+	      << std::setw(10) << "enc allc"
+	      << std::setw(10) << (std::string("dec ") + tick_unit)
+	      << std::setw(10) << "dec Mpps"
+	      << std::setw(10) << "dec allc"
+	      << std::endl;
+
+    for (int c = CryptoAlgs::NONE + 1; c < CryptoAlgs::SIZE; ++c)
+      {
+	const CryptoAlgs::Type cipher = CryptoAlgs::Type(c);
+	const CryptoAlgs::Alg& alg = CryptoAlgs::get(cipher);
+	if ((alg.flags() & (CryptoAlgs::F_CIPHER|CryptoAlgs::F_ALLOW_DC)) != (CryptoAlgs::F_CIPHER|CryptoAlgs::F_ALLOW_DC))
+	  continue;
+	if (!selected(cipher, argc, argv))
+	  continue;
+
+	if (alg.flags() & CryptoAlgs::AEAD)
+	  {
+	    try {
+	      run(factory, *rng, frame, cipher, CryptoAlgs::NONE, iterations);
+	      if (offload)
+		run(*offload, *rng, frame, cipher, CryptoAlgs::NONE, iterations, "prov");
+	    }
+	    catch (const std::exception& e)
+	      {
+		std::cout << alg.name() << ": skipped: " << e.what() << std::endl;
+	      }
+	  }
+	else
+	  {
+	    for (const CryptoAlgs::Type digest : hmac_digests)
+	      {
+		try {
+		  run(factory, *rng, frame, cipher, digest, iterations);
+		}
+		catch (const std::exception& e)
+		  {
+		    std::cout << alg.name() << '/' << CryptoAlgs::name(digest) << ": skipped: " << e.what() << std::endl;
+		  }
+	      }
+	  }
+      }
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      ret = 1;
+    }
+
+  InitProcess::uninit();
+  return ret;
+}
@@ -0,0 +1,969 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Server load generator: runs many emulated clients against a real
+// OpenVPN server over UDP or TCP.  Each client is a client-side
+// ProtoContext, as in test/ssl/proto.cpp, driven by its own socket:
+// it does the TLS handshake, pulls options, optionally renegotiates
+// or reconnects on a schedule, and sends bursts of data channel
+// packets.  Once a second the tool reports connected clients,
+// handshakes/s, handshake latency percentiles, data channel
+// throughput and (with --server-pid) the server's RSS.  With
+// --gremlin, each client's traffic passes through a seeded network
+// emulation (see openvpn/transport/gremlin.hpp).  See README.txt.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/io/io.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/init/initprocess.hpp>
+#include <openvpn/random/bufrand.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/ssl/proto_context_options.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/options/continuation.hpp>
+#include <openvpn/transport/pktstream.hpp>
+#include <openvpn/transport/gremlin.hpp>
+#include <openvpn/addr/ipv4.hpp>
+#include <openvpn/ip/ip4.hpp>
+#include <openvpn/ip/udp.hpp>
+#include <openvpn/ip/csum.hpp>
+#include <openvpn/log/latencyhist.hpp>
+
+using namespace openvpn;
+
+namespace {
+
+  struct Options
+  {
+    std::string profile;
+    std::string host;
+    std::string port = "1194";
+    Protocol proto = Protocol(Protocol::UDPv4);
+    std::string username;
+    std::string password;
+    unsigned int clients = 100;
+    unsigned int threads = 1;
+    unsigned int rate = 100;        // new clients per second, over all threads
+    unsigned int duration = 60;     // seconds
+    unsigned int reneg = 0;         // renegotiate every N seconds (0 for profile default)
+    unsigned int reconnect = 0;     // reconnect every N seconds (0 for never)
+    unsigned int pps = 0;           // data packets per second per client
+    unsigned int size = 1000;       // data packet size (IPv4)
+    std::string gremlin;            // network emulation, see Gremlin::Config
+    int server_pid = 0;
+  };
+
+  // Counters of one worker thread, read by the reporting thread.
+  struct Counters
+  {
+    std::atomic<std::uint64_t> connected{0};
+    std::atomic<std::uint64_t> failures{0};
+    std::atomic<std::uint64_t> tx_bytes{0}; // data channel, as sent on the wire
+    std::atomic<std::uint64_t> rx_bytes{0};
+  };
+
+  class Worker;
+
+  class EmuClient : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<EmuClient> Ptr;
+
+    EmuClient(Worker& worker_arg, const unsigned int id);
+
+    void start();
+    void stop();
+
+    // called by EmuSession
+    void net_send(const Buffer& net_buf);
+    void control_recv(const std::string& msg);
+    void active();
+    void client_auth(Buffer& buf);
+
+  private:
+    class EmuSession : public ProtoContext
+    {
+    public:
+      EmuSession(EmuClient& parent_arg,
+		 const ProtoContext::Config::Ptr& config,
+		 const SessionStats::Ptr& stats)
+	: ProtoContext(config, stats),
+	  parent(parent_arg)
+      {
+      }
+
+      using ProtoContext::write_auth_string;
+      using ProtoContext::write_control_string;
+
+    private:
+      void control_net_send(const Buffer& net_buf) override
+      {
+	parent.net_send(net_buf);
+      }
+
+      void control_recv(BufferPtr&& app_bp) override
+      {
+	parent.control_recv(read_control_string<std::string>(*app_bp));
+      }
+
+      void client_auth(Buffer& buf) override
+      {
+	parent.client_auth(buf);
+      }
+
+      void active() override
+      {
+	parent.active();
+      }
+
+      EmuClient& parent;
+    };
+
+    void connected(const openvpn_io::error_code& error, const unsigned int gen);
+    void queue_read();
+    void handle_read(const openvpn_io::error_code& error, const size_t bytes, const unsigned int gen);
+    void recv_bytes(BufferAllocated& buf, const unsigned int gen);
+    void sock_send(const Buffer& net_buf);
+    void recv_packet(BufferAllocated& buf);
+    void queue_write();
+    void set_housekeeping_timer();
+    void housekeeping();
+    void data_burst();
+    void fail(const std::string& reason);
+    void restart_after(const Time::Duration& delay);
+    void close();
+
+    Worker& worker;
+    unsigned int generation = 0;
+    std::unique_ptr<EmuSession> session;
+    std::unique_ptr<OptionListContinuation> pushed;
+    openvpn_io::ip::udp::socket udp;
+    openvpn_io::ip::tcp::socket tcp;
+    BufferAllocated read_buf;
+    PacketStream pktstream;
+    std::deque<BufferPtr> write_queue;
+    bool write_pending = false;
+    AsioTimer housekeeping_timer;
+    AsioTimer data_timer;
+    AsioTimer restart_timer;
+    bool up = false;
+    std::uint32_t tun_src = 0; // net byte order
+    std::uint32_t tun_dst = 0;
+    std::unique_ptr<Gremlin::SendRecvQueue> gremlin;
+  };
+
+  class Worker
+  {
+  public:
+    Worker(const Options& opt_arg,
+	   const OptionList& profile,
+	   const openvpn_io::ip::udp::endpoint& udp_ep_arg,
+	   const openvpn_io::ip::tcp::endpoint& tcp_ep_arg,
+	   const unsigned int first_client_arg,
+	   const unsigned int n_clients_arg)
+      : opt(opt_arg),
+	udp_ep(udp_ep_arg),
+	tcp_ep(tcp_ep_arg),
+	first_client(first_client_arg),
+	n_clients(n_clients_arg),
+	stats(new SessionStats()),
+	ramp_timer(io_context)
+    {
+      stats->enable_latency();
+      handshake_hist = stats->latency(SessionStats::LAT_HANDSHAKE);
+
+      rng.reset(new SSLLib::RandomAPI(false));
+      prng.reset(new BufferedRandom(rng));
+      frame = frame_init(true, 0, 0, false);
+      pco.reset(new ProtoContextOptions());
+
+      SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
+      cc->set_frame(frame);
+      cc->set_rng(rng);
+      cc->set_local_cert_enabled(profile.exists("cert") || profile.exists("pkcs12"));
+      cc->load(profile, SSLConfigAPI::LF_PARSE_MODE);
+      if (!cc->get_mode().is_client())
+	OPENVPN_THROW_EXCEPTION("profile is not a client profile");
+
+      proto_config.reset(new ProtoContext::Config());
+      proto_config->ssl_factory = cc->new_factory();
+      proto_config->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, stats, prng));
+      proto_config->dc_deferred = true; // until options are pulled
+      proto_config->tls_auth_factory.reset(new CryptoOvpnHMACFactory<SSLLib::CryptoAPI>());
+      proto_config->tls_crypt_factory.reset(new CryptoTLSCryptFactory<SSLLib::CryptoAPI>());
+      proto_config->tls_crypt_metadata_factory.reset(new CryptoTLSCryptMetadataFactory());
+      proto_config->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+      proto_config->load(profile, *pco, -1, false);
+      proto_config->set_xmit_creds(!opt.username.empty());
+      if (opt.reneg)
+	{
+	  proto_config->renegotiate = Time::Duration::seconds(opt.reneg);
+	  proto_config->expire = proto_config->renegotiate + proto_config->handshake_window;
+	}
+      proto_config->frame = frame;
+      proto_config->now = &now;
+      proto_config->rng = rng;
+      proto_config->prng = prng;
+
+      if (!opt.gremlin.empty())
+	gremlin_config.reset(new Gremlin::Config(opt.gremlin));
+    }
+
+    void run()
+    {
+      ramp_timer.expires_after(Time::Duration::seconds(0));
+      ramp_timer.async_wait([this](const openvpn_io::error_code& error)
+                            {
+                              if (!error)
+                                ramp();
+                            });
+      io_context.run();
+    }
+
+    void stop()
+    {
+      openvpn_io::post(io_context, [this]()
+                       {
+                         ramp_timer.cancel();
+                         for (auto& c : clients)
+                           c->stop();
+                         clients.clear();
+                       });
+    }
+
+    const Options& opt;
+    const openvpn_io::ip::udp::endpoint udp_ep;
+    const openvpn_io::ip::tcp::endpoint tcp_ep;
+    openvpn_io::io_context io_context;
+    Time now;
+    Frame::Ptr frame;
+    SessionStats::Ptr stats;
+    const LatencyHistogram* handshake_hist;
+    ProtoContext::Config::Ptr proto_config; // copied for each session
+    ProtoContextOptions::Ptr pco;
+    Gremlin::Config::Ptr gremlin_config; // per worker, since not thread-safe
+    Counters counters;
+
+  private:
+    // start clients at this worker's share of --rate
+    void ramp()
+    {
+      enum { TICK_MS = 10 };
+      const double per_tick = double(opt.rate) / opt.threads * TICK_MS / 1000.0;
+      ramp_credit += per_tick;
+      while (ramp_credit >= 1.0 && clients.size() < n_clients)
+	{
+	  ramp_credit -= 1.0;
+	  EmuClient::Ptr c(new EmuClient(*this, first_client + unsigned(clients.size())));
+	  clients.push_back(c);
+	  c->start();
+	}
+      if (clients.size() < n_clients)
+	{
+	  ramp_timer.expires_after(Time::Duration::milliseconds(TICK_MS));
+	  ramp_timer.async_wait([this](const openvpn_io::error_code& error)
+                                {
+                                  if (!error)
+                                    ramp();
+                                });
+	}
+    }
+
+    const unsigned int first_client;
+    const unsigned int n_clients;
+    RandomAPI::Ptr rng;
+    RandomAPI::Ptr prng;
+    std::vector<EmuClient::Ptr> clients;
+    AsioTimer ramp_timer;
+    double ramp_credit = 0.0;
+  };
+
+  // With a seeded --gremlin config, each client's impairments are a
+  // function of the seed and its id, whatever the thread count.
+  EmuClient::EmuClient(Worker& worker_arg, const unsigned int id)
+    : worker(worker_arg),
+      udp(worker_arg.io_context),
+      tcp(worker_arg.io_context),
+      housekeeping_timer(worker_arg.io_context),
+      data_timer(worker_arg.io_context),
+      restart_timer(worker_arg.io_context)
+  {
+    if (worker.gremlin_config)
+      gremlin.reset(new Gremlin::SendRecvQueue(worker.io_context, worker.gremlin_config,
+					       worker.opt.proto.is_tcp(), id));
+  }
+
+  void EmuClient::start()
+  {
+    const unsigned int gen = ++generation;
+    session.reset(new EmuSession(*this, new ProtoContext::Config(*worker.proto_config), worker.stats));
+    pushed.reset(new OptionListContinuation(PushOptionsBase::Ptr()));
+    pktstream = PacketStream();
+    write_queue.clear();
+    write_pending = false;
+
+    if (worker.opt.proto.is_udp())
+      {
+	openvpn_io::error_code ec;
+	udp.open(worker.udp_ep.protocol(), ec);
+	if (!ec)
+	  udp.connect(worker.udp_ep, ec);
+	connected(ec, gen);
+      }
+    else
+      {
+	tcp.open(worker.tcp_ep.protocol());
+	tcp.set_option(openvpn_io::ip::tcp::no_delay(true));
+	tcp.async_connect(worker.tcp_ep, [self=Ptr(this), gen](const openvpn_io::error_code& error)
+                          {
+                            self->connected(error, gen);
+                          });
+      }
+  }
+
+  void EmuClient::stop()
+  {
+    if (up && session->data_channel_ready() && worker.opt.proto.is_udp())
+      {
+	session->update_now();
+	session->send_explicit_exit_notify();
+      }
+    ++generation;
+    close();
+    session.reset();
+  }
+
+  void EmuClient::connected(const openvpn_io::error_code& error, const unsigned int gen)
+  {
+    if (gen != generation)
+      return;
+    if (error)
+      {
+	fail("connect: " + error.message());
+	return;
+      }
+    session->update_now();
+    session->set_protocol(worker.opt.proto);
+    session->reset();
+    session->start();
+    session->flush(true);
+    set_housekeeping_timer();
+    queue_read();
+    if (worker.opt.reconnect)
+      {
+	restart_timer.expires_after(Time::Duration::seconds(worker.opt.reconnect));
+	restart_timer.async_wait([self=Ptr(this), gen](const openvpn_io::error_code& error)
+                                 {
+                                   if (!error && gen == self->generation)
+                                     {
+                                       self->stop();
+                                       self->start();
+                                     }
+                                 });
+      }
+  }
+
+  void EmuClient::queue_read()
+  {
+    const unsigned int gen = generation;
+    if (worker.opt.proto.is_udp())
+      {
+	worker.frame->prepare(Frame::READ_LINK_UDP, read_buf);
+	udp.async_receive((*worker.frame)[Frame::READ_LINK_UDP].mutable_buffer(read_buf),
+			  [self=Ptr(this), gen](const openvpn_io::error_code& error, const size_t bytes)
+                          {
+                            self->handle_read(error, bytes, gen);
+                          });
+      }
+    else
+      {
+	worker.frame->prepare(Frame::READ_LINK_TCP, read_buf);
+	tcp.async_read_some((*worker.frame)[Frame::READ_LINK_TCP].mutable_buffer(read_buf),
+			    [self=Ptr(this), gen](const openvpn_io::error_code& error, const size_t bytes)
+                            {
+                              self->handle_read(error, bytes, gen);
+                            });
+      }
+  }
+
+  void EmuClient::handle_read(const openvpn_io::error_code& error, const size_t bytes, const unsigned int gen)
+  {
+    if (gen != generation)
+      return;
+    if (error)
+      {
+	if (worker.opt.proto.is_udp() && error != openvpn_io::error::operation_aborted)
+	  queue_read(); // e.g. ICMP port unreachable, keep trying until keepalive timeout
+	else
+	  fail("read: " + error.message());
+	return;
+      }
+    read_buf.set_size(bytes);
+    if (gremlin)
+      {
+	gremlin->recv_queue([self=Ptr(this), buf=BufferAllocated(read_buf, 0), gen]() mutable {
+	    if (gen == self->generation)
+	      self->recv_bytes(buf, gen);
+	  }, bytes);
+      }
+    else
+      recv_bytes(read_buf, gen);
+    if (gen == generation)
+      queue_read();
+  }
+
+  void EmuClient::recv_bytes(BufferAllocated& buf, const unsigned int gen)
+  {
+    try {
+      session->update_now();
+      if (worker.opt.proto.is_udp())
+	recv_packet(buf);
+      else
+	{
+	  while (buf.size())
+	    {
+	      pktstream.put(buf, (*worker.frame)[Frame::READ_LINK_TCP]);
+	      if (pktstream.ready())
+		{
+		  BufferAllocated pkt;
+		  pktstream.get(pkt);
+		  recv_packet(pkt);
+		  if (gen != generation)
+		    return;
+		}
+	    }
+	}
+    }
+    catch (const std::exception& e)
+      {
+	fail(std::string("recv: ") + e.what());
+      }
+  }
+
+  void EmuClient::recv_packet(BufferAllocated& buf)
+  {
+    const unsigned int gen = generation;
+    const size_t wire_size = buf.size();
+    const ProtoContext::PacketType pt = session->packet_type(buf);
+    if (pt.is_data())
+      {
+	if (session->data_decrypt(pt, buf))
+	  worker.counters.rx_bytes.fetch_add(wire_size, std::memory_order_relaxed);
+      }
+    else if (pt.is_control())
+      session->control_net_recv(pt, std::move(buf));
+    if (gen != generation)
+      return;
+    session->flush(true);
+    set_housekeeping_timer();
+  }
+
+  void EmuClient::net_send(const Buffer& net_buf)
+  {
+    if (gremlin)
+      {
+	const unsigned int gen = generation;
+	gremlin->send_queue([self=Ptr(this), buf=BufferAllocated(net_buf, 0), gen]() {
+	    if (gen == self->generation)
+	      self->sock_send(buf);
+	  }, net_buf.size());
+      }
+    else
+      sock_send(net_buf);
+  }
+
+  void EmuClient::sock_send(const Buffer& net_buf)
+  {
+    if (worker.opt.proto.is_udp())
+      {
+	openvpn_io::error_code ec;
+	udp.send(net_buf.const_buffer(), 0, ec); // drop on error, like the UDP transport
+	if (!ec)
+	  session->update_last_sent();
+      }
+    else
+      {
+	BufferPtr buf(new BufferAllocated(net_buf, 0));
+	worker.frame->prepare(Frame::WRITE_SSL_INIT, *buf); // headroom for the size prefix
+	buf->write(net_buf.c_data(), net_buf.size());
+	PacketStream::prepend_size(*buf);
+	write_queue.push_back(std::move(buf));
+	session->update_last_sent();
+	queue_write();
+      }
+  }
+
+  void EmuClient::queue_write()
+  {
+    if (write_pending || write_queue.empty())
+      return;
+    write_pending = true;
+    const unsigned int gen = generation;
+    openvpn_io::async_write(tcp, write_queue.front()->const_buffer(),
+			    [self=Ptr(this), gen](const openvpn_io::error_code& error, const size_t)
+                            {
+                              if (gen != self->generation)
+                                return;
+                              self->write_pending = false;
+                              if (error)
+                                {
+                                  self->fail("write: " + error.message());
+                                  return;
+                                }
+                              self->write_queue.pop_front();
+                              self->queue_write();
+                            });
+  }
+
+  void EmuClient::control_recv(const std::string& msg)
+  {
+    if (!pushed->complete() && string::starts_with(msg, "PUSH_REPLY,"))
+      {
+	pushed->add(OptionList::parse_from_csv_static(msg.substr(11), nullptr), nullptr);
+	if (!pushed->complete())
+	  return;
+	session->process_push(*pushed, *worker.pco);
+	session->init_data_channel();
+
+	// source and destination of our data packets
+	const Option* o = pushed->get_ptr("ifconfig");
+	if (o)
+	  {
+	    tun_src = IPv4::Addr::from_string(o->get(1, 64)).to_uint32_net();
+	    const Option* gw = pushed->get_ptr("route-gateway");
+	    tun_dst = IPv4::Addr::from_string(gw ? gw->get(1, 64) : o->get(2, 64)).to_uint32_net();
+	  }
+
+	up = true;
+	worker.counters.connected.fetch_add(1, std::memory_order_relaxed);
+	if (worker.opt.pps && tun_src)
+	  data_burst();
+      }
+    else if (string::starts_with(msg, "AUTH_FAILED"))
+      fail("AUTH_FAILED");
+    else if (string::starts_with(msg, "RESTART") || string::starts_with(msg, "HALT"))
+      fail(msg);
+  }
+
+  void EmuClient::active()
+  {
+    session->write_control_string(std::string("PUSH_REQUEST"));
+  }
+
+  void EmuClient::client_auth(Buffer& buf)
+  {
+    EmuSession::write_auth_string(worker.opt.username, buf);
+    EmuSession::write_auth_string(worker.opt.password, buf);
+  }
+
+  void EmuClient::set_housekeeping_timer()
+  {
+    Time next = session->next_housekeeping();
+    if (next.is_infinite())
+      return;
+    next.max(worker.now);
+    const unsigned int gen = generation;
+    housekeeping_timer.expires_at(next);
+    housekeeping_timer.async_wait([self=Ptr(this), gen](const openvpn_io::error_code& error)
+                                  {
+                                    if (!error && gen == self->generation)
+                                      self->housekeeping();
+                                  });
+  }
+
+  void EmuClient::housekeeping()
+  {
+    const unsigned int gen = generation;
+    try {
+      session->update_now();
+      session->housekeeping();
+      if (gen != generation)
+	return;
+      if (session->invalidated())
+	{
+	  fail(std::string("invalidated: ") + Error::name(session->invalidation_reason()));
+	  return;
+	}
+      set_housekeeping_timer();
+    }
+    catch (const std::exception& e)
+      {
+	fail(std::string("housekeeping: ") + e.what());
+      }
+  }
+
+  // send this tick's share of --pps as IPv4/UDP packets to the
+  // discard port of the VPN gateway
+  void EmuClient::data_burst()
+  {
+    enum { TICK_MS = 100 };
+    const unsigned int gen = generation;
+    const unsigned int size = std::max(worker.opt.size, unsigned(sizeof(IPv4Header) + sizeof(UDPHeader)));
+    const unsigned int n = std::max(worker.opt.pps * TICK_MS / 1000, 1u);
+    try {
+      session->update_now();
+      for (unsigned int i = 0; i < n && session->data_channel_ready(); ++i)
+	{
+	  BufferAllocated buf;
+	  worker.frame->prepare(Frame::READ_TUN, buf);
+	  std::uint8_t* pkt = buf.write_alloc(size);
+	  std::memset(pkt, 0, size);
+	  IPv4Header* ip = reinterpret_cast<IPv4Header*>(pkt);
+	  ip->version_len = IPv4Header::ver_len(4, sizeof(IPv4Header));
+	  ip->tot_len = htons(size);
+	  ip->ttl = 64;
+	  ip->protocol = IPCommon::UDP;
+	  ip->saddr = tun_src;
+	  ip->daddr = tun_dst;
+	  ip->check = IPChecksum::checksum(ip, sizeof(IPv4Header));
+	  UDPHeader* udph = reinterpret_cast<UDPHeader*>(pkt + sizeof(IPv4Header));
+	  udph->source = htons(9);
+	  udph->dest = htons(9);
+	  udph->len = htons(size - sizeof(IPv4Header));
+
+	  session->data_encrypt(buf);
+	  if (buf.size())
+	    {
+	      worker.counters.tx_bytes.fetch_add(buf.size(), std::memory_order_relaxed);
+	      net_send(buf);
+	    }
+	}
+      if (gen != generation)
+	return;
+      set_housekeeping_timer();
+    }
+    catch (const std::exception& e)
+      {
+	fail(std::string("data: ") + e.what());
+	return;
+      }
+    data_timer.expires_after(Time::Duration::milliseconds(TICK_MS));
+    data_timer.async_wait([self=Ptr(this), gen](const openvpn_io::error_code& error)
+                          {
+                            if (!error && gen == self->generation)
+                              self->data_burst();
+                          });
+  }
+
+  void EmuClient::fail(const std::string& reason)
+  {
+    worker.counters.failures.fetch_add(1, std::memory_order_relaxed);
+    if (worker.counters.failures.load(std::memory_order_relaxed) <= 10)
+      OPENVPN_LOG("client failed: " << reason);
+    ++generation;
+    close();
+    restart_after(Time::Duration::seconds(1));
+  }
+
+  void EmuClient::restart_after(const Time::Duration& delay)
+  {
+    const unsigned int gen = generation;
+    restart_timer.expires_after(delay);
+    restart_timer.async_wait([self=Ptr(this), gen](const openvpn_io::error_code& error)
+                             {
+                               if (!error && gen == self->generation)
+                                 self->start();
+                             });
+  }
+
+  void EmuClient::close()
+  {
+    if (up)
+      {
+	worker.counters.connected.fetch_sub(1, std::memory_order_relaxed);
+	up = false;
+      }
+    tun_src = tun_dst = 0;
+    housekeeping_timer.cancel();
+    data_timer.cancel();
+    restart_timer.cancel();
+    openvpn_io::error_code ec;
+    udp.close(ec);
+    tcp.close(ec);
+  }
+
+  // Handshake latency percentile over all workers.  Each bucket is
+  // re-recorded at its upper bound, so the result is the same as
+  // LatencyHistogram::percentile() of a single histogram.
+  std::uint64_t handshake_percentile(const std::vector<std::unique_ptr<Worker>>& workers, const double p)
+  {
+    std::unique_ptr<LatencyHistogram> merged(new LatencyHistogram());
+    for (const auto& w : workers)
+      for (unsigned int b = 0; b < LatencyHistogram::N_BUCKETS; ++b)
+	{
+	  const std::uint64_t n = w->handshake_hist->bucket_count(b);
+	  if (n)
+	    merged->record(LatencyHistogram::lower_bound(b + 1) - 1, n);
+	}
+    return merged->percentile(p);
+  }
+
+  // resident set size of a process in bytes, or 0 if unknown
+  std::uint64_t process_rss(const int pid)
+  {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(in, line))
+      {
+	if (string::starts_with(line, "VmRSS:"))
+	  return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+      }
+    return 0;
+  }
+
+  void usage()
+  {
+    std::cout << "usage: loadgen [options] <client profile>" << std::endl
+	      << "--remote HOST[:PORT]  : server (default: first remote of profile)" << std::endl
+	      << "--proto udp|tcp       : transport protocol (default: from profile)" << std::endl
+	      << "--auth USER:PASS      : username/password for auth-user-pass" << std::endl
+	      << "--clients N           : number of emulated clients (default 100)" << std::endl
+	      << "--threads N           : worker threads (default 1)" << std::endl
+	      << "--rate N              : new clients per second (default 100)" << std::endl
+	      << "--duration N          : seconds to run (default 60)" << std::endl
+	      << "--reneg N             : renegotiate every N seconds" << std::endl
+	      << "--reconnect N         : reconnect each client every N seconds" << std::endl
+	      << "--pps N               : data packets per second per client" << std::endl
+	      << "--size N              : data packet size in bytes (default 1000)" << std::endl
+	      << "--gremlin CONFIG      : emulate a bad network, see README.txt" << std::endl
+	      << "--server-pid PID      : report RSS of this local server process" << std::endl;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  InitProcess::init();
+  int ret = 0;
+
+  try {
+    Options opt;
+    std::string proto_arg;
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string arg = argv[i];
+	auto value = [&]() -> std::string {
+	  if (i + 1 >= argc)
+	    OPENVPN_THROW_EXCEPTION(arg << " requires a value");
+	  return argv[++i];
+	};
+	auto number = [&]() -> unsigned int {
+	  return parse_number_throw<unsigned int>(value(), arg.c_str());
+	};
+
+	if (arg == "--remote")
+	  {
+	    const std::string r = value();
+	    const size_t colon = r.rfind(':');
+	    if (colon != std::string::npos && r.find(':') == colon)
+	      {
+		opt.host = r.substr(0, colon);
+		opt.port = r.substr(colon + 1);
+	      }
+	    else
+	      opt.host = r;
+	  }
+	else if (arg == "--proto")
+	  proto_arg = value();
+	else if (arg == "--auth")
+	  {
+	    const std::string a = value();
+	    const size_t colon = a.find(':');
+	    opt.username = a.substr(0, colon);
+	    if (colon != std::string::npos)
+	      opt.password = a.substr(colon + 1);
+	  }
+	else if (arg == "--clients")
+	  opt.clients = number();
+	else if (arg == "--threads")
+	  opt.threads = number();
+	else if (arg == "--rate")
+	  opt.rate = number();
+	else if (arg == "--duration")
+	  opt.duration = number();
+	else if (arg == "--reneg")
+	  opt.reneg = number();
+	else if (arg == "--reconnect")
+	  opt.reconnect = number();
+	else if (arg == "--pps")
+	  opt.pps = number();
+	else if (arg == "--size")
+	  opt.size = number();
+	else if (arg == "--gremlin")
+	  opt.gremlin = value();
+	else if (arg == "--server-pid")
+	  opt.server_pid = int(number());
+	else if (arg == "--help" || arg == "-h")
+	  {
+	    usage();
+	    InitProcess::uninit();
+	    return 0;
+	  }
+	else if (!string::starts_with(arg, "--") && opt.profile.empty())
+	  opt.profile = arg;
+	else
+	  OPENVPN_THROW_EXCEPTION("unknown option: " << arg);
+      }
+    if (opt.profile.empty() || !opt.clients || !opt.threads || !opt.rate)
+      {
+	usage();
+	InitProcess::uninit();
+	return 2;
+      }
+
+    OptionList profile = OptionList::parse_from_config_static(read_text(opt.profile), nullptr);
+    profile.update_map();
+
+    // server address and protocol, from the command line or the
+    // profile's first remote
+    std::string proto_str = profile.get_default("proto", 1, 16, "udp");
+    if (opt.host.empty())
+      {
+	const Option& r = profile.get("remote");
+	opt.host = r.get(1, 256);
+	opt.port = profile.get_default("port", 1, 16, "1194");
+	if (r.size() >= 3)
+	  opt.port = r.get(2, 16);
+	if (r.size() >= 4)
+	  proto_str = r.get(3, 16);
+      }
+    if (!proto_arg.empty())
+      proto_str = proto_arg;
+    opt.proto = Protocol::parse(proto_str, Protocol::CLIENT_SUFFIX);
+    if (!opt.proto.is_udp() && !opt.proto.is_tcp())
+      OPENVPN_THROW_EXCEPTION("unsupported protocol: " << proto_str);
+
+    openvpn_io::io_context resolve_context;
+    openvpn_io::ip::udp::endpoint udp_ep;
+    openvpn_io::ip::tcp::endpoint tcp_ep;
+    if (opt.proto.is_udp())
+      udp_ep = *openvpn_io::ip::udp::resolver(resolve_context).resolve(opt.host, opt.port).begin();
+    else
+      tcp_ep = *openvpn_io::ip::tcp::resolver(resolve_context).resolve(opt.host, opt.port).begin();
+    opt.proto = Protocol(opt.proto.is_udp() ? (udp_ep.address().is_v6() ? Protocol::UDPv6 : Protocol::UDPv4)
+			 : (tcp_ep.address().is_v6() ? Protocol::TCPv6 : Protocol::TCPv4));
+
+    std::cout << "loadgen: " << opt.clients << " clients on " << opt.threads << " threads -> "
+	      << opt.host << ':' << opt.port << ' ' << opt.proto.str() << std::endl;
+
+    if (!opt.gremlin.empty())
+      std::cout << "gremlin: " << Gremlin::Config(opt.gremlin).to_string() << std::endl;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    unsigned int first_client = 0;
+    for (unsigned int t = 0; t < opt.threads; ++t)
+      {
+	const unsigned int n = opt.clients / opt.threads + (t < opt.clients % opt.threads ? 1 : 0);
+	workers.emplace_back(new Worker(opt, profile, udp_ep, tcp_ep, first_client, n));
+	first_client += n;
+      }
+    std::vector<std::thread> threads;
+    for (auto& w : workers)
+      {
+	Worker* wp = w.get();
+	threads.emplace_back([wp]() {
+	    try {
+	      wp->run();
+	    }
+	    catch (const std::exception& e)
+	      {
+		std::cerr << "worker: " << e.what() << std::endl;
+	      }
+	  });
+      }
+
+    // report once a second
+    std::uint64_t hs_last = 0, tx_last = 0, rx_last = 0, hs_total = 0;
+    std::uint64_t tx_total = 0, rx_total = 0, failures = 0;
+    for (unsigned int s = 1; s <= opt.duration; ++s)
+      {
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	std::uint64_t connected = 0;
+	hs_total = tx_total = rx_total = failures = 0;
+	for (const auto& w : workers)
+	  {
+	    connected += w->counters.connected.load(std::memory_order_relaxed);
+	    failures += w->counters.failures.load(std::memory_order_relaxed);
+	    tx_total += w->counters.tx_bytes.load(std::memory_order_relaxed);
+	    rx_total += w->counters.rx_bytes.load(std::memory_order_relaxed);
+	    hs_total += w->handshake_hist->count();
+	  }
+	std::cout << std::fixed << std::setprecision(2)
+		  << "t=" << s << "s up=" << connected
+		  << " hs/s=" << (hs_total - hs_last)
+		  << " hs_p50=" << handshake_percentile(workers, 0.50) / 1e6 << "ms"
+		  << " hs_p99=" << handshake_percentile(workers, 0.99) / 1e6 << "ms"
+		  << " tx=" << (tx_total - tx_last) * 8 / 1e9 << "Gbps"
+		  << " rx=" << (rx_total - rx_last) * 8 / 1e9 << "Gbps"
+		  << " fail=" << failures;
+	if (opt.server_pid)
+	  std::cout << " server_rss=" << process_rss(opt.server_pid) / (1024 * 1024) << "MB";
+	std::cout << std::endl;
+	hs_last = hs_total;
+	tx_last = tx_total;
+	rx_last = rx_total;
+      }
+
+    for (auto& w : workers)
+      w->stop();
+    for (auto& t : threads)
+      t.join();
+
+    std::cout << std::fixed << std::setprecision(2)
+	      << "total: handshakes=" << hs_total
+	      << " hs/s=" << double(hs_total) / opt.duration
+	      << " hs_p99=" << handshake_percentile(workers, 0.99) / 1e6 << "ms"
+	      << " tx=" << tx_total * 8 / 1e9 / opt.duration << "Gbps"
+	      << " rx=" << rx_total * 8 / 1e9 / opt.duration << "Gbps"
+	      << " failures=" << failures << std::endl;
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      ret = 1;
+    }
+
+  InitProcess::uninit();
+  return ret;
+}
@@ -240,7 +240,8 @@ public:
   void print_stats()
   {
     const int n = stats_n();
-    std::vector<long long> stats = stats_bundle();
+    std::vector<long long>& stats = stats_values;
+    stats_snapshot(stats);
 
     std::cout << "STATS:" << std::endl;
     for (int i = 0; i < n; ++i)
@@ -249,6 +250,30 @@ public:
 	if (value)
 	  std::cout << "  " << stats_name(i) << " : " << value << std::endl;
       }
+
+    const ClientAPI::TransportStats ts = transport_stats();
+    for (const auto& ls : ts.latency)
+      {
+	if (ls.count)
+	  std::cout << "  LATENCY_" << ls.name << " : n=" << ls.count
+		    << " mean=" << ls.mean << " p50=" << ls.p50 << " p90=" << ls.p90
+		    << " p99=" << ls.p99 << " p99.9=" << ls.p999 << " max=" << ls.max << " us" << std::endl;
+      }
+    if (ts.rtt >= 0)
+      std::cout << "  RTT : srtt=" << ts.rtt << " jitter=" << ts.rttJitter
+		<< " us loss=" << ts.rttLoss << "/1000" << std::endl;
+
+#ifdef OPENVPN_TRACE
+    try {
+      const std::string fn = "ovpncli-trace.json";
+      Trace::dump_chrome_file(fn);
+      std::cout << "TRACE: wrote " << fn << std::endl;
+    }
+    catch (const std::exception& e)
+      {
+	std::cout << "TRACE: " << e.what() << std::endl;
+      }
+#endif
   }
 
 #ifdef OPENVPN_REMOTE_OVERRIDE
@@ -468,6 +493,7 @@ private:
   std::string dc_cookie;
   RandomAPI::Ptr rng;      // random data source for epki
   volatile ClockTickAction clock_tick_action = CT_UNDEF;
+  std::vector<long long> stats_values;
 
 #ifdef OPENVPN_REMOTE_OVERRIDE
   std::string remote_override_cmd;
@@ -714,6 +740,17 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
     { "epki-cert",      required_argument,  nullptr,       2  },
     { "epki-ca",        required_argument,  nullptr,       3  },
     { "epki-key",       required_argument,  nullptr,       4  },
+    { "latency-stats",  no_argument,        nullptr,       6  },
+    { "connect-race",   required_argument,  nullptr,       7  },
+    { "dns-cache",      required_argument,  nullptr,       8  },
+    { "async-log",      no_argument,        nullptr,       9  },
+    { "pkt-sample",     required_argument,  nullptr,       10 },
+    { "pkt-sample-rate",required_argument,  nullptr,       11 },
+    { "pkt-sample-flow",required_argument,  nullptr,       12 },
+    { "metrics",        required_argument,  nullptr,       13 },
+    { "dc-threads",     required_argument,  nullptr,       14 },
+    { "fast-reconnect", required_argument,  nullptr,       15 },
+    { "battery-saver",  no_argument,        nullptr,       16 },
 #ifdef OPENVPN_REMOTE_OVERRIDE
     { "remote-override",required_argument,  nullptr,       5  },
 #endif
@@ -758,6 +795,17 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
 	bool googleDnsFallback = false;
 	bool autologinSessions = false;
 	bool retryOnAuthFailed = false;
+	bool latencyStats = false;
+	bool asyncLog = false;
+	std::string packetSampleFile;
+	int packetSampleRate = 0;
+	int packetSampleFlowFirst = 0;
+	std::string metricsListen;
+	int connectRace = 0;
+	int dataChannelThreads = 0;
+	int fastReconnect = 0;
+	bool batterySaver = false;
+	std::string dnsCacheFile;
 	bool tunPersist = false;
 	bool wintun = false;
 	bool merge = false;
@@ -789,6 +837,39 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
 	      case 4: // --epki-key
 		epki_key_fn = optarg;
 		break;
+	      case 6: // --latency-stats
+		latencyStats = true;
+		break;
+	      case 7: // --connect-race
+		connectRace = ::atoi(optarg);
+		break;
+	      case 8: // --dns-cache
+		dnsCacheFile = optarg;
+		break;
+	      case 9: // --async-log
+		asyncLog = true;
+		break;
+	      case 10: // --pkt-sample
+		packetSampleFile = optarg;
+		break;
+	      case 11: // --pkt-sample-rate
+		packetSampleRate = ::atoi(optarg);
+		break;
+	      case 12: // --pkt-sample-flow
+		packetSampleFlowFirst = ::atoi(optarg);
+		break;
+	      case 13: // --metrics
+		metricsListen = optarg;
+		break;
+	      case 14: // --dc-threads
+		dataChannelThreads = ::atoi(optarg);
+		break;
+	      case 15: // --fast-reconnect
+		fastReconnect = ::atoi(optarg);
+		break;
+	      case 16: // --battery-saver
+		batterySaver = true;
+		break;
 #ifdef OPENVPN_REMOTE_OVERRIDE
 	      case 5: // --remote-override
 		remote_override_cmd = optarg;
@@ -979,7 +1060,18 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
 	      config.googleDnsFallback = googleDnsFallback;
 	      config.autologinSessions = autologinSessions;
 	      config.retryOnAuthFailed = retryOnAuthFailed;
+	      config.latencyStats = latencyStats;
+	      config.asyncLog = asyncLog;
+	      config.packetSampleFile = packetSampleFile;
+	      config.packetSampleRate = packetSampleRate;
+	      config.packetSampleFlowFirst = packetSampleFlowFirst;
+	      config.metricsListen = metricsListen;
+	      config.connectRace = connectRace;
+	      config.dataChannelThreads = dataChannelThreads;
+	      config.dnsCacheFile = dnsCacheFile;
 	      config.tunPersist = tunPersist;
+	      config.fastReconnect = fastReconnect;
+	      config.batterySaver = batterySaver;
 	      config.gremlinConfig = gremlin;
 	      config.info = true;
 	      config.wintun = wintun;
@@ -1160,6 +1252,17 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
       std::cout << "--google-dns, -g      : enable Google DNS fallback" << std::endl;
       std::cout << "--auto-sess, -a       : request autologin session" << std::endl;
       std::cout << "--auth-retry, -Y      : retry connection on auth failure" << std::endl;
+      std::cout << "--latency-stats       : record data path and handshake latency histograms" << std::endl;
+      std::cout << "--connect-race        : try up to N remote entries in parallel" << std::endl;
+      std::cout << "--dns-cache           : persist remote DNS resolutions in file" << std::endl;
+      std::cout << "--async-log           : deliver log lines from a background thread" << std::endl;
+      std::cout << "--pkt-sample          : write sampled tunnel packets to pcap file" << std::endl;
+      std::cout << "--pkt-sample-rate     : with --pkt-sample, capture 1 in N packets" << std::endl;
+      std::cout << "--pkt-sample-flow     : with --pkt-sample, capture first N packets of each flow" << std::endl;
+      std::cout << "--metrics             : serve OpenMetrics stats on http://host:port/metrics" << std::endl;
+      std::cout << "--dc-threads          : run data channel crypto for bursts on N threads" << std::endl;
+      std::cout << "--fast-reconnect      : on UDP transport errors, keep the session for up to N seconds" << std::endl;
+      std::cout << "--battery-saver       : coalesce keepalives with other wakeups, adapt the ping interval" << std::endl;
       std::cout << "--persist-tun, -j     : keep TUN interface open across reconnects" << std::endl;
       std::cout << "--wintun, -w          : use WinTun instead of TAP-Windows6 on Windows" << std::endl;
       std::cout << "--peer-info, -I       : peer info key/value list in the form K1=V1,K2=V2,..." << std::endl;
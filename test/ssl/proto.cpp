@@ -29,6 +29,7 @@
 #include <cstring>
 #include <limits>
 #include <thread>
+#include <chrono>
 
 #include <openvpn/common/platform.hpp>
 
@@ -93,8 +94,10 @@
 
 // NoisyWire
 #ifndef NOERR
+#ifndef GREMLIN
 #define SIMULATE_OOO
 #define SIMULATE_DROPPED
+#endif
 #define SIMULATE_CORRUPTED
 #endif
 
@@ -177,7 +180,13 @@
 #include <openvpn/time/time.hpp>
 #include <openvpn/random/mtrandapi.hpp>
 #include <openvpn/frame/frame.hpp>
+#ifdef GREMLIN
+#include <openvpn/transport/gremlin.hpp>
+#endif
 #include <openvpn/ssl/proto.hpp>
+#ifdef SSL_EXECUTOR
+#include <openvpn/ssl/sslexecasio.hpp>
+#endif
 #include <openvpn/init/initprocess.hpp>
 
 #include <openvpn/crypto/cryptodcsel.hpp>
@@ -440,6 +449,12 @@ public:
     return bp;
   }
 
+  void data_prepare(BufferAllocated& buf, const std::string& payload)
+  {
+    frame->prepare(Frame::READ_LINK_UDP, buf);
+    buf.write((const unsigned char *)payload.c_str(), payload.size());
+  }
+
   void data_encrypt(BufferAllocated& in_out)
   {
     Base::data_encrypt(in_out);
@@ -601,7 +616,8 @@ private:
 };
 
 // Simulate a noisy transmission channel where packets can be dropped,
-// reordered, or corrupted.
+// reordered, or corrupted.  With GREMLIN, delay, loss and reordering
+// come from a Gremlin::Wire instead.
 class NoisyWire
 {
 public:
@@ -610,13 +626,21 @@ public:
 	    RandomAPI& rand_arg,
 	    const unsigned int reorder_prob_arg,
 	    const unsigned int drop_prob_arg,
-	    const unsigned int corrupt_prob_arg)
+	    const unsigned int corrupt_prob_arg
+#ifdef GREMLIN
+	    , const Gremlin::LinkParams& gremlin_params,
+	    const std::uint64_t gremlin_seed
+#endif
+	    )
     : title(title_arg),
       now(now_arg),
       random(rand_arg),
       reorder_prob(reorder_prob_arg),
       drop_prob(drop_prob_arg),
       corrupt_prob(corrupt_prob_arg)
+#ifdef GREMLIN
+      , gremlin(gremlin_params, gremlin_seed)
+#endif
   {
   }
 
@@ -642,7 +666,7 @@ public:
     if (a.data_channel_ready())
       {
 	BufferPtr bp = a.data_encrypt_string("Waiting for godot A... Waiting for godot B... Waiting for godot C... Waiting for godot D... Waiting for godot E... Waiting for godot F... Waiting for godot G... Waiting for godot H... Waiting for godot I... Waiting for godot J...");
-	wire.push_back(bp);
+	send(bp);
       }
 
     // transfer network packets from A -> wire
@@ -653,7 +677,7 @@ public:
 	std::cout << now->raw() << " " << title << " " << a.dump_packet(*bp) <<  std::endl;
 #endif
 	a.net_out.pop_front();
-	wire.push_back(bp);
+	send(bp);
       }
 
     // transfer network packets from wire -> B
@@ -702,8 +726,28 @@ public:
   }
 
 private:
+  void send(const BufferPtr& bp)
+  {
+#ifdef GREMLIN
+    if (!gremlin.send(*now, bp, bp->size()))
+      {
+#ifdef VERBOSE
+	std::cout << now->raw() << " " << title << " Gremlin dropped a packet" << std::endl;
+#endif
+      }
+#else
+    wire.push_back(bp);
+#endif
+  }
+
   BufferPtr recv()
   {
+#ifdef GREMLIN
+    BufferPtr gbp;
+    if (gremlin.recv(*now, gbp))
+      wire.push_back(std::move(gbp));
+#endif
+
 #ifdef SIMULATE_OOO
     // simulate packets being received out of order
     if (wire.size() >= 2 && !rand(reorder_prob))
@@ -769,7 +813,270 @@ private:
   unsigned int drop_prob;
   unsigned int corrupt_prob;
   std::deque<BufferPtr> wire;
+#ifdef GREMLIN
+  Gremlin::Wire<BufferPtr> gremlin;
+#endif
+};
+
+#ifdef PSID_COOKIE
+// Run the initial reset exchange through a stateless PsidCookie
+// (tls-auth, tls-crypt or no tls-wrap only) before starting the
+// server session from the cookie echoed by the client.
+void psid_cookie_start(TestProto& cli_proto, TestProto& serv_proto, const ProtoContext::Config& sp)
+{
+  OPENVPN_SIMPLE_EXCEPTION(psid_cookie_failed);
+
+  ProtoContext::PsidCookie pc(sp);
+  const IP::Addr addr = IP::Addr::from_string("10.0.0.1");
+  const unsigned int port = 1194;
+
+  // client reset -> stateless server reset
+  BufferPtr reset = cli_proto.net_out.front();
+  cli_proto.net_out.pop_front();
+  BufferPtr reply(new BufferAllocated());
+  if (pc.process(*reset, addr, port, *reply) != ProtoContext::PsidCookie::REPLY)
+    throw psid_cookie_failed();
+  cli_proto.control_net_recv(cli_proto.packet_type(*reply), std::move(reply));
+  cli_proto.flush(true);
+
+  // client echo of the cookie -> server session
+  const BufferPtr& echo = cli_proto.net_out.front();
+  ProtoSessionID self, peer;
+  if (pc.verify(*echo, addr, port + 1, self, peer))
+    throw psid_cookie_failed();
+  if (!pc.verify(*echo, addr, port, self, peer))
+    throw psid_cookie_failed();
+  serv_proto.start_from_cookie(self, peer);
+}
+#endif
+
+#ifdef PRE_VALIDATE
+// Check the client's initial reset with the TLSWrapPreValidate that
+// a server transport would run before creating a session.
+void pre_validate(TestProto& cli_proto, const ProtoContext::Config& sp)
+{
+  OPENVPN_SIMPLE_EXCEPTION(pre_validate_failed);
+
+  ProtoContext::TLSWrapPreValidate::Ptr pv;
+  if (sp.tls_crypt_v2_enabled())
+    pv.reset(new ProtoContext::TLSCryptV2PreValidate(sp, true));
+  else if (sp.tls_crypt_enabled())
+    pv.reset(new ProtoContext::TLSCryptPreValidate(sp, true));
+  else if (sp.tls_auth_enabled())
+    pv.reset(new ProtoContext::TLSAuthPreValidate(sp, true));
+  else
+    return;
+
+  // the reset and its retransmissions, as from one recvmmsg() burst
+  const BufferAllocated& reset = *cli_proto.net_out.front();
+  const BufferAllocated* burst[] = { &reset, &reset, &reset };
+  bool ok[3];
+  if (!pv->validate(reset) || pv->validate_batch(burst, 3, ok) != 3)
+    throw pre_validate_failed();
+
+  BufferAllocated corrupt(reset);
+  corrupt[corrupt.size() / 2] ^= 1;
+  if (pv->validate(corrupt))
+    throw pre_validate_failed();
+}
+#endif
+
+#ifdef DATA_BENCH
+#ifdef OPENVPN_PLATFORM_LINUX
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// L1D read miss counter for the calling thread, if the PMU is
+// accessible, otherwise inactive.
+class L1DMissCounter
+{
+public:
+  L1DMissCounter()
+  {
+#ifdef OPENVPN_PLATFORM_LINUX
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D
+      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = int(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+
+  ~L1DMissCounter()
+  {
+#ifdef OPENVPN_PLATFORM_LINUX
+    if (fd >= 0)
+      ::close(fd);
+#endif
+  }
+
+  bool defined() const { return fd >= 0; }
+
+  void start()
+  {
+#ifdef OPENVPN_PLATFORM_LINUX
+    if (fd >= 0)
+      {
+	::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+  }
+
+  unsigned long long stop()
+  {
+    unsigned long long count = 0;
+#ifdef OPENVPN_PLATFORM_LINUX
+    if (fd >= 0)
+      {
+	::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (::read(fd, &count, sizeof(count)) != sizeof(count))
+	  count = 0;
+      }
+#endif
+    return count;
+  }
+
+private:
+  int fd = -1;
+};
+
+// Time the steady-state data channel path (ProtoContext::data_encrypt
+// on one side, data_decrypt on the other) once both sides are keyed.
+template <typename T1, typename T2>
+void data_bench(T1& a, T2& b, const size_t n)
+{
+  OPENVPN_SIMPLE_EXCEPTION(data_bench_failed);
+
+  if (!a.data_channel_ready() || !b.data_channel_ready())
+    {
+      std::cerr << "*** data bench: data channel not ready" << std::endl;
+      return;
+    }
+
+  const std::string payload(200, 'x'); // fits the test frame
+  const size_t warmup = 1000;
+  BufferAllocated buf;
+  L1DMissCounter l1d;
+  std::chrono::steady_clock::duration elapsed{};
+  unsigned long long misses = 0;
+
+  for (size_t i = 0; i < n + warmup; ++i)
+    {
+      const bool measure = i >= warmup;
+      a.data_prepare(buf, payload);
+      if (measure)
+	l1d.start();
+      const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      a.data_encrypt(buf);
+      const typename T2::PacketType pt = b.packet_type(buf);
+      b.data_decrypt(pt, buf);
+      const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+      if (measure)
+	{
+	  misses += l1d.stop();
+	  elapsed += t1 - t0;
+	}
+      if (buf.size() != payload.size())
+	throw data_bench_failed();
+    }
+
+  std::cerr << "*** data bench: packets=" << n
+	    << " ns/packet=" << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / double(n)
+	    << " L1D-misses/packet=";
+  if (l1d.defined())
+    std::cerr << double(misses) / n;
+  else
+    std::cerr << "n/a";
+  std::cerr << std::endl;
+}
+#endif
+
+#ifdef REKEY_BENCH
+// Time data channel rekeys over many sessions.  Each round replaces
+// every session's crypto instance with a newly keyed one, as
+// KeyContext::init_data_channel() does for a new key_id.  The first
+// round starts from nothing, later rounds can recycle the contexts
+// released by the previous key.
+void rekey_bench(ProtoContext::Config& c, RandomAPI& rng, const SessionStats::Ptr& stats, const size_t n)
+{
+  OpenVPNStaticKey key;
+  rng.rand_bytes(key.raw_alloc(), OpenVPNStaticKey::KEY_SIZE);
+
+  std::vector<CryptoDCInstance::Ptr> sessions(n);
+  for (unsigned int round = 0; round < 4; ++round)
+    {
+      const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      for (auto& dc : sessions)
+	{
+	  CryptoDCInstance::Ptr next = c.dc.context().new_obj(round & 7);
+	  const unsigned int flags = next->defined();
+	  if (flags & CryptoDCInstance::CIPHER_DEFINED)
+	    next->init_cipher(key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT),
+			      key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT));
+	  if (flags & CryptoDCInstance::HMAC_DEFINED)
+	    next->init_hmac(key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT),
+			    key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT));
+	  next->init_pid(PacketID::SHORT_FORM, c.pid_mode, PacketID::SHORT_FORM, "DATA", int(round & 7), stats);
+	  dc = std::move(next);
+	}
+      const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+      std::cerr << "*** rekey bench: round=" << round
+		<< " sessions=" << n
+		<< " ns/rekey=" << std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / double(n)
+		<< std::endl;
+    }
+}
+#endif
+
+#ifdef SSL_EXECUTOR
+// Runs SSL work on a thread pool, but lets the simulation
+// wait for outstanding jobs so that results stay reproducible
+// in simulated time.
+class TestExecutor : public SSLExecutor
+{
+public:
+  typedef RCPtr<TestExecutor> Ptr;
+
+  TestExecutor(const SSLThreadPool::Ptr& pool)
+    : exec(new SSLAsioExecutor(pool, io_context))
+  {
+  }
+
+  virtual void execute(Function work, Function done)
+  {
+    ++pending;
+    exec->execute(std::move(work), [this, done=std::move(done)]() {
+	--pending;
+	done();
+      });
+  }
+
+  // run completions until no jobs are outstanding
+  void wait()
+  {
+    while (pending)
+      {
+	if (!io_context.run_one())
+	  io_context.restart();
+      }
+  }
+
+private:
+  openvpn_io::io_context io_context{1};
+  SSLAsioExecutor::Ptr exec;
+  unsigned int pending = 0;
 };
+#endif
 
 class MySessionStats : public SessionStats
 {
@@ -815,6 +1122,8 @@ int test(const int thread_num)
   try {
     // frame
     Frame::Ptr frame(new Frame(Frame::Context(128, 256, 128, 0, 16, 0)));
+    // the auth message, with the full peer info, may exceed the payload
+    (*frame)[Frame::WRITE_SSL_CLEARTEXT] = Frame::Context(128, 256, 128, 0, 16, BufferAllocated::GROW);
 
     // RNG
     ClientRandomAPI::Ptr rng_cli(new ClientRandomAPI(false));
@@ -825,7 +1134,13 @@ int test(const int thread_num)
 
     // init simulated time
     Time time;
+#ifdef GREMLIN
+    // fine enough to resolve emulated delays
+    const Time::Duration time_step = Time::Duration::binary_ms(10);
+    const Gremlin::Config gremlin(GREMLIN);
+#else
     const Time::Duration time_step = Time::Duration::binary_ms(100);
+#endif
 
     // client config files
     const std::string ca_crt = read_text("ca.crt");
@@ -1026,6 +1341,19 @@ int test(const int thread_num)
     std::cout << sp->peer_info_string();
 #endif
 
+#ifdef SSL_EXECUTOR
+    SSLThreadPool::Ptr ssl_pool(new SSLThreadPool(2));
+    TestExecutor::Ptr ssl_exec(new TestExecutor(ssl_pool));
+    cp->ssl_executor = ssl_exec;
+    sp->ssl_executor = ssl_exec;
+#endif
+
+#ifdef REKEY_BUDGET
+    RekeyScheduler::Config rsc;
+    rsc.max_per_second = REKEY_BUDGET;
+    sp->rekey_scheduler.reset(new RekeyScheduler(rsc));
+#endif
+
     TestProtoClient cli_proto(cp, cli_stats);
     TestProtoServer serv_proto(sp, serv_stats);
 
@@ -1036,15 +1364,32 @@ int test(const int thread_num)
 #endif
 	cli_proto.reset();
 	serv_proto.reset();
+#ifdef TLS_EKM
+	cli_proto.enable_tls_ekm();
+	serv_proto.enable_tls_ekm();
+#endif
 
+#ifdef GREMLIN
+	NoisyWire client_to_server("Client -> Server", &time, rng_noncrypto, 8, 16, 32,
+				   gremlin.send, gremlin.seed + 2 * (SITER * thread_num + i));
+	NoisyWire server_to_client("Server -> Client", &time, rng_noncrypto, 8, 16, 32,
+				   gremlin.recv, gremlin.seed + 2 * (SITER * thread_num + i) + 1);
+#else
 	NoisyWire client_to_server("Client -> Server", &time, rng_noncrypto, 8, 16, 32); // last value: 32
 	NoisyWire server_to_client("Server -> Client", &time, rng_noncrypto, 8, 16, 32); // last value: 32
+#endif
 
 	int j = -1;
 	try {
 #if FEEDBACK
 	  // start feedback loop
 	  cli_proto.initial_app_send(message);
+#ifdef PRE_VALIDATE
+	  pre_validate(cli_proto, *sp);
+#endif
+#ifdef PSID_COOKIE
+	  psid_cookie_start(cli_proto, serv_proto, *sp);
+#endif
 	  serv_proto.start();
 #else
 	  cli_proto.app_send_templ_init(message);
@@ -1056,6 +1401,9 @@ int test(const int thread_num)
 	    {
 	      client_to_server.xfer(cli_proto, serv_proto);
 	      server_to_client.xfer(serv_proto, cli_proto);
+#ifdef SSL_EXECUTOR
+	      ssl_exec->wait();
+#endif
 	      time += time_step;
 	    }
 	}
@@ -1066,6 +1414,28 @@ int test(const int thread_num)
 	  }
       }
 
+#ifdef DATA_BENCH
+    try {
+      data_bench(cli_proto, serv_proto, DATA_BENCH);
+    }
+    catch (const std::exception& e)
+      {
+	std::cerr << "Exception[data bench]: " << e.what() << std::endl;
+	return 1;
+      }
+#endif
+
+#ifdef REKEY_BENCH
+    try {
+      rekey_bench(*sp, *prng_serv, serv_stats, REKEY_BENCH);
+    }
+    catch (const std::exception& e)
+      {
+	std::cerr << "Exception[rekey bench]: " << e.what() << std::endl;
+	return 1;
+      }
+#endif
+
     cli_proto.finalize();
     serv_proto.finalize();
 
@@ -1092,6 +1462,10 @@ int test(const int thread_num)
     std::cerr << "-------- SERVER STATS --------" << std::endl;
     serv_stats->show_error_counts();
 #endif
+#ifdef REKEY_BUDGET
+    std::cerr << "REKEY acquired=" << sp->rekey_scheduler->stats().acquired
+	      << " deferred=" << sp->rekey_scheduler->stats().deferred << std::endl;
+#endif
 #ifdef OPENVPN_MAX_DATALIMIT_BYTES
     std::cerr << "------------------------------" << std::endl;
     std::cerr << "MAX_DATALIMIT_BYTES=" << DataLimit::max_bytes() << std::endl;
@@ -0,0 +1,186 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <map>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <openvpn/addr/addrkey.hpp>
+#include <openvpn/addr/pool.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static std::vector<IP::Addr> sample_addrs()
+  {
+    std::vector<IP::Addr> v;
+    for (const char* s : { "0.0.0.0", "1.2.3.4", "1.2.3.5", "255.255.255.255", "10.8.0.1",
+			   "::", "::1", "::ffff:1.2.3.4", "2001:db8::1", "2001:db8::1:0:0:1",
+			   "fe80::1", "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff" })
+      v.push_back(IP::Addr(s));
+    v.push_back(IP::Addr::from_ipv6(IPv6::Addr::from_uint64(0xfe80000000000000ull, 1, 2))); // fe80::1%2
+    v.push_back(IP::Addr());
+    return v;
+  }
+
+  TEST(addrkey, agrees_with_addr)
+  {
+    const std::vector<IP::Addr> v = sample_addrs();
+    for (const auto& a : v)
+      {
+	const IP::AddrKey ka(a);
+	ASSERT_EQ(a, ka.addr()) << a.to_string();
+	ASSERT_EQ(a.version(), ka.version());
+	ASSERT_EQ(0, ka.port());
+	for (const auto& b : v)
+	  {
+	    const IP::AddrKey kb(b);
+	    ASSERT_EQ(a == b, ka == kb) << a.to_string() << ' ' << b.to_string();
+	    if (ka == kb)
+	      {
+		ASSERT_EQ(ka.hashval(), kb.hashval());
+	      }
+
+	    // strict weak ordering, consistent with equality
+	    ASSERT_FALSE((ka < kb) && (kb < ka));
+	    ASSERT_EQ(ka == kb, !(ka < kb) && !(kb < ka));
+	  }
+      }
+
+    // IPv4 and its v4-mapped twin stay apart
+    ASSERT_NE(IP::AddrKey(IP::Addr("1.2.3.4")), IP::AddrKey(IP::Addr("::ffff:1.2.3.4")));
+    ASSERT_EQ(IP::AddrKey(IP::Addr("1.2.3.4")), IP::AddrKey::from_ipv4(0x01020304));
+  }
+
+  TEST(addrkey, port)
+  {
+    const IP::Addr a("192.168.1.1");
+    const IP::AddrKey k1(a, 1194), k2(a, 1195);
+    ASSERT_NE(k1, k2);
+    ASSERT_NE(k1, IP::AddrKey(a));
+    ASSERT_EQ(1194, k1.port());
+    ASSERT_EQ(a, k1.addr());
+    ASSERT_EQ(k1, IP::AddrKey::from_ipv4(0xC0A80101, 1194));
+  }
+
+  TEST(addrkey, hash_spread)
+  {
+    // consecutive pool addresses and ports hash apart
+    std::unordered_set<std::size_t> h;
+    for (std::uint32_t i = 0; i < 65536; ++i)
+      h.insert(IP::AddrKey::from_ipv4(0x0A000000 + i).hashval() & 0xFFFFF);
+    for (std::uint16_t p = 0; p < 4096; ++p)
+      h.insert(IP::AddrKey(IP::Addr("2001:db8::1"), p).hashval() & 0xFFFFF);
+    ASSERT_GT(h.size(), size_t(65536 + 4096) * 9 / 10);
+  }
+
+  TEST(addrkey, pool)
+  {
+    IP::Pool pool;
+    pool.add_range(IP::Range(IP::Addr("10.0.0.1"), 4));
+    pool.add_addr(IP::Addr("2001:db8::1"));
+    ASSERT_EQ(5u, pool.n_free());
+    ASSERT_TRUE(pool.acquire_specific_addr(IP::Addr("2001:db8::1")));
+    ASSERT_FALSE(pool.acquire_specific_addr(IP::Addr("2001:db8::1")));
+    IP::Addr a;
+    ASSERT_TRUE(pool.acquire_addr(a));
+    ASSERT_EQ("10.0.0.1", a.to_string());
+    ASSERT_FALSE(pool.acquire_specific_addr(a));
+    pool.release_addr(a);
+    ASSERT_TRUE(pool.acquire_specific_addr(IP::Addr("10.0.0.1")));
+    ASSERT_FALSE(pool.acquire_specific_addr(IP::Addr("10.0.0.5")));
+  }
+
+  // Peer-map style lookups of IP::Addr against AddrKey.  Only logs
+  // the timings; run the test binary on an idle machine to compare.
+  TEST(addrkey, microbench)
+  {
+    enum {
+      N_PEERS = 20000,
+      N_LOOKUPS = 400000,
+    };
+    std::mt19937 rng(1);
+    std::vector<IP::Addr> addrs;
+    for (unsigned int i = 0; i < N_PEERS; ++i)
+      {
+	if (i & 1)
+	  addrs.push_back(IP::Addr::from_ipv6(IPv6::Addr::from_uint64(0x20010db800000000ull, rng())));
+	else
+	  addrs.push_back(IP::Addr::from_ipv4(IPv4::Addr::from_uint32(rng())));
+      }
+    std::vector<unsigned int> order(N_LOOKUPS);
+    for (auto& o : order)
+      o = rng() % N_PEERS;
+
+    std::map<IP::Addr, unsigned int> by_addr;
+    std::unordered_map<IP::AddrKey, unsigned int> by_key;
+    std::vector<IP::AddrKey> keys;
+    for (unsigned int i = 0; i < N_PEERS; ++i)
+      {
+	by_addr[addrs[i]] = i;
+	by_key[IP::AddrKey(addrs[i])] = i;
+	keys.emplace_back(addrs[i]);
+      }
+    ASSERT_EQ(by_addr.size(), by_key.size());
+
+    typedef std::chrono::steady_clock clock;
+    auto ns_per_op = [](const clock::time_point start, const size_t n) {
+      return double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()) / n;
+    };
+
+    unsigned long sum_addr = 0;
+    clock::time_point t = clock::now();
+    for (const unsigned int o : order)
+      sum_addr += by_addr.find(addrs[o])->second;
+    const double map_ns = ns_per_op(t, N_LOOKUPS);
+
+    unsigned long sum_key = 0;
+    t = clock::now();
+    for (const unsigned int o : order)
+      sum_key += by_key.find(keys[o])->second;
+    const double key_ns = ns_per_op(t, N_LOOKUPS);
+    ASSERT_EQ(sum_addr, sum_key);
+
+    unsigned int eq_addr = 0;
+    t = clock::now();
+    for (unsigned int i = 1; i < N_LOOKUPS; ++i)
+      eq_addr += addrs[order[i]] == addrs[order[i - 1]];
+    const double addr_eq_ns = ns_per_op(t, N_LOOKUPS);
+
+    unsigned int eq_key = 0;
+    t = clock::now();
+    for (unsigned int i = 1; i < N_LOOKUPS; ++i)
+      eq_key += keys[order[i]] == keys[order[i - 1]];
+    const double key_eq_ns = ns_per_op(t, N_LOOKUPS);
+    ASSERT_EQ(eq_addr, eq_key);
+
+    OPENVPN_LOG("addrkey microbench: std::map<IP::Addr> find " << map_ns
+		<< " ns, unordered_map<AddrKey> find " << key_ns
+		<< " ns, IP::Addr== " << addr_eq_ns
+		<< " ns, AddrKey== " << key_eq_ns << " ns");
+  }
+}
@@ -0,0 +1,279 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/acceptor/unix.hpp>
+#include <openvpn/client/win/agentproto.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static AgentProto::Message two_actions()
+  {
+    AgentProto::Message msg;
+    msg.id = 7;
+    AgentProto::Record add(AgentProto::ADD_BYPASS_ROUTE);
+    add.set(AgentProto::HOST, "192.0.2.1");
+    add.set_bool(AgentProto::IPV6, false);
+    add.set_uint(AgentProto::PID, 4242);
+    msg.records.push_back(std::move(add));
+    AgentProto::Record tun(AgentProto::TUN_SETUP);
+    tun.set(AgentProto::TUN, std::string("{\"a\":\0}", 7));
+    msg.records.push_back(std::move(tun));
+    return msg;
+  }
+
+  static std::string to_string(const AgentProto::Message& msg)
+  {
+    BufferAllocated buf(64, BufferAllocated::GROW);
+    AgentProto::serialize(msg, buf);
+    return std::string(reinterpret_cast<const char *>(buf.c_data()), buf.size());
+  }
+
+  TEST(agentproto, roundtrip)
+  {
+    const std::string wire = to_string(two_actions());
+    const AgentProto::Message msg = AgentProto::parse(reinterpret_cast<const unsigned char *>(wire.data()), wire.length());
+    EXPECT_EQ(msg.id, 7u);
+    ASSERT_EQ(msg.records.size(), 2u);
+    EXPECT_EQ(msg.records[0].type, AgentProto::ADD_BYPASS_ROUTE);
+    EXPECT_EQ(msg.records[0].get_string(AgentProto::HOST), "192.0.2.1");
+    EXPECT_FALSE(msg.records[0].get_bool(AgentProto::IPV6));
+    EXPECT_EQ(msg.records[0].get_uint(AgentProto::PID), 4242u);
+    EXPECT_EQ(msg.records[0].get_uint_optional(AgentProto::LOG_APPEND, 3), 3u);
+    EXPECT_EQ(msg.records[1].get_string(AgentProto::TUN), std::string("{\"a\":\0}", 7));
+    EXPECT_THROW(msg.records[1].get_string(AgentProto::HOST), AgentProto::agent_proto_error);
+    EXPECT_EQ(to_string(msg), wire);
+  }
+
+  TEST(agentproto, reader)
+  {
+    const std::string wire = to_string(two_actions()) + to_string(AgentProto::Message());
+    AgentProto::MessageReader reader;
+    AgentProto::Message msg;
+    size_t n = 0;
+    for (const char c : wire)
+      {
+	reader.put(reinterpret_cast<const unsigned char *>(&c), 1);
+	while (reader.get(msg))
+	  ++n;
+      }
+    EXPECT_EQ(n, 2u);
+    EXPECT_EQ(msg.id, 0u);
+    EXPECT_TRUE(msg.records.empty());
+  }
+
+  TEST(agentproto, malformed)
+  {
+    std::string wire = to_string(two_actions());
+    const unsigned char* p = reinterpret_cast<const unsigned char *>(wire.data());
+    EXPECT_THROW(AgentProto::parse(p, wire.length() - 1), AgentProto::agent_proto_error);
+
+    // first field length running past the end of the message
+    const size_t HEADER_OFFSET = AgentProto::HEADER_SIZE + 6 + 2;
+    wire[HEADER_OFFSET] = 0x7f;
+    EXPECT_THROW(AgentProto::parse(p, wire.length()), AgentProto::agent_proto_error);
+
+    AgentProto::MessageReader reader;
+    const unsigned char huge[] = { 0xff, 0xff, 0xff, 0xff };
+    reader.put(huge, sizeof(huge));
+    AgentProto::Message msg;
+    EXPECT_THROW(reader.get(msg), AgentProto::agent_proto_error);
+  }
+
+  // Answers ADD_BYPASS_ROUTE right away and TUN_SETUP after a
+  // delay, so a later request can complete first.
+  struct TestHandler : public AgentProto::Session::Handler
+  {
+    TestHandler(openvpn_io::io_context& io_context_arg)
+      : io_context(io_context_arg)
+    {
+    }
+
+    virtual void agent_request(AgentProto::Session& session, AgentProto::Message& request) override
+    {
+      AgentProto::Message reply;
+      reply.id = request.id;
+      bool delay = false;
+      for (const auto& r : request.records)
+	{
+	  AgentProto::Record res(r.type);
+	  if (r.type == AgentProto::ADD_BYPASS_ROUTE)
+	    res.set(AgentProto::LOG_TXT, "route " + r.get_string(AgentProto::HOST));
+	  else if (r.type == AgentProto::TUN_SETUP)
+	    delay = true;
+	  else
+	    res.status = AgentProto::STATUS_UNKNOWN_ACTION;
+	  reply.records.push_back(std::move(res));
+	}
+      ++requests;
+      if (delay)
+	{
+	  std::shared_ptr<AsioTimer> timer(new AsioTimer(io_context));
+	  timer->expires_after(Time::Duration::milliseconds(100));
+	  timer->async_wait([timer, session=AgentProto::Session::Ptr(&session), reply](const openvpn_io::error_code& error) {
+	      session->reply(reply);
+	    });
+	}
+      else
+	session.reply(reply);
+    }
+
+    virtual void agent_session_closed(AgentProto::Session& session) override
+    {
+      ++closed;
+    }
+
+    openvpn_io::io_context& io_context;
+    int requests = 0;
+    int closed = 0;
+  };
+
+  struct FDStream
+  {
+    void write_all(const unsigned char* data, size_t size)
+    {
+      while (size)
+	{
+	  const ssize_t n = ::write(fd, data, size);
+	  if (n <= 0)
+	    throw Exception("write failed");
+	  data += n;
+	  size -= n;
+	}
+    }
+
+    size_t read_some(unsigned char* data, const size_t size)
+    {
+      const ssize_t n = ::read(fd, data, size);
+      if (n < 0)
+	throw Exception("read failed");
+      return n;
+    }
+
+    int fd = -1;
+  };
+
+  static int connect_unix(const std::string& path)
+  {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un sa = {};
+    sa.sun_family = AF_UNIX;
+    std::strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+    if (::connect(fd, (const struct sockaddr *)&sa, sizeof(sa)) < 0)
+      {
+	::close(fd);
+	return -1;
+      }
+    return fd;
+  }
+
+  TEST(agentproto, session)
+  {
+    const std::string path = "/tmp/test_agentproto." + std::to_string(::getpid());
+    openvpn_io::io_context io_context(1);
+    RCPtr<TestHandler> handler(new TestHandler(io_context));
+    AgentProto::Listener::Ptr listener(new AgentProto::Listener(io_context, handler.get()));
+
+    Acceptor::Unix::Ptr a(new Acceptor::Unix(io_context));
+    a->pre_listen(path);
+    a->local_endpoint.path(path);
+    a->acceptor.open(a->local_endpoint.protocol());
+    a->acceptor.bind(a->local_endpoint);
+    a->acceptor.listen();
+    listener->add_acceptor(a);
+
+    std::string error;
+    std::thread client([&]() {
+	try {
+	  FDStream stream;
+	  stream.fd = connect_unix(path);
+	  if (stream.fd < 0)
+	    throw Exception("connect failed");
+
+	  // batched request on a persistent connection
+	  AgentProto::SyncClient<FDStream> cli(stream);
+	  AgentProto::Message req = two_actions();
+	  AgentProto::Message reply = cli.transact(req);
+	  if (reply.records.size() != 2
+	      || reply.records[0].get_string(AgentProto::LOG_TXT) != "route 192.0.2.1"
+	      || reply.records[1].type != AgentProto::TUN_SETUP)
+	    throw Exception("bad batch reply");
+
+	  // a delayed request is overtaken by a later one
+	  AgentProto::Message slow;
+	  slow.id = 100;
+	  slow.records.emplace_back(AgentProto::TUN_SETUP);
+	  AgentProto::Message fast;
+	  fast.id = 101;
+	  fast.records.emplace_back(999);
+	  const std::string wire = to_string(slow) + to_string(fast);
+	  stream.write_all(reinterpret_cast<const unsigned char *>(wire.data()), wire.length());
+	  AgentProto::MessageReader reader;
+	  std::vector<std::uint32_t> ids;
+	  unsigned char buf[256];
+	  while (ids.size() < 2)
+	    {
+	      const size_t n = stream.read_some(buf, sizeof(buf));
+	      if (!n)
+		throw Exception("eof");
+	      reader.put(buf, n);
+	      while (reader.get(reply))
+		{
+		  ids.push_back(reply.id);
+		  if (reply.id == 101 && reply.records.at(0).status != AgentProto::STATUS_UNKNOWN_ACTION)
+		    throw Exception("bad status");
+		}
+	    }
+	  if (ids != std::vector<std::uint32_t>{101, 100})
+	    throw Exception("replies not reordered");
+	  ::close(stream.fd);
+	}
+	catch (const std::exception& e)
+	  {
+	    error = e.what();
+	  }
+      });
+
+    // run until the client has disconnected
+    while (handler->closed == 0)
+      io_context.run_one();
+    client.join();
+    listener->stop();
+    io_context.poll();
+    ::unlink(path.c_str());
+
+    EXPECT_EQ(error, "");
+    EXPECT_EQ(handler->requests, 3);
+    EXPECT_EQ(listener->n_sessions(), 0u);
+  }
+}
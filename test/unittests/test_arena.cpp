@@ -0,0 +1,91 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <vector>
+
+#include <openvpn/common/arena.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(arena, scope)
+  {
+    const Arena::Stats before = Arena::stats();
+    Arena::Ptr arena(new Arena());
+    BufferPtr a, b, c;
+    {
+      Arena::Scope scope(arena.get());
+      a.reset(new BufferAllocated(64, 0));
+      b.reset(new BufferAllocated(64, 0));
+    }
+    c.reset(new BufferAllocated(64, 0));
+    const Arena::Stats after = Arena::stats();
+    EXPECT_EQ(before.arena_objects + 2, after.arena_objects);
+    EXPECT_EQ(before.heap_objects + 1, after.heap_objects);
+    EXPECT_EQ(before.chunks + 1, after.chunks);
+  }
+
+  // objects stay valid after the arena is retired and destroyed
+  TEST(arena, outlive)
+  {
+    std::vector<BufferPtr> bufs;
+    {
+      Arena::Ptr arena(new Arena());
+      Arena::Scope scope(arena.get());
+      for (int i = 0; i < 200; ++i) // several chunks
+	{
+	  bufs.emplace_back(new BufferAllocated(16, 0));
+	  bufs.back()->push_back(i);
+	}
+      arena->retire();
+      EXPECT_TRUE(arena->is_retired());
+
+      // no more arena allocations once retired
+      const Arena::Stats before = Arena::stats();
+      BufferPtr heap(new BufferAllocated(16, 0));
+      EXPECT_EQ(before.arena_objects, Arena::stats().arena_objects);
+      EXPECT_EQ(before.heap_objects + 1, Arena::stats().heap_objects);
+    }
+    for (int i = 0; i < 200; ++i)
+      EXPECT_EQ(i, (*bufs[i])[0]);
+    bufs.clear();
+  }
+
+  TEST(arena, null_scope)
+  {
+    Arena::Ptr arena(new Arena());
+    Arena::Scope outer(arena.get());
+    {
+      Arena::Scope inner(nullptr);
+      const Arena::Stats before = Arena::stats();
+      BufferPtr buf(new BufferAllocated(16, 0));
+      EXPECT_EQ(before.arena_objects, Arena::stats().arena_objects);
+    }
+    const Arena::Stats before = Arena::stats();
+    BufferPtr buf(new BufferAllocated(16, 0));
+    EXPECT_EQ(before.arena_objects + 1, Arena::stats().arena_objects);
+  }
+}
@@ -0,0 +1,108 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <atomic>
+#include <future>
+#include <set>
+#include <thread>
+
+#include <openvpn/asio/asiopool.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static std::thread::id thread_of(AsioContextPool& pool, const unsigned int unit)
+  {
+    std::promise<std::thread::id> id;
+    openvpn_io::post(pool.io_context(unit), [&id]() {
+	id.set_value(std::this_thread::get_id());
+      });
+    return id.get_future().get();
+  }
+
+  TEST(asiopool, placement)
+  {
+    AsioContextPool pool(3);
+    pool.start();
+    ASSERT_EQ(3u, pool.size());
+
+    // objects are spread evenly, and a released slot is reused first
+    for (unsigned int i = 0; i < 6; ++i)
+      ASSERT_EQ(i % 3, pool.acquire());
+    pool.release(1);
+    ASSERT_EQ(1u, pool.acquire());
+    ASSERT_EQ(2u, pool.load(2));
+
+    // each io_context has a thread of its own, other than ours
+    std::set<std::thread::id> ids;
+    for (unsigned int i = 0; i < pool.size(); ++i)
+      ids.insert(thread_of(pool, i));
+    ASSERT_EQ(3u, ids.size());
+    ASSERT_EQ(0u, ids.count(std::this_thread::get_id()));
+  }
+
+  // the threads keep running without work, until stop()
+  TEST(asiopool, idle)
+  {
+    AsioContextPool pool(2);
+    pool.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(thread_of(pool, 1), thread_of(pool, 1));
+    pool.stop();
+    ASSERT_TRUE(pool.io_context(0).stopped());
+  }
+
+  class CountingPool : public AsioContextPool
+  {
+  public:
+    CountingPool()
+      : AsioContextPool(2)
+    {
+    }
+
+    ~CountingPool()
+    {
+      stop();
+    }
+
+    std::atomic<int> runs{0};
+
+  protected:
+    virtual void run(const unsigned int unit) override
+    {
+      ++runs;
+      AsioContextPool::run(unit);
+    }
+  };
+
+  TEST(asiopool, run_override)
+  {
+    CountingPool pool;
+    pool.start();
+    thread_of(pool, 0);
+    thread_of(pool, 1);
+    ASSERT_EQ(2, pool.runs.load());
+    ASSERT_THROW(pool.start(), AsioContextPool::asio_context_pool_error);
+  }
+}
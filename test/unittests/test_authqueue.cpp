@@ -0,0 +1,272 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/ws/httpserv.hpp>
+#include <openvpn/ws/httpauth.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // backend that completes requests only when told to
+  struct ManualBackend : public AuthQueue::Backend
+  {
+    typedef RCPtr<ManualBackend> Ptr;
+
+    virtual void start(const AuthQueue::Request& req, AuthQueue::Completion complete) override
+    {
+      ++n_started;
+      pending.push_back(std::move(complete));
+    }
+
+    virtual void stop() override
+    {
+      pending.clear();
+    }
+
+    void complete_one(const AuthQueue::Result::Status status)
+    {
+      AuthQueue::Completion c = std::move(pending.front());
+      pending.pop_front();
+      c(AuthQueue::Result(status));
+    }
+
+    std::deque<AuthQueue::Completion> pending;
+    unsigned int n_started = 0;
+  };
+
+  static AuthCreds::Ptr creds(const std::string& user, const std::string& pass)
+  {
+    return new AuthCreds(std::string(user), SafeString(pass), "");
+  }
+
+  struct Results : public std::vector<AuthQueue::Result>
+  {
+    AuthQueue::Completion add()
+    {
+      return [this](const AuthQueue::Result& r) {
+	push_back(r);
+      };
+    }
+  };
+
+  TEST(AuthQueue, Concurrency)
+  {
+    openvpn_io::io_context io_context(1);
+    ManualBackend::Ptr backend = new ManualBackend();
+    AuthQueue::Config config;
+    config.max_in_flight = 2;
+    config.max_queued = 2;
+    AuthQueue::Ptr queue = new AuthQueue(io_context, backend, config);
+    Results results;
+
+    for (int i = 0; i < 5; ++i)
+      queue->submit(creds("user" + std::to_string(i), "pass"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    io_context.poll();
+
+    // two in flight, two waiting, one rejected
+    EXPECT_EQ(backend->n_started, 2u);
+    EXPECT_EQ(queue->in_flight(), 2u);
+    EXPECT_EQ(queue->queued(), 2u);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].status, AuthQueue::Result::OVERLOAD);
+
+    backend->complete_one(AuthQueue::Result::SUCCESS);
+    backend->complete_one(AuthQueue::Result::FAIL);
+    EXPECT_EQ(backend->n_started, 4u);
+    EXPECT_EQ(queue->queued(), 0u);
+    backend->complete_one(AuthQueue::Result::SUCCESS);
+    backend->complete_one(AuthQueue::Result::SUCCESS);
+    ASSERT_EQ(results.size(), 5u);
+    EXPECT_EQ(results[2].status, AuthQueue::Result::FAIL);
+    EXPECT_EQ(queue->in_flight(), 0u);
+    queue->stop();
+  }
+
+  TEST(AuthQueue, Deadline)
+  {
+    openvpn_io::io_context io_context(1);
+    ManualBackend::Ptr backend = new ManualBackend();
+    AuthQueue::Config config;
+    config.max_in_flight = 1;
+    config.deadline = Time::Duration::milliseconds(100);
+    AuthQueue::Ptr queue = new AuthQueue(io_context, backend, config);
+    Results results;
+
+    queue->submit(creds("a", "pass"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    AuthQueue::Request::Ptr b = queue->submit(creds("b", "pass"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    queue->submit(creds("c", "pass"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    b->cancel();
+    io_context.run();
+
+    // both timed out, the cancelled one wasn't reported
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0].status, AuthQueue::Result::TIMEOUT);
+    EXPECT_EQ(results[1].status, AuthQueue::Result::TIMEOUT);
+    EXPECT_EQ(queue->queued(), 0u);
+    EXPECT_EQ(queue->stats().timeout, 2u);
+
+    // the in-flight slot is only freed when the backend answers,
+    // and the late answer is dropped
+    EXPECT_EQ(queue->in_flight(), 1u);
+    backend->complete_one(AuthQueue::Result::SUCCESS);
+    EXPECT_EQ(queue->in_flight(), 0u);
+    EXPECT_EQ(backend->n_started, 1u);
+    EXPECT_EQ(results.size(), 2u);
+    queue->stop();
+  }
+
+  TEST(AuthQueue, TokenCache)
+  {
+    openvpn_io::io_context io_context(1);
+    ManualBackend::Ptr backend = new ManualBackend();
+    AuthQueue::Ptr queue = new AuthQueue(io_context, backend, AuthQueue::Config());
+    Results results;
+
+    queue->submit(creds("user", "SESS_ID_abc"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    queue->submit(creds("user", "password"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    backend->complete_one(AuthQueue::Result::SUCCESS);
+    backend->complete_one(AuthQueue::Result::SUCCESS);
+
+    // only the token reauth is answered from the cache
+    queue->submit(creds("user", "SESS_ID_abc"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    queue->submit(creds("user", "password"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    queue->submit(creds("user", "SESS_ID_xyz"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    io_context.poll();
+    EXPECT_EQ(backend->n_started, 4u);
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_TRUE(results[2].success());
+    EXPECT_TRUE(results[2].cached);
+    EXPECT_EQ(queue->stats().cache_hits, 1u);
+
+    queue->invalidate_user("user");
+    queue->submit(creds("user", "SESS_ID_abc"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    EXPECT_EQ(backend->n_started, 5u);
+    queue->stop();
+  }
+
+  static const char *auth_port = "19126";
+
+  class AuthServerClient : public WS::Server::Listener::Client
+  {
+  public:
+    AuthServerClient(WS::Server::Listener::Client::Initializer& ci)
+      : WS::Server::Listener::Client(ci)
+    {
+    }
+
+  private:
+    virtual void http_content_in(BufferAllocated& buf) override
+    {
+      if (buf.size())
+	content += buf_to_string(buf);
+    }
+
+    // called once the request content is complete
+    virtual void http_request_received() override
+    {
+      WS::Server::ContentInfo ci;
+      if (content == "username=alice&password=secret")
+	{
+	  ci.http_status = HTTP::Status::OK;
+	  out = buf_from_string("OK\n");
+	}
+      else
+	{
+	  ci.http_status = HTTP::Status::Forbidden;
+	  out = buf_from_string("bad password\nfor " + content + '\n');
+	}
+      ci.type = "text/plain";
+      ci.length = out->size();
+      ci.keepalive = keepalive_request();
+      content.clear();
+      generate_reply_headers(ci);
+    }
+
+    virtual BufferPtr http_content_out() override
+    {
+      BufferPtr ret;
+      ret.swap(out);
+      return ret;
+    }
+
+    virtual bool http_out_eof() override
+    {
+      return true;
+    }
+
+    std::string content;
+    BufferPtr out;
+  };
+
+  struct AuthServerFactory : public WS::Server::Listener::Client::Factory
+  {
+    virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+    {
+      return new AuthServerClient(ci);
+    }
+  };
+
+  TEST(AuthQueue, HTTPBackend)
+  {
+    openvpn_io::io_context io_context(1);
+
+    WS::Server::Config::Ptr sconf = new WS::Server::Config();
+    sconf->frame = frame_init_simple(2048);
+    sconf->stats.reset(new SessionStats());
+    Listen::Item li;
+    li.addr = "127.0.0.1";
+    li.port = auth_port;
+    li.proto = Protocol(Protocol::TCPv4);
+    li.ssl = Listen::Item::SSLOff;
+    li.n_threads = 1;
+    WS::Server::Listener::Ptr listener = new WS::Server::Listener(io_context, sconf, li, new AuthServerFactory());
+    listener->start();
+
+    WS::HTTPAuthBackend::Config bconf;
+    bconf.http_config.reset(new WS::Client::Config());
+    bconf.http_config->frame = frame_init_simple(2048);
+    bconf.http_config->stats.reset(new SessionStats());
+    bconf.http_config->connect_timeout = 5;
+    bconf.http_config->general_timeout = 5;
+    bconf.host.host = "127.0.0.1";
+    bconf.host.port = auth_port;
+    WS::HTTPAuthBackend::Ptr backend = new WS::HTTPAuthBackend(io_context, bconf);
+    AuthQueue::Ptr queue = new AuthQueue(io_context, backend, AuthQueue::Config());
+
+    Results results;
+    queue->submit(creds("alice", "secret"), AuthCert::Ptr(), PeerAddr::Ptr(), results.add());
+    queue->submit(creds("alice", "wrong"), AuthCert::Ptr(), PeerAddr::Ptr(),
+		  [&](const AuthQueue::Result& r) {
+		    results.push_back(r);
+		    queue->stop();
+		    listener->stop();
+		  });
+    io_context.run();
+
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0].status, AuthQueue::Result::SUCCESS);
+    EXPECT_EQ(results[1].status, AuthQueue::Result::FAIL);
+    EXPECT_EQ(results[1].reason, "bad password");
+  }
+}
@@ -0,0 +1,157 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <map>
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/auth/authtoken.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  typedef AuthTokenHMAC<SSLLib::CryptoAPI> TokenHMAC;
+
+  class AuthTokenTest : public testing::Test
+  {
+  protected:
+    AuthTokenTest()
+      : rng(new SSLLib::RandomAPI(false)),
+	key1(*rng, 1),
+	key2(*rng, 2)
+    {
+      base64_init_static();
+    }
+
+    RandomAPI::Ptr rng;
+    TokenHMAC::Key key1;
+    TokenHMAC::Key key2;
+  };
+
+  TEST_F(AuthTokenTest, Verify)
+  {
+    TokenHMAC hmac(TokenHMAC::Config(), key1);
+    const std::time_t now = 1600000000;
+    const std::string tok = hmac.generate_initial(*rng, "alice", "cert1", now);
+    EXPECT_TRUE(TokenHMAC::is_token(tok));
+
+    TokenHMAC::Info info;
+    EXPECT_EQ(hmac.verify(tok, "alice", "cert1", &info, now + 60), TokenHMAC::VALID);
+    EXPECT_EQ(info.initial, std::uint64_t(now));
+
+    // bound to user and binding
+    EXPECT_EQ(hmac.verify(tok, "bob", "cert1", nullptr, now), TokenHMAC::BAD_HMAC);
+    EXPECT_EQ(hmac.verify(tok, "alice", "cert2", nullptr, now), TokenHMAC::BAD_HMAC);
+    EXPECT_EQ(hmac.verify(tok, "alic", "ecert1", nullptr, now), TokenHMAC::BAD_HMAC);
+
+    // tampering
+    std::string bad = tok;
+    bad[bad.length() - 5] = bad[bad.length() - 5] == 'A' ? 'B' : 'A';
+    EXPECT_EQ(hmac.verify(bad, "alice", "cert1", nullptr, now), TokenHMAC::BAD_HMAC);
+    EXPECT_EQ(hmac.verify("SESS_ID_AT_xyz", "alice", "cert1", nullptr, now), TokenHMAC::MALFORMED);
+    EXPECT_EQ(hmac.verify("password", "alice", "cert1", nullptr, now), TokenHMAC::NOT_TOKEN);
+  }
+
+  TEST_F(AuthTokenTest, Window)
+  {
+    TokenHMAC::Config config;
+    config.renew_window = 3600;
+    config.max_lifetime = 86400;
+    TokenHMAC hmac(config, key1);
+    const std::time_t now = 1600000000;
+    const std::string tok = hmac.generate_initial(*rng, "alice", "", now);
+
+    EXPECT_EQ(hmac.verify(tok, "alice", "", nullptr, now + 3599), TokenHMAC::VALID);
+    EXPECT_EQ(hmac.verify(tok, "alice", "", nullptr, now + 3600), TokenHMAC::EXPIRED);
+    EXPECT_EQ(hmac.verify(tok, "alice", "", nullptr, now - 3600), TokenHMAC::NOT_YET_VALID);
+
+    // renewal keeps the session and initial login time
+    TokenHMAC::Info info;
+    ASSERT_EQ(hmac.verify(tok, "alice", "", &info, now + 3000), TokenHMAC::VALID);
+    const std::string renewed = hmac.generate("alice", "", info, now + 3000);
+    TokenHMAC::Info info2;
+    EXPECT_EQ(hmac.verify(renewed, "alice", "", &info2, now + 6000), TokenHMAC::VALID);
+    EXPECT_EQ(info2.session, info.session);
+    EXPECT_EQ(info2.initial, std::uint64_t(now));
+
+    // but not past max_lifetime
+    info2.issued = now + 86000;
+    const std::string late = hmac.generate("alice", "", info2, now + 86000);
+    EXPECT_EQ(hmac.verify(late, "alice", "", nullptr, now + 86400), TokenHMAC::EXPIRED);
+  }
+
+  TEST_F(AuthTokenTest, KeyRotation)
+  {
+    TokenHMAC old_hmac(TokenHMAC::Config(), key1);
+    const std::string tok = old_hmac.generate_initial(*rng, "alice", "");
+
+    TokenHMAC rotated(TokenHMAC::Config(), key2, &key1);
+    EXPECT_EQ(rotated.verify(tok, "alice", ""), TokenHMAC::VALID);
+    TokenHMAC retired(TokenHMAC::Config(), key2);
+    EXPECT_EQ(retired.verify(tok, "alice", ""), TokenHMAC::UNKNOWN_KEY);
+  }
+
+  struct NoBackend : public AuthQueue::Backend
+  {
+    virtual void start(const AuthQueue::Request& req, AuthQueue::Completion complete) override
+    {
+      ++n_started;
+      complete(AuthQueue::Result(AuthQueue::Result::FAIL));
+    }
+
+    virtual void stop() override
+    {
+    }
+
+    unsigned int n_started = 0;
+  };
+
+  TEST_F(AuthTokenTest, FastPath)
+  {
+    openvpn_io::io_context io_context(1);
+    RCPtr<NoBackend> backend = new NoBackend();
+    AuthQueue::Ptr queue = new AuthQueue(io_context, backend, AuthQueue::Config());
+    queue->set_fast_path(new AuthTokenFastPath<SSLLib::CryptoAPI>(TokenHMAC::Config(), key1));
+
+    TokenHMAC hmac(TokenHMAC::Config(), key1);
+    const std::string tok = hmac.generate_initial(*rng, "alice", AuthTokenFastPath<SSLLib::CryptoAPI>::binding(nullptr));
+
+    std::map<std::string, AuthQueue::Result> results;
+    auto submit = [&](const std::string& user, const std::string& pass) {
+      queue->submit(new AuthCreds(std::string(user), SafeString(pass), ""), AuthCert::Ptr(), PeerAddr::Ptr(),
+		    [&results, user](const AuthQueue::Result& r) {
+		      results[user] = r;
+		    });
+    };
+    submit("alice", tok);
+    submit("bob", tok);
+    io_context.run();
+
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_TRUE(results["alice"].success());
+    EXPECT_TRUE(results["alice"].fast_path);
+    EXPECT_FALSE(results["bob"].success());
+    EXPECT_EQ(backend->n_started, 1u);
+    queue->stop();
+  }
+}
@@ -22,6 +22,8 @@
 #include "test_common.h"
 
 #include <iostream>
+#include <algorithm>
+#include <vector>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/base64.hpp>
@@ -178,4 +180,66 @@ TEST(Base64, binary_data)
         b64_test_binary(b64, data, i);
         delete[] data;
     }
-}
\ No newline at end of file
+}
+std::string random_bytes(const size_t len)
+{
+    std::string data(len, '\0');
+    for (size_t j = 0; j < len; j++)
+        data[j] = (char)(std::rand() & 0xff);
+    return data;
+}
+
+// Long enough inputs go through the vector kernels, if the CPU has them
+TEST(Base64, long_data)
+{
+    const Base64 b64;
+    const Base64 b64_urlsafe("-_.");
+    std::srand(0);
+    for (unsigned int i = 0; i < 400; i++)
+    {
+        const std::string data = random_bytes(i);
+        b64_test_binary(b64, data.c_str(), i);
+
+        std::string libenc = ssllib_b64enc(data.c_str(), i);
+        std::replace(libenc.begin(), libenc.end(), '+', '-');
+        std::replace(libenc.begin(), libenc.end(), '/', '_');
+        std::replace(libenc.begin(), libenc.end(), '=', '.');
+        const std::string enc = b64_urlsafe.encode(data);
+        EXPECT_EQ(enc, libenc);
+        EXPECT_EQ(b64_urlsafe.decode(enc), data);
+
+        // container without a string append or raw pointer
+        std::vector<unsigned char> dec;
+        b64_urlsafe.decode(dec, enc);
+        EXPECT_EQ(std::string(dec.begin(), dec.end()), data);
+    }
+}
+
+TEST(Base64, long_data_bad)
+{
+    const Base64 b64;
+    std::srand(0);
+    const std::string data = random_bytes(300);
+    const std::string enc = b64.encode(data);
+    for (size_t k = 0; k < enc.length(); ++k)
+    {
+        std::string bad = enc;
+        bad[k] = '*';
+        if (k % 4 == 0)
+        {
+            // decoding stops at a token starting with a non-base64 char
+            std::string dec;
+            b64.decode(dec, bad);
+            EXPECT_EQ(dec, data.substr(0, k / 4 * 3));
+        }
+        else
+            b64_test_bad(b64, bad);
+
+        bad[k] = '=';
+        if (k % 4 != 3)
+            b64_test_bad(b64, bad);
+    }
+
+    char buf[299];
+    EXPECT_THROW(b64.decode(buf, sizeof(buf), enc), Base64::base64_decode_out_of_bound_error);
+}
@@ -0,0 +1,145 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <set>
+
+#include <openvpn/addr/bitmappool.hpp>
+#include <openvpn/server/vpnservpool.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(BitmapPool, AcquireRelease)
+  {
+    IP::BitmapPool pool(IP::Range(IP::Addr("10.0.0.2"), 70));
+    std::set<std::string> seen;
+    IP::Addr a;
+    for (int i = 0; i < 70; ++i)
+      {
+	ASSERT_TRUE(pool.acquire_addr(a));
+	seen.insert(a.to_string());
+      }
+    EXPECT_EQ(seen.size(), 70u);
+    EXPECT_EQ(*seen.begin(), "10.0.0.10");
+    EXPECT_TRUE(seen.find("10.0.0.2") != seen.end());
+    EXPECT_TRUE(seen.find("10.0.0.71") != seen.end());
+    EXPECT_FALSE(pool.acquire_addr(a));
+    EXPECT_EQ(pool.n_in_use(), 70u);
+    EXPECT_EQ(pool.n_free(), 0u);
+
+    EXPECT_TRUE(pool.release_addr(IP::Addr("10.0.0.40")));
+    EXPECT_TRUE(pool.release_addr(IP::Addr("10.0.0.40")));
+    EXPECT_EQ(pool.n_free(), 1u);
+    ASSERT_TRUE(pool.acquire_addr(a));
+    EXPECT_EQ(a.to_string(), "10.0.0.40");
+
+    EXPECT_FALSE(pool.release_addr(IP::Addr("10.0.0.72")));
+    EXPECT_FALSE(pool.release_addr(IP::Addr("10.0.0.1")));
+    EXPECT_FALSE(pool.release_addr(IP::Addr("fd00::2")));
+    EXPECT_EQ(pool.n_in_use(), 70u);
+  }
+
+  TEST(BitmapPool, Specific)
+  {
+    IP::BitmapPool pool(IP::Range(IP::Addr("fd00::2"), 100));
+    EXPECT_TRUE(pool.acquire_specific_addr(IP::Addr("fd00::2")));
+    EXPECT_FALSE(pool.acquire_specific_addr(IP::Addr("fd00::2")));
+    EXPECT_FALSE(pool.acquire_specific_addr(IP::Addr("fd00::1")));
+    EXPECT_FALSE(pool.acquire_specific_addr(IP::Addr("10.0.0.2")));
+    IP::Addr a;
+    ASSERT_TRUE(pool.acquire_addr(a));
+    EXPECT_EQ(a.to_string(), "fd00::3");
+    EXPECT_EQ(pool.to_string(), "fd00::2\nfd00::3\n");
+  }
+
+  TEST(BitmapPool, Threads)
+  {
+    const unsigned int n_threads = 8;
+    const size_t extent = 100000;
+    IP::BitmapPoolSet pool;
+    IP::RangePartition rp(IP::Range(IP::Addr("10.0.0.0"), extent), n_threads);
+    IP::Range r;
+    while (rp.next(r))
+      pool.add_shard(r);
+    ASSERT_EQ(pool.n_shards(), n_threads);
+
+    // threads acquire more than their shard, so they must steal
+    std::vector<std::vector<IP::Addr>> got(n_threads);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < n_threads; ++t)
+      threads.emplace_back([&, t]() {
+	  IP::Addr a;
+	  for (unsigned int i = 0; i < (t % 2 ? extent / n_threads / 2 : extent / n_threads * 3 / 2); ++i)
+	    {
+	      if (!pool.acquire_addr(a, t))
+		break;
+	      got[t].push_back(a);
+	      if (i % 3 == 0)
+		{
+		  pool.release_addr(a);
+		  got[t].pop_back();
+		}
+	    }
+	});
+    for (auto& th : threads)
+      th.join();
+
+    std::set<IP::Addr> all;
+    size_t total = 0;
+    for (auto& v : got)
+      {
+	total += v.size();
+	all.insert(v.begin(), v.end());
+      }
+    EXPECT_EQ(all.size(), total);
+    EXPECT_EQ(pool.n_in_use(), total);
+    EXPECT_EQ(pool.n_free(), extent - total);
+  }
+
+  TEST(BitmapPool, VPNServerPool)
+  {
+    OptionList opt;
+    opt.parse_from_config("server 10.8.0.1 255.255.255.0\nserver-ipv6 fd00::/112\n", nullptr);
+    opt.update_map();
+    VPNServerPool::Pool pool(opt, 4);
+
+    VPNServerPool::IP46 p0, p3;
+    EXPECT_EQ(pool.acquire(p0, true, 0), 0u);
+    EXPECT_EQ(pool.acquire(p3, true, 3), 0u);
+    EXPECT_EQ(p0.ip4.to_string(), pool.per_thread(0).range4().start().to_string());
+    EXPECT_EQ(p3.ip4.to_string(), pool.per_thread(3).range4().start().to_string());
+    EXPECT_EQ(p3.ip6.to_string(), pool.per_thread(3).range6().start().to_string());
+
+    // deplete the IPv4 pool
+    std::vector<VPNServerPool::IP46> v(251);
+    for (auto& p : v)
+      pool.acquire(p, false, 1);
+    VPNServerPool::IP46 p;
+    EXPECT_EQ(pool.acquire(p, true, 1), unsigned(VPNServerPool::Pool::IPv4_DEPLETION));
+    pool.release(p3);
+    EXPECT_EQ(pool.acquire(p, false, 1), 0u);
+    EXPECT_EQ(p.ip4, p3.ip4);
+  }
+}
@@ -0,0 +1,169 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/buffer/bufcomposed.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/frame/memq_stream.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(buffer, pool_reuse)
+  {
+    // run on a fresh thread so that the pool starts out empty
+    std::thread th([]() {
+	Frame::Ptr frame = frame_init_simple(2048);
+	const unsigned char *first;
+	{
+	  BufferAllocated buf;
+	  frame->prepare(Frame::READ_LINK_UDP, buf);
+	  first = buf.c_data_raw();
+	}
+	BufferPool<unsigned char>::Stats s = BufferPool<unsigned char>::stats();
+	EXPECT_EQ(0ULL, s.hits);
+	EXPECT_EQ(1ULL, s.misses);
+	EXPECT_EQ(1ULL, s.returns);
+
+	// the released block is handed out again
+	{
+	  BufferAllocated buf;
+	  frame->prepare(Frame::READ_TUN, buf);
+	  EXPECT_EQ(first, buf.c_data_raw());
+	}
+	s = BufferPool<unsigned char>::stats();
+	EXPECT_EQ(1ULL, s.hits);
+	EXPECT_EQ(2ULL, s.returns);
+
+	// buffers not allocated with POOL bypass the pool
+	{
+	  BufferAllocated buf(100, 0);
+	}
+	s = BufferPool<unsigned char>::stats();
+	EXPECT_EQ(1ULL, s.misses);
+	EXPECT_EQ(2ULL, s.returns);
+
+	// grown buffers leave the pool size class
+	{
+	  BufferAllocated buf;
+	  frame->prepare(Frame::READ_TUN, buf);
+	  buf.or_flags(BufferAllocated::GROW);
+	  buf.write_alloc(buf.remaining() + 1);
+	}
+	s = BufferPool<unsigned char>::stats();
+	EXPECT_EQ(2ULL, s.hits);
+	EXPECT_EQ(3ULL, s.returns);
+
+	BufferPool<unsigned char>::purge();
+      });
+    th.join();
+  }
+
+#ifdef OPENVPN_BUFFER_POOL_HUGE
+  TEST(buffer, pool_huge_pages)
+  {
+    std::thread th([]() {
+	Frame::Ptr frame = frame_init_simple(2048);
+	BufferPool<unsigned char>::set_huge_pages(true);
+	std::vector<unsigned char*> blocks;
+	{
+	  std::vector<BufferAllocated> bufs(100);
+	  for (auto& buf : bufs)
+	    {
+	      frame->prepare(Frame::READ_LINK_UDP, buf);
+	      blocks.push_back(buf.data_raw());
+	      EXPECT_EQ(0u, std::uintptr_t(buf.data_raw()) % 64);
+	      EXPECT_EQ(0u, std::uintptr_t(buf.data()) % sizeof(size_t));
+	    }
+	}
+	BufferPool<unsigned char>::set_huge_pages(false);
+	const BufferPool<unsigned char>::Stats s = BufferPool<unsigned char>::stats();
+	EXPECT_GE(s.huge, 1ULL);
+	EXPECT_LE(s.huge, s.misses);
+	EXPECT_GE(BufferPool<unsigned char>::huge_bytes(), size_t(HugePage::SIZE));
+
+	// blocks the pool has no room for, and those purged, are
+	// kept for reuse rather than freed
+	BufferPool<unsigned char>::purge();
+	BufferPool<unsigned char>::set_huge_pages(true);
+	{
+	  BufferAllocated buf;
+	  frame->prepare(Frame::READ_LINK_UDP, buf);
+	  EXPECT_NE(blocks.end(), std::find(blocks.begin(), blocks.end(), buf.data_raw()));
+	}
+	BufferPool<unsigned char>::set_huge_pages(false);
+	BufferPool<unsigned char>::purge();
+      });
+    th.join();
+  }
+#endif
+
+  TEST(buffer, composed)
+  {
+    BufferComposed bc;
+    BufferPtr first(new BufferAllocated((const unsigned char *)"PUSH_", 5, 0));
+    bc.put(first);
+    EXPECT_EQ(5u, bc.size());
+    EXPECT_FALSE(bc.null_seen());
+
+    // a single buffer is handed back without copying
+    BufferPtr ret = bc.get();
+    EXPECT_EQ(first.get(), ret.get());
+    EXPECT_EQ(0u, bc.size());
+
+    bc.put(first);
+    bc.put(BufferPtr(new BufferAllocated((const unsigned char *)"REPLY", 6, 0)));
+    EXPECT_EQ(11u, bc.size());
+    EXPECT_TRUE(bc.null_seen());
+    ret = bc.get();
+    EXPECT_EQ(std::string("PUSH_REPLY"), std::string((const char *)ret->c_data()));
+    EXPECT_FALSE(bc.null_seen());
+  }
+
+  TEST(buffer, memq_stream)
+  {
+    Frame::Ptr frame = frame_init_simple(512);
+    MemQStream mq(frame);
+    std::string in;
+    for (int i = 0; i < 4096; ++i)
+      in += (char)('a' + i % 26);
+
+    std::string out;
+    unsigned char tmp[300];
+    for (int round = 0; round < 3; ++round)
+      {
+	mq.write((const unsigned char *)in.c_str(), in.length());
+	EXPECT_EQ(in.length(), mq.pending());
+	size_t n;
+	while ((n = mq.read(tmp, sizeof(tmp))))
+	  out.append((const char *)tmp, n);
+	EXPECT_EQ(0u, mq.pending());
+      }
+    EXPECT_EQ(in + in + in, out);
+  }
+}
@@ -0,0 +1,115 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <set>
+#include <string>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/hexstr.hpp>
+#include <openvpn/random/bufrand.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+
+#if !defined(OPENVPN_PLATFORM_WIN)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // RFC 8439 section 2.3.2
+  TEST(bufrand, chacha20_block)
+  {
+    unsigned char key[32];
+    for (unsigned int i = 0; i < sizeof(key); ++i)
+      key[i] = static_cast<unsigned char>(i);
+    const unsigned char nonce[12] = { 0, 0, 0, 0x09, 0, 0, 0, 0x4a, 0, 0, 0, 0 };
+    unsigned char out[64];
+    BufferedRandom::chacha20_block(key, 1, nonce, out);
+    ASSERT_EQ("10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+	      "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e",
+	      render_hex(out, sizeof(out)));
+  }
+
+  TEST(bufrand, output)
+  {
+    RandomAPI::Ptr seed(new SSLLib::RandomAPI(false));
+    BufferedRandom::Ptr a(new BufferedRandom(seed));
+    BufferedRandom::Ptr b(new BufferedRandom(seed));
+    ASSERT_TRUE(a->is_crypto());
+
+    // no repeats within or across instances, also across refills
+    // and reseeds, and for reads of odd sizes
+    std::set<std::string> seen;
+    unsigned char buf[37];
+    for (unsigned int i = 0; i < BufferedRandom::RESEED_BYTES / sizeof(buf) + 100; ++i)
+      {
+	a->rand_bytes(buf, sizeof(buf));
+	ASSERT_TRUE(seen.insert(std::string((const char *)buf, sizeof(buf))).second);
+	b->rand_bytes(buf, sizeof(buf));
+	ASSERT_TRUE(seen.insert(std::string((const char *)buf, sizeof(buf))).second);
+      }
+
+    // reads larger than the pool
+    unsigned char big[BufferedRandom::POOL_SIZE * 3 + 5];
+    a->rand_bytes(big, sizeof(big));
+    size_t zeros = 0;
+    for (const unsigned char c : big)
+      zeros += (c == 0);
+    ASSERT_LT(zeros, sizeof(big) / 64);
+  }
+
+#if !defined(OPENVPN_PLATFORM_WIN)
+  // parent and child must not continue the same stream
+  TEST(bufrand, fork)
+  {
+    RandomAPI::Ptr seed(new SSLLib::RandomAPI(false));
+    BufferedRandom::Ptr r(new BufferedRandom(seed));
+    unsigned char first[16];
+    r->rand_bytes(first, sizeof(first));
+
+    int fds[2];
+    ASSERT_EQ(0, ::pipe(fds));
+    const pid_t pid = ::fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+      {
+	unsigned char out[16];
+	r->rand_bytes(out, sizeof(out));
+	const ssize_t len = ::write(fds[1], out, sizeof(out));
+	::_exit(len == sizeof(out) ? 0 : 1);
+      }
+    unsigned char parent[16];
+    unsigned char child[16];
+    r->rand_bytes(parent, sizeof(parent));
+    ASSERT_EQ(ssize_t(sizeof(child)), ::read(fds[0], child, sizeof(child)));
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ASSERT_NE(render_hex(parent, sizeof(parent)), render_hex(child, sizeof(child)));
+  }
+#endif
+}
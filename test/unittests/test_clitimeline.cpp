@@ -0,0 +1,70 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <thread>
+
+#include <openvpn/client/clitimeline.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(clitimeline, marks)
+  {
+    ConnectTimeline tl;
+    tl.mark("BEFORE_START"); // ignored
+    ASSERT_EQ(0u, tl.size());
+
+    tl.start();
+    tl.mark("PROFILE");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    tl.mark("CONNECTED");
+    ASSERT_EQ(2u, tl.size());
+    ASSERT_STREQ("PROFILE", tl[0].name);
+    ASSERT_LT(tl[0].ms, 20u);
+    ASSERT_GE(tl[1].ms, 20u);
+    ASSERT_GE(tl[1].ms, tl[0].ms);
+
+    tl.freeze();
+    tl.mark("RECONNECTING"); // ignored once frozen
+    ASSERT_EQ(2u, tl.size());
+    ASSERT_EQ("PROFILE=" + std::to_string(tl[0].ms) + "ms CONNECTED=" + std::to_string(tl[1].ms) + "ms",
+	      tl.to_string());
+
+    // a restart clears the timeline
+    tl.start();
+    ASSERT_FALSE(tl.frozen());
+    ASSERT_EQ(0u, tl.size());
+    ASSERT_EQ("", tl.to_string());
+  }
+
+  TEST(clitimeline, bounded)
+  {
+    ConnectTimeline tl;
+    tl.start();
+    for (int i = 0; i < ConnectTimeline::MAX_MILESTONES + 10; ++i)
+      tl.mark("WAIT");
+    ASSERT_EQ(size_t(ConnectTimeline::MAX_MILESTONES), tl.size());
+  }
+}
@@ -234,8 +234,152 @@ void runTest(comppair alg, bool verbose=false)
 		  << std::endl;
 }
 
+// Feed incompressible packets to an adaptive compressor, then
+// compressible ones, and check that it backs off and recovers while
+// every packet still round-trips.
+void runAdaptiveTest(Compress& comp, MySessionStats& stats, const Frame& frame)
+{
+  comp.set_adaptive(true);
+  std::uint32_t seed = 1;
+  auto round_trip = [&](const bool random) {
+    BufferAllocated data;
+    frame.prepare(Frame::DECRYPT_WORK, data);
+    for (size_t i = 0; i < 1000; ++i)
+      {
+	seed = seed * 1103515245 + 12345;
+	data.push_back(random ? (unsigned char)(seed >> 16) : (unsigned char)"abcd"[i % 4]);
+      }
+    BufferAllocated pkt(data);
+    comp.compress(pkt, true);
+    const size_t comp_size = pkt.size();
+    comp.decompress(pkt);
+    verify_eq(data, pkt);
+    return comp_size < data.size();
+  };
+
+  for (int i = 0; i < 2000; ++i)
+    ASSERT_FALSE(round_trip(true));
+  const count_t skipped = stats.get_stat(SessionStats::COMPRESS_SKIPPED);
+  ASSERT_GT(skipped, 1900u);
+  ASSERT_EQ(0u, stats.get_stat(SessionStats::COMPRESS_BYTES_SAVED));
+
+  // the next probe finds compressible data within one backoff period
+  int n_compressed = 0;
+  for (int i = 0; i < 1100; ++i)
+    n_compressed += round_trip(false);
+  ASSERT_GT(n_compressed, 0);
+  ASSERT_TRUE(round_trip(false));
+  ASSERT_GT(stats.get_stat(SessionStats::COMPRESS_BYTES_SAVED), 0u);
+  ASSERT_EQ(0u, stats.get_error_count(Error::COMPRESS_ERROR));
+}
+
+// IPv4 packet with the given protocol, ports and payload start
+BufferAllocated ip4_packet(const std::uint8_t protocol,
+			   const std::uint16_t sport,
+			   const std::uint16_t dport,
+			   const std::string& payload)
+{
+  BufferAllocated buf(256, 0);
+  IPv4Header ip = {};
+  ip.version_len = IPv4Header::ver_len(4, sizeof(IPv4Header));
+  ip.protocol = protocol;
+  buf.write((const unsigned char *)&ip, sizeof(ip));
+  if (protocol == IPCommon::TCP)
+    {
+      TCPHeader tcp = {};
+      tcp.source = htons(sport);
+      tcp.dest = htons(dport);
+      tcp.doff_res = (sizeof(TCPHeader) / 4) << 4;
+      buf.write((const unsigned char *)&tcp, sizeof(tcp));
+    }
+  else if (protocol == IPCommon::UDP)
+    {
+      UDPHeader udp = {};
+      udp.source = htons(sport);
+      udp.dest = htons(dport);
+      buf.write((const unsigned char *)&udp, sizeof(udp));
+    }
+  buf.write((const unsigned char *)payload.data(), payload.size());
+  return buf;
+}
+
 namespace unittests
 {
+    TEST(Compression, precheck)
+    {
+	const std::string http = "GET / HTTP/1.1\r\n";
+	const std::string tls("\x17\x03\x03\x01\x00", 5);
+
+	ASSERT_TRUE(CompressPrecheck::compressible(ip4_packet(IPCommon::TCP, 40000, 80, http), false));
+	ASSERT_TRUE(CompressPrecheck::compressible(ip4_packet(IPCommon::UDP, 40000, 53, http), false));
+	ASSERT_TRUE(CompressPrecheck::compressible(ip4_packet(IPCommon::ICMPv4, 0, 0, http), false));
+	ASSERT_FALSE(CompressPrecheck::compressible(ip4_packet(IPCommon::TCP, 40000, 443, http), false));
+	ASSERT_FALSE(CompressPrecheck::compressible(ip4_packet(IPCommon::TCP, 443, 40000, http), false));
+	ASSERT_FALSE(CompressPrecheck::compressible(ip4_packet(IPCommon::TCP, 40000, 8443, tls), false));
+	ASSERT_FALSE(CompressPrecheck::compressible(ip4_packet(IPCommon::UDP, 40000, 443, http), false));
+	ASSERT_FALSE(CompressPrecheck::compressible(ip4_packet(CompressPrecheck::ESP, 0, 0, http), false));
+
+	// layer 2 frames carry an Ethernet header first
+	const BufferAllocated pkt = ip4_packet(IPCommon::TCP, 40000, 443, http);
+	EthHeader eth = {};
+	eth.ethertype = htons(0x0800);
+	BufferAllocated frame(256, 0);
+	frame.write((const unsigned char *)&eth, sizeof(eth));
+	frame.write(pkt.c_data(), pkt.size());
+	ASSERT_FALSE(CompressPrecheck::compressible(frame, true));
+	ASSERT_TRUE(CompressPrecheck::compressible(frame, false));
+
+	// anything we can't parse may be compressible
+	BufferAllocated junk(16, 0);
+	junk.push_back(0xFF);
+	ASSERT_TRUE(CompressPrecheck::compressible(junk, false));
+	ASSERT_TRUE(CompressPrecheck::compressible(BufferAllocated(), false));
+    }
+
+    // A compressed packet lands in the caller's buffer with that
+    // buffer's headroom, an uncompressed one stays in place.
+    TEST(Compression, decompress_to)
+    {
+	MySessionStats::Ptr stats(new MySessionStats);
+	Frame::Ptr frame = frame_init(BLOCK_SIZE);
+	(*frame)[Frame::READ_TUN] = Frame::Context(64, BLOCK_SIZE, 64, 0, 16, 0);
+	CompressLZOAsym decomp(frame, stats, false, false);
+
+	// LZO1X stream of one literal run, then the end marker
+	const std::string text = "decompressed straight into the tun buffer";
+	auto compressed = [&text]() {
+	  BufferAllocated pkt(256, 0);
+	  pkt.push_back(CompressLZOAsym::LZO_COMPRESS);
+	  pkt.push_back((unsigned char)(17 + text.length()));
+	  pkt.write((const unsigned char *)text.data(), text.length());
+	  const unsigned char eos[] = { 0x11, 0, 0 };
+	  pkt.write(eos, sizeof(eos));
+	  return pkt;
+	};
+	BufferAllocated pkt = compressed();
+
+	BufferAllocated dest;
+	frame->prepare(Frame::READ_TUN, dest);
+	const size_t headroom = dest.offset();
+	ASSERT_TRUE(decomp.decompress_to(pkt, dest));
+	ASSERT_EQ(text, std::string((const char *)dest.c_data(), dest.size()));
+	ASSERT_EQ(headroom, dest.offset());
+
+	BufferAllocated plain(256, 0);
+	plain.push_back(0xFA); // NO_COMPRESS
+	plain.write((const unsigned char *)text.data(), text.length());
+	frame->prepare(Frame::READ_TUN, dest);
+	ASSERT_FALSE(decomp.decompress_to(plain, dest));
+	ASSERT_EQ(text, std::string((const char *)plain.c_data(), plain.size()));
+	ASSERT_EQ(0u, dest.size());
+
+	// decompress() still goes through the work buffer
+	pkt = compressed();
+	decomp.decompress(pkt);
+	ASSERT_EQ(text, std::string((const char *)pkt.c_data(), pkt.size()));
+	ASSERT_EQ(0u, stats->get_error_count(Error::COMPRESS_ERROR));
+    }
+
 #if defined(HAVE_SNAPPY)
     TEST(Compression, snappy)
     {
@@ -252,11 +396,76 @@ namespace unittests
     {
         runTest(comppair::lzoasym);
     }
+
+    TEST(Compression, lzo_adaptive)
+    {
+	CompressContext::init_static();
+	MySessionStats::Ptr stats(new MySessionStats);
+	Frame::Ptr frame = frame_init(BLOCK_SIZE);
+	CompressLZO comp(frame, stats, SUPPORT_SWAP, false);
+	runAdaptiveTest(comp, *stats, *frame);
+    }
 #endif
 #if defined(HAVE_LZ4)
     TEST(Compression, lz4)
     {
 	runTest(comppair::lz4);
     }
+
+    TEST(Compression, lz4_adaptive)
+    {
+	MySessionStats::Ptr stats(new MySessionStats);
+	Frame::Ptr frame = frame_init(BLOCK_SIZE);
+	CompressLZ4v2 comp(frame, stats, false);
+	runAdaptiveTest(comp, *stats, *frame);
+    }
+
+    // Small telemetry-like packets barely compress on their own, but
+    // do against a dictionary of similar records.
+    TEST(Compression, lz4_dict)
+    {
+	auto record = [](const int i) {
+	  return "{\"host\":\"sensor-" + std::to_string(i % 7) + "\",\"metric\":\"temperature\",\"unit\":\"celsius\",\"value\":"
+	    + std::to_string(20 + i % 13) + "}";
+	};
+	std::string dict_data;
+	for (int i = 0; i < 50; ++i)
+	  dict_data += record(i * 3);
+	const CompressDict::Ptr dict(new CompressDict((const unsigned char *)dict_data.data(), dict_data.size()));
+	base64_init_static();
+	ASSERT_EQ(dict->id(), CompressDict::parse(base64->encode(dict_data))->id());
+
+	MySessionStats::Ptr stats(new MySessionStats);
+	Frame::Ptr frame = frame_init(BLOCK_SIZE);
+	CompressLZ4v2 plain(frame, stats, false);
+	CompressLZ4Dict comp(frame, stats, dict, false);
+	CompressLZ4Dict decomp(frame, stats, dict, false);
+	size_t plain_bytes = 0;
+	size_t dict_bytes = 0;
+	for (int i = 0; i < 100; ++i)
+	  {
+	    const std::string r = record(i);
+	    BufferAllocated data;
+	    frame->prepare(Frame::DECRYPT_WORK, data);
+	    data.write((const unsigned char *)r.data(), r.size());
+
+	    BufferAllocated pkt(data);
+	    plain.compress(pkt, true);
+	    plain_bytes += pkt.size();
+
+	    pkt = data;
+	    comp.compress(pkt, true);
+	    dict_bytes += pkt.size();
+	    decomp.decompress(pkt);
+	    verify_eq(data, pkt);
+	  }
+	ASSERT_LT(dict_bytes * 2, plain_bytes);
+	ASSERT_EQ(0u, stats->get_error_count(Error::COMPRESS_ERROR));
+
+	CompressContext ctx(CompressContext::LZ4DICT, false);
+	ASSERT_THROW(ctx.new_compressor(frame, stats), CompressContext::compressor_unavailable);
+	ctx.set_dict(dict);
+	ASSERT_STREQ("lz4-dict", ctx.new_compressor(frame, stats)->name());
+    }
 #endif
 }
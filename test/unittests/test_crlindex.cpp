@@ -0,0 +1,426 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include <openvpn/openssl/pki/crlindex.hpp>
+#include <openvpn/openssl/ssl/trustreload.hpp>
+#include <openvpn/openssl/ssl/verifycache.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/common/file.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static ::EVP_PKEY* gen_key()
+  {
+    ::EVP_PKEY* key = nullptr;
+    ::EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY_keygen_init(pctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(pctx, &key);
+    EVP_PKEY_CTX_free(pctx);
+    return key;
+  }
+
+  static OpenSSLPKI::X509 make_cert(const char *cn, const long serial,
+				    ::EVP_PKEY* key, ::EVP_PKEY* signer, const char *issuer_cn,
+				    const bool ca = false)
+  {
+    ::X509* x = X509_new();
+    X509_set_version(x, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x), serial);
+    X509_gmtime_adj(X509_getm_notBefore(x), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(x), 86400);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(x), "CN", MBSTRING_ASC, (const unsigned char *)cn, -1, -1, 0);
+    X509_NAME_add_entry_by_txt(X509_get_issuer_name(x), "CN", MBSTRING_ASC, (const unsigned char *)issuer_cn, -1, -1, 0);
+    X509_set_pubkey(x, key);
+    if (key == signer || ca)
+      {
+	::X509_EXTENSION* ext = X509V3_EXT_conf_nid(nullptr, nullptr, NID_basic_constraints, (char *)"critical,CA:TRUE");
+	X509_add_ext(x, ext, -1);
+	X509_EXTENSION_free(ext);
+      }
+    X509_sign(x, signer, EVP_sha256());
+    return OpenSSLPKI::X509(x);
+  }
+
+  static OpenSSLPKI::CRL make_crl(const char *issuer_cn, ::EVP_PKEY* signer,
+				  const std::vector<long>& revoked, const long next_update)
+  {
+    ::X509_CRL* crl = X509_CRL_new();
+    X509_CRL_set_version(crl, 1);
+    X509_NAME* name = X509_NAME_new();
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)issuer_cn, -1, -1, 0);
+    X509_CRL_set_issuer_name(crl, name);
+    X509_NAME_free(name);
+    ASN1_TIME* t = X509_gmtime_adj(nullptr, -7200);
+    X509_CRL_set1_lastUpdate(crl, t);
+    X509_gmtime_adj(t, next_update);
+    X509_CRL_set1_nextUpdate(crl, t);
+    for (const long s : revoked)
+      {
+	::X509_REVOKED* r = X509_REVOKED_new();
+	ASN1_INTEGER* ai = ASN1_INTEGER_new();
+	ASN1_INTEGER_set(ai, s);
+	X509_REVOKED_set_serialNumber(r, ai);
+	X509_REVOKED_set_revocationDate(r, t);
+	ASN1_INTEGER_free(ai);
+	X509_CRL_add0_revoked(crl, r);
+      }
+    ASN1_TIME_free(t);
+    X509_CRL_sort(crl);
+    X509_CRL_sign(crl, signer, EVP_sha256());
+
+    BIO* bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509_CRL(bio, crl);
+    char *data;
+    const long len = BIO_get_mem_data(bio, &data);
+    const std::string pem(data, len);
+    BIO_free(bio);
+    X509_CRL_free(crl);
+    return OpenSSLPKI::CRL(pem);
+  }
+
+  static std::string key_pem(::EVP_PKEY* key)
+  {
+    BIO* bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_PrivateKey(bio, key, nullptr, nullptr, 0, nullptr, nullptr);
+    char *data;
+    const long len = BIO_get_mem_data(bio, &data);
+    const std::string pem(data, len);
+    BIO_free(bio);
+    return pem;
+  }
+
+  // run a client/server handshake to completion, returns false
+  // if it failed or stalled
+  static bool handshake(SSLAPI& client, SSLAPI& server)
+  {
+    client.start_handshake();
+    server.start_handshake();
+    unsigned char buf[64];
+    for (int i = 0; i < 32; ++i)
+      {
+	try {
+	  while (client.read_ciphertext_ready())
+	    server.write_ciphertext(client.read_ciphertext());
+	  server.read_cleartext(buf, sizeof(buf));
+	  while (server.read_ciphertext_ready())
+	    client.write_ciphertext(server.read_ciphertext());
+	  client.read_cleartext(buf, sizeof(buf));
+	}
+	catch (const std::exception&)
+	  {
+	    return false;
+	  }
+	if (!server.auth_cert()->is_uninitialized() && client.ssl_handshake_details() != "")
+	  return true;
+      }
+    return false;
+  }
+
+  class CRLIndexTest : public testing::Test
+  {
+  protected:
+    CRLIndexTest()
+      : ca_key(gen_key()),
+	other_key(gen_key()),
+	leaf_key(gen_key())
+    {
+      cas.push_back(make_cert("Test CA", 1, ca_key, ca_key, "Test CA"));
+    }
+
+    ~CRLIndexTest()
+    {
+      EVP_PKEY_free(ca_key);
+      EVP_PKEY_free(other_key);
+      EVP_PKEY_free(leaf_key);
+    }
+
+    OpenSSLPKI::X509 leaf(const long serial, const char *issuer_cn="Test CA")
+    {
+      return make_cert("leaf", serial, leaf_key, ca_key, issuer_cn);
+    }
+
+    ::EVP_PKEY* ca_key;
+    ::EVP_PKEY* other_key;
+    ::EVP_PKEY* leaf_key;
+    OpenSSLPKI::X509List cas;
+  };
+
+  TEST_F(CRLIndexTest, Revoked)
+  {
+    std::vector<long> revoked;
+    for (long s = 1000; s < 21000; s += 2)
+      revoked.push_back(s);
+    OpenSSLPKI::CRLList crls;
+    crls.push_back(make_crl("Test CA", ca_key, revoked, 86400));
+    OpenSSLPKI::CRLIndex index(crls, cas);
+
+    EXPECT_EQ(index.size(), revoked.size());
+    EXPECT_EQ(index.check(leaf(1000).obj()), X509_V_ERR_CERT_REVOKED);
+    EXPECT_EQ(index.check(leaf(20998).obj()), X509_V_ERR_CERT_REVOKED);
+    EXPECT_EQ(index.check(leaf(1001).obj()), X509_V_OK);
+    EXPECT_EQ(index.check(leaf(5).obj()), X509_V_OK);
+    EXPECT_EQ(index.check(cas[0].obj()), X509_V_OK);
+    EXPECT_EQ(index.check(leaf(1000, "Other CA").obj()), X509_V_ERR_UNABLE_TO_GET_CRL);
+  }
+
+  TEST_F(CRLIndexTest, Expired)
+  {
+    OpenSSLPKI::CRLList crls;
+    crls.push_back(make_crl("Test CA", ca_key, { 7 }, -3600));
+    OpenSSLPKI::CRLIndex index(crls, cas);
+    EXPECT_EQ(index.check(leaf(8).obj()), X509_V_ERR_CRL_HAS_EXPIRED);
+
+    // a current CRL from the same issuer takes precedence
+    crls.push_back(make_crl("Test CA", ca_key, { 7 }, 3600));
+    OpenSSLPKI::CRLIndex index2(crls, cas);
+    EXPECT_EQ(index2.check(leaf(8).obj()), X509_V_OK);
+    EXPECT_EQ(index2.check(leaf(7).obj()), X509_V_ERR_CERT_REVOKED);
+  }
+
+  TEST_F(CRLIndexTest, BadSignature)
+  {
+    OpenSSLPKI::CRLList crls;
+    crls.push_back(make_crl("Test CA", other_key, { 7 }, 3600));
+    EXPECT_THROW(OpenSSLPKI::CRLIndex(crls, cas), OpenSSLPKI::CRLIndex::crl_index_error);
+  }
+
+  TEST_F(CRLIndexTest, Reload)
+  {
+    OpenSSLContext::Config::Ptr config = new OpenSSLContext::Config();
+    config->set_mode(Mode(Mode::CLIENT));
+    config->set_flags(SSLConst::CRL_INDEX);
+    config->set_local_cert_enabled(false);
+    config->load_ca(cas.render_pem(), false);
+    config->set_frame(frame_init_simple(2048));
+    OpenSSLContext::Ptr ctx = config->new_factory().dynamic_pointer_cast<OpenSSLContext>();
+    ASSERT_TRUE(ctx);
+
+    const OpenSSLPKI::TrustStore::Ptr orig = ctx->get_trust();
+    ASSERT_TRUE(orig);
+    EXPECT_EQ(orig->check_revocation(leaf(7).obj()), X509_V_OK);
+
+    OpenSSLPKI::CRLList crls;
+    crls.push_back(make_crl("Test CA", ca_key, { 7 }, 3600));
+
+    openvpn_io::io_context io_context(1);
+    OpenSSLTrustReloader::Ptr reloader = new OpenSSLTrustReloader(io_context, ctx);
+    std::vector<std::string> errors;
+    auto done = [&errors](const std::string& error) {
+      errors.push_back(error);
+    };
+
+    ASSERT_TRUE(reloader->reload(cas.render_pem() + crls.render_pem(), done));
+    EXPECT_FALSE(reloader->reload(cas.render_pem(), done));
+    io_context.run();
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_EQ(errors[0], "");
+    const OpenSSLPKI::TrustStore::Ptr reloaded = ctx->get_trust();
+    EXPECT_NE(reloaded.get(), orig.get());
+    EXPECT_EQ(reloaded->check_revocation(leaf(7).obj()), X509_V_ERR_CERT_REVOKED);
+    EXPECT_EQ(orig->check_revocation(leaf(7).obj()), X509_V_OK);
+
+    // a CRL signed by the wrong key is rejected and the store kept
+    OpenSSLPKI::CRLList bad;
+    bad.push_back(make_crl("Test CA", other_key, { 8 }, 3600));
+    io_context.restart();
+    ASSERT_TRUE(reloader->reload(cas.render_pem() + bad.render_pem(), done));
+    io_context.run();
+    ASSERT_EQ(errors.size(), 2u);
+    EXPECT_NE(errors[1], "");
+    EXPECT_EQ(ctx->get_trust().get(), reloaded.get());
+  }
+
+  static int verify(const OpenSSLPKI::TrustStore& ts, const OpenSSLPKI::X509& cert)
+  {
+    ::X509_STORE_CTX* ctx = X509_STORE_CTX_new();
+    X509_STORE_CTX_init(ctx, ts.obj(), cert.obj(), nullptr);
+    const int ok = X509_verify_cert(ctx);
+    const int err = X509_STORE_CTX_get_error(ctx);
+    X509_STORE_CTX_free(ctx);
+    return ok == 1 ? X509_V_OK : err;
+  }
+
+  // A leaf sent without its intermediate is verified through the
+  // issuer index, which never makes an intermediate or a self-signed
+  // extra cert a trust anchor.
+  TEST_F(CRLIndexTest, IssuerIndex)
+  {
+    ::EVP_PKEY* inter_key = gen_key();
+    const OpenSSLPKI::X509 inter = make_cert("Test Intermediate", 2, inter_key, ca_key, "Test CA", true);
+    const OpenSSLPKI::X509 client = make_cert("client", 3, leaf_key, inter_key, "Test Intermediate");
+    const OpenSSLPKI::X509 other_ca = make_cert("Other CA", 4, other_key, other_key, "Other CA");
+    const OpenSSLPKI::X509 other_client = make_cert("other client", 5, leaf_key, other_key, "Other CA");
+    EVP_PKEY_free(inter_key);
+
+    OpenSSLPKI::X509Store::CertCRLList cc;
+    cc.certs = cas;
+    OpenSSLPKI::X509List extra;
+    extra.push_back(inter);
+    extra.push_back(other_ca);
+
+    const OpenSSLPKI::TrustStore cas_only(cc, false);
+    EXPECT_NE(verify(cas_only, client), X509_V_OK);
+
+    const OpenSSLPKI::TrustStore ts(cc, false, &extra);
+    EXPECT_EQ(ts.n_issuers(), 2u);
+    ASSERT_TRUE(ts.find_issuer(client.obj()));
+    EXPECT_EQ(X509_cmp(ts.find_issuer(client.obj()), inter.obj()), 0);
+    ASSERT_TRUE(ts.find_issuer(inter.obj()));
+    EXPECT_EQ(X509_cmp(ts.find_issuer(inter.obj()), cas[0].obj()), 0);
+    EXPECT_EQ(ts.find_issuer(other_client.obj()), nullptr);
+    EXPECT_EQ(verify(ts, client), X509_V_OK);
+    EXPECT_EQ(verify(ts, leaf(6)), X509_V_OK);
+    EXPECT_NE(verify(ts, other_client), X509_V_OK);
+
+    OpenSSLPKI::X509Store::CertCRLList none;
+    OpenSSLPKI::X509List inter_only;
+    inter_only.push_back(inter);
+    const OpenSSLPKI::TrustStore no_ca(none, false, &inter_only);
+    EXPECT_NE(verify(no_ca, client), X509_V_OK);
+  }
+
+  // SSL contexts given the same trust store share it
+  TEST_F(CRLIndexTest, SharedTrustStore)
+  {
+    auto config = [this]() {
+      OpenSSLContext::Config::Ptr c = new OpenSSLContext::Config();
+      c->set_mode(Mode(Mode::CLIENT));
+      c->set_local_cert_enabled(false);
+      c->load_ca(cas.render_pem(), false);
+      c->set_frame(frame_init_simple(2048));
+      return c;
+    };
+    const OpenSSLPKI::TrustStore::Ptr shared = config()->build_trust_store();
+    OpenSSLContext::Config::Ptr c1 = config();
+    OpenSSLContext::Config::Ptr c2 = config();
+    c1->set_trust_store(shared);
+    c2->set_trust_store(shared);
+    OpenSSLContext::Ptr ctx1 = c1->new_factory().dynamic_pointer_cast<OpenSSLContext>();
+    OpenSSLContext::Ptr ctx2 = c2->new_factory().dynamic_pointer_cast<OpenSSLContext>();
+    EXPECT_EQ(ctx1->get_trust().get(), shared.get());
+    EXPECT_EQ(ctx2->get_trust().get(), shared.get());
+
+    OpenSSLContext::Ptr own = config()->new_factory().dynamic_pointer_cast<OpenSSLContext>();
+    EXPECT_NE(own->get_trust().get(), shared.get());
+  }
+
+  TEST(VerifyCache, LookupInsert)
+  {
+    OpenSSLVerifyCache cache(2);
+    OpenSSLVerifyCache::Result res;
+    res.cn = "one";
+    res.sn = 1;
+    std::memset(res.issuer_fp, 0xAA, sizeof(res.issuer_fp));
+    cache.insert("fp1", 1, res);
+
+    OpenSSLVerifyCache::Result out;
+    ASSERT_TRUE(cache.lookup("fp1", 1, out));
+    EXPECT_EQ(out.cn, "one");
+    EXPECT_EQ(out.sn, 1);
+    EXPECT_EQ(out.issuer_fp[19], 0xAA);
+
+    // a newer trust store generation invalidates the entry
+    EXPECT_FALSE(cache.lookup("fp1", 2, out));
+    EXPECT_EQ(cache.size(), 0u);
+
+    // least recently used entry is evicted
+    cache.insert("fp1", 2, res);
+    cache.insert("fp2", 2, res);
+    ASSERT_TRUE(cache.lookup("fp1", 2, out));
+    cache.insert("fp3", 2, res);
+    EXPECT_TRUE(cache.lookup("fp1", 2, out));
+    EXPECT_FALSE(cache.lookup("fp2", 2, out));
+    EXPECT_TRUE(cache.lookup("fp3", 2, out));
+
+    const OpenSSLVerifyCache::Stats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 4u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.inserts, 4u);
+    EXPECT_EQ(stats.evictions, 1u);
+  }
+
+  TEST(VerifyCache, Expired)
+  {
+    OpenSSLVerifyCache cache(16, Time::Duration());
+    OpenSSLVerifyCache::Result res;
+    cache.insert("fp", 1, res);
+    EXPECT_FALSE(cache.lookup("fp", 1, res));
+  }
+
+  TEST_F(CRLIndexTest, VerifyCache)
+  {
+    OpenSSLContext::SSL::init_static();
+    const OpenSSLPKI::X509 server_cert = make_cert("server", 2, other_key, ca_key, "Test CA");
+    const OpenSSLPKI::X509 client_cert = leaf(3);
+    const Frame::Ptr frame = frame_init_simple(2048);
+    OpenSSLVerifyCache::Ptr cache = new OpenSSLVerifyCache();
+
+    OpenSSLContext::Config::Ptr sconf = new OpenSSLContext::Config();
+    sconf->set_mode(Mode(Mode::SERVER));
+    sconf->load_ca(cas.render_pem(), false);
+    sconf->load_cert(server_cert.render_pem());
+    sconf->load_private_key(key_pem(other_key));
+    sconf->load_dh(read_text(UNITTEST_SOURCE_DIR "../ssl/dh.pem"));
+    sconf->set_frame(frame);
+    sconf->set_verify_cache(cache);
+    OpenSSLContext::Ptr sctx = sconf->new_factory().dynamic_pointer_cast<OpenSSLContext>();
+
+    OpenSSLContext::Config::Ptr cconf = new OpenSSLContext::Config();
+    cconf->set_mode(Mode(Mode::CLIENT));
+    cconf->load_ca(cas.render_pem(), false);
+    cconf->load_cert(client_cert.render_pem());
+    cconf->load_private_key(key_pem(leaf_key));
+    cconf->set_frame(frame);
+    SSLFactoryAPI::Ptr cctx = cconf->new_factory();
+
+    for (int i = 0; i < 3; ++i)
+      {
+	SSLAPI::Ptr server = sctx->ssl();
+	SSLAPI::Ptr client = cctx->ssl();
+	ASSERT_TRUE(handshake(*client, *server));
+	EXPECT_FALSE(server->auth_cert()->is_fail());
+	EXPECT_EQ(server->auth_cert()->get_cn(), "leaf");
+	EXPECT_EQ(server->auth_cert()->get_sn(), 3);
+      }
+    EXPECT_EQ(cache->stats().inserts, 1u);
+    EXPECT_EQ(cache->stats().hits, 2u);
+
+    // a reloaded trust store doesn't trust the cached result
+    sctx->update_trust(OpenSSLContext::CertCRLList(cas.render_pem(), "ca"));
+    {
+      SSLAPI::Ptr server = sctx->ssl();
+      SSLAPI::Ptr client = cctx->ssl();
+      ASSERT_TRUE(handshake(*client, *server));
+    }
+    EXPECT_EQ(cache->stats().hits, 2u);
+    EXPECT_EQ(cache->stats().inserts, 2u);
+  }
+}
@@ -0,0 +1,720 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/common/hexstr.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/crypto/crypto_aead.hpp>
+#include <openvpn/crypto/crypto_chm.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#ifdef USE_OPENSSL
+#include <openvpn/openssl/crypto/provider.hpp>
+#endif
+
+using namespace openvpn;
+
+namespace unittests
+{
+  typedef AEAD::Crypto<SSLLib::CryptoAPI> AEADCrypto;
+
+  static StaticKey test_key(const size_t size, const unsigned char seed)
+  {
+    unsigned char data[64];
+    for (size_t i = 0; i < sizeof(data); ++i)
+      data[i] = static_cast<unsigned char>(seed + i);
+    return StaticKey(data, size);
+  }
+
+  static CryptoDCInstance::Ptr new_aead(const CryptoAlgs::Type cipher,
+					const Frame::Ptr& frame,
+					const bool encrypt_side,
+					const unsigned char seed = 0,
+					const DCPipeline::Ptr& pipeline = DCPipeline::Ptr(),
+					const int pid_form = PacketID::SHORT_FORM)
+  {
+    CryptoDCInstance::Ptr dc(new AEADCrypto(cipher, frame, SessionStats::Ptr(new SessionStats()), pipeline));
+    StaticKey k1 = test_key(32, 1 + seed);
+    StaticKey k2 = test_key(32, 101 + seed);
+    StaticKey h1 = test_key(8, 11);
+    StaticKey h2 = test_key(8, 111);
+    if (encrypt_side)
+      {
+	dc->init_cipher(std::move(k1), std::move(k2));
+	dc->init_hmac(std::move(h1), std::move(h2));
+      }
+    else
+      {
+	dc->init_cipher(std::move(k2), std::move(k1));
+	dc->init_hmac(std::move(h2), std::move(h1));
+      }
+    dc->init_pid(pid_form,
+		 PacketIDReceive::UDP_MODE,
+		 pid_form,
+		 "DATA", 0,
+		 SessionStats::Ptr(new SessionStats()));
+    return dc;
+  }
+
+  static BufferAllocated make_packet(const Frame::Ptr& frame, const size_t size, const unsigned char fill)
+  {
+    BufferAllocated buf;
+    frame->prepare(Frame::READ_TUN, buf);
+    for (size_t i = 0; i < size; ++i)
+      buf.push_back(static_cast<unsigned char>(fill + i));
+    return buf;
+  }
+
+  static void aead_roundtrip(const CryptoAlgs::Type cipher)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    CryptoDCInstance::Ptr enc = new_aead(cipher, frame, true);
+    CryptoDCInstance::Ptr dec = new_aead(cipher, frame, false);
+
+    for (size_t size = 1; size < 1500; size += 97)
+      {
+	BufferAllocated orig = make_packet(frame, size, static_cast<unsigned char>(size));
+	BufferAllocated buf = orig;
+	enc->encrypt(buf, 0, nullptr);
+	ASSERT_GT(buf.size(), orig.size());
+	ASSERT_EQ(Error::SUCCESS, dec->decrypt(buf, 0, nullptr));
+	ASSERT_EQ(orig, buf);
+      }
+
+    // replayed packets must be rejected
+    BufferAllocated buf = make_packet(frame, 100, 0);
+    enc->encrypt(buf, 0, nullptr);
+    BufferAllocated replay = buf;
+    ASSERT_EQ(Error::SUCCESS, dec->decrypt(buf, 0, nullptr));
+    ASSERT_EQ(Error::REPLAY_ERROR, dec->decrypt(replay, 0, nullptr));
+
+    // tampered packets must be rejected
+    buf = make_packet(frame, 100, 0);
+    enc->encrypt(buf, 0, nullptr);
+    buf[buf.size() - 1] ^= 1;
+    ASSERT_EQ(Error::DECRYPT_ERROR, dec->decrypt(buf, 0, nullptr));
+  }
+
+  TEST(crypto, aead_aes_256_gcm)
+  {
+    aead_roundtrip(CryptoAlgs::AES_256_GCM);
+  }
+
+  TEST(crypto, aead_chacha20_poly1305)
+  {
+    aead_roundtrip(CryptoAlgs::CHACHA20_POLY1305);
+  }
+
+  // 64-bit packet IDs carry on past 2^32 without asking for a
+  // renegotiation, and the peer must use the same form
+  TEST(crypto, aead_wide_pid)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    CryptoDCInstance::Ptr enc = new_aead(CryptoAlgs::AES_256_GCM, frame, true, 0, DCPipeline::Ptr(), PacketID::WIDE_FORM);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_256_GCM, frame, false, 0, DCPipeline::Ptr(), PacketID::WIDE_FORM);
+    CryptoDCInstance::Ptr short_enc = new_aead(CryptoAlgs::AES_256_GCM, frame, true);
+
+    const BufferAllocated orig = make_packet(frame, 200, 9);
+    BufferAllocated buf = orig;
+    BufferAllocated short_buf = orig;
+    EXPECT_FALSE(enc->encrypt(buf, 0, nullptr));
+    short_enc->encrypt(short_buf, 0, nullptr);
+    EXPECT_EQ(short_buf.size() + 4, buf.size());
+    ASSERT_EQ(Error::SUCCESS, dec->decrypt(buf, 0, nullptr));
+    ASSERT_EQ(orig, buf);
+
+    PacketID send, recv;
+    ASSERT_TRUE(enc->export_pid(send, recv));
+    send.id = 0xFFFFFFF0;
+    ASSERT_TRUE(enc->import_pid(send, recv));
+    for (int i = 0; i < 32; ++i)
+      {
+	buf = orig;
+	EXPECT_FALSE(enc->encrypt(buf, 0, nullptr));
+	ASSERT_EQ(Error::SUCCESS, dec->decrypt(buf, 0, nullptr));
+	ASSERT_EQ(orig, buf);
+      }
+    ASSERT_TRUE(enc->export_pid(send, recv));
+    EXPECT_EQ(0x100000010u, send.id);
+    ASSERT_TRUE(dec->export_pid(send, recv));
+    EXPECT_EQ(0x100000010u, recv.id);
+
+    // replayed and short-form packets are rejected
+    buf = orig;
+    enc->encrypt(buf, 0, nullptr);
+    BufferAllocated replay = buf;
+    ASSERT_EQ(Error::SUCCESS, dec->decrypt(buf, 0, nullptr));
+    ASSERT_EQ(Error::REPLAY_ERROR, dec->decrypt(replay, 0, nullptr));
+    short_buf = orig;
+    short_enc->encrypt(short_buf, 0, nullptr);
+    EXPECT_EQ(Error::DECRYPT_ERROR, dec->decrypt(short_buf, 0, nullptr));
+
+    // the batch path numbers packets the same way
+    BufferAllocated bufs[4];
+    for (auto& b : bufs)
+      b = orig;
+    EXPECT_FALSE(enc->encrypt_batch(bufs, 4, 0, nullptr));
+    Error::Type errs[4];
+    dec->decrypt_batch(bufs, errs, 4, 0, nullptr);
+    for (size_t i = 0; i < 4; ++i)
+      {
+	ASSERT_EQ(Error::SUCCESS, errs[i]);
+	ASSERT_EQ(orig, bufs[i]);
+      }
+  }
+
+  // the statically bound fast path must match the virtual one, and
+  // must not be offered by subclasses that may override it
+  TEST(crypto, aead_fast_path)
+  {
+    struct Derived : public AEADCrypto
+    {
+      Derived(const Frame::Ptr& frame)
+	: AEADCrypto(CryptoAlgs::AES_128_GCM, frame, SessionStats::Ptr(new SessionStats()))
+      {
+      }
+    };
+
+    const unsigned char op32[] = { 0x48, 0x00, 0x00, 0x01 };
+    Frame::Ptr frame = frame_init_simple(2048);
+    CryptoDCInstance::Ptr enc = new_aead(CryptoAlgs::AES_256_GCM, frame, true);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_256_GCM, frame, false);
+    const CryptoDCInstance::FastPath efp = enc->fast_path();
+    const CryptoDCInstance::FastPath dfp = dec->fast_path();
+    ASSERT_TRUE(efp.defined());
+    ASSERT_TRUE(dfp.defined());
+    EXPECT_FALSE(Derived(frame).fast_path().defined());
+
+    for (size_t i = 0; i < 8; ++i)
+      {
+	BufferAllocated orig = make_packet(frame, 100 + i * 50, static_cast<unsigned char>(i));
+	BufferAllocated buf = orig;
+	if (i & 1)
+	  efp.encrypt(*enc, buf, 0, op32);
+	else
+	  enc->encrypt(buf, 0, op32);
+	BufferAllocated copy = buf;
+	ASSERT_EQ(Error::SUCCESS, (i & 2) ? dfp.decrypt(*dec, buf, 0, op32) : dec->decrypt(buf, 0, op32));
+	ASSERT_EQ(orig, buf);
+	ASSERT_EQ(Error::REPLAY_ERROR, dfp.decrypt(*dec, copy, 0, op32));
+      }
+  }
+
+  TEST(crypto, aead_batch)
+  {
+    const unsigned char op32[] = { 0x48, 0x00, 0x00, 0x01 };
+    Frame::Ptr frame = frame_init_simple(2048);
+    CryptoDCInstance::Ptr enc = new_aead(CryptoAlgs::AES_128_GCM, frame, true);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_128_GCM, frame, false);
+
+    const size_t n = 16;
+    std::vector<BufferAllocated> orig;
+    std::vector<BufferAllocated> bufs;
+    for (size_t i = 0; i < n; ++i)
+      {
+	orig.push_back(make_packet(frame, 100 + i * 10, static_cast<unsigned char>(i)));
+	bufs.push_back(orig.back());
+      }
+
+    enc->encrypt_batch(bufs.data(), n, 0, op32);
+
+    // batch-encrypted packets can be decrypted individually ...
+    BufferAllocated first = bufs[0];
+    ASSERT_EQ(Error::SUCCESS, dec->decrypt(first, 0, op32));
+    ASSERT_EQ(orig[0], first);
+
+    // ... or as a batch
+    std::vector<Error::Type> errs(n);
+    dec->decrypt_batch(bufs.data() + 1, errs.data(), n - 1, 0, op32);
+    for (size_t i = 1; i < n; ++i)
+      {
+	ASSERT_EQ(Error::SUCCESS, errs[i - 1]);
+	ASSERT_EQ(orig[i], bufs[i]);
+      }
+  }
+
+  // Batches spread over a DCPipeline must give the same result as
+  // serial processing, including replay and integrity checks.
+  TEST(crypto, aead_pipeline)
+  {
+    const unsigned char op32[] = { 0x48, 0x00, 0x00, 0x01 };
+    Frame::Ptr frame = frame_init_simple(2048);
+    DCPipeline::Ptr pipeline(new DCPipeline(3));
+    CryptoDCInstance::Ptr enc = new_aead(CryptoAlgs::AES_256_GCM, frame, true, 0, pipeline);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_256_GCM, frame, false, 0, pipeline);
+    CryptoDCInstance::Ptr ref = new_aead(CryptoAlgs::AES_256_GCM, frame, false);
+
+    const size_t n = 150;
+    std::vector<BufferAllocated> orig;
+    std::vector<BufferAllocated> bufs;
+    for (size_t i = 0; i < n; ++i)
+      {
+	orig.push_back(make_packet(frame, 200 + (i * 37) % 1200, static_cast<unsigned char>(i)));
+	bufs.push_back(orig.back());
+      }
+    enc->encrypt_batch(bufs.data(), n, 0, op32);
+
+    // pipelined encryption matches what the serial path decrypts
+    for (size_t i = 0; i < n; i += 2)
+      {
+	BufferAllocated buf = bufs[i];
+	ASSERT_EQ(Error::SUCCESS, ref->decrypt(buf, 0, op32));
+	ASSERT_EQ(orig[i], buf);
+      }
+
+    // replay, tampered and truncated packets in a pipelined batch
+    bufs.push_back(bufs[10]);
+    bufs[20][bufs[20].size() - 1] ^= 1;
+    bufs[30].set_size(3);
+    std::vector<Error::Type> errs(bufs.size());
+    dec->decrypt_batch(bufs.data(), errs.data(), bufs.size(), 0, op32);
+    for (size_t i = 0; i < n; ++i)
+      {
+	if (i == 20)
+	  ASSERT_EQ(Error::DECRYPT_ERROR, errs[i]);
+	else if (i == 30)
+	  ASSERT_NE(Error::SUCCESS, errs[i]);
+	else
+	  {
+	    ASSERT_EQ(Error::SUCCESS, errs[i]) << i;
+	    ASSERT_EQ(orig[i], bufs[i]);
+	  }
+      }
+    ASSERT_EQ(Error::REPLAY_ERROR, errs[n]);
+  }
+
+  // Cipher contexts released by a key are recycled for the next key,
+  // which must then behave exactly like a freshly created context.
+  TEST(crypto, rekey_recycle)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    for (const CryptoAlgs::Type cipher : { CryptoAlgs::AES_256_GCM, CryptoAlgs::CHACHA20_POLY1305 })
+      {
+	for (unsigned char seed = 0; seed < 40; seed += 10)
+	  {
+	    CryptoDCInstance::Ptr enc = new_aead(cipher, frame, true, seed);
+	    CryptoDCInstance::Ptr dec = new_aead(cipher, frame, false, seed);
+	    CryptoDCInstance::Ptr stale = new_aead(cipher, frame, false, seed + 1);
+
+	    BufferAllocated orig = make_packet(frame, 500, seed);
+	    BufferAllocated buf = orig;
+	    enc->encrypt(buf, 0, nullptr);
+	    BufferAllocated copy = buf;
+	    ASSERT_EQ(Error::SUCCESS, dec->decrypt(buf, 0, nullptr));
+	    ASSERT_EQ(orig, buf);
+	    ASSERT_EQ(Error::DECRYPT_ERROR, stale->decrypt(copy, 0, nullptr));
+	  }
+      }
+
+    // CBC contexts, rekeyed in place by a second init_cipher()
+    RandomAPI::Ptr prng(new SSLLib::RandomAPI(false));
+    SessionStats::Ptr stats(new SessionStats());
+    typedef CryptoCHM<SSLLib::CryptoAPI> CHM;
+    CHM enc(CryptoAlgs::AES_128_CBC, CryptoAlgs::SHA1, frame, stats, prng);
+    CHM dec(CryptoAlgs::AES_128_CBC, CryptoAlgs::SHA1, frame, stats, prng);
+    enc.init_hmac(test_key(32, 11), test_key(32, 111));
+    dec.init_hmac(test_key(32, 111), test_key(32, 11));
+    enc.init_pid(PacketID::SHORT_FORM, PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+		 "DATA", 0, stats);
+    dec.init_pid(PacketID::SHORT_FORM, PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+		 "DATA", 0, stats);
+    for (unsigned char seed = 0; seed < 40; seed += 10)
+      {
+	enc.init_cipher(test_key(16, 1 + seed), test_key(16, 101 + seed));
+	dec.init_cipher(test_key(16, 101 + seed), test_key(16, 1 + seed));
+	BufferAllocated orig = make_packet(frame, 500, seed);
+	BufferAllocated buf = orig;
+	enc.encrypt(buf, 0, nullptr);
+	ASSERT_EQ(Error::SUCCESS, dec.decrypt(buf, 0, nullptr));
+	ASSERT_EQ(orig, buf);
+      }
+  }
+
+  // CipherContextGCM::encrypt_batch() must give the same result
+  // as encrypting each packet on its own, whatever path it takes.
+  TEST(crypto, gcm_encrypt_batch)
+  {
+    typedef SSLLib::CryptoAPI::CipherContextGCM GCM;
+    const StaticKey key = test_key(32, 3);
+    GCM batch;
+    GCM serial;
+    batch.init(CryptoAlgs::AES_256_GCM, key.data(), 32, GCM::ENCRYPT);
+    serial.init(CryptoAlgs::AES_256_GCM, key.data(), 32, GCM::ENCRYPT);
+
+    const size_t n = 5;
+    std::vector<std::vector<unsigned char>> in(n), out(n), tag(n), iv(n), ad(n);
+    GCM::Op ops[n];
+    for (size_t i = 0; i < n; ++i)
+      {
+	for (size_t j = 0; j < 100 + i * 300; ++j)
+	  in[i].push_back(static_cast<unsigned char>(i + j));
+	out[i].resize(in[i].size());
+	tag[i].resize(GCM::AUTH_TAG_LEN);
+	iv[i].assign(GCM::IV_LEN, static_cast<unsigned char>(i));
+	ad[i].assign(i & 1 ? 8 : 4, static_cast<unsigned char>(i * 7));
+	ops[i] = { in[i].data(), out[i].data(), in[i].size(), iv[i].data(), tag[i].data(), ad[i].data(), ad[i].size() };
+      }
+    batch.encrypt_batch(ops, n);
+
+    for (size_t i = 0; i < n; ++i)
+      {
+	std::vector<unsigned char> ref(in[i].size());
+	unsigned char ref_tag[GCM::AUTH_TAG_LEN];
+	serial.encrypt(in[i].data(), ref.data(), in[i].size(), iv[i].data(), ref_tag, ad[i].data(), ad[i].size());
+	ASSERT_EQ(ref, out[i]);
+	ASSERT_EQ(0, std::memcmp(ref_tag, tag[i].data(), GCM::AUTH_TAG_LEN));
+      }
+  }
+
+  class CopyCountStats : public SessionStats
+  {
+  public:
+    typedef RCPtr<CopyCountStats> Ptr;
+
+    void error(const size_t type, const std::string* text=nullptr) override
+    {
+      if (type == Error::N_ENCRYPT_COPY)
+	++n_copy;
+    }
+
+    unsigned int n_copy = 0;
+  };
+
+  static void in_place_encrypt(CryptoDCInstance& enc, CryptoDCInstance& dec,
+			       const Frame::Ptr& frame, const CopyCountStats& stats)
+  {
+    // buffers prepared by the frame are encrypted in-place
+    BufferAllocated orig = make_packet(frame, 1000, 7);
+    BufferAllocated buf = orig;
+    const unsigned char *raw = buf.c_data_raw();
+    enc.encrypt(buf, 0, nullptr);
+    ASSERT_EQ(raw, buf.c_data_raw());
+    ASSERT_EQ(0U, stats.n_copy);
+    ASSERT_EQ(Error::SUCCESS, dec.decrypt(buf, 0, nullptr));
+    ASSERT_EQ(orig, buf);
+
+    // buffers with insufficient headroom take the counted slow path
+    buf.init(orig.size() + 8, 0);
+    buf.init_headroom(8);
+    buf.write(orig.c_data(), orig.size());
+    enc.encrypt(buf, 0, nullptr);
+    ASSERT_EQ(1U, stats.n_copy);
+    ASSERT_EQ(Error::SUCCESS, dec.decrypt(buf, 0, nullptr));
+    ASSERT_EQ(orig, buf);
+  }
+
+  TEST(crypto, aead_in_place)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    CopyCountStats::Ptr stats(new CopyCountStats());
+    AEADCrypto enc(CryptoAlgs::AES_256_GCM, frame, stats);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_256_GCM, frame, false);
+    enc.init_cipher(test_key(32, 1), test_key(32, 101));
+    enc.init_hmac(test_key(8, 11), test_key(8, 111));
+    enc.init_pid(PacketID::SHORT_FORM, PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+		 "DATA", 0, stats);
+    in_place_encrypt(enc, *dec, frame, *stats);
+  }
+
+  // With a payload alignment, the ciphertext and tag stay aligned
+  // through encryption, a link read using the ProtoContext alignment
+  // hint and decryption, even after a compression header byte.
+  TEST(crypto, aead_payload_align)
+  {
+    const unsigned char op32[] = { 0x48, 0x00, 0x00, 0x01 };
+    const size_t align = 64;
+    Frame::Ptr frame = frame_init(true, 1500, 1024, false, align);
+    CryptoDCInstance::Ptr enc = new_aead(CryptoAlgs::AES_256_GCM, frame, true);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_256_GCM, frame, false);
+    Frame::Context link = (*frame)[Frame::READ_LINK_UDP];
+    link.reset_align_adjust(sizeof(op32) + 4 + 16);
+
+    for (size_t size = 1; size < 1500; size += 131)
+      {
+	BufferAllocated orig = make_packet(frame, size, static_cast<unsigned char>(size));
+	orig.push_front(0xFA);
+	BufferAllocated buf = orig;
+	enc->encrypt(buf, 0, op32);
+	EXPECT_EQ(0u, std::uintptr_t(buf.c_data() + 4 + 16) % align);
+	EXPECT_EQ(0u, std::uintptr_t(buf.c_data() + 4) % 16);
+	buf.prepend(op32, sizeof(op32));
+
+	BufferAllocated recv;
+	link.prepare(recv);
+	recv.write(buf.c_data(), buf.size());
+	EXPECT_EQ(0u, std::uintptr_t(recv.c_data() + sizeof(op32) + 4 + 16) % align);
+	recv.advance(sizeof(op32));
+	ASSERT_EQ(Error::SUCCESS, dec->decrypt(recv, 0, op32));
+	EXPECT_EQ(0u, std::uintptr_t(recv.c_data()) % align);
+	ASSERT_EQ(orig, recv);
+      }
+  }
+
+  TEST(crypto, payload_align_limits)
+  {
+    EXPECT_THROW(frame_init(true, 1500, 1024, false, 8), Frame::frame_payload_align);
+    EXPECT_THROW(frame_init(true, 1500, 1024, false, 48), Frame::frame_payload_align);
+    EXPECT_THROW(frame_init(true, 1500, 1024, false, 128), Frame::frame_payload_align);
+    Frame::Ptr frame = frame_init_simple(2048);
+    EXPECT_THROW(frame->set_payload_align(32), Frame::frame_payload_align);
+    EXPECT_EQ(0u, frame->payload_align());
+    EXPECT_EQ(32u, frame_init(true, 1500, 1024, false, 32)->payload_align());
+  }
+
+  TEST(crypto, cbc_hmac_in_place)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    CopyCountStats::Ptr stats(new CopyCountStats());
+    RandomAPI::Ptr prng(new SSLLib::RandomAPI(false));
+    typedef CryptoCHM<SSLLib::CryptoAPI> CHM;
+    CHM enc(CryptoAlgs::AES_256_CBC, CryptoAlgs::SHA256, frame, stats, prng);
+    CHM dec(CryptoAlgs::AES_256_CBC, CryptoAlgs::SHA256, frame, stats, prng);
+    enc.init_cipher(test_key(32, 1), test_key(32, 101));
+    enc.init_hmac(test_key(32, 11), test_key(32, 111));
+    dec.init_cipher(test_key(32, 101), test_key(32, 1));
+    dec.init_hmac(test_key(32, 111), test_key(32, 11));
+    enc.init_pid(PacketID::SHORT_FORM, PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+		 "DATA", 0, stats);
+    dec.init_pid(PacketID::SHORT_FORM, PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+		 "DATA", 0, stats);
+    in_place_encrypt(enc, dec, frame, *stats);
+  }
+
+  // RFC 2202 / RFC 4231 test case 2
+  TEST(crypto, hmac_vectors)
+  {
+    static const struct {
+      CryptoAlgs::Type digest;
+      const char *hmac;
+    } vectors[] = {
+      { CryptoAlgs::MD5, "750c783e6ab0b503eaa86e310a5db738" },
+      { CryptoAlgs::SHA1, "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+      { CryptoAlgs::SHA224, "a30e01098bc6dbbf45690f3a7e9e6d0f8bbea2a39e6148008fd05e44" },
+      { CryptoAlgs::SHA256, "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+      { CryptoAlgs::SHA384, "af45d2e376484031617f78d2b58a6b1b9c7ef464f5a01b47e42ec3736322445e8e2240ca5e69e2c78b3239ecfab21649" },
+      { CryptoAlgs::SHA512, "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea2505549758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737" },
+    };
+    const std::string key = "Jefe";
+    const std::string data = "what do ya want for nothing?";
+
+    for (const auto& v : vectors)
+      {
+	SSLLib::CryptoAPI::HMACContext ctx(v.digest, (const unsigned char *)key.c_str(), key.length());
+	unsigned char out[SSLLib::CryptoAPI::HMACContext::MAX_HMAC_SIZE];
+
+	// the context must be reusable after reset(), also with split updates
+	for (size_t split = 0; split < data.length(); split += 9)
+	  {
+	    ctx.reset();
+	    ctx.update((const unsigned char *)data.c_str(), split);
+	    ctx.update((const unsigned char *)data.c_str() + split, data.length() - split);
+	    const size_t len = ctx.final(out);
+	    ASSERT_EQ(CryptoAlgs::size(v.digest), len);
+	    ASSERT_EQ(CryptoAlgs::size(v.digest), ctx.size());
+	    ASSERT_EQ(std::string(v.hmac), render_hex(out, len)) << CryptoAlgs::name(v.digest);
+	  }
+      }
+  }
+
+#ifdef USE_OPENSSL
+  TEST(crypto, openssl_fetch_cache)
+  {
+    // fetched once, then the same object for every context
+    const EVP_CIPHER* gcm = OpenSSLCrypto::Fetch::cipher(CryptoAlgs::AES_256_GCM, EVP_aes_256_gcm());
+    ASSERT_NE(gcm, nullptr);
+    EXPECT_EQ(gcm, OpenSSLCrypto::Fetch::cipher(CryptoAlgs::AES_256_GCM, EVP_aes_256_gcm()));
+    const EVP_MD* sha = OpenSSLCrypto::Fetch::digest(CryptoAlgs::SHA256, EVP_sha256());
+    ASSERT_NE(sha, nullptr);
+    EXPECT_EQ(sha, OpenSSLCrypto::Fetch::digest(CryptoAlgs::SHA256, EVP_sha256()));
+    EXPECT_EQ(EVP_MD_size(sha), 32);
+
+    SSLLib::CryptoAPI::DigestContext ctx(CryptoAlgs::SHA256);
+    unsigned char out[SSLLib::CryptoAPI::DigestContext::MAX_DIGEST_SIZE];
+    ctx.update((const unsigned char *)"abc", 3);
+    ASSERT_EQ(ctx.final(out), 32u);
+    EXPECT_EQ(render_hex(out, 32), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  }
+
+  TEST(crypto, openssl_offload)
+  {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EXPECT_THROW(OpenSSLCrypto::Provider("no-such-provider", ""), OpenSSLCrypto::openssl_provider_error);
+
+    // offload packets of 256 bytes or more to the default provider, the
+    // peer must not be able to tell which implementation was used
+    Frame::Ptr frame = frame_init_simple(2048);
+    SessionStats::Ptr stats(new SessionStats());
+    RandomAPI::Ptr prng(new SSLLib::RandomAPI(false));
+    OpenSSLCrypto::Provider::Ptr provider(new OpenSSLCrypto::Provider("", "provider=default"));
+    ASSERT_NE(provider->cipher(CryptoAlgs::AES_256_GCM), nullptr);
+    OpenSSLCrypto::OffloadDCFactory factory(frame, stats, prng, provider, 256);
+    CryptoDCInstance::Ptr enc = factory.new_obj(CryptoAlgs::AES_256_GCM, CryptoAlgs::NONE)->new_obj(0);
+    enc->init_cipher(test_key(32, 1), test_key(32, 101));
+    enc->init_hmac(test_key(8, 11), test_key(8, 111));
+    enc->init_pid(PacketID::SHORT_FORM, PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+		  "DATA", 0, stats);
+    CryptoDCInstance::Ptr dec = new_aead(CryptoAlgs::AES_256_GCM, frame, false);
+
+    std::vector<BufferAllocated> orig;
+    std::vector<BufferAllocated> bufs;
+    for (size_t size = 1; size < 1500; size += 97)
+      {
+	orig.push_back(make_packet(frame, size, static_cast<unsigned char>(size)));
+	bufs.push_back(orig.back());
+      }
+    enc->encrypt(bufs[0], 0, nullptr);
+    enc->encrypt(bufs[5], 0, nullptr);
+    ASSERT_EQ(Error::SUCCESS, dec->decrypt(bufs[0], 0, nullptr));
+    ASSERT_EQ(Error::SUCCESS, dec->decrypt(bufs[5], 0, nullptr));
+    ASSERT_EQ(orig[0], bufs[0]);
+    ASSERT_EQ(orig[5], bufs[5]);
+
+    // mixed-size batch
+    enc->encrypt_batch(bufs.data() + 6, bufs.size() - 6, 0, nullptr);
+    for (size_t i = 6; i < bufs.size(); ++i)
+      {
+	ASSERT_EQ(Error::SUCCESS, dec->decrypt(bufs[i], 0, nullptr));
+	ASSERT_EQ(orig[i], bufs[i]);
+      }
+
+    // CBC/HMAC ciphers aren't offloaded
+    CryptoDCContext::Ptr cbc = factory.new_obj(CryptoAlgs::AES_256_CBC, CryptoAlgs::SHA256);
+    ASSERT_EQ(CryptoAlgs::AES_256_CBC, cbc->crypto_info().cipher_alg);
+#endif
+  }
+#endif
+
+  static bool pid_add(PacketIDReceive& pr, const PacketID::id_t id)
+  {
+    PacketID pid;
+    pid.id = id;
+    pid.time = 0;
+    return pr.test_add(pid, 0, true);
+  }
+
+  TEST(crypto, packet_id_wide)
+  {
+    // the short form wraps at 2^32, the wide form doesn't
+    PacketIDSend ps;
+    ps.init(PacketID::SHORT_FORM);
+    ps.resume(PacketIDConstruct(0, 0xFFFFFFFE));
+    EXPECT_TRUE(ps.wrap_warning());
+    EXPECT_EQ(0xFFFFFFFFu, ps.next(0).id);
+    EXPECT_THROW(ps.next(0), PacketIDSend::packet_id_wrap);
+
+    PacketIDSend pw;
+    pw.init(PacketID::WIDE_FORM);
+    pw.resume(PacketIDConstruct(0, 0xFFFFFFFE));
+    EXPECT_FALSE(pw.wrap_warning());
+    EXPECT_EQ(0xFFFFFFFFu, pw.next(0).id);
+    EXPECT_EQ(0x100000000u, pw.next(0).id);
+    pw.resume(PacketIDConstruct(0, ~PacketID::wide_id_t(0) - 1));
+    EXPECT_TRUE(pw.wrap_warning());
+    pw.next(0);
+    EXPECT_THROW(pw.next(0), PacketIDSend::packet_id_wrap);
+
+    // wire format is 8 bytes big-endian
+    unsigned char raw[8];
+    Buffer out(raw, sizeof(raw), false);
+    PacketIDConstruct(0, 0x0102030405060708).write(out, PacketID::WIDE_FORM, false);
+    ASSERT_EQ(PacketID::size(PacketID::WIDE_FORM), out.size());
+    EXPECT_EQ(1, raw[0]);
+    EXPECT_EQ(8, raw[7]);
+    PacketID in;
+    in.read(out, PacketID::WIDE_FORM);
+    EXPECT_EQ(0x0102030405060708u, in.id);
+
+    // the replay window works across 2^32
+    PacketIDReceive pr;
+    pr.init(PacketIDReceive::UDP_MODE, PacketID::WIDE_FORM, "DATA", 0, SessionStats::Ptr(new SessionStats()));
+    pr.resume(PacketIDConstruct(0, 0xFFFFFF00));
+    PacketID pid;
+    pid.time = 0;
+    for (pid.id = 0x100000010; pid.id > 0xFFFFFF00; pid.id -= 3)
+      ASSERT_TRUE(pr.test_add(pid, 0, true));
+    pid.id = 0x100000010;
+    EXPECT_FALSE(pr.test_add(pid, 0, true));
+    pid.id = 0xFFFFFFFF - 2;
+    EXPECT_TRUE(pr.test_add(pid, 0, true));
+    EXPECT_FALSE(pr.test_add(pid, 0, true));
+    pid.id = 0x100000010 - PacketIDReceive::REPLAY_WINDOW_SIZE - 1;
+    EXPECT_FALSE(pr.test_add(pid, 0, true));
+    pid.id = 0x300000000;
+    EXPECT_TRUE(pr.test_add(pid, 0, true));
+  }
+
+  TEST(crypto, packet_id_replay_window)
+  {
+    PacketIDReceive pr;
+    pr.init(PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM, "DATA", 0, SessionStats::Ptr(new SessionStats()));
+
+    // fill and wrap the history several times
+    PacketID::id_t id;
+    for (id = 1; id <= 5000; ++id)
+      ASSERT_TRUE(pid_add(pr, id));
+    ASSERT_FALSE(pid_add(pr, 4999));
+
+    // jump forward, the skipped IDs must each be accepted exactly once
+    const PacketID::id_t high = 5000 + 1000;
+    ASSERT_TRUE(pid_add(pr, high));
+    for (id = 5001; id < high; id += 7)
+      ASSERT_TRUE(pid_add(pr, id));
+    for (id = 5001; id < high; id += 7)
+      ASSERT_FALSE(pid_add(pr, id));
+    ASSERT_FALSE(pid_add(pr, high));
+
+    // IDs from before the jump which are still in the window remain replays
+    ASSERT_FALSE(pid_add(pr, 4500));
+
+    // backtrack beyond the window is rejected
+    ASSERT_FALSE(pid_add(pr, high - PacketIDReceive::REPLAY_WINDOW_SIZE - 1));
+
+    // small forward jumps crossing history word boundaries
+    for (id = high + 3; id < high + 1000; id += 61)
+      {
+	ASSERT_TRUE(pid_add(pr, id));
+	ASSERT_TRUE(pid_add(pr, id - 1));
+	ASSERT_FALSE(pid_add(pr, id - 1));
+      }
+
+    // jump larger than the window resets the history
+    ASSERT_TRUE(pid_add(pr, high + 10000));
+    ASSERT_TRUE(pid_add(pr, high + 10000 - 5));
+    ASSERT_FALSE(pid_add(pr, high + 10000 - 5));
+  }
+
+  static_assert(CryptoAlgs::is_aead(CryptoAlgs::CHACHA20_POLY1305), "CHACHA20-POLY1305 is AEAD");
+  static_assert(!CryptoAlgs::is_aead(CryptoAlgs::AES_256_CBC), "AES-256-CBC is not AEAD");
+  static_assert(CryptoAlgs::is_bs64(CryptoAlgs::BF_CBC), "BF-CBC has a 64-bit block size");
+
+  TEST(crypto, alg_lookup)
+  {
+    for (size_t i = 0; i < CryptoAlgs::SIZE; ++i)
+      {
+	const std::string name = CryptoAlgs::get_index(i).name();
+	ASSERT_EQ(i, size_t(CryptoAlgs::lookup(name)));
+	ASSERT_EQ(i, size_t(CryptoAlgs::lookup(string::to_lower_copy(name))));
+      }
+    ASSERT_EQ(CryptoAlgs::AES_256_GCM, CryptoAlgs::lookup("aes-256-Gcm"));
+    ASSERT_THROW(CryptoAlgs::lookup("AES-256-GCM2"), CryptoAlgs::crypto_alg);
+    ASSERT_THROW(CryptoAlgs::lookup(""), CryptoAlgs::crypto_alg);
+  }
+}
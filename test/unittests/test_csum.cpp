@@ -0,0 +1,112 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <random>
+#include <vector>
+
+#include <openvpn/ip/csum.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // RFC 1071 checksum over big-endian 16-bit words
+  static std::uint16_t reference_checksum(const std::uint8_t *buf, size_t len)
+  {
+    std::uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+      sum += (buf[i] << 8) | buf[i+1];
+    if (len & 1)
+      sum += buf[len-1] << 8;
+    while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum & 0xffff;
+  }
+
+  static std::uint16_t to_net(const std::uint16_t csum)
+  {
+    return ntohs(csum);
+  }
+
+  TEST(csum, compute)
+  {
+    std::mt19937 rng(1);
+    std::vector<std::uint8_t> buf(4096 + 8);
+    for (auto& b : buf)
+      b = rng();
+
+    for (size_t off = 0; off < 8; ++off)
+      for (size_t len = 0; len <= 1600; len += (len < 130 ? 1 : 37))
+	ASSERT_EQ(to_net(IPChecksum::checksum(buf.data() + off, len)),
+		  reference_checksum(buf.data() + off, len)) << off << '/' << len;
+
+    // all-ones data stresses the carry handling
+    std::vector<std::uint8_t> ones(65535, 0xff);
+    ASSERT_EQ(to_net(IPChecksum::checksum(ones.data(), ones.size())),
+	      reference_checksum(ones.data(), ones.size()));
+  }
+
+  TEST(csum, kernels)
+  {
+    std::mt19937 rng(2);
+    std::vector<std::uint8_t> buf(8192);
+    for (auto& b : buf)
+      b = rng();
+
+    for (size_t len = 0; len <= buf.size(); len += 4 * (1 + rng() % 40))
+      {
+	const std::uint32_t ref = IPChecksum::fold(IPChecksum::fold64(IPChecksum::sum32_scalar(buf.data(), len)));
+#if defined(OPENVPN_CSUM_AVX2)
+	if (IPChecksum::have_avx2())
+	  {
+	    ASSERT_EQ(IPChecksum::fold(IPChecksum::fold64(IPChecksum::sum32_avx2(buf.data(), len))), ref) << len;
+	  }
+#endif
+#if defined(OPENVPN_CSUM_NEON)
+	ASSERT_EQ(IPChecksum::fold(IPChecksum::fold64(IPChecksum::sum32_neon(buf.data(), len))), ref) << len;
+#endif
+	std::vector<std::uint8_t> copy(len);
+	ASSERT_EQ(IPChecksum::fold(IPChecksum::fold64(IPChecksum::copy_sum32_scalar(copy.data(), buf.data(), len))), ref) << len;
+	ASSERT_EQ(IPChecksum::fold(IPChecksum::fold64(IPChecksum::sum32(buf.data(), len))), ref) << len;
+      }
+  }
+
+  TEST(csum, copy_compute)
+  {
+    std::mt19937 rng(3);
+    std::vector<std::uint8_t> src(5008), dst(5008);
+    for (auto& b : src)
+      b = rng();
+
+    for (size_t soff = 0; soff < 4; ++soff)
+      for (size_t doff = 0; doff < 4; ++doff)
+	for (size_t len : {0, 1, 2, 3, 5, 63, 64, 65, 1023, 1024, 1025, 2047, 4999})
+	  {
+	    const std::uint8_t *s = src.data() + soff;
+	    std::fill(dst.begin(), dst.end(), 0);
+	    const std::uint32_t sum = IPChecksum::copy_compute(dst.data() + doff, s, len);
+	    ASSERT_EQ(sum, IPChecksum::compute(s, len)) << soff << '/' << doff << '/' << len;
+	    ASSERT_EQ(std::memcmp(dst.data() + doff, s, len), 0);
+	  }
+  }
+}
@@ -0,0 +1,80 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/ssl/datalimit.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static DataLimit::Parameters params(const DataLimit::size_type limit)
+  {
+    DataLimit::Parameters p;
+    p.encrypt_red_limit = limit;
+    p.decrypt_red_limit = limit;
+    return p;
+  }
+
+  // decrypt goes green on the first bytes and red exactly at the limit
+  TEST(datalimit, decrypt_exact)
+  {
+    DataLimit dl(params(1000));
+    ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Decrypt, 0));
+    ASSERT_FALSE(dl.is_decrypt_green());
+    ASSERT_EQ(DataLimit::Green, dl.add(DataLimit::Decrypt, 100));
+    ASSERT_TRUE(dl.is_decrypt_green());
+    for (int i = 0; i < 8; ++i)
+      ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Decrypt, 100));
+    ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Decrypt, 99));
+    ASSERT_EQ(DataLimit::Red, dl.add(DataLimit::Decrypt, 1));
+    ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Decrypt, 100));
+  }
+
+  // encrypt red is held back until decrypt has gone green
+  TEST(datalimit, encrypt_waits_for_decrypt_green)
+  {
+    DataLimit dl(params(1000));
+    ASSERT_EQ(DataLimit::Green, dl.add(DataLimit::Encrypt, 999));
+    ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Encrypt, 1));
+    ASSERT_EQ(DataLimit::Red, dl.add(DataLimit::Decrypt, 1));
+  }
+
+  // a state raised by notification moves the threshold too
+  TEST(datalimit, update_state)
+  {
+    DataLimit dl(params(1000));
+    ASSERT_EQ(DataLimit::Green, dl.update_state(DataLimit::Decrypt, DataLimit::Green));
+    ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Decrypt, 999));
+    ASSERT_EQ(DataLimit::Red, dl.add(DataLimit::Decrypt, 1));
+  }
+
+  // without a red limit, only the green transition happens
+  TEST(datalimit, no_red_limit)
+  {
+    DataLimit dl(params(0));
+    ASSERT_EQ(DataLimit::Green, dl.add(DataLimit::Decrypt, 1));
+    for (int i = 0; i < 1000; ++i)
+      ASSERT_EQ(DataLimit::None, dl.add(DataLimit::Decrypt, 1000000));
+  }
+}
@@ -0,0 +1,222 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/client/async_resolve/dns.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  typedef AsyncResolvableDNS<openvpn_io::ip::tcp::resolver> Resolvable;
+
+  // Append an answer record for the question name to a query,
+  // turning it into a response.
+  static void add_answer(std::vector<unsigned char>& msg, const IP::Addr& addr)
+  {
+    msg[2] |= 0x80;
+    msg[7] += 1;
+    const unsigned char rr[10] = {
+      0, (unsigned char)(addr.is_ipv6() ? DNSStub::AAAA : DNSStub::A),
+      0, 1,       // IN
+      0, 0, 0, 60, // TTL
+      0, (unsigned char)(addr.is_ipv6() ? 16 : 4),
+    };
+    msg.push_back(0xC0);
+    msg.push_back(12); // pointer to question name
+    msg.insert(msg.end(), rr, rr + sizeof(rr));
+    unsigned char bytes[16];
+    if (addr.is_ipv6())
+      addr.to_ipv6().to_byte_string(bytes);
+    else
+      addr.to_ipv4().to_byte_string(bytes);
+    msg.insert(msg.end(), bytes, bytes + (addr.is_ipv6() ? 16 : 4));
+  }
+
+  TEST(dns_resolve, wire_format)
+  {
+    std::vector<unsigned char> msg;
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "vpn.example.com", DNSStub::A));
+    ASSERT_EQ(12u + 17u + 4u, msg.size());
+    ASSERT_FALSE(DNSStub::encode_query(msg, 1, "bad..name", DNSStub::A));
+
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "vpn.example.com", DNSStub::A));
+    add_answer(msg, IP::Addr("192.0.2.1"));
+    add_answer(msg, IP::Addr("2001:db8::1")); // wrong type, ignored
+
+    std::vector<IP::Addr> addrs;
+    int rcode = -1;
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x4321, "vpn.example.com", DNSStub::A, addrs, rcode));
+    ASSERT_TRUE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+    ASSERT_EQ(DNSStub::NOERROR, rcode);
+    ASSERT_EQ(1u, addrs.size());
+    ASSERT_EQ("192.0.2.1", addrs[0].to_string());
+
+    // truncated answer must not be read past the end
+    addrs.clear();
+    ASSERT_TRUE(DNSStub::decode_response(msg.data(), msg.size() - 28 - 2, 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+    ASSERT_TRUE(addrs.empty());
+  }
+
+  // An answer is only accepted if the question section echoes the
+  // name, type and class that were asked for.
+  TEST(dns_resolve, question_mismatch)
+  {
+    std::vector<unsigned char> msg;
+    std::vector<IP::Addr> addrs;
+    int rcode = -1;
+
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "VPN.Example.com", DNSStub::A));
+    add_answer(msg, IP::Addr("192.0.2.1"));
+    ASSERT_TRUE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+    ASSERT_EQ(1u, addrs.size());
+
+    // different name, same id
+    addrs.clear();
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "evil.example.com", DNSStub::A));
+    add_answer(msg, IP::Addr("192.0.2.66"));
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.co", DNSStub::A, addrs, rcode));
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "example.com", DNSStub::A, addrs, rcode));
+    ASSERT_TRUE(addrs.empty());
+
+    // different type
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "vpn.example.com", DNSStub::AAAA));
+    add_answer(msg, IP::Addr("192.0.2.66"));
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+
+    // different class
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "vpn.example.com", DNSStub::A));
+    msg[12 + 17 + 3] = 3; // CH
+    add_answer(msg, IP::Addr("192.0.2.66"));
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+
+    // no question, or a compressed question name
+    ASSERT_TRUE(DNSStub::encode_query(msg, 0x1234, "vpn.example.com", DNSStub::A));
+    msg[2] |= 0x80;
+    msg[5] = 0;
+    ASSERT_FALSE(DNSStub::decode_response(msg.data(), msg.size(), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+    const unsigned char compressed[] = { 0x12, 0x34, 0x81, 0x80, 0, 1, 0, 0, 0, 0, 0, 0, 0xC0, 12, 0, 1, 0, 1 };
+    ASSERT_FALSE(DNSStub::decode_response(compressed, sizeof(compressed), 0x1234, "vpn.example.com", DNSStub::A, addrs, rcode));
+    ASSERT_TRUE(addrs.empty());
+  }
+
+  TEST(dns_resolve, config)
+  {
+    DNSStub::Config c;
+    c.parse_resolv_conf("# comment\nnameserver 192.0.2.53\nnameserver fe80::1%eth0\noptions timeout:1 attempts:3\n");
+    ASSERT_EQ(2u, c.nameservers.size());
+    ASSERT_EQ(1000u, c.timeout_ms);
+    ASSERT_EQ(3u, c.attempts);
+    c.parse_hosts("127.0.0.1 localhost Local.Host # comment\n::1 localhost\n");
+    ASSERT_EQ(2u, c.hosts["localhost"].size());
+    ASSERT_EQ(1u, c.hosts["local.host"].size());
+  }
+
+  class TestResolve : public Resolvable
+  {
+  public:
+    TestResolve(openvpn_io::io_context& io_context_arg)
+      : Resolvable(io_context_arg),
+	io_context(io_context_arg)
+    {
+    }
+
+    void resolve_callback(const openvpn_io::error_code& error_arg,
+			  openvpn_io::ip::tcp::resolver::results_type results) override
+    {
+      ++calls;
+      error = error_arg;
+      for (const auto& r : results)
+	endpoints.push_back(r.endpoint());
+      io_context.stop();
+    }
+
+    openvpn_io::io_context& io_context;
+    int calls = 0;
+    openvpn_io::error_code error;
+    std::vector<openvpn_io::ip::tcp::endpoint> endpoints;
+  };
+
+  TEST(dns_resolve, query)
+  {
+    openvpn_io::io_context io_context;
+
+    // fake nameserver answering A and AAAA queries for any name
+    openvpn_io::ip::udp::socket server(io_context, openvpn_io::ip::udp::endpoint(openvpn_io::ip::address_v4::loopback(), 0));
+    unsigned char buf[512];
+    openvpn_io::ip::udp::endpoint from;
+    int queries = 0;
+    std::function<void()> serve = [&]() {
+      server.async_receive_from(openvpn_io::buffer(buf), from, [&](const openvpn_io::error_code& error, size_t bytes) {
+	if (error)
+	  return;
+	++queries;
+	std::vector<unsigned char> msg(buf, buf + bytes);
+	if (msg[bytes - 3] == DNSStub::AAAA)
+	  add_answer(msg, IP::Addr("2001:db8::1"));
+	else
+	  add_answer(msg, IP::Addr("192.0.2.1"));
+	server.send_to(openvpn_io::buffer(msg), from);
+	serve();
+      });
+    };
+    serve();
+
+    std::shared_ptr<DNSStub::Config> c(new DNSStub::Config());
+    c->nameservers.push_back(IP::Addr("127.0.0.1"));
+    c->port = server.local_endpoint().port();
+    c->hosts["fixed.example.com"].push_back(IP::Addr("192.0.2.99"));
+    DNSStub::Config::set(c);
+
+    TestResolve r(io_context);
+    r.async_resolve_name("vpn.example.com", "1194");
+    io_context.run_for(std::chrono::seconds(5));
+    ASSERT_EQ(1, r.calls);
+    ASSERT_FALSE(r.error);
+    ASSERT_EQ(2, queries);
+    ASSERT_EQ(2u, r.endpoints.size());
+    ASSERT_EQ("192.0.2.1", r.endpoints[0].address().to_string());
+    ASSERT_EQ("2001:db8::1", r.endpoints[1].address().to_string());
+    ASSERT_EQ(1194, r.endpoints[1].port());
+
+    // answered locally, without queries
+    r.endpoints.clear();
+    r.async_resolve_name("fixed.example.com", "443");
+    io_context.restart();
+    io_context.run_for(std::chrono::seconds(5));
+    ASSERT_EQ(2, r.calls);
+    ASSERT_EQ(2, queries);
+    ASSERT_EQ(1u, r.endpoints.size());
+    ASSERT_EQ("192.0.2.99", r.endpoints[0].address().to_string());
+
+    // a cancelled resolve never calls back
+    r.async_resolve_name("vpn.example.com", "1194");
+    r.async_resolve_cancel();
+    server.close();
+    io_context.restart();
+    io_context.run_for(std::chrono::milliseconds(200));
+    ASSERT_EQ(2, r.calls);
+
+    DNSStub::Config::set(DNSStub::Config::Ptr());
+  }
+}
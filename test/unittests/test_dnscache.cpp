@@ -0,0 +1,98 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <unistd.h>
+
+#include <openvpn/client/dnscache.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static std::string cache_path()
+  {
+    const std::string path = "/tmp/ovpn_test_dns_cache." + std::to_string(::getpid());
+    ::unlink(path.c_str());
+    return path;
+  }
+
+  TEST(dnscache, persist)
+  {
+    const std::string path = cache_path();
+    {
+      RemoteDNSCache::Ptr dc(new RemoteDNSCache(path));
+      std::vector<IP::Addr> addrs;
+      ASSERT_EQ(RemoteDNSCache::MISS, dc->lookup("vpn.example.com", addrs));
+      dc->store("vpn.example.com", { IP::Addr("192.0.2.1"), IP::Addr("2001:db8::1") });
+      dc->store("192.0.2.7", { IP::Addr("192.0.2.7") }); // literal, not cached
+      ASSERT_EQ(1u, dc->size());
+    }
+
+    RemoteDNSCache::Ptr dc(new RemoteDNSCache(path));
+    std::vector<IP::Addr> addrs;
+    ASSERT_EQ(RemoteDNSCache::FRESH, dc->lookup("vpn.example.com", addrs));
+    ASSERT_EQ(2u, addrs.size());
+    ASSERT_EQ("192.0.2.1", addrs[0].to_string());
+    ASSERT_EQ("2001:db8::1", addrs[1].to_string());
+    ::unlink(path.c_str());
+  }
+
+  TEST(dnscache, stale)
+  {
+    const std::string path = cache_path();
+    const long long now = std::time(nullptr);
+    write_string(path,
+		 "fresh.example.com " + std::to_string(now + 60) + " 192.0.2.1\n"
+		 "stale.example.com " + std::to_string(now - 60) + " 192.0.2.2\n"
+		 "old.example.com " + std::to_string(now - 2*RemoteDNSCache::DEFAULT_MAX_STALE) + " 192.0.2.3\n"
+		 "bad.example.com soon 192.0.2.4\n"
+		 "junk.example.com " + std::to_string(now + 60) + " not-an-address\n"
+		 "truncated.example.com\n");
+
+    RemoteDNSCache::Ptr dc(new RemoteDNSCache(path));
+    ASSERT_EQ(2u, dc->size());
+    std::vector<IP::Addr> addrs;
+    ASSERT_EQ(RemoteDNSCache::FRESH, dc->lookup("fresh.example.com", addrs));
+    ASSERT_EQ(RemoteDNSCache::STALE, dc->lookup("stale.example.com", addrs));
+    ASSERT_EQ("192.0.2.2", addrs.at(0).to_string());
+    ASSERT_EQ(RemoteDNSCache::MISS, dc->lookup("old.example.com", addrs));
+    ASSERT_EQ(RemoteDNSCache::MISS, dc->lookup("bad.example.com", addrs));
+
+    // refreshing an entry makes it fresh again
+    dc->store("stale.example.com", { IP::Addr("192.0.2.9") });
+    ASSERT_EQ(RemoteDNSCache::FRESH, dc->lookup("stale.example.com", addrs));
+    ASSERT_EQ("192.0.2.9", addrs.at(0).to_string());
+    ::unlink(path.c_str());
+  }
+
+  // without a file, entries are only kept in memory
+  TEST(dnscache, memory)
+  {
+    RemoteDNSCache::Ptr dc(new RemoteDNSCache(""));
+    std::vector<IP::Addr> addrs;
+    ASSERT_EQ(RemoteDNSCache::MISS, dc->lookup("vpn.example.com", addrs));
+    dc->store("vpn.example.com", { IP::Addr("192.0.2.1") });
+    ASSERT_EQ(RemoteDNSCache::FRESH, dc->lookup("vpn.example.com", addrs));
+    ASSERT_EQ("192.0.2.1", addrs.at(0).to_string());
+  }
+}
@@ -0,0 +1,252 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/sess_ticket_ring.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/common/file.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  class EarlyDataTest : public testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      OpenSSLContext::SSL::init_static();
+
+      ::EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+      EVP_PKEY_keygen_init(pctx);
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+      EVP_PKEY_keygen(pctx, &key);
+      EVP_PKEY_CTX_free(pctx);
+
+      ::X509* x = X509_new();
+      ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+      X509_gmtime_adj(X509_getm_notBefore(x), -3600);
+      X509_gmtime_adj(X509_getm_notAfter(x), 86400);
+      X509_NAME_add_entry_by_txt(X509_get_subject_name(x), "CN", MBSTRING_ASC, (const unsigned char *)"server", -1, -1, 0);
+      X509_set_issuer_name(x, X509_get_subject_name(x));
+      X509_set_pubkey(x, key);
+      X509_sign(x, key, EVP_sha256());
+      cert = OpenSSLPKI::X509(x);
+
+      rng.reset(new SSLLib::RandomAPI(false));
+      tickets.reset(new TLSSessionTicketKeyRing(rng, "test", Time::Duration::infinite(), 1));
+    }
+
+    void TearDown() override
+    {
+      EVP_PKEY_free(key);
+    }
+
+    SSLFactoryAPI::Ptr server_factory(const unsigned int flags)
+    {
+      BIO* bio = BIO_new(BIO_s_mem());
+      PEM_write_bio_PrivateKey(bio, key, nullptr, nullptr, 0, nullptr, nullptr);
+      char *data;
+      const long len = BIO_get_mem_data(bio, &data);
+      const std::string key_pem(data, len);
+      BIO_free(bio);
+
+      OpenSSLContext::Config::Ptr config = new OpenSSLContext::Config();
+      config->set_mode(Mode(Mode::SERVER));
+      config->set_flags(SSLConst::NO_VERIFY_PEER | flags);
+      config->load_cert(cert.render_pem());
+      config->load_private_key(key_pem);
+      config->load_dh(read_text(UNITTEST_SOURCE_DIR "../ssl/dh.pem"));
+      config->set_session_ticket_handler(tickets.get());
+      config->set_frame(frame);
+      return config->new_factory();
+    }
+
+    SSLFactoryAPI::Ptr client_factory(const unsigned int flags)
+    {
+      OpenSSLContext::Config::Ptr config = new OpenSSLContext::Config();
+      config->set_mode(Mode(Mode::CLIENT));
+      config->set_flags(SSLConst::NO_VERIFY_PEER | flags);
+      config->set_local_cert_enabled(false);
+      config->set_client_session_tickets(true);
+      config->set_frame(frame);
+      return config->new_factory();
+    }
+
+    // Connect, with the client's first write right after
+    // start_handshake() like KeyContext::send_auth, and the
+    // server answering as soon as it has the request.  Returns
+    // the number of round trips until the client has the answer,
+    // or 0 on failure.
+    int exchange(SSLFactoryAPI& client_factory, SSLFactoryAPI& server_factory,
+		 std::string& details)
+    {
+      const std::string cache_key = "server";
+      SSLAPI::Ptr client = client_factory.ssl(nullptr, &cache_key);
+      SSLAPI::Ptr server = server_factory.ssl();
+      const std::string request = "auth request";
+      const std::string reply = "auth reply";
+      std::string client_out = request;
+      std::string server_out;
+      std::string server_in;
+      std::string client_in;
+
+      client->start_handshake();
+      server->start_handshake();
+      for (int i = 1; i <= 16; ++i)
+	{
+	  write(*client, client_out);
+	  while (client->read_ciphertext_ready())
+	    server->write_ciphertext(client->read_ciphertext());
+	  read(*server, server_in);
+	  if (server_in == request)
+	    {
+	      server_in.clear();
+	      server_out = reply;
+	    }
+	  write(*server, server_out);
+	  while (server->read_ciphertext_ready())
+	    client->write_ciphertext(server->read_ciphertext());
+	  read(*client, client_in);
+	  if (client_in == reply)
+	    {
+	      details = server->ssl_handshake_details();
+	      return i;
+	    }
+	}
+      return 0;
+    }
+
+    static void write(SSLAPI& ssl, std::string& out)
+    {
+      if (out.empty())
+	return;
+      const ssize_t size = ssl.write_cleartext_unbuffered(out.data(), out.length());
+      if (size > 0)
+	out.erase(0, size);
+    }
+
+    static void read(SSLAPI& ssl, std::string& in)
+    {
+      unsigned char buf[256];
+      while (ssl.read_cleartext_ready())
+	{
+	  const ssize_t size = ssl.read_cleartext(buf, sizeof(buf));
+	  if (size < 0)
+	    break;
+	  in.append((const char *)buf, size);
+	}
+    }
+
+    ::EVP_PKEY* key = nullptr;
+    OpenSSLPKI::X509 cert;
+    RandomAPI::Ptr rng;
+    std::unique_ptr<TLSSessionTicketKeyRing> tickets;
+    Frame::Ptr frame = frame_init_simple(2048);
+  };
+
+  TEST_F(EarlyDataTest, resume)
+  {
+    SSLFactoryAPI::Ptr server = server_factory(SSLConst::ENABLE_EARLY_DATA);
+    SSLFactoryAPI::Ptr client = client_factory(SSLConst::ENABLE_EARLY_DATA);
+    std::string details;
+    const int full = exchange(*client, *server, details);
+    ASSERT_GT(full, 0);
+    EXPECT_EQ(std::string::npos, details.find("[REUSED]"));
+    EXPECT_EQ(std::string::npos, details.find("EARLY DATA"));
+
+    // the request rides on the ClientHello; the server only
+    // acts on it once the client's Finished is in, so the reply
+    // can't come any sooner than without early data
+    const int early = exchange(*client, *server, details);
+    ASSERT_GT(early, 0);
+    EXPECT_LE(early, full);
+    EXPECT_NE(std::string::npos, details.find("[REUSED] [EARLY DATA]"));
+  }
+
+  // The server must not act on early data, which can be replayed,
+  // before the client's Finished proves it holds the session.
+  TEST_F(EarlyDataTest, held_until_finished)
+  {
+    SSLFactoryAPI::Ptr server_f = server_factory(SSLConst::ENABLE_EARLY_DATA);
+    SSLFactoryAPI::Ptr client_f = client_factory(SSLConst::ENABLE_EARLY_DATA);
+    std::string details;
+    ASSERT_GT(exchange(*client_f, *server_f, details), 0);
+
+    const std::string cache_key = "server";
+    SSLAPI::Ptr client = client_f->ssl(nullptr, &cache_key);
+    SSLAPI::Ptr server = server_f->ssl();
+    std::string request = "auth request";
+    std::string server_in;
+    std::string client_in;
+    client->start_handshake();
+    server->start_handshake();
+
+    // ClientHello and early data
+    write(*client, request);
+    ASSERT_TRUE(request.empty());
+    while (client->read_ciphertext_ready())
+      server->write_ciphertext(client->read_ciphertext());
+    read(*server, server_in);
+    ASSERT_TRUE(server_in.empty());
+
+    // server flight, then the client's Finished
+    while (server->read_ciphertext_ready())
+      client->write_ciphertext(server->read_ciphertext());
+    read(*client, client_in);
+    while (client->read_ciphertext_ready())
+      server->write_ciphertext(client->read_ciphertext());
+    read(*server, server_in);
+    ASSERT_EQ("auth request", server_in);
+    ASSERT_NE(std::string::npos, server->ssl_handshake_details().find("[EARLY DATA]"));
+  }
+
+  TEST_F(EarlyDataTest, client_disabled)
+  {
+    SSLFactoryAPI::Ptr server = server_factory(SSLConst::ENABLE_EARLY_DATA);
+    SSLFactoryAPI::Ptr client = client_factory(0);
+    std::string details;
+    ASSERT_GT(exchange(*client, *server, details), 0);
+    ASSERT_GT(exchange(*client, *server, details), 0);
+    EXPECT_NE(std::string::npos, details.find("[REUSED]"));
+    EXPECT_EQ(std::string::npos, details.find("EARLY DATA"));
+  }
+
+  // A server that has no record of the ticket, as after its first
+  // use, ignores it: the early data is sent again after a full
+  // handshake.
+  TEST_F(EarlyDataTest, rejected)
+  {
+    SSLFactoryAPI::Ptr client = client_factory(SSLConst::ENABLE_EARLY_DATA);
+    std::string details;
+    ASSERT_GT(exchange(*client, *server_factory(SSLConst::ENABLE_EARLY_DATA), details), 0);
+    ASSERT_GT(exchange(*client, *server_factory(SSLConst::ENABLE_EARLY_DATA), details), 0);
+    EXPECT_EQ(std::string::npos, details.find("[REUSED]"));
+    EXPECT_NE(std::string::npos, details.find("[EARLY DATA REJECTED]"));
+  }
+}
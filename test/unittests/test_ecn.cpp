@@ -0,0 +1,151 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/ip/ecn.hpp>
+#include <openvpn/transport/udplink.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static BufferAllocated make_ip(const bool ipv6, const unsigned int tos)
+  {
+    const size_t size = ipv6 ? sizeof(IPv6Header) : sizeof(IPv4Header);
+    BufferAllocated buf(size, 0);
+    std::uint8_t *p = buf.write_alloc(size);
+    std::memset(p, 0, size);
+    if (ipv6)
+      {
+	IPv6Header *h = (IPv6Header *)p;
+	h->version_prio = std::uint8_t(0x60 | (tos >> 4));
+	h->flow_lbl[0] = std::uint8_t((tos & 0x0F) << 4 | 0x0A);
+	h->hop_limit = 64;
+      }
+    else
+      {
+	IPv4Header *h = (IPv4Header *)p;
+	h->version_len = IPv4Header::ver_len(4, sizeof(IPv4Header));
+	h->tos = std::uint8_t(tos);
+	h->tot_len = htons(std::uint16_t(size));
+	h->ttl = 64;
+	h->saddr = htonl(0x0a000001);
+	h->daddr = htonl(0x0a000002);
+	h->check = IPChecksum::checksum(p, size);
+      }
+    return buf;
+  }
+
+  TEST(ECN, tos)
+  {
+    EXPECT_EQ(0xB8u | ECN::ECT_0, ECN::tos(make_ip(false, 0xB8 | ECN::ECT_0)));
+    EXPECT_EQ(0xB8u | ECN::CE, ECN::tos(make_ip(true, 0xB8 | ECN::CE)));
+    EXPECT_EQ(0u, ECN::tos(BufferAllocated()));
+  }
+
+  TEST(ECN, encap)
+  {
+    const unsigned int tos = 0xB8 | ECN::ECT_1;
+    EXPECT_EQ(tos, ECN::encap(tos, true, true));
+    EXPECT_EQ(0xB8u, ECN::encap(tos, true, false));
+    EXPECT_EQ(unsigned(ECN::ECT_1), ECN::encap(tos, false, true));
+    EXPECT_EQ(0u, ECN::encap(tos, false, false));
+  }
+
+  // RFC 6040 section 4.2 decapsulation table
+  TEST(ECN, decap)
+  {
+    const unsigned int X = 4; // drop
+    const unsigned int table[4][4] = {
+      // outer:  Not-ECT  ECT(1)  ECT(0)  CE     inner:
+      { ECN::NOT_ECT, ECN::NOT_ECT, ECN::NOT_ECT, X },      // Not-ECT
+      { ECN::ECT_1, ECN::ECT_1, ECN::ECT_1, ECN::CE },      // ECT(1)
+      { ECN::ECT_0, ECN::ECT_1, ECN::ECT_0, ECN::CE },      // ECT(0)
+      { ECN::CE, ECN::CE, ECN::CE, ECN::CE },               // CE
+    };
+    for (const bool ipv6 : { false, true })
+      for (unsigned int inner = 0; inner < 4; ++inner)
+	for (unsigned int outer = 0; outer < 4; ++outer)
+	  {
+	    BufferAllocated buf = make_ip(ipv6, 0xB8 | inner);
+	    const bool pass = ECN::decap(buf, 0x28 | outer);
+	    const unsigned int want = table[inner][outer];
+	    EXPECT_EQ(want != X, pass) << ipv6 << ' ' << inner << ' ' << outer;
+	    if (!pass)
+	      continue;
+	    EXPECT_EQ(0xB8 | want, ECN::tos(buf)) << ipv6 << ' ' << inner << ' ' << outer;
+	    if (ipv6)
+	      EXPECT_EQ(0x0A, buf[1] & 0x0F); // flow label untouched
+	    else
+	      EXPECT_EQ(0, IPChecksum::checksum(buf.c_data(), buf.size()));
+	  }
+  }
+
+#ifdef OPENVPN_UDPLINK_MMSG
+  struct TOSReceiver
+  {
+    void udp_read_handler(UDPTransport::PacketFrom::SPtr& pfp)
+    {
+      tos.push_back(pfp->tos);
+    }
+    void udp_read_burst_begin() {}
+    void udp_read_burst_end() {}
+
+    std::vector<unsigned int> tos;
+  };
+
+  // TOS set on send() comes back in PacketFrom::tos, for single and
+  // batched sends
+  TEST(ECN, link_tos)
+  {
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::udp::socket sock(io_context);
+    sock.open(openvpn_io::ip::udp::v4());
+    sock.bind(openvpn_io::ip::udp::endpoint(openvpn_io::ip::address_v4::loopback(), 0));
+    const UDPTransport::AsioEndpoint self = sock.local_endpoint();
+
+    TOSReceiver recv;
+    SessionStats::Ptr stats(new SessionStats());
+    Frame::Context fc(128, 2048, 128, 0, 16, 0);
+    UDPTransport::Link<TOSReceiver*>::Ptr link(new UDPTransport::Link<TOSReceiver*>(&recv, sock, fc, stats));
+    link->enable_tos(true);
+    link->start(1, 8);
+
+    const unsigned char data[] = "probe";
+    const Buffer buf(const_cast<unsigned char *>(data), sizeof(data), true);
+    EXPECT_EQ(0, link->send(buf, &self, 0xB8 | ECN::ECT_0));
+    link->set_send_batch(4, false);
+    link->send(buf, &self, 0x28 | ECN::CE);
+    link->send(buf, &self, 0);
+
+    for (int i = 0; i < 100 && recv.tos.size() < 3; ++i)
+      io_context.run_for(std::chrono::milliseconds(10));
+    link->stop();
+    ASSERT_EQ(3u, recv.tos.size());
+    EXPECT_EQ(0xB8u | ECN::ECT_0, recv.tos[0]);
+    EXPECT_EQ(0x28u | ECN::CE, recv.tos[1]);
+    EXPECT_EQ(0u, recv.tos[2]);
+  }
+#endif
+}
@@ -0,0 +1,325 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/transport/server/egress.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const Frame::Context frame_context(128, 2048, 128, 0, 16, 0);
+
+  // records what the scheduler sends
+  struct Sent : public TransportClientInstance::Send
+  {
+    typedef RCPtr<Sent> Ptr;
+
+    Sent(const int id_arg, const bool txtime_arg = false)
+      : id(id_arg),
+	txtime(txtime_arg)
+    {
+    }
+
+    bool defined() const override { return !stopped; }
+    void stop() override { stopped = true; }
+
+    bool transport_send_const(const Buffer& buf) override
+    {
+      ++n_const;
+      return true;
+    }
+
+    bool transport_send(BufferAllocated& buf) override
+    {
+      order->push_back(id);
+      bytes += buf.size();
+      return true;
+    }
+
+    bool transport_txtime() const override { return txtime; }
+
+    bool transport_send_txtime(BufferAllocated& buf, const std::uint64_t departure) override
+    {
+      departures.push_back(departure);
+      return transport_send(buf);
+    }
+
+    const std::string& transport_info() const override { return info; }
+    bool stats_pending() const override { return false; }
+    PeerStats stats_poll() override { return PeerStats(); }
+
+    const int id;
+    const bool txtime;
+    std::vector<int>* order = nullptr;
+    size_t bytes = 0;
+    int n_const = 0;
+    bool stopped = false;
+    std::vector<std::uint64_t> departures;
+    std::string info;
+  };
+
+  class EgressTest : public testing::Test
+  {
+  protected:
+    EgressScheduler::Queue::Ptr queue(EgressScheduler& sched, Sent::Ptr& sent, const int id,
+				      const std::uint64_t rate = 0, const bool txtime = false)
+    {
+      sent.reset(new Sent(id, txtime));
+      sent->order = &order;
+      return sched.new_queue(sent, rate);
+    }
+
+    static void send(EgressScheduler::Queue& q, const size_t size, const int n = 1)
+    {
+      for (int i = 0; i < n; ++i)
+	{
+	  BufferAllocated buf;
+	  frame_context.prepare(buf);
+	  buf.write_alloc(size);
+	  q.transport_send(buf);
+	}
+    }
+
+    static std::uint64_t now()
+    {
+      return LatencyHistogram::now_ns();
+    }
+
+    openvpn_io::io_context io_context;
+    std::vector<int> order;
+  };
+
+  // a bulk queue doesn't hold up another that starts later
+  TEST_F(EgressTest, fairness)
+  {
+    EgressScheduler::Config config;
+    config.burst = 1000;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a, b;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    EgressScheduler::Queue::Ptr qb = queue(*sched, b, 2);
+    send(*qa, 1400, 100);
+    send(*qb, 100, 10);
+
+    EXPECT_EQ(0u, sched->run(now()));
+    ASSERT_EQ(110u, order.size());
+    // b's 1000 bytes go out within a's first packets
+    const auto last_b = std::find(order.rbegin(), order.rend(), 2);
+    EXPECT_GT(order.rend() - last_b, 0);
+    EXPECT_LE(order.rend() - last_b, 12);
+    EXPECT_EQ(140000u, a->bytes);
+    EXPECT_EQ(1000u, b->bytes);
+  }
+
+  // equal bytes per round for queues of different packet sizes
+  TEST_F(EgressTest, byte_fairness)
+  {
+    EgressScheduler::Config config;
+    config.burst = 60;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a, b;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    EgressScheduler::Queue::Ptr qb = queue(*sched, b, 2);
+    send(*qa, 1500, 100);
+    send(*qb, 150, 1000);
+
+    EXPECT_NE(0u, sched->run(now()));
+    EXPECT_NEAR(double(a->bytes), double(b->bytes), 1500.0);
+  }
+
+  TEST_F(EgressTest, burst)
+  {
+    EgressScheduler::Config config;
+    config.burst = 8;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    send(*qa, 100, 20);
+
+    const std::uint64_t t = now();
+    EXPECT_EQ(t, sched->run(t));
+    EXPECT_EQ(8u, order.size());
+    EXPECT_EQ(12u, qa->size());
+  }
+
+  TEST_F(EgressTest, overflow)
+  {
+    EgressScheduler::Config config;
+    config.queue_limit = 10;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    send(*qa, 100, 15);
+    EXPECT_EQ(10u, qa->size());
+    EXPECT_EQ(5u, sched->stats().overflow_drops);
+  }
+
+  // packets that have waited longer than target for a whole
+  // interval start to be dropped, at an increasing rate
+  TEST_F(EgressTest, codel)
+  {
+    EgressScheduler::Config config;
+    config.burst = 1;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    send(*qa, 1000, 500);
+
+    // no drops at first, a short standing queue is fine
+    std::uint64_t t = now();
+    sched->run(t);
+    EXPECT_EQ(0u, sched->stats().codel_drops);
+
+    // 1 ms per packet, with the queue standing at 100+ ms
+    t += 110000000;
+    for (int i = 0; i < 300; ++i)
+      {
+	t += 1000000;
+	sched->run(t);
+      }
+    const std::uint64_t drops = sched->stats().codel_drops;
+    EXPECT_GT(drops, 2u);
+    EXPECT_LT(drops, 100u);
+    EXPECT_EQ(500u, order.size() + drops + qa->size());
+  }
+
+  // short queues are never dropped from
+  TEST_F(EgressTest, codel_short)
+  {
+    EgressScheduler::Config config;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    std::uint64_t t = now();
+    for (int i = 0; i < 100; ++i)
+      {
+	send(*qa, 1000, 2);
+	t += 1000000;
+	sched->run(t);
+      }
+    EXPECT_EQ(0u, sched->stats().codel_drops);
+    EXPECT_EQ(200u, order.size());
+  }
+
+  // rate limited queues are held to their departure times
+  TEST_F(EgressTest, pacing)
+  {
+    EgressScheduler::Config config;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a, b;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1, 1000000); // 1 ms per 1000 bytes
+    EgressScheduler::Queue::Ptr qb = queue(*sched, b, 2);
+    send(*qa, 1000, 5);
+    send(*qb, 1000, 5);
+
+    const std::uint64_t t = now();
+    const std::uint64_t next = sched->run(t);
+    EXPECT_EQ(1u, a->bytes / 1000);
+    EXPECT_EQ(5u, b->bytes / 1000);
+    EXPECT_EQ(t + 1000000, next);
+
+    EXPECT_EQ(t + 2000000, sched->run(next));
+    EXPECT_EQ(2u, a->bytes / 1000);
+    // late runs don't bunch up the rest
+    EXPECT_EQ(t + 11000000, sched->run(t + 10000000));
+    EXPECT_EQ(3u, a->bytes / 1000);
+    EXPECT_EQ(t + 12000000, sched->run(t + 11000000));
+    EXPECT_EQ(0u, sched->run(t + 12000000));
+    EXPECT_EQ(5u, a->bytes / 1000);
+  }
+
+  TEST_F(EgressTest, link_rate)
+  {
+    EgressScheduler::Config config;
+    config.link_rate = 1000000;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a, b;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    EgressScheduler::Queue::Ptr qb = queue(*sched, b, 2);
+    send(*qa, 1000, 5);
+    send(*qb, 1000, 5);
+
+    const std::uint64_t t = now();
+    EXPECT_EQ(t + 1000000, sched->run(t));
+    EXPECT_EQ(1u, order.size());
+    // no catching up after the link was idle
+    EXPECT_EQ(t + 3000000, sched->run(t + 2000000));
+    EXPECT_EQ((std::vector<int>{1, 2}), order);
+    EXPECT_EQ(t + 4000000, sched->run(t + 3000000));
+    EXPECT_EQ((std::vector<int>{1, 2, 1}), order);
+  }
+
+  // SO_TXTIME transports get paced packets early, with their
+  // departure times
+  TEST_F(EgressTest, txtime)
+  {
+    EgressScheduler::Config config;
+    config.txtime_horizon_ns = 3000000;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1, 1000000, true);
+    send(*qa, 1000, 10);
+
+    const std::uint64_t t = now();
+    const std::uint64_t next = sched->run(t);
+    ASSERT_EQ(4u, order.size());
+    ASSERT_EQ(3u, a->departures.size());
+    EXPECT_EQ(t + 1000000, a->departures[0]);
+    EXPECT_EQ(t + 3000000, a->departures[2]);
+    EXPECT_EQ(t + 1000000, next);
+  }
+
+  TEST_F(EgressTest, bypass_and_stop)
+  {
+    EgressScheduler::Config config;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1);
+    send(*qa, 100, 5);
+    BufferAllocated ctrl;
+    frame_context.prepare(ctrl);
+    qa->transport_send_const(ctrl);
+    EXPECT_EQ(1, a->n_const);
+
+    qa->stop();
+    EXPECT_TRUE(a->stopped);
+    EXPECT_EQ(0u, qa->size());
+    EXPECT_EQ(0u, sched->run(now()));
+    EXPECT_TRUE(order.empty());
+  }
+
+  // driven by the reactor
+  TEST_F(EgressTest, io_context)
+  {
+    EgressScheduler::Config config;
+    config.burst = 4;
+    EgressScheduler::Ptr sched(new EgressScheduler(io_context, config));
+    Sent::Ptr a;
+    EgressScheduler::Queue::Ptr qa = queue(*sched, a, 1, 10000000); // 0.1 ms per packet
+    send(*qa, 1000, 20);
+    io_context.run();
+    EXPECT_EQ(20u, order.size());
+    EXPECT_EQ(0u, qa->size());
+  }
+}
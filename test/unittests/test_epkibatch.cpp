@@ -0,0 +1,86 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <openvpn/pki/epkibatch.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  class TestSigner : public ExternalPKIBatchBase
+  {
+  public:
+    virtual void sign_batch(const std::vector<SignRequest*>& reqs) override
+    {
+      // hold the first batch until the other callers have queued up
+      if (!n_calls++)
+	{
+	  while (n_entered < N_THREADS)
+	    std::this_thread::yield();
+	  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+      for (auto* r : reqs)
+	{
+	  if (r->data == "bad")
+	    continue;
+	  r->sig = r->algorithm + ':' + r->data;
+	  r->status = true;
+	}
+    }
+
+    enum {
+      N_THREADS = 8,
+    };
+
+    std::atomic<int> n_entered{0};
+    std::atomic<int> n_calls{0};
+  };
+
+  TEST(epkibatch, concurrent)
+  {
+    TestSigner signer;
+    ExternalPKIBatch batch(signer);
+    std::atomic<int> n_ok{0};
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < TestSigner::N_THREADS; ++i)
+      threads.emplace_back([&, i]() {
+	  const std::string data = i == 3 ? "bad" : std::to_string(i);
+	  std::string sig;
+	  ++signer.n_entered;
+	  const bool status = batch.sign(data, sig, "RSA_PKCS1_PADDING");
+	  if (status == (i != 3) && (!status || sig == "RSA_PKCS1_PADDING:" + data))
+	    ++n_ok;
+	});
+    for (auto& t : threads)
+      t.join();
+
+    ASSERT_EQ(TestSigner::N_THREADS, n_ok);
+    ASSERT_EQ(size_t(signer.n_calls), batch.n_batches());
+    ASSERT_LT(batch.n_batches(), size_t(TestSigner::N_THREADS));
+  }
+}
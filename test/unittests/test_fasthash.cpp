@@ -0,0 +1,176 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <unordered_set>
+
+#include <openvpn/common/fasthash.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/addrkey.hpp>
+#include <openvpn/ssl/psid.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // reference vector from the SipHash paper (appendix A)
+  TEST(fasthash, siphash_vector)
+  {
+    SipHash::Key key;
+    key.k0 = 0x0706050403020100ull;
+    key.k1 = 0x0f0e0d0c0b0a0908ull;
+    unsigned char msg[15];
+    for (unsigned int i = 0; i < sizeof(msg); ++i)
+      msg[i] = (unsigned char)i;
+    ASSERT_EQ(0xa129ca6149be45e5ull, SipHash::hash(key, msg, sizeof(msg)));
+  }
+
+  TEST(fasthash, lengths)
+  {
+    // every length class hashes all its bytes
+    unsigned char buf[200] = {};
+    std::unordered_set<std::uint64_t> seen;
+    for (std::size_t len = 0; len <= sizeof(buf); ++len)
+      {
+	ASSERT_TRUE(seen.insert(FastHash::hash(buf, len)).second);
+	if (len)
+	  {
+	    const std::uint64_t h = FastHash::hash(buf, len);
+	    buf[len - 1] ^= 1;
+	    ASSERT_NE(h, FastHash::hash(buf, len));
+	    buf[len - 1] ^= 1;
+	  }
+      }
+
+    // seeds give independent hashes
+    ASSERT_NE(FastHash::hash(buf, 16, 1), FastHash::hash(buf, 16, 2));
+  }
+
+  // Sequential keys, the common case for pool addresses and peer
+  // IDs, must spread evenly over the buckets of a table.
+  template <typename HASH>
+  static void check_dispersion(HASH hash, const char *what)
+  {
+    enum {
+      N_KEYS = 1 << 16,
+      N_BUCKETS = 1 << 10,
+    };
+    std::vector<unsigned int> buckets(N_BUCKETS);
+    std::unordered_set<std::uint64_t> full;
+    for (unsigned int i = 0; i < N_KEYS; ++i)
+      {
+	const std::uint64_t h = hash(i);
+	full.insert(h);
+	++buckets[h % N_BUCKETS];
+      }
+    ASSERT_EQ(size_t(N_KEYS), full.size()) << what;
+
+    // chi-square over the buckets, expect about N_BUCKETS - 1
+    const double expect = double(N_KEYS) / N_BUCKETS;
+    double chi2 = 0.0;
+    for (const unsigned int b : buckets)
+      chi2 += (b - expect) * (b - expect) / expect;
+    ASSERT_LT(chi2, 1.2 * N_BUCKETS) << what;
+  }
+
+  TEST(fasthash, dispersion)
+  {
+    check_dispersion([](const unsigned int i) {
+	return std::hash<IP::Addr>()(IP::Addr::from_ipv4(IPv4::Addr::from_uint32(0x0a000000 + i)));
+      }, "IPv4");
+    check_dispersion([](const unsigned int i) {
+	return std::hash<IP::Addr>()(IP::Addr::from_ipv6(IPv6::Addr::from_uint64(0xfd00000000000000ull, i)));
+      }, "IPv6");
+    check_dispersion([](const unsigned int i) {
+	return FastHash::hash64(i);
+      }, "peer ID");
+    check_dispersion([](const unsigned int i) {
+	AddrPort ap;
+	ap.addr = IP::Addr::from_ipv4(IPv4::Addr::from_uint32(0xc0000200));
+	ap.port = (std::uint16_t)i;
+	return std::hash<AddrPort>()(ap);
+      }, "port");
+    check_dispersion([](const unsigned int i) {
+	unsigned char id[ProtoSessionID::SIZE] = {};
+	std::memcpy(id, &i, sizeof(i));
+	Buffer buf(id, sizeof(id), true);
+	return std::hash<ProtoSessionID>()(ProtoSessionID(buf));
+      }, "session ID");
+  }
+
+  TEST(fasthash, peer_addr)
+  {
+    PeerAddr a, b;
+    a.remote.addr = b.remote.addr = IP::Addr("192.0.2.1");
+    a.remote.port = b.remote.port = 1194;
+    a.local.addr = b.local.addr = IP::Addr("198.51.100.1");
+    a.local.port = b.local.port = 1194;
+    ASSERT_TRUE(a == b);
+    ASSERT_EQ(std::hash<PeerAddr>()(a), std::hash<PeerAddr>()(b));
+    b.tcp = true;
+    ASSERT_FALSE(a == b);
+    ASSERT_NE(std::hash<PeerAddr>()(a), std::hash<PeerAddr>()(b));
+  }
+
+  // Only logs the timings; run the test binary on an idle machine to
+  // compare.
+  TEST(fasthash, microbench)
+  {
+    enum {
+      N = 1000000,
+    };
+    std::mt19937 rng(1);
+    std::vector<IPv6::Addr> addrs;
+    for (unsigned int i = 0; i < 1024; ++i)
+      addrs.push_back(IPv6::Addr::from_uint64(0x20010db800000000ull | rng(), rng()));
+
+    typedef std::chrono::steady_clock clock;
+    auto ns_per_op = [](const clock::time_point start) {
+      return double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()) / N;
+    };
+
+    std::uint64_t sum = 0;
+    clock::time_point t = clock::now();
+    for (unsigned int i = 0; i < N; ++i)
+      sum += FastHash::hash(&addrs[i & 1023], sizeof(IPv6::Addr));
+    const double fast_ns = ns_per_op(t);
+
+    t = clock::now();
+    for (unsigned int i = 0; i < N; ++i)
+      sum += SipHash::hash(&addrs[i & 1023], sizeof(IPv6::Addr));
+    const double sip_ns = ns_per_op(t);
+
+    t = clock::now();
+    for (unsigned int i = 0; i < N; ++i)
+      sum += std::hash<std::string>()(addrs[i & 1023].to_string());
+    const double str_ns = ns_per_op(t);
+
+    ASSERT_NE(0u, sum);
+    OPENVPN_LOG("fasthash microbench: FastHash " << fast_ns
+		<< " ns, SipHash " << sip_ns
+		<< " ns, std::hash of to_string() " << str_ns << " ns");
+  }
+}
@@ -0,0 +1,166 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include "test_common.h"
+
+#include <openvpn/transport/fec.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const Frame::Context frame_context(128, 2048, 128, 0, 16, 0);
+
+  static BufferAllocated packet(const unsigned char seed, const size_t size)
+  {
+    BufferAllocated buf;
+    frame_context.prepare(buf);
+    for (size_t i = 0; i < size; ++i)
+      buf.push_back(std::uint8_t(seed + i));
+    return buf;
+  }
+
+  static std::string str(const Buffer& buf)
+  {
+    return std::string((const char *)buf.c_data(), buf.size());
+  }
+
+  // Send n packets through a sender/receiver pair, dropping those
+  // for which drop(i) is true, with i counting the parity packets
+  // too.  Returns the packets that came out of the receiver.
+  template <typename DROP>
+  static std::vector<std::string> transfer(FEC& tx, FEC& rx, const int n, DROP drop)
+  {
+    std::vector<std::string> ret;
+    int wire = 0;
+    auto receive = [&](BufferAllocated& buf) {
+      if (drop(wire++))
+	return;
+      EXPECT_TRUE(FEC::is_fec(buf));
+      BufferAllocated recovered;
+      if (rx.decode(buf, recovered))
+	ret.push_back(str(buf));
+      if (recovered.size())
+	ret.push_back(str(recovered));
+    };
+    for (int i = 0; i < n; ++i)
+      {
+	BufferAllocated buf = packet(std::uint8_t(i), 40 + i % 7);
+	BufferAllocated parity;
+	const bool p = tx.encode(buf, parity);
+	receive(buf);
+	if (p)
+	  receive(parity);
+      }
+    BufferAllocated parity;
+    if (tx.flush(parity))
+      receive(parity);
+    return ret;
+  }
+
+  static std::vector<std::string> sent(const int n)
+  {
+    std::vector<std::string> ret;
+    for (int i = 0; i < n; ++i)
+      ret.push_back(str(packet(std::uint8_t(i), 40 + i % 7)));
+    return ret;
+  }
+
+  TEST(FEC, no_loss)
+  {
+    FEC tx(frame_context), rx(frame_context);
+    EXPECT_EQ(unsigned(FEC::MAX_GROUP), tx.group_size());
+    EXPECT_EQ(sent(100), transfer(tx, rx, 100, [](int) { return false; }));
+    EXPECT_EQ(0u, rx.n_recovered());
+    EXPECT_EQ(0u, rx.loss());
+  }
+
+  // one loss per group is rebuilt, also from a partial group
+  TEST(FEC, recover_one)
+  {
+    FEC tx(frame_context), rx(frame_context);
+    const int n = FEC::MAX_GROUP + 10;
+    std::vector<std::string> got = transfer(tx, rx, n, [](int i) { return i == 3 || i == FEC::MAX_GROUP + 5; });
+    EXPECT_EQ(2u, rx.n_recovered());
+    std::sort(got.begin(), got.end());
+    std::vector<std::string> want = sent(n);
+    std::sort(want.begin(), want.end());
+    EXPECT_EQ(want, got);
+  }
+
+  // two losses in a group can't be rebuilt, and don't corrupt
+  // anything
+  TEST(FEC, two_lost)
+  {
+    FEC tx(frame_context), rx(frame_context);
+    std::vector<std::string> got = transfer(tx, rx, FEC::MAX_GROUP, [](int i) { return i == 3 || i == 4; });
+    EXPECT_EQ(0u, rx.n_recovered());
+    EXPECT_EQ(size_t(FEC::MAX_GROUP - 2), got.size());
+    EXPECT_GT(rx.loss(), 0u);
+  }
+
+  // the parity packet arriving before the last packet of the group
+  TEST(FEC, parity_first)
+  {
+    FEC tx(frame_context), rx(frame_context);
+    std::vector<BufferAllocated> wire;
+    BufferAllocated parity;
+    for (int i = 0; i < 3; ++i)
+      {
+	wire.push_back(packet(std::uint8_t(i), 50));
+	tx.encode(wire.back(), parity);
+      }
+    ASSERT_TRUE(tx.flush(parity));
+
+    BufferAllocated recovered;
+    EXPECT_FALSE(rx.decode(parity, recovered));
+    EXPECT_TRUE(rx.decode(wire[2], recovered));
+    EXPECT_EQ(0u, recovered.size());
+    EXPECT_TRUE(rx.decode(wire[0], recovered)); // wire[1] lost
+    EXPECT_EQ(str(packet(1, 50)), str(recovered));
+  }
+
+  // the loss that the receiver sees sizes the sender's groups
+  TEST(FEC, adaptive)
+  {
+    FEC a(frame_context), b(frame_context);
+    transfer(a, b, 2000, [](int i) { return i % 20 == 7; });
+    EXPECT_GT(b.loss(), unsigned(FEC::LOSS_ONE) / 40);
+    transfer(b, a, 1, [](int) { return false; });
+    EXPECT_EQ(b.loss(), a.peer_loss());
+    EXPECT_LT(a.group_size(), unsigned(FEC::MAX_GROUP));
+    EXPECT_GE(a.group_size(), unsigned(FEC::MIN_GROUP));
+  }
+
+  // a packet without headroom for the header is left alone
+  TEST(FEC, no_headroom)
+  {
+    FEC tx(frame_context);
+    BufferAllocated buf(64, 0);
+    buf.push_back(1);
+    BufferAllocated parity;
+    EXPECT_FALSE(tx.encode(buf, parity));
+    EXPECT_FALSE(FEC::is_fec(buf));
+    EXPECT_FALSE(tx.pending());
+  }
+}
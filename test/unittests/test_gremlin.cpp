@@ -0,0 +1,229 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <vector>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/transport/gremlin.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // arrival times in binary ms after start, -1 for lost packets
+  static std::vector<long> run(const Gremlin::LinkParams& params, const std::uint64_t seed,
+			       const int n, const Time::Duration& interval, const size_t size)
+  {
+    Gremlin::VirtualClock clock;
+    const Time start = clock.now();
+    Gremlin::Link link(params, seed, false);
+    std::vector<long> ret;
+    for (int i = 0; i < n; ++i)
+      {
+	Time deliver;
+	if (link.transmit(clock.now(), size, deliver))
+	  ret.push_back(deliver.delta_prec(start));
+	else
+	  ret.push_back(-1);
+	clock.advance(interval);
+      }
+    return ret;
+  }
+
+  TEST(gremlin, config)
+  {
+    Gremlin::Config c("50, 20, 0,100,seed=7,jitter=5,recv_kbps=8000,queue=200,send_reorder=2.5,ge=1:25");
+    EXPECT_EQ(50u, c.send.delay_ms);
+    EXPECT_EQ(20u, c.recv.delay_ms);
+    EXPECT_EQ(100u, c.recv.drop_probability);
+    EXPECT_EQ(7u, c.seed);
+    EXPECT_EQ(5u, c.send.jitter_ms);
+    EXPECT_EQ(5u, c.recv.jitter_ms);
+    EXPECT_EQ(0u, c.send.kbps);
+    EXPECT_EQ(8000u, c.recv.kbps);
+    EXPECT_DOUBLE_EQ(0.025, c.send.reorder);
+    EXPECT_DOUBLE_EQ(0.0, c.recv.reorder);
+    EXPECT_DOUBLE_EQ(0.01, c.recv.ge_p);
+    EXPECT_DOUBLE_EQ(0.25, c.recv.ge_r);
+    EXPECT_DOUBLE_EQ(1.0, c.recv.ge_loss);
+    EXPECT_EQ("[50,20,0,100,seed=7,send_jitter=5,send_queue=200,send_reorder=2.5,send_ge=1:25:100,"
+	      "recv_jitter=5,recv_kbps=8000,recv_queue=200,recv_ge=1:25:100]", c.to_string());
+
+    EXPECT_EQ("[1,2,3,4]", Gremlin::Config("1,2,3,4").to_string());
+    EXPECT_THROW(Gremlin::Config("1,2,3"), Gremlin::gremlin_error);
+    EXPECT_THROW(Gremlin::Config("1,2,3,4,bogus=1"), Gremlin::gremlin_error);
+    EXPECT_THROW(Gremlin::Config("1,2,3,4,reorder=101"), Gremlin::gremlin_error);
+    EXPECT_THROW(Gremlin::Config("1,2,3,4,ge=0:10"), Gremlin::gremlin_error);
+    EXPECT_THROW(Gremlin::Config("1,2,3,4,kbps"), Gremlin::gremlin_error);
+  }
+
+  TEST(gremlin, reproducible)
+  {
+    Gremlin::Config c("40,0,10,0,jitter=30,kbps=2000,reorder=5,ge=2:20:80");
+    const auto a = run(c.send, 1, 2000, Time::Duration::binary_ms(3), 500);
+    EXPECT_EQ(a, run(c.send, 1, 2000, Time::Duration::binary_ms(3), 500));
+    EXPECT_NE(a, run(c.send, 2, 2000, Time::Duration::binary_ms(3), 500));
+  }
+
+  TEST(gremlin, delay_and_jitter_keep_order)
+  {
+    Gremlin::LinkParams p;
+    p.delay_ms = 100;
+    p.jitter_ms = 50;
+    const auto a = run(p, 3, 1000, Time::Duration::binary_ms(1), 100);
+    for (size_t i = 0; i < a.size(); ++i)
+      {
+	ASSERT_GE(a[i], long(i) + 102); // 100ms is 102.4 binary ms
+	ASSERT_LE(a[i], long(i) + 155);
+	if (i)
+	  {
+	    ASSERT_GE(a[i], a[i-1]);
+	  }
+      }
+  }
+
+  TEST(gremlin, reorder)
+  {
+    Gremlin::LinkParams p;
+    p.delay_ms = 100;
+    p.reorder = 0.1;
+    const auto a = run(p, 4, 10000, Time::Duration::binary_ms(1), 100);
+    int overtaking = 0;
+    for (size_t i = 1; i < a.size(); ++i)
+      if (a[i] < a[i-1])
+	++overtaking;
+    EXPECT_NEAR(1000, overtaking, 150);
+  }
+
+  TEST(gremlin, bandwidth)
+  {
+    // 1000 byte packets at 8000 kbps take 1 ms each, so a burst of
+    // 1000 drains in a second
+    Gremlin::LinkParams p;
+    p.kbps = 8000;
+    const auto a = run(p, 5, 1000, Time::Duration(), 1000);
+    EXPECT_NEAR(1024, a.back(), 1);
+
+    // with a 100 ms queue the rest of the burst is tail-dropped
+    p.queue_ms = 100;
+    Gremlin::VirtualClock clock;
+    Gremlin::Link link(p, 5, false);
+    int delivered = 0;
+    for (int i = 0; i < 1000; ++i)
+      {
+	Time deliver;
+	if (link.transmit(clock.now(), 1000, deliver))
+	  ++delivered;
+      }
+    EXPECT_EQ(101, delivered);
+    EXPECT_EQ(899u, link.stats().overflow);
+  }
+
+  TEST(gremlin, gilbert_elliott)
+  {
+    Gremlin::LinkParams p;
+    p.ge_p = 0.01;
+    p.ge_r = 0.1;
+    p.ge_loss = 0.5;
+    const int n = 200000;
+    const auto a = run(p, 6, n, Time::Duration::binary_ms(1), 100);
+    int lost = 0, runs = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+      {
+	if (a[i] < 0)
+	  {
+	    ++lost;
+	    if (!i || a[i-1] >= 0)
+	      ++runs;
+	  }
+      }
+    EXPECT_NEAR(p.ge_loss_rate(), double(lost) / n, 0.006);
+
+    // loss comes in bursts: more packets per run of losses than the
+    // ~1.05 of Bernoulli loss at the same rate
+    EXPECT_GT(double(lost) / runs, 1.5);
+  }
+
+  TEST(gremlin, stream_never_drops_or_reorders)
+  {
+    Gremlin::LinkParams p;
+    p.drop_probability = 2;
+    p.reorder = 0.5;
+    p.ge_p = 0.5;
+    p.ge_r = 0.1;
+    p.jitter_ms = 20;
+    Gremlin::VirtualClock clock;
+    Gremlin::Link link(p, 7, true);
+    Time last;
+    for (int i = 0; i < 1000; ++i)
+      {
+	Time deliver;
+	ASSERT_TRUE(link.transmit(clock.now(), 100, deliver));
+	ASSERT_GE(deliver, last);
+	last = deliver;
+	clock.advance(Time::Duration::binary_ms(1));
+      }
+  }
+
+  TEST(gremlin, wire)
+  {
+    Gremlin::LinkParams p;
+    p.delay_ms = 50;
+    Gremlin::VirtualClock clock;
+    Gremlin::Wire<int> wire(p, 8);
+    for (int i = 0; i < 3; ++i)
+      EXPECT_TRUE(wire.send(clock.now(), i, 100));
+    int pkt;
+    EXPECT_FALSE(wire.recv(clock.now(), pkt));
+    EXPECT_EQ(clock.now() + Time::Duration::binary_ms(52), wire.next_time()); // 51.2, rounded up
+
+    // jump straight to the next arrival
+    clock.advance_to(wire.next_time());
+    for (int i = 0; i < 3; ++i)
+      {
+	ASSERT_TRUE(wire.recv(clock.now(), pkt));
+	EXPECT_EQ(i, pkt);
+      }
+    EXPECT_EQ(0u, wire.size());
+    EXPECT_TRUE(wire.next_time().is_infinite());
+  }
+
+  TEST(gremlin, send_recv_queue)
+  {
+    openvpn_io::io_context io_context;
+    Gremlin::Config::Ptr conf(new Gremlin::Config("30,0,0,0,seed=9"));
+    Gremlin::SendRecvQueue q(io_context, conf, false);
+    std::vector<int> order;
+    const Time start = Time::now();
+    q.send_queue([&]() { order.push_back(1); }, 100);
+    q.recv_queue([&]() { order.push_back(0); }, 100);
+    EXPECT_EQ(1u, q.send_size());
+    EXPECT_EQ(1u, q.recv_size());
+    io_context.run();
+    EXPECT_EQ(std::vector<int>({0, 1}), order);
+    EXPECT_GE(Time::now().delta_prec(start), 30);
+    EXPECT_EQ(0u, q.send_size());
+    EXPECT_EQ(1u, q.send_stats().packets);
+  }
+}
@@ -0,0 +1,209 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <vector>
+
+#include <openvpn/ip/gso.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // TCP packet with a 12 byte option block and the given payload
+  static BufferAllocated make_tcp(const bool ipv6, const std::uint32_t seq,
+				  const size_t payload, const std::uint8_t flags)
+  {
+    const size_t iphl = ipv6 ? sizeof(IPv6Header) : sizeof(IPv4Header);
+    const size_t thl = sizeof(TCPHeader) + 12;
+    BufferAllocated buf(iphl + thl + payload, 0);
+    std::uint8_t *p = buf.write_alloc(iphl + thl + payload);
+    std::memset(p, 0, iphl + thl);
+    if (ipv6)
+      {
+	IPv6Header *h = (IPv6Header *)p;
+	h->version_prio = 0x60;
+	h->payload_len = htons(std::uint16_t(thl + payload));
+	h->nexthdr = IPCommon::TCP;
+	h->hop_limit = 64;
+	h->saddr.s6_addr[0] = 0xfd;
+	h->saddr.s6_addr[15] = 1;
+	h->daddr.s6_addr[0] = 0xfd;
+	h->daddr.s6_addr[15] = 2;
+      }
+    else
+      {
+	IPv4Header *h = (IPv4Header *)p;
+	h->version_len = IPv4Header::ver_len(4, sizeof(IPv4Header));
+	h->tot_len = htons(std::uint16_t(iphl + thl + payload));
+	h->id = htons(1000);
+	h->frag_off = htons(0x4000);
+	h->ttl = 64;
+	h->protocol = IPCommon::TCP;
+	h->saddr = htonl(0x0a080002);
+	h->daddr = htonl(0x0a080001);
+	h->check = IPChecksum::checksum(h, iphl);
+      }
+    TCPHeader *th = (TCPHeader *)(p + iphl);
+    th->source = htons(40000);
+    th->dest = htons(443);
+    th->seq = htonl(seq);
+    th->ack_seq = htonl(77);
+    th->doff_res = std::uint8_t((thl / 4) << 4);
+    th->flags = flags;
+    th->window = htons(512);
+    std::uint8_t *opt = (std::uint8_t *)(th + 1);
+    opt[0] = opt[1] = TCPHeader::OPT_NOP;
+    opt[2] = 8; // timestamp
+    opt[3] = 10;
+    opt[4] = 0x12;
+    for (size_t i = 0; i < payload; ++i)
+      p[iphl + thl + i] = std::uint8_t(seq + i);
+
+    GSO::TCPLayout l;
+    l.parse(p, buf.size());
+    th->check = IPChecksum::cfold(GSO::pseudo_header_sum(p, l, thl + payload)
+				  + IPChecksum::compute(th, thl + payload));
+    return buf;
+  }
+
+  static bool tcp_csum_ok(const Buffer& pkt)
+  {
+    GSO::TCPLayout l;
+    if (!l.parse(pkt.c_data(), pkt.size()))
+      return false;
+    const size_t tcp_len = pkt.size() - l.iphl;
+    const std::uint32_t sum = GSO::pseudo_header_sum(pkt.c_data(), l, tcp_len)
+      + IPChecksum::compute(pkt.c_data() + l.iphl, tcp_len);
+    if (IPChecksum::cfold(sum))
+      return false;
+    return l.version == IPCommon::IPv6 || !IPChecksum::checksum(pkt.c_data(), l.iphl);
+  }
+
+  static void roundtrip(const bool ipv6)
+  {
+    const size_t mss = 1388;
+    const size_t payload = 5 * mss + 300;
+    BufferAllocated super = make_tcp(ipv6, 5000, payload, GSO::TCP_ACK|GSO::TCP_PSH);
+
+    GSO::VirtioNetHdr hdr = {};
+    hdr.gso_type = ipv6 ? GSO::VirtioNetHdr::GSO_TCPV6 : GSO::VirtioNetHdr::GSO_TCPV4;
+    hdr.gso_size = mss;
+
+    GSO::Segmenter seg;
+    ASSERT_TRUE(seg.init(super, hdr));
+    std::vector<BufferAllocated> segs;
+    while (true)
+      {
+	BufferAllocated b(2048, 0);
+	if (!seg.next(b))
+	  break;
+	segs.push_back(std::move(b));
+      }
+    ASSERT_EQ(segs.size(), 6u);
+    for (size_t i = 0; i < segs.size(); ++i)
+      {
+	const BufferAllocated& s = segs[i];
+	ASSERT_TRUE(tcp_csum_ok(s)) << i;
+	GSO::TCPLayout l;
+	ASSERT_TRUE(l.parse(s.c_data(), s.size()));
+	const TCPHeader *th = (const TCPHeader *)(s.c_data() + l.iphl);
+	ASSERT_EQ(ntohl(th->seq), 5000 + i * mss);
+	ASSERT_EQ(s.size() - l.hl(), i < 5 ? mss : 300u);
+	ASSERT_EQ(bool(th->flags & GSO::TCP_PSH), i == 5);
+	if (!ipv6)
+	  {
+	    ASSERT_EQ(ntohs(((const IPv4Header *)s.c_data())->id), 1000 + i);
+	  }
+      }
+
+    // coalesce them back into the original super-packet
+    BufferAllocated out(GSO::MAX_PACKET, 0);
+    GSO::Coalescer gro(out);
+    ASSERT_TRUE(gro.start(segs[0]));
+    for (size_t i = 1; i < segs.size(); ++i)
+      ASSERT_TRUE(gro.append(segs[i])) << i;
+    const GSO::VirtioNetHdr h = gro.finish();
+    ASSERT_EQ(gro.count(), segs.size());
+    ASSERT_EQ(out.size(), super.size());
+    ASSERT_EQ(h.gso_size, mss);
+    ASSERT_EQ(h.gso_type, hdr.gso_type);
+    ASSERT_EQ(h.flags, GSO::VirtioNetHdr::F_NEEDS_CSUM);
+
+    // completing the partial checksum as the kernel would gives
+    // back the original packet
+    ASSERT_TRUE(GSO::complete_csum(out, h));
+    ASSERT_TRUE(tcp_csum_ok(out));
+    ASSERT_EQ(std::memcmp(out.c_data(), super.c_data(), super.size()), 0);
+  }
+
+  TEST(gso, roundtrip_ipv4)
+  {
+    roundtrip(false);
+  }
+
+  TEST(gso, roundtrip_ipv6)
+  {
+    roundtrip(true);
+  }
+
+  TEST(gso, coalesce_boundaries)
+  {
+    BufferAllocated out(GSO::MAX_PACKET, 0);
+    GSO::Coalescer gro(out);
+
+    BufferAllocated a = make_tcp(false, 100, 1000, GSO::TCP_ACK);
+    BufferAllocated gap = make_tcp(false, 1200, 1000, GSO::TCP_ACK);
+    BufferAllocated bigger = make_tcp(false, 1100, 1200, GSO::TCP_ACK);
+    BufferAllocated shorter = make_tcp(false, 1100, 500, GSO::TCP_ACK);
+    BufferAllocated after_short = make_tcp(false, 1600, 500, GSO::TCP_ACK);
+    BufferAllocated fin = make_tcp(false, 100, 1000, GSO::TCP_ACK|GSO::TCP_FIN);
+
+    ASSERT_FALSE(gro.start(fin));
+
+    ASSERT_TRUE(gro.start(a));
+    ASSERT_FALSE(gro.append(gap));
+    ASSERT_FALSE(gro.append(bigger));
+    ASSERT_TRUE(gro.append(shorter));
+    ASSERT_FALSE(gro.append(after_short));
+    ASSERT_EQ(gro.count(), 2u);
+  }
+
+  TEST(gso, complete_csum)
+  {
+    BufferAllocated pkt = make_tcp(false, 1, 333, GSO::TCP_ACK);
+    const std::vector<std::uint8_t> orig(pkt.c_data(), pkt.c_data() + pkt.size());
+
+    // leave only the pseudo-header sum in the checksum field
+    GSO::TCPLayout l;
+    l.parse(pkt.c_data(), pkt.size());
+    const std::uint16_t partial = IPChecksum::fold(GSO::pseudo_header_sum(pkt.c_data(), l, pkt.size() - l.iphl));
+    std::memcpy(pkt.data() + l.iphl + GSO::TCP_CHECK_OFFSET, &partial, 2);
+
+    GSO::VirtioNetHdr hdr = {};
+    hdr.flags = GSO::VirtioNetHdr::F_NEEDS_CSUM;
+    hdr.csum_start = std::uint16_t(l.iphl);
+    hdr.csum_offset = GSO::TCP_CHECK_OFFSET;
+    ASSERT_TRUE(GSO::complete_csum(pkt, hdr));
+    ASSERT_EQ(std::memcmp(pkt.c_data(), orig.data(), orig.size()), 0);
+  }
+}
@@ -0,0 +1,139 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/http/request.hpp>
+#include <openvpn/http/reply.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  template <typename PARSER, typename STATE>
+  static typename PARSER::status parse(PARSER& parser, STATE& obj, const std::string& text)
+  {
+    typename PARSER::status status = PARSER::pending;
+    for (const char c : text)
+      {
+	status = parser.consume(obj, c);
+	if (status != PARSER::pending)
+	  break;
+      }
+    return status;
+  }
+
+  static const std::string request_text =
+    "GET /metrics HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection: keep-alive \r\n"
+    "X-Long: first\r\n"
+    "  second\r\n"
+    "x-dup: 1\r\n"
+    "X-Dup: 2\r\n"
+    "Content-Length: 42\r\n"
+    "\r\n";
+
+  TEST(HTTPHeaders, views_match_list)
+  {
+    HTTP::RequestParser parser;
+    HTTP::Request list;
+    ASSERT_EQ(parse(parser, list, request_text), HTTP::RequestParser::success);
+
+    HTTP::Request views;
+    parser.reset();
+    parser.set_views(true);
+    ASSERT_EQ(parse(parser, views, request_text), HTTP::RequestParser::success);
+    EXPECT_TRUE(views.headers.empty());
+    EXPECT_EQ(views.method, "GET");
+    EXPECT_EQ(views.uri, "/metrics");
+
+    ASSERT_EQ(views.header_block.size(), list.headers.size());
+    for (size_t i = 0; i < list.headers.size(); ++i)
+      {
+	EXPECT_EQ(views.header_block.name(i).to_string(), list.headers[i].name);
+	EXPECT_EQ(views.header_block.value(i).to_string(), list.headers[i].value);
+      }
+
+    const HTTP::HeaderBlock& hb = views.header_block;
+    EXPECT_TRUE(hb.get_value("HOST").equals("localhost"));
+    EXPECT_TRUE(hb.get_value_trim("connection").equals("keep-alive"));
+    EXPECT_EQ(hb.get_value("x-long").to_string(), list.headers.get_value("x-long"));
+    EXPECT_TRUE(hb.get_value("x-dup").equals("1"));
+    EXPECT_TRUE(hb.get_value("content-length").equals("42"));
+    EXPECT_EQ(hb.find("missing"), -1);
+    EXPECT_TRUE(hb.get_value("missing").empty());
+  }
+
+  TEST(HTTPHeaders, reply_views)
+  {
+    HTTP::ReplyParser parser;
+    parser.set_views(true);
+    HTTP::Reply reply;
+    ASSERT_EQ(parse(parser, reply, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n"),
+	      HTTP::ReplyParser::success);
+    EXPECT_EQ(reply.status_code, 200);
+    EXPECT_TRUE(reply.header_block.get_value("transfer-encoding").iequals("CHUNKED"));
+    EXPECT_TRUE(reply.header_block.get_value("content-type").equals("text/plain"));
+  }
+
+  // storage is reused by further messages of the same size or smaller
+  TEST(HTTPHeaders, reuse)
+  {
+    HTTP::RequestParser parser;
+    parser.set_views(true);
+    HTTP::Request req;
+    ASSERT_EQ(parse(parser, req, request_text), HTTP::RequestParser::success);
+    const char *data = req.header_block.name(0).data;
+
+    req.reset();
+    parser.reset();
+    ASSERT_EQ(parse(parser, req, request_text), HTTP::RequestParser::success);
+    EXPECT_EQ(req.header_block.name(0).data, data);
+    EXPECT_TRUE(req.header_block.get_value("host").equals("localhost"));
+  }
+
+  // more headers than hash index slots
+  TEST(HTTPHeaders, many)
+  {
+    std::string text = "GET / HTTP/1.1\r\n";
+    for (int i = 0; i < 100; ++i)
+      text += "H" + std::to_string(i) + ": " + std::to_string(i * 2) + "\r\n";
+    text += "\r\n";
+
+    for (const bool views : {false, true})
+      {
+	HTTP::RequestParser parser;
+	parser.set_views(views);
+	HTTP::Request req;
+	ASSERT_EQ(parse(parser, req, text), HTTP::RequestParser::success);
+	if (views)
+	  {
+	    EXPECT_EQ(req.header_block.size(), 100u);
+	    EXPECT_TRUE(req.header_block.get_value("h99").equals("198"));
+	    EXPECT_TRUE(req.header_block.get_value("H0").equals("0"));
+	  }
+	else
+	  EXPECT_EQ(req.headers.get_value("h99"), "198");
+      }
+  }
+}
@@ -0,0 +1,264 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <thread>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openvpn/ws/httpserv.hpp>
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/common/file.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const char *ka_port = "19126";
+  static const std::string ka_file = "/tmp/test_httpkeepalive.bin";
+  static const size_t ka_file_size = 300000;
+
+  // "/file" is ka_file, anything else "hello <uri>"
+  class KeepaliveClient : public WS::Server::Listener::Client
+  {
+  public:
+    KeepaliveClient(WS::Server::Listener::Client::Initializer& ci)
+      : WS::Server::Listener::Client(ci)
+    {
+    }
+
+  private:
+    virtual void http_request_received() override
+    {
+      WS::Server::ContentInfo ci;
+      ci.http_status = HTTP::Status::OK;
+      ci.type = "application/octet-stream";
+      ci.keepalive = keepalive_request();
+      if (request().uri == "/file")
+	{
+	  ci.file_fd = ::open(ka_file.c_str(), O_RDONLY);
+	  ci.file_offset = 0;
+	  ci.length = ka_file_size;
+	}
+      else
+	{
+	  body = buf_from_string("hello " + request().uri);
+	  ci.length = body->size();
+	}
+      generate_reply_headers(ci);
+    }
+
+    virtual BufferPtr http_content_out() override
+    {
+      return std::move(body);
+    }
+
+    BufferPtr body;
+  };
+
+  struct KeepaliveFactory : public WS::Server::Listener::Client::Factory
+  {
+    virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+    {
+      return new KeepaliveClient(ci);
+    }
+  };
+
+  class HTTPKeepalive : public testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      std::string data;
+      for (size_t i = 0; i < ka_file_size; ++i)
+	data.push_back(char(i % 251));
+      write_string(ka_file, data);
+    }
+
+    void TearDown() override
+    {
+      if (listener)
+	openvpn_io::post(io_context, [this]() { listener->stop(); });
+      if (thread.joinable())
+	thread.join();
+      ::unlink(ka_file.c_str());
+    }
+
+    void start(const WS::Server::Config::Ptr& sconf)
+    {
+      sconf->frame = frame_init_simple(2048);
+      sconf->stats.reset(new SessionStats());
+      Listen::Item li;
+      li.addr = "127.0.0.1";
+      li.port = ka_port;
+      li.proto = Protocol(Protocol::TCPv4);
+      li.ssl = Listen::Item::SSLOff;
+      li.n_threads = 1;
+      listener.reset(new WS::Server::Listener(io_context, sconf, li, new KeepaliveFactory()));
+      listener->start();
+      thread = std::thread([this]() { io_context.run(); });
+    }
+
+    static int connect_server()
+    {
+      const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+      struct timeval tv = { 5, 0 };
+      ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      struct sockaddr_in sa = {};
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(std::atoi(ka_port));
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if (::connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	{
+	  ::close(fd);
+	  return -1;
+	}
+      return fd;
+    }
+
+    static void send_str(const int fd, const std::string& str)
+    {
+      ASSERT_EQ(::send(fd, str.data(), str.length(), 0), ssize_t(str.length()));
+    }
+
+    static std::string get(const std::string& uri)
+    {
+      return "GET " + uri + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    }
+
+    // Read one reply, returning its body, or "EOF" if the server
+    // closed the connection first.
+    static std::string read_reply(const int fd)
+    {
+      std::string head;
+      char c;
+      while (head.find("\r\n\r\n") == std::string::npos)
+	{
+	  if (::recv(fd, &c, 1, 0) != 1)
+	    return "EOF";
+	  head.push_back(c);
+	}
+      const size_t cl = head.find("Content-Length: ");
+      if (cl == std::string::npos)
+	return "";
+      std::string body(std::atoi(head.c_str() + cl + 16), '\0');
+      size_t got = 0;
+      while (got < body.size())
+	{
+	  const ssize_t n = ::recv(fd, &body[got], body.size() - got, 0);
+	  if (n <= 0)
+	    return "EOF";
+	  got += n;
+	}
+      return body;
+    }
+
+    openvpn_io::io_context io_context{1};
+    WS::Server::Listener::Ptr listener;
+    std::thread thread;
+  };
+
+  TEST_F(HTTPKeepalive, pipelined)
+  {
+    start(new WS::Server::Config());
+    const int fd = connect_server();
+    ASSERT_GE(fd, 0);
+    send_str(fd, get("/a") + get("/b") + get("/c"));
+    EXPECT_EQ(read_reply(fd), "hello /a");
+    EXPECT_EQ(read_reply(fd), "hello /b");
+    EXPECT_EQ(read_reply(fd), "hello /c");
+    send_str(fd, get("/d"));
+    EXPECT_EQ(read_reply(fd), "hello /d");
+    ::close(fd);
+  }
+
+  TEST_F(HTTPKeepalive, file_content)
+  {
+    start(new WS::Server::Config());
+    const int fd = connect_server();
+    ASSERT_GE(fd, 0);
+    send_str(fd, get("/file") + get("/after"));
+    const std::string body = read_reply(fd);
+    ASSERT_EQ(body.size(), ka_file_size);
+    bool ok = true;
+    for (size_t i = 0; i < body.size(); ++i)
+      if (body[i] != char(i % 251))
+	ok = false;
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(read_reply(fd), "hello /after");
+    ::close(fd);
+  }
+
+  TEST_F(HTTPKeepalive, idle_timeout_and_max_requests)
+  {
+    WS::Server::Config::Ptr sconf = new WS::Server::Config();
+    sconf->keepalive_timeout = 1;
+    sconf->keepalive_max_requests = 2;
+    start(sconf);
+
+    const int fd = connect_server();
+    ASSERT_GE(fd, 0);
+    send_str(fd, get("/a"));
+    EXPECT_EQ(read_reply(fd), "hello /a");
+    EXPECT_EQ(read_reply(fd), "EOF"); // idle
+    ::close(fd);
+
+    const int fd2 = connect_server();
+    ASSERT_GE(fd2, 0);
+    send_str(fd2, get("/a") + get("/b") + get("/c"));
+    EXPECT_EQ(read_reply(fd2), "hello /a");
+    EXPECT_EQ(read_reply(fd2), "hello /b");
+    EXPECT_EQ(read_reply(fd2), "EOF");
+    ::close(fd2);
+  }
+
+  TEST_F(HTTPKeepalive, tcp_max_defer)
+  {
+    WS::Server::Config::Ptr sconf = new WS::Server::Config();
+    sconf->tcp_max = 1;
+    sconf->tcp_max_defer = true;
+    sconf->accept_batch = 4;
+    start(sconf);
+
+    const int fd = connect_server();
+    ASSERT_GE(fd, 0);
+    send_str(fd, get("/a"));
+    EXPECT_EQ(read_reply(fd), "hello /a");
+
+    // waits in the backlog rather than being closed
+    const int fd2 = connect_server();
+    ASSERT_GE(fd2, 0);
+    send_str(fd2, get("/b"));
+    struct timeval tv = { 0, 300000 };
+    ::setsockopt(fd2, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    EXPECT_EQ(read_reply(fd2), "EOF");
+
+    ::close(fd);
+    tv.tv_sec = 5;
+    ::setsockopt(fd2, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    EXPECT_EQ(read_reply(fd2), "hello /b");
+    ::close(fd2);
+  }
+}
@@ -0,0 +1,173 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/ws/httpserv.hpp>
+#include <openvpn/ws/httpcliset.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const char *pool_port = "19124";
+
+  class EchoClient : public WS::Server::Listener::Client
+  {
+  public:
+    EchoClient(WS::Server::Listener::Client::Initializer& ci, unsigned int& n_requests_arg)
+      : WS::Server::Listener::Client(ci),
+	n_requests(n_requests_arg)
+    {
+    }
+
+  private:
+    virtual void http_request_received() override
+    {
+      ++n_requests;
+      out = buf_from_string(request().uri);
+      WS::Server::ContentInfo ci;
+      ci.http_status = HTTP::Status::OK;
+      ci.type = "text/plain";
+      ci.length = out->size();
+      ci.keepalive = keepalive_request();
+      generate_reply_headers(ci);
+    }
+
+    virtual void http_content_in(BufferAllocated& buf) override
+    {
+    }
+
+    virtual BufferPtr http_content_out() override
+    {
+      BufferPtr ret;
+      ret.swap(out);
+      return ret;
+    }
+
+    virtual bool http_out_eof() override
+    {
+      return true;
+    }
+
+    BufferPtr out;
+    unsigned int& n_requests;
+  };
+
+  struct EchoFactory : public WS::Server::Listener::Client::Factory
+  {
+    virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+    {
+      ++n_connections;
+      return new EchoClient(ci, n_requests);
+    }
+
+    unsigned int n_connections = 0;
+    unsigned int n_requests = 0;
+  };
+
+  static WS::ClientSet::TransactionSet::Ptr make_ts(const WS::Client::Config::Ptr& config,
+						    const WS::ClientSet::Pool::Ptr& pool,
+						    const std::string& uri)
+  {
+    WS::ClientSet::TransactionSet::Ptr ts = new WS::ClientSet::TransactionSet;
+    ts->http_config = config;
+    ts->host.host = "127.0.0.1";
+    ts->host.port = pool_port;
+    ts->debug_level = 0;
+    ts->pool = pool;
+    std::unique_ptr<WS::ClientSet::Transaction> t(new WS::ClientSet::Transaction);
+    t->req.method = "GET";
+    t->req.uri = uri;
+    ts->transactions.push_back(std::move(t));
+    return ts;
+  }
+
+  TEST(HTTPPool, Reuse)
+  {
+    openvpn_io::io_context io_context(1);
+
+    WS::Server::Config::Ptr sconf = new WS::Server::Config();
+    sconf->frame = frame_init_simple(2048);
+    sconf->stats.reset(new SessionStats());
+    Listen::Item li;
+    li.addr = "127.0.0.1";
+    li.port = pool_port;
+    li.proto = Protocol(Protocol::TCPv4);
+    li.ssl = Listen::Item::SSLOff;
+    li.n_threads = 1;
+    RCPtr<EchoFactory> factory = new EchoFactory();
+    WS::Server::Listener::Ptr listener = new WS::Server::Listener(io_context, sconf, li, factory);
+    listener->start();
+
+    WS::Client::Config::Ptr cconf = new WS::Client::Config();
+    cconf->frame = frame_init_simple(2048);
+    cconf->stats.reset(new SessionStats());
+    cconf->connect_timeout = 5;
+    cconf->general_timeout = 5;
+
+    WS::ClientSet::Pool::Config pc;
+    pc.idle_timeout = Time::Duration::seconds(5);
+    WS::ClientSet::Pool::Ptr pool = new WS::ClientSet::Pool(io_context, pc);
+    WS::ClientSet::Ptr cs = new WS::ClientSet(io_context);
+
+    std::vector<std::string> results;
+    std::function<void(int)> next = [&](const int i) {
+      WS::ClientSet::TransactionSet::Ptr ts = make_ts(cconf, pool, "/req" + std::to_string(i));
+      ts->completion = [&, i](WS::ClientSet::TransactionSet& ts) {
+	results.push_back(ts.first_transaction().content_in_string());
+	if (i < 3)
+	  next(i + 1);
+	else
+	  {
+	    pool->stop();
+	    listener->stop();
+	  }
+      };
+      cs->new_request(ts);
+    };
+    next(1);
+    io_context.run();
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0], "/req1");
+    EXPECT_EQ(results[2], "/req3");
+    EXPECT_EQ(factory->n_requests, 3u);
+    EXPECT_EQ(factory->n_connections, 1u);
+    EXPECT_EQ(pool->n_reused(), 2u);
+    EXPECT_EQ(pool->n_idle(), 0u);
+  }
+
+  TEST(HTTPPool, MaxIdlePerHost)
+  {
+    openvpn_io::io_context io_context(1);
+    WS::ClientSet::Pool::Config pc;
+    pc.max_idle_per_host = 1;
+    WS::ClientSet::Pool::Ptr pool = new WS::ClientSet::Pool(io_context, pc);
+
+    // connections that aren't alive are closed rather than pooled
+    WS::Client::Config::Ptr cconf = new WS::Client::Config();
+    cconf->frame = frame_init_simple(2048);
+    pool->release("k", new WS::ClientSet::HTTPDelegate(io_context, cconf, nullptr));
+    EXPECT_EQ(pool->n_idle(), 0u);
+    EXPECT_FALSE(pool->acquire("k"));
+  }
+}
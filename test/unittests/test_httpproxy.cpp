@@ -0,0 +1,252 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <vector>
+#include <string>
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/crypto/digestapi.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/transport/client/httpcli.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // A blocking HTTP proxy that plays one scripted exchange per
+  // connection, in its own thread.
+  class ProxyServer
+  {
+  public:
+    enum Step {
+      DEMAND_BASIC,   // reply 407 and close
+      CONNECT,        // reply 200, then exchange one packet
+      CONNECT_LATE,   // read one packet before replying 200
+      BAD_GATEWAY,    // read one packet, then reply 502
+    };
+
+    ProxyServer()
+      : acceptor(io_context, openvpn_io::ip::tcp::endpoint(openvpn_io::ip::make_address("127.0.0.1"), 0))
+    {
+    }
+
+    std::string port() const
+    {
+      return std::to_string(acceptor.local_endpoint().port());
+    }
+
+    void run(const std::vector<Step>& steps)
+    {
+      for (const Step step : steps)
+	{
+	  openvpn_io::ip::tcp::socket socket(io_context);
+	  acceptor.accept(socket);
+	  requests.push_back(read_request(socket));
+	  switch (step)
+	    {
+	    case DEMAND_BASIC:
+	      write(socket, "HTTP/1.1 407 Proxy Authentication Required\r\n"
+		    "Proxy-Authenticate: Basic realm=\"test\"\r\n"
+		    "Content-Length: 0\r\n\r\n");
+	      break;
+	    case CONNECT:
+	      write(socket, "HTTP/1.1 200 Connection established\r\n\r\n");
+	      packets.push_back(read_packet(socket));
+	      write(socket, packet("reply"));
+	      break;
+	    case CONNECT_LATE:
+	      packets.push_back(read_packet(socket));
+	      write(socket, "HTTP/1.1 200 Connection established\r\n\r\n" + packet("reply"));
+	      break;
+	    case BAD_GATEWAY:
+	      packets.push_back(read_packet(socket));
+	      write(socket, "HTTP/1.1 502 Bad Gateway\r\n\r\n");
+	      break;
+	    }
+	  socket.shutdown(openvpn_io::ip::tcp::socket::shutdown_send);
+	  char c;
+	  openvpn_io::error_code ec;
+	  while (socket.read_some(openvpn_io::buffer(&c, 1), ec))
+	    ;
+	}
+    }
+
+    std::vector<std::string> requests;
+    std::vector<std::string> packets;
+
+  private:
+    static std::string read_request(openvpn_io::ip::tcp::socket& socket)
+    {
+      std::string req;
+      char c;
+      while (req.find("\r\n\r\n") == std::string::npos)
+	{
+	  openvpn_io::read(socket, openvpn_io::buffer(&c, 1));
+	  req += c;
+	}
+      return req;
+    }
+
+    static std::string read_packet(openvpn_io::ip::tcp::socket& socket)
+    {
+      unsigned char len[2];
+      openvpn_io::read(socket, openvpn_io::buffer(len, 2));
+      std::string pkt((len[0] << 8) | len[1], '\0');
+      openvpn_io::read(socket, openvpn_io::buffer(&pkt[0], pkt.length()));
+      return pkt;
+    }
+
+    static std::string packet(const std::string& payload)
+    {
+      std::string ret(2, '\0');
+      ret[0] = char(payload.length() >> 8);
+      ret[1] = char(payload.length() & 0xff);
+      return ret + payload;
+    }
+
+    static void write(openvpn_io::ip::tcp::socket& socket, const std::string& str)
+    {
+      openvpn_io::write(socket, openvpn_io::buffer(str));
+    }
+
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::tcp::acceptor acceptor;
+  };
+
+  class ProxyParent : public TransportClientParent
+  {
+  public:
+    void transport_connecting() override
+    {
+      ++n_connecting;
+      BufferAllocated buf(64, 0);
+      buf.init_headroom(16);
+      buf_write_string(buf, "hello");
+      client->transport_send(buf);
+    }
+
+    void transport_recv(BufferAllocated& buf) override
+    {
+      received.push_back(buf_to_string(buf));
+      client->stop();
+    }
+
+    void transport_error(const Error::Type fatal_err, const std::string& err_text) override
+    {
+      error = err_text;
+      client->stop();
+    }
+
+    void proxy_error(const Error::Type fatal_err, const std::string& err_text) override
+    {
+      error = err_text;
+      proxy_fatal = fatal_err;
+    }
+
+    void transport_needs_send() override {}
+    bool transport_is_openvpn_protocol() override { return true; }
+    void transport_pre_resolve() override {}
+    void transport_wait_proxy() override {}
+    void transport_wait() override {}
+    bool is_keepalive_enabled() const override { return false; }
+    void disable_keepalive(unsigned int& keepalive_ping,
+			   unsigned int& keepalive_timeout) override {}
+
+    TransportClient::Ptr client;
+    unsigned int n_connecting = 0;
+    std::vector<std::string> received;
+    std::string error;
+    Error::Type proxy_fatal = Error::SUCCESS;
+  };
+
+  static void run_client(HTTPProxyTransport::ClientConfig::Ptr config, ProxyParent& parent)
+  {
+    openvpn_io::io_context io_context;
+    parent.client = config->new_transport_client_obj(io_context, &parent);
+    parent.client->transport_start();
+    io_context.run();
+    parent.client.reset();
+  }
+
+  TEST(httpproxy, cached_auth_and_optimistic_send)
+  {
+    base64_init_static();
+    ProxyServer server;
+    std::thread server_thread([&server]() {
+	server.run({ ProxyServer::DEMAND_BASIC,
+		     ProxyServer::CONNECT,
+		     ProxyServer::CONNECT_LATE,
+		     ProxyServer::BAD_GATEWAY });
+      });
+
+    HTTPProxyTransport::Options::Ptr opt(new HTTPProxyTransport::Options());
+    opt->set_proxy_server("127.0.0.1", server.port());
+    opt->username = "user";
+    opt->password = "pass";
+    opt->allow_cleartext_auth = true;
+    opt->optimistic_send = true;
+
+    HTTPProxyTransport::ClientConfig::Ptr config = HTTPProxyTransport::ClientConfig::new_obj();
+    config->remote_list.reset(new RemoteList("vpn.example.com", "1194", Protocol(Protocol::TCP), "test"));
+    config->frame = frame_init(true, 1500, 1024, false);
+    config->stats.reset(new SessionStats());
+    config->http_proxy_options = opt;
+    config->rng.reset(new SSLLib::RandomAPI(false));
+    config->digest_factory.reset(new CryptoDigestFactory<SSLLib::CryptoAPI>());
+
+    // first connection learns the method on a 407
+    {
+      ProxyParent parent;
+      run_client(config, parent);
+      ASSERT_EQ(std::vector<std::string>{"reply"}, parent.received) << parent.error;
+      ASSERT_EQ(1u, parent.n_connecting);
+    }
+
+    // reconnect: credentials up front, packet before the reply
+    {
+      ProxyParent parent;
+      run_client(config, parent);
+      ASSERT_EQ(std::vector<std::string>{"reply"}, parent.received) << parent.error;
+      ASSERT_EQ(1u, parent.n_connecting);
+    }
+
+    // a refused optimistic CONNECT is a nonfatal error and turns it off
+    {
+      ProxyParent parent;
+      run_client(config, parent);
+      ASSERT_TRUE(parent.received.empty());
+      ASSERT_EQ(Error::UNDEF, parent.proxy_fatal) << parent.error;
+      ASSERT_FALSE(config->proxy_cache.connect_ok);
+    }
+    server_thread.join();
+
+    const std::string auth = "Proxy-Authorization: Basic " + base64->encode(std::string("user:pass")) + "\r\n";
+    ASSERT_EQ(4u, server.requests.size());
+    ASSERT_EQ(0u, server.requests[0].find("CONNECT vpn.example.com:1194 HTTP/1.0\r\n"));
+    ASSERT_EQ(std::string::npos, server.requests[0].find("Proxy-Authorization"));
+    for (size_t i = 1; i < 4; ++i)
+      ASSERT_NE(std::string::npos, server.requests[i].find(auth)) << server.requests[i];
+    ASSERT_EQ(std::vector<std::string>(3, "hello"), server.packets);
+  }
+}
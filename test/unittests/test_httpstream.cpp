@@ -0,0 +1,160 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/ws/httpserv.hpp>
+#include <openvpn/ws/httpcliset.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const char *stream_port = "19125";
+
+  enum {
+    N_CHUNKS = 64,
+    CHUNK_SIZE = 1000,
+  };
+
+  // replies with N_CHUNKS chunks of CHUNK_SIZE bytes, byte i of
+  // the body is (i % 251)
+  class ChunkedClient : public WS::Server::Listener::Client
+  {
+  public:
+    ChunkedClient(WS::Server::Listener::Client::Initializer& ci)
+      : WS::Server::Listener::Client(ci)
+    {
+    }
+
+  private:
+    virtual void http_request_received() override
+    {
+      WS::Server::ContentInfo ci;
+      ci.http_status = HTTP::Status::OK;
+      ci.type = "application/octet-stream";
+      ci.length = WS::Server::ContentInfo::CHUNKED;
+      generate_reply_headers(ci);
+    }
+
+    virtual void http_content_in(BufferAllocated& buf) override
+    {
+    }
+
+    virtual BufferPtr http_content_out() override
+    {
+      if (n_sent == N_CHUNKS)
+	return BufferPtr();
+      BufferPtr buf = new BufferAllocated(CHUNK_SIZE, 0);
+      for (size_t i = 0; i < CHUNK_SIZE; ++i)
+	buf->push_back((unsigned char)((n_sent * CHUNK_SIZE + i) % 251));
+      ++n_sent;
+      return buf;
+    }
+
+    virtual bool http_out_eof() override
+    {
+      return true;
+    }
+
+    unsigned int n_sent = 0;
+  };
+
+  struct ChunkedFactory : public WS::Server::Listener::Client::Factory
+  {
+    virtual WS::Server::Listener::Client::Ptr new_client(WS::Server::Listener::Client::Initializer& ci) override
+    {
+      return new ChunkedClient(ci);
+    }
+  };
+
+  TEST(HTTPStream, ContentInHandler)
+  {
+    openvpn_io::io_context io_context(1);
+
+    WS::Server::Config::Ptr sconf = new WS::Server::Config();
+    sconf->frame = frame_init_simple(2048);
+    sconf->stats.reset(new SessionStats());
+    Listen::Item li;
+    li.addr = "127.0.0.1";
+    li.port = stream_port;
+    li.proto = Protocol(Protocol::TCPv4);
+    li.ssl = Listen::Item::SSLOff;
+    li.n_threads = 1;
+    WS::Server::Listener::Ptr listener = new WS::Server::Listener(io_context, sconf, li, new ChunkedFactory());
+    listener->start();
+
+    WS::Client::Config::Ptr cconf = new WS::Client::Config();
+    cconf->frame = frame_init_simple(2048);
+    cconf->stats.reset(new SessionStats());
+    cconf->connect_timeout = 5;
+    cconf->general_timeout = 5;
+
+    WS::ClientSet::TransactionSet::Ptr ts = new WS::ClientSet::TransactionSet;
+    ts->http_config = cconf;
+    ts->host.host = "127.0.0.1";
+    ts->host.port = stream_port;
+    ts->debug_level = 0;
+
+    size_t received = 0;
+    size_t max_buf = 0;
+    unsigned int n_calls = 0;
+    unsigned int n_paused = 0;
+    bool content_ok = true;
+
+    std::unique_ptr<WS::ClientSet::Transaction> t(new WS::ClientSet::Transaction);
+    t->req.method = "GET";
+    t->req.uri = "/crl";
+    t->content_in_handler = [&](WS::ClientSet::Transaction& t, BufferAllocated& buf) {
+      for (size_t i = 0; i < buf.size(); ++i)
+	if (buf[i] != (received + i) % 251)
+	  content_ok = false;
+      received += buf.size();
+      max_buf = std::max(max_buf, buf.size());
+      if (++n_calls % 4)
+	return true;
+
+      // apply back-pressure, resume later
+      ++n_paused;
+      openvpn_io::post(io_context, [ts]() {
+	  ts->resume_content_in();
+	});
+      return false;
+    };
+    ts->transactions.push_back(std::move(t));
+
+    ts->completion = [&](WS::ClientSet::TransactionSet& ts) {
+      listener->stop();
+    };
+
+    WS::ClientSet::Ptr cs = new WS::ClientSet(io_context);
+    cs->new_request(ts);
+    io_context.run();
+
+    WS::ClientSet::Transaction& tr = ts->first_transaction();
+    EXPECT_TRUE(tr.http_status_success());
+    EXPECT_EQ(received, size_t(N_CHUNKS * CHUNK_SIZE));
+    EXPECT_TRUE(content_ok);
+    EXPECT_LE(max_buf, size_t(2048));
+    EXPECT_GT(n_paused, 0u);
+    EXPECT_EQ(tr.content_in.join_size(), 0u);
+  }
+}
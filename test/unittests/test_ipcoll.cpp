@@ -0,0 +1,98 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include "test_common.h"
+
+#include <openvpn/dco/ipcoll.hpp>
+#ifdef __linux__
+#include <openvpn/tun/linux/client/sitnl.hpp>
+#endif
+
+using namespace openvpn;
+
+namespace unittests
+{
+  namespace {
+    IP::RouteList system_routes()
+    {
+      IP::RouteList rl;
+      rl.emplace_back("192.168.1.0/24");
+      rl.emplace_back("10.20.0.0/16");
+      rl.emplace_back("fd00:1::/64");
+      return rl;
+    }
+  }
+
+  TEST(ipcoll, system_overlap)
+  {
+    IPCollisionDetect::Ptr det(new IPCollisionDetect(system_routes()));
+    ActionList remove;
+    EXPECT_THROW(det->add("192.168.1.7", 0, remove), IPCollisionDetectBase::ip_collision);
+    EXPECT_THROW(det->add("10.20.30.0/24", 0, remove), IPCollisionDetectBase::ip_collision);
+    EXPECT_THROW(det->add("10.0.0.0/8", 0, remove), IPCollisionDetectBase::ip_collision);
+    EXPECT_THROW(det->add("fd00:1::2", 0, remove), IPCollisionDetectBase::ip_collision);
+    det->add("10.8.0.1", 0, remove);
+    det->add("10.21.0.0/16", 0, remove);
+    det->add("fd00:2::1", 0, remove);
+    EXPECT_EQ(3u, det->size());
+  }
+
+  TEST(ipcoll, units)
+  {
+    IPCollisionDetect::Ptr det(new IPCollisionDetect(IP::RouteList()));
+    ActionList remove0, remove1;
+    det->add("10.8.0.1", 0, remove0);
+    det->add("10.8.0.1", 0, remove0); // same unit again
+    EXPECT_EQ(1u, remove0.size());
+    EXPECT_THROW(det->add("10.8.0.1", 1, remove1), IPCollisionDetectBase::ip_collision);
+
+    // released by the late remove actions of unit 0
+    remove0.execute_log();
+    EXPECT_EQ(0u, det->size());
+    det->add("10.8.0.1", 1, remove1);
+    EXPECT_EQ(1u, det->size());
+  }
+
+  TEST(ipcoll, many_routes)
+  {
+    IP::RouteList rl;
+    for (unsigned int i = 0; i < 4096; ++i)
+      rl.emplace_back(IP::Addr::from_ipv4(IPv4::Addr::from_uint32(0x0a000000u + (i << 8))), 24);
+    IPCollisionDetect::Ptr det(new IPCollisionDetect(rl));
+    ActionList remove;
+    EXPECT_THROW(det->add("10.0.200.5", 0, remove), IPCollisionDetectBase::ip_collision);
+    det->add("10.16.0.5", 0, remove);
+  }
+
+#ifdef __linux__
+  TEST(ipcoll, netlink_dump)
+  {
+    IP::RouteList rl;
+    if (TunNetlink::SITNL::net_system_routes(rl) < 0)
+      GTEST_SKIP() << "netlink not available";
+    IPCollisionDetect::Ptr det(new IPCollisionDetect(rl));
+    ActionList remove;
+    EXPECT_THROW(det->add("127.0.0.1", 0, remove), IPCollisionDetectBase::ip_collision);
+  }
+#endif
+}
@@ -0,0 +1,143 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/common/jsonflat.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const std::string identity = R"({
+  "devpayProductCodes" : null,
+  "marketplaceProductCodes" : [ "abcd1234" ],
+  "privateIp" : "10.0.0.12",
+  "version" : "2017-09-30",
+  "instanceId" : "i-0123456789abcdef0",
+  "billingProducts" : null,
+  "pendingTime" : "2019-01-01T00:00:00Z",
+  "nested" : { "a" : [1, 2.5e3, {"b": "\u00e9"}], "c" : {} },
+  "region" : "us-east-1",
+  "count" : 42,
+  "negative" : -7,
+  "big" : 18446744073709551615,
+  "ratio" : 0.5,
+  "enabled" : true,
+  "disabled" : false
+})";
+
+  TEST(jsonflat, scalars)
+  {
+    const json::FlatObject root(identity, "identity-document");
+    EXPECT_EQ(json::get_string(root, "region", "identity-document"), "us-east-1");
+    EXPECT_EQ(json::get_string(root, "instanceId"), "i-0123456789abcdef0");
+    EXPECT_EQ(json::get_string(root, std::string("privateIp")), "10.0.0.12");
+    EXPECT_EQ(json::get_string_optional(root, "missing", "def"), "def");
+    EXPECT_EQ(json::get_string_optional(root, "billingProducts", "null"), "null");
+    EXPECT_EQ(json::get_int(root, "count"), 42);
+    EXPECT_EQ(json::get_int(root, "negative"), -7);
+    EXPECT_EQ(json::get_uint(root, "count"), 42u);
+    EXPECT_EQ(json::get_uint64(root, "big"), 18446744073709551615ull);
+    EXPECT_EQ(json::get_int_optional(root, "missing", 3), 3);
+    EXPECT_TRUE(json::get_bool(root, "enabled"));
+    EXPECT_FALSE(json::get_bool(root, "disabled"));
+    EXPECT_TRUE(json::get_bool_optional(root, "count"));
+    EXPECT_TRUE(json::get_bool_optional(root, "missing", true));
+    EXPECT_TRUE(json::exists(root, "nested"));
+    EXPECT_FALSE(json::exists(root, "devpayProductCodes"));
+    EXPECT_FALSE(json::string_exists(root, "count"));
+    EXPECT_TRUE(json::string_exists(root, "version"));
+  }
+
+  static std::string error_of(const std::function<void()>& f)
+  {
+    try {
+      f();
+    }
+    catch (const json::json_parse& e)
+      {
+	return e.what();
+      }
+    return "";
+  }
+
+  TEST(jsonflat, errors)
+  {
+    const json::FlatObject root(identity);
+    EXPECT_EQ(error_of([&]() { json::get_string(root, "absent", "doc"); }), "json_parse: string doc.absent is missing");
+    EXPECT_EQ(error_of([&]() { json::get_string(root, "count", "doc"); }), "json_parse: string doc.count is of incorrect type");
+    EXPECT_EQ(error_of([&]() { json::get_int(root, "ratio"); }), "json_parse: int ratio is of incorrect type");
+    EXPECT_EQ(error_of([&]() { json::get_int(root, "big"); }), "json_parse: int big is of incorrect type");
+    EXPECT_EQ(error_of([&]() { json::get_uint(root, "negative"); }), "json_parse: uint negative is of incorrect type");
+    EXPECT_EQ(error_of([&]() { json::get_bool(root, "nested"); }), "json_parse: bool nested is of incorrect type");
+
+    const char *bad[] = {
+      "",
+      "[1]",
+      "{\"a\":1,}",
+      "{\"a\":1} x",
+      "{\"a\":01}",
+      "{\"a\":-}",
+      "{\"a\":tru}",
+      "{\"a\":\"\\x\"}",
+      "{\"a\":\"\\ud800\"}",
+      "{\"a\":\"tab\there\"}",
+      "{\"a\":[1,2}",
+      "{\"a\":{\"b\" 1}}",
+      "{\"a\":\"unterminated}",
+    };
+    for (const char *text : bad)
+      EXPECT_THROW(json::FlatObject(text, "bad"), json::json_parse) << text;
+
+    std::string deep = "{\"a\":";
+    for (int i = 0; i < 100; ++i)
+      deep += '[';
+    for (int i = 0; i < 100; ++i)
+      deep += ']';
+    deep += '}';
+    EXPECT_THROW(json::FlatObject(deep, "deep"), json::json_parse);
+  }
+
+  TEST(jsonflat, escapes)
+  {
+    const json::FlatObject root(R"({"s":"a\"b\\c\/d\n\t\u0041\u00e9\u20ac\ud83d\ude00","k\u0031":"v","e":""})");
+    EXPECT_EQ(json::get_string(root, "s"), "a\"b\\c/d\n\tA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    EXPECT_EQ(json::get_string(root, "k1"), "v");
+    EXPECT_EQ(json::get_string(root, "e"), "");
+  }
+
+  TEST(jsonflat, duplicate_and_move)
+  {
+    json::FlatObject a(std::string("{\"k\":\"first\",\"k\":\"last\"}"));
+    EXPECT_EQ(json::get_string(a, "k"), "last");
+    EXPECT_EQ(a.size(), 2u);
+
+    // short text lives inside the string object itself
+    json::FlatObject b(std::move(a));
+    EXPECT_EQ(json::get_string(b, "k"), "last");
+    json::FlatObject c;
+    c = std::move(b);
+    EXPECT_EQ(json::get_string(c, "k"), "last");
+    EXPECT_EQ(json::FlatObject("{}").size(), 0u);
+  }
+}
@@ -0,0 +1,290 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <string>
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509v3.h>
+
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/openssl/ssl/sslctx.hpp>
+#include <openvpn/linux/ktls.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // A bare OpenSSL server over memory BIOs, so that the test can
+  // pin the protocol version and cipher suite.
+  class KTLSServer
+  {
+  public:
+    KTLSServer(const int version, const char *suite)
+    {
+      ::EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+      EVP_PKEY_keygen_init(pctx);
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+      EVP_PKEY_keygen(pctx, &key);
+      EVP_PKEY_CTX_free(pctx);
+
+      cert = X509_new();
+      ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+      X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+      X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+      X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (const unsigned char *)"server", -1, -1, 0);
+      X509_set_issuer_name(cert, X509_get_subject_name(cert));
+      X509_set_pubkey(cert, key);
+      X509_sign(cert, key, EVP_sha256());
+
+      ctx = SSL_CTX_new(TLS_server_method());
+      SSL_CTX_use_certificate(ctx, cert);
+      SSL_CTX_use_PrivateKey(ctx, key);
+      SSL_CTX_set_min_proto_version(ctx, version);
+      SSL_CTX_set_max_proto_version(ctx, version);
+      if (version == TLS1_3_VERSION)
+	SSL_CTX_set_ciphersuites(ctx, suite);
+      else
+	SSL_CTX_set_cipher_list(ctx, suite);
+      SSL_CTX_set_num_tickets(ctx, 0);
+
+      ssl = SSL_new(ctx);
+      SSL_set_bio(ssl, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+      SSL_set_accept_state(ssl);
+    }
+
+    ~KTLSServer()
+    {
+      SSL_free(ssl);
+      SSL_CTX_free(ctx);
+      X509_free(cert);
+      EVP_PKEY_free(key);
+    }
+
+    bool handshake(SSLAPI& client)
+    {
+      unsigned char buf[64];
+      client.start_handshake();
+      for (int i = 0; i < 16 && !SSL_is_init_finished(ssl); ++i)
+	{
+	  while (client.read_ciphertext_ready())
+	    {
+	      BufferPtr b = client.read_ciphertext();
+	      BIO_write(SSL_get_rbio(ssl), b->c_data(), int(b->size()));
+	    }
+	  SSL_do_handshake(ssl);
+	  write_to(client);
+	  client.read_cleartext(buf, sizeof(buf));
+	}
+      return SSL_is_init_finished(ssl);
+    }
+
+    // pending output of the server, to the client
+    void write_to(SSLAPI& client)
+    {
+      char buf[4096];
+      int n;
+      while ((n = BIO_read(SSL_get_wbio(ssl), buf, sizeof(buf))) > 0)
+	client.write_ciphertext_unbuffered((const unsigned char *)buf, n);
+    }
+
+    std::string read(const std::string& record)
+    {
+      BIO_write(SSL_get_rbio(ssl), record.data(), int(record.length()));
+      char buf[256];
+      const int n = SSL_read(ssl, buf, sizeof(buf));
+      return n > 0 ? std::string(buf, n) : std::string();
+    }
+
+  private:
+    ::EVP_PKEY* key = nullptr;
+    ::X509* cert = nullptr;
+    ::SSL_CTX* ctx = nullptr;
+    ::SSL* ssl = nullptr;
+  };
+
+  static SSLFactoryAPI::Ptr client_factory(const unsigned int flags)
+  {
+    static const bool initialized = (OpenSSLContext::SSL::init_static(), true);
+    (void)initialized;
+    OpenSSLContext::Config::Ptr config = new OpenSSLContext::Config();
+    config->set_mode(Mode(Mode::CLIENT));
+    config->set_local_cert_enabled(false);
+    config->set_flags(SSLConst::NO_VERIFY_PEER | flags);
+    config->set_frame(frame_init_simple(2048));
+    return config->new_factory();
+  }
+
+  // Decrypt one application data record with the exported keys,
+  // independently of OpenSSL's record layer.
+  static std::string open_record(const SSLAPI::TrafficKeys& keys, const std::string& record)
+  {
+    const unsigned char *rec = (const unsigned char *)record.data();
+    const size_t explicit_len = keys.version == TLS1_2_VERSION ? 8 : 0;
+    if (record.length() < 5 + explicit_len + 16 || rec[0] != 0x17)
+      return "bad record";
+    const size_t ct_len = record.length() - 5 - explicit_len - 16;
+
+    unsigned char nonce[12];
+    unsigned char aad[13];
+    size_t aad_len;
+    if (keys.version == TLS1_2_VERSION)
+      {
+	std::memcpy(nonce, keys.iv, 4);
+	std::memcpy(nonce + 4, rec + 5, 8);
+	for (size_t i = 0; i < 8; ++i)
+	  aad[i] = (unsigned char)(keys.rec_seq >> (56 - 8 * i));
+	aad[8] = rec[0];
+	aad[9] = rec[1];
+	aad[10] = rec[2];
+	aad[11] = (unsigned char)(ct_len >> 8);
+	aad[12] = (unsigned char)ct_len;
+	aad_len = 13;
+      }
+    else
+      {
+	std::memcpy(nonce, keys.iv, 12);
+	for (size_t i = 0; i < 8; ++i)
+	  nonce[4 + i] ^= (unsigned char)(keys.rec_seq >> (56 - 8 * i));
+	std::memcpy(aad, rec, 5);
+	aad_len = 5;
+      }
+
+    const EVP_CIPHER* cipher = keys.cipher == SSLAPI::TrafficKeys::AES_128_GCM ? EVP_aes_128_gcm() : EVP_aes_256_gcm();
+    const unsigned char *ct = rec + 5 + explicit_len;
+    std::string pt(ct_len, '\0');
+    int len = 0;
+    EVP_CIPHER_CTX* c = EVP_CIPHER_CTX_new();
+    bool ok = EVP_DecryptInit_ex(c, cipher, nullptr, keys.key, nonce)
+      && EVP_DecryptUpdate(c, nullptr, &len, aad, int(aad_len))
+      && EVP_DecryptUpdate(c, (unsigned char *)&pt[0], &len, ct, int(ct_len))
+      && EVP_CIPHER_CTX_ctrl(c, EVP_CTRL_GCM_SET_TAG, 16, (void *)(ct + ct_len))
+      && EVP_DecryptFinal_ex(c, nullptr, &len) > 0;
+    EVP_CIPHER_CTX_free(c);
+    if (!ok)
+      return "auth failed";
+
+    // TLS 1.3 inner plaintext ends with the real content type
+    if (keys.version == TLS1_3_VERSION)
+      {
+	while (!pt.empty() && pt.back() == 0)
+	  pt.pop_back();
+	if (pt.empty() || pt.back() != 0x17)
+	  return "bad inner type";
+	pt.pop_back();
+      }
+    return pt;
+  }
+
+  static void check_export(const int version, const char *suite,
+			   const SSLAPI::TrafficKeys::Cipher cipher)
+  {
+    KTLSServer server(version, suite);
+    SSLAPI::Ptr client = client_factory(SSLConst::ENABLE_KTLS_TX)->ssl();
+    SSLAPI::TrafficKeys keys;
+    ASSERT_FALSE(client->export_tx_keys(keys)); // handshake not started
+    ASSERT_TRUE(server.handshake(*client));
+    ASSERT_TRUE(client->export_tx_keys(keys));
+    ASSERT_EQ((unsigned int)version, keys.version);
+    ASSERT_EQ(cipher, keys.cipher);
+
+    // the next record from the SSL object is sealed with the
+    // exported keys at the exported sequence number
+    const std::string msg = "GET / HTTP/1.1\r\n\r\n";
+    ASSERT_EQ(ssize_t(msg.length()), client->write_cleartext_unbuffered(msg.data(), msg.length()));
+    std::string record;
+    while (client->read_ciphertext_ready())
+      record += buf_to_string(*client->read_ciphertext());
+    ASSERT_EQ(msg, open_record(keys, record));
+    ASSERT_EQ(msg, server.read(record));
+
+    // after a userspace record, the sequence number is unknown
+    ASSERT_FALSE(client->export_tx_keys(keys));
+  }
+
+  TEST(ktls, export_tls12_aes128)
+  {
+    check_export(TLS1_2_VERSION, "ECDHE-ECDSA-AES128-GCM-SHA256", SSLAPI::TrafficKeys::AES_128_GCM);
+  }
+
+  TEST(ktls, export_tls12_aes256)
+  {
+    check_export(TLS1_2_VERSION, "ECDHE-ECDSA-AES256-GCM-SHA384", SSLAPI::TrafficKeys::AES_256_GCM);
+  }
+
+  TEST(ktls, export_tls13_aes128)
+  {
+    check_export(TLS1_3_VERSION, "TLS_AES_128_GCM_SHA256", SSLAPI::TrafficKeys::AES_128_GCM);
+  }
+
+  TEST(ktls, export_tls13_aes256)
+  {
+    check_export(TLS1_3_VERSION, "TLS_AES_256_GCM_SHA384", SSLAPI::TrafficKeys::AES_256_GCM);
+  }
+
+  TEST(ktls, export_needs_flag)
+  {
+    KTLSServer server(TLS1_3_VERSION, "TLS_AES_128_GCM_SHA256");
+    SSLAPI::Ptr client = client_factory(0)->ssl();
+    ASSERT_TRUE(server.handshake(*client));
+    SSLAPI::TrafficKeys keys;
+    ASSERT_FALSE(client->export_tx_keys(keys));
+  }
+
+  // Installing keys either works or leaves a plain socket behind,
+  // depending on the kernel.
+  TEST(ktls, enable_tx)
+  {
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::tcp::acceptor acceptor(io_context, openvpn_io::ip::tcp::endpoint(openvpn_io::ip::make_address("127.0.0.1"), 0));
+    openvpn_io::ip::tcp::socket client(io_context);
+    openvpn_io::ip::tcp::socket server(io_context);
+    client.connect(acceptor.local_endpoint());
+    acceptor.accept(server);
+
+    SSLAPI::TrafficKeys keys;
+    keys.version = TLS1_3_VERSION;
+    keys.cipher = SSLAPI::TrafficKeys::AES_128_GCM;
+    keys.key_len = 16;
+    std::memset(keys.key, 1, sizeof(keys.key));
+    std::memset(keys.iv, 2, sizeof(keys.iv));
+
+    std::string err;
+    const bool ok = KTLS::enable_tx(client.native_handle(), keys, &err);
+    if (!ok)
+      {
+	OPENVPN_LOG("kTLS not available: " << err);
+	ASSERT_FALSE(err.empty());
+      }
+
+    // with kernel TLS, the cleartext written arrives as one record
+    const std::string msg = "hello";
+    openvpn_io::write(client, openvpn_io::buffer(msg));
+    std::string in(ok ? 5 + msg.length() + 1 + 16 : msg.length(), '\0');
+    openvpn_io::read(server, openvpn_io::buffer(&in[0], in.length()));
+    if (ok)
+      ASSERT_EQ(msg, open_record(keys, in));
+    else
+      ASSERT_EQ(msg, in);
+  }
+}
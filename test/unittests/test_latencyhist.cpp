@@ -0,0 +1,86 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/log/sessionstats.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(latency, histogram_buckets)
+  {
+    // bucket bounds are contiguous and values land within their bucket
+    for (unsigned int b = 0; b + 1 < LatencyHistogram::N_BUCKETS; ++b)
+      {
+	const std::uint64_t lo = LatencyHistogram::lower_bound(b);
+	const std::uint64_t hi = LatencyHistogram::lower_bound(b + 1) - 1;
+	ASSERT_EQ(b, LatencyHistogram::bucket(lo));
+	ASSERT_EQ(b, LatencyHistogram::bucket(hi));
+	if (lo >= LatencyHistogram::SUB_COUNT)
+	  {
+	    ASSERT_LE(hi - lo, lo / LatencyHistogram::SUB_COUNT);
+	  }
+      }
+    ASSERT_EQ(unsigned(LatencyHistogram::N_BUCKETS - 1), LatencyHistogram::bucket(~std::uint64_t(0)));
+  }
+
+  TEST(latency, histogram_percentiles)
+  {
+    LatencyHistogram h;
+    ASSERT_EQ(0U, h.percentile(0.99));
+
+    // 1..1000 us
+    for (std::uint64_t i = 1; i <= 1000; ++i)
+      h.record(i * 1000);
+    ASSERT_EQ(1000U, h.count());
+    ASSERT_EQ(1000000U, h.max());
+    ASSERT_EQ(500500U, h.mean());
+
+    const std::uint64_t p50 = h.percentile(0.5);
+    ASSERT_GE(p50, 500000U);
+    ASSERT_LE(p50, 500000U + 500000U / LatencyHistogram::SUB_COUNT);
+    const std::uint64_t p99 = h.percentile(0.99);
+    ASSERT_GE(p99, 990000U);
+    ASSERT_LE(p99, 1000000U);
+    ASSERT_EQ(1000000U, h.percentile(1.0));
+
+    // a tail outlier shows up at the top percentile only
+    h.record(50000000, 1);
+    ASSERT_LE(h.percentile(0.99), 1000000U + 1000000U / LatencyHistogram::SUB_COUNT);
+    ASSERT_EQ(50000000U, h.percentile(1.0));
+  }
+
+  TEST(latency, session_stats_opt_in)
+  {
+    SessionStats stats;
+    ASSERT_FALSE(stats.latency_enabled());
+    stats.record_latency(SessionStats::LAT_HANDSHAKE, 1000);
+    ASSERT_EQ(nullptr, stats.latency(SessionStats::LAT_HANDSHAKE));
+
+    stats.enable_latency();
+    stats.record_latency(SessionStats::LAT_NET_TO_TUN, 1000, 3);
+    ASSERT_EQ(3U, stats.latency(SessionStats::LAT_NET_TO_TUN)->count());
+    ASSERT_EQ(0U, stats.latency(SessionStats::LAT_TUN_TO_NET)->count());
+    ASSERT_STREQ("HANDSHAKE", SessionStats::latency_name(SessionStats::LAT_HANDSHAKE));
+  }
+}
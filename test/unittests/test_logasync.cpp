@@ -0,0 +1,137 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <openvpn/log/logasync.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct CollectSink : public Log::AsyncQueue::Sink
+  {
+    typedef RCPtr<CollectSink> Ptr;
+
+    virtual void write(const std::string& line, const std::time_t) override
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      lines.push_back(line);
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> lines;
+  };
+
+  TEST(logasync, multi_producer)
+  {
+    CollectSink::Ptr sink(new CollectSink());
+    const int n_threads = 4;
+    const int n_lines = 5000;
+    size_t dropped;
+    {
+      Log::AsyncQueue queue(sink, 256);
+      std::vector<std::thread> threads;
+      for (int t = 0; t < n_threads; ++t)
+	threads.emplace_back([&queue, t]() {
+	  for (int i = 0; i < n_lines; ++i)
+	    queue.push(std::to_string(t) + ' ' + std::to_string(i));
+	});
+      for (auto& th : threads)
+	th.join();
+      queue.stop();
+      dropped = queue.n_dropped();
+    }
+
+    // lines from each thread arrive in order, and every line
+    // is either delivered or counted as dropped
+    std::vector<int> last(n_threads, -1);
+    size_t delivered = 0;
+    for (const auto& line : sink->lines)
+      {
+	if (line.compare(0, 10, "ASYNC LOG:") == 0)
+	  continue;
+	int t, i;
+	ASSERT_EQ(std::sscanf(line.c_str(), "%d %d", &t, &i), 2) << line;
+	ASSERT_GT(i, last[t]) << line;
+	last[t] = i;
+	++delivered;
+      }
+    ASSERT_EQ(delivered + dropped, size_t(n_threads * n_lines));
+  }
+
+  TEST(logasync, long_lines)
+  {
+    CollectSink::Ptr sink(new CollectSink());
+    std::string lines[3];
+    lines[0] = std::string(Log::AsyncQueue::RECORD_SIZE, 'a');
+    lines[1] = std::string(Log::AsyncQueue::RECORD_SIZE * 3 + 7, 'b');
+    lines[2] = "short\n";
+    {
+      Log::AsyncQueue queue(sink, 16);
+      for (const auto& l : lines)
+	ASSERT_TRUE(queue.push(l));
+
+      // longer than half the ring, truncated
+      ASSERT_TRUE(queue.push(std::string(Log::AsyncQueue::RECORD_SIZE * 20, 'c')));
+    }
+    ASSERT_EQ(sink->lines.size(), 4u);
+    for (int i = 0; i < 3; ++i)
+      ASSERT_EQ(sink->lines[i], lines[i]);
+    ASSERT_EQ(sink->lines[3], std::string(Log::AsyncQueue::RECORD_SIZE * 8, 'c'));
+  }
+
+  TEST(logasync, overflow)
+  {
+    // a sink that blocks until released backs up the ring
+    struct BlockingSink : public CollectSink
+    {
+      virtual void write(const std::string& line, const std::time_t t) override
+      {
+	while (!release)
+	  std::this_thread::yield();
+	CollectSink::write(line, t);
+      }
+
+      std::atomic<bool> release{false};
+    };
+
+    RCPtr<BlockingSink> sink(new BlockingSink());
+    size_t accepted = 0;
+    {
+      Log::AsyncQueue queue(sink, 8);
+      for (int i = 0; i < 100; ++i)
+	accepted += queue.push("x\n");
+      ASSERT_LE(accepted, 9u); // ring plus the one being written
+      ASSERT_EQ(queue.n_dropped(), 100 - accepted);
+      sink->release = true;
+    }
+
+    // the drop count is reported once, in order with the lines
+    ASSERT_EQ(sink->lines.size(), accepted + 1);
+    const std::string notice = "ASYNC LOG: " + std::to_string(100 - accepted) + " lines dropped\n";
+    ASSERT_EQ(std::count(sink->lines.begin(), sink->lines.end(), notice), 1);
+  }
+}
@@ -0,0 +1,182 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <thread>
+#include <vector>
+
+#include <openvpn/server/manevents.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct Collect : public ManEvents::Sink
+  {
+    virtual void man_events(std::vector<ManEvents::Event>& events) override
+    {
+      batches.push_back(events.size());
+      for (auto& ev : events)
+	received.push_back(std::move(ev));
+    }
+
+    std::vector<size_t> batches;
+    std::vector<ManEvents::Event> received;
+  };
+
+  static ManEvents::Event stats_event(const std::uint64_t id, const bool final = false)
+  {
+    ManEvents::Event ev(ManEvents::Event::STATS, id);
+    ev.stats.rx_bytes = id;
+    ev.final = final;
+    return ev;
+  }
+
+  TEST(manevents, batch_by_count)
+  {
+    openvpn_io::io_context session, man;
+    Collect sink;
+    ManEvents::Config config;
+    config.batch_size = 4;
+    config.flush_ms = 1000;
+    ManEvents::Bus bus(man, &sink, config);
+    ManEvents::Bus::Producer::Ptr producer(new ManEvents::Bus::Producer(bus, session));
+
+    for (std::uint64_t i = 0; i < 10; ++i)
+      producer->post(stats_event(i));
+    EXPECT_EQ(2u, producer->queued());
+    man.run();
+    EXPECT_EQ(std::vector<size_t>({4, 4}), sink.batches);
+
+    producer->stop();
+    man.restart();
+    man.run();
+    EXPECT_EQ(std::vector<size_t>({4, 4, 2}), sink.batches);
+    ASSERT_EQ(10u, sink.received.size());
+    for (std::uint64_t i = 0; i < 10; ++i)
+      EXPECT_EQ(i, sink.received[i].stats.rx_bytes);
+    EXPECT_EQ(10u, bus.n_events());
+    EXPECT_EQ(3u, bus.n_batches());
+    EXPECT_EQ(0u, bus.in_flight());
+    session.run(); // cancelled timer
+  }
+
+  TEST(manevents, batch_by_time)
+  {
+    openvpn_io::io_context session, man;
+    Collect sink;
+    ManEvents::Config config;
+    config.flush_ms = 5;
+    ManEvents::Bus bus(man, &sink, config);
+    ManEvents::Bus::Producer::Ptr producer(new ManEvents::Bus::Producer(bus, session));
+
+    producer->post(ManEvents::Event(ManEvents::Event::CONNECT, 1));
+    producer->post(stats_event(1));
+    producer->post(ManEvents::Event(ManEvents::Event::DISCONNECT, 1));
+    session.run(); // the flush timer
+    EXPECT_EQ(0u, producer->queued());
+    man.run();
+    EXPECT_EQ(std::vector<size_t>({3}), sink.batches);
+    EXPECT_EQ(ManEvents::Event::DISCONNECT, sink.received.back().type);
+  }
+
+  // With the management thread not keeping up, producers hold their
+  // events and drop only periodic ones beyond max_queue.
+  TEST(manevents, back_pressure)
+  {
+    openvpn_io::io_context session, man;
+    Collect sink;
+    ManEvents::Config config;
+    config.batch_size = 2;
+    config.max_batches = 2;
+    config.max_queue = 4;
+    ManEvents::Bus bus(man, &sink, config);
+    ManEvents::Bus::Producer::Ptr producer(new ManEvents::Bus::Producer(bus, session));
+
+    for (std::uint64_t i = 0; i < 4; ++i)
+      producer->post(stats_event(i));
+    EXPECT_EQ(2u, bus.in_flight());
+    EXPECT_EQ(0u, producer->queued());
+
+    for (std::uint64_t i = 4; i < 10; ++i)
+      producer->post(stats_event(i));
+    EXPECT_EQ(4u, producer->queued());
+    EXPECT_EQ(2u, bus.n_dropped());
+    EXPECT_GT(bus.n_deferred(), 0u);
+
+    // kept however full the queue is
+    producer->post(stats_event(100, true));
+    producer->post(ManEvents::Event(ManEvents::Event::DISCONNECT, 100));
+    EXPECT_EQ(6u, producer->queued());
+    EXPECT_EQ(2u, bus.n_dropped());
+
+    // the management thread catches up, the next flush goes through
+    man.run();
+    EXPECT_EQ(0u, bus.in_flight());
+    producer->stop();
+    man.restart();
+    man.run();
+    ASSERT_EQ(10u, sink.received.size());
+    EXPECT_EQ(7u, sink.received[7].stats.rx_bytes); // 8 and 9 were dropped
+    EXPECT_TRUE(sink.received[8].final);
+    EXPECT_EQ(ManEvents::Event::DISCONNECT, sink.received[9].type);
+    session.run();
+  }
+
+  TEST(manevents, threads)
+  {
+    openvpn_io::io_context man;
+    Collect sink;
+    ManEvents::Config config;
+    config.batch_size = 16;
+    config.flush_ms = 1;
+    config.max_queue = 1000000;
+    ManEvents::Bus bus(man, &sink, config);
+    auto work = openvpn_io::make_work_guard(man);
+    std::thread man_thread([&man]() { man.run(); });
+
+    const int n_threads = 4;
+    const std::uint64_t n_events = 10000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n_threads; ++t)
+      threads.emplace_back([&bus, t, n_events]() {
+	  openvpn_io::io_context session;
+	  ManEvents::Bus::Producer::Ptr producer(new ManEvents::Bus::Producer(bus, session));
+	  for (std::uint64_t i = 0; i < n_events; ++i)
+	    {
+	      producer->post(stats_event(t * n_events + i));
+	      session.poll();
+	    }
+	  producer->stop();
+	  session.run();
+	});
+    for (auto& t : threads)
+      t.join();
+    work.reset();
+    man_thread.join();
+
+    EXPECT_EQ(n_threads * n_events, sink.received.size() + bus.n_dropped());
+    EXPECT_EQ(0u, bus.n_dropped());
+    EXPECT_LT(sink.batches.size(), sink.received.size());
+  }
+}
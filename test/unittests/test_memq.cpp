@@ -0,0 +1,92 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <string>
+
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/frame/memq_dgram.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static void write_str(MemQDgram& q, const std::string& s)
+  {
+    q.write((const unsigned char *)s.data(), s.length());
+  }
+
+  static std::string read_str(MemQDgram& q)
+  {
+    unsigned char buf[256];
+    return std::string((const char *)buf, q.read(buf, sizeof(buf)));
+  }
+
+  TEST(memq, dgram_boundaries)
+  {
+    MemQDgram q(frame_init_simple(2048));
+    write_str(q, "first");
+    write_str(q, "second");
+    ASSERT_EQ(2u, q.size());
+    ASSERT_EQ(11u, q.total_length());
+    ASSERT_EQ(5u, q.pending());
+    ASSERT_EQ("first", read_str(q));
+    ASSERT_EQ("second", read_str(q));
+    ASSERT_TRUE(q.empty());
+    ASSERT_EQ(0u, q.total_length());
+  }
+
+  // a datagram taken whole keeps the frame headroom for headers
+  TEST(memq, dgram_headroom)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    MemQDgram q(frame);
+    write_str(q, "payload");
+    BufferPtr b = q.read_buf();
+    ASSERT_EQ("payload", buf_to_string(*b));
+    ASSERT_GE(b->offset(), 256u);
+    b->prepend((const unsigned char *)"hdr", 3);
+    ASSERT_EQ("hdrpayload", buf_to_string(*b));
+  }
+
+  // drained buffers are reused for later writes
+  TEST(memq, dgram_recycle)
+  {
+    MemQDgram q(frame_init_simple(2048));
+    write_str(q, "one");
+    const Buffer* first = q.peek().get();
+    ASSERT_EQ("one", read_str(q));
+    write_str(q, "two");
+    ASSERT_EQ(first, q.peek().get());
+    ASSERT_EQ("two", read_str(q));
+
+    // a buffer still referenced elsewhere isn't reused
+    write_str(q, "three");
+    BufferPtr held = q.peek();
+    ASSERT_EQ("three", read_str(q));
+    write_str(q, "four");
+    ASSERT_NE(held.get(), q.peek().get());
+    ASSERT_EQ("four", read_str(q));
+  }
+}
@@ -0,0 +1,253 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <openvpn/asio/asiowork.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/common/mpscring.hpp>
+#include <openvpn/common/mpschandoff.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(mpscring, capacity)
+  {
+    MPSCRing<int> r(5);
+    ASSERT_EQ(8u, r.capacity());
+    ASSERT_TRUE(r.empty());
+    ASSERT_THROW(MPSCRing<int>(0), MPSCRing<int>::mpsc_ring_capacity);
+  }
+
+  TEST(mpscring, full_and_wrap)
+  {
+    MPSCRing<int> r(4);
+    int v[6] = { 0, 1, 2, 3, 4, 5 };
+
+    // only the free run is taken, the rest is left alone
+    ASSERT_EQ(4u, r.push(v, 6));
+    ASSERT_EQ(0u, r.push(v + 4, 2));
+    ASSERT_FALSE(r.push(9));
+
+    int out[8];
+    ASSERT_EQ(3u, r.pop(out, 3));
+    ASSERT_EQ(0, out[0]);
+    ASSERT_EQ(2, out[2]);
+
+    // wraps around the end of the cell array
+    ASSERT_EQ(3u, r.push(v + 3, 3));
+    ASSERT_EQ(4u, r.pop(out, 8));
+    ASSERT_EQ(3, out[0]);
+    ASSERT_EQ(3, out[1]);
+    ASSERT_EQ(5, out[3]);
+    ASSERT_TRUE(r.empty());
+    ASSERT_EQ(0u, r.pop(out, 8));
+  }
+
+  TEST(mpscring, batches_from_many_producers)
+  {
+    enum {
+      N_PRODUCERS = 4,
+      N_ITEMS = 20000,
+      BATCH = 7,
+    };
+    MPSCRing<unsigned int> r(256);
+    std::vector<std::thread> producers;
+    for (unsigned int p = 0; p < N_PRODUCERS; ++p)
+      producers.emplace_back([&r, p]() {
+	  unsigned int i = 0;
+	  while (i < N_ITEMS)
+	    {
+	      unsigned int b[BATCH];
+	      unsigned int n = 0;
+	      for (; n < BATCH && i + n < N_ITEMS; ++n)
+		b[n] = p * N_ITEMS + i + n;
+	      const size_t k = r.push(b, n);
+	      if (!k)
+		std::this_thread::yield();
+	      i += unsigned(k);
+	    }
+	});
+
+    // each producer's items come out in order, none lost
+    std::vector<unsigned int> next(N_PRODUCERS, 0);
+    unsigned int n = 0;
+    while (n < N_PRODUCERS * N_ITEMS)
+      {
+	unsigned int v[32];
+	const size_t k = r.pop(v, 32);
+	if (!k)
+	  {
+	    std::this_thread::yield();
+	    continue;
+	  }
+	for (size_t i = 0; i < k; ++i)
+	  {
+	    const unsigned int p = v[i] / N_ITEMS;
+	    ASSERT_LT(p, unsigned(N_PRODUCERS));
+	    ASSERT_EQ(next[p], v[i] % N_ITEMS);
+	    ++next[p];
+	  }
+	n += unsigned(k);
+      }
+    for (auto& t : producers)
+      t.join();
+    ASSERT_TRUE(r.empty());
+  }
+
+  struct Counter : public MPSCHandoff<BufferAllocated>::Recv
+  {
+    void handoff_recv(BufferAllocated* v, const size_t n) override
+    {
+      for (size_t i = 0; i < n; ++i)
+	bytes += v[i].size();
+      packets += n;
+      ++batches;
+    }
+
+    size_t packets = 0;
+    size_t bytes = 0;
+    size_t batches = 0;
+  };
+
+  static BufferAllocated packet(const size_t size)
+  {
+    BufferAllocated buf(size, 0);
+    buf.set_size(size);
+    return buf;
+  }
+
+  TEST(mpschandoff, wakeup_per_batch)
+  {
+    openvpn_io::io_context io;
+    MPSCHandoff<BufferAllocated> h(io, 64, nullptr);
+    Counter c;
+    h.start(&c);
+
+    // handed over before the consumer runs: one wakeup for all
+    BufferAllocated b[10];
+    for (auto& buf : b)
+      buf = packet(100);
+    ASSERT_EQ(10u, h.push(b, 10));
+    for (int i = 0; i < 5; ++i)
+      ASSERT_TRUE(h.push(packet(1)));
+    ASSERT_EQ(1u, h.n_wakeups());
+
+    io.poll();
+    ASSERT_EQ(15u, c.packets);
+    ASSERT_EQ(1005u, c.bytes);
+    ASSERT_EQ(1u, c.batches);
+
+    // the next push after a drain wakes the consumer again
+    ASSERT_TRUE(h.push(packet(1)));
+    ASSERT_EQ(2u, h.n_wakeups());
+    io.poll();
+    ASSERT_EQ(16u, c.packets);
+    h.stop();
+  }
+
+  TEST(mpschandoff, overflow_counted_in_stats)
+  {
+    openvpn_io::io_context io;
+    SessionStats::Ptr stats(new SessionStats());
+    MPSCHandoff<BufferAllocated> h(io, 8, stats);
+    Counter c;
+    h.start(&c);
+
+    BufferAllocated b[12];
+    for (auto& buf : b)
+      buf = packet(10);
+    ASSERT_EQ(8u, h.push(b, 12));
+    ASSERT_FALSE(h.push(packet(10)));
+    ASSERT_EQ(5u, h.n_dropped());
+    ASSERT_EQ(5u, stats->get_stat(SessionStats::HANDOFF_DROPS));
+
+    io.poll();
+    ASSERT_EQ(8u, c.packets);
+    ASSERT_TRUE(h.push(packet(10)));
+    io.poll();
+    ASSERT_EQ(9u, c.packets);
+    h.stop();
+  }
+
+  TEST(mpschandoff, threads)
+  {
+    enum {
+      N_PRODUCERS = 3,
+      N_PACKETS = 5000,
+    };
+    openvpn_io::io_context io;
+    SessionStats::Ptr stats(new SessionStats());
+    MPSCHandoff<BufferAllocated> h(io, 128, stats);
+
+    struct Recv : public Counter
+    {
+      void handoff_recv(BufferAllocated* v, const size_t n) override
+      {
+	Counter::handoff_recv(v, n);
+	done.fetch_add(unsigned(n), std::memory_order_release);
+      }
+
+      std::atomic<unsigned int> done{0};
+    } c;
+
+    std::thread consumer([&]() {
+	AsioWork work(io);
+	h.start(&c);
+	io.run();
+	h.stop();
+      });
+
+    std::vector<std::thread> producers;
+    for (unsigned int p = 0; p < N_PRODUCERS; ++p)
+      producers.emplace_back([&h]() {
+	  for (unsigned int i = 0; i < N_PACKETS; )
+	    {
+	      BufferAllocated b[4];
+	      for (auto& buf : b)
+		buf = packet(1);
+	      h.push(b, 4);
+	      i += 4;
+	      if (i % 64 == 0)
+		std::this_thread::yield();
+	    }
+	});
+    for (auto& t : producers)
+      t.join();
+
+    // every packet was either delivered or counted as dropped
+    const std::uint64_t total = N_PRODUCERS * N_PACKETS;
+    const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (c.done.load(std::memory_order_acquire) + h.n_dropped() < total && std::chrono::steady_clock::now() < until)
+      std::this_thread::yield();
+    io.stop();
+    consumer.join();
+
+    EXPECT_EQ(total, c.packets + h.n_dropped());
+    EXPECT_EQ(h.n_dropped(), stats->get_stat(SessionStats::HANDOFF_DROPS));
+  }
+}
@@ -0,0 +1,127 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/transport/mssfix.hpp>
+#include <openvpn/ip/csum.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const std::uint8_t TCP_ACK = 0x10;
+
+  // TCP packet with an MSS option, checksummed over the TCP
+  // header only (enough to verify the incremental update)
+  static BufferAllocated make_packet(const bool ipv6, const std::uint8_t flags, const std::uint16_t mss)
+  {
+    const size_t iphl = ipv6 ? sizeof(IPv6Header) : sizeof(IPv4Header);
+    const size_t thl = sizeof(TCPHeader) + 4;
+    BufferAllocated buf(iphl + thl, 0);
+    std::uint8_t *p = buf.write_alloc(iphl + thl);
+    std::memset(p, 0, iphl + thl);
+    if (ipv6)
+      {
+	IPv6Header *h = (IPv6Header *)p;
+	h->version_prio = 0x60;
+	h->payload_len = htons(thl);
+	h->nexthdr = IPCommon::TCP;
+      }
+    else
+      {
+	IPv4Header *h = (IPv4Header *)p;
+	h->version_len = IPv4Header::ver_len(4, sizeof(IPv4Header));
+	h->tot_len = htons(iphl + thl);
+	h->protocol = IPCommon::TCP;
+      }
+    TCPHeader *th = (TCPHeader *)(p + iphl);
+    th->doff_res = std::uint8_t((thl / 4) << 4);
+    th->flags = flags;
+    std::uint8_t *opt = (std::uint8_t *)(th + 1);
+    opt[0] = TCPHeader::OPT_MAXSEG;
+    opt[1] = TCPHeader::OPTLEN_MAXSEG;
+    opt[2] = mss >> 8;
+    opt[3] = mss & 0xff;
+    th->check = IPChecksum::checksum(th, thl);
+    return buf;
+  }
+
+  static std::uint16_t get_mss(const Buffer& buf, const bool ipv6)
+  {
+    const std::uint8_t *opt = buf.c_data() + (ipv6 ? sizeof(IPv6Header) : sizeof(IPv4Header)) + sizeof(TCPHeader);
+    return (opt[2] << 8) | opt[3];
+  }
+
+  static bool tcp_csum_ok(const Buffer& buf, const bool ipv6)
+  {
+    const size_t iphl = ipv6 ? sizeof(IPv6Header) : sizeof(IPv4Header);
+    return IPChecksum::checksum(buf.c_data() + iphl, buf.size() - iphl) == 0;
+  }
+
+  TEST(mssfix, clamp)
+  {
+    const MSSFix mf(1400);
+    for (const bool ipv6 : {false, true})
+      {
+	BufferAllocated syn = make_packet(ipv6, TCPHeader::FLAG_SYN, 1460);
+	mf.fix(syn);
+	ASSERT_EQ(get_mss(syn, ipv6), ipv6 ? 1340 : 1360);
+	ASSERT_TRUE(tcp_csum_ok(syn, ipv6));
+
+	// smaller MSS is left alone
+	BufferAllocated small = make_packet(ipv6, TCPHeader::FLAG_SYN|TCP_ACK, 1200);
+	mf.fix(small);
+	ASSERT_EQ(get_mss(small, ipv6), 1200);
+
+	// only SYN packets are touched
+	BufferAllocated ack = make_packet(ipv6, TCP_ACK, 1460);
+	mf.fix(ack);
+	ASSERT_EQ(get_mss(ack, ipv6), 1460);
+      }
+  }
+
+  TEST(mssfix, malformed)
+  {
+    const MSSFix mf(1400);
+    BufferAllocated syn = make_packet(false, TCPHeader::FLAG_SYN, 1460);
+
+    // wrong total length
+    BufferAllocated trunc(syn);
+    trunc.set_size(trunc.size() - 1);
+    mf.fix(trunc);
+    ASSERT_EQ(get_mss(trunc, false), 1460);
+
+    // not TCP
+    BufferAllocated udp(syn);
+    ((IPv4Header *)udp.data())->protocol = IPCommon::UDP;
+    mf.fix(udp);
+    ASSERT_EQ(get_mss(udp, false), 1460);
+
+    // too short for the flags byte
+    BufferAllocated tiny(syn);
+    tiny.set_size(sizeof(IPv4Header) + 2);
+    mf.fix(tiny);
+
+    ASSERT_FALSE(MSSFix().enabled());
+    ASSERT_TRUE(mf.enabled());
+  }
+}
@@ -0,0 +1,163 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include "test_common.h"
+
+#include <openvpn/transport/multipath.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // Answer one round of probes, path i after rtt_ms[i] milliseconds,
+  // or never if rtt_ms[i] is 0.
+  static void probe_round(MultipathScheduler& ms, Time& now, const std::vector<int>& rtt_ms)
+  {
+    for (size_t n = 0; n < ms.size(); ++n)
+      {
+	if (ms.next_event() > now)
+	  now = ms.next_event();
+	const int i = ms.probe(now);
+	if (i < 0)
+	  continue;
+	if (rtt_ms[i])
+	  ms.reply(now + Time::Duration::milliseconds(rtt_ms[i]));
+	else
+	  now += Time::Duration::seconds(2);
+      }
+  }
+
+  static std::vector<size_t> schedule(MultipathScheduler& ms, const int n_packets, const size_t size)
+  {
+    std::vector<size_t> ret(ms.size());
+    for (int i = 0; i < n_packets; ++i)
+      {
+	const int path = ms.select(size);
+	if (path >= 0)
+	  ++ret[path];
+      }
+    return ret;
+  }
+
+  TEST(Multipath, nothing_up)
+  {
+    MultipathScheduler ms(2);
+    EXPECT_EQ(-1, ms.select(1000));
+    EXPECT_EQ(-1, ms.primary());
+    EXPECT_EQ(-1, ms.probe(Time::now()));
+    EXPECT_TRUE(ms.next_event().is_infinite());
+  }
+
+  // until a path is measured, everything goes on the first one up
+  TEST(Multipath, unmeasured)
+  {
+    MultipathScheduler ms(3);
+    ms.set_up(1, true);
+    ms.set_up(2, true);
+    EXPECT_EQ(1, ms.primary());
+    EXPECT_EQ(std::vector<size_t>({ 0, 100, 0 }), schedule(ms, 100, 1000));
+  }
+
+  // bytes are shared in inverse proportion to the round trip time
+  TEST(Multipath, weighted)
+  {
+    Time now = Time::now();
+    MultipathScheduler ms(3);
+    for (size_t i = 0; i < 3; ++i)
+      ms.set_up(i, true);
+    probe_round(ms, now, { 20, 40, 60 });
+    EXPECT_EQ(0, ms.primary());
+    const std::vector<size_t> n = schedule(ms, 1100, 1000);
+    EXPECT_NEAR(600, n[0], 10);
+    EXPECT_NEAR(300, n[1], 10);
+    EXPECT_NEAR(200, n[2], 10);
+  }
+
+  // a path far slower than the best one is kept on standby
+  TEST(Multipath, standby)
+  {
+    Time now = Time::now();
+    MultipathScheduler ms(2);
+    ms.set_up(0, true);
+    ms.set_up(1, true);
+    probe_round(ms, now, { 10, 600 });
+    EXPECT_EQ(std::vector<size_t>({ 100, 0 }), schedule(ms, 100, 1000));
+  }
+
+  // unanswered probes take a path out, answers bring it back,
+  // without a burst to make up for the time it sat out
+  TEST(Multipath, failover)
+  {
+    Time now = Time::now();
+    MultipathScheduler ms(2);
+    ms.set_up(0, true);
+    ms.set_up(1, true);
+    probe_round(ms, now, { 20, 20 });
+    EXPECT_EQ(std::vector<size_t>({ 50, 50 }), schedule(ms, 100, 1000));
+
+    for (int i = 0; i < MultipathScheduler::MAX_FAILURES; ++i)
+      probe_round(ms, now, { 0, 20 });
+    EXPECT_EQ(MultipathScheduler::MAX_FAILURES, int(ms.path(0).failures));
+    EXPECT_EQ(1, ms.primary());
+    EXPECT_EQ(std::vector<size_t>({ 0, 100 }), schedule(ms, 100, 1000));
+
+    // lossy path costs more for a while
+    for (int i = 0; i < 10; ++i)
+      probe_round(ms, now, { 20, 20 });
+    EXPECT_EQ(0u, ms.path(0).failures);
+    const std::vector<size_t> n = schedule(ms, 100, 1000);
+    EXPECT_GT(n[0], 30u);
+    EXPECT_LT(n[0], 50u);
+  }
+
+  TEST(Multipath, path_down)
+  {
+    Time now = Time::now();
+    MultipathScheduler ms(2);
+    ms.set_up(0, true);
+    ms.set_up(1, true);
+    probe_round(ms, now, { 20, 20 });
+    ms.set_up(0, false);
+    EXPECT_EQ(1, ms.primary());
+    EXPECT_EQ(std::vector<size_t>({ 0, 10 }), schedule(ms, 10, 1000));
+  }
+
+  // one probe at a time, every path in turn
+  TEST(Multipath, probe_timing)
+  {
+    Time now = Time::now();
+    MultipathScheduler ms(2);
+    ms.set_up(0, true);
+    ms.set_up(1, true);
+    EXPECT_EQ(0, ms.probe(now));
+    EXPECT_EQ(-1, ms.probe(now));
+    EXPECT_EQ(now + Time::Duration::seconds(2), ms.next_event());
+    ms.reply(now);
+    EXPECT_EQ(1, ms.probe(now));
+    ms.cancel();
+    EXPECT_EQ(0u, ms.path(1).failures);
+    EXPECT_EQ(now + Time::Duration::seconds(1), ms.next_event());
+    EXPECT_EQ(-1, ms.probe(now));
+    EXPECT_EQ(0, ms.probe(ms.next_event()));
+  }
+}
@@ -0,0 +1,138 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include "test_common.h"
+
+#include <thread>
+#include <vector>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/objpool.hpp>
+#include <openvpn/log/openmetrics.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  namespace {
+    struct Obj : public RC<thread_safe_refcount>, public PoolAllocated<Obj, 4>
+    {
+      typedef RCPtr<Obj> Ptr;
+
+      static const char *pool_name()
+      {
+	return "test_obj";
+      }
+
+      unsigned char data[200];
+    };
+
+    struct Derived : public Obj
+    {
+      unsigned char more[100];
+    };
+
+    ObjPool::Snapshot pool()
+    {
+      for (const auto& s : ObjPool::snapshot())
+	if (s.name == "test_obj")
+	  return s;
+      return ObjPool::Snapshot();
+    }
+  }
+
+  TEST(objpool, reuse)
+  {
+    Obj::thread_trim();
+    Obj* a = new Obj();
+    const ObjPool::Snapshot s1 = pool();
+    EXPECT_EQ(1u, s1.live);
+    EXPECT_EQ(0u, s1.cached);
+    delete a;
+    EXPECT_EQ(1u, Obj::thread_cached());
+    EXPECT_EQ(0u, pool().live);
+    EXPECT_EQ(1u, pool().cached);
+
+    Obj* b = new Obj();
+    EXPECT_EQ(static_cast<void*>(a), static_cast<void*>(b));
+    EXPECT_EQ(s1.reused + 1, pool().reused);
+    EXPECT_EQ(s1.heap, pool().heap);
+    EXPECT_EQ(0u, Obj::thread_cached());
+    delete b;
+    Obj::thread_trim();
+    EXPECT_EQ(0u, pool().cached);
+  }
+
+  TEST(objpool, cap)
+  {
+    Obj::thread_trim();
+    std::vector<Obj::Ptr> objs;
+    for (int i = 0; i < 10; ++i)
+      objs.emplace_back(new Obj());
+    EXPECT_EQ(10u, pool().live);
+    objs.clear();
+    EXPECT_EQ(4u, Obj::thread_cached());
+    EXPECT_EQ(4u, pool().cached);
+    Obj::thread_trim();
+  }
+
+  // a derived class is a different size, so it isn't pooled
+  TEST(objpool, derived)
+  {
+    Obj::thread_trim();
+    const ObjPool::Snapshot s1 = pool();
+    Obj::Ptr d(new Derived());
+    EXPECT_EQ(s1.heap + 1, pool().heap);
+    d.reset();
+    EXPECT_EQ(0u, Obj::thread_cached());
+    EXPECT_EQ(0u, pool().live);
+  }
+
+  // a block released on another thread joins that thread's free
+  // list, which is returned to the heap when the thread exits
+  TEST(objpool, cross_thread)
+  {
+    Obj::thread_trim();
+    Obj::Ptr obj(new Obj());
+    std::thread t([&obj]() {
+	obj.reset();
+	EXPECT_EQ(1u, Obj::thread_cached());
+	EXPECT_EQ(1u, pool().cached);
+      });
+    t.join();
+    EXPECT_EQ(0u, Obj::thread_cached());
+    EXPECT_EQ(0u, pool().cached);
+    EXPECT_EQ(0u, pool().live);
+  }
+
+  TEST(objpool, metrics)
+  {
+    Obj::Ptr obj(new Obj());
+    OpenMetrics::Writer w;
+    OpenMetrics::render_pools(w);
+    const std::string out = w.str();
+    EXPECT_NE(std::string::npos, out.find("# TYPE openvpn_pool_objects gauge\n"));
+    EXPECT_NE(std::string::npos, out.find("openvpn_pool_objects{pool=\"test_obj\",state=\"live\"} 1\n"));
+    EXPECT_NE(std::string::npos, out.find("openvpn_pool_allocs_total{pool=\"test_obj\",source=\"heap\"}"));
+  }
+}
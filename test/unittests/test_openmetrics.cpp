@@ -0,0 +1,118 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <sstream>
+
+#include <openvpn/log/openmetrics.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct ErrorStats : public SessionStats
+  {
+    virtual void error(const size_t type, const std::string* text=nullptr) override
+    {
+      if (type < Error::N_ERRORS)
+	++errors[type];
+    }
+
+    virtual count_t error_count(const size_t type) const override
+    {
+      return type < Error::N_ERRORS ? errors[type] : 0;
+    }
+
+    count_t errors[Error::N_ERRORS] = {};
+  };
+
+  static bool has_line(const std::string& text, const std::string& line)
+  {
+    std::istringstream is(text);
+    std::string l;
+    while (std::getline(is, l))
+      if (l == line)
+	return true;
+    return false;
+  }
+
+  TEST(OpenMetrics, Counters)
+  {
+    ErrorStats stats;
+    stats.inc_stat(SessionStats::BYTES_IN, 1234);
+    stats.inc_stat(SessionStats::HANDSHAKES, 2);
+    stats.error(Error::HMAC_ERROR);
+    stats.error(Error::HMAC_ERROR);
+
+    OpenMetrics::Writer w;
+    OpenMetrics::render(w, stats);
+    const std::string out = w.str();
+
+    EXPECT_TRUE(has_line(out, "# TYPE openvpn_bytes_in counter"));
+    EXPECT_TRUE(has_line(out, "openvpn_bytes_in_total 1234"));
+    EXPECT_TRUE(has_line(out, "openvpn_handshakes_total 2"));
+    EXPECT_TRUE(has_line(out, "openvpn_errors_total{type=\"HMAC_ERROR\"} 2"));
+    EXPECT_TRUE(has_line(out, "openvpn_errors_total{type=\"DECRYPT_ERROR\"} 0"));
+    EXPECT_TRUE(has_line(out, "# TYPE openvpn_cpu_seconds counter"));
+    EXPECT_TRUE(has_line(out, "openvpn_cpu_seconds_total{subsystem=\"HANDSHAKE\"} 0"));
+    EXPECT_EQ(out.find("openvpn_cpu_handshake"), std::string::npos);
+    EXPECT_EQ(out.find("latency"), std::string::npos);
+    EXPECT_EQ(out.substr(out.length() - 6), "# EOF\n");
+  }
+
+  TEST(OpenMetrics, Histogram)
+  {
+    SessionStats stats;
+    stats.enable_latency();
+    stats.record_latency(SessionStats::LAT_NET_TO_TUN, 1500, 3);  // 1.5us
+    stats.record_latency(SessionStats::LAT_NET_TO_TUN, 5000000);  // 5ms
+
+    OpenMetrics::Writer w;
+    OpenMetrics::render(w, stats);
+    const std::string out = w.str();
+
+    const std::string b = "openvpn_latency_seconds_bucket{path=\"NET_TO_TUN\",le=";
+    EXPECT_TRUE(has_line(out, b + "\"1.024e-06\"} 0"));
+    EXPECT_TRUE(has_line(out, b + "\"2.048e-06\"} 3"));
+    EXPECT_TRUE(has_line(out, b + "\"0.004194304\"} 3"));
+    EXPECT_TRUE(has_line(out, b + "\"0.008388608\"} 4"));
+    EXPECT_TRUE(has_line(out, b + "\"+Inf\"} 4"));
+    EXPECT_TRUE(has_line(out, "openvpn_latency_seconds_count{path=\"NET_TO_TUN\"} 4"));
+    EXPECT_TRUE(has_line(out, "openvpn_latency_seconds_sum{path=\"NET_TO_TUN\"} 0.0050045"));
+    EXPECT_TRUE(has_line(out, "openvpn_latency_seconds_count{path=\"HANDSHAKE\"} 0"));
+  }
+
+  TEST(OpenMetrics, CpuSeconds)
+  {
+    SessionStats stats;
+    stats.inc_stat(SessionStats::CPU_CRYPTO, 1500000000);
+
+    OpenMetrics::Writer w;
+    OpenMetrics::render(w, stats);
+    EXPECT_TRUE(has_line(w.str(), "openvpn_cpu_seconds_total{subsystem=\"CRYPTO\"} 1.5"));
+  }
+
+  TEST(OpenMetrics, LabelEscape)
+  {
+    EXPECT_EQ(OpenMetrics::Writer::label("name", "a\"b\\c\nd"), "name=\"a\\\"b\\\\c\\nd\"");
+  }
+}
@@ -0,0 +1,256 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <chrono>
+
+#include <openvpn/common/options.hpp>
+#include <openvpn/options/continuation.hpp>
+
+using namespace openvpn;
+
+namespace {
+  // parse_from_csv as it was before Split::ByChar, as a reference
+  OptionList parse_from_csv_copying(const std::string& str, OptionList::Limits* lim)
+  {
+    OptionList ret;
+    if (lim)
+      lim->add_string(str);
+    const std::vector<std::string> list = Split::by_char<std::vector<std::string>, OptionList::Lex, OptionList::Limits>(str, ',', 0, ~0, lim);
+    for (const auto& item : list)
+      {
+	Option opt = Split::by_space<Option, OptionList::Lex, SpaceMatch, OptionList::Limits>(item, lim);
+	if (opt.size())
+	  {
+	    if (lim)
+	      lim->add_opt();
+	    ret.push_back(std::move(opt));
+	  }
+      }
+    return ret;
+  }
+
+  OptionList::Limits push_limits()
+  {
+    return OptionList::Limits("pushed options too large", 1024*1024, 16, 8, 512, 64);
+  }
+}
+
+namespace unittests
+{
+  TEST(options, splitlines)
+  {
+    const std::string str = "one\r\ntwo\n\nthree-is-long\nfour";
+    SplitLines in(str, 8);
+    ASSERT_TRUE(in(true));
+    EXPECT_EQ("one", in.line_ref());
+    ASSERT_TRUE(in(true));
+    EXPECT_EQ("two", in.line_ref());
+    ASSERT_TRUE(in(true));
+    EXPECT_EQ("", in.line_ref());
+    ASSERT_TRUE(in(true));
+    EXPECT_TRUE(in.line_overflow());
+    EXPECT_EQ("three-is", in.line_ref());
+    ASSERT_TRUE(in(true));
+    EXPECT_FALSE(in.line_overflow());
+    EXPECT_EQ("-long", in.line_ref());
+    ASSERT_TRUE(in(true));
+    EXPECT_EQ("four", in.line_ref());
+    EXPECT_FALSE(in(true));
+  }
+
+  TEST(options, splitlines_read_block)
+  {
+    const std::string str = "<ca>\nAAAA\r\nBBBB\n\nCCCC\n</ca>\r\nnext\n";
+    SplitLines in(str, 8);
+    ASSERT_TRUE(in(true));
+    std::string block = "x";
+    ASSERT_EQ(5u, in.read_block("</ca>", block));
+    EXPECT_EQ("xAAAA\nBBBB\n\nCCCC\n", block);
+    ASSERT_TRUE(in(true));
+    EXPECT_EQ("next", in.line_ref());
+
+    // missing end line or overlong line: nothing consumed
+    SplitLines in2(str, 8);
+    block.clear();
+    ASSERT_EQ(0u, in2.read_block("</cert>", block));
+    const std::string str3 = "a\ntoo-long-line\n</ca>\n";
+    SplitLines in3(str3, 8);
+    ASSERT_EQ(0u, in3.read_block("</ca>", block));
+    EXPECT_EQ("", block);
+    ASSERT_TRUE(in3(true));
+    EXPECT_EQ("a", in3.line_ref());
+  }
+
+  TEST(options, parse_from_config)
+  {
+    const std::string config =
+      "client\n"
+      "# comment\n"
+      "remote vpn.example.com 1194 udp\n"
+      "route 10.0.0.0 255.0.0.0\n"
+      "route \"10.1.0.0\" 255.255.0.0\n"
+      "<ca>\n"
+      "line1\n"
+      "line2\n"
+      "</ca>\n";
+
+    OptionList opt;
+    opt.parse_from_config(config, nullptr);
+    opt.update_map();
+    EXPECT_EQ(5u, opt.size());
+    EXPECT_TRUE(opt.exists("client"));
+    EXPECT_EQ("vpn.example.com", opt.get("remote", 1, 256));
+    EXPECT_EQ(2u, opt.get_index("route").size());
+    EXPECT_EQ("10.1.0.0", opt[opt.get_index("route")[1]].get(1, 64));
+    EXPECT_EQ("line1\nline2\n", opt.get("ca", 1, 256|Option::MULTILINE));
+
+    // CRLF line endings are normalized inside blocks too
+    OptionList crlf = OptionList::parse_from_config_static("<ca>\r\nline1\r\nline2\n</ca>\r\n", nullptr);
+    crlf.update_map();
+    EXPECT_EQ("line1\nline2\n", crlf.get("ca", 1, 256|Option::MULTILINE));
+
+    EXPECT_THROW(OptionList::parse_from_config_static("<ca>\nfoo\n", nullptr), option_error);
+  }
+
+  TEST(options, push_update)
+  {
+    PushOptionsBase::Ptr base(new PushOptionsBase());
+    base->multi.parse_from_config("route 192.168.0.0 255.255.0.0\n", nullptr);
+    base->multi.update_map();
+    base->singleton.parse_from_config("route-metric 5\n", nullptr);
+    base->singleton.update_map();
+
+    OptionListContinuation olc(base);
+    olc.add(OptionList::parse_from_csv_static("route 10.0.0.0 255.0.0.0,route 10.1.0.0 255.255.0.0,"
+					      "dhcp-option DNS 10.0.0.1,topology subnet", nullptr), nullptr);
+    ASSERT_TRUE(olc.complete());
+    EXPECT_EQ(3u, olc.get_index("route").size());
+
+    // replace the pushed routes, local route and other options are kept
+    EXPECT_TRUE(olc.push_update(OptionList::parse_from_csv_static("route 10.2.0.0 255.255.0.0,ifconfig 1.2.3.4 255.0.0.0", nullptr), nullptr));
+    const OptionList::IndexList& routes = olc.get_index("route");
+    ASSERT_EQ(2u, routes.size());
+    EXPECT_EQ("192.168.0.0", olc[routes[0]].get(1, 64));
+    EXPECT_EQ("10.2.0.0", olc[routes[1]].get(1, 64));
+    EXPECT_TRUE(olc.exists("dhcp-option"));
+    EXPECT_EQ("subnet", olc.get("topology", 1, 16));
+    EXPECT_EQ("5", olc.get("route-metric", 1, 16));
+    EXPECT_FALSE(olc.exists("ifconfig"));
+
+    // remove
+    EXPECT_TRUE(olc.push_update(OptionList::parse_from_csv_static("-dhcp-option", nullptr), nullptr));
+    EXPECT_FALSE(olc.exists("dhcp-option"));
+    EXPECT_EQ(2u, olc.get_index("route").size());
+
+    // nothing updatable
+    EXPECT_FALSE(olc.push_update(OptionList::parse_from_csv_static("topology net30", nullptr), nullptr));
+  }
+
+  TEST(options, split_by_char_view)
+  {
+    const char *inputs[] = {
+      "",
+      ",",
+      "a,b,,c,",
+      "route 10.0.0.0 255.0.0.0,echo \"x,y\",z",
+      "a\\,b\\\",c\",d",
+      "\"unterminated,quote",
+    };
+    for (const std::string input : inputs)
+      for (const unsigned int max_terms : { ~0u, 0u, 1u, 2u })
+	{
+	  const std::vector<std::string> expected = Split::by_char<std::vector<std::string>, StandardLex, Split::NullLimit>(input, ',', 0, max_terms);
+	  std::vector<std::string> actual;
+	  Split::ByChar<StandardLex, Split::NullLimit> split(input, ',', max_terms);
+	  Split::View term;
+	  while (split.next(term))
+	    {
+	      ASSERT_GE(term.data(), input.data());
+	      ASSERT_LE(term.end(), input.data() + input.length());
+	      actual.push_back(term.to_string());
+	    }
+	  EXPECT_EQ(expected, actual) << input << " max_terms=" << max_terms;
+	}
+  }
+
+  TEST(options, parse_from_peer_info)
+  {
+    OptionList::Limits lim = push_limits();
+    OptionList opt;
+    opt.parse_from_peer_info("IV_VER=3.git::\r\nIV_PLAT=linux\nIV_GUI_VER=a=b\nIV_NONE\n\nIV_EMPTY=\n", &lim);
+    opt.update_map();
+    ASSERT_EQ(6u, opt.size());
+    EXPECT_EQ("3.git::", opt.get("IV_VER", 1, 64));
+    EXPECT_EQ("a=b", opt.get("IV_GUI_VER", 1, 64));
+    EXPECT_EQ(1u, opt[3].size());
+    ASSERT_EQ(1u, opt[4].size());
+    EXPECT_EQ("", opt[4].ref(0));
+    EXPECT_EQ("", opt.get("IV_EMPTY", 1, 64));
+  }
+
+  // Parse a 64KB PUSH_REPLY, checking that the options and limit
+  // accounting match the copying parser, and log both timings.
+  TEST(options, parse_from_csv_64k)
+  {
+    std::string push = "PUSH_REPLY";
+    for (unsigned int i = 0; push.length() < 65536; ++i)
+      {
+	push += ",route 10." + std::to_string(i >> 8 & 0xff) + '.' + std::to_string(i & 0xff) + ".0 255.255.255.0";
+	if (i % 16 == 0)
+	  push += ",dhcp-option DOMAIN-SEARCH \"corp " + std::to_string(i) + "\\\"x\\\"\"";
+      }
+    push += ",topology subnet,ifconfig 10.8.0.2 255.255.255.0,peer-id 7";
+
+    OptionList::Limits lim = push_limits();
+    OptionList opt;
+    opt.parse_from_csv(push, &lim);
+    OptionList::Limits ref_lim = push_limits();
+    const OptionList ref = parse_from_csv_copying(push, &ref_lim);
+    ASSERT_EQ(ref.size(), opt.size());
+    for (size_t i = 0; i < ref.size(); ++i)
+      ASSERT_EQ(ref[i].render(0), opt[i].render(0));
+    EXPECT_EQ(ref_lim.get_bytes(), lim.get_bytes());
+    EXPECT_EQ("corp 0\"x\"", opt[2].get(2, 64));
+
+    const unsigned int N_ROUNDS = 20;
+    typedef std::chrono::steady_clock clock;
+    auto us_per_round = [](const clock::time_point start) {
+      return double(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count()) / N_ROUNDS;
+    };
+
+    size_t n = 0;
+    clock::time_point t = clock::now();
+    for (unsigned int i = 0; i < N_ROUNDS; ++i)
+      n += parse_from_csv_copying(push, nullptr).size();
+    const double copying_us = us_per_round(t);
+
+    t = clock::now();
+    for (unsigned int i = 0; i < N_ROUNDS; ++i)
+      n -= OptionList::parse_from_csv_static(push, nullptr).size();
+    const double view_us = us_per_round(t);
+    ASSERT_EQ(0u, n);
+
+    OPENVPN_LOG("64KB push parse: copying " << copying_us << " us, views " << view_us
+		<< " us, " << opt.size() << " options");
+  }
+}
@@ -0,0 +1,137 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/server/peerfloat.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // Accepts data packets whose last byte is 1, as if it were the
+  // AEAD tag check.
+  struct MockSession
+  {
+    bool transport_recv(BufferAllocated& buf)
+    {
+      ++n_recv;
+      return buf.size() && buf[buf.size() - 1] == 1;
+    }
+
+    void float_notify(const PeerAddr::Ptr& addr)
+    {
+      floated_to = addr;
+    }
+
+    unsigned int n_recv = 0;
+    PeerAddr::Ptr floated_to;
+  };
+
+  typedef PeerFloat<MockSession> Float;
+
+  static BufferAllocated data_v2(const int peer_id, const bool auth)
+  {
+    const unsigned char pkt[] = { (9 << 3) | 1, (unsigned char)(peer_id >> 16),
+				  (unsigned char)(peer_id >> 8), (unsigned char)peer_id,
+				  0xAA, (unsigned char)auth };
+    return BufferAllocated(pkt, sizeof(pkt), 0);
+  }
+
+  static AddrPort addr_port(const std::string& addr, const std::uint16_t port)
+  {
+    AddrPort ap;
+    ap.addr = IP::Addr(addr);
+    ap.port = port;
+    return ap;
+  }
+
+  class PeerFloatTest : public testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      PeerAddr addr;
+      addr.remote = addr_port("192.0.2.1", 40000);
+      addr.local = addr_port("198.51.100.1", 1194);
+      ASSERT_TRUE(table.add(0x123456, &session, addr));
+      reader = table.register_reader();
+    }
+
+    void TearDown() override
+    {
+      reader.reset();
+    }
+
+    MockSession session;
+    Float table;
+    std::unique_ptr<Float::Reader> reader;
+  };
+
+  TEST_F(PeerFloatTest, peer_id)
+  {
+    ASSERT_EQ(0x123456, Float::data_v2_peer_id(data_v2(0x123456, true)));
+    ASSERT_EQ(-1, Float::data_v2_peer_id(data_v2(0xFFFFFF, true)));
+    BufferAllocated v1 = data_v2(0x123456, true);
+    v1[0] = (6 << 3); // P_DATA_V1
+    ASSERT_EQ(-1, Float::data_v2_peer_id(v1));
+  }
+
+  TEST_F(PeerFloatTest, known_address)
+  {
+    BufferAllocated buf = data_v2(0x123456, true);
+    ASSERT_EQ(Float::RECEIVED, table.recv(buf, addr_port("192.0.2.1", 40000)));
+    ASSERT_EQ(1U, session.n_recv);
+    ASSERT_FALSE(session.floated_to);
+
+    buf = data_v2(0x654321, true);
+    ASSERT_EQ(Float::DROPPED, table.recv(buf, addr_port("192.0.2.1", 40000)));
+    ASSERT_EQ(1U, session.n_recv);
+  }
+
+  TEST_F(PeerFloatTest, float)
+  {
+    // not authenticated: the peer stays where it is
+    BufferAllocated buf = data_v2(0x123456, false);
+    ASSERT_EQ(Float::DROPPED, table.recv(buf, addr_port("203.0.113.9", 50000)));
+    ASSERT_EQ("192.0.2.1:40000", table.lookup(0x123456)->remote.to_string());
+    ASSERT_FALSE(session.floated_to);
+
+    buf = data_v2(0x123456, true);
+    ASSERT_EQ(Float::FLOATED, table.recv(buf, addr_port("203.0.113.9", 50000)));
+    ASSERT_EQ("203.0.113.9:50000", table.lookup(0x123456)->remote.to_string());
+    ASSERT_EQ(1U, table.n_floats(0x123456));
+    ASSERT_TRUE(session.floated_to);
+    ASSERT_EQ("UDP 203.0.113.9:50000 -> 198.51.100.1:1194", session.floated_to->to_string());
+
+    // further packets from the new address are received directly
+    reader->quiescent();
+    session.floated_to.reset();
+    buf = data_v2(0x123456, true);
+    ASSERT_EQ(Float::RECEIVED, table.recv(buf, addr_port("203.0.113.9", 50000)));
+    ASSERT_FALSE(session.floated_to);
+    ASSERT_EQ(3U, session.n_recv);
+
+    table.remove(0x123456);
+    ASSERT_EQ(nullptr, table.lookup(0x123456));
+  }
+}
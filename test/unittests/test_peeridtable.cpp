@@ -0,0 +1,158 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <atomic>
+
+#include <openvpn/server/peeridtable.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct Entry
+  {
+    Entry(const int peer_id_arg, const unsigned int port_arg)
+      : peer_id(peer_id_arg), port(port_arg)
+    {
+    }
+
+    int peer_id;
+    unsigned int port;
+  };
+
+  static std::atomic<int> n_reclaimed{0};
+
+  struct CountingReclaim
+  {
+    void operator()(Entry* e) const
+    {
+      ++n_reclaimed;
+      delete e;
+    }
+  };
+
+  typedef PeerIDTable<Entry, CountingReclaim> Table;
+
+  TEST(peeridtable, basic)
+  {
+    n_reclaimed = 0;
+    {
+      Table table;
+      ASSERT_EQ(nullptr, table.lookup(5));
+      ASSERT_EQ(nullptr, table.lookup(-1));
+      ASSERT_EQ(nullptr, table.lookup(1 << 24));
+
+      ASSERT_TRUE(table.insert(5, new Entry(5, 1000)));
+      ASSERT_TRUE(table.insert(0xFFFFFE, new Entry(0xFFFFFE, 1001)));
+      Entry dup(5, 0);
+      ASSERT_FALSE(table.insert(5, &dup));
+      ASSERT_EQ(2U, table.size());
+      ASSERT_EQ(1000U, table.lookup(5)->port);
+      ASSERT_EQ(1001U, table.lookup(0xFFFFFE)->port);
+
+      std::unique_ptr<Table::Reader> reader = table.register_reader();
+
+      // float: the old entry is retained until the reader is quiescent
+      Entry* old = table.lookup(5);
+      table.replace(5, new Entry(5, 2000));
+      ASSERT_EQ(2000U, table.lookup(5)->port);
+      ASSERT_EQ(1000U, old->port);
+      ASSERT_EQ(1U, table.n_retired());
+      ASSERT_EQ(0, n_reclaimed);
+
+      reader->quiescent();
+      table.reclaim();
+      ASSERT_EQ(0U, table.n_retired());
+      ASSERT_EQ(1, n_reclaimed);
+
+      // offline readers don't hold up reclaim
+      reader->offline();
+      table.erase(5);
+      ASSERT_EQ(nullptr, table.lookup(5));
+      ASSERT_EQ(2, n_reclaimed);
+      ASSERT_EQ(1U, table.size());
+    }
+    ASSERT_EQ(3, n_reclaimed);
+  }
+
+  TEST(peeridtable, concurrent_float)
+  {
+    n_reclaimed = 0;
+    const int n_peers = 64;
+    std::atomic<bool> done{false};
+    std::atomic<unsigned long> n_lookups{0};
+    std::atomic<bool> mismatch{false};
+    {
+      Table table;
+      for (int i = 0; i < n_peers; ++i)
+	table.insert(i * 4096, new Entry(i * 4096, 0));
+
+      std::thread reader_thread([&]() {
+	  std::unique_ptr<Table::Reader> reader = table.register_reader();
+	  while (!done)
+	    {
+	      for (int i = 0; i < n_peers; ++i)
+		{
+		  const Entry* e = table.lookup(i * 4096);
+		  if (!e || e->peer_id != i * 4096)
+		    mismatch = true;
+		}
+	      ++n_lookups;
+	      reader->quiescent();
+	    }
+	});
+
+      unsigned int port = 1;
+      while (n_lookups < 1000)
+	{
+	  for (int i = 0; i < n_peers; ++i)
+	    table.replace(i * 4096, new Entry(i * 4096, port++));
+	}
+      done = true;
+      reader_thread.join();
+      ASSERT_FALSE(mismatch);
+    }
+    ASSERT_GT(n_reclaimed, 0);
+  }
+
+  TEST(peeridtable, replace_if)
+  {
+    n_reclaimed = 0;
+    {
+      Table table;
+      table.insert(7, new Entry(7, 1000));
+      Entry* first = table.lookup(7);
+      ASSERT_TRUE(table.replace_if(7, first, new Entry(7, 2000)));
+
+      // a float based on the stale entry loses, its copy is reclaimed
+      ASSERT_FALSE(table.replace_if(7, first, new Entry(7, 3000)));
+      ASSERT_EQ(2000U, table.lookup(7)->port);
+      ASSERT_FALSE(table.replace_if(8, nullptr, new Entry(8, 4000)));
+      ASSERT_EQ(nullptr, table.lookup(8));
+      ASSERT_EQ(1U, table.size());
+      ASSERT_EQ(3, n_reclaimed);
+    }
+    ASSERT_EQ(4, n_reclaimed);
+  }
+}
@@ -0,0 +1,116 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/peerinfo.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/frame/frame_init.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(peerinfo, capabilities)
+  {
+    PeerInfo::Capabilities caps;
+    caps.parse("IV_VER=3.git::\r\n"
+	       "IV_PLAT=linux\n"
+	       "IV_NCP=2\n"
+	       "IV_TCPNL=1\n"
+	       "IV_PROTO=10\n"
+	       "IV_CIPHERS=AES-256-GCM::aes-128-gcm:CHACHA20-POLY1305\n"
+	       "IV_LZ4=1\n"
+	       "IV_LZ4v2=0\n"
+	       "IV_COMP_STUBv2=1\n"
+	       "IV_LZ4DICT=abc\n"
+	       "IV_WIDE_PID=1\n"
+	       "IV_GUI_VER=x=y\n"
+	       "IV_FEC\n");
+    EXPECT_EQ("3.git::", caps.version);
+    EXPECT_EQ("linux", caps.platform);
+    EXPECT_EQ("abc", caps.lz4dict);
+    EXPECT_EQ(10u, caps.iv_proto);
+    EXPECT_TRUE(caps.has_proto(1<<1));
+    EXPECT_TRUE(caps.has_proto((1<<1)|(1<<3)));
+    EXPECT_FALSE(caps.has_proto(1<<2));
+    EXPECT_TRUE(caps.has(PeerInfo::Capabilities::NCP|PeerInfo::Capabilities::TCPNL));
+    EXPECT_TRUE(caps.has(PeerInfo::Capabilities::LZ4));
+    EXPECT_TRUE(caps.has(PeerInfo::Capabilities::WIDE_PID));
+    EXPECT_TRUE(caps.has(PeerInfo::Capabilities::COMP_STUBv2));
+    EXPECT_FALSE(caps.has(PeerInfo::Capabilities::LZ4v2));
+    EXPECT_FALSE(caps.has(PeerInfo::Capabilities::COMP_STUB));
+    EXPECT_FALSE(caps.has(PeerInfo::Capabilities::FEC));
+    EXPECT_EQ(3u, caps.ciphers.size());
+    EXPECT_TRUE(caps.supports_cipher("AES-128-GCM"));
+    EXPECT_TRUE(caps.supports_cipher("chacha20-poly1305"));
+    EXPECT_FALSE(caps.supports_cipher("BF-CBC"));
+
+    // a later key wins, and parse() starts over
+    caps.parse("IV_NCP=1\nIV_PROTO=junk\nIV_RELAY=1\nIV_RELAY=0\n");
+    EXPECT_EQ(0u, caps.flags);
+    EXPECT_EQ(0u, caps.iv_proto);
+    EXPECT_TRUE(caps.ciphers.empty());
+    EXPECT_TRUE(caps.version.empty());
+  }
+
+  // A client advertises the AEAD ciphers its data channel can use,
+  // then its configured cipher.
+  TEST(peerinfo, iv_ciphers)
+  {
+    Frame::Ptr frame = frame_init_simple(2048);
+    SessionStats::Ptr stats(new SessionStats());
+    RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+
+    SSLLib::SSLAPI::Config::Ptr sslconf = new SSLLib::SSLAPI::Config();
+    sslconf->set_mode(Mode(Mode::CLIENT));
+    sslconf->set_flags(SSLConst::NO_VERIFY_PEER);
+    sslconf->set_local_cert_enabled(false);
+    sslconf->set_frame(frame);
+
+    ProtoContext::Config::Ptr c(new ProtoContext::Config());
+    c->ssl_factory = sslconf->new_factory();
+    c->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, stats, rng));
+    c->dc.set_cipher(CryptoAlgs::AES_256_GCM);
+
+    PeerInfo::Capabilities caps;
+    caps.parse(c->peer_info_string());
+    EXPECT_TRUE(caps.has(PeerInfo::Capabilities::NCP));
+    EXPECT_TRUE(caps.supports_cipher("AES-128-GCM"));
+    EXPECT_TRUE(caps.supports_cipher("AES-256-GCM"));
+    EXPECT_TRUE(caps.supports_cipher("CHACHA20-POLY1305"));
+    EXPECT_FALSE(caps.supports_cipher("AES-256-CBC"));
+    EXPECT_FALSE(caps.supports_cipher("AES-256-CTR"));
+    EXPECT_EQ("IV_CIPHERS=AES-128-GCM:AES-192-GCM:AES-256-GCM:CHACHA20-POLY1305\n", c->iv_ciphers());
+
+    c->dc.set_cipher(CryptoAlgs::AES_256_CBC);
+    caps.parse(c->peer_info_string());
+    ASSERT_EQ(5u, caps.ciphers.size());
+    EXPECT_EQ("AES-256-CBC", caps.ciphers.back());
+
+    // nothing to advertise without a data channel
+    c->dc.reset();
+    EXPECT_EQ("", c->iv_ciphers());
+  }
+}
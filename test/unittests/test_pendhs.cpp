@@ -0,0 +1,140 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/server/pendhs.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static ProtoSessionID make_psid(const unsigned int n)
+  {
+    unsigned char data[ProtoSessionID::SIZE] = { 0 };
+    std::memcpy(data, &n, sizeof(n));
+    Buffer buf(data, sizeof(data), true);
+    return ProtoSessionID(buf);
+  }
+
+  static AddrPort make_addr(const std::string& addr, const std::uint16_t port)
+  {
+    AddrPort ret;
+    ret.addr = IP::Addr(addr);
+    ret.port = port;
+    return ret;
+  }
+
+  TEST(pendhs, find)
+  {
+    PendingHandshakeTable<int> table(64, Time::Duration::seconds(30));
+    const Time now = Time::now();
+    const ProtoSessionID psid = make_psid(1);
+    const AddrPort addr = make_addr("10.0.0.1", 1194);
+
+    ASSERT_EQ(nullptr, table.find(psid, addr, now));
+    table.insert(psid, addr, now) = 42;
+    int *v = table.find(psid, addr, now);
+    ASSERT_NE(nullptr, v);
+    ASSERT_EQ(42, *v);
+
+    // the same session ID from another address is another handshake
+    ASSERT_EQ(nullptr, table.find(psid, make_addr("10.0.0.1", 1195), now));
+    ASSERT_EQ(nullptr, table.find(psid, make_addr("10.0.0.2", 1194), now));
+    ASSERT_EQ(nullptr, table.find(make_psid(2), addr, now));
+
+    // inserting the same key again doesn't duplicate it
+    table.insert(psid, addr, now) = 43;
+    ASSERT_EQ(1, table.size(now));
+    ASSERT_EQ(43, *table.find(psid, addr, now));
+
+    ASSERT_TRUE(table.erase(psid, addr, now));
+    ASSERT_FALSE(table.erase(psid, addr, now));
+    ASSERT_EQ(nullptr, table.find(psid, addr, now));
+    ASSERT_EQ(0, table.size(now));
+  }
+
+  TEST(pendhs, expire)
+  {
+    PendingHandshakeTable<int> table(64, Time::Duration::seconds(10));
+    const Time now = Time::now();
+    const ProtoSessionID psid = make_psid(1);
+    const AddrPort addr = make_addr("2001:db8::1", 1194);
+
+    table.insert(psid, addr, now) = 1;
+    ASSERT_NE(nullptr, table.find(psid, addr, now + Time::Duration::seconds(9)));
+    ASSERT_EQ(nullptr, table.find(psid, addr, now + Time::Duration::seconds(10)));
+    ASSERT_EQ(0, table.size(now + Time::Duration::seconds(10)));
+  }
+
+  // However many handshakes are pending, the table keeps its size,
+  // newer entries pushing out the oldest.
+  TEST(pendhs, bounded)
+  {
+    PendingHandshakeTable<int> table(256, Time::Duration::seconds(30));
+    ASSERT_EQ(256, table.capacity());
+    Time now = Time::now();
+    const unsigned int n = 10000;
+    for (unsigned int i = 0; i < n; ++i)
+      {
+	now += Time::Duration::binary_ms(1);
+	table.insert(make_psid(i), make_addr("10.0.0.1", std::uint16_t(i)), now) = int(i);
+      }
+    ASSERT_EQ(table.capacity(), table.size(now));
+    ASSERT_EQ(n - table.capacity(), table.evicted());
+
+    // the most recent handshake is still there
+    int *v = table.find(make_psid(n - 1), make_addr("10.0.0.1", std::uint16_t(n - 1)), now);
+    ASSERT_NE(nullptr, v);
+    ASSERT_EQ(int(n - 1), *v);
+  }
+
+  TEST(pendhs, initial_reset_psid)
+  {
+    // opcodes, shifted left by 3 above the key ID
+    const unsigned char hard_reset_client_v2 = 7 << 3;
+    const unsigned char control_v1 = 4 << 3;
+
+    const ProtoSessionID psid = make_psid(0x12345678);
+    BufferAllocated buf(64, 0);
+    buf.push_back(hard_reset_client_v2);
+    psid.write(buf);
+    buf.push_back(0);
+
+    ProtoSessionID out;
+    ASSERT_TRUE(ProtoContext::initial_reset_psid(buf, out));
+    ASSERT_TRUE(out == psid);
+
+    // a reset with a nonzero key ID isn't an initial one
+    buf[0] |= 1;
+    ASSERT_FALSE(ProtoContext::initial_reset_psid(buf, out));
+
+    buf[0] = control_v1;
+    ASSERT_FALSE(ProtoContext::initial_reset_psid(buf, out));
+
+    BufferAllocated shortbuf(64, 0);
+    shortbuf.push_back(hard_reset_client_v2);
+    ASSERT_FALSE(ProtoContext::initial_reset_psid(shortbuf, out));
+  }
+}
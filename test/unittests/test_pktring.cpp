@@ -0,0 +1,185 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/transport/pktring.hpp>
+#include <openvpn/transport/tcplink.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static std::string framed(const std::string& payload)
+  {
+    std::string ret(2, '\0');
+    ret[0] = char(payload.length() >> 8);
+    ret[1] = char(payload.length() & 0xff);
+    return ret + payload;
+  }
+
+  static std::string random_payload(std::mt19937& rng, const size_t max)
+  {
+    std::string ret(1 + rng() % max, '\0');
+    for (auto& c : ret)
+      c = char(rng());
+    return ret;
+  }
+
+  TEST(pktring, in_place)
+  {
+    const Frame::Context fc = frame_init_context_simple(2048);
+    PacketRing ring(4096);
+    const std::string stream = framed("one") + framed("two") + framed("three") + std::string(1, '\0');
+    unsigned char* read_at = ring.write_ptr();
+    std::memcpy(read_at, stream.data(), stream.length());
+    ring.commit(stream.length());
+
+    Buffer pkt;
+    ASSERT_TRUE(ring.next(pkt, fc));
+    ASSERT_EQ("one", buf_to_string(pkt));
+    ASSERT_EQ(read_at + 2, pkt.c_data()); // a view, not a copy
+    ASSERT_TRUE(ring.next(pkt, fc));
+    ASSERT_EQ("two", buf_to_string(pkt));
+    ASSERT_TRUE(ring.next(pkt, fc));
+    ASSERT_EQ("three", buf_to_string(pkt));
+    ASSERT_EQ(read_at + 12, pkt.c_data());
+
+    // one byte of the next prefix
+    ASSERT_FALSE(ring.next(pkt, fc));
+    ASSERT_EQ(1u, ring.buffered());
+
+    // a zero-length packet is a framing error
+    ring.write((const unsigned char *)"\x00", 1);
+    ASSERT_THROW(ring.next(pkt, fc), PacketStream::embedded_packet_size_error);
+  }
+
+  TEST(pktring, oversize)
+  {
+    const Frame::Context fc = frame_init_context_simple(100);
+    PacketRing ring(4096);
+    const std::string stream = framed(std::string(101, 'x'));
+    ring.write((const unsigned char *)stream.data(), stream.length());
+    Buffer pkt;
+    ASSERT_THROW(ring.next(pkt, fc), PacketStream::embedded_packet_size_error);
+  }
+
+  // random packets read in random chunks, so that they straddle
+  // reads and wrap around the end of the ring
+  TEST(pktring, random_stream)
+  {
+    const Frame::Context fc = frame_init_context_simple(1500);
+    std::mt19937 rng(7);
+    std::vector<std::string> sent;
+    std::string stream;
+    for (int i = 0; i < 5000; ++i)
+      {
+	sent.push_back(random_payload(rng, 1500));
+	stream += framed(sent.back());
+      }
+
+    PacketRing ring(2 * 1502);
+    std::vector<std::string> received;
+    size_t pos = 0;
+    while (pos < stream.length())
+      {
+	const size_t n = std::min({ size_t(1 + rng() % 4000), ring.write_space(), stream.length() - pos });
+	ASSERT_GT(n, 0u);
+	std::memcpy(ring.write_ptr(), stream.data() + pos, n);
+	ring.commit(n);
+	pos += n;
+	Buffer pkt;
+	while (ring.next(pkt, fc))
+	  received.push_back(buf_to_string(pkt));
+      }
+    ASSERT_EQ(0u, ring.buffered());
+    ASSERT_EQ(sent, received);
+  }
+
+  struct LinkHandler
+  {
+    typedef TCPTransport::Link<openvpn_io::ip::tcp, LinkHandler*, false> LinkImpl;
+
+    bool tcp_read_handler(BufferAllocated& buf)
+    {
+      received.push_back(buf_to_string(buf));
+      if (received.size() == expected)
+	link->stop();
+      return true;
+    }
+
+    void tcp_write_queue_needs_send() {}
+    void tcp_eof_handler() { link->stop(); }
+    void tcp_error_handler(const char *error) { this->error = error; link->stop(); }
+
+    LinkImpl* link = nullptr;
+    size_t expected = 0;
+    std::vector<std::string> received;
+    std::string error;
+  };
+
+  // many packets in one write come out of the link in order
+  TEST(pktring, tcp_link)
+  {
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::tcp::acceptor acceptor(io_context, openvpn_io::ip::tcp::endpoint(openvpn_io::ip::make_address("127.0.0.1"), 0));
+    openvpn_io::ip::tcp::socket client(io_context);
+    openvpn_io::ip::tcp::socket server(io_context);
+    client.connect(acceptor.local_endpoint());
+    acceptor.accept(server);
+
+    std::mt19937 rng(11);
+    std::vector<std::string> sent;
+    std::string stream;
+    for (int i = 0; i < 2000; ++i)
+      {
+	sent.push_back(random_payload(rng, 1400));
+	stream += framed(sent.back());
+      }
+
+    Frame::Ptr frame = frame_init(true, 1500, 1024, false);
+    SessionStats::Ptr stats(new SessionStats());
+    LinkHandler handler;
+    handler.expected = sent.size();
+    LinkHandler::LinkImpl::Ptr link(new LinkHandler::LinkImpl(&handler, server, 0, 8,
+							      (*frame)[Frame::READ_LINK_TCP], stats));
+    handler.link = link.get();
+    link->start();
+
+    std::thread writer([&client, &stream]() {
+	openvpn_io::write(client, openvpn_io::buffer(stream));
+      });
+    io_context.run();
+    writer.join();
+
+    ASSERT_EQ("", handler.error);
+    ASSERT_EQ(sent, handler.received);
+    ASSERT_EQ(stream.length(), stats->get_stat(SessionStats::BYTES_IN));
+  }
+}
@@ -0,0 +1,133 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <openvpn/log/pktsample.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static const char *pcap_fn = "/tmp/ovpn_test_pktsample.pcap";
+
+  // minimal IPv4/UDP packet from 10.0.0.1:sport to 10.0.0.2:dport
+  static BufferAllocated udp_packet(const unsigned int sport, const unsigned int dport, const size_t len=64)
+  {
+    BufferAllocated buf(len, 0);
+    buf.init_headroom(0);
+    for (size_t i = 0; i < len; ++i)
+      buf.push_back(0);
+    unsigned char *p = buf.data();
+    p[0] = 0x45;
+    p[9] = IPCommon::UDP;
+    p[12] = 10; p[15] = 1;
+    p[16] = 10; p[19] = 2;
+    p[20] = sport >> 8; p[21] = sport & 0xFF;
+    p[22] = dport >> 8; p[23] = dport & 0xFF;
+    return buf;
+  }
+
+  static std::vector<unsigned char> read_file(const char *fn)
+  {
+    std::ifstream ifs(fn, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  }
+
+  TEST(PacketSampler, OneInN)
+  {
+    PacketSampler::Config config;
+    config.fn = pcap_fn;
+    config.every = 4;
+    PacketSampler ps(config);
+    const BufferAllocated pkt = udp_packet(1000, 53);
+    unsigned int n = 0;
+    for (int i = 0; i < 20; ++i)
+      n += ps.sample(pkt);
+    EXPECT_EQ(n, 5u);
+    EXPECT_EQ(ps.n_captured(), 5u);
+  }
+
+  TEST(PacketSampler, FlowFirst)
+  {
+    PacketSampler::Config config;
+    config.fn = pcap_fn;
+    config.flow_first = 3;
+    PacketSampler ps(config);
+
+    const BufferAllocated a = udp_packet(1000, 53);
+    const BufferAllocated b = udp_packet(2000, 53);
+    // reply direction belongs to the same flow as a
+    BufferAllocated a_reply = udp_packet(53, 1000);
+    std::swap(a_reply.data()[15], a_reply.data()[19]);
+
+    EXPECT_TRUE(ps.sample(a));
+    EXPECT_TRUE(ps.sample(a_reply));
+    EXPECT_TRUE(ps.sample(b));
+    EXPECT_TRUE(ps.sample(a));
+    EXPECT_FALSE(ps.sample(a_reply));
+    EXPECT_FALSE(ps.sample(a));
+    EXPECT_TRUE(ps.sample(b));
+    EXPECT_TRUE(ps.sample(b));
+    EXPECT_FALSE(ps.sample(b));
+  }
+
+  TEST(PacketSampler, PcapFormat)
+  {
+    {
+      PacketSampler::Config config;
+      config.fn = pcap_fn;
+      config.every = 1;
+      config.snaplen = 32;
+      PacketSampler ps(config);
+      ps.sample(udp_packet(1000, 53, 64));
+      ps.sample(udp_packet(1000, 53, 28));
+    }
+
+    const std::vector<unsigned char> f = read_file(pcap_fn);
+    std::remove(pcap_fn);
+    ASSERT_EQ(f.size(), 24u + 16 + 32 + 16 + 28);
+
+    auto u32 = [&f](const size_t off) {
+      std::uint32_t v;
+      std::memcpy(&v, &f[off], sizeof(v));
+      return v;
+    };
+    EXPECT_EQ(u32(0), 0xa1b2c3d4u);
+    EXPECT_EQ(u32(16), 32u);  // snaplen
+    EXPECT_EQ(u32(20), 101u); // LINKTYPE_RAW
+
+    // first record truncated to snaplen
+    EXPECT_EQ(u32(24 + 8), 32u);
+    EXPECT_EQ(u32(24 + 12), 64u);
+    EXPECT_EQ(f[24 + 16], 0x45);
+
+    // second record captured whole
+    const size_t r2 = 24 + 16 + 32;
+    EXPECT_EQ(u32(r2 + 8), 28u);
+    EXPECT_EQ(u32(r2 + 12), 28u);
+  }
+}
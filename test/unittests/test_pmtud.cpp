@@ -0,0 +1,122 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/transport/pmtud.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // Run the engine against a path that carries packets up to
+  // path_mtu, answering each probe that fits right away.  Returns
+  // the number of probes sent until the search converged.
+  static int converge(PMTUDiscovery& pd, Time& now, const unsigned int path_mtu)
+  {
+    int probes = 0;
+    while (probes < 100)
+      {
+	const unsigned int size = pd.probe(now);
+	if (!size)
+	  {
+	    if (pd.next_event() > now + Time::Duration::seconds(60))
+	      return probes; // waiting for the raise timer
+	    now = pd.next_event();
+	    continue;
+	  }
+	++probes;
+	if (size <= path_mtu)
+	  pd.reply(size, now);
+      }
+    return probes;
+  }
+
+  TEST(PMTUD, max_fits)
+  {
+    Time now = Time::now();
+    PMTUDiscovery pd(1200, 1400);
+    EXPECT_EQ(0u, pd.pmtu());
+    EXPECT_EQ(1, converge(pd, now, 1500));
+    EXPECT_EQ(1400u, pd.pmtu());
+  }
+
+  TEST(PMTUD, bisect)
+  {
+    Time now = Time::now();
+    PMTUDiscovery pd(1200, 1400);
+    converge(pd, now, 1300);
+    EXPECT_LE(pd.pmtu(), 1300u);
+    EXPECT_GT(pd.pmtu(), 1300u - PMTUDiscovery::MIN_STEP);
+  }
+
+  TEST(PMTUD, nothing_fits)
+  {
+    Time now = Time::now();
+    PMTUDiscovery pd(1200, 1400);
+    converge(pd, now, 1000);
+    EXPECT_EQ(0u, pd.pmtu());
+  }
+
+  // a reply showing less than the probe size doesn't confirm it
+  TEST(PMTUD, short_reply)
+  {
+    Time now = Time::now();
+    PMTUDiscovery pd(1200, 1400);
+    EXPECT_EQ(1400u, pd.probe(now));
+    EXPECT_FALSE(pd.reply(1399, now));
+    EXPECT_EQ(0u, pd.pmtu());
+  }
+
+  // one lost probe is retried at the same size
+  TEST(PMTUD, retry)
+  {
+    Time now = Time::now();
+    PMTUDiscovery pd(1200, 1400);
+    EXPECT_EQ(1400u, pd.probe(now));
+    EXPECT_EQ(0u, pd.probe(now));
+    now = pd.next_event();
+    EXPECT_EQ(1400u, pd.probe(now));
+    EXPECT_TRUE(pd.reply(1400, now));
+    EXPECT_EQ(1400u, pd.pmtu());
+  }
+
+  // After the raise timer, a path that shrank is searched again,
+  // and one that grew is found.
+  TEST(PMTUD, raise)
+  {
+    Time now = Time::now();
+    PMTUDiscovery pd(1200, 1400);
+    converge(pd, now, 1300);
+    const unsigned int first = pd.pmtu();
+
+    now = pd.next_event();
+    converge(pd, now, 1250);
+    EXPECT_LE(pd.pmtu(), 1250u);
+    EXPECT_GT(pd.pmtu(), 1250u - PMTUDiscovery::MIN_STEP);
+
+    now = pd.next_event();
+    converge(pd, now, 1500);
+    EXPECT_EQ(1400u, pd.pmtu());
+    EXPECT_NE(first, pd.pmtu());
+  }
+}
@@ -0,0 +1,118 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <atomic>
+
+#include <openvpn/io/io.hpp>
+#include <openvpn/transport/protectpool.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct TestProtect : public SocketProtect
+  {
+    bool socket_protect(int socket, IP::Addr endpoint) override
+    {
+      ++calls;
+      if (endpoint.defined() && !endpoint.all_zeros())
+	++with_endpoint;
+      if (endpoint.is_ipv6() && refuse_v6)
+	return false;
+      return true;
+    }
+
+    bool socket_protect_ahead() const override
+    {
+      return true;
+    }
+
+    std::atomic<int> calls{0};
+    std::atomic<int> with_endpoint{0};
+    bool refuse_v6 = false;
+  };
+
+  TEST(protectpool, fill_and_take)
+  {
+    TestProtect protect;
+    ProtectedSocketPool::Ptr pool(new ProtectedSocketPool(&protect, 2));
+    pool->wait_full();
+    EXPECT_EQ(protect.with_endpoint, 0);
+    const int calls = protect.calls;
+
+    const int fd = pool->take(ProtectedSocketPool::UDP4);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(pool->hits(), 1u);
+    ::close(fd);
+
+    // refilled in the background
+    pool->wait_full();
+    EXPECT_EQ(protect.calls, calls + 1);
+    pool->stop();
+  }
+
+  TEST(protectpool, refused_kind)
+  {
+    TestProtect protect;
+    protect.refuse_v6 = true;
+    ProtectedSocketPool::Ptr pool(new ProtectedSocketPool(&protect, 1));
+    pool->wait_full();
+    const int calls = protect.calls;
+
+    EXPECT_LT(pool->take(ProtectedSocketPool::TCP6), 0);
+    EXPECT_LT(pool->take(ProtectedSocketPool::UDP6), 0);
+    EXPECT_EQ(pool->misses(), 2u);
+    const int fd = pool->take(ProtectedSocketPool::TCP4);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+
+    // a refused kind isn't retried
+    pool->wait_full();
+    EXPECT_EQ(protect.calls, calls + 1);
+  }
+
+  TEST(protectpool, assign)
+  {
+    TestProtect protect;
+    ProtectedSocketPool::Ptr pool(new ProtectedSocketPool(&protect, 1));
+    pool->wait_full();
+
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::udp::socket socket(io_context);
+    const openvpn_io::ip::udp::endpoint ep(openvpn_io::ip::address_v4::loopback(), 0);
+    ASSERT_TRUE(pool->assign(socket, ep.protocol()));
+    EXPECT_TRUE(socket.is_open());
+    socket.bind(ep);
+    socket.close();
+
+    openvpn_io::ip::tcp::socket tcp(io_context);
+    ASSERT_TRUE(pool->assign(tcp, openvpn_io::ip::tcp::v4()));
+    EXPECT_TRUE(tcp.is_open());
+
+    // empty until refilled
+    openvpn_io::ip::tcp::socket tcp2(io_context);
+    pool->stop();
+    EXPECT_FALSE(pool->assign(tcp2, openvpn_io::ip::tcp::v4()));
+  }
+}
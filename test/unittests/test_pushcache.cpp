@@ -0,0 +1,95 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/options/pushcache.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static std::string msg(const BufferPtr& buf)
+  {
+    return std::string((const char *)buf->c_data());
+  }
+
+  TEST(pushcache, single)
+  {
+    ServerPushList common;
+    common.push_back("route 10.0.0.0 255.0.0.0");
+    common.push_back("dhcp-option DNS 10.0.0.1");
+    ServerPushList client;
+    client.push_back("ifconfig 10.8.0.2 255.255.255.0");
+    client.push_back("peer-id 7");
+
+    PushReply pr(common);
+    std::vector<BufferPtr> out = pr.build(client);
+    ASSERT_EQ(1u, out.size());
+    EXPECT_EQ("PUSH_REPLY,route 10.0.0.0 255.0.0.0,dhcp-option DNS 10.0.0.1,ifconfig 10.8.0.2 255.255.255.0,peer-id 7", msg(out[0]));
+
+    // the cached common part is not modified by build
+    out = pr.build(ServerPushList());
+    ASSERT_EQ(1u, out.size());
+    EXPECT_EQ("PUSH_REPLY,route 10.0.0.0 255.0.0.0,dhcp-option DNS 10.0.0.1", msg(out[0]));
+  }
+
+  TEST(pushcache, continuation)
+  {
+    ServerPushList common;
+    for (int i = 0; i < 100; ++i)
+      common.push_back("route 10.0." + std::to_string(i) + ".0 255.255.255.0");
+    ServerPushList client;
+    client.push_back("peer-id 1");
+
+    PushReply pr(common);
+    ASSERT_GT(pr.n_segments(), 1u);
+    std::vector<BufferPtr> out = pr.build(client);
+    ASSERT_GE(out.size(), pr.n_segments());
+
+    OptionList all;
+    for (size_t i = 0; i < out.size(); ++i)
+      {
+	EXPECT_LE(out[i]->size(), size_t(PushReply::DEFAULT_MAX_SIZE));
+	const std::string m = msg(out[i]);
+	ASSERT_EQ(0u, m.find("PUSH_REPLY,"));
+	const std::string cont = (i + 1 < out.size()) ? ",push-continuation 2" : ",push-continuation 1";
+	EXPECT_EQ(m.length() - cont.length(), m.rfind(cont));
+	all.extend(OptionList::parse_from_csv_static(m.substr(11), nullptr), nullptr);
+      }
+    all.update_map();
+    EXPECT_EQ(100u, all.get_index("route").size());
+    EXPECT_EQ("1", all.get("peer-id", 1, 16));
+  }
+
+  TEST(pushcache, cache)
+  {
+    PushReplyCache cache;
+    ServerPushList common;
+    common.push_back("redirect-gateway def1");
+    PushReply::Ptr a = cache.get("default", common);
+    EXPECT_EQ(a.get(), cache.get("default", ServerPushList()).get());
+    EXPECT_NE(a.get(), cache.get("other", common).get());
+    EXPECT_EQ(2u, cache.size());
+    cache.invalidate("default");
+    EXPECT_NE(a.get(), cache.get("default", common).get());
+  }
+}
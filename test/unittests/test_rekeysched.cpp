@@ -0,0 +1,104 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <map>
+
+#include <openvpn/random/mtrandapi.hpp>
+#include <openvpn/ssl/rekeysched.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // count of clients assigned to each reneg-sec value
+  static std::map<unsigned int, unsigned int> assign_n(RekeyScheduler& rs,
+						       RandomAPI& prng,
+						       const unsigned int n,
+						       const unsigned int reneg)
+  {
+    const Time now = Time::now();
+    std::map<unsigned int, unsigned int> hist;
+    for (unsigned int i = 0; i < n; ++i)
+      ++hist[rs.assign(now, Time::Duration::seconds(reneg), prng).to_seconds()];
+    return hist;
+  }
+
+  TEST(rekeysched, spread_within_budget)
+  {
+    RekeyScheduler::Config c;
+    c.window = Time::Duration::seconds(600);
+    c.max_per_second = 2;
+    RekeyScheduler rs(c);
+    MTRand prng(1);
+
+    // a mass reconnect of 1000 clients fits the 601 * 2 budget
+    const auto hist = assign_n(rs, prng, 1000, 3600);
+    for (const auto& e : hist)
+      {
+	ASSERT_GE(e.first, 3000u);
+	ASSERT_LE(e.first, 3600u);
+	ASSERT_LE(e.second, 2u);
+      }
+    ASSERT_EQ(1000u, rs.stats().assigned);
+  }
+
+  TEST(rekeysched, over_budget_stays_in_window)
+  {
+    RekeyScheduler::Config c;
+    c.window = Time::Duration::seconds(100);
+    c.max_per_second = 1;
+    RekeyScheduler rs(c);
+    MTRand prng(2);
+
+    // more clients than budget: fill the least loaded seconds
+    const auto hist = assign_n(rs, prng, 505, 60);
+    unsigned int hi = 0;
+    for (const auto& e : hist)
+      {
+	ASSERT_GE(e.first, 10u);
+	ASSERT_LE(e.first, 60u);
+	hi = std::max(hi, e.second);
+      }
+    ASSERT_EQ(51u, hist.size());
+    ASSERT_LE(hi, 11u);
+  }
+
+  TEST(rekeysched, acquire_budget)
+  {
+    RekeyScheduler::Config c;
+    c.max_per_second = 3;
+    RekeyScheduler rs(c);
+    const Time t = Time::now();
+
+    ASSERT_TRUE(rs.acquire(t));
+    ASSERT_TRUE(rs.acquire(t));
+    ASSERT_TRUE(rs.acquire(t));
+    ASSERT_FALSE(rs.acquire(t));
+    ASSERT_TRUE(rs.acquire(t, true));
+    ASSERT_TRUE(rs.acquire(t + Time::Duration::seconds(1)));
+
+    const RekeyScheduler::Stats s = rs.stats();
+    ASSERT_EQ(5u, s.acquired);
+    ASSERT_EQ(1u, s.deferred);
+  }
+}
@@ -0,0 +1,157 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <vector>
+
+#include <openvpn/transport/client/relay.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  class FakeTransport : public TransportClient
+  {
+  public:
+    typedef RCPtr<FakeTransport> Ptr;
+
+    void recv(const std::string& data, const unsigned int tos = 0)
+    {
+      BufferAllocated buf(reinterpret_cast<const unsigned char *>(data.data()), data.length(), 0);
+      if (tos)
+	parent->transport_recv_tos(buf, tos);
+      else
+	parent->transport_recv(buf);
+    }
+
+    void error()
+    {
+      parent->transport_error(Error::TRANSPORT_ERROR, "fake");
+    }
+
+    TransportClientParent* parent = nullptr;
+    std::vector<std::string> sent;
+    std::vector<unsigned int> sent_tos;
+    bool full = false;
+    bool started = false;
+    bool stopped = false;
+
+  private:
+    virtual void transport_start() override { started = true; }
+    virtual void stop() override { stopped = true; }
+
+    virtual bool transport_send_const(const Buffer& buf) override
+    {
+      return false;
+    }
+
+    virtual bool transport_send(BufferAllocated& buf) override
+    {
+      return transport_send_tos(buf, 0);
+    }
+
+    virtual bool transport_send_tos(BufferAllocated& buf, const unsigned int tos) override
+    {
+      if (full)
+	return false;
+      sent.emplace_back(reinterpret_cast<const char *>(buf.c_data()), buf.size());
+      sent_tos.push_back(tos);
+      return true;
+    }
+
+    virtual bool transport_send_queue_empty() override { return true; }
+    virtual bool transport_has_send_queue() override { return false; }
+    virtual void transport_stop_requeueing() override {}
+    virtual unsigned int transport_send_queue_size() override { return 0; }
+    virtual void reset_align_adjust(const size_t align_adjust) override {}
+    virtual IP::Addr server_endpoint_addr() const override { return IP::Addr(); }
+
+    virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const override
+    {
+    }
+
+    virtual Protocol transport_protocol() const override { return Protocol(Protocol::UDPv4); }
+
+    virtual void transport_reparent(TransportClientParent* parent_arg) override
+    {
+      parent = parent_arg;
+    }
+  };
+
+  struct ForwardParent : public TransportRelayForwarder::Parent
+  {
+    virtual void relay_forward_error(const Error::Type fatal_err, const std::string& err_text) override
+    {
+      ++errors;
+    }
+
+    int errors = 0;
+  };
+
+  TEST(relayfwd, forward)
+  {
+    FakeTransport::Ptr ingress(new FakeTransport());
+    FakeTransport::Ptr egress(new FakeTransport());
+    SessionStats::Ptr stats(new SessionStats());
+    ForwardParent parent;
+
+    TransportRelayForwarder::Ptr fwd(new TransportRelayForwarder(ingress, egress, stats, &parent));
+    fwd->start(false);
+    ASSERT_TRUE(egress->started);
+
+    ingress->recv("client packet");
+    egress->recv("server packet", 2);
+    ASSERT_EQ(std::vector<std::string>{"client packet"}, egress->sent);
+    ASSERT_EQ(std::vector<std::string>{"server packet"}, ingress->sent);
+    ASSERT_EQ(2u, ingress->sent_tos[0]);
+
+    egress->full = true;
+    ingress->recv("dropped");
+    ASSERT_EQ(1u, egress->sent.size());
+
+    ASSERT_EQ(26, stats->get_stat(SessionStats::RELAY_BYTES));
+    ASSERT_EQ(2, stats->get_stat(SessionStats::RELAY_PACKETS));
+    ASSERT_EQ(1, stats->get_stat(SessionStats::RELAY_DROPS));
+  }
+
+  // an error on one side stops both
+  TEST(relayfwd, error)
+  {
+    FakeTransport::Ptr ingress(new FakeTransport());
+    FakeTransport::Ptr egress(new FakeTransport());
+    ForwardParent parent;
+
+    TransportRelayForwarder::Ptr fwd(new TransportRelayForwarder(ingress, egress, new SessionStats(), &parent));
+    fwd->start(true);
+    ASSERT_FALSE(egress->started);
+
+    egress->error();
+    ASSERT_TRUE(fwd->halted());
+    ASSERT_TRUE(ingress->stopped);
+    ASSERT_TRUE(egress->stopped);
+    ASSERT_EQ(1, parent.errors);
+
+    ingress->recv("late");
+    ASSERT_TRUE(egress->sent.empty());
+  }
+}
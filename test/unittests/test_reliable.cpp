@@ -0,0 +1,176 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/reliable/relsend.hpp>
+#include <openvpn/reliable/relrecv.hpp>
+#include <openvpn/reliable/relack.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  typedef ReliableSendTemplate<BufferPtr> ReliableSend;
+
+  static Time::Duration ms(const unsigned int v)
+  {
+    return Time::Duration::milliseconds(v);
+  }
+
+  TEST(reliable, rto_estimate)
+  {
+    const Time::Duration tls_timeout = Time::Duration::seconds(1);
+    ReliableRTO rto;
+    ASSERT_EQ(tls_timeout, rto.rto(tls_timeout));
+    ASSERT_EQ(tls_timeout * 2, rto.rto(tls_timeout, 1));
+
+    // steady 600ms RTT, e.g. a satellite link
+    for (int i = 0; i < 20; ++i)
+      rto.sample(ms(600));
+    ASSERT_GT(rto.rto(tls_timeout), ms(600));
+    ASSERT_LT(rto.rto(tls_timeout), ms(700));
+
+    // a fast link never goes below MIN_RTO_MS
+    ReliableRTO fast;
+    for (int i = 0; i < 20; ++i)
+      fast.sample(ms(5));
+    ASSERT_EQ(ms(ReliableRTO::MIN_RTO_MS), fast.rto(tls_timeout));
+
+    // backoff is capped
+    ASSERT_EQ(ms(ReliableRTO::MAX_RTO_MS), rto.rto(tls_timeout, 20));
+  }
+
+  TEST(reliable, send_karn)
+  {
+    const Time::Duration tls_timeout = Time::Duration::seconds(2);
+    ReliableSend rs(4);
+    Time now(Time::now());
+
+    ReliableSend::Message& m0 = rs.send(now, tls_timeout);
+    m0.packet.reset(new BufferAllocated(16, 0));
+    ReliableSend::Message& m1 = rs.send(now, tls_timeout);
+    m1.packet.reset(new BufferAllocated(16, 0));
+    ASSERT_EQ(tls_timeout, rs.until_retransmit(now));
+
+    // m1 is retransmitted, so its ACK gives no RTT sample
+    now += tls_timeout;
+    ASSERT_TRUE(m1.ready_retransmit(now));
+    rs.retransmitted(m1, now, tls_timeout);
+    ASSERT_EQ(tls_timeout * 2, m1.until_retransmit(now));
+    rs.ack(m1.id(), now + ms(300));
+    ASSERT_EQ(0u, rs.rto().samples());
+
+    // m0 is not, although late ACKs still count
+    rs.ack(0, now);
+    ASSERT_EQ(1u, rs.rto().samples());
+    ASSERT_EQ(0u, rs.n_unacked());
+
+    // next message uses the measured RTT
+    ReliableSend::Message& m2 = rs.send(now, tls_timeout);
+    ASSERT_GT(m2.until_retransmit(now), tls_timeout);
+  }
+
+  TEST(reliable, ack_coalesce)
+  {
+    ReliableAck acks(ReliableAck::MAX_ACK_LIST_COMPAT);
+    for (ReliableAck::id_t id = 0; id < 12; ++id)
+      {
+	acks.push_back(id);
+	acks.push_back(id); // retransmitted by peer
+      }
+    ASSERT_EQ(12u, acks.size());
+
+    // first packet carries the maximum OpenVPN 2.x accepts
+    BufferAllocated buf(256, 0);
+    buf.init_headroom(128);
+    acks.prepend(buf);
+    ASSERT_EQ(4u, acks.size());
+    ASSERT_EQ(size_t(ReliableAck::MAX_ACK_LIST_COMPAT), ReliableAck::ack_skip(buf));
+  }
+
+  TEST(reliable, window)
+  {
+    // a large receive window accepts a burst out of order
+    ReliableRecvTemplate<BufferPtr> rr(16);
+    BufferPtr pkt(new BufferAllocated(16, 0));
+    for (ReliableAck::id_t id = 15; id > 0; --id)
+      ASSERT_TRUE(rr.receive(pkt, id) & ReliableRecvTemplate<BufferPtr>::IN_WINDOW);
+    ASSERT_FALSE(rr.ready());
+    ASSERT_FALSE(rr.receive(pkt, 16) & ReliableRecvTemplate<BufferPtr>::IN_WINDOW);
+    rr.receive(pkt, 0);
+    int n = 0;
+    while (rr.ready())
+      {
+	rr.advance();
+	++n;
+      }
+    ASSERT_EQ(16, n);
+
+    // and a large send window doesn't stall after 4 messages
+    ReliableSend rs(16);
+    const Time now(Time::now());
+    for (int i = 0; i < 16; ++i)
+      {
+	ASSERT_TRUE(rs.ready());
+	rs.send(now, Time::Duration::seconds(1)).packet = pkt;
+      }
+    ASSERT_FALSE(rs.ready());
+  }
+
+  // compact() on an idle window keeps sequencing, and leaves a
+  // window with messages in flight alone
+  TEST(reliable, compact)
+  {
+    BufferPtr pkt(new BufferAllocated(16, 0));
+    ReliableRecvTemplate<BufferPtr> rr(4);
+    rr.receive(pkt, 0);
+    rr.receive(pkt, 2);
+    rr.compact();
+    ASSERT_TRUE(rr.ready());
+    rr.advance();
+    ASSERT_FALSE(rr.ready());
+    rr.receive(pkt, 1);
+    rr.advance();
+    rr.advance();
+    rr.compact();
+    ASSERT_FALSE(rr.ready());
+    ASSERT_TRUE(rr.receive(pkt, 3) & ReliableRecvTemplate<BufferPtr>::IN_WINDOW);
+    ASSERT_TRUE(rr.ready());
+    ASSERT_EQ(3u, rr.next_sequenced().id());
+
+    ReliableSend rs(4);
+    const Time now(Time::now());
+    rs.send(now, Time::Duration::seconds(1)).packet = pkt;
+    rs.compact();
+    ASSERT_EQ(1u, rs.n_unacked());
+    rs.ack(0);
+    rs.compact();
+    ASSERT_EQ(0u, rs.n_unacked());
+    ASSERT_EQ(1u, rs.send(now, Time::Duration::seconds(1)).id());
+
+    ReliableAck acks(ReliableAck::MAX_ACK_LIST_COMPAT);
+    acks.compact();
+    acks.push_back(7);
+    ASSERT_EQ(1u, acks.size());
+  }
+}
@@ -0,0 +1,114 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <unistd.h>
+
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/tun/builder/capture.hpp>
+#include <openvpn/tun/persist/tunpersist.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static TunBuilderCapture::Ptr make_capture(const std::vector<std::string>& routes)
+  {
+    TunBuilderCapture::Ptr tbc(new TunBuilderCapture());
+    tbc->tun_builder_set_remote_address("192.0.2.1", false);
+    tbc->tun_builder_add_address("10.8.0.2", 24, "10.8.0.1", false, false);
+    for (const auto& r : routes)
+      {
+	const IP::Route route(r);
+	tbc->tun_builder_add_route(route.addr.to_string(), route.prefix_len, -1, route.addr.is_ipv6());
+      }
+    return tbc;
+  }
+
+  TEST(routediff, diff)
+  {
+    TunBuilderCapture::Ptr prev = make_capture({"10.1.0.0/16", "10.2.0.0/16", "fd00::/64"});
+    TunBuilderCapture::Ptr next = make_capture({"fd00::/64", "10.3.0.0/16", "10.1.0.0/16"});
+
+    const TunBuilderCapture::RouteDiff diff = prev->diff_routes(*next);
+    ASSERT_EQ(diff.removed.size(), 1u);
+    ASSERT_EQ(diff.added.size(), 1u);
+    ASSERT_EQ(diff.removed[0].to_string(), "10.2.0.0/16");
+    ASSERT_EQ(diff.added[0].to_string(), "10.3.0.0/16");
+    ASSERT_TRUE(prev->same_except_routes(*next));
+
+    ASSERT_TRUE(prev->diff_routes(*prev).empty());
+
+    TunBuilderCapture::Ptr other = make_capture({"10.1.0.0/16"});
+    other->tun_builder_set_mtu(1400);
+    ASSERT_FALSE(prev->same_except_routes(*other));
+  }
+
+  namespace {
+    struct NullDestructor : public DestructorBase
+    {
+      virtual void destroy(std::ostream& os) override
+      {
+      }
+    };
+  }
+
+  TEST(routediff, persist)
+  {
+    typedef TunPersistTemplate<ScopedFD> TunPersist;
+    TunPersist::Ptr tp(new TunPersist(true, false, nullptr));
+
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    ::close(fds[1]);
+
+    const IP::Addr server("192.0.2.1");
+    TunProp::Config tun_prop;
+    OptionList opt1 = OptionList::parse_from_config_static("ifconfig 10.8.0.2 255.255.255.0\n"
+							    "topology subnet\n"
+							    "route 10.1.0.0 255.255.0.0\n", nullptr);
+    OptionList opt2 = OptionList::parse_from_config_static("ifconfig 10.8.0.2 255.255.255.0\n"
+							    "topology subnet\n"
+							    "route 10.2.0.0 255.255.0.0\n", nullptr);
+    OptionList opt3 = OptionList::parse_from_config_static("ifconfig 10.8.0.3 255.255.255.0\n"
+							    "topology subnet\n"
+							    "route 10.2.0.0 255.255.0.0\n", nullptr);
+
+    ASSERT_FALSE(tp->use_persisted_tun(server, tun_prop, opt1));
+    ASSERT_FALSE(tp->routes_changed());
+    tp->persist_tun_state(fds[0], new TunProp::State());
+    tp->add_destructor(new NullDestructor());
+
+    ASSERT_TRUE(tp->use_persisted_tun(server, tun_prop, opt1));
+
+    ASSERT_FALSE(tp->use_persisted_tun(server, tun_prop, opt2));
+    ASSERT_TRUE(tp->routes_changed());
+    tp->persist_route_update();
+    ASSERT_FALSE(tp->routes_changed());
+    ASSERT_EQ(tp->capture()->add_routes.size(), 1u);
+    ASSERT_EQ(tp->capture()->add_routes[0].address, "10.2.0.0");
+    ASSERT_TRUE(tp->use_persisted_tun(server, tun_prop, opt2));
+
+    ASSERT_FALSE(tp->use_persisted_tun(server, tun_prop, opt3));
+    ASSERT_FALSE(tp->routes_changed());
+  }
+}
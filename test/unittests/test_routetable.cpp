@@ -0,0 +1,222 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <map>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <memory>
+
+#include <openvpn/addr/routetable.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct Owner
+  {
+    explicit Owner(const IP::Route& route_arg)
+      : route(route_arg)
+    {
+    }
+
+    IP::Route route;
+  };
+
+  typedef IP::RouteTable<Owner> Table;
+
+  static std::string lm(const Table& t, const std::string& addr)
+  {
+    const Owner* o = t.longest_match(IP::Addr(addr));
+    return o ? o->route.to_string() : "none";
+  }
+
+  static bool add(Table& t, const std::string& route)
+  {
+    const IP::Route r(route);
+    return t.insert(r, new Owner(r));
+  }
+
+  TEST(routetable, basic)
+  {
+    Table t;
+    ASSERT_TRUE(add(t, "10.0.0.0/8"));
+    ASSERT_TRUE(add(t, "10.1.0.0/16"));
+    ASSERT_TRUE(add(t, "10.1.2.0/24"));
+    ASSERT_TRUE(add(t, "10.8.0.6/32"));
+    ASSERT_TRUE(add(t, "2001:db8::/32"));
+    ASSERT_TRUE(add(t, "2001:db8::1000/128"));
+    ASSERT_FALSE(t.insert(IP::Route("10.1.0.0/16"), nullptr));
+    ASSERT_EQ(6u, t.size());
+
+    ASSERT_EQ("10.1.2.0/24", lm(t, "10.1.2.3"));
+    ASSERT_EQ("10.1.0.0/16", lm(t, "10.1.3.3"));
+    ASSERT_EQ("10.8.0.6/32", lm(t, "10.8.0.6"));
+    ASSERT_EQ("10.0.0.0/8", lm(t, "10.8.0.7"));
+    ASSERT_EQ("none", lm(t, "11.0.0.1"));
+    ASSERT_EQ("2001:db8::1000/128", lm(t, "2001:db8::1000"));
+    ASSERT_EQ("2001:db8::/32", lm(t, "2001:db8::1001"));
+    ASSERT_EQ("none", lm(t, "::1"));
+
+    ASSERT_NE(nullptr, t.lookup(IP::Route("10.1.0.0/16")));
+    ASSERT_EQ(nullptr, t.lookup(IP::Route("10.1.0.0/17")));
+
+    // removing a route uncovers the shorter one
+    t.erase(IP::Route("10.1.2.0/24"));
+    ASSERT_EQ("10.1.0.0/16", lm(t, "10.1.2.3"));
+    t.erase(IP::Route("10.0.0.0/8"));
+    ASSERT_EQ("none", lm(t, "10.8.0.7"));
+    ASSERT_EQ("10.8.0.6/32", lm(t, "10.8.0.6"));
+    ASSERT_EQ(4u, t.size());
+
+    // no readers, so nothing stays retired
+    ASSERT_EQ(0u, t.n_retired());
+
+    // replace swaps the entry in place
+    const IP::Route r("10.8.0.6/32");
+    Owner* o = new Owner(IP::Route("10.8.0.6/31"));
+    t.replace(r, o);
+    ASSERT_EQ(o, t.longest_match(IP::Addr("10.8.0.6")));
+    ASSERT_EQ(4u, t.size());
+  }
+
+  TEST(routetable, default_route)
+  {
+    Table t;
+    ASSERT_TRUE(add(t, "0.0.0.0/0"));
+    ASSERT_TRUE(add(t, "192.168.1.0/24"));
+    ASSERT_EQ("0.0.0.0/0", lm(t, "1.2.3.4"));
+    ASSERT_EQ("192.168.1.0/24", lm(t, "192.168.1.1"));
+    ASSERT_EQ("none", lm(t, "::1"));
+  }
+
+  // random inserts and erases against a linear scan
+  TEST(routetable, random)
+  {
+    std::mt19937 rng(42);
+    for (int ipv6 = 0; ipv6 <= 1; ++ipv6)
+      {
+	Table t;
+	std::map<IP::Route, bool> routes;
+	auto random_route = [&rng, ipv6]() {
+	  unsigned char bytes[16];
+	  for (auto& b : bytes)
+	    b = rng() & 0x0f; // keep routes close together so that they nest
+	  const IP::Addr addr = ipv6
+	    ? IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(bytes))
+	    : IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(bytes));
+	  const unsigned int pl = rng() % (addr.size() + 1);
+	  return IP::Route(addr.network_addr(pl), pl);
+	};
+
+	for (int i = 0; i < 3000; ++i)
+	  {
+	    const IP::Route r = random_route();
+	    if (rng() % 3 == 0)
+	      {
+		t.erase(r);
+		routes.erase(r);
+	      }
+	    else
+	      {
+		std::unique_ptr<Owner> o(new Owner(r));
+		if (t.insert(r, o.get()))
+		  {
+		    o.release();
+		    ASSERT_TRUE(routes.emplace(r, true).second) << r.to_string();
+		  }
+		else
+		  ASSERT_EQ(1u, routes.count(r)) << r.to_string();
+	      }
+	  }
+	ASSERT_EQ(routes.size(), t.size());
+
+	for (int i = 0; i < 3000; ++i)
+	  {
+	    const IP::Route q = random_route();
+	    const IP::Addr a = q.addr;
+	    const IP::Route* best = nullptr;
+	    for (const auto& e : routes)
+	      if (e.first.contains(a) && (!best || e.first.prefix_len > best->prefix_len))
+		best = &e.first;
+	    const Owner* o = t.longest_match(a);
+	    ASSERT_EQ(!best, !o) << a.to_string();
+	    if (best)
+	      {
+		ASSERT_EQ(*best, o->route) << a.to_string();
+	      }
+	    ASSERT_EQ(routes.count(q) != 0, t.lookup(q) != nullptr) << q.to_string();
+	  }
+      }
+  }
+
+  // readers keep matching while a writer churns other routes
+  TEST(routetable, concurrent)
+  {
+    Table t;
+    for (unsigned int i = 0; i < 64; ++i)
+      add(t, "10." + std::to_string(i) + ".0.0/16");
+
+    std::atomic<bool> done{false};
+    std::atomic<bool> mismatch{false};
+    std::atomic<unsigned long> n_lookups{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 2; ++r)
+      readers.emplace_back([&]() {
+	  std::unique_ptr<Table::Reader> reader = t.register_reader();
+	  while (!done)
+	    {
+	      for (unsigned int i = 0; i < 64; ++i)
+		{
+		  const Owner* o = t.longest_match(IP::Addr("10." + std::to_string(i) + ".1.1"));
+		  if (!o || o->route.prefix_len < 16 || o->route.addr.to_ipv4().to_uint32() >> 24 != 10)
+		    mismatch = true;
+		}
+	      ++n_lookups;
+	      reader->quiescent();
+	    }
+	});
+
+    unsigned int n = 0;
+    while (n_lookups < 2000)
+      {
+	// more specific routes come and go under the /16s
+	const IP::Route r("10." + std::to_string(n % 64) + ".1." + std::to_string(n % 256) + "/32");
+	std::unique_ptr<Owner> o(new Owner(r));
+	if (t.insert(r, o.get()))
+	  o.release();
+	const IP::Route s("10." + std::to_string(n % 64) + ".1.0/24");
+	t.replace(s, new Owner(s));
+	if (n % 3 == 0)
+	  t.erase(s);
+	t.erase(r);
+	++n;
+      }
+    done = true;
+    for (auto& r : readers)
+      r.join();
+    ASSERT_FALSE(mismatch);
+    t.reclaim();
+    ASSERT_EQ(0u, t.n_retired());
+  }
+}
@@ -0,0 +1,142 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <random>
+
+#include <openvpn/addr/routetree.hpp>
+#include <openvpn/addr/addrspacesplit.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static IP::Route random_route(std::mt19937& rng, const bool ipv6)
+  {
+    unsigned char bytes[16];
+    for (auto& b : bytes)
+      b = rng() & 0x0f; // keep routes close together so that they nest
+    const IP::Addr addr = ipv6
+      ? IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(bytes))
+      : IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(bytes));
+    const unsigned int pl = rng() % (addr.size() + 1);
+    return IP::Route(addr.network_addr(pl), pl);
+  }
+
+  static const IP::Route* linear_longest_match(const IP::RouteList& rl, const IP::Route& r)
+  {
+    const IP::Route* best = nullptr;
+    for (const auto& e : rl)
+      if (e.contains(r) && (!best || e.prefix_len > best->prefix_len))
+	best = &e;
+    return best;
+  }
+
+  TEST(routetree, basic)
+  {
+    IP::RouteList rl;
+    rl.emplace_back(IP::Route("10.0.0.0/8"));
+    rl.emplace_back(IP::Route("10.1.0.0/16"));
+    rl.emplace_back(IP::Route("10.1.2.0/24"));
+    rl.emplace_back(IP::Route("192.168.0.0/16"));
+    rl.emplace_back(IP::Route("2001:db8::/32"));
+    const IP::RouteTree tree(rl);
+
+    ASSERT_TRUE(tree.exists(IP::Route("10.1.0.0/16")));
+    ASSERT_FALSE(tree.exists(IP::Route("10.2.0.0/16")));
+    ASSERT_FALSE(tree.exists(IP::Route("0.0.0.0/0")));
+
+    ASSERT_EQ(tree.longest_match(IP::Addr("10.1.2.3"))->to_string(), "10.1.2.0/24");
+    ASSERT_EQ(tree.longest_match(IP::Addr("10.1.3.3"))->to_string(), "10.1.0.0/16");
+    ASSERT_EQ(tree.longest_match(IP::Addr("10.9.9.9"))->to_string(), "10.0.0.0/8");
+    ASSERT_EQ(tree.longest_match(IP::Addr("2001:db8::1"))->to_string(), "2001:db8::/32");
+    ASSERT_EQ(tree.longest_match(IP::Addr("11.0.0.1")), nullptr);
+    ASSERT_EQ(tree.longest_match(IP::Addr("::1")), nullptr);
+
+    ASSERT_TRUE(tree.contains_subroute(IP::Route("0.0.0.0/0")));
+    ASSERT_TRUE(tree.contains_subroute(IP::Route("10.0.0.0/8")));
+    ASSERT_FALSE(tree.contains_subroute(IP::Route("10.1.2.0/24")));
+    ASSERT_FALSE(tree.contains_subroute(IP::Route("172.16.0.0/12")));
+    ASSERT_TRUE(tree.contains_subroute(IP::Route("::/0")));
+  }
+
+  TEST(routetree, random)
+  {
+    std::mt19937 rng(42);
+    for (int ipv6 = 0; ipv6 <= 1; ++ipv6)
+      {
+	IP::RouteList rl;
+	IP::RouteTree tree;
+	for (int i = 0; i < 500; ++i)
+	  {
+	    const IP::Route r = random_route(rng, ipv6);
+	    rl.push_back(r);
+	    tree.insert(r);
+	  }
+	for (int i = 0; i < 2000; ++i)
+	  {
+	    const IP::Route q = random_route(rng, ipv6);
+
+	    const IP::Route* lm = linear_longest_match(rl, q);
+	    const IP::Route* tm = tree.longest_match(q);
+	    ASSERT_EQ(!lm, !tm) << q.to_string();
+	    if (lm)
+	      {
+		ASSERT_EQ(*lm, *tm) << q.to_string();
+	      }
+
+	    bool sub = false, eq = false;
+	    for (const auto& e : rl)
+	      {
+		if (e == q)
+		  eq = true;
+		else if (q.contains(e))
+		  sub = true;
+	      }
+	    ASSERT_EQ(sub, tree.contains_subroute(q)) << q.to_string();
+	    ASSERT_EQ(eq, tree.exists(q)) << q.to_string();
+	  }
+      }
+  }
+
+  TEST(routetree, splitter_many_routes)
+  {
+    IP::RouteList rl;
+    rl.emplace_back(IP::Route("0.0.0.0/0"));
+    for (unsigned int i = 0; i < 10000; ++i)
+      rl.emplace_back(IP::Addr::from_ipv4(IPv4::Addr::from_uint32(0x0a000000 + (i << 8))), 24);
+
+    const IP::AddressSpaceSplitter split(rl, IP::Addr::V4_MASK);
+
+    // the split is a partition of the address space
+    // that doesn't break up any of the input routes
+    const IP::RouteTree tree(split);
+    for (const auto& r : rl)
+      {
+	if (r.prefix_len)
+	  {
+	    ASSERT_TRUE(tree.exists(r)) << r.to_string();
+	  }
+      }
+    ASSERT_FALSE(tree.contains_subroute(IP::Route("10.0.0.0/24")));
+  }
+}
@@ -0,0 +1,126 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include "test_common.h"
+
+#include <openvpn/transport/rttprobe.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(RTTProbe, steady)
+  {
+    Time now = Time::now();
+    std::uint64_t us = 1000000;
+    RTTProbe rp(Time::Duration::seconds(1));
+    EXPECT_FALSE(rp.defined());
+    for (int i = 0; i < 20; ++i)
+      {
+	std::uint32_t seq;
+	ASSERT_TRUE(rp.probe(now, us, seq));
+	EXPECT_FALSE(rp.probe(now, us, seq)); // not due yet
+	EXPECT_TRUE(rp.reply(seq, us, 0, us + 30000));
+	now = rp.next_event();
+	us += 1000000;
+      }
+    ASSERT_TRUE(rp.defined());
+    EXPECT_EQ(30000u, rp.srtt());
+    EXPECT_EQ(0u, rp.jitter());
+    EXPECT_EQ(0u, rp.loss());
+    EXPECT_EQ(20u, rp.probes());
+    EXPECT_EQ(0u, rp.lost());
+  }
+
+  // the peer's hold time is not part of the round trip
+  TEST(RTTProbe, hold)
+  {
+    const Time now = Time::now();
+    RTTProbe rp(Time::Duration::seconds(1));
+    std::uint32_t seq;
+    ASSERT_TRUE(rp.probe(now, 500, seq));
+    EXPECT_TRUE(rp.reply(seq, 500, 4000, 500 + 10000));
+    EXPECT_EQ(6000u, rp.srtt());
+    EXPECT_EQ(3000u, rp.rttvar());
+    EXPECT_EQ(18000u, rp.rto());
+  }
+
+  TEST(RTTProbe, jitter)
+  {
+    Time now = Time::now();
+    std::uint64_t us = 0;
+    RTTProbe rp(Time::Duration::seconds(1));
+    for (int i = 0; i < 200; ++i)
+      {
+	std::uint32_t seq;
+	ASSERT_TRUE(rp.probe(now, us, seq));
+	rp.reply(seq, us, 0, us + (i & 1 ? 40000 : 20000));
+	now = rp.next_event();
+	us += 1000000;
+      }
+    EXPECT_NEAR(30000.0, double(rp.srtt()), 3000.0);
+    EXPECT_NEAR(20000.0, double(rp.jitter()), 1000.0);
+  }
+
+  TEST(RTTProbe, loss)
+  {
+    Time now = Time::now();
+    std::uint64_t us = 0;
+    RTTProbe rp(Time::Duration::seconds(1));
+    std::uint32_t lost_seq = 0;
+    std::uint64_t lost_ts = 0;
+    for (int i = 0; i < 100; ++i)
+      {
+	std::uint32_t seq;
+	ASSERT_TRUE(rp.probe(now, us, seq));
+	if (i % 4)
+	  rp.reply(seq, us, 0, us + 10000);
+	else
+	  {
+	    lost_seq = seq;
+	    lost_ts = us;
+	  }
+	now = rp.next_event();
+	us += 1000000;
+      }
+    EXPECT_EQ(25u, rp.lost());
+    EXPECT_NEAR(250.0, double(rp.loss_permille()), 100.0);
+
+    // a late reply to a probe counted as lost is ignored
+    EXPECT_FALSE(rp.reply(lost_seq, lost_ts, 0, us));
+  }
+
+  // an echo must match both the seq and the timestamp of a probe
+  TEST(RTTProbe, mismatch)
+  {
+    const Time now = Time::now();
+    RTTProbe rp(Time::Duration::seconds(1));
+    std::uint32_t seq;
+    ASSERT_TRUE(rp.probe(now, 1000, seq));
+    EXPECT_FALSE(rp.reply(seq + 1, 1000, 0, 2000));
+    EXPECT_FALSE(rp.reply(seq, 999, 0, 2000));
+    EXPECT_TRUE(rp.reply(seq, 1000, 0, 2000));
+    EXPECT_FALSE(rp.reply(seq, 1000, 0, 2000)); // duplicate
+    EXPECT_EQ(1000u, rp.srtt());
+  }
+}
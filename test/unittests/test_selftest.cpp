@@ -0,0 +1,67 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <unistd.h>
+
+#include <openvpn/crypto/selftest.hpp>
+#include <openvpn/common/file.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static std::string cache_path()
+  {
+    const std::string path = "/tmp/ovpn_test_selftest." + std::to_string(::getpid());
+    ::unlink(path.c_str());
+    return path;
+  }
+
+  TEST(SelfTest, cache)
+  {
+    const std::string path = cache_path();
+    const std::string id = SelfTest::crypto_self_test_build_id() + '\n';
+    const std::string result = SelfTest::crypto_self_test();
+
+    // first run writes the cache
+    EXPECT_EQ(result, SelfTest::crypto_self_test(path));
+    EXPECT_EQ(id + result, read_text_simple(path));
+
+    // later runs of the same build take the result from it
+    write_string(path, id + "cached result\n");
+    EXPECT_EQ("cached result\n", SelfTest::crypto_self_test(path));
+
+    // another build runs the tests again
+    write_string(path, "OpenVPN 0.0 / other\ncached result\n");
+    EXPECT_EQ(result, SelfTest::crypto_self_test(path));
+    EXPECT_EQ(id + result, read_text_simple(path));
+    ::unlink(path.c_str());
+  }
+
+  TEST(SelfTest, unwritable_cache)
+  {
+    EXPECT_EQ(SelfTest::crypto_self_test(),
+	      SelfTest::crypto_self_test("/nonexistent/dir/selftest"));
+  }
+}
@@ -0,0 +1,84 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <atomic>
+#include <thread>
+
+#include <openvpn/common/seqlock.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(seqlock, store_load)
+  {
+    SeqLockArray<long long, 4> sl;
+    long long v[4] = { 1, 2, 3, 4 };
+    long long out[4];
+    ASSERT_EQ(0u, sl.load(out));
+    ASSERT_EQ(0, out[3]);
+    sl.store(v);
+    ASSERT_EQ(1u, sl.load(out));
+    for (size_t i = 0; i < 4; ++i)
+      ASSERT_EQ(v[i], out[i]);
+  }
+
+  // every published array holds one value repeated, so a torn read
+  // shows up as a mix of values
+  TEST(seqlock, no_torn_reads)
+  {
+    enum { N = 32, WRITES = 200000 };
+    SeqLockArray<long long, N> sl;
+    std::atomic<bool> done{false};
+
+    std::thread writer([&sl, &done]() {
+	long long v[N];
+	for (long long w = 1; w <= WRITES; ++w)
+	  {
+	    for (auto& e : v)
+	      e = w;
+	    sl.store(v);
+	  }
+	done = true;
+      });
+
+    long long last = 0;
+    size_t reads = 0;
+    while (!done || !reads)
+      {
+	long long out[N];
+	sl.load(out);
+	for (size_t i = 1; i < N; ++i)
+	  ASSERT_EQ(out[0], out[i]);
+	ASSERT_GE(out[0], last);
+	last = out[0];
+	++reads;
+      }
+    writer.join();
+
+    long long out[N];
+    ASSERT_EQ((unsigned int)WRITES, sl.load(out));
+    ASSERT_EQ(WRITES, out[N - 1]);
+  }
+}
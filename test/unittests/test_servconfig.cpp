@@ -0,0 +1,136 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/server/servconfig.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static ServerConfig::Ptr config(const std::string& text)
+  {
+    return new ServerConfig(OptionList::parse_from_config_static(text, nullptr));
+  }
+
+  static std::vector<std::string> update(const ServerConfig& from, const ServerConfig& to, bool& complete)
+  {
+    std::vector<BufferPtr> msgs;
+    complete = to.push_update(from, msgs);
+    std::vector<std::string> ret;
+    for (auto &m : msgs)
+      ret.push_back(std::string((const char *)m->c_data()));
+    return ret;
+  }
+
+  TEST(servconfig, store_versions)
+  {
+    ServerConfigStore store;
+    EXPECT_FALSE(store.current());
+    ServerConfig::Ptr a = config("push \"route 10.0.0.0 255.0.0.0\"\n");
+    ServerConfig::Ptr b = config("push \"route 10.1.0.0 255.255.0.0\"\n");
+    EXPECT_EQ(1u, store.publish(a));
+    EXPECT_EQ(2u, store.publish(b));
+    EXPECT_EQ(b, store.current());
+    EXPECT_EQ(1u, a->version());
+    EXPECT_EQ(2u, b->version());
+
+    // a session that started on a keeps it
+    EXPECT_EQ(1u, a->push().size());
+    EXPECT_EQ("route 10.0.0.0 255.0.0.0", a->push()[0]);
+  }
+
+  TEST(servconfig, unchanged)
+  {
+    ServerConfig::Ptr a = config("push \"route 10.0.0.0 255.0.0.0\"\npush \"ping 10\"\n");
+    ServerConfig::Ptr b = config("push \"route 10.0.0.0 255.0.0.0\"\npush \"ping 10\"\n");
+    bool complete = false;
+    EXPECT_TRUE(update(*a, *b, complete).empty());
+    EXPECT_TRUE(complete);
+  }
+
+  TEST(servconfig, routes_changed)
+  {
+    ServerConfig::Ptr a = config("push \"route 10.0.0.0 255.0.0.0\"\n"
+				 "push \"dhcp-option DNS 10.0.0.1\"\n"
+				 "push \"route-ipv6 fd00::/64\"\n");
+    ServerConfig::Ptr b = config("push \"route 10.0.0.0 255.0.0.0\"\n"
+				 "push \"route 10.2.0.0 255.255.0.0\"\n"
+				 "push \"dhcp-option DNS 10.0.0.1\"\n");
+    bool complete = false;
+    const std::vector<std::string> msgs = update(*a, *b, complete);
+    EXPECT_TRUE(complete);
+    ASSERT_EQ(1u, msgs.size());
+    EXPECT_EQ("PUSH_UPDATE,route 10.0.0.0 255.0.0.0,route 10.2.0.0 255.255.0.0,-route-ipv6", msgs[0]);
+  }
+
+  TEST(servconfig, not_updatable)
+  {
+    ServerConfig::Ptr a = config("push \"ping 10\"\npush \"route 10.0.0.0 255.0.0.0\"\n");
+    ServerConfig::Ptr b = config("push \"ping 20\"\npush \"route 10.0.0.0 255.0.0.0\"\n");
+    bool complete = true;
+    EXPECT_TRUE(update(*a, *b, complete).empty());
+    EXPECT_FALSE(complete);
+  }
+
+  TEST(servconfig, split_by_name)
+  {
+    std::string ta, tb;
+    for (int i = 0; i < 25; ++i)
+      {
+	tb += "push \"route 10.0." + std::to_string(i) + ".0 255.255.255.0\"\n";
+	tb += "push \"dhcp-option DOMAIN d" + std::to_string(i) + ".example\"\n";
+      }
+    ServerConfig::Ptr a = config("push \"ping 10\"\n");
+    ServerConfig::Ptr b = config(tb + "push \"ping 10\"\n");
+    bool complete = false;
+    const std::vector<std::string> msgs = update(*a, *b, complete);
+    EXPECT_TRUE(complete);
+    ASSERT_EQ(2u, msgs.size());
+
+    // each name's instances stay in one message
+    for (auto &m : msgs)
+      {
+	EXPECT_LT(m.length(), size_t(PushReply::DEFAULT_MAX_SIZE));
+	const OptionList opt = OptionList::parse_from_csv_static(m.substr(12), nullptr);
+	EXPECT_EQ(25u, opt.size());
+	for (auto &o : opt)
+	  EXPECT_EQ(opt[0].ref(0), o.ref(0));
+      }
+  }
+
+  // a name whose instances don't fit in one message is left for reconnect
+  TEST(servconfig, too_large)
+  {
+    std::string tb;
+    for (int i = 0; i < 100; ++i)
+      tb += "push \"route 10.0." + std::to_string(i) + ".0 255.255.255.0\"\n";
+    ServerConfig::Ptr a = config("push \"dhcp-option DNS 10.0.0.1\"\n");
+    ServerConfig::Ptr b = config(tb);
+    bool complete = true;
+    const std::vector<std::string> msgs = update(*a, *b, complete);
+    EXPECT_FALSE(complete);
+    ASSERT_EQ(1u, msgs.size());
+    EXPECT_EQ("PUSH_UPDATE,-dhcp-option", msgs[0]);
+  }
+}
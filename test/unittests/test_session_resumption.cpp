@@ -0,0 +1,210 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/sess_ticket_ring.hpp>
+#include <openvpn/ssl/sess_ticket_shm.hpp>
+#include <openvpn/openssl/ssl/sess_cache.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(session_resumption, ticket_key_rotation)
+  {
+    RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+    TLSSessionTicketKeyRing ring(rng, "test", Time::Duration::infinite(), 1);
+    TLSSessionTicketBase::Name name0(*rng), name1(*rng), name2(*rng);
+    TLSSessionTicketBase::Key key0(*rng), key1(*rng), key2(*rng);
+
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, ring.create_session_ticket_key(name0, key0));
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, ring.lookup_session_ticket_key(name0, key1));
+    ASSERT_EQ(key0, key1);
+
+    // the previous key is still accepted, but marked as expiring
+    ring.rotate();
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, ring.create_session_ticket_key(name1, key1));
+    ASSERT_NE(name0, name1);
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_EXPIRING, ring.lookup_session_ticket_key(name0, key2));
+    ASSERT_EQ(key0, key2);
+
+    // keys older than that are gone
+    ring.rotate();
+    ASSERT_EQ(TLSSessionTicketBase::NO_TICKET, ring.lookup_session_ticket_key(name0, key2));
+
+    // installed keys become current
+    const TLSSessionTicketBase::Name name3(*rng);
+    const TLSSessionTicketBase::Key key3(*rng);
+    ring.install(name3, key3);
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, ring.create_session_ticket_key(name2, key2));
+    ASSERT_EQ(name3, name2);
+    ASSERT_EQ(key3, key2);
+
+    const TLSSessionTicketKeyRing::Stats st = ring.stats();
+    ASSERT_EQ(3U, st.created);
+    ASSERT_EQ(1U, st.hits);
+    ASSERT_EQ(1U, st.expiring);
+    ASSERT_EQ(1U, st.misses);
+    ASSERT_EQ(2U, st.rotations);
+  }
+
+  TEST(session_resumption, ticket_key_shm)
+  {
+    RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+    const std::string path = "/tmp/ovpn_test_ticket_keys." + std::to_string(::getpid());
+    ::unlink(path.c_str());
+    TLSSessionTicketKeyShm a(path, rng, "test", Time::Duration::infinite(), 1);
+    TLSSessionTicketKeyShm b(path, rng, "test", Time::Duration::infinite(), 1);
+    ::unlink(path.c_str());
+    TLSSessionTicketBase::Name name0(*rng), name1(*rng);
+    TLSSessionTicketBase::Key key0(*rng), key1(*rng);
+
+    // both instances see the key published by the first one
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, a.create_session_ticket_key(name0, key0));
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, b.lookup_session_ticket_key(name0, key1));
+    ASSERT_EQ(key0, key1);
+
+    // a rotation by one instance is picked up by the other
+    b.rotate();
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, a.create_session_ticket_key(name1, key1));
+    ASSERT_NE(name0, name1);
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_EXPIRING, a.lookup_session_ticket_key(name0, key1));
+    ASSERT_EQ(key0, key1);
+  }
+
+  // A writer that dies part way through an update leaves the seqlock
+  // odd; readers must recover rather than spin, and so must a process
+  // opening the segment afterwards.
+  TEST(session_resumption, ticket_key_shm_dead_writer)
+  {
+    RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+    const std::string path = "/tmp/ovpn_test_ticket_keys_dead." + std::to_string(::getpid());
+    ::unlink(path.c_str());
+    TLSSessionTicketKeyShm a(path, rng, "test", Time::Duration::infinite(), 1);
+    TLSSessionTicketBase::Name name0(*rng), name1(*rng);
+    TLSSessionTicketBase::Key key0(*rng), key1(*rng);
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, a.create_session_ticket_key(name0, key0));
+
+    // seq follows the 32-bit magic and version
+    const int fd = ::open(path.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    std::uint64_t seq = 0;
+    ASSERT_EQ(ssize_t(sizeof(seq)), ::pread(fd, &seq, sizeof(seq), 8));
+    seq |= 1;
+    ASSERT_EQ(ssize_t(sizeof(seq)), ::pwrite(fd, &seq, sizeof(seq), 8));
+
+    // the keys may be torn, so a fresh one replaces them
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, a.create_session_ticket_key(name1, key1));
+    ASSERT_NE(name0, name1);
+    ASSERT_EQ(TLSSessionTicketBase::NO_TICKET, a.lookup_session_ticket_key(name0, key1));
+    ASSERT_EQ(ssize_t(sizeof(seq)), ::pread(fd, &seq, sizeof(seq), 8));
+    ASSERT_EQ(0u, seq & 1);
+
+    seq |= 1;
+    ASSERT_EQ(ssize_t(sizeof(seq)), ::pwrite(fd, &seq, sizeof(seq), 8));
+    TLSSessionTicketKeyShm b(path, rng, "test", Time::Duration::infinite(), 1);
+    ASSERT_EQ(ssize_t(sizeof(seq)), ::pread(fd, &seq, sizeof(seq), 8));
+    ASSERT_EQ(0u, seq & 1);
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, b.create_session_ticket_key(name0, key0));
+    ASSERT_EQ(TLSSessionTicketBase::TICKET_AVAILABLE, a.lookup_session_ticket_key(name0, key1));
+    ASSERT_EQ(key0, key1);
+
+    ::close(fd);
+    ::unlink(path.c_str());
+  }
+
+  static void commit_session(const OpenSSLSessionCache::Ptr& cache, const std::string& key, const unsigned char id)
+  {
+    SSL_SESSION* sess = SSL_SESSION_new();
+    SSL_SESSION_set1_id(sess, &id, 1);
+    OpenSSLSessionCache::Key(key, cache).commit(sess);
+  }
+
+  static int extract_session(const OpenSSLSessionCache::Ptr& cache, const std::string& key)
+  {
+    int ret = -1;
+    cache->extract(key, [&ret](SSL_SESSION* sess) {
+	unsigned int len = 0;
+	const unsigned char* id = SSL_SESSION_get_id(sess, &len);
+	ret = len == 1 ? id[0] : -1;
+      });
+    return ret;
+  }
+
+  TEST(session_resumption, client_cache_eviction)
+  {
+    OpenSSLSessionCache::Ptr cache(new OpenSSLSessionCache(2, 2));
+
+    // per-key limit drops the oldest session, newest is used first
+    commit_session(cache, "a", 1);
+    commit_session(cache, "a", 2);
+    commit_session(cache, "a", 3);
+    ASSERT_EQ(2U, cache->size());
+    ASSERT_EQ(3, extract_session(cache, "a"));
+    ASSERT_EQ(2, extract_session(cache, "a"));
+    ASSERT_EQ(-1, extract_session(cache, "a"));
+
+    // key limit drops the least recently committed key
+    commit_session(cache, "a", 4);
+    commit_session(cache, "b", 5);
+    commit_session(cache, "a", 6);
+    commit_session(cache, "c", 7);
+    ASSERT_EQ(-1, extract_session(cache, "b"));
+    ASSERT_EQ(6, extract_session(cache, "a"));
+    ASSERT_EQ(7, extract_session(cache, "c"));
+
+    const OpenSSLSessionCache::Stats& st = cache->stats();
+    ASSERT_EQ(7U, st.inserts);
+    ASSERT_EQ(2U, st.evictions);
+    ASSERT_EQ(4U, st.hits);
+    ASSERT_EQ(2U, st.misses);
+    ASSERT_EQ(1U, cache->size());
+  }
+
+  // Sessions are committed from the handshake thread while the
+  // connecting thread extracts them.
+  TEST(session_resumption, client_cache_threads)
+  {
+    enum {
+      N = 2000,
+    };
+    OpenSSLSessionCache::Ptr cache(new OpenSSLSessionCache(2, 4));
+
+    std::thread committer([&cache]() {
+	for (unsigned int i = 0; i < N; ++i)
+	  commit_session(cache, i & 1 ? "a" : "b", (unsigned char)i);
+      });
+    unsigned int found = 0;
+    for (unsigned int i = 0; i < N; ++i)
+      found += extract_session(cache, i & 1 ? "a" : "b") >= 0;
+    committer.join();
+
+    const OpenSSLSessionCache::Stats st = cache->stats();
+    ASSERT_EQ(unsigned(N), st.inserts);
+    ASSERT_EQ(found, st.hits);
+    ASSERT_EQ(unsigned(N), st.hits + st.misses);
+    ASSERT_EQ(st.inserts - st.hits - st.evictions, cache->size());
+  }
+}
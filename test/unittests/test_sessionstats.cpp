@@ -0,0 +1,129 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  TEST(session_stats, sharded_counters)
+  {
+    SessionStats::Ptr stats(new SessionStats());
+    const unsigned int n_threads = SessionStats::N_SHARDS * 2; // some threads share a slot
+    const count_t n_inc = 100000;
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < n_threads; ++t)
+      threads.emplace_back([&stats, n_inc]() {
+	  for (count_t i = 0; i < n_inc; ++i)
+	    {
+	      stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	      stats->inc_stat(SessionStats::BYTES_IN, 100);
+	    }
+	});
+
+    // concurrent snapshots only ever move forward
+    count_t last = 0;
+    for (int i = 0; i < 1000; ++i)
+      {
+	const SessionStats::Snapshot snap = stats->snapshot();
+	ASSERT_GE(snap.stats[SessionStats::PACKETS_IN], last);
+	last = snap.stats[SessionStats::PACKETS_IN];
+      }
+
+    for (auto& t : threads)
+      t.join();
+
+    ASSERT_EQ(n_inc * n_threads, stats->get_stat(SessionStats::PACKETS_IN));
+    ASSERT_EQ(n_inc * n_threads * 100, stats->get_stat(SessionStats::BYTES_IN));
+    ASSERT_EQ(0, stats->get_stat(SessionStats::BYTES_OUT));
+  }
+
+  // allocations go to the innermost phase only
+  TEST(session_stats, alloc_scope)
+  {
+    SessionStats::Ptr stats(new SessionStats());
+    {
+      SessionStats::AllocScope outer(stats.get(), AllocStats::TUN_READ);
+      BufferAllocated a(64, 0);
+      {
+	SessionStats::AllocScope inner(stats.get(), AllocStats::DATA_ENCRYPT);
+	BufferAllocated b(64, 0);
+	BufferAllocated c(64, 0);
+      }
+    }
+#ifdef OPENVPN_ALLOC_STATS
+    if (!AllocStats::global_new_hooked())
+      {
+	EXPECT_EQ(1, stats->get_stat(SessionStats::ALLOCS_TUN_READ));
+	EXPECT_EQ(2, stats->get_stat(SessionStats::ALLOCS_DATA_ENCRYPT));
+      }
+#else
+    EXPECT_EQ(0, stats->get_stat(SessionStats::ALLOCS_TUN_READ));
+    EXPECT_EQ(0, stats->get_stat(SessionStats::ALLOCS_DATA_ENCRYPT));
+#endif
+    EXPECT_EQ(0, stats->get_stat(SessionStats::ALLOCS_DATA_DECRYPT));
+  }
+
+  static void spin_ms(const int ms)
+  {
+    const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (std::chrono::steady_clock::now() < end)
+      ;
+  }
+
+  // CPU time goes to the innermost scope only
+  TEST(session_stats, cpu_scope)
+  {
+    SessionStats::Ptr stats(new SessionStats());
+    const std::uint64_t crypto_before = CpuStats::thread_ns(CpuStats::CRYPTO);
+    {
+      SessionStats::CpuScope outer(stats.get(), CpuStats::TUN_IO);
+      spin_ms(20);
+      {
+	SessionStats::CpuScope inner(stats.get(), CpuStats::CRYPTO);
+	spin_ms(40);
+      }
+      spin_ms(20);
+    }
+#ifdef OPENVPN_NO_CPU_STATS
+    EXPECT_EQ(0, stats->get_stat(SessionStats::CPU_TUN_IO));
+    EXPECT_EQ(0, stats->get_stat(SessionStats::CPU_CRYPTO));
+#else
+    const count_t tun = stats->get_stat(SessionStats::CPU_TUN_IO);
+    const count_t crypto = stats->get_stat(SessionStats::CPU_CRYPTO);
+    EXPECT_GE(tun, 36000000);
+    EXPECT_LT(tun, 60000000);
+    EXPECT_GE(crypto, 36000000);
+    EXPECT_LT(crypto, 60000000);
+    EXPECT_NEAR(double(crypto), double(CpuStats::thread_ns(CpuStats::CRYPTO) - crypto_before), 100000.0);
+#endif
+    EXPECT_EQ(0, stats->get_stat(SessionStats::CPU_HANDSHAKE));
+  }
+}
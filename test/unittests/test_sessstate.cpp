@@ -0,0 +1,397 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2017 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <deque>
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+
+#include <openvpn/ssl/sessstate.hpp>
+#include <openvpn/server/sessmigrate.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/common/file.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static ProtoSessionState make_state(const unsigned int socket_index)
+  {
+    ProtoSessionState st;
+    st.key_id = 3;
+    st.cipher = "AES-256-GCM";
+    st.compress = 2;
+    st.enable_op32 = true;
+    st.wide_pid = true;
+    st.tls_ekm = true;
+    st.remote_peer_id = 17;
+    st.key_age = 1234;
+    unsigned char *raw = st.key.raw_alloc();
+    for (size_t i = 0; i < OpenVPNStaticKey::KEY_SIZE; ++i)
+      raw[i] = (unsigned char)i;
+    st.data_send.id = 1000;
+    st.data_send.time = 0;
+    st.data_recv.id = 0x100000002;
+    st.data_recv.time = 0;
+    st.control_send.id = 5;
+    st.control_send.time = 1600000000;
+    st.peer_addr = "192.0.2.1";
+    st.peer_port = 1194;
+    st.vpn_ip4 = "10.8.0.6";
+    st.options = "PUSH_REPLY,ping 10";
+    st.socket_index = socket_index;
+    return st;
+  }
+
+  static void expect_same(const ProtoSessionState& a, const ProtoSessionState& b)
+  {
+    EXPECT_EQ(a.key_id, b.key_id);
+    EXPECT_EQ(a.cipher, b.cipher);
+    EXPECT_EQ(a.digest, b.digest);
+    EXPECT_EQ(a.compress, b.compress);
+    EXPECT_EQ(a.compress_asym, b.compress_asym);
+    EXPECT_EQ(a.enable_op32, b.enable_op32);
+    EXPECT_EQ(a.wide_pid, b.wide_pid);
+    EXPECT_EQ(a.tls_ekm, b.tls_ekm);
+    EXPECT_EQ(a.remote_peer_id, b.remote_peer_id);
+    EXPECT_EQ(a.local_peer_id, b.local_peer_id);
+    EXPECT_EQ(a.key_age, b.key_age);
+    ASSERT_TRUE(b.key.defined());
+    EXPECT_EQ(0, std::memcmp(a.key.raw(), b.key.raw(), OpenVPNStaticKey::KEY_SIZE));
+    EXPECT_EQ(a.data_send.id, b.data_send.id);
+    EXPECT_EQ(a.data_recv.id, b.data_recv.id);
+    EXPECT_EQ(a.control_send.id, b.control_send.id);
+    EXPECT_EQ(a.control_send.time, b.control_send.time);
+    EXPECT_FALSE(b.tls_crypt_v2_key.defined());
+    EXPECT_EQ(a.peer_addr, b.peer_addr);
+    EXPECT_EQ(a.peer_port, b.peer_port);
+    EXPECT_EQ(a.vpn_ip4, b.vpn_ip4);
+    EXPECT_EQ(a.vpn_ip6, b.vpn_ip6);
+    EXPECT_EQ(a.options, b.options);
+    EXPECT_EQ(a.socket_index, b.socket_index);
+  }
+
+  TEST(sessstate, roundtrip)
+  {
+    const ProtoSessionState st = make_state(0);
+    BufferAllocated buf(1024, BufferAllocated::GROW);
+    st.serialize(buf);
+
+    ProtoSessionState out;
+    out.parse(buf);
+    EXPECT_TRUE(buf.empty());
+    expect_same(st, out);
+  }
+
+  TEST(sessstate, truncated)
+  {
+    BufferAllocated buf(1024, BufferAllocated::GROW);
+    make_state(0).serialize(buf);
+    buf.set_size(buf.size() - 3);
+    ProtoSessionState out;
+    EXPECT_THROW(out.parse(buf), ProtoSessionState::proto_session_state_error);
+  }
+
+  TEST(sessstate, packet_id_resume)
+  {
+    PacketIDSend ps;
+    ps.init(PacketID::SHORT_FORM);
+    ps.next(0);
+    ps.next(0);
+
+    PacketIDSend ps2;
+    ps2.init(PacketID::SHORT_FORM);
+    ps2.resume(ps.last());
+    EXPECT_EQ(3u, ps2.next(0).id);
+
+    PacketIDReceive pr;
+    pr.init(PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM, "DATA", 0, SessionStats::Ptr(new SessionStats()));
+    PacketID pid;
+    pid.time = 0;
+    for (pid.id = 1; pid.id <= 100; ++pid.id)
+      ASSERT_TRUE(pr.test_add(pid, 0, true));
+
+    // nothing at or below the highest ID is accepted after resume
+    PacketIDReceive pr2;
+    pr2.init(PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM, "DATA", 0, SessionStats::Ptr(new SessionStats()));
+    pr2.resume(pr.high());
+    pid.id = 100;
+    EXPECT_FALSE(pr2.test_add(pid, 0, true));
+    pid.id = 90;
+    EXPECT_FALSE(pr2.test_add(pid, 0, true));
+    pid.id = 102;
+    EXPECT_TRUE(pr2.test_add(pid, 0, true));
+    pid.id = 101;
+    EXPECT_TRUE(pr2.test_add(pid, 0, true));
+    EXPECT_FALSE(pr2.test_add(pid, 0, true));
+  }
+
+  TEST(sessstate, migrate_socketpair)
+  {
+    int sv[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    ScopedFD a(sv[0]);
+    ScopedFD b(sv[1]);
+
+    int pipefd[2];
+    ASSERT_EQ(0, ::pipe(pipefd));
+    ScopedFD pr(pipefd[0]);
+    ScopedFD pw(pipefd[1]);
+
+    std::vector<ProtoSessionState> states;
+    states.push_back(make_state(0));
+    states.push_back(make_state(1));
+    states[1].options = std::string(100000, 'x'); // larger than a socket buffer
+
+    // send from a thread, since the payload may not fit in the socket buffer
+    std::thread sender([&]() {
+	SessionMigrate::send(a(), { pr(), pw() }, states);
+      });
+    std::vector<ScopedFD> fds;
+    std::vector<ProtoSessionState> out;
+    SessionMigrate::receive(b(), fds, out);
+    sender.join();
+
+    ASSERT_EQ(2u, fds.size());
+    ASSERT_EQ(2u, out.size());
+    expect_same(states[0], out[0]);
+    expect_same(states[1], out[1]);
+
+    // the received fds refer to the same pipe
+    ASSERT_EQ(1, ::write(fds[1](), "z", 1));
+    char c = 0;
+    ASSERT_EQ(1, ::read(pr(), &c, 1));
+    EXPECT_EQ('z', c);
+  }
+
+  TEST(sessstate, migrate_bad_socket_index)
+  {
+    int sv[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    ScopedFD a(sv[0]);
+    ScopedFD b(sv[1]);
+    std::vector<ProtoSessionState> states;
+    states.push_back(make_state(1));
+    EXPECT_THROW(SessionMigrate::send(a(), { b() }, states), SessionMigrate::session_migrate_error);
+  }
+
+  class SessResumeProto : public ProtoContext
+  {
+  public:
+    SessResumeProto(const Config::Ptr& config, const SessionStats::Ptr& stats)
+      : ProtoContext(config, stats)
+    {
+    }
+
+    std::deque<BufferPtr> net_out;
+
+  private:
+    void control_net_send(const Buffer& net_buf) override
+    {
+      net_out.push_back(BufferPtr(new BufferAllocated(net_buf, 0)));
+    }
+
+    void control_recv(BufferPtr&& app_bp) override
+    {
+    }
+  };
+
+  // Export the server side of an established session and resume it
+  // in a new ProtoContext, as a process taking the session over would.
+  class SessResumeTest : public testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      OpenSSLContext::SSL::init_static();
+
+      ::EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+      EVP_PKEY_keygen_init(pctx);
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+      EVP_PKEY_keygen(pctx, &key);
+      EVP_PKEY_CTX_free(pctx);
+
+      ::X509* x = X509_new();
+      ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+      X509_gmtime_adj(X509_getm_notBefore(x), -3600);
+      X509_gmtime_adj(X509_getm_notAfter(x), 86400);
+      X509_NAME_add_entry_by_txt(X509_get_subject_name(x), "CN", MBSTRING_ASC, (const unsigned char *)"server", -1, -1, 0);
+      X509_set_issuer_name(x, X509_get_subject_name(x));
+      X509_set_pubkey(x, key);
+      X509_sign(x, key, EVP_sha256());
+      cert = OpenSSLPKI::X509(x);
+
+      rng.reset(new SSLLib::RandomAPI(false));
+      prng.reset(new SSLLib::RandomAPI(true));
+    }
+
+    void TearDown() override
+    {
+      EVP_PKEY_free(key);
+    }
+
+    ProtoContext::Config::Ptr proto_config(const bool server)
+    {
+      OpenSSLContext::Config::Ptr sc = new OpenSSLContext::Config();
+      sc->set_mode(Mode(server ? Mode::SERVER : Mode::CLIENT));
+      sc->set_flags(SSLConst::NO_VERIFY_PEER);
+      sc->set_frame(frame);
+      sc->set_rng(rng);
+      if (server)
+	{
+	  BIO* bio = BIO_new(BIO_s_mem());
+	  PEM_write_bio_PrivateKey(bio, key, nullptr, nullptr, 0, nullptr, nullptr);
+	  char *data;
+	  const long len = BIO_get_mem_data(bio, &data);
+	  const std::string key_pem(data, len);
+	  BIO_free(bio);
+
+	  sc->load_cert(cert.render_pem());
+	  sc->load_private_key(key_pem);
+	  sc->load_dh(read_text(UNITTEST_SOURCE_DIR "../ssl/dh.pem"));
+	}
+      else
+	sc->set_local_cert_enabled(false);
+
+      ProtoContext::Config::Ptr c(new ProtoContext::Config);
+      c->ssl_factory = sc->new_factory();
+      c->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, stats, prng));
+      c->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+      c->frame = frame;
+      c->now = &now;
+      c->rng = rng;
+      c->prng = prng;
+      c->protocol = Protocol(Protocol::UDPv4);
+      c->layer = Layer(Layer::OSI_LAYER_3);
+      c->dc.set_cipher(CryptoAlgs::lookup("AES-256-GCM"));
+      c->dc.set_digest(CryptoAlgs::NONE);
+      c->reliable_window = 4;
+      c->max_ack_list = 4;
+      c->pid_mode = PacketIDReceive::UDP_MODE;
+      c->handshake_window = Time::Duration::seconds(60);
+      c->become_primary = c->handshake_window;
+      c->renegotiate = Time::Duration::seconds(3600);
+      c->expire = c->renegotiate + c->renegotiate;
+      c->keepalive_ping = Time::Duration::seconds(10);
+      c->keepalive_timeout = Time::Duration::seconds(60);
+      c->session_export = server;
+      return c;
+    }
+
+    static void xfer(SessResumeProto& a, SessResumeProto& b)
+    {
+      a.housekeeping();
+      a.flush(true);
+      while (!a.net_out.empty())
+	{
+	  BufferPtr bp = std::move(a.net_out.front());
+	  a.net_out.pop_front();
+	  b.control_net_recv(b.packet_type(*bp), std::move(bp));
+	}
+      b.flush(true);
+    }
+
+    // Encrypt payload on a, decrypt it on b, and return what b got.
+    std::string data(SessResumeProto& a, SessResumeProto& b, const std::string& payload)
+    {
+      BufferAllocated buf;
+      frame->prepare(Frame::READ_LINK_UDP, buf);
+      buf.write((const unsigned char *)payload.c_str(), payload.size());
+      a.data_encrypt(buf);
+      if (!b.data_decrypt(b.packet_type(buf), buf))
+	return std::string();
+      return std::string((const char *)buf.c_data(), buf.size());
+    }
+
+    void resume(const bool tls_ekm)
+    {
+      SessResumeProto cli(proto_config(false), stats);
+      SessResumeProto serv(proto_config(true), stats);
+      cli.reset();
+      serv.reset();
+      if (tls_ekm)
+	{
+	  cli.enable_tls_ekm();
+	  serv.enable_tls_ekm();
+	}
+      cli.start();
+      serv.start();
+      for (int i = 0; i < 100 && !(cli.data_channel_ready() && serv.data_channel_ready()); ++i)
+	{
+	  xfer(cli, serv);
+	  xfer(serv, cli);
+	  now += Time::Duration::milliseconds(100);
+	}
+      ASSERT_TRUE(cli.data_channel_ready());
+      ASSERT_TRUE(serv.data_channel_ready());
+      ASSERT_EQ("before", data(cli, serv, "before"));
+      ASSERT_EQ("before", data(serv, cli, "before"));
+
+      ProtoSessionState exported;
+      serv.export_session(exported);
+      EXPECT_EQ(tls_ekm, exported.tls_ekm);
+      BufferAllocated buf(1024, BufferAllocated::GROW);
+      exported.serialize(buf);
+      ProtoSessionState st;
+      st.parse(buf);
+
+      // the old server sends no more data packets, see export_session()
+      SessResumeProto resumed(proto_config(true), stats);
+      resumed.reset();
+      resumed.resume_session(st);
+      ASSERT_TRUE(resumed.data_channel_ready());
+      EXPECT_EQ(tls_ekm, resumed.tls_ekm_enabled());
+      EXPECT_EQ("to server", data(cli, resumed, "to server"));
+      EXPECT_EQ("to client", data(resumed, cli, "to client"));
+      EXPECT_EQ("to server again", data(cli, resumed, "to server again"));
+    }
+
+    ::EVP_PKEY* key = nullptr;
+    OpenSSLPKI::X509 cert;
+    RandomAPI::Ptr rng;
+    RandomAPI::Ptr prng;
+    Frame::Ptr frame = frame_init_simple(2048);
+    SessionStats::Ptr stats = new SessionStats();
+    Time now = Time::now();
+  };
+
+  TEST_F(SessResumeTest, tls_prf)
+  {
+    resume(false);
+  }
+
+  TEST_F(SessResumeTest, tls_ekm)
+  {
+    resume(true);
+  }
+}
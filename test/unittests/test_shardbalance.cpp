@@ -0,0 +1,183 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <openvpn/common/file.hpp>
+#include <openvpn/linux/numa.hpp>
+#include <openvpn/transport/server/shardbalance.hpp>
+
+using namespace openvpn;
+using namespace openvpn::UDPTransport;
+
+namespace unittests
+{
+  struct Recorder : public ShardRecv
+  {
+    void shard_recv(BufferAllocated& buf, const PeerAddr::Ptr& addr, const unsigned int from_shard) override
+    {
+      ++n;
+      last_size = buf.size();
+      last_port = addr->remote.port;
+      last_from = from_shard;
+    }
+
+    unsigned int n = 0;
+    size_t last_size = 0;
+    unsigned int last_port = 0;
+    unsigned int last_from = 0;
+  };
+
+  static void add_load(ShardBalancer& b, const unsigned int shard, const unsigned int packets)
+  {
+    b.count_packets(shard, packets);
+  }
+
+  TEST(shardbalance, stays_when_balanced)
+  {
+    ShardBalancer b(4);
+    for (unsigned int i = 0; i < 4; ++i)
+      add_load(b, i, 1000);
+    b.sample();
+    for (unsigned int i = 0; i < 4; ++i)
+      ASSERT_EQ(i, b.place(i));
+  }
+
+  TEST(shardbalance, moves_off_busy_shard)
+  {
+    openvpn_io::io_context io;
+    ShardBalancer b(4);
+    for (unsigned int i = 0; i < 4; ++i)
+      b.attach(i, io, i < 2 ? 0 : 1);
+    add_load(b, 0, 100000);
+    add_load(b, 1, 9500);
+    add_load(b, 2, 9000);
+    add_load(b, 3, 100000);
+    b.sample();
+
+    // shard 1 is on shard 0's node and within SAME_NODE_PCT of the minimum
+    ASSERT_EQ(1u, b.place(0));
+
+    // shard 3's node peer is idle enough
+    ASSERT_EQ(2u, b.place(3));
+  }
+
+  TEST(shardbalance, burst_is_spread)
+  {
+    ShardBalancer b(3);
+    for (unsigned int i = 0; i < 3; ++i)
+      b.session_up(i);
+    add_load(b, 0, 30000);
+    add_load(b, 1, 1000);
+    add_load(b, 2, 1000);
+    b.sample();
+
+    // each placement charges the target, so a burst doesn't all land on one shard
+    unsigned int hist[3] = { 0, 0, 0 };
+    for (unsigned int i = 0; i < 30; ++i)
+      ++hist[b.place(0)];
+    ASSERT_GT(hist[1], 5u);
+    ASSERT_GT(hist[2], 5u);
+  }
+
+  TEST(shardbalance, forward_and_release)
+  {
+    openvpn_io::io_context io;
+    ShardBalancer::Ptr b(new ShardBalancer(2));
+    b->attach(0, io, 0);
+    b->attach(1, io, 0);
+    Recorder r0, r1;
+    b->set_recv(0, &r0);
+    b->set_recv(1, &r1);
+    add_load(*b, 0, 100000);
+    b->sample();
+
+    PeerAddr addr;
+    addr.remote.addr = IP::Addr("10.1.2.3");
+    addr.remote.port = 4242;
+    BufferAllocated buf(64, 0);
+    buf.write((const unsigned char *)"hello", 5);
+
+    ASSERT_EQ(-1, b->redirect_of(0, addr.remote));
+    ASSERT_TRUE(b->forward_new(0, buf, addr));
+    ASSERT_EQ(1, b->redirect_of(0, addr.remote));
+    io.run();
+    io.restart();
+    ASSERT_EQ(1u, r1.n);
+    ASSERT_EQ(0u, r0.n);
+    ASSERT_EQ(5u, r1.last_size);
+    ASSERT_EQ(4242u, r1.last_port);
+    ASSERT_EQ(0u, r1.last_from);
+
+    // later packets of the peer follow the redirect
+    BufferAllocated buf2(64, 0);
+    buf2.write((const unsigned char *)"ab", 2);
+    b->forward(0, 1, buf2, addr);
+    io.run();
+    io.restart();
+    ASSERT_EQ(2u, r1.n);
+    ASSERT_EQ(2u, r1.last_size);
+
+    b->release(0, addr.remote);
+    io.run();
+    ASSERT_EQ(-1, b->redirect_of(0, addr.remote));
+  }
+
+  TEST(shardbalance, parse_cpulist)
+  {
+    ASSERT_EQ(std::vector<int>({ 0, 1, 2, 3, 8, 10, 11 }), NUMA::parse_cpulist("0-3,8,10-11\n"));
+    ASSERT_EQ(std::vector<int>({ 5 }), NUMA::parse_cpulist("5"));
+    ASSERT_TRUE(NUMA::parse_cpulist("\n").empty());
+    ASSERT_THROW(NUMA::parse_cpulist("3-1"), NUMA::numa_error);
+    ASSERT_THROW(NUMA::parse_cpulist("x"), NUMA::numa_error);
+  }
+
+  TEST(shardbalance, numa_topology)
+  {
+    char tmpl[] = "/tmp/numa_test.XXXXXX";
+    ASSERT_NE(nullptr, ::mkdtemp(tmpl));
+    const std::string root = tmpl;
+    ::mkdir((root + "/node").c_str(), 0700);
+    ::mkdir((root + "/node/node0").c_str(), 0700);
+    ::mkdir((root + "/node/node1").c_str(), 0700);
+    write_string(root + "/node/online", "0-1\n");
+    write_string(root + "/node/node0/cpulist", "0-5\n");
+    write_string(root + "/node/node1/cpulist", "6-7\n");
+
+    const NUMA::Topology topo(root);
+    ASSERT_EQ(2u, topo.size());
+    ASSERT_EQ(1u, topo.index_of_cpu(7));
+    ASSERT_EQ(0u, topo.index_of_cpu(2));
+
+    // 8 threads over 6 + 2 CPUs
+    ASSERT_EQ(std::vector<size_t>({ 0, 0, 0, 0, 0, 0, 1, 1 }), topo.spread(8));
+    ASSERT_EQ(std::vector<size_t>({ 0, 0, 0, 1 }), topo.spread(4));
+
+    // no node directory: a single node
+    const NUMA::Topology none(root + "/missing");
+    ASSERT_EQ(1u, none.size());
+
+    ::system(("rm -rf " + root).c_str());
+  }
+}
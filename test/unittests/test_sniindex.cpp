@@ -0,0 +1,182 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/ssl/sni_index.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  namespace {
+    struct FakeFactory : public SSLFactoryAPI
+    {
+      FakeFactory(std::string name_arg)
+	: name(std::move(name_arg))
+      {
+      }
+
+      SSLAPI::Ptr ssl() override
+      {
+	return SSLAPI::Ptr();
+      }
+
+      SSLAPI::Ptr ssl(const std::string* hostname, const std::string* cache_key) override
+      {
+	return SSLAPI::Ptr();
+      }
+
+      const Mode& mode() const override
+      {
+	return mode_;
+      }
+
+      std::string name;
+      Mode mode_{Mode::SERVER};
+    };
+
+    struct TestMetadata : public SNI::Metadata
+    {
+      TestMetadata(std::string name_arg)
+	: name(std::move(name_arg))
+      {
+      }
+
+      std::string sni_client_name(const AuthCert& ac) const override
+      {
+	return name;
+      }
+
+      std::string name;
+    };
+  }
+
+  class SNIIndexTest : public testing::Test
+  {
+  protected:
+    void add(SNI::IndexedHandler& h, const std::string& name)
+    {
+      h.add(name, [this, name]() {
+	  ++loads;
+	  return SSLFactoryAPI::Ptr(new FakeFactory(name));
+	});
+    }
+
+    std::string hello(const SNI::IndexedHandler& h, const std::string& sni_name)
+    {
+      SNI::Metadata::UPtr md;
+      SSLFactoryAPI::Ptr f = h.sni_hello(sni_name, md, SSLConfigAPI::Ptr());
+      return f ? static_cast<FakeFactory*>(f.get())->name : std::string();
+    }
+
+    int loads = 0;
+  };
+
+  TEST_F(SNIIndexTest, lookup)
+  {
+    SNI::IndexedHandler h;
+    add(h, "vpn.example.com");
+    add(h, "*.example.com");
+    add(h, "*.tenant.example.net");
+    EXPECT_EQ(h.size(), 3u);
+    EXPECT_EQ(loads, 0);
+
+    EXPECT_EQ(hello(h, "vpn.example.com"), "vpn.example.com");
+    EXPECT_EQ(hello(h, "VPN.Example.COM"), "vpn.example.com");
+    EXPECT_EQ(hello(h, "other.example.com"), "*.example.com");
+    EXPECT_EQ(hello(h, "a.tenant.example.net"), "*.tenant.example.net");
+
+    // a wildcard matches one label only
+    EXPECT_EQ(hello(h, "example.com"), "");
+    EXPECT_EQ(hello(h, "a.b.example.com"), "");
+    EXPECT_EQ(hello(h, "tenant.example.net"), "");
+    EXPECT_EQ(hello(h, ".example.com"), "");
+
+    EXPECT_THROW(add(h, ""), SNI::IndexedHandler::sni_index_error);
+    EXPECT_THROW(add(h, "*."), SNI::IndexedHandler::sni_index_error);
+    EXPECT_THROW(add(h, "a.*.example.com"), SNI::IndexedHandler::sni_index_error);
+  }
+
+  TEST_F(SNIIndexTest, lazy_and_lru)
+  {
+    SNI::IndexedHandler h(2);
+    add(h, "a.example");
+    add(h, "b.example");
+    add(h, "c.example");
+
+    EXPECT_EQ(hello(h, "a.example"), "a.example");
+    EXPECT_EQ(hello(h, "a.example"), "a.example");
+    EXPECT_EQ(loads, 1);
+    EXPECT_EQ(h.hits(), 1u);
+
+    EXPECT_EQ(hello(h, "b.example"), "b.example");
+    EXPECT_EQ(hello(h, "a.example"), "a.example"); // a is now most recent
+    EXPECT_EQ(hello(h, "c.example"), "c.example"); // evicts b
+    EXPECT_EQ(loads, 3);
+    EXPECT_EQ(h.evictions(), 1u);
+    EXPECT_EQ(h.n_contexts(), 2u);
+
+    EXPECT_EQ(hello(h, "a.example"), "a.example");
+    EXPECT_EQ(loads, 3);
+    EXPECT_EQ(hello(h, "b.example"), "b.example");
+    EXPECT_EQ(loads, 4);
+    EXPECT_EQ(h.misses(), 4u);
+
+    // replacing or removing a name drops its context
+    add(h, "b.example");
+    EXPECT_EQ(h.n_contexts(), 1u);
+    EXPECT_TRUE(h.remove("a.example"));
+    EXPECT_FALSE(h.remove("a.example"));
+    EXPECT_EQ(h.n_contexts(), 0u);
+    EXPECT_EQ(hello(h, "a.example"), "");
+  }
+
+  TEST_F(SNIIndexTest, metadata)
+  {
+    SNI::IndexedHandler h;
+    h.add("*.example.org",
+	  [this]() {
+	    ++loads;
+	    return SSLFactoryAPI::Ptr(new FakeFactory("org"));
+	  },
+	  [](const std::string& sni_name) {
+	    return SNI::Metadata::UPtr(new TestMetadata(sni_name));
+	  });
+    SNI::Metadata::UPtr md;
+    ASSERT_TRUE(h.sni_hello("host.example.org", md, SSLConfigAPI::Ptr()));
+    ASSERT_TRUE(md);
+    EXPECT_EQ(static_cast<TestMetadata*>(md.get())->name, "host.example.org");
+  }
+
+  TEST_F(SNIIndexTest, many_tenants)
+  {
+    SNI::IndexedHandler h(100);
+    for (int i = 0; i < 5000; ++i)
+      add(h, "t" + std::to_string(i) + ".example.com");
+    for (int round = 0; round < 2; ++round)
+      for (int i = 0; i < 5000; i += 7)
+	EXPECT_EQ(hello(h, "t" + std::to_string(i) + ".example.com"), "t" + std::to_string(i) + ".example.com");
+    EXPECT_EQ(h.n_contexts(), 100u);
+    EXPECT_EQ(h.evictions(), size_t(loads) - 100);
+  }
+}
@@ -0,0 +1,113 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <string>
+
+#include <openvpn/client/sslfactorycache.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  class FakeFactory : public SSLFactoryAPI
+  {
+  public:
+    virtual SSLAPI::Ptr ssl() override { return SSLAPI::Ptr(); }
+    virtual SSLAPI::Ptr ssl(const std::string*, const std::string*) override { return SSLAPI::Ptr(); }
+    virtual const Mode& mode() const override { return mode_; }
+
+  private:
+    Mode mode_;
+  };
+
+  static SSLFactoryCache::Entry make_entry()
+  {
+    SSLFactoryCache::Entry e;
+    e.factory.reset(new FakeFactory());
+    return e;
+  }
+
+  TEST(sslfactorycache, take_put)
+  {
+    SSLFactoryCache& cache = SSLFactoryCache::instance();
+    cache.clear();
+
+    SSLFactoryCache::Entry e;
+    ASSERT_FALSE(cache.take("profile", e));
+
+    SSLFactoryCache::Entry built = make_entry();
+    const SSLFactoryAPI* f = built.factory.get();
+    cache.put("profile", std::move(built));
+    ASSERT_EQ(1u, cache.size());
+
+    // checked out by one session at a time
+    ASSERT_TRUE(cache.take("profile", e));
+    ASSERT_EQ(f, e.factory.get());
+    SSLFactoryCache::Entry e2;
+    ASSERT_FALSE(cache.take("profile", e2));
+    ASSERT_FALSE(cache.take("other", e2));
+
+    cache.put("profile", std::move(e));
+    ASSERT_TRUE(cache.take("profile", e2));
+    ASSERT_EQ(f, e2.factory.get());
+    cache.clear();
+  }
+
+  TEST(sslfactorycache, evict_oldest)
+  {
+    SSLFactoryCache& cache = SSLFactoryCache::instance();
+    cache.clear();
+    for (int i = 0; i <= SSLFactoryCache::MAX_ENTRIES; ++i)
+      cache.put(std::to_string(i), make_entry());
+    ASSERT_EQ(size_t(SSLFactoryCache::MAX_ENTRIES), cache.size());
+
+    SSLFactoryCache::Entry e;
+    ASSERT_FALSE(cache.take("0", e));
+    ASSERT_TRUE(cache.take(std::to_string(SSLFactoryCache::MAX_ENTRIES), e));
+    cache.clear();
+  }
+
+  // options consumed by building the factory are consumed again on
+  // reuse, so they don't show up as unused
+  TEST(sslfactorycache, touched)
+  {
+    OptionList opt = OptionList::parse_from_config_static("client\nca ca.crt\ncert c.crt\nverb 3\n", nullptr);
+    opt.update_map();
+    opt[0].touch();
+
+    SSLFactoryCache::Entry e = make_entry();
+    const std::vector<bool> untouched = SSLFactoryCache::Entry::untouched(opt);
+    opt.get("ca");
+    opt.get("cert");
+    e.set_touched(opt, untouched);
+    ASSERT_EQ(std::vector<size_t>({ 1, 2 }), e.touched);
+
+    OptionList opt2 = OptionList::parse_from_config_static("client\nca ca.crt\ncert c.crt\nverb 3\n", nullptr);
+    e.touch(opt2);
+    ASSERT_FALSE(opt2[0].touched());
+    ASSERT_TRUE(opt2[1].touched());
+    ASSERT_TRUE(opt2[2].touched());
+    ASSERT_FALSE(opt2[3].touched());
+  }
+}
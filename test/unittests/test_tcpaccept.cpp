@@ -0,0 +1,113 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <vector>
+
+#include <openvpn/acceptor/tcp.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+#ifdef OPENVPN_ACCEPTOR_TCP_CBPF
+  // Run the steering program as the kernel would for a packet
+  // processed on cpu, for the instructions it uses.
+  static unsigned int run_steering(const unsigned int cpu, const unsigned int n_cpus)
+  {
+    struct sock_filter code[Acceptor::TCP::CPU_STEERING_LEN];
+    Acceptor::TCP::cpu_steering_program(code, n_cpus);
+    std::uint32_t a = 0;
+    for (const auto& insn : code)
+      {
+	if (insn.code == (BPF_LD|BPF_W|BPF_ABS) && insn.k == (__u32)(SKF_AD_OFF + SKF_AD_CPU))
+	  a = cpu;
+	else if (insn.code == (BPF_ALU|BPF_MOD|BPF_K))
+	  a %= insn.k;
+	else if (insn.code == (BPF_RET|BPF_A))
+	  return a;
+	else
+	  ADD_FAILURE() << "unexpected instruction " << insn.code;
+      }
+    ADD_FAILURE() << "no return";
+    return 0;
+  }
+
+  // each CPU's connections go to the acceptor bound in its position
+  TEST(TCPAccept, cpu_steering_program)
+  {
+    for (unsigned int n_cpus = 2; n_cpus <= 8; ++n_cpus)
+      for (unsigned int cpu = 0; cpu < 64; ++cpu)
+	EXPECT_EQ(cpu % n_cpus, run_steering(cpu, n_cpus));
+  }
+
+  // The kernel takes the program, and every connection is accepted
+  // by some acceptor of the group.  Which one depends on the CPU
+  // that processes the handshake, so isn't checked here.
+  TEST(TCPAccept, cpu_steering_group)
+  {
+    enum { N_CPUS = 2, N_CONN = 16 };
+    openvpn_io::io_context io_context;
+    std::vector<Acceptor::TCP::Ptr> acceptors;
+    unsigned short port = 0;
+    for (unsigned int cpu = 0; cpu < N_CPUS; ++cpu)
+      {
+	Acceptor::TCP::Ptr a(new Acceptor::TCP(io_context));
+	a->local_endpoint = openvpn_io::ip::tcp::endpoint(openvpn_io::ip::address_v4::loopback(), port);
+	a->acceptor.open(a->local_endpoint.protocol());
+	a->set_socket_options(Acceptor::TCP::REUSE_PORT);
+	a->set_incoming_cpu(int(cpu));
+	a->acceptor.bind(a->local_endpoint);
+	if (cpu == 0)
+	  {
+	    ASSERT_NO_THROW(a->attach_cpu_steering(N_CPUS));
+	    port = a->acceptor.local_endpoint().port();
+	  }
+	a->acceptor.listen(N_CONN);
+	a->acceptor.non_blocking(true);
+	acceptors.push_back(std::move(a));
+      }
+
+    const openvpn_io::ip::tcp::endpoint ep = acceptors[0]->acceptor.local_endpoint();
+    std::vector<openvpn_io::ip::tcp::socket> clients;
+    for (int i = 0; i < N_CONN; ++i)
+      {
+	clients.emplace_back(io_context);
+	clients.back().connect(ep);
+      }
+
+    size_t accepted = 0;
+    for (const auto& a : acceptors)
+      for (;;)
+	{
+	  openvpn_io::ip::tcp::socket s(io_context);
+	  openvpn_io::error_code error;
+	  a->acceptor.accept(s, error);
+	  if (error)
+	    break;
+	  ++accepted;
+	}
+    EXPECT_EQ(size_t(N_CONN), accepted);
+  }
+#endif
+}
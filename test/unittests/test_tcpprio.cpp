@@ -0,0 +1,190 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <thread>
+#include <string>
+#include <vector>
+
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/transport/tcplink.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  struct PrioHandler
+  {
+    typedef TCPTransport::Link<openvpn_io::ip::tcp, PrioHandler*, false> LinkImpl;
+
+    bool tcp_read_handler(BufferAllocated& buf)
+    {
+      const std::string data = buf_to_string(buf);
+      received.push_back(data.substr(0, 5));
+      stream += data;
+      return true;
+    }
+
+    // sender side: all sent
+    void tcp_write_queue_needs_send()
+    {
+      socket->shutdown(openvpn_io::ip::tcp::socket::shutdown_send);
+    }
+
+    void tcp_eof_handler() { link->stop(); }
+    void tcp_error_handler(const char *error) { this->error = error; link->stop(); }
+
+    LinkImpl* link = nullptr;
+    openvpn_io::ip::tcp::socket* socket = nullptr;
+    std::vector<std::string> received;
+    std::string stream;
+    std::string error;
+  };
+
+  struct DropStats : public SessionStats
+  {
+    void error(const size_t type, const std::string* text=nullptr) override
+    {
+      if (type == Error::TCP_OVERFLOW)
+	++drops;
+    }
+
+    size_t drops = 0;
+  };
+
+  class TCPPrioTest : public testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      openvpn_io::ip::tcp::acceptor acceptor(io_context, openvpn_io::ip::tcp::endpoint(openvpn_io::ip::make_address("127.0.0.1"), 0));
+      client.connect(acceptor.local_endpoint());
+      acceptor.accept(server);
+
+      sender.socket = &client;
+      send_link.reset(new PrioHandler::LinkImpl(&sender, client, 0, 8, (*frame)[Frame::READ_LINK_TCP], stats));
+      sender.link = send_link.get();
+      recv_link.reset(new PrioHandler::LinkImpl(&receiver, server, 0, 8, (*frame)[Frame::READ_LINK_TCP], stats));
+      receiver.link = recv_link.get();
+      recv_link->start();
+    }
+
+    void send(const std::string& name, const size_t size, const TCPTransport::SendClass* cls = nullptr)
+    {
+      BufferAllocated buf;
+      (*frame)[Frame::ENCRYPT_WORK].prepare(buf);
+      buf_append_string(buf, name);
+      buf.write_alloc(size - name.length());
+      if (cls)
+	send_link->send(buf, *cls);
+      else
+	send_link->send(buf);
+    }
+
+    // first packet starts a write, the rest queue behind it
+    void send_mix()
+    {
+      const TCPTransport::SendClass control = TCPTransport::SEND_CONTROL;
+      for (int i = 0; i < 10; ++i)
+	send("B" + std::to_string(1000 + i), 1200);
+      send("S1000", 100);
+      send("C1000", 100, &control);
+      send("S1001", 100);
+      send("C1001", 100, &control);
+    }
+
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::tcp::socket client{io_context};
+    openvpn_io::ip::tcp::socket server{io_context};
+    Frame::Ptr frame = frame_init(true, 1500, 1024, false);
+    RCPtr<DropStats> stats{new DropStats()};
+    PrioHandler sender;
+    PrioHandler receiver;
+    PrioHandler::LinkImpl::Ptr send_link;
+    PrioHandler::LinkImpl::Ptr recv_link;
+  };
+
+  TEST_F(TCPPrioTest, fifo)
+  {
+    send_mix();
+    io_context.run();
+    ASSERT_EQ("", receiver.error);
+    EXPECT_EQ((std::vector<std::string>{"B1000", "B1001", "B1002", "B1003", "B1004",
+					"B1005", "B1006", "B1007", "B1008", "B1009",
+					"S1000", "C1000", "S1001", "C1001"}), receiver.received);
+  }
+
+  TEST_F(TCPPrioTest, priority)
+  {
+    send_link->set_send_priority(TCPTransport::SendPriority());
+    send_mix();
+    EXPECT_EQ(14u, send_link->send_queue_size());
+    io_context.run();
+    ASSERT_EQ("", receiver.error);
+    EXPECT_EQ((std::vector<std::string>{"B1000", "C1000", "C1001", "S1000", "S1001",
+					"B1001", "B1002", "B1003", "B1004", "B1005",
+					"B1006", "B1007", "B1008", "B1009"}), receiver.received);
+  }
+
+  // raw streams are never reordered
+  TEST_F(TCPPrioTest, raw)
+  {
+    send_link->set_send_priority(TCPTransport::SendPriority());
+    send_link->set_raw_mode_write(true);
+    recv_link->set_raw_mode_read(true);
+    const TCPTransport::SendClass control = TCPTransport::SEND_CONTROL;
+    send("B1000", 100);
+    send("B1001", 100);
+    send("C1000", 100, &control);
+    io_context.run();
+    ASSERT_EQ("", receiver.error);
+    ASSERT_EQ(300u, receiver.stream.length());
+    EXPECT_EQ("B1000", receiver.stream.substr(0, 5));
+    EXPECT_EQ("B1001", receiver.stream.substr(100, 5));
+    EXPECT_EQ("C1000", receiver.stream.substr(200, 5));
+  }
+
+  // bulk data queued for longer than the target is dropped, the
+  // rest arrives in order
+  TEST_F(TCPPrioTest, codel)
+  {
+    TCPTransport::SendPriority prio;
+    prio.target_ns = 1;
+    prio.interval_ns = 1;
+    send_link->set_send_priority(prio);
+    const TCPTransport::SendClass control = TCPTransport::SEND_CONTROL;
+    for (int i = 0; i < 500; ++i)
+      send("B" + std::to_string(1000 + i), 1000);
+    send("C1000", 100, &control);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    io_context.run();
+    ASSERT_EQ("", receiver.error);
+
+    EXPECT_GT(stats->drops, 0u);
+    EXPECT_LT(stats->drops, 500u);
+    EXPECT_EQ(501u, receiver.received.size() + stats->drops);
+    EXPECT_EQ("C1000", receiver.received.at(1));
+    EXPECT_TRUE(std::is_sorted(receiver.received.begin() + 2, receiver.received.end()));
+  }
+}
@@ -0,0 +1,127 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <thread>
+
+#include <openvpn/common/threadpolicy.hpp>
+#include <openvpn/time/asiotimer.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static void post_chain(openvpn_io::io_context& io_context, int& n)
+  {
+    if (--n > 0)
+      openvpn_io::post(io_context, [&io_context, &n]() { post_chain(io_context, n); });
+  }
+
+  TEST(ThreadPolicy, run_until_done)
+  {
+    openvpn_io::io_context io_context;
+    int n = 100;
+    post_chain(io_context, n);
+    ThreadStats stats;
+    run_io_context(io_context, ThreadPolicy(), &stats);
+    EXPECT_EQ(0, n);
+    EXPECT_EQ(99u, stats.handlers.load());
+    EXPECT_EQ(0u, stats.blocks.load());
+    EXPECT_GT(stats.latency.count(), 0u);
+  }
+
+  // an event that arrives while spinning is run without blocking
+  TEST(ThreadPolicy, spin)
+  {
+    openvpn_io::io_context io_context;
+    AsioTimer timer(io_context);
+    bool fired = false;
+    timer.expires_after(Time::Duration::binary_ms(2));
+    timer.async_wait([&fired](const openvpn_io::error_code& error) { fired = !error; });
+
+    ThreadPolicy policy;
+    policy.spin_us = 1000000;
+    ThreadStats stats;
+    run_io_context(io_context, policy, &stats);
+    EXPECT_TRUE(fired);
+    EXPECT_EQ(1u, stats.spin_handlers.load());
+    EXPECT_EQ(0u, stats.blocks.load());
+  }
+
+  TEST(ThreadPolicy, block)
+  {
+    openvpn_io::io_context io_context;
+    AsioTimer timer(io_context);
+    bool fired = false;
+    timer.expires_after(Time::Duration::binary_ms(2));
+    timer.async_wait([&fired](const openvpn_io::error_code& error) { fired = !error; });
+
+    ThreadPolicy policy;
+    policy.spin_us = 10;
+    ThreadStats stats;
+    run_io_context(io_context, policy, &stats);
+    EXPECT_TRUE(fired);
+    EXPECT_EQ(0u, stats.spin_handlers.load());
+    EXPECT_EQ(1u, stats.blocks.load());
+    EXPECT_EQ(1u, stats.handlers.load());
+  }
+
+  // a stop from another thread ends a spinning run
+  TEST(ThreadPolicy, stop)
+  {
+    openvpn_io::io_context io_context;
+    auto work = openvpn_io::make_work_guard(io_context);
+    ThreadPolicy policy;
+    policy.spin_us = 1000;
+    std::thread t([&io_context]() {
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	io_context.stop();
+      });
+    run_io_context(io_context, policy, nullptr);
+    t.join();
+    EXPECT_TRUE(io_context.stopped());
+  }
+
+  TEST(ThreadPolicy, cpu)
+  {
+    ThreadPolicy policy;
+    EXPECT_FALSE(policy.defined());
+    EXPECT_EQ(-1, policy.cpu(3));
+    EXPECT_EQ(0, policy.pin(3));
+    policy.cpus = {0, 1};
+    EXPECT_TRUE(policy.defined());
+    EXPECT_EQ(0, policy.cpu(2));
+    EXPECT_EQ(1, policy.cpu(3));
+#ifdef OPENVPN_PLATFORM_LINUX
+    std::thread t([&policy]() {
+	EXPECT_EQ(0, policy.pin(0));
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+	EXPECT_EQ(1, CPU_COUNT(&set));
+	EXPECT_TRUE(CPU_ISSET(0, &set));
+      });
+    t.join();
+#endif
+  }
+}
@@ -0,0 +1,99 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <vector>
+#include <memory>
+
+#include <openvpn/time/timerwheel.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  // expiry of each timer must be close to, and never before, its deadline
+  TEST(timerwheel, expiry)
+  {
+    TimerWheel::Ptr tw(new TimerWheel());
+    const Time start = Time::now();
+    const Time::Duration tick = Time::Duration::binary_ms(1 << TimerWheel::TICK_SHIFT);
+    const unsigned int delays[] = { 0, 1, 100, 1000, 5000, 40000, 100000, 3000000 };
+    const size_t n = sizeof(delays) / sizeof(delays[0]);
+
+    std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+    std::vector<Time> fired(n, Time::infinite());
+    Time now = start;
+    for (size_t i = 0; i < n; ++i)
+      {
+	timers.emplace_back(new TimerWheel::Timer(tw, [&fired, &now, i]() { fired[i] = now; }));
+	timers.back()->expires_at(start + Time::Duration::milliseconds(delays[i]));
+      }
+    ASSERT_EQ(tw->size(), n);
+
+    // advance in irregular steps until everything has fired
+    const Time end = start + Time::Duration::milliseconds(3000000) + Time::Duration::seconds(1);
+    unsigned int step = 1;
+    while (now < end)
+      {
+	now += Time::Duration::milliseconds(step);
+	step = step * 7 % 997 + 1;
+	tw->advance(now);
+      }
+    ASSERT_EQ(tw->size(), 0u);
+
+    for (size_t i = 0; i < n; ++i)
+      {
+	const Time deadline = start + Time::Duration::milliseconds(delays[i]);
+	ASSERT_FALSE(fired[i].is_infinite()) << "timer " << i;
+	ASSERT_GE(fired[i], deadline) << "timer " << i;
+	ASSERT_LE(fired[i], deadline + tick + Time::Duration::milliseconds(1000)) << "timer " << i;
+      }
+  }
+
+  // callbacks may re-arm and cancel timers, including themselves
+  TEST(timerwheel, rearm_cancel)
+  {
+    TimerWheel::Ptr tw(new TimerWheel());
+    Time now = Time::now();
+    int a_count = 0;
+    int b_count = 0;
+    TimerWheel::Timer b(tw, [&b_count]() { ++b_count; });
+    TimerWheel::Timer a;
+    a.init(tw, [&]() {
+	if (++a_count < 5)
+	  a.expires_at(now + Time::Duration::seconds(1));
+	b.cancel();
+      });
+    a.expires_at(now + Time::Duration::seconds(1));
+    b.expires_at(now + Time::Duration::seconds(2));
+    ASSERT_TRUE(b.pending());
+    for (int i = 0; i < 100; ++i)
+      {
+	now += Time::Duration::milliseconds(100);
+	tw->advance(now);
+      }
+    ASSERT_EQ(a_count, 5);
+    ASSERT_EQ(b_count, 0);
+    ASSERT_FALSE(a.pending());
+    ASSERT_TRUE(tw->next_expiry().is_infinite());
+  }
+}
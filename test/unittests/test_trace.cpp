@@ -0,0 +1,92 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <sstream>
+#include <thread>
+
+#define OPENVPN_TRACE
+#include <openvpn/log/trace.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static size_t count(const std::string& str, const std::string& sub)
+  {
+    size_t n = 0;
+    for (size_t pos = str.find(sub); pos != std::string::npos; pos = str.find(sub, pos + 1))
+      ++n;
+    return n;
+  }
+
+  TEST(trace, rings)
+  {
+    int tag;
+
+    // one ring per thread, each keeps its last RING_SIZE - 1 events
+    std::thread t1([&tag]() {
+      for (unsigned int i = 0; i < 10; ++i)
+	OPENVPN_TRACE_EVENT(KEY_STATE, &tag, 1, i, i + 1);
+    });
+    t1.join();
+    std::thread t2([&tag]() {
+      for (unsigned int i = 0; i < Trace::Ring::RING_SIZE + 100; ++i)
+	OPENVPN_TRACE_EVENT(RETRANSMIT, &tag, 2, i, 0);
+    });
+    t2.join();
+
+    Trace::Record last;
+    size_t n_state = 0, n_retransmit = 0;
+    Trace::Registry::instance().for_each([&](const Trace::Ring& ring) {
+      std::uint64_t ns = 0;
+      for (const auto& r : ring.snapshot())
+	{
+	  if (r.obj != reinterpret_cast<std::uintptr_t>(&tag))
+	    continue;
+	  ASSERT_GE(r.ns, ns);
+	  ns = r.ns;
+	  if (r.type == Trace::KEY_STATE)
+	    {
+	      ASSERT_EQ(r.b, r.a + 1);
+	      ++n_state;
+	    }
+	  else if (r.type == Trace::RETRANSMIT)
+	    {
+	      ++n_retransmit;
+	      last = r;
+	    }
+	}
+    });
+    ASSERT_EQ(n_state, 10u);
+    ASSERT_EQ(n_retransmit, size_t(Trace::Ring::RING_SIZE - 1));
+    ASSERT_EQ(last.a, Trace::Ring::RING_SIZE + 99u);
+    ASSERT_EQ(last.id, 2);
+
+    std::ostringstream os;
+    Trace::dump_chrome(os);
+    const std::string json = os.str();
+    ASSERT_EQ(json.compare(0, 15, "{\"traceEvents\":"), 0);
+    ASSERT_GE(count(json, "\"name\":\"KEY_STATE\""), 10u);
+    ASSERT_GE(count(json, "\"name\":\"RETRANSMIT\""), size_t(Trace::Ring::RING_SIZE - 1));
+  }
+}
@@ -0,0 +1,128 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include "test_common.h"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <openvpn/common/jsonlib.hpp>
+
+#ifdef HAVE_JSON
+
+#include <openvpn/tun/persist/tunpersist.hpp>
+#include <openvpn/tun/persist/tunhandoff.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  namespace {
+    TunBuilderCapture::Ptr make_capture()
+    {
+      TunBuilderCapture::Ptr c(new TunBuilderCapture());
+      c->tun_builder_set_remote_address("192.0.2.1", false);
+      c->tun_builder_add_address("10.8.0.2", 24, "10.8.0.1", false, false);
+      c->tun_builder_add_address("fd00::2", 64, "fd00::1", true, false);
+      c->tun_builder_add_route("172.16.0.0", 12, -1, false);
+      c->tun_builder_add_dns_server("10.8.0.1", false);
+      c->tun_builder_add_search_domain("vpn.example");
+      c->tun_builder_set_mtu(1400);
+      return c;
+    }
+
+    TunProp::State::Ptr make_state()
+    {
+      TunProp::State::Ptr st(new TunProp::State());
+      st->iface_name = "tun7";
+      st->vpn_ip4_addr = IP::Addr("10.8.0.2");
+      st->vpn_ip4_gw = IP::Addr("10.8.0.1");
+      st->vpn_ip6_addr = IP::Addr("fd00::2");
+      return st;
+    }
+  }
+
+  TEST(tunhandoff, send_receive)
+  {
+    int sp[2], pipefd[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sp));
+    ASSERT_EQ(0, ::pipe(pipefd));
+    ScopedFD a(sp[0]), b(sp[1]), pr(pipefd[0]), pw(pipefd[1]);
+
+    const TunBuilderCapture::Ptr capture = make_capture();
+    TunHandoff::send(a(), pw(), *capture, *make_state());
+    TunHandoff::Item item = TunHandoff::receive(b());
+
+    EXPECT_EQ(capture->to_string(), item.capture->to_string());
+    EXPECT_EQ("tun7", item.state->iface_name);
+    EXPECT_EQ("10.8.0.2", item.state->vpn_ip4_addr.to_string());
+    EXPECT_EQ("10.8.0.1", item.state->vpn_ip4_gw.to_string());
+    EXPECT_EQ("fd00::2", item.state->vpn_ip6_addr.to_string());
+    EXPECT_FALSE(item.state->vpn_ip6_gw.defined());
+
+    // the received fd is the same open file
+    ASSERT_TRUE(item.fd.defined());
+    EXPECT_NE(pw(), item.fd());
+    ASSERT_EQ(1, ::write(item.fd(), "x", 1));
+    char c = 0;
+    ASSERT_EQ(1, ::read(pr(), &c, 1));
+    EXPECT_EQ('x', c);
+  }
+
+  TEST(tunhandoff, bad_magic)
+  {
+    int sp[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sp));
+    ScopedFD a(sp[0]), b(sp[1]);
+    const unsigned char junk[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    ASSERT_EQ(8, ::write(a(), junk, sizeof(junk)));
+    EXPECT_THROW(TunHandoff::receive(b()), TunHandoff::tun_handoff_error);
+  }
+
+  // detach() leaves the tun open for the next process, which adopts
+  // it as its persisted tun
+  TEST(tunhandoff, persist_detach_adopt)
+  {
+    typedef TunPersistTemplate<ScopedFD> TunPersist;
+    int pipefd[2];
+    ASSERT_EQ(0, ::pipe(pipefd));
+    ScopedFD pr(pipefd[0]);
+
+    const TunBuilderCapture::Ptr capture = make_capture();
+    TunPersist::Ptr old_tp(new TunPersist(true, false, nullptr));
+    old_tp->adopt(pipefd[1], capture, make_state(), DestructorBase::Ptr());
+    EXPECT_TRUE(old_tp->obj_defined());
+    EXPECT_EQ(capture->to_string(), old_tp->options());
+    EXPECT_EQ("tun7", old_tp->state()->iface_name);
+
+    ScopedFD fd(old_tp->detach());
+    EXPECT_FALSE(old_tp->obj_defined());
+    EXPECT_TRUE(old_tp->options().empty());
+    old_tp.reset();
+    EXPECT_EQ(pipefd[1], fd());
+    EXPECT_NE(-1, ::fcntl(fd(), F_GETFD));
+  }
+}
+
+#endif
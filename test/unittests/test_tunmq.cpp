@@ -0,0 +1,192 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openvpn/asio/asiowork.hpp>
+#include <openvpn/common/argv.hpp>
+#include <openvpn/common/process.hpp>
+#include <openvpn/common/redir.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/tun/linux/server/tunmq.hpp>
+
+using namespace openvpn;
+using namespace openvpn::TunLinuxServer;
+
+namespace unittests
+{
+  class Session : public TunClientInstance::Recv
+  {
+  public:
+    typedef RCPtr<Session> Ptr;
+
+    void stop() override
+    {
+    }
+
+    void tun_recv(BufferAllocated& buf) override
+    {
+      ++n;
+    }
+
+    void push_halt_restart_msg(const HaltRestart::Type type,
+			       const std::string& reason,
+			       const bool tell_client) override
+    {
+    }
+
+    std::atomic<unsigned int> n{0};
+  };
+
+  class TunMQTest : public testing::Test
+  {
+  protected:
+    static void ip(std::vector<std::string> args)
+    {
+      RedirectPipe::InOut pipe;
+      Argv argv;
+      argv.emplace_back("/sbin/ip");
+      for (auto& a : args)
+	argv.emplace_back(std::move(a));
+      system_cmd(argv[0], argv, nullptr, pipe, 0);
+    }
+
+    void SetUp() override
+    {
+      if (geteuid() != 0)
+	GTEST_SKIP() << "Need root to run this test";
+      OptionList opt;
+      opt.parse_from_config("pool 10.222.0.1 255.255.255.0\n", nullptr);
+      opt.update_map();
+      netblock.reset(new VPNServerNetblock(opt, "pool", false, 2));
+    }
+
+    void TearDown() override
+    {
+      ip({ "link", "del", dev });
+    }
+
+    // Send one UDP packet into the tun towards each of dests, and
+    // run both queue threads until n packets have been delivered.
+    void run(const bool steer)
+    {
+      MultiQueue::Config c;
+      c.iface_name = dev;
+      c.n_queues = 2;
+      c.frame = frame_init_simple(2048);
+      c.netblock = netblock.get();
+      c.steer = steer;
+      MultiQueue::Ptr mq = MultiQueue::open(c);
+      ip({ "addr", "add", "10.222.0.1/24", "dev", dev });
+      ip({ "link", "set", dev, "up" });
+
+      openvpn_io::io_context io[2];
+      MultiQueue::Queue* q[2];
+      for (unsigned int i = 0; i < 2; ++i)
+	q[i] = mq->queue(i, io[i]);
+
+      // .10 is in thread 0's partition, .200 in thread 1's
+      Session::Ptr s0(new Session()), s1(new Session());
+      TunClientInstance::Send::Ptr t0 = q[0]->new_obj(s0.get());
+      TunClientInstance::Send::Ptr t1 = q[1]->new_obj(s1.get());
+      t0->add_vpn_addr(IP::Addr("10.222.0.10"));
+      t1->add_vpn_addr(IP::Addr("10.222.0.200"));
+      ASSERT_EQ(0, mq->owner_of(IP::Addr("10.222.0.10")));
+      ASSERT_EQ(1, mq->owner_of(IP::Addr("10.222.0.200")));
+
+      // an address outside the partitions, owned by thread 1
+      t1->add_vpn_addr(IP::Addr("10.222.1.5"));
+      ASSERT_EQ(1, mq->owner_of(IP::Addr("10.222.1.5")));
+
+      // a network behind client 0, with a host inside it behind client 1
+      t0->add_iroute(IP::Route("10.223.0.0/16"));
+      t1->add_iroute(IP::Route("10.223.1.1/32"));
+      ASSERT_EQ(0, mq->owner_of(IP::Addr("10.223.7.7")));
+      ASSERT_EQ(1, mq->owner_of(IP::Addr("10.223.1.1")));
+
+      q[0]->start();
+      q[1]->start();
+
+      std::thread thr([&io]() {
+	  AsioWork work(io[1]);
+	  io[1].run();
+	});
+
+      const int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+      ASSERT_GE(sock, 0);
+      for (int i = 0; i < 20; ++i)
+	{
+	  for (const char* dest : { "10.222.0.10", "10.222.0.200" })
+	    {
+	      struct sockaddr_in sa = {};
+	      sa.sin_family = AF_INET;
+	      sa.sin_port = htons(uint16_t(4000 + i));
+	      ::inet_pton(AF_INET, dest, &sa.sin_addr);
+	      ::sendto(sock, "x", 1, 0, (struct sockaddr *)&sa, sizeof(sa));
+	    }
+	}
+      ::close(sock);
+
+      const Time until = Time::now() + Time::Duration::seconds(5);
+      while ((s0->n.load() < 20 || s1->n.load() < 20) && Time::now() < until)
+	io[0].run_for(std::chrono::milliseconds(10));
+
+      io[1].stop();
+      thr.join();
+      io[0].poll();
+
+      EXPECT_EQ(20u, s0->n.load());
+      EXPECT_EQ(20u, s1->n.load());
+      if (steer && mq->steering())
+	{
+	  EXPECT_EQ(0u, mq->n_handoff());
+	}
+
+      t0->stop();
+      t1->stop();
+      q[0]->stop();
+      q[1]->stop();
+      ASSERT_EQ(-1, mq->owner_of(IP::Addr("10.222.1.5")));
+      ASSERT_EQ(-1, mq->owner_of(IP::Addr("10.223.7.7")));
+    }
+
+    const std::string dev = "ovpnmqtest0";
+    std::unique_ptr<VPNServerNetblock> netblock;
+  };
+
+  TEST_F(TunMQTest, steered)
+  {
+    run(true);
+  }
+
+  TEST_F(TunMQTest, handoff)
+  {
+    run(false);
+  }
+}
@@ -0,0 +1,146 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <openvpn/common/bigmutex.hpp>
+#include <openvpn/transport/udplink.hpp>
+#include <openvpn/transport/client/udpcli.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+#ifdef OPENVPN_UDPLINK_MMSG
+  struct CountReceiver
+  {
+    void udp_read_handler(UDPTransport::PacketFrom::SPtr& pfp) { ++n; }
+    void udp_read_burst_begin() {}
+    void udp_read_burst_end() {}
+
+    size_t n = 0;
+  };
+
+  // a burst that overflows a small receive buffer is counted, and
+  // grows the buffer
+  TEST(udpbuf, recv_autotune)
+  {
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::udp::socket sock(io_context);
+    sock.open(openvpn_io::ip::udp::v4());
+    sock.bind(openvpn_io::ip::udp::endpoint(openvpn_io::ip::address_v4::loopback(), 0));
+    sock.set_option(openvpn_io::socket_base::receive_buffer_size(8192));
+    const UDPTransport::AsioEndpoint self = sock.local_endpoint();
+
+    openvpn_io::ip::udp::socket peer(io_context);
+    peer.open(openvpn_io::ip::udp::v4());
+
+    CountReceiver recv;
+    SessionStats::Ptr stats(new SessionStats());
+    Frame::Context fc(128, 2048, 128, 0, 16, 0);
+    UDPTransport::Link<CountReceiver*>::Ptr link(new UDPTransport::Link<CountReceiver*>(&recv, sock, fc, stats));
+    link->enable_buffer_autotune(1 << 20);
+    const int size = link->recv_buffer_size();
+
+    const std::string data(1000, 'x');
+    const int n_sent = 200;
+    for (int i = 0; i < n_sent; ++i)
+      peer.send_to(openvpn_io::buffer(data), self);
+
+    // drop counts come with the first packet after the drops
+    link->start(1, 16);
+    io_context.run_for(std::chrono::milliseconds(20));
+    ASSERT_LT(recv.n, size_t(n_sent));
+    peer.send_to(openvpn_io::buffer(data), self);
+    for (int i = 0; i < 100 && recv.n + stats->get_stat(SessionStats::SOCKET_RECV_DROPS) < n_sent + 1; ++i)
+      io_context.run_for(std::chrono::milliseconds(10));
+    link->stop();
+
+    EXPECT_EQ(size_t(n_sent + 1), recv.n + stats->get_stat(SessionStats::SOCKET_RECV_DROPS));
+    EXPECT_GT(link->recv_buffer_size(), size);
+  }
+
+  // counting only
+  TEST(udpbuf, recv_count)
+  {
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::udp::socket sock(io_context);
+    sock.open(openvpn_io::ip::udp::v4());
+    sock.bind(openvpn_io::ip::udp::endpoint(openvpn_io::ip::address_v4::loopback(), 0));
+    sock.set_option(openvpn_io::socket_base::receive_buffer_size(8192));
+    const UDPTransport::AsioEndpoint self = sock.local_endpoint();
+
+    CountReceiver recv;
+    SessionStats::Ptr stats(new SessionStats());
+    Frame::Context fc(128, 2048, 128, 0, 16, 0);
+    UDPTransport::Link<CountReceiver*>::Ptr link(new UDPTransport::Link<CountReceiver*>(&recv, sock, fc, stats));
+    link->enable_buffer_autotune(0);
+    const int size = link->recv_buffer_size();
+
+    const unsigned char data[1000] = {};
+    const Buffer buf(const_cast<unsigned char *>(data), sizeof(data), true);
+    for (int i = 0; i < 100; ++i)
+      link->send(buf, &self);
+    link->start(1, 16);
+    io_context.run_for(std::chrono::milliseconds(20));
+    link->send(buf, &self);
+    for (int i = 0; i < 100 && recv.n + stats->get_stat(SessionStats::SOCKET_RECV_DROPS) < 101; ++i)
+      io_context.run_for(std::chrono::milliseconds(10));
+    link->stop();
+
+    EXPECT_GT(stats->get_stat(SessionStats::SOCKET_RECV_DROPS), 0);
+    EXPECT_EQ(101u, recv.n + stats->get_stat(SessionStats::SOCKET_RECV_DROPS));
+    EXPECT_EQ(size, link->recv_buffer_size());
+  }
+#endif
+
+  TEST(udpbuf, client_batch_options)
+  {
+    UDPTransport::ClientConfig::Batching batching;
+    OptionList none;
+    none.parse_from_config("dev tun\n", nullptr);
+    none.update_map();
+    batching.load(none);
+    EXPECT_EQ(16u, batching.recv_batch);
+    EXPECT_EQ(0u, batching.send_batch);
+    EXPECT_FALSE(batching.send_gso);
+
+    OptionList opt;
+    opt.parse_from_config("udp-recv-batch 8\nudp-send-batch 32\nudp-gso\n", nullptr);
+    opt.update_map();
+    batching.load(opt);
+    EXPECT_EQ(8u, batching.recv_batch);
+    EXPECT_EQ(32u, batching.send_batch);
+    EXPECT_TRUE(batching.send_gso);
+
+    UDPTransport::ClientConfig::Ptr udpconf = UDPTransport::ClientConfig::new_obj();
+    udpconf->set_batching(batching);
+    EXPECT_EQ(8u, udpconf->recv_batch);
+    EXPECT_EQ(32u, udpconf->send_batch);
+    EXPECT_TRUE(udpconf->send_gso);
+
+    OptionList bad;
+    bad.parse_from_config("udp-send-batch 4096\n", nullptr);
+    bad.update_map();
+    EXPECT_THROW(batching.load(bad), option_error);
+  }
+}
@@ -0,0 +1,255 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <mutex>
+#include <chrono>
+
+#include <openvpn/transport/server/udpshard.hpp>
+
+using namespace openvpn;
+using namespace openvpn::UDPTransport;
+
+namespace unittests
+{
+  namespace
+  {
+    // (shard, peer ID) of each P_DATA_V2 packet received
+    struct Received
+    {
+      size_t size()
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	return packets.size();
+      }
+
+      std::mutex mutex;
+      std::vector<std::pair<unsigned int, int>> packets;
+    };
+
+    class TestShardServer : public TransportServer
+    {
+    public:
+      TestShardServer(openvpn_io::ip::udp::socket&& socket_arg,
+		      const unsigned int shard_arg,
+		      Received& received_arg)
+	: socket(std::move(socket_arg)),
+	  shard(shard_arg),
+	  received(received_arg)
+      {
+      }
+
+      void start() override
+      {
+	queue_read();
+      }
+
+      void stop() override
+      {
+	socket.close();
+      }
+
+      std::string local_endpoint_info() const override
+      {
+	return "UDP " + socket.local_endpoint().address().to_string();
+      }
+
+      IP::Addr local_endpoint_addr() const override
+      {
+	return IP::Addr::from_asio(socket.local_endpoint().address());
+      }
+
+    private:
+      void queue_read()
+      {
+	socket.async_receive(openvpn_io::buffer(buf, sizeof(buf)),
+			     [self=Ptr(this)](const openvpn_io::error_code& error, const size_t n)
+			     {
+			       if (error)
+				 return;
+			       TestShardServer* s = static_cast<TestShardServer*>(self.get());
+			       if (n >= 4)
+				 {
+				   const int peer_id = (s->buf[1] << 16) | (s->buf[2] << 8) | s->buf[3];
+				   std::lock_guard<std::mutex> lock(s->received.mutex);
+				   s->received.packets.emplace_back(s->shard, peer_id);
+				 }
+			       s->queue_read();
+			     });
+      }
+
+      openvpn_io::ip::udp::socket socket;
+      const unsigned int shard;
+      Received& received;
+      unsigned char buf[256];
+    };
+
+    struct TestShardFactory : public ShardServerFactory
+    {
+      TransportServer::Ptr new_shard_server(openvpn_io::io_context& io_context,
+					    openvpn_io::ip::udp::socket&& socket,
+					    const unsigned int shard,
+					    const unsigned int n_shards,
+					    const ShardBalancer::Ptr& balancer,
+					    XDPProgram* xdp) override
+      {
+	return new TestShardServer(std::move(socket), shard, received);
+      }
+
+      Received received;
+    };
+
+    unsigned short free_udp_port(openvpn_io::io_context& io_context)
+    {
+      openvpn_io::ip::udp::socket s(io_context, openvpn_io::ip::udp::endpoint(openvpn_io::ip::address_v4::loopback(), 0));
+      return s.local_endpoint().port();
+    }
+  }
+
+  TEST(udpshard, load_options)
+  {
+    OptionList opt;
+    opt.parse_from_config("udp-shards 4\nudp-shard-balance 250\nudp-shard-numa\n", nullptr);
+    opt.update_map();
+    ASSERT_TRUE(ShardedServerConfig::enabled(opt));
+    ShardedServerConfig::Ptr conf = ShardedServerConfig::new_obj();
+    conf->load(opt);
+    EXPECT_EQ(4u, conf->n_shards);
+    EXPECT_TRUE(conf->balance);
+    EXPECT_EQ(250u, conf->balance_interval_ms);
+    EXPECT_TRUE(conf->numa);
+    EXPECT_TRUE(conf->steer_peer_id);
+    EXPECT_TRUE(conf->xdp_ifname.empty());
+
+    OptionList plain;
+    plain.parse_from_config("udp-shards 2\nudp-shard-no-steer\nudp-shard-xdp eth0\n", nullptr);
+    plain.update_map();
+    conf = ShardedServerConfig::new_obj();
+    conf->load(plain);
+    EXPECT_EQ(2u, conf->n_shards);
+    EXPECT_FALSE(conf->balance);
+    EXPECT_FALSE(conf->numa);
+    EXPECT_FALSE(conf->steer_peer_id);
+    EXPECT_EQ("eth0", conf->xdp_ifname);
+
+    OptionList none;
+    none.parse_from_config("dev tun\n", nullptr);
+    none.update_map();
+    EXPECT_FALSE(ShardedServerConfig::enabled(none));
+
+    OptionList bad;
+    bad.parse_from_config("udp-shards 0\n", nullptr);
+    bad.update_map();
+    conf = ShardedServerConfig::new_obj();
+    EXPECT_THROW(conf->load(bad), option_error);
+  }
+
+#ifdef OPENVPN_UDPSHARD_CBPF
+  // P_DATA_V2 packets arrive on shard (peer_id % n_shards)
+  TEST(udpshard, steer_peer_id)
+  {
+    enum {
+      N_SHARDS = 4,
+      N_PACKETS = 16,
+    };
+
+    openvpn_io::io_context io_context(1);
+    OptionList opt;
+    opt.parse_from_config("udp-shards 4\n", nullptr);
+    opt.update_map();
+
+    ShardedServerConfig::Ptr conf = ShardedServerConfig::new_obj();
+    conf->load(opt);
+    conf->local_addr = IP::Addr("127.0.0.1");
+    conf->local_port = free_udp_port(io_context);
+    RCPtr<TestShardFactory> factory(new TestShardFactory);
+    conf->shard_factory = factory;
+
+    TransportServer::Ptr server = conf->new_server_obj(io_context);
+    server->start();
+
+    openvpn_io::ip::udp::socket client(io_context, openvpn_io::ip::udp::v4());
+    const openvpn_io::ip::udp::endpoint dest(openvpn_io::ip::address_v4::loopback(), conf->local_port);
+    for (int peer_id = 0; peer_id < N_PACKETS; ++peer_id)
+      {
+	const unsigned char pkt[] = {
+	  9 << 3, // P_DATA_V2, key ID 0
+	  (unsigned char)(peer_id >> 16),
+	  (unsigned char)(peer_id >> 8),
+	  (unsigned char)peer_id,
+	  0, 0, 0, 0,
+	};
+	client.send_to(openvpn_io::buffer(pkt, sizeof(pkt)), dest);
+      }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (factory->received.size() < N_PACKETS && std::chrono::steady_clock::now() < deadline)
+      io_context.run_for(std::chrono::milliseconds(10));
+    server->stop();
+
+    ASSERT_EQ(size_t(N_PACKETS), factory->received.packets.size());
+    for (const auto& p : factory->received.packets)
+      EXPECT_EQ(ShardPeerID::shard_of(p.second, N_SHARDS), p.first) << "peer ID " << p.second;
+  }
+#endif
+
+#ifdef OPENVPN_XDPLINK
+  // a route is only usable once the packet it came with is validated
+  TEST(udpshard, xdp_route_learn)
+  {
+    XDPRouteTable table(2);
+    const AsioEndpoint a(openvpn_io::ip::address_v4::loopback(), 1001);
+    const AsioEndpoint b(openvpn_io::ip::address_v4::loopback(), 1002);
+    const AsioEndpoint c(openvpn_io::ip::address_v4::loopback(), 1003);
+    XDPRoute route = {};
+    route.peer_mac[0] = 1;
+
+    // unvalidated packets don't install a route
+    table.stage(a, route);
+    EXPECT_EQ(nullptr, table.find(a));
+    table.clear_staged();
+    EXPECT_FALSE(table.learn(a));
+    EXPECT_EQ(0u, table.size());
+
+    table.stage(a, route);
+    ASSERT_TRUE(table.learn(a));
+    ASSERT_NE(nullptr, table.find(a));
+    EXPECT_EQ(1, table.find(a)->peer_mac[0]);
+
+    // a full table evicts the least recently learned peer only
+    table.stage(b, route);
+    table.stage(c, route);
+    ASSERT_TRUE(table.learn(b));
+    ASSERT_TRUE(table.learn(a));
+    ASSERT_TRUE(table.learn(c));
+    EXPECT_EQ(2u, table.size());
+    EXPECT_NE(nullptr, table.find(a));
+    EXPECT_EQ(nullptr, table.find(b));
+    EXPECT_NE(nullptr, table.find(c));
+
+    table.forget(a);
+    EXPECT_EQ(nullptr, table.find(a));
+    EXPECT_EQ(1u, table.size());
+  }
+#endif
+}
@@ -0,0 +1,144 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "test_common.h"
+
+#include <string>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/transport/uringlink.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+#ifdef OPENVPN_UDPLINK_URING
+  namespace {
+    struct Handler
+    {
+      typedef UDPTransport::UringLink<Handler*> LinkImpl;
+
+      void udp_read_handler(UDPTransport::PacketFrom::SPtr& pfp)
+      {
+	received.push_back(buf_to_string(pfp->buf));
+	from = pfp->sender_endpoint;
+      }
+
+      void udp_read_burst_begin()
+      {
+	++bursts;
+      }
+
+      void udp_read_burst_end()
+      {
+      }
+
+      std::vector<std::string> received;
+      UDPTransport::AsioEndpoint from;
+      int bursts = 0;
+    };
+  }
+
+  // A setup that fails part way through, here for want of a file
+  // descriptor for the eventfd once the ring has been created, must
+  // leave nothing for stop() to wait on.
+  TEST(UringLink, setup_failure)
+  {
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::udp::socket sock(io_context, openvpn_io::ip::udp::endpoint(openvpn_io::ip::make_address("127.0.0.1"), 0));
+    Frame::Ptr frame = frame_init_simple(2048);
+    SessionStats::Ptr stats(new SessionStats());
+    Handler h;
+    Handler::LinkImpl::Ptr link(new Handler::LinkImpl(&h, sock, (*frame)[Frame::READ_LINK_UDP], stats));
+
+    struct rlimit saved;
+    ASSERT_EQ(0, ::getrlimit(RLIMIT_NOFILE, &saved));
+    const int next_fd = ::dup(0);
+    ASSERT_GE(next_fd, 0);
+    ::close(next_fd);
+    struct rlimit lim = saved;
+    lim.rlim_cur = next_fd + 1; // room for the ring fd only
+    ASSERT_EQ(0, ::setrlimit(RLIMIT_NOFILE, &lim));
+    bool threw = false;
+    try {
+      link->start();
+    }
+    catch (const UDPTransport::udp_uring_error&)
+      {
+	threw = true;
+      }
+    ::setrlimit(RLIMIT_NOFILE, &saved);
+    ASSERT_TRUE(threw);
+
+    link->stop();
+    link.reset();
+    io_context.run();
+  }
+
+  TEST(UringLink, loopback)
+  {
+    openvpn_io::io_context io_context;
+    const openvpn_io::ip::udp::endpoint lo(openvpn_io::ip::make_address("127.0.0.1"), 0);
+    openvpn_io::ip::udp::socket sock(io_context, lo);
+    openvpn_io::ip::udp::socket peer(io_context, lo);
+    Frame::Ptr frame = frame_init_simple(2048);
+    SessionStats::Ptr stats(new SessionStats());
+    Handler h;
+    Handler::LinkImpl::Ptr link(new Handler::LinkImpl(&h, sock, (*frame)[Frame::READ_LINK_UDP], stats));
+    try {
+      link->start(4);
+    }
+    catch (const UDPTransport::udp_uring_error& e)
+      {
+	link->stop();
+	GTEST_SKIP() << "io_uring not available: " << e.what();
+      }
+
+    for (int i = 0; i < 6; ++i) // more than the receive buffers
+      peer.send_to(openvpn_io::buffer("packet" + std::to_string(i)), sock.local_endpoint());
+    for (int i = 0; i < 200 && h.received.size() < 6; ++i)
+      io_context.run_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(6u, h.received.size());
+    for (int i = 0; i < 6; ++i)
+      ASSERT_EQ("packet" + std::to_string(i), h.received[i]);
+    ASSERT_EQ(peer.local_endpoint(), h.from);
+    ASSERT_EQ(6u, stats->get_stat(SessionStats::PACKETS_IN));
+
+    const std::string reply("reply");
+    BufferAllocated buf(reply.size(), 0);
+    buf_append_string(buf, reply);
+    ASSERT_EQ(0, link->send(buf, &h.from));
+    for (int i = 0; i < 200 && !peer.available(); ++i)
+      io_context.run_for(std::chrono::milliseconds(10));
+    ASSERT_NE(0u, peer.available());
+    char rbuf[64];
+    const size_t n = peer.receive(openvpn_io::buffer(rbuf));
+    ASSERT_EQ(reply, std::string(rbuf, n));
+
+    link->stop();
+  }
+#endif
+}
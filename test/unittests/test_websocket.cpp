@@ -0,0 +1,244 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2019 OpenVPN Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#include "test_common.h"
+
+#include <thread>
+#include <vector>
+#include <string>
+
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/crypto/digestapi.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/ws/websocket.hpp>
+#include <openvpn/transport/client/wscli.hpp>
+
+using namespace openvpn;
+
+namespace unittests
+{
+  static DigestFactory::Ptr digest_factory()
+  {
+    return new CryptoDigestFactory<SSLLib::CryptoAPI>();
+  }
+
+  TEST(websocket, mask_matches_bytewise)
+  {
+    const WebSocket::Protocol::MaskingKey mk(0x1b2c3d4e);
+    const std::uint8_t* m8 = reinterpret_cast<const std::uint8_t*>(&mk);
+    std::uint8_t storage[128];
+    for (size_t off = 0; off < 8; ++off)
+      for (size_t len = 0; len <= 100; ++len)
+	{
+	  for (size_t i = 0; i < sizeof(storage); ++i)
+	    storage[i] = std::uint8_t(i * 7 + 3);
+	  Buffer buf(storage + off, len, true);
+	  mk.xor_buf(buf);
+	  for (size_t i = 0; i < sizeof(storage); ++i)
+	    {
+	      const std::uint8_t orig = std::uint8_t(i * 7 + 3);
+	      if (i >= off && i < off + len)
+		ASSERT_EQ(std::uint8_t(orig ^ m8[(i - off) & 3]), storage[i]) << off << '/' << len << '/' << i;
+	      else
+		ASSERT_EQ(orig, storage[i]) << off << '/' << len << '/' << i;
+	    }
+	}
+  }
+
+  TEST(websocket, frame_roundtrip)
+  {
+    RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+    const WebSocket::Sender sender(rng);
+    WebSocket::Receiver receiver(false);
+    for (const size_t len : { 0, 1, 125, 126, 1000, 65535, 65536 })
+      {
+	const std::string payload(len, char('a' + len % 26));
+	BufferAllocated buf(len + WebSocket::Protocol::MAX_HEAD, 0);
+	buf.init_headroom(WebSocket::Protocol::MAX_HEAD);
+	buf_write_string(buf, payload);
+	sender.frame(buf, WebSocket::Status(WebSocket::Protocol::Binary));
+	receiver.add_buf(std::move(buf));
+	ASSERT_TRUE(receiver.complete());
+	ASSERT_EQ(WebSocket::Protocol::Binary, receiver.status().opcode());
+	ASSERT_EQ(payload, buf_to_string(receiver.buf_unframed()));
+	receiver.reset();
+      }
+  }
+
+  // server side of the transport test: blocking, in its own thread
+  class WSServer
+  {
+  public:
+    WSServer()
+      : acceptor(io_context, openvpn_io::ip::tcp::endpoint(openvpn_io::ip::make_address("127.0.0.1"), 0)),
+	socket(io_context),
+	receiver(false),
+	sender(RandomAPI::Ptr())
+    {
+    }
+
+    unsigned short port() const
+    {
+      return acceptor.local_endpoint().port();
+    }
+
+    void run()
+    {
+      acceptor.accept(socket);
+
+      // upgrade request
+      std::string req;
+      char c;
+      while (req.find("\r\n\r\n") == std::string::npos)
+	{
+	  openvpn_io::read(socket, openvpn_io::buffer(&c, 1));
+	  req += c;
+	}
+      request = req;
+      const std::string kh = "Sec-WebSocket-Key: ";
+      const size_t k = req.find(kh) + kh.length();
+      const std::string key = req.substr(k, req.find("\r\n", k) - k);
+
+      // reply, followed in the same write by a ping and a packet
+      std::string reply = "HTTP/1.1 101 Switching Protocols\r\n"
+	"Upgrade: websocket\r\n"
+	"Connection: Upgrade\r\n"
+	"Sec-WebSocket-Accept: " + WebSocket::accept_confirmation(*digest_factory(), key) + "\r\n"
+	"\r\n";
+      reply += frame("ping-data", WebSocket::Protocol::Ping);
+      reply += frame("hello", WebSocket::Protocol::Binary);
+      openvpn_io::write(socket, openvpn_io::buffer(reply));
+
+      // pong, then the packets the client sends back
+      while (messages.size() < 3)
+	{
+	  BufferAllocated buf(4096, 0);
+	  buf.set_size(socket.read_some(openvpn_io::buffer(buf.data(), buf.max_size())));
+	  receiver.add_buf(std::move(buf));
+	  while (receiver.complete())
+	    {
+	      messages.push_back(WebSocket::Protocol::opcode_to_string(receiver.status().opcode()) + ':'
+				 + buf_to_string(receiver.buf_unframed()));
+	      receiver.reset();
+	    }
+	}
+
+      openvpn_io::write(socket, openvpn_io::buffer(frame("", WebSocket::Protocol::Close)));
+    }
+
+    std::string request;
+    std::vector<std::string> messages;
+
+  private:
+    std::string frame(const std::string& payload, const unsigned int opcode)
+    {
+      BufferAllocated buf(payload.length() + 32, 0);
+      buf.init_headroom(32);
+      buf_write_string(buf, payload);
+      sender.frame(buf, WebSocket::Status(opcode, true, 1000));
+      return buf_to_string(buf);
+    }
+
+    openvpn_io::io_context io_context;
+    openvpn_io::ip::tcp::acceptor acceptor;
+    openvpn_io::ip::tcp::socket socket;
+    WebSocket::Receiver receiver;
+    WebSocket::Sender sender;
+  };
+
+  class WSParent : public TransportClientParent
+  {
+  public:
+    void transport_recv(BufferAllocated& buf) override
+    {
+      received.push_back(buf_to_string(buf));
+
+      // echo a large packet in place, then a const one that gets copied
+      BufferAllocated big;
+      frame->prepare(Frame::WRITE_DC_MSG, big);
+      buf_write_string(big, std::string(1000, 'x'));
+      client->transport_send(big);
+      client->transport_send_const(Buffer(buf.data(), buf.size(), true));
+    }
+
+    void transport_error(const Error::Type fatal_err, const std::string& err_text) override
+    {
+      error = err_text;
+      client->stop();
+    }
+
+    void transport_connecting() override { connected = true; }
+    void transport_needs_send() override {}
+    void proxy_error(const Error::Type fatal_err, const std::string& err_text) override {}
+    bool transport_is_openvpn_protocol() override { return true; }
+    void transport_pre_resolve() override {}
+    void transport_wait_proxy() override {}
+    void transport_wait() override {}
+    bool is_keepalive_enabled() const override { return false; }
+    void disable_keepalive(unsigned int& keepalive_ping,
+			   unsigned int& keepalive_timeout) override {}
+
+    Frame::Ptr frame;
+    TransportClient::Ptr client;
+    bool connected = false;
+    std::vector<std::string> received;
+    std::string error;
+  };
+
+  TEST(websocket, transport_client)
+  {
+    base64_init_static();
+    WSServer server;
+    std::thread server_thread([&server]() { server.run(); });
+
+    WebSocket::Client::Config::Ptr wsconf(new WebSocket::Client::Config());
+    wsconf->rng.reset(new SSLLib::RandomAPI(false));
+    wsconf->digest_factory = digest_factory();
+    wsconf->protocol = "openvpn";
+
+    WSTransport::ClientConfig::Ptr config = WSTransport::ClientConfig::new_obj();
+    config->remote_list.reset(new RemoteList("127.0.0.1", std::to_string(server.port()), Protocol(Protocol::TCPv4), "test"));
+    config->frame = frame_init(true, 1500, 1024, false);
+    config->stats.reset(new SessionStats());
+    config->websocket = wsconf;
+    config->uri = "/vpn";
+
+    openvpn_io::io_context io_context;
+    WSParent parent;
+    parent.frame = config->frame;
+    parent.client = config->new_transport_client_obj(io_context, &parent);
+    parent.client->transport_start();
+    io_context.run();
+    server_thread.join();
+
+    ASSERT_EQ(0u, server.request.find("GET /vpn HTTP/1.1\r\n"));
+    ASSERT_NE(std::string::npos, server.request.find("Sec-WebSocket-Protocol: openvpn\r\n"));
+    ASSERT_TRUE(parent.connected);
+    ASSERT_EQ(std::vector<std::string>{"hello"}, parent.received);
+    ASSERT_EQ(3u, server.messages.size());
+    ASSERT_EQ("Pong:ping-data", server.messages[0]);
+    ASSERT_EQ("Binary:" + std::string(1000, 'x'), server.messages[1]);
+    ASSERT_EQ("Binary:hello", server.messages[2]);
+    ASSERT_NE(std::string::npos, parent.error.find("status=1000")) << parent.error;
+    ASSERT_EQ(1u, config->stats->get_stat(SessionStats::PACKETS_IN));
+    parent.client.reset();
+  }
+}